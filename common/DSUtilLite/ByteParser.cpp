@@ -22,25 +22,72 @@
 #include "stdafx.h"
 #include "ByteParser.h"
 
-#pragma warning( push )
-#pragma warning( disable : 4101 )
-#pragma warning( disable : 4244 )
 extern "C" {
-#define AVCODEC_X86_MATHOPS_H
-#include "libavcodec/get_bits.h"
+#include "libavutil/common.h"
+#include "libavutil/intreadwrite.h"
 };
-#pragma warning( pop )
 
 CByteParser::CByteParser(const BYTE *pData, size_t length)
-  : m_pData(pData), m_pEnd(pData+length)
+  : m_pData(pData), m_pEnd(pData+length), m_pNext(pData)
 {
-  m_gbCtx = (GetBitContext *)av_mallocz(sizeof(GetBitContext));
-  init_get_bits8(m_gbCtx, pData, (int)length);
+  Refill();
 }
 
 CByteParser::~CByteParser()
 {
-  av_freep(&m_gbCtx);
+}
+
+// Fill the cache up to at least 32 valid bits
+// Once the end of the array is reached, the cache is considered full, and only zeros are shifted in.
+void CByteParser::Refill()
+{
+  if (m_nCacheBits >= 32)
+    return;
+
+  if (m_pEnd - m_pNext >= 8) {
+    // Load 8 bytes at once, but only count the whole bytes that fit.
+    // The excess bits belong to the next byte, and are loaded again identically on the next refill.
+    m_Cache |= AV_RB64(m_pNext) >> m_nCacheBits;
+    const unsigned nBytes = (63 - m_nCacheBits) >> 3;
+    m_pNext += nBytes;
+    m_nCacheBits += nBytes << 3;
+  } else {
+    while (m_nCacheBits <= 56 && m_pNext < m_pEnd) {
+      m_Cache |= (uint64_t)*m_pNext++ << (56 - m_nCacheBits);
+      m_nCacheBits += 8;
+    }
+    if (m_pNext == m_pEnd)
+      m_nCacheBits = 64;
+  }
+}
+
+void CByteParser::Consume(unsigned int numBits)
+{
+  ASSERT(numBits < 64 && numBits <= m_nCacheBits);
+  m_Cache <<= numBits;
+  m_nCacheBits -= numBits;
+  m_nBitPos += numBits;
+}
+
+void CByteParser::Seek(size_t nBitPos)
+{
+  m_Cache = 0;
+  m_nCacheBits = 0;
+  m_nBitPos = nBitPos;
+
+  const size_t nByte = nBitPos >> 3;
+  if (nByte >= (size_t)(m_pEnd - m_pData)) {
+    m_pNext = m_pEnd;
+    m_nCacheBits = 64;
+    return;
+  }
+
+  m_pNext = m_pData + nByte;
+  Refill();
+
+  const unsigned nBits = nBitPos & 7;
+  m_Cache <<= nBits;
+  m_nCacheBits -= nBits;
 }
 
 unsigned int CByteParser::BitRead(unsigned int numBits, bool peek)
@@ -48,10 +95,14 @@ unsigned int CByteParser::BitRead(unsigned int numBits, bool peek)
   if (numBits == 0)
     return 0;
 
-  if (peek)
-    return show_bits_long(m_gbCtx, numBits);
-  else
-    return get_bits_long(m_gbCtx, numBits);
+  ASSERT(numBits <= 32);
+
+  Refill();
+  const unsigned int value = (unsigned int)(m_Cache >> (64 - numBits));
+  if (!peek)
+    Consume(numBits);
+
+  return value;
 }
 
 void CByteParser::BitSkip(unsigned int numBits)
@@ -59,15 +110,18 @@ void CByteParser::BitSkip(unsigned int numBits)
   if (numBits == 0)
     return;
 
-  skip_bits_long(m_gbCtx, numBits);
+  if (numBits < m_nCacheBits)
+    Consume(numBits);
+  else
+    Seek(m_nBitPos + numBits);
 }
 
 size_t CByteParser::RemainingBits() const
 {
-  int bits = get_bits_left(m_gbCtx);
-  if (bits < 0)
+  const size_t nTotalBits = (size_t)(m_pEnd - m_pData) << 3;
+  if (m_nBitPos >= nTotalBits)
     return 0;
-  return (size_t)bits;
+  return nTotalBits - m_nBitPos;
 }
 
 size_t CByteParser::Pos() const
@@ -81,13 +135,27 @@ size_t CByteParser::Pos() const
 
 unsigned CByteParser::UExpGolombRead()
 {
+  // Codes of up to 31 bits are read straight from the cache
+  Refill();
+  const uint32_t top = (uint32_t)(m_Cache >> 32);
+  if (top >= 0x10000) {
+    const unsigned nZeros = 31 - av_log2(top);
+    if (RemainingBits() > nZeros + 1) {
+      const unsigned nLength = 2 * nZeros + 1;
+      const unsigned value = (top >> (32 - nLength)) - 1;
+      Consume(nLength);
+      return value;
+    }
+  }
+
   int n = -1;
   for(BYTE b = 0; !b && RemainingBits(); n++) {
-    b = get_bits1(m_gbCtx);
+    b = BitRead(1);
   }
-  if (!RemainingBits())
+  // codes longer than 32 bits are invalid
+  if (!RemainingBits() || n >= 32)
     return 0;
-  return ((1 << n) | BitRead(n)) - 1;
+  return ((1u << n) | BitRead(n)) - 1;
 }
 
 int CByteParser::SExpGolombRead()
@@ -106,5 +174,9 @@ int CByteParser::SExpGolombRead()
 
 void CByteParser::BitByteAlign()
 {
-  align_get_bits(m_gbCtx);
+  const unsigned nBits = (8 - (m_nBitPos & 7)) & 7;
+  if (nBits) {
+    Refill();
+    Consume(nBits);
+  }
 }
\ No newline at end of file
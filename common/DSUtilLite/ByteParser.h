@@ -21,10 +21,10 @@
 
 #pragma once
 
-struct GetBitContext;
-
 /**
 * Byte Parser Utility Class
+* Bits are read through a 64-bit cache, which is refilled with up to 8 bytes at once.
+* Reading past the end of the array returns zero bits.
 */
 class CByteParser
 {
@@ -63,8 +63,16 @@ public:
   void BitByteAlign();
 
 private:
-  GetBitContext *m_gbCtx = nullptr;
+  void Refill();
+  void Consume(unsigned int numBits);
+  void Seek(size_t nBitPos);
 
+private:
   const BYTE *m_pData    = nullptr;
   const BYTE *m_pEnd     = nullptr;
+
+  const BYTE *m_pNext    = nullptr;   // next byte to be loaded into the cache
+  uint64_t   m_Cache     = 0;         // the next bit to be read is the MSB
+  unsigned   m_nCacheBits = 0;        // number of valid bits in the cache
+  size_t     m_nBitPos   = 0;         // position of the next bit to be read
 };
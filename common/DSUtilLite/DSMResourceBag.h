@@ -12,7 +12,11 @@ public:
   CDSMResource();
   CDSMResource(LPCWSTR name, LPCWSTR desc, LPCWSTR mime, BYTE* pData, int len, DWORD_PTR tag = 0);
 
+  CDSMResource(const CDSMResource& r) = default;
+  CDSMResource(CDSMResource&& r) = default;
+
   CDSMResource& operator=(const CDSMResource& r);
+  CDSMResource& operator=(CDSMResource&& r) = default;
 
 public:
   DWORD_PTR tag;
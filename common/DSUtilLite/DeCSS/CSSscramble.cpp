@@ -117,30 +117,89 @@ unsigned char CSStab5[256]= {
 	0xf0,0x70,0xb0,0x30,0xd0,0x50,0x90,0x10,0xe0,0x60,0xa0,0x20,0xc0,0x40,0x80,0x00
 };
 
+#define CSS_SECTOR_SIZE 0x800
+#define CSS_SCRAMBLED_OFFSET 0x80
+#define CSS_SCRAMBLED_SIZE (CSS_SECTOR_SIZE-CSS_SCRAMBLED_OFFSET)
+#define CSS_BATCH 4
+
+// Generate the keystream of up to CSS_BATCH sectors
+// The LFSRs of the sectors are independent, running them in lockstep lets their dependency chains overlap.
+static void CSSkeystream(unsigned char **secs,int n,unsigned char *tkey,unsigned char ks[][CSS_SCRAMBLED_SIZE])
+{
+	unsigned int t1[CSS_BATCH],t2[CSS_BATCH],t3[CSS_BATCH],t5[CSS_BATCH];
+	unsigned int t4,t6;
+	int i,j;
+
+	for(j=0; j<n; j++) {
+		unsigned char *sec=secs[j];
+		t1[j]=tkey[0]^sec[0x54]|0x100;
+		t2[j]=tkey[1]^sec[0x55];
+		t3[j]=(*((unsigned int *)(tkey+2)))^(*((unsigned int *)(sec+0x56)));
+		t4=t3[j]&7;
+		t3[j]=t3[j]*2+8-t4;
+		t5[j]=0;
+	}
+
+	for(i=0; i<CSS_SCRAMBLED_SIZE; i++) {
+		for(j=0; j<n; j++) {
+			t4=CSStab2[t2[j]]^CSStab3[t1[j]];
+			t2[j]=t1[j]>>1;
+			t1[j]=((t1[j]&1)<<8)^t4;
+			t4=CSStab5[t4];
+			t6=(((((((t3[j]>>3)^t3[j])>>1)^t3[j])>>8)^t3[j])>>5)&0xff;
+			t3[j]=(t3[j]<<8)|t6;
+			t6=CSStab4[t6];
+			t5[j]+=t6+t4;
+			ks[j][i]=t5[j]&0xff;
+			t5[j]>>=8;
+		}
+	}
+}
+
+// CSStab1 is not linear, so the substitution is a plain table lookup for every byte
+static void CSSdescrambleBatch(unsigned char **secs,int n,unsigned char *tkey)
+{
+	unsigned char ks[CSS_BATCH][CSS_SCRAMBLED_SIZE];
+	int i,j;
+
+	CSSkeystream(secs,n,tkey,ks);
+
+	for(j=0; j<n; j++) {
+		unsigned char *p=secs[j]+CSS_SCRAMBLED_OFFSET;
+		for(i=0; i<CSS_SCRAMBLED_SIZE; i++)
+			p[i]=CSStab1[p[i]]^ks[j][i];
+	}
+}
+
 void CSSdescramble(unsigned char *sec,unsigned char *tkey)
 {
-	unsigned int t1,t2,t3,t4,t5,t6;
-	unsigned char *end=sec+0x800;
+	CSSdescrambleBatch(&sec,1,tkey);
+}
 
-	t1=tkey[0]^sec[0x54]|0x100;
-	t2=tkey[1]^sec[0x55];
-	t3=(*((unsigned int *)(tkey+2)))^(*((unsigned int *)(sec+0x56)));
-	t4=t3&7;
-	t3=t3*2+8-t4;
-	sec+=0x80;
-	t5=0;
-	while(sec!=end) {
-		t4=CSStab2[t2]^CSStab3[t1];
-		t2=t1>>1;
-		t1=((t1&1)<<8)^t4;
-		t4=CSStab5[t4];
-		t6=(((((((t3>>3)^t3)>>1)^t3)>>8)^t3)>>5)&0xff;
-		t3=(t3<<8)|t6;
-		t6=CSStab4[t6];
-		t5+=t6+t4;
-		*sec++=CSStab1[*sec]^(t5&0xff);
-		t5>>=8;
+int CSSdescrambleSectors(unsigned char *sec,int nSectors,unsigned char *tkey)
+{
+	unsigned char *batch[CSS_BATCH];
+	int n=0,count=0;
+
+	for(int i=0; i<nSectors; i++,sec+=CSS_SECTOR_SIZE) {
+		if(!(sec[0x14]&0x30))
+			continue;
+
+		// the key is derived from bytes past the flags, so they can be cleared right away
+		sec[0x14]&=~0x30;
+		batch[n++]=sec;
+		if(n==CSS_BATCH) {
+			CSSdescrambleBatch(batch,n,tkey);
+			count+=n;
+			n=0;
+		}
 	}
+	if(n) {
+		CSSdescrambleBatch(batch,n,tkey);
+		count+=n;
+	}
+
+	return count;
 }
 
 void CSSdisckey(unsigned char *dkey,unsigned char *pkey)
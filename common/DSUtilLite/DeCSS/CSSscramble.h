@@ -3,6 +3,9 @@
 extern void CSSdisckey(unsigned char *dkey,unsigned char *pkey);
 extern void CSStitlekey(unsigned char *tkey,unsigned char *dkey);
 extern void CSSdescramble(unsigned char *sector,unsigned char *tkey);
+// Descramble every scrambled sector of a run of consecutive 2048-byte sectors, and clear their scrambling flags
+// Returns the number of sectors that were scrambled
+extern int CSSdescrambleSectors(unsigned char *sectors,int nSectors,unsigned char *tkey);
 
 extern unsigned char g_PlayerKeys[][6];
 extern int g_nPlayerKeys;
\ No newline at end of file
@@ -49,10 +49,8 @@ void CDeCSSPinHelper::Decrypt(IMediaSample* pSample)
 
   BYTE* p = nullptr;
   if(SUCCEEDED(pSample->GetPointer(&p)) && len > 0) {
-    if(m_mt.majortype == MEDIATYPE_DVD_ENCRYPTED_PACK && len == 2048 && (p[0x14]&0x30)) {
-      CSSdescramble(p, m_TitleKey);
-      p[0x14] &= ~0x30;
-
+    // samples can hold a run of packs, all of them are descrambled in one go
+    if(m_mt.majortype == MEDIATYPE_DVD_ENCRYPTED_PACK && (len % 2048) == 0 && CSSdescrambleSectors(p, len / 2048, m_TitleKey) > 0) {
       IMediaSample2 *pMS2 = nullptr;
       if(SUCCEEDED(pSample->QueryInterface(&pMS2)) && pMS2) {
         AM_SAMPLE2_PROPERTIES props;
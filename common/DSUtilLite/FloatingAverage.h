@@ -22,6 +22,11 @@
 #include <assert.h>
 #include "DShowUtil.h"
 
+// Average and extremes over the most recent samples
+//
+// The sum and the extremes are maintained incrementally, so sampling and every query are O(1) (amortized).
+// The extremes are tracked with monotonic queues of the slot indices in the ring buffer, ordered by age.
+// Resizing the window or offsetting all values rebuilds them, which is O(n).
 template <class T>
 class FloatingAverage
 {
@@ -32,82 +37,163 @@ public:
 
   ~FloatingAverage() {
     free(m_Samples);
+    free(m_Queues);
   }
 
   void SetNumSamples(unsigned int iNumSamples) {
     if (iNumSamples > m_NumSamplesAlloc) {
       m_Samples = (T *)realloc(m_Samples, iNumSamples * sizeof(T));
+      m_Queues = (unsigned int *)realloc(m_Queues, iNumSamples * sizeof(unsigned int) * QueueCount);
       m_NumSamplesAlloc = iNumSamples;
     }
     if (iNumSamples > m_NumSamples)
       memset(m_Samples + m_NumSamples, 0, sizeof(T) * (iNumSamples - m_NumSamples));
     m_NumSamples = iNumSamples;
+    if (m_CurrentSample >= m_NumSamples)
+      m_CurrentSample = 0;
+
+    Rebuild();
   }
 
   void Sample(T fSample) {
-    m_Samples[m_CurrentSample] = fSample;
+    const unsigned int slot = m_CurrentSample;
+
+    // the slot being replaced holds the oldest sample, which can only be at the front of the queues
+    for (int q = 0; q < QueueCount; q++) {
+      if (m_Queue[q].count && QueueFront(q) == slot)
+        QueuePopFront(q);
+    }
+
+    m_Sum += fSample - m_Samples[slot];
+    m_Samples[slot] = fSample;
+    Push(slot);
+
     if (++m_CurrentSample >= m_NumSamples) {
       m_CurrentSample = 0;
+      // re-sum once per cycle, so rounding errors of floating point types don't accumulate
+      Resum();
     }
   }
 
   T Average() const {
-    T fAverage = 0;
-    for(unsigned int i = 0; i < m_NumSamples; ++i) {
-      fAverage += m_Samples[i] / m_NumSamples;
-    }
-    return fAverage;
+    return m_Sum / (T)m_NumSamples;
   }
 
   T Minimum() const {
-    T min = m_Samples[0];
-    for(unsigned int i = 1; i < m_NumSamples; ++i) {
-      if (m_Samples[i] < min)
-        min = m_Samples[i];
-    }
-    return min;
+    return m_Samples[QueueFront(QueueMin)];
   }
 
+  // The value closest to zero
   T AbsMinimum() const {
-    T min = m_Samples[0];
-    for(unsigned int i = 1; i < m_NumSamples; ++i) {
-      if (abs(m_Samples[i]) < abs(min))
-        min = m_Samples[i];
-    }
-    return min;
+    if (m_Queue[QueueMinPositive].count == 0)
+      return m_Samples[QueueFront(QueueMaxNegative)];
+    if (m_Queue[QueueMaxNegative].count == 0)
+      return m_Samples[QueueFront(QueueMinPositive)];
+
+    const T pos = m_Samples[QueueFront(QueueMinPositive)];
+    const T neg = m_Samples[QueueFront(QueueMaxNegative)];
+    return (abs(neg) < abs(pos)) ? neg : pos;
   }
 
   T Maximum() const {
-    T max = m_Samples[0];
-    for(unsigned int i = 1; i < m_NumSamples; ++i) {
-      if (m_Samples[i] > max)
-        max = m_Samples[i];
-    }
-    return max;
+    return m_Samples[QueueFront(QueueMax)];
   }
 
+  // The value furthest from zero
   T AbsMaximum() const {
-    T max = m_Samples[0];
-    for(unsigned int i = 1; i < m_NumSamples; ++i) {
-      if (abs(m_Samples[i]) > abs(max))
-        max = m_Samples[i];
-    }
-    return max;
+    const T min = Minimum();
+    const T max = Maximum();
+    return (abs(min) > abs(max)) ? min : max;
   }
 
-  void OffsetValues(T value) const {
+  void OffsetValues(T value) {
     for(unsigned int i = 0; i < m_NumSamples; ++i) {
       m_Samples[i] += value;
     }
+    // the offset can move values across zero, which changes the order for the absolute extremes
+    Rebuild();
   }
 
   unsigned int CurrentSample() const {
     return m_CurrentSample;
   }
 
+private:
+  enum {
+    QueueMin,               // increasing values
+    QueueMax,               // decreasing values
+    QueueMinPositive,       // increasing values, of the samples >= 0 only
+    QueueMaxNegative,       // decreasing values, of the samples < 0 only
+    QueueCount
+  };
+
+  struct Queue {
+    unsigned int head;
+    unsigned int count;
+  };
+
+  // Append the sample in the given slot to the queues, dropping the samples it supersedes
+  void Push(unsigned int slot) {
+    const T value = m_Samples[slot];
+
+    while (m_Queue[QueueMin].count && m_Samples[QueueBack(QueueMin)] >= value)
+      QueuePopBack(QueueMin);
+    QueuePushBack(QueueMin, slot);
+
+    while (m_Queue[QueueMax].count && m_Samples[QueueBack(QueueMax)] <= value)
+      QueuePopBack(QueueMax);
+    QueuePushBack(QueueMax, slot);
+
+    if (value >= 0) {
+      while (m_Queue[QueueMinPositive].count && m_Samples[QueueBack(QueueMinPositive)] >= value)
+        QueuePopBack(QueueMinPositive);
+      QueuePushBack(QueueMinPositive, slot);
+    } else {
+      while (m_Queue[QueueMaxNegative].count && m_Samples[QueueBack(QueueMaxNegative)] <= value)
+        QueuePopBack(QueueMaxNegative);
+      QueuePushBack(QueueMaxNegative, slot);
+    }
+  }
+
+  // Re-create the queues from all samples, oldest first
+  void Rebuild() {
+    for (int q = 0; q < QueueCount; q++) {
+      m_Queue[q].head = 0;
+      m_Queue[q].count = 0;
+    }
+    for (unsigned int i = 0; i < m_NumSamples; i++) {
+      unsigned int slot = m_CurrentSample + i;
+      if (slot >= m_NumSamples)
+        slot -= m_NumSamples;
+      Push(slot);
+    }
+    Resum();
+  }
+
+  void Resum() {
+    m_Sum = 0;
+    for(unsigned int i = 0; i < m_NumSamples; ++i) {
+      m_Sum += m_Samples[i];
+    }
+  }
+
+  // Every queue is a ring buffer of up to m_NumSamples slot indices
+  unsigned int *QueueData(int q) const { return m_Queues + q * m_NumSamplesAlloc; }
+  unsigned int QueueIndex(int q, unsigned int n) const { unsigned int i = m_Queue[q].head + n; return (i >= m_NumSamples) ? i - m_NumSamples : i; }
+
+  unsigned int QueueFront(int q) const { return QueueData(q)[m_Queue[q].head]; }
+  unsigned int QueueBack(int q) const { return QueueData(q)[QueueIndex(q, m_Queue[q].count - 1)]; }
+  void QueuePopFront(int q) { m_Queue[q].head = QueueIndex(q, 1); m_Queue[q].count--; }
+  void QueuePopBack(int q) { m_Queue[q].count--; }
+  void QueuePushBack(int q, unsigned int slot) { QueueData(q)[QueueIndex(q, m_Queue[q].count++)] = slot; }
+
 private:
   T *m_Samples                   = nullptr;
   unsigned int m_NumSamples      = 0;
   unsigned int m_NumSamplesAlloc = 0;
   unsigned int m_CurrentSample   = 0;
+
+  T m_Sum                        = 0;
+  unsigned int *m_Queues         = nullptr;
+  Queue m_Queue[QueueCount]      = {};
 };
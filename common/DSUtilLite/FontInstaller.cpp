@@ -22,6 +22,8 @@
 #include "stdafx.h"
 #include "FontInstaller.h"
 
+#include <process.h>
+
 CFontInstaller::CFontInstaller()
   : pAddFontMemResourceEx(nullptr)
   , pRemoveFontMemResourceEx(nullptr)
@@ -35,6 +37,8 @@ CFontInstaller::CFontInstaller()
 CFontInstaller::~CFontInstaller()
 {
 	UninstallFonts();
+	if(m_hThread)
+		CloseHandle(m_hThread);
 }
 
 bool CFontInstaller::InstallFont(const void* pData, UINT len)
@@ -44,6 +48,8 @@ bool CFontInstaller::InstallFont(const void* pData, UINT len)
 
 void CFontInstaller::UninstallFonts()
 {
+	WaitForFonts();
+
 	if(pRemoveFontMemResourceEx) {
     std::vector<HANDLE>::iterator it;
     for(it = m_fonts.begin(); it != m_fonts.end(); ++it) {
@@ -66,3 +72,68 @@ bool CFontInstaller::InstallFontMemory(const void* pData, UINT len)
 	}
 	return hFont && nFonts > 0;
 }
+
+bool CFontInstaller::InstallFontAsync(const void* pData, UINT len)
+{
+	if(!pAddFontMemResourceEx || !pData || !len) {
+		return false;
+	}
+
+	CAutoLock lock(&m_csQueue);
+	const BYTE *pFont = (const BYTE *)pData;
+	m_queue.emplace_back(pFont, pFont + len);
+
+	// the thread exits once the queue is empty, and is started again for the next font
+	if(!m_bThreadRunning) {
+		if(m_hThread) {
+			WaitForSingleObject(m_hThread, INFINITE);
+			CloseHandle(m_hThread);
+		}
+		m_hThread = (HANDLE)_beginthreadex(nullptr, 0, InstallThreadProc, (LPVOID)this, 0, nullptr);
+		m_bThreadRunning = (m_hThread != nullptr);
+	}
+
+	// install right away if no thread could be started
+	if(!m_bThreadRunning) {
+		bool bInstalled = InstallFontMemory(m_queue.back().data(), (UINT)m_queue.back().size());
+		m_queue.pop_back();
+		return bInstalled;
+	}
+
+	return true;
+}
+
+void CFontInstaller::WaitForFonts()
+{
+	if(m_hThread) {
+		WaitForSingleObject(m_hThread, INFINITE);
+	}
+}
+
+unsigned int WINAPI CFontInstaller::InstallThreadProc(LPVOID pv)
+{
+	SetThreadName(-1, "CFontInstaller");
+	static_cast<CFontInstaller *>(pv)->InstallQueuedFonts();
+	return 0;
+}
+
+void CFontInstaller::InstallQueuedFonts()
+{
+	for(;;) {
+		std::vector<BYTE> font;
+		{
+			CAutoLock lock(&m_csQueue);
+			if(m_queue.empty()) {
+				m_bThreadRunning = false;
+				break;
+			}
+			font.swap(m_queue.front());
+			m_queue.pop_front();
+		}
+
+		// the font data is copied by GDI, the buffer can go right away
+		if(!InstallFontMemory(font.data(), (UINT)font.size())) {
+			DbgLog((LOG_TRACE, 10, L"CFontInstaller: Installing a font failed"));
+		}
+	}
+}
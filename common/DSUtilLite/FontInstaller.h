@@ -22,6 +22,7 @@
 #pragma once
 
 #include <vector>
+#include <deque>
 
 class CFontInstaller
 {
@@ -31,10 +32,26 @@ class CFontInstaller
 	std::vector<HANDLE> m_fonts;
 	bool InstallFontMemory(const void* pData, UINT len);
 
+	// Fonts waiting for installation on the background thread
+	CCritSec m_csQueue;
+	std::deque<std::vector<BYTE>> m_queue;
+	HANDLE m_hThread        = nullptr;
+	bool m_bThreadRunning   = false;
+
+	static unsigned int WINAPI InstallThreadProc(LPVOID pv);
+	void InstallQueuedFonts();
+
 public:
 	CFontInstaller();
 	virtual ~CFontInstaller();
 
 	bool InstallFont(const void* pData, UINT len);
 	void UninstallFonts();
+
+	// Install a copy of the font on a background thread, parsing many fonts can take a while
+	// Not to be called concurrently with WaitForFonts
+	bool InstallFontAsync(const void* pData, UINT len);
+
+	// Wait until all fonts queued for background installation are installed
+	void WaitForFonts();
 };
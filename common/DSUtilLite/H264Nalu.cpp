@@ -21,6 +21,7 @@
 
 #include "stdafx.h"
 #include "H264Nalu.h"
+#include "StartCode.h"
 
 void CH264Nalu::SetBuffer(const BYTE* pBuffer, size_t nSize, int nNALSize)
 {
@@ -43,12 +44,13 @@ bool CH264Nalu::MoveToNextAnnexBStartcode()
   if (m_nSize < 4)
     goto notfound;
 
-  size_t nBuffEnd = m_nSize - 4;
-
-  for (size_t i = m_nCurPos; i <= nBuffEnd; i++) {
-    if ((*((DWORD*)(m_pBuffer+i)) & 0x00FFFFFF) == 0x00010000) {
+  // The start code needs to be followed by at least one byte
+  if (m_nCurPos < m_nSize - 3) {
+    const BYTE *pEnd = m_pBuffer + m_nSize - 1;
+    const BYTE *pStartcode = FindAnnexBStartCode(m_pBuffer + m_nCurPos, pEnd);
+    if (pStartcode != pEnd) {
       // Found next AnnexB NAL
-      m_nCurPos = i;
+      m_nCurPos = pStartcode - m_pBuffer;
       return true;
     }
   }
@@ -119,33 +121,29 @@ bool CH265Nalu::ReadNext()
 CH264NALUnescape::CH264NALUnescape(const BYTE *src, size_t nSize)
 {
   m_pBuffer = (BYTE *)_aligned_malloc(nSize + 16, 16);
-  memset(m_pBuffer, 0, nSize + 16);
 
-  unsigned si = 0, di = 0;
+  // Copy the runs between the 00 00 03 escapes, which are found with the SIMD search
+  const BYTE *p = src, *end = src + nSize;
   BYTE *dst = m_pBuffer;
-  while (si + 2 < nSize) {
-    // detect and remove escapes
-    if (src[si + 2] > 3) {
-      dst[di++] = src[si++];
-      dst[di++] = src[si++];
-    }
-    else if (src[si] == 0 && src[si + 1] == 0 && src[si + 2] != 0) {
-      if (src[si + 2] == 3) { // escape
-        dst[di++] = 0;
-        dst[di++] = 0;
-        si += 3;
-
-        continue;
-      }
+  while (p < end) {
+    const BYTE *esc = FindSyncWord32(p, end, 0x00000300, 0xffffff00);
+    // the search needs a byte following the escape, but the buffer can also end with one
+    if (esc == end && end - p >= 3 && end[-3] == 0 && end[-2] == 0 && end[-1] == 3)
+      esc = end - 3;
+
+    if (esc == end) {
+      memcpy(dst, p, end - p);
+      dst += end - p;
+      break;
     }
 
-    dst[di++] = src[si++];
+    memcpy(dst, p, esc + 2 - p);
+    dst += esc + 2 - p;
+    p = esc + 3;
   }
 
-  while (si < nSize)
-    dst[di++] = src[si++];
-
-  m_nSize = di;
+  m_nSize = dst - m_pBuffer;
+  memset(dst, 0, nSize + 16 - m_nSize);
 }
 
 CH264NALUnescape::~CH264NALUnescape()
@@ -0,0 +1,76 @@
+/*
+ *      Copyright (C) 2010-2019 Hendrik Leppkes
+ *      http://www.1f0.de
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program; if not, write to the Free Software Foundation, Inc.,
+ *  51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+
+#include "stdafx.h"
+#include "LargePages.h"
+
+// Enable the privilege on the process token, it is granted to the user but disabled by default
+static BOOL enable_lock_memory_privilege()
+{
+  HANDLE hToken = nullptr;
+  if (!OpenProcessToken(GetCurrentProcess(), TOKEN_ADJUST_PRIVILEGES | TOKEN_QUERY, &hToken))
+    return FALSE;
+
+  TOKEN_PRIVILEGES tp = { 0 };
+  tp.PrivilegeCount = 1;
+  tp.Privileges[0].Attributes = SE_PRIVILEGE_ENABLED;
+
+  // AdjustTokenPrivileges succeeds without the privilege being granted, which is only reported by the last error
+  BOOL bEnabled = LookupPrivilegeValue(nullptr, SE_LOCK_MEMORY_NAME, &tp.Privileges[0].Luid)
+               && AdjustTokenPrivileges(hToken, FALSE, &tp, 0, nullptr, nullptr)
+               && GetLastError() == ERROR_SUCCESS;
+
+  CloseHandle(hToken);
+  return bEnabled;
+}
+
+size_t large_page_size()
+{
+  static const size_t size = []() {
+    const size_t minimum = GetLargePageMinimum();
+    if (minimum == 0 || !enable_lock_memory_privilege())
+      return (size_t)0;
+    DbgLog((LOG_TRACE, 10, L"large_page_size: Large pages of %Iu KB are available", minimum >> 10));
+    return minimum;
+  }();
+  return size;
+}
+
+void *large_page_alloc(size_t size, int node)
+{
+  const size_t page = large_page_size();
+  if (page == 0)
+    return nullptr;
+
+  size = (size + page - 1) & ~(page - 1);
+
+  void *ptr = nullptr;
+  if (node >= 0)
+    ptr = VirtualAllocExNuma(GetCurrentProcess(), nullptr, size, MEM_RESERVE | MEM_COMMIT | MEM_LARGE_PAGES, PAGE_READWRITE, (DWORD)node);
+  if (ptr == nullptr)
+    ptr = VirtualAlloc(nullptr, size, MEM_RESERVE | MEM_COMMIT | MEM_LARGE_PAGES, PAGE_READWRITE);
+  return ptr;
+}
+
+void large_page_free(void *ptr)
+{
+  if (ptr)
+    VirtualFree(ptr, 0, MEM_RELEASE);
+}
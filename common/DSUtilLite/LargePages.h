@@ -0,0 +1,36 @@
+/*
+ *      Copyright (C) 2010-2019 Hendrik Leppkes
+ *      http://www.1f0.de
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program; if not, write to the Free Software Foundation, Inc.,
+ *  51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+
+#pragma once
+
+// Large page allocations
+//
+// A large page (2 MB on x86) covers as much memory as 512 regular pages with one TLB entry, which helps code
+// streaming through big buffers, like video frames. Large pages can only be used if the user was granted the
+// "Lock pages in memory" privilege (SeLockMemoryPrivilege), which is enabled on the process token on first use.
+
+// Size of a large page, or 0 if this process can't use large pages
+size_t large_page_size();
+
+// Allocate memory from large pages, preferably from the node if it is not negative
+// The size is rounded up to whole large pages. Returns nullptr if large pages can't be used, or no contiguous
+// physical memory is left for them, in which case the caller should use regular pages. Free with large_page_free.
+void *large_page_alloc(size_t size, int node);
+void large_page_free(void *ptr);
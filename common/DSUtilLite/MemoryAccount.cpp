@@ -0,0 +1,167 @@
+/*
+ *      Copyright (C) 2010-2019 Hendrik Leppkes
+ *      http://www.1f0.de
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program; if not, write to the Free Software Foundation, Inc.,
+ *  51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+
+#include "stdafx.h"
+#include "MemoryAccount.h"
+
+// The version is part of the name, so an incompatible layout never shares the memory
+#define MEMORY_ACCOUNT_MAPPING L"Local\\LAVFilters_MemoryAccount_1_%u"
+
+struct ProcessMemoryUsage {
+  volatile LONGLONG nCurrent[LAVMemory_NB];
+  volatile LONGLONG nPeak[LAVMemory_NB];
+};
+
+// Usage of the process, shared by all LAV Filters modules through a mapping named after the process
+class CProcessMemoryUsage
+{
+public:
+  CProcessMemoryUsage()
+  {
+    WCHAR name[64];
+    swprintf_s(name, MEMORY_ACCOUNT_MAPPING, GetCurrentProcessId());
+
+    // a new mapping is zero-initialized, which is a valid empty usage
+    m_hMapping = CreateFileMapping(INVALID_HANDLE_VALUE, nullptr, PAGE_READWRITE, 0, sizeof(ProcessMemoryUsage), name);
+    if (m_hMapping)
+      m_pUsage = (ProcessMemoryUsage *)MapViewOfFile(m_hMapping, FILE_MAP_ALL_ACCESS, 0, 0, sizeof(ProcessMemoryUsage));
+
+    // without the mapping, only this module is counted
+    if (!m_pUsage) {
+      DbgLog((LOG_ERROR, 10, L"CProcessMemoryUsage(): Failed to map the process memory usage (error: %u)", GetLastError()));
+      m_pUsage = &m_LocalUsage;
+    }
+  }
+
+  ~CProcessMemoryUsage()
+  {
+    if (m_pUsage != &m_LocalUsage)
+      UnmapViewOfFile(m_pUsage);
+    if (m_hMapping)
+      CloseHandle(m_hMapping);
+  }
+
+  ProcessMemoryUsage *Get() const { return m_pUsage; }
+
+private:
+  HANDLE m_hMapping = nullptr;
+  ProcessMemoryUsage *m_pUsage = nullptr;
+  ProcessMemoryUsage m_LocalUsage = { { 0 }, { 0 } };
+};
+
+static ProcessMemoryUsage *get_process_usage()
+{
+  static CProcessMemoryUsage usage;
+  return usage.Get();
+}
+
+static void update_peak(volatile LONGLONG *pPeak, LONGLONG nValue)
+{
+  LONGLONG nPeak = *pPeak;
+  while (nValue > nPeak) {
+    const LONGLONG nPrev = InterlockedCompareExchange64(pPeak, nValue, nPeak);
+    if (nPrev == nPeak)
+      break;
+    nPeak = nPrev;
+  }
+}
+
+// Add to the category and the total of the counters
+static void add_usage(volatile LONGLONG *pCurrent, volatile LONGLONG *pPeak, LAVMemoryCategory category, LONGLONG nBytes)
+{
+  const LONGLONG nCurrent = InterlockedExchangeAdd64(&pCurrent[category], nBytes) + nBytes;
+  const LONGLONG nTotal = InterlockedExchangeAdd64(&pCurrent[LAVMemory_Total], nBytes) + nBytes;
+  if (nBytes > 0) {
+    update_peak(&pPeak[category], nCurrent);
+    update_peak(&pPeak[LAVMemory_Total], nTotal);
+  }
+}
+
+static HRESULT get_usage(const volatile LONGLONG *pCurrent, const volatile LONGLONG *pPeak, LAVMemoryCategory category, LAVMemoryUsage *pUsage)
+{
+  CheckPointer(pUsage, E_POINTER);
+  if (category < 0 || category >= LAVMemory_NB)
+    return E_INVALIDARG;
+
+  // charges are released by other threads at any time, a transient negative value is reported as empty
+  pUsage->nCurrent = (ULONGLONG)max(pCurrent[category], 0LL);
+  pUsage->nPeak = (ULONGLONG)max(pPeak[category], 0LL);
+  return S_OK;
+}
+
+CMemoryAccount::CMemoryAccount()
+{
+}
+
+CMemoryAccount::~CMemoryAccount()
+{
+  // every object holding a charge also holds a reference
+  ASSERT(m_nCurrent[LAVMemory_Total] == 0);
+}
+
+ULONG CMemoryAccount::AddRef()
+{
+  return (ULONG)InterlockedIncrement(&m_cRef);
+}
+
+ULONG CMemoryAccount::Release()
+{
+  const LONG lRef = InterlockedDecrement(&m_cRef);
+  if (lRef == 0)
+    delete this;
+  return (ULONG)lRef;
+}
+
+void CMemoryAccount::Add(LAVMemoryCategory category, LONGLONG nBytes)
+{
+  ASSERT(category >= 0 && category < LAVMemory_Total);
+  if (nBytes == 0)
+    return;
+
+  add_usage(m_nCurrent, m_nPeak, category, nBytes);
+  AddProcess(category, nBytes);
+}
+
+HRESULT CMemoryAccount::GetUsage(LAVMemoryCategory category, LAVMemoryUsage *pUsage) const
+{
+  return get_usage(m_nCurrent, m_nPeak, category, pUsage);
+}
+
+void CMemoryAccount::ResetPeak()
+{
+  for (int i = 0; i < LAVMemory_NB; i++)
+    InterlockedExchange64(&m_nPeak[i], m_nCurrent[i]);
+}
+
+void CMemoryAccount::AddProcess(LAVMemoryCategory category, LONGLONG nBytes)
+{
+  ASSERT(category >= 0 && category < LAVMemory_Total);
+  if (nBytes == 0)
+    return;
+
+  ProcessMemoryUsage *pUsage = get_process_usage();
+  add_usage(pUsage->nCurrent, pUsage->nPeak, category, nBytes);
+}
+
+HRESULT CMemoryAccount::GetProcessUsage(LAVMemoryCategory category, LAVMemoryUsage *pUsage)
+{
+  const ProcessMemoryUsage *pProcessUsage = get_process_usage();
+  return get_usage(pProcessUsage->nCurrent, pProcessUsage->nPeak, category, pUsage);
+}
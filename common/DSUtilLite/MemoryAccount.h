@@ -0,0 +1,64 @@
+/*
+ *      Copyright (C) 2010-2019 Hendrik Leppkes
+ *      http://www.1f0.de
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program; if not, write to the Free Software Foundation, Inc.,
+ *  51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+
+#pragma once
+
+#include "ILAVMemoryInfo.h"
+
+// Memory accounting of one filter instance, see ILAVMemoryInfo
+//
+// Every charge is also added to the process-wide usage, which is kept in shared memory of the process,
+// so all LAV Filters modules loaded in it count towards the same total.
+// The account is reference counted, objects which can outlive their filter (like samples or frames)
+// hold a reference while they are charged.
+class CMemoryAccount
+{
+public:
+  CMemoryAccount();
+
+  ULONG AddRef();
+  ULONG Release();
+
+  // Charge the bytes to the account, negative values release a charge
+  void Add(LAVMemoryCategory category, LONGLONG nBytes);
+
+  // Change a charge of the caller, which is kept in *pnCharged, to nBytes
+  void Update(LAVMemoryCategory category, size_t *pnCharged, size_t nBytes)
+  {
+    Add(category, (LONGLONG)nBytes - (LONGLONG)*pnCharged);
+    *pnCharged = nBytes;
+  }
+
+  HRESULT GetUsage(LAVMemoryCategory category, LAVMemoryUsage *pUsage) const;
+  void ResetPeak();
+
+  // Charge memory which is not held by any filter, like unused entries of shared pools, to the process only
+  static void AddProcess(LAVMemoryCategory category, LONGLONG nBytes);
+  static HRESULT GetProcessUsage(LAVMemoryCategory category, LAVMemoryUsage *pUsage);
+
+private:
+  ~CMemoryAccount();
+
+private:
+  volatile LONG m_cRef = 1;
+
+  volatile LONGLONG m_nCurrent[LAVMemory_NB] = { 0 };
+  volatile LONGLONG m_nPeak[LAVMemory_NB]    = { 0 };
+};
@@ -0,0 +1,50 @@
+/*
+ *      Copyright (C) 2010-2019 Hendrik Leppkes
+ *      http://www.1f0.de
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program; if not, write to the Free Software Foundation, Inc.,
+ *  51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#include "stdafx.h"
+#include "MemoryPressure.h"
+
+static volatile LONG g_bLowMemory = FALSE;
+static volatile LONGLONG g_llNextQuery = 0;
+
+BOOL memory_pressure_low()
+{
+  // the notification is never closed, it is shared by all callers for the lifetime of the module
+  static const HANDLE hNotification = CreateMemoryResourceNotification(LowMemoryResourceNotification);
+  if (hNotification == nullptr)
+    return FALSE;
+
+  const LONGLONG llNow = (LONGLONG)GetTickCount64();
+  const LONGLONG llNext = g_llNextQuery;
+  if (llNow < llNext)
+    return g_bLowMemory;
+
+  // only one of the threads racing for an expired state queries it, the others keep the cached one
+  if (InterlockedCompareExchange64(&g_llNextQuery, llNow + MEMORY_PRESSURE_POLL_INTERVAL, llNext) != llNext)
+    return g_bLowMemory;
+
+  BOOL bLowMemory = FALSE;
+  if (!QueryMemoryResourceNotification(hNotification, &bLowMemory))
+    bLowMemory = FALSE;
+
+  if (InterlockedExchange(&g_bLowMemory, bLowMemory) != bLowMemory)
+    DbgLog((LOG_TRACE, 10, L"memory_pressure_low: System memory is %s", bLowMemory ? L"low" : L"no longer low"));
+
+  return bLowMemory;
+}
@@ -0,0 +1,33 @@
+/*
+ *      Copyright (C) 2010-2019 Hendrik Leppkes
+ *      http://www.1f0.de
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program; if not, write to the Free Software Foundation, Inc.,
+ *  51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#pragma once
+
+// System memory pressure
+//
+// Windows signals a low memory condition once the available physical memory runs low, long before allocations
+// start to fail. Queues and pools which only trade memory for speed shrink while the condition is signaled,
+// so the player is not the first process to be terminated on small systems.
+
+// Interval in which the condition is queried, in milliseconds
+#define MEMORY_PRESSURE_POLL_INTERVAL 500
+
+// Returns TRUE while the system signals low memory
+// The state is cached for the poll interval, so this is cheap enough to be called for every packet or frame.
+BOOL memory_pressure_low();
@@ -0,0 +1,104 @@
+/*
+ *      Copyright (C) 2010-2019 Hendrik Leppkes
+ *      http://www.1f0.de
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program; if not, write to the Free Software Foundation, Inc.,
+ *  51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+
+#include "stdafx.h"
+#include "NumaPlacement.h"
+
+// The group-aware functions are only available on Windows 7 and newer
+typedef BOOL (WINAPI *PFN_GET_NUMA_NODE_PROCESSOR_MASK_EX)(USHORT Node, PGROUP_AFFINITY ProcessorMask);
+typedef BOOL (WINAPI *PFN_SET_THREAD_GROUP_AFFINITY)(HANDLE hThread, const GROUP_AFFINITY *GroupAffinity, PGROUP_AFFINITY PreviousGroupAffinity);
+
+static volatile LONG s_NextNode = -1;
+static thread_local int t_ThreadNode = -1;
+
+static ULONG numa_highest_node()
+{
+  static const ULONG highest = []() {
+    ULONG node = 0;
+    if (!GetNumaHighestNodeNumber(&node))
+      node = 0;
+    return node;
+  }();
+  return highest;
+}
+
+int numa_select_node(DWORD dwSetting)
+{
+  const ULONG highest = numa_highest_node();
+  if (dwSetting == NUMA_NODE_OFF || highest == 0)
+    return -1;
+
+  if (dwSetting == NUMA_NODE_AUTO)
+    return (int)((ULONG)InterlockedIncrement(&s_NextNode) % (highest + 1));
+
+  if (dwSetting > highest) {
+    DbgLog((LOG_TRACE, 10, L"numa_select_node: Node %u does not exist, the highest node is %u", dwSetting, highest));
+    return -1;
+  }
+  return (int)dwSetting;
+}
+
+void numa_bind_thread(int node)
+{
+  if (node < 0 || node == t_ThreadNode)
+    return;
+
+  static const PFN_GET_NUMA_NODE_PROCESSOR_MASK_EX mGetNumaNodeProcessorMaskEx = (PFN_GET_NUMA_NODE_PROCESSOR_MASK_EX)GetProcAddress(GetModuleHandle(L"kernel32.dll"), "GetNumaNodeProcessorMaskEx");
+  static const PFN_SET_THREAD_GROUP_AFFINITY mSetThreadGroupAffinity = (PFN_SET_THREAD_GROUP_AFFINITY)GetProcAddress(GetModuleHandle(L"kernel32.dll"), "SetThreadGroupAffinity");
+
+  BOOL bBound = FALSE;
+  if (mGetNumaNodeProcessorMaskEx && mSetThreadGroupAffinity) {
+    GROUP_AFFINITY affinity = { 0 };
+    if (mGetNumaNodeProcessorMaskEx((USHORT)node, &affinity) && affinity.Mask)
+      bBound = mSetThreadGroupAffinity(GetCurrentThread(), &affinity, nullptr);
+  } else {
+    // before Windows 7, all processors are in one group
+    ULONGLONG mask = 0;
+    if (GetNumaNodeProcessorMask((UCHAR)node, &mask) && mask)
+      bBound = (SetThreadAffinityMask(GetCurrentThread(), (DWORD_PTR)mask) != 0);
+  }
+
+  if (!bBound) {
+    DbgLog((LOG_ERROR, 10, L"numa_bind_thread: Binding to node %d failed (error: %u)", node, GetLastError()));
+    return;
+  }
+  t_ThreadNode = node;
+}
+
+int numa_thread_node()
+{
+  return t_ThreadNode;
+}
+
+void *numa_alloc(size_t size, int node)
+{
+  void *ptr = nullptr;
+  if (node >= 0)
+    ptr = VirtualAllocExNuma(GetCurrentProcess(), nullptr, size, MEM_RESERVE | MEM_COMMIT, PAGE_READWRITE, (DWORD)node);
+  if (ptr == nullptr)
+    ptr = VirtualAlloc(nullptr, size, MEM_RESERVE | MEM_COMMIT, PAGE_READWRITE);
+  return ptr;
+}
+
+void numa_free(void *ptr)
+{
+  if (ptr)
+    VirtualFree(ptr, 0, MEM_RELEASE);
+}
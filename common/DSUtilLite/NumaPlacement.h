@@ -0,0 +1,46 @@
+/*
+ *      Copyright (C) 2010-2019 Hendrik Leppkes
+ *      http://www.1f0.de
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program; if not, write to the Free Software Foundation, Inc.,
+ *  51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+
+#pragma once
+
+// NUMA placement of filter instances
+//
+// On systems with more than one NUMA node, the threads of a filter instance can be kept on the processors of
+// one node, and its buffers allocated from the memory of that node, so frames and packets don't cross the
+// interconnect between the sockets. Systems with a single node never place anything.
+
+// Setting values besides node numbers
+#define NUMA_NODE_OFF  0xFFFFFFFF   ///< Threads run on any processor
+#define NUMA_NODE_AUTO 0xFFFFFFFE   ///< Every instance is assigned the next node, round-robin
+
+// Select the node of a filter instance for the setting, or -1 if the instance is not placed
+int numa_select_node(DWORD dwSetting);
+
+// Restrict the calling thread to the processors of the node, and remember the node for allocations on this thread
+// A negative node is ignored. Binding the thread to the node it is already bound to does nothing.
+void numa_bind_thread(int node);
+
+// Node the calling thread was bound to, or -1
+int numa_thread_node();
+
+// Allocate page-aligned memory, preferably from the node, other nodes are only used once it runs out
+// Memory of a negative node is allocated wherever the thread first touches it. Free with numa_free.
+void *numa_alloc(size_t size, int node);
+void numa_free(void *ptr);
@@ -0,0 +1,124 @@
+/*
+ *      Copyright (C) 2010-2019 Hendrik Leppkes
+ *      http://www.1f0.de
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program; if not, write to the Free Software Foundation, Inc.,
+ *  51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#include "stdafx.h"
+#include "PerfCounters.h"
+
+#include <Shlwapi.h>
+
+CPerfCounterSet::CPerfCounterSet(const GUID &guidProvider, const GUID &guidCounterSet, const ULONG *pTypes, ULONG nCounters)
+  : m_guidProvider(guidProvider)
+  , m_guidCounterSet(guidCounterSet)
+{
+  ASSERT(nCounters <= LAV_PERF_MAX_COUNTERS);
+  m_nCounters = min(nCounters, (ULONG)LAV_PERF_MAX_COUNTERS);
+  memcpy(m_Types, pTypes, sizeof(ULONG) * m_nCounters);
+}
+
+CPerfCounterSet::~CPerfCounterSet()
+{
+  // all instances belong to filters, which are gone before the module is unloaded
+  ASSERT(m_nInstances == 0);
+}
+
+PPERF_COUNTERSET_INSTANCE CPerfCounterSet::CreateInstance(volatile ULONGLONG *pValues, LPCWSTR pszSuffix)
+{
+  CAutoLock lock(&m_csProvider);
+  if (m_bFailed)
+    return nullptr;
+
+  if (m_hProvider == nullptr) {
+    PERF_PROVIDER_CONTEXT context = { sizeof(PERF_PROVIDER_CONTEXT) };
+    ULONG status = PerfStartProviderEx(&m_guidProvider, &context, &m_hProvider);
+    if (status != ERROR_SUCCESS) {
+      DbgLog((LOG_TRACE, 10, L"CPerfCounterSet::CreateInstance(): Starting the provider failed (%u)", status));
+      m_hProvider = nullptr;
+      m_bFailed = TRUE;
+      return nullptr;
+    }
+
+    // the template is the counter set, followed by its counters
+    BYTE buffer[sizeof(PERF_COUNTERSET_INFO) + sizeof(PERF_COUNTER_INFO) * LAV_PERF_MAX_COUNTERS] = { 0 };
+    PERF_COUNTERSET_INFO *pSet = (PERF_COUNTERSET_INFO *)buffer;
+    pSet->CounterSetGuid = m_guidCounterSet;
+    pSet->ProviderGuid = m_guidProvider;
+    pSet->NumCounters = m_nCounters;
+    pSet->InstanceType = PERF_COUNTERSET_MULTI_AGGREGATE;
+
+    PERF_COUNTER_INFO *pCounters = (PERF_COUNTER_INFO *)(pSet + 1);
+    for (ULONG i = 0; i < m_nCounters; i++) {
+      pCounters[i].CounterId = i;
+      pCounters[i].Type = m_Types[i];
+      pCounters[i].Attrib = PERF_ATTRIB_BY_REFERENCE;
+      pCounters[i].Size = sizeof(ULONGLONG);
+      pCounters[i].DetailLevel = PERF_DETAIL_NOVICE;
+      pCounters[i].Offset = i * sizeof(ULONGLONG);
+    }
+
+    status = PerfSetCounterSetInfo(m_hProvider, pSet, sizeof(PERF_COUNTERSET_INFO) + sizeof(PERF_COUNTER_INFO) * m_nCounters);
+    if (status != ERROR_SUCCESS) {
+      DbgLog((LOG_TRACE, 10, L"CPerfCounterSet::CreateInstance(): The counter set is not registered (%u)", status));
+      PerfStopProvider(m_hProvider);
+      m_hProvider = nullptr;
+      m_bFailed = TRUE;
+      return nullptr;
+    }
+  }
+
+  // the name of the process, its id and a number tell the instances apart
+  WCHAR wszModule[MAX_PATH] = { 0 };
+  GetModuleFileNameW(nullptr, wszModule, MAX_PATH);
+  PathRemoveExtensionW(wszModule);
+
+  const ULONG id = m_nNextId++;
+  WCHAR wszName[MAX_PATH + 64];
+  if (pszSuffix)
+    swprintf_s(wszName, L"%s (%u) #%u %s", PathFindFileNameW(wszModule), GetCurrentProcessId(), id, pszSuffix);
+  else
+    swprintf_s(wszName, L"%s (%u) #%u", PathFindFileNameW(wszModule), GetCurrentProcessId(), id);
+
+  PPERF_COUNTERSET_INSTANCE pInstance = PerfCreateInstance(m_hProvider, &m_guidCounterSet, wszName, id);
+  if (pInstance == nullptr) {
+    if (m_nInstances == 0) {
+      PerfStopProvider(m_hProvider);
+      m_hProvider = nullptr;
+    }
+    return nullptr;
+  }
+
+  for (ULONG i = 0; i < m_nCounters; i++)
+    PerfSetCounterRefValue(m_hProvider, pInstance, i, (PVOID)&pValues[i]);
+
+  m_nInstances++;
+  return pInstance;
+}
+
+void CPerfCounterSet::DeleteInstance(PPERF_COUNTERSET_INSTANCE pInstance)
+{
+  if (pInstance == nullptr)
+    return;
+
+  CAutoLock lock(&m_csProvider);
+  PerfDeleteInstance(m_hProvider, pInstance);
+
+  if (--m_nInstances == 0) {
+    PerfStopProvider(m_hProvider);
+    m_hProvider = nullptr;
+  }
+}
@@ -0,0 +1,75 @@
+/*
+ *      Copyright (C) 2010-2019 Hendrik Leppkes
+ *      http://www.1f0.de
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program; if not, write to the Free Software Foundation, Inc.,
+ *  51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#pragma once
+
+// Windows performance counters of LAV Filters
+//
+// Every filter module is a PerfLib V2 provider with one counter set, which has an instance for every filter (or pin)
+// in every process; the _Total instance is aggregated by the consumer. The counters are read by reference from a
+// block of ULONGLONG values owned by the instance, so updating one is a plain (interlocked) write without any call
+// into PerfLib, whether anyone is watching or not.
+//
+// The providers are described in LAVFilters.PerfCounters.man, which has to be registered once to make the counters
+// visible in perfmon and PDH:
+//   lodctr /m:LAVFilters.PerfCounters.man <directory of the .ax files>
+// Without the registration, creating an instance fails, and the counters are just not published.
+
+#include <perflib.h>
+
+// Highest number of counters in one counter set
+#define LAV_PERF_MAX_COUNTERS 16
+
+class CPerfCounterSet
+{
+public:
+  // The counters are numbered 0..nCounters-1, in the order of their types, which are PERF_* counter types of 64-bit size
+  CPerfCounterSet(const GUID &guidProvider, const GUID &guidCounterSet, const ULONG *pTypes, ULONG nCounters);
+  ~CPerfCounterSet();
+
+  // Publish a block of values, one for every counter of the set, as a new instance
+  // The name is made unique with the process, and the suffix appended if given.
+  // The provider is started with the first instance, and stopped with the last one. Returns nullptr on failure.
+  PPERF_COUNTERSET_INSTANCE CreateInstance(volatile ULONGLONG *pValues, LPCWSTR pszSuffix = nullptr);
+  void DeleteInstance(PPERF_COUNTERSET_INSTANCE pInstance);
+
+private:
+  GUID m_guidProvider;
+  GUID m_guidCounterSet;
+  ULONG m_Types[LAV_PERF_MAX_COUNTERS];
+  ULONG m_nCounters = 0;
+
+  CCritSec m_csProvider;
+  HANDLE m_hProvider  = nullptr;
+  ULONG m_nInstances  = 0;
+  ULONG m_nNextId     = 0;
+  BOOL m_bFailed      = FALSE;    // the provider is not registered, it is not tried again
+};
+
+// Add to a counter of an instance, the value blocks are updated from several threads
+inline void perf_counter_add(volatile ULONGLONG *pValue, ULONGLONG ullValue)
+{
+  InterlockedAdd64((volatile LONG64 *)pValue, (LONG64)ullValue);
+}
+
+// Set a counter of an instance
+inline void perf_counter_set(volatile ULONGLONG *pValue, ULONGLONG ullValue)
+{
+  InterlockedExchange64((volatile LONG64 *)pValue, (LONG64)ullValue);
+}
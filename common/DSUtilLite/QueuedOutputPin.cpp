@@ -0,0 +1,190 @@
+/*
+ *      Copyright (C) 2010-2019 Hendrik Leppkes
+ *      http://www.1f0.de
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program; if not, write to the Free Software Foundation, Inc.,
+ *  51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#include "stdafx.h"
+#include "QueuedOutputPin.h"
+#include "DShowUtil.h"
+
+// COutputQueue which can report how many samples are waiting to be passed downstream
+class CBoundedOutputQueue : public COutputQueue
+{
+public:
+  CBoundedOutputQueue(IPin *pInputPin, HRESULT *phr, LONG lBatchSize, LONG lListSize)
+    : COutputQueue(pInputPin, phr, FALSE, TRUE, lBatchSize, FALSE, lListSize) {}
+
+  // Queued samples, including the batch currently being delivered
+  // Segment and end of stream notifications are counted as well, which only makes the bound a bit tighter.
+  LONG GetQueuedCount()
+  {
+    CAutoLock lck(this);
+    return (m_List ? m_List->GetCount() : 0) + m_nBatched;
+  }
+};
+
+CQueuedOutputPin::CQueuedOutputPin(LPCTSTR pObjectName, CTransformFilter *pFilter, HRESULT *phr, LPCWSTR pName)
+  : CTransformOutputPin(pObjectName, pFilter, phr, pName)
+{
+}
+
+CQueuedOutputPin::~CQueuedOutputPin()
+{
+  SAFE_DELETE(m_pOutputQueue);
+}
+
+void CQueuedOutputPin::SetOutputQueue(DWORD dwDepth, DWORD dwBatchSize)
+{
+  m_dwQueueDepth = min(dwDepth, (DWORD)OUTPUT_QUEUE_MAX_DEPTH);
+  m_dwBatchSize = max(min(dwBatchSize, m_dwQueueDepth), 1UL);
+}
+
+BOOL CQueuedOutputPin::IsQueueActive()
+{
+  CAutoLock lock(&m_csQueue);
+  return m_pOutputQueue != nullptr;
+}
+
+HRESULT CQueuedOutputPin::Active()
+{
+  HRESULT hr = __super::Active();
+  if (FAILED(hr) || m_dwQueueDepth == 0)
+    return hr;
+
+  CAutoLock lock(&m_csQueue);
+  ASSERT(m_pOutputQueue == nullptr);
+
+  HRESULT hrQueue = S_OK;
+  m_pOutputQueue = new CBoundedOutputQueue(GetConnected(), &hrQueue, m_dwBatchSize, m_dwQueueDepth);
+  if (FAILED(hrQueue)) {
+    DbgLog((LOG_ERROR, 10, L"CQueuedOutputPin::Active(): Creating the output queue failed (hr: 0x%x), delivering synchronously", hrQueue));
+    SAFE_DELETE(m_pOutputQueue);
+  }
+  m_bFlushing = FALSE;
+
+  return hr;
+}
+
+HRESULT CQueuedOutputPin::Inactive()
+{
+  {
+    // the queue thread is only blocked by the downstream filter, which is stopped first
+    CAutoLock lock(&m_csQueue);
+    SAFE_DELETE(m_pOutputQueue);
+  }
+  // release anyone waiting for queue space
+  m_evQueuePop.Set();
+
+  return __super::Inactive();
+}
+
+// Block until the queue has room for another sample, or it is flushed or deleted
+void CQueuedOutputPin::WaitForQueueSpace()
+{
+  for (;;) {
+    {
+      CAutoLock lock(&m_csQueue);
+      if (m_pOutputQueue == nullptr || m_bFlushing || m_pOutputQueue->GetQueuedCount() < (LONG)m_dwQueueDepth)
+        return;
+    }
+    // the pop event only coalesces wake-ups, the count is checked again in any case
+    m_evQueuePop.Wait(10);
+  }
+}
+
+HRESULT CQueuedOutputPin::WaitForQueueIdle(DWORD dwTimeout)
+{
+  const ULONGLONG ullStart = GetTickCount64();
+  for (;;) {
+    {
+      CAutoLock lock(&m_csQueue);
+      if (m_pOutputQueue == nullptr)
+        return S_FALSE;
+      if (m_pOutputQueue->IsIdle())
+        return S_OK;
+    }
+    if (dwTimeout != INFINITE && GetTickCount64() - ullStart >= dwTimeout)
+      return VFW_E_TIMEOUT;
+    m_evQueuePop.Wait(10);
+  }
+}
+
+// Without a queue, the calls are passed on outside of the lock, since the downstream filter can block them
+HRESULT CQueuedOutputPin::Deliver(IMediaSample *pSample)
+{
+  WaitForQueueSpace();
+
+  {
+    CAutoLock lock(&m_csQueue);
+    if (m_pOutputQueue) {
+      // the queue releases the sample once it was delivered, the caller keeps its own reference
+      pSample->AddRef();
+      return m_pOutputQueue->Receive(pSample);
+    }
+  }
+  return __super::Deliver(pSample);
+}
+
+HRESULT CQueuedOutputPin::DeliverEndOfStream()
+{
+  {
+    CAutoLock lock(&m_csQueue);
+    if (m_pOutputQueue) {
+      m_pOutputQueue->EOS();
+      return S_OK;
+    }
+  }
+  return __super::DeliverEndOfStream();
+}
+
+HRESULT CQueuedOutputPin::DeliverBeginFlush()
+{
+  {
+    CAutoLock lock(&m_csQueue);
+    if (m_pOutputQueue) {
+      m_bFlushing = TRUE;
+      m_pOutputQueue->BeginFlush();
+      return S_OK;
+    }
+  }
+  return __super::DeliverBeginFlush();
+}
+
+HRESULT CQueuedOutputPin::DeliverEndFlush()
+{
+  {
+    CAutoLock lock(&m_csQueue);
+    if (m_pOutputQueue) {
+      m_pOutputQueue->EndFlush();
+      m_bFlushing = FALSE;
+      return S_OK;
+    }
+  }
+  return __super::DeliverEndFlush();
+}
+
+HRESULT CQueuedOutputPin::DeliverNewSegment(REFERENCE_TIME tStart, REFERENCE_TIME tStop, double dRate)
+{
+  {
+    CAutoLock lock(&m_csQueue);
+    if (m_pOutputQueue) {
+      m_pOutputQueue->NewSegment(tStart, tStop, dRate);
+      return S_OK;
+    }
+  }
+  return __super::DeliverNewSegment(tStart, tStop, dRate);
+}
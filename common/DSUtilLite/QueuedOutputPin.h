@@ -0,0 +1,69 @@
+/*
+ *      Copyright (C) 2010-2019 Hendrik Leppkes
+ *      http://www.1f0.de
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program; if not, write to the Free Software Foundation, Inc.,
+ *  51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#pragma once
+
+#define OUTPUT_QUEUE_MAX_DEPTH 32
+
+class CBoundedOutputQueue;
+
+// Transform output pin which can deliver through a COutputQueue
+//
+// While the queue is active, samples, end of stream, flushes and new segments are passed downstream by the
+// thread of the queue, so the filter can run ahead of the downstream filter by up to the configured number of
+// samples, instead of waiting on it in every Deliver call. Without a queue, everything is delivered synchronously.
+class CQueuedOutputPin : public CTransformOutputPin
+{
+public:
+  CQueuedOutputPin(LPCTSTR pObjectName, CTransformFilter *pFilter, HRESULT *phr, LPCWSTR pName);
+  virtual ~CQueuedOutputPin();
+
+  // Set the maximum number of queued samples (0 disables the queue), and the number of samples
+  // passed downstream in one ReceiveMultiple call. Takes effect the next time the pin is activated.
+  void SetOutputQueue(DWORD dwDepth, DWORD dwBatchSize);
+  DWORD GetOutputQueueDepth() const { return m_dwQueueDepth; }
+
+  BOOL IsQueueActive();
+
+  // Wait until all queued samples were passed downstream
+  // Returns S_FALSE if no queue is active, and VFW_E_TIMEOUT if the queue did not drain in time
+  HRESULT WaitForQueueIdle(DWORD dwTimeout);
+
+  // CBaseOutputPin
+  HRESULT Active();
+  HRESULT Inactive();
+
+  HRESULT Deliver(IMediaSample *pSample);
+  HRESULT DeliverEndOfStream();
+  HRESULT DeliverBeginFlush();
+  HRESULT DeliverEndFlush();
+  HRESULT DeliverNewSegment(REFERENCE_TIME tStart, REFERENCE_TIME tStop, double dRate);
+
+private:
+  void WaitForQueueSpace();
+
+private:
+  CCritSec             m_csQueue;
+  CBoundedOutputQueue *m_pOutputQueue = nullptr;
+  CAMEvent             m_evQueuePop;
+  BOOL                 m_bFlushing    = FALSE;
+
+  DWORD m_dwQueueDepth = 0;
+  DWORD m_dwBatchSize  = 1;
+};
@@ -0,0 +1,72 @@
+/*
+ *      Copyright (C) 2010-2019 Hendrik Leppkes
+ *      http://www.1f0.de
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program; if not, write to the Free Software Foundation, Inc.,
+ *  51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#pragma once
+
+// Shared/exclusive lock based on a slim reader/writer lock
+//
+// Much cheaper than a critical section when uncontended, and readers don't block each other.
+// Meant for data which is read on hot paths and only rarely modified. Unlike CCritSec, the lock is
+// NOT recursive: a thread must never acquire it again while holding it, not even in shared mode.
+class CSharedLock
+{
+public:
+  CSharedLock() { InitializeSRWLock(&m_Lock); }
+
+  void Lock() { AcquireSRWLockExclusive(&m_Lock); }
+  void Unlock() { ReleaseSRWLockExclusive(&m_Lock); }
+
+  void LockShared() { AcquireSRWLockShared(&m_Lock); }
+  void UnlockShared() { ReleaseSRWLockShared(&m_Lock); }
+
+private:
+  // make copy constructor and assignment operator inaccessible
+  CSharedLock(const CSharedLock &);
+  CSharedLock &operator=(const CSharedLock &);
+
+  SRWLOCK m_Lock;
+};
+
+// Holds the lock in exclusive mode for the lifetime of the object
+class CAutoExclusiveLock
+{
+public:
+  CAutoExclusiveLock(CSharedLock *pLock) : m_pLock(pLock) { m_pLock->Lock(); }
+  ~CAutoExclusiveLock() { m_pLock->Unlock(); }
+
+private:
+  CAutoExclusiveLock(const CAutoExclusiveLock &);
+  CAutoExclusiveLock &operator=(const CAutoExclusiveLock &);
+
+  CSharedLock *m_pLock;
+};
+
+// Holds the lock in shared mode for the lifetime of the object
+class CAutoSharedLock
+{
+public:
+  CAutoSharedLock(CSharedLock *pLock) : m_pLock(pLock) { m_pLock->LockShared(); }
+  ~CAutoSharedLock() { m_pLock->UnlockShared(); }
+
+private:
+  CAutoSharedLock(const CAutoSharedLock &);
+  CAutoSharedLock &operator=(const CAutoSharedLock &);
+
+  CSharedLock *m_pLock;
+};
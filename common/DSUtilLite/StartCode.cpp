@@ -0,0 +1,122 @@
+/*
+ *      Copyright (C) 2010-2019 Hendrik Leppkes
+ *      http://www.1f0.de
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program; if not, write to the Free Software Foundation, Inc.,
+ *  51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#include "stdafx.h"
+#include "StartCode.h"
+
+#include <emmintrin.h>
+
+extern "C" {
+#include "libavutil/cpu.h"
+};
+
+const BYTE *find_start_code_c(const BYTE *p, const BYTE *end)
+{
+  // The third byte decides how far we can skip ahead:
+  // anything above 1 can't be part of a start code beginning at p, p+1 or p+2
+  while (end - p >= 3) {
+    if (p[2] > 1)
+      p += 3;
+    else if (p[1])
+      p += 2;
+    else if (p[0] || p[2] != 1)
+      p++;
+    else
+      return p;
+  }
+  return end;
+}
+
+const BYTE *find_start_code_sse2(const BYTE *p, const BYTE *end)
+{
+  const __m128i zero = _mm_setzero_si128();
+  const __m128i one = _mm_set1_epi8(1);
+
+  // Compare 16 positions at once, the loads at p+1 and p+2 need 18 bytes
+  while (end - p >= 18) {
+    const __m128i b0 = _mm_loadu_si128((const __m128i *)(p + 0));
+    const __m128i b1 = _mm_loadu_si128((const __m128i *)(p + 1));
+    const __m128i b2 = _mm_loadu_si128((const __m128i *)(p + 2));
+    const __m128i match = _mm_and_si128(_mm_and_si128(_mm_cmpeq_epi8(b0, zero), _mm_cmpeq_epi8(b1, zero)), _mm_cmpeq_epi8(b2, one));
+
+    const int mask = _mm_movemask_epi8(match);
+    if (mask) {
+      unsigned long idx;
+      _BitScanForward(&idx, mask);
+      return p + idx;
+    }
+    p += 16;
+  }
+
+  return find_start_code_c(p, end);
+}
+
+typedef const BYTE *(*FindStartCodeFunc)(const BYTE *p, const BYTE *end);
+static const FindStartCodeFunc find_start_code = (av_get_cpu_flags() & AV_CPU_FLAG_AVX2) ? find_start_code_avx2 : find_start_code_sse2;
+
+const BYTE *FindAnnexBStartCode(const BYTE *p, const BYTE *end)
+{
+  return find_start_code(p, end);
+}
+
+// Every byte of the sync word is compared at 16 positions at once, with its own load at the offset of the byte
+template <int Bytes, typename T>
+static const BYTE *find_sync_word_sse2(const BYTE *p, const BYTE *end, T pattern, T mask)
+{
+  __m128i pat[Bytes], msk[Bytes];
+  for (int i = 0; i < Bytes; i++) {
+    const int shift = (Bytes - 1 - i) * 8;
+    pat[i] = _mm_set1_epi8((char)((pattern & mask) >> shift));
+    msk[i] = _mm_set1_epi8((char)(mask >> shift));
+  }
+
+  while (end - p >= 15 + Bytes) {
+    __m128i match = _mm_cmpeq_epi8(_mm_and_si128(_mm_loadu_si128((const __m128i *)p), msk[0]), pat[0]);
+    for (int i = 1; i < Bytes; i++)
+      match = _mm_and_si128(match, _mm_cmpeq_epi8(_mm_and_si128(_mm_loadu_si128((const __m128i *)(p + i)), msk[i]), pat[i]));
+
+    const int bits = _mm_movemask_epi8(match);
+    if (bits) {
+      unsigned long idx;
+      _BitScanForward(&idx, bits);
+      return p + idx;
+    }
+    p += 16;
+  }
+
+  for (; end - p >= Bytes; p++) {
+    T word = 0;
+    for (int i = 0; i < Bytes; i++)
+      word = (T)((word << 8) | p[i]);
+    if ((word & mask) == (pattern & mask))
+      return p;
+  }
+
+  return end;
+}
+
+const BYTE *FindSyncWord16(const BYTE *p, const BYTE *end, uint16_t pattern, uint16_t mask)
+{
+  return find_sync_word_sse2<2, uint16_t>(p, end, pattern, mask);
+}
+
+const BYTE *FindSyncWord32(const BYTE *p, const BYTE *end, uint32_t pattern, uint32_t mask)
+{
+  return find_sync_word_sse2<4, uint32_t>(p, end, pattern, mask);
+}
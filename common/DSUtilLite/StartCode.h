@@ -0,0 +1,36 @@
+/*
+ *      Copyright (C) 2010-2019 Hendrik Leppkes
+ *      http://www.1f0.de
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program; if not, write to the Free Software Foundation, Inc.,
+ *  51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#pragma once
+
+// Find the next 00 00 01 start code in the range [p, end)
+// Returns a pointer to the first byte of the start code, or end if there is none.
+// Only start codes which are fully contained in the range are found.
+const BYTE *FindAnnexBStartCode(const BYTE *p, const BYTE *end);
+
+// Find the next big-endian 16 or 32-bit sync word in the range [p, end), for which (word & mask) == (pattern & mask)
+// Returns a pointer to the first byte of the sync word, or end if there is none.
+// Only sync words which are fully contained in the range are found.
+const BYTE *FindSyncWord16(const BYTE *p, const BYTE *end, uint16_t pattern, uint16_t mask = 0xffff);
+const BYTE *FindSyncWord32(const BYTE *p, const BYTE *end, uint32_t pattern, uint32_t mask = 0xffffffff);
+
+// Implementations, FindAnnexBStartCode picks the fastest one for the CPU
+const BYTE *find_start_code_c(const BYTE *p, const BYTE *end);
+const BYTE *find_start_code_sse2(const BYTE *p, const BYTE *end);
+const BYTE *find_start_code_avx2(const BYTE *p, const BYTE *end);
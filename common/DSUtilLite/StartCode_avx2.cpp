@@ -0,0 +1,47 @@
+/*
+ *      Copyright (C) 2010-2019 Hendrik Leppkes
+ *      http://www.1f0.de
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program; if not, write to the Free Software Foundation, Inc.,
+ *  51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#include "stdafx.h"
+#include "StartCode.h"
+
+#include <immintrin.h>
+
+const BYTE *find_start_code_avx2(const BYTE *p, const BYTE *end)
+{
+  const __m256i zero = _mm256_setzero_si256();
+  const __m256i one = _mm256_set1_epi8(1);
+
+  // Compare 32 positions at once, the loads at p+1 and p+2 need 34 bytes
+  while (end - p >= 34) {
+    const __m256i b0 = _mm256_loadu_si256((const __m256i *)(p + 0));
+    const __m256i b1 = _mm256_loadu_si256((const __m256i *)(p + 1));
+    const __m256i b2 = _mm256_loadu_si256((const __m256i *)(p + 2));
+    const __m256i match = _mm256_and_si256(_mm256_and_si256(_mm256_cmpeq_epi8(b0, zero), _mm256_cmpeq_epi8(b1, zero)), _mm256_cmpeq_epi8(b2, one));
+
+    const unsigned mask = (unsigned)_mm256_movemask_epi8(match);
+    if (mask) {
+      unsigned long idx;
+      _BitScanForward(&idx, mask);
+      return p + idx;
+    }
+    p += 32;
+  }
+
+  return find_start_code_sse2(p, end);
+}
@@ -0,0 +1,75 @@
+/*
+ *      Copyright (C) 2010-2019 Hendrik Leppkes
+ *      http://www.1f0.de
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program; if not, write to the Free Software Foundation, Inc.,
+ *  51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+
+#include "stdafx.h"
+#include "ThreadPriority.h"
+
+typedef HANDLE (WINAPI *PFN_AV_SET_MM_THREAD_CHARACTERISTICS)(LPCWSTR TaskName, LPDWORD TaskIndex);
+typedef BOOL (WINAPI *PFN_AV_REVERT_MM_THREAD_CHARACTERISTICS)(HANDLE AvrtHandle);
+
+static const LPCWSTR s_MMCSSTasks[] = {
+  nullptr,              // ThreadClass_Background
+  L"Playback",          // ThreadClass_Playback
+  L"Audio",             // ThreadClass_Audio
+  L"Pro Audio",         // ThreadClass_ProAudio
+  L"Capture",           // ThreadClass_Capture
+};
+
+struct AvrtFunctions {
+  PFN_AV_SET_MM_THREAD_CHARACTERISTICS    mAvSetMmThreadCharacteristicsW;
+  PFN_AV_REVERT_MM_THREAD_CHARACTERISTICS mAvRevertMmThreadCharacteristics;
+};
+
+// avrt.dll is loaded on first use, and stays loaded for the lifetime of the process
+static const AvrtFunctions *avrt_functions()
+{
+  static const AvrtFunctions avrt = []() {
+    AvrtFunctions fn = { nullptr, nullptr };
+    HMODULE hAvrt = LoadLibrary(L"avrt.dll");
+    if (hAvrt) {
+      fn.mAvSetMmThreadCharacteristicsW = (PFN_AV_SET_MM_THREAD_CHARACTERISTICS)GetProcAddress(hAvrt, "AvSetMmThreadCharacteristicsW");
+      fn.mAvRevertMmThreadCharacteristics = (PFN_AV_REVERT_MM_THREAD_CHARACTERISTICS)GetProcAddress(hAvrt, "AvRevertMmThreadCharacteristics");
+    }
+    return fn;
+  }();
+  return &avrt;
+}
+
+CStreamingThreadPriority::CStreamingThreadPriority(StreamingThreadClass threadClass, BOOL bEnabled)
+{
+  if (!bEnabled || threadClass < 0 || threadClass >= countof(s_MMCSSTasks) || s_MMCSSTasks[threadClass] == nullptr)
+    return;
+
+  const AvrtFunctions *avrt = avrt_functions();
+  if (avrt->mAvSetMmThreadCharacteristicsW == nullptr || avrt->mAvRevertMmThreadCharacteristics == nullptr)
+    return;
+
+  DWORD dwTaskIndex = 0;
+  m_hTask = avrt->mAvSetMmThreadCharacteristicsW(s_MMCSSTasks[threadClass], &dwTaskIndex);
+  if (m_hTask == nullptr) {
+    DbgLog((LOG_ERROR, 10, L"CStreamingThreadPriority: Registering for MMCSS task '%s' failed (error: %u)", s_MMCSSTasks[threadClass], GetLastError()));
+  }
+}
+
+CStreamingThreadPriority::~CStreamingThreadPriority()
+{
+  if (m_hTask)
+    avrt_functions()->mAvRevertMmThreadCharacteristics(m_hTask);
+}
@@ -0,0 +1,48 @@
+/*
+ *      Copyright (C) 2010-2019 Hendrik Leppkes
+ *      http://www.1f0.de
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program; if not, write to the Free Software Foundation, Inc.,
+ *  51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+
+#pragma once
+
+// Thread priority policy of the streaming threads
+//
+// Streaming threads register with the Multimedia Class Scheduler Service (MMCSS) for the task matching their
+// work, so background load on a busy machine doesn't preempt them. Background work keeps the normal priority.
+
+typedef enum {
+  ThreadClass_Background,       ///< Prefetching and index building, normal priority
+  ThreadClass_Playback,         ///< Demuxing, and delivery of video and subtitles
+  ThreadClass_Audio,            ///< Delivery of audio
+  ThreadClass_ProAudio,         ///< Delivery of audio when latency matters
+  ThreadClass_Capture,          ///< Reading live sources
+} StreamingThreadClass;
+
+// Registers the calling thread for the MMCSS task of its class, while the object is alive
+// The object has to be destroyed on the same thread, usually it lives on the stack of the thread procedure.
+class CStreamingThreadPriority
+{
+public:
+  CStreamingThreadPriority(StreamingThreadClass threadClass, BOOL bEnabled = TRUE);
+  ~CStreamingThreadPriority();
+
+  BOOL IsRegistered() const { return m_hTask != nullptr; }
+
+private:
+  HANDLE m_hTask = nullptr;
+};
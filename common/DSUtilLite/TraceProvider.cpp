@@ -0,0 +1,33 @@
+/*
+ *      Copyright (C) 2010-2019 Hendrik Leppkes
+ *      http://www.1f0.de
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program; if not, write to the Free Software Foundation, Inc.,
+ *  51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+
+#include "stdafx.h"
+#include "TraceProvider.h"
+
+// {936C163F-645F-44EA-B017-0AB70A7228E7}
+TRACELOGGING_DEFINE_PROVIDER(g_hLAVTraceProvider, "LAVFilters",
+  (0x936c163f, 0x645f, 0x44ea, 0xb0, 0x17, 0x0a, 0xb7, 0x0a, 0x72, 0x28, 0xe7));
+
+// Every module using the provider is linked with this object, which registers the provider once the module is
+// loaded, and unregisters it before it is unloaded
+static struct TraceProviderRegistration {
+  TraceProviderRegistration() { TraceLoggingRegister(g_hLAVTraceProvider); }
+  ~TraceProviderRegistration() { TraceLoggingUnregister(g_hLAVTraceProvider); }
+} s_TraceProviderRegistration;
@@ -0,0 +1,49 @@
+/*
+ *      Copyright (C) 2010-2019 Hendrik Leppkes
+ *      http://www.1f0.de
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program; if not, write to the Free Software Foundation, Inc.,
+ *  51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+
+#pragma once
+
+// Event Tracing for Windows provider of all LAV Filters
+//
+// Events are written with TraceLogging, which describes them in the events themselves, so no manifest has to be
+// installed to decode a trace. While no session listens to the provider, writing an event only tests one flag,
+// and its arguments are not evaluated.
+//
+// Provider name "LAVFilters", GUID {936C163F-645F-44EA-B017-0AB70A7228E7}, for example:
+//   wpr -start lav.wprp / tracelog -start lav -guid #936C163F-645F-44EA-B017-0AB70A7228E7 -f lav.etl
+
+#include <TraceLoggingProvider.h>
+
+TRACELOGGING_DECLARE_PROVIDER(g_hLAVTraceProvider);
+
+// Keywords to select the filters of interest in a trace session
+#define LAV_TRACE_KEYWORD_SPLITTER  0x1
+#define LAV_TRACE_KEYWORD_VIDEO     0x2
+#define LAV_TRACE_KEYWORD_AUDIO     0x4
+#define LAV_TRACE_KEYWORD_SUBTITLE  0x8
+
+// Write an event with the fields given as TraceLogging macros
+// Decoding begin and end are separate events, the duration is taken from the timestamps of the trace.
+#define LAV_TRACE(name, keyword, ...)                              \
+  TraceLoggingWrite(g_hLAVTraceProvider, name,                      \
+                    TraceLoggingLevel(WINEVENT_LEVEL_VERBOSE),      \
+                    TraceLoggingKeyword(keyword), __VA_ARGS__)
+
+#define LAV_TRACE_ENABLED(keyword) TraceLoggingProviderEnabled(g_hLAVTraceProvider, WINEVENT_LEVEL_VERBOSE, keyword)
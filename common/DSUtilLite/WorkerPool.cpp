@@ -0,0 +1,148 @@
+/*
+ *      Copyright (C) 2010-2019 Hendrik Leppkes
+ *      http://www.1f0.de
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program; if not, write to the Free Software Foundation, Inc.,
+ *  51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+
+#include "stdafx.h"
+#include "WorkerPool.h"
+
+static const LONG s_PriorityWeight[] = { 1, 2, 4 };
+
+// Sum of the weights of all registered budgets
+static volatile LONG s_TotalWeight = 0;
+
+class CWorkerPool
+{
+public:
+  CWorkerPool()
+  {
+    SYSTEM_INFO si;
+    GetSystemInfo(&si);
+    m_nThreads = max(1, (int)si.dwNumberOfProcessors);
+
+    InitializeThreadpoolEnvironment(&m_Environment);
+    m_pPool = CreateThreadpool(nullptr);
+    if (m_pPool) {
+      SetThreadpoolThreadMaximum(m_pPool, m_nThreads);
+      SetThreadpoolCallbackPool(&m_Environment, m_pPool);
+    }
+  }
+
+  ~CWorkerPool()
+  {
+    if (m_pPool)
+      CloseThreadpool(m_pPool);
+    DestroyThreadpoolEnvironment(&m_Environment);
+  }
+
+  int                  m_nThreads = 1;
+  PTP_POOL             m_pPool    = nullptr;
+  TP_CALLBACK_ENVIRON  m_Environment;
+};
+
+static CWorkerPool &worker_pool()
+{
+  static CWorkerPool pool;
+  return pool;
+}
+
+typedef struct {
+  const std::function<void(int, int)> *fn;
+  LONG          nJobs;
+  volatile LONG nNextJob;
+  volatile LONG nNextThread;
+} WorkerPoolRun;
+
+static void worker_pool_run_jobs(WorkerPoolRun *run, int thread)
+{
+  LONG job = 0;
+  while ((job = InterlockedIncrement(&run->nNextJob) - 1) < run->nJobs)
+    (*run->fn)(job, thread);
+}
+
+static VOID CALLBACK worker_pool_callback(PTP_CALLBACK_INSTANCE pInstance, PVOID pContext, PTP_WORK pWork)
+{
+  WorkerPoolRun *run = (WorkerPoolRun *)pContext;
+
+  // the calling thread is thread 0
+  worker_pool_run_jobs(run, InterlockedIncrement(&run->nNextThread));
+}
+
+int worker_pool_threads()
+{
+  return worker_pool().m_nThreads;
+}
+
+void worker_pool_run(int nJobs, int nThreads, const std::function<void(int job, int thread)> &fn)
+{
+  if (nJobs <= 0)
+    return;
+
+  CWorkerPool &pool = worker_pool();
+  nThreads = min(nThreads, min(nJobs, pool.m_nThreads));
+
+  WorkerPoolRun run = { &fn, nJobs, 0, 0 };
+
+  PTP_WORK pWork = nullptr;
+  if (nThreads > 1 && pool.m_pPool)
+    pWork = CreateThreadpoolWork(worker_pool_callback, &run, &pool.m_Environment);
+
+  if (pWork == nullptr) {
+    worker_pool_run_jobs(&run, 0);
+    return;
+  }
+
+  for (int i = 1; i < nThreads; i++)
+    SubmitThreadpoolWork(pWork);
+
+  worker_pool_run_jobs(&run, 0);
+
+  // callbacks which did not start yet would find no jobs left, so they are cancelled
+  WaitForThreadpoolWorkCallbacks(pWork, TRUE);
+  CloseThreadpoolWork(pWork);
+}
+
+CWorkerBudget::CWorkerBudget(WorkerPriority priority)
+  : m_Priority(priority)
+{
+  InterlockedExchangeAdd(&s_TotalWeight, s_PriorityWeight[m_Priority]);
+}
+
+CWorkerBudget::~CWorkerBudget()
+{
+  InterlockedExchangeAdd(&s_TotalWeight, -s_PriorityWeight[m_Priority]);
+}
+
+void CWorkerBudget::SetPriority(WorkerPriority priority)
+{
+  if (priority == m_Priority)
+    return;
+
+  InterlockedExchangeAdd(&s_TotalWeight, s_PriorityWeight[priority] - s_PriorityWeight[m_Priority]);
+  m_Priority = priority;
+}
+
+int CWorkerBudget::GetThreads() const
+{
+  const LONG weight = s_PriorityWeight[m_Priority];
+  const LONG total = max(weight, s_TotalWeight);
+  const int nThreads = worker_pool_threads();
+
+  // rounded up, so every stream gets at least one thread
+  return max(1, (int)((nThreads * weight + total - 1) / total));
+}
@@ -0,0 +1,58 @@
+/*
+ *      Copyright (C) 2010-2019 Hendrik Leppkes
+ *      http://www.1f0.de
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program; if not, write to the Free Software Foundation, Inc.,
+ *  51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+
+#pragma once
+
+#include <functional>
+
+// Pool of worker threads, shared by all filter instances in the module
+//
+// All parallel work of the instances runs on one set of threads, at most one per logical processor,
+// so many decoders in one process don't oversubscribe the CPU. The calling thread always takes part
+// in its own work, so the work completes even while the pool threads are busy with other instances.
+
+typedef enum {
+  WorkerPriority_Low,
+  WorkerPriority_Normal,
+  WorkerPriority_High,
+} WorkerPriority;
+
+// Number of threads in the pool
+int worker_pool_threads();
+
+// Run fn(job, thread) for every job in [0, nJobs), on at most nThreads threads, and wait for all of them
+// Every thread has its own index below nThreads, and the jobs are started in increasing order.
+void worker_pool_run(int nJobs, int nThreads, const std::function<void(int job, int thread)> &fn);
+
+// Share of the pool threads for one stream, weighted by its priority against all registered streams
+class CWorkerBudget
+{
+public:
+  CWorkerBudget(WorkerPriority priority = WorkerPriority_Normal);
+  ~CWorkerBudget();
+
+  void SetPriority(WorkerPriority priority);
+
+  // Number of threads the stream should use, at least one
+  int GetThreads() const;
+
+private:
+  WorkerPriority m_Priority;
+};
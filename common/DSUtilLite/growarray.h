@@ -145,3 +145,108 @@ protected:
   DWORD   m_count      = 0;        // Nominal count.
   DWORD   m_allocated  = 0;        // Actual allocation size.
 };
+
+// Class template: Re-sizable array, which is consumed from the front.
+
+// Consume() only advances the start of the array, instead of moving the remaining data.
+// The data is moved back to the front of the allocation once the free space at the end
+// runs out, so appending and consuming small amounts does not move the data every time.
+// Allocate() always reserves the requested size behind the current start of the array.
+
+template <class T>
+class ConsumableArray
+{
+public:
+  ConsumableArray()
+  {
+  }
+
+  virtual ~ConsumableArray()
+  {
+    free(m_pArray);
+  }
+
+  // Allocate: Reserves memory for the array, but does not increase the count.
+  HRESULT Allocate(DWORD alloc)
+  {
+    if (m_offset + alloc <= m_allocated && m_pArray)
+      return S_OK;
+
+    // Move the data to the front, if that makes enough room
+    if (m_offset) {
+      memmove(m_pArray, m_pArray + m_offset, m_count * sizeof(T));
+      m_offset = 0;
+      if (alloc <= m_allocated)
+        return S_OK;
+    }
+
+    // Grow with some headroom, so compacting is only needed rarely
+    DWORD newAlloc = max(alloc, m_allocated + (m_allocated >> 1));
+    T *pNew = (T *)realloc(m_pArray, sizeof(T) * newAlloc);
+    if (!pNew) {
+      Clear();
+      return E_OUTOFMEMORY;
+    }
+    m_pArray = pNew;
+    ZeroMemory(m_pArray + m_allocated, (newAlloc - m_allocated) * sizeof(T));
+    m_allocated = newAlloc;
+    return S_OK;
+  }
+
+  HRESULT Clear()
+  {
+    free(m_pArray);
+    m_pArray = nullptr;
+    m_count = m_offset = m_allocated = 0;
+    return S_OK;
+  }
+
+  // SetSize: Changes the count, and grows the array if needed.
+  HRESULT SetSize(DWORD count)
+  {
+    HRESULT hr = S_OK;
+    if (m_offset + count > m_allocated)
+    {
+      hr = Allocate(count);
+    }
+    if (SUCCEEDED(hr))
+    {
+      m_count = count;
+    }
+    return hr;
+  }
+
+  HRESULT Append(const T *other, DWORD dwSize)
+  {
+    DWORD old = GetCount();
+    HRESULT hr = SetSize(old + dwSize);
+    if (SUCCEEDED(hr))
+      memcpy(m_pArray + m_offset + old, other, dwSize * sizeof(T));
+
+    return hr;
+  }
+
+  // Consume: Removes elements from the front of the array
+  void Consume(DWORD dwSize)
+  {
+    ASSERT(dwSize <= m_count);
+
+    m_count -= dwSize;
+    m_offset = m_count ? m_offset + dwSize : 0;
+  }
+
+  DWORD GetCount() const { return m_count; }
+  DWORD GetAllocated() const { return m_allocated; }
+
+  // Return the underlying array, starting at the first element not consumed yet.
+  T* Ptr() { return m_pArray ? m_pArray + m_offset : nullptr; }
+
+protected:
+  ConsumableArray& operator=(const ConsumableArray& r);
+  ConsumableArray(const ConsumableArray &r);
+
+  T       *m_pArray    = nullptr;
+  DWORD   m_offset     = 0;        // Start of the array in the allocation.
+  DWORD   m_count      = 0;        // Nominal count.
+  DWORD   m_allocated  = 0;        // Actual allocation size.
+};
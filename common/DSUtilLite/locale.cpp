@@ -526,43 +526,142 @@ static struct {LPCSTR name, iso6392, iso6391, iso6392_2; LCID lcid;} s_isolangs[
   {"No subtitles", "---", nullptr, nullptr, (LCID)LCID_NOSUBTITLES},
 };
 
-std::string ISO6391ToLanguage(LPCSTR code)
+// Index of the language table
+// Two and three letter codes map directly to a slot (letters, and '-' for the "---" entry), which makes a perfect hash
+// of all codes, and names are found through a small open-addressing table. The index is built once on first use, and
+// a lookup neither scans the table nor allocates. Slots hold the table index + 1, so that 0 is empty, and the first
+// entry of the table wins for codes and names used more than once, like the linear search did before.
+#define ISO_CODE_SYMBOLS 27
+#define ISO_NAME_SLOTS   1024
+
+static inline int iso_code_symbol(CHAR c)
 {
-  CHAR tmp[2+1];
-  strncpy_s(tmp, code, 2);
-  tmp[2] = 0;
-  _strlwr_s(tmp);
-  for(size_t i = 0, j = countof(s_isolangs); i < j; i++) {
-    if(s_isolangs[i].iso6391 && !strcmp(s_isolangs[i].iso6391, tmp))
-    {
-      std::string ret = std::string(s_isolangs[i].name);
-      size_t i = ret.find(';');
-      if(i != std::string::npos) {
-        ret = ret.substr(0, i);
-      }
-      return ret;
+  if (c >= 'a' && c <= 'z')
+    return c - 'a';
+  if (c >= 'A' && c <= 'Z')
+    return c - 'A';
+  if (c == '-')
+    return 26;
+  return -1;
+}
+
+// Slot of the first len characters of the code, -1 if the code is shorter or contains other characters
+static int iso_code_slot(LPCSTR code, int len)
+{
+  int slot = 0;
+  for (int i = 0; i < len; i++) {
+    int symbol = iso_code_symbol(code[i]);
+    if (symbol < 0)
+      return -1;
+    slot = slot * ISO_CODE_SYMBOLS + symbol;
+  }
+  return slot;
+}
+
+// FNV-1a of the name, case-insensitive for ASCII like _stricmp
+static uint32_t iso_name_hash(LPCSTR name)
+{
+  uint32_t hash = 2166136261u;
+  for (; *name; name++) {
+    CHAR c = *name;
+    if (c >= 'A' && c <= 'Z')
+      c += 'a' - 'A';
+    hash = (hash ^ (uint8_t)c) * 16777619u;
+  }
+  return hash;
+}
+
+static struct ISOLangIndex {
+  uint16_t iso6391[ISO_CODE_SYMBOLS * ISO_CODE_SYMBOLS];
+  uint16_t iso6392[ISO_CODE_SYMBOLS * ISO_CODE_SYMBOLS * ISO_CODE_SYMBOLS];
+  uint16_t names[ISO_NAME_SLOTS];
+} s_isoindex;
+
+static_assert(countof(s_isolangs) < UINT16_MAX, "language table too large for the index");
+static_assert(countof(s_isolangs) * 2 <= ISO_NAME_SLOTS, "name index too small");
+
+static void AddCode(uint16_t *index, LPCSTR code, int len, uint16_t entry)
+{
+  if (!code || strlen(code) != (size_t)len)
+    return;
+  int slot = iso_code_slot(code, len);
+  if (slot >= 0 && index[slot] == 0)
+    index[slot] = entry;
+}
+
+static void BuildISOLangIndex()
+{
+  for (size_t i = 0, j = countof(s_isolangs); i < j; i++) {
+    uint16_t entry = (uint16_t)(i + 1);
+    AddCode(s_isoindex.iso6391, s_isolangs[i].iso6391, 2, entry);
+    AddCode(s_isoindex.iso6392, s_isolangs[i].iso6392, 3, entry);
+    AddCode(s_isoindex.iso6392, s_isolangs[i].iso6392_2, 3, entry);
+
+    if (s_isolangs[i].name) {
+      uint32_t slot = iso_name_hash(s_isolangs[i].name) & (ISO_NAME_SLOTS - 1);
+      while (s_isoindex.names[slot] && _stricmp(s_isolangs[s_isoindex.names[slot] - 1].name, s_isolangs[i].name))
+        slot = (slot + 1) & (ISO_NAME_SLOTS - 1);
+      if (s_isoindex.names[slot] == 0)
+        s_isoindex.names[slot] = entry;
     }
   }
+}
+
+static const ISOLangIndex &GetISOLangIndex()
+{
+  // initialization of a local static is thread-safe
+  static const bool built = (BuildISOLangIndex(), true);
+  (void)built;
+  return s_isoindex;
+}
+
+// Table entry of a code, or -1
+static int FindISO6391(LPCSTR code)
+{
+  int slot = iso_code_slot(code, 2);
+  return slot >= 0 ? GetISOLangIndex().iso6391[slot] - 1 : -1;
+}
+
+static int FindISO6392(LPCSTR code)
+{
+  int slot = iso_code_slot(code, 3);
+  return slot >= 0 ? GetISOLangIndex().iso6392[slot] - 1 : -1;
+}
+
+static int FindLanguage(LPCSTR name)
+{
+  const ISOLangIndex &index = GetISOLangIndex();
+  uint32_t slot = iso_name_hash(name) & (ISO_NAME_SLOTS - 1);
+  while (index.names[slot]) {
+    int i = index.names[slot] - 1;
+    if (!_stricmp(s_isolangs[i].name, name))
+      return i;
+    slot = (slot + 1) & (ISO_NAME_SLOTS - 1);
+  }
+  return -1;
+}
+
+// Name of a table entry, up to the first ';'
+static std::string LanguageName(int i)
+{
+  LPCSTR name = s_isolangs[i].name;
+  LPCSTR end = strchr(name, ';');
+  return end ? std::string(name, end - name) : std::string(name);
+}
+
+std::string ISO6391ToLanguage(LPCSTR code)
+{
+  int i = FindISO6391(code);
+  if (i >= 0)
+    return LanguageName(i);
   return std::string();
 }
 
 std::string ISO6392ToLanguage(LPCSTR code)
 {
-  CHAR tmp[3+1];
-  strncpy_s(tmp, code, 3);
-  tmp[3] = 0;
-  _strlwr_s(tmp);
-  for(size_t i = 0, j = countof(s_isolangs); i < j; i++) {
-    if((s_isolangs[i].iso6392 && !strcmp(s_isolangs[i].iso6392, tmp)) || (s_isolangs[i].iso6392_2 && !strcmp(s_isolangs[i].iso6392_2, tmp)))
-    {
-      std::string ret = std::string(s_isolangs[i].name);
-      size_t i = ret.find(';');
-      if(i != std::string::npos) {
-        ret = ret.substr(0, i);
-      }
-      return ret;
-    }
-  }
+  int i = FindISO6392(code);
+  if (i >= 0)
+    return LanguageName(i);
   return std::string();
 }
 
@@ -578,27 +677,22 @@ std::string ProbeLangForLanguage(LPCSTR code)
 
 static std::string ISO6392Check(LPCSTR lang)
 {
+  int i = FindISO6392(lang);
+  if (i >= 0)
+    return std::string(s_isolangs[i].iso6392);
+
   CHAR tmp[3+1];
   strncpy_s(tmp, lang, 3);
   tmp[3] = 0;
   _strlwr_s(tmp);
-  for(size_t i = 0, j = countof(s_isolangs); i < j; i++) {
-    if((s_isolangs[i].iso6392 && !strcmp(s_isolangs[i].iso6392, tmp)) || (s_isolangs[i].iso6392_2 && !strcmp(s_isolangs[i].iso6392_2, tmp)))
-    {
-      return std::string(s_isolangs[i].iso6392);
-    }
-  }
   return std::string(tmp);
 }
 
 static std::string LanguageToISO6392(LPCSTR code)
 {
-  for(size_t i = 0, j = countof(s_isolangs); i < j; i++) {
-    if((s_isolangs[i].name && !_stricmp(s_isolangs[i].name, code)))
-    {
-      return std::string(s_isolangs[i].iso6392);
-    }
-  }
+  int i = FindLanguage(code);
+  if (i >= 0)
+    return std::string(s_isolangs[i].iso6392);
   return std::string();
 }
 
@@ -612,7 +706,7 @@ std::string ProbeForISO6392(LPCSTR lang)
   } else if (strlen(lang) > 3) {
     isoLang = LanguageToISO6392(lang);
     if (isoLang.empty()) {
-      std::regex ogmRegex("\\[([[:alpha:]]{3})\\]");
+      static const std::regex ogmRegex("\\[([[:alpha:]]{3})\\]");
       std::cmatch res;
       bool found = std::regex_search(lang, res, ogmRegex);
       if (found && !res[1].str().empty()) {
@@ -627,59 +721,33 @@ std::string ProbeForISO6392(LPCSTR lang)
 
 LCID ISO6391ToLcid(LPCSTR code)
 {
-  CHAR tmp[2+1];
-  strncpy_s(tmp, code, 2);
-  tmp[2] = 0;
-  _strlwr_s(tmp);
-  for(size_t i = 0, j = countof(s_isolangs); i < j; i++) {
-    if(s_isolangs[i].iso6391 && !strcmp(s_isolangs[i].iso6391, tmp))
-    {
-      return s_isolangs[i].lcid;
-    }
-  }
+  int i = FindISO6391(code);
+  if (i >= 0)
+    return s_isolangs[i].lcid;
   return 0;
 }
 
 LCID ISO6392ToLcid(LPCSTR code)
 {
-  CHAR tmp[3+1];
-  strncpy_s(tmp, code, 3);
-  tmp[3] = 0;
-  _strlwr_s(tmp);
-  for(size_t i = 0, j = countof(s_isolangs); i < j; i++) {
-    if((s_isolangs[i].iso6392 && !strcmp(s_isolangs[i].iso6392, tmp)) || (s_isolangs[i].iso6392_2 && !strcmp(s_isolangs[i].iso6392_2, tmp)))
-    {
-      return s_isolangs[i].lcid;
-    }
-  }
+  int i = FindISO6392(code);
+  if (i >= 0)
+    return s_isolangs[i].lcid;
   return 0;
 }
 
 std::string ISO6391To6392(LPCSTR code)
 {
-  CHAR tmp[2+1];
-  strncpy_s(tmp, code, 2);
-  tmp[2] = 0;
-  _strlwr_s(tmp);
-  for(size_t i = 0, j = countof(s_isolangs); i < j; i++) {
-    if(s_isolangs[i].iso6391 && !strcmp(s_isolangs[i].iso6391, tmp)) {
-      return s_isolangs[i].iso6392;
-    }
-  }
+  int i = FindISO6391(code);
+  if (i >= 0)
+    return s_isolangs[i].iso6392;
   return std::string(code);
 }
 
 std::string ISO6392To6391(LPCSTR code)
 {
-  CHAR tmp[3+1];
-  strncpy_s(tmp, code, 3);
-  tmp[3] = 0;
-  _strlwr_s(tmp);
-  for(size_t i = 0, j = countof(s_isolangs); i < j; i++) {
-    if((s_isolangs[i].iso6392 && !strcmp(s_isolangs[i].iso6392, tmp)) || (s_isolangs[i].iso6392_2 && !strcmp(s_isolangs[i].iso6392_2, tmp))) {
-      return s_isolangs[i].iso6391;
-    }
-  }
+  int i = FindISO6392(code);
+  if (i >= 0 && s_isolangs[i].iso6391)
+    return s_isolangs[i].iso6391;
   return std::string();
 }
 
@@ -20,6 +20,10 @@
 #include "stdafx.h"
 #include "registry.h"
 
+#ifndef REG_NOTIFY_THREAD_AGNOSTIC
+#define REG_NOTIFY_THREAD_AGNOSTIC 0x10000000L
+#endif
+
 bool CreateRegistryKey(HKEY hKeyRoot, LPCTSTR pszSubKey)
 {
   HKEY hKey;
@@ -228,3 +232,60 @@ HRESULT CRegistry::DeleteKey(LPCTSTR pszKey)
   }
   return S_OK;
 }
+
+CRegistryChangeWatch::CRegistryChangeWatch(HKEY hkeyRoot, LPCTSTR pszSubKey, BOOL b64Bit)
+  : m_hkeyRoot(hkeyRoot), m_SubKey(pszSubKey)
+{
+  m_samFlags = KEY_NOTIFY;
+  if (b64Bit) m_samFlags |= KEY_WOW64_64KEY;
+  m_hEvent = CreateEvent(nullptr, TRUE, FALSE, nullptr);
+}
+
+CRegistryChangeWatch::~CRegistryChangeWatch()
+{
+  if (m_hKey)
+    RegCloseKey(m_hKey);
+  if (m_hEvent)
+    CloseHandle(m_hEvent);
+}
+
+BOOL CRegistryChangeWatch::Arm()
+{
+  if (m_hKey) {
+    RegCloseKey(m_hKey);
+    m_hKey = nullptr;
+  }
+
+  if (m_hEvent == nullptr)
+    return FALSE;
+
+  // open the key, or the closest parent that exists, to get notified when the key is created
+  std::wstring key = m_SubKey;
+  BOOL bExists = TRUE;
+  while (RegOpenKeyEx(m_hkeyRoot, key.c_str(), 0, m_samFlags, &m_hKey) != ERROR_SUCCESS) {
+    m_hKey = nullptr;
+    bExists = FALSE;
+
+    size_t pos = key.find_last_of(L'\\');
+    if (pos == std::wstring::npos || pos == 0)
+      return FALSE;
+    key.resize(pos);
+  }
+
+  ResetEvent(m_hEvent);
+
+  // The notification has to outlive the calling thread, which needs REG_NOTIFY_THREAD_AGNOSTIC (Windows 8 and newer).
+  // Older systems reject the flag, and the key is then considered changed on every call.
+  LONG lRet = RegNotifyChangeKeyValue(m_hKey, bExists, REG_NOTIFY_CHANGE_NAME | REG_NOTIFY_CHANGE_LAST_SET | REG_NOTIFY_THREAD_AGNOSTIC, m_hEvent, TRUE);
+  return (lRet == ERROR_SUCCESS);
+}
+
+BOOL CRegistryChangeWatch::HasChanged()
+{
+  if (m_bArmed && WaitForSingleObject(m_hEvent, 0) == WAIT_TIMEOUT)
+    return FALSE;
+
+  // re-arm before the caller reads the key, so no change gets lost in between
+  m_bArmed = Arm();
+  return TRUE;
+}
@@ -49,3 +49,62 @@ public:
 private:
   HKEY *m_key = nullptr;
 };
+
+// Watches a registry key and its subkeys for changes
+// If the key does not exist, its parent is watched for the key being created instead.
+class CRegistryChangeWatch
+{
+public:
+  CRegistryChangeWatch(HKEY hkeyRoot, LPCTSTR pszSubKey, BOOL b64Bit = TRUE);
+  ~CRegistryChangeWatch();
+
+  // TRUE on the first call, if the key changed since the previous call, or if the key can't be watched
+  BOOL HasChanged();
+
+private:
+  BOOL Arm();
+
+  HKEY         m_hkeyRoot = nullptr;
+  std::wstring m_SubKey;
+  REGSAM       m_samFlags = 0;
+
+  HKEY   m_hKey   = nullptr;
+  HANDLE m_hEvent = nullptr;
+  BOOL   m_bArmed = FALSE;
+};
+
+// Process-wide copy of filter settings read from the machine and user registry keys
+// Filters are created many times while a graph is built, so the settings are only read again after one of the keys changed.
+template <class T>
+class CRegistrySettingsCache
+{
+public:
+  CRegistrySettingsCache(LPCTSTR pszSubKey)
+    : m_WatchMachine(HKEY_LOCAL_MACHINE, pszSubKey), m_WatchUser(HKEY_CURRENT_USER, pszSubKey) {}
+
+  // Fill the settings from the cache, or call the read function to update them and the cache
+  template <class ReadFn>
+  HRESULT Load(T &settings, ReadFn read)
+  {
+    CAutoLock lock(&m_csCache);
+
+    // both watches have to be re-armed, so no short-circuit evaluation
+    if ((m_WatchMachine.HasChanged() | m_WatchUser.HasChanged()) || !m_bValid) {
+      m_hrRead = read();
+      m_Settings = settings;
+      m_bValid = TRUE;
+    } else {
+      settings = m_Settings;
+    }
+    return m_hrRead;
+  }
+
+private:
+  CCritSec             m_csCache;
+  CRegistryChangeWatch m_WatchMachine;
+  CRegistryChangeWatch m_WatchUser;
+
+  T       m_Settings;
+  HRESULT m_hrRead = E_FAIL;
+  BOOL    m_bValid = FALSE;
+};
@@ -17,8 +17,23 @@
  *  51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
  */
 
+#pragma once
+
 #include <intrin.h>
 
+// Current value of the performance counter, in 100ns units
+// Cheap enough to be used for always-on measurements
+static inline LONGLONG timer_get_ref_time()
+{
+  static LARGE_INTEGER frequency = { 0 };
+  if (frequency.QuadPart == 0)
+    QueryPerformanceFrequency(&frequency);
+
+  LARGE_INTEGER counter;
+  QueryPerformanceCounter(&counter);
+  return (counter.QuadPart / frequency.QuadPart) * 10000000LL + (counter.QuadPart % frequency.QuadPart) * 10000000LL / frequency.QuadPart;
+}
+
 #define START_TIMER                           \
   uint64_t tend;                              \
   uint64_t tstart = __rdtsc();                \
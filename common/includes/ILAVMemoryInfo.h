@@ -0,0 +1,54 @@
+/*
+ *      Copyright (C) 2010-2019 Hendrik Leppkes
+ *      http://www.1f0.de
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program; if not, write to the Free Software Foundation, Inc.,
+ *  51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+
+#pragma once
+
+// Categories of the memory used by the LAV Filters
+typedef enum LAVMemoryCategory {
+  LAVMemory_PacketQueue = 0,    // Packets queued on the output pins of the splitter
+  LAVMemory_Samples,            // Packets referenced by media samples of the splitter, until downstream releases them
+  LAVMemory_FrameBuffers,       // Decoded video frames in system memory
+  LAVMemory_ConversionBuffers,  // Intermediate buffers of the video pixel format conversion
+  LAVMemory_HWSurfaces,         // Surfaces of the hardware decoders, estimated from their format and dimensions
+  LAVMemory_AudioBuffers,       // Input and output buffers of the audio decoder
+  LAVMemory_Subtitles,          // Subtitle bitmaps rendered by LAV Video
+  LAVMemory_Total,              // All of the above
+  LAVMemory_NB                  // Number of categories, not a valid category
+} LAVMemoryCategory;
+
+typedef struct LAVMemoryUsage {
+  ULONGLONG nCurrent;           // Bytes in use right now
+  ULONGLONG nPeak;              // Most bytes in use at once, since creation or the last reset of the peak
+} LAVMemoryUsage;
+
+// Memory accounting interface, implemented by LAV Splitter, LAV Video and LAV Audio
+// The process-wide usage covers all instances of all LAV Filters in the process, and also includes
+// memory kept in shared pools for re-use, which is not held by any instance.
+interface __declspec(uuid("C25CDF78-DB5F-4A9B-A6F2-FC75F312EDBC")) ILAVMemoryInfo : public IUnknown
+{
+  // Get the memory used by this filter instance
+  STDMETHOD(GetMemoryUsage)(LAVMemoryCategory category, LAVMemoryUsage *pUsage) = 0;
+
+  // Get the memory used by the LAV Filters in the whole process
+  STDMETHOD(GetProcessMemoryUsage)(LAVMemoryCategory category, LAVMemoryUsage *pUsage) = 0;
+
+  // Reset the peaks of this filter instance to the current usage
+  STDMETHOD(ResetPeakMemoryUsage)() = 0;
+};
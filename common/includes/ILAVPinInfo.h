@@ -30,6 +30,7 @@ interface __declspec(uuid("FD220BF4-3F26-4AD4-A4A9-348C1273A141")) ILAVPinInfo :
 #define LAV_STREAM_FLAG_ONLY_DTS  0x0000001 ///< Stream has only DTS timestamps (AVI, MKV in MS-Compat mode)
 #define LAV_STREAM_FLAG_RV34_MKV  0x0000002 ///< RV30/40 in MKV or similar container with horrible timstamps
 #define LAV_STREAM_FLAG_LIVE      0x0000004 ///< Stream is from a Live source
+#define LAV_STREAM_FLAG_PARSED    0x0000008 ///< Stream was parsed into complete frames by the splitter, every sample holds one frame
 
   // Get the pixel format detected for this video stream
   STDMETHOD_(int,GetPixelFormat)() PURE;
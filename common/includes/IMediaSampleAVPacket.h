@@ -0,0 +1,34 @@
+/*
+ *      Copyright (C) 2010-2019 Hendrik Leppkes
+ *      http://www.1f0.de
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program; if not, write to the Free Software Foundation, Inc.,
+ *  51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#pragma once
+
+extern "C" {
+#include "libavcodec/avcodec.h"
+}
+
+// Exposed by media samples which are backed by a ref-counted AVPacket.
+// Only usable between filters linked against the same FFmpeg build, hence not part of the public interfaces.
+interface __declspec(uuid("0CFD45A9-EA23-4BDC-A764-629F5712F297")) IMediaSampleAVPacket : public IUnknown
+{
+  // Create a new reference to the packet backing this sample in pPacket, including its side data
+  // The payload is padded with AV_INPUT_BUFFER_PADDING_SIZE and can be passed to avcodec without copying.
+  // Only data, size, buf, flags and side data are meaningful, timestamps should be taken from the sample.
+  STDMETHOD(GetAVPacketRef)(AVPacket *pPacket) PURE;
+};
@@ -156,3 +156,72 @@ DEFINE_GUID(IID_MediaSideDataEIA608CC,
   0x40fefd7f, 0x85dd, 0x4335, 0xa8, 0x4, 0x8a, 0x33, 0xb0, 0xbf, 0x7b, 0x81);
 
 // There is no struct definition. The data is supplied as a list of 3 byte CC data packets (control byte + cc_data1/2)
+
+// -----------------------------------------------------------------
+// Capture Time Side Data
+// -----------------------------------------------------------------
+
+// {AF7C0E38-0AFF-4C08-8DB6-8CA930EE4D6D}
+DEFINE_GUID(IID_MediaSideDataCaptureTime,
+  0xaf7c0e38, 0xaff, 0x4c08, 0x8d, 0xb6, 0x8c, 0xa9, 0x30, 0xee, 0x4d, 0x6d);
+
+#pragma pack(push, 1)
+struct MediaSideDataCaptureTime
+{
+  // Time the data was read from the source, in 100ns units of the performance counter (QueryPerformanceCounter)
+  // Only comparable to other performance counter readings on the same system
+  LONGLONG rtCapture;
+};
+#pragma pack(pop)
+
+// -----------------------------------------------------------------
+// AV1 Film Grain Side Data
+// -----------------------------------------------------------------
+
+// {FA9F0C4A-7FB9-43FE-A208-0330102CDB13}
+DEFINE_GUID(IID_MediaSideDataAV1FilmGrain,
+  0xfa9f0c4a, 0x7fb9, 0x43fe, 0xa2, 0x8, 0x3, 0x30, 0x10, 0x2c, 0xdb, 0x13);
+
+#pragma pack(push, 1)
+// Film grain parameters of one AV1 frame, for grain the decoder did not apply itself
+// Refer to section 6.8.20 of the AV1 specification for the meaning of the fields, and to section 7.18.3 for the synthesis
+//
+// The values are already resolved for the frame (update_grain is applied), and the offsets of the syntax elements are removed:
+// the auto-regressive coefficients and the chroma multipliers are signed, the chroma offsets are in the range of -256 - 255,
+// grain_scaling is grain_scaling_minus_8 + 8, and ar_coeff_shift is ar_coeff_shift_minus_6 + 6
+struct MediaSideDataAV1FilmGrain
+{
+  // bit depth and matrix coefficients (ITU-T H.273) of the video the parameters apply to
+  unsigned int bit_depth;
+  unsigned int matrix_coefficients;
+
+  unsigned int grain_seed;
+
+  unsigned int num_y_points;
+  unsigned char y_points[14][2];          // value, scaling
+
+  unsigned int chroma_scaling_from_luma;
+  unsigned int num_cb_points;
+  unsigned char cb_points[10][2];         // value, scaling
+  unsigned int num_cr_points;
+  unsigned char cr_points[10][2];         // value, scaling
+
+  unsigned int grain_scaling;
+  unsigned int ar_coeff_lag;
+  signed char ar_coeffs_y[24];
+  signed char ar_coeffs_cb[25];
+  signed char ar_coeffs_cr[25];
+  unsigned int ar_coeff_shift;
+  unsigned int grain_scale_shift;
+
+  int cb_mult;
+  int cb_luma_mult;
+  int cb_offset;
+  int cr_mult;
+  int cr_luma_mult;
+  int cr_offset;
+
+  unsigned int overlap_flag;
+  unsigned int clip_to_restricted_range;
+};
+#pragma pack(pop)
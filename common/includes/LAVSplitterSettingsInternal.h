@@ -45,7 +45,12 @@ interface __declspec(uuid("72b2c5fa-a7a5-4463-9c1b-9f4749c35c79")) ILAVFSettings
   STDMETHOD_(BOOL,IsVC1CorrectionRequired)() = 0;
 
   STDMETHOD_(LPCSTR, GetInputFormat)() = 0;
-  STDMETHOD_(std::set<FormatInfo>&, GetInputFormats)() = 0;
+  STDMETHOD_(const std::set<FormatInfo>&, GetInputFormats)() = 0;
   STDMETHOD_(CMediaType *, GetOutputMediatype)(int stream) = 0;
   STDMETHOD_(IFilterGraph *, GetFilterGraph)() = 0;
+
+  // Sizes in effect, with the limits of the low footprint profile applied, in MB
+  STDMETHOD_(DWORD, GetSharedBlockCacheLimit)() = 0;
+  STDMETHOD_(DWORD, GetPreBufferLimit)() = 0;
+  STDMETHOD_(DWORD, GetNetworkReceiveBufferLimit)() = 0;
 };
@@ -107,12 +107,10 @@ HRESULT CLAVAudio::CreateBitstreamContext(AVCodecID codec, WAVEFORMATEX *wfe)
   // DTS-HD is by default off, unless explicitly asked for
   if (m_settings.DTSHDFraming && m_settings.bBitstream[Bitstream_DTSHD] && !m_bForceDTSCore) {
     m_DTSBitstreamMode = DTS_HDMA;
-    av_opt_set_int(m_avBSContext->priv_data, "dtshd_rate", LAV_BITSTREAM_DTS_HD_MA_RATE, 0);
   } else {
     m_DTSBitstreamMode = DTS_Core;
-    av_opt_set_int(m_avBSContext->priv_data, "dtshd_rate", 0, 0);
   }
-  av_opt_set_int(m_avBSContext->priv_data, "dtshd_fallback_time", -1, 0);
+  m_bDTSHDCoreOnly = FALSE;
 
   AVStream *st = avformat_new_stream(m_avBSContext, 0);
   if (!st) {
@@ -165,10 +163,8 @@ HRESULT CLAVAudio::UpdateBitstreamContext()
   if(m_avBSContext) {
     if (m_settings.bBitstream[Bitstream_DTSHD] && m_settings.DTSHDFraming && !m_bForceDTSCore) {
       m_DTSBitstreamMode = DTS_HDMA;
-      av_opt_set_int(m_avBSContext->priv_data, "dtshd_rate", LAV_BITSTREAM_DTS_HD_MA_RATE, 0);
     } else {
       m_DTSBitstreamMode = DTS_Core; // Force auto-detection
-      av_opt_set_int(m_avBSContext->priv_data, "dtshd_rate", 0, 0);
     }
   }
 
@@ -185,6 +181,8 @@ HRESULT CLAVAudio::FreeBitstreamContext()
 
   // Dump any remaining data
   m_bsOutput.SetSize(0);
+  SPDIFReset();
+  MATReset();
 
   // reset TrueHD MAT state
   memset(&m_TrueHDMATState, 0, sizeof(m_TrueHDMATState));
@@ -281,26 +279,29 @@ void CLAVAudio::ActivateDTSHDMuxing()
 
   // Check if downstream actually accepts it..
   const CMediaType &mt = CreateBitstreamMediaType(m_nCodecId, m_bsParser.m_dwSampleRate);
-  HRESULT hr = m_pOutput->GetConnected()->QueryAccept(&mt);
+  HRESULT hr = QueryAcceptOutput(mt);
   if (hr != S_OK) {
     DbgLog((LOG_TRACE, 20, L"-> But downstream doesn't want DTS-HD, sticking to DTS core"));
     m_DTSBitstreamMode = DTS_Core;
     m_bForceDTSCore = TRUE;
-  } else {
-    av_opt_set_int(m_avBSContext->priv_data, "dtshd_rate", (m_DTSBitstreamMode == DTS_HDHR) ? LAV_BITSTREAM_DTS_HD_HR_RATE : LAV_BITSTREAM_DTS_HD_MA_RATE, 0);
   }
 }
 
+// Rate of the DTS type IV bursts for the DTS-HD mode, 0 sends the core in type I-III bursts
+DWORD CLAVAudio::GetDTSHDRate() const
+{
+  switch (m_DTSBitstreamMode) {
+  case DTS_HDHR: return LAV_BITSTREAM_DTS_HD_HR_RATE;
+  case DTS_HDMA: return LAV_BITSTREAM_DTS_HD_MA_RATE;
+  }
+  return 0;
+}
+
 HRESULT CLAVAudio::Bitstream(const BYTE *pDataBuffer, int buffsize, int &consumed, HRESULT *hrDeliver)
 {
   HRESULT hr = S_OK;
-  int ret = 0;
   BOOL bFlush = (pDataBuffer == nullptr);
 
-  AVPacket avpkt;
-  av_init_packet(&avpkt);
-  avpkt.duration = 1;
-
   consumed = 0;
   while (buffsize > 0) {
     if (bFlush) buffsize = 0;
@@ -356,29 +357,21 @@ HRESULT CLAVAudio::Bitstream(const BYTE *pDataBuffer, int buffsize, int &consume
             ActivateDTSHDMuxing();
         }
 
-        avpkt.data = pOut;
-        avpkt.size = pOut_size;
-
-        // Write SPDIF muxed frame
-        ret = av_write_frame(m_avBSContext, &avpkt);
-        if (ret < 0) {
-          DbgLog((LOG_ERROR, 20, "::Bitstream(): av_write_frame returned error code (%d)", -ret));
-          m_bsOutput.SetSize(0);
-          continue;
-        }
-
-        m_bUpdateTimeCache = TRUE;
-
-        // Set long-time cache to the first timestamp encountered, used by TrueHD and E-AC3 because the S/PDIF muxer caches data internally
+        // Set long-time cache to the first timestamp encountered, used by TrueHD and E-AC3 because several frames are sent in one burst
         // If the current timestamp is not valid, use the last delivery timestamp in m_rtStart
+        const REFERENCE_TIME rtBitstreamCache = m_rtBitstreamCache;
         if (m_rtBitstreamCache == AV_NOPTS_VALUE)
           m_rtBitstreamCache = m_rtStartInputCache != AV_NOPTS_VALUE ? m_rtStartInputCache : m_rtStart;
 
-        // Deliver frame
-        if (m_bsOutput.GetCount() > 0) {
-          *hrDeliver = DeliverBitstream(m_nCodecId, m_bsOutput.Ptr(), m_bsOutput.GetCount(), m_rtStartInputCache, m_rtStopInputCache);
-          m_bsOutput.SetSize(0);
+        // Pack the frame into an IEC 61937 burst, which is delivered once complete
+        hr = BitstreamSPDIF(pOut, pOut_size, hrDeliver);
+        if (FAILED(hr)) {
+          DbgLog((LOG_ERROR, 20, "::Bitstream(): IEC 61937 packing failed (hr: 0x%x)", hr));
+          m_rtBitstreamCache = rtBitstreamCache;
+          continue;
         }
+
+        m_bUpdateTimeCache = TRUE;
       }
 
       /* if the bitstreaming context is lost at this point, then the deliver function caused a fallback to PCM */
@@ -391,7 +384,7 @@ HRESULT CLAVAudio::Bitstream(const BYTE *pDataBuffer, int buffsize, int &consume
   return S_OK;
 }
 
-HRESULT CLAVAudio::DeliverBitstream(AVCodecID codec, const BYTE *buffer, DWORD dwSize, REFERENCE_TIME rtStartInput, REFERENCE_TIME rtStopInput, BOOL bSwap)
+HRESULT CLAVAudio::GetBitstreamDeliveryBuffer(AVCodecID codec, DWORD dwSize, IMediaSample **ppOut, BYTE **ppDataOut, BOOL *pbTypeChanged)
 {
   HRESULT hr = S_OK;
 
@@ -403,13 +396,50 @@ HRESULT CLAVAudio::DeliverBitstream(AVCodecID codec, const BYTE *buffer, DWORD d
   if(FAILED(hr = ReconnectOutput(dwSize, mt))) {
     return hr;
   }
+  *pbTypeChanged = (hr == S_OK);
 
-  IMediaSample *pOut;
-  BYTE *pDataOut = nullptr;
-  if(FAILED(GetDeliveryBuffer(&pOut, &pDataOut))) {
+  if(FAILED(GetDeliveryBuffer(ppOut, ppDataOut))) {
     return E_FAIL;
   }
 
+  return S_OK;
+}
+
+HRESULT CLAVAudio::DeliverBitstream(AVCodecID codec, const BYTE *buffer, DWORD dwSize, REFERENCE_TIME rtStartInput, REFERENCE_TIME rtStopInput, BOOL bSwap)
+{
+  HRESULT hr = S_OK;
+
+  IMediaSample *pOut = nullptr;
+  BYTE *pDataOut = nullptr;
+  BOOL bTypeChanged = FALSE;
+  if ((hr = GetBitstreamDeliveryBuffer(codec, dwSize, &pOut, &pDataOut, &bTypeChanged)) != S_OK) {
+    return hr;
+  }
+
+  // byte-swap if needed
+  if (bSwap)
+  {
+    lav_spdif_bswap_buf16((uint16_t *)pDataOut, (uint16_t *)buffer, dwSize >> 1);
+  }
+  else
+  {
+    memcpy(pDataOut, buffer, dwSize);
+  }
+
+  return DeliverBitstreamSample(codec, pOut, dwSize, rtStartInput, rtStopInput, bTypeChanged);
+}
+
+HRESULT CLAVAudio::DeliverBitstreamSample(AVCodecID codec, IMediaSample *pOut, DWORD dwSize, REFERENCE_TIME rtStartInput, REFERENCE_TIME rtStopInput, BOOL bTypeChanged)
+{
+  HRESULT hr = S_OK;
+
+  if (m_bFlushing) {
+    SafeRelease(&pOut);
+    return S_FALSE;
+  }
+
+  CMediaType mt = CreateBitstreamMediaType(codec, m_bsParser.m_dwSampleRate);
+
   if (m_bResyncTimestamp && (rtStartInput != AV_NOPTS_VALUE || m_rtBitstreamCache != AV_NOPTS_VALUE)) {
     if (m_rtBitstreamCache != AV_NOPTS_VALUE)
       m_rtStart = m_rtBitstreamCache;
@@ -471,18 +501,8 @@ HRESULT CLAVAudio::DeliverBitstream(AVCodecID codec, const BYTE *buffer, DWORD d
 
   pOut->SetActualDataLength(dwSize);
 
-  // byte-swap if needed
-  if (bSwap)
-  {
-    lav_spdif_bswap_buf16((uint16_t *)pDataOut, (uint16_t *)buffer, dwSize >> 1);
-  }
-  else
-  {
-    memcpy(pDataOut, buffer, dwSize);
-  }
-
-  if(hr == S_OK) {
-    hr = m_pOutput->GetConnected()->QueryAccept(&mt);
+  if(bTypeChanged) {
+    hr = QueryAcceptOutput(mt);
     if (hr == S_FALSE && m_nCodecId == AV_CODEC_ID_DTS && m_DTSBitstreamMode != DTS_Core) {
       DbgLog((LOG_TRACE, 1, L"DTS-HD Media Type failed with %0#.8x, trying fallback to DTS core", hr));
       m_bForceDTSCore = TRUE;
@@ -502,6 +522,7 @@ HRESULT CLAVAudio::DeliverBitstream(AVCodecID codec, const BYTE *buffer, DWORD d
   hr = m_pOutput->Deliver(pOut);
   if (FAILED(hr)) {
     DbgLog((LOG_ERROR, 10, L"::DeliverBitstream failed with code: %0#.8x", hr));
+    m_OutputTypeCache.clear();
   }
 
 done:
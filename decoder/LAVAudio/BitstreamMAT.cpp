@@ -33,29 +33,52 @@ extern "C"
 #define MAT_BUFFER_LIMIT (MAT_BUFFER_SIZE - 24 /* MAT end code size */)
 #define MAT_POS_MIDDLE (30708 /* middle point*/ + 8 /* IEC header in front */)
 
-static const BYTE mat_start_code[20] = { 0x07, 0x9E, 0x00, 0x03, 0x84, 0x01, 0x01, 0x01, 0x80, 0x00, 0x56, 0xA5, 0x3B, 0xF4, 0x81, 0x83, 0x49, 0x80, 0x77, 0xE0 };
 static const BYTE mat_middle_code[12] = { 0xC3, 0xC1, 0x42, 0x49, 0x3B, 0xFA, 0x82, 0x83, 0x49, 0x80, 0x77, 0xE0 };
 static const BYTE mat_end_code[24] = { 0xC3, 0xC2, 0xC0, 0xC4, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x97, 0x11, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00 };
 
-void CLAVAudio::MATWriteHeader()
+// IEC burst header, followed by the MAT start code
+static const BYTE mat_header[BURST_HEADER_SIZE + 20] = {
+  SYNCWORD1 >> 8, SYNCWORD1 & 0xff, SYNCWORD2 >> 8, SYNCWORD2 & 0xff,
+  IEC61937_TRUEHD >> 8, IEC61937_TRUEHD & 0xff, 61424 >> 8, 61424 & 0xff,
+  0x07, 0x9E, 0x00, 0x03, 0x84, 0x01, 0x01, 0x01, 0x80, 0x00, 0x56, 0xA5, 0x3B, 0xF4, 0x81, 0x83, 0x49, 0x80, 0x77, 0xE0
+};
+
+void CLAVAudio::MATGetBuffer()
 {
-  ASSERT(m_bsOutput.GetCount() == 0);
+  ASSERT(m_pMATBuffer == nullptr && m_pMATSample == nullptr);
+
+  // Try to assemble the MAT frame directly in the output sample, which saves copying it on delivery
+  BYTE *pDataOut = nullptr;
+  if (GetBitstreamDeliveryBuffer(m_nCodecId, MAT_BUFFER_SIZE, &m_pMATSample, &pDataOut, &m_bMATTypeChanged) == S_OK && m_pMATSample->GetSize() >= MAT_BUFFER_SIZE) {
+    m_pMATBuffer = pDataOut;
+  } else {
+    SafeRelease(&m_pMATSample);
+
+    // otherwise use the intermediate buffer, which is delivered like any other bitstream packet
+    m_bsOutput.SetSize(MAT_BUFFER_SIZE);
+    m_pMATBuffer = m_bsOutput.Ptr();
+  }
+}
 
-  DWORD dwSize = BURST_HEADER_SIZE + sizeof(mat_start_code);
+void CLAVAudio::MATReset()
+{
+  SafeRelease(&m_pMATSample);
+  m_pMATBuffer = nullptr;
+  m_dwMATSize = 0;
+}
 
-  // reserve size for the IEC header and the MAT start code
-  m_bsOutput.SetSize(dwSize);
+void CLAVAudio::MATWriteHeader()
+{
+  ASSERT(m_dwMATSize == 0);
 
-  BYTE *p = m_bsOutput.Ptr();
+  if (m_pMATBuffer == nullptr)
+    MATGetBuffer();
 
-  // IEC burst header
-  AV_WB16(p + 0, SYNCWORD1);
-  AV_WB16(p + 2, SYNCWORD2);
-  AV_WB16(p + 4, IEC61937_TRUEHD);
-  AV_WB16(p + 6, 61424);
+  DWORD dwSize = sizeof(mat_header);
 
-  // MAT start code
-  memcpy(p + BURST_HEADER_SIZE, mat_start_code, sizeof(mat_start_code));
+  // IEC header and the MAT start code
+  memcpy(m_pMATBuffer, mat_header, dwSize);
+  m_dwMATSize = dwSize;
 
   // unless the start code falls into the padding,  its considered part of the current MAT frame
   // Note that audio frames are not always aligned with MAT frames, so we might already have a partial frame at this point
@@ -82,14 +105,8 @@ void CLAVAudio::MATWritePadding()
 {
   if (m_TrueHDMATState.padding > 0)
   {
-    // allocate padding (on the stack of possible)
-    BYTE *padding = (BYTE*)_malloca(m_TrueHDMATState.padding);
-
-    memset(padding, 0, m_TrueHDMATState.padding);
-    int remaining = MATFillDataBuffer(padding, m_TrueHDMATState.padding, true);
-
-    // free the padding block
-    _freea(padding);
+    // the padding is zeroed directly in the MAT buffer
+    int remaining = MATFillDataBuffer(nullptr, m_TrueHDMATState.padding, true);
 
     // not all padding could be written to the buffer, write it later
     if (remaining >= 0)
@@ -105,15 +122,23 @@ void CLAVAudio::MATWritePadding()
   }
 }
 
-void CLAVAudio::MATAppendData(const BYTE *p, int size)
+void CLAVAudio::MATAppendData(const BYTE *p, int size, bool padding)
 {
-  m_bsOutput.Append(p, size);
+  ASSERT(m_dwMATSize + size <= MAT_BUFFER_SIZE);
+
+  if (padding)
+    memset(m_pMATBuffer + m_dwMATSize, 0, size);
+  else
+    memcpy(m_pMATBuffer + m_dwMATSize, p, size);
+
+  m_dwMATSize += size;
   m_TrueHDMATState.mat_framesize += size;
 }
 
+// Write data into the MAT buffer, when writing padding p is ignored and zeroes are written instead
 int CLAVAudio::MATFillDataBuffer(const BYTE *p, int size, bool padding)
 {
-  if (m_bsOutput.GetCount() >= MAT_BUFFER_LIMIT)
+  if (m_dwMATSize >= MAT_BUFFER_LIMIT)
     return size;
 
   int remaining = size;
@@ -121,11 +146,11 @@ int CLAVAudio::MATFillDataBuffer(const BYTE *p, int size, bool padding)
   // Write MAT middle marker, if needed
   // The MAT middle marker always needs to be in the exact same spot, any audio data will be split.
   // If we're currently writing padding, then the marker will be considered as padding data and reduce the amount of padding still required.
-  if (m_bsOutput.GetCount() <= MAT_POS_MIDDLE && m_bsOutput.GetCount() + size > MAT_POS_MIDDLE)
+  if (m_dwMATSize <= MAT_POS_MIDDLE && m_dwMATSize + size > MAT_POS_MIDDLE)
   {
     // write as much data before the middle code as we can
-    int nBytesBefore = MAT_POS_MIDDLE - m_bsOutput.GetCount();
-    MATAppendData(p, nBytesBefore);
+    int nBytesBefore = MAT_POS_MIDDLE - m_dwMATSize;
+    MATAppendData(p, nBytesBefore, padding);
     remaining -= nBytesBefore;
 
     // write the MAT middle code
@@ -138,24 +163,24 @@ int CLAVAudio::MATFillDataBuffer(const BYTE *p, int size, bool padding)
     // write remaining data after the MAT marker
     if (remaining > 0)
     {
-      remaining = MATFillDataBuffer(p + nBytesBefore, remaining, padding);
+      remaining = MATFillDataBuffer(padding ? nullptr : p + nBytesBefore, remaining, padding);
     }
 
     return remaining;
   }
 
   // not enough room in the buffer to write all the data, write as much as we can and add the MAT footer
-  if (m_bsOutput.GetCount() + size >= MAT_BUFFER_LIMIT)
+  if (m_dwMATSize + size >= MAT_BUFFER_LIMIT)
   {
     // write as much data before the middle code as we can
-    int nBytesBefore = MAT_BUFFER_LIMIT - m_bsOutput.GetCount();
-    MATAppendData(p, nBytesBefore);
+    int nBytesBefore = MAT_BUFFER_LIMIT - m_dwMATSize;
+    MATAppendData(p, nBytesBefore, padding);
     remaining -= nBytesBefore;
 
     // write the MAT end code
     MATAppendData(mat_end_code, sizeof(mat_end_code));
 
-    ASSERT(m_bsOutput.GetCount() == MAT_BUFFER_SIZE);
+    ASSERT(m_dwMATSize == MAT_BUFFER_SIZE);
 
     // MAT markers don't displace padding, so reduce the amount of padding
     if (padding)
@@ -165,19 +190,31 @@ int CLAVAudio::MATFillDataBuffer(const BYTE *p, int size, bool padding)
     return remaining;
   }
 
-  MATAppendData(p, size);
+  MATAppendData(p, size, padding);
 
   return 0;
 }
 
 void CLAVAudio::MATFlushPacket(HRESULT *hrDeliver)
 {
-  if (m_bsOutput.GetCount() > 0) {
-    ASSERT(m_bsOutput.GetCount() == 61440);
+  if (m_dwMATSize > 0) {
+    ASSERT(m_dwMATSize == MAT_BUFFER_SIZE);
 
     // Deliver MAT packet to the audio renderer
-    *hrDeliver = DeliverBitstream(m_nCodecId, m_bsOutput.Ptr(), m_bsOutput.GetCount(), m_rtStartInputCache, m_rtStopInputCache, true);
-    m_bsOutput.SetSize(0);
+    if (m_pMATSample) {
+      // the frame is already in the output sample, only byte-swap it in place
+      lav_spdif_bswap_buf16((uint16_t *)m_pMATBuffer, (uint16_t *)m_pMATBuffer, m_dwMATSize >> 1);
+
+      IMediaSample *pOut = m_pMATSample;
+      m_pMATSample = nullptr;
+      *hrDeliver = DeliverBitstreamSample(m_nCodecId, pOut, m_dwMATSize, m_rtStartInputCache, m_rtStopInputCache, m_bMATTypeChanged);
+    } else {
+      *hrDeliver = DeliverBitstream(m_nCodecId, m_bsOutput.Ptr(), m_dwMATSize, m_rtStartInputCache, m_rtStopInputCache, true);
+      m_bsOutput.SetSize(0);
+    }
+
+    m_pMATBuffer = nullptr;
+    m_dwMATSize = 0;
   }
 }
 
@@ -314,7 +351,7 @@ HRESULT CLAVAudio::BitstreamTrueHD(const BYTE *p, int buffsize, HRESULT *hrDeliv
   m_TrueHDMATState.prev_frametime_valid = true;
 
   // Write the MAT header into the fresh buffer
-  if (m_bsOutput.GetCount() == 0)
+  if (m_dwMATSize == 0)
   {
     MATWriteHeader();
 
@@ -331,10 +368,10 @@ HRESULT CLAVAudio::BitstreamTrueHD(const BYTE *p, int buffsize, HRESULT *hrDeliv
   {
     MATWritePadding();
 
-    ASSERT(m_TrueHDMATState.padding == 0 || m_bsOutput.GetCount() == MAT_BUFFER_SIZE);
+    ASSERT(m_TrueHDMATState.padding == 0 || m_dwMATSize == MAT_BUFFER_SIZE);
 
     // Buffer is full, submit it
-    if (m_bsOutput.GetCount() == MAT_BUFFER_SIZE)
+    if (m_dwMATSize == MAT_BUFFER_SIZE)
     {
       MATFlushPacket(hrDeliver);
 
@@ -347,7 +384,7 @@ HRESULT CLAVAudio::BitstreamTrueHD(const BYTE *p, int buffsize, HRESULT *hrDeliv
   int remaining = MATFillDataBuffer(p, buffsize);
 
   // not all data could be written, or the buffer is full
-  if (remaining || m_bsOutput.GetCount() == MAT_BUFFER_SIZE)
+  if (remaining || m_dwMATSize == MAT_BUFFER_SIZE)
   {
     // flush out old data
     MATFlushPacket(hrDeliver);
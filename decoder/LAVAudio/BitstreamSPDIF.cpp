@@ -0,0 +1,297 @@
+/*
+ *      Copyright (C) 2010-2019 Hendrik Leppkes
+ *      http://www.1f0.de
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program; if not, write to the Free Software Foundation, Inc.,
+ *  51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+
+#include "stdafx.h"
+#include "LAVAudio.h"
+
+extern "C" {
+#include "libavformat/spdif.h"
+#include "libavutil/intreadwrite.h"
+}
+
+// IEC 61937 packing of AC3, E-AC3 and DTS, the bursts are assembled directly in the output sample
+// The burst layout follows the spdif muxer of libavformat.
+
+#define DTS_SYNCWORD_CORE_BE     0x7FFE8001
+#define DTS_SYNCWORD_CORE_LE     0xFE7F0180
+#define DTS_SYNCWORD_CORE_14B_BE 0x1FFFE800
+#define DTS_SYNCWORD_CORE_14B_LE 0xFF1F00E8
+
+// Repetition periods of the bursts, in bytes of the 16-bit stereo stream
+#define SPDIF_AC3_BURST_SIZE  (1536 * 4)
+#define SPDIF_EAC3_BURST_SIZE (6144 * 4)
+
+static const DWORD dts_sample_rates[16] = {
+  0, 8000, 16000, 32000, 0, 0, 11025, 22050, 44100, 0, 0, 12000, 24000, 48000, 96000, 192000
+};
+
+static const BYTE dtshd_start_code[10] = { 0x01, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0xfe, 0xfe };
+
+// Number of E-AC3 frames in a burst of 6 audio blocks, by numblkscod
+static const int eac3_repeat[4] = { 6, 3, 2, 1 };
+
+static int dts4_subtype(int period)
+{
+  switch (period) {
+  case 512:   return 0x0;
+  case 1024:  return 0x1;
+  case 2048:  return 0x2;
+  case 4096:  return 0x3;
+  case 8192:  return 0x4;
+  case 16384: return 0x5;
+  }
+  return -1;
+}
+
+static void spdif_write_preamble(BYTE *p, WORD wDataType, WORD wLengthCode)
+{
+  AV_WL16(p + 0, SYNCWORD1);
+  AV_WL16(p + 2, SYNCWORD2);
+  AV_WL16(p + 4, wDataType);
+  AV_WL16(p + 6, wLengthCode);
+}
+
+// Write the payload into the 16-bit words of the stream, big-endian payloads are byte-swapped
+// A final lone byte is MSB aligned in its word. Returns the number of bytes written.
+static DWORD spdif_write_payload(BYTE *dst, const BYTE *src, DWORD dwSize, BOOL bSwap)
+{
+  if (bSwap)
+    lav_spdif_bswap_buf16((uint16_t *)dst, (const uint16_t *)src, dwSize >> 1);
+  else
+    memcpy(dst, src, dwSize & ~1);
+
+  if (dwSize & 1) {
+    AV_WL16(dst + (dwSize & ~1), src[dwSize - 1] << 8);
+    dwSize++;
+  }
+
+  return dwSize;
+}
+
+// Get the buffer a burst is assembled in, the output sample if possible
+BYTE *CLAVAudio::SPDIFGetBuffer(DWORD dwSize)
+{
+  ASSERT(m_pSPDIFBuffer == nullptr && m_pSPDIFSample == nullptr);
+
+  BYTE *pDataOut = nullptr;
+  if (GetBitstreamDeliveryBuffer(m_nCodecId, dwSize, &m_pSPDIFSample, &pDataOut, &m_bSPDIFTypeChanged) == S_OK && m_pSPDIFSample->GetSize() >= (long)dwSize) {
+    m_pSPDIFBuffer = pDataOut;
+  } else {
+    SafeRelease(&m_pSPDIFSample);
+
+    // otherwise use the intermediate buffer, which is delivered like any other bitstream packet
+    m_bsOutput.SetSize(dwSize);
+    m_pSPDIFBuffer = m_bsOutput.Ptr();
+  }
+
+  return m_pSPDIFBuffer;
+}
+
+void CLAVAudio::SPDIFDeliver(DWORD dwSize, HRESULT *hrDeliver)
+{
+  if (m_pSPDIFSample) {
+    IMediaSample *pOut = m_pSPDIFSample;
+    m_pSPDIFSample = nullptr;
+    *hrDeliver = DeliverBitstreamSample(m_nCodecId, pOut, dwSize, m_rtStartInputCache, m_rtStopInputCache, m_bSPDIFTypeChanged);
+  } else {
+    *hrDeliver = DeliverBitstream(m_nCodecId, m_bsOutput.Ptr(), dwSize, m_rtStartInputCache, m_rtStopInputCache);
+    m_bsOutput.SetSize(0);
+  }
+
+  m_pSPDIFBuffer = nullptr;
+  m_dwSPDIFPayload = 0;
+  m_nSPDIFFrames = 0;
+}
+
+void CLAVAudio::SPDIFReset()
+{
+  SafeRelease(&m_pSPDIFSample);
+  m_pSPDIFBuffer = nullptr;
+  m_dwSPDIFPayload = 0;
+  m_nSPDIFFrames = 0;
+}
+
+// E-AC3 frames are collected in the burst until they add up to 6 audio blocks
+HRESULT CLAVAudio::BitstreamEAC3(const BYTE *p, int size, HRESULT *hrDeliver)
+{
+  if (size < 6)
+    return E_FAIL;
+
+  int repeat = 1;
+  const int bsid = p[5] >> 3;
+  if (bsid > 10 && (p[4] & 0xc0) != 0xc0)
+    repeat = eac3_repeat[(p[4] & 0x30) >> 4];
+
+  if (m_pSPDIFBuffer && BURST_HEADER_SIZE + m_dwSPDIFPayload + size > SPDIF_EAC3_BURST_SIZE) {
+    DbgLog((LOG_ERROR, 10, L"::BitstreamEAC3(): E-AC3 frames exceed the burst, dropping them"));
+    SPDIFReset();
+  }
+
+  if (m_pSPDIFBuffer == nullptr && SPDIFGetBuffer(SPDIF_EAC3_BURST_SIZE) == nullptr)
+    return E_OUTOFMEMORY;
+
+  if (BURST_HEADER_SIZE + m_dwSPDIFPayload + size > SPDIF_EAC3_BURST_SIZE)
+    return E_FAIL;
+
+  const DWORD dwLength = m_dwSPDIFPayload + size;
+  m_dwSPDIFPayload += spdif_write_payload(m_pSPDIFBuffer + BURST_HEADER_SIZE + m_dwSPDIFPayload, p, size, TRUE);
+
+  if (++m_nSPDIFFrames < repeat)
+    return S_OK;
+
+  spdif_write_preamble(m_pSPDIFBuffer, IEC61937_EAC3, (WORD)dwLength);
+  memset(m_pSPDIFBuffer + BURST_HEADER_SIZE + m_dwSPDIFPayload, 0, SPDIF_EAC3_BURST_SIZE - BURST_HEADER_SIZE - m_dwSPDIFPayload);
+
+  SPDIFDeliver(SPDIF_EAC3_BURST_SIZE, hrDeliver);
+  return S_OK;
+}
+
+// Pack a frame into an IEC 61937 burst, and deliver it
+HRESULT CLAVAudio::BitstreamSPDIF(const BYTE *p, int size, HRESULT *hrDeliver)
+{
+  WORD wDataType = 0;
+  DWORD dwBurstSize = 0;
+  DWORD dwLengthCode = FFALIGN(size, 2) << 3;
+  BOOL bPreamble = TRUE;
+  BOOL bSwap = TRUE;
+
+  BYTE prefix[sizeof(dtshd_start_code) + 2];
+  DWORD dwPrefix = 0;
+
+  switch (m_nCodecId) {
+  case AV_CODEC_ID_AC3:
+    if (size < 6)
+      return E_FAIL;
+    wDataType = IEC61937_AC3 | ((p[5] & 0x7) << 8);
+    dwBurstSize = SPDIF_AC3_BURST_SIZE;
+    break;
+  case AV_CODEC_ID_EAC3:
+    return BitstreamEAC3(p, size, hrDeliver);
+  case AV_CODEC_ID_DTS:
+    {
+      if (size < 9)
+        return E_FAIL;
+
+      int blocks = 0, core_size = 0;
+      DWORD sample_rate = 0;
+      switch (AV_RB32(p)) {
+      case DTS_SYNCWORD_CORE_BE:
+        blocks = (AV_RB16(p + 4) >> 2) & 0x7f;
+        core_size = ((AV_RB24(p + 5) >> 4) & 0x3fff) + 1;
+        sample_rate = dts_sample_rates[(p[8] >> 2) & 0x0f];
+        break;
+      case DTS_SYNCWORD_CORE_LE:
+        blocks = (AV_RL16(p + 4) >> 2) & 0x7f;
+        bSwap = FALSE;
+        break;
+      case DTS_SYNCWORD_CORE_14B_BE:
+        blocks = (((p[5] & 0x07) << 4) | ((p[6] & 0x3f) >> 2));
+        break;
+      case DTS_SYNCWORD_CORE_14B_LE:
+        blocks = (((p[4] & 0x07) << 4) | ((p[7] & 0x3f) >> 2));
+        bSwap = FALSE;
+        break;
+      default:
+        // DTS-HD frames without a core can't be sent
+        DbgLog((LOG_ERROR, 20, L"::BitstreamSPDIF(): Invalid DTS syncword 0x%08x", AV_RB32(p)));
+        return E_FAIL;
+      }
+      blocks++;
+
+      const DWORD dwHDRate = GetDTSHDRate();
+      if (dwHDRate) {
+        // DTS type IV burst, with the core and all extensions
+        if (!core_size || !sample_rate)
+          return E_FAIL;
+
+        const int period = dwHDRate * (blocks << 5) / sample_rate;
+        const int subtype = dts4_subtype(period);
+        if (subtype < 0)
+          return E_FAIL;
+
+        dwBurstSize = period * 4;
+        wDataType = IEC61937_DTSHD | (subtype << 8);
+
+        // streams too large for the rate only send the core from then on
+        if (!m_bDTSHDCoreOnly && sizeof(prefix) + size > dwBurstSize - BURST_HEADER_SIZE) {
+          DbgLog((LOG_TRACE, 10, L"::BitstreamSPDIF(): DTS-HD bitrate too high, sending the core only"));
+          m_bDTSHDCoreOnly = TRUE;
+        }
+        if (m_bDTSHDCoreOnly)
+          size = core_size;
+
+        memcpy(prefix, dtshd_start_code, sizeof(dtshd_start_code));
+        AV_WB16(prefix + sizeof(dtshd_start_code), size);
+        dwPrefix = sizeof(prefix);
+
+        // align so that (length_code & 0xf) == 0x8, which some receivers need
+        dwLengthCode = FFALIGN(dwPrefix + size + 0x8, 0x10) - 0x8;
+      } else {
+        switch (blocks) {
+        case 512 >> 5:  wDataType = IEC61937_DTS1; break;
+        case 1024 >> 5: wDataType = IEC61937_DTS2; break;
+        case 2048 >> 5: wDataType = IEC61937_DTS3; break;
+        default:
+          DbgLog((LOG_ERROR, 20, L"::BitstreamSPDIF(): %d samples in a DTS frame are not supported", blocks << 5));
+          return E_FAIL;
+        }
+
+        // only the core is sent
+        if (core_size && core_size < size) {
+          size = core_size;
+          dwLengthCode = core_size << 3;
+        }
+
+        // DTS that fits exactly into the stream is sent without the preamble, like DTS discs and DTS-in-WAV
+        dwBurstSize = blocks << 7;
+        if ((DWORD)size == dwBurstSize)
+          bPreamble = FALSE;
+      }
+    }
+    break;
+  default:
+    ASSERT(0);
+    return E_FAIL;
+  }
+
+  const DWORD dwHeader = bPreamble ? BURST_HEADER_SIZE : 0;
+  if (dwHeader + FFALIGN(dwPrefix + size, 2) > dwBurstSize) {
+    DbgLog((LOG_ERROR, 20, L"::BitstreamSPDIF(): Bitrate too high for the burst (%d bytes, burst %u bytes)", size, dwBurstSize));
+    return E_FAIL;
+  }
+
+  BYTE *pBuffer = SPDIFGetBuffer(dwBurstSize);
+  if (pBuffer == nullptr)
+    return E_OUTOFMEMORY;
+
+  BYTE *pOut = pBuffer;
+  if (bPreamble) {
+    spdif_write_preamble(pOut, wDataType, (WORD)dwLengthCode);
+    pOut += BURST_HEADER_SIZE;
+  }
+  if (dwPrefix)
+    pOut += spdif_write_payload(pOut, prefix, dwPrefix, bSwap);
+  pOut += spdif_write_payload(pOut, p, size, bSwap);
+
+  memset(pOut, 0, pBuffer + dwBurstSize - pOut);
+
+  SPDIFDeliver(dwBurstSize, hrDeliver);
+  return S_OK;
+}
@@ -0,0 +1,173 @@
+/*
+ *      Copyright (C) 2010-2019 Hendrik Leppkes
+ *      http://www.1f0.de
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program; if not, write to the Free Software Foundation, Inc.,
+ *  51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+
+#include "stdafx.h"
+#include "Interleave.h"
+
+#include <emmintrin.h>
+
+// The 32-bit formats are moved as float vectors, integer samples are only re-interpreted, never converted
+// Double samples are converted on load, so every kernel handles them as well.
+template <class T> static inline __m128 load4(const T *src);
+template <> inline __m128 load4(const float *src)   { return _mm_loadu_ps(src); }
+template <> inline __m128 load4(const int32_t *src) { return _mm_castsi128_ps(_mm_loadu_si128((const __m128i *)src)); }
+template <> inline __m128 load4(const double *src)  { return _mm_movelh_ps(_mm_cvtpd_ps(_mm_loadu_pd(src)), _mm_cvtpd_ps(_mm_loadu_pd(src + 2))); }
+
+template <class T> static inline void store1(float *dst, const T *src) { *dst = *src; }
+template <> inline void store1(float *dst, const int32_t *src) { *(int32_t *)dst = *src; }
+template <> inline void store1(float *dst, const double *src)  { *dst = (float)*src; }
+
+// 4 samples of all channels per iteration, the channel vectors are transposed into sample order
+template <class T, int channels>
+static void interleave_32_fixed(const uint8_t * const *planes, float *dst, int nSamples)
+{
+  const T *src[8];
+  for (int ch = 0; ch < channels; ch++)
+    src[ch] = (const T *)planes[ch];
+
+  int i = 0;
+  for (; i <= nSamples - 4; i += 4) {
+    if (channels == 1) {
+      _mm_storeu_ps(dst, load4(src[0] + i));
+    } else if (channels == 2) {
+      const __m128 l = load4(src[0] + i);
+      const __m128 r = load4(src[1] + i);
+      _mm_storeu_ps(dst + 0, _mm_unpacklo_ps(l, r));
+      _mm_storeu_ps(dst + 4, _mm_unpackhi_ps(l, r));
+    } else if (channels == 6) {
+      __m128 r0 = load4(src[0] + i), r1 = load4(src[1] + i), r2 = load4(src[2] + i), r3 = load4(src[3] + i);
+      _MM_TRANSPOSE4_PS(r0, r1, r2, r3);
+      const __m128 e = load4(src[4] + i), f = load4(src[5] + i);
+      const __m128 ef01 = _mm_unpacklo_ps(e, f), ef23 = _mm_unpackhi_ps(e, f);
+      _mm_storeu_ps(dst +  0, r0);
+      _mm_storeu_ps(dst +  4, _mm_shuffle_ps(ef01, r1, _MM_SHUFFLE(1, 0, 1, 0)));
+      _mm_storeu_ps(dst +  8, _mm_shuffle_ps(r1, ef01, _MM_SHUFFLE(3, 2, 3, 2)));
+      _mm_storeu_ps(dst + 12, r2);
+      _mm_storeu_ps(dst + 16, _mm_shuffle_ps(ef23, r3, _MM_SHUFFLE(1, 0, 1, 0)));
+      _mm_storeu_ps(dst + 20, _mm_shuffle_ps(r3, ef23, _MM_SHUFFLE(3, 2, 3, 2)));
+    } else if (channels == 8) {
+      __m128 a0 = load4(src[0] + i), a1 = load4(src[1] + i), a2 = load4(src[2] + i), a3 = load4(src[3] + i);
+      __m128 b0 = load4(src[4] + i), b1 = load4(src[5] + i), b2 = load4(src[6] + i), b3 = load4(src[7] + i);
+      _MM_TRANSPOSE4_PS(a0, a1, a2, a3);
+      _MM_TRANSPOSE4_PS(b0, b1, b2, b3);
+      _mm_storeu_ps(dst +  0, a0);
+      _mm_storeu_ps(dst +  4, b0);
+      _mm_storeu_ps(dst +  8, a1);
+      _mm_storeu_ps(dst + 12, b1);
+      _mm_storeu_ps(dst + 16, a2);
+      _mm_storeu_ps(dst + 20, b2);
+      _mm_storeu_ps(dst + 24, a3);
+      _mm_storeu_ps(dst + 28, b3);
+    }
+    dst += 4 * channels;
+  }
+
+  for (; i < nSamples; i++) {
+    for (int ch = 0; ch < channels; ch++)
+      store1(dst++, src[ch] + i);
+  }
+}
+
+template <class T>
+static void interleave_32_generic(const uint8_t * const *planes, int channels, float *dst, int nSamples)
+{
+  for (int i = 0; i < nSamples; i++) {
+    for (int ch = 0; ch < channels; ch++)
+      store1(dst++, (const T *)planes[ch] + i);
+  }
+}
+
+template <class T>
+static void interleave_32(const uint8_t * const *planes, int channels, float *dst, int nSamples)
+{
+  switch (channels) {
+  case 1: interleave_32_fixed<T, 1>(planes, dst, nSamples); break;
+  case 2: interleave_32_fixed<T, 2>(planes, dst, nSamples); break;
+  case 6: interleave_32_fixed<T, 6>(planes, dst, nSamples); break;
+  case 8: interleave_32_fixed<T, 8>(planes, dst, nSamples); break;
+  default:
+    interleave_32_generic<T>(planes, channels, dst, nSamples);
+    break;
+  }
+}
+
+template <class T>
+static void interleave_generic(const uint8_t * const *planes, int channels, T *dst, int nSamples)
+{
+  for (int i = 0; i < nSamples; i++) {
+    for (int ch = 0; ch < channels; ch++)
+      *dst++ = ((const T *)planes[ch])[i];
+  }
+}
+
+static void interleave_s16(const uint8_t * const *planes, int channels, int16_t *dst, int nSamples)
+{
+  if (channels != 2) {
+    interleave_generic(planes, channels, dst, nSamples);
+    return;
+  }
+
+  const int16_t *l = (const int16_t *)planes[0], *r = (const int16_t *)planes[1];
+  int i = 0;
+  for (; i <= nSamples - 8; i += 8) {
+    const __m128i vl = _mm_loadu_si128((const __m128i *)(l + i));
+    const __m128i vr = _mm_loadu_si128((const __m128i *)(r + i));
+    _mm_storeu_si128((__m128i *)(dst + 0), _mm_unpacklo_epi16(vl, vr));
+    _mm_storeu_si128((__m128i *)(dst + 8), _mm_unpackhi_epi16(vl, vr));
+    dst += 16;
+  }
+  for (; i < nSamples; i++) {
+    *dst++ = l[i];
+    *dst++ = r[i];
+  }
+}
+
+void interleave_samples(const uint8_t * const *src, AVSampleFormat fmt, int channels, BYTE *dst, int nSamples)
+{
+  switch (fmt) {
+  case AV_SAMPLE_FMT_U8P:
+    interleave_generic(src, channels, (uint8_t *)dst, nSamples);
+    break;
+  case AV_SAMPLE_FMT_S16P:
+    interleave_s16(src, channels, (int16_t *)dst, nSamples);
+    break;
+  case AV_SAMPLE_FMT_S32P:
+    interleave_32<int32_t>(src, channels, (float *)dst, nSamples);
+    break;
+  case AV_SAMPLE_FMT_FLTP:
+    interleave_32<float>(src, channels, (float *)dst, nSamples);
+    break;
+  case AV_SAMPLE_FMT_DBLP:
+    interleave_32<double>(src, channels, (float *)dst, nSamples);
+    break;
+  default:
+    ASSERT(0);
+    break;
+  }
+}
+
+void convert_dbl_to_flt(const double *src, float *dst, size_t count)
+{
+  size_t i = 0;
+  for (; i + 4 <= count; i += 4)
+    _mm_storeu_ps(dst + i, load4(src + i));
+  for (; i < count; i++)
+    dst[i] = (float)src[i];
+}
@@ -20,6 +20,7 @@
 #include "stdafx.h"
 #include "LAVAudio.h"
 #include "PostProcessor.h"
+#include "Interleave.h"
 
 #include <MMReg.h>
 #include <assert.h>
@@ -28,11 +29,15 @@
 #include "DShowUtil.h"
 #include "IMediaSideData.h"
 #include "IMediaSideDataFFmpeg.h"
+#include "IMediaSampleAVPacket.h"
 
 #include "AudioSettingsProp.h"
 
 #include "registry.h"
 #include "resource.h"
+#include "timer.h"
+#include "StartCode.h"
+#include "TraceProvider.h"
 
 #include "DeCSS/DeCSSInputPin.h"
 
@@ -58,6 +63,17 @@ __declspec(dllimport) extern const unsigned char ff_sipr_subpk_size[4];
 
 extern HINSTANCE g_hInst;
 
+// {11640AAF-4596-4434-9FC6-73EDF55BA9ED}
+static const GUID GUID_LAVAudioPerfProvider = { 0x11640aaf, 0x4596, 0x4434, { 0x9f, 0xc6, 0x73, 0xed, 0xf5, 0x5b, 0xa9, 0xed } };
+// {6C7CEE44-FA18-4B7D-A654-BD2B9FB29C75}
+static const GUID GUID_LAVAudioPerfCounterSet = { 0x6c7cee44, 0xfa18, 0x4b7d, { 0xa6, 0x54, 0xbd, 0x2b, 0x9f, 0xb2, 0x9c, 0x75 } };
+
+static const ULONG AudioPerfCounterTypes[AudioPerf_NB] = {
+  PERF_COUNTER_LARGE_RAWCOUNT,  // AudioPerf_Underruns
+};
+
+static CPerfCounterSet g_AudioPerfCounters(GUID_LAVAudioPerfProvider, GUID_LAVAudioPerfCounterSet, AudioPerfCounterTypes, AudioPerf_NB);
+
 // Constructor
 CLAVAudio::CLAVAudio(LPUNKNOWN pUnk, HRESULT* phr)
   : CTransformFilter(NAME("lavc audio decoder"), 0, __uuidof(CLAVAudio))
@@ -70,7 +86,7 @@ CLAVAudio::CLAVAudio(LPUNKNOWN pUnk, HRESULT* phr)
     return;
   }
 
-  m_pOutput = new CTransformOutputPin(NAME("CTransformOutputPin"), this, phr, L"Output");
+  m_pOutput = new CQueuedOutputPin(NAME("CQueuedOutputPin"), this, phr, L"Output");
   if(!m_pOutput) {
     *phr = E_OUTOFMEMORY;
   }
@@ -83,6 +99,8 @@ CLAVAudio::CLAVAudio(LPUNKNOWN pUnk, HRESULT* phr)
 
   InitBitstreaming();
 
+  m_pPerfInstance = g_AudioPerfCounters.CreateInstance(m_PerfValues);
+
 #ifdef DEBUG
   DbgSetModuleLevel (LOG_CUSTOM1, DWORD_MAX); // FFMPEG messages use custom1
   av_log_set_callback(lavf_log_callback);
@@ -103,6 +121,14 @@ CLAVAudio::CLAVAudio(LPUNKNOWN pUnk, HRESULT* phr)
 CLAVAudio::~CLAVAudio()
 {
   SAFE_DELETE(m_pTrayIcon);
+  g_AudioPerfCounters.DeleteInstance(m_pPerfInstance);
+
+  if (ThreadExists()) {
+    CallWorker(CMD_EXIT);
+    Close();
+  }
+  ClearDecodeQueue();
+
   ffmpeg_shutdown();
 
   ShutdownBitstreaming();
@@ -112,6 +138,9 @@ CLAVAudio::~CLAVAudio()
     m_hDllExtraDecoder = nullptr;
   }
 
+  m_pMemoryAccount->Update(LAVMemory_AudioBuffers, &m_nBuffersCharged, 0);
+  SafeRelease(&m_pMemoryAccount);
+
 #if defined(DEBUG) && defined(LAV_DEBUG_RELEASE)
   DbgCloseLogFile();
 #endif
@@ -186,6 +215,15 @@ HRESULT CLAVAudio::LoadDefaults()
 
   m_settings.SuppressFormatChanges = FALSE;
 
+  m_settings.OutputLatency = OutputLatency_Default;
+  m_settings.OutputBatchMs = PCM_BATCH_DEFAULT_MS;
+
+  m_settings.bDecodeAhead = FALSE;
+  m_settings.bLowFootprint = FALSE;
+
+  m_settings.OutputQueueDepth = 0;
+  m_settings.OutputQueueBatch = 1;
+
   return S_OK;
 }
 
@@ -203,8 +241,11 @@ HRESULT CLAVAudio::LoadSettings()
   if (m_bRuntimeConfig)
     return S_FALSE;
 
-  ReadSettings(HKEY_LOCAL_MACHINE);
-  return ReadSettings(HKEY_CURRENT_USER);
+  static CRegistrySettingsCache<decltype(m_settings)> cache(LAVC_AUDIO_REGISTRY_KEY);
+  return cache.Load(m_settings, [this]() {
+    ReadSettings(HKEY_LOCAL_MACHINE);
+    return ReadSettings(HKEY_CURRENT_USER);
+  });
 }
 
 HRESULT CLAVAudio::ReadSettings(HKEY rootKey)
@@ -284,6 +325,24 @@ HRESULT CLAVAudio::ReadSettings(HKEY rootKey)
     dwVal = reg.ReadDWORD(L"MixingLFELevel", hr);
     if (SUCCEEDED(hr)) m_settings.MixingLFELevel = dwVal;
 
+    dwVal = reg.ReadDWORD(L"OutputLatency", hr);
+    if (SUCCEEDED(hr) && dwVal < OutputLatency_NB) m_settings.OutputLatency = dwVal;
+
+    dwVal = reg.ReadDWORD(L"OutputBatchMs", hr);
+    if (SUCCEEDED(hr)) m_settings.OutputBatchMs = av_clip(dwVal, PCM_BATCH_MIN_MS, PCM_BATCH_MAX_MS);
+
+    bFlag = reg.ReadBOOL(L"DecodeAhead", hr);
+    if (SUCCEEDED(hr)) m_settings.bDecodeAhead = bFlag;
+
+    bFlag = reg.ReadBOOL(L"LowFootprint", hr);
+    if (SUCCEEDED(hr)) m_settings.bLowFootprint = bFlag;
+
+    dwVal = reg.ReadDWORD(L"OutputQueueDepth", hr);
+    if (SUCCEEDED(hr)) m_settings.OutputQueueDepth = min(dwVal, (DWORD)OUTPUT_QUEUE_MAX_DEPTH);
+
+    dwVal = reg.ReadDWORD(L"OutputQueueBatch", hr);
+    if (SUCCEEDED(hr)) m_settings.OutputQueueBatch = av_clip(dwVal, 1, OUTPUT_QUEUE_MAX_DEPTH);
+
     // Deprecated sample format storage
     pBuf = reg.ReadBinary(L"SampleFormats", dwVal, hr);
     if (SUCCEEDED(hr)) {
@@ -355,6 +414,12 @@ HRESULT CLAVAudio::SaveSettings()
     reg.WriteDWORD(L"MixingCenterLevel", m_settings.MixingCenterLevel);
     reg.WriteDWORD(L"MixingSurroundLevel", m_settings.MixingSurroundLevel);
     reg.WriteDWORD(L"MixingLFELevel", m_settings.MixingLFELevel);
+    reg.WriteDWORD(L"OutputLatency", m_settings.OutputLatency);
+    reg.WriteDWORD(L"OutputBatchMs", m_settings.OutputBatchMs);
+    reg.WriteBOOL(L"DecodeAhead", m_settings.bDecodeAhead);
+    reg.WriteBOOL(L"LowFootprint", m_settings.bLowFootprint);
+    reg.WriteDWORD(L"OutputQueueDepth", m_settings.OutputQueueDepth);
+    reg.WriteDWORD(L"OutputQueueBatch", m_settings.OutputQueueBatch);
 
     reg.DeleteKey(L"Formats");
     CreateRegistryKey(HKEY_CURRENT_USER, LAVC_AUDIO_REGISTRY_KEY_FORMATS);
@@ -421,6 +486,7 @@ STDMETHODIMP CLAVAudio::NonDelegatingQueryInterface(REFIID riid, void** ppv)
     QI(ISpecifyPropertyPages2)
     QI2(ILAVAudioSettings)
     QI2(ILAVAudioStatus)
+    QI(ILAVMemoryInfo)
     __super::NonDelegatingQueryInterface(riid, ppv);
 }
 
@@ -811,6 +877,84 @@ STDMETHODIMP_(BOOL) CLAVAudio::GetOutput51LegacyLayout()
   return m_settings.Output51Legacy;
 }
 
+STDMETHODIMP CLAVAudio::GetOutputLatency(LAVAudioOutputLatency *pLatency, DWORD *pdwBatchMs)
+{
+  if (pLatency)
+    *pLatency = (LAVAudioOutputLatency)m_settings.OutputLatency;
+  if (pdwBatchMs)
+    *pdwBatchMs = m_settings.OutputBatchMs;
+
+  return S_OK;
+}
+
+STDMETHODIMP CLAVAudio::SetOutputLatency(LAVAudioOutputLatency latency, DWORD dwBatchMs)
+{
+  if (latency < 0 || latency >= OutputLatency_NB)
+    return E_INVALIDARG;
+
+  m_settings.OutputLatency = latency;
+  m_settings.OutputBatchMs = av_clip(dwBatchMs, PCM_BATCH_MIN_MS, PCM_BATCH_MAX_MS);
+  return SaveSettings();
+}
+
+STDMETHODIMP CLAVAudio::SetDecodeAhead(BOOL bEnabled)
+{
+  m_settings.bDecodeAhead = bEnabled;
+  return SaveSettings();
+}
+
+STDMETHODIMP_(BOOL) CLAVAudio::GetDecodeAhead()
+{
+  return m_settings.bDecodeAhead;
+}
+
+STDMETHODIMP CLAVAudio::SetLowFootprint(BOOL bEnabled)
+{
+  m_settings.bLowFootprint = bEnabled;
+  return SaveSettings();
+}
+
+STDMETHODIMP_(BOOL) CLAVAudio::GetLowFootprint()
+{
+  return m_settings.bLowFootprint;
+}
+
+STDMETHODIMP CLAVAudio::GetMemoryBudget(ULONGLONG *pBudget)
+{
+  CheckPointer(pBudget, E_POINTER);
+  if (!m_pInput->IsConnected())
+    return E_UNEXPECTED;
+
+  // the output samples, and the output queue filled up to one sample
+  ULONGLONG budget = (ULONGLONG)(GetOutputBufferCount() + 1) * GetOutputBufferSize();
+
+  // the input and bitstreaming buffers are sized by the stream, and rarely grow after the first frames
+  budget += (ULONGLONG)m_buff.GetAllocated() + m_bsOutput.GetAllocated();
+
+  *pBudget = budget;
+  return S_OK;
+}
+
+STDMETHODIMP CLAVAudio::SetOutputQueue(DWORD dwDepth, DWORD dwBatchSize)
+{
+  if (dwDepth > OUTPUT_QUEUE_MAX_DEPTH)
+    return E_INVALIDARG;
+
+  m_settings.OutputQueueDepth = dwDepth;
+  m_settings.OutputQueueBatch = av_clip(dwBatchSize, 1, max(dwDepth, 1UL));
+  return SaveSettings();
+}
+
+STDMETHODIMP CLAVAudio::GetOutputQueue(DWORD *pdwDepth, DWORD *pdwBatchSize)
+{
+  if (pdwDepth)
+    *pdwDepth = m_settings.OutputQueueDepth;
+  if (pdwBatchSize)
+    *pdwBatchSize = m_settings.OutputQueueBatch;
+
+  return S_OK;
+}
+
 // ILAVAudioStatus
 BOOL CLAVAudio::IsSampleFormatSupported(LAVAudioSampleFormat sfCheck)
 {
@@ -904,6 +1048,7 @@ HRESULT CLAVAudio::GetOutputDetails(const char **pOutputFormat, int *pnChannels,
 HRESULT CLAVAudio::EnableVolumeStats()
 {
   DbgLog((LOG_TRACE, 1, L"Volume Statistics Enabled"));
+  m_VolumeMeter.Reset();
   m_bVolumeStats = TRUE;
   return S_OK;
 }
@@ -928,6 +1073,48 @@ HRESULT CLAVAudio::GetChannelVolumeAverage(WORD nChannel, float *pfDb)
   return S_OK;
 }
 
+HRESULT CLAVAudio::GetChannelLevels(WORD nChannel, LAVAudioChannelLevels *pLevels)
+{
+  CheckPointer(pLevels, E_POINTER);
+  if (!m_pOutput || m_pOutput->IsConnected() == FALSE || !m_bVolumeStats || m_avBSContext) {
+    return E_UNEXPECTED;
+  }
+  if (!m_VolumeMeter.GetLevels(nChannel, pLevels)) {
+    return E_INVALIDARG;
+  }
+  return S_OK;
+}
+
+HRESULT CLAVAudio::GetCaptureLatency(LAVAudioCaptureLatency *pLatency)
+{
+  CheckPointer(pLatency, E_POINTER);
+  CAutoLock lock(&m_csCaptureLatency);
+  *pLatency = m_CaptureLatency;
+  return m_CaptureLatency.dwBuffers ? S_OK : S_FALSE;
+}
+
+void CLAVAudio::AddCaptureLatency(REFERENCE_TIME rtLatency)
+{
+  LAV_TRACE("AudioCaptureLatency", LAV_TRACE_KEYWORD_AUDIO,
+            TraceLoggingInt64(rtLatency, "Latency"));
+
+  CAutoLock lock(&m_csCaptureLatency);
+  LAVAudioCaptureLatency &l = m_CaptureLatency;
+  if (l.dwBuffers == 0 || rtLatency < l.rtMin)
+    l.rtMin = rtLatency;
+  if (l.dwBuffers == 0 || rtLatency > l.rtMax)
+    l.rtMax = rtLatency;
+  l.rtAverage = (l.rtAverage * l.dwBuffers + rtLatency) / (l.dwBuffers + 1);
+  l.rtLast = rtLatency;
+  l.dwBuffers++;
+}
+
+void CLAVAudio::ResetCaptureLatency()
+{
+  CAutoLock lock(&m_csCaptureLatency);
+  memset(&m_CaptureLatency, 0, sizeof(m_CaptureLatency));
+}
+
 // CTransformFilter
 HRESULT CLAVAudio::CheckInputType(const CMediaType *mtIn)
 {
@@ -1026,6 +1213,23 @@ HRESULT CLAVAudio::GetMediaType(int iPosition, CMediaType *pMediaType)
   return S_OK;
 }
 
+// Ask downstream only once for every output type, so streams flipping between formats don't round trip every time
+HRESULT CLAVAudio::QueryAcceptOutput(const CMediaType &mt)
+{
+  for (const auto &entry : m_OutputTypeCache) {
+    if (entry.first == mt)
+      return entry.second;
+  }
+
+  HRESULT hr = m_pOutput->GetConnected()->QueryAccept(&mt);
+
+  if (m_OutputTypeCache.size() >= LAV_AUDIO_OUTPUT_TYPE_CACHE)
+    m_OutputTypeCache.erase(m_OutputTypeCache.begin());
+  m_OutputTypeCache.emplace_back(mt, hr);
+
+  return hr;
+}
+
 HRESULT CLAVAudio::ReconnectOutput(long cbBuffer, CMediaType& mt)
 {
   HRESULT hr = S_FALSE;
@@ -1159,9 +1363,9 @@ HRESULT CLAVAudio::DecideBufferSize(IMemAllocator* pAllocator, ALLOCATOR_PROPERT
   WAVEFORMATEX* wfe = (WAVEFORMATEX*)mt.Format();
   UNUSED_ALWAYS(wfe); */
 
-  pProperties->cBuffers = 4;
+  pProperties->cBuffers = GetOutputBufferCount();
   // TODO: we should base this on the output media type
-  pProperties->cbBuffer = LAV_AUDIO_BUFFER_SIZE; // 48KHz 6ch 32bps 100ms
+  pProperties->cbBuffer = GetOutputBufferSize();
   pProperties->cbAlign = 1;
   pProperties->cbPrefix = 0;
 
@@ -1178,7 +1382,7 @@ HRESULT CLAVAudio::DecideBufferSize(IMemAllocator* pAllocator, ALLOCATOR_PROPERT
 
 HRESULT CLAVAudio::ffmpeg_init(AVCodecID codec, const void *format, const GUID format_type, DWORD formatlen)
 {
-  CAutoLock lock(&m_csReceive);
+  CAutoLock lock(&m_csDecode);
   ffmpeg_shutdown();
   DbgLog((LOG_TRACE, 10, L"::ffmpeg_init(): Initializing decoder for codec %S", avcodec_get_name(codec)));
 
@@ -1517,6 +1721,8 @@ HRESULT CLAVAudio::CompleteConnect(PIN_DIRECTION dir, IPin *pReceivePin)
   DbgLog((LOG_TRACE, 5, L"CompleteConnect -- %S", dir == PINDIR_INPUT ? "in" : "out"));
   if (dir == PINDIR_OUTPUT)
   {
+    m_OutputTypeCache.clear();
+
     // check that we connected with a bitstream type, or go back to decoding otherwise
     if (m_avBSContext && m_settings.bBitstreamingFallback) {
       CMediaType &mt = m_pOutput->CurrentMediaType();
@@ -1544,6 +1750,8 @@ HRESULT CLAVAudio::EndOfStream()
   DbgLog((LOG_TRACE, 10, L"CLAVAudio::EndOfStream()"));
   CAutoLock cAutoLock(&m_csReceive);
 
+  WaitForDecodeIdle();
+
   // Flush the last data out of the parser
   ProcessBuffer(nullptr);
   ProcessBuffer(nullptr, TRUE);
@@ -1556,11 +1764,18 @@ HRESULT CLAVAudio::PerformFlush()
 {
   CAutoLock cAutoLock(&m_csReceive);
 
+  WaitForDecodeIdle();
+
   m_buff.Clear();
   FlushOutput(FALSE);
   FlushDecoder();
 
   m_bsOutput.SetSize(0);
+  SPDIFReset();
+  MATReset();
+  m_VolumeMeter.Reset();
+  ResetCaptureLatency();
+  UpdateMemoryUsage();
 
   m_rtStart = 0;
   m_bQueueResync = TRUE;
@@ -1578,6 +1793,10 @@ HRESULT CLAVAudio::BeginFlush()
 {
   DbgLog((LOG_TRACE, 10, L"CLAVAudio::BeginFlush()"));
   m_bFlushing = TRUE;
+
+  // Wake up the streaming thread if it's waiting for space in the decode queue
+  m_evDecodeQueueSpace.Set();
+
   return __super::BeginFlush();
 }
 
@@ -1586,6 +1805,10 @@ HRESULT CLAVAudio::EndFlush()
   DbgLog((LOG_TRACE, 10, L"CLAVAudio::EndFlush()"));
   CAutoLock cAutoLock(&m_csReceive);
 
+  // The decode thread drops all samples while flushing
+  WaitForDecodeIdle();
+  m_hrDecode = S_OK;
+
   if (m_bDVDPlayback)
     PerformFlush();
 
@@ -1608,6 +1831,43 @@ HRESULT CLAVAudio::NewSegment(REFERENCE_TIME tStart, REFERENCE_TIME tStop, doubl
   return __super::NewSegment(tStart, tStop, dRate);
 }
 
+HRESULT CLAVAudio::StartStreaming()
+{
+  CAutoLock cAutoLock(&m_csReceive);
+
+  // DVD playback relies on synchronous decoding
+  m_bDecodeAhead = m_settings.bDecodeAhead && !m_bDVDPlayback;
+  m_hrDecode = S_OK;
+  m_evDecodeIdle.Set();
+
+  if (m_bDecodeAhead && !ThreadExists()) {
+    if (!Create()) {
+      DbgLog((LOG_ERROR, 10, L"CLAVAudio::StartStreaming(): Creating the decode thread failed, decoding synchronously"));
+      m_bDecodeAhead = FALSE;
+    }
+  }
+
+  // the output queue is created when the output pin is activated, right after this
+  static_cast<CQueuedOutputPin *>(m_pOutput)->SetOutputQueue(m_bDVDPlayback ? 0 : m_settings.OutputQueueDepth, m_settings.OutputQueueBatch);
+
+  return __super::StartStreaming();
+}
+
+HRESULT CLAVAudio::StopStreaming()
+{
+  // Called with the receive lock held, after the output allocator was decommitted
+  // The decode thread never takes the receive lock, so it can always finish its current sample
+  if (ThreadExists()) {
+    CallWorker(CMD_EXIT);
+    Close();
+  }
+
+  ClearDecodeQueue();
+  m_bDecodeAhead = FALSE;
+
+  return __super::StopStreaming();
+}
+
 HRESULT CLAVAudio::FlushDecoder()
 {
   if (m_bJustFlushed)
@@ -1634,13 +1894,37 @@ HRESULT CLAVAudio::Receive(IMediaSample *pIn)
 {
   CAutoLock cAutoLock(&m_csReceive);
 
-  HRESULT hr;
-
   AM_SAMPLE2_PROPERTIES const *pProps = m_pInput->SampleProps();
   if(pProps->dwStreamId != AM_STREAM_MEDIA) {
+    WaitForDecodeIdle();
     return m_pOutput->Deliver(pIn);
   }
 
+  // Format changes and bitstreaming changes re-create the decoder, which is always done synchronously
+  if (m_bDecodeAhead && !(pProps->dwSampleFlags & AM_SAMPLE_TYPECHANGED) && !m_bBitStreamingSettingsChanged)
+    return QueueSample(pIn);
+
+  WaitForDecodeIdle();
+
+  CAutoLock decodeLock(&m_csDecode);
+  HRESULT hr = ProcessSample(pIn);
+  UpdateMemoryUsage();
+  return hr;
+}
+
+void CLAVAudio::UpdateMemoryUsage()
+{
+  size_t nBytes = (size_t)m_buff.GetAllocated() + m_bsOutput.GetAllocated();
+  if (m_OutputQueue.bBuffer)
+    nBytes += m_OutputQueue.bBuffer->GetAllocated();
+
+  m_pMemoryAccount->Update(LAVMemory_AudioBuffers, &m_nBuffersCharged, nBytes);
+}
+
+HRESULT CLAVAudio::ProcessSample(IMediaSample *pIn)
+{
+  HRESULT hr;
+
   AM_MEDIA_TYPE *pmt;
   if(SUCCEEDED(pIn->GetMediaType(&pmt)) && pmt) {
     DbgLog((LOG_TRACE, 10, L"::Receive(): Input sample contained media type, dynamic format change..."));
@@ -1717,6 +2001,17 @@ HRESULT CLAVAudio::Receive(IMediaSample *pIn)
   m_rtStartInput = SUCCEEDED(hr) ? rtStart : AV_NOPTS_VALUE;
   m_rtStopInput = (hr == S_OK) ? rtStop : AV_NOPTS_VALUE;
 
+  // Capture time of the source data, if the splitter provides it
+  m_rtCaptureInput = AV_NOPTS_VALUE;
+  IMediaSideData *pSideData = nullptr;
+  if (SUCCEEDED(pIn->QueryInterface(&pSideData))) {
+    const MediaSideDataCaptureTime *pCapture = nullptr;
+    size_t size = 0;
+    if (SUCCEEDED(pSideData->GetSideData(IID_MediaSideDataCaptureTime, (const BYTE **)&pCapture, &size)) && size == sizeof(MediaSideDataCaptureTime))
+      m_rtCaptureInput = pCapture->rtCapture;
+    SafeRelease(&pSideData);
+  }
+
   DWORD bufflen = m_buff.GetCount();
 
   // Hack to re-create the BD LPCM header because in the MPC-HC format its stripped off.
@@ -1741,6 +2036,14 @@ HRESULT CLAVAudio::Receive(IMediaSample *pIn)
     return E_FAIL;
   }
 
+  // Without any buffered data, try to decode straight from the packet of the splitter
+  if (bufflen == 0) {
+    BOOL bProcessed = FALSE;
+    hr = ProcessInPlace(pIn, pDataIn, len, &bProcessed);
+    if (bProcessed)
+      return FAILED(hr) ? hr : S_OK;
+  }
+
   m_buff.Allocate(bufflen + len + AV_INPUT_BUFFER_PADDING_SIZE);
   m_buff.Append(pDataIn, len);
 
@@ -1752,6 +2055,97 @@ HRESULT CLAVAudio::Receive(IMediaSample *pIn)
   return S_OK;
 }
 
+HRESULT CLAVAudio::QueueSample(IMediaSample *pIn)
+{
+  // Limit the number of samples decoded ahead
+  const size_t nQueueSize = m_settings.bLowFootprint ? LAV_AUDIO_LOW_FOOTPRINT_QUEUE_SIZE : LAV_AUDIO_DECODE_QUEUE_SIZE;
+  while (m_DecodeQueue.Size() >= nQueueSize && !m_bFlushing && SUCCEEDED(m_hrDecode)) {
+    m_evDecodeQueueSpace.Wait();
+  }
+
+  if (m_bFlushing)
+    return S_FALSE;
+
+  // Decoding or delivery failed, stop accepting samples
+  if (FAILED(m_hrDecode))
+    return m_hrDecode;
+
+  pIn->AddRef();
+  {
+    CAutoLock lock(&m_DecodeQueue);
+    m_evDecodeIdle.Reset();
+    m_DecodeQueue.Push(pIn);
+  }
+  m_evDecodeQueued.Set();
+
+  return S_OK;
+}
+
+HRESULT CLAVAudio::WaitForDecodeIdle()
+{
+  if (!m_bDecodeAhead || !ThreadExists())
+    return S_FALSE;
+
+  m_evDecodeIdle.Wait();
+  return S_OK;
+}
+
+void CLAVAudio::ClearDecodeQueue()
+{
+  IMediaSample *pSample = nullptr;
+  while (pSample = m_DecodeQueue.Pop()) {
+    SafeRelease(&pSample);
+  }
+  m_evDecodeQueueSpace.Set();
+  m_evDecodeIdle.Set();
+}
+
+DWORD CLAVAudio::ThreadProc()
+{
+  SetThreadName(-1, "LAVAudio Decode");
+
+  HANDLE hEvts[] = { GetRequestHandle(), m_evDecodeQueued };
+
+  while (1) {
+    DWORD dwWait = WaitForMultipleObjects(countof(hEvts), hEvts, FALSE, INFINITE);
+    if (dwWait == WAIT_OBJECT_0) {
+      DWORD cmd = GetRequest();
+      switch (cmd) {
+      case CMD_EXIT:
+        Reply(S_OK);
+        return 0;
+      }
+    } else if (dwWait == WAIT_OBJECT_0 + 1) {
+      while (!CheckRequest(nullptr)) {
+        IMediaSample *pSample = nullptr;
+        {
+          CAutoLock lock(&m_DecodeQueue);
+          pSample = m_DecodeQueue.Pop();
+          if (!pSample) {
+            m_evDecodeIdle.Set();
+            break;
+          }
+        }
+        m_evDecodeQueueSpace.Set();
+
+        // Samples queued before a flush are dropped, as is everything after a failure
+        if (!m_bFlushing && SUCCEEDED(m_hrDecode)) {
+          CAutoLock lock(&m_csDecode);
+          HRESULT hr = ProcessSample(pSample);
+          UpdateMemoryUsage();
+          if (FAILED(hr)) {
+            DbgLog((LOG_ERROR, 10, L"::ThreadProc(): Decoding failed with hr: %x", hr));
+            m_hrDecode = hr;
+            m_evDecodeQueueSpace.Set();
+          }
+        }
+        SafeRelease(&pSample);
+      }
+    }
+  }
+  return 0;
+}
+
 #define SAME_HEADER_MASK \
    (0xffe00000 | (3 << 17) | (3 << 10) | (3 << 19))
 
@@ -1769,13 +2163,30 @@ static int check_mpegaudio_header(uint8_t *buf, uint32_t *retheader)
   return sd.frame_size;
 }
 
+// Count the DTS sync words of one kind, 14-bit words also need the bits following the marker
+static int count_dts_sync_words(const BYTE *p, const BYTE *end, uint32_t marker)
+{
+  int count = 0;
+  for (const BYTE *m = FindSyncWord32(p, end, marker); m < end; m = FindSyncWord32(m + 1, end, marker)) {
+    if (marker == DCA_MARKER_14B_LE && !((end - m) >= 6 && (m[4] & 0xF0) == 0xF0 && m[5] == 0x07))
+      continue;
+    if (marker == DCA_MARKER_14B_BE && !((end - m) >= 6 && m[4] == 0x07 && (m[5] & 0xF0) == 0xF0))
+      continue;
+    count++;
+  }
+  return count;
+}
+
 HRESULT CLAVAudio::ResyncMPEGAudio()
 {
   uint8_t *buf = m_buff.Ptr();
   int size = m_buff.GetCount();
+  const uint8_t *end = buf + size;
 
-  for (int i = 0; i < (size - 3); i++)
+  // only positions with the 11-bit frame sync can hold a valid header
+  for (const uint8_t *p = FindSyncWord16(buf, end, 0xffe0, 0xffe0); (end - p) > 3; p = FindSyncWord16(p + 1, end, 0xffe0, 0xffe0))
   {
+    const int i = (int)(p - buf);
     uint32_t header, header2;
     int frame_size = check_mpegaudio_header(buf + i, &header);
     if (frame_size > 0 && (i + frame_size + 4) < size) {
@@ -1810,16 +2221,11 @@ HRESULT CLAVAudio::ProcessBuffer(IMediaSample *pMediaSample, BOOL bEOF)
 
   if (!bEOF) {
     if (m_bFindDTSInPCM) {
-      int i = 0, count = 0;
-      uint32_t state = -1;
-      for (i = 0; i < buffer_size; ++i) {
-        state = (state << 8) | p[i];
-        if ((state == DCA_MARKER_14B_LE && (i < buffer_size-2) && (p[i+1] & 0xF0) == 0xF0 && p[i+2] == 0x07)
-          || (state == DCA_MARKER_14B_BE && (i < buffer_size-2) && p[i+1] == 0x07 && (p[i+2] & 0xF0) == 0xF0)
-          || state == DCA_MARKER_RAW_LE || state == DCA_MARKER_RAW_BE) {
-            count++;
-        }
-      }
+      const BYTE *end = p + buffer_size;
+      int count = count_dts_sync_words(p, end, DCA_MARKER_14B_LE)
+                + count_dts_sync_words(p, end, DCA_MARKER_14B_BE)
+                + count_dts_sync_words(p, end, DCA_MARKER_RAW_LE)
+                + count_dts_sync_words(p, end, DCA_MARKER_RAW_BE);
       if (count >= 4) {
         DbgLog((LOG_TRACE, 10, L"::ProcessBuffer(): Detected %d DTS sync words in %d bytes of data, switching to DTS-in-WAV decoding", count, buffer_size));
         CMediaType mt = m_pInput->CurrentMediaType();
@@ -1940,6 +2346,54 @@ HRESULT CLAVAudio::ProcessBuffer(IMediaSample *pMediaSample, BOOL bEOF)
   return hr;
 }
 
+HRESULT CLAVAudio::ProcessInPlace(IMediaSample *pMediaSample, const BYTE *pData, int size, BOOL *pbProcessed)
+{
+  *pbProcessed = FALSE;
+
+  // Only plain decoding can work on the data in-place, everything else needs the input buffer
+  if (m_avBSContext || m_pDTSDecoderContext || m_bFindDTSInPCM || m_bMPEGAudioResync || m_raData.deint_id
+    || m_pInput->CurrentMediaType().subtype == MEDIASUBTYPE_DOLBY_AC3_SPDIF)
+    return S_FALSE;
+
+  IMediaSampleAVPacket *pSamplePacket = nullptr;
+  if (FAILED(pMediaSample->QueryInterface(&pSamplePacket)))
+    return S_FALSE;
+
+  AVPacket *pkt = av_packet_alloc();
+  HRESULT hr = pkt ? pSamplePacket->GetAVPacketRef(pkt) : E_OUTOFMEMORY;
+  SafeRelease(&pSamplePacket);
+
+  // The data may have been modified by the input pin
+  if (FAILED(hr) || pkt->data != pData || pkt->size != size) {
+    av_packet_free(&pkt);
+    return S_FALSE;
+  }
+
+  *pbProcessed = TRUE;
+
+  int consumed = 0;
+  HRESULT hr2 = Decode(pData, size, consumed, &hr, pMediaSample, pkt->buf);
+  av_packet_free(&pkt);
+
+  if (FAILED(hr2)) {
+    DbgLog((LOG_TRACE, 10, L"Dropped invalid sample in ProcessInPlace"));
+    m_bQueueResync = TRUE;
+    return S_FALSE;
+  } else if (FAILED(hr)) {
+    DbgLog((LOG_TRACE, 10, L"::Decode indicates delivery failed"));
+    return hr;
+  }
+
+  // Keep any data the decoder did not consume for the next sample
+  consumed = max(consumed, 0);
+  if (consumed < size) {
+    m_buff.Allocate(size - consumed + AV_INPUT_BUFFER_PADDING_SIZE);
+    m_buff.Append(pData + consumed, size - consumed);
+  }
+
+  return hr2 == S_FALSE ? S_FALSE : hr;
+}
+
 static DWORD get_lav_channel_layout(uint64_t layout)
 {
   if (layout > UINT32_MAX) {
@@ -1957,7 +2411,7 @@ static DWORD get_lav_channel_layout(uint64_t layout)
   return (DWORD)layout;
 }
 
-HRESULT CLAVAudio::Decode(const BYTE * pDataBuffer, int buffsize, int &consumed, HRESULT *hrDeliver, IMediaSample *pMediaSample)
+HRESULT CLAVAudio::Decode(const BYTE * pDataBuffer, int buffsize, int &consumed, HRESULT *hrDeliver, IMediaSample *pMediaSample, AVBufferRef *pInputBuffer)
 {
   int got_frame	= 0;
   BYTE *tmpProcessBuf = nullptr;
@@ -2063,7 +2517,13 @@ HRESULT CLAVAudio::Decode(const BYTE * pDataBuffer, int buffsize, int &consumed,
 
         CopyMediaSideDataFF(&avpkt, &pFFSideData);
 
+        LAV_TRACE("AudioDecodeBegin", LAV_TRACE_KEYWORD_AUDIO,
+                  TraceLoggingInt64(avpkt.dts, "Start"),
+                  TraceLoggingInt32(avpkt.size, "Size"));
         int ret2 = avcodec_decode_audio4(m_pAVCtx, m_pFrame, &got_frame, &avpkt);
+        LAV_TRACE("AudioDecodeEnd", LAV_TRACE_KEYWORD_AUDIO,
+                  TraceLoggingInt32(ret2, "Result"),
+                  TraceLoggingInt32(got_frame ? m_pFrame->nb_samples : 0, "Samples"));
         if (ret2 < 0) {
           DbgLog((LOG_TRACE, 50, L"::Decode() - decoding failed despite successfull parsing"));
           m_bQueueResync = TRUE;
@@ -2087,9 +2547,19 @@ HRESULT CLAVAudio::Decode(const BYTE * pDataBuffer, int buffsize, int &consumed,
       avpkt.size = buffsize;
       avpkt.dts  = m_rtStartInput;
 
+      // reference the input buffer, so the decoder does not need to copy the data
+      if (pInputBuffer)
+        avpkt.buf = av_buffer_ref(pInputBuffer);
+
       CopyMediaSideDataFF(&avpkt, &pFFSideData);
 
+      LAV_TRACE("AudioDecodeBegin", LAV_TRACE_KEYWORD_AUDIO,
+                TraceLoggingInt64(avpkt.dts, "Start"),
+                TraceLoggingInt32(avpkt.size, "Size"));
       int used_bytes = avcodec_decode_audio4(m_pAVCtx, m_pFrame, &got_frame, &avpkt);
+      LAV_TRACE("AudioDecodeEnd", LAV_TRACE_KEYWORD_AUDIO,
+                TraceLoggingInt32(used_bytes, "Result"),
+                TraceLoggingInt32(got_frame ? m_pFrame->nb_samples : 0, "Samples"));
 
       if(used_bytes < 0) {
         av_packet_unref(&avpkt);
@@ -2158,88 +2628,39 @@ HRESULT CLAVAudio::Decode(const BYTE * pDataBuffer, int buffsize, int &consumed,
         {
           out.bBuffer->Allocate(dwPCMSizeAligned / 2);
           out.bBuffer->SetSize(dwPCMSize / 2);
-          float *pDataOut = (float *)(out.bBuffer->Ptr());
-
-          for (size_t i = 0; i < out.nSamples; ++i) {
-            for(int ch = 0; ch < out.wChannels; ++ch) {
-              *pDataOut = (float)((double *)m_pFrame->data[0]) [ch+i*m_pAVCtx->channels];
-              pDataOut++;
-            }
-          }
+          convert_dbl_to_flt((const double *)m_pFrame->data[0], (float *)(out.bBuffer->Ptr()), out.nSamples * out.wChannels);
         }
         out.sfFormat = SampleFormat_FP32;
         break;
       // Planar Formats
       case AV_SAMPLE_FMT_U8P:
-        {
-          out.bBuffer->Allocate(dwPCMSizeAligned);
-          out.bBuffer->SetSize(dwPCMSize);
-          uint8_t *pOut = (uint8_t *)(out.bBuffer->Ptr());
-
-          for (size_t i = 0; i < out.nSamples; ++i) {
-            for(int ch = 0; ch < out.wChannels; ++ch) {
-              *pOut++ = ((uint8_t *)m_pFrame->extended_data[ch])[i];
-            }
-          }
-        }
-        out.sfFormat = SampleFormat_U8;
-        break;
       case AV_SAMPLE_FMT_S16P:
-        {
-          out.bBuffer->Allocate(dwPCMSizeAligned);
-          out.bBuffer->SetSize(dwPCMSize);
-          int16_t *pOut = (int16_t *)(out.bBuffer->Ptr());
-
-          for (size_t i = 0; i < out.nSamples; ++i) {
-            for(int ch = 0; ch < out.wChannels; ++ch) {
-              *pOut++ = ((int16_t *)m_pFrame->extended_data[ch])[i];
-            }
-          }
-        }
-        out.sfFormat = SampleFormat_16;
-        break;
       case AV_SAMPLE_FMT_S32P:
-        {
-          out.bBuffer->Allocate(dwPCMSizeAligned);
-          out.bBuffer->SetSize(dwPCMSize);
-          int32_t *pOut = (int32_t *)(out.bBuffer->Ptr());
-
-          for (size_t i = 0; i < out.nSamples; ++i) {
-            for(int ch = 0; ch < out.wChannels; ++ch) {
-              *pOut++ = ((int32_t *)m_pFrame->extended_data[ch])[i];
-            }
-          }
-        }
-        out.sfFormat = SampleFormat_32;
-        out.wBitsPerSample = m_pAVCtx->bits_per_raw_sample;
-        break;
       case AV_SAMPLE_FMT_FLTP:
-        {
-          out.bBuffer->Allocate(dwPCMSizeAligned);
-          out.bBuffer->SetSize(dwPCMSize);
-          float *pOut = (float *)(out.bBuffer->Ptr());
-
-          for (size_t i = 0; i < out.nSamples; ++i) {
-            for(int ch = 0; ch < out.wChannels; ++ch) {
-              *pOut++ = ((float *)m_pFrame->extended_data[ch])[i];
-            }
-          }
-        }
-        out.sfFormat = SampleFormat_FP32;
-        break;
       case AV_SAMPLE_FMT_DBLP:
         {
-          out.bBuffer->Allocate(dwPCMSizeAligned / 2);
-          out.bBuffer->SetSize(dwPCMSize / 2);
-          float *pOut = (float *)(out.bBuffer->Ptr());
-
-          for (size_t i = 0; i < out.nSamples; ++i) {
-            for(int ch = 0; ch < out.wChannels; ++ch) {
-              *pOut++ = (float)((double *)m_pFrame->extended_data[ch])[i];
-            }
+          // double samples are converted to float while interleaving
+          const BOOL bDouble = (m_pAVCtx->sample_fmt == AV_SAMPLE_FMT_DBLP);
+          out.bBuffer->Allocate(bDouble ? dwPCMSizeAligned / 2 : dwPCMSizeAligned);
+          out.bBuffer->SetSize(bDouble ? dwPCMSize / 2 : dwPCMSize);
+          interleave_samples(m_pFrame->extended_data, m_pAVCtx->sample_fmt, out.wChannels, out.bBuffer->Ptr(), (int)out.nSamples);
+
+          switch (m_pAVCtx->sample_fmt) {
+          case AV_SAMPLE_FMT_U8P:
+            out.sfFormat = SampleFormat_U8;
+            break;
+          case AV_SAMPLE_FMT_S16P:
+            out.sfFormat = SampleFormat_16;
+            break;
+          case AV_SAMPLE_FMT_S32P:
+            out.sfFormat = SampleFormat_32;
+            out.wBitsPerSample = m_pAVCtx->bits_per_raw_sample;
+            break;
+          default:
+            out.sfFormat = SampleFormat_FP32;
+            break;
           }
         }
-        out.sfFormat = SampleFormat_FP32;
         break;
       default:
         assert(FALSE);
@@ -2251,6 +2672,16 @@ HRESULT CLAVAudio::Decode(const BYTE * pDataBuffer, int buffsize, int &consumed,
       m_DecodeFormat = out.sfFormat == SampleFormat_32 && out.wBitsPerSample > 0 && out.wBitsPerSample <= 24 ? (out.wBitsPerSample <= 16 ? SampleFormat_16 : SampleFormat_24) : out.sfFormat;
       m_DecodeLayout = out.dwChannelMask;
 
+      // Audio ending before the seek target is dropped on delivery, don't spend any time on mixing and converting it
+      // Until the first buffer is delivered after a seek, the output timestamps follow the input, so it can be skipped entirely
+      if (m_bResyncTimestamp && out.rtStart != AV_NOPTS_VALUE && m_OutputQueue.nSamples == 0) {
+        REFERENCE_TIME rtStop = out.rtStart + (REFERENCE_TIME)(out.nSamples * DBL_SECOND_MULT / out.dwSamplesPerSec / m_dRate);
+        if (rtStop <= 0) {
+          m_rtStart = rtStop;
+          continue;
+        }
+      }
+
       if (SUCCEEDED(PostProcess(&out))) {
         *hrDeliver = QueueOutput(out);
         if (FAILED(*hrDeliver)) {
@@ -2303,9 +2734,10 @@ HRESULT CLAVAudio::QueueOutput(BufferDetails &buffer)
     m_OutputQueue.wBitsPerSample = buffer.wBitsPerSample;
   }
 
-  if (m_OutputQueue.nSamples == 0)
+  if (m_OutputQueue.nSamples == 0) {
     m_OutputQueue.rtStart = buffer.rtStart;
-  else if (m_OutputQueue.rtStart == AV_NOPTS_VALUE && buffer.rtStart != AV_NOPTS_VALUE)
+    m_OutputQueue.rtCapture = m_rtCaptureInput;
+  } else if (m_OutputQueue.rtStart == AV_NOPTS_VALUE && buffer.rtStart != AV_NOPTS_VALUE)
     m_OutputQueue.rtStart = buffer.rtStart - (REFERENCE_TIME)((double)m_OutputQueue.nSamples / m_OutputQueue.dwSamplesPerSec * 10000000.0);
 
   // Try to retain the buffer, if possible
@@ -2319,21 +2751,55 @@ HRESULT CLAVAudio::QueueOutput(BufferDetails &buffer)
   buffer.bBuffer->SetSize(0);
   buffer.nSamples = 0;
 
+  // Sample duration targets of the latency policy
+  double dMaxDuration = PCM_BUFFER_MAX_DURATION, dMinDuration = PCM_BUFFER_MIN_DURATION;
+  if (m_settings.OutputLatency == OutputLatency_Low) {
+    dMaxDuration = dMinDuration = 0.0;
+  } else if (m_settings.OutputLatency == OutputLatency_Throughput) {
+    dMaxDuration = GetOutputBatchMs() * 10000.0;
+    dMinDuration = dMaxDuration * 0.6;
+  }
+
   // Length of the current sample
   double dDuration = (double)m_OutputQueue.nSamples / m_OutputQueue.dwSamplesPerSec * 10000000.0;
   double dOffset = fmod(dDuration, 1.0);
 
   // Don't exceed the buffer
-  if (dDuration >= PCM_BUFFER_MAX_DURATION || (dDuration >= PCM_BUFFER_MIN_DURATION && dOffset <= FLT_EPSILON)) {
+  if (dDuration >= dMaxDuration || (dDuration >= dMinDuration && dOffset <= FLT_EPSILON)) {
     hr = FlushOutput();
   }
 
   return hr;
 }
 
+// Size of the output buffers, large enough for one batch of 192kHz 32-bit 8 channel audio
+long CLAVAudio::GetOutputBufferSize() const
+{
+  const long nBufferSize = m_settings.bLowFootprint ? LAV_AUDIO_LOW_FOOTPRINT_BUFFER_SIZE : LAV_AUDIO_BUFFER_SIZE;
+  if (m_settings.OutputLatency == OutputLatency_Throughput)
+    return max(nBufferSize, (long)(LAV_AUDIO_BUFFER_SIZE / 1000 * GetOutputBatchMs()));
+
+  return nBufferSize;
+}
+
+// Low latency delivers many small samples, allow more of them in flight
+// Samples waiting in the output queue need buffers of their own, or the allocator would bound the queue instead
+long CLAVAudio::GetOutputBufferCount() const
+{
+  const long nBuffers = (m_settings.OutputLatency == OutputLatency_Low) ? 8 : 4;
+  return nBuffers + (m_bDVDPlayback ? 0 : (long)m_settings.OutputQueueDepth);
+}
+
+DWORD CLAVAudio::GetOutputBatchMs() const
+{
+  if (m_settings.bLowFootprint)
+    return min(m_settings.OutputBatchMs, (DWORD)PCM_BATCH_LOW_FOOTPRINT_MS);
+  return m_settings.OutputBatchMs;
+}
+
 HRESULT CLAVAudio::FlushOutput(BOOL bDeliver)
 {
-  CAutoLock cAutoLock(&m_csReceive);
+  CAutoLock cAutoLock(&m_csDecode);
 
   HRESULT hr = S_OK;
   if (bDeliver && m_OutputQueue.nSamples > 0)
@@ -2343,6 +2809,7 @@ HRESULT CLAVAudio::FlushOutput(BOOL bDeliver)
   m_OutputQueue.nSamples = 0;
   m_OutputQueue.bBuffer->SetSize(0);
   m_OutputQueue.rtStart = AV_NOPTS_VALUE;
+  m_OutputQueue.rtCapture = AV_NOPTS_VALUE;
 
   return hr;
 }
@@ -2416,12 +2883,12 @@ HRESULT CLAVAudio::Deliver(BufferDetails &buffer)
 
   if(hr == S_OK) {
   retry_qa:
-    hr = m_pOutput->GetConnected()->QueryAccept(&mt);
+    hr = QueryAcceptOutput(mt);
     DbgLog((LOG_TRACE, 1, L"Sending new Media Type (QueryAccept: %0#.8x)", hr));
     if (hr != S_OK) {
       if (buffer.sfFormat != SampleFormat_16) {
         mt = CreateMediaType(SampleFormat_16, buffer.dwSamplesPerSec, buffer.wChannels, buffer.dwChannelMask, 16);
-        hr = m_pOutput->GetConnected()->QueryAccept(&mt);
+        hr = QueryAcceptOutput(mt);
         if (hr == S_OK) {
           DbgLog((LOG_TRACE, 1, L"-> 16-bit fallback type accepted"));
           m_FallbackFormat = SampleFormat_16;
@@ -2448,10 +2915,10 @@ HRESULT CLAVAudio::Deliver(BufferDetails &buffer)
         }
         if (buffer.wChannels != wfeCurrent->nChannels || buffer.dwChannelMask != dwChannelMask) {
           mt = CreateMediaType(buffer.sfFormat, buffer.dwSamplesPerSec, wChannels, dwChannelMask, buffer.wBitsPerSample);
-          hr = m_pOutput->GetConnected()->QueryAccept(&mt);
+          hr = QueryAcceptOutput(mt);
           if (hr != S_OK) {
             mt = CreateMediaType(SampleFormat_16, buffer.dwSamplesPerSec, wChannels, dwChannelMask, 16);
-            hr = m_pOutput->GetConnected()->QueryAccept(&mt);
+            hr = QueryAcceptOutput(mt);
             if (hr == S_OK)
               m_FallbackFormat = SampleFormat_16;
           }
@@ -2487,9 +2954,29 @@ HRESULT CLAVAudio::Deliver(BufferDetails &buffer)
 
   memcpy(pDataOut, buffer.bBuffer->Ptr(), buffer.bBuffer->GetCount());
 
+  // A buffer which starts after the stream time already passed it left the renderer without data
+  // Every late period counts as one underrun, not every buffer of it.
+  REFERENCE_TIME rtNow = 0;
+  if (m_State == State_Running && m_pClock && SUCCEEDED(m_pClock->GetTime(&rtNow))) {
+    const BOOL bUnderrun = rtStart < rtNow - (REFERENCE_TIME)m_tStart;
+    if (bUnderrun && !m_bUnderrun)
+      perf_counter_add(&m_PerfValues[AudioPerf_Underruns], 1);
+    m_bUnderrun = bUnderrun;
+  }
+
+  LAV_TRACE("AudioDeliverBegin", LAV_TRACE_KEYWORD_AUDIO,
+            TraceLoggingInt64(rtStart, "Start"),
+            TraceLoggingInt64(rtStop, "Stop"),
+            TraceLoggingInt32(buffer.nSamples, "Samples"));
   hr = m_pOutput->Deliver(pOut);
+  LAV_TRACE("AudioDeliverEnd", LAV_TRACE_KEYWORD_AUDIO,
+            TraceLoggingHResult(hr, "Result"));
+  if (SUCCEEDED(hr) && buffer.rtCapture != AV_NOPTS_VALUE)
+    AddCaptureLatency(timer_get_ref_time() - buffer.rtCapture);
   if (FAILED(hr)) {
     DbgLog((LOG_ERROR, 10, L"::Deliver failed with code: %0#.8x", hr));
+    // downstream might have changed its mind about the types it accepts
+    m_OutputTypeCache.clear();
   }
 done:
   SafeRelease(&pOut);
@@ -2501,6 +2988,8 @@ HRESULT CLAVAudio::BreakConnect(PIN_DIRECTION dir)
   if(dir == PINDIR_INPUT) {
     ffmpeg_shutdown();
     m_bHasVideo = -1;
+  } else {
+    m_OutputTypeCache.clear();
   }
   return __super::BreakConnect(dir);
 }
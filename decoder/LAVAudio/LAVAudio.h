@@ -24,9 +24,18 @@
 #include "Media.h"
 #include "BitstreamParser.h"
 #include "PostProcessor.h"
+#include "MatrixMixer.h"
+#include "VolumeMeter.h"
+#include "PCMBufferPool.h"
 
 #include "ISpecifyPropertyPages2.h"
 #include "BaseTrayIcon.h"
+#include "SynchronizedQueue.h"
+#include "MemoryAccount.h"
+#include "QueuedOutputPin.h"
+#include "PerfCounters.h"
+
+#include <vector>
 
 //////////////////// Configuration //////////////////////////
 
@@ -40,11 +49,35 @@
 // 6ms
 #define PCM_BUFFER_MIN_DURATION 60000
 
+// Limits of the output batch duration in throughput mode (in ms)
+#define PCM_BATCH_MIN_MS     10
+#define PCM_BATCH_MAX_MS     2000
+#define PCM_BATCH_DEFAULT_MS 500
+
+// Number of input samples queued for the decode-ahead thread
+#define LAV_AUDIO_DECODE_QUEUE_SIZE 16
+
+// Number of output types whose QueryAccept answer is remembered
+#define LAV_AUDIO_OUTPUT_TYPE_CACHE 16
+
+// Limits of the low footprint profile
+// Output buffers of 250ms of 192kHz 32-bit with 8 channels, they are still grown for larger samples
+#define LAV_AUDIO_LOW_FOOTPRINT_BUFFER_SIZE (LAV_AUDIO_BUFFER_SIZE / 4)
+#define LAV_AUDIO_LOW_FOOTPRINT_QUEUE_SIZE  4
+#define PCM_BATCH_LOW_FOOTPRINT_MS          100
+
 // Maximum desync that we attribute to jitter before re-syncing (10ms)
 #define MAX_JITTER_DESYNC 100000i64
 
 //////////////////// End Configuration //////////////////////
 
+// Counters of the "LAV Audio" counter set, in the order of LAVFilters.PerfCounters.man
+enum LAVAudioPerfCounter {
+  AudioPerf_Underruns,          // Output which started after its presentation time, the renderer ran out of data
+
+  AudioPerf_NB
+};
+
 #define AV_CODEC_ID_PCM_SxxBE (AVCodecID)0x19001
 #define AV_CODEC_ID_PCM_SxxLE (AVCodecID)0x19002
 #define AV_CODEC_ID_PCM_UxxBE (AVCodecID)0x19003
@@ -66,20 +99,21 @@ struct BufferDetails {
   WORD                  wChannels       = 0;               // Number of channels
   DWORD                 dwChannelMask   = 0;               // channel mask
   REFERENCE_TIME        rtStart         = AV_NOPTS_VALUE;  // Start Time of the buffer
+  REFERENCE_TIME        rtCapture       = AV_NOPTS_VALUE;  // Capture time of the source data of the first samples
   BOOL                  bPlanar         = FALSE;           // Planar (not used)
 
 
   BufferDetails() {
-    bBuffer = new GrowableArray<BYTE>();
+    bBuffer = AcquirePCMBuffer();
   };
   ~BufferDetails() {
-    delete bBuffer;
+    ReleasePCMBuffer(bBuffer);
   }
 };
 
 struct DTSDecoder;
 
-class __declspec(uuid("E8E73B6B-4CB3-44A4-BE99-4F7BCB96E491")) CLAVAudio : public CTransformFilter, public ISpecifyPropertyPages2, public ILAVAudioSettings, public ILAVAudioStatus
+class __declspec(uuid("E8E73B6B-4CB3-44A4-BE99-4F7BCB96E491")) CLAVAudio : public CTransformFilter, public ISpecifyPropertyPages2, public ILAVAudioSettings, public ILAVAudioStatus, public ILAVMemoryInfo, protected CAMThread
 {
 public:
   CLAVAudio(LPUNKNOWN pUnk, HRESULT* phr);
@@ -137,6 +171,15 @@ public:
   STDMETHODIMP_(BOOL) GetSuppressFormatChanges();
   STDMETHODIMP SetOutput51LegacyLayout(BOOL b51Legacy);
   STDMETHODIMP_(BOOL) GetOutput51LegacyLayout();
+  STDMETHODIMP GetOutputLatency(LAVAudioOutputLatency *pLatency, DWORD *pdwBatchMs);
+  STDMETHODIMP SetOutputLatency(LAVAudioOutputLatency latency, DWORD dwBatchMs);
+  STDMETHODIMP SetDecodeAhead(BOOL bEnabled);
+  STDMETHODIMP_(BOOL) GetDecodeAhead();
+  STDMETHODIMP SetLowFootprint(BOOL bEnabled);
+  STDMETHODIMP_(BOOL) GetLowFootprint();
+  STDMETHODIMP GetMemoryBudget(ULONGLONG *pBudget);
+  STDMETHODIMP SetOutputQueue(DWORD dwDepth, DWORD dwBatchSize);
+  STDMETHODIMP GetOutputQueue(DWORD *pdwDepth, DWORD *pdwBatchSize);
 
   // ILAVAudioStatus
   STDMETHODIMP_(BOOL) IsSampleFormatSupported(LAVAudioSampleFormat sfCheck);
@@ -145,6 +188,13 @@ public:
   STDMETHODIMP EnableVolumeStats();
   STDMETHODIMP DisableVolumeStats();
   STDMETHODIMP GetChannelVolumeAverage(WORD nChannel, float *pfDb);
+  STDMETHODIMP GetChannelLevels(WORD nChannel, LAVAudioChannelLevels *pLevels);
+  STDMETHODIMP GetCaptureLatency(LAVAudioCaptureLatency *pLatency);
+
+  // ILAVMemoryInfo
+  STDMETHODIMP GetMemoryUsage(LAVMemoryCategory category, LAVMemoryUsage *pUsage) { return m_pMemoryAccount->GetUsage(category, pUsage); }
+  STDMETHODIMP GetProcessMemoryUsage(LAVMemoryCategory category, LAVMemoryUsage *pUsage) { return CMemoryAccount::GetProcessUsage(category, pUsage); }
+  STDMETHODIMP ResetPeakMemoryUsage() { m_pMemoryAccount->ResetPeak(); return S_OK; }
 
   // CTransformFilter
   HRESULT CheckInputType(const CMediaType* mtIn);
@@ -166,6 +216,9 @@ public:
   HRESULT EndFlush();
   HRESULT NewSegment(REFERENCE_TIME tStart, REFERENCE_TIME tStop, double dRate);
 
+  HRESULT StartStreaming();
+  HRESULT StopStreaming();
+
   HRESULT BreakConnect(PIN_DIRECTION Dir);
 
 public:
@@ -194,15 +247,34 @@ private:
 
   CMediaType CreateMediaType(LAVAudioSampleFormat outputFormat, DWORD nSamplesPerSec, WORD nChannels, DWORD dwChannelMask, WORD wBitsPerSample = 0) const;
   HRESULT ReconnectOutput(long cbBuffer, CMediaType& mt);
+  HRESULT QueryAcceptOutput(const CMediaType &mt);
+  HRESULT ProcessSample(IMediaSample *pIn);
+  // Charge the current size of the input and output buffers to the memory account
+  void UpdateMemoryUsage();
   HRESULT ProcessBuffer(IMediaSample *pMediaSample, BOOL bEOF = FALSE);
-  HRESULT Decode(const BYTE *p, int buffsize, int &consumed, HRESULT *hrDeliver, IMediaSample *pMediaSample);
+  HRESULT ProcessInPlace(IMediaSample *pMediaSample, const BYTE *pData, int size, BOOL *pbProcessed);
+  HRESULT Decode(const BYTE *p, int buffsize, int &consumed, HRESULT *hrDeliver, IMediaSample *pMediaSample, AVBufferRef *pInputBuffer = nullptr);
   HRESULT PostProcess(BufferDetails *buffer);
   HRESULT GetDeliveryBuffer(IMediaSample **pSample, BYTE **pData);
 
   HRESULT QueueOutput(BufferDetails &buffer);
+  long GetOutputBufferSize() const;
+  long GetOutputBufferCount() const;
+  DWORD GetOutputBatchMs() const;
   HRESULT FlushOutput(BOOL bDeliver = TRUE);
+  void AddCaptureLatency(REFERENCE_TIME rtLatency);
+  void ResetCaptureLatency();
   HRESULT FlushDecoder();
 
+  // Decode-ahead thread
+  HRESULT QueueSample(IMediaSample *pIn);
+  HRESULT WaitForDecodeIdle();
+  void ClearDecodeQueue();
+
+  // CAMThread
+  enum {CMD_EXIT};
+  DWORD ThreadProc();
+
   HRESULT PerformFlush();
   HRESULT Deliver(BufferDetails &buffer);
 
@@ -224,18 +296,29 @@ private:
   HRESULT BitstreamFallbackToPCM();
 
   HRESULT Bitstream(const BYTE *p, int buffsize, int &consumed, HRESULT *hrDeliver);
+  HRESULT GetBitstreamDeliveryBuffer(AVCodecID codec, DWORD dwSize, IMediaSample **ppOut, BYTE **ppDataOut, BOOL *pbTypeChanged);
   HRESULT DeliverBitstream(AVCodecID codec, const BYTE *buffer, DWORD dwSize, REFERENCE_TIME rtStartInput, REFERENCE_TIME rtStopInput, BOOL bSwap = false);
+  HRESULT DeliverBitstreamSample(AVCodecID codec, IMediaSample *pOut, DWORD dwSize, REFERENCE_TIME rtStartInput, REFERENCE_TIME rtStopInput, BOOL bTypeChanged);
+
+  HRESULT BitstreamSPDIF(const BYTE *p, int size, HRESULT *hrDeliver);
+  HRESULT BitstreamEAC3(const BYTE *p, int size, HRESULT *hrDeliver);
+  BYTE *SPDIFGetBuffer(DWORD dwSize);
+  void SPDIFDeliver(DWORD dwSize, HRESULT *hrDeliver);
+  void SPDIFReset();
 
   HRESULT BitstreamTrueHD(const BYTE *p, int buffsize, HRESULT *hrDeliver);
+  void MATGetBuffer();
+  void MATReset();
   void MATWriteHeader();
   void MATWritePadding();
-  void MATAppendData(const BYTE *p, int size);
+  void MATAppendData(const BYTE *p, int size, bool padding = false);
   int MATFillDataBuffer(const BYTE *p, int size, bool padding = false);
   void MATFlushPacket(HRESULT *hrDeliver);
 
   CMediaType CreateBitstreamMediaType(AVCodecID codec, DWORD dwSampleRate, BOOL bDTSHDOverride = FALSE);
   void ActivateDTSHDMuxing();
   DTSBitstreamMode GetDTSHDBitstreamMode();
+  DWORD GetDTSHDRate() const;
 
   HRESULT InitDTSDecoder();
   HRESULT FreeDTSDecoder();
@@ -253,6 +336,7 @@ private:
   HRESULT PadTo32(BufferDetails *buffer);
 
   HRESULT PerformAVRProcessing(BufferDetails *buffer);
+  HRESULT PerformMatrixMixing(BufferDetails *buffer, DWORD dwMixingLayout);
 
 private:
   AVCodecID             m_nCodecId = AV_CODEC_ID_NONE;
@@ -272,14 +356,18 @@ private:
   REFERENCE_TIME       m_rtStartInputCache = AV_NOPTS_VALUE;   // rtStart of the last input package
   REFERENCE_TIME       m_rtStopInputCache  = AV_NOPTS_VALUE;   // rtStop of the last input package
   REFERENCE_TIME       m_rtBitstreamCache  = AV_NOPTS_VALUE;   // Bitstreaming time cache
+  REFERENCE_TIME       m_rtCaptureInput    = AV_NOPTS_VALUE;   // Capture time of the current input package
   BOOL                 m_bUpdateTimeCache  = TRUE;
 
-  GrowableArray<BYTE>  m_buff;                                 // Input Buffer
+  ConsumableArray<BYTE> m_buff;                                // Input Buffer
   LAVAudioSampleFormat m_DecodeFormat      = SampleFormat_16;
   LAVAudioSampleFormat m_MixingInputFormat = SampleFormat_None;
   LAVAudioSampleFormat m_FallbackFormat    = SampleFormat_None;
   DWORD                m_dwOverrideMixer   = 0;
 
+  // QueryAccept answers of the downstream filter on the current connection
+  std::vector<std::pair<CMediaType, HRESULT>> m_OutputTypeCache;
+
   int                  m_bHasVideo              = -1;
 
   AVAudioResampleContext *m_avrContext          = nullptr;
@@ -287,6 +375,25 @@ private:
   DWORD                m_dwRemixLayout          = 0;
   BOOL                 m_bAVResampleFailed      = FALSE;
   BOOL                 m_bMixingSettingsChanged = FALSE;
+  CMatrixMixer         m_MatrixMixer;
+
+  // Latency from reading the source data in LAV Splitter until the delivered buffer was accepted downstream
+  LAVAudioCaptureLatency m_CaptureLatency = { 0 };
+  CCritSec             m_csCaptureLatency;
+
+  // Performance counters of the filter
+  volatile ULONGLONG   m_PerfValues[AudioPerf_NB] = { 0 };
+  PPERF_COUNTERSET_INSTANCE m_pPerfInstance     = nullptr;
+  BOOL                 m_bUnderrun              = FALSE;  // The last buffer was delivered late
+
+  // Decode-ahead
+  BOOL                 m_bDecodeAhead = FALSE;
+  HRESULT              m_hrDecode     = S_OK;              // First decoding error of the worker, kept until the next flush
+  CCritSec             m_csDecode;                         // Held while decoding, the decode thread never takes the receive lock
+  CSynchronizedQueue<IMediaSample *> m_DecodeQueue;
+  CAMEvent             m_evDecodeQueued;
+  CAMEvent             m_evDecodeQueueSpace;
+  CAMEvent             m_evDecodeIdle{TRUE};
 
   // Settings
   struct AudioSettings {
@@ -317,11 +424,21 @@ private:
     DWORD MixingLFELevel;
 
     BOOL SuppressFormatChanges;
+
+    DWORD OutputLatency;
+    DWORD OutputBatchMs;
+
+    BOOL bDecodeAhead;
+    BOOL bLowFootprint;
+
+    DWORD OutputQueueDepth;
+    DWORD OutputQueueBatch;
   } m_settings;
   BOOL                m_bRuntimeConfig = FALSE;
 
   BOOL                m_bVolumeStats   = FALSE;    // Volume Stats gathering enabled
   FloatingAverage<float> m_faVolume[8];            // Floating Average for volume (8 channels)
+  CVolumeMeter        m_VolumeMeter;
 
   BOOL                m_bQueueResync     = FALSE;
   BOOL                m_bResyncTimestamp = FALSE;
@@ -332,6 +449,24 @@ private:
   AVIOContext        *m_avioBitstream = nullptr;
   AVFormatContext    *m_avBSContext   = nullptr;
   GrowableArray<BYTE> m_bsOutput;
+
+  CMemoryAccount     *m_pMemoryAccount = new CMemoryAccount();
+  size_t              m_nBuffersCharged = 0;
+
+  // IEC 61937 bursts are assembled directly in the output sample, or in m_bsOutput if no sample could be obtained
+  IMediaSample       *m_pSPDIFSample = nullptr;
+  BYTE               *m_pSPDIFBuffer = nullptr;
+  DWORD               m_dwSPDIFPayload = 0;   ///< Bytes of E-AC3 frames in the burst
+  int                 m_nSPDIFFrames = 0;     ///< Number of E-AC3 frames in the burst
+  BOOL                m_bSPDIFTypeChanged = FALSE;
+  BOOL                m_bDTSHDCoreOnly = FALSE; ///< DTS-HD is too large for the rate, only the core is sent
+
+  // MAT frames are assembled directly in the output sample, or in m_bsOutput if no sample could be obtained
+  IMediaSample       *m_pMATSample = nullptr;
+  BYTE               *m_pMATBuffer = nullptr;
+  DWORD               m_dwMATSize  = 0;
+  BOOL                m_bMATTypeChanged = FALSE;
+
   BOOL                m_bBitStreamingSettingsChanged = FALSE;
   BOOL                m_bBitstreamOverride[Bitstream_NB] = { FALSE };
 
@@ -93,6 +93,15 @@ typedef enum LAVAudioMixingMode {
   MatrixEncoding_NB
 } LAVAudioMixingMode;
 
+// Output latency policy, controls how much decoded audio is combined into one media sample
+typedef enum LAVAudioOutputLatency {
+  OutputLatency_Default,      // Combine decoded audio into samples of 60-100ms
+  OutputLatency_Low,          // Deliver every decoded frame immediately, for live and interactive use
+  OutputLatency_Throughput,   // Combine decoded audio into samples of up to the configured batch duration
+
+  OutputLatency_NB
+} LAVAudioOutputLatency;
+
 // LAV Audio configuration interface
 interface __declspec(uuid("4158A22B-6553-45D0-8069-24716F8FF171")) ILAVAudioSettings : public IUnknown
 {
@@ -197,8 +206,60 @@ interface __declspec(uuid("4158A22B-6553-45D0-8069-24716F8FF171")) ILAVAudioSett
   // Fallback to audio decoding if bitstreaming is not supported by the audio renderer/hardware
   STDMETHOD_(BOOL, GetBitstreamingFallback)() = 0;
   STDMETHOD(SetBitstreamingFallback)(BOOL bBitstreamingFallback) = 0;
+
+  // Output latency policy
+  // dwBatchMs is the maximum duration of one media sample in throughput mode, in ms (10-2000)
+  STDMETHOD(GetOutputLatency)(LAVAudioOutputLatency *pLatency, DWORD *pdwBatchMs) = 0;
+  STDMETHOD(SetOutputLatency)(LAVAudioOutputLatency latency, DWORD dwBatchMs) = 0;
+
+  // Decode ahead on a separate thread
+  // When enabled, input samples are queued and a worker thread decodes and delivers them,
+  // so the upstream filter does not wait on the decoder. DVD playback is always decoded synchronously.
+  // Changes take effect the next time playback is started.
+  STDMETHOD(SetDecodeAhead)(BOOL bEnabled) = 0;
+  STDMETHOD_(BOOL, GetDecodeAhead)() = 0;
+
+  // Low footprint profile for systems with little memory
+  // Uses smaller output buffers, fewer samples queued for decode-ahead, and output samples of at most 100 ms in throughput mode.
+  // Changes take effect the next time playback is started.
+  STDMETHOD(SetLowFootprint)(BOOL bEnabled) = 0;
+  STDMETHOD_(BOOL, GetLowFootprint)() = 0;
+
+  // Worst-case memory use of the decoder with the current settings, in bytes
+  // Covers the output buffers and the decoding buffers, input samples belong to the upstream filter.
+  // Returns E_UNEXPECTED if the decoder is not connected
+  STDMETHOD(GetMemoryBudget)(ULONGLONG *pBudget) = 0;
+
+  // Deliver the output through a queue on a separate thread
+  // dwDepth is the maximum number of queued output samples (0 - 32), 0 delivers synchronously
+  // dwBatchSize is the number of samples passed to the renderer at once (1 - dwDepth)
+  // The decoder can run ahead of the renderer by up to dwDepth samples. DVD playback is always delivered synchronously.
+  // Changes take effect the next time playback is started.
+  STDMETHOD(SetOutputQueue)(DWORD dwDepth, DWORD dwBatchSize) = 0;
+  STDMETHOD(GetOutputQueue)(DWORD *pdwDepth, DWORD *pdwBatchSize) = 0;
 };
 
+// Volume meter readings of one channel, all levels are in dBFS
+// Peak, RMS and true peak are measured over the last processed block of audio,
+// the maximum true peak is held until the volume stats are enabled again or playback is flushed.
+typedef struct LAVAudioChannelLevels {
+  float fPeak;
+  float fRMS;
+  float fTruePeak;      // 4x oversampled peak according to ITU-R BS.1770
+  float fMaxTruePeak;
+} LAVAudioChannelLevels;
+
+// Latency from reading the source data in LAV Splitter until the decoded audio was accepted downstream
+// All times are in 100ns units, measured over the buffers delivered since the last flush.
+// Only available if the source data was demuxed by LAV Splitter.
+typedef struct LAVAudioCaptureLatency {
+  DWORD dwBuffers;              // Number of buffers measured
+  REFERENCE_TIME rtLast;
+  REFERENCE_TIME rtMin;
+  REFERENCE_TIME rtAverage;
+  REFERENCE_TIME rtMax;
+} LAVAudioCaptureLatency;
+
 // LAV Audio Status Interface
 // Get the current playback stats
 interface __declspec(uuid("A668B8F2-BA87-4F63-9D41-768F7DE9C50E")) ILAVAudioStatus : public IUnknown
@@ -220,4 +281,13 @@ interface __declspec(uuid("A668B8F2-BA87-4F63-9D41-768F7DE9C50E")) ILAVAudioStat
 
   // Get Volume Average for the given channel
   STDMETHOD(GetChannelVolumeAverage)(WORD nChannel, float *pfDb) = 0;
+
+  // Get the current volume meter readings for the given channel
+  // The levels are published without locking, so this can be polled at a high rate from any thread.
+  // Volume stats need to be enabled with EnableVolumeStats first.
+  STDMETHOD(GetChannelLevels)(WORD nChannel, LAVAudioChannelLevels *pLevels) = 0;
+
+  // Get the latency from reading the source data until the delivery of the decoded audio
+  // Returns S_FALSE if no buffer was measured since the last flush
+  STDMETHOD(GetCaptureLatency)(LAVAudioCaptureLatency *pLatency) = 0;
 };
@@ -0,0 +1,191 @@
+/*
+ *      Copyright (C) 2010-2019 Hendrik Leppkes
+ *      http://www.1f0.de
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program; if not, write to the Free Software Foundation, Inc.,
+ *  51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#include "stdafx.h"
+#include "MatrixMixer.h"
+#include "Media.h"
+
+extern "C" {
+#include "libavutil/cpu.h"
+}
+
+template <LAVAudioSampleFormat sfFormat>
+static void mix_c(const BYTE *src, int in_ch, int out_ch, const float *matrix, float *dst, int nSamples)
+{
+  const int srcStride = in_ch * get_byte_per_sample(sfFormat);
+
+  for (int s = 0; s < nSamples; s++) {
+    float out[MATRIX_MIXER_MAX_OUT] = { 0.0f };
+    for (int i = 0; i < in_ch; i++) {
+      const float in = matrix_mix_load<sfFormat>(src, i);
+      const float *coeffs = matrix + i * MATRIX_MIXER_MAX_OUT;
+      for (int o = 0; o < out_ch; o++)
+        out[o] += in * coeffs[o];
+    }
+    for (int o = 0; o < out_ch; o++)
+      dst[o] = out[o];
+
+    src += srcStride;
+    dst += out_ch;
+  }
+}
+
+void matrix_mix_c(const BYTE *src, LAVAudioSampleFormat sfFormat, int in_ch, int out_ch, const float *matrix, float *dst, int nSamples)
+{
+  switch (sfFormat) {
+  case SampleFormat_16:
+    mix_c<SampleFormat_16>(src, in_ch, out_ch, matrix, dst, nSamples);
+    break;
+  case SampleFormat_24:
+    mix_c<SampleFormat_24>(src, in_ch, out_ch, matrix, dst, nSamples);
+    break;
+  case SampleFormat_32:
+    mix_c<SampleFormat_32>(src, in_ch, out_ch, matrix, dst, nSamples);
+    break;
+  case SampleFormat_FP32:
+    mix_c<SampleFormat_FP32>(src, in_ch, out_ch, matrix, dst, nSamples);
+    break;
+  default:
+    ASSERT(0);
+  }
+}
+
+CMatrixMixer::CMatrixMixer()
+{
+  memset(m_Cache, 0, sizeof(m_Cache));
+
+  int cpu = av_get_cpu_flags();
+  m_MixFunc = (cpu & AV_CPU_FLAG_AVX2) ? matrix_mix_avx2 : matrix_mix_c;
+}
+
+CMatrixMixer::~CMatrixMixer()
+{
+  Flush();
+}
+
+void CMatrixMixer::Flush()
+{
+  for (int i = 0; i < MATRIX_MIXER_CACHE_SIZE; i++) {
+    av_freep(&m_Cache[i].matrix);
+  }
+  memset(m_Cache, 0, sizeof(m_Cache));
+  m_pCurrent = nullptr;
+}
+
+BOOL CMatrixMixer::IsFormatSupported(LAVAudioSampleFormat sfFormat) const
+{
+  return sfFormat == SampleFormat_16 || sfFormat == SampleFormat_24 || sfFormat == SampleFormat_32 || sfFormat == SampleFormat_FP32;
+}
+
+HRESULT CMatrixMixer::SetLayouts(DWORD dwInLayout, DWORD dwOutLayout, const MatrixMixerSettings &settings)
+{
+  m_bClipProtection = settings.bClipProtection;
+
+  // Look for the matrix in the cache, and move it to the front once found
+  for (int i = 0; i < MATRIX_MIXER_CACHE_SIZE && m_Cache[i].matrix; i++) {
+    if (m_Cache[i].dwInLayout == dwInLayout && m_Cache[i].dwOutLayout == dwOutLayout) {
+      MixingMatrix entry = m_Cache[i];
+      memmove(&m_Cache[1], &m_Cache[0], i * sizeof(MixingMatrix));
+      m_Cache[0] = entry;
+      m_pCurrent = &m_Cache[0];
+      return S_OK;
+    }
+  }
+
+  m_pCurrent = nullptr;
+
+  const int in_ch = av_get_channel_layout_nb_channels(dwInLayout);
+  const int out_ch = av_get_channel_layout_nb_channels(dwOutLayout);
+  if (in_ch <= 0 || out_ch <= 0 || out_ch > MATRIX_MIXER_MAX_OUT)
+    return E_NOTIMPL;
+
+  double *matrix_dbl = (double *)av_mallocz(in_ch * out_ch * sizeof(*matrix_dbl));
+  float *matrix = (float *)av_mallocz(in_ch * MATRIX_MIXER_MAX_OUT * sizeof(*matrix));
+  if (!matrix_dbl || !matrix) {
+    av_free(matrix_dbl);
+    av_free(matrix);
+    return E_OUTOFMEMORY;
+  }
+
+  int ret = avresample_build_matrix(dwInLayout, dwOutLayout, settings.CenterLevel, settings.SurroundLevel, settings.LFELevel, settings.bNormalize, matrix_dbl, in_ch, (AVMatrixEncoding)settings.MatrixEncoding);
+  if (ret < 0) {
+    DbgLog((LOG_ERROR, 10, L"avresample_build_matrix failed, layout in: %x, out: %x", dwInLayout, dwOutLayout));
+    av_free(matrix_dbl);
+    av_free(matrix);
+    return E_FAIL;
+  }
+
+  // Transpose the matrix, so the coefficients of one input channel are stored together
+  for (int o = 0; o < out_ch; o++) {
+    for (int i = 0; i < in_ch; i++) {
+      matrix[i * MATRIX_MIXER_MAX_OUT + o] = (float)matrix_dbl[o * in_ch + i];
+    }
+  }
+  av_free(matrix_dbl);
+
+  // Evict the least recently used matrix
+  av_freep(&m_Cache[MATRIX_MIXER_CACHE_SIZE - 1].matrix);
+  memmove(&m_Cache[1], &m_Cache[0], (MATRIX_MIXER_CACHE_SIZE - 1) * sizeof(MixingMatrix));
+
+  m_Cache[0].dwInLayout = dwInLayout;
+  m_Cache[0].dwOutLayout = dwOutLayout;
+  m_Cache[0].in_ch = in_ch;
+  m_Cache[0].out_ch = out_ch;
+  m_Cache[0].matrix = matrix;
+  m_pCurrent = &m_Cache[0];
+
+  return S_OK;
+}
+
+void CMatrixMixer::ApplyClipProtection(MixingMatrix *pMatrix, float *dst, int nSamples)
+{
+  const int count = nSamples * pMatrix->out_ch;
+
+  float peak = 1.0f;
+  for (int i = 0; i < count; i++) {
+    const float sample = fabsf(dst[i]);
+    if (sample > peak)
+      peak = sample;
+  }
+
+  // Reduce the volume permanently, so the following buffers do not clip either
+  if (peak > 1.0f) {
+    const float scale = 1.0f / peak;
+    DbgLog((LOG_TRACE, 10, L"Clipping protection, reducing volume by %f", scale));
+    for (int i = 0; i < count; i++)
+      dst[i] *= scale;
+    for (int i = 0; i < pMatrix->in_ch * MATRIX_MIXER_MAX_OUT; i++)
+      pMatrix->matrix[i] *= scale;
+  }
+}
+
+HRESULT CMatrixMixer::Mix(const BYTE *src, LAVAudioSampleFormat sfFormat, int nSamples, float *dst)
+{
+  if (!m_pCurrent)
+    return E_UNEXPECTED;
+  if (!IsFormatSupported(sfFormat))
+    return E_INVALIDARG;
+
+  m_MixFunc(src, sfFormat, m_pCurrent->in_ch, m_pCurrent->out_ch, m_pCurrent->matrix, dst, nSamples);
+
+  if (m_bClipProtection)
+    ApplyClipProtection(m_pCurrent, dst, nSamples);
+
+  return S_OK;
+}
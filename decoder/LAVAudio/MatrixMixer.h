@@ -0,0 +1,103 @@
+/*
+ *      Copyright (C) 2010-2019 Hendrik Leppkes
+ *      http://www.1f0.de
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program; if not, write to the Free Software Foundation, Inc.,
+ *  51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#pragma once
+
+#include "LAVAudioSettings.h"
+
+// Maximum number of output channels the mixer supports (7.1)
+#define MATRIX_MIXER_MAX_OUT 8
+
+// Number of matrices kept around, so switching back and forth between layouts does not need to rebuild them
+#define MATRIX_MIXER_CACHE_SIZE 4
+
+struct MatrixMixerSettings {
+  double CenterLevel;
+  double SurroundLevel;
+  double LFELevel;
+  BOOL   bNormalize;
+  BOOL   bClipProtection;
+  int    MatrixEncoding;
+};
+
+// Mix function, the matrix contains one row of MATRIX_MIXER_MAX_OUT coefficients for every input channel
+// dst needs to be padded by MATRIX_MIXER_MAX_OUT floats, the SIMD variants always store full rows
+typedef void (*MatrixMixFunc)(const BYTE *src, LAVAudioSampleFormat sfFormat, int in_ch, int out_ch, const float *matrix, float *dst, int nSamples);
+
+// Channel matrix mixer for interleaved audio
+// Reads 16/24/32-bit integer and float input directly and outputs interleaved float,
+// so no separate sample format conversion pass is needed before mixing.
+class CMatrixMixer
+{
+public:
+  CMatrixMixer();
+  ~CMatrixMixer();
+
+  // Select the matrix for the given layouts, it is only built if it is not in the cache yet
+  HRESULT SetLayouts(DWORD dwInLayout, DWORD dwOutLayout, const MatrixMixerSettings &settings);
+
+  // Drop all cached matrices, needs to be called when the mixing settings change
+  void Flush();
+
+  BOOL IsFormatSupported(LAVAudioSampleFormat sfFormat) const;
+  int GetOutputChannels() const { return m_pCurrent ? m_pCurrent->out_ch : 0; }
+
+  // Mix nSamples of the interleaved input into dst
+  // dst needs to hold nSamples * GetOutputChannels() + MATRIX_MIXER_MAX_OUT floats
+  HRESULT Mix(const BYTE *src, LAVAudioSampleFormat sfFormat, int nSamples, float *dst);
+
+private:
+  struct MixingMatrix {
+    DWORD dwInLayout;
+    DWORD dwOutLayout;
+    int in_ch;
+    int out_ch;
+    float *matrix;
+  };
+
+  void ApplyClipProtection(MixingMatrix *pMatrix, float *dst, int nSamples);
+
+private:
+  MixingMatrix m_Cache[MATRIX_MIXER_CACHE_SIZE];
+  MixingMatrix *m_pCurrent = nullptr;
+  BOOL m_bClipProtection = FALSE;
+
+  MatrixMixFunc m_MixFunc = nullptr;
+};
+
+void matrix_mix_c(const BYTE *src, LAVAudioSampleFormat sfFormat, int in_ch, int out_ch, const float *matrix, float *dst, int nSamples);
+void matrix_mix_avx2(const BYTE *src, LAVAudioSampleFormat sfFormat, int in_ch, int out_ch, const float *matrix, float *dst, int nSamples);
+
+// Read one interleaved sample as float, using the same scaling as the avresample conversions
+template <LAVAudioSampleFormat sfFormat>
+static inline float matrix_mix_load(const BYTE *src, int idx)
+{
+  switch (sfFormat) {
+  case SampleFormat_16:
+    return ((const int16_t *)src)[idx] * (1.0f / (1 << 15));
+  case SampleFormat_24:
+    src += idx * 3;
+    return (int32_t)((src[0] << 8) | (src[1] << 16) | ((uint32_t)src[2] << 24)) * (1.0f / (1U << 31));
+  case SampleFormat_32:
+    return ((const int32_t *)src)[idx] * (1.0f / (1U << 31));
+  case SampleFormat_FP32:
+    return ((const float *)src)[idx];
+  }
+  return 0.0f;
+}
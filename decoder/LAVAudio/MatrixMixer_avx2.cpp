@@ -0,0 +1,66 @@
+/*
+ *      Copyright (C) 2010-2019 Hendrik Leppkes
+ *      http://www.1f0.de
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program; if not, write to the Free Software Foundation, Inc.,
+ *  51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#include "stdafx.h"
+#include "MatrixMixer.h"
+#include "Media.h"
+
+#include <immintrin.h>
+
+// One output sample (all channels) fits into one AVX register, every input channel is
+// broadcast and multiplied with its row of the matrix.
+// The full register is stored, the unused lanes are overwritten by the next sample.
+template <LAVAudioSampleFormat sfFormat>
+static void mix_avx2(const BYTE *src, int in_ch, int out_ch, const float *matrix, float *dst, int nSamples)
+{
+  const int srcStride = in_ch * get_byte_per_sample(sfFormat);
+
+  for (int s = 0; s < nSamples; s++) {
+    __m256 acc = _mm256_setzero_ps();
+    for (int i = 0; i < in_ch; i++) {
+      const __m256 in = _mm256_set1_ps(matrix_mix_load<sfFormat>(src, i));
+      const __m256 coeffs = _mm256_loadu_ps(matrix + i * MATRIX_MIXER_MAX_OUT);
+      acc = _mm256_add_ps(acc, _mm256_mul_ps(in, coeffs));
+    }
+    _mm256_storeu_ps(dst, acc);
+
+    src += srcStride;
+    dst += out_ch;
+  }
+}
+
+void matrix_mix_avx2(const BYTE *src, LAVAudioSampleFormat sfFormat, int in_ch, int out_ch, const float *matrix, float *dst, int nSamples)
+{
+  switch (sfFormat) {
+  case SampleFormat_16:
+    mix_avx2<SampleFormat_16>(src, in_ch, out_ch, matrix, dst, nSamples);
+    break;
+  case SampleFormat_24:
+    mix_avx2<SampleFormat_24>(src, in_ch, out_ch, matrix, dst, nSamples);
+    break;
+  case SampleFormat_32:
+    mix_avx2<SampleFormat_32>(src, in_ch, out_ch, matrix, dst, nSamples);
+    break;
+  case SampleFormat_FP32:
+    mix_avx2<SampleFormat_FP32>(src, in_ch, out_ch, matrix, dst, nSamples);
+    break;
+  default:
+    ASSERT(0);
+  }
+}
@@ -21,6 +21,7 @@
 #include "LAVAudio.h"
 
 #include <MMReg.h>
+#include <emmintrin.h>
 
 #include "moreuuids.h"
 
@@ -574,32 +575,19 @@ T get_sample_from_buffer(const BYTE * const pBuffer, LAVAudioSampleFormat sfForm
   return fSample;
 }
 
-// This function calculates the Root mean square (RMS) of all samples in the buffer,
-// converts the result into a reference dB value, and adds it to the volume floating average
+// This function runs the volume meter over the buffer, which publishes the peak/RMS/true-peak levels,
+// and adds the RMS of every channel to the volume floating average
 void CLAVAudio::UpdateVolumeStats(const BufferDetails &buffer)
 {
-  const BYTE bSampleSize = get_byte_per_sample(buffer.sfFormat);
-  const DWORD dwSamplesPerChannel = buffer.nSamples;
-  const BYTE *pBuffer = buffer.bBuffer->Ptr();
-  float * const fChAvg = (float *)calloc(buffer.wChannels, sizeof(float));
-  for (DWORD i = 0; i < dwSamplesPerChannel; ++i) {
-    for (WORD ch = 0; ch < buffer.wChannels; ++ch) {
-      const float fSample = get_sample_from_buffer<float>(pBuffer, buffer.sfFormat);
-      fChAvg[ch] += fSample * fSample;
-      pBuffer += bSampleSize;
-    }
-  }
+  m_VolumeMeter.Process(buffer.bBuffer->Ptr(), buffer.sfFormat, buffer.wChannels, buffer.nSamples);
 
-  for (int ch = 0; ch < buffer.wChannels; ++ch) {
-    if (fChAvg[ch] > FLT_EPSILON) {
-      const float fAvgSqrt =  sqrt(fChAvg[ch] / dwSamplesPerChannel);
-      const float fDb = 20.0f * log10(fAvgSqrt);
-      m_faVolume[ch].Sample(fDb);
-    } else {
+  LAVAudioChannelLevels levels;
+  for (int ch = 0; ch < buffer.wChannels && ch < 8; ++ch) {
+    if (m_VolumeMeter.GetLevels(ch, &levels))
+      m_faVolume[ch].Sample(levels.fRMS);
+    else
       m_faVolume[ch].Sample(-100.0f);
-    }
   }
-  free(fChAvg);
 }
 
 #define MAX_SPEAKER_LAYOUT 18
@@ -735,20 +723,17 @@ LAVAudioSampleFormat CLAVAudio::GetBestAvailableSampleFormat(LAVAudioSampleForma
   return outFormat;
 }
 
-// Copy of ff_spdif_bswap_buf16, which sadly is a private symbol
+// Like ff_spdif_bswap_buf16, which sadly is a private symbol, with SSE2
+// The buffers can be the same, for swapping in place
 void lav_spdif_bswap_buf16(uint16_t *dst, const uint16_t *src, int w)
 {
   int i;
 
-  for (i = 0; i + 8 <= w; i += 8) {
-    dst[i + 0] = av_bswap16(src[i + 0]);
-    dst[i + 1] = av_bswap16(src[i + 1]);
-    dst[i + 2] = av_bswap16(src[i + 2]);
-    dst[i + 3] = av_bswap16(src[i + 3]);
-    dst[i + 4] = av_bswap16(src[i + 4]);
-    dst[i + 5] = av_bswap16(src[i + 5]);
-    dst[i + 6] = av_bswap16(src[i + 6]);
-    dst[i + 7] = av_bswap16(src[i + 7]);
+  for (i = 0; i + 16 <= w; i += 16) {
+    const __m128i a = _mm_loadu_si128((const __m128i *)(src + i));
+    const __m128i b = _mm_loadu_si128((const __m128i *)(src + i + 8));
+    _mm_storeu_si128((__m128i *)(dst + i), _mm_or_si128(_mm_slli_epi16(a, 8), _mm_srli_epi16(a, 8)));
+    _mm_storeu_si128((__m128i *)(dst + i + 8), _mm_or_si128(_mm_slli_epi16(b, 8), _mm_srli_epi16(b, 8)));
   }
   for (; i < w; i++)
     dst[i + 0] = av_bswap16(src[i + 0]);
@@ -0,0 +1,87 @@
+/*
+ *      Copyright (C) 2010-2019 Hendrik Leppkes
+ *      http://www.1f0.de
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program; if not, write to the Free Software Foundation, Inc.,
+ *  51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+
+#include "stdafx.h"
+#include "PCMBufferPool.h"
+
+#include <vector>
+
+static struct PCMBufferPool {
+  CCritSec                           cs;
+  std::vector<GrowableArray<BYTE> *> buffers;
+  size_t                             nBytes = 0;
+
+  ~PCMBufferPool() {
+    for (GrowableArray<BYTE> *pBuffer : buffers)
+      delete pBuffer;
+  }
+} s_PCMBufferPool;
+
+GrowableArray<BYTE> *AcquirePCMBuffer(DWORD dwSize)
+{
+  GrowableArray<BYTE> *pBuffer = nullptr;
+
+  {
+    CAutoLock lock(&s_PCMBufferPool.cs);
+    std::vector<GrowableArray<BYTE> *> &pool = s_PCMBufferPool.buffers;
+
+    // the smallest buffer which fits, or the largest one if none does
+    size_t nBest = 0;
+    for (size_t i = 1; i < pool.size(); i++) {
+      const DWORD dwAlloc = pool[i]->GetAllocated(), dwBest = pool[nBest]->GetAllocated();
+      const bool bFits = dwAlloc >= dwSize, bBestFits = dwBest >= dwSize;
+      if (bFits != bBestFits ? bFits : (bFits ? dwAlloc < dwBest : dwAlloc > dwBest))
+        nBest = i;
+    }
+
+    if (nBest < pool.size()) {
+      pBuffer = pool[nBest];
+      pool.erase(pool.begin() + nBest);
+      s_PCMBufferPool.nBytes -= pBuffer->GetAllocated();
+    }
+  }
+
+  if (pBuffer == nullptr)
+    pBuffer = new GrowableArray<BYTE>();
+
+  if (dwSize)
+    pBuffer->Allocate(dwSize);
+
+  return pBuffer;
+}
+
+void ReleasePCMBuffer(GrowableArray<BYTE> *pBuffer)
+{
+  if (pBuffer == nullptr)
+    return;
+
+  pBuffer->SetSize(0);
+
+  {
+    CAutoLock lock(&s_PCMBufferPool.cs);
+    if (s_PCMBufferPool.buffers.size() < PCM_BUFFER_POOL_SIZE && s_PCMBufferPool.nBytes + pBuffer->GetAllocated() <= PCM_BUFFER_POOL_MAX_BYTES) {
+      s_PCMBufferPool.buffers.push_back(pBuffer);
+      s_PCMBufferPool.nBytes += pBuffer->GetAllocated();
+      return;
+    }
+  }
+
+  delete pBuffer;
+}
@@ -0,0 +1,37 @@
+/*
+ *      Copyright (C) 2010-2019 Hendrik Leppkes
+ *      http://www.1f0.de
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program; if not, write to the Free Software Foundation, Inc.,
+ *  51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+
+#pragma once
+
+#include "growarray.h"
+
+// Number of PCM buffers kept for re-use, and the memory they can hold together
+#define PCM_BUFFER_POOL_SIZE      16
+#define PCM_BUFFER_POOL_MAX_BYTES (16 << 20)
+
+// Process-wide pool of the PCM buffers of BufferDetails and the post-processing steps
+// Every decoder produces frames of a steady size, so a buffer of the right capacity is almost always available,
+// and decoding does not allocate any memory once the pool is warm.
+
+// Get an empty buffer with at least dwSize bytes allocated
+GrowableArray<BYTE> *AcquirePCMBuffer(DWORD dwSize = 0);
+
+// Return a buffer to the pool, or free it if the pool is full
+void ReleasePCMBuffer(GrowableArray<BYTE> *pBuffer);
@@ -24,8 +24,11 @@
 
 extern "C" {
 #include "libavutil/intreadwrite.h"
+#include "libavutil/cpu.h"
 };
 
+#include <tmmintrin.h>
+
 // PCM Volume Adjustment Factors, both for integer and float math
 // entries start at 2 channel mixing, half volume
 static int pcm_volume_adjust_integer[7] = {
@@ -50,7 +53,8 @@ static float pcm_volume_adjust_float[7] = {
 //
 // Helper Function that reads one sample from pIn, applys the scale specified by iFactor, and writes it to pOut
 //
-static inline void SampleCopyAdjust(BYTE *pOut, const BYTE *pIn, int iFactor, LAVAudioSampleFormat sfSampleFormat)
+template <LAVAudioSampleFormat sfSampleFormat>
+static inline void SampleCopyAdjust(BYTE *pOut, const BYTE *pIn, int iFactor)
 {
   ASSERT(abs(iFactor) > 1 && abs(iFactor) <= 8);
   const int factorIndex = abs(iFactor) - 2;
@@ -112,7 +116,8 @@ static inline void SampleCopyAdjust(BYTE *pOut, const BYTE *pIn, int iFactor, LA
 //
 // Writes one sample of silence into the buffer
 //
-static inline void Silence(BYTE *pBuffer, LAVAudioSampleFormat sfSampleFormat)
+template <LAVAudioSampleFormat sfSampleFormat>
+static inline void Silence(BYTE *pBuffer)
 {
   switch (sfSampleFormat) {
   case SampleFormat_16:
@@ -129,6 +134,89 @@ static inline void Silence(BYTE *pBuffer, LAVAudioSampleFormat sfSampleFormat)
   }
 }
 
+//
+// Remap samples [start, nSamples) of the buffer, the sample format is resolved at compile time
+//
+template <LAVAudioSampleFormat sfSampleFormat>
+static void ExtendedChannelMappingRange(const BYTE *pIn, BYTE *pOut, unsigned start, unsigned nSamples, unsigned uInChannels, unsigned uOutChannels, const ExtendedChannelMap extMap)
+{
+  const unsigned uSampleSize = (sfSampleFormat == SampleFormat_U8) ? 1 : (sfSampleFormat == SampleFormat_16) ? 2 : (sfSampleFormat == SampleFormat_24) ? 3 : 4;
+
+  pIn += start * uInChannels * uSampleSize;
+  pOut += start * uOutChannels * uSampleSize;
+
+  for (unsigned i = start; i < nSamples; ++i) {
+    for (unsigned ch = 0; ch < uOutChannels; ++ch) {
+      if (extMap[ch].idx >= 0) {
+        if (!extMap[ch].factor || abs(extMap[ch].factor) == 1)
+          memcpy(pOut, pIn + (extMap[ch].idx * uSampleSize), uSampleSize);
+        else
+          SampleCopyAdjust<sfSampleFormat>(pOut, pIn + (extMap[ch].idx * uSampleSize), extMap[ch].factor);
+      } else
+        Silence<sfSampleFormat>(pOut);
+      pOut += uSampleSize;
+    }
+    pIn += uSampleSize * uInChannels;
+  }
+}
+
+//
+// SSSE3 Channel Remapping, for maps without volume adjustment
+// One sample of all channels is loaded into up to two registers, and every output register is
+// assembled from both input registers with a byte shuffle. Silent channels are zeroed by the shuffle.
+//
+// Returns the number of samples processed, the remaining samples need to be processed by ExtendedChannelMappingRange
+//
+static unsigned ExtendedChannelMapping_ssse3(const BYTE *pIn, BYTE *pOut, unsigned nSamples, unsigned uInChannels, unsigned uOutChannels, unsigned uSampleSize, const ExtendedChannelMap extMap)
+{
+  const unsigned uInStride = uInChannels * uSampleSize;
+  const unsigned uOutStride = uOutChannels * uSampleSize;
+  if (uInStride > 32 || uOutStride > 32)
+    return 0;
+
+  // Registers read and written per sample, which can extend into the next sample
+  const unsigned uInRegs = (uInStride + 15) >> 4;
+  const unsigned uOutRegs = (uOutStride + 15) >> 4;
+
+  // Only process samples whose loads and stores stay within the buffers
+  const size_t inSize = (size_t)nSamples * uInStride, outSize = (size_t)nSamples * uOutStride;
+  unsigned nSimd = nSamples;
+  while (nSimd > 0 && ((size_t)(nSimd - 1) * uInStride + uInRegs * 16 > inSize || (size_t)(nSimd - 1) * uOutStride + uOutRegs * 16 > outSize))
+    nSimd--;
+
+  // Build the shuffle masks, [output register][input register]
+  int8_t masks[2][2][16];
+  for (unsigned r = 0; r < 2; r++) {
+    for (unsigned l = 0; l < 16; l++) {
+      const unsigned b = r * 16 + l;
+      masks[r][0][l] = masks[r][1][l] = -1;
+      if (b >= uOutStride || extMap[b / uSampleSize].idx < 0)
+        continue;
+      const unsigned src = extMap[b / uSampleSize].idx * uSampleSize + (b % uSampleSize);
+      masks[r][src >> 4][l] = src & 15;
+    }
+  }
+
+  const __m128i mask00 = _mm_loadu_si128((const __m128i *)masks[0][0]);
+  const __m128i mask01 = _mm_loadu_si128((const __m128i *)masks[0][1]);
+  const __m128i mask10 = _mm_loadu_si128((const __m128i *)masks[1][0]);
+  const __m128i mask11 = _mm_loadu_si128((const __m128i *)masks[1][1]);
+
+  for (unsigned i = 0; i < nSimd; ++i) {
+    const __m128i in0 = _mm_loadu_si128((const __m128i *)pIn);
+    const __m128i in1 = (uInRegs > 1) ? _mm_loadu_si128((const __m128i *)(pIn + 16)) : _mm_setzero_si128();
+
+    _mm_storeu_si128((__m128i *)pOut, _mm_or_si128(_mm_shuffle_epi8(in0, mask00), _mm_shuffle_epi8(in1, mask01)));
+    if (uOutRegs > 1)
+      _mm_storeu_si128((__m128i *)(pOut + 16), _mm_or_si128(_mm_shuffle_epi8(in0, mask10), _mm_shuffle_epi8(in1, mask11)));
+
+    pIn += uInStride;
+    pOut += uOutStride;
+  }
+
+  return nSimd;
+}
+
 //
 // Channel Remapping Processor
 // This function can process a PCM buffer of any sample format, and remap the channels
@@ -189,28 +277,46 @@ HRESULT ExtendedChannelMapping(BufferDetails *pcm, const unsigned uOutChannels,
   const unsigned uSampleSize = get_byte_per_sample(pcm->sfFormat);
 
   // New Output Buffer
-  GrowableArray<BYTE> *out = new GrowableArray<BYTE>();
+  GrowableArray<BYTE> *out = AcquirePCMBuffer(uOutChannels * pcm->nSamples * uSampleSize);
   out->SetSize(uOutChannels * pcm->nSamples * uSampleSize);
 
   const BYTE *pIn = pcm->bBuffer->Ptr();
   BYTE *pOut = out->Ptr();
 
-  for(unsigned i = 0; i < pcm->nSamples; ++i) {
-    for (unsigned ch = 0; ch < uOutChannels; ++ch) {
-      if (extMap[ch].idx >= 0) {
-        if (!extMap[ch].factor || abs(extMap[ch].factor) == 1)
-          memcpy(pOut, pIn + (extMap[ch].idx * uSampleSize), uSampleSize);
-        else
-          SampleCopyAdjust(pOut, pIn + (extMap[ch].idx * uSampleSize), extMap[ch].factor, pcm->sfFormat);
-      } else
-        Silence(pOut, pcm->sfFormat);
-      pOut += uSampleSize;
-    }
-    pIn += uSampleSize * pcm->wChannels;
+  // Pure copies can be done with byte shuffles, U8 is excluded because its silence is not zero
+  BOOL bCopyOnly = (pcm->sfFormat != SampleFormat_U8);
+  for (unsigned ch = 0; ch < uOutChannels; ++ch) {
+    if (abs(extMap[ch].factor) > 1)
+      bCopyOnly = FALSE;
+  }
+
+  unsigned start = 0;
+  if (bCopyOnly && (av_get_cpu_flags() & AV_CPU_FLAG_SSSE3))
+    start = ExtendedChannelMapping_ssse3(pIn, pOut, pcm->nSamples, pcm->wChannels, uOutChannels, uSampleSize, extMap);
+
+  switch (pcm->sfFormat) {
+  case SampleFormat_U8:
+    ExtendedChannelMappingRange<SampleFormat_U8>(pIn, pOut, start, pcm->nSamples, pcm->wChannels, uOutChannels, extMap);
+    break;
+  case SampleFormat_16:
+    ExtendedChannelMappingRange<SampleFormat_16>(pIn, pOut, start, pcm->nSamples, pcm->wChannels, uOutChannels, extMap);
+    break;
+  case SampleFormat_24:
+    ExtendedChannelMappingRange<SampleFormat_24>(pIn, pOut, start, pcm->nSamples, pcm->wChannels, uOutChannels, extMap);
+    break;
+  case SampleFormat_32:
+    ExtendedChannelMappingRange<SampleFormat_32>(pIn, pOut, start, pcm->nSamples, pcm->wChannels, uOutChannels, extMap);
+    break;
+  case SampleFormat_FP32:
+    ExtendedChannelMappingRange<SampleFormat_FP32>(pIn, pOut, start, pcm->nSamples, pcm->wChannels, uOutChannels, extMap);
+    break;
+  default:
+    ASSERT(0);
+    break;
   }
 
   // Apply changes to buffer
-  delete pcm->bBuffer;
+  ReleasePCMBuffer(pcm->bBuffer);
   pcm->bBuffer       = out;
   pcm->wChannels     = uOutChannels;
 
@@ -394,20 +500,32 @@ HRESULT CLAVAudio::PadTo32(BufferDetails *buffer)
   ASSERT(buffer->sfFormat == SampleFormat_24);
 
   const DWORD size = (buffer->nSamples * buffer->wChannels) * 4;
-  GrowableArray<BYTE> *pcmOut = new GrowableArray<BYTE>();
+  GrowableArray<BYTE> *pcmOut = AcquirePCMBuffer(size);
   pcmOut->SetSize(size);
 
   const BYTE *pDataIn = buffer->bBuffer->Ptr();
   BYTE *pDataOut = pcmOut->Ptr();
 
-  for (unsigned int i = 0; i < buffer->nSamples; ++i) {
-    for(int ch = 0; ch < buffer->wChannels; ++ch) {
-      AV_WL32(pDataOut, AV_RL24(pDataIn) << 8);
-      pDataOut += 4;
-      pDataIn += 3;
+  const size_t count = (size_t)buffer->nSamples * buffer->wChannels;
+  size_t i = 0;
+
+  // 4 samples per iteration, the 12 input bytes are loaded exactly to not read past the buffer
+  if (av_get_cpu_flags() & AV_CPU_FLAG_SSSE3) {
+    const __m128i shuffle = _mm_setr_epi8(-1, 0, 1, 2, -1, 3, 4, 5, -1, 6, 7, 8, -1, 9, 10, 11);
+    for (; i + 4 <= count; i += 4) {
+      __m128i in = _mm_unpacklo_epi64(_mm_loadl_epi64((const __m128i *)pDataIn), _mm_cvtsi32_si128(AV_RN32(pDataIn + 8)));
+      _mm_storeu_si128((__m128i *)pDataOut, _mm_shuffle_epi8(in, shuffle));
+      pDataIn += 12;
+      pDataOut += 16;
     }
   }
-  delete buffer->bBuffer;
+
+  for (; i < count; ++i) {
+    AV_WL32(pDataOut, AV_RL24(pDataIn) << 8);
+    pDataOut += 4;
+    pDataIn += 3;
+  }
+  ReleasePCMBuffer(buffer->bBuffer);
   buffer->bBuffer = pcmOut;
   buffer->sfFormat = SampleFormat_32;
   buffer->wBitsPerSample = 24;
@@ -426,28 +544,99 @@ HRESULT CLAVAudio::Truncate32Buffer(BufferDetails *buffer)
 
   const int skip = 4 - bytes_per_sample;
   const DWORD size = (buffer->nSamples * buffer->wChannels) * bytes_per_sample;
-  GrowableArray<BYTE> *pcmOut = new GrowableArray<BYTE>();
+  GrowableArray<BYTE> *pcmOut = AcquirePCMBuffer(size);
   pcmOut->SetSize(size);
 
   const BYTE *pDataIn = buffer->bBuffer->Ptr();
   BYTE *pDataOut = pcmOut->Ptr();
 
-  pDataIn += skip;
-  for (unsigned int i = 0; i < buffer->nSamples; ++i) {
-    for(int ch = 0; ch < buffer->wChannels; ++ch) {
-      memcpy(pDataOut, pDataIn, bytes_per_sample);
-      pDataOut += bytes_per_sample;
-      pDataIn += 4;
+  const size_t count = (size_t)buffer->nSamples * buffer->wChannels;
+  size_t i = 0;
+
+  // 4 samples per iteration, the output is stored exactly to not write past the buffer
+  if (av_get_cpu_flags() & AV_CPU_FLAG_SSSE3) {
+    if (bytes_per_sample == 3) {
+      const __m128i shuffle = _mm_setr_epi8(1, 2, 3, 5, 6, 7, 9, 10, 11, 13, 14, 15, -1, -1, -1, -1);
+      for (; i + 4 <= count; i += 4) {
+        __m128i out = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)pDataIn), shuffle);
+        _mm_storel_epi64((__m128i *)pDataOut, out);
+        AV_WN32(pDataOut + 8, _mm_cvtsi128_si32(_mm_srli_si128(out, 8)));
+        pDataIn += 16;
+        pDataOut += 12;
+      }
+    } else {
+      const __m128i shuffle = _mm_setr_epi8(2, 3, 6, 7, 10, 11, 14, 15, -1, -1, -1, -1, -1, -1, -1, -1);
+      for (; i + 4 <= count; i += 4) {
+        _mm_storel_epi64((__m128i *)pDataOut, _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)pDataIn), shuffle));
+        pDataIn += 16;
+        pDataOut += 8;
+      }
     }
   }
 
-  delete buffer->bBuffer;
+  pDataIn += skip;
+  for (; i < count; ++i) {
+    memcpy(pDataOut, pDataIn, bytes_per_sample);
+    pDataOut += bytes_per_sample;
+    pDataIn += 4;
+  }
+
+  ReleasePCMBuffer(buffer->bBuffer);
   buffer->bBuffer = pcmOut;
   buffer->sfFormat = bytes_per_sample == 3 ? SampleFormat_24 : SampleFormat_16;
 
   return S_OK;
 }
 
+HRESULT CLAVAudio::PerformMatrixMixing(BufferDetails *buffer, DWORD dwMixingLayout)
+{
+  HRESULT hr = S_OK;
+
+  if (m_bMixingSettingsChanged) {
+    m_MatrixMixer.Flush();
+    m_bMixingSettingsChanged = FALSE;
+
+    // The avresample context needs to pick up the new settings as well
+    m_bAVResampleFailed = FALSE;
+    if (m_avrContext) {
+      avresample_close(m_avrContext);
+      avresample_free(&m_avrContext);
+    }
+  }
+
+  MatrixMixerSettings settings;
+  settings.bNormalize = !!(m_settings.MixingFlags & LAV_MIXING_FLAG_NORMALIZE_MATRIX);
+  settings.bClipProtection = !settings.bNormalize && (m_settings.MixingFlags & LAV_MIXING_FLAG_CLIP_PROTECTION);
+  settings.CenterLevel = (double)m_settings.MixingCenterLevel / 10000.0;
+  settings.SurroundLevel = (double)m_settings.MixingSurroundLevel / 10000.0;
+  settings.LFELevel = (double)m_settings.MixingLFELevel / 10000.0 / (dwMixingLayout == AV_CH_LAYOUT_MONO ? 1.0 : M_SQRT1_2);
+  settings.MatrixEncoding = m_settings.MixingMode;
+
+  hr = m_MatrixMixer.SetLayouts(buffer->dwChannelMask, dwMixingLayout, settings);
+  if (FAILED(hr))
+    return hr;
+
+  const int out_ch = m_MatrixMixer.GetOutputChannels();
+
+  GrowableArray<BYTE> *pcmOut = AcquirePCMBuffer((buffer->nSamples * out_ch + MATRIX_MIXER_MAX_OUT) * sizeof(float));
+
+  hr = m_MatrixMixer.Mix(buffer->bBuffer->Ptr(), buffer->sfFormat, buffer->nSamples, (float *)pcmOut->Ptr());
+  if (FAILED(hr)) {
+    ReleasePCMBuffer(pcmOut);
+    return hr;
+  }
+
+  ReleasePCMBuffer(buffer->bBuffer);
+  buffer->bBuffer = pcmOut;
+  buffer->dwChannelMask = dwMixingLayout;
+  buffer->sfFormat = SampleFormat_FP32;
+  buffer->wBitsPerSample = 32;
+  buffer->wChannels = out_ch;
+  buffer->bBuffer->SetSize(out_ch * buffer->nSamples * sizeof(float));
+
+  return S_OK;
+}
+
 HRESULT CLAVAudio::PerformAVRProcessing(BufferDetails *buffer)
 {
   int ret = 0;
@@ -471,6 +660,12 @@ HRESULT CLAVAudio::PerformAVRProcessing(BufferDetails *buffer)
     }
   }
 
+  // Mix straight into float, without converting the input or rebuilding avresample on layout changes
+  if (dwMixingLayout != buffer->dwChannelMask && outputFormat == SampleFormat_FP32 && !buffer->bPlanar && m_MatrixMixer.IsFormatSupported(buffer->sfFormat)) {
+    if (PerformMatrixMixing(buffer, dwMixingLayout) == S_OK)
+      return S_OK;
+  }
+
   // Sadly, we need to convert this, avresample has no 24-bit mode
   if (buffer->sfFormat == SampleFormat_24) {
     PadTo32(buffer);
@@ -478,7 +673,10 @@ HRESULT CLAVAudio::PerformAVRProcessing(BufferDetails *buffer)
 
   if (buffer->dwChannelMask != m_MixingInputLayout || (!m_avrContext && !m_bAVResampleFailed) || m_bMixingSettingsChanged || m_dwRemixLayout != dwMixingLayout || outputFormat != m_sfRemixFormat || buffer->sfFormat != m_MixingInputFormat) {
     m_bAVResampleFailed = FALSE;
-    m_bMixingSettingsChanged = FALSE;
+    if (m_bMixingSettingsChanged) {
+      m_MatrixMixer.Flush();
+      m_bMixingSettingsChanged = FALSE;
+    }
     if (m_avrContext) {
       avresample_close(m_avrContext);
       avresample_free(&m_avrContext);
@@ -542,19 +740,18 @@ HRESULT CLAVAudio::PerformAVRProcessing(BufferDetails *buffer)
 
   LAVAudioSampleFormat bufferFormat = (m_sfRemixFormat == SampleFormat_24) ? SampleFormat_32 : m_sfRemixFormat; // avresample always outputs 32-bit
 
-  GrowableArray<BYTE> *pcmOut = new GrowableArray<BYTE>();
-  pcmOut->Allocate(FFALIGN(buffer->nSamples, 32) * av_get_channel_layout_nb_channels(m_dwRemixLayout) * get_byte_per_sample(bufferFormat));
+  GrowableArray<BYTE> *pcmOut = AcquirePCMBuffer(FFALIGN(buffer->nSamples, 32) * av_get_channel_layout_nb_channels(m_dwRemixLayout) * get_byte_per_sample(bufferFormat));
   BYTE *pOut = pcmOut->Ptr();
 
   BYTE *pIn = buffer->bBuffer->Ptr();
   ret = avresample_convert(m_avrContext, &pOut, pcmOut->GetAllocated(), buffer->nSamples, &pIn, buffer->bBuffer->GetAllocated(), buffer->nSamples);
   if (ret < 0) {
     DbgLog((LOG_ERROR, 10, L"avresample_convert failed"));
-    delete pcmOut;
+    ReleasePCMBuffer(pcmOut);
     return S_FALSE;
   }
 
-  delete buffer->bBuffer;
+  ReleasePCMBuffer(buffer->bBuffer);
   buffer->bBuffer = pcmOut;
   buffer->dwChannelMask = m_dwRemixLayout;
   buffer->sfFormat = bufferFormat;
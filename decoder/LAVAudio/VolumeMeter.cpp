@@ -0,0 +1,252 @@
+/*
+ *      Copyright (C) 2010-2019 Hendrik Leppkes
+ *      http://www.1f0.de
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program; if not, write to the Free Software Foundation, Inc.,
+ *  51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#include "stdafx.h"
+#include "VolumeMeter.h"
+#include "Media.h"
+
+#include <emmintrin.h>
+
+// 4x oversampling interpolation filter from ITU-R BS.1770-4 Annex 2
+// Stored by tap, with the four phases next to each other, so one tap can be applied to all phases at once
+static const float tp_coeffs[VOLUME_METER_TAPS][4] = {
+  {  0.0017089843750f, -0.0291748046875f, -0.0189208984375f, -0.0083007812500f },
+  {  0.0109863281250f,  0.0292968750000f,  0.0330810546875f,  0.0148925781250f },
+  { -0.0196533203125f, -0.0517578125000f, -0.0582275390625f, -0.0266113281250f },
+  {  0.0332031250000f,  0.0891113281250f,  0.1015625000000f,  0.0476074218750f },
+  { -0.0594482421875f, -0.1665039062500f, -0.2003173828125f, -0.1022949218750f },
+  {  0.1373291015625f,  0.4650878906250f,  0.7797851562500f,  0.9721679687500f },
+  {  0.9721679687500f,  0.7797851562500f,  0.4650878906250f,  0.1373291015625f },
+  { -0.1022949218750f, -0.2003173828125f, -0.1665039062500f, -0.0594482421875f },
+  {  0.0476074218750f,  0.1015625000000f,  0.0891113281250f,  0.0332031250000f },
+  { -0.0266113281250f, -0.0582275390625f, -0.0517578125000f, -0.0196533203125f },
+  {  0.0148925781250f,  0.0330810546875f,  0.0292968750000f,  0.0109863281250f },
+  { -0.0083007812500f, -0.0189208984375f, -0.0291748046875f,  0.0017089843750f },
+};
+
+static inline float hmax_ps(__m128 v)
+{
+  v = _mm_max_ps(v, _mm_shuffle_ps(v, v, _MM_SHUFFLE(1, 0, 3, 2)));
+  v = _mm_max_ps(v, _mm_shuffle_ps(v, v, _MM_SHUFFLE(2, 3, 0, 1)));
+  return _mm_cvtss_f32(v);
+}
+
+static inline float level_to_db(float fLevel)
+{
+  return fLevel > 0.00001f ? 20.0f * log10f(fLevel) : -100.0f;
+}
+
+// Convert interleaved samples to float, full scale of every format maps to 1.0
+static void convert_to_float(const BYTE *pIn, LAVAudioSampleFormat sfFormat, float *pOut, int count)
+{
+  int i = 0;
+  switch (sfFormat) {
+  case SampleFormat_U8:
+    for (; i < count; i++)
+      pOut[i] = (pIn[i] - 128) * (1.0f / 128);
+    break;
+  case SampleFormat_16:
+    {
+      const int16_t *pSrc = (const int16_t *)pIn;
+      const __m128 scale = _mm_set1_ps(1.0f / (1 << 15));
+      for (; i + 8 <= count; i += 8) {
+        const __m128i v = _mm_loadu_si128((const __m128i *)(pSrc + i));
+        const __m128i lo = _mm_srai_epi32(_mm_unpacklo_epi16(v, v), 16);
+        const __m128i hi = _mm_srai_epi32(_mm_unpackhi_epi16(v, v), 16);
+        _mm_storeu_ps(pOut + i,     _mm_mul_ps(_mm_cvtepi32_ps(lo), scale));
+        _mm_storeu_ps(pOut + i + 4, _mm_mul_ps(_mm_cvtepi32_ps(hi), scale));
+      }
+      for (; i < count; i++)
+        pOut[i] = pSrc[i] * (1.0f / (1 << 15));
+    }
+    break;
+  case SampleFormat_24:
+    for (; i < count; i++, pIn += 3)
+      pOut[i] = (int32_t)((pIn[0] << 8) | (pIn[1] << 16) | ((uint32_t)pIn[2] << 24)) * (1.0f / (1U << 31));
+    break;
+  case SampleFormat_32:
+    {
+      const int32_t *pSrc = (const int32_t *)pIn;
+      const __m128 scale = _mm_set1_ps(1.0f / (1U << 31));
+      for (; i + 4 <= count; i += 4) {
+        const __m128i v = _mm_loadu_si128((const __m128i *)(pSrc + i));
+        _mm_storeu_ps(pOut + i, _mm_mul_ps(_mm_cvtepi32_ps(v), scale));
+      }
+      for (; i < count; i++)
+        pOut[i] = pSrc[i] * (1.0f / (1U << 31));
+    }
+    break;
+  default:
+    ASSERT(0);
+    memset(pOut, 0, count * sizeof(float));
+  }
+}
+
+CVolumeMeter::CVolumeMeter()
+{
+  memset(&m_Snapshot, 0, sizeof(m_Snapshot));
+  memset(m_History, 0, sizeof(m_History));
+  memset(m_fMaxTruePeak, 0, sizeof(m_fMaxTruePeak));
+}
+
+void CVolumeMeter::MeasureBlock(const float *pSamples, int nChannels, int nSamples)
+{
+  const __m128 absmask = _mm_castsi128_ps(_mm_set1_epi32(0x7fffffff));
+
+  // Sample peak and sum of squares
+  // Four samples of every channel fill nChannels registers, lane j of register k always holds channel (4k + j) % nChannels
+  __m128 sum[VOLUME_METER_MAX_CHANNELS], peak[VOLUME_METER_MAX_CHANNELS];
+  for (int k = 0; k < nChannels; k++) {
+    sum[k] = _mm_setzero_ps();
+    peak[k] = _mm_setzero_ps();
+  }
+
+  int s = 0;
+  for (; s + 4 <= nSamples; s += 4) {
+    const float *p = pSamples + s * nChannels;
+    for (int k = 0; k < nChannels; k++) {
+      const __m128 v = _mm_loadu_ps(p + 4 * k);
+      sum[k] = _mm_add_ps(sum[k], _mm_mul_ps(v, v));
+      peak[k] = _mm_max_ps(peak[k], _mm_and_ps(v, absmask));
+    }
+  }
+
+  float fSum[VOLUME_METER_MAX_CHANNELS] = { 0.0f };
+  for (int k = 0; k < nChannels; k++) {
+    float lanesSum[4], lanesPeak[4];
+    _mm_storeu_ps(lanesSum, sum[k]);
+    _mm_storeu_ps(lanesPeak, peak[k]);
+    for (int j = 0; j < 4; j++) {
+      const int ch = (4 * k + j) % nChannels;
+      fSum[ch] += lanesSum[j];
+      m_fPeak[ch] = max(m_fPeak[ch], lanesPeak[j]);
+    }
+  }
+
+  for (; s < nSamples; s++) {
+    for (int ch = 0; ch < nChannels; ch++) {
+      const float v = pSamples[s * nChannels + ch];
+      fSum[ch] += v * v;
+      m_fPeak[ch] = max(m_fPeak[ch], fabsf(v));
+    }
+  }
+
+  for (int ch = 0; ch < nChannels; ch++)
+    m_dSumSquares[ch] += fSum[ch];
+
+  // True peak, every input sample produces all four interpolated samples at once
+  __m128 coeffs[VOLUME_METER_TAPS];
+  for (int t = 0; t < VOLUME_METER_TAPS; t++)
+    coeffs[t] = _mm_loadu_ps(tp_coeffs[t]);
+
+  for (int ch = 0; ch < nChannels; ch++) {
+    memcpy(m_Channel, m_History[ch], sizeof(m_History[ch]));
+    for (int i = 0; i < nSamples; i++)
+      m_Channel[VOLUME_METER_TAPS - 1 + i] = pSamples[i * nChannels + ch];
+
+    __m128 tp = _mm_setzero_ps();
+    for (int i = 0; i < nSamples; i++) {
+      const float *x = m_Channel + VOLUME_METER_TAPS - 1 + i;
+      __m128 acc = _mm_setzero_ps();
+      for (int t = 0; t < VOLUME_METER_TAPS; t++)
+        acc = _mm_add_ps(acc, _mm_mul_ps(coeffs[t], _mm_set1_ps(x[-t])));
+      tp = _mm_max_ps(tp, _mm_and_ps(acc, absmask));
+    }
+    m_fTruePeak[ch] = max(m_fTruePeak[ch], hmax_ps(tp));
+
+    memcpy(m_History[ch], m_Channel + nSamples, sizeof(m_History[ch]));
+  }
+}
+
+void CVolumeMeter::Process(const BYTE *pBuffer, LAVAudioSampleFormat sfFormat, int nChannels, int nSamples)
+{
+  if (nChannels <= 0 || nChannels > VOLUME_METER_MAX_CHANNELS || nSamples <= 0)
+    return;
+
+  // Start over on request, or when the channel layout changed
+  if (m_bReset.exchange(false) || nChannels != m_nChannels) {
+    memset(m_History, 0, sizeof(m_History));
+    memset(m_fMaxTruePeak, 0, sizeof(m_fMaxTruePeak));
+    m_nChannels = nChannels;
+  }
+
+  for (int ch = 0; ch < nChannels; ch++) {
+    m_dSumSquares[ch] = 0.0;
+    m_fPeak[ch] = 0.0f;
+    m_fTruePeak[ch] = 0.0f;
+  }
+
+  const int bytesPerSample = get_byte_per_sample(sfFormat) * nChannels;
+  for (int s = 0; s < nSamples; s += VOLUME_METER_BLOCK) {
+    const int nBlock = min(nSamples - s, VOLUME_METER_BLOCK);
+    const BYTE *pBlock = pBuffer + s * bytesPerSample;
+    if (sfFormat == SampleFormat_FP32) {
+      MeasureBlock((const float *)pBlock, nChannels, nBlock);
+    } else {
+      convert_to_float(pBlock, sfFormat, m_Convert, nBlock * nChannels);
+      MeasureBlock(m_Convert, nChannels, nBlock);
+    }
+  }
+
+  // Publish the new levels
+  const LONG lSequence = m_lSequence.load(std::memory_order_relaxed);
+  m_lSequence.store(lSequence + 1, std::memory_order_relaxed);
+  std::atomic_thread_fence(std::memory_order_release);
+
+  m_Snapshot.nChannels = nChannels;
+  for (int ch = 0; ch < nChannels; ch++) {
+    m_fMaxTruePeak[ch] = max(m_fMaxTruePeak[ch], m_fTruePeak[ch]);
+
+    LAVAudioChannelLevels &levels = m_Snapshot.levels[ch];
+    levels.fPeak = level_to_db(m_fPeak[ch]);
+    levels.fRMS = level_to_db((float)sqrt(m_dSumSquares[ch] / nSamples));
+    levels.fTruePeak = level_to_db(m_fTruePeak[ch]);
+    levels.fMaxTruePeak = level_to_db(m_fMaxTruePeak[ch]);
+  }
+
+  m_lSequence.store(lSequence + 2, std::memory_order_release);
+}
+
+BOOL CVolumeMeter::GetLevels(int nChannel, LAVAudioChannelLevels *pLevels) const
+{
+  if (nChannel < 0 || nChannel >= VOLUME_METER_MAX_CHANNELS)
+    return FALSE;
+
+  // Retry until a consistent snapshot was read, the writer only holds the sequence odd for a few instructions
+  for (;;) {
+    const LONG lSequence = m_lSequence.load(std::memory_order_acquire);
+    if (lSequence & 1) {
+      YieldProcessor();
+      continue;
+    }
+
+    const int nChannels = m_Snapshot.nChannels;
+    const LAVAudioChannelLevels levels = m_Snapshot.levels[nChannel];
+
+    std::atomic_thread_fence(std::memory_order_acquire);
+    if (m_lSequence.load(std::memory_order_relaxed) != lSequence)
+      continue;
+
+    if (lSequence == 0 || nChannel >= nChannels)
+      return FALSE;
+
+    *pLevels = levels;
+    return TRUE;
+  }
+}
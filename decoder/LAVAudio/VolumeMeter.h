@@ -0,0 +1,79 @@
+/*
+ *      Copyright (C) 2010-2019 Hendrik Leppkes
+ *      http://www.1f0.de
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program; if not, write to the Free Software Foundation, Inc.,
+ *  51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#pragma once
+
+#include "LAVAudioSettings.h"
+
+#include <atomic>
+
+#define VOLUME_METER_MAX_CHANNELS 8
+
+// Number of samples per channel converted to float at once
+#define VOLUME_METER_BLOCK 1024
+
+// Taps per phase of the true-peak oversampling filter
+#define VOLUME_METER_TAPS 12
+
+// Peak, RMS and true-peak meter for interleaved audio
+// Process is called from the streaming thread, and publishes the levels of every processed buffer.
+// The levels can be read with GetLevels from any thread, readers never block the streaming thread.
+class CVolumeMeter
+{
+public:
+  CVolumeMeter();
+
+  // Measure the buffer and publish its levels
+  void Process(const BYTE *pBuffer, LAVAudioSampleFormat sfFormat, int nChannels, int nSamples);
+
+  // Reset the oversampling filters and the held maximum
+  // Can be called from any thread, the reset is performed before the next buffer is measured
+  void Reset() { m_bReset = true; }
+
+  // Get the last published levels of the given channel
+  // Returns FALSE if no levels for this channel are available
+  BOOL GetLevels(int nChannel, LAVAudioChannelLevels *pLevels) const;
+
+private:
+  void MeasureBlock(const float *pSamples, int nChannels, int nSamples);
+
+private:
+  // Snapshot of the levels, protected by a sequence counter which is odd while it is being written
+  struct Snapshot {
+    int nChannels;
+    LAVAudioChannelLevels levels[VOLUME_METER_MAX_CHANNELS];
+  } m_Snapshot;
+  std::atomic<LONG> m_lSequence{0};
+
+  std::atomic<bool> m_bReset{true};
+
+  // Accumulated over one call to Process
+  double m_dSumSquares[VOLUME_METER_MAX_CHANNELS];
+  float m_fPeak[VOLUME_METER_MAX_CHANNELS];
+  float m_fTruePeak[VOLUME_METER_MAX_CHANNELS];
+
+  float m_fMaxTruePeak[VOLUME_METER_MAX_CHANNELS];
+  int m_nChannels = 0;
+
+  // The last samples of every channel, needed by the oversampling filter
+  float m_History[VOLUME_METER_MAX_CHANNELS][VOLUME_METER_TAPS - 1];
+
+  float m_Convert[VOLUME_METER_BLOCK * VOLUME_METER_MAX_CHANNELS];
+  float m_Channel[VOLUME_METER_TAPS - 1 + VOLUME_METER_BLOCK];
+};
@@ -19,15 +19,11 @@
 
 #pragma once
 
+#include "StartCode.h"
+
 static inline const uint8_t *find_marker32_position(const uint8_t *pBuffer, size_t uBufSize, uint32_t marker)
 {
-  uint32_t state = 0;
-  for (size_t i = 0; i < uBufSize; ++i) {
-    state = (state << 8) | pBuffer[i];
-    if (state == marker) {
-      return pBuffer + (i - 3);
-    }
-  }
-
-  return nullptr;
+  const uint8_t *end = pBuffer + uBufSize;
+  const uint8_t *pMarker = FindSyncWord32(pBuffer, end, marker);
+  return (pMarker != end) ? pMarker : nullptr;
 }
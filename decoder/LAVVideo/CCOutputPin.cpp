@@ -41,6 +41,12 @@ HRESULT CCCOutputPin::Active(void)
   return __super::Active();
 }
 
+HRESULT CCCOutputPin::Inactive(void)
+{
+  ClearPendingCCData();
+  return __super::Inactive();
+}
+
 STDMETHODIMP CCCOutputPin::NonDelegatingQueryInterface(REFIID riid, void** ppv)
 {
   CheckPointer(ppv, E_POINTER);
@@ -56,8 +62,9 @@ HRESULT CCCOutputPin::DecideBufferSize(IMemAllocator * pAlloc, ALLOCATOR_PROPERT
 
   HRESULT hr = S_OK;
 
-  pProperties->cBuffers = max(pProperties->cBuffers, 1);
-  pProperties->cbBuffer = max((ULONG)pProperties->cbBuffer, 4096);
+  // a second buffer lets the next batch be filled while the previous one is still held downstream
+  pProperties->cBuffers = max(pProperties->cBuffers, 2);
+  pProperties->cbBuffer = max((ULONG)pProperties->cbBuffer, CC_BATCH_SIZE);
 
   // Sanity checks
   ALLOCATOR_PROPERTIES Actual;
@@ -84,7 +91,57 @@ HRESULT CCCOutputPin::GetMediaType(int iPosition, CMediaType* pmt)
   return S_OK;
 }
 
+// Collect the captions of a few frames, and deliver them in one sample with the time of the first frame
+// The caption data is a sequence of cc_data triplets, so the payloads of consecutive frames can simply be concatenated.
 STDMETHODIMP CCCOutputPin::DeliverCCData(BYTE *pDataIn, size_t size, REFERENCE_TIME rtTime)
+{
+  CAutoLock lock(&m_csBatch);
+  HRESULT hr = S_OK;
+
+  // Frames without a time stamp, or a time stamp going backwards, can't be part of the batch
+  if (m_nBatchSize > 0 && (rtTime == AV_NOPTS_VALUE || m_rtBatch == AV_NOPTS_VALUE || rtTime < m_rtBatch || size > CC_BATCH_SIZE - m_nBatchSize)) {
+    hr = DeliverPendingCCData();
+  }
+
+  if (size > CC_BATCH_SIZE) {
+    return DeliverSample(pDataIn, size, rtTime);
+  }
+
+  if (m_nBatchSize == 0)
+    m_rtBatch = rtTime;
+
+  memcpy(m_Batch + m_nBatchSize, pDataIn, size);
+  m_nBatchSize += size;
+  m_nBatchFrames++;
+
+  if (m_nBatchFrames >= CC_BATCH_FRAMES || rtTime == AV_NOPTS_VALUE || rtTime - m_rtBatch >= CC_BATCH_DURATION) {
+    hr = DeliverPendingCCData();
+  }
+
+  return hr;
+}
+
+STDMETHODIMP CCCOutputPin::DeliverPendingCCData()
+{
+  CAutoLock lock(&m_csBatch);
+  if (m_nBatchSize == 0)
+    return S_FALSE;
+
+  HRESULT hr = DeliverSample(m_Batch, m_nBatchSize, m_rtBatch);
+  ClearPendingCCData();
+  return hr;
+}
+
+STDMETHODIMP CCCOutputPin::ClearPendingCCData()
+{
+  CAutoLock lock(&m_csBatch);
+  m_nBatchSize   = 0;
+  m_nBatchFrames = 0;
+  m_rtBatch      = AV_NOPTS_VALUE;
+  return S_OK;
+}
+
+HRESULT CCCOutputPin::DeliverSample(const BYTE *pDataIn, size_t size, REFERENCE_TIME rtTime)
 {
   HRESULT hr;
   IMediaSample *pSample = nullptr;
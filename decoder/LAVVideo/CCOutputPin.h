@@ -21,6 +21,11 @@
 
 class CLAVVideo;
 
+// Closed captions of consecutive frames are collected into one sample, up to these limits
+#define CC_BATCH_SIZE       4096
+#define CC_BATCH_FRAMES     4
+#define CC_BATCH_DURATION   1000000
+
 class CCCOutputPin : public CBaseOutputPin
 {
 public:
@@ -35,13 +40,25 @@ public:
   virtual HRESULT CheckMediaType(const CMediaType* pmt);
   virtual HRESULT GetMediaType(int iPosition, CMediaType* pmt);
   virtual HRESULT Active(void);
+  virtual HRESULT Inactive(void);
 
   // CBaseOutputPin
   virtual HRESULT DecideBufferSize(IMemAllocator * pAlloc, ALLOCATOR_PROPERTIES * ppropInputRequest);
 
   // CCOutputPin
   STDMETHODIMP DeliverCCData(BYTE *pData, size_t size, REFERENCE_TIME rtTime);
+  STDMETHODIMP DeliverPendingCCData();
+  STDMETHODIMP ClearPendingCCData();
+
+private:
+  HRESULT DeliverSample(const BYTE *pData, size_t size, REFERENCE_TIME rtTime);
 
 private:
   CMediaType m_CCmt;
+
+  CCritSec       m_csBatch;
+  BYTE           m_Batch[CC_BATCH_SIZE];
+  size_t         m_nBatchSize   = 0;
+  int            m_nBatchFrames = 0;
+  REFERENCE_TIME m_rtBatch      = AV_NOPTS_VALUE;
 };
@@ -23,13 +23,32 @@
 
 #include <Shlwapi.h>
 
+// The packets of very long GOPs are not kept, a failing hardware decoder then resumes at the next keyframe
+#define LAV_STANDBY_MAX_BYTES (64 << 20)
+
+// Results of the hardware backend probes, shared by all decoders in the process
+static struct {
+  CCritSec lock;
+  BOOL     bProbed[HWAccel_NB];
+  HRESULT  hrProbe[HWAccel_NB];
+} s_HWAccelProbes;
+
+static BOOL is_hwdec_blacklisted_process()
+{
+  static const BOOL bBlackList = []() {
+    WCHAR fileName[1024];
+    GetModuleFileName(nullptr, fileName, 1024);
+    const WCHAR *processName = PathFindFileName(fileName);
+    DbgLog((LOG_TRACE, 10, L"-> Process is %s", processName));
+    return _wcsicmp(processName, L"dllhost.exe") == 0 || _wcsicmp(processName, L"explorer.exe") == 0 || _wcsicmp(processName, L"ReClockHelper.dll") == 0;
+  }();
+  return bBlackList;
+}
 
 CDecodeManager::CDecodeManager(CLAVVideo *pLAVVideo)
   : m_pLAVVideo(pLAVVideo)
+  , m_Benchmark(pLAVVideo)
 {
-  WCHAR fileName[1024];
-  GetModuleFileName(nullptr, fileName, 1024);
-  m_processName = PathFindFileName (fileName);
 }
 
 CDecodeManager::~CDecodeManager(void)
@@ -41,10 +60,21 @@ STDMETHODIMP CDecodeManager::Close()
 {
   CAutoLock decoderLock(this);
   SAFE_DELETE(m_pDecoder);
+  ClearStandbyPackets();
   
   return S_OK;
 }
 
+STDMETHODIMP_(BOOL) CDecodeManager::IsNativeDecoderActive()
+{
+  CAutoLock decoderLock(this);
+  if (!m_pDecoder || !m_bHWDecoder)
+    return FALSE;
+
+  const WCHAR *pszName = m_pDecoder->GetDecoderName();
+  return wcscmp(pszName, L"dxva2n") == 0 || wcscmp(pszName, L"d3d11 native") == 0 || wcscmp(pszName, L"cuvid native") == 0;
+}
+
 #define HWFORMAT_ENABLED \
    ((codec == AV_CODEC_ID_H264 && m_pLAVVideo->GetHWAccelCodec(HWCodec_H264))                                                       \
 || ((codec == AV_CODEC_ID_VC1 || codec == AV_CODEC_ID_WMV3) && m_pLAVVideo->GetHWAccelCodec(HWCodec_VC1))                           \
@@ -75,6 +105,85 @@ ILAVDecoder * CDecodeManager::CreateHWAccelDecoder(LAVHWAccel hwAccel)
   return pDecoder;
 }
 
+HRESULT CDecodeManager::CheckHWAccel(LAVHWAccel hwAccel, ILAVVideoSettings *pSettings, ILAVVideoCallback *pCallback)
+{
+  if (hwAccel <= HWAccel_None || hwAccel >= HWAccel_NB)
+    return E_INVALIDARG;
+
+  CAutoLock lock(&s_HWAccelProbes.lock);
+  if (s_HWAccelProbes.bProbed[hwAccel])
+    return s_HWAccelProbes.hrProbe[hwAccel];
+
+  HRESULT hr = E_FAIL;
+  ILAVDecoder *pDecoder = CreateHWAccelDecoder(hwAccel);
+  if (pDecoder) {
+    hr = pDecoder->InitInterfaces(pSettings, pCallback);
+    if (SUCCEEDED(hr)) {
+      hr = pDecoder->Check();
+    }
+    SAFE_DELETE(pDecoder);
+  }
+
+  DbgLog((LOG_TRACE, 10, L"CDecodeManager::CheckHWAccel(): Probed hardware backend %d (hr: 0x%x)", hwAccel, hr));
+
+  s_HWAccelProbes.bProbed[hwAccel] = TRUE;
+  s_HWAccelProbes.hrProbe[hwAccel] = hr;
+  return hr;
+}
+
+BOOL CDecodeManager::IsHWAccelUnavailable(LAVHWAccel hwAccel)
+{
+  if (hwAccel <= HWAccel_None || hwAccel >= HWAccel_NB)
+    return TRUE;
+
+  CAutoLock lock(&s_HWAccelProbes.lock);
+  return s_HWAccelProbes.bProbed[hwAccel] && FAILED(s_HWAccelProbes.hrProbe[hwAccel]);
+}
+
+// Remember a backend which failed to initialize its libraries or devices, so other instances don't try again
+void CDecodeManager::SetHWAccelUnavailable(LAVHWAccel hwAccel)
+{
+  if (hwAccel <= HWAccel_None || hwAccel >= HWAccel_NB)
+    return;
+
+  CAutoLock lock(&s_HWAccelProbes.lock);
+  s_HWAccelProbes.bProbed[hwAccel] = TRUE;
+  s_HWAccelProbes.hrProbe[hwAccel] = E_FAIL;
+}
+
+// Pick the backend with the best benchmark results for the stream, and benchmark the ones which were not measured yet
+LAVHWAccel CDecodeManager::SelectHWAccel(const CMediaType *pmt, AVCodecID codec, LAVHWAccel hwAccel, BOOL bHWAllowed)
+{
+  // native DXVA2 depends on the renderer, and MVC only has one decoder
+  if (hwAccel == HWAccel_DXVA2Native || codec == AV_CODEC_ID_H264_MVC)
+    return hwAccel;
+
+  static const LAVHWAccel backends[] = { HWAccel_CUDA, HWAccel_QuickSync, HWAccel_DXVA2CopyBack, HWAccel_D3D11 };
+  std::vector<LAVHWAccel> candidates = { HWAccel_None };
+  if (bHWAllowed) {
+    for (LAVHWAccel backend : backends) {
+      if (!IsHWAccelUnavailable(backend))
+        candidates.push_back(backend);
+    }
+  }
+
+  LAVPinInfo pinInfo;
+  const BOOL bPinInfo = SUCCEEDED(m_pLAVVideo->GetLAVPinInfo(pinInfo));
+  const std::wstring key = CDecoderBenchmark::GetStreamKey(pmt, codec, bPinInfo ? &pinInfo : nullptr);
+  const BOOL bLowLatency = !!(m_pLAVVideo->GetDecodeFlags() & (LAV_VIDEO_DEC_FLAG_LIVE | LAV_VIDEO_DEC_FLAG_LOW_DELAY));
+
+  // the configured backend is used until one of the candidates was measured
+  std::vector<LAVHWAccel> unmeasured;
+  if (CDecoderBenchmark::SelectBackend(key, candidates, bLowLatency, &hwAccel, &unmeasured) == S_OK) {
+    DbgLog((LOG_TRACE, 10, L"-> Benchmark results for %s select backend %d", key.c_str(), hwAccel));
+  }
+
+  if (!unmeasured.empty())
+    m_Benchmark.Start(pmt, codec, key, unmeasured);
+
+  return hwAccel;
+}
+
 STDMETHODIMP CDecodeManager::CreateDecoder(const CMediaType *pmt, AVCodecID codec)
 {
   CAutoLock decoderLock(this);
@@ -83,26 +192,60 @@ STDMETHODIMP CDecodeManager::CreateDecoder(const CMediaType *pmt, AVCodecID code
   HRESULT hr = S_OK;
   BOOL bWMV9 = FALSE;
 
-  BOOL bHWDecBlackList = _wcsicmp(m_processName.c_str(), L"dllhost.exe") == 0 || _wcsicmp(m_processName.c_str(), L"explorer.exe") == 0 || _wcsicmp(m_processName.c_str(), L"ReClockHelper.dll") == 0;
-  DbgLog((LOG_TRACE, 10, L"-> Process is %s, blacklist: %d", m_processName.c_str(), bHWDecBlackList));
+  ClearStandbyPackets();
+
+  BOOL bHWDecBlackList = is_hwdec_blacklisted_process();
+  DbgLog((LOG_TRACE, 10, L"-> Process blacklist: %d", bHWDecBlackList));
 
   BITMAPINFOHEADER *pBMI = nullptr;
   videoFormatTypeHandler(*pmt, &pBMI);
 
+  BOOL bHWAllowed = !bHWDecBlackList && !m_bHWDecoderFailed && HWFORMAT_ENABLED && HWRESOLUTION_ENABLED;
+
+  // the hardware decoders need the output pin to be connected to negotiate their device
+  if (bHWAllowed && m_pLAVVideo->IsFrameSourceActive()) {
+    DbgLog((LOG_TRACE, 10, L"-> No hardware decoding in frame source mode"));
+    bHWAllowed = FALSE;
+  }
+
+  const BOOL bAutoSelect = m_pLAVVideo->GetHWAccelAutoSelect();
+  LAVHWAccel hwAccel = m_pLAVVideo->GetHWAccel();
+  if (bAutoSelect)
+    hwAccel = SelectHWAccel(pmt, codec, hwAccel, bHWAllowed);
+
+  BOOL bTryHWAccel = bHWAllowed && hwAccel != HWAccel_None;
+
+  // skip backends which are already known to be unavailable in this process, without loading their libraries
+  if (bTryHWAccel && IsHWAccelUnavailable(hwAccel)) {
+    DbgLog((LOG_TRACE, 10, L"-> Hardware Codec %d is not available in this process", hwAccel));
+    bTryHWAccel = FALSE;
+  }
+
+  // With automatic selection, the benchmark results can pick another backend than the current one
+  const BOOL bSameBackend = !bAutoSelect || (m_bHWDecoder ? (bTryHWAccel && m_HWAccel == hwAccel) : !bTryHWAccel);
+
+  // Try reconfiguring the current decoder, if the same type of decoder would be created again
+  if (m_pDecoder && codec == m_Codec && bSameBackend && (m_bHWDecoder ? (!m_bHWDecoderFailed && HWFORMAT_ENABLED && HWRESOLUTION_ENABLED) : !bTryHWAccel)) {
+    if (m_pDecoder->Reconfigure(codec, pmt) == S_OK) {
+      DbgLog((LOG_TRACE, 10, L"-> Re-configured the current decoder"));
+      return S_OK;
+    }
+  }
+
   // Try reusing the current HW decoder
-  if (m_pDecoder && m_bHWDecoder && !m_bHWDecoderFailed && HWFORMAT_ENABLED && HWRESOLUTION_ENABLED) {
+  if (m_pDecoder && m_bHWDecoder && bSameBackend && !m_bHWDecoderFailed && HWFORMAT_ENABLED && HWRESOLUTION_ENABLED) {
     DbgLog((LOG_TRACE, 10, L"-> Trying to re-use old HW Decoder"));
     hr = m_pDecoder->InitDecoder(codec, pmt);
     goto done;
   }
   SAFE_DELETE(m_pDecoder);
 
-  LAVHWAccel hwAccel = m_pLAVVideo->GetHWAccel();
-  if (!bHWDecBlackList &&  hwAccel != HWAccel_None && !m_bHWDecoderFailed && HWFORMAT_ENABLED && HWRESOLUTION_ENABLED)
+  if (bTryHWAccel)
   {
     DbgLog((LOG_TRACE, 10, L"-> Trying Hardware Codec %d", hwAccel));
     m_pDecoder = CreateHWAccelDecoder(hwAccel);
     m_bHWDecoder = TRUE;
+    m_HWAccel = hwAccel;
   }
 
 softwaredec:
@@ -123,6 +266,8 @@ softwaredec:
   hr = m_pDecoder->InitInterfaces(static_cast<ILAVVideoSettings *>(m_pLAVVideo), static_cast<ILAVVideoCallback *>(m_pLAVVideo));
   if (FAILED(hr)) {
     DbgLog((LOG_TRACE, 10, L"-> Init Interfaces failed (hr: 0x%x)", hr));
+    if (m_bHWDecoder)
+      SetHWAccelUnavailable(hwAccel);
     goto done;
   }
 
@@ -162,14 +307,25 @@ STDMETHODIMP CDecodeManager::Decode(IMediaSample *pSample)
   if (!m_pDecoder)
     return E_UNEXPECTED;
 
+  if (m_Benchmark.IsCollecting())
+    m_Benchmark.AddSample(pSample);
+
   hr = m_pDecoder->Decode(pSample);
 
+  if (SUCCEEDED(hr) && m_bHWDecoder && m_pLAVVideo->GetHWAccelStandby())
+    AddStandbyPacket(pSample);
+
   // If a hardware decoder indicates a hard failure, we switch back to software
   // This is used to indicate incompatible media
   if (FAILED(hr) && m_bHWDecoder) {
     DbgLog((LOG_TRACE, 10, L"CDecodeManager::Decode(): Hardware decoder indicates failure, switching back to software"));
     m_bHWDecoderFailed = TRUE;
 
+    // the packets of the current GOP are passed to the software decoder, after it was created
+    std::vector<StandbyPacket> packets;
+    if (m_bStandbyValid)
+      packets.swap(m_StandbyPackets);
+
     // If we're disabling DXVA2 Native decoding, we need to release resources now
     if (wcscmp(m_pDecoder->GetDecoderName(), L"dxva2n") == 0 || wcscmp(m_pDecoder->GetDecoderName(), L"d3d11 native") == 0) {
       m_pLAVVideo->ReleaseAllDXVAResources();
@@ -183,6 +339,7 @@ STDMETHODIMP CDecodeManager::Decode(IMediaSample *pSample)
     hr = CreateDecoder(&mt, m_Codec);
 
     if (SUCCEEDED(hr)) {
+      ReplayStandbyPackets(packets);
       hr = m_pDecoder->Decode(pSample);
     }
   }
@@ -190,10 +347,120 @@ STDMETHODIMP CDecodeManager::Decode(IMediaSample *pSample)
   return S_OK;
 }
 
+// Keep a copy of the packets since the last keyframe, to be able to decode the current GOP again in software
+void CDecodeManager::AddStandbyPacket(IMediaSample *pSample)
+{
+  const BOOL bSyncPoint = (pSample->IsSyncPoint() == S_OK);
+  if (bSyncPoint) {
+    m_StandbyPackets.clear();
+    m_nStandbyBytes = 0;
+    m_bStandbyValid = TRUE;
+  }
+
+  if (!m_bStandbyValid)
+    return;
+
+  BYTE *pData = nullptr;
+  const long len = pSample->GetActualDataLength();
+  if (len <= 0 || FAILED(pSample->GetPointer(&pData)))
+    return;
+
+  if (m_nStandbyBytes + len > LAV_STANDBY_MAX_BYTES) {
+    ClearStandbyPackets();
+    return;
+  }
+
+  StandbyPacket packet;
+  packet.data.assign(pData, pData + len);
+  packet.bSyncPoint = bSyncPoint;
+  if (FAILED(pSample->GetTime(&packet.rtStart, &packet.rtStop)))
+    packet.rtStart = packet.rtStop = AV_NOPTS_VALUE;
+  m_StandbyPackets.push_back(std::move(packet));
+  m_nStandbyBytes += len;
+}
+
+void CDecodeManager::ClearStandbyPackets()
+{
+  m_StandbyPackets.clear();
+  m_StandbyPackets.shrink_to_fit();
+  m_nStandbyBytes = 0;
+  m_bStandbyValid = FALSE;
+}
+
+// Decode the packets of the current GOP with the new decoder, without delivering the frames shown already
+HRESULT CDecodeManager::ReplayStandbyPackets(const std::vector<StandbyPacket> &packets)
+{
+  if (packets.empty())
+    return S_FALSE;
+
+  DbgLog((LOG_TRACE, 10, L"CDecodeManager::ReplayStandbyPackets(): Decoding %u packets of the current GOP, resuming after %I64d", (unsigned)packets.size(), m_rtLastFrame));
+
+  size_t nMaxSize = 0;
+  for (const StandbyPacket &packet : packets)
+    nMaxSize = max(nMaxSize, packet.data.size());
+
+  HRESULT hr = S_OK;
+  IMemAllocator *pAllocator = new CMemAllocator(L"LAV Video Standby Allocator", nullptr, &hr);
+  pAllocator->AddRef();
+
+  ALLOCATOR_PROPERTIES props = { 4, (long)(nMaxSize + AV_INPUT_BUFFER_PADDING_SIZE), 1, 0 }, actual;
+  if (SUCCEEDED(hr))
+    hr = pAllocator->SetProperties(&props, &actual);
+  if (SUCCEEDED(hr))
+    hr = pAllocator->Commit();
+
+  m_rtStandbyResume = m_rtLastFrame;
+  for (size_t i = 0; SUCCEEDED(hr) && i < packets.size(); i++) {
+    const StandbyPacket &packet = packets[i];
+
+    IMediaSample *pSample = nullptr;
+    hr = pAllocator->GetBuffer(&pSample, nullptr, nullptr, 0);
+    if (FAILED(hr))
+      break;
+
+    BYTE *pData = nullptr;
+    pSample->GetPointer(&pData);
+    memcpy(pData, packet.data.data(), packet.data.size());
+    pSample->SetActualDataLength((long)packet.data.size());
+    pSample->SetTime(packet.rtStart != AV_NOPTS_VALUE ? (REFERENCE_TIME *)&packet.rtStart : nullptr, packet.rtStart != AV_NOPTS_VALUE ? (REFERENCE_TIME *)&packet.rtStop : nullptr);
+    pSample->SetSyncPoint(packet.bSyncPoint);
+    pSample->SetDiscontinuity(i == 0);
+
+    // frames which were shown already are only decoded if other frames depend on them
+    pSample->SetPreroll(packet.rtStart != AV_NOPTS_VALUE && m_rtStandbyResume != AV_NOPTS_VALUE && packet.rtStart <= m_rtStandbyResume);
+
+    hr = m_pDecoder->Decode(pSample);
+    SafeRelease(&pSample);
+  }
+
+  pAllocator->Decommit();
+  SafeRelease(&pAllocator);
+  return hr;
+}
+
+BOOL CDecodeManager::IsStandbyReplayFrame(const LAVFrame *pFrame)
+{
+  if (pFrame->flags & (LAV_FRAME_FLAG_FLUSH | LAV_FRAME_FLAG_REDRAW))
+    return FALSE;
+
+  if (m_rtStandbyResume != AV_NOPTS_VALUE) {
+    if (pFrame->rtStart != AV_NOPTS_VALUE && pFrame->rtStart <= m_rtStandbyResume)
+      return TRUE;
+    m_rtStandbyResume = AV_NOPTS_VALUE;
+  }
+
+  m_rtLastFrame = pFrame->rtStart;
+  return FALSE;
+}
+
 STDMETHODIMP CDecodeManager::Flush()
 {
   CAutoLock decoderLock(this);
 
+  ClearStandbyPackets();
+  m_rtLastFrame = AV_NOPTS_VALUE;
+  m_rtStandbyResume = AV_NOPTS_VALUE;
+
   if (!m_pDecoder)
     return E_UNEXPECTED;
 
@@ -20,6 +20,7 @@
 #pragma once
 
 #include "decoders/ILAVDecoder.h"
+#include "DecoderBenchmark.h"
 #include "SynchronizedQueue.h"
 
 class CLAVVideo;
@@ -32,6 +33,10 @@ public:
 
   static ILAVDecoder * CreateHWAccelDecoder(LAVHWAccel hwAccel);
 
+  // Check if a hardware decoder backend is usable
+  // The backend is only probed once per process, and the result is shared by all instances.
+  static HRESULT CheckHWAccel(LAVHWAccel hwAccel, ILAVVideoSettings *pSettings, ILAVVideoCallback *pCallback);
+
   // Decoder management
   STDMETHODIMP CreateDecoder(const CMediaType *pmt, AVCodecID codec);
   STDMETHODIMP Close();
@@ -48,6 +53,8 @@ public:
 
   // HWAccel Query
   STDMETHODIMP_(BOOL) IsHWDecoderActive() { return m_bHWDecoder; }
+  // The decoder outputs hardware surfaces, from the allocator it provided to the renderer
+  STDMETHODIMP_(BOOL) IsNativeDecoderActive();
   STDMETHODIMP GetHWAccelActiveDevice(BSTR *pstrDeviceName) { return m_pDecoder ? m_pDecoder->GetHWAccelActiveDevice(pstrDeviceName) : E_UNEXPECTED; }
 
   // ILAVDecoder (partial)
@@ -58,6 +65,30 @@ public:
   STDMETHODIMP_(REFERENCE_TIME) GetFrameDuration() { ASSERT(m_pDecoder); return m_pDecoder->GetFrameDuration(); }
   STDMETHODIMP HasThreadSafeBuffers() { return m_pDecoder ? m_pDecoder->HasThreadSafeBuffers() : S_FALSE; }
   STDMETHODIMP SetDirectOutput(BOOL bDirect) { return m_pDecoder ? m_pDecoder->SetDirectOutput(bDirect) : S_FALSE; }
+  STDMETHODIMP GetSurfacePoolStatus(LAVHWSurfacePoolStatus *pStatus) { return m_pDecoder ? m_pDecoder->GetSurfacePoolStatus(pStatus) : S_FALSE; }
+  STDMETHODIMP GetThreadingStatus(LAVDecoderThreadingStatus *pStatus) { return m_pDecoder ? m_pDecoder->GetThreadingStatus(pStatus) : S_FALSE; }
+
+  // Check if a frame of the software decoder which took over from a failed hardware decoder was delivered already
+  // Every other frame is remembered as the latest delivered frame.
+  BOOL IsStandbyReplayFrame(const LAVFrame *pFrame);
+
+private:
+  static BOOL IsHWAccelUnavailable(LAVHWAccel hwAccel);
+  static void SetHWAccelUnavailable(LAVHWAccel hwAccel);
+
+  LAVHWAccel SelectHWAccel(const CMediaType *pmt, AVCodecID codec, LAVHWAccel hwAccel, BOOL bHWAllowed);
+
+  // Packets since the last keyframe, decoded again by the software decoder if the hardware decoder fails
+  struct StandbyPacket {
+    std::vector<BYTE> data;
+    REFERENCE_TIME    rtStart;
+    REFERENCE_TIME    rtStop;
+    BOOL              bSyncPoint;
+  };
+
+  void AddStandbyPacket(IMediaSample *pSample);
+  void ClearStandbyPackets();
+  HRESULT ReplayStandbyPackets(const std::vector<StandbyPacket> &packets);
 
 private:
   CLAVVideo    *m_pLAVVideo = nullptr;
@@ -67,8 +98,15 @@ private:
 
   BOOL         m_bHWDecoder = FALSE;
   BOOL         m_bHWDecoderFailed = FALSE;
+  LAVHWAccel   m_HWAccel    = HWAccel_None;
 
-  BOOL         m_bWMV9Failed = FALSE;
+  CDecoderBenchmark m_Benchmark;
 
-  std::wstring m_processName;
+  std::vector<StandbyPacket> m_StandbyPackets;
+  size_t         m_nStandbyBytes      = 0;
+  BOOL           m_bStandbyValid      = FALSE;  ///< the packets start at a keyframe
+  REFERENCE_TIME m_rtLastFrame        = AV_NOPTS_VALUE;
+  REFERENCE_TIME m_rtStandbyResume    = AV_NOPTS_VALUE;
+
+  BOOL         m_bWMV9Failed = FALSE;
 };
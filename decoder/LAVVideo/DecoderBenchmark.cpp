@@ -0,0 +1,444 @@
+/*
+ *      Copyright (C) 2010-2019 Hendrik Leppkes
+ *      http://www.1f0.de
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program; if not, write to the Free Software Foundation, Inc.,
+ *  51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+
+#include "stdafx.h"
+#include "DecoderBenchmark.h"
+#include "LAVVideo.h"
+
+#include "registry.h"
+#include "timer.h"
+
+#include <map>
+#include <process.h>
+
+// Kept outside of the settings key, so storing the results doesn't invalidate the cached settings
+// The version is part of the value names, so an incompatible layout is never read back
+#define BENCHMARK_REGISTRY_KEY L"Software\\LAV\\DecoderBenchmark"
+#define BENCHMARK_REGISTRY_VERSION 1
+
+// Registry names of the backends, indexed by LAVHWAccel
+static const WCHAR *s_BackendNames[HWAccel_NB] = {
+  L"software",
+  L"cuda",
+  L"quicksync",
+  L"dxva2cb",
+  L"dxva2n",
+  L"d3d11",
+};
+
+static CCritSec s_ResultsLock;
+static std::map<std::wstring, std::vector<BYTE>> s_Results;
+
+// Only one benchmark runs in the process, so the backends are not measured against each other
+static volatile LONG s_lBenchmarkRunning = 0;
+
+CDecoderBenchmark::CDecoderBenchmark(CLAVVideo *pLAVVideo)
+  : m_pLAVVideo(pLAVVideo)
+{
+}
+
+CDecoderBenchmark::~CDecoderBenchmark()
+{
+  Stop();
+}
+
+std::wstring CDecoderBenchmark::GetStreamKey(const CMediaType *pmt, AVCodecID codec, const LAVPinInfo *pPinInfo)
+{
+  BITMAPINFOHEADER *pBMI = nullptr;
+  videoFormatTypeHandler(*pmt, &pBMI);
+
+  // the same resolution classes as the hardware resolution flags
+  const WCHAR *resolution = L"sd";
+  if (pBMI && (pBMI->biHeight > 1200 || pBMI->biWidth > 1920))
+    resolution = L"uhd";
+  else if (pBMI && (pBMI->biHeight > 576 || pBMI->biWidth > 1024))
+    resolution = L"hd";
+
+  // the bit depth is only known up-front from the pixel format reported by LAV Splitter
+  int bitdepth = 8;
+  if (pPinInfo && pPinInfo->pix_fmt != AV_PIX_FMT_NONE) {
+    const AVPixFmtDescriptor *desc = av_pix_fmt_desc_get(pPinInfo->pix_fmt);
+    if (desc)
+      bitdepth = desc->comp[0].depth;
+  }
+
+  WCHAR key[64];
+  swprintf_s(key, L"%S_%s_%d", avcodec_get_name(codec), resolution, bitdepth);
+  return std::wstring(key);
+}
+
+static std::wstring benchmark_value_name(const std::wstring &key, LAVHWAccel backend)
+{
+  WCHAR name[96];
+  swprintf_s(name, L"%s_%s_%d", key.c_str(), s_BackendNames[backend], BENCHMARK_REGISTRY_VERSION);
+  return std::wstring(name);
+}
+
+BOOL CDecoderBenchmark::LoadResult(const std::wstring &key, LAVHWAccel backend, Result *pResult)
+{
+  const std::wstring name = benchmark_value_name(key, backend);
+
+  CAutoLock lock(&s_ResultsLock);
+  auto it = s_Results.find(name);
+  if (it == s_Results.end()) {
+    HRESULT hr = S_OK;
+    CRegistry reg = CRegistry(HKEY_CURRENT_USER, BENCHMARK_REGISTRY_KEY, hr, TRUE);
+    if (FAILED(hr))
+      return FALSE;
+
+    DWORD dwSize = 0;
+    BYTE *pData = reg.ReadBinary(name.c_str(), dwSize, hr);
+    if (FAILED(hr))
+      return FALSE;
+
+    it = s_Results.emplace(name, std::vector<BYTE>(pData, pData + dwSize)).first;
+    CoTaskMemFree(pData);
+  }
+
+  if (it->second.size() != sizeof(Result))
+    return FALSE;
+
+  memcpy(pResult, it->second.data(), sizeof(Result));
+  return TRUE;
+}
+
+void CDecoderBenchmark::StoreResult(const std::wstring &key, LAVHWAccel backend, const Result *pResult)
+{
+  const std::wstring name = benchmark_value_name(key, backend);
+
+  CAutoLock lock(&s_ResultsLock);
+  s_Results[name] = std::vector<BYTE>((const BYTE *)pResult, (const BYTE *)pResult + sizeof(Result));
+
+  HRESULT hr = S_OK;
+  CreateRegistryKey(HKEY_CURRENT_USER, BENCHMARK_REGISTRY_KEY);
+  CRegistry reg = CRegistry(HKEY_CURRENT_USER, BENCHMARK_REGISTRY_KEY, hr);
+  if (SUCCEEDED(hr))
+    reg.WriteBinary(name.c_str(), (const BYTE *)pResult, sizeof(Result));
+}
+
+HRESULT CDecoderBenchmark::SelectBackend(const std::wstring &key, const std::vector<LAVHWAccel> &candidates, BOOL bLowLatency, LAVHWAccel *pBackend, std::vector<LAVHWAccel> *pUnmeasured)
+{
+  CheckPointer(pBackend, E_POINTER);
+
+  BOOL bFound = FALSE;
+  Result best = { 0 };
+  for (LAVHWAccel backend : candidates) {
+    Result result;
+    if (!LoadResult(key, backend, &result)) {
+      if (pUnmeasured)
+        pUnmeasured->push_back(backend);
+      continue;
+    }
+
+    if (result.rtFrameTime <= 0)
+      continue;
+
+    const REFERENCE_TIME rtBest = bLowLatency ? best.rtLatency : best.rtFrameTime;
+    const REFERENCE_TIME rtResult = bLowLatency ? result.rtLatency : result.rtFrameTime;
+    if (!bFound || rtResult < rtBest) {
+      bFound = TRUE;
+      best = result;
+      *pBackend = backend;
+    }
+  }
+
+  return bFound ? S_OK : S_FALSE;
+}
+
+HRESULT CDecoderBenchmark::Start(const CMediaType *pmt, AVCodecID codec, const std::wstring &key, const std::vector<LAVHWAccel> &backends)
+{
+  // the benchmark of the stream is already under way
+  if ((m_bCollecting || m_hThread) && key == m_Key && m_InputType == *pmt)
+    return S_OK;
+
+  Stop();
+
+  if (backends.empty())
+    return S_FALSE;
+
+  if (InterlockedCompareExchange(&s_lBenchmarkRunning, 1, 0) != 0)
+    return S_FALSE;
+
+  DbgLog((LOG_TRACE, 10, L"CDecoderBenchmark::Start(): Collecting samples to benchmark %u backends for %s", (unsigned)backends.size(), key.c_str()));
+
+  m_InputType = *pmt;
+  m_OutputType = CMediaType();
+  m_Codec = codec;
+  m_Key = key;
+  m_Backends = backends;
+  m_bCollecting = TRUE;
+  return S_OK;
+}
+
+void CDecoderBenchmark::AddSample(IMediaSample *pSample)
+{
+  if (!m_bCollecting)
+    return;
+
+  // a format change ends the stream the samples were collected from
+  AM_MEDIA_TYPE *pmt = nullptr;
+  if (pSample->GetMediaType(&pmt) == S_OK) {
+    DeleteMediaType(pmt);
+    if (!m_Packets.empty()) {
+      Stop();
+      return;
+    }
+  }
+
+  if (m_Packets.empty() && pSample->IsSyncPoint() != S_OK)
+    return;
+
+  BYTE *pData = nullptr;
+  const long len = pSample->GetActualDataLength();
+  if (len <= 0 || FAILED(pSample->GetPointer(&pData)))
+    return;
+
+  if (m_nBytes + len > LAV_BENCHMARK_MAX_BYTES && m_Packets.size() < LAV_BENCHMARK_MIN_FRAMES) {
+    Stop();
+    return;
+  }
+
+  if (m_nBytes + len <= LAV_BENCHMARK_MAX_BYTES) {
+    Packet packet;
+    packet.data.assign(pData, pData + len);
+    packet.bSyncPoint = (pSample->IsSyncPoint() == S_OK);
+    if (FAILED(pSample->GetTime(&packet.rtStart, &packet.rtStop)))
+      packet.rtStart = packet.rtStop = AV_NOPTS_VALUE;
+    m_Packets.push_back(std::move(packet));
+    m_nBytes += len;
+
+    if (m_Packets.size() < LAV_BENCHMARK_SAMPLES)
+      return;
+  }
+
+  // the thread ends the benchmark in the process when it is done
+  m_lAbort = 0;
+  m_hThread = (HANDLE)_beginthreadex(nullptr, 0, BenchmarkThreadProc, this, 0, nullptr);
+  if (m_hThread)
+    m_bCollecting = FALSE;
+  else
+    Stop();
+}
+
+void CDecoderBenchmark::Stop()
+{
+  if (m_bCollecting) {
+    m_bCollecting = FALSE;
+    InterlockedExchange(&s_lBenchmarkRunning, 0);
+  }
+
+  if (m_hThread) {
+    InterlockedExchange(&m_lAbort, 1);
+    WaitForSingleObject(m_hThread, INFINITE);
+    CloseHandle(m_hThread);
+    m_hThread = nullptr;
+  }
+
+  m_Packets.clear();
+  m_Packets.shrink_to_fit();
+  m_nBytes = 0;
+}
+
+unsigned __stdcall CDecoderBenchmark::BenchmarkThreadProc(void *pParam)
+{
+  // the hardware decoders use COM for their devices
+  HRESULT hr = CoInitializeEx(nullptr, COINIT_MULTITHREADED);
+  static_cast<CDecoderBenchmark *>(pParam)->BenchmarkThread();
+  if (SUCCEEDED(hr))
+    CoUninitialize();
+  return 0;
+}
+
+void CDecoderBenchmark::BenchmarkThread()
+{
+  size_t nMaxSize = 0;
+  for (const Packet &packet : m_Packets)
+    nMaxSize = max(nMaxSize, packet.data.size());
+
+  // the samples are filled from the copies again for every backend
+  HRESULT hr = S_OK;
+  IMemAllocator *pAllocator = new CMemAllocator(L"LAV Video Benchmark Allocator", nullptr, &hr);
+  pAllocator->AddRef();
+
+  ALLOCATOR_PROPERTIES props = { 16, (long)(nMaxSize + AV_INPUT_BUFFER_PADDING_SIZE), 1, 0 }, actual;
+  if (SUCCEEDED(hr))
+    hr = pAllocator->SetProperties(&props, &actual);
+  if (SUCCEEDED(hr))
+    hr = pAllocator->Commit();
+
+  for (size_t i = 0; SUCCEEDED(hr) && i < m_Backends.size() && !m_lAbort; i++) {
+    Result result = { 0 };
+    HRESULT hrBackend = RunBackend(m_Backends[i], pAllocator, &result);
+    if (m_lAbort)
+      break;
+
+    DbgLog((LOG_TRACE, 10, L"CDecoderBenchmark::BenchmarkThread(): Backend %s for %s: %I64d per frame, %I64d latency (hr: 0x%x)", s_BackendNames[m_Backends[i]], m_Key.c_str(), result.rtFrameTime, result.rtLatency, hrBackend));
+    StoreResult(m_Key, m_Backends[i], &result);
+  }
+
+  pAllocator->Decommit();
+  SafeRelease(&pAllocator);
+
+  m_Packets.clear();
+  m_Packets.shrink_to_fit();
+  m_nBytes = 0;
+
+  InterlockedExchange(&s_lBenchmarkRunning, 0);
+}
+
+HRESULT CDecoderBenchmark::RunBackend(LAVHWAccel backend, IMemAllocator *pAllocator, Result *pResult)
+{
+  ILAVDecoder *pDecoder = (backend == HWAccel_None) ? CreateDecoderAVCodec() : CDecodeManager::CreateHWAccelDecoder(backend);
+  if (pDecoder == nullptr)
+    return E_FAIL;
+
+  HRESULT hr = pDecoder->InitInterfaces(static_cast<ILAVVideoSettings *>(m_pLAVVideo), static_cast<ILAVVideoCallback *>(this));
+  if (SUCCEEDED(hr))
+    hr = pDecoder->InitDecoder(m_Codec, &m_InputType);
+  if (FAILED(hr)) {
+    SAFE_DELETE(pDecoder);
+    return hr;
+  }
+
+  m_dwFrames = 0;
+  m_rtFirstFrame = 0;
+
+  const REFERENCE_TIME rtStart = timer_get_ref_time();
+  for (size_t i = 0; SUCCEEDED(hr) && i < m_Packets.size() && !m_lAbort; i++) {
+    const Packet &packet = m_Packets[i];
+
+    IMediaSample *pSample = nullptr;
+    hr = pAllocator->GetBuffer(&pSample, nullptr, nullptr, 0);
+    if (FAILED(hr))
+      break;
+
+    BYTE *pData = nullptr;
+    pSample->GetPointer(&pData);
+    memcpy(pData, packet.data.data(), packet.data.size());
+    pSample->SetActualDataLength((long)packet.data.size());
+    pSample->SetTime(packet.rtStart != AV_NOPTS_VALUE ? (REFERENCE_TIME *)&packet.rtStart : nullptr, packet.rtStart != AV_NOPTS_VALUE ? (REFERENCE_TIME *)&packet.rtStop : nullptr);
+    pSample->SetSyncPoint(packet.bSyncPoint);
+    pSample->SetDiscontinuity(i == 0);
+
+    hr = pDecoder->Decode(pSample);
+    SafeRelease(&pSample);
+  }
+  if (SUCCEEDED(hr))
+    hr = pDecoder->EndOfStream();
+  const REFERENCE_TIME rtEnd = timer_get_ref_time();
+
+  SAFE_DELETE(pDecoder);
+
+  if (FAILED(hr))
+    return hr;
+  if (m_dwFrames < LAV_BENCHMARK_MIN_FRAMES)
+    return E_FAIL;
+
+  pResult->rtFrameTime = max((rtEnd - rtStart) / m_dwFrames, 1LL);
+  pResult->rtLatency = m_rtFirstFrame - rtStart;
+  return S_OK;
+}
+
+// ILAVVideoCallback
+
+STDMETHODIMP CDecoderBenchmark::AllocateFrame(LAVFrame **ppFrame)
+{
+  return static_cast<ILAVVideoCallback *>(m_pLAVVideo)->AllocateFrame(ppFrame);
+}
+
+STDMETHODIMP CDecoderBenchmark::ReleaseFrame(LAVFrame **ppFrame)
+{
+  return static_cast<ILAVVideoCallback *>(m_pLAVVideo)->ReleaseFrame(ppFrame);
+}
+
+STDMETHODIMP CDecoderBenchmark::Deliver(LAVFrame *pFrame)
+{
+  if (pFrame->flags & LAV_FRAME_FLAG_FLUSH) {
+    ReleaseFrame(&pFrame);
+    return S_FALSE;
+  }
+
+  // Copy-back decoders in direct mode only copy the frame when it is used, which is part of their cost
+  if (pFrame->direct) {
+    LAVDirectBuffer buffer;
+    if (pFrame->direct_lock(pFrame, &buffer)) {
+      const LAVPixFmtDesc desc = getPixelFormatDesc(pFrame->format);
+      for (int i = 0; i < desc.planes; i++) {
+        const size_t size = (size_t)(pFrame->height / desc.planeHeight[i]) * buffer.stride[i];
+        if (m_CopyBuffer.size() < size)
+          m_CopyBuffer.resize(size);
+        memcpy(m_CopyBuffer.data(), buffer.data[i], size);
+      }
+      pFrame->direct_unlock(pFrame);
+    }
+  }
+
+  if (m_dwFrames++ == 0)
+    m_rtFirstFrame = timer_get_ref_time();
+
+  ReleaseFrame(&pFrame);
+  return m_lAbort ? E_ABORT : S_OK;
+}
+
+STDMETHODIMP_(LPWSTR) CDecoderBenchmark::GetFileExtension()
+{
+  return static_cast<ILAVVideoCallback *>(m_pLAVVideo)->GetFileExtension();
+}
+
+STDMETHODIMP_(DWORD) CDecoderBenchmark::GetDecodeFlags()
+{
+  // every frame is decoded, regardless of the playback state of the filter
+  return static_cast<ILAVVideoCallback *>(m_pLAVVideo)->GetDecodeFlags() & ~(LAV_VIDEO_DEC_FLAGS_DYNAMIC | LAV_VIDEO_DEC_FLAG_KEYFRAMES_ONLY | LAV_VIDEO_DEC_FLAG_NO_LOOP_FILTER);
+}
+
+STDMETHODIMP CDecoderBenchmark::GetLAVPinInfo(LAVPinInfo &info)
+{
+  return static_cast<ILAVVideoCallback *>(m_pLAVVideo)->GetLAVPinInfo(info);
+}
+
+STDMETHODIMP_(CBasePin*) CDecoderBenchmark::GetOutputPin()
+{
+  return static_cast<ILAVVideoCallback *>(m_pLAVVideo)->GetOutputPin();
+}
+
+STDMETHODIMP_(LAVFrame*) CDecoderBenchmark::GetFlushFrame()
+{
+  return static_cast<ILAVVideoCallback *>(m_pLAVVideo)->GetFlushFrame();
+}
+
+STDMETHODIMP_(DWORD) CDecoderBenchmark::GetGPUDeviceIndex()
+{
+  return static_cast<ILAVVideoCallback *>(m_pLAVVideo)->GetGPUDeviceIndex();
+}
+
+STDMETHODIMP_(int) CDecoderBenchmark::GetX264Build()
+{
+  return static_cast<ILAVVideoCallback *>(m_pLAVVideo)->GetX264Build();
+}
+
+STDMETHODIMP_(int) CDecoderBenchmark::GetWorkerThreads()
+{
+  return static_cast<ILAVVideoCallback *>(m_pLAVVideo)->GetWorkerThreads();
+}
+
+STDMETHODIMP_(CMemoryAccount*) CDecoderBenchmark::GetMemoryAccount()
+{
+  return static_cast<ILAVVideoCallback *>(m_pLAVVideo)->GetMemoryAccount();
+}
@@ -0,0 +1,130 @@
+/*
+ *      Copyright (C) 2010-2019 Hendrik Leppkes
+ *      http://www.1f0.de
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program; if not, write to the Free Software Foundation, Inc.,
+ *  51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+
+#pragma once
+
+#include "decoders/ILAVDecoder.h"
+
+#include <string>
+#include <vector>
+
+// Number of samples every backend decodes in a benchmark, starting at a keyframe
+#define LAV_BENCHMARK_SAMPLES     120
+
+// Fewer samples are collected if they exceed this size, but at least this many frames have to be decoded
+#define LAV_BENCHMARK_MAX_BYTES   (64 << 20)
+#define LAV_BENCHMARK_MIN_FRAMES  30
+
+class CLAVVideo;
+
+/* Micro-benchmark of the decoder backends, for the automatic backend selection (see SetHWAccelAutoSelect)
+ * The first samples of a stream are copied, and decoded by every backend in turn on a background thread, with
+ * the frames discarded instead of delivered. The time per frame and the delay until the first frame are stored
+ * in the registry per codec, resolution class and bit depth, so every backend is only measured once per system.
+ * Software decoding is identified with HWAccel_None. */
+class CDecoderBenchmark : public ILAVVideoCallback
+{
+public:
+  CDecoderBenchmark(CLAVVideo *pLAVVideo);
+  ~CDecoderBenchmark();
+
+  // Key of the stored results for a stream
+  static std::wstring GetStreamKey(const CMediaType *pmt, AVCodecID codec, const LAVPinInfo *pPinInfo);
+
+  // Pick the candidate with the lowest time per frame, or with the lowest delay for low-latency streams
+  // Candidates which were not measured yet are returned in pUnmeasured. Returns S_FALSE if no candidate was
+  // measured successfully, *pBackend is not changed then.
+  static HRESULT SelectBackend(const std::wstring &key, const std::vector<LAVHWAccel> &candidates, BOOL bLowLatency, LAVHWAccel *pBackend, std::vector<LAVHWAccel> *pUnmeasured);
+
+  // Start collecting the samples of a new stream, to benchmark the backends once enough are collected
+  // Only one benchmark runs in the process at a time, S_FALSE is returned while another one runs.
+  HRESULT Start(const CMediaType *pmt, AVCodecID codec, const std::wstring &key, const std::vector<LAVHWAccel> &backends);
+
+  // Copy an input sample of the stream, until the benchmark is started
+  void AddSample(IMediaSample *pSample);
+  BOOL IsCollecting() const { return m_bCollecting; }
+
+  // Discard the samples, and wait for a running benchmark to abort
+  void Stop();
+
+  // ILAVVideoCallback
+  STDMETHODIMP AllocateFrame(LAVFrame **ppFrame);
+  STDMETHODIMP ReleaseFrame(LAVFrame **ppFrame);
+  STDMETHODIMP Deliver(LAVFrame *pFrame);
+  STDMETHODIMP_(LPWSTR) GetFileExtension();
+  STDMETHODIMP_(DWORD) GetDecodeFlags();
+  STDMETHODIMP_(CMediaType&) GetInputMediaType() { return m_InputType; }
+  STDMETHODIMP GetLAVPinInfo(LAVPinInfo &info);
+  STDMETHODIMP_(CBasePin*) GetOutputPin();
+  STDMETHODIMP_(CMediaType&) GetOutputMediaType() { return m_OutputType; }
+  STDMETHODIMP DVDStripPacket(BYTE*& p, long& len) { return S_OK; }
+  STDMETHODIMP_(LAVFrame*) GetFlushFrame();
+  STDMETHODIMP ReleaseAllDXVAResources() { return S_OK; }
+  STDMETHODIMP_(DWORD) GetGPUDeviceIndex();
+  STDMETHODIMP_(BOOL) HasDynamicInputAllocator() { return FALSE; }
+  STDMETHODIMP SetX264Build(int nBuild) { return S_OK; }
+  STDMETHODIMP_(int) GetX264Build();
+  STDMETHODIMP AddStageTime(LAVVideoStage stage, REFERENCE_TIME rtTime) { return S_OK; }
+  STDMETHODIMP_(int) GetWorkerThreads();
+  STDMETHODIMP GetDirectRenderingBuffer(LAVPixelFormat format, int width, int height, int codedWidth, int codedHeight, int align, IMediaSample **ppSample, LAVDirectBuffer *pBuffer) { return E_NOTIMPL; }
+  STDMETHODIMP_(CMemoryAccount*) GetMemoryAccount();
+  STDMETHODIMP GetOutputScaling(int width, int height, RECT *prcCrop, int *pWidth, int *pHeight) { return S_FALSE; }
+
+private:
+  struct Packet {
+    std::vector<BYTE> data;
+    REFERENCE_TIME    rtStart;
+    REFERENCE_TIME    rtStop;
+    BOOL              bSyncPoint;
+  };
+
+  struct Result {
+    REFERENCE_TIME rtFrameTime;   ///< Decoding time per frame, 0 if the backend failed
+    REFERENCE_TIME rtLatency;     ///< Time from the first sample until the first frame
+  };
+
+  static unsigned __stdcall BenchmarkThreadProc(void *pParam);
+  void BenchmarkThread();
+  HRESULT RunBackend(LAVHWAccel backend, IMemAllocator *pAllocator, Result *pResult);
+
+  static BOOL LoadResult(const std::wstring &key, LAVHWAccel backend, Result *pResult);
+  static void StoreResult(const std::wstring &key, LAVHWAccel backend, const Result *pResult);
+
+private:
+  CLAVVideo              *m_pLAVVideo = nullptr;
+
+  CMediaType              m_InputType;
+  CMediaType              m_OutputType;
+  AVCodecID               m_Codec = AV_CODEC_ID_NONE;
+  std::wstring            m_Key;
+  std::vector<LAVHWAccel> m_Backends;
+
+  BOOL                    m_bCollecting = FALSE;
+  std::vector<Packet>     m_Packets;
+  size_t                  m_nBytes = 0;
+
+  HANDLE                  m_hThread = nullptr;
+  volatile LONG           m_lAbort = 0;
+
+  // State of the backend being measured, only used on the benchmark thread
+  DWORD                   m_dwFrames = 0;
+  REFERENCE_TIME          m_rtFirstFrame = 0;
+  std::vector<BYTE>       m_CopyBuffer;
+};
@@ -0,0 +1,452 @@
+/*
+ *      Copyright (C) 2010-2019 Hendrik Leppkes
+ *      http://www.1f0.de
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program; if not, write to the Free Software Foundation, Inc.,
+ *  51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+
+#include "stdafx.h"
+#include "FilmGrain.h"
+#include "IMediaSideData.h"
+#include "WorkerPool.h"
+
+#include <emmintrin.h>
+
+#define GAUSSIAN_SEQUENCE_SIZE 2048
+
+// Lines of every stripe, the first lines of a stripe are blended with the grain of the stripe above
+#define STRIPE_HEIGHT 32
+
+// Pseudo-random number generator of the specification (section 7.18.3.2)
+static inline int get_random_number(int bits, unsigned *state)
+{
+  const unsigned r = *state;
+  const unsigned bit = ((r >> 0) ^ (r >> 1) ^ (r >> 3) ^ (r >> 12)) & 1;
+  *state = (r >> 1) | (bit << 15);
+  return (*state >> (16 - bits)) & ((1 << bits) - 1);
+}
+
+static inline int round2(int x, int shift)
+{
+  return (x + ((1 << shift) >> 1)) >> shift;
+}
+
+// Gaussian sequence with a standard deviation of 512, clipped to the 12-bit range of the table of the specification
+// Every value is the scaled sum of 12 uniform random numbers, which is close enough to a normal distribution for grain.
+// The numbers come from a fixed LCG, so the sequence is the same everywhere.
+static const int16_t *gaussian_sequence()
+{
+  static const struct GaussianSequence {
+    int16_t v[GAUSSIAN_SEQUENCE_SIZE];
+    GaussianSequence() {
+      uint32_t state = 0x1f0de;
+      for (int i = 0; i < GAUSSIAN_SEQUENCE_SIZE; i++) {
+        int sum = 0;
+        for (int j = 0; j < 12; j++) {
+          state = state * 1664525u + 1013904223u;
+          sum += state >> 20;
+        }
+        v[i] = (int16_t)av_clip((sum - 24570) >> 3, -2048, 2047);
+      }
+    }
+  } sequence;
+  return sequence.v;
+}
+
+// Piecewise linear scaling function of one plane, for 8-bit values (section 7.18.3.4)
+static void init_scaling_lut(uint8_t lut[256], const unsigned char (*points)[2], int numPoints)
+{
+  if (numPoints == 0) {
+    memset(lut, 0, 256);
+    return;
+  }
+
+  for (int i = 0; i < points[0][0]; i++)
+    lut[i] = points[0][1];
+
+  for (int i = 0; i < numPoints - 1; i++) {
+    const int deltaY = points[i + 1][1] - points[i][1];
+    const int deltaX = points[i + 1][0] - points[i][0];
+    // the values have to be increasing, broken parameters only lose their segment
+    if (deltaX <= 0)
+      continue;
+
+    const int delta = deltaY * ((65536 + (deltaX >> 1)) / deltaX);
+    for (int x = 0; x < deltaX; x++)
+      lut[points[i][0] + x] = (uint8_t)(points[i][1] + ((x * delta + 32768) >> 16));
+  }
+
+  for (int i = points[numPoints - 1][0]; i < 256; i++)
+    lut[i] = points[numPoints - 1][1];
+}
+
+// Random offsets into the grain template for every block of a stripe (section 7.18.3.5)
+static void get_block_offsets(unsigned seed, int stripe, int nBlocks, uint8_t *offsets)
+{
+  unsigned state = seed & 0xFFFF;
+  state ^= ((stripe * 37 + 178) & 255) << 8;
+  state ^= ((stripe * 173 + 105) & 255);
+
+  for (int b = 0; b < nBlocks; b++)
+    offsets[b] = (uint8_t)get_random_number(8, &state);
+}
+
+static inline const int16_t *block_grain(const int16_t (*grain)[AV1_GRAIN_WIDTH], uint8_t offset, int row, int subX, int subY)
+{
+  const int offsetX = offset >> 4, offsetY = offset & 15;
+  const int x = subX ? 6 + offsetX : 9 + offsetX * 2;
+  const int y = subY ? 6 + offsetY : 9 + offsetY * 2;
+  return grain[y + row] + x;
+}
+
+static inline int16_t blend_grain(int a, int b, int wa, int wb, int grainMin, int grainMax)
+{
+  return (int16_t)av_clip(round2(a * wa + b * wb, 5), grainMin, grainMax);
+}
+
+// Grain of one row of a stripe, blending the columns where the blocks overlap
+static void grain_row(const int16_t (*grain)[AV1_GRAIN_WIDTH], const uint8_t *offsets, int row, int subX, int subY, BOOL bOverlap, int width, int grainMin, int grainMax, int16_t *dst)
+{
+  const int blockWidth = 32 >> subX;
+  for (int b = 0, x = 0; x < width; b++, x += blockWidth) {
+    const int16_t *g = block_grain(grain, offsets[b], row, subX, subY);
+    const int n = min(blockWidth, width - x);
+    memcpy(dst + x, g, n * sizeof(int16_t));
+
+    if (bOverlap && b > 0) {
+      const int16_t *old = block_grain(grain, offsets[b - 1], row, subX, subY) + blockWidth;
+      if (subX) {
+        dst[x] = blend_grain(old[0], g[0], 23, 22, grainMin, grainMax);
+      } else {
+        dst[x] = blend_grain(old[0], g[0], 27, 17, grainMin, grainMax);
+        if (n > 1)
+          dst[x + 1] = blend_grain(old[1], g[1], 17, 27, grainMin, grainMax);
+      }
+    }
+  }
+}
+
+// pixels += round2(scale * noise, shift), clipped to [minValue, maxValue]
+static void add_noise(int16_t *pixels, const int16_t *scale, const int16_t *noise, int width, int shift, int minValue, int maxValue)
+{
+  const __m128i round = _mm_set1_epi32((1 << shift) >> 1);
+  const __m128i count = _mm_cvtsi32_si128(shift);
+  const __m128i vmin  = _mm_set1_epi16((short)minValue);
+  const __m128i vmax  = _mm_set1_epi16((short)maxValue);
+
+  int x = 0;
+  for (; x + 8 <= width; x += 8) {
+    const __m128i s  = _mm_loadu_si128((const __m128i *)(scale + x));
+    const __m128i n  = _mm_loadu_si128((const __m128i *)(noise + x));
+    const __m128i lo = _mm_mullo_epi16(s, n);
+    const __m128i hi = _mm_mulhi_epi16(s, n);
+
+    const __m128i p0 = _mm_sra_epi32(_mm_add_epi32(_mm_unpacklo_epi16(lo, hi), round), count);
+    const __m128i p1 = _mm_sra_epi32(_mm_add_epi32(_mm_unpackhi_epi16(lo, hi), round), count);
+
+    __m128i v = _mm_add_epi16(_mm_loadu_si128((const __m128i *)(pixels + x)), _mm_packs_epi32(p0, p1));
+    v = _mm_min_epi16(_mm_max_epi16(v, vmin), vmax);
+    _mm_storeu_si128((__m128i *)(pixels + x), v);
+  }
+
+  for (; x < width; x++)
+    pixels[x] = (int16_t)av_clip(pixels[x] + round2(scale[x] * noise[x], shift), minValue, maxValue);
+}
+
+CAV1FilmGrain::CAV1FilmGrain()
+{
+}
+
+CAV1FilmGrain::~CAV1FilmGrain()
+{
+}
+
+// Grain templates of all planes, filtered with the auto-regressive filter (section 7.18.3.3)
+void CAV1FilmGrain::GenerateGrain(const MediaSideDataAV1FilmGrain *p, int subX, int subY)
+{
+  const int16_t *gaussian = gaussian_sequence();
+  const int shift = 12 - m_BitDepth + p->grain_scale_shift;
+  const int lag = min(p->ar_coeff_lag, 3u);
+
+  unsigned seed = p->grain_seed & 0xFFFF;
+  for (int y = 0; y < AV1_GRAIN_HEIGHT; y++) {
+    for (int x = 0; x < AV1_GRAIN_WIDTH; x++)
+      m_LumaGrain[y][x] = p->num_y_points ? (int16_t)round2(gaussian[get_random_number(11, &seed)], shift) : 0;
+  }
+
+  if (p->num_y_points) {
+    for (int y = 3; y < AV1_GRAIN_HEIGHT; y++) {
+      for (int x = 3; x < AV1_GRAIN_WIDTH - 3; x++) {
+        int sum = 0, pos = 0;
+        for (int dy = -lag; dy <= 0; dy++) {
+          for (int dx = -lag; dx <= lag; dx++) {
+            if (dy == 0 && dx == 0)
+              break;
+            sum += m_LumaGrain[y + dy][x + dx] * p->ar_coeffs_y[pos++];
+          }
+        }
+        m_LumaGrain[y][x] = (int16_t)av_clip(m_LumaGrain[y][x] + round2(sum, p->ar_coeff_shift), m_GrainMin, m_GrainMax);
+      }
+    }
+  }
+
+  const int chromaW = subX ? 44 : AV1_GRAIN_WIDTH;
+  const int chromaH = subY ? 38 : AV1_GRAIN_HEIGHT;
+
+  for (int pl = 0; pl < 2; pl++) {
+    int16_t (*grain)[AV1_GRAIN_WIDTH] = m_ChromaGrain[pl];
+    const signed char *coeffs = pl ? p->ar_coeffs_cr : p->ar_coeffs_cb;
+    const BOOL bActive = (pl ? p->num_cr_points : p->num_cb_points) || p->chroma_scaling_from_luma;
+
+    seed = (p->grain_seed & 0xFFFF) ^ (pl ? 0x49d8 : 0xb524);
+    for (int y = 0; y < chromaH; y++) {
+      for (int x = 0; x < chromaW; x++)
+        grain[y][x] = bActive ? (int16_t)round2(gaussian[get_random_number(11, &seed)], shift) : 0;
+    }
+
+    if (!bActive)
+      continue;
+
+    for (int y = 3; y < chromaH; y++) {
+      for (int x = 3; x < chromaW - 3; x++) {
+        int sum = 0, pos = 0;
+        for (int dy = -lag; dy <= 0; dy++) {
+          for (int dx = -lag; dx <= lag; dx++) {
+            if (dy == 0 && dx == 0) {
+              // the last input of the filter is the luma grain at the same position
+              if (p->num_y_points) {
+                const int lumaX = ((x - 3) << subX) + 3;
+                const int lumaY = ((y - 3) << subY) + 3;
+                int luma = 0;
+                for (int i = 0; i <= subY; i++)
+                  for (int j = 0; j <= subX; j++)
+                    luma += m_LumaGrain[lumaY + i][lumaX + j];
+                sum += round2(luma, subX + subY) * coeffs[pos];
+              }
+              break;
+            }
+            sum += grain[y + dy][x + dx] * coeffs[pos++];
+          }
+        }
+        grain[y][x] = (int16_t)av_clip(grain[y][x] + round2(sum, p->ar_coeff_shift), m_GrainMin, m_GrainMax);
+      }
+    }
+  }
+}
+
+void CAV1FilmGrain::InitScaling(const MediaSideDataAV1FilmGrain *p)
+{
+  uint8_t lut[3][256];
+  init_scaling_lut(lut[0], p->y_points, min(p->num_y_points, 14u));
+  if (p->chroma_scaling_from_luma) {
+    memcpy(lut[1], lut[0], 256);
+    memcpy(lut[2], lut[0], 256);
+  } else {
+    init_scaling_lut(lut[1], p->cb_points, min(p->num_cb_points, 10u));
+    init_scaling_lut(lut[2], p->cr_points, min(p->num_cr_points, 10u));
+  }
+
+  // higher bit depths interpolate between the 8-bit points
+  const int shift = m_BitDepth - 8;
+  for (int plane = 0; plane < 3; plane++) {
+    for (int i = 0; i < (256 << shift); i++) {
+      const int x = i >> shift;
+      const int rem = i - (x << shift);
+      if (shift == 0 || x == 255)
+        m_Scaling[plane][i] = lut[plane][x];
+      else
+        m_Scaling[plane][i] = (uint8_t)(lut[plane][x] + round2((lut[plane][x + 1] - lut[plane][x]) * rem, shift));
+    }
+  }
+}
+
+// Add the grain to one stripe of all planes (section 7.18.3.5)
+// The chroma is processed first, its scaling uses the luma of the same lines without grain.
+template <typename pixel>
+void CAV1FilmGrain::ApplyStripe(const MediaSideDataAV1FilmGrain *p, const LAVFrame *pSrc, LAVFrame *pDst, int subX, int subY, int stripe, int16_t *scratch)
+{
+  const int width = pDst->width;
+  const int height = pDst->height;
+  const ptrdiff_t rowSize = FFALIGN(width, 16);
+  const BOOL bInPlace = (pSrc->data[0] == pDst->data[0]);
+  const BOOL bOverlap = !!p->overlap_flag;
+
+  int16_t *noise   = scratch;
+  int16_t *overlap = scratch + rowSize;
+  int16_t *values  = scratch + 2 * rowSize;
+  int16_t *scale   = scratch + 3 * rowSize;
+  uint8_t *offsets = (uint8_t *)(scratch + 4 * rowSize);
+  uint8_t *offsetsAbove = offsets + rowSize;
+
+  const int nBlocks = ((width + 1) / 2 + 15) / 16;
+  get_block_offsets(p->grain_seed, stripe, nBlocks, offsets);
+  if (bOverlap && stripe > 0)
+    get_block_offsets(p->grain_seed, stripe - 1, nBlocks, offsetsAbove);
+
+  const int depthShift = m_BitDepth - 8;
+  const int maxValue   = (256 << depthShift) - 1;
+  const int minValue   = p->clip_to_restricted_range ? 16 << depthShift : 0;
+  const int maxLuma    = p->clip_to_restricted_range ? 235 << depthShift : maxValue;
+  const int maxChroma  = (p->clip_to_restricted_range && p->matrix_coefficients != 0) ? 240 << depthShift : maxLuma;
+
+  const int lumaStart = stripe * STRIPE_HEIGHT;
+  const int lumaEnd = min(lumaStart + STRIPE_HEIGHT, height);
+
+  // grain of one line of the stripe, blended with the last lines of the stripe above
+  auto noise_row = [&](const int16_t (*grain)[AV1_GRAIN_WIDTH], int row, int planeSubX, int planeSubY, int planeWidth) {
+    grain_row(grain, offsets, row, planeSubX, planeSubY, bOverlap, planeWidth, m_GrainMin, m_GrainMax, noise);
+    if (bOverlap && stripe > 0 && row < (planeSubY ? 1 : 2)) {
+      grain_row(grain, offsetsAbove, row + (STRIPE_HEIGHT >> planeSubY), planeSubX, planeSubY, bOverlap, planeWidth, m_GrainMin, m_GrainMax, overlap);
+      const int wa = planeSubY ? 23 : (row == 0 ? 27 : 17);
+      const int wb = planeSubY ? 22 : (row == 0 ? 17 : 27);
+      for (int x = 0; x < planeWidth; x++)
+        noise[x] = blend_grain(overlap[x], noise[x], wa, wb, m_GrainMin, m_GrainMax);
+    }
+  };
+
+  const int chromaWidth = (width + subX) >> subX;
+  const int chromaStart = lumaStart >> subY;
+  const int chromaEnd = (lumaEnd + subY) >> subY;
+
+  for (int pl = 0; pl < 2; pl++) {
+    const int plane = pl + 1;
+    const BOOL bActive = (pl ? p->num_cr_points : p->num_cb_points) || p->chroma_scaling_from_luma;
+    const int mult = pl ? p->cr_mult : p->cb_mult;
+    const int lumaMult = pl ? p->cr_luma_mult : p->cb_luma_mult;
+    const int offset = (pl ? p->cr_offset : p->cb_offset) * (1 << depthShift);
+
+    for (int y = chromaStart; y < chromaEnd; y++) {
+      const pixel *src = (const pixel *)(pSrc->data[plane] + y * pSrc->stride[plane]);
+      pixel *dst = (pixel *)(pDst->data[plane] + y * pDst->stride[plane]);
+
+      if (!bActive) {
+        if (!bInPlace)
+          memcpy(dst, src, chromaWidth * sizeof(pixel));
+        continue;
+      }
+
+      noise_row(m_ChromaGrain[pl], y - chromaStart, subX, subY, chromaWidth);
+
+      const pixel *luma = (const pixel *)(pSrc->data[0] + (y << subY) * pSrc->stride[0]);
+      for (int x = 0; x < chromaWidth; x++) {
+        const int lumaX = x << subX;
+        const int average = subX ? (luma[lumaX] + luma[min(lumaX + 1, width - 1)] + 1) >> 1 : luma[lumaX];
+        int merged = min(average, maxValue);
+        if (!p->chroma_scaling_from_luma)
+          merged = av_clip(((average * lumaMult + src[x] * mult) >> 6) + offset, 0, maxValue);
+
+        values[x] = (int16_t)min((int)src[x], maxValue);
+        scale[x] = m_Scaling[plane][merged];
+      }
+
+      add_noise(values, scale, noise, chromaWidth, p->grain_scaling, minValue, maxChroma);
+      for (int x = 0; x < chromaWidth; x++)
+        dst[x] = (pixel)values[x];
+    }
+  }
+
+  for (int y = lumaStart; y < lumaEnd; y++) {
+    const pixel *src = (const pixel *)(pSrc->data[0] + y * pSrc->stride[0]);
+    pixel *dst = (pixel *)(pDst->data[0] + y * pDst->stride[0]);
+
+    if (!p->num_y_points) {
+      if (!bInPlace)
+        memcpy(dst, src, width * sizeof(pixel));
+      continue;
+    }
+
+    noise_row(m_LumaGrain, y - lumaStart, 0, 0, width);
+
+    for (int x = 0; x < width; x++) {
+      values[x] = (int16_t)min((int)src[x], maxValue);
+      scale[x] = m_Scaling[0][values[x]];
+    }
+
+    add_noise(values, scale, noise, width, p->grain_scaling, minValue, maxLuma);
+    for (int x = 0; x < width; x++)
+      dst[x] = (pixel)values[x];
+  }
+}
+
+HRESULT CAV1FilmGrain::Apply(LAVFrame *pFrame, const MediaSideDataAV1FilmGrain *p, int nThreads)
+{
+  int bitDepth = 8, subX = 0, subY = 0;
+  switch (pFrame->format) {
+  case LAVPixFmt_YUV420:   subX = 1; subY = 1; break;
+  case LAVPixFmt_YUV422:   subX = 1; break;
+  case LAVPixFmt_YUV444:   break;
+  case LAVPixFmt_YUV420bX: bitDepth = pFrame->bpp; subX = 1; subY = 1; break;
+  case LAVPixFmt_YUV422bX: bitDepth = pFrame->bpp; subX = 1; break;
+  case LAVPixFmt_YUV444bX: bitDepth = pFrame->bpp; break;
+  default:
+    return S_FALSE;
+  }
+
+  if (pFrame->direct || (unsigned)bitDepth != p->bit_depth || bitDepth > 12 || p->grain_scaling < 8 || p->grain_scaling > 11)
+    return S_FALSE;
+
+  if (!p->num_y_points && !p->num_cb_points && !p->num_cr_points && !p->chroma_scaling_from_luma)
+    return S_FALSE;
+
+  m_BitDepth = bitDepth;
+  m_GrainMin = -(128 << (bitDepth - 8));
+  m_GrainMax = (128 << (bitDepth - 8)) - 1;
+
+  GenerateGrain(p, subX, subY);
+  InitScaling(p);
+
+  // frames which can't be modified get new buffers, the grain is added while copying them
+  LAVFrame srcFrame = *pFrame;
+  srcFrame.side_data = nullptr;
+  srcFrame.side_data_count = 0;
+
+  const BOOL bInPlace = !!(pFrame->flags & LAV_FRAME_FLAG_BUFFER_MODIFY);
+  if (!bInPlace) {
+    pFrame->destruct  = nullptr;
+    pFrame->priv_data = nullptr;
+    pFrame->dr_sample = nullptr;
+    memset(pFrame->data, 0, sizeof(pFrame->data));
+    memset(pFrame->stereo, 0, sizeof(pFrame->stereo));
+    pFrame->flags &= ~LAV_FRAME_FLAG_MVC;
+
+    HRESULT hr = AllocLAVFrameBuffers(pFrame);
+    if (FAILED(hr)) {
+      FreeLAVFrameBuffers(&srcFrame);
+      return hr;
+    }
+  }
+
+  const int nStripes = (pFrame->height + STRIPE_HEIGHT - 1) / STRIPE_HEIGHT;
+  nThreads = av_clip(nThreads, 1, max(nStripes, 1));
+
+  // every thread has its own rows of noise, pixels and scaling, and the block offsets
+  const ptrdiff_t scratchSize = FFALIGN(pFrame->width, 16) * 5;
+  if (m_Scratch.size() < (size_t)(scratchSize * nThreads))
+    m_Scratch.resize(scratchSize * nThreads);
+
+  worker_pool_run(nStripes, nThreads, [&](int stripe, int thread) {
+    int16_t *scratch = m_Scratch.data() + thread * scratchSize;
+    if (bitDepth > 8)
+      ApplyStripe<uint16_t>(p, &srcFrame, pFrame, subX, subY, stripe, scratch);
+    else
+      ApplyStripe<uint8_t>(p, &srcFrame, pFrame, subX, subY, stripe, scratch);
+  });
+
+  if (!bInPlace)
+    FreeLAVFrameBuffers(&srcFrame);
+
+  return S_OK;
+}
@@ -0,0 +1,65 @@
+/*
+ *      Copyright (C) 2010-2019 Hendrik Leppkes
+ *      http://www.1f0.de
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program; if not, write to the Free Software Foundation, Inc.,
+ *  51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+
+#pragma once
+
+#include "decoders/ILAVDecoder.h"
+
+#include <vector>
+
+struct MediaSideDataAV1FilmGrain;
+
+#define AV1_GRAIN_WIDTH  82
+#define AV1_GRAIN_HEIGHT 73
+
+// Synthesizes the film grain of AV1 video, for frames the decoder left the grain to the output stage
+// The synthesis follows section 7.18.3 of the AV1 specification, except for the gaussian sequence, which is generated
+// with the same distribution instead of using the table of the specification, so the grain is not bit-exact with the
+// grain of the decoder. Stripes of 32 lines are processed in parallel on the shared worker pool.
+class CAV1FilmGrain
+{
+public:
+  CAV1FilmGrain();
+  ~CAV1FilmGrain();
+
+  // Apply the grain to the frame, in-place for frames which can be modified, otherwise into new buffers
+  // Returns S_FALSE if the format of the frame is not supported, or does not match the parameters
+  HRESULT Apply(LAVFrame *pFrame, const MediaSideDataAV1FilmGrain *pParams, int nThreads);
+
+private:
+  void GenerateGrain(const MediaSideDataAV1FilmGrain *p, int subX, int subY);
+  void InitScaling(const MediaSideDataAV1FilmGrain *p);
+
+  template <typename pixel>
+  void ApplyStripe(const MediaSideDataAV1FilmGrain *p, const LAVFrame *pSrc, LAVFrame *pDst, int subX, int subY, int stripe, int16_t *scratch);
+
+private:
+  int m_BitDepth  = 8;
+  int m_GrainMin  = 0;
+  int m_GrainMax  = 0;
+
+  int16_t m_LumaGrain[AV1_GRAIN_HEIGHT][AV1_GRAIN_WIDTH];
+  int16_t m_ChromaGrain[2][AV1_GRAIN_HEIGHT][AV1_GRAIN_WIDTH];
+
+  // scaling function of every plane, indexed by the full-depth pixel value
+  uint8_t m_Scaling[3][4096];
+
+  std::vector<int16_t> m_Scratch;
+};
@@ -33,22 +33,75 @@ static void lav_unref_frame(void *opaque, uint8_t *data)
   av_buffer_unref(&buf);
 }
 
+// Slice jobs of the filters run on the shared worker pool
+static int lav_avfilter_execute(AVFilterContext *ctx, avfilter_action_func *func, void *arg, int *ret, int nb_jobs)
+{
+  worker_pool_run(nb_jobs, ctx->graph->nb_threads, [&](int job, int thread) {
+    int r = func(ctx, arg, job, nb_jobs);
+    if (ret)
+      ret[job] = r;
+  });
+  return 0;
+}
+
 static void avfilter_free_lav_buffer(LAVFrame *pFrame)
 {
   av_frame_free((AVFrame **)&pFrame->priv_data);
 }
 
+BOOL CLAVVideo::IsSWDeintFramePerField()
+{
+  // W3FDIF always outputs one frame per field, the other filters follow the output setting
+  return ((m_settings.SWDeintMode == SWDeintMode_YADIF || m_settings.SWDeintMode == SWDeintMode_BWDIF || m_settings.SWDeintMode == SWDeintMode_Auto) && m_settings.SWDeintOutput == DeintOutput_FramePerField)
+       || m_settings.SWDeintMode == SWDeintMode_W3FDIF_Simple || m_settings.SWDeintMode == SWDeintMode_W3FDIF_Complex;
+}
+
+void CLAVVideo::UpdateSWDeintAutoLevel(REFERENCE_TIME rtCost, REFERENCE_TIME rtBudget)
+{
+  if (rtBudget <= 0)
+    return;
+
+  m_rtFilterCost   += rtCost;
+  m_rtFilterBudget += rtBudget;
+  if (++m_nFilterCostFrames < LAV_SWDEINT_AUTO_WINDOW)
+    return;
+
+  int nLoad = (int)(m_rtFilterCost * 100 / m_rtFilterBudget);
+  m_rtFilterCost = m_rtFilterBudget = 0;
+  m_nFilterCostFrames = 0;
+
+  if (m_nFilterHoldWindows > 0)
+    m_nFilterHoldWindows--;
+
+  if (nLoad > LAV_SWDEINT_AUTO_STEP_DOWN && m_SWDeintAutoLevel < SWDeintAuto_NB - 1) {
+    m_SWDeintAutoLevel++;
+    m_nFilterHoldWindows = m_nFilterHoldPeriod;
+    // Wait longer each time we have to step down again, so a filter which barely fits does not keep toggling
+    m_nFilterHoldPeriod = min(m_nFilterHoldPeriod * 2, LAV_SWDEINT_AUTO_HOLD_MAX);
+    DbgLog((LOG_TRACE, 10, L"::UpdateSWDeintAutoLevel(): Filter load at %d%%, stepping down to level %d", nLoad, m_SWDeintAutoLevel));
+  } else if (nLoad < LAV_SWDEINT_AUTO_STEP_UP && m_SWDeintAutoLevel > SWDeintAuto_BWDIF && m_nFilterHoldWindows == 0) {
+    m_SWDeintAutoLevel--;
+    DbgLog((LOG_TRACE, 10, L"::UpdateSWDeintAutoLevel(): Filter load at %d%%, stepping up to level %d", nLoad, m_SWDeintAutoLevel));
+  }
+}
+
 HRESULT CLAVVideo::Filter(LAVFrame *pFrame)
 {
   int ret = 0;
   BOOL bFlush = pFrame->flags & LAV_FRAME_FLAG_FLUSH;
   if (m_Decoder.IsInterlaced(FALSE) && m_settings.DeintMode != DeintMode_Disable
-    && (m_settings.SWDeintMode == SWDeintMode_YADIF || m_settings.SWDeintMode == SWDeintMode_W3FDIF_Simple || m_settings.SWDeintMode == SWDeintMode_W3FDIF_Complex)
+    && (m_settings.SWDeintMode == SWDeintMode_YADIF || m_settings.SWDeintMode == SWDeintMode_W3FDIF_Simple || m_settings.SWDeintMode == SWDeintMode_W3FDIF_Complex
+     || m_settings.SWDeintMode == SWDeintMode_BWDIF || m_settings.SWDeintMode == SWDeintMode_Auto)
     && ((bFlush && m_pFilterGraph) || pFrame->format == LAVPixFmt_YUV420 || pFrame->format == LAVPixFmt_YUV422 || pFrame->format == LAVPixFmt_NV12)) {
     AVPixelFormat ff_pixfmt = (pFrame->format == LAVPixFmt_YUV420) ? AV_PIX_FMT_YUV420P : (pFrame->format == LAVPixFmt_YUV422) ? AV_PIX_FMT_YUV422P : AV_PIX_FMT_NV12;
 
-    if (!bFlush && (!m_pFilterGraph || pFrame->format != m_filterPixFmt || pFrame->width != m_filterWidth || pFrame->height != m_filterHeight)) {
+    BOOL bAutoLevelChanged = (m_settings.SWDeintMode == SWDeintMode_Auto && m_SWDeintAutoLevel != m_filterAutoLevel);
+    if (!bFlush && (!m_pFilterGraph || pFrame->format != m_filterPixFmt || pFrame->width != m_filterWidth || pFrame->height != m_filterHeight || bAutoLevelChanged)) {
       DbgLog((LOG_TRACE, 10, L":Filter()(init) Initializing YADIF deinterlacing filter..."));
+      // Deliver the frames still buffered in the old filter when only switching the automatic filter
+      if (m_pFilterGraph && bAutoLevelChanged && pFrame->format == m_filterPixFmt && pFrame->width == m_filterWidth && pFrame->height == m_filterHeight)
+        Filter(GetFlushFrame());
+
       if (m_pFilterGraph) {
         avfilter_graph_free(&m_pFilterGraph);
         m_pFilterBufferSrc = nullptr;
@@ -78,8 +131,21 @@ HRESULT CLAVVideo::Filter(LAVFrame *pFrame)
 
       m_pFilterGraph = avfilter_graph_alloc();
 
+      // has to be set before any filter is added to the graph
+      m_pFilterGraph->execute = lav_avfilter_execute;
+
+      // Slice threading splits each field into bands of lines, more than 8 threads
+      // yields little benefit, and very small pictures are not worth splitting at all
+      int nThreads = m_settings.SWDeintThreads;
+      if (nThreads == 0) {
+        nThreads = m_settings.NumThreads ? m_settings.NumThreads : GetWorkerThreads();
+        nThreads = FFMIN(nThreads, 8);
+      }
+      nThreads = av_clip(nThreads, 1, FFMAX(1, pFrame->height / 64));
+
       av_opt_set(m_pFilterGraph, "thread_type", "slice", AV_OPT_SEARCH_CHILDREN);
-      av_opt_set_int(m_pFilterGraph, "threads", FFMAX(1, av_cpu_count() / 2), AV_OPT_SEARCH_CHILDREN);
+      av_opt_set_int(m_pFilterGraph, "threads", nThreads, AV_OPT_SEARCH_CHILDREN);
+      DbgLog((LOG_TRACE, 10, L"::Filter()(init) Using %d threads for the filter graph", nThreads));
 
       // 0/0 is not a valid value for avfilter, make sure it doesn't happen
       AVRational aspect_ratio = pFrame->aspect_ratio;
@@ -117,11 +183,32 @@ HRESULT CLAVVideo::Filter(LAVFrame *pFrame)
       inputs->pad_idx    = 0;
       inputs->next       = nullptr;
 
-      if (m_settings.SWDeintMode == SWDeintMode_YADIF)
-        _snprintf_s(args, sizeof(args), "yadif=mode=%s:parity=auto:deint=interlaced", (m_settings.SWDeintOutput == DeintOutput_FramePerField) ? "send_field" : "send_frame");
-      else if (m_settings.SWDeintMode == SWDeintMode_W3FDIF_Simple)
+      DWORD dwDeintMode = m_settings.SWDeintMode;
+      BOOL bLineDouble = FALSE;
+      if (dwDeintMode == SWDeintMode_Auto) {
+        m_filterAutoLevel = m_SWDeintAutoLevel;
+        if (m_filterAutoLevel == SWDeintAuto_BWDIF)
+          dwDeintMode = SWDeintMode_BWDIF;
+        else if (m_filterAutoLevel == SWDeintAuto_YADIF)
+          dwDeintMode = SWDeintMode_YADIF;
+        else
+          bLineDouble = TRUE;
+      }
+
+      const char *strFieldMode = (m_settings.SWDeintOutput == DeintOutput_FramePerField) ? "send_field" : "send_frame";
+      if (bLineDouble) {
+        // Scale up the individual fields, the aspect ratio needs to be restored after scaling the half-height fields
+        if (m_settings.SWDeintOutput == DeintOutput_FramePerField)
+          _snprintf_s(args, sizeof(args), "separatefields,scale=w=iw:h=ih*2:flags=fast_bilinear,setsar=%d/%d", aspect_ratio.num, aspect_ratio.den);
+        else
+          _snprintf_s(args, sizeof(args), "field=type=top,scale=w=iw:h=ih*2:flags=fast_bilinear,setsar=%d/%d", aspect_ratio.num, aspect_ratio.den);
+      } else if (dwDeintMode == SWDeintMode_BWDIF)
+        _snprintf_s(args, sizeof(args), "bwdif=mode=%s:parity=auto:deint=interlaced", strFieldMode);
+      else if (dwDeintMode == SWDeintMode_YADIF)
+        _snprintf_s(args, sizeof(args), "yadif=mode=%s:parity=auto:deint=interlaced", strFieldMode);
+      else if (dwDeintMode == SWDeintMode_W3FDIF_Simple)
         _snprintf_s(args, sizeof(args), "w3fdif=filter=simple:deint=interlaced");
-      else if (m_settings.SWDeintMode == SWDeintMode_W3FDIF_Complex)
+      else if (dwDeintMode == SWDeintMode_W3FDIF_Complex)
         _snprintf_s(args, sizeof(args), "w3fdif=filter=complex:deint=interlaced");
       else
         ASSERT(0);
@@ -189,23 +276,33 @@ HRESULT CLAVVideo::Filter(LAVFrame *pFrame)
       m_FilterPrevFrame = *pFrame;
       memset(m_FilterPrevFrame.data, 0, sizeof(m_FilterPrevFrame.data));
       m_FilterPrevFrame.destruct = nullptr;
+      m_FilterPrevFrame.dr_sample = nullptr;
     } else {
       if (!m_FilterPrevFrame.height) // if height is not set, the frame is most likely not valid
         return S_OK;
       *pFrame = m_FilterPrevFrame;
     }
 
+    // Time spent in the filter, excluding delivery, for the automatic mode and the telemetry
+    REFERENCE_TIME rtBudget = pFrame->rtStop - pFrame->rtStart;
+    REFERENCE_TIME rtFilterStart = timer_get_ref_time();
     if ((ret = av_buffersrc_write_frame(m_pFilterBufferSrc, in_frame)) < 0) {
       av_frame_free(&in_frame);
       goto deliver;
     }
+    REFERENCE_TIME rtFilterCost = timer_get_ref_time() - rtFilterStart;
 
-    BOOL bFramePerField = (m_settings.SWDeintMode == SWDeintMode_YADIF && m_settings.SWDeintOutput == DeintOutput_FramePerField)
-                        || m_settings.SWDeintMode == SWDeintMode_W3FDIF_Simple || m_settings.SWDeintMode == SWDeintMode_W3FDIF_Complex;
+    BOOL bFramePerField = IsSWDeintFramePerField();
 
     AVFrame *out_frame = av_frame_alloc();
     HRESULT hrDeliver = S_OK;
-    while (SUCCEEDED(hrDeliver) && (av_buffersink_get_frame(m_pFilterBufferSink, out_frame) >= 0)) {
+    while (SUCCEEDED(hrDeliver)) {
+      rtFilterStart = timer_get_ref_time();
+      ret = av_buffersink_get_frame(m_pFilterBufferSink, out_frame);
+      rtFilterCost += timer_get_ref_time() - rtFilterStart;
+      if (ret < 0)
+        break;
+
       LAVFrame *outFrame = nullptr;
       AllocateFrame(&outFrame);
 
@@ -250,6 +347,12 @@ HRESULT CLAVVideo::Filter(LAVFrame *pFrame)
     av_frame_free(&in_frame);
     av_frame_free(&out_frame);
 
+    if (!bFlush) {
+      m_Telemetry.AddSample(VideoStage_Filter, rtFilterCost);
+      if (m_settings.SWDeintMode == SWDeintMode_Auto)
+        UpdateSWDeintAutoLevel(rtFilterCost, rtBudget);
+    }
+
     // We EOF'ed the graph, need to close it
     if (bFlush) {
       if (m_pFilterGraph) {
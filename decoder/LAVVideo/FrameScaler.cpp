@@ -0,0 +1,243 @@
+/*
+ *      Copyright (C) 2010-2019 Hendrik Leppkes
+ *      http://www.1f0.de
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program; if not, write to the Free Software Foundation, Inc.,
+ *  51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+
+#include "stdafx.h"
+#include "FrameScaler.h"
+
+#include <emmintrin.h>
+
+// Average 2x2 blocks of an 8-bit plane
+static void box_downscale_2x(const uint8_t *src, ptrdiff_t srcStride, uint8_t *dst, ptrdiff_t dstStride, int width, int height)
+{
+  const __m128i mask = _mm_set1_epi16(0x00FF);
+  for (int y = 0; y < height; y++) {
+    const uint8_t *s0 = src + 2 * y * srcStride;
+    const uint8_t *s1 = s0 + srcStride;
+    uint8_t *d = dst + y * dstStride;
+
+    int x = 0;
+    for (; x + 16 <= width; x += 16) {
+      __m128i a = _mm_avg_epu8(_mm_loadu_si128((const __m128i *)(s0 + 2 * x)), _mm_loadu_si128((const __m128i *)(s1 + 2 * x)));
+      __m128i b = _mm_avg_epu8(_mm_loadu_si128((const __m128i *)(s0 + 2 * x + 16)), _mm_loadu_si128((const __m128i *)(s1 + 2 * x + 16)));
+      a = _mm_avg_epu16(_mm_and_si128(a, mask), _mm_srli_epi16(a, 8));
+      b = _mm_avg_epu16(_mm_and_si128(b, mask), _mm_srli_epi16(b, 8));
+      _mm_storeu_si128((__m128i *)(d + x), _mm_packus_epi16(a, b));
+    }
+    for (; x < width; x++)
+      d[x] = (s0[2 * x] + s0[2 * x + 1] + s1[2 * x] + s1[2 * x + 1] + 2) >> 2;
+  }
+}
+
+// Average 4x4 blocks of an 8-bit plane
+static void box_downscale_4x(const uint8_t *src, ptrdiff_t srcStride, uint8_t *dst, ptrdiff_t dstStride, int width, int height)
+{
+  const __m128i mask = _mm_set1_epi16(0x00FF);
+#define HALVE(v) _mm_avg_epu16(_mm_and_si128(v, mask), _mm_srli_epi16(v, 8))
+  for (int y = 0; y < height; y++) {
+    const uint8_t *s = src + 4 * y * srcStride;
+    uint8_t *d = dst + y * dstStride;
+
+    int x = 0;
+    for (; x + 16 <= width; x += 16) {
+      __m128i v[4];
+      for (int i = 0; i < 4; i++) {
+        const uint8_t *p = s + 4 * x + 16 * i;
+        __m128i r01 = _mm_avg_epu8(_mm_loadu_si128((const __m128i *)p), _mm_loadu_si128((const __m128i *)(p + srcStride)));
+        __m128i r23 = _mm_avg_epu8(_mm_loadu_si128((const __m128i *)(p + 2 * srcStride)), _mm_loadu_si128((const __m128i *)(p + 3 * srcStride)));
+        v[i] = _mm_avg_epu8(r01, r23);
+      }
+      __m128i h0 = _mm_packus_epi16(HALVE(v[0]), HALVE(v[1]));
+      __m128i h1 = _mm_packus_epi16(HALVE(v[2]), HALVE(v[3]));
+      _mm_storeu_si128((__m128i *)(d + x), _mm_packus_epi16(HALVE(h0), HALVE(h1)));
+    }
+    for (; x < width; x++) {
+      int sum = 8;
+      for (int j = 0; j < 4; j++)
+        for (int i = 0; i < 4; i++)
+          sum += s[j * srcStride + 4 * x + i];
+      d[x] = sum >> 4;
+    }
+  }
+#undef HALVE
+}
+
+CFrameScaler::CFrameScaler()
+{
+}
+
+CFrameScaler::~CFrameScaler()
+{
+  if (m_pSwsContext)
+    sws_freeContext(m_pSwsContext);
+}
+
+void CFrameScaler::SetScaling(const RECT *prcCrop, int width, int height)
+{
+  CAutoLock lock(&m_csSettings);
+  m_bCrop = (prcCrop != nullptr);
+  if (prcCrop)
+    m_Crop = *prcCrop;
+  m_Width = max(width, 0);
+  m_Height = max(height, 0);
+}
+
+BOOL CFrameScaler::GetScaling(int frameWidth, int frameHeight, RECT *prcCrop, int *pWidth, int *pHeight) const
+{
+  CAutoLock lock(&m_csSettings);
+  if (!IsActive() || frameWidth < 2 || frameHeight < 2)
+    return FALSE;
+
+  GetOutputRect(frameWidth, frameHeight, prcCrop, pWidth, pHeight);
+  return prcCrop->left != 0 || prcCrop->top != 0 || prcCrop->right != frameWidth || prcCrop->bottom != frameHeight
+      || *pWidth != frameWidth || *pHeight != frameHeight;
+}
+
+void CFrameScaler::GetOutputRect(int frameWidth, int frameHeight, RECT *prcCrop, int *pWidth, int *pHeight) const
+{
+  RECT crop = { 0, 0, frameWidth, frameHeight };
+  if (m_bCrop) {
+    RECT frame = crop;
+    if (!IntersectRect(&crop, &frame, &m_Crop))
+      crop = frame;
+  }
+
+  // subsampled chroma, interleaved chroma and packed pixels all need an even position
+  crop.left &= ~1;
+  crop.top &= ~1;
+  crop.right = crop.left + max((crop.right - crop.left) & ~1, 2);
+  crop.bottom = crop.top + max((crop.bottom - crop.top) & ~1, 2);
+  crop.right = min(crop.right, (LONG)frameWidth);
+  crop.bottom = min(crop.bottom, (LONG)frameHeight);
+
+  const int cropWidth = crop.right - crop.left;
+  const int cropHeight = crop.bottom - crop.top;
+
+  int width = m_Width, height = m_Height;
+  if (!width && !height) {
+    width = cropWidth;
+    height = cropHeight;
+  } else if (!width) {
+    width = (int)((int64_t)height * cropWidth / cropHeight);
+  } else if (!height) {
+    height = (int)((int64_t)width * cropHeight / cropWidth);
+  }
+
+  // only ever downscale
+  *pWidth = max(min(width, cropWidth) & ~1, 2);
+  *pHeight = max(min(height, cropHeight) & ~1, 2);
+  *prcCrop = crop;
+}
+
+HRESULT CFrameScaler::Scale(LAVFrame *pFrame)
+{
+  if (!IsActive() || pFrame->format == LAVPixFmt_DXVA2 || pFrame->format == LAVPixFmt_D3D11 || pFrame->direct || (pFrame->flags & LAV_FRAME_FLAG_SCALED))
+    return S_FALSE;
+
+  RECT crop;
+  int width, height;
+  GetOutputRect(pFrame->width, pFrame->height, &crop, &width, &height);
+
+  const int cropWidth = crop.right - crop.left;
+  const int cropHeight = crop.bottom - crop.top;
+  if (cropWidth == pFrame->width && cropHeight == pFrame->height && width == cropWidth && height == cropHeight)
+    return S_FALSE;
+
+  LAVPixFmtDesc desc = getPixelFormatDesc(pFrame->format);
+
+  // the source buffers are released after scaling, sidedata remains on the main frame
+  LAVFrame tmpFrame = *pFrame;
+  tmpFrame.side_data = nullptr;
+  tmpFrame.side_data_count = 0;
+
+  pFrame->destruct  = nullptr;
+  pFrame->priv_data = nullptr;
+  pFrame->dr_sample = nullptr;
+  memset(pFrame->data, 0, sizeof(pFrame->data));
+  memset(pFrame->stereo, 0, sizeof(pFrame->stereo));
+
+  // only the base view is scaled
+  pFrame->flags &= ~LAV_FRAME_FLAG_MVC;
+  pFrame->width = width;
+  pFrame->height = height;
+
+  HRESULT hr = AllocLAVFrameBuffers(pFrame);
+  if (FAILED(hr)) {
+    FreeLAVFrameBuffers(&tmpFrame);
+    return hr;
+  }
+
+  const BOOL bPlanar8 = (pFrame->format == LAVPixFmt_YUV420 || pFrame->format == LAVPixFmt_YUV422 || pFrame->format == LAVPixFmt_YUV444);
+  const int factor = cropWidth / width;
+  if ((factor == 1 || (bPlanar8 && (factor == 2 || factor == 4))) && cropWidth == width * factor && cropHeight == height * factor) {
+    for (int plane = 0; plane < desc.planes; plane++) {
+      const uint8_t *src = tmpFrame.data[plane] + (crop.top / desc.planeHeight[plane]) * tmpFrame.stride[plane] + (crop.left * desc.codedbytes) / desc.planeWidth[plane];
+      const int planeWidth = (width * desc.codedbytes) / desc.planeWidth[plane];
+      const int planeHeight = height / desc.planeHeight[plane];
+
+      if (factor == 2) {
+        box_downscale_2x(src, tmpFrame.stride[plane], pFrame->data[plane], pFrame->stride[plane], planeWidth, planeHeight);
+      } else if (factor == 4) {
+        box_downscale_4x(src, tmpFrame.stride[plane], pFrame->data[plane], pFrame->stride[plane], planeWidth, planeHeight);
+      } else {
+        for (int y = 0; y < planeHeight; y++)
+          memcpy(pFrame->data[plane] + y * pFrame->stride[plane], src + y * tmpFrame.stride[plane], planeWidth);
+      }
+    }
+  } else {
+    hr = ScaleSWS(&tmpFrame, crop, pFrame);
+  }
+
+  // the display aspect ratio follows the cropped area
+  if (SUCCEEDED(hr) && pFrame->aspect_ratio.num > 0 && pFrame->aspect_ratio.den > 0 && (cropWidth != tmpFrame.width || cropHeight != tmpFrame.height)) {
+    av_reduce(&pFrame->aspect_ratio.num, &pFrame->aspect_ratio.den,
+              (int64_t)pFrame->aspect_ratio.num * cropWidth * tmpFrame.height,
+              (int64_t)pFrame->aspect_ratio.den * cropHeight * tmpFrame.width, INT_MAX);
+  }
+
+  FreeLAVFrameBuffers(&tmpFrame);
+  return hr;
+}
+
+HRESULT CFrameScaler::ScaleSWS(const LAVFrame *pSrc, const RECT &crop, LAVFrame *pDst)
+{
+  AVPixelFormat format = getFFPixelFormatFromLAV(pSrc->format, pSrc->bpp);
+  if (format == AV_PIX_FMT_NONE)
+    return E_FAIL;
+
+  const int cropWidth = crop.right - crop.left;
+  const int cropHeight = crop.bottom - crop.top;
+
+  m_pSwsContext = sws_getCachedContext(m_pSwsContext, cropWidth, cropHeight, format, pDst->width, pDst->height, format, SWS_BILINEAR, nullptr, nullptr, nullptr);
+  if (!m_pSwsContext)
+    return E_FAIL;
+
+  LAVPixFmtDesc desc = getPixelFormatDesc(pSrc->format);
+
+  const uint8_t *src[4] = { 0 };
+  int srcStride[4] = { 0 }, dstStride[4] = { 0 };
+  for (int plane = 0; plane < desc.planes; plane++) {
+    src[plane] = pSrc->data[plane] + (crop.top / desc.planeHeight[plane]) * pSrc->stride[plane] + (crop.left * desc.codedbytes) / desc.planeWidth[plane];
+    srcStride[plane] = (int)pSrc->stride[plane];
+    dstStride[plane] = (int)pDst->stride[plane];
+  }
+
+  sws_scale(m_pSwsContext, src, srcStride, 0, cropHeight, pDst->data, dstStride);
+  return S_OK;
+}
@@ -0,0 +1,61 @@
+/*
+ *      Copyright (C) 2010-2019 Hendrik Leppkes
+ *      http://www.1f0.de
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program; if not, write to the Free Software Foundation, Inc.,
+ *  51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+
+#pragma once
+
+#include "decoders/ILAVDecoder.h"
+
+// Crops and downscales decoded frames before the pixel format conversion
+// Exact 2x and 4x reductions of 8-bit planar formats use a box filter, everything else is scaled by swscale.
+// The frame keeps its format, so the conversion and the output media type work at the reduced size.
+class CFrameScaler
+{
+public:
+  CFrameScaler();
+  ~CFrameScaler();
+
+  // Set the area of the decoded frame to use (NULL for the whole frame) and the output size
+  // Output dimensions of 0 keep the size of the cropped area, if only one is 0 the aspect ratio is preserved
+  void SetScaling(const RECT *prcCrop, int width, int height);
+  BOOL IsActive() const { return m_bCrop || m_Width || m_Height; }
+
+  // Get the area used of a frame of the given size, and the size it is scaled to
+  // Returns FALSE if such frames are output unchanged. Safe to call from any thread, for decoders scaling in hardware.
+  BOOL GetScaling(int frameWidth, int frameHeight, RECT *prcCrop, int *pWidth, int *pHeight) const;
+
+  // Replace the buffers of the frame with the cropped and scaled image
+  // Returns S_FALSE if the frame did not need to be changed, or the decoder already scaled it
+  HRESULT Scale(LAVFrame *pFrame);
+
+private:
+  void GetOutputRect(int frameWidth, int frameHeight, RECT *prcCrop, int *pWidth, int *pHeight) const;
+  HRESULT ScaleSWS(const LAVFrame *pSrc, const RECT &crop, LAVFrame *pDst);
+
+private:
+  // guards the settings against the threads of hardware decoders, frames are scaled under the delivery lock
+  mutable CCritSec m_csSettings;
+
+  BOOL m_bCrop  = FALSE;
+  RECT m_Crop   = { 0 };
+  int  m_Width  = 0;
+  int  m_Height = 0;
+
+  SwsContext *m_pSwsContext = nullptr;
+};
@@ -27,8 +27,18 @@
 #include "moreuuids.h"
 
 #include <time.h>
+#include "WorkerPool.h"
 #include "rand_sse.h"
 
+extern "C" {
+#include "libavutil/imgutils.h"
+};
+
+#if defined(DEBUG) && DEBUG_PIXELCONV_VERIFY
+#include <intrin.h>
+#include <math.h>
+#endif
+
 /*
  * Availability of custom high-quality converters
  * x = formatter available, - = fallback using swscale
@@ -150,7 +160,9 @@ CLAVPixFmtConverter::CLAVPixFmtConverter()
   convert = &CLAVPixFmtConverter::convert_generic;
   convert_direct = nullptr;
 
-  m_NumThreads = min(8, max(1, av_cpu_count() / 2));
+  // The actual number of threads per frame is chosen adaptively, see GetSliceThreads
+  m_NumThreads = min(SLICE_MAX_THREADS, worker_pool_threads());
+  QueryPerformanceFrequency(&m_PerfFrequency);
 
   ZeroMemory(&m_ColorProps, sizeof(m_ColorProps));
 }
@@ -158,7 +170,89 @@ CLAVPixFmtConverter::CLAVPixFmtConverter()
 CLAVPixFmtConverter::~CLAVPixFmtConverter()
 {
   DestroySWScale();
-  av_freep(&m_pAlignedBuffer);
+  FreeAlignedBuffer();
+  FreeStagingBuffer();
+  SafeRelease(&m_pAccount);
+}
+
+void CLAVPixFmtConverter::SetMemoryAccount(CMemoryAccount *pAccount)
+{
+  FreeAlignedBuffer();
+  FreeStagingBuffer();
+  if (pAccount)
+    pAccount->AddRef();
+  SafeRelease(&m_pAccount);
+  m_pAccount = pAccount;
+}
+
+HRESULT CLAVPixFmtConverter::AllocAlignedBuffer(size_t requiredSize)
+{
+  if (requiredSize <= m_nAlignedBufferSize && m_pAlignedBuffer)
+    return S_OK;
+
+  FreeAlignedBuffer();
+  m_pAlignedBuffer = (uint8_t *)_aligned_malloc(requiredSize + AV_INPUT_BUFFER_PADDING_SIZE, PIXCONV_BUFFER_ALIGN);
+  if (!m_pAlignedBuffer)
+    return E_OUTOFMEMORY;
+  m_nAlignedBufferSize = requiredSize;
+
+  if (m_pAccount)
+    m_pAccount->Update(LAVMemory_ConversionBuffers, &m_nAlignedBufferCharged, requiredSize + AV_INPUT_BUFFER_PADDING_SIZE);
+  return S_OK;
+}
+
+void CLAVPixFmtConverter::FreeAlignedBuffer()
+{
+  _aligned_free(m_pAlignedBuffer);
+  m_pAlignedBuffer = nullptr;
+  m_nAlignedBufferSize = 0;
+
+  if (m_pAccount)
+    m_pAccount->Update(LAVMemory_ConversionBuffers, &m_nAlignedBufferCharged, 0);
+}
+
+HRESULT CLAVPixFmtConverter::AllocStagingBuffer(size_t requiredSize)
+{
+  if (requiredSize <= m_nStagingBufferSize && m_pStagingBuffer)
+    return S_OK;
+
+  FreeStagingBuffer();
+  m_pStagingBuffer = (uint8_t *)_aligned_malloc(requiredSize, PIXCONV_BUFFER_ALIGN);
+  if (!m_pStagingBuffer)
+    return E_OUTOFMEMORY;
+  m_nStagingBufferSize = requiredSize;
+
+  if (m_pAccount)
+    m_pAccount->Update(LAVMemory_ConversionBuffers, &m_nStagingBufferCharged, requiredSize);
+  return S_OK;
+}
+
+void CLAVPixFmtConverter::FreeStagingBuffer()
+{
+  _aligned_free(m_pStagingBuffer);
+  m_pStagingBuffer = nullptr;
+  m_nStagingBufferSize = 0;
+
+  if (m_pAccount)
+    m_pAccount->Update(LAVMemory_ConversionBuffers, &m_nStagingBufferCharged, 0);
+}
+
+void CLAVPixFmtConverter::DestroySWScale()
+{
+  for (int i = 0; i < SWS_CACHE_SIZE; i++) {
+    if (m_SwsCache[i].ctx)
+      sws_freeContext(m_SwsCache[i].ctx);
+    if (m_RGBCoeffsCache[i].coeffs)
+      _aligned_free(m_RGBCoeffsCache[i].coeffs);
+  }
+  for (int i = 0; i <= SLICE_MAX_THREADS; i++) {
+    if (m_SliceSwsCache[i].ctx)
+      sws_freeContext(m_SliceSwsCache[i].ctx);
+  }
+  ZeroMemory(m_SwsCache, sizeof(m_SwsCache));
+  ZeroMemory(m_SliceSwsCache, sizeof(m_SliceSwsCache));
+  ZeroMemory(m_RGBCoeffsCache, sizeof(m_RGBCoeffsCache));
+  m_pDitherTable = nullptr;
 }
 
 LAVOutPixFmts CLAVPixFmtConverter::GetOutputBySubtype(const GUID *guid)
@@ -186,36 +280,167 @@ static bool IsDXVAPixFmt(LAVPixelFormat inputFormat, LAVOutPixFmts outputFormat,
   return false;
 }
 
-int CLAVPixFmtConverter::GetFilteredFormatCount()
+// Modelled conversion costs, from cheapest to most expensive
+#define PIXCONV_COST_COPY       0   // the output stores the planes as decoded, converted with a plain copy
+#define PIXCONV_COST_OPTIMIZED  1   // repacked or dithered by one of our SIMD converters
+#define PIXCONV_COST_GENERIC    2   // converted by swscale (convert_generic)
+
+// Quality class of an output format, its chroma subsampling and bit depth
+// The formats of one class are next to each other in the preference tables, and only ranked by cost among themselves.
+static int get_output_class(LAVOutPixFmts fmt)
 {
-  LAV_INOUT_PIXFMT_MAP *pixFmtMap = lookupFormatMap(m_InputPixFmt, m_InBpp);
-  int count = 0;
-  for (int i = 0; i < LAVOutPixFmt_NB; ++i) {
-    if (m_pSettings->GetPixelFormat(pixFmtMap->lav_pix_fmts[i]) || IsDXVAPixFmt(m_InputPixFmt, pixFmtMap->lav_pix_fmts[i], m_InBpp))
-      count++;
+  switch (fmt) {
+  case LAVOutPixFmt_NV12:
+  case LAVOutPixFmt_YV12:  return 0;
+  case LAVOutPixFmt_YUY2:
+  case LAVOutPixFmt_UYVY:
+  case LAVOutPixFmt_YV16:  return 1;
+  case LAVOutPixFmt_YV24:
+  case LAVOutPixFmt_AYUV:  return 2;
+  case LAVOutPixFmt_RGB32:
+  case LAVOutPixFmt_RGB24: return 3;
+  case LAVOutPixFmt_P010:  return 4;
+  case LAVOutPixFmt_P210:
+  case LAVOutPixFmt_v210:  return 5;
+  case LAVOutPixFmt_Y410:
+  case LAVOutPixFmt_v410:  return 6;
+  case LAVOutPixFmt_P016:  return 7;
+  case LAVOutPixFmt_P216:  return 8;
+  case LAVOutPixFmt_Y416:  return 9;
+  case LAVOutPixFmt_RGB48: return 10;
+  default: break;
   }
+  return -1;
+}
 
-  if (count == 0)
-    count = LAVOutPixFmt_NB;
+// Follows the choices of SelectConvertFunction, without changing the active converter
+int CLAVPixFmtConverter::GetConversionCost(LAVOutPixFmts outFmt)
+{
+  const LAVPixelFormat in = m_InputPixFmt;
+  const int bpp = m_InBpp;
+
+  if (IsIdentityFormat(outFmt, in) || IsDXVAPixFmt(in, outFmt, bpp)
+    || (outFmt == LAVOutPixFmt_RGB32 && (in == LAVPixFmt_RGB32 || in == LAVPixFmt_ARGB32))
+    || (outFmt == LAVOutPixFmt_RGB24 && in == LAVPixFmt_RGB24) || (outFmt == LAVOutPixFmt_RGB48 && in == LAVPixFmt_RGB48)
+    || (outFmt == LAVOutPixFmt_YUY2 && in == LAVPixFmt_YUY2))
+    return PIXCONV_COST_COPY;
+
+  const int cpu = av_get_cpu_flags();
+  if (!(cpu & AV_CPU_FLAG_SSE2))
+    return PIXCONV_COST_GENERIC;
+
+  const bool in420 = (in == LAVPixFmt_YUV420 || in == LAVPixFmt_NV12 || in == LAVPixFmt_YUV420bX || in == LAVPixFmt_P016);
+  const bool inYUV = in420 || in == LAVPixFmt_YUV422 || in == LAVPixFmt_YUV422bX || in == LAVPixFmt_YUV444 || in == LAVPixFmt_YUV444bX;
+
+  bool bOptimized = false;
+  switch (outFmt) {
+  case LAVOutPixFmt_v210:
+    bOptimized = (in == LAVPixFmt_YUV422bX && bpp == 10 && (cpu & AV_CPU_FLAG_SSSE3));
+    break;
+  case LAVOutPixFmt_v410:
+  case LAVOutPixFmt_Y410:
+    bOptimized = (in == LAVPixFmt_YUV444bX && bpp <= 10);
+    break;
+  case LAVOutPixFmt_Y416:
+    bOptimized = (in == LAVPixFmt_YUV444bX);
+    break;
+  case LAVOutPixFmt_AYUV:
+    bOptimized = (in == LAVPixFmt_YUV444 || in == LAVPixFmt_YUV444bX);
+    break;
+  case LAVOutPixFmt_NV12:
+    bOptimized = (in == LAVPixFmt_YUV420 || in == LAVPixFmt_YUV420bX || in == LAVPixFmt_P016);
+    break;
+  case LAVOutPixFmt_YV12:
+    bOptimized = (in == LAVPixFmt_YUV420bX || in == LAVPixFmt_NV12);
+    break;
+  case LAVOutPixFmt_YV16:
+    bOptimized = (in == LAVPixFmt_YUV422bX);
+    break;
+  case LAVOutPixFmt_YV24:
+    bOptimized = (in == LAVPixFmt_YUV444bX);
+    break;
+  case LAVOutPixFmt_P010:
+  case LAVOutPixFmt_P016:
+    bOptimized = (in == LAVPixFmt_YUV420bX);
+    break;
+  case LAVOutPixFmt_P210:
+  case LAVOutPixFmt_P216:
+    bOptimized = (in == LAVPixFmt_YUV422bX);
+    break;
+  case LAVOutPixFmt_YUY2:
+  case LAVOutPixFmt_UYVY:
+    bOptimized = (in == LAVPixFmt_YUV422 || in == LAVPixFmt_YUV422bX || ((in == LAVPixFmt_YUV420 || in == LAVPixFmt_NV12 || in == LAVPixFmt_YUV420bX) && bpp <= 14));
+    break;
+  case LAVOutPixFmt_RGB32:
+  case LAVOutPixFmt_RGB24:
+    bOptimized = (inYUV || in == LAVPixFmt_RGB48);
+    break;
+  default:
+    break;
+  }
 
-  return count;
+  return bOptimized ? PIXCONV_COST_OPTIMIZED : PIXCONV_COST_GENERIC;
 }
 
-LAVOutPixFmts CLAVPixFmtConverter::GetFilteredFormat(int index)
+int CLAVPixFmtConverter::GetFilteredFormats(LAVOutPixFmts formats[LAVOutPixFmt_NB])
 {
   LAV_INOUT_PIXFMT_MAP *pixFmtMap = lookupFormatMap(m_InputPixFmt, m_InBpp);
-  int actualIndex = -1;
+  int count = 0;
   for (int i = 0; i < LAVOutPixFmt_NB; ++i) {
     if (m_pSettings->GetPixelFormat(pixFmtMap->lav_pix_fmts[i]) || IsDXVAPixFmt(m_InputPixFmt, pixFmtMap->lav_pix_fmts[i], m_InBpp))
-      actualIndex++;
-    if (index == actualIndex)
-      return pixFmtMap->lav_pix_fmts[i];
+      formats[count++] = pixFmtMap->lav_pix_fmts[i];
   }
 
   // If no format is enabled, we use the fallback formats to avoid catastrophic failure
-  if (index >= LAVOutPixFmt_NB)
+  if (count == 0) {
+    memcpy(formats, lav_pixfmt_map[0].lav_pix_fmts, sizeof(LAVOutPixFmts) * LAVOutPixFmt_NB);
+    return LAVOutPixFmt_NB;
+  }
+
+  // Within a run of formats of the same quality, the cheaper conversions go first, otherwise the order is kept
+  // The cost per pixel only depends on the formats, so the ranking is the same for any resolution.
+  if (m_pSettings->GetOutputFormatCostRanking()) {
+    int cost[LAVOutPixFmt_NB];
+    for (int i = 0; i < count; ++i)
+      cost[i] = GetConversionCost(formats[i]);
+
+    for (int start = 0; start < count;) {
+      int end = start + 1;
+      while (end < count && get_output_class(formats[end]) == get_output_class(formats[start]))
+        end++;
+
+      // insertion sort, stable
+      for (int i = start + 1; i < end; ++i) {
+        LAVOutPixFmts fmt = formats[i];
+        int c = cost[i];
+        int j = i;
+        for (; j > start && cost[j - 1] > c; --j) {
+          formats[j] = formats[j - 1];
+          cost[j] = cost[j - 1];
+        }
+        formats[j] = fmt;
+        cost[j] = c;
+      }
+      start = end;
+    }
+  }
+
+  return count;
+}
+
+int CLAVPixFmtConverter::GetFilteredFormatCount()
+{
+  LAVOutPixFmts formats[LAVOutPixFmt_NB];
+  return GetFilteredFormats(formats);
+}
+
+LAVOutPixFmts CLAVPixFmtConverter::GetFilteredFormat(int index)
+{
+  LAVOutPixFmts formats[LAVOutPixFmt_NB];
+  int count = GetFilteredFormats(formats);
+  if (index < 0 || index >= count)
     index = 0;
-  return lav_pixfmt_map[0].lav_pix_fmts[index];
+  return formats[index];
 }
 
 LAVOutPixFmts CLAVPixFmtConverter::GetPreferredOutput()
@@ -331,19 +556,69 @@ BOOL CLAVPixFmtConverter::IsAllowedSubtype(const GUID *guid)
 
 #define OUTPUT_RGB (m_OutputPixFmt == LAVOutPixFmt_RGB32 || m_OutputPixFmt == LAVOutPixFmt_RGB24)
 
+// Select the dithering converter of high bit depth inputs for the output format
+template <int bits>
+void CLAVPixFmtConverter::SelectDitherConvertFunctionBits()
+{
+  switch (m_OutputPixFmt) {
+  case LAVOutPixFmt_AYUV:
+    convert = &CLAVPixFmtConverter::convert_yuv444_ayuv_dither_le<bits>;
+    break;
+  case LAVOutPixFmt_NV12:
+    convert = &CLAVPixFmtConverter::convert_yuv_yv_nv12_dither_le<TRUE, bits>;
+    break;
+  case LAVOutPixFmt_YV12:
+  case LAVOutPixFmt_YV16:
+  case LAVOutPixFmt_YV24:
+    convert = &CLAVPixFmtConverter::convert_yuv_yv_nv12_dither_le<FALSE, bits>;
+    break;
+  case LAVOutPixFmt_YUY2:
+    convert = &CLAVPixFmtConverter::convert_yuv422_yuy2_uyvy_dither_le<0, bits>;
+    break;
+  case LAVOutPixFmt_UYVY:
+    convert = &CLAVPixFmtConverter::convert_yuv422_yuy2_uyvy_dither_le<1, bits>;
+    break;
+  default:
+    ASSERT(0);
+  }
+}
+
+// The common bit depths have specializations which shift by immediates, any others are shifted at run-time
+void CLAVPixFmtConverter::SelectDitherConvertFunction()
+{
+  switch (m_InBpp) {
+  case 9:  SelectDitherConvertFunctionBits<9>();  break;
+  case 10: SelectDitherConvertFunctionBits<10>(); break;
+  case 12: SelectDitherConvertFunctionBits<12>(); break;
+  case 16: SelectDitherConvertFunctionBits<16>(); break;
+  default: SelectDitherConvertFunctionBits<0>();  break;
+  }
+}
+
 void CLAVPixFmtConverter::SelectConvertFunction()
 {
   m_RequiredAlignment = 16;
   m_bRGBConverter = FALSE;
+  m_bSliceThreading = FALSE;
+  m_SliceCost = 0.0;
   convert = nullptr;
 
+  // Vertical subsampling of the source planes, for slicing
+  const AVPixFmtDescriptor *desc = av_pix_fmt_desc_get(GetFFInput());
+  for (int i = 0; i < 4; i++)
+    m_SrcPlaneShift[i] = (desc && i > 0 && i < 3) ? desc->log2_chroma_h : 0;
+
   int cpu = av_get_cpu_flags();
   if (m_OutputPixFmt == LAVOutPixFmt_v210 || m_OutputPixFmt == LAVOutPixFmt_v410) {
     // We assume that every filter that understands v210 will also properly handle it
     m_RequiredAlignment = 0;
+    if (m_OutputPixFmt == LAVOutPixFmt_v210 && m_InputPixFmt == LAVPixFmt_YUV422bX && m_InBpp == 10 && (cpu & AV_CPU_FLAG_SSSE3))
+      convert = &CLAVPixFmtConverter::convert_yuv422_v210;
+    else if (m_OutputPixFmt == LAVOutPixFmt_v410 && m_InputPixFmt == LAVPixFmt_YUV444bX && m_InBpp <= 10 && (cpu & AV_CPU_FLAG_SSE2))
+      convert = &CLAVPixFmtConverter::convert_yuv444_v410;
   } else if ((m_OutputPixFmt == LAVOutPixFmt_RGB32 && (m_InputPixFmt == LAVPixFmt_RGB32 || m_InputPixFmt == LAVPixFmt_ARGB32))
     || (m_OutputPixFmt == LAVOutPixFmt_RGB24 && m_InputPixFmt == LAVPixFmt_RGB24) || (m_OutputPixFmt == LAVOutPixFmt_RGB48 && m_InputPixFmt == LAVPixFmt_RGB48)
-    || (m_OutputPixFmt == LAVOutPixFmt_NV12 && m_InputPixFmt == LAVPixFmt_NV12)
+    || (m_OutputPixFmt == LAVOutPixFmt_NV12 && m_InputPixFmt == LAVPixFmt_NV12) || (m_OutputPixFmt == LAVOutPixFmt_YUY2 && m_InputPixFmt == LAVPixFmt_YUY2)
     || ((m_OutputPixFmt == LAVOutPixFmt_P010 || m_OutputPixFmt == LAVOutPixFmt_P016) && m_InputPixFmt == LAVPixFmt_P016)) {
     if (cpu & AV_CPU_FLAG_SSE2)
       convert = &CLAVPixFmtConverter::plane_copy_sse2;
@@ -351,28 +626,39 @@ void CLAVPixFmtConverter::SelectConvertFunction()
       convert = &CLAVPixFmtConverter::plane_copy;
     m_RequiredAlignment = 0;
   } else if (m_InputPixFmt == LAVPixFmt_RGB48 && m_OutputPixFmt == LAVOutPixFmt_RGB32 && (cpu & AV_CPU_FLAG_SSSE3)) {
-    convert = &CLAVPixFmtConverter::convert_rgb48_rgb32_ssse3;
+    if (cpu & AV_CPU_FLAG_AVX2)
+      convert = &CLAVPixFmtConverter::convert_rgb48_rgb32_avx2;
+    else
+      convert = &CLAVPixFmtConverter::convert_rgb48_rgb32_ssse3;
   } else if (cpu & AV_CPU_FLAG_SSE2) {
     if (m_OutputPixFmt == LAVOutPixFmt_AYUV && m_InputPixFmt == LAVPixFmt_YUV444bX) {
-      convert = &CLAVPixFmtConverter::convert_yuv444_ayuv_dither_le;
+      SelectDitherConvertFunction();
     } else if (m_OutputPixFmt == LAVOutPixFmt_AYUV && m_InputPixFmt == LAVPixFmt_YUV444) {
       convert = &CLAVPixFmtConverter::convert_yuv444_ayuv;
     } else if (m_OutputPixFmt == LAVOutPixFmt_Y410 && m_InputPixFmt == LAVPixFmt_YUV444bX && m_InBpp <= 10) {
       convert = &CLAVPixFmtConverter::convert_yuv444_y410;
+    } else if (m_OutputPixFmt == LAVOutPixFmt_Y416 && m_InputPixFmt == LAVPixFmt_YUV444bX) {
+      convert = &CLAVPixFmtConverter::convert_yuv444_y416;
     } else if (((m_OutputPixFmt == LAVOutPixFmt_YV12 || m_OutputPixFmt == LAVOutPixFmt_NV12) && m_InputPixFmt == LAVPixFmt_YUV420bX)
              || (m_OutputPixFmt == LAVOutPixFmt_YV16 && m_InputPixFmt == LAVPixFmt_YUV422bX)
              || (m_OutputPixFmt == LAVOutPixFmt_YV24 && m_InputPixFmt == LAVPixFmt_YUV444bX)) {
-      if (m_OutputPixFmt == LAVOutPixFmt_NV12) {
-        convert = &CLAVPixFmtConverter::convert_yuv_yv_nv12_dither_le<TRUE>;
+      if (cpu & AV_CPU_FLAG_AVX2) {
+        if (m_OutputPixFmt == LAVOutPixFmt_NV12)
+          convert = &CLAVPixFmtConverter::convert_yuv_yv_nv12_dither_le_avx2<TRUE>;
+        else
+          convert = &CLAVPixFmtConverter::convert_yuv_yv_nv12_dither_le_avx2<FALSE>;
       } else {
-        convert = &CLAVPixFmtConverter::convert_yuv_yv_nv12_dither_le<FALSE>;
+        SelectDitherConvertFunction();
       }
       m_RequiredAlignment = 32;
     } else if (((m_OutputPixFmt == LAVOutPixFmt_P010 || m_OutputPixFmt == LAVOutPixFmt_P016) && m_InputPixFmt == LAVPixFmt_YUV420bX)
             || ((m_OutputPixFmt == LAVOutPixFmt_P210 || m_OutputPixFmt == LAVOutPixFmt_P216) && m_InputPixFmt == LAVPixFmt_YUV422bX)) {
       convert = &CLAVPixFmtConverter::convert_yuv420_px1x_le;
     } else if (m_OutputPixFmt == LAVOutPixFmt_NV12 && m_InputPixFmt == LAVPixFmt_YUV420) {
-      convert = &CLAVPixFmtConverter::convert_yuv420_nv12;
+      if (cpu & AV_CPU_FLAG_AVX2)
+        convert = &CLAVPixFmtConverter::convert_yuv420_nv12_avx2;
+      else
+        convert = &CLAVPixFmtConverter::convert_yuv420_nv12;
       m_RequiredAlignment = 32;
     } else if (m_OutputPixFmt == LAVOutPixFmt_YUY2 && m_InputPixFmt == LAVPixFmt_YUV422) {
       convert = &CLAVPixFmtConverter::convert_yuv422_yuy2_uyvy<0>;
@@ -401,11 +687,7 @@ void CLAVPixFmtConverter::SelectConvertFunction()
       }
       m_RequiredAlignment = 8; // Pixel alignment of 8 guarantees a byte alignment of 16
     } else if ((m_OutputPixFmt == LAVOutPixFmt_YUY2 || m_OutputPixFmt == LAVOutPixFmt_UYVY) && m_InputPixFmt == LAVPixFmt_YUV422bX) {
-      if (m_OutputPixFmt == LAVOutPixFmt_YUY2) {
-        convert = &CLAVPixFmtConverter::convert_yuv422_yuy2_uyvy_dither_le<0>;
-      } else {
-        convert = &CLAVPixFmtConverter::convert_yuv422_yuy2_uyvy_dither_le<1>;
-      }
+      SelectDitherConvertFunction();
 
       m_RequiredAlignment = 8; // Pixel alignment of 8 guarantees a byte alignment of 16
     } else if ((m_OutputPixFmt == LAVOutPixFmt_YV12 && m_InputPixFmt == LAVPixFmt_YUV420)
@@ -419,7 +701,10 @@ void CLAVPixFmtConverter::SelectConvertFunction()
       else
         convert = &CLAVPixFmtConverter::convert_rgb48_rgb<0>;
     } else if (m_InputPixFmt == LAVPixFmt_P016 && m_OutputPixFmt == LAVOutPixFmt_NV12) {
-      convert = &CLAVPixFmtConverter::convert_p010_nv12_sse2;
+      if (cpu & AV_CPU_FLAG_AVX2)
+        convert = &CLAVPixFmtConverter::convert_p010_nv12_avx2;
+      else
+        convert = &CLAVPixFmtConverter::convert_p010_nv12_sse2;
     }
   }
 
@@ -427,6 +712,18 @@ void CLAVPixFmtConverter::SelectConvertFunction()
     convert = &CLAVPixFmtConverter::convert_generic;
   }
 
+  // All optimized converters process lines independently and can be sliced
+  // swscale manages its own state, and the YUV->RGB and 4:2:0->4:2:2 converters need to look at neighbouring lines, and slice internally
+  m_bSliceThreading = (convert != &CLAVPixFmtConverter::convert_generic && convert != &CLAVPixFmtConverter::convert_yuv_rgb
+                    && convert != &CLAVPixFmtConverter::convert_yuv420_yuy2<0> && convert != &CLAVPixFmtConverter::convert_yuv420_yuy2<1>);
+
+  // Converters without horizontal filtering produce the same output for any range of columns, so only the last
+  // columns of a misaligned output need to go through a buffer
+  // v210 packs groups of 6 pixels and derives its own stride, so columns can't be split
+  m_bColumnSplit = (convert != &CLAVPixFmtConverter::convert_generic && convert != &CLAVPixFmtConverter::convert_yuv_rgb
+                 && convert != &CLAVPixFmtConverter::convert_yuv422_v210
+                 && convert != &CLAVPixFmtConverter::convert_rgb48_rgb<0> && convert != &CLAVPixFmtConverter::convert_rgb48_rgb<1>);
+
   SelectConvertFunctionDirect();
 }
 
@@ -454,51 +751,227 @@ void CLAVPixFmtConverter::SelectConvertFunctionDirect()
       convert_direct = &CLAVPixFmtConverter::convert_nv12_yv12_direct_sse4;
     else if (cpu & AV_CPU_FLAG_SSE2)
       convert_direct = &CLAVPixFmtConverter::convert_nv12_yv12;
+  } else if (cpu & AV_CPU_FLAG_SSE4) {
+    // Converters which read neighbouring lines convert straight from USWC memory through a small staging buffer
+    if (convert == &CLAVPixFmtConverter::convert_yuv_rgb && (m_InputPixFmt == LAVPixFmt_NV12 || m_InputPixFmt == LAVPixFmt_P016))
+      convert_direct = &CLAVPixFmtConverter::convert_yuv_rgb_direct;
+    else if (convert == &CLAVPixFmtConverter::convert_yuv420_yuy2<0> && m_InputPixFmt == LAVPixFmt_NV12)
+      convert_direct = &CLAVPixFmtConverter::convert_yuv420_yuy2_direct<0>;
+    else if (convert == &CLAVPixFmtConverter::convert_yuv420_yuy2<1> && m_InputPixFmt == LAVPixFmt_NV12)
+      convert_direct = &CLAVPixFmtConverter::convert_yuv420_yuy2_direct<1>;
   }
 
   if (convert_direct != nullptr)
     m_bDirectMode = TRUE;
+
+  // the staged converters slice on their own
+  m_bSliceThreadingDirect = m_bDirectMode && convert_direct != &CLAVPixFmtConverter::convert_yuv_rgb_direct
+                         && convert_direct != &CLAVPixFmtConverter::convert_yuv420_yuy2_direct<0> && convert_direct != &CLAVPixFmtConverter::convert_yuv420_yuy2_direct<1>;
+}
+
+// Pointers to the planes of an output buffer
+static void get_output_planes(const LAVOutPixFmtDesc &desc, uint8_t *out, ptrdiff_t outStride, int planeHeight, uint8_t *dst[4], ptrdiff_t dstStride[4])
+{
+  const ptrdiff_t byteStride = outStride * desc.codedbytes;
+
+  dst[0] = out;
+  dstStride[0] = byteStride;
+
+  for (int i = 1; i < desc.planes; ++i) {
+    dst[i] = dst[i-1] + dstStride[i-1] * (planeHeight / desc.planeHeight[i-1]);
+    dstStride[i] = byteStride / desc.planeWidth[i];
+  }
+}
+
+// The YV formats are planar YUV with the chroma planes in reverse order
+static BOOL is_yv_identity(LAVOutPixFmts outFmt, LAVPixelFormat pixfmt)
+{
+  return (outFmt == LAVOutPixFmt_YV12 && pixfmt == LAVPixFmt_YUV420) || (outFmt == LAVOutPixFmt_YV16 && pixfmt == LAVPixFmt_YUV422) || (outFmt == LAVOutPixFmt_YV24 && pixfmt == LAVPixFmt_YUV444);
+}
+
+BOOL CLAVPixFmtConverter::IsIdentityFormat(LAVOutPixFmts outFmt, LAVPixelFormat pixfmt)
+{
+  return is_yv_identity(outFmt, pixfmt) || (outFmt == LAVOutPixFmt_NV12 && pixfmt == LAVPixFmt_NV12) || ((outFmt == LAVOutPixFmt_P010 || outFmt == LAVOutPixFmt_P016) && pixfmt == LAVPixFmt_P016);
+}
+
+void CLAVPixFmtConverter::GetIdentityOutputPlanes(LAVOutPixFmts outFmt, LAVPixelFormat pixfmt, uint8_t *dst, ptrdiff_t dstStride, int planeHeight, uint8_t *dstArray[4], ptrdiff_t dstStrideArray[4])
+{
+  ASSERT(IsIdentityFormat(outFmt, pixfmt));
+  for (int i = 0; i < 4; i++) {
+    dstArray[i] = nullptr;
+    dstStrideArray[i] = 0;
+  }
+  get_output_planes(lav_pixfmt_desc[outFmt], dst, dstStride, planeHeight, dstArray, dstStrideArray);
+
+  if (is_yv_identity(outFmt, pixfmt)) {
+    uint8_t *tmp = dstArray[1];
+    dstArray[1] = dstArray[2];
+    dstArray[2] = tmp;
+  }
 }
 
 HRESULT CLAVPixFmtConverter::Convert(const BYTE* const src[4], const ptrdiff_t srcStride[4], uint8_t *dst, int width, int height, ptrdiff_t dstStride, int planeHeight) {
-  uint8_t *out = dst;
-  ptrdiff_t outStride = dstStride, i;
+  const LAVOutPixFmtDesc &desc = lav_pixfmt_desc[m_OutputPixFmt];
   planeHeight = max(height, planeHeight);
+
+  uint8_t *dstArray[4] = {0};
+  ptrdiff_t dstStrideArray[4] = {0};
+  get_output_planes(desc, dst, dstStride, planeHeight, dstArray, dstStrideArray);
+
+  // Every line of every plane has to start 16-byte aligned for the converters to write into the output directly
+  BOOL bLinesAligned = TRUE;
+  for (int i = 0; i < max(desc.planes, 1); ++i) {
+    if (((uintptr_t)dstArray[i] | (uintptr_t)dstStrideArray[i]) % 16u)
+      bLinesAligned = FALSE;
+  }
+
+#if defined(DEBUG) && DEBUG_PIXELCONV_VERIFY
+  unsigned __int64 cycles = __rdtsc();
+#endif
+
+  HRESULT hr = S_OK;
   // Check if we have proper pixel alignment and the dst memory is actually aligned
-  if (m_RequiredAlignment && (FFALIGN(dstStride, m_RequiredAlignment) != dstStride || ((uintptr_t)dst % 16u))) {
-    outStride = FFALIGN(dstStride, m_RequiredAlignment);
-    size_t requiredSize = (outStride * planeHeight * lav_pixfmt_desc[m_OutputPixFmt].bpp) >> 3;
+  if (!m_RequiredAlignment || (FFALIGN(dstStride, m_RequiredAlignment) == dstStride && !((uintptr_t)dst % 16u))) {
+    hr = ConvertSliced(convert, m_bSliceThreading, src, srcStride, dstArray, dstStrideArray, width, height);
+  } else if (m_bColumnSplit && bLinesAligned) {
+    hr = ConvertColumnSplit(src, srcStride, dstArray, dstStrideArray, width, height);
+  } else {
+    // Last resort, convert into an aligned buffer and copy it into the output
+    const ptrdiff_t outStride = FFALIGN(dstStride, m_RequiredAlignment);
+    size_t requiredSize = (outStride * planeHeight * desc.bpp) >> 3;
     if (requiredSize > m_nAlignedBufferSize || !m_pAlignedBuffer) {
       DbgLog((LOG_TRACE, 10, L"::Convert(): Conversion requires a bigger stride (need: %d, have: %d), allocating buffer...", outStride, dstStride));
-      av_freep(&m_pAlignedBuffer);
-      m_pAlignedBuffer = (uint8_t *)av_malloc(requiredSize+ AV_INPUT_BUFFER_PADDING_SIZE);
-      if (!m_pAlignedBuffer) {
+      if (FAILED(AllocAlignedBuffer(requiredSize))) {
         return E_FAIL;
       }
-      m_nAlignedBufferSize = requiredSize;
     }
-    out = m_pAlignedBuffer;
+
+    uint8_t *outArray[4] = {0};
+    ptrdiff_t outStrideArray[4] = {0};
+    get_output_planes(desc, m_pAlignedBuffer, outStride, planeHeight, outArray, outStrideArray);
+
+    hr = ConvertSliced(convert, m_bSliceThreading, src, srcStride, outArray, outStrideArray, width, height);
+    ChangeStride(m_pAlignedBuffer, outStride, dst, dstStride, width, height, planeHeight, m_OutputPixFmt);
+    m_ullBounceFrames++;
   }
 
-  uint8_t *dstArray[4] = {0};
-  ptrdiff_t dstStrideArray[4] = {0};
-  ptrdiff_t byteStride = outStride * lav_pixfmt_desc[m_OutputPixFmt].codedbytes;
+#if defined(DEBUG) && DEBUG_PIXELCONV_VERIFY
+  cycles = __rdtsc() - cycles;
+  if (SUCCEEDED(hr))
+    VerifyConversion(src, srcStride, dstArray, dstStrideArray, width, height, planeHeight, cycles);
+#endif
 
-  dstArray[0] = out;
-  dstStrideArray[0] = byteStride;
+  return hr;
+}
 
-  for (i = 1; i < lav_pixfmt_desc[m_OutputPixFmt].planes; ++i) {
-    dstArray[i] = dstArray[i-1] + dstStrideArray[i-1] * (planeHeight / lav_pixfmt_desc[m_OutputPixFmt].planeHeight[i-1]);
-    dstStrideArray[i] = byteStride / lav_pixfmt_desc[m_OutputPixFmt].planeWidth[i];
+// Convert the lines straight into the output up to the last full block of columns, and only the remaining
+// columns through a small aligned buffer, because the converters write full blocks past the end of the line.
+HRESULT CLAVPixFmtConverter::ConvertColumnSplit(const uint8_t* const src[4], const ptrdiff_t srcStride[4], uint8_t* const dst[4], const ptrdiff_t dstStride[4], int width, int height)
+{
+  const LAVOutPixFmtDesc &desc = lav_pixfmt_desc[m_OutputPixFmt];
+  const int bodyWidth = width & ~(PIXCONV_COLUMN_BLOCK - 1);
+  const int tailWidth = width - bodyWidth;
+
+  HRESULT hr = S_OK;
+  if (bodyWidth > 0) {
+    uint8_t *bodyDst[4] = { dst[0], dst[1], dst[2], dst[3] };
+    hr = ConvertSliced(convert, m_bSliceThreading, src, srcStride, bodyDst, dstStride, bodyWidth, height);
+    if (FAILED(hr) || tailWidth == 0)
+      return hr;
   }
 
-  HRESULT hr = (this->*convert)(src, srcStride, dstArray, dstStrideArray, width, height, m_InputPixFmt, m_InBpp, m_OutputPixFmt);
-  if (out != dst) {
-    ChangeStride(out, outStride, dst, dstStride, width, height, planeHeight, m_OutputPixFmt);
+  // The tail is converted into a block wide buffer, starting at the same column of the input
+  const int tailPlaneHeight = FFALIGN(height, 2);
+  const size_t requiredSize = ((size_t)PIXCONV_COLUMN_BLOCK * tailPlaneHeight * desc.bpp) >> 3;
+  if (FAILED(AllocAlignedBuffer(requiredSize)))
+    return E_OUTOFMEMORY;
+
+  int srcOffset[4] = { 0 };
+  if (av_image_fill_linesizes(srcOffset, GetFFInput(), bodyWidth) < 0)
+    return E_FAIL;
+
+  const uint8_t *tailSrc[4] = { 0 };
+  for (int i = 0; i < 4; ++i)
+    tailSrc[i] = src[i] ? src[i] + srcOffset[i] : nullptr;
+
+  uint8_t *tailDst[4] = { 0 };
+  ptrdiff_t tailDstStride[4] = { 0 };
+  get_output_planes(desc, m_pAlignedBuffer, PIXCONV_COLUMN_BLOCK, tailPlaneHeight, tailDst, tailDstStride);
+
+  hr = ConvertSliced(convert, m_bSliceThreading, tailSrc, srcStride, tailDst, tailDstStride, tailWidth, height);
+  if (FAILED(hr))
+    return hr;
+
+  for (int plane = 0; plane < max(desc.planes, 1); ++plane) {
+    const size_t offset = ((size_t)bodyWidth * desc.codedbytes) / desc.planeWidth[plane];
+    const size_t bytes  = ((size_t)tailWidth * desc.codedbytes) / desc.planeWidth[plane];
+    const int lines     = height / desc.planeHeight[plane];
+    for (int line = 0; line < lines; ++line)
+      memcpy(dst[plane] + line * dstStride[plane] + offset, tailDst[plane] + line * tailDstStride[plane], bytes);
   }
-  return hr;
+
+  return S_OK;
 }
 
+#if defined(DEBUG) && DEBUG_PIXELCONV_VERIFY
+// Run the generic converter on the same frame, and compare its output byte by byte
+// Ordered dithering and rounding differ between the paths, so a small difference is expected, large ones point to a broken converter.
+void CLAVPixFmtConverter::VerifyConversion(const uint8_t* const src[4], const ptrdiff_t srcStride[4], uint8_t* const dst[4], const ptrdiff_t dstStride[4], int width, int height, int planeHeight, unsigned __int64 cycles)
+{
+  if (convert == &CLAVPixFmtConverter::convert_generic)
+    return;
+
+  const LAVOutPixFmtDesc &desc = lav_pixfmt_desc[m_OutputPixFmt];
+  const int planes = max(desc.planes, 1);
+
+  size_t size = 0;
+  for (int i = 0; i < planes; i++)
+    size += dstStride[i] * (planeHeight / desc.planeHeight[i]);
+
+  uint8_t *pReference = (uint8_t *)av_malloc(size + AV_INPUT_BUFFER_PADDING_SIZE);
+  if (!pReference)
+    return;
+
+  uint8_t *refArray[4] = { 0 };
+  refArray[0] = pReference;
+  for (int i = 1; i < planes; i++)
+    refArray[i] = refArray[i - 1] + dstStride[i - 1] * (planeHeight / desc.planeHeight[i - 1]);
+
+  unsigned __int64 cyclesGeneric = __rdtsc();
+  HRESULT hr = convert_generic(src, srcStride, refArray, dstStride, width, height, m_InputPixFmt, m_InBpp, m_OutputPixFmt);
+  cyclesGeneric = __rdtsc() - cyclesGeneric;
+
+  if (SUCCEEDED(hr)) {
+    ULONGLONG ullDiffSquared = 0, ullBytes = 0, ullMismatches = 0;
+    int maxDiff = 0;
+    for (int i = 0; i < planes; i++) {
+      const int lineBytes = width * desc.codedbytes / desc.planeWidth[i];
+      const int lines = height / desc.planeHeight[i];
+      for (int y = 0; y < lines; y++) {
+        const uint8_t *a = dst[i] + y * dstStride[i];
+        const uint8_t *b = refArray[i] + y * dstStride[i];
+        for (int x = 0; x < lineBytes; x++) {
+          const int diff = abs(a[x] - b[x]);
+          if (diff) {
+            ullMismatches++;
+            ullDiffSquared += diff * diff;
+            maxDiff = max(maxDiff, diff);
+          }
+        }
+        ullBytes += lineBytes;
+      }
+    }
+
+    const double pixels = (double)width * height;
+    const double psnr = ullDiffSquared ? 10.0 * log10(255.0 * 255.0 * ullBytes / ullDiffSquared) : INFINITY;
+    DbgLog((LOG_TRACE, 10, L"Pixel conversion %d (%d bit) -> %d at %dx%d: %I64u of %I64u bytes differ (max %d, PSNR %.2f dB), %.2f cycles/pixel (generic: %.2f)",
+            m_InputPixFmt, m_InBpp, m_OutputPixFmt, width, height, ullMismatches, ullBytes, maxDiff, psnr, cycles / pixels, cyclesGeneric / pixels));
+  }
+
+  av_freep(&pReference);
+}
+#endif
+
 BOOL CLAVPixFmtConverter::IsDirectModeSupported(uintptr_t dst, ptrdiff_t stride) {
   const int stride_align = (m_OutputPixFmt == LAVOutPixFmt_YV12 ? 32 : 16);
   if (FFALIGN(stride, stride_align) != stride || (dst % 16u))
@@ -526,13 +999,94 @@ HRESULT CLAVPixFmtConverter::ConvertDirect(LAVFrame *pFrame, uint8_t *dst, int w
       dstStrideArray[i] = byteStride / lav_pixfmt_desc[m_OutputPixFmt].planeWidth[i];
     }
 
-    hr = (this->*convert_direct)(buffer.data, buffer.stride, dstArray, dstStrideArray, width, height, m_InputPixFmt, m_InBpp, m_OutputPixFmt);
+    hr = ConvertSliced(convert_direct, m_bSliceThreadingDirect, buffer.data, buffer.stride, dstArray, dstStrideArray, width, height);
     pFrame->direct_unlock(pFrame);
   }
 
   return hr;
 }
 
+HRESULT CLAVPixFmtConverter::ConvertSliced(ConverterFn fn, BOOL bSliced, const uint8_t* const src[4], const ptrdiff_t srcStride[4], uint8_t* dst[4], const ptrdiff_t dstStride[4], int width, int height)
+{
+  if (!bSliced)
+    return (this->*fn)(src, srcStride, dst, dstStride, width, height, m_InputPixFmt, m_InBpp, m_OutputPixFmt);
+
+  const LAVOutPixFmtDesc &desc = lav_pixfmt_desc[m_OutputPixFmt];
+  HRESULT hr = S_OK;
+
+  // Random dithering coefficients are shared by all slices, make sure they cover the whole frame
+  m_ditherMinHeight = height;
+
+  RunSlices(width, height, [&](int, int start, int end) {
+    const uint8_t *sliceSrc[4] = { 0 };
+    uint8_t *sliceDst[4] = { 0 };
+    for (int i = 0; i < 4; i++) {
+      if (src[i])
+        sliceSrc[i] = src[i] + (start >> m_SrcPlaneShift[i]) * srcStride[i];
+      if (dst[i])
+        sliceDst[i] = dst[i] + (start / desc.planeHeight[i]) * dstStride[i];
+    }
+
+    HRESULT hrSlice = (this->*fn)(sliceSrc, srcStride, sliceDst, dstStride, width, end - start, m_InputPixFmt, m_InBpp, m_OutputPixFmt);
+    if (FAILED(hrSlice))
+      hr = hrSlice;
+  });
+
+  m_ditherMinHeight = 0;
+
+  return hr;
+}
+
+int CLAVPixFmtConverter::GetSliceThreads(int width, int height)
+{
+  if (width != m_SliceWidth || height != m_SliceHeight) {
+    m_SliceWidth = width;
+    m_SliceHeight = height;
+    m_SliceCost = 0.0;
+  }
+
+  int maxThreads = min(m_NumThreads, height / SLICE_MIN_LINES);
+  if (maxThreads <= 1)
+    return 1;
+
+  // Without a measurement, start with one thread for every 1080p worth of pixels
+  if (m_SliceCost <= 0.0)
+    return av_clip((width * height) / (1920 * 1080) + 1, 1, maxThreads);
+
+  // Spread the measured work so every thread gets a meaningful amount of it
+  return av_clip((int)(m_SliceCost / SLICE_TARGET_COST) + 1, 1, maxThreads);
+}
+
+// The callback receives the index of the thread running the slice, which is below SLICE_MAX_THREADS
+void CLAVPixFmtConverter::RunSlices(int width, int height, const std::function<void(int, int, int)> &fn)
+{
+  const int nThreads = GetSliceThreads(width, height);
+
+  // Use more slices than threads, and let each thread grab the next free slice when done with one
+  int nSlices = (nThreads > 1) ? nThreads * SLICE_PER_THREAD : 1;
+  const int sliceHeight = FFALIGN((height + nSlices - 1) / nSlices, SLICE_ALIGN);
+  nSlices = (height + sliceHeight - 1) / sliceHeight;
+
+  volatile LONGLONG llWork = 0;
+
+  worker_pool_run(nSlices, nThreads, [&](int slice, int thread) {
+    LARGE_INTEGER start, end;
+    QueryPerformanceCounter(&start);
+
+    const int startY = slice * sliceHeight;
+    fn(thread, startY, min(startY + sliceHeight, height));
+
+    QueryPerformanceCounter(&end);
+    InterlockedExchangeAdd64(&llWork, end.QuadPart - start.QuadPart);
+  });
+
+  // Track the total work per frame, summed over all slices, to adapt the thread count for the next frame
+  if (m_PerfFrequency.QuadPart) {
+    double cost = llWork * 1000000.0 / m_PerfFrequency.QuadPart;
+    m_SliceCost = (m_SliceCost > 0.0) ? (m_SliceCost * 0.875 + cost * 0.125) : cost;
+  }
+}
+
 void CLAVPixFmtConverter::ChangeStride(const uint8_t* src, ptrdiff_t srcStride, uint8_t *dst, ptrdiff_t dstStride, int width, int height, int planeHeight, LAVOutPixFmts format)
 {
   LAVOutPixFmtDesc desc = lav_pixfmt_desc[format];
@@ -565,28 +1119,67 @@ void CLAVPixFmtConverter::ChangeStride(const uint8_t* src, ptrdiff_t srcStride,
   }
 }
 
-const uint16_t* CLAVPixFmtConverter::GetRandomDitherCoeffs(int height, int coeffs, int bits, int line)
+// Random dithering coefficients, shared by all converters in the process
+// Tables are immutable once published, and are only freed when the module is unloaded.
+// The list is append-only, so lookups don't need a lock, only creating a new table does.
+struct RandomDitherTable {
+  int width;
+  int height;
+  int bits;
+  uint16_t *coeffs;
+  RandomDitherTable *next;
+};
+
+// Heights are rounded up, so that small size changes re-use the same table
+#define DITHER_TABLE_HEIGHT_ALIGN 64
+
+static class CRandomDitherTableCache
 {
-  if (m_pSettings->GetDitherMode() != LAVDither_Random)
+public:
+  ~CRandomDitherTableCache() {
+    RandomDitherTable *table = m_pHead;
+    while (table) {
+      RandomDitherTable *next = table->next;
+      _aligned_free(table->coeffs);
+      delete table;
+      table = next;
+    }
+  }
+
+  const RandomDitherTable *Get(int width, int height, int bits) {
+    const RandomDitherTable *table = Find(width, height, bits);
+    if (table)
+      return table;
+
+    CAutoLock lock(&m_csCreate);
+
+    // another thread may have created it
+    table = Find(width, height, bits);
+    if (table)
+      return table;
+
+    return Create(width, FFALIGN(height, DITHER_TABLE_HEIGHT_ALIGN), bits);
+  }
+
+private:
+  const RandomDitherTable *Find(int width, int height, int bits) const {
+    for (const RandomDitherTable *table = (const RandomDitherTable *)InterlockedCompareExchangePointer((PVOID volatile *)&m_pHead, nullptr, nullptr); table; table = table->next) {
+      if (table->bits == bits && table->width >= width && table->height >= height)
+        return table;
+    }
     return nullptr;
+  }
 
-  int totalWidth = 8 * coeffs;
-  if (!m_pRandomDithers || totalWidth > m_ditherWidth || height > m_ditherHeight || bits != m_ditherBits) {
-    if (m_pRandomDithers)
-      _aligned_free(m_pRandomDithers);
-    m_pRandomDithers = nullptr;
-    m_ditherWidth = totalWidth;
-    m_ditherHeight = height;
-    m_ditherBits = bits;
-    m_pRandomDithers = (uint16_t *)_aligned_malloc(m_ditherWidth * m_ditherHeight * 2, 16);
-    if (m_pRandomDithers == nullptr)
+  const RandomDitherTable *Create(int width, int height, int bits) {
+    uint16_t *coeffs = (uint16_t *)_aligned_malloc(width * height * 2, 16);
+    if (coeffs == nullptr)
       return nullptr;
 
 #ifdef DEBUG
     LARGE_INTEGER frequency, start, end;
     QueryPerformanceFrequency(&frequency);
     QueryPerformanceCounter(&start);
-    DbgLog((LOG_TRACE, 10, L"Creating dither matrix"));
+    DbgLog((LOG_TRACE, 10, L"Creating dither matrix (%dx%d, %d bits)", width, height, bits));
 #endif
 
     // Seed random number generator
@@ -594,28 +1187,62 @@ const uint16_t* CLAVPixFmtConverter::GetRandomDitherCoeffs(int height, int coeff
     seed >>= 1;
     srand_sse((unsigned int)seed);
 
-    bits = (1 << bits);
-    for (int i = 0; i < m_ditherHeight; i++) {
-      uint16_t *ditherline = m_pRandomDithers + (m_ditherWidth * i);
-      for (int j = 0; j < m_ditherWidth; j += 4) {
+    const int range = (1 << bits);
+    for (int i = 0; i < height; i++) {
+      uint16_t *ditherline = coeffs + (width * i);
+      for (int j = 0; j < width; j += 4) {
         int rnds[4];
         rand_sse(rnds);
-        ditherline[j+0] = rnds[0] % bits;
-        ditherline[j+1] = rnds[1] % bits;
-        ditherline[j+2] = rnds[2] % bits;
-        ditherline[j+3] = rnds[3] % bits;
+        ditherline[j+0] = rnds[0] % range;
+        ditherline[j+1] = rnds[1] % range;
+        ditherline[j+2] = rnds[2] % range;
+        ditherline[j+3] = rnds[3] % range;
       }
     }
+
 #ifdef DEBUG
     QueryPerformanceCounter(&end);
     double diff = (end.QuadPart - start.QuadPart) * 1000.0 / frequency.QuadPart;
     DbgLog((LOG_TRACE, 10, L"Finished creating dither matrix (took %2.3fms)", diff));
 #endif
 
+    RandomDitherTable *table = new RandomDitherTable();
+    table->width = width;
+    table->height = height;
+    table->bits = bits;
+    table->coeffs = coeffs;
+    table->next = m_pHead;
+
+    // publish the fully initialized table
+    InterlockedExchangePointer((PVOID volatile *)&m_pHead, table);
+    return table;
+  }
+
+private:
+  RandomDitherTable * volatile m_pHead = nullptr;
+  CCritSec m_csCreate;
+} s_RandomDitherTables;
+
+const uint16_t* CLAVPixFmtConverter::GetRandomDitherCoeffs(int height, int coeffs, int bits, int line)
+{
+  if (m_pSettings->GetDitherMode() != LAVDither_Random)
+    return nullptr;
+
+  height = max(height, m_ditherMinHeight);
+
+  const int totalWidth = 8 * coeffs;
+
+  // Slices may race on updating the table, but any table that fits is valid, and none are ever freed
+  const RandomDitherTable *table = m_pDitherTable;
+  if (!table || totalWidth > table->width || height > table->height || bits != table->bits) {
+    table = s_RandomDitherTables.Get(totalWidth, height, bits);
+    if (table == nullptr)
+      return nullptr;
+    m_pDitherTable = table;
   }
 
-  if (line < 0 || line >= m_ditherHeight)
-    line = rand() % m_ditherHeight;
+  if (line < 0 || line >= table->height)
+    line = rand() % table->height;
 
-  return &m_pRandomDithers[line * m_ditherWidth];
+  return &table->coeffs[line * table->width];
 }
@@ -21,8 +21,10 @@
 
 #include "LAVVideoSettings.h"
 #include "decoders/ILAVDecoder.h"
+#include "MemoryAccount.h"
 
 #include <emmintrin.h>
+#include <functional>
 
 #define CONV_FUNC_PARAMS (const uint8_t* const src[4], const ptrdiff_t srcStride[4], uint8_t* dst[4], const ptrdiff_t dstStride[4], int width, int height, LAVPixelFormat inputFormat, int bpp, LAVOutPixFmts outputFormat)
 
@@ -52,10 +54,27 @@ typedef struct _RGBCoeffs {
   __m128i cB_Cb;
 } RGBCoeffs;
 
+// Compare every optimized conversion against the generic (swscale) path, and log the difference and cost (debug builds only)
+#define DEBUG_PIXELCONV_VERIFY 0
+
+#define SLICE_ALIGN        16   // slice boundaries are aligned to this many lines, which keeps chroma and ordered dithering intact
+#define SLICE_MIN_LINES    64   // minimum height of one slice
+#define SLICE_MAX_THREADS  16   // maximum number of threads working on one frame
+
+#define PIXCONV_COLUMN_BLOCK 64 // misaligned outputs are converted directly up to a multiple of this many columns
+#define PIXCONV_BUFFER_ALIGN  64 // the bounce buffer is aligned for full 512-bit vector loads and stores
+#define PIXCONV_STAGING_LINES 8  // lines of a USWC frame staged in the cache at once, keeps the ordered dithering intact
+#define SLICE_PER_THREAD   4    // slices per thread, so threads that finish early can pick up remaining slices
+#define SLICE_TARGET_COST  500  // amount of work per thread (in microseconds) below which additional threads do not pay off
+
+#define SWS_CACHE_SIZE     4    // number of swscale contexts and RGB coefficient tables kept for re-use
+
 typedef int (__stdcall *YUVRGBConversionFunc)(const uint8_t *srcY, const uint8_t *srcU, const uint8_t *srcV, uint8_t *dst, int width, int height, ptrdiff_t srcStrideY, ptrdiff_t srcStrideUV, ptrdiff_t dstStride, ptrdiff_t sliceYStart, ptrdiff_t sliceYEnd, const RGBCoeffs *coeffs, const uint16_t *dithers);
 
 extern LAVOutPixFmtDesc lav_pixfmt_desc[];
 
+struct RandomDitherTable;
+
 class CLAVPixFmtConverter
 {
 public:
@@ -63,15 +82,17 @@ public:
   ~CLAVPixFmtConverter();
 
   void SetSettings(ILAVVideoSettings *pSettings) { m_pSettings = pSettings; }
+  // Account the intermediate buffer is charged to, the converter holds a reference
+  void SetMemoryAccount(CMemoryAccount *pAccount);
 
-  BOOL SetInputFmt(enum LAVPixelFormat pixfmt, int bpp) { if (m_InputPixFmt != pixfmt || m_InBpp != bpp) { m_InputPixFmt = pixfmt; m_InBpp = bpp; DestroySWScale(); SelectConvertFunction(); return TRUE; } return FALSE; }
-  HRESULT SetOutputPixFmt(enum LAVOutPixFmts pix_fmt) { m_OutputPixFmt = pix_fmt; DestroySWScale(); SelectConvertFunction(); return S_OK; }
+  BOOL SetInputFmt(enum LAVPixelFormat pixfmt, int bpp) { if (m_InputPixFmt != pixfmt || m_InBpp != bpp) { m_InputPixFmt = pixfmt; m_InBpp = bpp; SelectConvertFunction(); return TRUE; } return FALSE; }
+  HRESULT SetOutputPixFmt(enum LAVOutPixFmts pix_fmt) { m_OutputPixFmt = pix_fmt; SelectConvertFunction(); return S_OK; }
   
   LAVOutPixFmts GetOutputBySubtype(const GUID *guid);
   LAVOutPixFmts GetPreferredOutput();
 
   LAVOutPixFmts GetOutputPixFmt() { return m_OutputPixFmt; }
-  void SetColorProps(DXVA2_ExtendedFormat props, int RGBOutputRange) { if (props.value != m_ColorProps.value || swsOutputRange != RGBOutputRange) { DestroySWScale(); m_ColorProps = props; swsOutputRange = RGBOutputRange; } }
+  void SetColorProps(DXVA2_ExtendedFormat props, int RGBOutputRange) { m_ColorProps = props; swsOutputRange = RGBOutputRange; }
 
   int GetNumMediaTypes();
   void GetMediaType(CMediaType *mt, int index, LONG biWidth, LONG biHeight, DWORD dwAspectX, DWORD dwAspectY, REFERENCE_TIME rtAvgTime, BOOL bInterlaced = TRUE, BOOL bVIH1 = FALSE);
@@ -81,8 +102,16 @@ public:
   HRESULT ConvertDirect(LAVFrame *pFrame, uint8_t *dst, int width, int height, ptrdiff_t dstStride, int planeHeight);
 
   BOOL IsRGBConverterActive() { return m_bRGBConverter; }
+
+  // Number of frames which had to be converted into an intermediate buffer and copied into the output again
+  ULONGLONG GetBounceFrames() const { return m_ullBounceFrames; }
   BOOL IsDirectModeSupported(uintptr_t dst, ptrdiff_t stride);
 
+  // Check if frames of the input format are stored in the output format as-is
+  static BOOL IsIdentityFormat(LAVOutPixFmts outFmt, LAVPixelFormat pixfmt);
+  // Get the planes of an output buffer in the plane order of the input format, only valid for identity formats
+  static void GetIdentityOutputPlanes(LAVOutPixFmts outFmt, LAVPixelFormat pixfmt, uint8_t *dst, ptrdiff_t dstStride, int planeHeight, uint8_t *dstArray[4], ptrdiff_t dstStrideArray[4]);
+
   DWORD GetImageSize(int width, int height, LAVOutPixFmts pixFmt = LAVOutPixFmt_None);
 
 private:
@@ -92,10 +121,20 @@ private:
 
   int GetFilteredFormatCount();
   LAVOutPixFmts GetFilteredFormat(int index);
+  // The enabled output formats for the input format, in the order they are offered
+  int GetFilteredFormats(LAVOutPixFmts formats[LAVOutPixFmt_NB]);
+  // Modelled cost of converting the input format into an output format, see PIXCONV_COST_*
+  int GetConversionCost(LAVOutPixFmts outFmt);
 
   void SelectConvertFunction();
   void SelectConvertFunctionDirect();
 
+  // Per-thread staging buffers of ConvertStaged
+  HRESULT AllocStagingBuffer(size_t requiredSize);
+  void FreeStagingBuffer();
+  void SelectDitherConvertFunction();
+  template <int bits> void SelectDitherConvertFunctionBits();
+
   // Helper functions for convert_generic
   HRESULT swscale_scale(enum AVPixelFormat srcPix, enum AVPixelFormat dstPix, const uint8_t* const src[4], const ptrdiff_t srcStride[4], uint8_t* dst[4], int width, int height, const ptrdiff_t dstStride[4], LAVOutPixFmtDesc pixFmtDesc, bool swapPlanes12 = false);
   HRESULT ConvertTo422Packed(const uint8_t* const src[4], const ptrdiff_t srcStride[4], uint8_t *dst[4], int width, int height, const ptrdiff_t dstStride[4]);
@@ -106,8 +145,24 @@ private:
   HRESULT ConvertTov210(const uint8_t* const src[4], const ptrdiff_t srcStride[4], uint8_t *dst[4], int width, int height, const ptrdiff_t dstStride[4]);
   HRESULT ConvertTov410(const uint8_t* const src[4], const ptrdiff_t srcStride[4], uint8_t *dst[4], int width, int height, const ptrdiff_t dstStride[4]);
 
-  void DestroySWScale() { if (m_pSwsContext) sws_freeContext(m_pSwsContext); m_pSwsContext = nullptr; if (m_rgbCoeffs) _aligned_free(m_rgbCoeffs); m_rgbCoeffs = nullptr; if (m_pRandomDithers) _aligned_free(m_pRandomDithers); m_pRandomDithers = nullptr; };
+  void DestroySWScale();
+
+  // Grow the intermediate buffer to at least the required size
+  HRESULT AllocAlignedBuffer(size_t requiredSize);
+  void FreeAlignedBuffer();
+
   SwsContext *GetSWSContext(int width, int height, enum AVPixelFormat srcPix, enum AVPixelFormat dstPix, int flags);
+  SwsContext *CreateSWSContext(int width, int height, int frameWidth, int frameHeight, enum AVPixelFormat srcPix, enum AVPixelFormat dstPix, int flags);
+  SwsContext *GetSliceSWSContext(int slot, int width, int height, int frameHeight, enum AVPixelFormat srcPix, enum AVPixelFormat dstPix, int flags);
+  HRESULT sws_scale_sliced(enum AVPixelFormat srcPix, enum AVPixelFormat dstPix, int flags, const uint8_t* const src[4], const ptrdiff_t srcStride[4], uint8_t* const dst[4], const ptrdiff_t dstStride[4], int width, int height);
+
+  // Slice threading
+  int GetSliceThreads(int width, int height);
+  void RunSlices(int width, int height, const std::function<void(int, int, int)> &fn);
+
+#if defined(DEBUG) && DEBUG_PIXELCONV_VERIFY
+  void VerifyConversion(const uint8_t* const src[4], const ptrdiff_t srcStride[4], uint8_t* const dst[4], const ptrdiff_t dstStride[4], int width, int height, int planeHeight, unsigned __int64 cycles);
+#endif
 
   void ChangeStride(const uint8_t* src, ptrdiff_t srcStride, uint8_t *dst, ptrdiff_t dstStride, int width, int height, int planeHeight, LAVOutPixFmts format);
 
@@ -117,24 +172,41 @@ private:
   ConverterFn convert;
   ConverterFn convert_direct;
 
+  // Run a conversion function sliced over multiple threads, if supported by the function
+  HRESULT ConvertSliced(ConverterFn fn, BOOL bSliced, const uint8_t* const src[4], const ptrdiff_t srcStride[4], uint8_t* dst[4], const ptrdiff_t dstStride[4], int width, int height);
+  HRESULT ConvertColumnSplit(const uint8_t* const src[4], const ptrdiff_t srcStride[4], uint8_t* const dst[4], const ptrdiff_t dstStride[4], int width, int height);
+
+  // Converts the lines [sliceYStart, sliceYEnd) of a block of blockHeight lines staged from the frame, which starts at line origin of the frame
+  typedef std::function<void(const uint8_t *y, const uint8_t *uv, ptrdiff_t stride, int origin, int blockHeight, ptrdiff_t sliceYStart, ptrdiff_t sliceYEnd)> StagedConverterFn;
+  // Run a 4:2:0 line pair converter on a NV12/P010 frame in USWC memory, see convert_direct.cpp
+  HRESULT ConvertStaged(const uint8_t* const src[4], const ptrdiff_t srcStride[4], int width, int height, const StagedConverterFn &fn);
+
   // Pixel Implementations
   DECLARE_CONV_FUNC(convert_generic);
   DECLARE_CONV_FUNC(plane_copy);
   DECLARE_CONV_FUNC(plane_copy_sse2);
   DECLARE_CONV_FUNC(convert_yuv444_ayuv);
-  DECLARE_CONV_FUNC(convert_yuv444_ayuv_dither_le);
+  template <int bits> DECLARE_CONV_FUNC(convert_yuv444_ayuv_dither_le);
   DECLARE_CONV_FUNC(convert_yuv444_y410);
+  DECLARE_CONV_FUNC(convert_yuv444_y416);
+  DECLARE_CONV_FUNC(convert_yuv444_v410);
+  DECLARE_CONV_FUNC(convert_yuv422_v210);
   DECLARE_CONV_FUNC(convert_yuv420_px1x_le);
   DECLARE_CONV_FUNC(convert_yuv420_nv12);
   DECLARE_CONV_FUNC(convert_yuv_yv);
   DECLARE_CONV_FUNC(convert_nv12_yv12);
   DECLARE_CONV_FUNC(convert_p010_nv12_sse2);
+  DECLARE_CONV_FUNC(convert_yuv420_nv12_avx2);
+  DECLARE_CONV_FUNC(convert_p010_nv12_avx2);
   template <int uyvy> DECLARE_CONV_FUNC(convert_yuv420_yuy2);
+  template <int uyvy> DECLARE_CONV_FUNC(convert_yuv420_yuy2_direct);
   template <int uyvy> DECLARE_CONV_FUNC(convert_yuv422_yuy2_uyvy);
-  template <int uyvy> DECLARE_CONV_FUNC(convert_yuv422_yuy2_uyvy_dither_le);
-  template <int nv12> DECLARE_CONV_FUNC(convert_yuv_yv_nv12_dither_le);
+  template <int uyvy, int bits> DECLARE_CONV_FUNC(convert_yuv422_yuy2_uyvy_dither_le);
+  template <int nv12, int bits> DECLARE_CONV_FUNC(convert_yuv_yv_nv12_dither_le);
+  template <int nv12> DECLARE_CONV_FUNC(convert_yuv_yv_nv12_dither_le_avx2);
 
   DECLARE_CONV_FUNC(convert_rgb48_rgb32_ssse3);
+  DECLARE_CONV_FUNC(convert_rgb48_rgb32_avx2);
   template <int out32> DECLARE_CONV_FUNC(convert_rgb48_rgb);
 
   DECLARE_CONV_FUNC(plane_copy_direct_sse4);
@@ -142,8 +214,11 @@ private:
   DECLARE_CONV_FUNC(convert_p010_nv12_direct_sse4);
 
   DECLARE_CONV_FUNC(convert_yuv_rgb);
+  DECLARE_CONV_FUNC(convert_yuv_rgb_direct);
   const RGBCoeffs* getRGBCoeffs(int width, int height);
+  YUVRGBConversionFunc GetRGBConvFunc(LAVPixelFormat inputFormat, int bpp, LAVOutPixFmts outputFormat, int height, const uint16_t **pDithers);
   void InitRGBConvDispatcher();
+  void InitRGBConvDispatcherAVX2();
 
   const uint16_t* GetRandomDitherCoeffs(int height, int coeffs, int bits, int line);
 
@@ -154,32 +229,69 @@ private:
 
   BOOL m_bDirectMode = false;
 
-  int swsWidth       = 0;
-  int swsHeight      = 0;
   int swsOutputRange = 0;
 
   DXVA2_ExtendedFormat m_ColorProps;
 
   ptrdiff_t m_RequiredAlignment  = 0;
 
-  SwsContext *m_pSwsContext     = nullptr;
+  // Recently used swscale contexts and RGB coefficients, so streams switching back and forth between formats can re-use them
+  struct SwsCacheEntry {
+    SwsContext   *ctx;
+    int           width;
+    int           height;
+    AVPixelFormat srcPix;
+    AVPixelFormat dstPix;
+    int           flags;
+    UINT          colorProps;
+    int           frameHeight;
+    ULONGLONG     lastUse;
+  } m_SwsCache[SWS_CACHE_SIZE] = {};
+
+  // swscale contexts of the slice threads, plus one for the last slice of a frame
+  SwsCacheEntry m_SliceSwsCache[SLICE_MAX_THREADS + 1] = {};
+
+  struct RGBCoeffsCacheEntry {
+    RGBCoeffs *coeffs;
+    int        width;
+    int        height;
+    UINT       colorProps;
+    int        outputRange;
+    ULONGLONG  lastUse;
+  } m_RGBCoeffsCache[SWS_CACHE_SIZE] = {};
+
+  ULONGLONG m_CacheUseCounter   = 0;
 
   size_t   m_nAlignedBufferSize = 0;
   uint8_t *m_pAlignedBuffer     = nullptr;
+  size_t   m_nAlignedBufferCharged = 0;
+  size_t   m_nStagingBufferSize = 0;
+  uint8_t *m_pStagingBuffer     = nullptr;
+  size_t   m_nStagingBufferCharged = 0;
+  CMemoryAccount *m_pAccount    = nullptr;
+  ULONGLONG m_ullBounceFrames   = 0;
+  BOOL     m_bColumnSplit       = FALSE;
 
   int m_NumThreads              = 1;
 
+  // Slice threading state
+  BOOL m_bSliceThreading        = FALSE;
+  BOOL m_bSliceThreadingDirect  = FALSE;
+  int m_SrcPlaneShift[4]        = { 0 };
+  int m_SliceWidth              = 0;
+  int m_SliceHeight             = 0;
+  double m_SliceCost            = 0.0;
+  LARGE_INTEGER m_PerfFrequency = { 0 };
+
   ILAVVideoSettings *m_pSettings = nullptr;
 
-  RGBCoeffs *m_rgbCoeffs = nullptr;
   BOOL m_bRGBConverter   = FALSE;
   BOOL m_bRGBConvInit    = FALSE;
 
   // [out32][dithermode][ycgco][format][shift]
   YUVRGBConversionFunc m_RGBConvFuncs[2][2][2][LAVPixFmt_NB][9];
 
-  uint16_t *m_pRandomDithers = nullptr;
-  int m_ditherWidth  = 0;
-  int m_ditherHeight = 0;
-  int m_ditherBits   = 0;
+  // Random dithering coefficients, owned by the process-wide table cache
+  const RandomDitherTable *m_pDitherTable = nullptr;
+  int m_ditherMinHeight = 0;
 };
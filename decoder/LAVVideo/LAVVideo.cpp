@@ -28,6 +28,8 @@
 
 #include "moreuuids.h"
 #include "registry.h"
+#include "ThreadPriority.h"
+#include "TraceProvider.h"
 #include "resource.h"
 
 #include "IMediaSample3D.h"
@@ -60,8 +62,10 @@ CLAVVideo::CLAVVideo(LPUNKNOWN pUnk, HRESULT* phr)
   memset(&m_SideData, 0, sizeof(m_SideData));
 
   LoadSettings();
+  UpdateFramePoolFootprint();
 
   m_PixFmtConverter.SetSettings(this);
+  m_PixFmtConverter.SetMemoryAccount(m_pMemoryAccount);
 
 #ifdef DEBUG
   DbgSetModuleLevel (LOG_TRACE, DWORD_MAX);
@@ -75,8 +79,15 @@ CLAVVideo::CLAVVideo(LPUNKNOWN pUnk, HRESULT* phr)
 
 CLAVVideo::~CLAVVideo()
 {
+  CancelIdleRelease();
   SAFE_DELETE(m_pTrayIcon);
 
+  if (ThreadExists()) {
+    CallWorker(CMD_EXIT);
+    Close();
+  }
+  ClearDeliveryQueue();
+
   ReleaseLastSequenceFrame();
   m_Decoder.Close();
 
@@ -92,6 +103,22 @@ CLAVVideo::~CLAVVideo()
   SAFE_DELETE(m_pSubtitleInput);
   SAFE_DELETE(m_pCCOutputPin);
 
+  SafeRelease(&m_pFrameInfoCallback);
+  SafeRelease(&m_pThumbnailCallback);
+  ClearSourceFrames();
+  SafeRelease(&m_pFrameSourceCallback);
+  if (m_pThumbnailSws)
+    sws_freeContext(m_pThumbnailSws);
+  av_freep(&m_pThumbnailBuffer);
+
+  for (LAVFrame *pFrame : m_FramePool)
+    CoTaskMemFree(pFrame);
+  m_FramePool.clear();
+
+  if (m_bFramePoolLowFootprint)
+    SetLAVFrameBufferPoolLowFootprint(false);
+  SafeRelease(&m_pMemoryAccount);
+
 #if defined(DEBUG) && defined(LAV_DEBUG_RELEASE)
   DbgCloseLogFile();
 #endif
@@ -158,6 +185,8 @@ HRESULT CLAVVideo::LoadDefaults()
   m_settings.bHWFormats[HWCodec_H264MVC] = FALSE;
 
   m_settings.HWAccelResFlags = LAVHWResFlag_SD|LAVHWResFlag_HD|LAVHWResFlag_UHD;
+  m_settings.bHWAccelAuto = FALSE;
+  m_settings.bHWAccelStandby = FALSE;
 
   m_settings.HWAccelCUVIDXVA = TRUE;
 
@@ -166,6 +195,7 @@ HRESULT CLAVVideo::LoadDefaults()
 
   m_settings.SWDeintMode = SWDeintMode_None;
   m_settings.SWDeintOutput = DeintOutput_FramePerField;
+  m_settings.SWDeintThreads = 0;
 
   m_settings.DitherMode = LAVDither_Random;
 
@@ -175,9 +205,31 @@ HRESULT CLAVVideo::LoadDefaults()
   m_settings.HWAccelDeviceD3D11 = LAVHWACCEL_DEVICE_DEFAULT;
   m_settings.HWAccelDeviceD3D11Desc = 0;
 
+  m_settings.HWAccelStagingTextures = 3;
+
+  m_settings.HWAccelSurfacePoolMin = 0;
+  m_settings.HWAccelSurfacePoolMax = 0;
+
+  m_settings.bHWAccelDeviceLoadBalancing = FALSE;
+  m_settings.bHWAccelGPUConversion = FALSE;
+
+  m_settings.bAsyncDelivery = FALSE;
+
   m_settings.bH264MVCOverride = TRUE;
   m_settings.bCCOutputPinEnabled = FALSE;
 
+  m_settings.PerformanceMode = PerfMode_Off;
+  m_settings.bStreamingThreadPriority = TRUE;
+  m_settings.NUMANode = NUMA_NODE_OFF;
+  m_settings.bDirectRendering = FALSE;
+  m_settings.bLowDelay = FALSE;
+  m_settings.bLowFootprint = FALSE;
+  m_settings.OutputQueueDepth = 0;
+  m_settings.OutputQueueBatch = 1;
+  m_settings.AV1FilmGrainMode = AV1FilmGrain_Decoder;
+  m_settings.IdleReleaseTime = 0;
+  m_settings.bOutputFormatCostRanking = TRUE;
+
   return S_OK;
 }
 
@@ -191,8 +243,11 @@ HRESULT CLAVVideo::LoadSettings()
   if (m_bRuntimeConfig)
     return S_FALSE;
 
-  ReadSettings(HKEY_LOCAL_MACHINE);
-  return ReadSettings(HKEY_CURRENT_USER);
+  static CRegistrySettingsCache<decltype(m_settings)> cache(LAVC_VIDEO_REGISTRY_KEY);
+  return cache.Load(m_settings, [this]() {
+    ReadSettings(HKEY_LOCAL_MACHINE);
+    return ReadSettings(HKEY_CURRENT_USER);
+  });
 }
 
 HRESULT CLAVVideo::ReadSettings(HKEY rootKey)
@@ -237,14 +292,53 @@ HRESULT CLAVVideo::ReadSettings(HKEY rootKey)
     dwVal = reg.ReadDWORD(L"SWDeintOutput", hr);
     if (SUCCEEDED(hr)) m_settings.SWDeintOutput = dwVal;
 
+    dwVal = reg.ReadDWORD(L"SWDeintThreads", hr);
+    if (SUCCEEDED(hr) && dwVal <= 16) m_settings.SWDeintThreads = dwVal;
+
     dwVal = reg.ReadDWORD(L"DitherMode", hr);
     if (SUCCEEDED(hr)) m_settings.DitherMode = dwVal;
 
+    dwVal = reg.ReadDWORD(L"PerformanceMode", hr);
+    if (SUCCEEDED(hr) && dwVal <= PerfMode_Fast) m_settings.PerformanceMode = dwVal;
+
+    bFlag = reg.ReadBOOL(L"StreamingThreadPriority", hr);
+    if (SUCCEEDED(hr)) m_settings.bStreamingThreadPriority = bFlag;
+
+    dwVal = reg.ReadDWORD(L"NUMANode", hr);
+    if (SUCCEEDED(hr)) m_settings.NUMANode = dwVal;
+
+    bFlag = reg.ReadBOOL(L"DirectRendering", hr);
+    if (SUCCEEDED(hr)) m_settings.bDirectRendering = bFlag;
+
+    bFlag = reg.ReadBOOL(L"LowDelay", hr);
+    if (SUCCEEDED(hr)) m_settings.bLowDelay = bFlag;
+
+    bFlag = reg.ReadBOOL(L"LowFootprint", hr);
+    if (SUCCEEDED(hr)) m_settings.bLowFootprint = bFlag;
+
+    dwVal = reg.ReadDWORD(L"OutputQueueDepth", hr);
+    if (SUCCEEDED(hr)) m_settings.OutputQueueDepth = min(dwVal, (DWORD)OUTPUT_QUEUE_MAX_DEPTH);
+
+    dwVal = reg.ReadDWORD(L"OutputQueueBatch", hr);
+    if (SUCCEEDED(hr)) m_settings.OutputQueueBatch = av_clip(dwVal, 1, OUTPUT_QUEUE_MAX_DEPTH);
+
+    dwVal = reg.ReadDWORD(L"AV1FilmGrainMode", hr);
+    if (SUCCEEDED(hr) && dwVal <= AV1FilmGrain_Output) m_settings.AV1FilmGrainMode = dwVal;
+
+    dwVal = reg.ReadDWORD(L"IdleReleaseTime", hr);
+    if (SUCCEEDED(hr)) m_settings.IdleReleaseTime = dwVal;
+
+    bFlag = reg.ReadBOOL(L"OutputFormatCostRanking", hr);
+    if (SUCCEEDED(hr)) m_settings.bOutputFormatCostRanking = bFlag;
+
     bFlag = reg.ReadBOOL(L"DVDVideo", hr);
     if (SUCCEEDED(hr)) m_settings.bDVDVideo = bFlag;
 
     bFlag = reg.ReadBOOL(L"MSWMV9DMO", hr);
     if (SUCCEEDED(hr)) m_settings.bMSWMV9DMO = bFlag;
+
+    bFlag = reg.ReadBOOL(L"AsyncDelivery", hr);
+    if (SUCCEEDED(hr)) m_settings.bAsyncDelivery = bFlag;
   }
 
   CRegistry regF = CRegistry(rootKey, LAVC_VIDEO_REGISTRY_KEY_FORMATS, hr, TRUE);
@@ -299,6 +393,12 @@ HRESULT CLAVVideo::ReadSettings(HKEY rootKey)
     dwVal = regHW.ReadDWORD(L"HWResFlags", hr);
     if (SUCCEEDED(hr)) m_settings.HWAccelResFlags = dwVal;
 
+    bFlag = regHW.ReadBOOL(L"HWAccelAuto", hr);
+    if (SUCCEEDED(hr)) m_settings.bHWAccelAuto = bFlag;
+
+    bFlag = regHW.ReadBOOL(L"HWAccelStandby", hr);
+    if (SUCCEEDED(hr)) m_settings.bHWAccelStandby = bFlag;
+
     dwVal = regHW.ReadDWORD(L"HWDeintMode", hr);
     if (SUCCEEDED(hr)) m_settings.HWDeintMode = dwVal;
 
@@ -317,8 +417,26 @@ HRESULT CLAVVideo::ReadSettings(HKEY rootKey)
     dwVal = regHW.ReadDWORD(L"HWAccelDeviceD3D11Desc", hr);
     if (SUCCEEDED(hr)) m_settings.HWAccelDeviceD3D11Desc = dwVal;
 
+    dwVal = regHW.ReadDWORD(L"HWAccelStagingTextures", hr);
+    if (SUCCEEDED(hr)) m_settings.HWAccelStagingTextures = dwVal;
+
+    dwVal = regHW.ReadDWORD(L"HWAccelSurfacePoolMin", hr);
+    if (SUCCEEDED(hr) && dwVal <= 127) m_settings.HWAccelSurfacePoolMin = dwVal;
+
+    dwVal = regHW.ReadDWORD(L"HWAccelSurfacePoolMax", hr);
+    if (SUCCEEDED(hr) && dwVal <= 127) m_settings.HWAccelSurfacePoolMax = dwVal;
+
+    if (m_settings.HWAccelSurfacePoolMax && m_settings.HWAccelSurfacePoolMax < m_settings.HWAccelSurfacePoolMin)
+      m_settings.HWAccelSurfacePoolMax = m_settings.HWAccelSurfacePoolMin;
+
+    bFlag = regHW.ReadBOOL(L"HWAccelDeviceLoadBalancing", hr);
+    if (SUCCEEDED(hr)) m_settings.bHWAccelDeviceLoadBalancing = bFlag;
+
     bFlag = regHW.ReadBOOL(L"HWAccelCUVIDXVA", hr);
     if (SUCCEEDED(hr)) m_settings.HWAccelCUVIDXVA = bFlag;
+
+    bFlag = regHW.ReadBOOL(L"HWAccelGPUConversion", hr);
+    if (SUCCEEDED(hr)) m_settings.bHWAccelGPUConversion = bFlag;
   }
 
   return S_OK;
@@ -350,6 +468,7 @@ HRESULT CLAVVideo::SaveSettings()
 
     reg.WriteBOOL(L"DVDVideo", m_settings.bDVDVideo);
     reg.WriteBOOL(L"MSWMV9DMO", m_settings.bMSWMV9DMO);
+    reg.WriteBOOL(L"AsyncDelivery", m_settings.bAsyncDelivery);
 
     CreateRegistryKey(HKEY_CURRENT_USER, LAVC_VIDEO_REGISTRY_KEY_OUTPUT);
     CRegistry regP = CRegistry(HKEY_CURRENT_USER, LAVC_VIDEO_REGISTRY_KEY_OUTPUT, hr);
@@ -370,6 +489,8 @@ HRESULT CLAVVideo::SaveSettings()
     regHW.WriteBOOL(L"h264mvc", m_settings.bHWFormats[HWCodec_H264MVC]);
 
     regHW.WriteDWORD(L"HWResFlags", m_settings.HWAccelResFlags);
+    regHW.WriteBOOL(L"HWAccelAuto", m_settings.bHWAccelAuto);
+    regHW.WriteBOOL(L"HWAccelStandby", m_settings.bHWAccelStandby);
 
     regHW.WriteDWORD(L"HWDeintMode", m_settings.HWDeintMode);
     regHW.WriteDWORD(L"HWDeintOutput", m_settings.HWDeintOutput);
@@ -380,11 +501,31 @@ HRESULT CLAVVideo::SaveSettings()
     regHW.WriteDWORD(L"HWAccelDeviceD3D11", m_settings.HWAccelDeviceD3D11);
     regHW.WriteDWORD(L"HWAccelDeviceD3D11Desc", m_settings.HWAccelDeviceD3D11Desc);
 
+    regHW.WriteDWORD(L"HWAccelStagingTextures", m_settings.HWAccelStagingTextures);
+
+    regHW.WriteDWORD(L"HWAccelSurfacePoolMin", m_settings.HWAccelSurfacePoolMin);
+    regHW.WriteDWORD(L"HWAccelSurfacePoolMax", m_settings.HWAccelSurfacePoolMax);
+
+    regHW.WriteBOOL(L"HWAccelDeviceLoadBalancing", m_settings.bHWAccelDeviceLoadBalancing);
+
     regHW.WriteBOOL(L"HWAccelCUVIDXVA", m_settings.HWAccelCUVIDXVA);
+    regHW.WriteBOOL(L"HWAccelGPUConversion", m_settings.bHWAccelGPUConversion);
 
     reg.WriteDWORD(L"SWDeintMode", m_settings.SWDeintMode);
     reg.WriteDWORD(L"SWDeintOutput", m_settings.SWDeintOutput);
+    reg.WriteDWORD(L"SWDeintThreads", m_settings.SWDeintThreads);
     reg.WriteDWORD(L"DitherMode", m_settings.DitherMode);
+    reg.WriteDWORD(L"PerformanceMode", m_settings.PerformanceMode);
+    reg.WriteBOOL(L"StreamingThreadPriority", m_settings.bStreamingThreadPriority);
+    reg.WriteDWORD(L"NUMANode", m_settings.NUMANode);
+    reg.WriteBOOL(L"DirectRendering", m_settings.bDirectRendering);
+    reg.WriteBOOL(L"LowDelay", m_settings.bLowDelay);
+    reg.WriteBOOL(L"LowFootprint", m_settings.bLowFootprint);
+    reg.WriteDWORD(L"OutputQueueDepth", m_settings.OutputQueueDepth);
+    reg.WriteDWORD(L"OutputQueueBatch", m_settings.OutputQueueBatch);
+    reg.WriteDWORD(L"AV1FilmGrainMode", m_settings.AV1FilmGrainMode);
+    reg.WriteDWORD(L"IdleReleaseTime", m_settings.IdleReleaseTime);
+    reg.WriteBOOL(L"OutputFormatCostRanking", m_settings.bOutputFormatCostRanking);
 
     reg.DeleteKey(L"DeintAggressive");
     reg.DeleteKey(L"DeintForce");
@@ -406,6 +547,10 @@ STDMETHODIMP CLAVVideo::NonDelegatingQueryInterface(REFIID riid, void** ppv)
     QI(IPropertyBag)
     QI2(ILAVVideoSettings)
     QI2(ILAVVideoStatus)
+    QI2(ILAVVideoTelemetry)
+    QI2(ILAVVideoFrameSource)
+    QI2(ILAVVideoBatchDecoder)
+    QI(ILAVMemoryInfo)
     __super::NonDelegatingQueryInterface(riid, ppv);
 }
 
@@ -534,14 +679,17 @@ HRESULT CLAVVideo::DecideBufferSize(IMemAllocator* pAllocator, ALLOCATOR_PROPERT
 
   // try to honor the requested number of downstream buffers, but cap at the decoders maximum
   long decoderBuffersMax = LONG_MAX;
-  long decoderBuffs = m_Decoder.GetBufferCount(&decoderBuffersMax);
+  m_Decoder.GetBufferCount(&decoderBuffersMax);
+  long decoderBuffs = (long)GetPipelineDepth();
   long downstreamBuffers = pProperties->cBuffers;
-  pProperties->cBuffers = min(max(pProperties->cBuffers, 2) + decoderBuffs, decoderBuffersMax);
+  // frames waiting in the output queue hold on to their buffers until the renderer received them
+  long queueBuffs = (long)GetOutputQueueDepth();
+  pProperties->cBuffers = min(max(pProperties->cBuffers, 2) + decoderBuffs + queueBuffs, decoderBuffersMax);
   pProperties->cbBuffer = pBIH ? pBIH->biSizeImage : 3110400;
   pProperties->cbAlign  = 1;
   pProperties->cbPrefix = 0;
 
-  DbgLog((LOG_TRACE, 10, L" -> Downstream wants %d buffers, decoder wants %d, for a total of: %d", downstreamBuffers, decoderBuffs, pProperties->cBuffers));
+  DbgLog((LOG_TRACE, 10, L" -> Downstream wants %d buffers, decoder wants %d, output queue wants %d, for a total of: %d", downstreamBuffers, decoderBuffs, queueBuffs, pProperties->cBuffers));
 
   HRESULT hr;
   ALLOCATOR_PROPERTIES Actual;
@@ -579,9 +727,7 @@ HRESULT CLAVVideo::GetMediaType(int iPosition, CMediaType *pMediaType)
 
   // Adjust for deinterlacing
   if (m_Decoder.IsInterlaced(FALSE) && m_settings.DeintMode != DeintMode_Disable) {
-    BOOL bFramePerField = (m_settings.SWDeintMode == SWDeintMode_YADIF && m_settings.SWDeintOutput == DeintOutput_FramePerField)
-                        || m_settings.SWDeintMode == SWDeintMode_W3FDIF_Simple || m_settings.SWDeintMode == SWDeintMode_W3FDIF_Complex;
-    if (bFramePerField)
+    if (IsSWDeintFramePerField())
       rtAvgTime /= 2;
   }
 
@@ -605,6 +751,20 @@ HRESULT CLAVVideo::CreateDecoder(const CMediaType *pmt)
   DbgLog((LOG_TRACE, 10, L"::CreateDecoder(): Creating new decoder..."));
   HRESULT hr = S_OK;
 
+  // Frames still waiting for delivery belong to the old decoder
+  WaitForDeliveryIdle();
+
+  // Start every new stream with the best automatic deinterlacing quality
+  m_SWDeintAutoLevel = SWDeintAuto_BWDIF;
+  m_rtFilterCost = m_rtFilterBudget = 0;
+  m_nFilterCostFrames = m_nFilterHoldWindows = 0;
+  m_nFilterHoldPeriod = LAV_SWDEINT_AUTO_HOLD_MIN;
+
+  // .. and at full decoding quality
+  m_nPerfLevel = PerfLevel_Full;
+  m_rtPerfLevelChange = m_rtPerfLastLate = AV_NOPTS_VALUE;
+  m_bQualityBehind = FALSE;
+
   AVCodecID codec = FindCodecId(pmt);
   if (codec == AV_CODEC_ID_NONE) {
     return VFW_E_TYPE_NOT_ACCEPTED;
@@ -731,6 +891,17 @@ HRESULT CLAVVideo::CreateDecoder(const CMediaType *pmt)
     m_dwDecodeFlags |= LAV_VIDEO_DEC_FLAG_SAGE_HACK;
   if (m_LAVPinInfoValid && (m_LAVPinInfo.flags & LAV_STREAM_FLAG_LIVE))
     m_dwDecodeFlags |= LAV_VIDEO_DEC_FLAG_LIVE;
+  // frames can only leave the decoder right away if none of them are re-ordered
+  if (m_settings.bLowDelay && (m_dwDecodeFlags & LAV_VIDEO_DEC_FLAG_LIVE) && m_LAVPinInfo.has_b_frames == 0)
+    m_dwDecodeFlags |= LAV_VIDEO_DEC_FLAG_LOW_DELAY;
+
+  m_WorkerBudget.SetPriority((m_dwDecodeFlags & LAV_VIDEO_DEC_FLAG_LIVE) ? WorkerPriority_High : WorkerPriority_Normal);
+
+  if (m_settings.NUMANode != m_dwNUMAPlacementSetting) {
+    m_dwNUMAPlacementSetting = m_settings.NUMANode;
+    m_nNUMAPlacement = numa_select_node(m_dwNUMAPlacementSetting);
+    DbgLog((LOG_TRACE, 10, L"-> Decoder placed on NUMA node %d", m_nNUMAPlacement));
+  }
 
   SAFE_CO_FREE(pszExtension);
 
@@ -770,15 +941,21 @@ HRESULT CLAVVideo::CheckDirectMode()
   int bpp;
   m_Decoder.GetPixelFormat(&pix, &bpp);
 
+  const GUID &subtype = m_pOutput->CurrentMediaType().subtype;
+  const BOOL bRGBOutput = (subtype == MEDIASUBTYPE_RGB32 || subtype == MEDIASUBTYPE_RGB24);
+
+  // RGB and YUY2 are converted through a staging buffer, if the converter can't do that the frame is copied back first
   BOOL bDirect = (pix == LAVPixFmt_NV12 || pix == LAVPixFmt_P016);
   if (pix == LAVPixFmt_NV12 && m_Decoder.IsInterlaced(FALSE) && m_settings.SWDeintMode != SWDeintMode_None)
     bDirect = FALSE;
-  else if (pix == LAVPixFmt_NV12 && m_pOutput->CurrentMediaType().subtype != MEDIASUBTYPE_NV12 && m_pOutput->CurrentMediaType().subtype != MEDIASUBTYPE_YV12)
+  else if (pix == LAVPixFmt_NV12 && subtype != MEDIASUBTYPE_NV12 && subtype != MEDIASUBTYPE_YV12 && subtype != MEDIASUBTYPE_YUY2 && subtype != MEDIASUBTYPE_UYVY && !bRGBOutput)
     bDirect = FALSE;
-  else if (pix == LAVPixFmt_P016 && m_pOutput->CurrentMediaType().subtype != MEDIASUBTYPE_P010 && m_pOutput->CurrentMediaType().subtype != MEDIASUBTYPE_P016 && m_pOutput->CurrentMediaType().subtype != MEDIASUBTYPE_NV12)
+  else if (pix == LAVPixFmt_P016 && subtype != MEDIASUBTYPE_P010 && subtype != MEDIASUBTYPE_P016 && subtype != MEDIASUBTYPE_NV12 && !bRGBOutput)
     bDirect = FALSE;
   else if (m_SubtitleConsumer && m_SubtitleConsumer->HasProvider())
     bDirect = FALSE;
+  else if (m_settings.bAsyncDelivery && !(m_dwDecodeFlags & LAV_VIDEO_DEC_FLAG_DVD))
+    bDirect = FALSE;
 
   m_Decoder.SetDirectOutput(bDirect);
 
@@ -807,10 +984,13 @@ HRESULT CLAVVideo::EndOfStream()
   CAutoLock cAutoLock(&m_csReceive);
 
   m_Decoder.EndOfStream();
+  WaitForDeliveryIdle();
   Filter(GetFlushFrame());
 
-  if (m_pCCOutputPin)
+  if (m_pCCOutputPin) {
+    m_pCCOutputPin->DeliverPendingCCData();
     m_pCCOutputPin->DeliverEndOfStream();
+  }
 
   DbgLog((LOG_TRACE, 1, L"EndOfStream finished, decoder flushed"));
   return __super::EndOfStream();
@@ -822,6 +1002,7 @@ HRESULT CLAVVideo::EndOfSegment()
   CAutoLock cAutoLock(&m_csReceive);
 
   m_Decoder.EndOfStream();
+  WaitForDeliveryIdle();
   Filter(GetFlushFrame());
 
   // Forward the EndOfSegment call downstream
@@ -845,8 +1026,16 @@ HRESULT CLAVVideo::BeginFlush()
   DbgLog((LOG_TRACE, 1, L"::BeginFlush"));
   m_bFlushing = TRUE;
 
-  if (m_pCCOutputPin)
+  // Wake up the streaming thread if it's waiting for space in the delivery queue
+  m_evDeliveryQueueSpace.Set();
+
+  // the renderer gets all its samples back while flushing
+  m_SamplePrefetch.Reset();
+
+  if (m_pCCOutputPin) {
+    m_pCCOutputPin->ClearPendingCCData();
     m_pCCOutputPin->DeliverBeginFlush();
+  }
 
   return __super::BeginFlush();
 }
@@ -856,6 +1045,13 @@ HRESULT CLAVVideo::EndFlush()
   DbgLog((LOG_TRACE, 1, L"::EndFlush"));
   CAutoLock cAutoLock(&m_csReceive);
 
+  // The delivery thread drops all frames while flushing
+  WaitForDeliveryIdle();
+  m_hrDeliver = S_OK;
+
+  ResetDirectRendering();
+  m_SamplePrefetch.Reset();
+
   ReleaseLastSequenceFrame();
 
   if (m_dwDecodeFlags & LAV_VIDEO_DEC_FLAG_DVD) {
@@ -873,6 +1069,8 @@ HRESULT CLAVVideo::EndFlush()
 
 HRESULT CLAVVideo::ReleaseLastSequenceFrame()
 {
+  CAutoLock lock(&m_csDeliver);
+
   // Release DXVA2 frames hold in the last sequence frame
   if (m_pLastSequenceFrame && m_pLastSequenceFrame->format == LAVPixFmt_DXVA2) {
     IMediaSample *pSample = (IMediaSample *)m_pLastSequenceFrame->data[0];
@@ -886,6 +1084,9 @@ HRESULT CLAVVideo::ReleaseLastSequenceFrame()
   }
   ReleaseFrame(&m_pLastSequenceFrame);
 
+  av_freep(&m_pStillOutput);
+  m_lStillOutputSize = m_lStillOutputLength = 0;
+
   return S_OK;
 }
 
@@ -893,8 +1094,11 @@ HRESULT CLAVVideo::PerformFlush()
 {
   CAutoLock cAutoLock(&m_csReceive);
 
+  WaitForDeliveryIdle();
+
   ReleaseLastSequenceFrame();
   m_Decoder.Flush();
+  ClearCaptureTimes();
 
   m_bInDVDMenu = FALSE;
 
@@ -913,12 +1117,74 @@ HRESULT CLAVVideo::NewSegment(REFERENCE_TIME tStart, REFERENCE_TIME tStop, doubl
 
   PerformFlush();
 
+  // LAV Splitter switches to keyframe-only delivery at high rates
+  m_bTrickPlay = (m_dwDecodeFlags & LAV_VIDEO_DEC_FLAG_LAVSPLITTER) && dRate >= LAV_TRICKPLAY_RATE;
+
+  // Quality timestamps restart with the segment, the performance level is kept
+  m_rtPerfLevelChange = m_rtPerfLastLate = AV_NOPTS_VALUE;
+  m_bQualityBehind = FALSE;
+
   if (m_pCCOutputPin)
     m_pCCOutputPin->DeliverNewSegment(tStart, tStop, dRate);
 
   return __super::NewSegment(tStart, tStop, dRate);
 }
 
+HRESULT CLAVVideo::AlterQuality(Quality q)
+{
+  if (q.Late > 0)
+    m_Telemetry.AddLateFrame();
+
+  // Without a performance mode, the quality messages are passed upstream
+  if (m_settings.PerformanceMode == PerfMode_Off)
+    return S_FALSE;
+
+  m_bQualityBehind = (q.Late > LAV_PERF_LATE);
+  UpdatePerformanceLevel(q);
+  return S_OK;
+}
+
+BOOL CLAVVideo::IsFrameLate(const LAVFrame *pFrame)
+{
+  if (!m_bQualityBehind || m_settings.PerformanceMode == PerfMode_Off || m_bTrickPlay || m_bInDVDMenu || (pFrame->flags & LAV_FRAME_FLAG_REDRAW))
+    return FALSE;
+
+  if (m_State != State_Running || m_pClock == nullptr || pFrame->rtStart == AV_NOPTS_VALUE)
+    return FALSE;
+
+  REFERENCE_TIME rtStop = pFrame->rtStop;
+  if (rtStop == AV_NOPTS_VALUE || rtStop <= pFrame->rtStart)
+    rtStop = pFrame->rtStart + (pFrame->avgFrameDuration > 0 ? pFrame->avgFrameDuration : 1);
+
+  // the frame is late if its display time has already passed
+  REFERENCE_TIME rtClock = 0;
+  if (FAILED(m_pClock->GetTime(&rtClock)))
+    return FALSE;
+
+  return rtStop < (rtClock - m_tStart);
+}
+
+void CLAVVideo::UpdatePerformanceLevel(const Quality &q)
+{
+  const BOOL bLate = (q.Late > LAV_PERF_LATE);
+  if (bLate)
+    m_rtPerfLastLate = q.TimeStamp;
+
+  // Give every level some time to show an effect before changing it again
+  if (m_rtPerfLevelChange != AV_NOPTS_VALUE && q.TimeStamp >= m_rtPerfLevelChange && q.TimeStamp - m_rtPerfLevelChange < LAV_PERF_STEP)
+    return;
+
+  if (bLate && m_nPerfLevel < PerfLevel_NB - 1) {
+    m_nPerfLevel++;
+    m_rtPerfLevelChange = q.TimeStamp;
+    DbgLog((LOG_TRACE, 10, L"::UpdatePerformanceLevel(): Frame late by %I64d, stepping down to level %d", q.Late, m_nPerfLevel));
+  } else if (!bLate && m_nPerfLevel > PerfLevel_Full && (m_rtPerfLastLate == AV_NOPTS_VALUE || q.TimeStamp < m_rtPerfLastLate || q.TimeStamp - m_rtPerfLastLate > LAV_PERF_RECOVER)) {
+    m_nPerfLevel--;
+    m_rtPerfLevelChange = q.TimeStamp;
+    DbgLog((LOG_TRACE, 10, L"::UpdatePerformanceLevel(): Caught up, stepping up to level %d", m_nPerfLevel));
+  }
+}
+
 HRESULT CLAVVideo::CheckConnect(PIN_DIRECTION dir, IPin *pPin)
 {
   if (dir == PINDIR_INPUT) {
@@ -956,11 +1222,16 @@ HRESULT CLAVVideo::BreakConnect(PIN_DIRECTION dir)
       avfilter_graph_free(&m_pFilterGraph);
 
     m_Decoder.Close();
+    m_Telemetry.SetHWDecoderActive(FALSE);
     m_X264Build = -1;
+    m_bIdleReleased = FALSE;
   }
   else if (dir == PINDIR_OUTPUT)
   {
     m_Decoder.BreakConnect();
+    ResetDirectRendering();
+    m_SamplePrefetch.Reset();
+    m_OutputTypeCache.clear();
   }
   return __super::BreakConnect(dir);
 }
@@ -970,6 +1241,8 @@ HRESULT CLAVVideo::CompleteConnect(PIN_DIRECTION dir, IPin *pReceivePin)
   DbgLog((LOG_TRACE, 10, L"::CompleteConnect"));
   HRESULT hr = S_OK;
   if (dir == PINDIR_OUTPUT) {
+    m_OutputTypeCache.clear();
+
     BOOL bFailNonDXVA = false;
     // Fail P010 software connections before Windows 10 Creators Update (presumably it was fixed before Creators already, but this is definitely a safe known condition)
     if (!IsWindows10BuildOrNewer(15063) && (m_pOutput->CurrentMediaType().subtype == MEDIASUBTYPE_P010 || m_pOutput->CurrentMediaType().subtype == MEDIASUBTYPE_P016)) {
@@ -1064,9 +1337,55 @@ HRESULT CLAVVideo::StartStreaming()
     }
   }
 
+  // DVD playback relies on synchronous delivery for menus and still frames
+  m_bAsyncDelivery = m_settings.bAsyncDelivery && !(m_dwDecodeFlags & LAV_VIDEO_DEC_FLAG_DVD);
+  m_hrDeliver = S_OK;
+  m_evDeliveryIdle.Set();
+
+  // the decoder was released while the graph was stopped
+  if (m_bIdleReleased) {
+    m_bIdleReleased = FALSE;
+    HRESULT hr = CreateDecoder(&m_pInput->CurrentMediaType());
+    if (SUCCEEDED(hr) && m_pOutput->IsConnected())
+      hr = m_Decoder.PostConnect(m_pOutput->GetConnected());
+    DbgLog((LOG_TRACE, 10, L"CLAVVideo::StartStreaming(): Re-created the decoder released while idle (hr: 0x%x)", hr));
+    if (FAILED(hr))
+      return hr;
+  }
+
+  if (m_bAsyncDelivery && !ThreadExists()) {
+    if (!Create()) {
+      DbgLog((LOG_ERROR, 10, L"CLAVVideo::StartStreaming(): Creating the delivery thread failed, delivering synchronously"));
+      m_bAsyncDelivery = FALSE;
+    }
+  }
+
+  // the output queue is created when the output pin is activated, right after this
+  static_cast<CQueuedOutputPin *>(m_pOutput)->SetOutputQueue(GetOutputQueueDepth(), m_settings.OutputQueueBatch);
+
+  // holding a sample in advance takes one from the renderer, which low footprint mode avoids
+  if (!m_settings.bLowFootprint)
+    m_SamplePrefetch.Start(m_pOutput);
+
   return S_OK;
 }
 
+HRESULT CLAVVideo::StopStreaming()
+{
+  // Called with the receive lock held, after the output allocator was decommitted
+  if (ThreadExists()) {
+    CallWorker(CMD_EXIT);
+    Close();
+  }
+
+  ClearDeliveryQueue();
+  m_bAsyncDelivery = FALSE;
+  ResetDirectRendering();
+  m_SamplePrefetch.Stop();
+
+  return __super::StopStreaming();
+}
+
 STDMETHODIMP CLAVVideo::Stop()
 {
   // Get the receiver lock and prevent frame delivery
@@ -1080,9 +1399,86 @@ STDMETHODIMP CLAVVideo::Stop()
 
   // unblock delivery again, if we continue receiving frames
   m_bFlushing = FALSE;
+
+  ScheduleIdleRelease();
+  return hr;
+}
+
+STDMETHODIMP CLAVVideo::Pause()
+{
+  CancelIdleRelease();
+
+  HRESULT hr = __super::Pause();
+  if (SUCCEEDED(hr))
+    ScheduleIdleRelease();
   return hr;
 }
 
+STDMETHODIMP CLAVVideo::Run(REFERENCE_TIME tStart)
+{
+  CancelIdleRelease();
+  return __super::Run(tStart);
+}
+
+void CLAVVideo::ScheduleIdleRelease()
+{
+  CancelIdleRelease();
+  if (m_settings.IdleReleaseTime == 0)
+    return;
+
+  if (!CreateTimerQueueTimer(&m_hIdleTimer, nullptr, IdleReleaseTimerProc, this, m_settings.IdleReleaseTime, 0, WT_EXECUTEONLYONCE)) {
+    DbgLog((LOG_ERROR, 10, L"CLAVVideo::ScheduleIdleRelease(): Creating the timer failed (%u)", GetLastError()));
+    m_hIdleTimer = nullptr;
+  }
+}
+
+void CLAVVideo::CancelIdleRelease()
+{
+  if (m_hIdleTimer) {
+    // waits for a release which is already running
+    DeleteTimerQueueTimer(nullptr, m_hIdleTimer, INVALID_HANDLE_VALUE);
+    m_hIdleTimer = nullptr;
+  }
+}
+
+VOID CALLBACK CLAVVideo::IdleReleaseTimerProc(PVOID lpParameter, BOOLEAN TimerOrWaitFired)
+{
+  static_cast<CLAVVideo *>(lpParameter)->ReleaseIdleResources();
+}
+
+void CLAVVideo::ReleaseIdleResources()
+{
+  // the state can't change during the release, the filter lock comes before the receive lock
+  CAutoLock lock(&m_csFilter);
+  if (m_State == State_Running)
+    return;
+
+  DbgLog((LOG_TRACE, 10, L"CLAVVideo::ReleaseIdleResources(): Filter was idle for %u ms, releasing resources (%s)", m_settings.IdleReleaseTime, m_State == State_Stopped ? L"stopped" : L"paused"));
+
+  // While stopped, the allocator is decommitted and nothing is in flight, the decoder can go with all of its surfaces
+  // Native decoders are kept, their surfaces belong to the allocator of the renderer and are already released,
+  // and the decoder is tied to that allocator for as long as the pins are connected.
+  if (m_State == State_Stopped && m_pInput->IsConnected()) {
+    CAutoLock lck(&m_csReceive);
+    if (!m_bIdleReleased && m_Decoder.GetDecoderName() && !m_Decoder.IsNativeDecoderActive()) {
+      ReleaseLastSequenceFrame();
+      m_Decoder.Close();
+      m_Telemetry.SetHWDecoderActive(FALSE);
+      m_bIdleReleased = TRUE;
+    }
+  }
+
+  // Frames released by now are not needed to resume, which leaves only the unused buffers
+  // The buffer pool is shared by all decoders of the process, others refill it as they need.
+  {
+    CAutoLock lck(&m_csFramePool);
+    for (LAVFrame *pFrame : m_FramePool)
+      CoTaskMemFree(pFrame);
+    m_FramePool.clear();
+  }
+  ReleaseLAVFrameBufferPool();
+}
+
 HRESULT CLAVVideo::GetDeliveryBuffer(IMediaSample** ppOut, int width, int height, AVRational ar, DXVA2_ExtendedFormat dxvaExtFlags, REFERENCE_TIME avgFrameDuration)
 {
   CheckPointer(ppOut, E_POINTER);
@@ -1093,8 +1489,25 @@ HRESULT CLAVVideo::GetDeliveryBuffer(IMediaSample** ppOut, int width, int height
     return hr;
   }
 
-  if(FAILED(hr = m_pOutput->GetDeliveryBuffer(ppOut, nullptr, nullptr, 0))) {
-    return hr;
+  // A sample the decoder fetched for direct rendering carries a media type change, and is used first
+  {
+    CAutoLock lock(&m_csDirectRendering);
+    *ppOut = m_pDirectRenderingSample;
+    m_pDirectRenderingSample = nullptr;
+  }
+
+  if (*ppOut == nullptr) {
+    REFERENCE_TIME rtWaitStart = timer_get_ref_time();
+    *ppOut = m_SamplePrefetch.Take();
+    if (*ppOut == nullptr)
+      hr = m_pOutput->GetDeliveryBuffer(ppOut, nullptr, nullptr, 0);
+    m_Telemetry.AddSample(VideoStage_DeliveryBuffer, timer_get_ref_time() - rtWaitStart);
+    if(FAILED(hr)) {
+      return hr;
+    }
+
+    // the sample for the next frame is acquired while this one is converted
+    m_SamplePrefetch.Request();
   }
 
   CheckPointer(*ppOut, E_UNEXPECTED);
@@ -1157,6 +1570,49 @@ HRESULT CLAVVideo::GetDeliveryBuffer(IMediaSample** ppOut, int width, int height
   return S_OK;
 }
 
+// Find the type the renderer negotiated for a proposed output type before
+// The cached type is only returned if the samples of the current allocator are large enough for it.
+const CMediaType *CLAVVideo::GetCachedOutputType(const CMediaType &mt)
+{
+  for (const auto &entry : m_OutputTypeCache) {
+    if (entry.first != mt)
+      continue;
+
+    BITMAPINFOHEADER *pBIH = nullptr;
+    videoFormatTypeHandler(entry.second.Format(), entry.second.FormatType(), &pBIH);
+    if (!pBIH)
+      return nullptr;
+
+    BOOL bFits = FALSE;
+    IMemInputPin *pMemPin = nullptr;
+    if (SUCCEEDED(m_pOutput->GetConnected()->QueryInterface<IMemInputPin>(&pMemPin)) && pMemPin) {
+      IMemAllocator *pMemAllocator = nullptr;
+      ALLOCATOR_PROPERTIES props;
+      if (SUCCEEDED(pMemPin->GetAllocator(&pMemAllocator)) && pMemAllocator && SUCCEEDED(pMemAllocator->GetProperties(&props)))
+        bFits = (props.cbBuffer > 0 && (DWORD)props.cbBuffer >= pBIH->biSizeImage);
+      SafeRelease(&pMemAllocator);
+    }
+    SafeRelease(&pMemPin);
+
+    return bFits ? &entry.second : nullptr;
+  }
+  return nullptr;
+}
+
+void CLAVVideo::CacheOutputType(const CMediaType &mt, const CMediaType &negotiated)
+{
+  for (auto it = m_OutputTypeCache.begin(); it != m_OutputTypeCache.end(); it++) {
+    if (it->first == mt) {
+      m_OutputTypeCache.erase(it);
+      break;
+    }
+  }
+
+  if (m_OutputTypeCache.size() >= LAV_OUTPUT_TYPE_CACHE)
+    m_OutputTypeCache.erase(m_OutputTypeCache.begin());
+  m_OutputTypeCache.emplace_back(mt, negotiated);
+}
+
 HRESULT CLAVVideo::ReconnectOutput(int width, int height, AVRational ar, DXVA2_ExtendedFormat dxvaExtFlags, REFERENCE_TIME avgFrameDuration, BOOL bDXVA)
 {
   CMediaType mt = m_pOutput->CurrentMediaType();
@@ -1259,6 +1715,8 @@ HRESULT CLAVVideo::ReconnectOutput(int width, int height, AVRational ar, DXVA2_E
 
   if (bNeedReconnect) {
     DbgLog((LOG_TRACE, 10, L"::ReconnectOutput(): Performing reconnect"));
+    ResetDirectRendering();
+    m_SamplePrefetch.Reset();
     BITMAPINFOHEADER *pBIH = nullptr;
     if (mt.formattype == FORMAT_VideoInfo) {
       VIDEOINFOHEADER *vih = (VIDEOINFOHEADER *)mt.Format();
@@ -1317,11 +1775,25 @@ HRESULT CLAVVideo::ReconnectOutput(int width, int height, AVRational ar, DXVA2_E
       pBIH->biWidth = FFALIGN(width, 48);
     }
 
+    // A format negotiated before on this connection is sent in-band with the next sample,
+    // so streams switching back and forth between resolutions don't go through a reconnect every time
+    const CMediaType mtProposed = mt;
+    const CMediaType *pCachedMt = bDXVA ? nullptr : GetCachedOutputType(mt);
+    if (pCachedMt) {
+      DbgLog((LOG_TRACE, 10, L"-> Re-using the previously negotiated media type"));
+      m_pOutput->SetMediaType(pCachedMt);
+      m_bSendMediaType = TRUE;
+      NotifyEvent(EC_VIDEO_SIZE_CHANGED, MAKELPARAM(width, height), 0);
+      return S_OK;
+    }
+
     HRESULT hrQA = m_pOutput->GetConnected()->QueryAccept(&mt);
     if (bDXVA) {
       m_bSendMediaType = TRUE;
       m_pOutput->SetMediaType(&mt);
     } else {
+      // the renderer can only accept a new format once all samples were returned
+      static_cast<CQueuedOutputPin *>(m_pOutput)->WaitForQueueIdle(LAV_OUTPUT_QUEUE_IDLE_TIMEOUT);
 receiveconnection:
       hr = m_pOutput->GetConnected()->ReceiveConnection(m_pOutput, &mt);
       if(SUCCEEDED(hr)) {
@@ -1348,6 +1820,7 @@ receiveconnection:
             }
             // Store media type
             m_pOutput->SetMediaType(&newmt);
+            CacheOutputType(mtProposed, newmt);
             m_bSendMediaType = TRUE;
             if (newmt.formattype == FORMAT_VideoInfo2 && mt.formattype == FORMAT_VideoInfo2 && m_bDXVAExtFormatSupport) {
               VIDEOINFOHEADER2 *vih2New = (VIDEOINFOHEADER2 *)newmt.pbFormat;
@@ -1367,6 +1840,7 @@ receiveconnection:
             DbgLog((LOG_TRACE, 10, L"-> We did not get a stride request, using width %d for stride", pBIH->biWidth));
             m_bSendMediaType = TRUE;
             m_pOutput->SetMediaType(&mt);
+            CacheOutputType(mtProposed, mt);
           }
           pOut->Release();
         }
@@ -1410,6 +1884,7 @@ receiveconnection:
         }
         m_pOutput->SetMediaType(&mt);
         m_bSendMediaType = TRUE;
+        CacheOutputType(mtProposed, mt);
       } else {
         DbgLog((LOG_TRACE, 10, L"-> Receive Connection failed (hr: %x); QueryAccept: %x", hr, hrQA));
       }
@@ -1436,6 +1911,8 @@ HRESULT CLAVVideo::NegotiatePixelFormat(CMediaType &outMt, int width, int height
   BOOL bVIH1 = (outMt.formattype == FORMAT_VideoInfo);
   videoFormatTypeHandler(outMt.Format(), outMt.FormatType(), nullptr, &rtAvg, &dwAspectX, &dwAspectY);
 
+  static_cast<CQueuedOutputPin *>(m_pOutput)->WaitForQueueIdle(LAV_OUTPUT_QUEUE_IDLE_TIMEOUT);
+
   CMediaType mt;
   for (i = 0; i < m_PixFmtConverter.GetNumMediaTypes(); ++i) {
     m_PixFmtConverter.GetMediaType(&mt, i, width, height, dwAspectX, dwAspectY, rtAvg, IsInterlacedOutput(), bVIH1);
@@ -1475,6 +1952,9 @@ HRESULT CLAVVideo::Receive(IMediaSample *pIn)
   CAutoLock cAutoLock(&m_csReceive);
   HRESULT        hr = S_OK;
 
+  // frames are decoded on the thread delivering the samples, and their buffers allocated from its node
+  numa_bind_thread(m_nNUMAPlacement);
+
   AM_SAMPLE2_PROPERTIES const *pProps = m_pInput->SampleProps();
   if(pProps->dwStreamId != AM_STREAM_MEDIA) {
     return m_pOutput->Deliver(pIn);
@@ -1495,17 +1975,38 @@ HRESULT CLAVVideo::Receive(IMediaSample *pIn)
     }
   }
 
-  m_hrDeliver = S_OK;
+  // In asynchronous mode, delivery errors are reported by the delivery thread and stay until the next flush
+  if (!m_bAsyncDelivery)
+    m_hrDeliver = S_OK;
 
   // Skip over empty packets
   if (pIn->GetActualDataLength() == 0) {
     return S_OK;
   }
 
+  // Delivery and GPU copy-back are timed separately, and not counted as decoding time
+  m_rtDecodeExcluded = 0;
+  StoreCaptureTime(pIn);
+  LAV_TRACE("VideoDecodeBegin", LAV_TRACE_KEYWORD_VIDEO,
+            TraceLoggingInt64((pProps->dwSampleFlags & AM_SAMPLE_TIMEVALID) ? pProps->tStart : AV_NOPTS_VALUE, "Start"),
+            TraceLoggingInt32(pIn->GetActualDataLength(), "Size"),
+            TraceLoggingBool(pIn->IsSyncPoint() == S_OK, "SyncPoint"));
+  REFERENCE_TIME rtDecodeStart = timer_get_ref_time();
   hr = m_Decoder.Decode(pIn);
+  m_Telemetry.AddSample(VideoStage_Decode, timer_get_ref_time() - rtDecodeStart - m_rtDecodeExcluded);
+  LAV_TRACE("VideoDecodeEnd", LAV_TRACE_KEYWORD_VIDEO,
+            TraceLoggingInt64(m_rtDecodeExcluded, "ExcludedTime"),
+            TraceLoggingHResult(hr, "Result"));
   if (FAILED(hr))
     return hr;
 
+  // Keyframes in trick-play are not followed by any frames depending on them,
+  // drain the decoder to output them right away instead of waiting for the reorder delay
+  if (m_bTrickPlay && pIn->IsSyncPoint() == S_OK) {
+    m_Decoder.EndOfStream();
+    m_Decoder.Flush();
+  }
+
   if (FAILED(m_hrDeliver))
     return m_hrDeliver;
 
@@ -1517,9 +2018,21 @@ STDMETHODIMP CLAVVideo::AllocateFrame(LAVFrame **ppFrame)
 {
   CheckPointer(ppFrame, E_POINTER);
 
-  *ppFrame = (LAVFrame *)CoTaskMemAlloc(sizeof(LAVFrame));
+  // Re-use a previously released frame, if possible
+  *ppFrame = nullptr;
+  {
+    CAutoLock lock(&m_csFramePool);
+    if (!m_FramePool.empty()) {
+      *ppFrame = m_FramePool.back();
+      m_FramePool.pop_back();
+    }
+  }
+
   if (!*ppFrame) {
-    return E_OUTOFMEMORY;
+    *ppFrame = (LAVFrame *)CoTaskMemAlloc(sizeof(LAVFrame));
+    if (!*ppFrame) {
+      return E_OUTOFMEMORY;
+    }
   }
 
   // Initialize with zero
@@ -1533,6 +2046,8 @@ STDMETHODIMP CLAVVideo::AllocateFrame(LAVFrame **ppFrame)
 
   (*ppFrame)->frame_type = '?';
 
+  (*ppFrame)->memory_account = m_pMemoryAccount;
+
   return S_OK;
 }
 
@@ -1543,7 +2058,15 @@ STDMETHODIMP CLAVVideo::ReleaseFrame(LAVFrame **ppFrame)
   // Allow *ppFrame to be NULL already
   if (*ppFrame) {
     FreeLAVFrameBuffers(*ppFrame);
-    SAFE_CO_FREE(*ppFrame);
+
+    // Keep the frame around for re-use in AllocateFrame
+    CAutoLock lock(&m_csFramePool);
+    if (m_FramePool.size() < LAV_FRAME_POOL_SIZE) {
+      m_FramePool.push_back(*ppFrame);
+      *ppFrame = nullptr;
+    } else {
+      SAFE_CO_FREE(*ppFrame);
+    }
   }
   return S_OK;
 }
@@ -1560,6 +2083,7 @@ HRESULT CLAVVideo::DeDirectFrame(LAVFrame *pFrame, bool bDisableDirectMode)
   LAVFrame tmpFrame     = *pFrame;
   pFrame->destruct      = nullptr;
   pFrame->priv_data     = nullptr;
+  pFrame->dr_sample     = nullptr;
   pFrame->direct        = false;
   pFrame->direct_lock   = nullptr;
   pFrame->direct_unlock = nullptr;
@@ -1601,6 +2125,118 @@ HRESULT CLAVVideo::DeDirectFrame(LAVFrame *pFrame, bool bDisableDirectMode)
   return S_OK;
 }
 
+// Publish the layout of the output samples, for the decoder to decode frames straight into them
+void CLAVVideo::UpdateDirectRenderingLayout(LAVFrame *pFrame, int width, int height, const BITMAPINFOHEADER *pBIH)
+{
+  // Frames are only delivered as-is, if nothing modifies or re-formats them on the way
+  BOOL bValid = m_settings.bDirectRendering && !m_FrameScaler.IsActive() && !m_pFilterGraph && !(m_SubtitleConsumer && m_SubtitleConsumer->HasProvider())
+             && !(pFrame->flags & LAV_FRAME_FLAG_MVC) && pFrame->width == width && pFrame->height == height
+             && CLAVPixFmtConverter::IsIdentityFormat(m_PixFmtConverter.GetOutputPixFmt(), pFrame->format);
+
+  CAutoLock lock(&m_csDirectRendering);
+  m_DirectRenderingLayout.bValid = bValid;
+  if (bValid) {
+    m_DirectRenderingLayout.outFmt      = m_PixFmtConverter.GetOutputPixFmt();
+    m_DirectRenderingLayout.format      = pFrame->format;
+    m_DirectRenderingLayout.width       = width;
+    m_DirectRenderingLayout.height      = height;
+    m_DirectRenderingLayout.stride      = pBIH->biWidth;
+    m_DirectRenderingLayout.planeHeight = abs(pBIH->biHeight);
+    m_DirectRenderingLayout.lImageSize  = m_PixFmtConverter.GetImageSize(pBIH->biWidth, abs(pBIH->biHeight));
+  }
+}
+
+// Check if a frame decoded into an output sample still matches the current output format
+BOOL CLAVVideo::IsDirectRenderingFrame(LAVFrame *pFrame)
+{
+  BYTE *pData = nullptr;
+  if (FAILED(pFrame->dr_sample->GetPointer(&pData)) || pData == nullptr)
+    return FALSE;
+
+  CMediaType &mt = m_pOutput->CurrentMediaType();
+  BITMAPINFOHEADER *pBIH = nullptr;
+  videoFormatTypeHandler(mt.Format(), mt.FormatType(), &pBIH);
+  if (pBIH == nullptr || !CLAVPixFmtConverter::IsIdentityFormat(m_PixFmtConverter.GetOutputPixFmt(), pFrame->format))
+    return FALSE;
+
+  uint8_t *planes[4];
+  ptrdiff_t strides[4];
+  CLAVPixFmtConverter::GetIdentityOutputPlanes(m_PixFmtConverter.GetOutputPixFmt(), pFrame->format, pData, pBIH->biWidth, abs(pBIH->biHeight), planes, strides);
+  for (int i = 0; i < 4; i++) {
+    if (pFrame->data[i] != planes[i] || pFrame->stride[i] != strides[i])
+      return FALSE;
+  }
+
+  return TRUE;
+}
+
+void CLAVVideo::ResetDirectRendering()
+{
+  CAutoLock lock(&m_csDirectRendering);
+  m_DirectRenderingLayout.bValid = FALSE;
+  SafeRelease(&m_pDirectRenderingSample);
+}
+
+// Called by the decoder while decoding, on the thread delivering into the decoder
+STDMETHODIMP CLAVVideo::GetDirectRenderingBuffer(LAVPixelFormat format, int width, int height, int codedWidth, int codedHeight, int align, IMediaSample **ppSample, LAVDirectBuffer *pBuffer)
+{
+  CheckPointer(ppSample, E_POINTER);
+  CheckPointer(pBuffer, E_POINTER);
+  *ppSample = nullptr;
+
+  if (m_bFlushing || m_pThumbnailCallback || m_pFrameInfoCallback || m_bFrameSource)
+    return E_FAIL;
+
+  DirectRenderingLayout layout;
+  {
+    CAutoLock lock(&m_csDirectRendering);
+    layout = m_DirectRenderingLayout;
+    if (m_pDirectRenderingSample)
+      return E_FAIL;
+  }
+
+  // The decoder writes the whole coded area, which has to fit into the planes of the sample
+  if (!layout.bValid || layout.format != format || layout.width != width || layout.height != height || layout.stride < codedWidth || layout.planeHeight < FFALIGN(codedHeight, 2))
+    return E_FAIL;
+
+  // Never wait for a sample, the decoder may hold on to the ones that are still in flight
+  IMediaSample *pSample = nullptr;
+  HRESULT hr = m_pOutput->GetDeliveryBuffer(&pSample, nullptr, nullptr, AM_GBF_NOWAIT);
+  if (FAILED(hr) || pSample == nullptr)
+    return E_FAIL;
+
+  // A media type change has to be applied by the regular delivery, which uses this sample next
+  AM_MEDIA_TYPE *pmt = nullptr;
+  if (SUCCEEDED(pSample->GetMediaType(&pmt)) && pmt) {
+    DeleteMediaType(pmt);
+
+    CAutoLock lock(&m_csDirectRendering);
+    m_DirectRenderingLayout.bValid = FALSE;
+    if (m_pDirectRenderingSample == nullptr)
+      m_pDirectRenderingSample = pSample;
+    else
+      pSample->Release();
+    return E_FAIL;
+  }
+
+  BYTE *pData = nullptr;
+  if (FAILED(pSample->GetPointer(&pData)) || pData == nullptr || pSample->GetSize() < layout.lImageSize) {
+    pSample->Release();
+    return E_FAIL;
+  }
+
+  CLAVPixFmtConverter::GetIdentityOutputPlanes(layout.outFmt, format, pData, layout.stride, layout.planeHeight, pBuffer->data, pBuffer->stride);
+  for (int i = 0; i < 4; i++) {
+    if (((uintptr_t)pBuffer->data[i] | (uintptr_t)pBuffer->stride[i]) % align) {
+      pSample->Release();
+      return E_FAIL;
+    }
+  }
+
+  *ppSample = pSample;
+  return S_OK;
+}
+
 STDMETHODIMP_(LAVFrame*) CLAVVideo::GetFlushFrame()
 {
   LAVFrame *pFlushFrame = nullptr;
@@ -1613,54 +2249,237 @@ STDMETHODIMP_(LAVFrame*) CLAVVideo::GetFlushFrame()
 
 STDMETHODIMP CLAVVideo::Deliver(LAVFrame *pFrame)
 {
-  // Out-of-sequence flush event to get all frames delivered,
-  // only triggered by decoders when they are already "empty"
-  // so no need to flush the decoder here
-  if (pFrame->flags & LAV_FRAME_FLAG_FLUSH) {
-    DbgLog((LOG_TRACE, 10, L"Decoder triggered a flush..."));
-    Filter(GetFlushFrame());
+  HRESULT hr = S_OK;
+  REFERENCE_TIME rtDeliverStart = timer_get_ref_time();
 
+  // The software decoder which took over from a failed hardware decoder decodes the GOP again from its keyframe
+  if (m_Decoder.IsStandbyReplayFrame(pFrame)) {
     ReleaseFrame(&pFrame);
-    return S_FALSE;
+    return S_OK;
   }
 
-  if (m_bFlushing) {
-    ReleaseFrame(&pFrame);
-    return S_FALSE;
+  // Queue the frame for the delivery thread, if its buffers are not owned by the decoder
+  // Redraws of still images always come from the last sequence frame, which is stored during processing
+  if (m_bAsyncDelivery && !pFrame->direct && !(pFrame->flags & LAV_FRAME_FLAG_REDRAW) && m_Decoder.HasThreadSafeBuffers() == S_OK) {
+    hr = QueueFrame(pFrame);
+  } else {
+    WaitForDeliveryIdle();
+
+    CAutoLock lock(&m_csDeliver);
+    hr = ProcessFrame(pFrame);
   }
 
-  if (pFrame->rtStart == AV_NOPTS_VALUE) {
-    pFrame->rtStart = m_rtPrevStop;
-    pFrame->rtStop = AV_NOPTS_VALUE;
+  m_rtDecodeExcluded += timer_get_ref_time() - rtDeliverStart;
+  return hr;
+}
+
+// Remember the capture time of the source data of the sample, if the splitter provides it
+void CLAVVideo::StoreCaptureTime(IMediaSample *pIn)
+{
+  IMediaSideData *pSideData = nullptr;
+  if (FAILED(pIn->QueryInterface(&pSideData)))
+    return;
+
+  const MediaSideDataCaptureTime *pCapture = nullptr;
+  size_t size = 0;
+  REFERENCE_TIME rtStart = AV_NOPTS_VALUE, rtStop = AV_NOPTS_VALUE;
+  if (SUCCEEDED(pSideData->GetSideData(IID_MediaSideDataCaptureTime, (const BYTE **)&pCapture, &size)) && size == sizeof(MediaSideDataCaptureTime)
+    && SUCCEEDED(pIn->GetTime(&rtStart, &rtStop))) {
+    CAutoLock lock(&m_csCaptureTimes);
+    m_CaptureTimes[m_nCaptureTimeNext].rtStart = rtStart;
+    m_CaptureTimes[m_nCaptureTimeNext].rtCapture = pCapture->rtCapture;
+    m_nCaptureTimeNext = (m_nCaptureTimeNext + 1) % LAV_CAPTURE_TIME_ENTRIES;
+    m_nCaptureTimes = min(m_nCaptureTimes + 1, LAV_CAPTURE_TIME_ENTRIES);
   }
 
-  if (pFrame->rtStop == AV_NOPTS_VALUE) {
-    REFERENCE_TIME duration = 0;
+  SafeRelease(&pSideData);
+}
 
-    CMediaType &mt = m_pOutput->CurrentMediaType();
-    videoFormatTypeHandler(mt.Format(), mt.FormatType(), nullptr, &duration, nullptr, nullptr);
+// Attach the capture time of the input sample the frame was decoded from, and return it
+// Frames are matched by their start time, frames without an exact match (ie. the second field of deinterlaced frames)
+// get the capture time of the closest earlier sample.
+REFERENCE_TIME CLAVVideo::SetFrameCaptureTime(LAVFrame *pFrame)
+{
+  if (pFrame->rtStart == AV_NOPTS_VALUE)
+    return AV_NOPTS_VALUE;
 
-    REFERENCE_TIME decoderDuration = m_Decoder.GetFrameDuration();
-    if (pFrame->avgFrameDuration && pFrame->avgFrameDuration != AV_NOPTS_VALUE) {
-      duration = pFrame->avgFrameDuration;
-    } else if (!duration && decoderDuration) {
-      duration = decoderDuration;
-    } else if(!duration) {
-      duration = 1;
+  REFERENCE_TIME rtCapture = AV_NOPTS_VALUE, rtMatch = AV_NOPTS_VALUE;
+  {
+    CAutoLock lock(&m_csCaptureTimes);
+    for (int i = 0; i < m_nCaptureTimes; i++) {
+      const CaptureTime &entry = m_CaptureTimes[i];
+      if (entry.rtStart <= pFrame->rtStart && (rtMatch == AV_NOPTS_VALUE || entry.rtStart > rtMatch)) {
+        rtMatch = entry.rtStart;
+        rtCapture = entry.rtCapture;
+      }
     }
-
-    pFrame->rtStop = pFrame->rtStart + (duration * (pFrame->repeat ? 3 : 2)  / 2);
   }
 
-#if defined(DEBUG) && DEBUG_FRAME_TIMINGS
-  DbgLog((LOG_TRACE, 10, L"Frame, rtStart: %I64d, dur: %I64d, diff: %I64d, key: %d, type: %C, repeat: %d, interlaced: %d, tff: %d", pFrame->rtStart, pFrame->rtStop-pFrame->rtStart, pFrame->rtStart-m_rtPrevStart, pFrame->key_frame, pFrame->frame_type, pFrame->repeat, pFrame->interlaced, pFrame->tff));
-#endif
+  if (rtCapture == AV_NOPTS_VALUE)
+    return AV_NOPTS_VALUE;
 
-  m_rtPrevStart = pFrame->rtStart;
-  m_rtPrevStop  = pFrame->rtStop;
+  MediaSideDataCaptureTime *pCapture = (MediaSideDataCaptureTime *)AddLAVFrameSideData(pFrame, IID_MediaSideDataCaptureTime, sizeof(MediaSideDataCaptureTime));
+  if (pCapture)
+    pCapture->rtCapture = rtCapture;
 
-  if (!pFrame->avgFrameDuration || pFrame->avgFrameDuration == AV_NOPTS_VALUE)
-    pFrame->avgFrameDuration = m_rtAvgTimePerFrame;
+  return rtCapture;
+}
+
+void CLAVVideo::ClearCaptureTimes()
+{
+  CAutoLock lock(&m_csCaptureTimes);
+  m_nCaptureTimes = 0;
+  m_nCaptureTimeNext = 0;
+}
+
+STDMETHODIMP CLAVVideo::AddStageTime(LAVVideoStage stage, REFERENCE_TIME rtTime)
+{
+  if (stage < 0 || stage >= VideoStage_NB)
+    return E_INVALIDARG;
+
+  m_Telemetry.AddSample(stage, rtTime);
+
+  // Decoders only report stages they perform while decoding
+  m_rtDecodeExcluded += rtTime;
+  return S_OK;
+}
+
+HRESULT CLAVVideo::QueueFrame(LAVFrame *pFrame)
+{
+  // Limit the number of frames in flight, the renderer only needs a few
+  while (m_DeliveryQueue.Size() >= LAV_DELIVERY_QUEUE_SIZE && !m_bFlushing && SUCCEEDED(m_hrDeliver)) {
+    m_evDeliveryQueueSpace.Wait();
+  }
+
+  if (m_bFlushing) {
+    ReleaseFrame(&pFrame);
+    return S_FALSE;
+  }
+
+  // Delivery failed downstream, don't pile up any more frames
+  if (FAILED(m_hrDeliver)) {
+    ReleaseFrame(&pFrame);
+    return m_hrDeliver;
+  }
+
+  {
+    CAutoLock lock(&m_DeliveryQueue);
+    m_evDeliveryIdle.Reset();
+    m_DeliveryQueue.Push(pFrame);
+  }
+  m_evDeliveryQueued.Set();
+
+  return S_OK;
+}
+
+HRESULT CLAVVideo::WaitForDeliveryIdle()
+{
+  if (!m_bAsyncDelivery || !ThreadExists())
+    return S_FALSE;
+
+  m_evDeliveryIdle.Wait();
+  return S_OK;
+}
+
+void CLAVVideo::ClearDeliveryQueue()
+{
+  LAVFrame *pFrame = nullptr;
+  while (pFrame = m_DeliveryQueue.Pop()) {
+    ReleaseFrame(&pFrame);
+  }
+  m_evDeliveryQueueSpace.Set();
+  m_evDeliveryIdle.Set();
+}
+
+DWORD CLAVVideo::ThreadProc()
+{
+  SetThreadName(-1, "LAVVideo Delivery");
+
+  CStreamingThreadPriority priority(ThreadClass_Playback, m_settings.bStreamingThreadPriority);
+  numa_bind_thread(m_nNUMAPlacement);
+
+  HANDLE hEvts[] = { GetRequestHandle(), m_evDeliveryQueued };
+
+  while (1) {
+    DWORD dwWait = WaitForMultipleObjects(countof(hEvts), hEvts, FALSE, INFINITE);
+    if (dwWait == WAIT_OBJECT_0) {
+      DWORD cmd = GetRequest();
+      switch (cmd) {
+      case CMD_EXIT:
+        Reply(S_OK);
+        return 0;
+      }
+    } else if (dwWait == WAIT_OBJECT_0 + 1) {
+      while (!CheckRequest(nullptr)) {
+        LAVFrame *pFrame = nullptr;
+        {
+          CAutoLock lock(&m_DeliveryQueue);
+          pFrame = m_DeliveryQueue.Pop();
+          if (!pFrame) {
+            m_evDeliveryIdle.Set();
+            break;
+          }
+        }
+        m_evDeliveryQueueSpace.Set();
+
+        CAutoLock lock(&m_csDeliver);
+        ProcessFrame(pFrame);
+      }
+    }
+  }
+  return 0;
+}
+
+HRESULT CLAVVideo::ProcessFrame(LAVFrame *pFrame)
+{
+  // Out-of-sequence flush event to get all frames delivered,
+  // only triggered by decoders when they are already "empty"
+  // so no need to flush the decoder here
+  if (pFrame->flags & LAV_FRAME_FLAG_FLUSH) {
+    DbgLog((LOG_TRACE, 10, L"Decoder triggered a flush..."));
+    Filter(GetFlushFrame());
+
+    ReleaseFrame(&pFrame);
+    return S_FALSE;
+  }
+
+  if (m_bFlushing) {
+    ReleaseFrame(&pFrame);
+    return S_FALSE;
+  }
+
+  if (pFrame->rtStart == AV_NOPTS_VALUE) {
+    pFrame->rtStart = m_rtPrevStop;
+    pFrame->rtStop = AV_NOPTS_VALUE;
+  }
+
+  if (pFrame->rtStop == AV_NOPTS_VALUE) {
+    REFERENCE_TIME duration = 0;
+
+    CMediaType &mt = m_pOutput->CurrentMediaType();
+    videoFormatTypeHandler(mt.Format(), mt.FormatType(), nullptr, &duration, nullptr, nullptr);
+
+    REFERENCE_TIME decoderDuration = m_Decoder.GetFrameDuration();
+    if (pFrame->avgFrameDuration && pFrame->avgFrameDuration != AV_NOPTS_VALUE) {
+      duration = pFrame->avgFrameDuration;
+    } else if (!duration && decoderDuration) {
+      duration = decoderDuration;
+    } else if(!duration) {
+      duration = 1;
+    }
+
+    pFrame->rtStop = pFrame->rtStart + (duration * (pFrame->repeat ? 3 : 2)  / 2);
+  }
+
+#if defined(DEBUG) && DEBUG_FRAME_TIMINGS
+  DbgLog((LOG_TRACE, 10, L"Frame, rtStart: %I64d, dur: %I64d, diff: %I64d, key: %d, type: %C, repeat: %d, interlaced: %d, tff: %d", pFrame->rtStart, pFrame->rtStop-pFrame->rtStart, pFrame->rtStart-m_rtPrevStart, pFrame->key_frame, pFrame->frame_type, pFrame->repeat, pFrame->interlaced, pFrame->tff));
+#endif
+
+  m_rtPrevStart = pFrame->rtStart;
+  m_rtPrevStop  = pFrame->rtStop;
+
+  if (!pFrame->avgFrameDuration || pFrame->avgFrameDuration == AV_NOPTS_VALUE)
+    pFrame->avgFrameDuration = m_rtAvgTimePerFrame;
   else
     m_rtAvgTimePerFrame = pFrame->avgFrameDuration;
 
@@ -1671,7 +2490,8 @@ STDMETHODIMP CLAVVideo::Deliver(LAVFrame *pFrame)
 
   // Only perform filtering if we have to.
   // DXVA Native generally can't be filtered, and the only filtering we currently support is software deinterlacing
-  if ( pFrame->format == LAVPixFmt_DXVA2 || pFrame->format == LAVPixFmt_D3D11
+  // Frames are not filtered in metadata-only output, the deinterlacer would only change the frame rate
+  if ( pFrame->format == LAVPixFmt_DXVA2 || pFrame->format == LAVPixFmt_D3D11 || m_pFrameInfoCallback || m_pThumbnailCallback
     || !(m_Decoder.IsInterlaced(FALSE) && m_settings.SWDeintMode != SWDeintMode_None)
     || pFrame->flags & LAV_FRAME_FLAG_REDRAW) {
     return DeliverToRenderer(pFrame);
@@ -1681,10 +2501,31 @@ STDMETHODIMP CLAVVideo::Deliver(LAVFrame *pFrame)
   return S_OK;
 }
 
+// Pixel format to blend subtitles directly into an output buffer, LAVPixFmt_None if the output format can't be blended
+static LAVPixelFormat get_output_blend_format(LAVOutPixFmts outFmt, int *bpp)
+{
+  *bpp = 8;
+  switch (outFmt) {
+  case LAVOutPixFmt_RGB32: return LAVPixFmt_RGB32;
+  case LAVOutPixFmt_RGB24: return LAVPixFmt_RGB24;
+  case LAVOutPixFmt_NV12:  return LAVPixFmt_NV12;
+  case LAVOutPixFmt_YV12:  return LAVPixFmt_YUV420;
+  case LAVOutPixFmt_YV16:  return LAVPixFmt_YUV422;
+  case LAVOutPixFmt_YV24:  return LAVPixFmt_YUV444;
+  case LAVOutPixFmt_P010:
+  case LAVOutPixFmt_P016:  *bpp = 16; return LAVPixFmt_P016;
+  default: break;
+  }
+  return LAVPixFmt_None;
+}
+
 HRESULT CLAVVideo::DeliverToRenderer(LAVFrame *pFrame)
 {
   HRESULT hr = S_OK;
 
+  // The last sequence frame of a still or a DVD menu, which is redrawn whenever the subtitles change
+  BOOL bStillFrame = FALSE;
+
   // This should never get here, but better check
   if (pFrame->flags & LAV_FRAME_FLAG_FLUSH) {
     ReleaseFrame(&pFrame);
@@ -1695,6 +2536,7 @@ HRESULT CLAVVideo::DeliverToRenderer(LAVFrame *pFrame)
     // Release the old End-of-Sequence frame, this ensures any "normal" frame will clear the stored EOS frame
     if (pFrame->format != LAVPixFmt_DXVA2 && pFrame->format != LAVPixFmt_D3D11) {
       ReleaseFrame(&m_pLastSequenceFrame);
+      m_lStillOutputLength = 0;
       if ((pFrame->flags & LAV_FRAME_FLAG_END_OF_SEQUENCE || m_bInDVDMenu)) {
         if (pFrame->direct) {
           hr = DeDirectFrame(pFrame, false);
@@ -1703,7 +2545,7 @@ HRESULT CLAVVideo::DeliverToRenderer(LAVFrame *pFrame)
             return hr;
           }
         }
-        CopyLAVFrame(pFrame, &m_pLastSequenceFrame);
+        bStillFrame = SUCCEEDED(RefLAVFrame(pFrame, &m_pLastSequenceFrame, m_Decoder.HasThreadSafeBuffers() == S_OK));
       }
     } else if (pFrame->format == LAVPixFmt_DXVA2) {
       if ((pFrame->flags & LAV_FRAME_FLAG_END_OF_SEQUENCE || m_bInDVDMenu)) {
@@ -1727,6 +2569,7 @@ HRESULT CLAVVideo::DeliverToRenderer(LAVFrame *pFrame)
           // Be careful not to accidentally copy the destructor of the original frame, that would end up being bad
           m_pLastSequenceFrame->destruct = nullptr;
           m_pLastSequenceFrame->priv_data = nullptr;
+          m_pLastSequenceFrame->dr_sample = nullptr;
 
           // don't copy side data
           m_pLastSequenceFrame->side_data = nullptr;
@@ -1750,6 +2593,8 @@ HRESULT CLAVVideo::DeliverToRenderer(LAVFrame *pFrame)
     {
       // TODO D3D11
     }
+  } else if (pFrame->format != LAVPixFmt_DXVA2 && pFrame->format != LAVPixFmt_D3D11) {
+    bStillFrame = TRUE;
   }
 
   if (m_bFlushing) {
@@ -1757,47 +2602,45 @@ HRESULT CLAVVideo::DeliverToRenderer(LAVFrame *pFrame)
     return S_FALSE;
   }
 
+  // Attach the capture time of the source data, to measure the latency once the renderer accepted the frame
+  REFERENCE_TIME rtCapture = AV_NOPTS_VALUE;
+  if (!(pFrame->flags & LAV_FRAME_FLAG_REDRAW))
+    rtCapture = SetFrameCaptureTime(pFrame);
+
   // Process stream-level sidedata and attach it to the frame if necessary
   if (m_SideData.Mastering.has_colorspace) {
     fillDXVAExtFormat(pFrame->ext_format, m_SideData.Mastering.color_range - 1, m_SideData.Mastering.color_primaries, m_SideData.Mastering.colorspace, m_SideData.Mastering.color_trc, m_SideData.Mastering.chroma_location, false);
   }
+  // The merged data is shared between the frames, as long as neither the stream-level data nor the HDR data of the
+  // decoder change, so both make up the source of the cache entry
   if (m_SideData.Mastering.has_luminance || m_SideData.Mastering.has_primaries) {
-    MediaSideDataHDR *hdr = nullptr;
-
-    // Check if HDR data already exists
-    if (pFrame->side_data && pFrame->side_data_count) {
-      for (int i = 0; i < pFrame->side_data_count; i++) {
-        if (pFrame->side_data[i].guidType == IID_MediaSideDataHDR) {
-          hdr = (MediaSideDataHDR *)pFrame->side_data[i].data;
-          break;
-        }
-      }
-    }
-
-    if (hdr == nullptr)
-      hdr = (MediaSideDataHDR *)AddLAVFrameSideData(pFrame, IID_MediaSideDataHDR, sizeof(MediaSideDataHDR));
+    struct {
+      MediaSideDataHDR frame;
+      AVMasteringDisplayMetadata stream;
+    } source;
+    memset(&source, 0, sizeof(source));
+    source.stream = m_SideData.Mastering;
 
-    processFFHDRData(hdr, &m_SideData.Mastering);
+    size_t size = 0;
+    const BYTE *pFrameHDR = GetLAVFrameSideData(pFrame, IID_MediaSideDataHDR, &size);
+    if (pFrameHDR && size == sizeof(MediaSideDataHDR))
+      source.frame = *(const MediaSideDataHDR *)pFrameHDR;
+
+    bool bNew = false;
+    MediaSideDataHDR *hdr = (MediaSideDataHDR *)m_SideDataCache.SetSideData(pFrame, IID_MediaSideDataHDR, sizeof(MediaSideDataHDR), &source, sizeof(source), &bNew);
+    if (hdr && bNew) {
+      *hdr = source.frame;
+      processFFHDRData(hdr, &m_SideData.Mastering);
+    }
   }
 
   if (m_SideData.ContentLight.MaxCLL && m_SideData.ContentLight.MaxFALL) {
-    MediaSideDataHDRContentLightLevel *hdr = nullptr;
-
-    // Check if data already exists
-    if (pFrame->side_data && pFrame->side_data_count) {
-      for (int i = 0; i < pFrame->side_data_count; i++) {
-        if (pFrame->side_data[i].guidType == IID_MediaSideDataHDRContentLightLevel) {
-          hdr = (MediaSideDataHDRContentLightLevel *)pFrame->side_data[i].data;
-          break;
-        }
-      }
+    bool bNew = false;
+    MediaSideDataHDRContentLightLevel *hdr = (MediaSideDataHDRContentLightLevel *)m_SideDataCache.SetSideData(pFrame, IID_MediaSideDataHDRContentLightLevel, sizeof(MediaSideDataHDRContentLightLevel), &m_SideData.ContentLight, sizeof(m_SideData.ContentLight), &bNew);
+    if (hdr && bNew) {
+      hdr->MaxCLL = m_SideData.ContentLight.MaxCLL;
+      hdr->MaxFALL = m_SideData.ContentLight.MaxFALL;
     }
-
-    if (hdr == nullptr)
-      hdr = (MediaSideDataHDRContentLightLevel *)AddLAVFrameSideData(pFrame, IID_MediaSideDataHDRContentLightLevel, sizeof(MediaSideDataHDRContentLightLevel));
-
-    hdr->MaxCLL = m_SideData.ContentLight.MaxCLL;
-    hdr->MaxFALL = m_SideData.ContentLight.MaxFALL;
   }
 
   // Collect width/height
@@ -1808,6 +2651,74 @@ HRESULT CLAVVideo::DeliverToRenderer(LAVFrame *pFrame)
     height = 1080;
   }
 
+  // Frames of a hardware decoder in a system memory format were copied back from the GPU
+  const BOOL bHWDecoder = m_Decoder.IsHWDecoderActive();
+  m_Telemetry.SetHWDecoderActive(bHWDecoder);
+  if (bHWDecoder && pFrame->format != LAVPixFmt_DXVA2 && pFrame->format != LAVPixFmt_D3D11 && !(pFrame->flags & LAV_FRAME_FLAG_REDRAW)) {
+    const LAVPixFmtDesc desc = getPixelFormatDesc(pFrame->format);
+    ULONGLONG ullBytes = 0;
+    for (int i = 0; i < desc.planes; i++)
+      ullBytes += (ULONGLONG)(pFrame->width / desc.planeWidth[i]) * (pFrame->height / desc.planeHeight[i]) * desc.codedbytes;
+    m_Telemetry.AddCopyBack(ullBytes);
+  }
+
+  if (m_pThumbnailCallback)
+    return DeliverThumbnail(pFrame, width, height);
+  if (m_pFrameInfoCallback)
+    return DeliverFrameInfo(pFrame, width, height);
+  if (m_bFrameSource)
+    return DeliverSourceFrame(pFrame, width, height);
+
+  // Nobody sees the video, so the frames are not converted and delivered at all
+  if (m_HiddenOutput != HiddenOutput_Visible) {
+    ReleaseFrame(&pFrame);
+    return S_OK;
+  }
+
+  // While the renderer is behind, frames which are already late are dropped before spending any time on them
+  if (IsFrameLate(pFrame)) {
+    DbgLog((LOG_TRACE, 10, L"::DeliverToRenderer(): Dropping late frame at %I64d", pFrame->rtStart));
+    m_Telemetry.AddDroppedFrame();
+    ReleaseFrame(&pFrame);
+    return S_OK;
+  }
+
+  // Synthesize the film grain the decoder left to the output stage, at the decoded size
+  BOOL bFilmGrainApplied = FALSE;
+  if (m_settings.AV1FilmGrainMode == AV1FilmGrain_Output) {
+    size_t size = 0;
+    const MediaSideDataAV1FilmGrain *pGrain = (const MediaSideDataAV1FilmGrain *)GetLAVFrameSideData(pFrame, IID_MediaSideDataAV1FilmGrain, &size);
+    if (pGrain && size == sizeof(MediaSideDataAV1FilmGrain)) {
+      REFERENCE_TIME rtGrainStart = timer_get_ref_time();
+      hr = m_FilmGrain.Apply(pFrame, pGrain, m_WorkerBudget.GetThreads());
+      if (FAILED(hr)) {
+        ReleaseFrame(&pFrame);
+        return hr;
+      }
+      bFilmGrainApplied = (hr == S_OK);
+      m_Telemetry.AddSample(VideoStage_FilmGrain, timer_get_ref_time() - rtGrainStart);
+    }
+  }
+
+  // Crop and downscale before the conversion, which then runs at the output size
+  if (m_FrameScaler.IsActive() && pFrame->format != LAVPixFmt_DXVA2 && pFrame->format != LAVPixFmt_D3D11) {
+    if (pFrame->direct) {
+      hr = DeDirectFrame(pFrame, true);
+      if (FAILED(hr)) {
+        ReleaseFrame(&pFrame);
+        return hr;
+      }
+    }
+    pFrame->height = height;
+    hr = m_FrameScaler.Scale(pFrame);
+    if (FAILED(hr)) {
+      ReleaseFrame(&pFrame);
+      return hr;
+    }
+    width  = pFrame->width;
+    height = pFrame->height;
+  }
+
   if (m_PixFmtConverter.SetInputFmt(pFrame->format, pFrame->bpp) || m_bForceFormatNegotiation) {
     DbgLog((LOG_TRACE, 10, L"::Decode(): Changed input pixel format to %d (%d bpp)", pFrame->format, pFrame->bpp));
 
@@ -1832,11 +2743,17 @@ HRESULT CLAVVideo::DeliverToRenderer(LAVFrame *pFrame)
 
   // Check if we are doing RGB output
   BOOL bRGBOut = (m_PixFmtConverter.GetOutputPixFmt() == LAVOutPixFmt_RGB24 || m_PixFmtConverter.GetOutputPixFmt() == LAVOutPixFmt_RGB32);
+  // Stills are blended into the output as well, so the unblended output can be stored for their redraws
+  int blendBpp = 8;
+  const LAVPixelFormat blendFmt = get_output_blend_format(m_PixFmtConverter.GetOutputPixFmt(), &blendBpp);
+  if (blendFmt == LAVPixFmt_None || (pFrame->flags & LAV_FRAME_FLAG_MVC))
+    bStillFrame = FALSE;
+  const BOOL bBlendOutput = bRGBOut || bStillFrame;
   // And blend subtitles if we're on YUV output before blending (because the output YUV formats are more complicated to handle)
   if (m_SubtitleConsumer && m_SubtitleConsumer->HasProvider()) {
     m_SubtitleConsumer->SetVideoSize(width, height);
     m_SubtitleConsumer->RequestFrame(pFrame->rtStart, pFrame->rtStop);
-    if (!bRGBOut) {
+    if (!bBlendOutput) {
       if (pFrame->direct) {
         hr = DeDirectFrame(pFrame, true);
         if (FAILED(hr)) {
@@ -1851,6 +2768,7 @@ HRESULT CLAVVideo::DeliverToRenderer(LAVFrame *pFrame)
   // Grab a media sample, and start assembling the data for it.
   IMediaSample *pSampleOut = nullptr;
   BYTE         *pDataOut   = nullptr;
+  BOOL          bDirectRendering = FALSE;
 
   REFERENCE_TIME avgDuration = pFrame->avgFrameDuration;
   if (avgDuration == 0)
@@ -1864,6 +2782,14 @@ HRESULT CLAVVideo::DeliverToRenderer(LAVFrame *pFrame)
       pSampleOut->AddRef();
 
     ReconnectOutput(width, height, pFrame->aspect_ratio, pFrame->ext_format, avgDuration, TRUE);
+  } else if (pFrame->dr_sample && ReconnectOutput(width, height, pFrame->aspect_ratio, pFrame->ext_format, avgDuration) == S_FALSE && IsDirectRenderingFrame(pFrame)) {
+    // The frame was decoded into an output sample, which is delivered as-is
+    pSampleOut = pFrame->dr_sample;
+    pSampleOut->AddRef();
+    pSampleOut->GetPointer(&pDataOut);
+    pSampleOut->SetDiscontinuity(FALSE);
+    pSampleOut->SetSyncPoint(TRUE);
+    bDirectRendering = TRUE;
   } else {
     if(FAILED(hr = GetDeliveryBuffer(&pSampleOut, width, height, pFrame->aspect_ratio, pFrame->ext_format, avgDuration)) || FAILED(hr = pSampleOut->GetPointer(&pDataOut)) || pDataOut == nullptr) {
       SafeRelease(&pSampleOut);
@@ -1882,6 +2808,8 @@ HRESULT CLAVVideo::DeliverToRenderer(LAVFrame *pFrame)
     if (SUCCEEDED(hr = pSampleOut->QueryInterface(&pMediaSideData))) {
       for (int i = 0; i < pFrame->side_data_count; i++)
       {
+        if (pFrame->side_data[i].guidType == IID_MediaSideDataAV1FilmGrain && bFilmGrainApplied)
+          continue;
         if (pFrame->side_data[i].guidType != IID_MediaSideDataEIA608CC)
           pMediaSideData->SetSideData(pFrame->side_data[i].guidType, pFrame->side_data[i].data, pFrame->side_data[i].size);
       }
@@ -1899,6 +2827,8 @@ HRESULT CLAVVideo::DeliverToRenderer(LAVFrame *pFrame)
   }
 
   if (pFrame->format != LAVPixFmt_DXVA2 && pFrame->format != LAVPixFmt_D3D11) {
+    UpdateDirectRenderingLayout(pFrame, width, height, pBIH);
+
     long required = m_PixFmtConverter.GetImageSize(pBIH->biWidth, abs(pBIH->biHeight));
 
     long lSampleSize = pSampleOut->GetSize();
@@ -1916,14 +2846,43 @@ HRESULT CLAVVideo::DeliverToRenderer(LAVFrame *pFrame)
     QueryPerformanceCounter(&start);
   #endif
 
-    if (pFrame->direct && !m_PixFmtConverter.IsDirectModeSupported((uintptr_t)pDataOut, pBIH->biWidth)) {
-      DeDirectFrame(pFrame, true);
+    REFERENCE_TIME rtConvertStart = timer_get_ref_time();
+
+    // A redraw of a still only needs the stored output of its first delivery
+    const BOOL bStillOutputValid = bStillFrame && (pFrame->flags & LAV_FRAME_FLAG_REDRAW) && m_lStillOutputLength == required
+                                && m_StillOutputSubtype == mt.subtype && m_lStillOutputWidth == pBIH->biWidth && m_lStillOutputHeight == pBIH->biHeight;
+    if (bStillOutputValid) {
+      memcpy(pDataOut, m_pStillOutput, required);
     }
+    // Frames decoded into the output sample are already in place
+    else if (!bDirectRendering) {
+      if (pFrame->direct && !m_PixFmtConverter.IsDirectModeSupported((uintptr_t)pDataOut, pBIH->biWidth)) {
+        DeDirectFrame(pFrame, true);
+      }
 
-    if (pFrame->direct)
-      m_PixFmtConverter.ConvertDirect(pFrame, pDataOut, width, height, pBIH->biWidth, abs(pBIH->biHeight));
-    else
-      m_PixFmtConverter.Convert(pFrame->data, pFrame->stride, pDataOut, width, height, pBIH->biWidth, abs(pBIH->biHeight));
+      if (pFrame->direct)
+        m_PixFmtConverter.ConvertDirect(pFrame, pDataOut, width, height, pBIH->biWidth, abs(pBIH->biHeight));
+      else
+        m_PixFmtConverter.Convert(pFrame->data, pFrame->stride, pDataOut, width, height, pBIH->biWidth, abs(pBIH->biHeight));
+    }
+
+    // Keep the unblended output of a still for its redraws
+    if (bStillFrame && !bStillOutputValid) {
+      if (m_lStillOutputSize < required) {
+        av_freep(&m_pStillOutput);
+        m_lStillOutputSize = 0;
+        m_pStillOutput = (BYTE *)av_malloc(required);
+        if (m_pStillOutput)
+          m_lStillOutputSize = required;
+      }
+      if (m_pStillOutput) {
+        memcpy(m_pStillOutput, pDataOut, required);
+        m_lStillOutputLength = required;
+        m_StillOutputSubtype = mt.subtype;
+        m_lStillOutputWidth  = pBIH->biWidth;
+        m_lStillOutputHeight = pBIH->biHeight;
+      }
+    }
 
   #if defined(DEBUG) && DEBUG_PIXELCONV_TIMINGS
     QueryPerformanceCounter(&end);
@@ -1945,28 +2904,25 @@ HRESULT CLAVVideo::DeliverToRenderer(LAVFrame *pFrame)
       }
     }
 
+    m_Telemetry.AddSample(VideoStage_PixelConversion, timer_get_ref_time() - rtConvertStart);
+
     // Once we're done with the old frame, release its buffers
     // This does not release the frame yet, just free its buffers
     FreeLAVFrameBuffers(pFrame);
 
     // .. and if we do RGB conversion, blend after the conversion, for improved quality
-    if (bRGBOut && m_SubtitleConsumer && m_SubtitleConsumer->HasProvider()) {
-      int strideBytes = pBIH->biWidth;
-      LAVPixelFormat pixFmt;
-      if (m_PixFmtConverter.GetOutputPixFmt() == LAVOutPixFmt_RGB32) {
-        pixFmt = LAVPixFmt_RGB32;
-        strideBytes *= 4;
-      } else {
-        pixFmt = LAVPixFmt_RGB24;
-        strideBytes *= 3;
-      }
-
+    // Stills are blended after the conversion in any format, the stored output stays unblended
+    if (bBlendOutput && m_SubtitleConsumer && m_SubtitleConsumer->HasProvider()) {
       // We need to supply a LAV Frame to the subtitle API
       // So update it with the appropriate settings
-      pFrame->data[0]   = pDataOut;
-      pFrame->stride[0] = strideBytes;
-      pFrame->format    = pixFmt;
-      pFrame->bpp       = 8;
+      if (bRGBOut) {
+        pFrame->data[0]   = pDataOut;
+        pFrame->stride[0] = pBIH->biWidth * (blendFmt == LAVPixFmt_RGB32 ? 4 : 3);
+      } else {
+        CLAVPixFmtConverter::GetIdentityOutputPlanes(m_PixFmtConverter.GetOutputPixFmt(), blendFmt, pDataOut, pBIH->biWidth, abs(pBIH->biHeight), pFrame->data, pFrame->stride);
+      }
+      pFrame->format    = blendFmt;
+      pFrame->bpp       = blendBpp;
       pFrame->flags    |= LAV_FRAME_FLAG_BUFFER_MODIFY;
       m_SubtitleConsumer->ProcessFrame(pFrame);
     }
@@ -2013,10 +2969,17 @@ HRESULT CLAVVideo::DeliverToRenderer(LAVFrame *pFrame)
   // Release frame before delivery, so it can be re-used by the decoder (if required)
   ReleaseFrame(&pFrame);
 
+  REFERENCE_TIME rtDeliverStart = timer_get_ref_time();
   hr = m_pOutput->Deliver(pSampleOut);
+  REFERENCE_TIME rtDeliverEnd = timer_get_ref_time();
+  m_Telemetry.AddSample(VideoStage_Deliver, rtDeliverEnd - rtDeliverStart);
+  if (SUCCEEDED(hr) && rtCapture != AV_NOPTS_VALUE)
+    m_Telemetry.AddSample(VideoStage_CaptureLatency, rtDeliverEnd - rtCapture);
   if (FAILED(hr)) {
     DbgLog((LOG_ERROR, 10, L"::Decode(): Deliver failed with hr: %x", hr));
     m_hrDeliver = hr;
+    // don't trust the negotiated types anymore, the renderer might have rejected one
+    m_OutputTypeCache.clear();
   }
 
   if (bSizeChanged)
@@ -2027,13 +2990,195 @@ HRESULT CLAVVideo::DeliverToRenderer(LAVFrame *pFrame)
   return hr;
 }
 
+// Pass the frame information to the callback of the metadata-only output, instead of delivering the frame
+HRESULT CLAVVideo::DeliverFrameInfo(LAVFrame *pFrame, int width, int height)
+{
+  LAVVideoFrameInfo info = { 0 };
+  info.rtStart        = pFrame->rtStart;
+  info.rtStop         = pFrame->rtStop;
+  info.width          = width;
+  info.height         = height;
+  info.frameType      = pFrame->frame_type ? pFrame->frame_type : '?';
+  info.bKeyFrame      = pFrame->key_frame;
+  info.bInterlaced    = pFrame->interlaced;
+  info.bTopFieldFirst = pFrame->tff;
+  info.bRepeatField   = pFrame->repeat;
+  info.uExtFormat     = pFrame->ext_format.value;
+
+  for (int i = 0; i < pFrame->side_data_count; i++) {
+    if (pFrame->side_data[i].guidType == IID_MediaSideDataHDR)
+      info.pHDR = (const MediaSideDataHDR *)pFrame->side_data[i].data;
+    else if (pFrame->side_data[i].guidType == IID_MediaSideDataHDRContentLightLevel)
+      info.pHDRContentLightLevel = (const MediaSideDataHDRContentLightLevel *)pFrame->side_data[i].data;
+  }
+
+  HRESULT hr = m_pFrameInfoCallback->FrameDecoded(&info);
+  ReleaseFrame(&pFrame);
+
+  return SUCCEEDED(hr) ? S_OK : hr;
+}
+
+// Scale the frame into the thumbnail image, and pass it to the callback of the thumbnail output
+HRESULT CLAVVideo::DeliverThumbnail(LAVFrame *pFrame, int width, int height)
+{
+  HRESULT hr = S_OK;
+
+  if (pFrame->direct) {
+    hr = DeDirectFrame(pFrame, true);
+    if (FAILED(hr)) {
+      ReleaseFrame(&pFrame);
+      return hr;
+    }
+  }
+
+  // frames of hardware decoders in native mode are not in system memory
+  AVPixelFormat srcFmt = getFFPixelFormatFromLAV(pFrame->format, pFrame->bpp);
+  if (pFrame->format == LAVPixFmt_DXVA2 || pFrame->format == LAVPixFmt_D3D11 || srcFmt == AV_PIX_FMT_NONE) {
+    ReleaseFrame(&pFrame);
+    return S_FALSE;
+  }
+
+  int dstWidth = m_ThumbnailSize.cx, dstHeight = m_ThumbnailSize.cy;
+  if (!dstWidth || !dstHeight) {
+    double dar = (pFrame->aspect_ratio.num > 0 && pFrame->aspect_ratio.den > 0) ? av_q2d(pFrame->aspect_ratio) : (double)width / height;
+    if (!dstWidth)
+      dstWidth = max(1, (int)(dstHeight * dar + 0.5));
+    else
+      dstHeight = max(1, (int)(dstWidth / dar + 0.5));
+  }
+
+  const ptrdiff_t dstStride = FFALIGN(dstWidth * 4, 32);
+  const size_t size = dstStride * dstHeight;
+  if (size > m_nThumbnailBufferSize) {
+    av_freep(&m_pThumbnailBuffer);
+    m_nThumbnailBufferSize = 0;
+    m_pThumbnailBuffer = (BYTE *)av_malloc(size + AV_INPUT_BUFFER_PADDING_SIZE);
+    if (!m_pThumbnailBuffer) {
+      ReleaseFrame(&pFrame);
+      return E_OUTOFMEMORY;
+    }
+    m_nThumbnailBufferSize = size;
+  }
+
+  m_pThumbnailSws = sws_getCachedContext(m_pThumbnailSws, width, height, srcFmt, dstWidth, dstHeight, AV_PIX_FMT_BGRA, SWS_BILINEAR, nullptr, nullptr, nullptr);
+  if (!m_pThumbnailSws) {
+    ReleaseFrame(&pFrame);
+    return E_FAIL;
+  }
+
+  // without a transfer matrix, assume BT.601 for SD content
+  int colorspace = SWS_CS_ITU709;
+  if (pFrame->ext_format.VideoTransferMatrix == DXVA2_VideoTransferMatrix_BT601
+    || (pFrame->ext_format.VideoTransferMatrix == DXVA2_VideoTransferMatrix_Unknown && height < 720 && width < 1280))
+    colorspace = SWS_CS_ITU601;
+
+  const int *coeffs = sws_getCoefficients(colorspace);
+  sws_setColorspaceDetails(m_pThumbnailSws, coeffs, pFrame->ext_format.NominalRange == DXVA2_NominalRange_0_255, coeffs, 1, 0, 1 << 16, 1 << 16);
+
+  const int srcStride[4] = { (int)pFrame->stride[0], (int)pFrame->stride[1], (int)pFrame->stride[2], (int)pFrame->stride[3] };
+  uint8_t *dst[4] = { m_pThumbnailBuffer, nullptr, nullptr, nullptr };
+  const int dstStrides[4] = { (int)dstStride, 0, 0, 0 };
+  sws_scale(m_pThumbnailSws, pFrame->data, srcStride, 0, height, dst, dstStrides);
+
+  hr = m_pThumbnailCallback->ThumbnailDecoded(pFrame->rtStart, dstWidth, dstHeight, m_pThumbnailBuffer, dstStride);
+  ReleaseFrame(&pFrame);
+
+  return SUCCEEDED(hr) ? S_OK : hr;
+}
+
+// Convert the frame into the output format of the frame source, and pass it to the callback or queue it
+HRESULT CLAVVideo::DeliverSourceFrame(LAVFrame *pFrame, int width, int height)
+{
+  HRESULT hr = S_OK;
+
+  if (pFrame->direct) {
+    hr = DeDirectFrame(pFrame, true);
+    if (FAILED(hr)) {
+      ReleaseFrame(&pFrame);
+      return hr;
+    }
+  }
+
+  // frames of hardware decoders in native mode are not in system memory
+  if (pFrame->format == LAVPixFmt_DXVA2 || pFrame->format == LAVPixFmt_D3D11) {
+    ReleaseFrame(&pFrame);
+    return S_FALSE;
+  }
+
+  m_PixFmtConverter.SetInputFmt(pFrame->format, pFrame->bpp);
+  m_PixFmtConverter.SetColorProps(pFrame->ext_format, m_settings.RGBRange);
+
+  const ptrdiff_t stride = FFALIGN(width, 32);
+  const int planeHeight = FFALIGN(height, 2);
+  const DWORD dwImageSize = m_PixFmtConverter.GetImageSize((int)stride, planeHeight);
+
+  LAVVideoSourceFrame *pSourceFrame = (LAVVideoSourceFrame *)CoTaskMemAlloc(sizeof(LAVVideoSourceFrame));
+  BYTE *pImage = (BYTE *)av_malloc(dwImageSize + AV_INPUT_BUFFER_PADDING_SIZE);
+  if (!pSourceFrame || !pImage) {
+    CoTaskMemFree(pSourceFrame);
+    av_free(pImage);
+    ReleaseFrame(&pFrame);
+    return E_OUTOFMEMORY;
+  }
+
+  REFERENCE_TIME rtConvertStart = timer_get_ref_time();
+  hr = m_PixFmtConverter.Convert(pFrame->data, pFrame->stride, pImage, width, height, stride, planeHeight);
+  m_Telemetry.AddSample(VideoStage_PixelConversion, timer_get_ref_time() - rtConvertStart);
+
+  ZeroMemory(pSourceFrame, sizeof(LAVVideoSourceFrame));
+  pSourceFrame->rtStart        = pFrame->rtStart;
+  pSourceFrame->rtStop         = pFrame->rtStop;
+  pSourceFrame->width          = width;
+  pSourceFrame->height         = height;
+  if (pFrame->aspect_ratio.num > 0 && pFrame->aspect_ratio.den > 0) {
+    pSourceFrame->aspectX      = pFrame->aspect_ratio.num;
+    pSourceFrame->aspectY      = pFrame->aspect_ratio.den;
+  }
+  pSourceFrame->format         = m_PixFmtConverter.GetOutputPixFmt();
+  pSourceFrame->pImage         = pImage;
+  pSourceFrame->dwImageSize    = dwImageSize;
+  pSourceFrame->stride         = stride;
+  pSourceFrame->planeHeight    = planeHeight;
+  pSourceFrame->bKeyFrame      = pFrame->key_frame;
+  pSourceFrame->bInterlaced    = pFrame->interlaced;
+  pSourceFrame->bTopFieldFirst = pFrame->tff;
+  pSourceFrame->uExtFormat     = pFrame->ext_format.value;
+  ReleaseFrame(&pFrame);
+
+  if (FAILED(hr)) {
+    ReleaseSourceFrame(pSourceFrame);
+    return hr;
+  }
+
+  if (m_pFrameSourceCallback) {
+    hr = m_pFrameSourceCallback->FrameDecoded(pSourceFrame);
+    ReleaseSourceFrame(pSourceFrame);
+    if (FAILED(hr))
+      m_hrDeliver = hr;
+    return SUCCEEDED(hr) ? S_OK : hr;
+  }
+
+  m_FrameSourceQueue.push_back(pSourceFrame);
+  return S_OK;
+}
+
+void CLAVVideo::ClearSourceFrames()
+{
+  for (LAVVideoSourceFrame *pFrame : m_FrameSourceQueue)
+    ReleaseSourceFrame(pFrame);
+  m_FrameSourceQueue.clear();
+}
+
 HRESULT CLAVVideo::GetD3DBuffer(LAVFrame *pFrame)
 {
   CheckPointer(pFrame, E_POINTER);
 
   IMediaSample *pSample = nullptr;
   HRESULT hr = m_pOutput->GetDeliveryBuffer(&pSample, nullptr, nullptr, 0);
-  if (SUCCEEDED(hr)) {
+  if (SUCCEEDED(hr) && pFrame->format == LAVPixFmt_D3D11) {
+    // D3D11 samples carry their texture themselves
+    pFrame->data[0] = (BYTE *)pSample;
+  } else if (SUCCEEDED(hr)) {
     IMFGetService *pService = nullptr;
     hr = pSample->QueryInterface(&pService);
     if (SUCCEEDED(hr)) {
@@ -2064,6 +3209,8 @@ HRESULT CLAVVideo::RedrawStillImage()
 
   if (m_pLastSequenceFrame) {
     CAutoLock lock(&m_csReceive);
+    WaitForDeliveryIdle();
+
     // Since a delivery call can clear the stored sequence frame, we need a second check here
     // Because only after we obtained the receive lock, we are in charge..
     if (!m_pLastSequenceFrame)
@@ -2104,7 +3251,7 @@ HRESULT CLAVVideo::RedrawStillImage()
       // TODO D3D11
     } else {
       LAVFrame *pFrame = nullptr;
-      HRESULT hr = CopyLAVFrame(m_pLastSequenceFrame, &pFrame);
+      HRESULT hr = RefLAVFrame(m_pLastSequenceFrame, &pFrame, true);
       if (FAILED(hr))
         return hr;
 
@@ -2170,6 +3317,7 @@ STDMETHODIMP CLAVVideo::SetRuntimeConfig(BOOL bRuntimeConfig)
 {
   m_bRuntimeConfig = bRuntimeConfig;
   LoadSettings();
+  UpdateFramePoolFootprint();
 
   // Tray Icon is disabled by default
   SAFE_DELETE(m_pTrayIcon);
@@ -2290,17 +3438,7 @@ STDMETHODIMP_(DWORD) CLAVVideo::CheckHWAccelSupport(LAVHWAccel hwAccel)
   if (hwAccel == m_settings.HWAccel && m_Decoder.IsHWDecoderActive())
     return 2;
 
-  HRESULT hr = E_FAIL;
-  ILAVDecoder *pDecoder = CDecodeManager::CreateHWAccelDecoder(hwAccel);
-
-  if (pDecoder) {
-    hr = pDecoder->InitInterfaces(this, this);
-    if (SUCCEEDED(hr)) {
-      hr = pDecoder->Check();
-    }
-    SAFE_DELETE(pDecoder);
-  }
-
+  HRESULT hr = CDecodeManager::CheckHWAccel(hwAccel, this, this);
   return SUCCEEDED(hr) ? 1 : 0;
 }
 
@@ -2583,7 +3721,534 @@ STDMETHODIMP CLAVVideo::SetEnableCCOutputPin(BOOL bEnabled)
   return S_OK;
 }
 
-STDMETHODIMP CLAVVideo::GetHWAccelActiveDevice(BSTR *pstrDeviceName)
+STDMETHODIMP CLAVVideo::SetHWAccelStagingTextures(DWORD dwCount)
 {
-  return m_Decoder.GetHWAccelActiveDevice(pstrDeviceName);
+  if (dwCount < 1 || dwCount > 8)
+    return E_INVALIDARG;
+
+  m_settings.HWAccelStagingTextures = dwCount;
+  return SaveSettings();
+}
+
+STDMETHODIMP_(DWORD) CLAVVideo::GetHWAccelStagingTextures()
+{
+  return m_settings.HWAccelStagingTextures;
+}
+
+STDMETHODIMP CLAVVideo::SetAsyncDelivery(BOOL bEnabled)
+{
+  m_settings.bAsyncDelivery = bEnabled;
+  return SaveSettings();
+}
+
+STDMETHODIMP_(BOOL) CLAVVideo::GetAsyncDelivery()
+{
+  return m_settings.bAsyncDelivery;
+}
+
+STDMETHODIMP CLAVVideo::SetSWDeintThreads(DWORD dwNum)
+{
+  if (dwNum > 16)
+    return E_INVALIDARG;
+
+  m_settings.SWDeintThreads = dwNum;
+  return SaveSettings();
+}
+
+STDMETHODIMP_(DWORD) CLAVVideo::GetSWDeintThreads()
+{
+  return m_settings.SWDeintThreads;
+}
+
+STDMETHODIMP CLAVVideo::SetHWAccelSurfacePool(DWORD dwMin, DWORD dwMax)
+{
+  if (dwMin > 127 || dwMax > 127 || (dwMax && dwMax < dwMin))
+    return E_INVALIDARG;
+
+  m_settings.HWAccelSurfacePoolMin = dwMin;
+  m_settings.HWAccelSurfacePoolMax = dwMax;
+  return SaveSettings();
+}
+
+STDMETHODIMP CLAVVideo::GetHWAccelSurfacePool(DWORD *pdwMin, DWORD *pdwMax)
+{
+  CheckPointer(pdwMin, E_POINTER);
+  CheckPointer(pdwMax, E_POINTER);
+
+  *pdwMin = m_settings.HWAccelSurfacePoolMin;
+  *pdwMax = m_settings.HWAccelSurfacePoolMax;
+  return S_OK;
+}
+
+STDMETHODIMP CLAVVideo::SetHWAccelDeviceLoadBalancing(BOOL bEnabled)
+{
+  m_settings.bHWAccelDeviceLoadBalancing = bEnabled;
+  return SaveSettings();
+}
+
+STDMETHODIMP_(BOOL) CLAVVideo::GetHWAccelDeviceLoadBalancing()
+{
+  return m_settings.bHWAccelDeviceLoadBalancing;
+}
+
+STDMETHODIMP CLAVVideo::SetMetadataOnlyOutput(ILAVVideoFrameInfoCallback *pCallback, BOOL bKeyFramesOnly)
+{
+  // Frames are processed under the delivery lock, so the callback can't change during a call
+  CAutoLock lock(&m_csDeliver);
+
+  SafeRelease(&m_pFrameInfoCallback);
+  m_pFrameInfoCallback = pCallback;
+  if (m_pFrameInfoCallback)
+    m_pFrameInfoCallback->AddRef();
+
+  m_bKeyFramesOnly = (pCallback && bKeyFramesOnly);
+  return S_OK;
+}
+
+STDMETHODIMP CLAVVideo::SetThumbnailOutput(ILAVVideoThumbnailCallback *pCallback, int width, int height)
+{
+  if (pCallback && (width < 0 || height < 0 || (width == 0 && height == 0)))
+    return E_INVALIDARG;
+
+  CAutoLock lock(&m_csDeliver);
+
+  SafeRelease(&m_pThumbnailCallback);
+  m_pThumbnailCallback = pCallback;
+  if (m_pThumbnailCallback)
+    m_pThumbnailCallback->AddRef();
+
+  m_ThumbnailSize.cx = width;
+  m_ThumbnailSize.cy = height;
+  return S_OK;
+}
+
+STDMETHODIMP CLAVVideo::SetOutputScaling(const RECT *prcCrop, DWORD dwWidth, DWORD dwHeight)
+{
+  if (prcCrop && (prcCrop->left < 0 || prcCrop->top < 0 || prcCrop->right <= prcCrop->left || prcCrop->bottom <= prcCrop->top))
+    return E_INVALIDARG;
+  if (dwWidth > INT_MAX || dwHeight > INT_MAX)
+    return E_INVALIDARG;
+
+  CAutoLock lock(&m_csDeliver);
+  m_FrameScaler.SetScaling(prcCrop, (int)dwWidth, (int)dwHeight);
+  return S_OK;
+}
+
+STDMETHODIMP CLAVVideo::SetPerformanceMode(LAVPerformanceMode mode)
+{
+  if (mode < PerfMode_Off || mode > PerfMode_Fast)
+    return E_INVALIDARG;
+
+  m_settings.PerformanceMode = mode;
+  return SaveSettings();
+}
+
+STDMETHODIMP_(LAVPerformanceMode) CLAVVideo::GetPerformanceMode()
+{
+  return (LAVPerformanceMode)m_settings.PerformanceMode;
+}
+
+STDMETHODIMP CLAVVideo::SetHWAccelGPUConversion(BOOL bEnabled)
+{
+  m_settings.bHWAccelGPUConversion = bEnabled;
+  return SaveSettings();
+}
+
+STDMETHODIMP_(BOOL) CLAVVideo::GetHWAccelGPUConversion()
+{
+  return m_settings.bHWAccelGPUConversion;
+}
+
+STDMETHODIMP CLAVVideo::SetStreamingThreadPriority(BOOL bEnabled)
+{
+  m_settings.bStreamingThreadPriority = bEnabled;
+  return SaveSettings();
+}
+
+STDMETHODIMP_(BOOL) CLAVVideo::GetStreamingThreadPriority()
+{
+  return m_settings.bStreamingThreadPriority;
+}
+
+STDMETHODIMP CLAVVideo::SetNUMANode(DWORD dwNode)
+{
+  m_settings.NUMANode = dwNode;
+  return SaveSettings();
+}
+
+STDMETHODIMP_(DWORD) CLAVVideo::GetNUMANode()
+{
+  return m_settings.NUMANode;
+}
+
+STDMETHODIMP CLAVVideo::SetDirectRendering(BOOL bEnabled)
+{
+  m_settings.bDirectRendering = bEnabled;
+  return SaveSettings();
+}
+
+STDMETHODIMP_(BOOL) CLAVVideo::GetDirectRendering()
+{
+  return m_settings.bDirectRendering;
+}
+
+STDMETHODIMP CLAVVideo::SetLowDelay(BOOL bEnabled)
+{
+  m_settings.bLowDelay = bEnabled;
+  return SaveSettings();
+}
+
+STDMETHODIMP_(BOOL) CLAVVideo::GetLowDelay()
+{
+  return m_settings.bLowDelay;
+}
+
+STDMETHODIMP CLAVVideo::SetLowFootprint(BOOL bEnabled)
+{
+  m_settings.bLowFootprint = bEnabled;
+  UpdateFramePoolFootprint();
+  return SaveSettings();
+}
+
+STDMETHODIMP_(BOOL) CLAVVideo::GetLowFootprint()
+{
+  return m_settings.bLowFootprint;
+}
+
+STDMETHODIMP CLAVVideo::GetMemoryBudget(ULONGLONG *pBudget)
+{
+  CheckPointer(pBudget, E_POINTER);
+  if (!m_pOutput->IsConnected())
+    return E_UNEXPECTED;
+
+  BITMAPINFOHEADER *pBIH = nullptr;
+  videoFormatTypeHandler(m_pOutput->CurrentMediaType(), &pBIH);
+  if (!pBIH)
+    return E_UNEXPECTED;
+
+  // frames held by the decoder and the deinterlacer, two output samples, the output queue, the unused buffers of the shared pool,
+  // and the intermediate buffer of the pixel format conversion, all estimated with the size of the output frames
+  const ULONGLONG nFrames = GetPipelineDepth() + 2 + GetOutputQueueDepth() + GetLAVFrameBufferPoolSize() + 1;
+  ULONGLONG budget = nFrames * pBIH->biSizeImage;
+
+  // the surface pool of the hardware decoder is allocated in full when the decoder is created
+  LAVMemoryUsage usage;
+  if (SUCCEEDED(m_pMemoryAccount->GetUsage(LAVMemory_HWSurfaces, &usage)))
+    budget += usage.nCurrent;
+
+  *pBudget = budget;
+  return S_OK;
+}
+
+STDMETHODIMP CLAVVideo::SetOutputQueue(DWORD dwDepth, DWORD dwBatchSize)
+{
+  if (dwDepth > OUTPUT_QUEUE_MAX_DEPTH)
+    return E_INVALIDARG;
+
+  m_settings.OutputQueueDepth = dwDepth;
+  m_settings.OutputQueueBatch = av_clip(dwBatchSize, 1, max(dwDepth, 1UL));
+  return SaveSettings();
+}
+
+STDMETHODIMP CLAVVideo::GetOutputQueue(DWORD *pdwDepth, DWORD *pdwBatchSize)
+{
+  if (pdwDepth)
+    *pdwDepth = m_settings.OutputQueueDepth;
+  if (pdwBatchSize)
+    *pdwBatchSize = m_settings.OutputQueueBatch;
+
+  return S_OK;
+}
+
+STDMETHODIMP CLAVVideo::SetD3D11FrameSharing(LPCWSTR pszName, DWORD dwSurfaces)
+{
+  if (pszName == nullptr || *pszName == 0) {
+    m_D3D11ShareName.clear();
+    m_dwD3D11ShareSurfaces = 0;
+    return S_OK;
+  }
+
+  if (dwSurfaces < 2 || dwSurfaces > LAV_D3D11_SHARE_MAX_SURFACES || wcslen(pszName) > 64 || wcschr(pszName, L'\\'))
+    return E_INVALIDARG;
+
+  m_D3D11ShareName = pszName;
+  m_dwD3D11ShareSurfaces = dwSurfaces;
+  return S_OK;
+}
+
+STDMETHODIMP_(LPCWSTR) CLAVVideo::GetD3D11FrameSharing(DWORD *pdwSurfaces)
+{
+  if (pdwSurfaces)
+    *pdwSurfaces = m_dwD3D11ShareSurfaces;
+  return m_D3D11ShareName.empty() ? nullptr : m_D3D11ShareName.c_str();
+}
+
+STDMETHODIMP CLAVVideo::SetAV1FilmGrainMode(LAVAV1FilmGrainMode mode)
+{
+  if (mode < AV1FilmGrain_Decoder || mode > AV1FilmGrain_Output)
+    return E_INVALIDARG;
+
+  m_settings.AV1FilmGrainMode = mode;
+  return SaveSettings();
+}
+
+STDMETHODIMP_(LAVAV1FilmGrainMode) CLAVVideo::GetAV1FilmGrainMode()
+{
+  return (LAVAV1FilmGrainMode)m_settings.AV1FilmGrainMode;
+}
+
+STDMETHODIMP CLAVVideo::SetHiddenOutput(LAVHiddenOutputMode mode)
+{
+  if (mode < HiddenOutput_Visible || mode > HiddenOutput_KeyFramesOnly)
+    return E_INVALIDARG;
+
+  if (mode != m_HiddenOutput)
+    DbgLog((LOG_TRACE, 10, L"::SetHiddenOutput(): Switching to hidden output mode %d", mode));
+
+  // picked up by the decoder with the next packet, see GetDecodeFlags
+  m_HiddenOutput = mode;
+  return S_OK;
+}
+
+STDMETHODIMP_(LAVHiddenOutputMode) CLAVVideo::GetHiddenOutput()
+{
+  return m_HiddenOutput;
+}
+
+STDMETHODIMP CLAVVideo::SetHWAccelAutoSelect(BOOL bEnabled)
+{
+  m_settings.bHWAccelAuto = bEnabled;
+  return SaveSettings();
+}
+
+STDMETHODIMP_(BOOL) CLAVVideo::GetHWAccelAutoSelect()
+{
+  return m_settings.bHWAccelAuto;
+}
+
+STDMETHODIMP CLAVVideo::SetHWAccelStandby(BOOL bEnabled)
+{
+  m_settings.bHWAccelStandby = bEnabled;
+  return SaveSettings();
+}
+
+STDMETHODIMP_(BOOL) CLAVVideo::GetHWAccelStandby()
+{
+  return m_settings.bHWAccelStandby;
+}
+
+STDMETHODIMP CLAVVideo::SetIdleReleaseTime(DWORD dwMilliseconds)
+{
+  m_settings.IdleReleaseTime = dwMilliseconds;
+  return SaveSettings();
+}
+
+STDMETHODIMP_(DWORD) CLAVVideo::GetIdleReleaseTime()
+{
+  return m_settings.IdleReleaseTime;
+}
+
+STDMETHODIMP CLAVVideo::SetOutputFormatCostRanking(BOOL bEnabled)
+{
+  m_settings.bOutputFormatCostRanking = bEnabled;
+  return SaveSettings();
+}
+
+STDMETHODIMP_(BOOL) CLAVVideo::GetOutputFormatCostRanking()
+{
+  return m_settings.bOutputFormatCostRanking;
+}
+
+void CLAVVideo::UpdateFramePoolFootprint()
+{
+  if (m_settings.bLowFootprint != m_bFramePoolLowFootprint) {
+    m_bFramePoolLowFootprint = m_settings.bLowFootprint;
+    SetLAVFrameBufferPoolLowFootprint(!!m_bFramePoolLowFootprint);
+  }
+}
+
+STDMETHODIMP_(DWORD) CLAVVideo::GetDecodeFlags()
+{
+  DWORD dwFlags = m_dwDecodeFlags;
+  if (m_bKeyFramesOnly || m_pThumbnailCallback)
+    dwFlags |= LAV_VIDEO_DEC_FLAG_KEYFRAMES_ONLY;
+  if (m_pThumbnailCallback)
+    dwFlags |= LAV_VIDEO_DEC_FLAG_NO_LOOP_FILTER;
+
+  if (m_HiddenOutput == HiddenOutput_KeyFramesOnly)
+    dwFlags |= LAV_VIDEO_DEC_FLAG_SKIP_NONKEY;
+  else if (m_HiddenOutput == HiddenOutput_ReferenceOnly)
+    dwFlags |= LAV_VIDEO_DEC_FLAG_SKIP_NONREF | LAV_VIDEO_DEC_FLAG_SKIP_NONREF_FILTER;
+
+  if (m_settings.PerformanceMode != PerfMode_Off) {
+    int nLevel = m_nPerfLevel;
+    if (m_settings.PerformanceMode == PerfMode_Fast)
+      nLevel = max(nLevel, (int)PerfLevel_SkipNonRefFilter);
+
+    if (nLevel >= PerfLevel_SkipNonRefFilter)
+      dwFlags |= LAV_VIDEO_DEC_FLAG_SKIP_NONREF_FILTER;
+    if (nLevel >= PerfLevel_SkipNonRef)
+      dwFlags |= LAV_VIDEO_DEC_FLAG_SKIP_NONREF;
+  }
+  return dwFlags;
+}
+
+STDMETHODIMP CLAVVideo::GetHWAccelActiveDevice(BSTR *pstrDeviceName)
+{
+  return m_Decoder.GetHWAccelActiveDevice(pstrDeviceName);
+}
+
+STDMETHODIMP_(DWORD) CLAVVideo::GetPipelineDepth()
+{
+  // frame threads and re-ordering delay of the decoder
+  long depth = m_Decoder.GetBufferCount(nullptr);
+
+  // the software deinterlacer holds back frames for its lookahead
+  if (m_settings.SWDeintMode != SWDeintMode_None && m_Decoder.IsInterlaced(FALSE))
+    depth += LAV_SWDEINT_LOOKAHEAD;
+
+  return (DWORD)max(depth, 0);
+}
+
+STDMETHODIMP CLAVVideo::GetHWAccelSurfacePoolStatus(LAVHWSurfacePoolStatus *pStatus)
+{
+  CheckPointer(pStatus, E_POINTER);
+  return m_Decoder.GetSurfacePoolStatus(pStatus);
+}
+
+STDMETHODIMP CLAVVideo::GetDecoderThreadingStatus(LAVDecoderThreadingStatus *pStatus)
+{
+  CheckPointer(pStatus, E_POINTER);
+  return m_Decoder.GetThreadingStatus(pStatus);
+}
+
+// ILAVVideoFrameSource
+STDMETHODIMP CLAVVideo::OpenFrameSource(const AM_MEDIA_TYPE *pmt, LAVOutPixFmts outputFormat, ILAVVideoFrameSourceCallback *pCallback)
+{
+  CheckPointer(pmt, E_POINTER);
+  if (outputFormat < 0 || outputFormat >= LAVOutPixFmt_NB)
+    return E_INVALIDARG;
+  if (m_pInput->IsConnected() || m_pOutput->IsConnected())
+    return VFW_E_ALREADY_CONNECTED;
+
+  CloseFrameSource();
+
+  CAutoLock cAutoLock(&m_csReceive);
+
+  // the decoders get the media type through the callback, instead of the input pin
+  m_FrameSourceType = *pmt;
+  m_bFrameSource = TRUE;
+
+  HRESULT hr = CreateDecoder(&m_FrameSourceType);
+  if (FAILED(hr)) {
+    DbgLog((LOG_TRACE, 10, L"::OpenFrameSource(): Decoder creation failed"));
+    m_Decoder.Close();
+    m_bFrameSource = FALSE;
+    return hr;
+  }
+
+  m_PixFmtConverter.SetOutputPixFmt(outputFormat);
+  m_bAsyncDelivery = FALSE;
+  m_hrDeliver = S_OK;
+  m_rtPrevStart = m_rtPrevStop = 0;
+
+  m_pFrameSourceCallback = pCallback;
+  if (m_pFrameSourceCallback)
+    m_pFrameSourceCallback->AddRef();
+
+  return S_OK;
+}
+
+STDMETHODIMP CLAVVideo::CloseFrameSource()
+{
+  CAutoLock cAutoLock(&m_csReceive);
+  if (!m_bFrameSource)
+    return S_FALSE;
+
+  PerformFlush();
+  m_Decoder.Close();
+  m_X264Build = -1;
+
+  ClearSourceFrames();
+  SafeRelease(&m_pFrameSourceCallback);
+
+  m_bFrameSource = FALSE;
+  m_FrameSourceType = CMediaType();
+  return S_OK;
+}
+
+STDMETHODIMP CLAVVideo::DecodeSourceSample(IMediaSample *pSample)
+{
+  CheckPointer(pSample, E_POINTER);
+
+  CAutoLock cAutoLock(&m_csReceive);
+  if (!m_bFrameSource)
+    return E_UNEXPECTED;
+
+  // callback errors are reported for the sample that produced the frame
+  m_hrDeliver = S_OK;
+
+  if (pSample->GetActualDataLength() == 0)
+    return S_OK;
+
+  m_rtDecodeExcluded = 0;
+  StoreCaptureTime(pSample);
+  REFERENCE_TIME rtDecodeStart = timer_get_ref_time();
+  HRESULT hr = m_Decoder.Decode(pSample);
+  m_Telemetry.AddSample(VideoStage_Decode, timer_get_ref_time() - rtDecodeStart - m_rtDecodeExcluded);
+  if (FAILED(hr))
+    return hr;
+
+  return m_hrDeliver;
+}
+
+STDMETHODIMP CLAVVideo::DrainFrameSource()
+{
+  CAutoLock cAutoLock(&m_csReceive);
+  if (!m_bFrameSource)
+    return E_UNEXPECTED;
+
+  m_hrDeliver = S_OK;
+  m_Decoder.EndOfStream();
+  Filter(GetFlushFrame());
+
+  return m_hrDeliver;
+}
+
+STDMETHODIMP CLAVVideo::FlushFrameSource()
+{
+  CAutoLock cAutoLock(&m_csReceive);
+  if (!m_bFrameSource)
+    return E_UNEXPECTED;
+
+  PerformFlush();
+  ClearSourceFrames();
+  m_hrDeliver = S_OK;
+
+  return S_OK;
+}
+
+STDMETHODIMP CLAVVideo::GetSourceFrame(LAVVideoSourceFrame **ppFrame)
+{
+  CheckPointer(ppFrame, E_POINTER);
+  *ppFrame = nullptr;
+
+  CAutoLock cAutoLock(&m_csReceive);
+  if (!m_bFrameSource)
+    return E_UNEXPECTED;
+  if (m_FrameSourceQueue.empty())
+    return S_FALSE;
+
+  *ppFrame = m_FrameSourceQueue.front();
+  m_FrameSourceQueue.pop_front();
+  return S_OK;
+}
+
+STDMETHODIMP CLAVVideo::ReleaseSourceFrame(LAVVideoSourceFrame *pFrame)
+{
+  if (pFrame) {
+    av_free(pFrame->pImage);
+    CoTaskMemFree(pFrame);
+  }
+  return S_OK;
 }
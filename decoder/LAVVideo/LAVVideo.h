@@ -24,11 +24,20 @@
 #include "ILAVPinInfo.h"
 
 #include "LAVPixFmtConverter.h"
+#include "FrameScaler.h"
+#include "OutputSamplePrefetch.h"
+#include "FilmGrain.h"
 #include "LAVVideoSettings.h"
 #include "FloatingAverage.h"
+#include "VideoTelemetry.h"
+#include "VideoBatch.h"
 
 #include "ISpecifyPropertyPages2.h"
 #include "SynchronizedQueue.h"
+#include "WorkerPool.h"
+#include "NumaPlacement.h"
+#include "MemoryAccount.h"
+#include "QueuedOutputPin.h"
 
 #include "subtitles/LAVSubtitleConsumer.h"
 #include "subtitles/LAVVideoSubtitleInputPin.h"
@@ -38,6 +47,10 @@
 #include "BaseTrayIcon.h"
 #include "IMediaSideData.h"
 
+#include <vector>
+#include <deque>
+#include <string>
+
 extern "C" {
 #include "libavutil/mastering_display_metadata.h"
 };
@@ -49,6 +62,42 @@ extern "C" {
 
 #define LAVC_VIDEO_LOG_FILE     L"LAVVideo.txt"
 
+// Maximum number of unused LAVFrame structures kept around for re-use
+#define LAV_FRAME_POOL_SIZE 16
+
+// Maximum number of decoded frames waiting for the delivery thread
+#define LAV_DELIVERY_QUEUE_SIZE 4
+
+// Maximum time to wait for the output queue to drain before a reconnection, in ms
+#define LAV_OUTPUT_QUEUE_IDLE_TIMEOUT 1000
+
+// Number of negotiated output types remembered for re-use on format changes
+#define LAV_OUTPUT_TYPE_CACHE 8
+
+// Number of recent input samples whose capture time is remembered, to match it to the decoded frames
+#define LAV_CAPTURE_TIME_ENTRIES 64
+
+// Segment rate from which LAV Splitter only delivers the keyframes of the video stream
+#define LAV_TRICKPLAY_RATE 4.0
+
+// Number of frames the software deinterlacers hold on to (yadif, bwdif and w3fdif use the previous and next frame)
+#define LAV_SWDEINT_LOOKAHEAD 2
+
+// Automatic software deinterlacing measures the filter cost over a window of frames, and steps down to a cheaper
+// filter if it exceeds STEP_DOWN percent of the frame duration, or back up if it stays below STEP_UP percent.
+// After stepping down, it waits between HOLD_MIN and HOLD_MAX windows before trying to step up again.
+#define LAV_SWDEINT_AUTO_WINDOW    32
+#define LAV_SWDEINT_AUTO_STEP_DOWN 50
+#define LAV_SWDEINT_AUTO_STEP_UP   20
+#define LAV_SWDEINT_AUTO_HOLD_MIN  4
+#define LAV_SWDEINT_AUTO_HOLD_MAX  64
+
+// The adaptive performance modes step down one level when the renderer reports a frame later than LATE, at most once per
+// STEP interval, and step back up once no late frame was reported for RECOVER. All values are in stream time.
+#define LAV_PERF_LATE              200000
+#define LAV_PERF_STEP              10000000
+#define LAV_PERF_RECOVER           50000000
+
 #define DEBUG_FRAME_TIMINGS 0
 #define DEBUG_PIXELCONV_TIMINGS 0
 
@@ -57,7 +106,7 @@ typedef struct {
   REFERENCE_TIME rtStop;
 } TimingCache;
 
-class __declspec(uuid("EE30215D-164F-4A92-A4EB-9D4C13390F9F")) CLAVVideo : public CTransformFilter, public ISpecifyPropertyPages2, public ILAVVideoSettings, public ILAVVideoStatus, public ILAVVideoCallback, public IPropertyBag
+class __declspec(uuid("EE30215D-164F-4A92-A4EB-9D4C13390F9F")) CLAVVideo : public CTransformFilter, public ISpecifyPropertyPages2, public ILAVVideoSettings, public ILAVVideoStatus, public ILAVVideoTelemetry, public ILAVVideoFrameSource, public ILAVVideoBatchDecoder, public ILAVMemoryInfo, public ILAVVideoCallback, public IPropertyBag, protected CAMThread
 {
 public:
   CLAVVideo(LPUNKNOWN pUnk, HRESULT* phr);
@@ -140,12 +189,91 @@ public:
 
   STDMETHODIMP SetEnableCCOutputPin(BOOL bEnabled);
 
+  STDMETHODIMP SetHWAccelStagingTextures(DWORD dwCount);
+  STDMETHODIMP_(DWORD) GetHWAccelStagingTextures();
+
+  STDMETHODIMP SetAsyncDelivery(BOOL bEnabled);
+  STDMETHODIMP_(BOOL) GetAsyncDelivery();
+
+  STDMETHODIMP SetSWDeintThreads(DWORD dwNum);
+  STDMETHODIMP_(DWORD) GetSWDeintThreads();
+
+  STDMETHODIMP SetHWAccelSurfacePool(DWORD dwMin, DWORD dwMax);
+  STDMETHODIMP GetHWAccelSurfacePool(DWORD *pdwMin, DWORD *pdwMax);
+
+  STDMETHODIMP SetHWAccelDeviceLoadBalancing(BOOL bEnabled);
+  STDMETHODIMP_(BOOL) GetHWAccelDeviceLoadBalancing();
+  STDMETHODIMP SetMetadataOnlyOutput(ILAVVideoFrameInfoCallback *pCallback, BOOL bKeyFramesOnly);
+  STDMETHODIMP SetThumbnailOutput(ILAVVideoThumbnailCallback *pCallback, int width, int height);
+  STDMETHODIMP SetOutputScaling(const RECT *prcCrop, DWORD dwWidth, DWORD dwHeight);
+  STDMETHODIMP SetPerformanceMode(LAVPerformanceMode mode);
+  STDMETHODIMP_(LAVPerformanceMode) GetPerformanceMode();
+  STDMETHODIMP SetHWAccelGPUConversion(BOOL bEnabled);
+  STDMETHODIMP_(BOOL) GetHWAccelGPUConversion();
+  STDMETHODIMP SetStreamingThreadPriority(BOOL bEnabled);
+  STDMETHODIMP_(BOOL) GetStreamingThreadPriority();
+  STDMETHODIMP SetNUMANode(DWORD dwNode);
+  STDMETHODIMP_(DWORD) GetNUMANode();
+  STDMETHODIMP SetDirectRendering(BOOL bEnabled);
+  STDMETHODIMP_(BOOL) GetDirectRendering();
+  STDMETHODIMP SetLowDelay(BOOL bEnabled);
+  STDMETHODIMP_(BOOL) GetLowDelay();
+  STDMETHODIMP SetLowFootprint(BOOL bEnabled);
+  STDMETHODIMP_(BOOL) GetLowFootprint();
+  STDMETHODIMP GetMemoryBudget(ULONGLONG *pBudget);
+  STDMETHODIMP SetOutputQueue(DWORD dwDepth, DWORD dwBatchSize);
+  STDMETHODIMP GetOutputQueue(DWORD *pdwDepth, DWORD *pdwBatchSize);
+  STDMETHODIMP SetD3D11FrameSharing(LPCWSTR pszName, DWORD dwSurfaces);
+  STDMETHODIMP_(LPCWSTR) GetD3D11FrameSharing(DWORD *pdwSurfaces);
+  STDMETHODIMP SetAV1FilmGrainMode(LAVAV1FilmGrainMode mode);
+  STDMETHODIMP_(LAVAV1FilmGrainMode) GetAV1FilmGrainMode();
+  STDMETHODIMP SetHiddenOutput(LAVHiddenOutputMode mode);
+  STDMETHODIMP_(LAVHiddenOutputMode) GetHiddenOutput();
+  STDMETHODIMP SetHWAccelAutoSelect(BOOL bEnabled);
+  STDMETHODIMP_(BOOL) GetHWAccelAutoSelect();
+  STDMETHODIMP SetHWAccelStandby(BOOL bEnabled);
+  STDMETHODIMP_(BOOL) GetHWAccelStandby();
+  STDMETHODIMP SetIdleReleaseTime(DWORD dwMilliseconds);
+  STDMETHODIMP_(DWORD) GetIdleReleaseTime();
+  STDMETHODIMP SetOutputFormatCostRanking(BOOL bEnabled);
+  STDMETHODIMP_(BOOL) GetOutputFormatCostRanking();
+
   // ILAVVideoStatus
   STDMETHODIMP_(const WCHAR *) GetActiveDecoderName() { return m_Decoder.GetDecoderName(); }
   STDMETHODIMP GetHWAccelActiveDevice(BSTR *pstrDeviceName);
+  STDMETHODIMP_(DWORD) GetPipelineDepth();
+  STDMETHODIMP GetHWAccelSurfacePoolStatus(LAVHWSurfacePoolStatus *pStatus);
+  STDMETHODIMP_(ULONGLONG) GetPixelConversionBounceFrames() { return m_PixFmtConverter.GetBounceFrames(); }
+  STDMETHODIMP GetDecoderThreadingStatus(LAVDecoderThreadingStatus *pStatus);
+
+  // ILAVVideoTelemetry
+  STDMETHODIMP GetStageStatistics(LAVVideoStage stage, LAVVideoStageStats *pStats) { return m_Telemetry.GetStatistics(stage, pStats); }
+  STDMETHODIMP ResetStageStatistics() { m_Telemetry.Reset(); return S_OK; }
+
+  // ILAVVideoFrameSource
+  STDMETHODIMP OpenFrameSource(const AM_MEDIA_TYPE *pmt, LAVOutPixFmts outputFormat, ILAVVideoFrameSourceCallback *pCallback);
+  STDMETHODIMP CloseFrameSource();
+  STDMETHODIMP DecodeSourceSample(IMediaSample *pSample);
+  STDMETHODIMP DrainFrameSource();
+  STDMETHODIMP FlushFrameSource();
+  STDMETHODIMP GetSourceFrame(LAVVideoSourceFrame **ppFrame);
+  STDMETHODIMP ReleaseSourceFrame(LAVVideoSourceFrame *pFrame);
+
+  // ILAVVideoBatchDecoder
+  STDMETHODIMP AddBatchFile(LPCWSTR pszFileName, DWORD *pdwFile) { return m_Batch.AddFile(pszFileName, pdwFile); }
+  STDMETHODIMP RunBatch(LAVOutPixFmts outputFormat, DWORD dwParallel, ILAVVideoBatchCallback *pCallback) { return m_Batch.Run(outputFormat, dwParallel, pCallback); }
+  STDMETHODIMP AbortBatch() { return m_Batch.Abort(); }
+  STDMETHODIMP RunScalingBenchmark(LAVOutPixFmts outputFormat, DWORD dwMaxStreams, DWORD dwStepSeconds, DWORD dwRounds, ILAVVideoScalingCallback *pCallback) { return m_Batch.RunScaling(outputFormat, dwMaxStreams, dwStepSeconds, dwRounds, pCallback); }
+
+  // ILAVMemoryInfo
+  STDMETHODIMP GetMemoryUsage(LAVMemoryCategory category, LAVMemoryUsage *pUsage) { return m_pMemoryAccount->GetUsage(category, pUsage); }
+  STDMETHODIMP GetProcessMemoryUsage(LAVMemoryCategory category, LAVMemoryUsage *pUsage) { return CMemoryAccount::GetProcessUsage(category, pUsage); }
+  STDMETHODIMP ResetPeakMemoryUsage() { m_pMemoryAccount->ResetPeak(); return S_OK; }
 
   // CTransformFilter
   STDMETHODIMP Stop();
+  STDMETHODIMP Pause();
+  STDMETHODIMP Run(REFERENCE_TIME tStart);
 
   HRESULT CheckInputType(const CMediaType* mtIn);
   HRESULT CheckTransform(const CMediaType* mtIn, const CMediaType* mtOut);
@@ -158,12 +286,14 @@ public:
   HRESULT EndFlush();
   HRESULT NewSegment(REFERENCE_TIME tStart, REFERENCE_TIME tStop, double dRate);
   HRESULT Receive(IMediaSample *pIn);
+  HRESULT AlterQuality(Quality q);
 
   HRESULT CheckConnect(PIN_DIRECTION dir, IPin *pPin);
   HRESULT BreakConnect(PIN_DIRECTION dir);
   HRESULT CompleteConnect(PIN_DIRECTION dir, IPin *pReceivePin);
 
   HRESULT StartStreaming();
+  HRESULT StopStreaming();
 
   int GetPinCount();
   CBasePin* GetPin(int n);
@@ -179,8 +309,8 @@ public:
   STDMETHODIMP Deliver(LAVFrame *pFrame);
   STDMETHODIMP_(LPWSTR) GetFileExtension();
   STDMETHODIMP_(BOOL) FilterInGraph(PIN_DIRECTION dir, const GUID &clsid) { if (dir == PINDIR_INPUT) return FilterInGraphSafe(m_pInput, clsid); else return FilterInGraphSafe(m_pOutput, clsid); }
-  STDMETHODIMP_(DWORD) GetDecodeFlags() { return m_dwDecodeFlags; }
-  STDMETHODIMP_(CMediaType&) GetInputMediaType() { return m_pInput->CurrentMediaType(); }
+  STDMETHODIMP_(DWORD) GetDecodeFlags();
+  STDMETHODIMP_(CMediaType&) GetInputMediaType() { return m_bFrameSource ? m_FrameSourceType : m_pInput->CurrentMediaType(); }
   STDMETHODIMP GetLAVPinInfo(LAVPinInfo &info) { if (m_LAVPinInfoValid) { info = m_LAVPinInfo; return S_OK; } return E_FAIL; }
   STDMETHODIMP_(CBasePin*) GetOutputPin() { return m_pOutput; }
   STDMETHODIMP_(CMediaType&) GetOutputMediaType() { return m_pOutput->CurrentMediaType(); }
@@ -191,12 +321,19 @@ public:
   STDMETHODIMP_(BOOL) HasDynamicInputAllocator();
   STDMETHODIMP SetX264Build(int nBuild) { m_X264Build = nBuild; return S_OK; }
   STDMETHODIMP_(int) GetX264Build() { return m_X264Build; }
+  STDMETHODIMP AddStageTime(LAVVideoStage stage, REFERENCE_TIME rtTime);
+  STDMETHODIMP_(int) GetWorkerThreads() { return m_WorkerBudget.GetThreads(); }
+  STDMETHODIMP GetDirectRenderingBuffer(LAVPixelFormat format, int width, int height, int codedWidth, int codedHeight, int align, IMediaSample **ppSample, LAVDirectBuffer *pBuffer);
+  STDMETHODIMP_(CMemoryAccount*) GetMemoryAccount() { return m_pMemoryAccount; }
+  STDMETHODIMP GetOutputScaling(int width, int height, RECT *prcCrop, int *pWidth, int *pHeight) { return m_FrameScaler.GetScaling(width, height, prcCrop, pWidth, pHeight) ? S_OK : S_FALSE; }
 
   // IPropertyBag
   STDMETHODIMP Read(LPCOLESTR pszPropName, VARIANT *pVar, IErrorLog *pErrorLog);
   STDMETHODIMP Write(LPCOLESTR pszPropName, VARIANT *pVar) { return E_NOTIMPL; }
 
 public:
+  BOOL IsFrameSourceActive() const { return m_bFrameSource; }
+
   // Pin Configuration
   const static AMOVIESETUP_MEDIATYPE    sudPinTypesIn[];
   const static UINT                     sudPinTypesInCount;
@@ -208,6 +345,10 @@ private:
   HRESULT ReadSettings(HKEY rootKey);
   HRESULT LoadSettings();
   HRESULT SaveSettings();
+  // Register the low footprint profile with the shared frame buffer pool, if it changed
+  void UpdateFramePoolFootprint();
+  // Depth of the output queue for the current stream, DVD playback relies on synchronous delivery
+  DWORD GetOutputQueueDepth() const { return (m_dwDecodeFlags & LAV_VIDEO_DEC_FLAG_DVD) ? 0 : m_settings.OutputQueueDepth; }
 
   HRESULT CreateTrayIcon();
 
@@ -215,6 +356,8 @@ private:
 
   HRESULT GetDeliveryBuffer(IMediaSample** ppOut, int width, int height, AVRational ar, DXVA2_ExtendedFormat dxvaExtFormat, REFERENCE_TIME avgFrameDuration);
   HRESULT ReconnectOutput(int width, int height, AVRational ar, DXVA2_ExtendedFormat dxvaExtFlags, REFERENCE_TIME avgFrameDuration, BOOL bDXVA = FALSE);
+  const CMediaType *GetCachedOutputType(const CMediaType &mt);
+  void CacheOutputType(const CMediaType &mt, const CMediaType &negotiated);
 
   HRESULT SetFrameFlags(IMediaSample* pMS, LAVFrame *pFrame);
 
@@ -224,13 +367,43 @@ private:
   HRESULT CheckDirectMode();
   HRESULT DeDirectFrame(LAVFrame *pFrame, bool bDisableDirectMode = true);
 
+  void UpdateDirectRenderingLayout(LAVFrame *pFrame, int width, int height, const BITMAPINFOHEADER *pBIH);
+  BOOL IsDirectRenderingFrame(LAVFrame *pFrame);
+  void ResetDirectRendering();
 
+
+  HRESULT ProcessFrame(LAVFrame *pFrame);
   HRESULT Filter(LAVFrame *pFrame);
+  BOOL IsSWDeintFramePerField();
+  void UpdateSWDeintAutoLevel(REFERENCE_TIME rtCost, REFERENCE_TIME rtBudget);
+  void UpdatePerformanceLevel(const Quality &q);
+  BOOL IsFrameLate(const LAVFrame *pFrame);
   HRESULT DeliverToRenderer(LAVFrame *pFrame);
+  HRESULT DeliverFrameInfo(LAVFrame *pFrame, int width, int height);
+  HRESULT DeliverThumbnail(LAVFrame *pFrame, int width, int height);
+  HRESULT DeliverSourceFrame(LAVFrame *pFrame, int width, int height);
+  void ClearSourceFrames();
+
+  // CAMThread
+  enum {CMD_EXIT};
+  DWORD ThreadProc();
+
+  HRESULT QueueFrame(LAVFrame *pFrame);
+  HRESULT WaitForDeliveryIdle();
+  void ClearDeliveryQueue();
+
+  void StoreCaptureTime(IMediaSample *pIn);
+  REFERENCE_TIME SetFrameCaptureTime(LAVFrame *pFrame);
+  void ClearCaptureTimes();
 
   HRESULT PerformFlush();
   HRESULT ReleaseLastSequenceFrame();
 
+  void ScheduleIdleRelease();
+  void CancelIdleRelease();
+  static VOID CALLBACK IdleReleaseTimerProc(PVOID lpParameter, BOOLEAN TimerOrWaitFired);
+  void ReleaseIdleResources();
+
   HRESULT GetD3DBuffer(LAVFrame *pFrame);
   HRESULT RedrawStillImage();
   HRESULT SetInDVDMenu(bool menu) { m_bInDVDMenu = menu; return S_OK; }
@@ -250,6 +423,9 @@ private:
 
   BOOL                 m_bForceInputAR  = FALSE;
   BOOL                 m_bSendMediaType = FALSE;
+
+  // Output types we proposed on the current connection, with the type the renderer negotiated for them
+  std::vector<std::pair<CMediaType, CMediaType>> m_OutputTypeCache;
   BOOL                 m_bFlushing      = FALSE;
   BOOL                 m_bForceFormatNegotiation = FALSE;
 
@@ -264,6 +440,45 @@ private:
   DWORD                m_dwDecodeFlags         = 0;
 
   BOOL                 m_bInDVDMenu            = FALSE;
+  BOOL                 m_bTrickPlay            = FALSE;
+
+  // Metadata-only output
+  ILAVVideoFrameInfoCallback *m_pFrameInfoCallback = nullptr;
+  BOOL                 m_bKeyFramesOnly        = FALSE;
+
+  // Decoding while the video is not visible
+  LAVHiddenOutputMode  m_HiddenOutput          = HiddenOutput_Visible;
+
+  // Sharing of the D3D11 frames with other processes
+  std::wstring         m_D3D11ShareName;
+  DWORD                m_dwD3D11ShareSurfaces  = 0;
+
+  // Thumbnail output
+  ILAVVideoThumbnailCallback *m_pThumbnailCallback = nullptr;
+  SIZE                 m_ThumbnailSize         = { 0, 0 };
+  SwsContext          *m_pThumbnailSws         = nullptr;
+  BYTE                *m_pThumbnailBuffer      = nullptr;
+  size_t               m_nThumbnailBufferSize  = 0;
+
+  // Frame source, decoding without a graph
+  BOOL                 m_bFrameSource          = FALSE;
+  CMediaType           m_FrameSourceType;
+  ILAVVideoFrameSourceCallback *m_pFrameSourceCallback = nullptr;
+  std::deque<LAVVideoSourceFrame *> m_FrameSourceQueue;
+
+  // Batch decoding, on instances of its own
+  CVideoBatch          m_Batch;
+
+  // Output cropping and downscaling
+  CFrameScaler         m_FrameScaler;
+  CAV1FilmGrain        m_FilmGrain;
+
+  // Adaptive performance mode
+  enum { PerfLevel_Full, PerfLevel_SkipNonRefFilter, PerfLevel_SkipNonRef, PerfLevel_NB };
+  int                  m_nPerfLevel            = PerfLevel_Full;
+  REFERENCE_TIME       m_rtPerfLevelChange     = AV_NOPTS_VALUE;
+  REFERENCE_TIME       m_rtPerfLastLate        = AV_NOPTS_VALUE;
+  BOOL                 m_bQualityBehind        = FALSE;   ///< The last quality message reported a late frame
 
   AVFilterGraph        *m_pFilterGraph         = nullptr;
   AVFilterContext      *m_pFilterBufferSrc     = nullptr;
@@ -274,14 +489,31 @@ private:
   int                  m_filterHeight          = 0;
   LAVFrame             m_FilterPrevFrame;
 
+  enum { SWDeintAuto_BWDIF, SWDeintAuto_YADIF, SWDeintAuto_LineDouble, SWDeintAuto_NB };
+  int                  m_SWDeintAutoLevel      = SWDeintAuto_BWDIF;
+  int                  m_filterAutoLevel       = SWDeintAuto_BWDIF;
+  REFERENCE_TIME       m_rtFilterCost          = 0;
+  REFERENCE_TIME       m_rtFilterBudget        = 0;
+  int                  m_nFilterCostFrames     = 0;
+  int                  m_nFilterHoldWindows    = 0;
+  int                  m_nFilterHoldPeriod     = LAV_SWDEINT_AUTO_HOLD_MIN;
+
   BOOL                 m_LAVPinInfoValid       = FALSE;
   LAVPinInfo           m_LAVPinInfo;
   int                  m_X264Build             = -1;
 
+  // share of the worker pool threads, live streams get a larger share
+  CWorkerBudget        m_WorkerBudget;
+
+  // NUMA node of the decoder, only selected again if the setting changes
+  DWORD                m_dwNUMAPlacementSetting = NUMA_NODE_OFF;
+  int                  m_nNUMAPlacement        = -1;
+
   struct {
     AVMasteringDisplayMetadata Mastering;
     AVContentLightMetadata ContentLight;
   } m_SideData;
+  CLAVFrameSideDataCache m_SideDataCache;         ///< stream-level side data merged into the frames
 
   CLAVVideoSubtitleInputPin *m_pSubtitleInput  = nullptr;
   CLAVSubtitleConsumer *m_SubtitleConsumer     = nullptr;
@@ -290,6 +522,50 @@ private:
 
   LAVFrame             *m_pLastSequenceFrame   = nullptr;
 
+  // converted output of the last sequence frame before subtitles were blended, redraws copy it instead of converting again
+  BYTE                 *m_pStillOutput         = nullptr;
+  long                 m_lStillOutputSize      = 0;
+  long                 m_lStillOutputLength    = 0;      // 0 if nothing is stored
+  GUID                 m_StillOutputSubtype    = GUID_NULL;
+  LONG                 m_lStillOutputWidth     = 0;
+  LONG                 m_lStillOutputHeight    = 0;
+
+  CCritSec             m_csFramePool;
+  std::vector<LAVFrame *> m_FramePool;
+
+  // frame buffers and subtitles hold their own reference, they can be released after the filter
+  CMemoryAccount       *m_pMemoryAccount       = new CMemoryAccount();
+  BOOL                 m_bFramePoolLowFootprint = FALSE;
+
+  // Asynchronous delivery
+  BOOL                 m_bAsyncDelivery = FALSE;
+  CCritSec             m_csDeliver;
+  CSynchronizedQueue<LAVFrame *> m_DeliveryQueue;
+  CAMEvent             m_evDeliveryQueued;
+  CAMEvent             m_evDeliveryQueueSpace;
+  CAMEvent             m_evDeliveryIdle{TRUE};
+
+  // Direct rendering, the layout of the output samples is published by the delivery for the decoder
+  CCritSec             m_csDirectRendering;
+  struct DirectRenderingLayout {
+    BOOL           bValid;
+    LAVOutPixFmts  outFmt;
+    LAVPixelFormat format;
+    int            width;
+    int            height;
+    LONG           stride;              ///< in pixel
+    LONG           planeHeight;
+    long           lImageSize;
+  } m_DirectRenderingLayout = { FALSE };
+  IMediaSample        *m_pDirectRenderingSample = nullptr;  ///< sample carrying a media type change, left for the regular delivery
+
+  // The output sample of the next frame is acquired in the background
+  COutputSamplePrefetch m_SamplePrefetch;
+
+  // Resources are released after the filter was idle for a while (see SetIdleReleaseTime)
+  HANDLE               m_hIdleTimer     = nullptr;
+  BOOL                 m_bIdleReleased  = FALSE;   ///< the decoder was closed while stopped, and is created again at start
+
   AM_SimpleRateChange  m_DVDRate = AM_SimpleRateChange{AV_NOPTS_VALUE, 10000};
 
   BOOL                 m_bRuntimeConfig = FALSE;
@@ -304,6 +580,8 @@ private:
     DWORD HWAccel;
     BOOL bHWFormats[HWCodec_NB];
     DWORD HWAccelResFlags;
+    BOOL  bHWAccelAuto;
+    BOOL  bHWAccelStandby;
     BOOL  HWAccelCUVIDXVA;
     DWORD HWDeintMode;
     DWORD HWDeintOutput;
@@ -311,20 +589,50 @@ private:
     LAVDeintMode DeintMode;
     DWORD SWDeintMode;
     DWORD SWDeintOutput;
+    DWORD SWDeintThreads;
     DWORD DitherMode;
     BOOL bDVDVideo;
     DWORD HWAccelDeviceDXVA2;
     DWORD HWAccelDeviceDXVA2Desc;
     DWORD HWAccelDeviceD3D11;
     DWORD HWAccelDeviceD3D11Desc;
+    DWORD HWAccelStagingTextures;
+    DWORD HWAccelSurfacePoolMin;
+    DWORD HWAccelSurfacePoolMax;
+    BOOL bHWAccelDeviceLoadBalancing;
+    BOOL bHWAccelGPUConversion;
+    BOOL bAsyncDelivery;
     BOOL bH264MVCOverride;
     BOOL bCCOutputPinEnabled;
+    DWORD PerformanceMode;
+    BOOL bStreamingThreadPriority;
+    DWORD NUMANode;
+    BOOL bDirectRendering;
+    BOOL bLowDelay;
+    BOOL bLowFootprint;
+    DWORD OutputQueueDepth;
+    DWORD OutputQueueBatch;
+    DWORD AV1FilmGrainMode;
+    DWORD IdleReleaseTime;
+    BOOL bOutputFormatCostRanking;
   } m_settings;
 
   DWORD m_dwGPUDeviceIndex = DWORD_MAX;
 
   CBaseTrayIcon *m_pTrayIcon = nullptr;
 
+  CVideoTelemetry m_Telemetry;
+  REFERENCE_TIME  m_rtDecodeExcluded = 0;  ///< Time spent in delivery and GPU copy-back during the current Decode call
+
+  // Capture times of the recent input samples, written while decoding and read on delivery
+  struct CaptureTime {
+    REFERENCE_TIME rtStart;
+    REFERENCE_TIME rtCapture;
+  } m_CaptureTimes[LAV_CAPTURE_TIME_ENTRIES];
+  int      m_nCaptureTimes    = 0;
+  int      m_nCaptureTimeNext = 0;
+  CCritSec m_csCaptureTimes;
+
 #ifdef DEBUG
   FloatingAverage<double> m_pixFmtTimingAvg;
 #endif
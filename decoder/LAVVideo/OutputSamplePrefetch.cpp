@@ -0,0 +1,145 @@
+/*
+ *      Copyright (C) 2010-2019 Hendrik Leppkes
+ *      http://www.1f0.de
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program; if not, write to the Free Software Foundation, Inc.,
+ *  51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#include "stdafx.h"
+#include "OutputSamplePrefetch.h"
+
+COutputSamplePrefetch::COutputSamplePrefetch()
+{
+}
+
+COutputSamplePrefetch::~COutputSamplePrefetch()
+{
+  Stop();
+}
+
+HRESULT COutputSamplePrefetch::Start(CBaseOutputPin *pPin)
+{
+  CheckPointer(pPin, E_POINTER);
+  if (m_hThread)
+    return S_FALSE;
+
+  m_pPin = pPin;
+  m_bExit = FALSE;
+  m_bPending = FALSE;
+  m_dwHits = m_dwMisses = 0;
+  m_evRequest.Reset();
+
+  m_hThread = (HANDLE)_beginthreadex(nullptr, 0, PrefetchThreadProc, this, 0, nullptr);
+  if (m_hThread == nullptr) {
+    DbgLog((LOG_ERROR, 10, L"COutputSamplePrefetch::Start(): Creating the prefetch thread failed"));
+    m_pPin = nullptr;
+    return E_FAIL;
+  }
+
+  return S_OK;
+}
+
+void COutputSamplePrefetch::Stop()
+{
+  if (m_hThread) {
+    m_bExit = TRUE;
+    m_evRequest.Set();
+    WaitForSingleObject(m_hThread, INFINITE);
+    CloseHandle(m_hThread);
+    m_hThread = nullptr;
+
+    DbgLog((LOG_TRACE, 10, L"COutputSamplePrefetch::Stop(): %u samples prefetched, %u requested directly", m_dwHits, m_dwMisses));
+  }
+
+  Reset();
+  m_pPin = nullptr;
+}
+
+void COutputSamplePrefetch::Request()
+{
+  CAutoLock lock(&m_csSample);
+  if (m_hThread == nullptr || m_pSample || m_bPending)
+    return;
+
+  m_bPending = TRUE;
+  m_evRequest.Set();
+}
+
+IMediaSample *COutputSamplePrefetch::Take()
+{
+  CAutoLock lock(&m_csSample);
+  if (m_hThread == nullptr)
+    return nullptr;
+
+  IMediaSample *pSample = m_pSample;
+  m_pSample = nullptr;
+
+  if (pSample)
+    m_dwHits++;
+  else
+    m_dwMisses++;
+
+  return pSample;
+}
+
+void COutputSamplePrefetch::Reset()
+{
+  CAutoLock lock(&m_csSample);
+  SafeRelease(&m_pSample);
+  m_dwGeneration++;
+}
+
+unsigned __stdcall COutputSamplePrefetch::PrefetchThreadProc(void *pParam)
+{
+  SetThreadName(-1, "LAVVideo Sample Prefetch");
+  static_cast<COutputSamplePrefetch *>(pParam)->PrefetchThread();
+  return 0;
+}
+
+void COutputSamplePrefetch::PrefetchThread()
+{
+  while (1) {
+    m_evRequest.Wait();
+    if (m_bExit)
+      break;
+
+    DWORD dwGeneration = 0;
+    {
+      CAutoLock lock(&m_csSample);
+      dwGeneration = m_dwGeneration;
+    }
+
+    // blocks until the renderer returns a sample, or the allocator is decommitted
+    IMediaSample *pSample = nullptr;
+    HRESULT hr = m_pPin->GetDeliveryBuffer(&pSample, nullptr, nullptr, 0);
+
+    // the buffer is checked here already, a media type change is applied by the delivery
+    BYTE *pData = nullptr;
+    if (SUCCEEDED(hr) && pSample && (FAILED(pSample->GetPointer(&pData)) || pData == nullptr))
+      SafeRelease(&pSample);
+
+    {
+      CAutoLock lock(&m_csSample);
+      if (pSample && dwGeneration == m_dwGeneration && m_pSample == nullptr) {
+        m_pSample = pSample;
+        pSample = nullptr;
+      }
+      m_bPending = FALSE;
+    }
+
+    // a sample of a previous format, or one that arrived while the output was flushed
+    SafeRelease(&pSample);
+  }
+}
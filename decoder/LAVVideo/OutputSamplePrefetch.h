@@ -0,0 +1,64 @@
+/*
+ *      Copyright (C) 2010-2019 Hendrik Leppkes
+ *      http://www.1f0.de
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program; if not, write to the Free Software Foundation, Inc.,
+ *  51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+
+#pragma once
+
+// Acquires the next output sample in the background, while the current frame is converted and delivered
+// Renderers holding on to their samples until presentation make GetBuffer block; the wait now overlaps with the
+// work on the previous frame. At most one sample is held, and taking it never waits: if it did not arrive yet,
+// the caller gets its sample from the allocator as before.
+class COutputSamplePrefetch
+{
+public:
+  COutputSamplePrefetch();
+  ~COutputSamplePrefetch();
+
+  // Start the prefetch thread for the pin, samples are only requested once the allocator is committed
+  HRESULT Start(CBaseOutputPin *pPin);
+  // Stop the thread, called after the allocator was decommitted so a pending request returns
+  void Stop();
+
+  // Acquire the next sample, if none is held or on its way
+  void Request();
+  // Take the sample acquired for the next frame, nullptr if it is not available yet
+  IMediaSample *Take();
+  // Release the held sample, and drop a pending one once it arrives
+  // Needed before the output format changes, and when the renderer wants its samples back.
+  void Reset();
+
+private:
+  static unsigned __stdcall PrefetchThreadProc(void *pParam);
+  void PrefetchThread();
+
+private:
+  CBaseOutputPin *m_pPin = nullptr;
+  HANDLE m_hThread       = nullptr;
+  volatile BOOL m_bExit  = FALSE;
+
+  CCritSec m_csSample;
+  IMediaSample *m_pSample = nullptr;
+  BOOL m_bPending         = FALSE;
+  DWORD m_dwGeneration    = 0;      // changes with every reset, samples requested before are released
+
+  CAMEvent m_evRequest;
+
+  DWORD m_dwHits   = 0;
+  DWORD m_dwMisses = 0;
+};
@@ -0,0 +1,421 @@
+/*
+ *      Copyright (C) 2010-2019 Hendrik Leppkes
+ *      http://www.1f0.de
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program; if not, write to the Free Software Foundation, Inc.,
+ *  51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+
+#include "stdafx.h"
+#include "VideoBatch.h"
+#include "LAVVideo.h"
+
+#include "LAVSplitterSettings.h"
+#include "WorkerPool.h"
+#include "timer.h"
+#include "moreuuids.h"
+
+#include <process.h>
+#include <Psapi.h>
+#include <PdhMsg.h>
+#include <float.h>
+
+CVideoBatch::CVideoBatch()
+{
+}
+
+CVideoBatch::~CVideoBatch()
+{
+  ASSERT(!m_bRunning);
+}
+
+HRESULT CVideoBatch::AddFile(LPCWSTR pszFileName, DWORD *pdwFile)
+{
+  CheckPointer(pszFileName, E_POINTER);
+  if (!*pszFileName)
+    return E_INVALIDARG;
+
+  CAutoLock lock(&m_csFiles);
+  if (m_bRunning)
+    return E_UNEXPECTED;
+
+  m_Files.push_back(pszFileName);
+  if (pdwFile)
+    *pdwFile = (DWORD)m_Files.size() - 1;
+  return S_OK;
+}
+
+HRESULT CVideoBatch::Run(LAVOutPixFmts outputFormat, DWORD dwParallel, ILAVVideoBatchCallback *pCallback)
+{
+  CheckPointer(pCallback, E_POINTER);
+  if (outputFormat < 0 || outputFormat >= LAVOutPixFmt_NB)
+    return E_INVALIDARG;
+
+  {
+    CAutoLock lock(&m_csFiles);
+    if (m_bRunning)
+      return E_UNEXPECTED;
+    m_bRunning = TRUE;
+  }
+
+  m_OutputFormat = outputFormat;
+  m_pCallback = pCallback;
+  m_pCallback->AddRef();
+  m_lNextFile = 0;
+  m_lFailed = 0;
+  m_lAbort = 0;
+
+  // every decoder takes its share of the worker pool, so a few threads per file keep all processors busy
+  const DWORD nFiles = (DWORD)m_Files.size();
+  DWORD nThreads = dwParallel ? dwParallel : (DWORD)max(1, worker_pool_threads() / LAV_BATCH_THREADS_PER_FILE);
+  nThreads = min(nThreads, nFiles);
+
+  DbgLog((LOG_TRACE, 10, L"CVideoBatch::Run(): Decoding %u files on %u threads", nFiles, nThreads));
+
+  std::vector<HANDLE> threads;
+  for (DWORD i = 0; i < nThreads; i++) {
+    HANDLE hThread = (HANDLE)_beginthreadex(nullptr, 0, BatchThreadProc, this, 0, nullptr);
+    if (hThread)
+      threads.push_back(hThread);
+  }
+
+  // the files are still decoded, one after another, if no thread could be created
+  if (threads.empty() && nFiles > 0)
+    BatchThread();
+
+  for (HANDLE hThread : threads) {
+    WaitForSingleObject(hThread, INFINITE);
+    CloseHandle(hThread);
+  }
+
+  HRESULT hr = (m_lFailed || m_lAbort) ? S_FALSE : S_OK;
+  SafeRelease(&m_pCallback);
+
+  CAutoLock lock(&m_csFiles);
+  m_Files.clear();
+  m_bRunning = FALSE;
+
+  return hr;
+}
+
+HRESULT CVideoBatch::RunScaling(LAVOutPixFmts outputFormat, DWORD dwMaxStreams, DWORD dwStepSeconds, DWORD dwRounds, ILAVVideoScalingCallback *pCallback)
+{
+  CheckPointer(pCallback, E_POINTER);
+  if (outputFormat < 0 || outputFormat >= LAVOutPixFmt_NB || dwMaxStreams == 0 || dwMaxStreams > LAV_BATCH_MAX_STREAMS || dwStepSeconds == 0)
+    return E_INVALIDARG;
+
+  {
+    CAutoLock lock(&m_csFiles);
+    if (m_bRunning || m_Files.empty())
+      return E_UNEXPECTED;
+    m_bRunning = TRUE;
+  }
+
+  m_OutputFormat = outputFormat;
+  m_pCallback = nullptr;
+  m_lFailed = 0;
+  m_lAbort = 0;
+
+  // the decode engines of the GPUs are only published by WDDM 2 drivers (Windows 10 1709 and newer)
+  PDH_HQUERY hQuery = nullptr;
+  PDH_HCOUNTER hGPUCounter = nullptr;
+  if (PdhOpenQueryW(nullptr, 0, &hQuery) == ERROR_SUCCESS) {
+    if (PdhAddEnglishCounterW(hQuery, L"\\GPU Engine(*engtype_VideoDecode)\\Utilization Percentage", 0, &hGPUCounter) != ERROR_SUCCESS)
+      hGPUCounter = nullptr;
+  }
+
+  DbgLog((LOG_TRACE, 10, L"CVideoBatch::RunScaling(): Benchmarking up to %u streams of %u files, %u seconds per step", dwMaxStreams, (DWORD)m_Files.size(), dwStepSeconds));
+
+  HRESULT hr = S_OK;
+  for (DWORD dwRound = 0; (dwRounds == 0 || dwRound < dwRounds) && !m_lAbort && SUCCEEDED(hr); dwRound++) {
+    DWORD dwStreams = 1;
+    for (;;) {
+      hr = RunScalingStep(dwRound, dwStreams, dwStepSeconds, hQuery, hGPUCounter, pCallback);
+      if (FAILED(hr) || m_lAbort || dwStreams == dwMaxStreams)
+        break;
+      dwStreams = min(dwStreams * 2, dwMaxStreams);
+    }
+  }
+
+  if (hQuery)
+    PdhCloseQuery(hQuery);
+
+  hr = (FAILED(hr) || m_lFailed || m_lAbort) ? S_FALSE : S_OK;
+
+  CAutoLock lock(&m_csFiles);
+  m_Files.clear();
+  m_bRunning = FALSE;
+
+  return hr;
+}
+
+// Sum up the instances of a counter with a wildcard, -1 if it has no valid data
+static double GetCounterSum(PDH_HCOUNTER hCounter)
+{
+  DWORD dwSize = 0, dwCount = 0;
+  PDH_STATUS status = PdhGetFormattedCounterArrayW(hCounter, PDH_FMT_DOUBLE, &dwSize, &dwCount, nullptr);
+  if (status == ERROR_SUCCESS)
+    return 0.0;
+  if (status != PDH_MORE_DATA)
+    return -1.0;
+
+  std::vector<BYTE> buffer(dwSize);
+  PDH_FMT_COUNTERVALUE_ITEM_W *pItems = (PDH_FMT_COUNTERVALUE_ITEM_W *)buffer.data();
+  if (PdhGetFormattedCounterArrayW(hCounter, PDH_FMT_DOUBLE, &dwSize, &dwCount, pItems) != ERROR_SUCCESS)
+    return -1.0;
+
+  // every process using an engine has an instance of its own
+  double dSum = 0.0;
+  for (DWORD i = 0; i < dwCount; i++) {
+    if (pItems[i].FmtValue.CStatus == PDH_CSTATUS_VALID_DATA || pItems[i].FmtValue.CStatus == PDH_CSTATUS_NEW_DATA)
+      dSum += pItems[i].FmtValue.doubleValue;
+  }
+  return dSum;
+}
+
+static ULONGLONG FileTimeToULL(const FILETIME &ft)
+{
+  return ((ULONGLONG)ft.dwHighDateTime << 32) | ft.dwLowDateTime;
+}
+
+HRESULT CVideoBatch::RunScalingStep(DWORD dwRound, DWORD dwStreams, DWORD dwStepSeconds, PDH_HQUERY hQuery, PDH_HCOUNTER hGPUCounter, ILAVVideoScalingCallback *pCallback)
+{
+  std::vector<ScalingStream> streams(dwStreams);
+  for (DWORD i = 0; i < dwStreams; i++) {
+    streams[i].pBatch = this;
+    streams[i].dwIndex = i;
+  }
+
+  FILETIME ftCreation, ftExit, ftKernelStart, ftUserStart, ftKernelEnd, ftUserEnd;
+  GetProcessTimes(GetCurrentProcess(), &ftCreation, &ftExit, &ftKernelStart, &ftUserStart);
+  if (hGPUCounter)
+    PdhCollectQueryData(hQuery);
+
+  const REFERENCE_TIME rtStart = timer_get_ref_time();
+  m_ullStepEnd = GetTickCount64() + dwStepSeconds * 1000ULL;
+
+  std::vector<HANDLE> threads;
+  for (ScalingStream &stream : streams) {
+    HANDLE hThread = (HANDLE)_beginthreadex(nullptr, 0, ScalingThreadProc, &stream, 0, nullptr);
+    if (hThread)
+      threads.push_back(hThread);
+    else
+      stream.hr = E_FAIL;
+  }
+
+  for (HANDLE hThread : threads) {
+    WaitForSingleObject(hThread, INFINITE);
+    CloseHandle(hThread);
+  }
+
+  LAVVideoScalingResult result = { 0 };
+  result.dwRound = dwRound;
+  result.dwStreams = dwStreams;
+  result.rtDuration = max(timer_get_ref_time() - rtStart, 1LL);
+  const double dSeconds = result.rtDuration / 10000000.0;
+
+  // the frame rate of every stream, and their spread
+  double dSum = 0.0, dSumSquares = 0.0;
+  result.dStreamFpsMin = DBL_MAX;
+  for (const ScalingStream &stream : streams) {
+    const double dFps = stream.ullFrames / dSeconds;
+    dSum += dFps;
+    dSumSquares += dFps * dFps;
+    result.dStreamFpsMin = min(result.dStreamFpsMin, dFps);
+    result.dStreamFpsMax = max(result.dStreamFpsMax, dFps);
+    result.ullFrames += stream.ullFrames;
+    if (FAILED(stream.hr))
+      result.dwFailedStreams++;
+  }
+  const double dMean = dSum / dwStreams;
+  result.dStreamFpsVariance = max(dSumSquares / dwStreams - dMean * dMean, 0.0);
+  result.dFramesPerSecond = result.ullFrames / dSeconds;
+
+  // CPU time of all threads of the process, against the time of all processors
+  GetProcessTimes(GetCurrentProcess(), &ftCreation, &ftExit, &ftKernelEnd, &ftUserEnd);
+  const ULONGLONG ullCPUTime = (FileTimeToULL(ftKernelEnd) - FileTimeToULL(ftKernelStart)) + (FileTimeToULL(ftUserEnd) - FileTimeToULL(ftUserStart));
+  result.dCPUUsage = 100.0 * ullCPUTime / ((double)result.rtDuration * max(GetActiveProcessorCount(ALL_PROCESSOR_GROUPS), 1UL));
+
+  result.dGPUDecodeUsage = -1.0;
+  if (hGPUCounter && PdhCollectQueryData(hQuery) == ERROR_SUCCESS)
+    result.dGPUDecodeUsage = GetCounterSum(hGPUCounter);
+
+  PROCESS_MEMORY_COUNTERS_EX pmc = { sizeof(pmc) };
+  if (GetProcessMemoryInfo(GetCurrentProcess(), (PROCESS_MEMORY_COUNTERS *)&pmc, sizeof(pmc))) {
+    result.ullPrivateBytes = pmc.PrivateUsage;
+    result.ullWorkingSet = pmc.WorkingSetSize;
+  }
+
+  DbgLog((LOG_TRACE, 10, L"CVideoBatch::RunScalingStep(): Round %u, %u streams: %.1f fps (%.1f - %.1f per stream), CPU %.1f%%, GPU decode %.1f%%, %I64u MB private", dwRound, dwStreams,
+          result.dFramesPerSecond, result.dStreamFpsMin, result.dStreamFpsMax, result.dCPUUsage, result.dGPUDecodeUsage, result.ullPrivateBytes >> 20));
+
+  return pCallback->ScalingStepDone(&result);
+}
+
+unsigned __stdcall CVideoBatch::ScalingThreadProc(void *pParam)
+{
+  ScalingStream *pStream = static_cast<ScalingStream *>(pParam);
+  HRESULT hr = CoInitializeEx(nullptr, COINIT_MULTITHREADED);
+  pStream->pBatch->ScalingThread(pStream);
+  if (SUCCEEDED(hr))
+    CoUninitialize();
+  return 0;
+}
+
+// Decode the files one after another until the step ends, every stream starts at a different one
+void CVideoBatch::ScalingThread(ScalingStream *pStream)
+{
+  const DWORD nFiles = (DWORD)m_Files.size();
+  DWORD dwFile = pStream->dwIndex % nFiles;
+  while (!m_lAbort && GetTickCount64() < m_ullStepEnd) {
+    HRESULT hr = DecodeFile(dwFile, pStream);
+    if (hr == E_ABORT)
+      break;
+    if (FAILED(hr)) {
+      pStream->hr = hr;
+      InterlockedExchange(&m_lFailed, 1);
+      break;
+    }
+    dwFile = (dwFile + 1) % nFiles;
+  }
+}
+
+HRESULT CVideoBatch::Abort()
+{
+  CAutoLock lock(&m_csFiles);
+  if (!m_bRunning)
+    return S_FALSE;
+
+  InterlockedExchange(&m_lAbort, 1);
+  return S_OK;
+}
+
+unsigned __stdcall CVideoBatch::BatchThreadProc(void *pParam)
+{
+  // the splitter instances are created through COM
+  HRESULT hr = CoInitializeEx(nullptr, COINIT_MULTITHREADED);
+  static_cast<CVideoBatch *>(pParam)->BatchThread();
+  if (SUCCEEDED(hr))
+    CoUninitialize();
+  return 0;
+}
+
+void CVideoBatch::BatchThread()
+{
+  const LONG nFiles = (LONG)m_Files.size();
+  for (;;) {
+    const LONG nFile = InterlockedIncrement(&m_lNextFile) - 1;
+    if (nFile >= nFiles)
+      break;
+
+    HRESULT hr = m_lAbort ? E_ABORT : DecodeFile((DWORD)nFile);
+    if (FAILED(hr))
+      InterlockedExchange(&m_lFailed, 1);
+
+    m_pCallback->BatchFileDone((DWORD)nFile, hr);
+  }
+}
+
+// Decode one file, with its own splitter and decoder instance
+// The streams of a scaling benchmark only count the frames, and stop at the end of the step.
+HRESULT CVideoBatch::DecodeFile(DWORD dwFile, ScalingStream *pStream)
+{
+  HRESULT hr = S_OK;
+  IBaseFilter *pSplitter = nullptr;
+  IFileSourceFilter *pFileSource = nullptr;
+  ILAVFPacketSource *pPacketSource = nullptr;
+  AM_MEDIA_TYPE *pmt = nullptr;
+  IMediaSample *pSample = nullptr;
+  CLAVVideo *pVideo = nullptr;
+
+  hr = CoCreateInstance(CLSID_LAVSplitterSource, nullptr, CLSCTX_INPROC_SERVER, IID_IBaseFilter, (void **)&pSplitter);
+  if (FAILED(hr))
+    goto done;
+
+  if (FAILED(hr = pSplitter->QueryInterface(&pFileSource)) || FAILED(hr = pSplitter->QueryInterface(&pPacketSource)))
+    goto done;
+
+  hr = pFileSource->Load(m_Files[dwFile].c_str(), nullptr);
+  if (FAILED(hr)) {
+    DbgLog((LOG_TRACE, 10, L"CVideoBatch::DecodeFile(): Opening '%s' failed (hr: 0x%x)", m_Files[dwFile].c_str(), hr));
+    goto done;
+  }
+
+  hr = pPacketSource->GetPacketSourceMediaType(&pmt);
+  if (FAILED(hr))
+    goto done;
+
+  pVideo = new CLAVVideo(nullptr, &hr);
+  if (pVideo == nullptr) {
+    hr = E_OUTOFMEMORY;
+    goto done;
+  }
+  pVideo->NonDelegatingAddRef();
+  if (FAILED(hr))
+    goto done;
+
+  hr = pVideo->OpenFrameSource(pmt, m_OutputFormat, nullptr);
+  if (FAILED(hr))
+    goto done;
+
+  while (!m_lAbort && (hr = pPacketSource->ReadSourcePacket(&pSample)) == S_OK) {
+    hr = pVideo->DecodeSourceSample(pSample);
+    SafeRelease(&pSample);
+    if (SUCCEEDED(hr))
+      hr = DeliverFrames(pVideo, dwFile, pStream);
+    if (FAILED(hr))
+      goto done;
+    if (pStream && GetTickCount64() >= m_ullStepEnd)
+      goto done;
+  }
+  if (FAILED(hr))
+    goto done;
+
+  if (m_lAbort) {
+    hr = E_ABORT;
+    goto done;
+  }
+
+  hr = pVideo->DrainFrameSource();
+  if (SUCCEEDED(hr))
+    hr = DeliverFrames(pVideo, dwFile, pStream);
+
+done:
+  if (pVideo) {
+    pVideo->CloseFrameSource();
+    pVideo->NonDelegatingRelease();
+  }
+  if (pmt)
+    DeleteMediaType(pmt);
+  SafeRelease(&pPacketSource);
+  SafeRelease(&pFileSource);
+  SafeRelease(&pSplitter);
+
+  return SUCCEEDED(hr) ? S_OK : hr;
+}
+
+HRESULT CVideoBatch::DeliverFrames(ILAVVideoFrameSource *pSource, DWORD dwFile, ScalingStream *pStream)
+{
+  HRESULT hr = S_OK;
+  LAVVideoSourceFrame *pFrame = nullptr;
+  while (SUCCEEDED(hr) && pSource->GetSourceFrame(&pFrame) == S_OK) {
+    if (pStream)
+      pStream->ullFrames++;
+    else
+      hr = m_pCallback->BatchFrameDecoded(dwFile, pFrame);
+    pSource->ReleaseSourceFrame(pFrame);
+  }
+  return SUCCEEDED(hr) ? S_OK : hr;
+}
@@ -0,0 +1,80 @@
+/*
+ *      Copyright (C) 2010-2019 Hendrik Leppkes
+ *      http://www.1f0.de
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program; if not, write to the Free Software Foundation, Inc.,
+ *  51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+
+#pragma once
+
+#include "LAVVideoSettings.h"
+
+#include <Pdh.h>
+
+#include <string>
+#include <vector>
+
+// Number of worker pool threads per file decoded at once, if the batch doesn't specify the number of files
+#define LAV_BATCH_THREADS_PER_FILE 4
+
+// Highest number of streams of a scaling benchmark step
+#define LAV_BATCH_MAX_STREAMS 256
+
+// Batch decoding of many files without a graph, see ILAVVideoBatchDecoder
+// Every batch thread takes the next file which was not started yet, until all of them are done.
+class CVideoBatch
+{
+public:
+  CVideoBatch();
+  ~CVideoBatch();
+
+  HRESULT AddFile(LPCWSTR pszFileName, DWORD *pdwFile);
+  HRESULT Run(LAVOutPixFmts outputFormat, DWORD dwParallel, ILAVVideoBatchCallback *pCallback);
+  HRESULT RunScaling(LAVOutPixFmts outputFormat, DWORD dwMaxStreams, DWORD dwStepSeconds, DWORD dwRounds, ILAVVideoScalingCallback *pCallback);
+  HRESULT Abort();
+
+private:
+  // A stream of a scaling benchmark step, which only counts its frames
+  struct ScalingStream {
+    CVideoBatch *pBatch  = nullptr;
+    DWORD dwIndex        = 0;
+    ULONGLONG ullFrames  = 0;
+    HRESULT hr           = S_OK;
+  };
+
+  static unsigned __stdcall BatchThreadProc(void *pParam);
+  void BatchThread();
+
+  static unsigned __stdcall ScalingThreadProc(void *pParam);
+  void ScalingThread(ScalingStream *pStream);
+  HRESULT RunScalingStep(DWORD dwRound, DWORD dwStreams, DWORD dwStepSeconds, PDH_HQUERY hQuery, PDH_HCOUNTER hGPUCounter, ILAVVideoScalingCallback *pCallback);
+
+  HRESULT DecodeFile(DWORD dwFile, ScalingStream *pStream = nullptr);
+  HRESULT DeliverFrames(ILAVVideoFrameSource *pSource, DWORD dwFile, ScalingStream *pStream);
+
+private:
+  CCritSec m_csFiles;
+  std::vector<std::wstring> m_Files;
+  BOOL m_bRunning = FALSE;
+
+  // State of the running batch, the files are not changed while it runs
+  LAVOutPixFmts m_OutputFormat         = LAVOutPixFmt_None;
+  ILAVVideoBatchCallback *m_pCallback  = nullptr;
+  volatile LONG m_lNextFile            = 0;
+  volatile LONG m_lFailed              = 0;
+  volatile LONG m_lAbort               = 0;
+  ULONGLONG m_ullStepEnd               = 0;   // tick count the running scaling step ends at
+};
@@ -36,6 +36,13 @@ STDMETHODIMP CVideoInputPin::NonDelegatingQueryInterface(REFIID riid, void** ppv
     __super::NonDelegatingQueryInterface(riid, ppv);
 }
 
+// The receive lock is only taken once for the whole batch, every sample only re-enters it
+STDMETHODIMP CVideoInputPin::ReceiveMultiple(IMediaSample **pSamples, long nSamples, long *nSamplesProcessed)
+{
+  CAutoLock lock(&m_pTransformFilter->m_csReceive);
+  return __super::ReceiveMultiple(pSamples, nSamples, nSamplesProcessed);
+}
+
 STDMETHODIMP CVideoInputPin::NotifyAllocator(IMemAllocator * pAllocator, BOOL bReadOnly)
 {
   HRESULT hr = __super::NotifyAllocator(pAllocator, bReadOnly);
@@ -34,6 +34,7 @@ public:
 
   // IMemInputPin
   STDMETHODIMP NotifyAllocator(IMemAllocator * pAllocator, BOOL bReadOnly);
+  STDMETHODIMP ReceiveMultiple(IMediaSample **pSamples, long nSamples, long *nSamplesProcessed);
 
   // IPinSegmentEx
   STDMETHODIMP EndOfSegment();
@@ -22,7 +22,7 @@
 #include "VideoOutputPin.h"
 
 CVideoOutputPin::CVideoOutputPin(LPCTSTR pObjectName, CLAVVideo *pFilter, HRESULT * phr, LPCWSTR pName)
-  : CTransformOutputPin(pObjectName, (CTransformFilter *)pFilter, phr, pName)
+  : CQueuedOutputPin(pObjectName, (CTransformFilter *)pFilter, phr, pName)
   , m_pFilter(pFilter)
 {
 }
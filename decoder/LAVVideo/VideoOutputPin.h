@@ -19,7 +19,7 @@
 
 #pragma once
 
-class CVideoOutputPin : public CTransformOutputPin
+class CVideoOutputPin : public CQueuedOutputPin
 {
 public:
   CVideoOutputPin(LPCTSTR pObjectName, CLAVVideo *pFilter, HRESULT * phr, LPCWSTR pName);
@@ -248,10 +248,14 @@ HRESULT CLAVVideoSettingsProp::OnActivate()
   WCHAR swdeintYADIF[] = L"YADIF";
   WCHAR swdeintW3FDIFS[] = L"Weston Three Field (Simple)";
   WCHAR swdeintW3FDIFC[] = L"Weston Three Field (Complex)";
+  WCHAR swdeintBWDIF[] = L"Bob Weaver (BWDIF)";
+  WCHAR swdeintAuto[] = L"Automatic (adapts to CPU load)";
   SendDlgItemMessage(m_Dlg, IDC_SWDEINT_MODE, CB_ADDSTRING, 0, (LPARAM)swdeintNone);
   SendDlgItemMessage(m_Dlg, IDC_SWDEINT_MODE, CB_ADDSTRING, 0, (LPARAM)swdeintYADIF);
   SendDlgItemMessage(m_Dlg, IDC_SWDEINT_MODE, CB_ADDSTRING, 0, (LPARAM)swdeintW3FDIFS);
   SendDlgItemMessage(m_Dlg, IDC_SWDEINT_MODE, CB_ADDSTRING, 0, (LPARAM)swdeintW3FDIFC);
+  SendDlgItemMessage(m_Dlg, IDC_SWDEINT_MODE, CB_ADDSTRING, 0, (LPARAM)swdeintBWDIF);
+  SendDlgItemMessage(m_Dlg, IDC_SWDEINT_MODE, CB_ADDSTRING, 0, (LPARAM)swdeintAuto);
 
   addHint(IDC_HWACCEL_MPEG4, L"EXPERIMENTAL! The MPEG4-ASP decoder is known to be unstable! Use at your own peril!");
   addHint(IDC_HWACCEL_CUVID_DXVA, L"Enable DXVA video processing for CUVID decoding, enables hybrid decoding and can affect deinterlacing quality.\n\nNote: Using DXVA2-CopyBack is recommended for hybrid decoding instead of using CUVID in DXVA mode.");
@@ -354,7 +358,7 @@ HRESULT CLAVVideoSettingsProp::UpdateHWOptions()
 
   DWORD dwSupport = m_pVideoSettings->CheckHWAccelSupport(hwAccel);
   BOOL bEnabled = (hwAccel != HWAccel_None) && dwSupport;
-  BOOL bHWDeint = bEnabled && (hwAccel == HWAccel_CUDA || hwAccel == HWAccel_QuickSync);
+  BOOL bHWDeint = bEnabled && (hwAccel == HWAccel_CUDA || hwAccel == HWAccel_QuickSync || hwAccel == HWAccel_DXVA2CopyBack || hwAccel == HWAccel_D3D11);
   BOOL bHWDeintEnabled = bHWDeint && (BOOL)SendDlgItemMessage(m_Dlg, IDC_HWDEINT_ENABLE, BM_GETCHECK, 0, 0);
   BOOL bCUDAOnly = bEnabled && (hwAccel == HWAccel_CUDA);
   BOOL bDVD = bEnabled && (BOOL)SendDlgItemMessage(m_Dlg, IDC_HWACCEL_MPEG2, BM_GETCHECK, 0, 0);
@@ -445,9 +449,11 @@ HRESULT CLAVVideoSettingsProp::UpdateYADIFOptions()
 {
   DWORD dwVal = (DWORD)SendDlgItemMessage(m_Dlg, IDC_SWDEINT_MODE, CB_GETCURSEL, 0, 0);
 
-  EnableWindow(GetDlgItem(m_Dlg, IDC_LBL_SWDEINT_MODE), (dwVal == SWDeintMode_YADIF));
-  EnableWindow(GetDlgItem(m_Dlg, IDC_SWDEINT_OUT_FILM), (dwVal == SWDeintMode_YADIF));
-  EnableWindow(GetDlgItem(m_Dlg, IDC_SWDEINT_OUT_VIDEO), (dwVal == SWDeintMode_YADIF));
+  // W3FDIF only supports one frame per field
+  BOOL bOutputMode = (dwVal == SWDeintMode_YADIF || dwVal == SWDeintMode_BWDIF || dwVal == SWDeintMode_Auto);
+  EnableWindow(GetDlgItem(m_Dlg, IDC_LBL_SWDEINT_MODE), bOutputMode);
+  EnableWindow(GetDlgItem(m_Dlg, IDC_SWDEINT_OUT_FILM), bOutputMode);
+  EnableWindow(GetDlgItem(m_Dlg, IDC_SWDEINT_OUT_VIDEO), bOutputMode);
 
   return S_OK;
 }
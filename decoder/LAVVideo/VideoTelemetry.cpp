@@ -0,0 +1,37 @@
+/*
+ *      Copyright (C) 2010-2019 Hendrik Leppkes
+ *      http://www.1f0.de
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program; if not, write to the Free Software Foundation, Inc.,
+ *  51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#include "stdafx.h"
+#include "VideoTelemetry.h"
+
+// {52627DAB-AB35-4DE7-B66D-A9CDDE3CD20D}
+static const GUID GUID_LAVVideoPerfProvider = { 0x52627dab, 0xab35, 0x4de7, { 0xb6, 0x6d, 0xa9, 0xcd, 0xde, 0x3c, 0xd2, 0x0d } };
+// {4518813C-65B1-43F2-8737-8E80F39E5C2E}
+static const GUID GUID_LAVVideoPerfCounterSet = { 0x4518813c, 0x65b1, 0x43f2, { 0x87, 0x37, 0x8e, 0x80, 0xf3, 0x9e, 0x5c, 0x2e } };
+
+static const ULONG VideoPerfCounterTypes[VideoPerf_NB] = {
+  PERF_COUNTER_BULK_COUNT,      // VideoPerf_Frames
+  PERF_COUNTER_LARGE_RAWCOUNT,  // VideoPerf_DroppedFrames
+  PERF_COUNTER_LARGE_RAWCOUNT,  // VideoPerf_LateFrames
+  PERF_COUNTER_BULK_COUNT,      // VideoPerf_CopyBackBytes
+  PERF_100NSEC_TIMER,           // VideoPerf_ConversionTime
+  PERF_COUNTER_LARGE_RAWCOUNT,  // VideoPerf_HWSessions
+};
+
+CPerfCounterSet g_VideoPerfCounters(GUID_LAVVideoPerfProvider, GUID_LAVVideoPerfCounterSet, VideoPerfCounterTypes, VideoPerf_NB);
@@ -0,0 +1,132 @@
+/*
+ *      Copyright (C) 2010-2019 Hendrik Leppkes
+ *      http://www.1f0.de
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program; if not, write to the Free Software Foundation, Inc.,
+ *  51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#pragma once
+
+#include "LAVVideoSettings.h"
+#include "timer.h"
+#include "TraceProvider.h"
+#include "PerfCounters.h"
+
+#include <algorithm>
+
+// Number of samples per stage the percentiles are calculated over
+#define LAV_TELEMETRY_WINDOW 512
+
+// Counters of the "LAV Video" counter set, in the order of LAVFilters.PerfCounters.man
+enum LAVVideoPerfCounter {
+  VideoPerf_Frames,             // Frames delivered to the renderer, per second
+  VideoPerf_DroppedFrames,      // Frames dropped because they were already late
+  VideoPerf_LateFrames,         // Frames the renderer reported as late
+  VideoPerf_CopyBackBytes,      // Bytes of hardware decoded frames copied into system memory, per second
+  VideoPerf_ConversionTime,     // Time spent converting into the output format, in percent
+  VideoPerf_HWSessions,         // Hardware decoders in use
+
+  VideoPerf_NB
+};
+
+extern CPerfCounterSet g_VideoPerfCounters;
+
+// Rolling timing statistics for the processing stages of LAV Video
+// Samples are added from the decoding and delivery threads, the statistics can be read from any thread.
+// The samples also feed the performance counters of the filter, which are never reset.
+class CVideoTelemetry
+{
+public:
+  CVideoTelemetry() {
+    Reset();
+    m_pPerfInstance = g_VideoPerfCounters.CreateInstance(m_PerfValues);
+  }
+  ~CVideoTelemetry() { g_VideoPerfCounters.DeleteInstance(m_pPerfInstance); }
+
+  void AddSample(LAVVideoStage stage, REFERENCE_TIME rtTime) {
+    ASSERT(stage >= 0 && stage < VideoStage_NB);
+    LAV_TRACE("VideoStage", LAV_TRACE_KEYWORD_VIDEO,
+              TraceLoggingInt32(stage, "Stage"),
+              TraceLoggingInt64(rtTime, "Duration"));
+    if (stage == VideoStage_PixelConversion)
+      perf_counter_add(&m_PerfValues[VideoPerf_ConversionTime], rtTime);
+    else if (stage == VideoStage_Deliver)
+      perf_counter_add(&m_PerfValues[VideoPerf_Frames], 1);
+
+    CAutoLock lock(&m_csSamples);
+    StageSamples &s = m_Stages[stage];
+    s.samples[s.nCurrent] = rtTime;
+    if (++s.nCurrent >= LAV_TELEMETRY_WINDOW)
+      s.nCurrent = 0;
+    if (s.nSamples < LAV_TELEMETRY_WINDOW)
+      s.nSamples++;
+    s.ullTotalSamples++;
+  }
+
+  HRESULT GetStatistics(LAVVideoStage stage, LAVVideoStageStats *pStats) {
+    CheckPointer(pStats, E_POINTER);
+    if (stage < 0 || stage >= VideoStage_NB)
+      return E_INVALIDARG;
+
+    // Copy the samples, so the lock is not held while sorting
+    REFERENCE_TIME samples[LAV_TELEMETRY_WINDOW];
+    DWORD nSamples = 0;
+    {
+      CAutoLock lock(&m_csSamples);
+      const StageSamples &s = m_Stages[stage];
+      nSamples = s.nSamples;
+      pStats->ullTotalSamples = s.ullTotalSamples;
+      memcpy(samples, s.samples, sizeof(REFERENCE_TIME) * nSamples);
+    }
+
+    pStats->dwSamples = nSamples;
+    if (nSamples == 0) {
+      pStats->rtP50 = pStats->rtP95 = pStats->rtP99 = pStats->rtMax = 0;
+      return S_FALSE;
+    }
+
+    std::sort(samples, samples + nSamples);
+    pStats->rtP50 = samples[(nSamples - 1) * 50 / 100];
+    pStats->rtP95 = samples[(nSamples - 1) * 95 / 100];
+    pStats->rtP99 = samples[(nSamples - 1) * 99 / 100];
+    pStats->rtMax = samples[nSamples - 1];
+
+    return S_OK;
+  }
+
+  void Reset() {
+    CAutoLock lock(&m_csSamples);
+    memset(m_Stages, 0, sizeof(m_Stages));
+  }
+
+  // Events of the output, which are only counted
+  void AddDroppedFrame() { perf_counter_add(&m_PerfValues[VideoPerf_DroppedFrames], 1); }
+  void AddLateFrame() { perf_counter_add(&m_PerfValues[VideoPerf_LateFrames], 1); }
+  void AddCopyBack(ULONGLONG ullBytes) { perf_counter_add(&m_PerfValues[VideoPerf_CopyBackBytes], ullBytes); }
+  void SetHWDecoderActive(BOOL bActive) { perf_counter_set(&m_PerfValues[VideoPerf_HWSessions], bActive ? 1 : 0); }
+
+private:
+  struct StageSamples {
+    REFERENCE_TIME samples[LAV_TELEMETRY_WINDOW];
+    DWORD nCurrent;
+    DWORD nSamples;
+    ULONGLONG ullTotalSamples;
+  } m_Stages[VideoStage_NB];
+
+  CCritSec m_csSamples;
+
+  volatile ULONGLONG m_PerfValues[VideoPerf_NB] = { 0 };
+  PPERF_COUNTERSET_INSTANCE m_pPerfInstance = nullptr;
+};
@@ -34,6 +34,7 @@ public:
   // ILAVDecoder
   STDMETHODIMP InitInterfaces(ILAVVideoSettings *pSettings, ILAVVideoCallback *pCallback) { m_pSettings = pSettings; m_pCallback = pCallback; return Init(); }
   STDMETHODIMP Check() { return S_FALSE; }
+  STDMETHODIMP Reconfigure(AVCodecID codec, const CMediaType *pmt) { return S_FALSE; }
   STDMETHODIMP_(REFERENCE_TIME) GetFrameDuration() { return 0; }
   STDMETHODIMP_(BOOL) IsInterlaced(BOOL bAllowGuess) { return TRUE; }
   STDMETHODIMP InitAllocator(IMemAllocator **ppAlloc) { return E_NOTIMPL; }
@@ -45,6 +46,9 @@ public:
 
   STDMETHODIMP SetDirectOutput(BOOL bDirect) { return S_FALSE; }
 
+  STDMETHODIMP GetSurfacePoolStatus(LAVHWSurfacePoolStatus *pStatus) { return S_FALSE; }
+  STDMETHODIMP GetThreadingStatus(LAVDecoderThreadingStatus *pStatus) { return S_FALSE; }
+
   STDMETHODIMP_(DWORD) GetHWAccelNumDevices() { return 0; }
   STDMETHODIMP GetHWAccelDeviceInfo(DWORD dwIndex, BSTR *pstrDeviceName, DWORD *dwDeviceIdentifier) { return E_UNEXPECTED; }
   STDMETHODIMP GetHWAccelActiveDevice(BSTR *pstrDeviceName) { return E_UNEXPECTED; }
@@ -22,6 +22,8 @@
 #include "LAVVideoSettings.h"
 #include "ILAVPinInfo.h"
 
+class CMemoryAccount;
+
 /**
  * List of internally used pixel formats
  *
@@ -84,12 +86,31 @@ typedef struct LAVDirectBuffer {
   ptrdiff_t stride[4];              ///< stride of the planes (in bytes)
 } LAVDirectBuffer;
 
+/**
+ * Reference-counted side data, shared between frames as long as it doesn't change
+ */
+typedef struct LAVFrameSideDataBlob {
+  volatile LONG refs;
+  ULONG version;                    ///< unique for every blob, a changed version means changed side data
+  BYTE *data;
+  size_t size;
+} LAVFrameSideDataBlob;
+
 typedef struct LAVFrameSideData {
   GUID guidType;                    ///< type of the side data
   BYTE *data;                       ///< side data
   size_t size;                      ///< size
+  LAVFrameSideDataBlob *shared;     ///< blob holding the data if it is shared, the data must not be changed then
+  ULONG version;                    ///< version of the shared blob, 0 for side data of this frame alone
 } LAVFrameSideData;
 
+/**
+ * Side data stored inside of the frame itself, before falling back to heap allocations
+ * Sized for the common per-frame payloads, like closed captions and static HDR metadata.
+ */
+#define LAV_FRAME_SIDE_DATA_INLINE_ENTRIES  4
+#define LAV_FRAME_SIDE_DATA_INLINE_SIZE     512
+
 /**
  * A Video Frame
  *
@@ -133,10 +154,16 @@ typedef struct LAVFrame {
 #define LAV_FRAME_FLAG_REDRAW               0x00000008
 #define LAV_FRAME_FLAG_DXVA_NOADDREF        0x00000010
 #define LAV_FRAME_FLAG_MVC                  0x00000020
+#define LAV_FRAME_FLAG_SCALED               0x00000040
 
   LAVFrameSideData *side_data;
   int side_data_count;
 
+  /* inline side data storage, only to be used through AddLAVFrameSideData */
+  LAVFrameSideData side_data_inline[LAV_FRAME_SIDE_DATA_INLINE_ENTRIES];
+  size_t side_data_buffer_used;
+  BYTE side_data_buffer[LAV_FRAME_SIDE_DATA_INLINE_SIZE];
+
   /* destruct function to free any buffers being held by this frame (may be null) */
   void  (*destruct)(struct LAVFrame *);
   void *priv_data;                  ///< private data from the decoder (mostly for destruct)
@@ -144,6 +171,10 @@ typedef struct LAVFrame {
   bool direct;
   bool (*direct_lock)(struct LAVFrame *, struct LAVDirectBuffer *);
   void (*direct_unlock)(struct LAVFrame *);
+
+  IMediaSample *dr_sample;          ///< output sample the frame was decoded into (direct rendering), referenced by the frame buffers
+
+  CMemoryAccount *memory_account;   ///< account the frame buffers are charged to (not referenced by the frame, may be null)
 } LAVFrame;
 
 /**
@@ -163,11 +194,40 @@ HRESULT AllocLAVFrameBuffers(LAVFrame *pFrame, ptrdiff_t stride = 0);
  */
 HRESULT FreeLAVFrameBuffers(LAVFrame *pFrame);
 
+/**
+ * Register (or unregister) a decoder using the low footprint profile
+ *
+ * Buffers of released frames are kept for re-use in a pool shared by all decoders of the process,
+ * which keeps fewer of them while any decoder using the low footprint profile is registered.
+ */
+void SetLAVFrameBufferPoolLowFootprint(bool bEnable);
+
+/**
+ * Get the maximum number of unused frame buffers kept by the shared pool
+ */
+size_t GetLAVFrameBufferPoolSize();
+
+/**
+ * Release all unused frame buffers kept by the shared pool
+ */
+void ReleaseLAVFrameBufferPool();
+
 /**
  * Copy a LAV Frame, including a memcpy of the data
  */
 HRESULT CopyLAVFrame(LAVFrame *pSrc, LAVFrame **ppDst);
 
+/**
+ * Reference a LAV Frame, sharing its buffers instead of copying them
+ *
+ * Both frames lose the LAV_FRAME_FLAG_BUFFER_MODIFY flag, and the buffers are freed once both are released.
+ * Frames which can't be shared are copied with CopyLAVFrame: direct frames, direct rendering frames,
+ * and frames of decoders which re-use their buffers, unless they were allocated with AllocLAVFrameBuffers.
+ *
+ * @param bPersistentBuffers the frame buffers stay valid until destruct is called (thread-safe decoder buffers)
+ */
+HRESULT RefLAVFrame(LAVFrame *pSrc, LAVFrame **ppDst, bool bPersistentBuffers);
+
 /**
  * Copy the buffers in the LAV Frame, calling destruct on the old buffers.
  *
@@ -177,14 +237,70 @@ HRESULT CopyLAVFrameInPlace(LAVFrame *pFrame);
 
 /**
  * Add Side Data to the frame and return a pointer to it
+ *
+ * Small entries are stored inside of the frame, so frames must only be copied with CopyLAVFrame,
+ * or have their side data reset after a plain struct copy.
  */
 BYTE * AddLAVFrameSideData(LAVFrame *pFrame, GUID guidType, size_t size);
 
 /**
  * Get a side data entry from the frame by its type
+ *
+ * Shared entries must not be written to.
  */
 BYTE * GetLAVFrameSideData(LAVFrame *pFrame, GUID guidType, size_t *pSize);
 
+/**
+ * Remove the side data entry of the type from the frame, if there is one
+ */
+void RemoveLAVFrameSideData(LAVFrame *pFrame, GUID guidType);
+
+/**
+ * Create a shared side data blob of the given size, with a reference held by the caller
+ */
+LAVFrameSideDataBlob * CreateLAVFrameSideDataBlob(size_t size);
+void ReleaseLAVFrameSideDataBlob(LAVFrameSideDataBlob *pBlob);
+
+/**
+ * Add a reference to the shared side data blob to the frame
+ */
+BYTE * AddLAVFrameSideDataShared(LAVFrame *pFrame, GUID guidType, LAVFrameSideDataBlob *pBlob);
+
+#define LAV_FRAME_SIDE_DATA_CACHE_ENTRIES 4
+
+/**
+ * Cache of the last side data of every type, to share unchanged side data between frames
+ *
+ * The side data is derived from a source (e.g. the side data of the AVFrame), and only created again when the
+ * source changed. Otherwise, the frames share one blob, instead of every frame carrying its own copy.
+ * A cache must only be used by one thread.
+ */
+class CLAVFrameSideDataCache
+{
+public:
+  CLAVFrameSideDataCache() {}
+  ~CLAVFrameSideDataCache() { Clear(); }
+
+  /**
+   * Set the side data of the type on the frame, replacing an existing entry of the type
+   *
+   * If pbNew is set on return, the side data was created anew (zeroed), and has to be filled in by the caller before
+   * the frame is passed on. Otherwise, it is shared with earlier frames and must not be written to.
+   */
+  BYTE * SetSideData(LAVFrame *pFrame, GUID guidType, size_t size, const void *pSource, size_t sourceSize, bool *pbNew);
+
+  void Clear();
+
+private:
+  struct Entry {
+    GUID guidType;
+    LAVFrameSideDataBlob *blob;
+    BYTE *source;
+    size_t sourceSize;
+  } m_Entries[LAV_FRAME_SIDE_DATA_CACHE_ENTRIES];
+  int m_nEntries = 0;
+};
+
 typedef struct LAVPinInfo
 {
   DWORD flags;              ///< Flags that describe the video content (see ILAVPinInfo.h for valid values)
@@ -244,6 +360,15 @@ interface ILAVVideoCallback
 #define LAV_VIDEO_DEC_FLAG_NO_MT                  0x00000020
 #define LAV_VIDEO_DEC_FLAG_SAGE_HACK              0x00000040
 #define LAV_VIDEO_DEC_FLAG_LIVE                   0x00000080
+#define LAV_VIDEO_DEC_FLAG_KEYFRAMES_ONLY         0x00000100
+#define LAV_VIDEO_DEC_FLAG_NO_LOOP_FILTER         0x00000200
+#define LAV_VIDEO_DEC_FLAG_SKIP_NONREF_FILTER     0x00000400
+#define LAV_VIDEO_DEC_FLAG_SKIP_NONREF            0x00000800
+#define LAV_VIDEO_DEC_FLAG_LOW_DELAY              0x00001000
+#define LAV_VIDEO_DEC_FLAG_SKIP_NONKEY            0x00002000
+
+// Flags changing while decoding, which don't require a new decoder
+#define LAV_VIDEO_DEC_FLAGS_DYNAMIC               (LAV_VIDEO_DEC_FLAG_SKIP_NONREF_FILTER | LAV_VIDEO_DEC_FLAG_SKIP_NONREF | LAV_VIDEO_DEC_FLAG_SKIP_NONKEY)
 
   /**
    * Get the input media type
@@ -303,6 +428,60 @@ interface ILAVVideoCallback
   * Get the x264 build info
   */
   STDMETHOD_(int, GetX264Build)() PURE;
+
+  /**
+   * Add a timing sample of a processing stage done by the decoder, like GPU copy-back
+   *
+   * @param stage the stage that was timed
+   * @param rtTime time spent, in 100ns units
+   */
+  STDMETHOD(AddStageTime)(LAVVideoStage stage, REFERENCE_TIME rtTime) PURE;
+
+  /**
+   * Get the number of threads of the shared worker pool this stream should use
+   *
+   * @return thread count, at least 1
+   */
+  STDMETHOD_(int, GetWorkerThreads)() PURE;
+
+  /**
+   * Get an output sample for the decoder to decode a frame into (direct rendering)
+   *
+   * Only succeeds if frames of this format are delivered without any conversion, the planes of the sample
+   * fit the whole area written by the decoder, and a sample is available without waiting.
+   *
+   * @param format pixel format of the frame
+   * @param width width of the frame
+   * @param height height of the frame
+   * @param codedWidth width of the area written by the decoder (in pixel)
+   * @param codedHeight height of the area written by the decoder (in lines)
+   * @param align required alignment of the plane pointers and strides (in bytes)
+   * @param ppSample receives the sample, holding a reference for the caller
+   * @param pBuffer receives the planes in the sample, in the plane order of the pixel format
+   * @return HRESULT
+   */
+  STDMETHOD(GetDirectRenderingBuffer)(LAVPixelFormat format, int width, int height, int codedWidth, int codedHeight, int align, IMediaSample **ppSample, LAVDirectBuffer *pBuffer) PURE;
+
+  /**
+   * Get the memory account of the filter, to charge buffers and surfaces of the decoder to
+   *
+   * @return account, not referenced for the caller
+   */
+  STDMETHOD_(CMemoryAccount*, GetMemoryAccount)() PURE;
+
+  /**
+   * Get the crop and downscale applied to the output, for decoders which can scale in hardware
+   *
+   * Frames the decoder already scaled this way need to be flagged with LAV_FRAME_FLAG_SCALED.
+   *
+   * @param width width of the decoded frame
+   * @param height height of the decoded frame
+   * @param prcCrop receives the area of the frame that is used
+   * @param pWidth receives the width the area is scaled to
+   * @param pHeight receives the height the area is scaled to
+   * @return S_OK if frames of this size are cropped or scaled, S_FALSE if they are output as they are
+   */
+  STDMETHOD(GetOutputScaling)(int width, int height, RECT *prcCrop, int *pWidth, int *pHeight) PURE;
 };
 
 /**
@@ -341,6 +520,16 @@ interface ILAVDecoder
    */
   STDMETHOD(InitDecoder)(AVCodecID codec, const CMediaType *pmt) PURE;
 
+  /**
+   * Adapt an initialized decoder to a changed media type of the same stream,
+   * keeping the decoder and its resources alive.
+   *
+   * @param codec Codec Id
+   * @param pmt DirectShow Media Type
+   * @return S_OK if the decoder was reconfigured, S_FALSE if the change requires InitDecoder, an error code otherwise
+   */
+  STDMETHOD(Reconfigure)(AVCodecID codec, const CMediaType *pmt) PURE;
+
   /**
    * Decode a frame.
    *
@@ -425,6 +614,18 @@ interface ILAVDecoder
    */
   STDMETHOD(SetDirectOutput)(BOOL bDirect) PURE;
 
+  /**
+   * Get the state of the hardware surface pool
+   * Returns S_FALSE if the decoder does not use a surface pool
+   */
+  STDMETHOD(GetSurfacePoolStatus)(LAVHWSurfacePoolStatus *pStatus) PURE;
+
+  /**
+   * Get the thread configuration of the decoder
+   * Returns S_FALSE if the decoder does not decode with threads of its own
+   */
+  STDMETHOD(GetThreadingStatus)(LAVDecoderThreadingStatus *pStatus) PURE;
+
   /**
    * Get the number of available hw accel devices
    */
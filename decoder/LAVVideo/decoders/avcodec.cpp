@@ -23,12 +23,16 @@
 #include "moreuuids.h"
 #include "parsers/MPEG2HeaderParser.h"
 #include "parsers/H264SequenceParser.h"
+#include "parsers/HEVCSequenceParser.h"
+#include "parsers/AnnexBConverter.h"
 #include "parsers/VC1HeaderParser.h"
 
 #include "Media.h"
 #include "IMediaSideData.h"
 #include "IMediaSideDataFFmpeg.h"
+#include "IMediaSampleAVPacket.h"
 #include "ByteParser.h"
+#include "WorkerPool.h"
 
 #ifdef DEBUG
 #include "lavf_log.h"
@@ -40,6 +44,8 @@ extern "C" {
 #include "libavutil/hdr_dynamic_metadata.h"
 };
 
+#include "dav1d/picture.h"
+
 ////////////////////////////////////////////////////////////////////////////////
 // Constructor
 ////////////////////////////////////////////////////////////////////////////////
@@ -48,6 +54,31 @@ ILAVDecoder *CreateDecoderAVCodec() {
   return new CDecAvcodec();
 }
 
+////////////////////////////////////////////////////////////////////////////////
+// Slice threading on the shared worker pool
+////////////////////////////////////////////////////////////////////////////////
+
+// The thread index is below thread_count, which decoders rely on to pick per-thread contexts
+static int lav_avcodec_execute(AVCodecContext *c, int (*func)(AVCodecContext *c2, void *arg2), void *arg, int *ret, int count, int size)
+{
+  worker_pool_run(count, c->thread_count, [&](int job, int thread) {
+    int r = func(c, (uint8_t *)arg + (size_t)job * size);
+    if (ret)
+      ret[job] = r;
+  });
+  return 0;
+}
+
+static int lav_avcodec_execute2(AVCodecContext *c, int (*func)(AVCodecContext *c2, void *arg2, int jobnr, int threadnr), void *arg, int *ret, int count)
+{
+  worker_pool_run(count, c->thread_count, [&](int job, int thread) {
+    int r = func(c, arg, job, thread);
+    if (ret)
+      ret[job] = r;
+  });
+  return 0;
+}
+
 ////////////////////////////////////////////////////////////////////////////////
 // Create DXVA2 Extended Flags from a AVFrame and AVCodecContext
 ////////////////////////////////////////////////////////////////////////////////
@@ -258,6 +289,115 @@ static AVCodecID ff_interlace_capable[] = {
   AV_CODEC_ID_UTVIDEO
 };
 
+// Codecs which signal all stream parameters in-band, and handle changes of them in an open decoder
+// Threads worth spending on a stream, by its decoding cost in luma samples per frame
+// Threads beyond the limit hardly speed up decoding, but cost the memory of one more frame in flight each, and latency
+static const struct {
+  int64_t nCost;
+  int     nThreads;
+} avcodec_thread_tiers[] = {
+  {  414720,  4 },          // SD, 720x576
+  {  921600,  6 },          // 720p
+  { 2228224,  8 },          // 1080p, 2048x1088
+  { 4096000, 12 },          // 1440p, 2560x1600
+  { 8912896, 16 },          // 4K, 4096x2176
+};
+
+static int avcodec_thread_limit(AVCodecID codec, int width, int height, DWORD dwProfile)
+{
+  // the size is not known for every media type, the threads are not limited then
+  if (width <= 0 || height <= 0)
+    return AVCODEC_MAX_THREADS;
+
+  int64_t nCost = (int64_t)width * height;
+
+  // relative decoding cost of a sample of the codec
+  switch (codec) {
+  case AV_CODEC_ID_MPEG1VIDEO:
+  case AV_CODEC_ID_MPEG2VIDEO:
+  case AV_CODEC_ID_VC1:
+  case AV_CODEC_ID_WMV3:
+  case AV_CODEC_ID_MJPEG:
+  case AV_CODEC_ID_DVVIDEO:
+    nCost /= 2;
+    break;
+  case AV_CODEC_ID_HEVC:
+  case AV_CODEC_ID_VP9:
+  case AV_CODEC_ID_AV1:
+    nCost = nCost * 3 / 2;
+    break;
+  }
+
+  // high bit-depth and chroma resolution profiles
+  if ((codec == AV_CODEC_ID_H264 && dwProfile >= FF_PROFILE_H264_HIGH_10)
+   || (codec == AV_CODEC_ID_HEVC && (dwProfile == FF_PROFILE_HEVC_MAIN_10 || dwProfile == FF_PROFILE_HEVC_REXT)))
+    nCost = nCost * 3 / 2;
+
+  for (int i = 0; i < countof(avcodec_thread_tiers); i++) {
+    if (nCost <= avcodec_thread_tiers[i].nCost)
+      return avcodec_thread_tiers[i].nThreads;
+  }
+  return AVCODEC_MAX_THREADS;
+}
+
+static int avcodec_thread_limit(AVCodecID codec, const CMediaType *pmt)
+{
+  BITMAPINFOHEADER *pBMI = nullptr;
+  videoFormatTypeHandler(*pmt, &pBMI);
+  if (!pBMI)
+    return AVCODEC_MAX_THREADS;
+
+  DWORD dwProfile = 0;
+  if (pmt->formattype == FORMAT_MPEG2Video)
+    dwProfile = ((MPEG2VIDEOINFO *)pmt->Format())->dwProfile;
+
+  return avcodec_thread_limit(codec, pBMI->biWidth, abs(pBMI->biHeight), dwProfile);
+}
+
+// Codecs which code every frame on its own
+static bool avcodec_is_intra_only(AVCodecID codec)
+{
+  // Cineform is not flagged, but only uses intra frames
+  if (codec == AV_CODEC_ID_CFHD)
+    return true;
+
+  const AVCodecDescriptor *desc = avcodec_descriptor_get(codec);
+  return desc && (desc->props & AV_CODEC_PROP_INTRA_ONLY);
+}
+
+static AVCodecID ff_reconfigure_capable[] = {
+  AV_CODEC_ID_MPEG1VIDEO,
+  AV_CODEC_ID_MPEG2VIDEO,
+  AV_CODEC_ID_H264,
+  AV_CODEC_ID_HEVC,
+  AV_CODEC_ID_VP8,
+  AV_CODEC_ID_VP9,
+  AV_CODEC_ID_AV1
+};
+
+static BOOL extradata_equal(const CMediaType &mt1, const CMediaType &mt2)
+{
+  size_t len1 = 0, len2 = 0;
+  getExtraData(mt1, nullptr, &len1);
+  getExtraData(mt2, nullptr, &len2);
+  if (len1 != len2)
+    return FALSE;
+  if (len1 == 0)
+    return TRUE;
+
+  BYTE *extra1 = (BYTE *)av_malloc(len1);
+  BYTE *extra2 = (BYTE *)av_malloc(len2);
+  BOOL bEqual = FALSE;
+  if (extra1 && extra2) {
+    getExtraData(mt1, extra1, nullptr);
+    getExtraData(mt2, extra2, nullptr);
+    bEqual = (memcmp(extra1, extra2, len1) == 0);
+  }
+  av_freep(&extra1);
+  av_freep(&extra2);
+  return bEqual;
+}
+
 static struct PixelFormatMapping getPixFmtMapping(AVPixelFormat pixfmt) {
   const PixelFormatMapping def = { pixfmt, LAVPixFmt_YUV420, TRUE, 8 };
   PixelFormatMapping result = def;
@@ -315,8 +455,14 @@ STDMETHODIMP CDecAvcodec::InitDecoder(AVCodecID codec, const CMediaType *pmt)
 
   DWORD dwDecFlags = m_pCallback->GetDecodeFlags();
 
+  // LAV Splitter signals streams it already parsed into complete frames
+  LAVPinInfo parsePinInfo = {0};
+  BOOL bCompleteFrames = (dwDecFlags & LAV_VIDEO_DEC_FLAG_LAVSPLITTER) && SUCCEEDED(m_pCallback->GetLAVPinInfo(parsePinInfo)) && (parsePinInfo.flags & LAV_STREAM_FLAG_PARSED);
+
   // Use parsing for mpeg1/2 at all times, or H264/HEVC when its not from LAV Splitter
-  if(    codec == AV_CODEC_ID_MPEG1VIDEO
+  // Neither needs parsing if the splitter delivers complete frames
+  if(   !bCompleteFrames
+     && (codec == AV_CODEC_ID_MPEG1VIDEO
       || codec == AV_CODEC_ID_MPEG2VIDEO
       || (!(dwDecFlags & LAV_VIDEO_DEC_FLAG_LAVSPLITTER) &&
          (pmt->subtype == MEDIASUBTYPE_H264
@@ -324,9 +470,10 @@ STDMETHODIMP CDecAvcodec::InitDecoder(AVCodecID codec, const CMediaType *pmt)
        || pmt->subtype == MEDIASUBTYPE_X264
        || pmt->subtype == MEDIASUBTYPE_x264
        || pmt->subtype == MEDIASUBTYPE_H264_bis
-       || pmt->subtype == MEDIASUBTYPE_HEVC))) {
+       || pmt->subtype == MEDIASUBTYPE_HEVC)))) {
     m_pParser = av_parser_init(codec);
   }
+  DbgLog((LOG_TRACE, 10, L"-> Parser: %s", m_pParser ? L"enabled" : (bCompleteFrames ? L"disabled, complete frames from the splitter" : L"disabled")));
 
   LONG biRealWidth = pBMI->biWidth, biRealHeight = pBMI->biHeight;
   if (pmt->formattype == FORMAT_VideoInfo || pmt->formattype == FORMAT_MPEGVideo) {
@@ -353,17 +500,39 @@ STDMETHODIMP CDecAvcodec::InitDecoder(AVCodecID codec, const CMediaType *pmt)
   m_pAVCtx->refcounted_frames     = 1;
 
   // Setup threading
-  // Thread Count. 0 = auto detect
+  // Thread Count. 0 = auto detect, from the share of the worker pool granted to this stream,
+  // limited to what the resolution, codec and profile of the stream can make use of
+  // Frame threads of intra-only codecs never wait on each other, they use the whole share.
+  m_bIntraOnly = avcodec_is_intra_only(codec);
   int thread_count = m_pSettings->GetNumThreads();
+  m_nThreadLimit = 0;
   if (thread_count == 0) {
-    thread_count = av_cpu_count();
+    thread_count = m_pCallback->GetWorkerThreads();
+    if (!m_bIntraOnly)
+      m_nThreadLimit = avcodec_thread_limit(codec, pmt);
   }
+  m_ThreadingStatus.dwAvailableThreads = max(1, thread_count);
+  if (m_nThreadLimit)
+    thread_count = min(thread_count, m_nThreadLimit);
+  if (m_pSettings->GetLowFootprint())
+    thread_count = min(thread_count, AVCODEC_LOW_FOOTPRINT_MAX_THREADS);
   m_pAVCtx->thread_count = max(1, min(thread_count, AVCODEC_MAX_THREADS));
 
   if (dwDecFlags & LAV_VIDEO_DEC_FLAG_NO_MT || codec == AV_CODEC_ID_MPEG4) {
     m_pAVCtx->thread_count = 1;
   }
 
+  // Low-delay decoding, every frame thread adds a frame of latency, slice threads don't
+  if (dwDecFlags & LAV_VIDEO_DEC_FLAG_LOW_DELAY) {
+    m_pAVCtx->thread_type = FF_THREAD_SLICE;
+    m_pAVCtx->flags      |= AV_CODEC_FLAG_LOW_DELAY;
+  }
+
+  // frames in flight in the decoder, updated once the threading mode is known
+  m_nFrameThreads = 1;
+  m_ThreadingStatus.dwTileThreads = 0;
+  m_bAV1FilmGrainExport = FALSE;
+
   // setup tile/frame threads for dav1d
   if (codec == AV_CODEC_ID_AV1 && strcmp(m_pAVCodec->name, "libdav1d") == 0)
   {
@@ -372,6 +541,10 @@ STDMETHODIMP CDecAvcodec::InitDecoder(AVCodecID codec, const CMediaType *pmt)
       nTileThreads = 1;
       nFrameThreads = 1;
     }
+    else if (dwDecFlags & LAV_VIDEO_DEC_FLAG_LOW_DELAY) {
+      nTileThreads = min(thread_count, 64); // 64 is DAV1D_MAX_TILE_THREADS
+      nFrameThreads = 1;
+    }
     else if (thread_count < 12) {
       nTileThreads = 2;
       nFrameThreads = thread_count;
@@ -382,6 +555,13 @@ STDMETHODIMP CDecAvcodec::InitDecoder(AVCodecID codec, const CMediaType *pmt)
     }
     av_opt_set_int(m_pAVCtx->priv_data, "tilethreads", nTileThreads, 0);
     av_opt_set_int(m_pAVCtx->priv_data, "framethreads", nFrameThreads, 0);
+    m_nFrameThreads = nFrameThreads;
+    m_ThreadingStatus.dwTileThreads = nTileThreads;
+
+    // leave the film grain to the renderer, or the output stage
+    m_bAV1FilmGrainExport = (m_pSettings->GetAV1FilmGrainMode() != AV1FilmGrain_Decoder);
+    if (m_bAV1FilmGrainExport)
+      av_opt_set_int(m_pAVCtx->priv_data, "filmgrain", 0, 0);
   }
 
   m_pFrame = av_frame_alloc();
@@ -530,10 +710,12 @@ STDMETHODIMP CDecAvcodec::InitDecoder(AVCodecID codec, const CMediaType *pmt)
   // LAV Splitter does them allright with RV30/RV40, everything else screws them up
   m_bRVDropBFrameTimings = (codec == AV_CODEC_ID_RV10 || codec == AV_CODEC_ID_RV20 || ((codec == AV_CODEC_ID_RV30 || codec == AV_CODEC_ID_RV40) && (!(dwDecFlags & LAV_VIDEO_DEC_FLAG_LAVSPLITTER) || (bLAVInfoValid && (lavPinInfo.flags & LAV_STREAM_FLAG_RV34_MKV)))));
 
-  // Enable B-Frame delay handling
-  m_bBFrameDelay = !m_bFFReordering && !m_bRVDropBFrameTimings;
+  // Enable B-Frame delay handling, low-delay streams have no B-Frames to wait for
+  m_bBFrameDelay = !m_bFFReordering && !m_bRVDropBFrameTimings && !(dwDecFlags & LAV_VIDEO_DEC_FLAG_LOW_DELAY);
 
   m_bWaitingForKeyFrame = TRUE;
+  m_bSkippingNonKey = FALSE;
+  m_bResumeAfterSkip = FALSE;
   m_bResumeAtKeyFrame =    codec == AV_CODEC_ID_MPEG2VIDEO
                         || codec == AV_CODEC_ID_VC1
                         || codec == AV_CODEC_ID_VC1IMAGE
@@ -558,6 +740,21 @@ STDMETHODIMP CDecAvcodec::InitDecoder(AVCodecID codec, const CMediaType *pmt)
     return E_FAIL;
   }
 
+  // Decode at half resolution in the fast performance mode, if the decoder supports it
+  if (m_pSettings->GetPerformanceMode() == PerfMode_Fast && m_pAVCodec->max_lowres > 0 && !m_pAVCtx->hwaccel_context) {
+    DbgLog((LOG_TRACE, 10, L"-> Decoding at reduced resolution"));
+    m_pAVCtx->lowres = 1;
+  }
+
+  // Decode straight into the output samples, unless a hardware decoder already manages the frame buffers
+  m_bDirectRendering = m_pSettings->GetDirectRendering() && (m_pAVCodec->capabilities & AV_CODEC_CAP_DR1) && !m_pAVCtx->hwaccel_context
+                    && !m_pAVCtx->lowres && m_pAVCtx->get_buffer2 == avcodec_default_get_buffer2;
+  if (m_bDirectRendering) {
+    DbgLog((LOG_TRACE, 10, L"-> Using direct rendering"));
+    m_pAVCtx->get_buffer2 = get_dr_buffer;
+    m_pAVCtx->opaque      = this;
+  }
+
   if (bLAVInfoValid) {
     // Use strict decoding with LAV Splitter and non-live sources
     if (codec == AV_CODEC_ID_H264 && !(dwDecFlags & LAV_VIDEO_DEC_FLAG_LIVE) && m_bFFReordering && !m_pAVCtx->hwaccel_context) {
@@ -581,6 +778,28 @@ STDMETHODIMP CDecAvcodec::InitDecoder(AVCodecID codec, const CMediaType *pmt)
   if (ret >= 0) {
     DbgLog((LOG_TRACE, 10, L"-> ffmpeg codec opened successfully (ret: %d)", ret));
     m_nCodecId = codec;
+    if (m_pAVCtx->active_thread_type & FF_THREAD_FRAME)
+      m_nFrameThreads = m_pAVCtx->thread_count;
+
+    m_ThreadingStatus.dwThreads      = m_ThreadingStatus.dwTileThreads ? m_nFrameThreads : max(1, m_pAVCtx->thread_count);
+    m_ThreadingStatus.dwFrameThreads = m_nFrameThreads;
+    DbgLog((LOG_TRACE, 10, L"-> Decoding with %u threads (%u frame threads, %u tile threads, limit: %d)", m_ThreadingStatus.dwThreads, m_ThreadingStatus.dwFrameThreads, m_ThreadingStatus.dwTileThreads, m_nThreadLimit));
+
+    // run the slice jobs on the shared worker pool, instead of the threads of this decoder
+    // frame threads each decode their own frame and can't be replaced
+    if (m_pAVCtx->active_thread_type & FF_THREAD_SLICE) {
+      m_pAVCtx->execute  = lav_avcodec_execute;
+      m_pAVCtx->execute2 = lav_avcodec_execute2;
+    }
+
+    // remember the input, to check if a future media type can be handled by this decoder
+    m_InputMediaType = *pmt;
+    m_dwInputDecFlags = m_pCallback->GetDecodeFlags() & ~LAV_VIDEO_DEC_FLAGS_DYNAMIC;
+    m_dwInputNumThreads = m_pSettings->GetNumThreads();
+    m_InputPerfMode = m_pSettings->GetPerformanceMode();
+    m_InputFilmGrainMode = m_pSettings->GetAV1FilmGrainMode();
+    m_bInputPinInfoValid = bLAVInfoValid;
+    m_InputPinInfo = lavPinInfo;
   } else {
     DbgLog((LOG_TRACE, 10, L"-> ffmpeg codec failed to open (ret: %d)", ret));
     DestroyDecoder();
@@ -592,6 +811,9 @@ STDMETHODIMP CDecAvcodec::InitDecoder(AVCodecID codec, const CMediaType *pmt)
     av_opt_set_int(m_pAVCtx->priv_data, "x264_build", nX264Build, 0);
   }
 
+  // the splitter knows if the stream has B-frames, the sequence header tells how many frames are reordered
+  m_iReorderDepth = (bLAVInfoValid && lavPinInfo.has_b_frames == 0) ? 0 : -1;
+
   m_iInterlaced = 0;
   for (int i = 0; i < countof(ff_interlace_capable); i++) {
     if (codec == ff_interlace_capable[i]) {
@@ -618,8 +840,27 @@ STDMETHODIMP CDecAvcodec::InitDecoder(AVCodecID codec, const CMediaType *pmt)
         h264parser.ParseNALs(m_pAVCtx->extradata+6, m_pAVCtx->extradata_size-6, 2);
       else
         h264parser.ParseNALs(m_pAVCtx->extradata, m_pAVCtx->extradata_size, 0);
-      if (h264parser.sps.valid)
+      if (h264parser.sps.valid) {
         m_iInterlaced = h264parser.sps.interlaced;
+        if (h264parser.sps.reorder_frames >= 0)
+          m_iReorderDepth = h264parser.sps.reorder_frames;
+      }
+    } else if (codec == AV_CODEC_ID_HEVC) {
+      CHEVCSequenceParser hevcParser;
+      if (m_pAVCtx->extradata[0] == 1 && m_pAVCtx->extradata_size >= 23) {
+        // hvcC, the parameter sets are converted to Annex B
+        CAnnexBConverter converter;
+        BYTE *annexB = nullptr;
+        int size = 0;
+        if (SUCCEEDED(converter.ConvertHEVCExtradata(&annexB, &size, m_pAVCtx->extradata, m_pAVCtx->extradata_size)) && annexB) {
+          hevcParser.ParseNALs(annexB, size, 0);
+          av_freep(&annexB);
+        }
+      } else {
+        hevcParser.ParseNALs(m_pAVCtx->extradata, m_pAVCtx->extradata_size, 0);
+      }
+      if (hevcParser.sps.valid && hevcParser.sps.reorder_pics >= 0)
+        m_iReorderDepth = hevcParser.sps.reorder_pics;
     } else if (codec == AV_CODEC_ID_VC1) {
       CVC1HeaderParser vc1parser(m_pAVCtx->extradata, m_pAVCtx->extradata_size);
       if (vc1parser.hdr.valid)
@@ -645,6 +886,79 @@ STDMETHODIMP CDecAvcodec::InitDecoder(AVCodecID codec, const CMediaType *pmt)
   return S_OK;
 }
 
+// A new media type can be handled by the open decoder if only the picture properties changed,
+// ie. the dimensions, aspect ratio or frame rate, which the decoder picks up from the bitstream itself
+BOOL CDecAvcodec::IsCompatibleInput(AVCodecID codec, const CMediaType *pmt)
+{
+  if (!m_pAVCtx || !avcodec_is_open(m_pAVCtx) || codec != m_nCodecId)
+    return FALSE;
+
+  BOOL bCapable = FALSE;
+  for (int i = 0; i < countof(ff_reconfigure_capable); i++) {
+    if (codec == ff_reconfigure_capable[i]) {
+      bCapable = TRUE;
+      break;
+    }
+  }
+  if (!bCapable)
+    return FALSE;
+
+  const CMediaType &mt = m_InputMediaType;
+  if (pmt->subtype != mt.subtype || pmt->formattype != mt.formattype)
+    return FALSE;
+
+  BITMAPINFOHEADER *pBMI = nullptr, *pOldBMI = nullptr;
+  videoFormatTypeHandler(*pmt, &pBMI);
+  videoFormatTypeHandler(mt, &pOldBMI);
+  if (!pBMI || !pOldBMI || pBMI->biCompression != pOldBMI->biCompression || pBMI->biBitCount != pOldBMI->biBitCount)
+    return FALSE;
+
+  // profile and level are part of the AVC1 extradata
+  if (pmt->formattype == FORMAT_MPEG2Video) {
+    MPEG2VIDEOINFO *mp2vi = (MPEG2VIDEOINFO *)pmt->Format();
+    MPEG2VIDEOINFO *oldmp2vi = (MPEG2VIDEOINFO *)mt.Format();
+    if (mp2vi->dwProfile != oldmp2vi->dwProfile || mp2vi->dwLevel != oldmp2vi->dwLevel || mp2vi->dwFlags != oldmp2vi->dwFlags)
+      return FALSE;
+  }
+
+  if (!extradata_equal(*pmt, mt))
+    return FALSE;
+
+  // The decoding and timing setup depends on the decode flags and the pin info
+  if ((m_pCallback->GetDecodeFlags() & ~LAV_VIDEO_DEC_FLAGS_DYNAMIC) != m_dwInputDecFlags || m_pSettings->GetNumThreads() != m_dwInputNumThreads || m_pSettings->GetPerformanceMode() != m_InputPerfMode
+   || m_pSettings->GetAV1FilmGrainMode() != m_InputFilmGrainMode)
+    return FALSE;
+
+  // A resolution change which calls for a different number of threads re-opens the decoder
+  if (m_nThreadLimit && avcodec_thread_limit(codec, pmt) != m_nThreadLimit)
+    return FALSE;
+
+  LAVPinInfo lavPinInfo = {0};
+  BOOL bLAVInfoValid = SUCCEEDED(m_pCallback->GetLAVPinInfo(lavPinInfo));
+  if (bLAVInfoValid != m_bInputPinInfoValid)
+    return FALSE;
+  if (bLAVInfoValid && (lavPinInfo.flags != m_InputPinInfo.flags || lavPinInfo.pix_fmt != m_InputPinInfo.pix_fmt || lavPinInfo.has_b_frames != m_InputPinInfo.has_b_frames))
+    return FALSE;
+
+  return TRUE;
+}
+
+STDMETHODIMP CDecAvcodec::Reconfigure(AVCodecID codec, const CMediaType *pmt)
+{
+  if (!IsCompatibleInput(codec, pmt))
+    return S_FALSE;
+
+  DbgLog((LOG_TRACE, 10, L"CDecAvcodec::Reconfigure(): Re-using the open decoder for the new media type"));
+
+  HRESULT hr = ResetDecoder(pmt);
+  if (FAILED(hr))
+    return hr;
+
+  m_InputMediaType = *pmt;
+
+  return __super::Flush();
+}
+
 STDMETHODIMP CDecAvcodec::DestroyDecoder()
 {
   m_pAVCodec	= nullptr;
@@ -671,6 +985,8 @@ STDMETHODIMP CDecAvcodec::DestroyDecoder()
   av_freep(&m_pFFBuffer);
   m_nFFBufferSize = 0;
 
+  m_SideDataCache.Clear();
+
   if (m_pSwsContext) {
     sws_freeContext(m_pSwsContext);
     m_pSwsContext = nullptr;
@@ -693,8 +1009,75 @@ static void avpacket_mediasample_free(void *opaque, uint8_t *buffer)
   SafeRelease(&pSample);
 }
 
+// Direct rendering, only frames which are not used as a reference are decoded into output samples
+// Reference frames are read again by the decoder, from memory that can be very slow to read, and stay around for too long.
+// Without frame-thread safe callbacks, avcodec calls this on the thread delivering into the decoder.
+int CDecAvcodec::get_dr_buffer(struct AVCodecContext *c, AVFrame *pic, int flags)
+{
+  CDecAvcodec *pDec = (CDecAvcodec *)c->opaque;
+
+  PixelFormatMapping map = getPixFmtMapping((AVPixelFormat)pic->format);
+  if ((flags & AV_GET_BUFFER_FLAG_REF) || map.conversion)
+    return avcodec_default_get_buffer2(c, pic, flags);
+
+  // The decoder writes whole macroblocks, up to the aligned size
+  // H.264 adds lines for the chroma motion compensation of reference frames, its coded height is already a whole number of macroblock pairs
+  int width = pic->width, height = pic->height;
+  int linesize_align[AV_NUM_DATA_POINTERS];
+  avcodec_align_dimensions2(c, &width, &height, linesize_align);
+  if (c->codec_id == AV_CODEC_ID_H264)
+    height = pic->height;
+
+  IMediaSample *pSample = nullptr;
+  LAVDirectBuffer buffer;
+  if (FAILED(pDec->m_pCallback->GetDirectRenderingBuffer(map.lavpixfmt, c->width, c->height, width, height, linesize_align[0], &pSample, &buffer)))
+    return avcodec_default_get_buffer2(c, pic, flags);
+
+  BYTE *pData = nullptr;
+  pSample->GetPointer(&pData);
+
+  // the buffer holds the reference to the sample, the opaque reference marks the frame for the output
+  pic->buf[0] = av_buffer_create(pData, pSample->GetSize(), avpacket_mediasample_free, pSample, 0);
+  if (!pic->buf[0]) {
+    SafeRelease(&pSample);
+    return avcodec_default_get_buffer2(c, pic, flags);
+  }
+  pic->opaque_ref = av_buffer_ref(pic->buf[0]);
+  if (!pic->opaque_ref) {
+    av_buffer_unref(&pic->buf[0]);
+    return avcodec_default_get_buffer2(c, pic, flags);
+  }
+
+  for (int i = 0; i < 4; i++) {
+    pic->data[i]     = buffer.data[i];
+    pic->linesize[i] = (int)buffer.stride[i];
+  }
+  pic->extended_data = pic->data;
+
+  return 0;
+}
+
 STDMETHODIMP CDecAvcodec::FillAVPacketData(AVPacket *avpkt, const uint8_t *buffer, int buflen, IMediaSample *pSample, bool bRefCounting)
 {
+  // reference the packet of the splitter directly, if possible
+  // this includes the side data, so no further processing is needed
+  if (pSample && bRefCounting && (m_pParser == nullptr))
+  {
+    IMediaSampleAVPacket *pSamplePacket = nullptr;
+    if (SUCCEEDED(pSample->QueryInterface(&pSamplePacket))) {
+      HRESULT hr = pSamplePacket->GetAVPacketRef(avpkt);
+      SafeRelease(&pSamplePacket);
+
+      if (SUCCEEDED(hr)) {
+        if (avpkt->data == buffer && avpkt->size == buflen)
+          return S_OK;
+
+        // the data was modified in-between, fall back to the regular path
+        av_packet_unref(avpkt);
+      }
+    }
+  }
+
   if (m_bInputPadded && (m_pParser == nullptr))
   {
     avpkt->data = (uint8_t *)buffer;
@@ -741,6 +1124,11 @@ STDMETHODIMP CDecAvcodec::Decode(const BYTE *buffer, int buflen, REFERENCE_TIME
 {
   CheckPointer(m_pAVCtx, E_UNEXPECTED);
 
+  // Every frame of an intra-only codec can be decoded on its own, so preroll frames ahead of the seek target are not decoded at all
+  // This has to happen before any timestamp is queued for the packet, and a parser may combine or split packets
+  if (m_bIntraOnly && buffer && !m_pParser && pSample && pSample->IsPreroll() == S_OK)
+    return S_OK;
+
   // Put timestamps into the buffers if appropriate
   if (m_pAVCtx->active_thread_type & FF_THREAD_FRAME)
   {
@@ -787,6 +1175,30 @@ STDMETHODIMP CDecAvcodec::Decode(const BYTE *buffer, int buflen, REFERENCE_TIME
     // flags
     avpkt->flags = bSyncPoint ? AV_PKT_FLAG_KEY : 0;
 
+    // Preroll samples are displayed before the seek target, so if no other frame depends on them, they don't need to be decoded at all
+    // This requires presentation timestamps on the input, and packets not being re-ordered by a parser
+    // The same applies to frames dropped by the performance mode
+    const DWORD dwDecFlags = m_pCallback->GetDecodeFlags();
+
+    // Once non-keyframes were skipped, the references of the following frames are missing up to the next keyframe
+    const BOOL bSkipNonKey = !!(dwDecFlags & LAV_VIDEO_DEC_FLAG_SKIP_NONKEY);
+    if (m_bSkippingNonKey && !bSkipNonKey) {
+      m_bWaitingForKeyFrame = TRUE;
+      m_bResumeAfterSkip = TRUE;
+    }
+    m_bSkippingNonKey = bSkipNonKey;
+
+    if (dwDecFlags & (LAV_VIDEO_DEC_FLAG_KEYFRAMES_ONLY | LAV_VIDEO_DEC_FLAG_SKIP_NONKEY))
+      m_pAVCtx->skip_frame = AVDISCARD_NONKEY;
+    else if (m_bFFReordering && !(dwDecFlags & LAV_VIDEO_DEC_FLAG_ONLY_DTS))
+      m_pAVCtx->skip_frame = ((dwDecFlags & LAV_VIDEO_DEC_FLAG_SKIP_NONREF) || (pSample && pSample->IsPreroll() == S_OK)) ? AVDISCARD_NONREF : AVDISCARD_DEFAULT;
+
+    if (dwDecFlags & LAV_VIDEO_DEC_FLAG_NO_LOOP_FILTER)
+      m_pAVCtx->skip_loop_filter = AVDISCARD_ALL;
+    else
+      m_pAVCtx->skip_loop_filter = (dwDecFlags & LAV_VIDEO_DEC_FLAG_SKIP_NONREF_FILTER) ? AVDISCARD_NONREF : AVDISCARD_DEFAULT;
+    m_pAVCtx->skip_idct = (dwDecFlags & LAV_VIDEO_DEC_FLAG_SKIP_NONREF_FILTER) ? AVDISCARD_NONREF : AVDISCARD_DEFAULT;
+
     // perform decoding
     HRESULT hr = DecodePacket(avpkt, rtStartIn, rtStopIn);
 
@@ -1016,10 +1428,11 @@ send_packet:
 
     // Judge frame usability
     // This determines if a frame is artifact free and can be delivered.
-    if (m_bResumeAtKeyFrame && m_bWaitingForKeyFrame && ret >= 0) {
+    if ((m_bResumeAtKeyFrame || m_bResumeAfterSkip) && m_bWaitingForKeyFrame && ret >= 0) {
       if (m_pFrame->key_frame) {
         DbgLog((LOG_TRACE, 50, L"::Decode() - Found Key-Frame, resuming decoding at %I64d", m_pFrame->pts));
         m_bWaitingForKeyFrame = FALSE;
+        m_bResumeAfterSkip = FALSE;
       }
       else {
         ret = AVERROR(EAGAIN);
@@ -1114,8 +1527,10 @@ send_packet:
     if (sdHDR) {
       if (sdHDR->size == sizeof(AVMasteringDisplayMetadata)) {
         AVMasteringDisplayMetadata *metadata = (AVMasteringDisplayMetadata *)sdHDR->data;
-        MediaSideDataHDR * hdr = (MediaSideDataHDR *)AddLAVFrameSideData(pOutFrame, IID_MediaSideDataHDR, sizeof(MediaSideDataHDR));
-        processFFHDRData(hdr, metadata);
+        bool bNew = false;
+        MediaSideDataHDR * hdr = (MediaSideDataHDR *)m_SideDataCache.SetSideData(pOutFrame, IID_MediaSideDataHDR, sizeof(MediaSideDataHDR), metadata, sizeof(AVMasteringDisplayMetadata), &bNew);
+        if (hdr && bNew)
+          processFFHDRData(hdr, metadata);
       }
       else {
         DbgLog((LOG_TRACE, 10, L"::Decode(): Found HDR data of an unexpected size (%d)", sdHDR->size));
@@ -1126,9 +1541,12 @@ send_packet:
     if (sdHDRContentLightLevel) {
       if (sdHDRContentLightLevel->size == sizeof(AVContentLightMetadata)) {
         AVContentLightMetadata *metadata = (AVContentLightMetadata *)sdHDRContentLightLevel->data;
-        MediaSideDataHDRContentLightLevel * hdr = (MediaSideDataHDRContentLightLevel *)AddLAVFrameSideData(pOutFrame, IID_MediaSideDataHDRContentLightLevel, sizeof(MediaSideDataHDRContentLightLevel));
-        hdr->MaxCLL = metadata->MaxCLL;
-        hdr->MaxFALL = metadata->MaxFALL;
+        bool bNew = false;
+        MediaSideDataHDRContentLightLevel * hdr = (MediaSideDataHDRContentLightLevel *)m_SideDataCache.SetSideData(pOutFrame, IID_MediaSideDataHDRContentLightLevel, sizeof(MediaSideDataHDRContentLightLevel), metadata, sizeof(AVContentLightMetadata), &bNew);
+        if (hdr && bNew) {
+          hdr->MaxCLL = metadata->MaxCLL;
+          hdr->MaxFALL = metadata->MaxFALL;
+        }
       }
       else {
         DbgLog((LOG_TRACE, 10, L"::Decode(): Found HDR Light Level data of an unexpected size (%d)", sdHDRContentLightLevel->size));
@@ -1147,13 +1565,20 @@ send_packet:
       }
     }
 
+    if (m_bAV1FilmGrainExport)
+      ExportAV1FilmGrain(pOutFrame);
+
     AVFrameSideData * sdCC = av_frame_get_side_data(m_pFrame, AV_FRAME_DATA_A53_CC);
     if (sdCC) {
       BYTE *CC = AddLAVFrameSideData(pOutFrame, IID_MediaSideDataEIA608CC, sdCC->size);
       memcpy(CC, sdCC->data, sdCC->size);
     }
 
-    if (map.conversion) {
+    // Frames starting before the seek target are dropped on delivery, skip the conversion of software frames
+    // The frame is still delivered without any data, to keep the timing of the following frames intact
+    if (rtStart != AV_NOPTS_VALUE && rtStart < 0 && pOutFrame->format != LAVPixFmt_DXVA2 && pOutFrame->format != LAVPixFmt_D3D11) {
+      DbgLog((LOG_TRACE, 50, L"::Decode() - Skipping conversion of preroll frame at %I64d", rtStart));
+    } else if (map.conversion) {
       ConvertPixFmt(m_pFrame, pOutFrame);
     } else {
       AVFrame *pFrameRef = av_frame_alloc();
@@ -1167,6 +1592,10 @@ send_packet:
       pOutFrame->priv_data = pFrameRef;
       pOutFrame->destruct = lav_avframe_free;
 
+      // Frames decoded into an output sample are delivered in that sample
+      if (m_bDirectRendering && pFrameRef->opaque_ref)
+        pOutFrame->dr_sample = (IMediaSample *)av_buffer_get_opaque(pFrameRef->opaque_ref);
+
       // Check alignment on rawvideo, which can be off depending on the source file
       if (m_nCodecId == AV_CODEC_ID_RAWVIDEO) {
         for (int i = 0; i < 4; i++) {
@@ -1215,7 +1644,9 @@ send_packet:
   return S_OK;
 }
 
-STDMETHODIMP CDecAvcodec::Flush()
+// Drop all buffered data and the timing state, and resume decoding at the next keyframe
+// H264 and MPEG-2 are re-opened, which keeps the hardware resources of the derived decoders alive
+HRESULT CDecAvcodec::ResetDecoder(const CMediaType *pmt)
 {
   if (m_pAVCtx && avcodec_is_open(m_pAVCtx)) {
     avcodec_flush_buffers(m_pAVCtx);
@@ -1236,9 +1667,15 @@ STDMETHODIMP CDecAvcodec::Flush()
   m_tcBFrameDelay[1].rtStart = m_tcBFrameDelay[1].rtStop = AV_NOPTS_VALUE;
 
   if (!(m_pCallback->GetDecodeFlags() & LAV_VIDEO_DEC_FLAG_DVD) && (m_nCodecId == AV_CODEC_ID_H264 || m_nCodecId == AV_CODEC_ID_MPEG2VIDEO)) {
-    CDecAvcodec::InitDecoder(m_nCodecId, &m_pCallback->GetInputMediaType());
+    return CDecAvcodec::InitDecoder(m_nCodecId, pmt);
   }
 
+  return S_OK;
+}
+
+STDMETHODIMP CDecAvcodec::Flush()
+{
+  ResetDecoder(&m_pCallback->GetInputMediaType());
   return __super::Flush();
 }
 
@@ -1259,6 +1696,50 @@ STDMETHODIMP CDecAvcodec::GetPixelFormat(LAVPixelFormat *pPix, int *pBpp)
   return S_OK;
 }
 
+// Attach the film grain parameters of the current frame, which dav1d was told not to apply
+// libdav1d wraps the Dav1dPicture in the first buffer of the frame, without any data of its own, which carries them.
+void CDecAvcodec::ExportAV1FilmGrain(LAVFrame *pOutFrame)
+{
+  AVBufferRef *buf = m_pFrame->buf[0];
+  if (!buf || buf->size != 0)
+    return;
+
+  const Dav1dPicture *pic = (const Dav1dPicture *)av_buffer_get_opaque(buf);
+  if (!pic || pic->data[0] != m_pFrame->data[0] || !pic->seq_hdr || !pic->frame_hdr || !pic->frame_hdr->film_grain.present)
+    return;
+
+  MediaSideDataAV1FilmGrain *grain = (MediaSideDataAV1FilmGrain *)AddLAVFrameSideData(pOutFrame, IID_MediaSideDataAV1FilmGrain, sizeof(MediaSideDataAV1FilmGrain));
+  if (!grain)
+    return;
+
+  const Dav1dFilmGrainData *fg = &pic->frame_hdr->film_grain.data;
+  grain->bit_depth                = pic->p.bpc;
+  grain->matrix_coefficients      = pic->seq_hdr->mtrx;
+  grain->grain_seed               = fg->seed;
+  grain->num_y_points             = fg->num_y_points;
+  memcpy(grain->y_points, fg->y_points, sizeof(grain->y_points));
+  grain->chroma_scaling_from_luma = fg->chroma_scaling_from_luma;
+  grain->num_cb_points            = fg->num_uv_points[0];
+  memcpy(grain->cb_points, fg->uv_points[0], sizeof(grain->cb_points));
+  grain->num_cr_points            = fg->num_uv_points[1];
+  memcpy(grain->cr_points, fg->uv_points[1], sizeof(grain->cr_points));
+  grain->grain_scaling            = fg->scaling_shift;
+  grain->ar_coeff_lag             = fg->ar_coeff_lag;
+  memcpy(grain->ar_coeffs_y, fg->ar_coeffs_y, sizeof(grain->ar_coeffs_y));
+  memcpy(grain->ar_coeffs_cb, fg->ar_coeffs_uv[0], sizeof(grain->ar_coeffs_cb));
+  memcpy(grain->ar_coeffs_cr, fg->ar_coeffs_uv[1], sizeof(grain->ar_coeffs_cr));
+  grain->ar_coeff_shift           = fg->ar_coeff_shift;
+  grain->grain_scale_shift        = fg->grain_scale_shift;
+  grain->cb_mult                  = fg->uv_mult[0];
+  grain->cb_luma_mult             = fg->uv_luma_mult[0];
+  grain->cb_offset                = fg->uv_offset[0];
+  grain->cr_mult                  = fg->uv_mult[1];
+  grain->cr_luma_mult             = fg->uv_luma_mult[1];
+  grain->cr_offset                = fg->uv_offset[1];
+  grain->overlap_flag             = fg->overlap_flag;
+  grain->clip_to_restricted_range = fg->clip_to_restricted_range;
+}
+
 STDMETHODIMP CDecAvcodec::ConvertPixFmt(AVFrame *pFrame, LAVFrame *pOutFrame)
 {
   // Allocate the buffers to write into
@@ -1282,6 +1763,31 @@ STDMETHODIMP CDecAvcodec::ConvertPixFmt(AVFrame *pFrame, LAVFrame *pOutFrame)
   return S_OK;
 }
 
+STDMETHODIMP_(long) CDecAvcodec::GetBufferCount(long *pMaxBuffers)
+{
+  // 2 buffers for handling, plus one for every frame that can be in flight
+  long buffers = 2;
+
+  if (m_pAVCtx) {
+    // every frame thread holds on to a frame until it is decoded
+    buffers += m_nFrameThreads - 1;
+
+    // and re-ordering delays output by the number of B-Frames
+    buffers += max(m_pAVCtx->has_b_frames, 0);
+  }
+
+  return buffers;
+}
+
+STDMETHODIMP CDecAvcodec::GetThreadingStatus(LAVDecoderThreadingStatus *pStatus)
+{
+  if (!m_pAVCtx || !avcodec_is_open(m_pAVCtx))
+    return S_FALSE;
+
+  *pStatus = m_ThreadingStatus;
+  return S_OK;
+}
+
 STDMETHODIMP_(REFERENCE_TIME) CDecAvcodec::GetFrameDuration()
 {
   if (m_pAVCtx->time_base.den && m_pAVCtx->time_base.num)
@@ -1291,5 +1797,64 @@ STDMETHODIMP_(REFERENCE_TIME) CDecAvcodec::GetFrameDuration()
 
 STDMETHODIMP_(BOOL) CDecAvcodec::IsInterlaced(BOOL bAllowGuess)
 {
+  // frames are deinterlaced on the GPU before they are copied back
+  if (m_bHWDeint)
+    return FALSE;
+
   return (bAllowGuess && m_iInterlaced) || (m_iInterlaced > 0) || m_pSettings->GetDeinterlacingMode() == DeintMode_Force;
 }
+
+void CDecAvcodec::UpdateHWDeint(BOOL bCopyBack)
+{
+  m_bHWDeint = bCopyBack && m_pSettings->GetHWAccelDeintMode() == HWDeintMode_Hardware && m_pSettings->GetDeinterlacingMode() != DeintMode_Disable;
+  m_bHWDeintDoubleRate = (m_pSettings->GetHWAccelDeintOutput() == DeintOutput_FramePerField);
+}
+
+HRESULT CDecAvcodec::SplitDeinterlacedFrame(LAVFrame *pFrame, LAVFrame **ppSecondField)
+{
+  *ppSecondField = nullptr;
+  pFrame->interlaced = 0;
+
+  if (!m_bHWDeintDoubleRate)
+    return S_FALSE;
+
+  LAVFrame *pSecondField = nullptr;
+  HRESULT hr = AllocateFrame(&pSecondField);
+  if (FAILED(hr))
+    return hr;
+
+  // the second field shares all properties, but none of the buffers or side data
+  *pSecondField = *pFrame;
+  memset(pSecondField->data, 0, sizeof(pSecondField->data));
+  memset(pSecondField->stride, 0, sizeof(pSecondField->stride));
+  memset(pSecondField->stereo, 0, sizeof(pSecondField->stereo));
+  pSecondField->side_data = nullptr;
+  pSecondField->side_data_count = 0;
+  pSecondField->priv_data = nullptr;
+  pSecondField->destruct = nullptr;
+
+  // only the last field ends the sequence
+  pFrame->flags &= ~LAV_FRAME_FLAG_END_OF_SEQUENCE;
+
+  REFERENCE_TIME rtDuration = 0;
+  if (pFrame->rtStart != AV_NOPTS_VALUE && pFrame->rtStop != AV_NOPTS_VALUE)
+    rtDuration = pFrame->rtStop - pFrame->rtStart;
+  if (rtDuration <= 0 && pFrame->avgFrameDuration != AV_NOPTS_VALUE)
+    rtDuration = pFrame->avgFrameDuration;
+  if (rtDuration <= 0)
+    rtDuration = GetFrameDuration();
+
+  if (rtDuration > 0) {
+    if (pFrame->rtStart != AV_NOPTS_VALUE) {
+      pFrame->rtStop = pFrame->rtStart + (rtDuration >> 1);
+      pSecondField->rtStart = pFrame->rtStop;
+      pSecondField->rtStop = pFrame->rtStart + rtDuration;
+    }
+    pFrame->avgFrameDuration = pSecondField->avgFrameDuration = rtDuration >> 1;
+  } else {
+    pSecondField->rtStart = pSecondField->rtStop = AV_NOPTS_VALUE;
+  }
+
+  *ppSecondField = pSecondField;
+  return S_OK;
+}
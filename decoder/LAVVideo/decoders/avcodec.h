@@ -24,6 +24,8 @@
 #include <map>
 
 #define AVCODEC_MAX_THREADS 32
+// Every frame thread holds frames of its own, the low footprint profile uses few of them
+#define AVCODEC_LOW_FOOTPRINT_MAX_THREADS 2
 
 typedef struct {
   REFERENCE_TIME rtStart;
@@ -38,14 +40,17 @@ public:
 
   // ILAVDecoder
   STDMETHODIMP InitDecoder(AVCodecID codec, const CMediaType *pmt);
+  STDMETHODIMP Reconfigure(AVCodecID codec, const CMediaType *pmt);
   STDMETHODIMP Decode(const BYTE *buffer, int buflen, REFERENCE_TIME rtStart, REFERENCE_TIME rtStop, BOOL bSyncPoint, BOOL bDiscontinuity, IMediaSample *pSample);
   STDMETHODIMP Flush();
   STDMETHODIMP EndOfStream();
   STDMETHODIMP GetPixelFormat(LAVPixelFormat *pPix, int *pBpp);
   STDMETHODIMP_(REFERENCE_TIME) GetFrameDuration();
   STDMETHODIMP_(BOOL) IsInterlaced(BOOL bAllowGuess);
+  STDMETHODIMP_(long) GetBufferCount(long *pMaxBuffers = nullptr);
   STDMETHODIMP_(const WCHAR*) GetDecoderName() { return L"avcodec"; }
   STDMETHODIMP HasThreadSafeBuffers() { return S_OK; }
+  STDMETHODIMP GetThreadingStatus(LAVDecoderThreadingStatus *pStatus);
 
   // CDecBase
   STDMETHODIMP Init();
@@ -60,8 +65,18 @@ protected:
   STDMETHODIMP DecodePacket(AVPacket *avpkt, REFERENCE_TIME rtStartIn, REFERENCE_TIME rtStopIn);
   STDMETHODIMP ParsePacket(const BYTE *buffer, int buflen, REFERENCE_TIME rtStart, REFERENCE_TIME rtStop, IMediaSample *pSample);
 
+  // GPU deinterlacing in the copy-back hardware decoders
+  void UpdateHWDeint(BOOL bCopyBack);
+  HRESULT SplitDeinterlacedFrame(LAVFrame *pFrame, LAVFrame **ppSecondField);
+
 private:
   STDMETHODIMP ConvertPixFmt(AVFrame *pFrame, LAVFrame *pOutFrame);
+  void ExportAV1FilmGrain(LAVFrame *pOutFrame);
+
+  static int get_dr_buffer(struct AVCodecContext *c, AVFrame *pic, int flags);
+
+  BOOL IsCompatibleInput(AVCodecID codec, const CMediaType *pmt);
+  HRESULT ResetDecoder(const CMediaType *pmt);
 
 protected:
   AVCodecContext       *m_pAVCtx   = nullptr;
@@ -69,6 +84,9 @@ protected:
   AVCodecID             m_nCodecId = AV_CODEC_ID_NONE;
   BOOL                  m_bInInit  = FALSE;
 
+  BOOL                  m_bHWDeint           = FALSE;
+  BOOL                  m_bHWDeintDoubleRate = FALSE;
+
 private:
   AVCodec              *m_pAVCodec   = nullptr;
   AVCodecParserContext *m_pParser    = nullptr;
@@ -79,6 +97,16 @@ private:
   SwsContext           *m_pSwsContext   = nullptr;
 
   BOOL                 m_bHasPalette    = FALSE;
+  BOOL                 m_bDirectRendering = FALSE;
+
+  // Input the decoder was opened for, used to check if a new media type can re-use the decoder
+  CMediaType           m_InputMediaType;
+  DWORD                m_dwInputDecFlags      = 0;
+  DWORD                m_dwInputNumThreads    = 0;
+  LAVPerformanceMode   m_InputPerfMode        = PerfMode_Off;
+  LAVAV1FilmGrainMode  m_InputFilmGrainMode   = AV1FilmGrain_Decoder;
+  BOOL                 m_bInputPinInfoValid   = FALSE;
+  LAVPinInfo           m_InputPinInfo         = { 0 };
 
   // Timing settings
   BOOL                 m_bFFReordering        = FALSE;
@@ -92,10 +120,20 @@ private:
 
   TimingCache          m_tcThreadBuffer[AVCODEC_MAX_THREADS];
   int                  m_CurrentThread        = 0;
+  int                  m_nFrameThreads        = 1;
+  int                  m_nThreadLimit         = 0;    ///< thread limit for the resolution of the stream, 0 if threads were set manually
+  LAVDecoderThreadingStatus m_ThreadingStatus = { 0 };
 
   REFERENCE_TIME       m_rtStartCache         = AV_NOPTS_VALUE;
   BOOL                 m_bResumeAtKeyFrame    = FALSE;
+  BOOL                 m_bIntraOnly           = FALSE;    ///< every frame is a keyframe, see avcodec_is_intra_only
+  BOOL                 m_bAV1FilmGrainExport  = FALSE;    ///< dav1d does not apply the film grain, its parameters are attached to the frames
   BOOL                 m_bWaitingForKeyFrame  = FALSE;
+  BOOL                 m_bSkippingNonKey      = FALSE;    ///< only keyframes are decoded, see LAV_VIDEO_DEC_FLAG_SKIP_NONKEY
+  BOOL                 m_bResumeAfterSkip     = FALSE;    ///< frames are dropped up to the next keyframe, after skipping non-keyframes
   int                  m_iInterlaced          = -1;
+  int                  m_iReorderDepth        = -1;    ///< frames output out of decoding order, from the sequence header or the splitter, -1 if unknown
   int                  m_nSoftTelecine        = 0;
+
+  CLAVFrameSideDataCache m_SideDataCache;         ///< static HDR metadata, shared between the frames while it doesn't change
 };
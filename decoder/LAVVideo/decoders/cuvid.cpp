@@ -22,12 +22,17 @@
 
 #include "moreuuids.h"
 
-#include "parsers/H264SequenceParser.h"
 #include "parsers/MPEG2HeaderParser.h"
 #include "parsers/VC1HeaderParser.h"
-#include "parsers/HEVCSequenceParser.h"
 
 #include "Media.h"
+#include "timer.h"
+#include "MemoryAccount.h"
+
+extern "C" {
+#include "libavutil/hwcontext.h"
+#include "libavutil/hwcontext_d3d11va.h"
+}
 
 ////////////////////////////////////////////////////////////////////////////////
 // Constructor
@@ -104,6 +109,153 @@ static BOOL IsLevelC(DWORD deviceId)
   }
 }
 
+////////////////////////////////////////////////////////////////////////////////
+// Pinned host memory
+////////////////////////////////////////////////////////////////////////////////
+
+// The pinned memory belongs to the CUDA context, and frames referencing it can outlive the decoder
+// The context is only destroyed after the decoder and all buffer pools released it
+struct CuvidHostContext {
+  HMODULE           cudaLib;
+  CUcontext         cudaContext;
+  tcuCtxPushCurrent *cuCtxPushCurrent;
+  tcuCtxPopCurrent  *cuCtxPopCurrent;
+  tcuCtxDestroy     *cuCtxDestroy;
+  tcuMemAllocHost   *cuMemAllocHost;
+  tcuMemHostAlloc   *cuMemHostAlloc;
+  tcuMemFreeHost    *cuMemFreeHost;
+};
+
+struct CuvidHostPool {
+  AVBufferRef  *pHostContext;
+  unsigned int flags;
+};
+
+static void cuvid_host_context_free(void *opaque, uint8_t *data)
+{
+  CuvidHostContext *ctx = (CuvidHostContext *)data;
+  ctx->cuCtxDestroy(ctx->cudaContext);
+  FreeLibrary(ctx->cudaLib);
+  delete ctx;
+}
+
+static void cuvid_host_buffer_free(void *opaque, uint8_t *data)
+{
+  CuvidHostPool *pool = (CuvidHostPool *)opaque;
+  CuvidHostContext *ctx = (CuvidHostContext *)pool->pHostContext->data;
+  CUcontext dummy;
+
+  ctx->cuCtxPushCurrent(ctx->cudaContext);
+  ctx->cuMemFreeHost(data);
+  ctx->cuCtxPopCurrent(&dummy);
+}
+
+static AVBufferRef *cuvid_host_buffer_alloc(void *opaque, int size)
+{
+  CuvidHostPool *pool = (CuvidHostPool *)opaque;
+  CuvidHostContext *ctx = (CuvidHostContext *)pool->pHostContext->data;
+  CUcontext dummy;
+  void *pMem = nullptr;
+  CUresult cuStatus;
+
+  ctx->cuCtxPushCurrent(ctx->cudaContext);
+  if (pool->flags && ctx->cuMemHostAlloc)
+    cuStatus = ctx->cuMemHostAlloc(&pMem, size, pool->flags);
+  else
+    cuStatus = ctx->cuMemAllocHost(&pMem, size);
+  ctx->cuCtxPopCurrent(&dummy);
+
+  if (cuStatus != CUDA_SUCCESS) {
+    DbgLog((LOG_ERROR, 10, L"cuvid_host_buffer_alloc(): allocating %d bytes of pinned memory failed (%d)", size, cuStatus));
+    return nullptr;
+  }
+
+  AVBufferRef *pBuffer = av_buffer_create((uint8_t *)pMem, size, cuvid_host_buffer_free, pool, 0);
+  if (!pBuffer)
+    cuvid_host_buffer_free(pool, (uint8_t *)pMem);
+
+  return pBuffer;
+}
+
+static void cuvid_host_pool_free(void *opaque)
+{
+  CuvidHostPool *pool = (CuvidHostPool *)opaque;
+  av_buffer_unref(&pool->pHostContext);
+  delete pool;
+}
+
+static void cuvid_frame_free(LAVFrame *pFrame)
+{
+  AVBufferRef *pBuffer = (AVBufferRef *)pFrame->priv_data;
+  av_buffer_unref(&pBuffer);
+}
+
+// The pinned memory is always mapped, direct access only needs its pointers
+static bool cuvid_direct_lock(LAVFrame *pFrame, LAVDirectBuffer *pBuffer)
+{
+  ASSERT(pFrame && pBuffer);
+
+  for (int i = 0; i < 4; i++) {
+    pBuffer->data[i] = pFrame->data[i];
+    pBuffer->stride[i] = pFrame->stride[i];
+  }
+  return true;
+}
+
+static void cuvid_direct_unlock(LAVFrame *pFrame)
+{
+}
+
+static void cuvid_d3d11_frame_free(LAVFrame *pFrame)
+{
+  IMediaSample *pSample = (IMediaSample *)pFrame->priv_data;
+  SafeRelease(&pSample);
+}
+
+static cudaVideoSurfaceFormat cuvid_output_format(cudaVideoChromaFormat chroma, int nBitdepth)
+{
+  switch (chroma) {
+  case cudaVideoChromaFormat_422: return nBitdepth > 8 ? cudaVideoSurfaceFormat_P216 : cudaVideoSurfaceFormat_NV16;
+  case cudaVideoChromaFormat_444: return nBitdepth > 8 ? cudaVideoSurfaceFormat_YUV444_16Bit : cudaVideoSurfaceFormat_YUV444;
+  default: break;
+  }
+  return nBitdepth > 8 ? cudaVideoSurfaceFormat_P016 : cudaVideoSurfaceFormat_NV12;
+}
+
+// 4:2:2 surfaces have interleaved chroma, which is split into planes behind the surface in the host buffer
+static bool cuvid_is_interleaved_422(cudaVideoSurfaceFormat fmt)
+{
+  return fmt == cudaVideoSurfaceFormat_NV16 || fmt == cudaVideoSurfaceFormat_P216;
+}
+
+// Size of a mapped output surface, the luma plane followed by the interleaved chroma plane, or both chroma planes for 4:4:4
+static size_t cuvid_surface_size(const CUVIDDECODECREATEINFO *dci, unsigned int pitch)
+{
+  const size_t nLumaSize = (size_t)pitch * dci->ulTargetHeight;
+  switch (dci->OutputFormat) {
+  case cudaVideoSurfaceFormat_NV16:
+  case cudaVideoSurfaceFormat_P216:         return nLumaSize * 2;
+  case cudaVideoSurfaceFormat_YUV444:
+  case cudaVideoSurfaceFormat_YUV444_16Bit: return nLumaSize * 3;
+  default: break;
+  }
+  return nLumaSize * 3 / 2;
+}
+
+template <typename T>
+static void cuvid_split_chroma(const uint8_t *src, ptrdiff_t srcStride, uint8_t *dstU, uint8_t *dstV, ptrdiff_t dstStride, int width, int height)
+{
+  for (int y = 0; y < height; y++) {
+    const T *in = (const T *)(src + y * srcStride);
+    T *u = (T *)(dstU + y * dstStride);
+    T *v = (T *)(dstV + y * dstStride);
+    for (int x = 0; x < width; x++) {
+      u[x] = in[2 * x];
+      v[x] = in[2 * x + 1];
+    }
+  }
+}
+
 ////////////////////////////////////////////////////////////////////////////////
 // CUVID decoder implementation
 ////////////////////////////////////////////////////////////////////////////////
@@ -115,15 +267,26 @@ CDecCuvid::CDecCuvid(void)
   ZeroMemory(&m_VideoFormat, sizeof(m_VideoFormat));
   ZeroMemory(&m_DXVAExtendedFormat, sizeof(m_DXVAExtendedFormat));
   ZeroMemory(&m_VideoDecoderInfo, sizeof(m_VideoDecoderInfo));
+  m_evParserIdle.Set();
 }
 
 CDecCuvid::~CDecCuvid(void)
 {
   DestroyDecoder(true);
+
+  if (m_pAllocator)
+    m_pAllocator->DecoderDestruct();
+  SafeRelease(&m_pAllocator);
 }
 
 STDMETHODIMP CDecCuvid::DestroyDecoder(bool bFull)
 {
+  // The parser thread uses the parser and the decoder
+  StopParserThread();
+
+  // Frames still in flight reference surfaces of the decoder
+  CompleteCopyBacks(0, true);
+
   if (m_cudaCtxLock) cuda.cuvidCtxLock(m_cudaCtxLock, 0);
 
   if (m_AnnexBConverter) {
@@ -133,6 +296,7 @@ STDMETHODIMP CDecCuvid::DestroyDecoder(bool bFull)
   if (m_hDecoder) {
     cuda.cuvidDestroyDecoder(m_hDecoder);
     m_hDecoder = 0;
+    m_pCallback->GetMemoryAccount()->Update(LAVMemory_HWSurfaces, &m_nSurfacesCharged, 0);
   }
 
   if (m_hParser) {
@@ -140,24 +304,33 @@ STDMETHODIMP CDecCuvid::DestroyDecoder(bool bFull)
     m_hParser = 0;
   }
 
-  if (m_pbRawNV12) {
-    cuda.cuMemFreeHost(m_pbRawNV12);
-    m_pbRawNV12 = nullptr;
-    m_cRawNV12 = 0;
-  }
+  // Buffers still referenced by frames are freed once all of them are released
+  av_buffer_pool_uninit(&m_pHostPool);
+  m_nHostPoolSize = 0;
 
   if (m_cudaCtxLock) cuda.cuvidCtxUnlock(m_cudaCtxLock, 0);
 
   if(bFull) {
+    DestroyCopyBack();
+
+    ReleaseD3D11Output();
+    av_buffer_unref(&m_pD3D11DevCtx);
+    m_bD3D11Native = FALSE;
+
     if (m_cudaCtxLock) {
       cuda.cuvidCtxLockDestroy(m_cudaCtxLock);
       m_cudaCtxLock = 0;
     }
 
-    if (m_cudaContext) {
+    // The context is shared with the pinned memory, and destroyed with the last reference
+    if (m_pHostContext) {
+      av_buffer_unref(&m_pHostContext);
+      m_cudaContext = 0;
+    } else if (m_cudaContext) {
       cuda.cuCtxDestroy(m_cudaContext);
       m_cudaContext = 0;
     }
+    m_cudaDevice = -1;
 
     SafeRelease(&m_pD3DDevice9);
     SafeRelease(&m_pD3D9);
@@ -215,6 +388,7 @@ STDMETHODIMP CDecCuvid::LoadCUDAFuncRefs()
   GET_PROC_CUDA_V2(cuCtxPopCurrent);
   GET_PROC_CUDA_V2(cuD3D9CtxCreate);
   GET_PROC_CUDA_V2(cuMemAllocHost);
+  GET_PROC_EX_OPT_V2(cuMemHostAlloc, cuda.cudaLib);
   GET_PROC_CUDA(cuMemFreeHost);
   GET_PROC_CUDA_V2(cuMemcpyDtoH);
   GET_PROC_CUDA(cuDeviceGetCount);
@@ -223,6 +397,26 @@ STDMETHODIMP CDecCuvid::LoadCUDAFuncRefs()
   GET_PROC_CUDA(cuDeviceComputeCapability);
   GET_PROC_CUDA(cuDeviceGetAttribute);
 
+  // Optional functions for the pipelined copy-back, it falls back to synchronous copies without them
+  GET_PROC_EX_OPT_V2(cuMemcpyDtoHAsync, cuda.cudaLib);
+  GET_PROC_EX_OPT(cuStreamCreate, cuda.cudaLib);
+  GET_PROC_EX_OPT(cuStreamDestroy, cuda.cudaLib);
+  GET_PROC_EX_OPT(cuEventCreate, cuda.cudaLib);
+  GET_PROC_EX_OPT(cuEventRecord, cuda.cudaLib);
+  GET_PROC_EX_OPT(cuEventQuery, cuda.cudaLib);
+  GET_PROC_EX_OPT(cuEventSynchronize, cuda.cudaLib);
+  GET_PROC_EX_OPT(cuEventDestroy, cuda.cudaLib);
+
+  // Optional functions for the native D3D11 output, it is only used if all of them are available
+  GET_PROC_EX_OPT_V2(cuMemcpy2D, cuda.cudaLib);
+  GET_PROC_EX_OPT(cuD3D11GetDevice, cuda.cudaLib);
+  GET_PROC_EX_OPT(cuGraphicsD3D11RegisterResource, cuda.cudaLib);
+  GET_PROC_EX_OPT(cuGraphicsUnregisterResource, cuda.cudaLib);
+  GET_PROC_EX_OPT(cuGraphicsResourceSetMapFlags, cuda.cudaLib);
+  GET_PROC_EX_OPT(cuGraphicsMapResources, cuda.cudaLib);
+  GET_PROC_EX_OPT(cuGraphicsUnmapResources, cuda.cudaLib);
+  GET_PROC_EX_OPT(cuGraphicsSubResourceGetMappedArray, cuda.cudaLib);
+
   // Load CUVID function
   cuda.cuvidLib = LoadLibrary(L"nvcuvid.dll");
   if (cuda.cuvidLib == nullptr) {
@@ -240,6 +434,8 @@ STDMETHODIMP CDecCuvid::LoadCUDAFuncRefs()
   GET_PROC_CUVID(cuvidCreateDecoder);
   GET_PROC_CUVID(cuvidDecodePicture);
   GET_PROC_CUVID(cuvidDestroyDecoder);
+  // only needed for the chroma formats other than 4:2:0, which depend on the hardware
+  GET_PROC_EX_OPT(cuvidGetDecoderCaps, cuda.cuvidLib);
 #ifdef _M_AMD64
   GET_PROC_CUVID(cuvidMapVideoFrame64);
   GET_PROC_CUVID(cuvidUnmapVideoFrame64);
@@ -259,18 +455,266 @@ STDMETHODIMP CDecCuvid::FlushParser()
   memset(&pCuvidPacket, 0, sizeof(pCuvidPacket));
 
   pCuvidPacket.flags |= CUVID_PKT_ENDOFSTREAM;
-  CUresult result = CUDA_SUCCESS;
 
-  cuda.cuvidCtxLock(m_cudaCtxLock, 0);
+  // wait for the parser to output all frames
+  HRESULT hr = QueueParserPacket(&pCuvidPacket, FALSE);
+  if (SUCCEEDED(hr))
+    WaitForParser(m_evParserIdle);
+
+  return hr;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Parser thread
+////////////////////////////////////////////////////////////////////////////////
+
+HRESULT CDecCuvid::StartParserThread()
+{
+  if (ThreadExists())
+    return S_OK;
+
+  m_nParserWait = CUVID_WAIT_NONE;
+  m_nDisplayingPicIdx = -1;
+  m_evParserIdle.Set();
+
+  if (!Create()) {
+    DbgLog((LOG_ERROR, 10, L"-> Creating the parser thread failed"));
+    return E_FAIL;
+  }
+
+  return S_OK;
+}
+
+void CDecCuvid::StopParserThread()
+{
+  if (!ThreadExists())
+    return;
+
+  // drop everything still queued, the parser may be waiting for the display of a frame
+  BOOL bFlushing = m_bFlushing;
+  m_bFlushing = TRUE;
+  ClearParserQueue();
+  WaitForParser(m_evParserIdle);
+  ProcessDisplayQueue();
+  m_bFlushing = bFlushing;
+
+  CallWorker(CMD_EXIT);
+  Close();
+
+  m_PendingDisplay.clear();
+}
+
+HRESULT CDecCuvid::QueueParserPacket(const CUVIDSOURCEDATAPACKET *pCuvidPacket, BOOL bFrameData)
+{
+  if (!ThreadExists())
+    return E_UNEXPECTED;
+
+  // the data only stays valid for the duration of the call
+  ParserPacket packet = { 0 };
+  if (pCuvidPacket->payload_size > 0) {
+    packet.pData = (BYTE *)av_malloc(pCuvidPacket->payload_size);
+    if (!packet.pData)
+      return E_OUTOFMEMORY;
+    memcpy(packet.pData, pCuvidPacket->payload, pCuvidPacket->payload_size);
+  }
+  packet.nSize = pCuvidPacket->payload_size;
+  packet.flags = pCuvidPacket->flags;
+  packet.rtTimestamp = pCuvidPacket->timestamp;
+  packet.bFrameData = bFrameData;
+
+  for (;;) {
+    {
+      CAutoLock lock(&m_csParserQueue);
+      if (m_ParserQueue.size() < CUVID_PARSER_QUEUE_SIZE) {
+        m_evParserIdle.Reset();
+        m_ParserQueue.push(packet);
+        break;
+      }
+    }
+    WaitForParser(m_evParserSpace);
+  }
+  m_evPacketQueued.Set();
+
+  return S_OK;
+}
+
+void CDecCuvid::ClearParserQueue()
+{
+  CAutoLock lock(&m_csParserQueue);
+  while (!m_ParserQueue.empty()) {
+    av_free(m_ParserQueue.front().pData);
+    m_ParserQueue.pop();
+  }
+  m_evParserSpace.Set();
+}
+
+DWORD CDecCuvid::ThreadProc()
+{
+  SetThreadName(-1, "LAVVideo CUVID Parser");
+
+  HANDLE hEvts[] = { GetRequestHandle(), m_evPacketQueued };
+
+  while (1) {
+    DWORD dwWait = WaitForMultipleObjects(countof(hEvts), hEvts, FALSE, INFINITE);
+    if (dwWait == WAIT_OBJECT_0) {
+      DWORD cmd = GetRequest();
+      switch (cmd) {
+      case CMD_EXIT:
+        Reply(S_OK);
+        return 0;
+      }
+    } else if (dwWait == WAIT_OBJECT_0 + 1) {
+      while (!CheckRequest(nullptr)) {
+        ParserPacket packet;
+        {
+          CAutoLock lock(&m_csParserQueue);
+          if (m_ParserQueue.empty()) {
+            m_evParserIdle.Set();
+            break;
+          }
+          packet = m_ParserQueue.front();
+          m_ParserQueue.pop();
+        }
+        m_evParserSpace.Set();
+
+        ParsePacket(&packet);
+        av_free(packet.pData);
+      }
+    }
+  }
+  return 0;
+}
+
+void CDecCuvid::ParsePacket(const ParserPacket *pPacket)
+{
+  CUVIDSOURCEDATAPACKET pCuvidPacket;
+  ZeroMemory(&pCuvidPacket, sizeof(pCuvidPacket));
+
+  pCuvidPacket.payload      = pPacket->pData;
+  pCuvidPacket.payload_size = pPacket->nSize;
+  pCuvidPacket.flags        = pPacket->flags;
+  pCuvidPacket.timestamp    = pPacket->rtTimestamp;
+
+  if (pPacket->bFrameData && m_bUseTimestampQueue)
+    m_timestampQueue.push(pPacket->rtTimestamp);
+
+  // The context lock is only taken by the callbacks around the calls into the decoder,
+  // they may wait for the streaming thread, which needs the lock for the copy-back.
+  CUcontext dummy;
+  cuda.cuCtxPushCurrent(m_cudaContext);
   __try {
-    result = cuda.cuvidParseVideoData(m_hParser, &pCuvidPacket);
-  } __except (1) {
-    DbgLog((LOG_ERROR, 10, L"cuvidFlushParser(): cuvidParseVideoData threw an exception"));
-    result = CUDA_ERROR_UNKNOWN;
+    cuda.cuvidParseVideoData(m_hParser, &pCuvidPacket);
+  } __except(1) {
+    DbgLog((LOG_ERROR, 10, L"CDecCuvid::ParsePacket(): cuvidParseVideoData threw an exception"));
+  }
+  cuda.cuCtxPopCurrent(&dummy);
+}
+
+// Wait for an event of the parser thread on the streaming thread, while serving its display requests
+void CDecCuvid::WaitForParser(HANDLE hEvent)
+{
+  HANDLE hEvts[] = { hEvent, m_evDisplayQueued };
+  while (WaitForMultipleObjects(countof(hEvts), hEvts, FALSE, INFINITE) == WAIT_OBJECT_0 + 1)
+    ProcessDisplayQueue();
+}
+
+// Wait on the parser thread until a picture can be decoded into, or for CUVID_WAIT_IDLE
+void CDecCuvid::WaitForDisplay(int nRequest)
+{
+  {
+    CAutoLock lock(&m_csDisplay);
+    if (nRequest >= 0 && !IsPictureQueued(nRequest) && m_nDisplayingPicIdx != nRequest) {
+      bool bPending = false;
+      for (const CUVIDPARSERDISPINFO &disp : m_PendingDisplay) {
+        if (disp.picture_index == nRequest) {
+          bPending = true;
+          break;
+        }
+      }
+      if (!bPending)
+        return;
+    }
+    m_nParserWait = nRequest;
   }
-  cuda.cuvidCtxUnlock(m_cudaCtxLock, 0);
 
-  return result;
+  m_evDisplayQueued.Set();
+  m_evDisplayDone.Wait();
+}
+
+bool CDecCuvid::IsPictureQueued(int nPicIdx)
+{
+  for (int i = 0; i < m_DisplayDelay; i++) {
+    if (m_DisplayQueue[i].picture_index == nPicIdx)
+      return true;
+  }
+  return false;
+}
+
+// Take in the frames output by the parser on the streaming thread, and serve the request of the parser thread
+void CDecCuvid::ProcessDisplayQueue()
+{
+  int nRequest = CUVID_WAIT_NONE;
+  for (;;) {
+    CUVIDPARSERDISPINFO disp;
+    BOOL bDisplay = FALSE;
+    BOOL bPending = FALSE;
+    int nSlot = -1;
+    {
+      CAutoLock lock(&m_csDisplay);
+      if (!m_PendingDisplay.empty()) {
+        // the new frame pushes the oldest entry out of the display queue
+        nSlot = m_DisplayPos;
+        bPending = TRUE;
+      } else if (m_nParserWait >= 0 && IsPictureQueued(m_nParserWait)) {
+        // the parser wants to decode into a frame still pending in the display queue, flush the oldest entries until it is free
+        for (int i = 0; i < m_DisplayDelay && nSlot == -1; i++) {
+          const int pos = (m_DisplayPos + i) % m_DisplayDelay;
+          if (m_DisplayQueue[pos].picture_index >= 0)
+            nSlot = pos;
+        }
+      }
+
+      // nothing left to do, the request is served with the state checked under this lock
+      if (nSlot == -1) {
+        nRequest = m_nParserWait;
+        break;
+      }
+
+      if (m_DisplayQueue[nSlot].picture_index >= 0) {
+        disp = m_DisplayQueue[nSlot];
+        m_nDisplayingPicIdx = disp.picture_index;
+        bDisplay = TRUE;
+      }
+    }
+
+    if (bDisplay && !m_bFlushing)
+      Display(&disp);
+
+    {
+      CAutoLock lock(&m_csDisplay);
+      m_nDisplayingPicIdx = -1;
+      if (bPending) {
+        m_DisplayQueue[nSlot] = m_PendingDisplay.front();
+        m_PendingDisplay.pop_front();
+        m_DisplayPos = (nSlot + 1) % m_DisplayDelay;
+      } else {
+        m_DisplayQueue[nSlot].picture_index = -1;
+      }
+    }
+  }
+
+  if (nRequest == CUVID_WAIT_NONE)
+    return;
+
+  // the decoder is about to be re-created, its frames have to be out of the way
+  if (nRequest == CUVID_WAIT_IDLE)
+    CompleteCopyBacks(0, m_bFlushing != FALSE);
+
+  {
+    CAutoLock lock(&m_csDisplay);
+    m_nParserWait = CUVID_WAIT_NONE;
+  }
+  m_evDisplayDone.Set();
 }
 
 // Beginning of GPU Architecture definitions
@@ -432,6 +876,7 @@ select_device:
 
     if (cuStatus == CUDA_SUCCESS) {
       int major, minor;
+      m_cudaDevice = best_device;
       cuda.cuDeviceComputeCapability(&major, &minor, best_device);
       m_bVDPAULevelC = (major >= 2);
       cuda.cuDeviceGetName(m_cudaDeviceName, sizeof(m_cudaDeviceName), best_device);
@@ -464,6 +909,115 @@ select_device:
     return E_FAIL;
   }
 
+  hr = InitHostContext();
+  if (FAILED(hr))
+    return hr;
+
+  InitCopyBack();
+
+  return S_OK;
+}
+
+STDMETHODIMP CDecCuvid::InitHostContext()
+{
+  CuvidHostContext *ctx = new CuvidHostContext;
+
+  // Hold a reference to the library, the context may need to be destroyed after the decoder unloaded it
+  ctx->cudaLib          = LoadLibrary(L"nvcuda.dll");
+  ctx->cudaContext      = m_cudaContext;
+  ctx->cuCtxPushCurrent = cuda.cuCtxPushCurrent;
+  ctx->cuCtxPopCurrent  = cuda.cuCtxPopCurrent;
+  ctx->cuCtxDestroy     = cuda.cuCtxDestroy;
+  ctx->cuMemAllocHost   = cuda.cuMemAllocHost;
+  ctx->cuMemHostAlloc   = cuda.cuMemHostAlloc;
+  ctx->cuMemFreeHost    = cuda.cuMemFreeHost;
+
+  m_pHostContext = av_buffer_create((uint8_t *)ctx, sizeof(*ctx), cuvid_host_context_free, nullptr, 0);
+  if (!m_pHostContext) {
+    FreeLibrary(ctx->cudaLib);
+    delete ctx;
+    return E_OUTOFMEMORY;
+  }
+
+  return S_OK;
+}
+
+STDMETHODIMP CDecCuvid::GetHostBuffer(int size, AVBufferRef **ppBuffer)
+{
+  // Direct output is read with streaming loads, which makes write-combined memory the better fit
+  // The chroma of 4:2:2 surfaces is split on the CPU, which would be slow to read from write-combined memory
+  const unsigned int flags = (m_bDirect && !cuvid_is_interleaved_422(m_VideoDecoderInfo.OutputFormat)) ? CU_MEMHOSTALLOC_WRITECOMBINED : 0;
+
+  if (!m_pHostPool || m_nHostPoolSize != size || m_nHostPoolFlags != flags) {
+    av_buffer_pool_uninit(&m_pHostPool);
+    m_nHostPoolSize = 0;
+
+    CuvidHostPool *pool = new CuvidHostPool;
+    pool->pHostContext = av_buffer_ref(m_pHostContext);
+    pool->flags = flags;
+
+    if (pool->pHostContext)
+      m_pHostPool = av_buffer_pool_init2(size, pool, cuvid_host_buffer_alloc, cuvid_host_pool_free);
+    if (!m_pHostPool) {
+      av_buffer_unref(&pool->pHostContext);
+      delete pool;
+      return E_OUTOFMEMORY;
+    }
+
+    m_nHostPoolSize = size;
+    m_nHostPoolFlags = flags;
+  }
+
+  *ppBuffer = av_buffer_pool_get(m_pHostPool);
+  return *ppBuffer ? S_OK : E_OUTOFMEMORY;
+}
+
+STDMETHODIMP CDecCuvid::InitCopyBack()
+{
+  m_bAsyncCopy = FALSE;
+
+  if (!cuda.cuMemcpyDtoHAsync || !cuda.cuStreamCreate || !cuda.cuStreamDestroy || !cuda.cuEventCreate || !cuda.cuEventRecord
+    || !cuda.cuEventQuery || !cuda.cuEventSynchronize || !cuda.cuEventDestroy) {
+    DbgLog((LOG_TRACE, 10, L"-> Asynchronous copy functions not available, using synchronous copy-back"));
+    return E_NOTIMPL;
+  }
+
+  cuda.cuvidCtxLock(m_cudaCtxLock, 0);
+  CUresult cuStatus = cuda.cuStreamCreate(&m_hCopyStream, 0);
+  for (int i = 0; i < CUVID_OUTPUT_SURFACES && cuStatus == CUDA_SUCCESS; i++) {
+    cuStatus = cuda.cuEventCreate(&m_CopyBack[i].evDone, CU_EVENT_BLOCKING_SYNC | CU_EVENT_DISABLE_TIMING);
+  }
+  cuda.cuvidCtxUnlock(m_cudaCtxLock, 0);
+
+  if (cuStatus != CUDA_SUCCESS) {
+    DbgLog((LOG_ERROR, 10, L"-> Creation of the copy stream failed with error %d, using synchronous copy-back", cuStatus));
+    DestroyCopyBack();
+    return E_FAIL;
+  }
+
+  m_bAsyncCopy = TRUE;
+  return S_OK;
+}
+
+STDMETHODIMP CDecCuvid::DestroyCopyBack()
+{
+  if (!m_cudaCtxLock)
+    return S_FALSE;
+
+  cuda.cuvidCtxLock(m_cudaCtxLock, 0);
+  for (int i = 0; i < CUVID_OUTPUT_SURFACES; i++) {
+    if (m_CopyBack[i].evDone) {
+      cuda.cuEventDestroy(m_CopyBack[i].evDone);
+      m_CopyBack[i].evDone = 0;
+    }
+  }
+  if (m_hCopyStream) {
+    cuda.cuStreamDestroy(m_hCopyStream);
+    m_hCopyStream = 0;
+  }
+  cuda.cuvidCtxUnlock(m_cudaCtxLock, 0);
+
+  m_bAsyncCopy = FALSE;
   return S_OK;
 }
 
@@ -536,6 +1090,7 @@ STDMETHODIMP CDecCuvid::InitD3D9(int best_device, DWORD requested_device)
         // Store resources
         m_pD3DDevice9 = pDev;
         m_cudaContext = cudaCtx;
+        m_cudaDevice = device;
         m_bVDPAULevelC = isLevelC;
         cuda.cuDeviceGetName(m_cudaDeviceName, sizeof(m_cudaDeviceName), best_device);
         // Is this the one we want?
@@ -549,24 +1104,278 @@ STDMETHODIMP CDecCuvid::InitD3D9(int best_device, DWORD requested_device)
     }
   }
 
-  if (requested_device != DWORD_MAX && device != best_device) {
-    DbgLog((LOG_ERROR, 10, L"-> No D3D Device found matching the requested device"));
-    SafeRelease(&m_pD3DDevice9);
-    SafeRelease(&m_pD3D9);
-    if (m_cudaContext) {
-      cuda.cuCtxDestroy(m_cudaContext);
-      m_cudaContext = 0;
-    }
+  if (requested_device != DWORD_MAX && device != best_device) {
+    DbgLog((LOG_ERROR, 10, L"-> No D3D Device found matching the requested device"));
+    SafeRelease(&m_pD3DDevice9);
+    SafeRelease(&m_pD3D9);
+    if (m_cudaContext) {
+      cuda.cuCtxDestroy(m_cudaContext);
+      m_cudaContext = 0;
+    }
+    m_cudaDevice = -1;
+
+    return E_FAIL;
+  }
+
+  if (!m_pD3DDevice9) {
+    SafeRelease(&m_pD3D9);
+    return E_FAIL;
+  }
+
+  return S_OK;
+}
+
+STDMETHODIMP CDecCuvid::GetD3D11Configuration(IPin *pPin, ID3D11DecoderConfiguration **ppConfiguration)
+{
+  *ppConfiguration = nullptr;
+
+  if (!pPin || !cuda.cuMemcpy2D || !cuda.cuD3D11GetDevice || !cuda.cuGraphicsD3D11RegisterResource || !cuda.cuGraphicsUnregisterResource
+    || !cuda.cuGraphicsResourceSetMapFlags || !cuda.cuGraphicsMapResources || !cuda.cuGraphicsUnmapResources || !cuda.cuGraphicsSubResourceGetMappedArray)
+    return E_NOTIMPL;
+
+  // the surfaces are copied into NV12 or P010 textures, which the connection has to match
+  if (m_VideoDecoderInfo.OutputFormat != cudaVideoSurfaceFormat_NV12 && m_VideoDecoderInfo.OutputFormat != cudaVideoSurfaceFormat_P016)
+    return E_FAIL;
+  CMediaType &mt = m_pCallback->GetOutputMediaType();
+  if (mt.subtype != ((m_VideoDecoderInfo.OutputFormat == cudaVideoSurfaceFormat_P016) ? MEDIASUBTYPE_P010 : MEDIASUBTYPE_NV12))
+    return E_FAIL;
+
+  return pPin->QueryInterface(ppConfiguration);
+}
+
+STDMETHODIMP CDecCuvid::InitAllocator(IMemAllocator **ppAlloc)
+{
+  HRESULT hr = S_OK;
+
+  // only renderers which take D3D11 textures get the D3D11 allocator, all others keep using system memory samples
+  ID3D11DecoderConfiguration *pD3D11DecoderConfiguration = nullptr;
+  hr = GetD3D11Configuration(m_pCallback->GetOutputPin()->GetConnected(), &pD3D11DecoderConfiguration);
+  SafeRelease(&pD3D11DecoderConfiguration);
+  if (FAILED(hr))
+    return E_NOTIMPL;
+
+  if (m_pAllocator == nullptr)
+  {
+    m_pAllocator = new CD3D11SurfaceAllocator(this, &hr);
+    if (!m_pAllocator) {
+      return E_OUTOFMEMORY;
+    }
+    if (FAILED(hr)) {
+      SAFE_DELETE(m_pAllocator);
+      return hr;
+    }
+
+    // Hold a reference on the allocator
+    m_pAllocator->AddRef();
+  }
+
+  // return the proper interface
+  return m_pAllocator->QueryInterface(__uuidof(IMemAllocator), (void **)ppAlloc);
+}
+
+STDMETHODIMP CDecCuvid::PostConnect(IPin *pPin)
+{
+  DbgLog((LOG_TRACE, 10, L"CDecCuvid::PostConnect()"));
+  HRESULT hr = S_OK;
+  AVD3D11VADeviceContext *pDeviceContext = nullptr;
+
+  // Release old D3D resources, we're about to re-init
+  m_pCallback->ReleaseAllDXVAResources();
+  ReleaseD3D11Output();
+  av_buffer_unref(&m_pD3D11DevCtx);
+  m_bD3D11Native = FALSE;
+
+  ID3D11DecoderConfiguration *pD3D11DecoderConfiguration = nullptr;
+  hr = GetD3D11Configuration(pPin, &pD3D11DecoderConfiguration);
+  if (FAILED(hr)) {
+    DbgLog((LOG_TRACE, 10, L"-> D3D11 output not available, using copy-back"));
+    return S_OK;
+  }
+
+  // create a device on the adapter of the renderer
+  {
+    char device[16];
+    snprintf(device, sizeof(device), "%u", pD3D11DecoderConfiguration->GetD3D11AdapterIndex());
+
+    int ret = av_hwdevice_ctx_create(&m_pD3D11DevCtx, AV_HWDEVICE_TYPE_D3D11VA, device, nullptr, 0);
+    if (ret < 0) {
+      DbgLog((LOG_ERROR, 10, L"-> Creating the D3D11 device on adapter %S failed", device));
+      goto fail;
+    }
+  }
+
+  pDeviceContext = (AVD3D11VADeviceContext *)((AVHWDeviceContext *)m_pD3D11DevCtx->data)->hwctx;
+
+  // the surfaces can only be copied on the GPU if the renderer uses the one CUDA decodes on
+  {
+    IDXGIDevice *pDXGIDevice = nullptr;
+    IDXGIAdapter *pDXGIAdapter = nullptr;
+    CUdevice cuDevice = -1;
+
+    hr = pDeviceContext->device->QueryInterface(&pDXGIDevice);
+    if (SUCCEEDED(hr))
+      hr = pDXGIDevice->GetAdapter(&pDXGIAdapter);
+    if (SUCCEEDED(hr) && cuda.cuD3D11GetDevice(&cuDevice, pDXGIAdapter) != CUDA_SUCCESS)
+      hr = E_FAIL;
+
+    SafeRelease(&pDXGIAdapter);
+    SafeRelease(&pDXGIDevice);
+
+    if (FAILED(hr) || cuDevice != m_cudaDevice) {
+      DbgLog((LOG_TRACE, 10, L"-> Renderer adapter is not CUDA device %d, using copy-back", m_cudaDevice));
+      goto fail;
+    }
+  }
+
+  hr = InitD3D11Output();
+  if (FAILED(hr))
+    goto fail;
+
+  // Notice the connected pin that we're sending D3D11 textures
+  hr = pD3D11DecoderConfiguration->ActivateD3D11Decoding(pDeviceContext->device, pDeviceContext->device_context, pDeviceContext->lock_ctx, 0);
+  if (FAILED(hr)) {
+    DbgLog((LOG_ERROR, 10, L"-> Activating D3D11 decoding on the renderer failed (hr: 0x%x)", hr));
+    goto fail;
+  }
+
+  SafeRelease(&pD3D11DecoderConfiguration);
+  m_bD3D11Native = TRUE;
+
+  // the textures are handed to the renderer at full size, drop any scaling with the next sequence
+  if (m_bHWScaled)
+    m_bForceSequenceUpdate = TRUE;
+
+  DbgLog((LOG_TRACE, 10, L"-> Using native D3D11 output"));
+  return S_OK;
+
+fail:
+  // copy-back keeps working, the connection does not need to fail
+  SafeRelease(&pD3D11DecoderConfiguration);
+  ReleaseD3D11Output();
+  av_buffer_unref(&m_pD3D11DevCtx);
+  return S_OK;
+}
+
+STDMETHODIMP CDecCuvid::BreakConnect()
+{
+  if (!m_bD3D11Native)
+    return S_FALSE;
+
+  // release any resources held by the core
+  m_pCallback->ReleaseAllDXVAResources();
+
+  return S_OK;
+}
+
+STDMETHODIMP CDecCuvid::InitD3D11Output()
+{
+  if (m_pD3D11DevCtx == nullptr)
+    return E_UNEXPECTED;
+
+  const int nWidth = m_VideoDecoderInfo.ulTargetWidth;
+  const int nHeight = m_VideoDecoderInfo.ulTargetHeight;
+  const BOOL bHighBitdepth = (m_VideoDecoderInfo.OutputFormat == cudaVideoSurfaceFormat_P016);
+  const AVPixelFormat sw_format = bHighBitdepth ? AV_PIX_FMT_P010 : AV_PIX_FMT_NV12;
+
+  if (m_pD3D11FramesCtx) {
+    AVHWFramesContext *pFrames = (AVHWFramesContext *)m_pD3D11FramesCtx->data;
+    if (pFrames->width == nWidth && pFrames->height == nHeight && pFrames->sw_format == sw_format)
+      return S_OK;
+  }
+
+  DbgLog((LOG_TRACE, 10, L"CDecCuvid::InitD3D11Output(): Allocating D3D11 output textures for %dx%d", nWidth, nHeight));
+  ReleaseD3D11Output();
+
+  AVD3D11VADeviceContext *pDeviceContext = (AVD3D11VADeviceContext *)((AVHWDeviceContext *)m_pD3D11DevCtx->data)->hwctx;
+  HRESULT hr = S_OK;
+  CUresult cuStatus = CUDA_SUCCESS;
+
+  // the samples are individual textures, so the allocator can have any number of them
+  m_pD3D11FramesCtx = av_hwframe_ctx_alloc(m_pD3D11DevCtx);
+  if (m_pD3D11FramesCtx == nullptr)
+    return E_OUTOFMEMORY;
+
+  {
+    AVHWFramesContext *pFrames = (AVHWFramesContext *)m_pD3D11FramesCtx->data;
+    pFrames->format = AV_PIX_FMT_D3D11;
+    pFrames->sw_format = sw_format;
+    pFrames->width = nWidth;
+    pFrames->height = nHeight;
+    pFrames->initial_pool_size = 0;
+
+    AVD3D11VAFramesContext *pFramesHWContext = (AVD3D11VAFramesContext *)pFrames->hwctx;
+    pFramesHWContext->BindFlags |= D3D11_BIND_SHADER_RESOURCE;
+    pFramesHWContext->MiscFlags |= D3D11_RESOURCE_MISC_SHARED;
+
+    int ret = av_hwframe_ctx_init(m_pD3D11FramesCtx);
+    if (ret < 0) {
+      hr = E_FAIL;
+      goto fail;
+    }
+  }
+
+  hr = m_D3D11PlaneCopy.Init(pDeviceContext->device, nWidth, nHeight, bHighBitdepth ? DXGI_FORMAT_P010 : DXGI_FORMAT_NV12);
+  if (FAILED(hr))
+    goto fail;
 
-    return E_FAIL;
+  // the planes are overwritten completely with every frame
+  cuda.cuvidCtxLock(m_cudaCtxLock, 0);
+  for (int i = 0; i < 2 && cuStatus == CUDA_SUCCESS; i++) {
+    cuStatus = cuda.cuGraphicsD3D11RegisterResource(&m_cudaPlaneResources[i], m_D3D11PlaneCopy.GetPlaneTexture(i), CU_GRAPHICS_REGISTER_FLAGS_NONE);
+    if (cuStatus == CUDA_SUCCESS)
+      cuda.cuGraphicsResourceSetMapFlags(m_cudaPlaneResources[i], CU_GRAPHICS_MAP_RESOURCE_FLAGS_WRITE_DISCARD);
   }
+  cuda.cuvidCtxUnlock(m_cudaCtxLock, 0);
 
-  if (!m_pD3DDevice9) {
-    SafeRelease(&m_pD3D9);
-    return E_FAIL;
+  if (cuStatus != CUDA_SUCCESS) {
+    DbgLog((LOG_ERROR, 10, L"-> Registering the plane textures with CUDA failed with error %d", cuStatus));
+    hr = E_FAIL;
+    goto fail;
+  }
+
+  // Update the frames context in the allocator
+  if (m_pAllocator && m_pAllocator->IsCommited())
+  {
+    // decommit the allocator
+    m_pAllocator->Decommit();
+
+    // verify we were able to decommit all its resources
+    if (m_pAllocator->DecommitInProgress()) {
+      DbgLog((LOG_TRACE, 10, L"WARNING! D3D11 Allocator is still busy, trying to flush downstream"));
+      m_pCallback->ReleaseAllDXVAResources();
+      m_pCallback->GetOutputPin()->GetConnected()->BeginFlush();
+      m_pCallback->GetOutputPin()->GetConnected()->EndFlush();
+      if (m_pAllocator->DecommitInProgress()) {
+        DbgLog((LOG_TRACE, 10, L"WARNING! Flush had no effect, decommit of the allocator still not complete"));
+      }
+    }
+
+    // re-commit it to update its frame reference
+    m_pAllocator->Commit();
   }
 
   return S_OK;
+
+fail:
+  ReleaseD3D11Output();
+  return hr;
+}
+
+void CDecCuvid::ReleaseD3D11Output()
+{
+  if (m_cudaCtxLock) {
+    cuda.cuvidCtxLock(m_cudaCtxLock, 0);
+    for (int i = 0; i < 2; i++) {
+      if (m_cudaPlaneResources[i]) {
+        cuda.cuGraphicsUnregisterResource(m_cudaPlaneResources[i]);
+        m_cudaPlaneResources[i] = 0;
+      }
+    }
+    cuda.cuvidCtxUnlock(m_cudaCtxLock, 0);
+  }
+
+  m_D3D11PlaneCopy.Release();
+  av_buffer_unref(&m_pD3D11FramesCtx);
 }
 
 STDMETHODIMP CDecCuvid::InitDecoder(AVCodecID codec, const CMediaType *pmt)
@@ -588,12 +1397,6 @@ STDMETHODIMP CDecCuvid::InitDecoder(AVCodecID codec, const CMediaType *pmt)
     m_DisplayQueue[i].picture_index = -1;
   m_DisplayPos = 0;
 
-  m_DisplayDelay = DISPLAY_DELAY;
-
-  // Reduce display delay for DVD decoding for lower decode latency
-  if (m_pCallback->GetDecodeFlags() & LAV_VIDEO_DEC_FLAG_DVD)
-    m_DisplayDelay /= 2;
-
   cudaVideoCodec cudaCodec = (cudaVideoCodec)-1;
   for (int i = 0; i < countof(cuda_codecs); i++) {
     if (cuda_codecs[i].ffcodec == codec) {
@@ -626,7 +1429,6 @@ STDMETHODIMP CDecCuvid::InitDecoder(AVCodecID codec, const CMediaType *pmt)
   ZeroMemory(&oVideoParserParameters, sizeof(CUVIDPARSERPARAMS));
   oVideoParserParameters.CodecType              = cudaCodec;
   oVideoParserParameters.ulMaxNumDecodeSurfaces = MAX_DECODE_FRAMES;
-  oVideoParserParameters.ulMaxDisplayDelay      = m_DisplayDelay;
   oVideoParserParameters.pUserData              = this;
   oVideoParserParameters.pfnSequenceCallback    = CDecCuvid::HandleVideoSequence;    // Called before decoding frames and/or whenever there is a format change
   oVideoParserParameters.pfnDecodePicture       = CDecCuvid::HandlePictureDecode;    // Called when a picture is ready to be decoded (decode order)
@@ -673,6 +1475,7 @@ STDMETHODIMP CDecCuvid::InitDecoder(AVCodecID codec, const CMediaType *pmt)
   }
 
   int bitdepth = 8;
+  cudaVideoChromaFormat chroma = cudaVideoChromaFormat_420;
   m_bNeedSequenceCheck = FALSE;
   if (m_VideoParserExInfo.format.seqhdr_data_length) {
     if (cudaCodec == cudaVideoCodec_H264) {
@@ -701,12 +1504,41 @@ STDMETHODIMP CDecCuvid::InitDecoder(AVCodecID codec, const CMediaType *pmt)
         return VFW_E_UNSUPPORTED_VIDEO;
       } else if (hr == S_FALSE) {
         m_bNeedSequenceCheck = TRUE;
+      } else if (m_HEVCParser.sps.chroma > 1) {
+        chroma = (cudaVideoChromaFormat)m_HEVCParser.sps.chroma;
       }
     }
   } else {
     m_bNeedSequenceCheck = (cudaCodec == cudaVideoCodec_H264 || cudaCodec == cudaVideoCodec_HEVC);
   }
 
+  // The reorder depth of the stream, from the splitter or the sequence header
+  int reorder = -1;
+  LAVPinInfo pinInfo = { 0 };
+  if (SUCCEEDED(m_pCallback->GetLAVPinInfo(pinInfo)) && pinInfo.has_b_frames == 0)
+    reorder = 0;
+  if (m_VideoParserExInfo.format.seqhdr_data_length && !m_bNeedSequenceCheck) {
+    if (cudaCodec == cudaVideoCodec_H264 && m_H264Parser.sps.reorder_frames >= 0)
+      reorder = m_H264Parser.sps.reorder_frames;
+    else if (cudaCodec == cudaVideoCodec_HEVC && m_HEVCParser.sps.reorder_pics >= 0)
+      reorder = m_HEVCParser.sps.reorder_pics;
+  }
+
+  // Without reordering, every frame is displayed as soon as it was decoded, and the display queue is all of the
+  // latency of the decoder, so it is kept short. Streams with reordering are held back by the parser already.
+  m_DisplayDelay = (reorder == 0) ? DISPLAY_DELAY / 2 : DISPLAY_DELAY;
+
+  // Reduce display delay for DVD decoding for lower decode latency
+  if (m_pCallback->GetDecodeFlags() & LAV_VIDEO_DEC_FLAG_DVD)
+    m_DisplayDelay /= 2;
+
+  // Low-delay decoding, the display queue needs at least one entry
+  if (m_pCallback->GetDecodeFlags() & LAV_VIDEO_DEC_FLAG_LOW_DELAY)
+    m_DisplayDelay = 1;
+
+  DbgLog((LOG_TRACE, 10, L"-> Display delay of %d frames (reorder depth: %d)", m_DisplayDelay, reorder));
+  oVideoParserParameters.ulMaxDisplayDelay = m_DisplayDelay;
+
   oVideoParserParameters.pExtVideoInfo = &m_VideoParserExInfo;
   CUresult oResult = cuda.cuvidCreateVideoParser(&m_hParser, &oVideoParserParameters);
   if (oResult != CUDA_SUCCESS) {
@@ -714,11 +1546,17 @@ STDMETHODIMP CDecCuvid::InitDecoder(AVCodecID codec, const CMediaType *pmt)
     return E_FAIL;
   }
 
+  hr = StartParserThread();
+  if (FAILED(hr))
+    return hr;
+
   BITMAPINFOHEADER *bmi = nullptr;
   videoFormatTypeHandler(pmt->Format(), pmt->FormatType(), &bmi);
 
   {
-    hr = CreateCUVIDDecoder(cudaCodec, bmi->biWidth, bmi->biHeight, bitdepth, !m_bInterlaced);
+    // scaling needs the display area, it is set up with the first sequence
+    m_bHWScaled = FALSE;
+    hr = CreateCUVIDDecoder(cudaCodec, bmi->biWidth, bmi->biHeight, bitdepth, chroma, !m_bInterlaced);
     if (FAILED(hr)) {
       DbgLog((LOG_ERROR, 10, L"-> Creating CUVID decoder failed"));
       return hr;
@@ -732,7 +1570,7 @@ STDMETHODIMP CDecCuvid::InitDecoder(AVCodecID codec, const CMediaType *pmt)
   return S_OK;
 }
 
-STDMETHODIMP CDecCuvid::CreateCUVIDDecoder(cudaVideoCodec codec, DWORD dwWidth, DWORD dwHeight, int nBitdepth, bool bProgressiveSequence)
+STDMETHODIMP CDecCuvid::CreateCUVIDDecoder(cudaVideoCodec codec, DWORD dwWidth, DWORD dwHeight, int nBitdepth, cudaVideoChromaFormat chroma, bool bProgressiveSequence)
 {
   DbgLog((LOG_TRACE, 10, L"CDecCuvid::CreateCUVIDDecoder(): Creating CUVID decoder instance"));
   HRESULT hr = S_OK;
@@ -752,17 +1590,27 @@ retry:
   dci->ulNumDecodeSurfaces = MAX_DECODE_FRAMES;
   dci->CodecType           = codec;
   dci->bitDepthMinus8      = nBitdepth - 8;
-  dci->ChromaFormat        = cudaVideoChromaFormat_420;
-  dci->OutputFormat        = nBitdepth > 8 ? cudaVideoSurfaceFormat_P016 : cudaVideoSurfaceFormat_NV12;
+  dci->ChromaFormat        = chroma;
+  dci->OutputFormat        = cuvid_output_format(chroma, nBitdepth);
   dci->DeinterlaceMode     = (bProgressiveSequence || (m_pSettings->GetDeinterlacingMode() == DeintMode_Disable)) ? cudaVideoDeinterlaceMode_Weave : (cudaVideoDeinterlaceMode)m_pSettings->GetHWAccelDeintMode();
-  dci->ulNumOutputSurfaces = 1;
-
-  dci->ulTargetWidth       = dwWidth;
-  dci->ulTargetHeight      = dwHeight;
+  dci->ulNumOutputSurfaces = m_bAsyncCopy ? CUVID_OUTPUT_SURFACES : 1;
+
+  if (m_bHWScaled) {
+    // the decoder crops the display area and scales it to the target size, so only the reduced frame is mapped and copied
+    dci->ulTargetWidth       = m_nHWScaleWidth;
+    dci->ulTargetHeight      = m_nHWScaleHeight;
+    dci->display_area.left   = (short)m_rcHWScaleCrop.left;
+    dci->display_area.top    = (short)m_rcHWScaleCrop.top;
+    dci->display_area.right  = (short)m_rcHWScaleCrop.right;
+    dci->display_area.bottom = (short)m_rcHWScaleCrop.bottom;
+  } else {
+    dci->ulTargetWidth       = dwWidth;
+    dci->ulTargetHeight      = dwHeight;
 
-  // can't provide the original values here, or the decoder starts doing weird things - scaling to the size and cropping afterwards
-  dci->display_area.right  = (short)dwWidth;
-  dci->display_area.bottom = (short)dwHeight;
+    // can't provide the original values here, or the decoder starts doing weird things - scaling to the size and cropping afterwards
+    dci->display_area.right  = (short)dwWidth;
+    dci->display_area.bottom = (short)dwHeight;
+  }
 
   dci->ulCreationFlags     = bDXVAMode ? cudaVideoCreate_PreferDXVA : cudaVideoCreate_PreferCUVID;
   dci->vidLock             = m_cudaCtxLock;
@@ -780,13 +1628,52 @@ retry:
   }
   cuda.cuvidCtxUnlock(m_cudaCtxLock, 0);
 
+  // decode and output surfaces, estimated from their format
+  const size_t nPlanesX2 = (chroma == cudaVideoChromaFormat_444) ? 6 : (chroma == cudaVideoChromaFormat_422) ? 4 : 3;
+  const size_t nSurfaceSize = (size_t)dwWidth * dwHeight * nPlanesX2 / 2 * (nBitdepth > 8 ? 2 : 1);
+  const size_t nOutputSize = (size_t)dci->ulTargetWidth * dci->ulTargetHeight * nPlanesX2 / 2 * (nBitdepth > 8 ? 2 : 1);
+  m_pCallback->GetMemoryAccount()->Update(LAVMemory_HWSurfaces, &m_nSurfacesCharged, SUCCEEDED(hr) ? nSurfaceSize * dci->ulNumDecodeSurfaces + nOutputSize * dci->ulNumOutputSurfaces : 0);
+
+  // the output textures have to match the new surfaces
+  if (SUCCEEDED(hr) && m_bD3D11Native)
+    hr = InitD3D11Output();
+
   return hr;
 }
 
-STDMETHODIMP CDecCuvid::DecodeSequenceData()
+// Decoding other chroma formats than 4:2:0 depends on the generation of the hardware, which the driver reports
+BOOL CDecCuvid::IsChromaFormatSupported(cudaVideoCodec codec, cudaVideoChromaFormat chroma, int nBitdepth)
+{
+  if (chroma == cudaVideoChromaFormat_420)
+    return TRUE;
+  if (chroma == cudaVideoChromaFormat_Monochrome || cuda.cuvidGetDecoderCaps == nullptr)
+    return FALSE;
+
+  CUVIDDECODECAPS caps;
+  ZeroMemory(&caps, sizeof(caps));
+  caps.eCodecType      = codec;
+  caps.eChromaFormat   = chroma;
+  caps.nBitDepthMinus8 = nBitdepth - 8;
+
+  cuda.cuvidCtxLock(m_cudaCtxLock, 0);
+  CUresult cuStatus = cuda.cuvidGetDecoderCaps(&caps);
+  cuda.cuvidCtxUnlock(m_cudaCtxLock, 0);
+
+  DbgLog((LOG_TRACE, 10, L"CDecCuvid::IsChromaFormatSupported(): codec %d, chroma %d, %d bit: %s", codec, chroma, nBitdepth, (cuStatus == CUDA_SUCCESS && caps.bIsSupported) ? L"supported" : L"not supported"));
+  return cuStatus == CUDA_SUCCESS && caps.bIsSupported;
+}
+
+BOOL CDecCuvid::GetHWScaling(const CUVIDEOFORMAT *cuvidfmt, RECT *prcCrop, int *pWidth, int *pHeight)
 {
-  CUresult oResult;
+  // native output keeps the full frames, the renderer scales those
+  if (m_bD3D11Native || cuvidfmt->display_area.right <= 0 || cuvidfmt->display_area.bottom <= 0)
+    return FALSE;
+
+  return m_pCallback->GetOutputScaling(cuvidfmt->display_area.right, cuvidfmt->display_area.bottom, prcCrop, pWidth, pHeight) == S_OK;
+}
 
+STDMETHODIMP CDecCuvid::DecodeSequenceData()
+{
   CUVIDSOURCEDATAPACKET pCuvidPacket;
   ZeroMemory(&pCuvidPacket, sizeof(pCuvidPacket));
 
@@ -794,9 +1681,8 @@ STDMETHODIMP CDecCuvid::DecodeSequenceData()
   pCuvidPacket.payload_size = m_VideoParserExInfo.format.seqhdr_data_length;
 
   if (pCuvidPacket.payload && pCuvidPacket.payload_size) {
-    cuda.cuvidCtxLock(m_cudaCtxLock, 0);
-    oResult = cuda.cuvidParseVideoData(m_hParser, &pCuvidPacket);
-    cuda.cuvidCtxUnlock(m_cudaCtxLock, 0);
+    if (SUCCEEDED(QueueParserPacket(&pCuvidPacket, FALSE)))
+      WaitForParser(m_evParserIdle);
   }
 
   return S_OK;
@@ -818,6 +1704,13 @@ int CUDAAPI CDecCuvid::HandleVideoSequence(void *obj, CUVIDEOFORMAT *cuvidfmt)
   // Check if we should be deinterlacing
   bool bShouldDeinterlace = (!cuvidfmt->progressive_sequence && filter->m_pSettings->GetDeinterlacingMode() != DeintMode_Disable && filter->m_pSettings->GetHWAccelDeintMode() != HWDeintMode_Weave);
 
+  // Check if the output is cropped or downscaled, which the decoder does on the way into the output surfaces
+  RECT rcCrop = { 0 };
+  int scaleWidth = 0, scaleHeight = 0;
+  BOOL bScale = filter->GetHWScaling(cuvidfmt, &rcCrop, &scaleWidth, &scaleHeight);
+  BOOL bScaleChanged = (bScale != filter->m_bHWScaled)
+    || (bScale && (!EqualRect(&rcCrop, &filter->m_rcHWScaleCrop) || scaleWidth != filter->m_nHWScaleWidth || scaleHeight != filter->m_nHWScaleHeight));
+
   // Re-initialize the decoder if needed
   if ((cuvidfmt->codec != dci->CodecType)
     || (cuvidfmt->coded_width != dci->ulWidth)
@@ -825,10 +1718,18 @@ int CUDAAPI CDecCuvid::HandleVideoSequence(void *obj, CUVIDEOFORMAT *cuvidfmt)
     || (cuvidfmt->chroma_format != dci->ChromaFormat)
     || (cuvidfmt->bit_depth_luma_minus8 != dci->bitDepthMinus8)
     || (bShouldDeinterlace != (dci->DeinterlaceMode != cudaVideoDeinterlaceMode_Weave))
+    || bScaleChanged
     || filter->m_bForceSequenceUpdate)
   {
+    // Hand out everything still in flight before its surfaces go away
+    filter->WaitForDisplay(CUVID_WAIT_IDLE);
+
     filter->m_bForceSequenceUpdate = FALSE;
-    HRESULT hr = filter->CreateCUVIDDecoder(cuvidfmt->codec, cuvidfmt->coded_width, cuvidfmt->coded_height, cuvidfmt->bit_depth_luma_minus8 + 8, cuvidfmt->progressive_sequence != 0);
+    filter->m_bHWScaled = bScale;
+    filter->m_rcHWScaleCrop = rcCrop;
+    filter->m_nHWScaleWidth = scaleWidth;
+    filter->m_nHWScaleHeight = scaleHeight;
+    HRESULT hr = filter->CreateCUVIDDecoder(cuvidfmt->codec, cuvidfmt->coded_width, cuvidfmt->coded_height, cuvidfmt->bit_depth_luma_minus8 + 8, cuvidfmt->chroma_format, cuvidfmt->progressive_sequence != 0);
     if (FAILED(hr))
       filter->m_bFormatIncompatible = TRUE;
   }
@@ -854,7 +1755,9 @@ int CUDAAPI CDecCuvid::HandleVideoSequence(void *obj, CUVIDEOFORMAT *cuvidfmt)
 
   filter->m_VideoFormat = *cuvidfmt;
 
-  if (cuvidfmt->chroma_format != cudaVideoChromaFormat_420) {
+  // 4:2:2 and 4:4:4 are copied back, the native output only has 4:2:0 textures
+  if (cuvidfmt->chroma_format != cudaVideoChromaFormat_420
+    && (filter->m_bD3D11Native || !filter->IsChromaFormatSupported(cuvidfmt->codec, cuvidfmt->chroma_format, cuvidfmt->bit_depth_luma_minus8 + 8))) {
     DbgLog((LOG_TRACE, 10, L"CDecCuvid::HandleVideoSequence(): Incompatible Chroma Format detected"));
     filter->m_bFormatIncompatible = TRUE;
   }
@@ -883,27 +1786,10 @@ int CUDAAPI CDecCuvid::HandlePictureDecode(void *obj, CUVIDPICPARAMS *cuvidpic)
     }
   }
 
-  int flush_pos = filter->m_DisplayPos;
-  for (;;) {
-    bool frame_in_use = false;
-    for (int i=0; i<filter->m_DisplayDelay; i++) {
-      if (filter->m_DisplayQueue[i].picture_index == cuvidpic->CurrPicIdx) {
-        frame_in_use = true;
-        break;
-      }
-    }
-    if (!frame_in_use) {
-      // No problem: we're safe to use this frame
-      break;
-    }
-    // The target frame is still pending in the display queue:
-    // Flush the oldest entry from the display queue and repeat
-    if (filter->m_DisplayQueue[flush_pos].picture_index >= 0) {
-      filter->Display(&filter->m_DisplayQueue[flush_pos]);
-      filter->m_DisplayQueue[flush_pos].picture_index = -1;
-    }
-    flush_pos = (flush_pos + 1) % filter->m_DisplayDelay;
-  }
+  // The target frame may still be pending in the display queue, the streaming thread flushes it out
+  filter->WaitForDisplay(cuvidpic->CurrPicIdx);
+  if (filter->m_bFlushing)
+    return FALSE;
 
   filter->cuda.cuvidCtxLock(filter->m_cudaCtxLock, 0);
   filter->m_PicParams[cuvidpic->CurrPicIdx] = *cuvidpic;
@@ -942,12 +1828,12 @@ int CUDAAPI CDecCuvid::HandlePictureDisplay(void *obj, CUVIDPARSERDISPINFO *cuvi
   if (cuviddisp->timestamp != AV_NOPTS_VALUE && cuviddisp->timestamp < 0)
     return TRUE;
 
-  if (filter->m_DisplayQueue[filter->m_DisplayPos].picture_index >= 0) {
-    filter->Display(&filter->m_DisplayQueue[filter->m_DisplayPos]);
-    filter->m_DisplayQueue[filter->m_DisplayPos].picture_index = -1;
+  // The streaming thread takes it into the display queue
+  {
+    CAutoLock lock(&filter->m_csDisplay);
+    filter->m_PendingDisplay.push_back(*cuviddisp);
   }
-  filter->m_DisplayQueue[filter->m_DisplayPos] = *cuviddisp;
-  filter->m_DisplayPos = (filter->m_DisplayPos + 1) % filter->m_DisplayDelay;
+  filter->m_evDisplayQueued.Set();
 
   return TRUE;
 }
@@ -996,11 +1882,18 @@ STDMETHODIMP CDecCuvid::Deliver(CUVIDPARSERDISPINFO *cuviddisp, int field)
   CUVIDPROCPARAMS vpp;
   CUresult cuStatus = CUDA_SUCCESS;
 
+  if (m_bD3D11Native)
+    return DeliverD3D11(cuviddisp, field);
+
+  if (m_bAsyncCopy)
+    return DeliverAsync(cuviddisp, field);
+
   memset(&vpp, 0, sizeof(vpp));
   vpp.progressive_frame = !m_nSoftTelecine && cuviddisp->progressive_frame;
   vpp.top_field_first = cuviddisp->top_field_first;
   vpp.second_field = (field == 1);
 
+  REFERENCE_TIME rtCopyStart = timer_get_ref_time();
   cuda.cuvidCtxLock(m_cudaCtxLock, 0);
   cuStatus = cuda.cuvidMapVideoFrame(m_hDecoder, cuviddisp->picture_index, &devPtr, &pitch, &vpp);
   if (cuStatus != CUDA_SUCCESS) {
@@ -1008,36 +1901,244 @@ STDMETHODIMP CDecCuvid::Deliver(CUVIDPARSERDISPINFO *cuviddisp, int field)
     goto cuda_fail;
   }
 
-  int size = pitch * m_VideoDecoderInfo.ulTargetHeight * 3 / 2;
-  if(!m_pbRawNV12 || size > m_cRawNV12) {
-    if (m_pbRawNV12) {
-      cuda.cuMemFreeHost(m_pbRawNV12);
-      m_pbRawNV12 = nullptr;
-      m_cRawNV12 = 0;
-    }
-    cuStatus = cuda.cuMemAllocHost((void **)&m_pbRawNV12, size);
-    if (cuStatus != CUDA_SUCCESS) {
-      DbgLog((LOG_CUSTOM1, 1, L"CDecCuvid::Deliver(): cuMemAllocHost failed to allocate %d bytes (%d)", size, cuStatus));
-      goto cuda_fail;
-    }
-    m_cRawNV12 = size;
+  int size = (int)cuvid_surface_size(&m_VideoDecoderInfo, pitch);
+  AVBufferRef *pBuffer = nullptr;
+  if (FAILED(GetHostBuffer(size + (cuvid_is_interleaved_422(m_VideoDecoderInfo.OutputFormat) ? pitch * m_VideoDecoderInfo.ulTargetHeight : 0), &pBuffer))) {
+    // If we don't have our memory, this is bad.
+    DbgLog((LOG_ERROR, 10, L"No Valid Staging Memory - failing"));
+    goto cuda_fail;
   }
   // Copy memory from the device into the staging area
-  if (m_pbRawNV12) {
-    cuStatus = cuda.cuMemcpyDtoH(m_pbRawNV12, devPtr, size);
-    if (cuStatus != CUDA_SUCCESS) {
-      DbgLog((LOG_ERROR, 10, L"Memory Transfer failed (%d)", cuStatus));
-      goto cuda_fail;
-    }
-  } else {
-    // If we don't have our memory, this is bad.
+  cuStatus = cuda.cuMemcpyDtoH(pBuffer->data, devPtr, size);
+  if (cuStatus != CUDA_SUCCESS) {
+    DbgLog((LOG_ERROR, 10, L"Memory Transfer failed (%d)", cuStatus));
+    av_buffer_unref(&pBuffer);
+    goto cuda_fail;
+  }
+  cuda.cuvidUnmapVideoFrame(m_hDecoder, devPtr);
+  cuda.cuvidCtxUnlock(m_cudaCtxLock, 0);
+
+  m_pCallback->AddStageTime(VideoStage_GPUCopyBack, timer_get_ref_time() - rtCopyStart);
+
+  LAVFrame *pFrame = nullptr;
+  SetupFrame(cuviddisp, field, pBuffer, pitch, &pFrame);
+  SplitChroma(pFrame);
+  m_pCallback->Deliver(pFrame);
+
+  return S_OK;
+
+cuda_fail:
+  cuda.cuvidUnmapVideoFrame(m_hDecoder, devPtr);
+  cuda.cuvidCtxUnlock(m_cudaCtxLock, 0);
+  return E_FAIL;
+}
+
+STDMETHODIMP CDecCuvid::DeliverAsync(CUVIDPARSERDISPINFO *cuviddisp, int field)
+{
+  CUdeviceptr devPtr = 0;
+  unsigned int pitch = 0;
+  CUVIDPROCPARAMS vpp;
+  CUresult cuStatus = CUDA_SUCCESS;
+
+  // Every output surface can be mapped at once, wait for the oldest one if all are in use
+  CompleteCopyBacks(CUVID_OUTPUT_SURFACES - 1, false);
+
+  CopyBackSlot &slot = m_CopyBack[(m_CopyBackHead + m_CopyBackCount) % CUVID_OUTPUT_SURFACES];
+
+  memset(&vpp, 0, sizeof(vpp));
+  vpp.progressive_frame = !m_nSoftTelecine && cuviddisp->progressive_frame;
+  vpp.top_field_first = cuviddisp->top_field_first;
+  vpp.second_field = (field == 1);
+
+  REFERENCE_TIME rtCopyStart = timer_get_ref_time();
+  cuda.cuvidCtxLock(m_cudaCtxLock, 0);
+  cuStatus = cuda.cuvidMapVideoFrame(m_hDecoder, cuviddisp->picture_index, &devPtr, &pitch, &vpp);
+  if (cuStatus != CUDA_SUCCESS) {
+    DbgLog((LOG_CUSTOM1, 1, L"CDecCuvid::DeliverAsync(): cuvidMapVideoFrame failed on index %d", cuviddisp->picture_index));
+    goto cuda_fail;
+  }
+
+  int size = (int)cuvid_surface_size(&m_VideoDecoderInfo, pitch);
+  AVBufferRef *pBuffer = nullptr;
+  if (FAILED(GetHostBuffer(size + (cuvid_is_interleaved_422(m_VideoDecoderInfo.OutputFormat) ? pitch * m_VideoDecoderInfo.ulTargetHeight : 0), &pBuffer))) {
     DbgLog((LOG_ERROR, 10, L"No Valid Staging Memory - failing"));
     goto cuda_fail;
   }
+
+  // Queue the transfer into the staging area, the frame is handed out once the event signals its completion
+  cuStatus = cuda.cuMemcpyDtoHAsync(pBuffer->data, devPtr, size, m_hCopyStream);
+  if (cuStatus == CUDA_SUCCESS)
+    cuStatus = cuda.cuEventRecord(slot.evDone, m_hCopyStream);
+  if (cuStatus != CUDA_SUCCESS) {
+    DbgLog((LOG_ERROR, 10, L"Asynchronous Memory Transfer failed (%d)", cuStatus));
+    av_buffer_unref(&pBuffer);
+    goto cuda_fail;
+  }
+  cuda.cuvidCtxUnlock(m_cudaCtxLock, 0);
+
+  m_pCallback->AddStageTime(VideoStage_GPUCopyBack, timer_get_ref_time() - rtCopyStart);
+
+  SetupFrame(cuviddisp, field, pBuffer, pitch, &slot.pFrame);
+  slot.devPtr = devPtr;
+  m_CopyBackCount++;
+
+  // Hand out all frames which are already done
+  CompleteCopyBacks(CUVID_OUTPUT_SURFACES, false);
+
+  return S_OK;
+
+cuda_fail:
+  if (devPtr)
+    cuda.cuvidUnmapVideoFrame(m_hDecoder, devPtr);
+  cuda.cuvidCtxUnlock(m_cudaCtxLock, 0);
+  return E_FAIL;
+}
+
+STDMETHODIMP CDecCuvid::DeliverD3D11(CUVIDPARSERDISPINFO *cuviddisp, int field)
+{
+  CUdeviceptr devPtr = 0;
+  unsigned int pitch = 0;
+  CUVIDPROCPARAMS vpp;
+  CUresult cuStatus = CUDA_SUCCESS;
+  ID3D11Texture2D *pTexture = nullptr;
+  UINT nSlice = 0;
+  LAVFrame *pFrame = nullptr;
+
+  // Take the sample first, this blocks until the renderer returns one
+  IMediaSample *pSample = nullptr;
+  HRESULT hr = m_pAllocator ? m_pAllocator->GetBuffer(&pSample, nullptr, nullptr, 0) : E_UNEXPECTED;
+  if (FAILED(hr)) {
+    DbgLog((LOG_ERROR, 10, L"CDecCuvid::DeliverD3D11(): No D3D11 sample available (hr: 0x%x)", hr));
+    return hr;
+  }
+
+  CD3D11MediaSample *pD3D11Sample = dynamic_cast<CD3D11MediaSample *>(pSample);
+  hr = pD3D11Sample ? pD3D11Sample->GetD3D11Texture(0, &pTexture, &nSlice) : E_NOINTERFACE;
+  if (FAILED(hr)) {
+    SafeRelease(&pSample);
+    return hr;
+  }
+
+  memset(&vpp, 0, sizeof(vpp));
+  vpp.progressive_frame = !m_nSoftTelecine && cuviddisp->progressive_frame;
+  vpp.top_field_first = cuviddisp->top_field_first;
+  vpp.second_field = (field == 1);
+
+  REFERENCE_TIME rtCopyStart = timer_get_ref_time();
+  cuda.cuvidCtxLock(m_cudaCtxLock, 0);
+  cuStatus = cuda.cuvidMapVideoFrame(m_hDecoder, cuviddisp->picture_index, &devPtr, &pitch, &vpp);
+  if (cuStatus != CUDA_SUCCESS) {
+    DbgLog((LOG_CUSTOM1, 1, L"CDecCuvid::DeliverD3D11(): cuvidMapVideoFrame failed on index %d", cuviddisp->picture_index));
+    goto cuda_fail;
+  }
+
+  // Copy both planes into the plane textures, the chroma plane follows the luma plane in the surface
+  cuStatus = cuda.cuGraphicsMapResources(2, m_cudaPlaneResources, 0);
+  if (cuStatus == CUDA_SUCCESS) {
+    const size_t nRowSize = m_VideoDecoderInfo.ulTargetWidth * (m_VideoDecoderInfo.OutputFormat == cudaVideoSurfaceFormat_P016 ? 2 : 1);
+
+    for (int plane = 0; plane < 2 && cuStatus == CUDA_SUCCESS; plane++) {
+      CUarray array = 0;
+      cuStatus = cuda.cuGraphicsSubResourceGetMappedArray(&array, m_cudaPlaneResources[plane], 0, 0);
+      if (cuStatus != CUDA_SUCCESS)
+        break;
+
+      CUDA_MEMCPY2D copy = { 0 };
+      copy.srcMemoryType = CU_MEMORYTYPE_DEVICE;
+      copy.srcDevice     = devPtr + (CUdeviceptr)plane * pitch * m_VideoDecoderInfo.ulTargetHeight;
+      copy.srcPitch      = pitch;
+      copy.dstMemoryType = CU_MEMORYTYPE_ARRAY;
+      copy.dstArray      = array;
+      copy.WidthInBytes  = nRowSize;
+      copy.Height        = plane ? (m_VideoDecoderInfo.ulTargetHeight + 1) / 2 : m_VideoDecoderInfo.ulTargetHeight;
+      cuStatus = cuda.cuMemcpy2D(&copy);
+    }
+
+    // unmapping orders the copies before any later D3D11 work on the textures
+    cuda.cuGraphicsUnmapResources(2, m_cudaPlaneResources, 0);
+  }
+  if (cuStatus != CUDA_SUCCESS) {
+    DbgLog((LOG_ERROR, 10, L"Device Memory Transfer failed (%d)", cuStatus));
+    goto cuda_fail;
+  }
   cuda.cuvidUnmapVideoFrame(m_hDecoder, devPtr);
   cuda.cuvidCtxUnlock(m_cudaCtxLock, 0);
 
+  hr = m_D3D11PlaneCopy.Copy(pTexture, nSlice);
+  SafeRelease(&pTexture);
+  if (FAILED(hr)) {
+    DbgLog((LOG_ERROR, 10, L"Copying the planes into the sample failed (hr: 0x%x)", hr));
+    SafeRelease(&pSample);
+    return hr;
+  }
+
+  m_pCallback->AddStageTime(VideoStage_GPUCopyBack, timer_get_ref_time() - rtCopyStart);
+
+  SetupFrame(cuviddisp, field, nullptr, 0, &pFrame);
+
+  // the frame owns the reference to the sample
+  pFrame->data[0]   = (BYTE *)pSample;
+  pFrame->priv_data = pSample;
+  pFrame->destruct  = cuvid_d3d11_frame_free;
+
+  m_pCallback->Deliver(pFrame);
+
+  return S_OK;
+
+cuda_fail:
+  if (devPtr)
+    cuda.cuvidUnmapVideoFrame(m_hDecoder, devPtr);
+  cuda.cuvidCtxUnlock(m_cudaCtxLock, 0);
+  SafeRelease(&pTexture);
+  SafeRelease(&pSample);
+  return E_FAIL;
+}
+
+STDMETHODIMP CDecCuvid::CompleteCopyBacks(int nMaxPending, bool bDrop)
+{
+  while (m_CopyBackCount > 0) {
+    CopyBackSlot &slot = m_CopyBack[m_CopyBackHead];
+
+    // Wait for the frames above the limit, all others are only taken once their copy finished
+    const bool bWait = m_CopyBackCount > nMaxPending;
+
+    REFERENCE_TIME rtWaitStart = timer_get_ref_time();
+    cuda.cuvidCtxLock(m_cudaCtxLock, 0);
+    CUresult cuStatus = bWait ? cuda.cuEventSynchronize(slot.evDone) : cuda.cuEventQuery(slot.evDone);
+    if (cuStatus == CUDA_ERROR_NOT_READY) {
+      cuda.cuvidCtxUnlock(m_cudaCtxLock, 0);
+      break;
+    }
+    cuda.cuvidUnmapVideoFrame(m_hDecoder, slot.devPtr);
+    cuda.cuvidCtxUnlock(m_cudaCtxLock, 0);
+
+    if (bWait && !bDrop)
+      m_pCallback->AddStageTime(VideoStage_GPUCopyBack, timer_get_ref_time() - rtWaitStart);
+
+    LAVFrame *pFrame = slot.pFrame;
+    slot.pFrame = nullptr;
+    slot.devPtr = 0;
+    m_CopyBackHead = (m_CopyBackHead + 1) % CUVID_OUTPUT_SURFACES;
+    m_CopyBackCount--;
+
+    if (cuStatus != CUDA_SUCCESS) {
+      DbgLog((LOG_ERROR, 10, L"Asynchronous Memory Transfer failed (%d)", cuStatus));
+      bDrop = true;
+    }
+
+    if (bDrop) {
+      ReleaseFrame(&pFrame);
+    } else {
+      SplitChroma(pFrame);
+      m_pCallback->Deliver(pFrame);
+    }
+  }
+
+  return S_OK;
+}
 
+STDMETHODIMP CDecCuvid::SetupFrame(CUVIDPARSERDISPINFO *cuviddisp, int field, AVBufferRef *pBuffer, unsigned int pitch, LAVFrame **ppFrame)
+{
   // Setup the LAVFrame
   LAVFrame *pFrame = nullptr;
   AllocateFrame(&pFrame);
@@ -1071,8 +2172,7 @@ STDMETHODIMP CDecCuvid::Deliver(CUVIDPARSERDISPINFO *cuviddisp, int field)
       rtStop = AV_NOPTS_VALUE;
   }
 
-  pFrame->format = (m_VideoDecoderInfo.OutputFormat == cudaVideoSurfaceFormat_P016) ? LAVPixFmt_P016 : LAVPixFmt_NV12;
-  pFrame->bpp = m_VideoDecoderInfo.bitDepthMinus8 + 8;
+  GetPixelFormat(&pFrame->format, &pFrame->bpp);
   pFrame->width  = m_VideoFormat.display_area.right;
   pFrame->height = m_VideoFormat.display_area.bottom;
   pFrame->rtStart = rtStart;
@@ -1082,9 +2182,19 @@ STDMETHODIMP CDecCuvid::Deliver(CUVIDPARSERDISPINFO *cuviddisp, int field)
     AVRational ar = { m_VideoFormat.display_aspect_ratio.x, m_VideoFormat.display_aspect_ratio.y };
     AVRational arDim = { pFrame->width, pFrame->height };
     if (m_bARPresent || av_cmp_q(ar, arDim) != 0) {
+      // the display aspect ratio follows the area cropped by the decoder
+      if (m_bHWScaled && ar.num > 0 && ar.den > 0) {
+        av_reduce(&ar.num, &ar.den, (int64_t)ar.num * (m_rcHWScaleCrop.right - m_rcHWScaleCrop.left) * pFrame->height,
+                  (int64_t)ar.den * (m_rcHWScaleCrop.bottom - m_rcHWScaleCrop.top) * pFrame->width, INT_MAX);
+      }
       pFrame->aspect_ratio = ar;
     }
   }
+  if (m_bHWScaled) {
+    pFrame->width  = m_VideoDecoderInfo.ulTargetWidth;
+    pFrame->height = m_VideoDecoderInfo.ulTargetHeight;
+    pFrame->flags |= LAV_FRAME_FLAG_SCALED;
+  }
   pFrame->ext_format = m_DXVAExtendedFormat;
   pFrame->interlaced = !cuviddisp->progressive_frame && m_VideoDecoderInfo.DeinterlaceMode == cudaVideoDeinterlaceMode_Weave;
   pFrame->tff = cuviddisp->top_field_first;
@@ -1092,30 +2202,66 @@ STDMETHODIMP CDecCuvid::Deliver(CUVIDPARSERDISPINFO *cuviddisp, int field)
   // TODO: This may be wrong for H264 where B-Frames can be references
   pFrame->frame_type = m_PicParams[cuviddisp->picture_index].intra_pic_flag ? 'I' : (m_PicParams[cuviddisp->picture_index].ref_pic_flag ? 'P' : 'B');
 
-  // Assign the buffer to the LAV Frame bufers
-  int Ysize = m_VideoDecoderInfo.ulTargetHeight * pitch;
-  pFrame->data[0] = m_pbRawNV12;
-  pFrame->data[1] = m_pbRawNV12+Ysize;
-  pFrame->stride[0] = pFrame->stride[1] = pitch;
   pFrame->flags  |= LAV_FRAME_FLAG_BUFFER_MODIFY;
 
+  // Assign the buffer to the LAV Frame bufers, the frame owns the reference to it
+  // Native frames get their sample assigned by the caller instead
+  if (pBuffer) {
+    int Ysize = m_VideoDecoderInfo.ulTargetHeight * pitch;
+    pFrame->data[0] = pBuffer->data;
+    pFrame->data[1] = pBuffer->data+Ysize;
+    pFrame->stride[0] = pFrame->stride[1] = pitch;
+
+    if (m_VideoDecoderInfo.OutputFormat == cudaVideoSurfaceFormat_YUV444 || m_VideoDecoderInfo.OutputFormat == cudaVideoSurfaceFormat_YUV444_16Bit) {
+      pFrame->data[2] = pBuffer->data+2*Ysize;
+      pFrame->stride[2] = pitch;
+    } else if (cuvid_is_interleaved_422(m_VideoDecoderInfo.OutputFormat)) {
+      // the chroma planes are split into the area behind the surface, see SplitChroma
+      pFrame->data[1] = pBuffer->data+2*Ysize;
+      pFrame->data[2] = pFrame->data[1]+Ysize/2;
+      pFrame->stride[1] = pFrame->stride[2] = pitch/2;
+    }
+
+    pFrame->priv_data = pBuffer;
+    pFrame->destruct  = cuvid_frame_free;
+
+    if (m_bDirect) {
+      pFrame->direct        = true;
+      pFrame->direct_lock   = cuvid_direct_lock;
+      pFrame->direct_unlock = cuvid_direct_unlock;
+    }
+  }
+
   if (m_bEndOfSequence)
     pFrame->flags |= LAV_FRAME_FLAG_END_OF_SEQUENCE;
 
-  m_pCallback->Deliver(pFrame);
-
+  *ppFrame = pFrame;
   return S_OK;
+}
 
-cuda_fail:
-  cuda.cuvidUnmapVideoFrame(m_hDecoder, devPtr);
-  cuda.cuvidCtxUnlock(m_cudaCtxLock, 0);
-  return E_FAIL;
+// Split the interleaved chroma of a 4:2:2 surface into the planes of the frame, once the surface was copied
+void CDecCuvid::SplitChroma(LAVFrame *pFrame)
+{
+  if (!cuvid_is_interleaved_422(m_VideoDecoderInfo.OutputFormat) || pFrame->priv_data == nullptr || pFrame->format == LAVPixFmt_D3D11)
+    return;
+
+  const int height = m_VideoDecoderInfo.ulTargetHeight;
+  const int width = (m_VideoDecoderInfo.ulTargetWidth + 1) / 2;
+  const ptrdiff_t pitch = pFrame->stride[0];
+  const uint8_t *src = pFrame->data[0] + height * pitch;
+
+  REFERENCE_TIME rtSplitStart = timer_get_ref_time();
+  if (m_VideoDecoderInfo.OutputFormat == cudaVideoSurfaceFormat_P216)
+    cuvid_split_chroma<uint16_t>(src, pitch, pFrame->data[1], pFrame->data[2], pFrame->stride[1], width, height);
+  else
+    cuvid_split_chroma<uint8_t>(src, pitch, pFrame->data[1], pFrame->data[2], pFrame->stride[1], width, height);
+  m_pCallback->AddStageTime(VideoStage_GPUCopyBack, timer_get_ref_time() - rtSplitStart);
 }
 
 STDMETHODIMP CDecCuvid::CheckH264Sequence(const BYTE *buffer, int buflen)
 {
   DbgLog((LOG_TRACE, 10, L"CDecCuvid::CheckH264Sequence(): Checking H264 frame for SPS"));
-  CH264SequenceParser h264parser;
+  CH264SequenceParser &h264parser = m_H264Parser;
   h264parser.ParseNALs(buffer, buflen, 0);
   if (h264parser.sps.valid) {
     m_bInterlaced = h264parser.sps.interlaced;
@@ -1135,12 +2281,15 @@ STDMETHODIMP CDecCuvid::CheckH264Sequence(const BYTE *buffer, int buflen)
 STDMETHODIMP CDecCuvid::CheckHEVCSequence(const BYTE *buffer, int buflen, int *bitdepth)
 {
   DbgLog((LOG_TRACE, 10, L"CDecCuvid::CheckHEVCSequence(): Checking HEVC frame for SPS"));
-  CHEVCSequenceParser hevcParser;
+  CHEVCSequenceParser &hevcParser = m_HEVCParser;
   hevcParser.ParseNALs(buffer, buflen, 0);
   if (hevcParser.sps.valid) {
     DbgLog((LOG_TRACE, 10, L"-> SPS found"));
-    if (hevcParser.sps.chroma > 1 || hevcParser.sps.bitdepth > 12 || !(hevcParser.sps.profile <= FF_PROFILE_HEVC_MAIN_10 || (hevcParser.sps.profile == FF_PROFILE_HEVC_REXT && hevcParser.sps.rext_profile == HEVC_REXT_PROFILE_MAIN_12))) {
-      DbgLog((LOG_TRACE, 10, L"  -> SPS indicates video incompatible with CUVID, aborting (profile: %d)", hevcParser.sps.profile));
+    // RExt is supported for 4:2:0 12-bit, and the 4:2:2 and 4:4:4 profiles the hardware can decode
+    const bool bChromaSupported = hevcParser.sps.chroma <= 1 || IsChromaFormatSupported(cudaVideoCodec_HEVC, (cudaVideoChromaFormat)hevcParser.sps.chroma, hevcParser.sps.bitdepth);
+    const bool bProfileSupported = hevcParser.sps.profile <= FF_PROFILE_HEVC_MAIN_10 || (hevcParser.sps.profile == FF_PROFILE_HEVC_REXT && (hevcParser.sps.rext_profile == HEVC_REXT_PROFILE_MAIN_12 || hevcParser.sps.chroma > 1));
+    if (!bChromaSupported || !bProfileSupported || hevcParser.sps.bitdepth > 12) {
+      DbgLog((LOG_TRACE, 10, L"  -> SPS indicates video incompatible with CUVID, aborting (profile: %d, chroma: %d, bitdepth: %d)", hevcParser.sps.profile, hevcParser.sps.chroma, hevcParser.sps.bitdepth));
       return E_FAIL;
     }
     if (bitdepth)
@@ -1153,7 +2302,6 @@ STDMETHODIMP CDecCuvid::CheckHEVCSequence(const BYTE *buffer, int buflen, int *b
 
 STDMETHODIMP CDecCuvid::Decode(const BYTE *buffer, int buflen, REFERENCE_TIME rtStart, REFERENCE_TIME rtStop, BOOL bSyncPoint, BOOL bDiscontinuity, IMediaSample *pSample)
 {
-  CUresult result;
   HRESULT hr = S_OK;
 
   CUVIDSOURCEDATAPACKET pCuvidPacket;
@@ -1203,27 +2351,28 @@ STDMETHODIMP CDecCuvid::Decode(const BYTE *buffer, int buflen, REFERENCE_TIME rt
     }
   }
 
-  if (rtStart != AV_NOPTS_VALUE) {
+  // the timestamp also goes into the timestamp queue, so it is always set
+  pCuvidPacket.timestamp    = rtStart;
+  if (rtStart != AV_NOPTS_VALUE)
     pCuvidPacket.flags     |= CUVID_PKT_TIMESTAMP;
-    pCuvidPacket.timestamp  = rtStart;
-  }
 
   if (bDiscontinuity)
     pCuvidPacket.flags     |= CUVID_PKT_DISCONTINUITY;
 
-  if (m_bUseTimestampQueue)
-    m_timestampQueue.push(rtStart);
-
-  cuda.cuvidCtxLock(m_cudaCtxLock, 0);
-  __try {
-    result = cuda.cuvidParseVideoData(m_hParser, &pCuvidPacket);
-  } __except(1) {
-    DbgLog((LOG_ERROR, 10, L"CDecCuvid::Decode(): cuvidParseVideoData threw an exception"));
-  }
-  cuda.cuvidCtxUnlock(m_cudaCtxLock, 0);
+  // Parsing and decoding continue on the parser thread, while the frames it output so far are delivered here
+  QueueParserPacket(&pCuvidPacket, TRUE);
 
   av_freep(&pBuffer);
 
+  // Wait for the frames of this packet, if the decoding latency has to be low
+  if (m_pCallback->GetDecodeFlags() & (LAV_VIDEO_DEC_FLAG_LOW_DELAY | LAV_VIDEO_DEC_FLAG_DVD))
+    WaitForParser(m_evParserIdle);
+
+  ProcessDisplayQueue();
+
+  // Frames finished copying while the packet was parsed can go out right away
+  CompleteCopyBacks(CUVID_OUTPUT_SURFACES, false);
+
   if (m_bEndOfSequence) {
     EndOfStream();
     m_pCallback->Deliver(m_pCallback->GetFlushFrame());
@@ -1243,8 +2392,14 @@ STDMETHODIMP CDecCuvid::Flush()
   DbgLog((LOG_TRACE, 10, L"CDecCuvid::Flush(): Flushing CUVID decoder"));
   m_bFlushing = TRUE;
 
+  ClearParserQueue();
   FlushParser();
 
+  // Drop the frames output by the parser, and all frames still being copied
+  ProcessDisplayQueue();
+  m_PendingDisplay.clear();
+  CompleteCopyBacks(0, true);
+
   // Flush display queue
   for (int i=0; i<m_DisplayDelay; ++i) {
     if (m_DisplayQueue[m_DisplayPos].picture_index >= 0) {
@@ -1256,12 +2411,12 @@ STDMETHODIMP CDecCuvid::Flush()
   m_bFlushing = FALSE;
   m_bWaitForKeyframe = m_bUseTimestampQueue;
 
+  // Clear timestamp queue, the parser thread is idle
+  std::queue<REFERENCE_TIME>().swap(m_timestampQueue);
+
   // Re-init decoder after flush
   DecodeSequenceData();
 
-  // Clear timestamp queue
-  std::queue<REFERENCE_TIME>().swap(m_timestampQueue);
-
   m_nSoftTelecine = 0;
 
   return __super::Flush();
@@ -1270,6 +2425,7 @@ STDMETHODIMP CDecCuvid::Flush()
 STDMETHODIMP CDecCuvid::EndOfStream()
 {
   FlushParser();
+  ProcessDisplayQueue();
 
   // Display all frames left in the queue
   for (int i=0; i<m_DisplayDelay; ++i) {
@@ -1280,16 +2436,30 @@ STDMETHODIMP CDecCuvid::EndOfStream()
     m_DisplayPos = (m_DisplayPos + 1) % m_DisplayDelay;
   }
 
+  // Wait for all pending copies
+  CompleteCopyBacks(0, false);
+
   return S_OK;
 }
 
 STDMETHODIMP CDecCuvid::GetPixelFormat(LAVPixelFormat *pPix, int *pBpp)
 {
-  // Output is always NV12
+  // Output is NV12 or P016 for 4:2:0, native output uses NV12 or P010 textures
+  // 4:2:2 and 4:4:4 are planar, high bitdepth samples are MSB aligned in 16-bit like P016, so they are handed out as 16-bit
+  LAVPixelFormat pix = LAVPixFmt_NV12;
+  int bpp = m_VideoDecoderInfo.bitDepthMinus8 + 8;
+  switch (m_VideoDecoderInfo.OutputFormat) {
+  case cudaVideoSurfaceFormat_P016:         pix = LAVPixFmt_P016; break;
+  case cudaVideoSurfaceFormat_NV16:         pix = LAVPixFmt_YUV422; break;
+  case cudaVideoSurfaceFormat_P216:         pix = LAVPixFmt_YUV422bX; bpp = 16; break;
+  case cudaVideoSurfaceFormat_YUV444:       pix = LAVPixFmt_YUV444; break;
+  case cudaVideoSurfaceFormat_YUV444_16Bit: pix = LAVPixFmt_YUV444bX; bpp = 16; break;
+  default: break;
+  }
   if (pPix)
-    *pPix = (m_VideoDecoderInfo.OutputFormat == cudaVideoSurfaceFormat_P016) ? LAVPixFmt_P016 : LAVPixFmt_NV12;
+    *pPix = m_bD3D11Native ? LAVPixFmt_D3D11 : pix;
   if (pBpp)
-    *pBpp = m_VideoDecoderInfo.bitDepthMinus8 + 8;
+    *pBpp = (m_bD3D11Native && m_VideoDecoderInfo.bitDepthMinus8) ? 10 : bpp;
   return S_OK;
 }
 
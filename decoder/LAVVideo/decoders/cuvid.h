@@ -20,23 +20,40 @@
 #pragma once
 #include "DecBase.h"
 
+#include "parsers/H264SequenceParser.h"
+#include "parsers/HEVCSequenceParser.h"
+
 #define MAX_DECODE_FRAMES 20
 #define DISPLAY_DELAY	4
 #define MAX_PIC_INDEX 64
 
+// Number of frames which can be in flight between the GPU and the host at once
+#define CUVID_OUTPUT_SURFACES 4
+
+// Number of packets queued for the parser thread
+#define CUVID_PARSER_QUEUE_SIZE 8
+
+// Requests of the parser thread to the streaming thread
+#define CUVID_WAIT_NONE -1      ///< No request
+#define CUVID_WAIT_IDLE -2      ///< Take in all frames the parser output, and finish the copy-backs in flight
+
 #include "cuvid/dynlink_cuda.h"
 #include "cuvid/dynlink_nvcuvid.h"
 
 #define CUDA_INIT_D3D9
+#define CUDA_INIT_D3D11
 #include "cuvid/dynlink_cuda_d3d.h"
 
+#include "d3d11/D3D11SurfaceAllocator.h"
+#include "d3d11/D3D11PlaneCopy.h"
 #include "parsers/AnnexBConverter.h"
 
 #include <queue>
+#include <deque>
 
 #define CUMETHOD(name) t##name *##name
 
-class CDecCuvid : public CDecBase
+class CDecCuvid : public CDecBase, public ID3D11FramesContextProvider, protected CAMThread
 {
 public:
   CDecCuvid(void);
@@ -50,19 +67,31 @@ public:
   STDMETHODIMP GetPixelFormat(LAVPixelFormat *pPix, int *pBpp);
   STDMETHODIMP_(REFERENCE_TIME) GetFrameDuration();
   STDMETHODIMP_(BOOL) IsInterlaced(BOOL bAllowGuess);
-  STDMETHODIMP_(const WCHAR*) GetDecoderName() { return L"cuvid"; }
+  STDMETHODIMP_(const WCHAR*) GetDecoderName() { return m_bD3D11Native ? L"cuvid native" : (m_bDirect ? L"cuvid direct" : L"cuvid"); }
+  STDMETHODIMP HasThreadSafeBuffers() { return S_OK; }
+  STDMETHODIMP SetDirectOutput(BOOL bDirect) { m_bDirect = bDirect; return S_OK; }
   STDMETHODIMP GetHWAccelActiveDevice(BSTR *pstrDeviceName);
 
+  STDMETHODIMP InitAllocator(IMemAllocator **ppAlloc);
+  STDMETHODIMP PostConnect(IPin *pPin);
+  STDMETHODIMP BreakConnect();
+
   // CDecBase
   STDMETHODIMP Init();
 
+  // ID3D11FramesContextProvider
+  AVBufferRef *GetD3D11FramesContext() { return m_pD3D11FramesCtx; }
+  ID3D11Texture2D *GetD3D11StandaloneTexture(int nIndex) { return nullptr; }
+
 private:
   STDMETHODIMP LoadCUDAFuncRefs();
   STDMETHODIMP DestroyDecoder(bool bFull);
 
   STDMETHODIMP InitD3D9(int best_device, DWORD requested_device);
 
-  STDMETHODIMP CreateCUVIDDecoder(cudaVideoCodec codec, DWORD dwWidth, DWORD dwHeight, int nBitdepth, bool bProgressiveSequence);
+  STDMETHODIMP CreateCUVIDDecoder(cudaVideoCodec codec, DWORD dwWidth, DWORD dwHeight, int nBitdepth, cudaVideoChromaFormat chroma, bool bProgressiveSequence);
+  BOOL IsChromaFormatSupported(cudaVideoCodec codec, cudaVideoChromaFormat chroma, int nBitdepth);
+  BOOL GetHWScaling(const CUVIDEOFORMAT *cuvidfmt, RECT *prcCrop, int *pWidth, int *pHeight);
   STDMETHODIMP DecodeSequenceData();
 
   // CUDA Callbacks
@@ -72,13 +101,48 @@ private:
 
   STDMETHODIMP Display(CUVIDPARSERDISPINFO *cuviddisp);
   STDMETHODIMP Deliver(CUVIDPARSERDISPINFO *cuviddisp, int field = 0);
+  STDMETHODIMP SetupFrame(CUVIDPARSERDISPINFO *cuviddisp, int field, AVBufferRef *pBuffer, unsigned int pitch, LAVFrame **ppFrame);
+
+  STDMETHODIMP InitHostContext();
+  STDMETHODIMP GetHostBuffer(int size, AVBufferRef **ppBuffer);
+
+  STDMETHODIMP InitCopyBack();
+  STDMETHODIMP DestroyCopyBack();
+  STDMETHODIMP DeliverAsync(CUVIDPARSERDISPINFO *cuviddisp, int field);
+  STDMETHODIMP CompleteCopyBacks(int nMaxPending, bool bDrop);
+
+  STDMETHODIMP GetD3D11Configuration(IPin *pPin, ID3D11DecoderConfiguration **ppConfiguration);
+  STDMETHODIMP InitD3D11Output();
+  void ReleaseD3D11Output();
+  STDMETHODIMP DeliverD3D11(CUVIDPARSERDISPINFO *cuviddisp, int field);
 
   CUVIDPARSERDISPINFO* GetNextFrame();
 
   STDMETHODIMP FlushParser();
 
+  // Parser thread
+  struct ParserPacket {
+    BYTE           *pData;
+    int            nSize;
+    unsigned long  flags;
+    REFERENCE_TIME rtTimestamp;
+    BOOL           bFrameData;    ///< Packet of the stream, its timestamp goes into the timestamp queue
+  };
+
+  DWORD ThreadProc();
+  HRESULT StartParserThread();
+  void StopParserThread();
+  HRESULT QueueParserPacket(const CUVIDSOURCEDATAPACKET *pCuvidPacket, BOOL bFrameData);
+  void ClearParserQueue();
+  void ParsePacket(const ParserPacket *pPacket);
+  void WaitForParser(HANDLE hEvent);
+  void WaitForDisplay(int nRequest);
+  void ProcessDisplayQueue();
+  bool IsPictureQueued(int nPicIdx);
+
   STDMETHODIMP CheckH264Sequence(const BYTE *buffer, int buflen);
   STDMETHODIMP CheckHEVCSequence(const BYTE *buffer, int buflen, int *bitdepth);
+  void SplitChroma(LAVFrame *pFrame);
 
   int GetMaxGflopsGraphicsDeviceId();
 
@@ -92,13 +156,30 @@ private:
     CUMETHOD(cuCtxPopCurrent);
     CUMETHOD(cuD3D9CtxCreate);
     CUMETHOD(cuMemAllocHost);
+    CUMETHOD(cuMemHostAlloc);
     CUMETHOD(cuMemFreeHost);
     CUMETHOD(cuMemcpyDtoH);
+    CUMETHOD(cuMemcpyDtoHAsync);
+    CUMETHOD(cuStreamCreate);
+    CUMETHOD(cuStreamDestroy);
+    CUMETHOD(cuEventCreate);
+    CUMETHOD(cuEventRecord);
+    CUMETHOD(cuEventQuery);
+    CUMETHOD(cuEventSynchronize);
+    CUMETHOD(cuEventDestroy);
     CUMETHOD(cuDeviceGetCount);
     CUMETHOD(cuDriverGetVersion);
     CUMETHOD(cuDeviceGetName);
     CUMETHOD(cuDeviceComputeCapability);
     CUMETHOD(cuDeviceGetAttribute);
+    CUMETHOD(cuMemcpy2D);
+    CUMETHOD(cuD3D11GetDevice);
+    CUMETHOD(cuGraphicsD3D11RegisterResource);
+    CUMETHOD(cuGraphicsUnregisterResource);
+    CUMETHOD(cuGraphicsResourceSetMapFlags);
+    CUMETHOD(cuGraphicsMapResources);
+    CUMETHOD(cuGraphicsUnmapResources);
+    CUMETHOD(cuGraphicsSubResourceGetMappedArray);
 
     HMODULE cuvidLib;
     CUMETHOD(cuvidCtxLockCreate);
@@ -111,6 +192,7 @@ private:
     CUMETHOD(cuvidCreateDecoder);
     CUMETHOD(cuvidDecodePicture);
     CUMETHOD(cuvidDestroyDecoder);
+    CUMETHOD(cuvidGetDecoderCaps);
     CUMETHOD(cuvidMapVideoFrame);
     CUMETHOD(cuvidUnmapVideoFrame);
 #ifdef _M_AMD64
@@ -123,12 +205,14 @@ private:
   IDirect3DDevice9       *m_pD3DDevice9 = nullptr;
 
   CUcontext              m_cudaContext = 0;
+  CUdevice               m_cudaDevice  = -1;
   CUvideoctxlock         m_cudaCtxLock = 0;
 
   CUvideoparser          m_hParser     = 0;
   CUVIDEOFORMATEX        m_VideoParserExInfo;
 
   CUvideodecoder         m_hDecoder    = 0;
+  size_t                 m_nSurfacesCharged = 0;
   CUVIDDECODECREATEINFO  m_VideoDecoderInfo;
 
   CUVIDEOFORMAT          m_VideoFormat;
@@ -136,6 +220,23 @@ private:
   CUVIDPARSERDISPINFO    m_DisplayQueue[DISPLAY_DELAY];
   int                    m_DisplayPos = 0;
 
+  // The parser and the decode submission run on a worker thread, fed by a packet queue
+  // Frames output by the parser are queued for the streaming thread, which does the copy-back and delivery.
+  // The display queue is owned by the streaming thread, the parser thread only checks it under m_csDisplay.
+  enum {CMD_EXIT};
+  std::queue<ParserPacket>        m_ParserQueue;
+  CCritSec                        m_csParserQueue;
+  CAMEvent                        m_evPacketQueued;
+  CAMEvent                        m_evParserSpace;
+  CAMEvent                        m_evParserIdle{TRUE};
+
+  std::deque<CUVIDPARSERDISPINFO> m_PendingDisplay;
+  CCritSec                        m_csDisplay;
+  CAMEvent                        m_evDisplayQueued;
+  CAMEvent                        m_evDisplayDone;
+  int                             m_nDisplayingPicIdx = -1;
+  int                             m_nParserWait       = CUVID_WAIT_NONE;
+
   CUVIDPICPARAMS         m_PicParams[MAX_PIC_INDEX];
 
   BOOL                   m_bVDPAULevelC = FALSE;
@@ -152,13 +253,46 @@ private:
 
   DXVA2_ExtendedFormat   m_DXVAExtendedFormat;
 
-  BYTE                   *m_pbRawNV12 = nullptr;
-  int                    m_cRawNV12   = 0;
+  // Pinned staging buffers, every frame holds on to its buffer until it is released
+  AVBufferRef            *m_pHostContext   = nullptr;
+  AVBufferPool           *m_pHostPool      = nullptr;
+  int                    m_nHostPoolSize   = 0;
+  unsigned int           m_nHostPoolFlags  = 0;
+  BOOL                   m_bDirect         = FALSE;
+
+  // Pipelined copy-back, every output surface can be in flight at once
+  // Frames are handed out in order, once the transfer into their buffer completed
+  struct CopyBackSlot {
+    CUevent     evDone    = 0;
+    CUdeviceptr devPtr    = 0;
+    LAVFrame    *pFrame   = nullptr;
+  } m_CopyBack[CUVID_OUTPUT_SURFACES];
+  CUstream               m_hCopyStream   = 0;
+  BOOL                   m_bAsyncCopy    = FALSE;
+  int                    m_CopyBackHead  = 0;
+  int                    m_CopyBackCount = 0;
+
+  // Native D3D11 output, the decoded surfaces are copied into the samples of the allocator on the GPU
+  // CUDA fills the plane textures of the plane copy, which assembles them into the sample textures.
+  CD3D11SurfaceAllocator *m_pAllocator     = nullptr;
+  AVBufferRef            *m_pD3D11DevCtx    = nullptr;
+  AVBufferRef            *m_pD3D11FramesCtx = nullptr;
+  CD3D11PlaneCopy        m_D3D11PlaneCopy;
+  CUgraphicsResource     m_cudaPlaneResources[2] = { 0 };
+  BOOL                   m_bD3D11Native    = FALSE;
+
+  // Output crop and downscale done by the decoder, the crop is in the coordinates of the display area
+  BOOL                   m_bHWScaled       = FALSE;
+  RECT                   m_rcHWScaleCrop   = { 0 };
+  int                    m_nHWScaleWidth   = 0;
+  int                    m_nHWScaleHeight  = 0;
 
   CAnnexBConverter       *m_AnnexBConverter = nullptr;
 
   BOOL                   m_bFormatIncompatible = FALSE;
   BOOL                   m_bNeedSequenceCheck  = FALSE;
+  CH264SequenceParser    m_H264Parser;
+  CHEVCSequenceParser    m_HEVCParser;
 
   BOOL                   m_bUseTimestampQueue  = FALSE;
   std::queue<REFERENCE_TIME> m_timestampQueue;
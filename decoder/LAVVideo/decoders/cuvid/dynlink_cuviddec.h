@@ -85,8 +85,14 @@ typedef enum cudaVideoCodec_enum {
 /*********************************************************************************/
 typedef enum cudaVideoSurfaceFormat_enum {
     cudaVideoSurfaceFormat_NV12=0,       /**< NV12 format          */
-    cudaVideoSurfaceFormat_P016=1        /**< 16 bit semiplaner format. Can be used for 10 bit(6LSB bits 0),
+    cudaVideoSurfaceFormat_P016=1,       /**< 16 bit semiplaner format. Can be used for 10 bit(6LSB bits 0),
                                               12 bit (4LSB bits 0) */
+    cudaVideoSurfaceFormat_YUV444=2,     /**< Planar YUV [Y plane followed by U and V planes] */
+    cudaVideoSurfaceFormat_YUV444_16Bit=3, /**< 16 bit Planar YUV [Y plane followed by U and V planes].
+                                                Can be used for 10 bit(6LSB bits 0), 12 bit (4LSB bits 0) */
+    cudaVideoSurfaceFormat_NV16=4,       /**< Semi-Planar YUV 4:2:2 [Y plane followed by interleaved UV plane] */
+    cudaVideoSurfaceFormat_P216=5        /**< 16 bit Semi-Planar YUV 4:2:2 [Y plane followed by interleaved UV plane].
+                                              Can be used for 10 bit(6LSB bits 0), 12 bit (4LSB bits 0) */
 } cudaVideoSurfaceFormat;
 
 /******************************************************************************************************************/
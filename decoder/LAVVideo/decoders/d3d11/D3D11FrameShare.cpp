@@ -0,0 +1,230 @@
+/*
+ *      Copyright (C) 2010-2019 Hendrik Leppkes
+ *      http://www.1f0.de
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program; if not, write to the Free Software Foundation, Inc.,
+ *  51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+
+#include "stdafx.h"
+#include "D3D11FrameShare.h"
+
+CD3D11FrameShare::CD3D11FrameShare()
+{
+}
+
+CD3D11FrameShare::~CD3D11FrameShare()
+{
+  Close();
+}
+
+HRESULT CD3D11FrameShare::Open(LPCWSTR pszName, DWORD dwSurfaces)
+{
+  if (m_pHeader && m_Name == pszName && m_dwSurfaces == dwSurfaces)
+    return S_OK;
+
+  Close();
+
+  if (dwSurfaces < 2 || dwSurfaces > LAV_D3D11_SHARE_MAX_SURFACES)
+    return E_INVALIDARG;
+
+  WCHAR wszName[128];
+  swprintf_s(wszName, LAV_D3D11_SHARE_HEADER_NAME, pszName);
+
+  // a consumer can have created the section already, waiting for the decoder
+  m_hMapping = CreateFileMapping(INVALID_HANDLE_VALUE, nullptr, PAGE_READWRITE, 0, sizeof(LAVD3D11ShareHeader), wszName);
+  if (m_hMapping == nullptr)
+    goto fail;
+
+  m_pHeader = (LAVD3D11ShareHeader *)MapViewOfFile(m_hMapping, FILE_MAP_ALL_ACCESS, 0, 0, sizeof(LAVD3D11ShareHeader));
+  if (m_pHeader == nullptr)
+    goto fail;
+
+  // continue the generations of a previous decoder, consumers may still hold its textures and names
+  m_dwGeneration = m_pHeader->dwGeneration;
+
+  m_pHeader->dwVersion = LAV_D3D11_SHARE_VERSION;
+  m_pHeader->dwSurfaces = 0;
+  InterlockedExchange64(&m_pHeader->llLatestFrame, 0);
+
+  m_Name = pszName;
+  m_dwSurfaces = dwSurfaces;
+  m_llFrame = 0;
+  m_dwNextSurface = 0;
+
+  DbgLog((LOG_TRACE, 10, L"CD3D11FrameShare::Open(): Sharing frames as '%s' with %u surfaces", pszName, dwSurfaces));
+  return S_OK;
+
+fail:
+  DbgLog((LOG_ERROR, 10, L"CD3D11FrameShare::Open(): Failed to create the share header (error: %u)", GetLastError()));
+  Close();
+  return E_FAIL;
+}
+
+void CD3D11FrameShare::Close()
+{
+  ReleaseTextures();
+
+  if (m_pHeader) {
+    InterlockedExchange64(&m_pHeader->llLatestFrame, 0);
+    UnmapViewOfFile(m_pHeader);
+    m_pHeader = nullptr;
+  }
+  if (m_hMapping) {
+    CloseHandle(m_hMapping);
+    m_hMapping = nullptr;
+  }
+
+  m_Name.clear();
+  m_dwSurfaces = 0;
+}
+
+void CD3D11FrameShare::ReleaseTextures()
+{
+  if (m_pHeader) {
+    InterlockedExchange64(&m_pHeader->llLatestFrame, 0);
+    m_pHeader->dwSurfaces = 0;
+  }
+
+  for (DWORD i = 0; i < LAV_D3D11_SHARE_MAX_SURFACES; i++) {
+    SafeRelease(&m_Surfaces[i].pMutex);
+    SafeRelease(&m_Surfaces[i].pTexture);
+    if (m_Surfaces[i].hShared) {
+      CloseHandle(m_Surfaces[i].hShared);
+      m_Surfaces[i].hShared = nullptr;
+    }
+  }
+
+  SafeRelease(&m_pDevice);
+  memset(&m_Desc, 0, sizeof(m_Desc));
+}
+
+HRESULT CD3D11FrameShare::PrepareTextures(ID3D11Device *pDevice, ID3D11Texture2D *pSourceTexture, const LUID &luid, DWORD dwWidth, DWORD dwHeight)
+{
+  HRESULT hr = S_OK;
+
+  if (m_pHeader == nullptr)
+    return E_UNEXPECTED;
+
+  D3D11_TEXTURE2D_DESC desc = { 0 };
+  pSourceTexture->GetDesc(&desc);
+
+  if (m_pDevice == pDevice && m_Desc.Format == desc.Format && m_Desc.Width == desc.Width && m_Desc.Height == desc.Height) {
+    m_pHeader->dwWidth = dwWidth;
+    m_pHeader->dwHeight = dwHeight;
+    return S_OK;
+  }
+
+  ReleaseTextures();
+
+  // the names of a new generation never collide with textures consumers still hold
+  const DWORD dwGeneration = m_dwGeneration + 1;
+
+  D3D11_TEXTURE2D_DESC texDesc = { 0 };
+  texDesc.Width = desc.Width;
+  texDesc.Height = desc.Height;
+  texDesc.MipLevels = 1;
+  texDesc.ArraySize = 1;
+  texDesc.Format = desc.Format;
+  texDesc.SampleDesc.Count = 1;
+  texDesc.Usage = D3D11_USAGE_DEFAULT;
+  texDesc.BindFlags = D3D11_BIND_SHADER_RESOURCE;
+  texDesc.MiscFlags = D3D11_RESOURCE_MISC_SHARED_NTHANDLE | D3D11_RESOURCE_MISC_SHARED_KEYEDMUTEX;
+
+  for (DWORD i = 0; i < m_dwSurfaces; i++) {
+    Surface *pSurface = &m_Surfaces[i];
+    IDXGIResource1 *pResource = nullptr;
+
+    hr = pDevice->CreateTexture2D(&texDesc, nullptr, &pSurface->pTexture);
+    if (FAILED(hr) && i == 0) {
+      // not every driver can sample from the video formats, consumers can still copy them
+      texDesc.BindFlags = 0;
+      hr = pDevice->CreateTexture2D(&texDesc, nullptr, &pSurface->pTexture);
+    }
+    if (FAILED(hr))
+      goto fail;
+
+    hr = pSurface->pTexture->QueryInterface(&pSurface->pMutex);
+    if (FAILED(hr))
+      goto fail;
+
+    hr = pSurface->pTexture->QueryInterface(&pResource);
+    if (FAILED(hr))
+      goto fail;
+
+    WCHAR wszName[128];
+    swprintf_s(wszName, LAV_D3D11_SHARE_TEXTURE_NAME, m_Name.c_str(), dwGeneration, i);
+    hr = pResource->CreateSharedHandle(nullptr, DXGI_SHARED_RESOURCE_READ | DXGI_SHARED_RESOURCE_WRITE, wszName, &pSurface->hShared);
+    SafeRelease(&pResource);
+    if (FAILED(hr))
+      goto fail;
+  }
+
+  m_pDevice = pDevice;
+  m_pDevice->AddRef();
+  m_Desc = desc;
+  m_dwGeneration = dwGeneration;
+  m_dwNextSurface = 0;
+
+  memset(m_pHeader->surfaces, 0, sizeof(m_pHeader->surfaces));
+  m_pHeader->dwFormat = desc.Format;
+  m_pHeader->dwWidth = dwWidth;
+  m_pHeader->dwHeight = dwHeight;
+  m_pHeader->AdapterLuid = luid;
+  m_pHeader->dwSurfaces = m_dwSurfaces;
+  MemoryBarrier();
+  m_pHeader->dwGeneration = dwGeneration;
+
+  DbgLog((LOG_TRACE, 10, L"CD3D11FrameShare::PrepareTextures(): Created generation %u, %ux%u", dwGeneration, desc.Width, desc.Height));
+  return S_OK;
+
+fail:
+  DbgLog((LOG_ERROR, 10, L"CD3D11FrameShare::PrepareTextures(): Failed to create the shared textures (hr: 0x%x)", hr));
+  ReleaseTextures();
+  return hr;
+}
+
+HRESULT CD3D11FrameShare::ShareFrame(ID3D11DeviceContext *pContext, ID3D11Texture2D *pSourceTexture, UINT nSubresource, REFERENCE_TIME rtStart, REFERENCE_TIME rtStop)
+{
+  if (m_pDevice == nullptr)
+    return E_UNEXPECTED;
+
+  // take the next surface no consumer holds, the decoder never waits for them
+  for (DWORD n = 0; n < m_dwSurfaces; n++) {
+    const DWORD nSurface = (m_dwNextSurface + n) % m_dwSurfaces;
+    Surface *pSurface = &m_Surfaces[nSurface];
+
+    // a consumer which exited holding the mutex leaves it abandoned, which still acquires it
+    HRESULT hr = pSurface->pMutex->AcquireSync(0, 0);
+    if (hr != S_OK && hr != WAIT_ABANDONED)
+      continue;
+
+    pContext->CopySubresourceRegion(pSurface->pTexture, 0, 0, 0, 0, pSourceTexture, nSubresource, nullptr);
+
+    LAVD3D11ShareSurface *pInfo = &m_pHeader->surfaces[nSurface];
+    pInfo->llFrame = ++m_llFrame;
+    pInfo->rtStart = rtStart;
+    pInfo->rtStop = rtStop;
+
+    pSurface->pMutex->ReleaseSync(0);
+
+    m_pHeader->dwLatestSurface = nSurface;
+    InterlockedExchange64(&m_pHeader->llLatestFrame, m_llFrame);
+    m_dwNextSurface = (nSurface + 1) % m_dwSurfaces;
+    return S_OK;
+  }
+
+  return S_FALSE;
+}
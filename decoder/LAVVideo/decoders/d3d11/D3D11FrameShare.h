@@ -0,0 +1,74 @@
+/*
+ *      Copyright (C) 2010-2019 Hendrik Leppkes
+ *      http://www.1f0.de
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program; if not, write to the Free Software Foundation, Inc.,
+ *  51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+
+#pragma once
+
+#include <d3d11_1.h>
+#include <dxgi1_2.h>
+#include <string>
+
+#include "LAVVideoSettings.h"
+
+// Shares the decoded frames with other processes, through a ring of named shared textures
+// Every frame is copied on the GPU into the next surface of the ring, surfaces held by a consumer are skipped.
+// The layout of the share is documented with LAVD3D11ShareHeader.
+class CD3D11FrameShare
+{
+public:
+  CD3D11FrameShare();
+  ~CD3D11FrameShare();
+
+  // Open the header of the share, the textures are only created with the first frame
+  HRESULT Open(LPCWSTR pszName, DWORD dwSurfaces);
+  void Close();
+
+  BOOL IsOpen() const { return m_pHeader != nullptr; }
+
+  // Create the textures to match the decoded surface, if they don't already
+  // Called without the device lock, only the copy needs it.
+  HRESULT PrepareTextures(ID3D11Device *pDevice, ID3D11Texture2D *pSourceTexture, const LUID &luid, DWORD dwWidth, DWORD dwHeight);
+
+  // Queue the copy of the frame into the next surface, with the device lock held
+  HRESULT ShareFrame(ID3D11DeviceContext *pContext, ID3D11Texture2D *pSourceTexture, UINT nSubresource, REFERENCE_TIME rtStart, REFERENCE_TIME rtStop);
+
+  // Release the textures, ie. when the device goes away
+  void ReleaseTextures();
+
+private:
+  struct Surface {
+    ID3D11Texture2D *pTexture;
+    IDXGIKeyedMutex *pMutex;
+    HANDLE           hShared;
+  };
+
+  std::wstring         m_Name;
+  DWORD                m_dwSurfaces = 0;
+
+  HANDLE               m_hMapping   = nullptr;
+  LAVD3D11ShareHeader *m_pHeader    = nullptr;
+
+  ID3D11Device        *m_pDevice    = nullptr;
+  D3D11_TEXTURE2D_DESC m_Desc       = { 0 };
+  Surface              m_Surfaces[LAV_D3D11_SHARE_MAX_SURFACES] = { 0 };
+  DWORD                m_dwGeneration = 0;
+
+  LONGLONG             m_llFrame    = 0;
+  DWORD                m_dwNextSurface = 0;
+};
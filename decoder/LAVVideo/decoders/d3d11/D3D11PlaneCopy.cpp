@@ -0,0 +1,250 @@
+/*
+ *      Copyright (C) 2010-2019 Hendrik Leppkes
+ *      http://www.1f0.de
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program; if not, write to the Free Software Foundation, Inc.,
+ *  51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+
+#include "stdafx.h"
+#include "D3D11PlaneCopy.h"
+
+#include <d3dcompiler.h>
+
+// The vertex shader spans a quad over the whole target, the pixel shader fetches the matching texel of the plane
+static const char s_PlaneCopyShaders[] =
+  "Texture2D plane : register(t0);\n"
+  "float4 vs_main(uint id : SV_VertexID) : SV_Position {\n"
+  "  float2 tex = float2(id & 1, id >> 1);\n"
+  "  return float4(tex.x * 2.0 - 1.0, 1.0 - tex.y * 2.0, 0.0, 1.0);\n"
+  "}\n"
+  "float4 ps_main(float4 pos : SV_Position) : SV_Target {\n"
+  "  return plane.Load(int3(pos.xy, 0));\n"
+  "}\n";
+
+CD3D11PlaneCopy::CD3D11PlaneCopy()
+{
+}
+
+CD3D11PlaneCopy::~CD3D11PlaneCopy()
+{
+  Release();
+}
+
+void CD3D11PlaneCopy::Release()
+{
+  for (int i = 0; i < 2; i++) {
+    SafeRelease(&m_pTargetViews[i]);
+    SafeRelease(&m_pPlaneViews[i]);
+    SafeRelease(&m_pPlaneTextures[i]);
+  }
+  SafeRelease(&m_pRenderTarget);
+  m_nWidth = m_nHeight = 0;
+
+  SafeRelease(&m_pVertexShader);
+  SafeRelease(&m_pPixelShader);
+
+  SafeRelease(&m_pMultithread);
+  SafeRelease(&m_pContext);
+  SafeRelease(&m_pDevice);
+}
+
+static HRESULT compile_shader(pD3DCompile mD3DCompile, const char *entry, const char *target, ID3DBlob **ppCode)
+{
+  ID3DBlob *pErrors = nullptr;
+  HRESULT hr = mD3DCompile(s_PlaneCopyShaders, sizeof(s_PlaneCopyShaders) - 1, "LAVPlaneCopy", nullptr, nullptr, entry, target, D3DCOMPILE_OPTIMIZATION_LEVEL3, 0, ppCode, &pErrors);
+  if (FAILED(hr)) {
+    DbgLog((LOG_ERROR, 10, L"-> Compiling shader %S failed: %S", entry, pErrors ? (const char *)pErrors->GetBufferPointer() : "unknown error"));
+  }
+  SafeRelease(&pErrors);
+  return hr;
+}
+
+HRESULT CD3D11PlaneCopy::InitShaders()
+{
+  HRESULT hr = S_OK;
+  ID3DBlob *pVSCode = nullptr, *pPSCode = nullptr;
+
+  HMODULE d3dcompiler = LoadLibrary(D3DCOMPILER_DLL_W);
+  pD3DCompile mD3DCompile = d3dcompiler ? (pD3DCompile)GetProcAddress(d3dcompiler, "D3DCompile") : nullptr;
+  if (mD3DCompile == nullptr) {
+    DbgLog((LOG_ERROR, 10, L"-> Loading %s failed", D3DCOMPILER_DLL_W));
+    hr = E_FAIL;
+    goto done;
+  }
+
+  if (FAILED(hr = compile_shader(mD3DCompile, "vs_main", "vs_4_0", &pVSCode))
+   || FAILED(hr = compile_shader(mD3DCompile, "ps_main", "ps_4_0", &pPSCode)))
+    goto done;
+
+  hr = m_pDevice->CreateVertexShader(pVSCode->GetBufferPointer(), pVSCode->GetBufferSize(), nullptr, &m_pVertexShader);
+  if (FAILED(hr))
+    goto done;
+
+  hr = m_pDevice->CreatePixelShader(pPSCode->GetBufferPointer(), pPSCode->GetBufferSize(), nullptr, &m_pPixelShader);
+
+done:
+  SafeRelease(&pVSCode);
+  SafeRelease(&pPSCode);
+  if (d3dcompiler)
+    FreeLibrary(d3dcompiler);
+
+  return hr;
+}
+
+HRESULT CD3D11PlaneCopy::Init(ID3D11Device *pDevice, UINT nWidth, UINT nHeight, DXGI_FORMAT format)
+{
+  CheckPointer(pDevice, E_POINTER);
+
+  DXGI_FORMAT planeFormats[2];
+  switch (format) {
+  case DXGI_FORMAT_NV12:
+    planeFormats[0] = DXGI_FORMAT_R8_UNORM;
+    planeFormats[1] = DXGI_FORMAT_R8G8_UNORM;
+    break;
+  case DXGI_FORMAT_P010:
+  case DXGI_FORMAT_P016:
+    planeFormats[0] = DXGI_FORMAT_R16_UNORM;
+    planeFormats[1] = DXGI_FORMAT_R16G16_UNORM;
+    break;
+  default:
+    DbgLog((LOG_TRACE, 10, L"-> Unsupported texture format %d for the plane copy", format));
+    return E_NOTIMPL;
+  }
+
+  if (m_pDevice == pDevice && m_pRenderTarget && m_nWidth == nWidth && m_nHeight == nHeight) {
+    D3D11_TEXTURE2D_DESC desc;
+    m_pRenderTarget->GetDesc(&desc);
+    if (desc.Format == format)
+      return S_OK;
+  }
+
+  DbgLog((LOG_TRACE, 10, L"CD3D11PlaneCopy::Init(): Creating plane textures for %ux%u, format %d", nWidth, nHeight, format));
+
+  Release();
+
+  m_pDevice = pDevice;
+  m_pDevice->AddRef();
+  m_pDevice->GetImmediateContext(&m_pContext);
+
+  // the immediate context is shared with the renderer, and needs to be protected while drawing
+  HRESULT hr = m_pDevice->QueryInterface(&m_pMultithread);
+  if (FAILED(hr))
+    goto fail;
+
+  UINT nSupport = 0;
+  if (FAILED(m_pDevice->CheckFormatSupport(format, &nSupport)) || !(nSupport & D3D11_FORMAT_SUPPORT_RENDER_TARGET)) {
+    DbgLog((LOG_TRACE, 10, L"-> Texture format %d can't be rendered to", format));
+    hr = E_NOTIMPL;
+    goto fail;
+  }
+
+  hr = InitShaders();
+  if (FAILED(hr))
+    goto fail;
+
+  {
+    D3D11_TEXTURE2D_DESC texDesc = { 0 };
+    texDesc.Width = nWidth;
+    texDesc.Height = nHeight;
+    texDesc.MipLevels = 1;
+    texDesc.ArraySize = 1;
+    texDesc.Format = format;
+    texDesc.SampleDesc.Count = 1;
+    texDesc.Usage = D3D11_USAGE_DEFAULT;
+    texDesc.BindFlags = D3D11_BIND_RENDER_TARGET;
+
+    hr = m_pDevice->CreateTexture2D(&texDesc, nullptr, &m_pRenderTarget);
+    if (FAILED(hr))
+      goto fail;
+  }
+
+  for (int i = 0; i < 2; i++) {
+    // the chroma plane is sub-sampled in both directions
+    D3D11_TEXTURE2D_DESC texDesc = { 0 };
+    texDesc.Width = i ? (nWidth + 1) / 2 : nWidth;
+    texDesc.Height = i ? (nHeight + 1) / 2 : nHeight;
+    texDesc.MipLevels = 1;
+    texDesc.ArraySize = 1;
+    texDesc.Format = planeFormats[i];
+    texDesc.SampleDesc.Count = 1;
+    texDesc.Usage = D3D11_USAGE_DEFAULT;
+    texDesc.BindFlags = D3D11_BIND_SHADER_RESOURCE;
+
+    hr = m_pDevice->CreateTexture2D(&texDesc, nullptr, &m_pPlaneTextures[i]);
+    if (FAILED(hr))
+      goto fail;
+
+    hr = m_pDevice->CreateShaderResourceView(m_pPlaneTextures[i], nullptr, &m_pPlaneViews[i]);
+    if (FAILED(hr))
+      goto fail;
+
+    D3D11_RENDER_TARGET_VIEW_DESC viewDesc = { };
+    viewDesc.ViewDimension = D3D11_RTV_DIMENSION_TEXTURE2D;
+    viewDesc.Format = planeFormats[i];
+
+    hr = m_pDevice->CreateRenderTargetView(m_pRenderTarget, &viewDesc, &m_pTargetViews[i]);
+    if (FAILED(hr))
+      goto fail;
+  }
+
+  m_nWidth = nWidth;
+  m_nHeight = nHeight;
+  return S_OK;
+
+fail:
+  DbgLog((LOG_ERROR, 10, L"-> Creating the plane textures failed (hr: 0x%x)", hr));
+  Release();
+  return hr;
+}
+
+HRESULT CD3D11PlaneCopy::Copy(ID3D11Texture2D *pTarget, UINT nTargetSlice)
+{
+  CheckPointer(pTarget, E_POINTER);
+
+  if (m_pRenderTarget == nullptr)
+    return E_UNEXPECTED;
+
+  m_pMultithread->Enter();
+
+  m_pContext->IASetPrimitiveTopology(D3D11_PRIMITIVE_TOPOLOGY_TRIANGLESTRIP);
+  m_pContext->IASetInputLayout(nullptr);
+  m_pContext->VSSetShader(m_pVertexShader, nullptr, 0);
+  m_pContext->PSSetShader(m_pPixelShader, nullptr, 0);
+  m_pContext->OMSetBlendState(nullptr, nullptr, 0xffffffff);
+
+  for (int plane = 0; plane < 2; plane++) {
+    D3D11_VIEWPORT viewport = { 0 };
+    viewport.Width = (float)(plane ? (m_nWidth + 1) / 2 : m_nWidth);
+    viewport.Height = (float)(plane ? (m_nHeight + 1) / 2 : m_nHeight);
+    viewport.MaxDepth = 1.0f;
+
+    m_pContext->OMSetRenderTargets(1, &m_pTargetViews[plane], nullptr);
+    m_pContext->RSSetViewports(1, &viewport);
+    m_pContext->PSSetShaderResources(0, 1, &m_pPlaneViews[plane]);
+    m_pContext->Draw(4, 0);
+  }
+
+  // unbind everything, so the textures can be used elsewhere
+  ID3D11ShaderResourceView *pNullView = nullptr;
+  m_pContext->PSSetShaderResources(0, 1, &pNullView);
+  m_pContext->OMSetRenderTargets(0, nullptr, nullptr);
+
+  m_pContext->CopySubresourceRegion(pTarget, D3D11CalcSubresource(0, nTargetSlice, 1), 0, 0, 0, m_pRenderTarget, 0, nullptr);
+
+  m_pMultithread->Leave();
+
+  return S_OK;
+}
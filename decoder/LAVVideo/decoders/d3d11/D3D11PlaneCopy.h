@@ -0,0 +1,67 @@
+/*
+ *      Copyright (C) 2010-2019 Hendrik Leppkes
+ *      http://www.1f0.de
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program; if not, write to the Free Software Foundation, Inc.,
+ *  51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+
+#pragma once
+
+#include <d3d10.h>
+#include <d3d11.h>
+
+// Assembles NV12 and P010 textures from separate luma and chroma plane textures on the GPU
+// Bi-planar textures can't be shared with compute APIs, so those fill the single-plane textures,
+// which are drawn into an intermediate render target and copied into the target slice.
+class CD3D11PlaneCopy
+{
+public:
+  CD3D11PlaneCopy();
+  ~CD3D11PlaneCopy();
+
+  // Create the plane textures for a target of the given size and format (NV12 or P010)
+  HRESULT Init(ID3D11Device *pDevice, UINT nWidth, UINT nHeight, DXGI_FORMAT format);
+
+  // Luma (0) or interleaved chroma (1) plane, the reference is owned by the object
+  ID3D11Texture2D *GetPlaneTexture(int nPlane) const { return m_pPlaneTextures[nPlane]; }
+
+  // Draw the planes into the target slice, the target has to be of the format and size given to Init
+  HRESULT Copy(ID3D11Texture2D *pTarget, UINT nTargetSlice);
+
+  // Free all resources
+  void Release();
+
+private:
+  HRESULT InitShaders();
+
+private:
+  ID3D11Device        *m_pDevice      = nullptr;
+  ID3D11DeviceContext *m_pContext     = nullptr;
+  ID3D10Multithread   *m_pMultithread = nullptr;
+
+  ID3D11VertexShader  *m_pVertexShader = nullptr;
+  ID3D11PixelShader   *m_pPixelShader  = nullptr;
+
+  ID3D11Texture2D          *m_pPlaneTextures[2] = { nullptr, nullptr };
+  ID3D11ShaderResourceView *m_pPlaneViews[2]    = { nullptr, nullptr };
+
+  // Intermediate target, with a render target on each plane
+  ID3D11Texture2D        *m_pRenderTarget = nullptr;
+  ID3D11RenderTargetView *m_pTargetViews[2] = { nullptr, nullptr };
+
+  UINT m_nWidth  = 0;
+  UINT m_nHeight = 0;
+};
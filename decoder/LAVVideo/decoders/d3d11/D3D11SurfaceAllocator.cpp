@@ -19,7 +19,6 @@
 
 #include "stdafx.h"
 #include "D3D11SurfaceAllocator.h"
-#include "decoders/d3d11va.h"
 
 extern "C" {
 #include "libavutil/hwcontext.h"
@@ -77,7 +76,7 @@ STDMETHODIMP CD3D11MediaSample::GetD3D11Texture(int nView, ID3D11Texture2D **ppT
   if (m_pFrame)
   {
     *ppTexture   = (ID3D11Texture2D *)m_pFrame->data[0];
-    *pArraySlice = (UINT)(intptr_t)m_pFrame->data[1];
+    *pArraySlice = m_bStandalone ? 0 : (UINT)(intptr_t)m_pFrame->data[1];
 
     (*ppTexture)->AddRef();
 
@@ -87,6 +86,12 @@ STDMETHODIMP CD3D11MediaSample::GetD3D11Texture(int nView, ID3D11Texture2D **ppT
   return E_FAIL;
 }
 
+static void bufref_release_texture(void *opaque, uint8_t *data)
+{
+  ID3D11Texture2D *pTexture = (ID3D11Texture2D *)opaque;
+  pTexture->Release();
+}
+
 static void bufref_release_sample(void *opaque, uint8_t *data)
 {
   CD3D11MediaSample *pSample = (CD3D11MediaSample *)opaque;
@@ -132,7 +137,7 @@ STDMETHODIMP CD3D11MediaSample::GetAVFrameBuffer(AVFrame *pFrame)
   return S_OK;
 }
 
-CD3D11SurfaceAllocator::CD3D11SurfaceAllocator(CDecD3D11 *pDec, HRESULT *phr)
+CD3D11SurfaceAllocator::CD3D11SurfaceAllocator(ID3D11FramesContextProvider *pDec, HRESULT *phr)
   : CBaseAllocator(NAME("CD3D11SurfaceAllocator"), nullptr, phr)
   , m_pDec(pDec)
 {
@@ -161,7 +166,7 @@ HRESULT CD3D11SurfaceAllocator::Alloc(void)
   Free();
 
   // get the frames context from the decoder
-  AVBufferRef *pDecoderFramesCtx = m_pDec->m_pFramesCtx;
+  AVBufferRef *pDecoderFramesCtx = m_pDec->GetD3D11FramesContext();
   if (pDecoderFramesCtx == nullptr)
     return S_FALSE;
 
@@ -169,11 +174,18 @@ HRESULT CD3D11SurfaceAllocator::Alloc(void)
   if (m_pFramesCtx == nullptr)
     return E_FAIL;
 
+  // the decoder created individual textures, instead of slices of the array texture of the frames context
+  const BOOL bStandalone = (m_pDec->GetD3D11StandaloneTexture(0) != nullptr);
+
   // create samples
   for (int i = 0; i < m_lCount; i++)
   {
     AVFrame *pFrame = av_frame_alloc();
-    int ret = av_hwframe_get_buffer(m_pFramesCtx, pFrame, 0);
+    int ret = 0;
+    if (bStandalone)
+      ret = WrapStandaloneTexture(m_pDec->GetD3D11StandaloneTexture(i), i, pFrame);
+    else
+      ret = av_hwframe_get_buffer(m_pFramesCtx, pFrame, 0);
     if (ret < 0)
     {
       av_frame_free(&pFrame);
@@ -188,6 +200,7 @@ HRESULT CD3D11SurfaceAllocator::Alloc(void)
       Free();
       return E_FAIL;
     }
+    pSample->m_bStandalone = bStandalone;
 
     m_lFree.Add(pSample);
   }
@@ -198,6 +211,31 @@ HRESULT CD3D11SurfaceAllocator::Alloc(void)
   return S_OK;
 }
 
+// Fill a frame like the frames context would, data[1] is the index of the output view of the decoder
+int CD3D11SurfaceAllocator::WrapStandaloneTexture(ID3D11Texture2D *pTexture, int nIndex, AVFrame *pFrame)
+{
+  if (pTexture == nullptr || pFrame == nullptr)
+    return AVERROR(EINVAL);
+
+  pFrame->buf[0] = av_buffer_create((uint8_t *)pTexture, 1, bufref_release_texture, pTexture, 0);
+  if (pFrame->buf[0] == nullptr)
+    return AVERROR(ENOMEM);
+  pTexture->AddRef();
+
+  pFrame->hw_frames_ctx = av_buffer_ref(m_pFramesCtx);
+  if (pFrame->hw_frames_ctx == nullptr)
+    return AVERROR(ENOMEM);
+
+  AVHWFramesContext *pFramesCtx = (AVHWFramesContext *)m_pFramesCtx->data;
+  pFrame->data[0] = (uint8_t *)pTexture;
+  pFrame->data[1] = (uint8_t *)(intptr_t)nIndex;
+  pFrame->format  = AV_PIX_FMT_D3D11;
+  pFrame->width   = pFramesCtx->width;
+  pFrame->height  = pFramesCtx->height;
+
+  return 0;
+}
+
 void CD3D11SurfaceAllocator::Free(void)
 {
   CAutoLock lock(this);
@@ -24,7 +24,14 @@
 #include "MediaSampleSideData.h"
 #include "ID3DVideoMemoryConfiguration.h"
 
-class CDecD3D11;
+// Decoders handing out the samples of the allocator provide the frames context the surfaces are allocated from
+class ID3D11FramesContextProvider
+{
+public:
+  virtual AVBufferRef *GetD3D11FramesContext() = 0;
+  // Individual texture of the surface with the index, nullptr if the surfaces are slices of the array texture of the frames context
+  virtual ID3D11Texture2D *GetD3D11StandaloneTexture(int nIndex) = 0;
+};
 
 class CD3D11MediaSample : public CMediaSampleSideData, public IMediaSampleD3D11
 {
@@ -50,13 +57,14 @@ public:
 
 private:
   AVFrame *m_pFrame = nullptr;
+  BOOL m_bStandalone = FALSE;   // data[1] is the surface index, the texture has no array slices
 };
 
 
 class CD3D11SurfaceAllocator : public CBaseAllocator
 {
 public:
-  CD3D11SurfaceAllocator(CDecD3D11 *pDec, HRESULT* phr);
+  CD3D11SurfaceAllocator(ID3D11FramesContextProvider *pDec, HRESULT* phr);
   virtual ~CD3D11SurfaceAllocator();
 
   STDMETHODIMP_(BOOL) DecommitInProgress() { CAutoLock cal(this); return m_bDecommitInProgress; }
@@ -70,6 +78,9 @@ protected:
   virtual HRESULT Alloc(void);
 
 private:
-  CDecD3D11 *m_pDec = nullptr;
+  int WrapStandaloneTexture(ID3D11Texture2D *pTexture, int nIndex, AVFrame *pFrame);
+
+private:
+  ID3D11FramesContextProvider *m_pDec = nullptr;
   AVBufferRef *m_pFramesCtx = nullptr;
 };
@@ -17,6 +17,15 @@
 // renderer should disconnect the decoder and re-connect it. At that
 // point the decoder should query GetD3D11AdapterIndex() again and
 // create a new decoder on the new device, as appropriate.
+//
+// Flags for ActivateD3D11Decoding:
+// D3D11_DECODER_FLAG_STANDALONE_TEXTURES
+//   The decoder sends individual textures (ArraySize 1) with D3D11_BIND_SHADER_RESOURCE, instead
+//   of slices of one array texture. The array slice of the samples is always 0, so the textures can
+//   be bound directly. Renderers which cannot handle these textures should return an error, the
+//   decoder will then activate again without the flag.
+#define D3D11_DECODER_FLAG_STANDALONE_TEXTURES 0x00000001
+
 interface __declspec(uuid("2BB66002-46B7-4F13-9036-7053328742BE")) ID3D11DecoderConfiguration : public IUnknown
 {
   // Set the surface format the decoder is going to send.
@@ -33,6 +42,8 @@ interface __declspec(uuid("2BB66002-46B7-4F13-9036-7053328742BE")) ID3D11Decoder
 // D3D11 textures used for decoding are typically array-textures,
 // a single ID3D11Texture2D object containing an array of textures
 // individually addressable by the ArraySlice index.
+// With D3D11_DECODER_FLAG_STANDALONE_TEXTURES every sample has its
+// own texture, and the ArraySlice index is 0.
 //
 // The texture lifetime is bound to the media samples lifetime. The
 // media sample can only be released when the texture is no longer in
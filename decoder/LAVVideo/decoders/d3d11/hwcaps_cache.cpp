@@ -0,0 +1,217 @@
+/*
+ *      Copyright (C) 2010-2019 Hendrik Leppkes
+ *      http://www.1f0.de
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program; if not, write to the Free Software Foundation, Inc.,
+ *  51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+
+#include "stdafx.h"
+#include "hwcaps_cache.h"
+#include "dxva2/dxva_common.h"
+#include "registry.h"
+
+#include <map>
+#include <string>
+#include <vector>
+
+// Kept outside of the settings key, so storing the capabilities doesn't invalidate the cached settings
+// The version is part of the value name, so an incompatible layout is never read back
+#define HWCAPS_REGISTRY_KEY L"Software\\LAV\\HWCaps"
+#define HWCAPS_REGISTRY_VALUE L"D3D11Profiles_1"
+
+static CCritSec s_HWCapsLock;
+static std::map<std::wstring, std::vector<HWCapsProfile>> s_HWCaps;
+
+// Sizes tested to find the resolution limit of a profile, the largest one means no limit
+static const SIZE s_ProbeSizes[] = {
+  { 1920, 1088 },
+  { 4096, 2304 },
+  { 8192, 4352 },
+};
+
+static const struct {
+  DXGI_FORMAT format;
+  DWORD       dwFlag;
+} s_ProbeFormats[] = {
+  { DXGI_FORMAT_NV12, HWCAPS_FORMAT_NV12 },
+  { DXGI_FORMAT_P010, HWCAPS_FORMAT_P010 },
+  { DXGI_FORMAT_P016, HWCAPS_FORMAT_P016 },
+};
+
+DWORD hwcaps_format(DXGI_FORMAT format)
+{
+  for (int i = 0; i < countof(s_ProbeFormats); i++) {
+    if (s_ProbeFormats[i].format == format)
+      return s_ProbeFormats[i].dwFlag;
+  }
+  return 0;
+}
+
+static std::wstring hwcaps_adapter_key(IDXGIAdapter *pAdapter)
+{
+  DXGI_ADAPTER_DESC desc;
+  if (FAILED(pAdapter->GetDesc(&desc)))
+    return std::wstring();
+
+  // the user mode driver version is only reported for the D3D10 device interface
+  LARGE_INTEGER umdVersion = { 0 };
+  if (FAILED(pAdapter->CheckInterfaceSupport(__uuidof(IDXGIDevice), &umdVersion)))
+    return std::wstring();
+
+  WCHAR key[64];
+  swprintf_s(key, L"%04X_%04X_%08X_%016llX", desc.VendorId, desc.DeviceId, desc.SubSysId, umdVersion.QuadPart);
+  return std::wstring(key);
+}
+
+// Find the capabilities of an adapter in memory or in the registry, with the lock held
+static const std::vector<HWCapsProfile> *hwcaps_find(const std::wstring &key)
+{
+  auto it = s_HWCaps.find(key);
+  if (it != s_HWCaps.end())
+    return &it->second;
+
+  HRESULT hr = S_OK;
+  CRegistry reg = CRegistry(HKEY_CURRENT_USER, (std::wstring(HWCAPS_REGISTRY_KEY L"\\") + key).c_str(), hr, TRUE);
+  if (FAILED(hr))
+    return nullptr;
+
+  DWORD dwSize = 0;
+  BYTE *pData = reg.ReadBinary(HWCAPS_REGISTRY_VALUE, dwSize, hr);
+  if (FAILED(hr))
+    return nullptr;
+
+  std::vector<HWCapsProfile> profiles;
+  if (dwSize % sizeof(HWCapsProfile) == 0) {
+    const HWCapsProfile *pProfiles = (const HWCapsProfile *)pData;
+    profiles.assign(pProfiles, pProfiles + dwSize / sizeof(HWCapsProfile));
+  }
+  CoTaskMemFree(pData);
+
+  if (profiles.empty())
+    return nullptr;
+
+  return &(s_HWCaps[key] = profiles);
+}
+
+HRESULT hwcaps_check(IDXGIAdapter *pAdapter, int codec, int profile, DWORD dwFormat, int width, int height)
+{
+  const std::wstring key = hwcaps_adapter_key(pAdapter);
+  if (key.empty())
+    return S_FALSE;
+
+  CAutoLock lock(&s_HWCapsLock);
+  const std::vector<HWCapsProfile> *pProfiles = hwcaps_find(key);
+  if (pProfiles == nullptr)
+    return S_FALSE;
+
+  for (unsigned i = 0; dxva_modes[i].name; i++) {
+    const dxva_mode_t *mode = &dxva_modes[i];
+    if (!check_dxva_mode_compatibility(mode, codec, profile))
+      continue;
+
+    for (const HWCapsProfile &p : *pProfiles) {
+      if (!IsEqualGUID(p.guid, *mode->guid) || !(p.dwFormats & dwFormat))
+        continue;
+      if (p.dwMaxWidth == 0 || ((DWORD)width <= p.dwMaxWidth && (DWORD)height <= p.dwMaxHeight))
+        return S_OK;
+    }
+  }
+
+  return E_FAIL;
+}
+
+static void hwcaps_probe_profile(ID3D11VideoDevice *pVideoDevice, HWCapsProfile *pProfile)
+{
+  DXGI_FORMAT format = DXGI_FORMAT_UNKNOWN;
+  for (int i = 0; i < countof(s_ProbeFormats); i++) {
+    BOOL bSupported = FALSE;
+    if (SUCCEEDED(pVideoDevice->CheckVideoDecoderFormat(&pProfile->guid, s_ProbeFormats[i].format, &bSupported)) && bSupported) {
+      pProfile->dwFormats |= s_ProbeFormats[i].dwFlag;
+      if (format == DXGI_FORMAT_UNKNOWN)
+        format = s_ProbeFormats[i].format;
+    }
+  }
+
+  if (format == DXGI_FORMAT_UNKNOWN)
+    return;
+
+  for (int i = 0; i < countof(s_ProbeSizes); i++) {
+    D3D11_VIDEO_DECODER_DESC desc = { 0 };
+    desc.Guid = pProfile->guid;
+    desc.OutputFormat = format;
+    desc.SampleWidth = s_ProbeSizes[i].cx;
+    desc.SampleHeight = s_ProbeSizes[i].cy;
+
+    UINT nConfig = 0;
+    if (FAILED(pVideoDevice->GetVideoDecoderConfigCount(&desc, &nConfig)) || nConfig == 0)
+      break;
+
+    pProfile->dwMaxWidth = s_ProbeSizes[i].cx;
+    pProfile->dwMaxHeight = s_ProbeSizes[i].cy;
+  }
+
+  // supporting the largest size, or no size at all (which some drivers report), is not a useful limit
+  if (pProfile->dwMaxWidth == 0 || pProfile->dwMaxWidth == s_ProbeSizes[countof(s_ProbeSizes) - 1].cx) {
+    pProfile->dwMaxWidth = 0;
+    pProfile->dwMaxHeight = 0;
+  }
+}
+
+void hwcaps_update(ID3D11Device *pDevice, ID3D11VideoDevice *pVideoDevice)
+{
+  IDXGIDevice *pDXGIDevice = nullptr;
+  IDXGIAdapter *pDXGIAdapter = nullptr;
+  std::wstring key;
+
+  if (SUCCEEDED(pDevice->QueryInterface(&pDXGIDevice)) && SUCCEEDED(pDXGIDevice->GetAdapter(&pDXGIAdapter)))
+    key = hwcaps_adapter_key(pDXGIAdapter);
+
+  SafeRelease(&pDXGIAdapter);
+  SafeRelease(&pDXGIDevice);
+
+  if (key.empty())
+    return;
+
+  CAutoLock lock(&s_HWCapsLock);
+  if (hwcaps_find(key))
+    return;
+
+  std::vector<HWCapsProfile> profiles;
+  const UINT nProfiles = pVideoDevice->GetVideoDecoderProfileCount();
+  for (UINT i = 0; i < nProfiles; i++) {
+    HWCapsProfile profile = { 0 };
+    if (FAILED(pVideoDevice->GetVideoDecoderProfile(i, &profile.guid)))
+      continue;
+
+    hwcaps_probe_profile(pVideoDevice, &profile);
+    profiles.push_back(profile);
+  }
+
+  if (profiles.empty())
+    return;
+
+  DbgLog((LOG_TRACE, 10, L"hwcaps: Probed %u decoder profiles of adapter %s", (UINT)profiles.size(), key.c_str()));
+
+  const std::wstring subKey = std::wstring(HWCAPS_REGISTRY_KEY L"\\") + key;
+  CreateRegistryKey(HKEY_CURRENT_USER, subKey.c_str());
+
+  HRESULT hr = S_OK;
+  CRegistry reg = CRegistry(HKEY_CURRENT_USER, subKey.c_str(), hr);
+  if (SUCCEEDED(hr))
+    reg.WriteBinary(HWCAPS_REGISTRY_VALUE, (const BYTE *)profiles.data(), (int)(profiles.size() * sizeof(HWCapsProfile)));
+
+  s_HWCaps[key] = profiles;
+}
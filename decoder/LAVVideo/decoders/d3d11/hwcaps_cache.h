@@ -0,0 +1,50 @@
+/*
+ *      Copyright (C) 2010-2019 Hendrik Leppkes
+ *      http://www.1f0.de
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program; if not, write to the Free Software Foundation, Inc.,
+ *  51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+
+#pragma once
+
+#include <d3d11.h>
+
+// Persistent cache of the video decoding capabilities of the D3D11 adapters
+//
+// Finding out if an adapter can decode a stream requires a device, so the capabilities are probed once
+// and stored in the registry, keyed by the PCI IDs and the driver version of the adapter.
+// Installing another driver changes the key, and the adapter is probed again by the next decoder.
+
+#define HWCAPS_FORMAT_NV12 0x1
+#define HWCAPS_FORMAT_P010 0x2
+#define HWCAPS_FORMAT_P016 0x4
+
+typedef struct {
+  GUID  guid;                     ///< Decoder profile
+  DWORD dwFormats;                ///< Supported output formats, HWCAPS_FORMAT_*
+  DWORD dwMaxWidth;               ///< Largest size a configuration was offered for, 0 if not limited
+  DWORD dwMaxHeight;
+} HWCapsProfile;
+
+// Map a surface format to its HWCAPS_FORMAT_* flag
+DWORD hwcaps_format(DXGI_FORMAT format);
+
+// Check if the adapter can decode the stream, using the cached capabilities
+// Returns S_OK if it can, E_FAIL if it can't, or S_FALSE if the adapter was not probed yet
+HRESULT hwcaps_check(IDXGIAdapter *pAdapter, int codec, int profile, DWORD dwFormat, int width, int height);
+
+// Probe the capabilities of the adapter of the device and store them, unless they are cached already
+void hwcaps_update(ID3D11Device *pDevice, ID3D11VideoDevice *pVideoDevice);
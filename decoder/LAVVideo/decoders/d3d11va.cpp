@@ -21,6 +21,10 @@
 #include "d3d11va.h"
 #include "d3d11/ID3DVideoMemoryConfiguration.h"
 #include "dxva2/dxva_common.h"
+#include "dxva2/gpu_copy.h"
+#include "dxva2/device_cache.h"
+#include "d3d11/hwcaps_cache.h"
+#include "timer.h"
 
 ILAVDecoder *CreateDecoderD3D11()
 {
@@ -112,6 +116,35 @@ static DXGI_FORMAT d3d11va_map_sw_to_hw_format(enum AVPixelFormat pix_fmt)
   }
 }
 
+static void d3d11_device_free(AVHWDeviceContext *ctx)
+{
+  // the device context is released before, now its DLL can go
+  if (ctx->user_opaque)
+    FreeLibrary((HMODULE)ctx->user_opaque);
+}
+
+static int d3d11_device_lost(AVBufferRef *device)
+{
+  AVD3D11VADeviceContext *pDeviceContext = (AVD3D11VADeviceContext *)((AVHWDeviceContext *)device->data)->hwctx;
+  return pDeviceContext->device->GetDeviceRemovedReason() != S_OK;
+}
+
+static HRESULT d3d11_get_adapter_desc(ID3D11Device *pDevice, DXGI_ADAPTER_DESC *pDesc)
+{
+  IDXGIDevice *pDXGIDevice = nullptr;
+  IDXGIAdapter *pDXGIAdapter = nullptr;
+
+  HRESULT hr = pDevice->QueryInterface(&pDXGIDevice);
+  if (SUCCEEDED(hr))
+    hr = pDXGIDevice->GetAdapter(&pDXGIAdapter);
+  if (SUCCEEDED(hr))
+    hr = pDXGIAdapter->GetDesc(pDesc);
+
+  SafeRelease(&pDXGIAdapter);
+  SafeRelease(&pDXGIDevice);
+  return hr;
+}
+
 CDecD3D11::CDecD3D11(void)
   : CDecAvcodec()
 {
@@ -143,15 +176,22 @@ STDMETHODIMP CDecD3D11::DestroyDecoder(bool bFull)
     av_freep(&m_pOutputViews);
     m_nOutputViews = 0;
   }
+  ReleaseStandaloneTextures();
 
   SafeRelease(&m_pDecoder);
-  SafeRelease(&m_pD3D11StagingTexture);
+  m_SurfacePool.OnDestroy();
+  ReleaseStagingTextures();
+  ReleaseD3D11Deinterlacer();
+  ReleaseD3D11Converter();
+  m_bConvFailed = FALSE;
   av_buffer_unref(&m_pFramesCtx);
 
   CDecAvcodec::DestroyDecoder();
 
   if (bFull) {
-    av_buffer_unref(&m_pDevCtx);
+    m_FrameShare.Close();
+    device_cache_release(&m_pDevCtx);
+    m_AdapterRegistry.ReleaseAdapter();
 
     if (dx.d3d11lib)
     {
@@ -322,6 +362,7 @@ STDMETHODIMP CDecD3D11::PostConnect(IPin *pPin)
 {
   DbgLog((LOG_TRACE, 10, L"CDecD3D11::PostConnect()"));
   HRESULT hr = S_OK;
+  BOOL bStandaloneTextures = FALSE;
 
   ID3D11DecoderConfiguration *pD3D11DecoderConfiguration = nullptr;
   hr = pPin->QueryInterface(&pD3D11DecoderConfiguration);
@@ -335,8 +376,10 @@ STDMETHODIMP CDecD3D11::PostConnect(IPin *pPin)
   // free the decoder to force a re-init down the line
   SafeRelease(&m_pDecoder);
 
-  // and the old device
-  av_buffer_unref(&m_pDevCtx);
+  // and the old device, with the shared textures on it
+  m_FrameShare.ReleaseTextures();
+  device_cache_release(&m_pDevCtx);
+  m_AdapterRegistry.ReleaseAdapter();
 
   // device id
   UINT nDevice = m_pSettings->GetHWAccelDeviceIndex(HWAccel_D3D11, nullptr);
@@ -351,32 +394,60 @@ STDMETHODIMP CDecD3D11::PostConnect(IPin *pPin)
     // if a device is specified manually, fallback to copy-back and use the selected device
     SafeRelease(&pD3D11DecoderConfiguration);
 
-    // use the configured device
+    // use the configured device, or the least busy one if the decoders are spread over all devices
     if (nDevice == LAVHWACCEL_DEVICE_DEFAULT)
-      nDevice = 0;
+    {
+      if (!m_pSettings->GetHWAccelDeviceLoadBalancing() || FAILED(m_AdapterRegistry.AcquireAdapter(&nDevice, nullptr)))
+        nDevice = 0;
+    }
   }
 
-  // create the device
-  ID3D11Device *pD3D11Device = nullptr;
-  hr = CreateD3D11Device(nDevice, &pD3D11Device, &m_AdapterDesc);
-  if (FAILED(hr))
+  // re-use the device of an earlier decoder on this adapter
+  m_pDevCtx = device_cache_get(DEVICE_CACHE_D3D11, nDevice);
+  if (m_pDevCtx)
   {
-    goto fail;
+    AVD3D11VADeviceContext *pCachedContext = (AVD3D11VADeviceContext *)((AVHWDeviceContext *)m_pDevCtx->data)->hwctx;
+    ZeroMemory(&m_AdapterDesc, sizeof(m_AdapterDesc));
+    d3d11_get_adapter_desc(pCachedContext->device, &m_AdapterDesc);
+    DbgLog((LOG_TRACE, 10, L"-> Using cached D3D11 device of adapter %d", nDevice));
   }
+  else
+  {
+    // create the device
+    ID3D11Device *pD3D11Device = nullptr;
+    hr = CreateD3D11Device(nDevice, &pD3D11Device, &m_AdapterDesc);
+    if (FAILED(hr))
+    {
+      goto fail;
+    }
 
-  // allocate and fill device context
-  m_pDevCtx = av_hwdevice_ctx_alloc(AV_HWDEVICE_TYPE_D3D11VA);
-  AVD3D11VADeviceContext *pDeviceContext = (AVD3D11VADeviceContext *)((AVHWDeviceContext *)m_pDevCtx->data)->hwctx;
-  pDeviceContext->device = pD3D11Device;
+    // allocate and fill device context, it keeps its own reference to the D3D11 DLL so it can outlive the decoder in the cache
+    m_pDevCtx = av_hwdevice_ctx_alloc(AV_HWDEVICE_TYPE_D3D11VA);
+    AVHWDeviceContext *pHWDeviceContext = (AVHWDeviceContext *)m_pDevCtx->data;
+    ((AVD3D11VADeviceContext *)pHWDeviceContext->hwctx)->device = pD3D11Device;
+    pHWDeviceContext->user_opaque = LoadLibrary(L"d3d11.dll");
+    pHWDeviceContext->free = d3d11_device_free;
 
-  // finalize the context
-  int ret = av_hwdevice_ctx_init(m_pDevCtx);
-  if (ret < 0)
-  {
-    av_buffer_unref(&m_pDevCtx);
-    goto fail;
+    // finalize the context
+    int ret = av_hwdevice_ctx_init(m_pDevCtx);
+    if (ret < 0)
+    {
+      av_buffer_unref(&m_pDevCtx);
+      goto fail;
+    }
+
+    device_cache_put(DEVICE_CACHE_D3D11, nDevice, m_pDevCtx, d3d11_device_lost);
   }
 
+  // the device creation falls back to the default device on failure
+  if (m_AdapterRegistry.IsAcquired())
+    m_AdapterRegistry.UpdateAdapter(m_AdapterDesc.AdapterLuid);
+
+  AVD3D11VADeviceContext *pDeviceContext = (AVD3D11VADeviceContext *)((AVHWDeviceContext *)m_pDevCtx->data)->hwctx;
+
+  // store the capabilities of a new adapter or driver, so later decoders can check them without a device
+  hwcaps_update(pDeviceContext->device, pDeviceContext->video_device);
+
   // check if the connection supports native mode
   if (pD3D11DecoderConfiguration)
   {
@@ -426,31 +497,67 @@ STDMETHODIMP CDecD3D11::PostConnect(IPin *pPin)
     texDesc.MiscFlags = D3D11_RESOURCE_MISC_SHARED;
 
     ID3D11Texture2D *pTexture2D = nullptr;
-    hr = pD3D11Device->CreateTexture2D(&texDesc, nullptr, &pTexture2D);
+    hr = pDeviceContext->device->CreateTexture2D(&texDesc, nullptr, &pTexture2D);
     if (FAILED(hr))
     {
       goto fail;
     }
     SafeRelease(&pTexture2D);
+
+    // check if the driver can decode into individual textures, which the renderer can bind without copying a slice out of an array
+    if (pD3D11DecoderConfiguration)
+    {
+      texDesc.ArraySize = 1;
+      hr = pDeviceContext->device->CreateTexture2D(&texDesc, nullptr, &pTexture2D);
+      if (SUCCEEDED(hr))
+      {
+        D3D11_VIDEO_DECODER_OUTPUT_VIEW_DESC viewDesc = { 0 };
+        viewDesc.DecodeProfile = guidConversion;
+        viewDesc.ViewDimension = D3D11_VDOV_DIMENSION_TEXTURE2D;
+
+        ID3D11VideoDecoderOutputView *pOutputView = nullptr;
+        hr = pDeviceContext->video_device->CreateVideoDecoderOutputView(pTexture2D, &viewDesc, &pOutputView);
+        bStandaloneTextures = SUCCEEDED(hr);
+
+        SafeRelease(&pOutputView);
+        SafeRelease(&pTexture2D);
+      }
+      DbgLog((LOG_TRACE, 10, L"-> Decoding into standalone textures is %s", bStandaloneTextures ? L"supported" : L"not supported"));
+    }
   }
 
   // Notice the connected pin that we're sending D3D11 textures
+  m_bStandaloneTextures = FALSE;
   if (pD3D11DecoderConfiguration)
   {
-    hr = pD3D11DecoderConfiguration->ActivateD3D11Decoding(pDeviceContext->device, pDeviceContext->device_context, pDeviceContext->lock_ctx, 0);
+    // offer standalone textures first, and fall back to array textures if the renderer refuses them
+    hr = E_FAIL;
+    if (bStandaloneTextures)
+    {
+      hr = pD3D11DecoderConfiguration->ActivateD3D11Decoding(pDeviceContext->device, pDeviceContext->device_context, pDeviceContext->lock_ctx, D3D11_DECODER_FLAG_STANDALONE_TEXTURES);
+      m_bStandaloneTextures = SUCCEEDED(hr);
+    }
+    if (FAILED(hr))
+      hr = pD3D11DecoderConfiguration->ActivateD3D11Decoding(pDeviceContext->device, pDeviceContext->device_context, pDeviceContext->lock_ctx, 0);
     SafeRelease(&pD3D11DecoderConfiguration);
 
     m_bReadBackFallback = FAILED(hr);
+    if (m_bReadBackFallback)
+      m_bStandaloneTextures = FALSE;
   }
   else
   {
     m_bReadBackFallback = true;
   }
 
+  // frames can only be deinterlaced on the GPU if we read them back ourselves
+  UpdateHWDeint(m_bReadBackFallback);
+
   return S_OK;
 
 fail:
   SafeRelease(&pD3D11DecoderConfiguration);
+  m_AdapterRegistry.ReleaseAdapter();
   return E_FAIL;
 }
 
@@ -480,12 +587,29 @@ STDMETHODIMP CDecD3D11::InitDecoder(AVCodecID codec, const CMediaType *pmt)
   // reset stream compatibility
   m_bFailHWDecode = false;
 
+  m_SurfacePool.Reset();
+  m_bSurfacePoolResized = FALSE;
+
   m_DisplayDelay = D3D11_QUEUE_SURFACES;
 
   // Reduce display delay for DVD decoding for lower decode latency
   if (m_pCallback->GetDecodeFlags() & LAV_VIDEO_DEC_FLAG_DVD)
     m_DisplayDelay /= 2;
 
+  m_nStagingTextures = min(D3D11_MAX_STAGING_TEXTURES, max(1, (int)m_pSettings->GetHWAccelStagingTextures()));
+
+  // Same for the staging textures, which delay the readback
+  if (m_pCallback->GetDecodeFlags() & LAV_VIDEO_DEC_FLAG_DVD)
+    m_nStagingTextures = min(m_nStagingTextures, 2);
+
+  // the share stays open as long as its settings don't change, its textures follow the decoded surfaces
+  DWORD dwShareSurfaces = 0;
+  LPCWSTR pszShareName = m_pSettings->GetD3D11FrameSharing(&dwShareSurfaces);
+  if (pszShareName)
+    m_FrameShare.Open(pszShareName, dwShareSurfaces);
+  else
+    m_FrameShare.Close();
+
   // Initialize ffmpeg
   hr = CDecAvcodec::InitDecoder(codec, pmt);
   if (FAILED(hr))
@@ -508,9 +632,69 @@ STDMETHODIMP CDecD3D11::InitDecoder(AVCodecID codec, const CMediaType *pmt)
   m_dwSurfaceWidth = dxva_align_dimensions(m_pAVCtx->codec_id, m_pAVCtx->coded_width);
   m_dwSurfaceHeight = dxva_align_dimensions(m_pAVCtx->codec_id, m_pAVCtx->coded_height);
 
+  // reject streams the adapters are known not to support, before a device is created for them
+  if (m_pDevCtx == nullptr && CheckCachedCapabilities() == E_FAIL)
+  {
+    DbgLog((LOG_TRACE, 10, L"-> Cached adapter capabilities don't support the stream, falling back to software decoding"));
+    return E_FAIL;
+  }
+
+  UpdateHWDeint(m_bReadBackFallback);
+
   return S_OK;
 }
 
+// Check the stream against the cached capabilities of the configured adapter, or all adapters in automatic mode
+// Returns E_FAIL only if every candidate adapter is known to be incapable
+HRESULT CDecD3D11::CheckCachedCapabilities()
+{
+  IDXGIFactory1 *pDXGIFactory = nullptr;
+  HRESULT hr = dx.mCreateDXGIFactory1(IID_IDXGIFactory1, (void **)&pDXGIFactory);
+  if (FAILED(hr))
+    return S_FALSE;
+
+  const DWORD dwFormat = hwcaps_format(m_SurfaceFormat);
+  UINT nDevice = m_pSettings->GetHWAccelDeviceIndex(HWAccel_D3D11, nullptr);
+
+  IDXGIAdapter *pDXGIAdapter = nullptr;
+  if (nDevice != LAVHWACCEL_DEVICE_DEFAULT)
+  {
+    // an unavailable device falls back to the default adapter
+    if (FAILED(pDXGIFactory->EnumAdapters(nDevice, &pDXGIAdapter)) && FAILED(pDXGIFactory->EnumAdapters(0, &pDXGIAdapter)))
+    {
+      SafeRelease(&pDXGIFactory);
+      return S_FALSE;
+    }
+
+    hr = hwcaps_check(pDXGIAdapter, m_pAVCtx->codec_id, m_pAVCtx->profile, dwFormat, m_dwSurfaceWidth, m_dwSurfaceHeight);
+    SafeRelease(&pDXGIAdapter);
+  }
+  else
+  {
+    hr = S_FALSE;
+    for (UINT i = 0; SUCCEEDED(pDXGIFactory->EnumAdapters(i, &pDXGIAdapter)); i++)
+    {
+      hr = hwcaps_check(pDXGIAdapter, m_pAVCtx->codec_id, m_pAVCtx->profile, dwFormat, m_dwSurfaceWidth, m_dwSurfaceHeight);
+      SafeRelease(&pDXGIAdapter);
+      if (hr != E_FAIL)
+        break;
+    }
+  }
+
+  SafeRelease(&pDXGIFactory);
+  return hr;
+}
+
+STDMETHODIMP CDecD3D11::Reconfigure(AVCodecID codec, const CMediaType *pmt)
+{
+  // the device, decoder and surfaces are kept, and are re-created on demand if the stream requires it
+  HRESULT hr = CDecAvcodec::Reconfigure(codec, pmt);
+  if (hr == S_OK)
+    FlushDisplayQueue(FALSE);
+
+  return hr;
+}
+
 HRESULT CDecD3D11::AdditionaDecoderInit()
 {
   AVD3D11VAContext *ctx = av_d3d11va_alloc_context();
@@ -577,15 +761,18 @@ STDMETHODIMP_(long) CDecD3D11::GetBufferCount(long *pMaxBuffers)
     buffers += 4;
   }
 
-  if (pMaxBuffers)
-  {
-    // cap at 127, because it needs to fit into the 7-bit DXVA structs
-    *pMaxBuffers = 127;
+  // cap at 127, because it needs to fit into the 7-bit DXVA structs
+  long maxBuffers = 127;
 
-    // VC-1 and VP9 decoding has stricter requirements (decoding flickers otherwise)
-    if (m_nCodecId == AV_CODEC_ID_VC1 || m_nCodecId == AV_CODEC_ID_VP9)
-      *pMaxBuffers = 32;
-  }
+  // VC-1 and VP9 decoding has stricter requirements (decoding flickers otherwise)
+  if (m_nCodecId == AV_CODEC_ID_VC1 || m_nCodecId == AV_CODEC_ID_VP9)
+    maxBuffers = 32;
+
+  // apply the surface pool policy
+  buffers = m_SurfacePool.GetSurfaceCount(m_pSettings, buffers, maxBuffers);
+
+  if (pMaxBuffers)
+    *pMaxBuffers = maxBuffers;
 
   return buffers;
 }
@@ -605,9 +792,48 @@ STDMETHODIMP CDecD3D11::FlushDisplayQueue(BOOL bDeliver)
     m_FrameQueuePosition = (m_FrameQueuePosition + 1) % m_DisplayDelay;
   }
 
+  // frames from the display queue end up in the staging queue, flush them out as well
+  FlushStagingQueue(bDeliver);
+
   return S_OK;
 }
 
+STDMETHODIMP CDecD3D11::FlushStagingQueue(BOOL bDeliver)
+{
+  for (int i = 0; i < m_nStagingTextures; ++i) {
+    if (m_StagingQueue[m_StagingQueuePosition]) {
+      if (bDeliver) {
+        DeliverStagedFrame(m_StagingQueuePosition);
+      }
+      else {
+        ReleaseFrame(&m_StagingQueue[m_StagingQueuePosition]);
+      }
+    }
+    m_StagingQueuePosition = (m_StagingQueuePosition + 1) % m_nStagingTextures;
+  }
+
+  return S_OK;
+}
+
+void CDecD3D11::ReleaseStagingTextures()
+{
+  for (int i = 0; i < D3D11_MAX_STAGING_TEXTURES; i++) {
+    ReleaseFrame(&m_StagingQueue[i]);
+    SafeRelease(&m_pD3D11StagingTextures[i]);
+    SafeRelease(&m_pStagingQueries[i]);
+    m_StagingFenceValues[i] = 0;
+  }
+  m_StagingQueuePosition = 0;
+
+  SafeRelease(&m_pStagingFence);
+  SafeRelease(&m_pStagingContext4);
+  m_nStagingFenceValue = 0;
+  if (m_hStagingEvent) {
+    CloseHandle(m_hStagingEvent);
+    m_hStagingEvent = nullptr;
+  }
+}
+
 STDMETHODIMP CDecD3D11::Flush()
 {
   CDecAvcodec::Flush();
@@ -615,6 +841,11 @@ STDMETHODIMP CDecD3D11::Flush()
   // Flush display queue
   FlushDisplayQueue(FALSE);
 
+  // Re-allocate the copy-back surfaces with a bigger pool on the next frame if the decoder ran out of surfaces,
+  // or with a smaller one if the system is low on memory
+  if (m_bReadBackFallback && m_pDecoder && (m_SurfacePool.Grow(m_pSettings) || m_SurfacePool.Shrink()))
+    m_bSurfacePoolResized = TRUE;
+
   return S_OK;
 }
 
@@ -681,11 +912,16 @@ int CDecD3D11::get_d3d11_buffer(struct AVCodecContext *c, AVFrame *frame, int fl
     return -1;
   }
 
+  // the frames pool has a fixed size, and the allocator blocks, when all surfaces are in use
+  pDec->m_SurfacePool.OnRequest(pDec->m_SurfacePool.GetInUse() >= pDec->m_dwSurfaceCount);
+
   if (pDec->m_bReadBackFallback && pDec->m_pFramesCtx)
   {
     int ret = av_hwframe_get_buffer(pDec->m_pFramesCtx, frame, 0);
     frame->width = c->coded_width;
     frame->height = c->coded_height;
+    if (ret >= 0)
+      pDec->m_SurfacePool.TrackFrame(frame);
     return ret;
   }
   else if (pDec->m_bReadBackFallback == false && pDec->m_pAllocator)
@@ -701,6 +937,7 @@ int CDecD3D11::get_d3d11_buffer(struct AVCodecContext *c, AVFrame *frame, int fl
 
       frame->width = c->coded_width;
       frame->height = c->coded_height;
+      pDec->m_SurfacePool.TrackFrame(frame);
 
       // the frame holds the sample now, can release the direct interface
       pD3D11Sample->Release();
@@ -727,7 +964,7 @@ STDMETHODIMP CDecD3D11::ReInitD3D11Decoder(AVCodecContext *c)
   if (m_bReadBackFallback == false && m_pAllocator == nullptr)
     return E_FAIL;
 
-  if (m_pDecoder == nullptr || m_dwSurfaceWidth != dxva_align_dimensions(c->codec_id, c->coded_width) || m_dwSurfaceHeight != dxva_align_dimensions(c->codec_id, c->coded_height) || m_SurfaceFormat != d3d11va_map_sw_to_hw_format(c->sw_pix_fmt))
+  if (m_pDecoder == nullptr || m_bSurfacePoolResized || m_dwSurfaceWidth != dxva_align_dimensions(c->codec_id, c->coded_width) || m_dwSurfaceHeight != dxva_align_dimensions(c->codec_id, c->coded_height) || m_SurfaceFormat != d3d11va_map_sw_to_hw_format(c->sw_pix_fmt))
   {
     AVD3D11VADeviceContext *pDeviceContext = (AVD3D11VADeviceContext *)((AVHWDeviceContext *)m_pDevCtx->data)->hwctx;
     DbgLog((LOG_TRACE, 10, L"No D3D11 Decoder or image dimensions changed -> Re-Allocating resources"));
@@ -739,6 +976,12 @@ STDMETHODIMP CDecD3D11::ReInitD3D11Decoder(AVCodecContext *c)
     else
       FlushDisplayQueue(TRUE);
 
+    // deliver the frames still waiting in the staging textures, they are re-created with the decoder
+    if (m_bReadBackFallback)
+      FlushStagingQueue(TRUE);
+
+    m_bSurfacePoolResized = FALSE;
+
     pDeviceContext->lock(pDeviceContext->lock_ctx);
     hr = CreateD3D11Decoder();
     pDeviceContext->unlock(pDeviceContext->lock_ctx);
@@ -914,6 +1157,8 @@ STDMETHODIMP CDecD3D11::CreateD3D11Decoder()
   m_dwSurfaceHeight = dxva_align_dimensions(m_pAVCtx->codec_id, m_pAVCtx->coded_height);
   m_SurfaceFormat = surface_format;
 
+  const size_t nSurfaceSize = dxva_surface_size(m_dwSurfaceWidth, m_dwSurfaceHeight, surface_format == DXGI_FORMAT_NV12 ? 1 : 2);
+
   if (m_bReadBackFallback == false && m_pAllocator)
   {
     ALLOCATOR_PROPERTIES properties;
@@ -922,14 +1167,19 @@ STDMETHODIMP CDecD3D11::CreateD3D11Decoder()
       return hr;
 
     m_dwSurfaceCount = properties.cBuffers;
+    m_SurfacePool.OnCreate(m_dwSurfaceCount, m_dwSurfaceCount, nSurfaceSize, m_pCallback->GetMemoryAccount());
   }
   else
   {
-    m_dwSurfaceCount = GetBufferCount();
+    long nMaxSurfaces = 0;
+    m_dwSurfaceCount = GetBufferCount(&nMaxSurfaces);
+    m_SurfacePool.OnCreate(m_dwSurfaceCount, nMaxSurfaces, nSurfaceSize, m_pCallback->GetMemoryAccount());
   }
 
   // allocate a new frames context for the dimensions and format
-  hr = AllocateFramesContext(m_dwSurfaceWidth, m_dwSurfaceHeight, m_pAVCtx->sw_pix_fmt, m_dwSurfaceCount, &m_pFramesCtx);
+  // with standalone textures, the frames context does not allocate any surfaces, the textures are created below
+  const BOOL bStandaloneTextures = (m_bReadBackFallback == false && m_bStandaloneTextures);
+  hr = AllocateFramesContext(m_dwSurfaceWidth, m_dwSurfaceHeight, m_pAVCtx->sw_pix_fmt, bStandaloneTextures ? 0 : m_dwSurfaceCount, &m_pFramesCtx);
   if (FAILED(hr))
   {
     DbgLog((LOG_ERROR, 10, L"-> Error allocating frames context"));
@@ -945,10 +1195,41 @@ STDMETHODIMP CDecD3D11::CreateD3D11Decoder()
     }
     av_freep(&m_pOutputViews);
   }
+  ReleaseStandaloneTextures();
 
   m_pOutputViews = (ID3D11VideoDecoderOutputView **)av_mallocz_array(m_dwSurfaceCount, sizeof(*m_pOutputViews));
   m_nOutputViews = m_dwSurfaceCount;
 
+  // create an individual texture for every surface, the allocator hands them out in the order of the output views
+  if (bStandaloneTextures)
+  {
+    m_pStandaloneTextures = (ID3D11Texture2D **)av_mallocz_array(m_dwSurfaceCount, sizeof(*m_pStandaloneTextures));
+    if (m_pStandaloneTextures == nullptr)
+      return E_OUTOFMEMORY;
+    m_nStandaloneTextures = m_dwSurfaceCount;
+
+    D3D11_TEXTURE2D_DESC texDesc = { 0 };
+    texDesc.Width = m_dwSurfaceWidth;
+    texDesc.Height = m_dwSurfaceHeight;
+    texDesc.MipLevels = 1;
+    texDesc.ArraySize = 1;
+    texDesc.Format = surface_format;
+    texDesc.SampleDesc.Count = 1;
+    texDesc.Usage = D3D11_USAGE_DEFAULT;
+    texDesc.BindFlags = D3D11_BIND_DECODER | D3D11_BIND_SHADER_RESOURCE;
+    texDesc.MiscFlags = D3D11_RESOURCE_MISC_SHARED;
+
+    for (DWORD i = 0; i < m_dwSurfaceCount; i++)
+    {
+      hr = pDeviceContext->device->CreateTexture2D(&texDesc, nullptr, &m_pStandaloneTextures[i]);
+      if (FAILED(hr))
+      {
+        DbgLog((LOG_ERROR, 10, L"-> Failed to create standalone texture (hr: 0x%x)", hr));
+        return E_FAIL;
+      }
+    }
+  }
+
   // allocate output views for the frames
   AVD3D11VAFramesContext *pFramesContext = (AVD3D11VAFramesContext *)((AVHWFramesContext *)m_pFramesCtx->data)->hwctx;
   for (int i = 0; i < m_nOutputViews; i++)
@@ -956,9 +1237,10 @@ STDMETHODIMP CDecD3D11::CreateD3D11Decoder()
     D3D11_VIDEO_DECODER_OUTPUT_VIEW_DESC viewDesc = { 0 };
     viewDesc.DecodeProfile = profileGUID;
     viewDesc.ViewDimension = D3D11_VDOV_DIMENSION_TEXTURE2D;
-    viewDesc.Texture2D.ArraySlice = i;
+    viewDesc.Texture2D.ArraySlice = bStandaloneTextures ? 0 : i;
 
-    hr = pDeviceContext->video_device->CreateVideoDecoderOutputView(pFramesContext->texture, &viewDesc, &m_pOutputViews[i]);
+    ID3D11Texture2D *pTexture = bStandaloneTextures ? m_pStandaloneTextures[i] : pFramesContext->texture;
+    hr = pDeviceContext->video_device->CreateVideoDecoderOutputView(pTexture, &viewDesc, &m_pOutputViews[i]);
     if (FAILED(hr))
     {
       DbgLog((LOG_ERROR, 10, L"-> Failed to create video decoder output views"));
@@ -979,6 +1261,27 @@ STDMETHODIMP CDecD3D11::CreateD3D11Decoder()
   return S_OK;
 }
 
+void CDecD3D11::ReleaseStandaloneTextures()
+{
+  if (m_pStandaloneTextures)
+  {
+    for (int i = 0; i < m_nStandaloneTextures; i++)
+    {
+      SafeRelease(&m_pStandaloneTextures[i]);
+    }
+    av_freep(&m_pStandaloneTextures);
+    m_nStandaloneTextures = 0;
+  }
+}
+
+ID3D11Texture2D *CDecD3D11::GetD3D11StandaloneTexture(int nIndex)
+{
+  if (m_pStandaloneTextures == nullptr || nIndex < 0 || nIndex >= m_nStandaloneTextures)
+    return nullptr;
+
+  return m_pStandaloneTextures[nIndex];
+}
+
 STDMETHODIMP CDecD3D11::AllocateFramesContext(int width, int height, AVPixelFormat format, int nSurfaces, AVBufferRef **ppFramesCtx)
 {
   ASSERT(m_pAVCtx);
@@ -987,7 +1290,9 @@ STDMETHODIMP CDecD3D11::AllocateFramesContext(int width, int height, AVPixelForm
 
   // unref any old buffer
   av_buffer_unref(ppFramesCtx);
-  SafeRelease(&m_pD3D11StagingTexture);
+  ReleaseStagingTextures();
+  ReleaseD3D11Deinterlacer();
+  ReleaseD3D11Converter();
 
   // allocate a new frames context for the device context
   *ppFramesCtx = av_hwframe_ctx_alloc(m_pDevCtx);
@@ -1048,12 +1353,16 @@ HRESULT CDecD3D11::HandleDXVA2Frame(LAVFrame *pFrame)
 
 HRESULT CDecD3D11::DeliverD3D11Frame(LAVFrame *pFrame)
 {
+  if (m_FrameShare.IsOpen())
+  {
+    AVFrame *pAVFrame = (AVFrame *)pFrame->priv_data;
+    // data[1] is the index of the output view, which is only the array slice for array textures
+    ShareD3D11Frame(pFrame, (ID3D11Texture2D *)pAVFrame->data[0], m_bStandaloneTextures ? 0 : (UINT)(intptr_t)pAVFrame->data[1]);
+  }
+
   if (m_bReadBackFallback)
   {
-    if (m_bDirect)
-      DeliverD3D11ReadbackDirect(pFrame);
-    else
-      DeliverD3D11Readback(pFrame);
+    QueueD3D11Readback(pFrame);
   }
   else
   {
@@ -1069,32 +1378,681 @@ HRESULT CDecD3D11::DeliverD3D11Frame(LAVFrame *pFrame)
   return S_OK;
 }
 
-HRESULT CDecD3D11::DeliverD3D11Readback(LAVFrame *pFrame)
+// Copy the decoded surface into the next texture of the frame share, on the GPU
+HRESULT CDecD3D11::ShareD3D11Frame(LAVFrame *pFrame, ID3D11Texture2D *pTexture, UINT nSubresource)
+{
+  AVD3D11VADeviceContext *pDeviceContext = (AVD3D11VADeviceContext *)((AVHWDeviceContext *)m_pDevCtx->data)->hwctx;
+
+  HRESULT hr = m_FrameShare.PrepareTextures(pDeviceContext->device, pTexture, m_AdapterDesc.AdapterLuid, pFrame->width, pFrame->height);
+  if (FAILED(hr))
+    return hr;
+
+  LockDevice();
+  hr = m_FrameShare.ShareFrame(pDeviceContext->device_context, pTexture, nSubresource, pFrame->rtStart, pFrame->rtStop);
+  UnlockDevice();
+
+  return hr;
+}
+
+HRESULT CDecD3D11::AllocateStagingTexture(int nSlot, ID3D11Texture2D *pSourceTexture)
+{
+  AVD3D11VADeviceContext *pDeviceContext = (AVD3D11VADeviceContext *)((AVHWDeviceContext *)m_pDevCtx->data)->hwctx;
+
+  D3D11_TEXTURE2D_DESC texDesc = { 0 };
+  pSourceTexture->GetDesc(&texDesc);
+
+  // the staging texture changes with the output format of the GPU conversion
+  if (m_pD3D11StagingTextures[nSlot])
+  {
+    D3D11_TEXTURE2D_DESC stagingDesc = { 0 };
+    m_pD3D11StagingTextures[nSlot]->GetDesc(&stagingDesc);
+    if (stagingDesc.Format == texDesc.Format && stagingDesc.Width == texDesc.Width && stagingDesc.Height == texDesc.Height)
+      return S_OK;
+
+    SafeRelease(&m_pD3D11StagingTextures[nSlot]);
+  }
+
+  texDesc.ArraySize = 1;
+  texDesc.Usage = D3D11_USAGE_STAGING;
+  texDesc.BindFlags = 0;
+  texDesc.CPUAccessFlags = D3D11_CPU_ACCESS_READ;
+
+  return pDeviceContext->device->CreateTexture2D(&texDesc, nullptr, &m_pD3D11StagingTextures[nSlot]);
+}
+
+// Lock the device context, the renderer and the other decoders on the adapter share it
+// The time spent waiting for the lock is recorded in the telemetry.
+void CDecD3D11::LockDevice()
+{
+  AVD3D11VADeviceContext *pDeviceContext = (AVD3D11VADeviceContext *)((AVHWDeviceContext *)m_pDevCtx->data)->hwctx;
+
+  REFERENCE_TIME rtWaitStart = timer_get_ref_time();
+  pDeviceContext->lock(pDeviceContext->lock_ctx);
+  m_pCallback->AddStageTime(VideoStage_HWDeviceLock, timer_get_ref_time() - rtWaitStart);
+}
+
+void CDecD3D11::UnlockDevice()
+{
+  AVD3D11VADeviceContext *pDeviceContext = (AVD3D11VADeviceContext *)((AVHWDeviceContext *)m_pDevCtx->data)->hwctx;
+  pDeviceContext->unlock(pDeviceContext->lock_ctx);
+}
+
+HRESULT CDecD3D11::InitStagingSync(int nSlot)
+{
+  AVD3D11VADeviceContext *pDeviceContext = (AVD3D11VADeviceContext *)((AVHWDeviceContext *)m_pDevCtx->data)->hwctx;
+
+  if (m_pStagingFence || m_pStagingQueries[nSlot])
+    return S_OK;
+
+  // one fence covers the whole ring
+  ID3D11Device5 *pDevice5 = nullptr;
+  HRESULT hr = pDeviceContext->device->QueryInterface(&pDevice5);
+  if (SUCCEEDED(hr))
+    hr = pDeviceContext->device_context->QueryInterface(&m_pStagingContext4);
+  if (SUCCEEDED(hr))
+    hr = pDevice5->CreateFence(0, D3D11_FENCE_FLAG_NONE, IID_PPV_ARGS(&m_pStagingFence));
+  if (SUCCEEDED(hr)) {
+    m_hStagingEvent = CreateEvent(nullptr, FALSE, FALSE, nullptr);
+    if (m_hStagingEvent == nullptr)
+      hr = E_FAIL;
+  }
+  SafeRelease(&pDevice5);
+
+  if (SUCCEEDED(hr))
+    return S_OK;
+
+  SafeRelease(&m_pStagingFence);
+  SafeRelease(&m_pStagingContext4);
+  if (m_hStagingEvent) {
+    CloseHandle(m_hStagingEvent);
+    m_hStagingEvent = nullptr;
+  }
+
+  // fall back to polling an event query
+  D3D11_QUERY_DESC queryDesc = { D3D11_QUERY_EVENT, 0 };
+  return pDeviceContext->device->CreateQuery(&queryDesc, &m_pStagingQueries[nSlot]);
+}
+
+// Wait for the copy into the staging texture to finish, without holding the device lock
+// The device is shared with the other decoders on the same adapter, a blocking Map would stall all of them.
+void CDecD3D11::WaitForStagingCopy(int nSlot)
+{
+  AVD3D11VADeviceContext *pDeviceContext = (AVD3D11VADeviceContext *)((AVHWDeviceContext *)m_pDevCtx->data)->hwctx;
+
+  if (m_pStagingFence)
+  {
+    const UINT64 nValue = m_StagingFenceValues[nSlot];
+    if (m_pStagingFence->GetCompletedValue() >= nValue)
+      return;
+
+    // the signal may still sit in the command buffer of the context
+    LockDevice();
+    pDeviceContext->device_context->Flush();
+    UnlockDevice();
+
+    if (SUCCEEDED(m_pStagingFence->SetEventOnCompletion(nValue, m_hStagingEvent)))
+      WaitForSingleObject(m_hStagingEvent, D3D11_STAGING_WAIT_TIMEOUT);
+  }
+  else if (m_pStagingQueries[nSlot])
+  {
+    // only the first poll flushes the context
+    const DWORD dwStart = GetTickCount();
+    UINT nFlags = 0;
+    for (int i = 0;; i++)
+    {
+      LockDevice();
+      HRESULT hr = pDeviceContext->device_context->GetData(m_pStagingQueries[nSlot], nullptr, 0, nFlags);
+      UnlockDevice();
+
+      if (hr != S_FALSE || GetTickCount() - dwStart > D3D11_STAGING_WAIT_TIMEOUT)
+        break;
+
+      nFlags = D3D11_ASYNC_GETDATA_DONOTFLUSH;
+      Sleep(i < 16 ? 0 : 1);
+    }
+  }
+}
+
+HRESULT CDecD3D11::QueueD3D11Readback(LAVFrame *pFrame)
 {
   AVFrame *src = (AVFrame *)pFrame->priv_data;
-  AVFrame *dst = av_frame_alloc();
+  ID3D11Texture2D *pTexture = (ID3D11Texture2D *)src->data[0];
+  UINT nSubresource = (UINT)(intptr_t)src->data[1];
+  HRESULT hr = S_OK;
 
-  int ret = av_hwframe_transfer_data(dst, src, 0);
-  if (ret < 0)
+  // the copies are ordered on the device context, so the decoder surface can be released once they are queued
+  pFrame->priv_data = nullptr;
+  pFrame->destruct = nullptr;
+  memset(pFrame->data, 0, sizeof(pFrame->data));
+
+  if (m_bHWDeint && pFrame->interlaced)
+    hr = QueueD3D11Deinterlace(pFrame, pTexture, nSubresource);
+  else
+    hr = QueueStagingCopy(pFrame, pTexture, nSubresource);
+
+  av_frame_free(&src);
+
+  return hr;
+}
+
+HRESULT CDecD3D11::QueueD3D11Deinterlace(LAVFrame *pFrame, ID3D11Texture2D *pTexture, UINT nSubresource)
+{
+  AVD3D11VADeviceContext *pDeviceContext = (AVD3D11VADeviceContext *)((AVHWDeviceContext *)m_pDevCtx->data)->hwctx;
+  HRESULT hr = S_OK;
+
+  if (m_pVideoProcessor == nullptr)
+  {
+    hr = CreateD3D11Deinterlacer(pTexture);
+    if (FAILED(hr))
+    {
+      DbgLog((LOG_ERROR, 10, L"-> Creating the D3D11 video processor failed, disabling hardware deinterlacing"));
+      ReleaseD3D11Deinterlacer();
+      m_bHWDeint = FALSE;
+      return QueueStagingCopy(pFrame, pTexture, nSubresource);
+    }
+  }
+
+  D3D11_VIDEO_PROCESSOR_INPUT_VIEW_DESC inputViewDesc = { 0 };
+  inputViewDesc.ViewDimension = D3D11_VPIV_DIMENSION_TEXTURE2D;
+  inputViewDesc.Texture2D.ArraySlice = nSubresource;
+
+  ID3D11VideoProcessorInputView *pInputView = nullptr;
+  hr = pDeviceContext->video_device->CreateVideoProcessorInputView(pTexture, m_pVideoProcessorEnum, &inputViewDesc, &pInputView);
+  if (FAILED(hr))
   {
     ReleaseFrame(&pFrame);
-    av_frame_free(&dst);
     return E_FAIL;
   }
 
-  // free the source frame
-  av_frame_free(&src);
+  const D3D11_VIDEO_FRAME_FORMAT frameFormat = pFrame->tff ? D3D11_VIDEO_FRAME_FORMAT_INTERLACED_TOP_FIELD_FIRST : D3D11_VIDEO_FRAME_FORMAT_INTERLACED_BOTTOM_FIELD_FIRST;
 
-  // and store the dst frame in LAVFrame
-  pFrame->priv_data = dst;
-  GetPixelFormat(&pFrame->format, &pFrame->bpp);
+  // in double-rate mode, every field turns into its own frame
+  LAVFrame *pSecondField = nullptr;
+  SplitDeinterlacedFrame(pFrame, &pSecondField);
+
+  D3D11_VIDEO_PROCESSOR_STREAM stream = { 0 };
+  stream.Enable = TRUE;
+  stream.pInputSurface = pInputView;
+
+  LAVFrame *pFields[2] = { pFrame, pSecondField };
+  for (UINT nField = 0; nField < 2; nField++)
+  {
+    if (pFields[nField] == nullptr)
+      continue;
+
+    LockDevice();
+    pDeviceContext->video_context->VideoProcessorSetStreamFrameFormat(m_pVideoProcessor, 0, frameFormat);
+    hr = pDeviceContext->video_context->VideoProcessorBlt(m_pVideoProcessor, m_pDeintOutputView, nField, 1, &stream);
+    UnlockDevice();
+
+    // the output texture can be re-used for the next field right away, the staging copy is ordered before it
+    if (SUCCEEDED(hr))
+      hr = QueueStagingCopy(pFields[nField], m_pDeintTexture, 0);
+    else
+      ReleaseFrame(&pFields[nField]);
+  }
+
+  SafeRelease(&pInputView);
+
+  return hr;
+}
+
+HRESULT CDecD3D11::QueueStagingCopy(LAVFrame *pFrame, ID3D11Texture2D *pTexture, UINT nSubresource)
+{
+  AVD3D11VADeviceContext *pDeviceContext = (AVD3D11VADeviceContext *)((AVHWDeviceContext *)m_pDevCtx->data)->hwctx;
+  const int nSlot = m_StagingQueuePosition;
+
+  ASSERT(m_StagingQueue[nSlot] == nullptr);
+
+  // convert into the output format of the renderer first, the converted texture is only read back like the decoded surface
+  // all objects are created upfront, so the calls on the device context can be submitted in one critical section
+  ID3D11VideoProcessorInputView *pConvInputView = nullptr;
+  PrepareD3D11Conversion(pFrame, pTexture, nSubresource, &pConvInputView);
+
+  HRESULT hr = AllocateStagingTexture(nSlot, pConvInputView ? m_pConvTexture : pTexture);
+  if (FAILED(hr))
+  {
+    SafeRelease(&pConvInputView);
+    ReleaseFrame(&pFrame);
+    return E_FAIL;
+  }
+
+  // track the completion of the copy, if that is not possible the readback simply blocks in Map
+  InitStagingSync(nSlot);
 
-  ASSERT((dst->format == AV_PIX_FMT_NV12 && pFrame->format == LAVPixFmt_NV12) || (dst->format == AV_PIX_FMT_P010 && pFrame->format == LAVPixFmt_P016));
+  LockDevice();
+  if (pConvInputView)
+  {
+    if (SUCCEEDED(ConvertD3D11Frame(pFrame, pConvInputView)))
+    {
+      pTexture = m_pConvTexture;
+      nSubresource = 0;
+    }
+    else
+    {
+      // the staging texture has to match the decoded surface for the CPU conversion
+      UnlockDevice();
+      hr = AllocateStagingTexture(nSlot, pTexture);
+      if (FAILED(hr))
+      {
+        SafeRelease(&pConvInputView);
+        ReleaseFrame(&pFrame);
+        return E_FAIL;
+      }
+      LockDevice();
+    }
+  }
 
-  for (int i = 0; i < 4; i++) {
-    pFrame->data[i] = dst->data[i];
-    pFrame->stride[i] = dst->linesize[i];
+  // queue the copy into the staging texture, it is only read back when it has made its way through the ring
+  pDeviceContext->device_context->CopySubresourceRegion(m_pD3D11StagingTextures[nSlot], 0, 0, 0, 0, pTexture, nSubresource, nullptr);
+  if (m_pStagingFence)
+  {
+    m_StagingFenceValues[nSlot] = ++m_nStagingFenceValue;
+    m_pStagingContext4->Signal(m_pStagingFence, m_nStagingFenceValue);
   }
+  else if (m_pStagingQueries[nSlot])
+  {
+    pDeviceContext->device_context->End(m_pStagingQueries[nSlot]);
+  }
+  UnlockDevice();
+
+  SafeRelease(&pConvInputView);
+
+  m_StagingQueue[nSlot] = pFrame;
+  m_StagingQueuePosition = (nSlot + 1) % m_nStagingTextures;
+
+  // deliver the oldest frame in the ring, its copy was queued m_nStagingTextures - 1 frames ago
+  // this leaves one texture free for the readback of the frame in "direct" mode
+  if (m_StagingQueue[m_StagingQueuePosition])
+    return DeliverStagedFrame(m_StagingQueuePosition);
+
+  return S_OK;
+}
+
+STDMETHODIMP CDecD3D11::CreateD3D11Deinterlacer(ID3D11Texture2D *pSourceTexture)
+{
+  AVD3D11VADeviceContext *pDeviceContext = (AVD3D11VADeviceContext *)((AVHWDeviceContext *)m_pDevCtx->data)->hwctx;
+  HRESULT hr = S_OK;
+
+  D3D11_TEXTURE2D_DESC texDesc = { 0 };
+  pSourceTexture->GetDesc(&texDesc);
+
+  D3D11_VIDEO_PROCESSOR_CONTENT_DESC contentDesc = { };
+  contentDesc.InputFrameFormat = D3D11_VIDEO_FRAME_FORMAT_INTERLACED_TOP_FIELD_FIRST;
+  contentDesc.InputWidth = texDesc.Width;
+  contentDesc.InputHeight = texDesc.Height;
+  contentDesc.OutputWidth = texDesc.Width;
+  contentDesc.OutputHeight = texDesc.Height;
+  contentDesc.Usage = D3D11_VIDEO_USAGE_PLAYBACK_NORMAL;
+
+  hr = pDeviceContext->video_device->CreateVideoProcessorEnumerator(&contentDesc, &m_pVideoProcessorEnum);
+  if (FAILED(hr))
+    return hr;
+
+  // the processor needs to read and write the surface format, so the output can be read back like a decoded frame
+  UINT uFormatSupport = 0;
+  hr = m_pVideoProcessorEnum->CheckVideoProcessorFormat(texDesc.Format, &uFormatSupport);
+  if (FAILED(hr) || !(uFormatSupport & D3D11_VIDEO_PROCESSOR_FORMAT_SUPPORT_INPUT) || !(uFormatSupport & D3D11_VIDEO_PROCESSOR_FORMAT_SUPPORT_OUTPUT))
+  {
+    DbgLog((LOG_TRACE, 10, L"-> Video processor does not support the surface format"));
+    return E_FAIL;
+  }
+
+  D3D11_VIDEO_PROCESSOR_CAPS caps;
+  hr = m_pVideoProcessorEnum->GetVideoProcessorCaps(&caps);
+  if (FAILED(hr))
+    return hr;
+
+  // pick the best deinterlacing mode the processor offers
+  static const UINT deintModes[] = {
+    D3D11_VIDEO_PROCESSOR_PROCESSOR_CAPS_DEINTERLACE_MOTION_COMPENSATION,
+    D3D11_VIDEO_PROCESSOR_PROCESSOR_CAPS_DEINTERLACE_ADAPTIVE,
+    D3D11_VIDEO_PROCESSOR_PROCESSOR_CAPS_DEINTERLACE_BLEND,
+    D3D11_VIDEO_PROCESSOR_PROCESSOR_CAPS_DEINTERLACE_BOB,
+  };
+
+  UINT nRateConversionIndex = UINT_MAX;
+  for (int m = 0; m < countof(deintModes) && nRateConversionIndex == UINT_MAX; m++)
+  {
+    for (UINT i = 0; i < caps.RateConversionCapsCount; i++)
+    {
+      D3D11_VIDEO_PROCESSOR_RATE_CONVERSION_CAPS rateCaps;
+      if (SUCCEEDED(m_pVideoProcessorEnum->GetVideoProcessorRateConversionCaps(i, &rateCaps)) && (rateCaps.ProcessorCaps & deintModes[m]))
+      {
+        DbgLog((LOG_TRACE, 10, L"-> Using video processor rate conversion %u (caps: 0x%x)", i, rateCaps.ProcessorCaps));
+        nRateConversionIndex = i;
+        break;
+      }
+    }
+  }
+
+  if (nRateConversionIndex == UINT_MAX)
+  {
+    DbgLog((LOG_TRACE, 10, L"-> Video processor does not support deinterlacing"));
+    return E_FAIL;
+  }
+
+  hr = pDeviceContext->video_device->CreateVideoProcessor(m_pVideoProcessorEnum, nRateConversionIndex, &m_pVideoProcessor);
+  if (FAILED(hr))
+    return hr;
+
+  // output texture, which is copied into the staging textures
+  D3D11_TEXTURE2D_DESC outDesc = { 0 };
+  outDesc.Width = texDesc.Width;
+  outDesc.Height = texDesc.Height;
+  outDesc.MipLevels = 1;
+  outDesc.ArraySize = 1;
+  outDesc.Format = texDesc.Format;
+  outDesc.SampleDesc.Count = 1;
+  outDesc.Usage = D3D11_USAGE_DEFAULT;
+  outDesc.BindFlags = D3D11_BIND_RENDER_TARGET;
+
+  hr = pDeviceContext->device->CreateTexture2D(&outDesc, nullptr, &m_pDeintTexture);
+  if (FAILED(hr))
+    return hr;
+
+  D3D11_VIDEO_PROCESSOR_OUTPUT_VIEW_DESC outputViewDesc = { };
+  outputViewDesc.ViewDimension = D3D11_VPOV_DIMENSION_TEXTURE2D;
+  outputViewDesc.Texture2D.MipSlice = 0;
+
+  hr = pDeviceContext->video_device->CreateVideoProcessorOutputView(m_pDeintTexture, m_pVideoProcessorEnum, &outputViewDesc, &m_pDeintOutputView);
+  if (FAILED(hr))
+    return hr;
+
+  // only deinterlace, the frame is not scaled or otherwise processed
+  pDeviceContext->lock(pDeviceContext->lock_ctx);
+  pDeviceContext->video_context->VideoProcessorSetStreamAutoProcessingMode(m_pVideoProcessor, 0, FALSE);
+  pDeviceContext->video_context->VideoProcessorSetStreamOutputRate(m_pVideoProcessor, 0, D3D11_VIDEO_PROCESSOR_OUTPUT_RATE_NORMAL, FALSE, nullptr);
+  pDeviceContext->unlock(pDeviceContext->lock_ctx);
+
+  return S_OK;
+}
+
+void CDecD3D11::ReleaseD3D11Deinterlacer()
+{
+  SafeRelease(&m_pDeintOutputView);
+  SafeRelease(&m_pDeintTexture);
+  SafeRelease(&m_pVideoProcessor);
+  SafeRelease(&m_pVideoProcessorEnum);
+}
+
+// Output format for the conversion on the GPU, or DXGI_FORMAT_UNKNOWN if the frame is converted on the CPU
+DXGI_FORMAT CDecD3D11::GetGPUConversionFormat(const LAVFrame *pFrame)
+{
+  if (m_bConvFailed || m_bDirect || !m_pSettings->GetHWAccelGPUConversion())
+    return DXGI_FORMAT_UNKNOWN;
+
+  // the software deinterlacer needs the YUV frames
+  if (m_pSettings->GetSWDeintMode() != SWDeintMode_None)
+    return DXGI_FORMAT_UNKNOWN;
+
+  // the video processor only knows the BT.601 and BT.709 matrices
+  const UINT matrix = pFrame->ext_format.VideoTransferMatrix;
+  if (matrix != DXVA2_VideoTransferMatrix_Unknown && matrix != DXVA2_VideoTransferMatrix_BT709 && matrix != DXVA2_VideoTransferMatrix_BT601)
+    return DXGI_FORMAT_UNKNOWN;
+
+  // RGB is delivered as full range, which is what the filter signals for RGB input
+  const GUID subtype = m_pCallback->GetOutputMediaType().subtype;
+  if (subtype == MEDIASUBTYPE_RGB32 && m_pSettings->GetRGBOutputRange() == 2)
+    return DXGI_FORMAT_B8G8R8A8_UNORM;
+  else if (subtype == MEDIASUBTYPE_YUY2)
+    return DXGI_FORMAT_YUY2;
+
+  return DXGI_FORMAT_UNKNOWN;
+}
+
+// Create the converter and the input view of the frame for the conversion into m_pConvTexture
+// Returns S_FALSE if the frame is not converted on the GPU. The device context is not used, so no lock is needed.
+HRESULT CDecD3D11::PrepareD3D11Conversion(LAVFrame *pFrame, ID3D11Texture2D *pTexture, UINT nSubresource, ID3D11VideoProcessorInputView **ppInputView)
+{
+  AVD3D11VADeviceContext *pDeviceContext = (AVD3D11VADeviceContext *)((AVHWDeviceContext *)m_pDevCtx->data)->hwctx;
+  HRESULT hr = S_OK;
+
+  const DXGI_FORMAT format = GetGPUConversionFormat(pFrame);
+  if (format == DXGI_FORMAT_UNKNOWN)
+    return S_FALSE;
+
+  D3D11_TEXTURE2D_DESC texDesc = { 0 };
+  pTexture->GetDesc(&texDesc);
+
+  if (m_pConvTexture)
+  {
+    D3D11_TEXTURE2D_DESC convDesc = { 0 };
+    m_pConvTexture->GetDesc(&convDesc);
+    if (convDesc.Format != format || convDesc.Width != texDesc.Width || convDesc.Height != texDesc.Height)
+      ReleaseD3D11Converter();
+  }
+
+  if (m_pConvProcessor == nullptr)
+  {
+    hr = CreateD3D11Converter(pTexture, format);
+    if (FAILED(hr))
+    {
+      DbgLog((LOG_ERROR, 10, L"-> Creating the D3D11 video processor for the output conversion failed, converting on the CPU"));
+      ReleaseD3D11Converter();
+      m_bConvFailed = TRUE;
+      return S_FALSE;
+    }
+  }
+
+  D3D11_VIDEO_PROCESSOR_INPUT_VIEW_DESC inputViewDesc = { 0 };
+  inputViewDesc.ViewDimension = D3D11_VPIV_DIMENSION_TEXTURE2D;
+  inputViewDesc.Texture2D.ArraySlice = nSubresource;
+
+  hr = pDeviceContext->video_device->CreateVideoProcessorInputView(pTexture, m_pConvProcessorEnum, &inputViewDesc, ppInputView);
+  if (FAILED(hr))
+    return S_FALSE;
+
+  return S_OK;
+}
+
+// Convert the frame into m_pConvTexture, the device lock has to be held by the caller
+HRESULT CDecD3D11::ConvertD3D11Frame(LAVFrame *pFrame, ID3D11VideoProcessorInputView *pInputView)
+{
+  AVD3D11VADeviceContext *pDeviceContext = (AVD3D11VADeviceContext *)((AVHWDeviceContext *)m_pDevCtx->data)->hwctx;
+
+  // same defaults for unknown properties as the CPU converter
+  D3D11_VIDEO_PROCESSOR_COLOR_SPACE inputColorSpace = { 0 };
+  if (pFrame->ext_format.VideoTransferMatrix == DXVA2_VideoTransferMatrix_Unknown)
+    inputColorSpace.YCbCr_Matrix = (pFrame->height > 576 || pFrame->width > 1024) ? 1 : 0;
+  else
+    inputColorSpace.YCbCr_Matrix = (pFrame->ext_format.VideoTransferMatrix == DXVA2_VideoTransferMatrix_BT709) ? 1 : 0;
+  inputColorSpace.Nominal_Range = (pFrame->ext_format.NominalRange == DXVA2_NominalRange_0_255) ? D3D11_VIDEO_PROCESSOR_NOMINAL_RANGE_0_255 : D3D11_VIDEO_PROCESSOR_NOMINAL_RANGE_16_235;
+
+  // YUV output keeps the matrix and range of the input, RGB output is full range
+  D3D11_VIDEO_PROCESSOR_COLOR_SPACE outputColorSpace = inputColorSpace;
+  outputColorSpace.RGB_Range = 0;
+
+  D3D11_VIDEO_PROCESSOR_STREAM stream = { 0 };
+  stream.Enable = TRUE;
+  stream.pInputSurface = pInputView;
+
+  pDeviceContext->video_context->VideoProcessorSetStreamColorSpace(m_pConvProcessor, 0, &inputColorSpace);
+  pDeviceContext->video_context->VideoProcessorSetOutputColorSpace(m_pConvProcessor, &outputColorSpace);
+  HRESULT hr = pDeviceContext->video_context->VideoProcessorBlt(m_pConvProcessor, m_pConvOutputView, 0, 1, &stream);
+  if (FAILED(hr))
+  {
+    DbgLog((LOG_ERROR, 10, L"-> Output conversion on the GPU failed (hr: 0x%x), converting on the CPU", hr));
+    m_bConvFailed = TRUE;
+    return hr;
+  }
+
+  D3D11_TEXTURE2D_DESC convDesc = { 0 };
+  m_pConvTexture->GetDesc(&convDesc);
+  if (convDesc.Format == DXGI_FORMAT_B8G8R8A8_UNORM)
+    pFrame->ext_format.NominalRange = DXVA2_NominalRange_0_255;
+
+  return S_OK;
+}
+
+STDMETHODIMP CDecD3D11::CreateD3D11Converter(ID3D11Texture2D *pSourceTexture, DXGI_FORMAT outputFormat)
+{
+  AVD3D11VADeviceContext *pDeviceContext = (AVD3D11VADeviceContext *)((AVHWDeviceContext *)m_pDevCtx->data)->hwctx;
+  HRESULT hr = S_OK;
+
+  D3D11_TEXTURE2D_DESC texDesc = { 0 };
+  pSourceTexture->GetDesc(&texDesc);
+
+  D3D11_VIDEO_PROCESSOR_CONTENT_DESC contentDesc = { };
+  contentDesc.InputFrameFormat = D3D11_VIDEO_FRAME_FORMAT_PROGRESSIVE;
+  contentDesc.InputWidth = texDesc.Width;
+  contentDesc.InputHeight = texDesc.Height;
+  contentDesc.OutputWidth = texDesc.Width;
+  contentDesc.OutputHeight = texDesc.Height;
+  contentDesc.Usage = D3D11_VIDEO_USAGE_PLAYBACK_NORMAL;
+
+  hr = pDeviceContext->video_device->CreateVideoProcessorEnumerator(&contentDesc, &m_pConvProcessorEnum);
+  if (FAILED(hr))
+    return hr;
+
+  UINT uFormatSupport = 0;
+  hr = m_pConvProcessorEnum->CheckVideoProcessorFormat(texDesc.Format, &uFormatSupport);
+  if (FAILED(hr) || !(uFormatSupport & D3D11_VIDEO_PROCESSOR_FORMAT_SUPPORT_INPUT))
+  {
+    DbgLog((LOG_TRACE, 10, L"-> Video processor does not support the surface format as input"));
+    return E_FAIL;
+  }
+
+  hr = m_pConvProcessorEnum->CheckVideoProcessorFormat(outputFormat, &uFormatSupport);
+  if (FAILED(hr) || !(uFormatSupport & D3D11_VIDEO_PROCESSOR_FORMAT_SUPPORT_OUTPUT))
+  {
+    DbgLog((LOG_TRACE, 10, L"-> Video processor does not support the output format %d", outputFormat));
+    return E_FAIL;
+  }
+
+  hr = pDeviceContext->video_device->CreateVideoProcessor(m_pConvProcessorEnum, 0, &m_pConvProcessor);
+  if (FAILED(hr))
+    return hr;
+
+  // output texture, which is copied into the staging textures
+  D3D11_TEXTURE2D_DESC outDesc = { 0 };
+  outDesc.Width = texDesc.Width;
+  outDesc.Height = texDesc.Height;
+  outDesc.MipLevels = 1;
+  outDesc.ArraySize = 1;
+  outDesc.Format = outputFormat;
+  outDesc.SampleDesc.Count = 1;
+  outDesc.Usage = D3D11_USAGE_DEFAULT;
+  outDesc.BindFlags = D3D11_BIND_RENDER_TARGET;
+
+  hr = pDeviceContext->device->CreateTexture2D(&outDesc, nullptr, &m_pConvTexture);
+  if (FAILED(hr))
+    return hr;
+
+  D3D11_VIDEO_PROCESSOR_OUTPUT_VIEW_DESC outputViewDesc = { };
+  outputViewDesc.ViewDimension = D3D11_VPOV_DIMENSION_TEXTURE2D;
+  outputViewDesc.Texture2D.MipSlice = 0;
+
+  hr = pDeviceContext->video_device->CreateVideoProcessorOutputView(m_pConvTexture, m_pConvProcessorEnum, &outputViewDesc, &m_pConvOutputView);
+  if (FAILED(hr))
+    return hr;
+
+  // only convert, the frame is not scaled or otherwise processed
+  pDeviceContext->lock(pDeviceContext->lock_ctx);
+  pDeviceContext->video_context->VideoProcessorSetStreamAutoProcessingMode(m_pConvProcessor, 0, FALSE);
+  pDeviceContext->video_context->VideoProcessorSetStreamFrameFormat(m_pConvProcessor, 0, D3D11_VIDEO_FRAME_FORMAT_PROGRESSIVE);
+  pDeviceContext->unlock(pDeviceContext->lock_ctx);
+
+  DbgLog((LOG_TRACE, 10, L"-> Converting to output format %d on the GPU", outputFormat));
+
+  return S_OK;
+}
+
+void CDecD3D11::ReleaseD3D11Converter()
+{
+  SafeRelease(&m_pConvOutputView);
+  SafeRelease(&m_pConvTexture);
+  SafeRelease(&m_pConvProcessor);
+  SafeRelease(&m_pConvProcessorEnum);
+}
+
+// Pixel format of the frames read back from a staging texture
+static void d3d11_staging_format(DXGI_FORMAT format, LAVPixelFormat *pPix, int *pBpp)
+{
+  switch (format)
+  {
+  case DXGI_FORMAT_B8G8R8A8_UNORM:
+    *pPix = LAVPixFmt_RGB32;
+    *pBpp = 8;
+    break;
+  case DXGI_FORMAT_YUY2:
+    *pPix = LAVPixFmt_YUY2;
+    *pBpp = 8;
+    break;
+  case DXGI_FORMAT_P010:
+    *pPix = LAVPixFmt_P016;
+    *pBpp = 10;
+    break;
+  case DXGI_FORMAT_P016:
+    *pPix = LAVPixFmt_P016;
+    *pBpp = 16;
+    break;
+  default:
+    *pPix = LAVPixFmt_NV12;
+    *pBpp = 8;
+    break;
+  }
+}
+
+HRESULT CDecD3D11::DeliverStagedFrame(int nSlot)
+{
+  if (m_bDirect)
+    return DeliverD3D11ReadbackDirect(nSlot);
+  else
+    return DeliverD3D11Readback(nSlot);
+}
+
+HRESULT CDecD3D11::DeliverD3D11Readback(int nSlot)
+{
+  AVD3D11VADeviceContext *pDeviceContext = (AVD3D11VADeviceContext *)((AVHWDeviceContext *)m_pDevCtx->data)->hwctx;
+  ID3D11Texture2D *pStagingTexture = m_pD3D11StagingTextures[nSlot];
+  LAVFrame *pFrame = m_StagingQueue[nSlot];
+  D3D11_TEXTURE2D_DESC desc;
+  D3D11_MAPPED_SUBRESOURCE map;
+
+  m_StagingQueue[nSlot] = nullptr;
+
+  pStagingTexture->GetDesc(&desc);
+
+  REFERENCE_TIME rtCopyStart = timer_get_ref_time();
+  WaitForStagingCopy(nSlot);
+
+  LockDevice();
+  HRESULT hr = pDeviceContext->device_context->Map(pStagingTexture, 0, D3D11_MAP_READ, 0, &map);
+  UnlockDevice();
+  if (FAILED(hr))
+  {
+    ReleaseFrame(&pFrame);
+    return E_FAIL;
+  }
+
+  // the staging texture holds the converted frame if it was converted on the GPU
+  d3d11_staging_format(desc.Format, &pFrame->format, &pFrame->bpp);
+  const bool bPacked = (pFrame->format == LAVPixFmt_RGB32 || pFrame->format == LAVPixFmt_YUY2);
+
+  // Allocate memory buffers
+  hr = AllocLAVFrameBuffers(pFrame, map.RowPitch / getPixelFormatDesc(pFrame->format).codedbytes);
+  if (SUCCEEDED(hr))
+  {
+    // Copy the mapped texture onto the memory buffers, outside of the device lock
+    // Intel GPUs benefit from multi-threaded copies
+    if (bPacked)
+      gpu_copy_frame_packed((BYTE *)map.pData, pFrame->data[0], pFrame->height, map.RowPitch, m_AdapterDesc.VendorId == 0x8086);
+    else
+      gpu_copy_frame_nv12((BYTE *)map.pData, pFrame->data[0], pFrame->data[1], desc.Height, pFrame->height, map.RowPitch, m_AdapterDesc.VendorId == 0x8086);
+  }
+
+  LockDevice();
+  pDeviceContext->device_context->Unmap(pStagingTexture, 0);
+  UnlockDevice();
+
+  if (FAILED(hr))
+  {
+    ReleaseFrame(&pFrame);
+    return E_FAIL;
+  }
+
+  m_pCallback->AddStageTime(VideoStage_GPUCopyBack, timer_get_ref_time() - rtCopyStart);
 
   return Deliver(pFrame);
 }
@@ -1114,18 +2072,14 @@ static bool d3d11_direct_lock(LAVFrame * pFrame, LAVDirectBuffer *pBuffer)
 
   ASSERT(pFrame && pBuffer);
 
-  // lock the device context
-  pDeviceContext->lock(pDeviceContext->lock_ctx);
-
   c->pStagingTexture->GetDesc(&desc);
 
-  // map
+  // map, the device lock is not held while the frame is being copied, the mapped memory stays valid until Unmap
+  pDeviceContext->lock(pDeviceContext->lock_ctx);
   HRESULT hr = pDeviceContext->device_context->Map(c->pStagingTexture, 0, D3D11_MAP_READ, 0, &map);
+  pDeviceContext->unlock(pDeviceContext->lock_ctx);
   if (FAILED(hr))
-  {
-    pDeviceContext->unlock(pDeviceContext->lock_ctx);
     return false;
-  }
 
   pBuffer->data[0] = (BYTE *)map.pData;
   pBuffer->data[1] = pBuffer->data[0] + desc.Height * map.RowPitch;
@@ -1141,6 +2095,7 @@ static void d3d11_direct_unlock(LAVFrame * pFrame)
   D3D11DirectPrivate *c = (D3D11DirectPrivate *)pFrame->priv_data;
   AVD3D11VADeviceContext *pDeviceContext = (AVD3D11VADeviceContext *)((AVHWDeviceContext *)c->pDeviceContex->data)->hwctx;
 
+  pDeviceContext->lock(pDeviceContext->lock_ctx);
   pDeviceContext->device_context->Unmap(c->pStagingTexture, 0);
   pDeviceContext->unlock(pDeviceContext->lock_ctx);
 }
@@ -1153,39 +2108,18 @@ static void d3d11_direct_free(LAVFrame * pFrame)
   delete c;
 }
 
-HRESULT CDecD3D11::DeliverD3D11ReadbackDirect(LAVFrame *pFrame)
+HRESULT CDecD3D11::DeliverD3D11ReadbackDirect(int nSlot)
 {
-  AVD3D11VADeviceContext *pDeviceContext = (AVD3D11VADeviceContext *)((AVHWDeviceContext *)m_pDevCtx->data)->hwctx;
-  AVFrame *src = (AVFrame *)pFrame->priv_data;
+  LAVFrame *pFrame = m_StagingQueue[nSlot];
+  m_StagingQueue[nSlot] = nullptr;
 
-  if (m_pD3D11StagingTexture == nullptr)
-  {
-    D3D11_TEXTURE2D_DESC texDesc = { 0 };
-    ((ID3D11Texture2D *)src->data[0])->GetDesc(&texDesc);
-
-    texDesc.ArraySize = 1;
-    texDesc.Usage = D3D11_USAGE_STAGING;
-    texDesc.BindFlags = 0;
-    texDesc.CPUAccessFlags = D3D11_CPU_ACCESS_READ;
-
-    HRESULT hr = pDeviceContext->device->CreateTexture2D(&texDesc, nullptr, &m_pD3D11StagingTexture);
-    if (FAILED(hr))
-    {
-      ReleaseFrame(&pFrame);
-      return E_FAIL;
-    }
-  }
-
-  pDeviceContext->lock(pDeviceContext->lock_ctx);
-  pDeviceContext->device_context->CopySubresourceRegion(m_pD3D11StagingTexture, 0, 0, 0, 0, (ID3D11Texture2D *)src->data[0], (UINT)(intptr_t)src->data[1], nullptr);
-  pDeviceContext->unlock(pDeviceContext->lock_ctx);
-
-  av_frame_free(&src);
+  // the renderer maps the texture later, from its own thread
+  WaitForStagingCopy(nSlot);
 
   D3D11DirectPrivate *c = new D3D11DirectPrivate;
   c->pDeviceContex = av_buffer_ref(m_pDevCtx);
-  c->pStagingTexture = m_pD3D11StagingTexture;
-  m_pD3D11StagingTexture->AddRef();
+  c->pStagingTexture = m_pD3D11StagingTextures[nSlot];
+  c->pStagingTexture->AddRef();
 
   pFrame->priv_data = c;
   pFrame->destruct = d3d11_direct_free;
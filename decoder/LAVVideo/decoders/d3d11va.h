@@ -21,10 +21,13 @@
 #include "DecBase.h"
 #include "avcodec.h"
 
-#include <d3d11.h>
+#include <d3d11_4.h>
 #include <dxgi.h>
 
 #include "d3d11/D3D11SurfaceAllocator.h"
+#include "d3d11/D3D11FrameShare.h"
+#include "dxva2/dxva_common.h"
+#include "dxva2/AdapterRegistry.h"
 
 extern "C" {
 #include "libavutil/hwcontext.h"
@@ -33,10 +36,14 @@ extern "C" {
 }
 
 #define D3D11_QUEUE_SURFACES 4
+#define D3D11_MAX_STAGING_TEXTURES 8
+
+// Maximum time to wait for a staging copy outside of the device lock, before leaving it to a blocking map
+#define D3D11_STAGING_WAIT_TIMEOUT 1000
 
 typedef HRESULT(WINAPI *PFN_CREATE_DXGI_FACTORY1)(REFIID riid, void **ppFactory);
 
-class CDecD3D11 : public CDecAvcodec
+class CDecD3D11 : public CDecAvcodec, public ID3D11FramesContextProvider
 {
 public:
   CDecD3D11(void);
@@ -45,6 +52,7 @@ public:
   // ILAVDecoder
   STDMETHODIMP Check();
   STDMETHODIMP InitDecoder(AVCodecID codec, const CMediaType *pmt);
+  STDMETHODIMP Reconfigure(AVCodecID codec, const CMediaType *pmt);
   STDMETHODIMP GetPixelFormat(LAVPixelFormat *pPix, int *pBpp);
   STDMETHODIMP Flush();
   STDMETHODIMP EndOfStream();
@@ -56,6 +64,7 @@ public:
   STDMETHODIMP_(const WCHAR*) GetDecoderName() { return m_bReadBackFallback ? (m_bDirect ? L"d3d11 cb direct" : L"d3d11 cb") : L"d3d11 native"; }
   STDMETHODIMP HasThreadSafeBuffers() { return S_FALSE; }
   STDMETHODIMP SetDirectOutput(BOOL bDirect) { m_bDirect = bDirect; return S_OK; }
+  STDMETHODIMP GetSurfacePoolStatus(LAVHWSurfacePoolStatus *pStatus) { return m_SurfacePool.GetStatus(pStatus); }
   STDMETHODIMP_(DWORD) GetHWAccelNumDevices();
   STDMETHODIMP GetHWAccelDeviceInfo(DWORD dwIndex, BSTR *pstrDeviceName, DWORD *dwDeviceIdentifier);
   STDMETHODIMP GetHWAccelActiveDevice(BSTR *pstrDeviceName);
@@ -69,8 +78,18 @@ protected:
 
   HRESULT HandleDXVA2Frame(LAVFrame *pFrame);
   HRESULT DeliverD3D11Frame(LAVFrame *pFrame);
-  HRESULT DeliverD3D11Readback(LAVFrame *pFrame);
-  HRESULT DeliverD3D11ReadbackDirect(LAVFrame *pFrame);
+  HRESULT ShareD3D11Frame(LAVFrame *pFrame, ID3D11Texture2D *pTexture, UINT nSubresource);
+  HRESULT AllocateStagingTexture(int nSlot, ID3D11Texture2D *pSourceTexture);
+  HRESULT InitStagingSync(int nSlot);
+  void WaitForStagingCopy(int nSlot);
+  HRESULT QueueD3D11Readback(LAVFrame *pFrame);
+  HRESULT QueueD3D11Deinterlace(LAVFrame *pFrame, ID3D11Texture2D *pTexture, UINT nSubresource);
+  HRESULT QueueStagingCopy(LAVFrame *pFrame, ID3D11Texture2D *pTexture, UINT nSubresource);
+  HRESULT PrepareD3D11Conversion(LAVFrame *pFrame, ID3D11Texture2D *pTexture, UINT nSubresource, ID3D11VideoProcessorInputView **ppInputView);
+  HRESULT ConvertD3D11Frame(LAVFrame *pFrame, ID3D11VideoProcessorInputView *pInputView);
+  HRESULT DeliverStagedFrame(int nSlot);
+  HRESULT DeliverD3D11Readback(int nSlot);
+  HRESULT DeliverD3D11ReadbackDirect(int nSlot);
 
 private:
   STDMETHODIMP DestroyDecoder(bool bFull);
@@ -83,14 +102,33 @@ private:
 
   STDMETHODIMP FindVideoServiceConversion(AVCodecID codec, int profile, DXGI_FORMAT surface_format, GUID *input);
   STDMETHODIMP FindDecoderConfiguration(const D3D11_VIDEO_DECODER_DESC *desc, D3D11_VIDEO_DECODER_CONFIG *pConfig);
+  HRESULT CheckCachedCapabilities();
 
   STDMETHODIMP FillHWContext(AVD3D11VAContext *ctx);
 
   STDMETHODIMP FlushDisplayQueue(BOOL bDeliver);
+  STDMETHODIMP FlushStagingQueue(BOOL bDeliver);
+  void ReleaseStagingTextures();
+
+  void LockDevice();
+  void UnlockDevice();
+
+  STDMETHODIMP CreateD3D11Deinterlacer(ID3D11Texture2D *pSourceTexture);
+  void ReleaseD3D11Deinterlacer();
+
+  DXGI_FORMAT GetGPUConversionFormat(const LAVFrame *pFrame);
+  STDMETHODIMP CreateD3D11Converter(ID3D11Texture2D *pSourceTexture, DXGI_FORMAT outputFormat);
+  void ReleaseD3D11Converter();
 
   static enum AVPixelFormat get_d3d11_format(struct AVCodecContext *s, const enum AVPixelFormat * pix_fmts);
   static int get_d3d11_buffer(struct AVCodecContext *c, AVFrame *pic, int flags);
 
+  void ReleaseStandaloneTextures();
+
+  // ID3D11FramesContextProvider
+  AVBufferRef *GetD3D11FramesContext() { return m_pFramesCtx; }
+  ID3D11Texture2D *GetD3D11StandaloneTexture(int nIndex);
+
 private:
   CD3D11SurfaceAllocator *m_pAllocator = nullptr;
 
@@ -103,16 +141,53 @@ private:
   int m_nOutputViews = 0;
   ID3D11VideoDecoderOutputView **m_pOutputViews = nullptr;
 
+  // individual textures of the output views, when the renderer accepted them instead of one array texture
+  int m_nStandaloneTextures = 0;
+  ID3D11Texture2D **m_pStandaloneTextures = nullptr;
+  BOOL m_bStandaloneTextures = FALSE;
+
   DWORD m_dwSurfaceWidth = 0;
   DWORD m_dwSurfaceHeight = 0;
   DWORD m_dwSurfaceCount = 0;
   DXGI_FORMAT m_SurfaceFormat = DXGI_FORMAT_UNKNOWN;
 
+  CDXVASurfacePool m_SurfacePool;
+  BOOL m_bSurfacePoolResized = FALSE;
+
+  CAdapterRegistry m_AdapterRegistry;
+  CD3D11FrameShare m_FrameShare;
+
   BOOL m_bReadBackFallback = FALSE;
   BOOL m_bDirect = FALSE;
   BOOL m_bFailHWDecode = FALSE;
 
-  ID3D11Texture2D *m_pD3D11StagingTexture = nullptr;
+  // ring of staging textures for copy-back, and the frames waiting in them
+  ID3D11Texture2D *m_pD3D11StagingTextures[D3D11_MAX_STAGING_TEXTURES] = { 0 };
+  LAVFrame        *m_StagingQueue[D3D11_MAX_STAGING_TEXTURES] = { 0 };
+  int              m_StagingQueuePosition = 0;
+  int              m_nStagingTextures = 1;
+
+  // completion of the staging copies, so the readback can wait for them without holding the shared device lock
+  // a fence is used on Windows 10 1703 and newer, an event query per slot otherwise
+  ID3D11Fence          *m_pStagingFence = nullptr;
+  ID3D11DeviceContext4 *m_pStagingContext4 = nullptr;
+  HANDLE                m_hStagingEvent = nullptr;
+  UINT64                m_nStagingFenceValue = 0;
+  UINT64                m_StagingFenceValues[D3D11_MAX_STAGING_TEXTURES] = { 0 };
+  ID3D11Query          *m_pStagingQueries[D3D11_MAX_STAGING_TEXTURES] = { 0 };
+
+  // video processor used to deinterlace before copy-back
+  ID3D11VideoProcessorEnumerator *m_pVideoProcessorEnum = nullptr;
+  ID3D11VideoProcessor           *m_pVideoProcessor = nullptr;
+  ID3D11Texture2D                *m_pDeintTexture = nullptr;
+  ID3D11VideoProcessorOutputView *m_pDeintOutputView = nullptr;
+
+  // video processor used to convert into the output format of the renderer before copy-back
+  ID3D11VideoProcessorEnumerator *m_pConvProcessorEnum = nullptr;
+  ID3D11VideoProcessor           *m_pConvProcessor = nullptr;
+  ID3D11Texture2D                *m_pConvTexture = nullptr;
+  ID3D11VideoProcessorOutputView *m_pConvOutputView = nullptr;
+  BOOL                            m_bConvFailed = FALSE;
 
   LAVFrame* m_FrameQueue[D3D11_QUEUE_SURFACES];
   int       m_FrameQueuePosition = 0;
@@ -128,6 +203,4 @@ private:
   } dx = { 0 };
 
   DXGI_ADAPTER_DESC m_AdapterDesc = { 0 };
-
-  friend class CD3D11SurfaceAllocator;
 };
@@ -0,0 +1,322 @@
+/*
+ *      Copyright (C) 2011-2019 Hendrik Leppkes
+ *      http://www.1f0.de
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program; if not, write to the Free Software Foundation, Inc.,
+ *  51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#include "stdafx.h"
+#include "AdapterRegistry.h"
+
+#include <dxgi1_4.h>
+
+// The version is part of the names, so an incompatible layout never shares the memory
+#define ADAPTER_REGISTRY_NAME L"Local\\LAVVideo_AdapterRegistry_1"
+#define ADAPTER_REGISTRY_LOCK L"Local\\LAVVideo_AdapterRegistry_Lock_1"
+
+#define ADAPTER_REGISTRY_MAX_ADAPTERS 16
+
+// Adapters using more than this share of their video memory budget are only used as a last resort
+#define ADAPTER_REGISTRY_LOW_MEMORY 0.9
+
+typedef HRESULT(WINAPI *PFN_CREATE_DXGI_FACTORY1)(REFIID riid, void **ppFactory);
+
+static inline bool luid_equal(const LUID &a, const LUID &b)
+{
+  return a.LowPart == b.LowPart && a.HighPart == b.HighPart;
+}
+
+CAdapterRegistry::CAdapterRegistry()
+{
+}
+
+CAdapterRegistry::~CAdapterRegistry()
+{
+  ReleaseAdapter();
+}
+
+HRESULT CAdapterRegistry::Open()
+{
+  if (m_pData)
+    return S_OK;
+
+  m_hMutex = CreateMutex(nullptr, FALSE, ADAPTER_REGISTRY_LOCK);
+  if (m_hMutex == nullptr)
+    goto fail;
+
+  // a new mapping is zero-initialized, which is a valid empty registry
+  m_hMapping = CreateFileMapping(INVALID_HANDLE_VALUE, nullptr, PAGE_READWRITE, 0, sizeof(SharedData), ADAPTER_REGISTRY_NAME);
+  if (m_hMapping == nullptr)
+    goto fail;
+
+  m_pData = (SharedData *)MapViewOfFile(m_hMapping, FILE_MAP_ALL_ACCESS, 0, 0, sizeof(SharedData));
+  if (m_pData == nullptr)
+    goto fail;
+
+  return S_OK;
+
+fail:
+  DbgLog((LOG_ERROR, 10, L"-> Failed to open the adapter registry (error: %u)", GetLastError()));
+  Close();
+  return E_FAIL;
+}
+
+void CAdapterRegistry::Close()
+{
+  if (m_pData) {
+    UnmapViewOfFile(m_pData);
+    m_pData = nullptr;
+  }
+  if (m_hMapping) {
+    CloseHandle(m_hMapping);
+    m_hMapping = nullptr;
+  }
+  if (m_hMutex) {
+    CloseHandle(m_hMutex);
+    m_hMutex = nullptr;
+  }
+}
+
+BOOL CAdapterRegistry::Lock()
+{
+  // an abandoned lock is still acquired, the process which crashed holding it is pruned from the registry
+  DWORD dwWait = WaitForSingleObject(m_hMutex, 1000);
+  return (dwWait == WAIT_OBJECT_0 || dwWait == WAIT_ABANDONED);
+}
+
+void CAdapterRegistry::Unlock()
+{
+  ReleaseMutex(m_hMutex);
+}
+
+// Remove the sessions of processes which exited without releasing them
+void CAdapterRegistry::PruneEntries()
+{
+  const DWORD dwCurrentProcessId = GetCurrentProcessId();
+
+  DWORD i = 0;
+  while (i < m_pData->dwEntries && i < ADAPTER_REGISTRY_MAX_ENTRIES) {
+    Entry *pEntry = &m_pData->entries[i];
+
+    BOOL bAlive = (pEntry->dwSessions > 0);
+    if (bAlive && pEntry->dwProcessId != dwCurrentProcessId) {
+      HANDLE hProcess = OpenProcess(SYNCHRONIZE, FALSE, pEntry->dwProcessId);
+      if (hProcess) {
+        bAlive = (WaitForSingleObject(hProcess, 0) == WAIT_TIMEOUT);
+        CloseHandle(hProcess);
+      } else {
+        // processes of other users can't be opened, but they are still alive
+        bAlive = (GetLastError() == ERROR_ACCESS_DENIED);
+      }
+    }
+
+    if (bAlive) {
+      i++;
+    } else {
+      *pEntry = m_pData->entries[--m_pData->dwEntries];
+    }
+  }
+
+  m_pData->dwEntries = min(m_pData->dwEntries, (DWORD)ADAPTER_REGISTRY_MAX_ENTRIES);
+}
+
+DWORD CAdapterRegistry::GetSessions(const LUID &luid) const
+{
+  DWORD dwSessions = 0;
+  for (DWORD i = 0; i < m_pData->dwEntries; i++) {
+    if (luid_equal(m_pData->entries[i].luid, luid))
+      dwSessions += m_pData->entries[i].dwSessions;
+  }
+  return dwSessions;
+}
+
+void CAdapterRegistry::AddSession(const LUID &luid)
+{
+  const DWORD dwCurrentProcessId = GetCurrentProcessId();
+
+  for (DWORD i = 0; i < m_pData->dwEntries; i++) {
+    Entry *pEntry = &m_pData->entries[i];
+    if (pEntry->dwProcessId == dwCurrentProcessId && luid_equal(pEntry->luid, luid)) {
+      pEntry->dwSessions++;
+      return;
+    }
+  }
+
+  // the session is not counted if the registry is full, the adapter selection is merely less balanced then
+  if (m_pData->dwEntries < ADAPTER_REGISTRY_MAX_ENTRIES) {
+    Entry *pEntry = &m_pData->entries[m_pData->dwEntries++];
+    pEntry->luid = luid;
+    pEntry->dwProcessId = dwCurrentProcessId;
+    pEntry->dwSessions = 1;
+  }
+}
+
+void CAdapterRegistry::RemoveSession(const LUID &luid)
+{
+  const DWORD dwCurrentProcessId = GetCurrentProcessId();
+
+  for (DWORD i = 0; i < m_pData->dwEntries; i++) {
+    Entry *pEntry = &m_pData->entries[i];
+    if (pEntry->dwProcessId == dwCurrentProcessId && luid_equal(pEntry->luid, luid)) {
+      if (--pEntry->dwSessions == 0)
+        *pEntry = m_pData->entries[--m_pData->dwEntries];
+      return;
+    }
+  }
+}
+
+HRESULT CAdapterRegistry::AcquireAdapter(UINT *pnIndex, LUID *pLuid)
+{
+  struct Candidate {
+    UINT   nIndex;
+    LUID   luid;
+    double fMemoryUse;
+    BOOL   bLowMemory;
+    DWORD  dwSessions;
+  } candidates[ADAPTER_REGISTRY_MAX_ADAPTERS];
+  UINT nCandidates = 0;
+  UINT nBest = 0;
+
+  ReleaseAdapter();
+
+  HMODULE dxgi = LoadLibrary(L"dxgi.dll");
+  if (dxgi == nullptr)
+    return E_FAIL;
+
+  HRESULT hr = S_OK;
+  IDXGIFactory1 *pDXGIFactory = nullptr;
+  IDXGIAdapter1 *pDXGIAdapter = nullptr;
+
+  PFN_CREATE_DXGI_FACTORY1 mCreateDXGIFactory1 = (PFN_CREATE_DXGI_FACTORY1)GetProcAddress(dxgi, "CreateDXGIFactory1");
+  if (mCreateDXGIFactory1 == nullptr) {
+    hr = E_FAIL;
+    goto done;
+  }
+
+  hr = mCreateDXGIFactory1(IID_IDXGIFactory1, (void **)&pDXGIFactory);
+  if (FAILED(hr))
+    goto done;
+
+  // collect the hardware adapters, and their video memory use
+  for (UINT i = 0; nCandidates < ADAPTER_REGISTRY_MAX_ADAPTERS && SUCCEEDED(pDXGIFactory->EnumAdapters1(i, &pDXGIAdapter)); i++) {
+    DXGI_ADAPTER_DESC1 desc;
+    if (SUCCEEDED(pDXGIAdapter->GetDesc1(&desc)) && !(desc.Flags & DXGI_ADAPTER_FLAG_SOFTWARE)) {
+      Candidate *pCandidate = &candidates[nCandidates++];
+      pCandidate->nIndex = i;
+      pCandidate->luid = desc.AdapterLuid;
+      pCandidate->fMemoryUse = 0.0;
+      pCandidate->bLowMemory = FALSE;
+      pCandidate->dwSessions = 0;
+
+      // the video memory budget is only available on Windows 10
+      IDXGIAdapter3 *pDXGIAdapter3 = nullptr;
+      if (SUCCEEDED(pDXGIAdapter->QueryInterface(&pDXGIAdapter3))) {
+        DXGI_QUERY_VIDEO_MEMORY_INFO info;
+        if (SUCCEEDED(pDXGIAdapter3->QueryVideoMemoryInfo(0, DXGI_MEMORY_SEGMENT_GROUP_LOCAL, &info)) && info.Budget > 0) {
+          pCandidate->fMemoryUse = (double)info.CurrentUsage / info.Budget;
+          pCandidate->bLowMemory = (pCandidate->fMemoryUse > ADAPTER_REGISTRY_LOW_MEMORY);
+        }
+        SafeRelease(&pDXGIAdapter3);
+      }
+    }
+    SafeRelease(&pDXGIAdapter);
+  }
+
+  if (nCandidates < 2) {
+    hr = E_FAIL;
+    goto done;
+  }
+
+  hr = Open();
+  if (FAILED(hr))
+    goto done;
+
+  if (!Lock()) {
+    DbgLog((LOG_ERROR, 10, L"-> Timeout waiting for the adapter registry"));
+    Close();
+    hr = E_FAIL;
+    goto done;
+  }
+
+  PruneEntries();
+
+  // fewest sessions first, adapters that are low on memory are only picked if all of them are
+  for (UINT i = 0; i < nCandidates; i++) {
+    Candidate *c = &candidates[i];
+    c->dwSessions = GetSessions(c->luid);
+
+    if (i == 0)
+      continue;
+
+    const Candidate *b = &candidates[nBest];
+    if (c->bLowMemory != b->bLowMemory) {
+      if (!c->bLowMemory)
+        nBest = i;
+    } else if (c->dwSessions != b->dwSessions) {
+      if (c->dwSessions < b->dwSessions)
+        nBest = i;
+    } else if (c->fMemoryUse < b->fMemoryUse) {
+      nBest = i;
+    }
+  }
+
+  AddSession(candidates[nBest].luid);
+  Unlock();
+
+  DbgLog((LOG_TRACE, 10, L"-> Adapter registry selected adapter %u with %u other sessions, %.0f%% video memory in use", candidates[nBest].nIndex, candidates[nBest].dwSessions, candidates[nBest].fMemoryUse * 100.0));
+
+  m_bAcquired = TRUE;
+  m_Luid = candidates[nBest].luid;
+
+  if (pnIndex)
+    *pnIndex = candidates[nBest].nIndex;
+  if (pLuid)
+    *pLuid = m_Luid;
+
+done:
+  SafeRelease(&pDXGIFactory);
+  FreeLibrary(dxgi);
+  return hr;
+}
+
+HRESULT CAdapterRegistry::UpdateAdapter(const LUID &luid)
+{
+  if (!m_bAcquired)
+    return E_UNEXPECTED;
+
+  if (luid_equal(luid, m_Luid))
+    return S_OK;
+
+  if (!Lock())
+    return E_FAIL;
+
+  RemoveSession(m_Luid);
+  AddSession(luid);
+  Unlock();
+
+  m_Luid = luid;
+  return S_OK;
+}
+
+void CAdapterRegistry::ReleaseAdapter()
+{
+  if (m_bAcquired && Lock()) {
+    RemoveSession(m_Luid);
+    Unlock();
+  }
+
+  m_bAcquired = FALSE;
+  Close();
+}
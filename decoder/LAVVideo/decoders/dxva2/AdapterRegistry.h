@@ -0,0 +1,76 @@
+/*
+ *      Copyright (C) 2011-2019 Hendrik Leppkes
+ *      http://www.1f0.de
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program; if not, write to the Free Software Foundation, Inc.,
+ *  51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#pragma once
+
+#define ADAPTER_REGISTRY_MAX_ENTRIES 256
+
+/* Registry of the hardware decoder sessions on every adapter of the system
+ * The registry is stored in shared memory, and counts the sessions of all processes in the user session.
+ * Every decoder instance owns one registry object, which holds at most one session. */
+class CAdapterRegistry
+{
+public:
+  CAdapterRegistry();
+  ~CAdapterRegistry();
+
+  /* Select the adapter with the fewest decoder sessions, using the video memory use as tie-breaker,
+   * and register a session on it. Returns the DXGI index and the LUID of the adapter.
+   * Fails if there is no choice to be made, ie. only one hardware adapter is present */
+  HRESULT AcquireAdapter(UINT *pnIndex, LUID *pLuid);
+
+  /* Move the session to another adapter, if the decoder ended up on a different device */
+  HRESULT UpdateAdapter(const LUID &luid);
+
+  /* Unregister the session */
+  void ReleaseAdapter();
+
+  BOOL IsAcquired() const { return m_bAcquired; }
+
+private:
+  struct Entry {
+    LUID  luid;
+    DWORD dwProcessId;
+    DWORD dwSessions;
+  };
+
+  struct SharedData {
+    DWORD dwEntries;
+    Entry entries[ADAPTER_REGISTRY_MAX_ENTRIES];
+  };
+
+  HRESULT Open();
+  void Close();
+
+  BOOL Lock();
+  void Unlock();
+
+  void PruneEntries();
+  DWORD GetSessions(const LUID &luid) const;
+  void AddSession(const LUID &luid);
+  void RemoveSession(const LUID &luid);
+
+private:
+  HANDLE      m_hMapping = nullptr;
+  HANDLE      m_hMutex   = nullptr;
+  SharedData *m_pData    = nullptr;
+
+  BOOL m_bAcquired = FALSE;
+  LUID m_Luid      = { 0 };
+};
@@ -0,0 +1,132 @@
+/*
+*      Copyright (C) 2011-2019 Hendrik Leppkes
+*      http://www.1f0.de
+*
+*  This program is free software; you can redistribute it and/or modify
+*  it under the terms of the GNU General Public License as published by
+*  the Free Software Foundation; either version 2 of the License, or
+*  (at your option) any later version.
+*
+*  This program is distributed in the hope that it will be useful,
+*  but WITHOUT ANY WARRANTY; without even the implied warranty of
+*  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+*  GNU General Public License for more details.
+*
+*  You should have received a copy of the GNU General Public License along
+*  with this program; if not, write to the Free Software Foundation, Inc.,
+*  51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+#include "stdafx.h"
+#include "device_cache.h"
+
+#define DEVICE_CACHE_SIZE 8
+
+// Time an unused device is kept, in milliseconds
+#define DEVICE_CACHE_IDLE_TIMEOUT 30000
+
+typedef struct {
+  DeviceCacheType      type;
+  UINT                 adapter;
+  AVBufferRef          *device;
+  device_cache_lost_fn lost;
+  DWORD                dwLastUse;
+} DeviceCacheEntry;
+
+// Devices still cached when the module is unloaded are not released on purpose,
+// releasing D3D objects under the loader lock is not safe.
+static CCritSec s_DeviceCacheLock;
+static DeviceCacheEntry s_DeviceCache[DEVICE_CACHE_SIZE];
+
+// Drop devices which nobody used for a while, with the lock held
+static void device_cache_expire(DWORD dwNow)
+{
+  for (int i = 0; i < DEVICE_CACHE_SIZE; i++) {
+    DeviceCacheEntry *entry = &s_DeviceCache[i];
+    if (entry->device && av_buffer_get_ref_count(entry->device) == 1 && (dwNow - entry->dwLastUse) > DEVICE_CACHE_IDLE_TIMEOUT) {
+      DbgLog((LOG_TRACE, 10, L"device_cache: Releasing idle device of adapter %u", entry->adapter));
+      av_buffer_unref(&entry->device);
+    }
+  }
+}
+
+AVBufferRef *device_cache_get(DeviceCacheType type, UINT adapter)
+{
+  CAutoLock lock(&s_DeviceCacheLock);
+  const DWORD dwNow = GetTickCount();
+  device_cache_expire(dwNow);
+
+  for (int i = 0; i < DEVICE_CACHE_SIZE; i++) {
+    DeviceCacheEntry *entry = &s_DeviceCache[i];
+    if (entry->device && entry->type == type && entry->adapter == adapter) {
+      if (entry->lost(entry->device)) {
+        DbgLog((LOG_TRACE, 10, L"device_cache: Cached device of adapter %u was lost", adapter));
+        av_buffer_unref(&entry->device);
+        return nullptr;
+      }
+
+      entry->dwLastUse = dwNow;
+      return av_buffer_ref(entry->device);
+    }
+  }
+
+  return nullptr;
+}
+
+void device_cache_put(DeviceCacheType type, UINT adapter, AVBufferRef *device, device_cache_lost_fn lost)
+{
+  CAutoLock lock(&s_DeviceCacheLock);
+  const DWORD dwNow = GetTickCount();
+  device_cache_expire(dwNow);
+
+  DeviceCacheEntry *slot = nullptr;
+  for (int i = 0; i < DEVICE_CACHE_SIZE; i++) {
+    DeviceCacheEntry *entry = &s_DeviceCache[i];
+
+    // another decoder created a device for this adapter at the same time, keep the first one
+    if (entry->device && entry->type == type && entry->adapter == adapter)
+      return;
+
+    if (!entry->device && !slot)
+      slot = entry;
+  }
+
+  // no free slot, replace the device which is unused for the longest time
+  if (!slot) {
+    for (int i = 0; i < DEVICE_CACHE_SIZE; i++) {
+      DeviceCacheEntry *entry = &s_DeviceCache[i];
+      if (av_buffer_get_ref_count(entry->device) == 1 && (!slot || (dwNow - entry->dwLastUse) > (dwNow - slot->dwLastUse)))
+        slot = entry;
+    }
+    if (!slot)
+      return;
+    av_buffer_unref(&slot->device);
+  }
+
+  slot->device = av_buffer_ref(device);
+  if (!slot->device)
+    return;
+
+  slot->type = type;
+  slot->adapter = adapter;
+  slot->lost = lost;
+  slot->dwLastUse = dwNow;
+}
+
+void device_cache_release(AVBufferRef **device)
+{
+  if (!*device)
+    return;
+
+  {
+    CAutoLock lock(&s_DeviceCacheLock);
+    for (int i = 0; i < DEVICE_CACHE_SIZE; i++) {
+      if (s_DeviceCache[i].device && s_DeviceCache[i].device->data == (*device)->data) {
+        s_DeviceCache[i].dwLastUse = GetTickCount();
+        break;
+      }
+    }
+  }
+
+  av_buffer_unref(device);
+}
@@ -0,0 +1,44 @@
+/*
+*      Copyright (C) 2011-2019 Hendrik Leppkes
+*      http://www.1f0.de
+*
+*  This program is free software; you can redistribute it and/or modify
+*  it under the terms of the GNU General Public License as published by
+*  the Free Software Foundation; either version 2 of the License, or
+*  (at your option) any later version.
+*
+*  This program is distributed in the hope that it will be useful,
+*  but WITHOUT ANY WARRANTY; without even the implied warranty of
+*  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+*  GNU General Public License for more details.
+*
+*  You should have received a copy of the GNU General Public License along
+*  with this program; if not, write to the Free Software Foundation, Inc.,
+*  51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+#pragma once
+
+// Process-wide cache of hardware devices, shared by the DXVA2 and D3D11 decoders
+//
+// Creating a device takes a considerable amount of time, so devices are kept alive for a while
+// after the last decoder released them, and are re-used by the next decoder on the same adapter.
+// The devices are reference counted AVBufferRefs, which have to hold on to their own DLLs.
+
+typedef enum {
+  DEVICE_CACHE_D3D11,
+  DEVICE_CACHE_DXVA2,
+} DeviceCacheType;
+
+// Returns non-zero if the device was lost and can't be used anymore
+typedef int (*device_cache_lost_fn)(AVBufferRef *device);
+
+// Get a new reference to the cached device of the adapter, or nullptr if none is cached
+// Devices which were lost are removed from the cache instead
+AVBufferRef *device_cache_get(DeviceCacheType type, UINT adapter);
+
+// Offer a newly created device to the cache, the cache takes its own reference
+void device_cache_put(DeviceCacheType type, UINT adapter, AVBufferRef *device, device_cache_lost_fn lost);
+
+// Release a reference obtained from the cache, or any other device
+void device_cache_release(AVBufferRef **device);
@@ -20,6 +20,7 @@
 #include "stdafx.h"
 #include "dxva_common.h"
 #include "moreuuids.h"
+#include "MemoryPressure.h"
 
 #define DXVA_SURFACE_BASE_ALIGN 16
 
@@ -36,6 +37,11 @@ DWORD dxva_align_dimensions(AVCodecID codec, DWORD dim)
   return FFALIGN(dim, align);
 }
 
+size_t dxva_surface_size(DWORD width, DWORD height, int bytes_per_sample)
+{
+  return (size_t)width * height * 3 / 2 * bytes_per_sample;
+}
+
 ////////////////////////////////////////////////////////////////////////////////
 // Codec Maps
 ////////////////////////////////////////////////////////////////////////////////
@@ -183,3 +189,157 @@ int check_dxva_codec_profile(AVCodecID codec, AVPixelFormat pix_fmt, int profile
 
   return 0;
 }
+
+////////////////////////////////////////////////////////////////////////////////
+// Surface Pool
+
+static void dxva_surface_pool_release(void *opaque, uint8_t *data)
+{
+  AVBufferRef *pInUse = (AVBufferRef *)opaque;
+  InterlockedDecrement((volatile LONG *)pInUse->data);
+  av_buffer_unref(&pInUse);
+}
+
+CDXVASurfacePool::CDXVASurfacePool()
+{
+  m_pInUse = av_buffer_allocz(sizeof(LONG));
+}
+
+CDXVASurfacePool::~CDXVASurfacePool()
+{
+  OnDestroy();
+  av_buffer_unref(&m_pInUse);
+}
+
+long CDXVASurfacePool::GetSurfaceCount(ILAVVideoSettings *pSettings, long nRequired, long nLimit)
+{
+  m_nRequired = min(nRequired, nLimit);
+  if (memory_pressure_low() || pSettings->GetLowFootprint()) {
+    m_nGrowth = 0;
+    return m_nRequired;
+  }
+
+  DWORD dwMin = 0, dwMax = 0;
+  pSettings->GetHWAccelSurfacePool(&dwMin, &dwMax);
+
+  long nSurfaces = max(nRequired, (long)dwMin) + m_nGrowth;
+  if (dwMax)
+    nSurfaces = min(nSurfaces, (long)dwMax);
+
+  return min(nSurfaces, nLimit);
+}
+
+void CDXVASurfacePool::OnCreate(DWORD dwSurfaces, DWORD dwLimit, size_t nSurfaceSize, CMemoryAccount *pAccount)
+{
+  m_dwSurfaces = dwSurfaces;
+  m_dwLimit = dwLimit;
+  m_dwMaxInUse = 0;
+  m_bExhausted = FALSE;
+
+  OnDestroy();
+  if (pAccount) {
+    pAccount->AddRef();
+    m_pAccount = pAccount;
+    m_pAccount->Update(LAVMemory_HWSurfaces, &m_nCharged, nSurfaceSize * dwSurfaces);
+  }
+}
+
+void CDXVASurfacePool::OnDestroy()
+{
+  if (m_pAccount) {
+    m_pAccount->Update(LAVMemory_HWSurfaces, &m_nCharged, 0);
+    SafeRelease(&m_pAccount);
+  }
+}
+
+void CDXVASurfacePool::OnRequest(BOOL bStall)
+{
+  if (bStall) {
+    m_dwStalls++;
+    m_bExhausted = TRUE;
+  }
+
+  m_dwMaxInUse = max(m_dwMaxInUse, GetInUse() + 1);
+}
+
+void CDXVASurfacePool::TrackFrame(AVFrame *pFrame)
+{
+  if (!m_pInUse)
+    return;
+
+  // the tracking reference goes into the first free buffer slot of the frame
+  unsigned i = 0;
+  while (i < FF_ARRAY_ELEMS(pFrame->buf) && pFrame->buf[i])
+    i++;
+
+  if (i == FF_ARRAY_ELEMS(pFrame->buf))
+    return;
+
+  AVBufferRef *pInUse = av_buffer_ref(m_pInUse);
+  if (!pInUse)
+    return;
+
+  pFrame->buf[i] = av_buffer_create(nullptr, 0, dxva_surface_pool_release, pInUse, 0);
+  if (!pFrame->buf[i]) {
+    av_buffer_unref(&pInUse);
+    return;
+  }
+
+  InterlockedIncrement((volatile LONG *)m_pInUse->data);
+}
+
+BOOL CDXVASurfacePool::Shrink()
+{
+  if (m_nRequired == 0 || m_dwSurfaces <= (DWORD)m_nRequired || !memory_pressure_low())
+    return FALSE;
+
+  m_nGrowth = 0;
+  m_bExhausted = FALSE;
+
+  DbgLog((LOG_TRACE, 10, L"-> System is low on memory, shrinking the surface pool from %u to %ld surfaces", m_dwSurfaces, m_nRequired));
+  return TRUE;
+}
+
+BOOL CDXVASurfacePool::Grow(ILAVVideoSettings *pSettings)
+{
+  if (!m_bExhausted)
+    return FALSE;
+  m_bExhausted = FALSE;
+
+  // the pool is not grown while the system is low on memory, or with the low footprint profile
+  if (memory_pressure_low() || pSettings->GetLowFootprint())
+    return FALSE;
+
+  // growth is only allowed up to the configured maximum
+  DWORD dwMin = 0, dwMax = 0;
+  pSettings->GetHWAccelSurfacePool(&dwMin, &dwMax);
+  if (dwMax == 0 || m_dwSurfaces >= min(dwMax, m_dwLimit))
+    return FALSE;
+
+  m_nGrowth += DXVA_SURFACE_POOL_GROWTH;
+  m_dwGrowths++;
+
+  DbgLog((LOG_TRACE, 10, L"-> Surface pool ran out of surfaces, growing beyond %u surfaces", m_dwSurfaces));
+  return TRUE;
+}
+
+void CDXVASurfacePool::Reset()
+{
+  m_dwStalls = 0;
+  m_dwGrowths = 0;
+  m_nGrowth = 0;
+  m_bExhausted = FALSE;
+}
+
+HRESULT CDXVASurfacePool::GetStatus(LAVHWSurfacePoolStatus *pStatus) const
+{
+  if (m_dwSurfaces == 0)
+    return S_FALSE;
+
+  pStatus->dwSurfaces = m_dwSurfaces;
+  pStatus->dwInUse = GetInUse();
+  pStatus->dwMaxInUse = m_dwMaxInUse;
+  pStatus->dwStalls = m_dwStalls;
+  pStatus->dwGrowths = m_dwGrowths;
+  return S_OK;
+}
@@ -19,9 +19,15 @@
 
 #pragma once
 
+#include "LAVVideoSettings.h"
+#include "MemoryAccount.h"
+
 /* Align dimensions for hardware and codec requirements */
 DWORD dxva_align_dimensions(AVCodecID codec, DWORD dim);
 
+/* Estimate the memory of a 4:2:0 surface, with 1 (NV12) or 2 (P010/P016) bytes per sample */
+size_t dxva_surface_size(DWORD width, DWORD height, int bytes_per_sample);
+
 /* hardware mode description */
 typedef struct {
   const char   *name;
@@ -46,3 +52,62 @@ int check_dxva_codec_profile(AVCodecID codec, AVPixelFormat pix_fmt, int profile
 
 #define VP9_CHECK_PROFILE(profile) \
   ((profile) == FF_PROFILE_VP9_0 || (profile) == FF_PROFILE_VP9_2)
+
+/* Number of surfaces added every time the surface pool grows */
+#define DXVA_SURFACE_POOL_GROWTH 4
+
+/* Surface pool sizing policy and statistics, shared by the DXVA2 and D3D11 decoders */
+class CDXVASurfacePool
+{
+public:
+  CDXVASurfacePool();
+  ~CDXVASurfacePool();
+
+  /* Apply the configured limits and the growth to the number of surfaces required by the codec
+   * nLimit is the maximum number of surfaces the decoder can handle
+   * While the system is low on memory, only the required surfaces are allocated */
+  long GetSurfaceCount(ILAVVideoSettings *pSettings, long nRequired, long nLimit);
+
+  /* A new pool was allocated, its surfaces are charged to the account until the pool is destroyed */
+  void OnCreate(DWORD dwSurfaces, DWORD dwLimit, size_t nSurfaceSize, CMemoryAccount *pAccount);
+
+  /* The surfaces of the pool were released */
+  void OnDestroy();
+
+  /* Account for a new surface request before its frame is tracked, bStall if no free surface was available */
+  void OnRequest(BOOL bStall);
+
+  /* Track the surface of the frame as in use until the frame is released */
+  void TrackFrame(AVFrame *pFrame);
+
+  /* Grow the pool if it ran out of surfaces since the last call, and the limits allow it
+   * Returns TRUE if the pool should be re-created with the new size */
+  BOOL Grow(ILAVVideoSettings *pSettings);
+
+  /* Drop the growth and the configured minimum if the system is low on memory
+   * Returns TRUE if the pool should be re-created with the required number of surfaces */
+  BOOL Shrink();
+
+  /* Reset the growth and statistics, for a new stream */
+  void Reset();
+
+  DWORD GetInUse() const { return m_pInUse ? *(volatile LONG *)m_pInUse->data : 0; }
+  HRESULT GetStatus(LAVHWSurfacePoolStatus *pStatus) const;
+
+private:
+  DWORD m_dwSurfaces = 0;
+  DWORD m_dwLimit    = 0;
+  DWORD m_dwMaxInUse = 0;
+  DWORD m_dwStalls   = 0;
+  DWORD m_dwGrowths  = 0;
+
+  long m_nGrowth     = 0;
+  long m_nRequired   = 0;
+  BOOL m_bExhausted  = FALSE;
+
+  // LONG counter of the surfaces in use, referenced by every tracked frame so it can outlive the pool
+  AVBufferRef *m_pInUse = nullptr;
+
+  CMemoryAccount *m_pAccount = nullptr;
+  size_t m_nCharged  = 0;
+};
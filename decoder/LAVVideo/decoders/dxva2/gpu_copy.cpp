@@ -0,0 +1,114 @@
+/*
+*      Copyright (C) 2011-2019 Hendrik Leppkes
+*      http://www.1f0.de
+*
+*  This program is free software; you can redistribute it and/or modify
+*  it under the terms of the GNU General Public License as published by
+*  the Free Software Foundation; either version 2 of the License, or
+*  (at your option) any later version.
+*
+*  This program is distributed in the hope that it will be useful,
+*  but WITHOUT ANY WARRANTY; without even the implied warranty of
+*  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+*  GNU General Public License for more details.
+*
+*  You should have received a copy of the GNU General Public License along
+*  with this program; if not, write to the Free Software Foundation, Inc.,
+*  51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+
+#include "stdafx.h"
+#include "gpu_copy.h"
+
+#include "gpu_memcpy_sse4.h"
+
+#include "WorkerPool.h"
+
+// Minimum amount of data per stripe, smaller copies are not worth the threading overhead
+#define GPU_COPY_MIN_STRIPE_SIZE (512 * 1024)
+// Maximum number of stripes, more threads do not improve the bus throughput any further
+#define GPU_COPY_MAX_STRIPES 8
+// Alignment of the stripe boundaries, keeps all stripes properly aligned for the streaming loads
+#define GPU_COPY_STRIPE_ALIGN 4096
+
+typedef void* (*gpu_memcpy_fn)(void* d, const void* s, size_t size);
+
+static void* gpu_memcpy_fallback(void* d, const void* s, size_t size)
+{
+  return memcpy(d, s, size);
+}
+
+static gpu_memcpy_fn gpu_copy_select_function()
+{
+  int cpu_flags = av_get_cpu_flags();
+  if (cpu_flags & AV_CPU_FLAG_AVX2) {
+    DbgLog((LOG_TRACE, 10, L"gpu_copy: Using AVX2 frame copy"));
+    return gpu_memcpy_avx2;
+  } else if (cpu_flags & AV_CPU_FLAG_SSE4) {
+    DbgLog((LOG_TRACE, 10, L"gpu_copy: Using SSE4 frame copy"));
+    return gpu_memcpy;
+  }
+
+  DbgLog((LOG_TRACE, 10, L"gpu_copy: Using fallback frame copy"));
+  return gpu_memcpy_fallback;
+}
+
+static int gpu_copy_stripes(size_t size)
+{
+  static const int nMaxStripes = min(GPU_COPY_MAX_STRIPES, worker_pool_threads());
+  return (int)min((size_t)nMaxStripes, max((size_t)1, size / GPU_COPY_MIN_STRIPE_SIZE));
+}
+
+void gpu_copy_frame_nv12(const BYTE *pSourceData, BYTE *pY, BYTE *pUV, size_t surfaceHeight, size_t imageHeight, size_t pitch, bool bThreaded)
+{
+  static const gpu_memcpy_fn copy = gpu_copy_select_function();
+
+  const size_t lumaSize = imageHeight * pitch;
+  const size_t chromaSize = lumaSize >> 1;
+  const size_t totalSize = lumaSize + chromaSize;
+  const BYTE *pSourceUV = pSourceData + (surfaceHeight * pitch);
+
+  const int nStripes = bThreaded ? gpu_copy_stripes(totalSize) : 1;
+  if (nStripes <= 1) {
+    copy(pY, pSourceData, lumaSize);
+    copy(pUV, pSourceUV, chromaSize);
+    return;
+  }
+
+  // Both planes are treated as one continuous range, so that all stripes have about the same size
+  const size_t stripeSize = FFALIGN((totalSize + nStripes - 1) / nStripes, GPU_COPY_STRIPE_ALIGN);
+  worker_pool_run(nStripes, nStripes, [&](int i, int thread) {
+    const size_t start = min(totalSize, stripeSize * i);
+    const size_t end = min(totalSize, start + stripeSize);
+
+    if (start < lumaSize)
+      copy(pY + start, pSourceData + start, min(end, lumaSize) - start);
+
+    if (end > lumaSize) {
+      const size_t chromaStart = max(start, lumaSize) - lumaSize;
+      copy(pUV + chromaStart, pSourceUV + chromaStart, end - lumaSize - chromaStart);
+    }
+  });
+}
+
+void gpu_copy_frame_packed(const BYTE *pSourceData, BYTE *pDst, size_t imageHeight, size_t pitch, bool bThreaded)
+{
+  static const gpu_memcpy_fn copy = gpu_copy_select_function();
+
+  const size_t totalSize = imageHeight * pitch;
+
+  const int nStripes = bThreaded ? gpu_copy_stripes(totalSize) : 1;
+  if (nStripes <= 1) {
+    copy(pDst, pSourceData, totalSize);
+    return;
+  }
+
+  const size_t stripeSize = FFALIGN((totalSize + nStripes - 1) / nStripes, GPU_COPY_STRIPE_ALIGN);
+  worker_pool_run(nStripes, nStripes, [&](int i, int thread) {
+    const size_t start = min(totalSize, stripeSize * i);
+    const size_t end = min(totalSize, start + stripeSize);
+    if (end > start)
+      copy(pDst + start, pSourceData + start, end - start);
+  });
+}
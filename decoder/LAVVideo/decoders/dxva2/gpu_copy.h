@@ -0,0 +1,42 @@
+/*
+*      Copyright (C) 2011-2019 Hendrik Leppkes
+*      http://www.1f0.de
+*
+*  This program is free software; you can redistribute it and/or modify
+*  it under the terms of the GNU General Public License as published by
+*  the Free Software Foundation; either version 2 of the License, or
+*  (at your option) any later version.
+*
+*  This program is distributed in the hope that it will be useful,
+*  but WITHOUT ANY WARRANTY; without even the implied warranty of
+*  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+*  GNU General Public License for more details.
+*
+*  You should have received a copy of the GNU General Public License along
+*  with this program; if not, write to the Free Software Foundation, Inc.,
+*  51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+
+#pragma once
+
+// Copy-back engine shared by the DXVA2 and D3D11 decoders
+//
+// Copies a NV12/P010 frame out of a locked/mapped GPU surface, using streaming loads
+// (AVX2 or SSE4, depending on the CPU), and optionally splits the copy into stripes
+// which are processed in parallel.
+
+// pSourceData   - start of the locked surface, the chroma plane follows after surfaceHeight lines
+// pY, pUV       - destination planes, using the same pitch as the surface
+// surfaceHeight - height of the surface in lines
+// imageHeight   - height of the image to copy
+// pitch         - pitch of the surface (and destination) in bytes
+// bThreaded     - split the copy across multiple threads
+void gpu_copy_frame_nv12(const BYTE *pSourceData, BYTE *pY, BYTE *pUV, size_t surfaceHeight, size_t imageHeight, size_t pitch, bool bThreaded);
+
+// Copy a frame in a packed format (RGB32, YUY2), with the same parameters as above
+void gpu_copy_frame_packed(const BYTE *pSourceData, BYTE *pDst, size_t imageHeight, size_t pitch, bool bThreaded);
+
+// AVX2 version of gpu_memcpy, in gpu_memcpy_avx2.cpp
+// Only call after checking for AV_CPU_FLAG_AVX2
+void* gpu_memcpy_avx2(void* d, const void* s, size_t size);
@@ -0,0 +1,103 @@
+/*
+*      Copyright (C) 2011-2019 Hendrik Leppkes
+*      http://www.1f0.de
+*
+*  This program is free software; you can redistribute it and/or modify
+*  it under the terms of the GNU General Public License as published by
+*  the Free Software Foundation; either version 2 of the License, or
+*  (at your option) any later version.
+*
+*  This program is distributed in the hope that it will be useful,
+*  but WITHOUT ANY WARRANTY; without even the implied warranty of
+*  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+*  GNU General Public License for more details.
+*
+*  You should have received a copy of the GNU General Public License along
+*  with this program; if not, write to the Free Software Foundation, Inc.,
+*  51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+
+#include "stdafx.h"
+#include "gpu_copy.h"
+
+#include <immintrin.h>
+
+// AVX2 version of gpu_memcpy, see gpu_memcpy_sse4.h
+// This file is compiled with AVX2 code generation, and should not use any inline functions
+// from shared headers, to avoid AVX2 versions of them being picked by the linker.
+void* gpu_memcpy_avx2(void* d, const void* s, size_t size)
+{
+  if (d == nullptr || s == nullptr) return nullptr;
+
+  // If memory is not aligned, use memcpy
+  bool isAligned = (((size_t)(s) | (size_t)(d)) & 0x1F) == 0;
+  if (!isAligned)
+  {
+    return memcpy(d, s, size);
+  }
+
+  __m256i ymm0, ymm1, ymm2, ymm3, ymm4, ymm5, ymm6, ymm7;
+
+  size_t remainder = size & (8 * sizeof(ymm0) - 1); // Copy 256 bytes every loop
+
+  __m256i* pTrg = (__m256i*)d;
+  __m256i* pTrgEnd = pTrg + ((size - remainder) >> 5);
+  __m256i* pSrc = (__m256i*)s;
+
+  // Make sure source is synced - doesn't hurt if not needed.
+  _mm_sfence();
+
+  while (pTrg < pTrgEnd)
+  {
+    // _mm256_stream_load_si256 emits the AVX2 instruction VMOVNTDQA with ymm registers
+    ymm0 = _mm256_stream_load_si256(pSrc);
+    ymm1 = _mm256_stream_load_si256(pSrc + 1);
+    ymm2 = _mm256_stream_load_si256(pSrc + 2);
+    ymm3 = _mm256_stream_load_si256(pSrc + 3);
+    ymm4 = _mm256_stream_load_si256(pSrc + 4);
+    ymm5 = _mm256_stream_load_si256(pSrc + 5);
+    ymm6 = _mm256_stream_load_si256(pSrc + 6);
+    ymm7 = _mm256_stream_load_si256(pSrc + 7);
+
+    _ReadWriteBarrier();
+
+    _mm256_store_si256(pTrg    , ymm0);
+    _mm256_store_si256(pTrg + 1, ymm1);
+    _mm256_store_si256(pTrg + 2, ymm2);
+    _mm256_store_si256(pTrg + 3, ymm3);
+    _mm256_store_si256(pTrg + 4, ymm4);
+    _mm256_store_si256(pTrg + 5, ymm5);
+    _mm256_store_si256(pTrg + 6, ymm6);
+    _mm256_store_si256(pTrg + 7, ymm7);
+
+    pSrc += 8;
+    pTrg += 8;
+  }
+
+  // Copy in 16 byte steps
+  __m128i* pTrg128 = (__m128i*)pTrg;
+  __m128i* pSrc128 = (__m128i*)pSrc;
+  size_t end = remainder >> 4;
+  for (size_t i = 0; i < end; ++i)
+  {
+    _mm_store_si128(pTrg128 + i, _mm_stream_load_si128(pSrc128 + i));
+  }
+  remainder &= 15;
+
+  // Copy last bytes - shouldn't happen as strides are modulu 16
+  if (remainder)
+  {
+    __m128i temp = _mm_stream_load_si128(pSrc128 + end);
+
+    char* ps = (char*)(&temp);
+    char* pt = (char*)(pTrg128 + end);
+
+    for (size_t i = 0; i < remainder; ++i)
+    {
+      pt[i] = ps[i];
+    }
+  }
+
+  return d;
+}
@@ -23,6 +23,9 @@
 #include "dxva2dec.h"
 #include "dxva2/dxva_common.h"
 #include "dxva2/DXVA2SurfaceAllocator.h"
+#include "dxva2/gpu_copy.h"
+#include "dxva2/device_cache.h"
+#include "timer.h"
 #include "moreuuids.h"
 #include "Media.h"
 
@@ -32,10 +35,6 @@
 #include <evr.h>
 #include "libavcodec/dxva2.h"
 
-#include "gpu_memcpy_sse4.h"
-
-#include <ppl.h>
-
 ////////////////////////////////////////////////////////////////////////////////
 // Constructor
 ////////////////////////////////////////////////////////////////////////////////
@@ -122,44 +121,6 @@ static int IsAMDUVD(DWORD dwDeviceId)
 // DXVA2 decoder implementation
 ////////////////////////////////////////////////////////////////////////////////
 
-static void (*CopyFrameNV12)(const BYTE *pSourceData, BYTE *pY, BYTE *pUV, size_t surfaceHeight, size_t imageHeight, size_t pitch) = nullptr;
-
-static void CopyFrameNV12_fallback(const BYTE *pSourceData, BYTE *pY, BYTE *pUV, size_t surfaceHeight, size_t imageHeight, size_t pitch)
-{
-  const size_t size = imageHeight * pitch;
-  memcpy(pY, pSourceData, size);
-  memcpy(pUV, pSourceData + (surfaceHeight * pitch), size >> 1);
-}
-
-static void CopyFrameNV12_fallback_MT(const BYTE *pSourceData, BYTE *pY, BYTE *pUV, size_t surfaceHeight, size_t imageHeight, size_t pitch)
-{
-  const size_t halfSize = (imageHeight * pitch) >> 1;
-  Concurrency::parallel_for(0, 3, [&](int i) {
-    if (i < 2)
-      memcpy(pY + (halfSize * i), pSourceData + (halfSize * i), halfSize);
-    else
-      memcpy(pUV, pSourceData + (surfaceHeight * pitch), halfSize);
-  });
-}
-
-static void CopyFrameNV12_SSE4(const BYTE *pSourceData, BYTE *pY, BYTE *pUV, size_t surfaceHeight, size_t imageHeight, size_t pitch)
-{
-  const size_t size = imageHeight * pitch;
-  gpu_memcpy(pY, pSourceData, size);
-  gpu_memcpy(pUV, pSourceData + (surfaceHeight * pitch), size >> 1);
-}
-
-static void CopyFrameNV12_SSE4_MT(const BYTE *pSourceData, BYTE *pY, BYTE *pUV, size_t surfaceHeight, size_t imageHeight, size_t pitch)
-{
-  const size_t halfSize = (imageHeight * pitch) >> 1;
-  Concurrency::parallel_for(0, 3, [&](int i) {
-    if (i < 2)
-      gpu_memcpy(pY + (halfSize * i), pSourceData + (halfSize * i), halfSize);
-    else
-      gpu_memcpy(pUV, pSourceData + (surfaceHeight * pitch), halfSize);
-  });
-}
-
 CDecDXVA2::CDecDXVA2(void)
   : CDecAvcodec()
 {
@@ -188,8 +149,12 @@ STDMETHODIMP CDecDXVA2::DestroyDecoder(bool bFull, bool bNoAVCodec)
     SafeRelease(&m_pSurfaces[i].d3d);
   }
   m_NumSurfaces = 0;
+  m_FreeSurfacesHead = 0;
+  m_nFreeSurfaces = 0;
+  m_SurfacePool.OnDestroy();
 
   SafeRelease(&m_pDecoder);
+  ReleaseDXVA2Deinterlacer();
 
   if (!bNoAVCodec) {
     CDecAvcodec::DestroyDecoder();
@@ -204,6 +169,8 @@ STDMETHODIMP CDecDXVA2::DestroyDecoder(bool bFull, bool bNoAVCodec)
 
 STDMETHODIMP CDecDXVA2::FreeD3DResources()
 {
+  ReleaseDXVA2Deinterlacer();
+  SafeRelease(&m_pDXVAProcessorService);
   SafeRelease(&m_pDXVADecoderService);
   if (m_pD3DDevMngr && m_hDevice != INVALID_HANDLE_VALUE)
     m_pD3DDevMngr->CloseDeviceHandle(m_hDevice);
@@ -211,6 +178,8 @@ STDMETHODIMP CDecDXVA2::FreeD3DResources()
   SafeRelease(&m_pD3DDevMngr);
   SafeRelease(&m_pD3DDev);
   SafeRelease(&m_pD3D);
+  device_cache_release(&m_pCachedDevice);
+  m_AdapterRegistry.ReleaseAdapter();
 
   if (dx.d3dlib) {
     FreeLibrary(dx.d3dlib);
@@ -588,6 +557,140 @@ HRESULT CDecDXVA2::InitD3D(UINT lAdapter)
   return S_OK;
 }
 
+typedef struct DXVA2CachedDevice {
+  HMODULE                 d3dlib;
+  HMODULE                 dxva2lib;
+  IDirect3D9              *pD3D;
+  IDirect3DDevice9        *pD3DDev;
+  IDirect3DDeviceManager9 *pD3DDevMngr;
+  UINT                    resetToken;
+} DXVA2CachedDevice;
+
+static void dxva2_device_free(void *opaque, uint8_t *data)
+{
+  DXVA2CachedDevice *pDevice = (DXVA2CachedDevice *)data;
+  SafeRelease(&pDevice->pD3DDevMngr);
+  SafeRelease(&pDevice->pD3DDev);
+  SafeRelease(&pDevice->pD3D);
+
+  if (pDevice->dxva2lib)
+    FreeLibrary(pDevice->dxva2lib);
+  if (pDevice->d3dlib)
+    FreeLibrary(pDevice->d3dlib);
+
+  av_free(pDevice);
+}
+
+static int dxva2_device_lost(AVBufferRef *device)
+{
+  DXVA2CachedDevice *pDevice = (DXVA2CachedDevice *)device->data;
+
+  IDirect3DDevice9Ex *pD3DDevEx = nullptr;
+  if (FAILED(pDevice->pD3DDev->QueryInterface(&pD3DDevEx)))
+    return 1;
+
+  HRESULT hr = pD3DDevEx->CheckDeviceState(nullptr);
+  SafeRelease(&pD3DDevEx);
+
+  return (hr == D3DERR_DEVICELOST || hr == D3DERR_DEVICEHUNG || hr == D3DERR_DEVICEREMOVED || hr == D3DERR_DEVICENOTRESET);
+}
+
+/**
+ * Take the D3D objects from the device cache, if a device for this adapter is cached
+ * Returns S_FALSE if a new device has to be created
+ */
+HRESULT CDecDXVA2::InitCachedD3D(UINT lAdapter)
+{
+  m_pCachedDevice = device_cache_get(DEVICE_CACHE_DXVA2, lAdapter);
+  if (!m_pCachedDevice)
+    return S_FALSE;
+
+  DXVA2CachedDevice *pDevice = (DXVA2CachedDevice *)m_pCachedDevice->data;
+  m_pD3D = pDevice->pD3D;
+  m_pD3D->AddRef();
+  m_pD3DDev = pDevice->pD3DDev;
+  m_pD3DDev->AddRef();
+  m_pD3DDevMngr = pDevice->pD3DDevMngr;
+  m_pD3DDevMngr->AddRef();
+  m_pD3DResetToken = pDevice->resetToken;
+
+  // the device may have been created on the default adapter instead of the requested one
+  D3DDEVICE_CREATION_PARAMETERS devParams;
+  HRESULT hr = m_pD3DDev->GetCreationParameters(&devParams);
+  if (SUCCEEDED(hr))
+    hr = InitD3DAdapterIdentifier(devParams.AdapterOrdinal);
+
+  if (FAILED(hr))
+    return hr;
+
+  DbgLog((LOG_TRACE, 10, L"-> Using cached D3D device of adapter %u", devParams.AdapterOrdinal));
+  return S_OK;
+}
+
+/**
+ * Offer the newly created D3D objects to the device cache
+ * Only D3D9Ex devices are shared, plain D3D9 devices can be lost at any time
+ */
+void CDecDXVA2::CacheD3D(UINT lAdapter)
+{
+  IDirect3DDevice9Ex *pD3DDevEx = nullptr;
+  if (FAILED(m_pD3DDev->QueryInterface(&pD3DDevEx)))
+    return;
+  SafeRelease(&pD3DDevEx);
+
+  DXVA2CachedDevice *pDevice = (DXVA2CachedDevice *)av_mallocz(sizeof(DXVA2CachedDevice));
+  if (!pDevice)
+    return;
+
+  m_pCachedDevice = av_buffer_create((uint8_t *)pDevice, sizeof(*pDevice), dxva2_device_free, nullptr, 0);
+  if (!m_pCachedDevice) {
+    av_free(pDevice);
+    return;
+  }
+
+  // the cached device can outlive the decoder, so it needs its own references to the DLLs
+  pDevice->d3dlib = LoadLibrary(L"d3d9.dll");
+  pDevice->dxva2lib = LoadLibrary(L"dxva2.dll");
+
+  pDevice->pD3D = m_pD3D;
+  pDevice->pD3D->AddRef();
+  pDevice->pD3DDev = m_pD3DDev;
+  pDevice->pD3DDev->AddRef();
+  pDevice->pD3DDevMngr = m_pD3DDevMngr;
+  pDevice->pD3DDevMngr->AddRef();
+  pDevice->resetToken = m_pD3DResetToken;
+
+  device_cache_put(DEVICE_CACHE_DXVA2, lAdapter, m_pCachedDevice, dxva2_device_lost);
+}
+
+UINT CDecDXVA2::AcquireBalancedAdapter()
+{
+  LUID luid;
+  if (dx.direct3DCreate9Ex == nullptr || FAILED(m_AdapterRegistry.AcquireAdapter(nullptr, &luid)))
+    return LAVHWACCEL_DEVICE_DEFAULT;
+
+  // find the D3D9 adapter of the selected device
+  UINT lAdapter = LAVHWACCEL_DEVICE_DEFAULT;
+  IDirect3D9Ex *pD3D9Ex = nullptr;
+  if (SUCCEEDED(dx.direct3DCreate9Ex(D3D_SDK_VERSION, &pD3D9Ex))) {
+    for (UINT i = 0; i < pD3D9Ex->GetAdapterCount(); i++) {
+      LUID adapterLuid;
+      if (SUCCEEDED(pD3D9Ex->GetAdapterLUID(i, &adapterLuid)) && adapterLuid.LowPart == luid.LowPart && adapterLuid.HighPart == luid.HighPart) {
+        lAdapter = i;
+        break;
+      }
+    }
+    SafeRelease(&pD3D9Ex);
+  }
+
+  if (lAdapter == LAVHWACCEL_DEVICE_DEFAULT) {
+    DbgLog((LOG_TRACE, 10, L"-> Selected adapter has no D3D9 device, using the default"));
+    m_AdapterRegistry.ReleaseAdapter();
+  }
+
+  return lAdapter;
+}
+
 HRESULT CDecDXVA2::InitD3DEx(UINT lAdapter)
 {
   HRESULT hr = S_OK;
@@ -825,31 +928,46 @@ STDMETHODIMP CDecDXVA2::Init()
 
     // determin the adapter the user requested
     UINT lAdapter = m_pSettings->GetHWAccelDeviceIndex(HWAccel_DXVA2CopyBack, nullptr);
-    if (lAdapter == LAVHWACCEL_DEVICE_DEFAULT)
-      lAdapter = D3DADAPTER_DEFAULT;
 
     DWORD dwDeviceIndex = m_pCallback->GetGPUDeviceIndex();
     if (dwDeviceIndex != DWORD_MAX) {
       lAdapter = (UINT)dwDeviceIndex;
+    } else if (lAdapter == LAVHWACCEL_DEVICE_DEFAULT && m_pSettings->GetHWAccelDeviceLoadBalancing()) {
+      // spread the decoders over all devices
+      lAdapter = AcquireBalancedAdapter();
     }
 
-    // initialize D3D
-    hr = InitD3DEx(lAdapter);
-    if (hr == E_NOINTERFACE) {
-      // D3D9Ex failed, try plain D3D
-      hr = InitD3D(lAdapter);
-    }
+    if (lAdapter == LAVHWACCEL_DEVICE_DEFAULT)
+      lAdapter = D3DADAPTER_DEFAULT;
 
+    // re-use the device of an earlier decoder on this adapter
+    hr = InitCachedD3D(lAdapter);
     if (FAILED(hr)) {
-      DbgLog((LOG_TRACE, 10, L"-> D3D Initialization failed with hr: %X", hr));
+      DbgLog((LOG_TRACE, 10, L"-> Initialization of the cached device failed with hr: %X", hr));
       return hr;
     }
 
-    // create device manager for the device
-    hr = CreateD3DDeviceManager(m_pD3DDev, &m_pD3DResetToken, &m_pD3DDevMngr);
-    if (FAILED(hr)) {
-      DbgLog((LOG_TRACE, 10, L"-> Creation of Device manager failed with hr: %X", hr));
-      return E_FAIL;
+    if (hr == S_FALSE) {
+      // initialize D3D
+      hr = InitD3DEx(lAdapter);
+      if (hr == E_NOINTERFACE) {
+        // D3D9Ex failed, try plain D3D
+        hr = InitD3D(lAdapter);
+      }
+
+      if (FAILED(hr)) {
+        DbgLog((LOG_TRACE, 10, L"-> D3D Initialization failed with hr: %X", hr));
+        return hr;
+      }
+
+      // create device manager for the device
+      hr = CreateD3DDeviceManager(m_pD3DDev, &m_pD3DResetToken, &m_pD3DDevMngr);
+      if (FAILED(hr)) {
+        DbgLog((LOG_TRACE, 10, L"-> Creation of Device manager failed with hr: %X", hr));
+        return E_FAIL;
+      }
+
+      CacheD3D(lAdapter);
     }
 
     // set it as the active device manager
@@ -858,23 +976,6 @@ STDMETHODIMP CDecDXVA2::Init()
       DbgLog((LOG_TRACE, 10, L"-> SetD3DDeviceManager failed with hr: %X", hr));
       return E_FAIL;
     }
-
-    if (CopyFrameNV12 == nullptr) {
-      int cpu_flags = av_get_cpu_flags();
-      if (cpu_flags & AV_CPU_FLAG_SSE4) {
-        DbgLog((LOG_TRACE, 10, L"-> Using SSE4 frame copy"));
-        if (m_dwVendorId == VEND_ID_INTEL)
-          CopyFrameNV12 = CopyFrameNV12_SSE4_MT;
-        else
-          CopyFrameNV12 = CopyFrameNV12_SSE4;
-      } else {
-        DbgLog((LOG_TRACE, 10, L"-> Using fallback frame copy"));
-        if (m_dwVendorId == VEND_ID_INTEL)
-          CopyFrameNV12 = CopyFrameNV12_fallback_MT;
-        else
-          CopyFrameNV12 = CopyFrameNV12_fallback;
-      }
-    }
   }
 
   // Init the ffmpeg parts
@@ -913,17 +1014,8 @@ STDMETHODIMP CDecDXVA2::InitDecoder(AVCodecID codec, const CMediaType *pmt)
 
   DestroyDecoder(false);
 
-  m_DisplayDelay = DXVA2_QUEUE_SURFACES;
-
-  // Intel GPUs don't like the display and performance goes way down, so disable it.
-  if (m_dwVendorId == VEND_ID_INTEL)
-    m_DisplayDelay = 0;
-
-  // Reduce display delay for DVD decoding for lower decode latency
-  if (m_pCallback->GetDecodeFlags() & LAV_VIDEO_DEC_FLAG_DVD)
-    m_DisplayDelay /= 2;
-
   m_bFailHWDecode = FALSE;
+  m_SurfacePool.Reset();
 
   DbgLog((LOG_TRACE, 10, L"-> Creation of DXVA2 decoder successfull, initializing ffmpeg"));
   hr = CDecAvcodec::InitDecoder(codec, pmt);
@@ -931,6 +1023,9 @@ STDMETHODIMP CDecDXVA2::InitDecoder(AVCodecID codec, const CMediaType *pmt)
     return hr;
   }
 
+  // the reorder depth of the stream is known now
+  UpdateDisplayDelay();
+
   // If we have a DXVA Decoder, check if its capable
   // If we don't have one yet, it may be handed to us later, and compat is checked at that point
   GUID input = GUID_NULL;
@@ -967,6 +1062,8 @@ STDMETHODIMP CDecDXVA2::InitDecoder(AVCodecID codec, const CMediaType *pmt)
 
   m_MediaType = *pmt;
 
+  UpdateHWDeint(!m_bNative);
+
   return S_OK;
 }
 
@@ -995,15 +1092,18 @@ STDMETHODIMP_(long) CDecDXVA2::GetBufferCount(long *pMaxBuffers)
     buffers += 4;
   }
 
-  if (pMaxBuffers)
-  {
-    // cap at 127, because it needs to fit into the 7-bit DXVA structs
-    *pMaxBuffers = 127;
+  // cap at 127, because it needs to fit into the 7-bit DXVA structs
+  long maxBuffers = 127;
 
-    // VC-1 and VP9 decoding has stricter requirements (decoding flickers otherwise)
-    if (m_nCodecId == AV_CODEC_ID_VC1 || m_nCodecId == AV_CODEC_ID_VP9)
-      *pMaxBuffers = 32;
-  }
+  // VC-1 and VP9 decoding has stricter requirements (decoding flickers otherwise)
+  if (m_nCodecId == AV_CODEC_ID_VC1 || m_nCodecId == AV_CODEC_ID_VP9)
+    maxBuffers = 32;
+
+  // apply the surface pool policy, copy-back surfaces also have to fit into our surface array
+  buffers = m_SurfacePool.GetSurfaceCount(m_pSettings, buffers, m_bNative ? maxBuffers : min(maxBuffers, (long)DXVA2_MAX_SURFACES));
+
+  if (pMaxBuffers)
+    *pMaxBuffers = maxBuffers;
 
   return buffers;
 }
@@ -1066,13 +1166,15 @@ HRESULT CDecDXVA2::CreateDXVA2Decoder(int nSurfaces, IDirect3DSurface9 **ppSurfa
   D3DFORMAT output;
   FindVideoServiceConversion(m_pAVCtx->codec_id, m_pAVCtx->profile, &input, &output);
 
+  long nMaxSurfaces = nSurfaces;
   if (!nSurfaces) {
     m_dwSurfaceWidth = dxva_align_dimensions(m_pAVCtx->codec_id, m_pAVCtx->coded_width);
     m_dwSurfaceHeight = dxva_align_dimensions(m_pAVCtx->codec_id, m_pAVCtx->coded_height);
     m_eSurfaceFormat = output;
     m_DecoderPixelFormat = m_pAVCtx->sw_pix_fmt;
 
-    m_NumSurfaces = GetBufferCount();
+    m_NumSurfaces = GetBufferCount(&nMaxSurfaces);
+    nMaxSurfaces = min(nMaxSurfaces, (long)DXVA2_MAX_SURFACES);
     hr = m_pDXVADecoderService->CreateSurface(m_dwSurfaceWidth, m_dwSurfaceHeight, m_NumSurfaces - 1, output, D3DPOOL_DEFAULT, 0, DXVA2_VideoDecoderRenderTarget, pSurfaces, nullptr);
     if (FAILED(hr)) {
       DbgLog((LOG_TRACE, 10, L"-> Creation of surfaces failed with hr: %X", hr));
@@ -1101,15 +1203,20 @@ HRESULT CDecDXVA2::CreateDXVA2Decoder(int nSurfaces, IDirect3DSurface9 **ppSurfa
     m_pSurfaces[i].d3d = ppSurfaces[i];
     m_pSurfaces[i].age = UINT64_MAX;
     m_pSurfaces[i].used = false;
+    m_FreeSurfaces[i] = i;
 
     // fill the surface in black, to avoid the "green screen" in case the first frame fails to decode.
     if (pDev) pDev->ColorFill(ppSurfaces[i], NULL, D3DCOLOR_XYUV(0, 128, 128));
   }
 
+  m_FreeSurfacesHead = 0;
+  m_nFreeSurfaces = m_NumSurfaces;
+
   // and done with the device
   SafeRelease(&pDev);
 
   DbgLog((LOG_TRACE, 10, L"-> Successfully created %d surfaces (%dx%d)", m_NumSurfaces, m_dwSurfaceWidth, m_dwSurfaceHeight));
+  m_SurfacePool.OnCreate(m_NumSurfaces, nMaxSurfaces, dxva_surface_size(m_dwSurfaceWidth, m_dwSurfaceHeight, m_eSurfaceFormat == FOURCC_NV12 ? 1 : 2), m_pCallback->GetMemoryAccount());
 
   DXVA2_VideoDesc desc;
   ZeroMemory(&desc, sizeof(desc));
@@ -1183,7 +1290,35 @@ enum AVPixelFormat CDecDXVA2::get_dxva2_format(struct AVCodecContext *c, const e
   return *p;
 }
 
+// Take the surface which was released the longest time ago, or -1 if all of them are in use
+int CDecDXVA2::AcquireSurface()
+{
+  if (m_nFreeSurfaces == 0)
+    return -1;
+
+  const int index = m_FreeSurfaces[m_FreeSurfacesHead];
+  m_FreeSurfacesHead = (m_FreeSurfacesHead + 1) % DXVA2_MAX_SURFACES;
+  m_nFreeSurfaces--;
+  return index;
+}
+
+void CDecDXVA2::ReleaseSurface(int index)
+{
+  // a surface handed out twice while the decoder was stalled is only freed once
+  if (!m_pSurfaces[index].used)
+    return;
+
+  m_pSurfaces[index].used = false;
+
+  // the allocator keeps track of the free surfaces in native mode
+  if (!m_bNative && m_nFreeSurfaces < m_NumSurfaces) {
+    m_FreeSurfaces[(m_FreeSurfacesHead + m_nFreeSurfaces) % DXVA2_MAX_SURFACES] = index;
+    m_nFreeSurfaces++;
+  }
+}
+
 typedef struct SurfaceWrapper {
+  int index;
   LPDIRECT3DSURFACE9 surface;
   IMediaSample *sample;
   CDecDXVA2 *pDec;
@@ -1195,13 +1330,10 @@ void CDecDXVA2::free_dxva2_buffer(void *opaque, uint8_t *data)
   SurfaceWrapper *sw = (SurfaceWrapper *)opaque;
   CDecDXVA2 *pDec = sw->pDec;
 
+  // the surfaces may have been re-created since
   LPDIRECT3DSURFACE9 pSurface = sw->surface;
-  for (int i = 0; i < pDec->m_NumSurfaces; i++) {
-    if (pDec->m_pSurfaces[i].d3d == pSurface) {
-      pDec->m_pSurfaces[i].used = false;
-      break;
-    }
-  }
+  if (sw->index < pDec->m_NumSurfaces && pDec->m_pSurfaces[sw->index].d3d == pSurface)
+    pDec->ReleaseSurface(sw->index);
   SafeRelease(&pSurface);
   SafeRelease(&sw->pDXDecoder);
   SafeRelease(&sw->sample);
@@ -1258,6 +1390,7 @@ HRESULT CDecDXVA2::ReInitDXVA2Decoder(AVCodecContext *c)
       hr = m_pDXVA2Allocator->Commit();
     } else if (!m_bNative) {
       FlushDisplayQueue(TRUE);
+      UpdateDisplayDelay();
       hr = CreateDXVA2Decoder();
     }
   }
@@ -1292,10 +1425,14 @@ int CDecDXVA2::get_dxva2_buffer(struct AVCodecContext *c, AVFrame *pic, int flag
   }
 
   int i;
+  BOOL bStall = FALSE;
   if (pDec->m_bNative) {
     if (!pDec->m_pDXVA2Allocator)
       return -1;
 
+    // the allocator blocks until a sample is returned when all of them are in use
+    bStall = pDec->m_SurfacePool.GetInUse() >= (DWORD)pDec->m_NumSurfaces;
+
     hr = pDec->m_pDXVA2Allocator->GetBuffer(&pSample, nullptr, nullptr, 0);
     if (FAILED(hr)) {
       DbgLog((LOG_ERROR, 10, L"DXVA2Allocator returned error, hr: 0x%x", hr));
@@ -1312,19 +1449,17 @@ int CDecDXVA2::get_dxva2_buffer(struct AVCodecContext *c, AVFrame *pic, int flag
     i = pLavDXVA2->GetDXSurfaceId();
     SafeRelease(&pLavDXVA2);
   } else {
-    int old, old_unused;
-    for (i = 0, old = 0, old_unused = -1; i < pDec->m_NumSurfaces; i++) {
-      d3d_surface_t *surface = &pDec->m_pSurfaces[i];
-      if (!surface->used && (old_unused == -1 || surface->age < pDec->m_pSurfaces[old_unused].age))
-        old_unused = i;
-      if (surface->age < pDec->m_pSurfaces[old].age)
-        old = i;
-    }
-    if (old_unused == -1) {
+    i = pDec->AcquireSurface();
+    if (i == -1) {
+      // only the fallback has to look at all surfaces
+      int old = 0;
+      for (i = 1; i < pDec->m_NumSurfaces; i++) {
+        if (pDec->m_pSurfaces[i].age < pDec->m_pSurfaces[old].age)
+          old = i;
+      }
       DbgLog((LOG_TRACE, 10, L"No free surface, using oldest"));
       i = old;
-    } else {
-      i = old_unused;
+      bStall = TRUE;
     }
   }
 
@@ -1338,6 +1473,8 @@ int CDecDXVA2::get_dxva2_buffer(struct AVCodecContext *c, AVFrame *pic, int flag
   pDec->m_pSurfaces[i].age  = pDec->m_CurrentSurfaceAge++;
   pDec->m_pSurfaces[i].used = true;
 
+  pDec->m_SurfacePool.OnRequest(bStall);
+
   memset(pic->data, 0, sizeof(pic->data));
   memset(pic->linesize, 0, sizeof(pic->linesize));
   memset(pic->buf, 0, sizeof(pic->buf));
@@ -1346,6 +1483,7 @@ int CDecDXVA2::get_dxva2_buffer(struct AVCodecContext *c, AVFrame *pic, int flag
   pic->data[4] = (uint8_t *)pSample;
 
   SurfaceWrapper *surfaceWrapper = new SurfaceWrapper();
+  surfaceWrapper->index = i;
   surfaceWrapper->pDec = pDec;
   surfaceWrapper->sample = pSample;
   surfaceWrapper->surface = pSurface;
@@ -1354,10 +1492,21 @@ int CDecDXVA2::get_dxva2_buffer(struct AVCodecContext *c, AVFrame *pic, int flag
   surfaceWrapper->pDXDecoder->AddRef();
 
   pic->buf[0] = av_buffer_create(nullptr, 0, free_dxva2_buffer, surfaceWrapper, 0);
+  pDec->m_SurfacePool.TrackFrame(pic);
 
   return 0;
 }
 
+STDMETHODIMP CDecDXVA2::Reconfigure(AVCodecID codec, const CMediaType *pmt)
+{
+  // the device, decoder and surfaces are kept, and are re-created on demand if the stream requires it
+  HRESULT hr = CDecAvcodec::Reconfigure(codec, pmt);
+  if (hr == S_OK)
+    FlushDisplayQueue(FALSE);
+
+  return hr;
+}
+
 HRESULT CDecDXVA2::AdditionaDecoderInit()
 {
   /* Create ffmpeg dxva_context, but only fill it if we have a decoder already. */
@@ -1418,8 +1567,13 @@ STDMETHODIMP CDecDXVA2::Flush()
   }
 #endif
 
+  // Re-create the copy-back surfaces with a bigger pool if the decoder ran out of surfaces,
+  // or with a smaller one if the system is low on memory
+  if (!m_bNative && m_pDecoder && (m_SurfacePool.Grow(m_pSettings) || m_SurfacePool.Shrink())) {
+    CreateDXVA2Decoder();
+  }
   // This solves an issue with corruption after seeks on AMD systems, see JIRA LAV-5
-  if (m_dwVendorId == VEND_ID_ATI && m_nCodecId == AV_CODEC_ID_H264 && m_pDecoder) {
+  else if (m_dwVendorId == VEND_ID_ATI && m_nCodecId == AV_CODEC_ID_H264 && m_pDecoder) {
     if (m_bNative && m_pDXVA2Allocator) {
       // The allocator needs to be locked because flushes can happen async to other graph events
       // and in the worst case the allocator is decommited while we're using it.
@@ -1433,6 +1587,35 @@ STDMETHODIMP CDecDXVA2::Flush()
   return S_OK;
 }
 
+// Decoded frames are queued before they are copied back, to give the GPU time to finish them
+// Without reordering, every frame is output as soon as it was decoded, and the queue is all of the latency of the
+// decoder, so it is kept short. Frames of streams with reordering are held back by avcodec already, they use the full
+// queue for smooth copy-back. Needs an empty queue, the number of surfaces depends on it.
+void CDecDXVA2::UpdateDisplayDelay()
+{
+  // avcodec raises the delay once it finds frames out of order
+  int reorder = m_iReorderDepth;
+  if (reorder >= 0 && m_pAVCtx && m_pAVCtx->has_b_frames > reorder)
+    reorder = m_pAVCtx->has_b_frames;
+
+  m_DisplayDelay = (reorder == 0) ? DXVA2_QUEUE_SURFACES / 2 : DXVA2_QUEUE_SURFACES;
+
+  // Intel GPUs don't like the display and performance goes way down, so disable it.
+  if (m_dwVendorId == VEND_ID_INTEL)
+    m_DisplayDelay = 0;
+
+  // Reduce display delay for DVD decoding for lower decode latency
+  if (m_pCallback->GetDecodeFlags() & LAV_VIDEO_DEC_FLAG_DVD)
+    m_DisplayDelay /= 2;
+
+  // Hand out every surface right away for low-delay decoding
+  if (m_pCallback->GetDecodeFlags() & LAV_VIDEO_DEC_FLAG_LOW_DELAY)
+    m_DisplayDelay = 0;
+
+  m_FrameQueuePosition = 0;
+  DbgLog((LOG_TRACE, 10, L"CDecDXVA2::UpdateDisplayDelay(): Queueing %d frames (reorder depth: %d)", m_DisplayDelay, reorder));
+}
+
 STDMETHODIMP CDecDXVA2::FlushDisplayQueue(BOOL bDeliver)
 {
   for (int i=0; i < m_DisplayDelay; ++i) {
@@ -1497,6 +1680,12 @@ HRESULT CDecDXVA2::DeliverDXVA2Frame(LAVFrame *pFrame)
     GetPixelFormat(&pFrame->format, &pFrame->bpp);
     Deliver(pFrame);
   } else {
+    // deinterlace on the GPU, and copy the resulting frames back
+    if (m_bHWDeint && pFrame->interlaced) {
+      if (DeliverDeinterlacedFrame(pFrame) != S_FALSE)
+        return S_OK;
+    }
+
     if (m_bDirect) {
       DeliverDirect(pFrame);
     } else {
@@ -1524,12 +1713,14 @@ STDMETHODIMP CDecDXVA2::GetPixelFormat(LAVPixelFormat *pPix, int *pBpp)
   return S_OK;
 }
 
-__forceinline bool CDecDXVA2::CopyFrame(LAVFrame *pFrame)
+__forceinline bool CDecDXVA2::CopyFrame(LAVFrame *pFrame, LPDIRECT3DSURFACE9 pSourceSurface)
 {
   HRESULT hr;
-  LPDIRECT3DSURFACE9 pSurface = (LPDIRECT3DSURFACE9)pFrame->data[3];
+  LPDIRECT3DSURFACE9 pSurface = pSourceSurface ? pSourceSurface : (LPDIRECT3DSURFACE9)pFrame->data[3];
   GetPixelFormat(&pFrame->format, &pFrame->bpp);
 
+  REFERENCE_TIME rtCopyStart = timer_get_ref_time();
+
   D3DSURFACE_DESC surfaceDesc;
   pSurface->GetDesc(&surfaceDesc);
 
@@ -1558,16 +1749,193 @@ __forceinline bool CDecDXVA2::CopyFrame(LAVFrame *pFrame)
   }
 
   // Copy surface onto memory buffers
-  CopyFrameNV12((BYTE *)LockedRect.pBits, pFrame->data[0], pFrame->data[1], surfaceDesc.Height, pFrame->height, LockedRect.Pitch);
+  // Intel GPUs benefit from multi-threaded copies
+  gpu_copy_frame_nv12((BYTE *)LockedRect.pBits, pFrame->data[0], pFrame->data[1], surfaceDesc.Height, pFrame->height, LockedRect.Pitch, m_dwVendorId == VEND_ID_INTEL);
 
   pSurface->UnlockRect();
 
+  m_pCallback->AddStageTime(VideoStage_GPUCopyBack, timer_get_ref_time() - rtCopyStart);
+
   // Free AVFrame based buffers, now that we're done
   FreeLAVFrameBuffers(&tmpFrame);
 
   return true;
 }
 
+HRESULT CDecDXVA2::CreateDXVA2Deinterlacer(LPDIRECT3DSURFACE9 pSourceSurface)
+{
+  HRESULT hr = S_OK;
+
+  if (m_pDXVAProcessorService == nullptr) {
+    hr = m_pD3DDevMngr->GetVideoService(m_hDevice, IID_IDirectXVideoProcessorService, (void**)&m_pDXVAProcessorService);
+    if (FAILED(hr)) {
+      DbgLog((LOG_ERROR, 10, L"-> Acquiring VideoProcessorService failed"));
+      return hr;
+    }
+  }
+
+  D3DSURFACE_DESC surfaceDesc;
+  pSourceSurface->GetDesc(&surfaceDesc);
+
+  ZeroMemory(&m_DeintVideoDesc, sizeof(m_DeintVideoDesc));
+  m_DeintVideoDesc.SampleWidth  = surfaceDesc.Width;
+  m_DeintVideoDesc.SampleHeight = surfaceDesc.Height;
+  m_DeintVideoDesc.Format       = surfaceDesc.Format;
+  m_DeintVideoDesc.SampleFormat.SampleFormat           = DXVA2_SampleFieldInterleavedEvenFirst;
+  m_DeintVideoDesc.SampleFormat.VideoChromaSubsampling = DXVA2_VideoChromaSubsampling_MPEG2;
+  m_DeintVideoDesc.SampleFormat.NominalRange           = DXVA2_NominalRange_16_235;
+
+  REFERENCE_TIME rtFrameDuration = GetFrameDuration();
+  if (rtFrameDuration > 0) {
+    m_DeintVideoDesc.InputSampleFreq.Numerator   = (UINT)REF_SECOND_MULT;
+    m_DeintVideoDesc.InputSampleFreq.Denominator = (UINT)rtFrameDuration;
+    m_DeintVideoDesc.OutputFrameFreq.Numerator   = (UINT)(REF_SECOND_MULT * 2);
+    m_DeintVideoDesc.OutputFrameFreq.Denominator = (UINT)rtFrameDuration;
+  }
+
+  UINT nGuids = 0;
+  GUID *pGuids = nullptr;
+  hr = m_pDXVAProcessorService->GetVideoProcessorDeviceGuids(&m_DeintVideoDesc, &nGuids, &pGuids);
+  if (FAILED(hr)) {
+    DbgLog((LOG_ERROR, 10, L"-> Enumerating video processor devices failed"));
+    return hr;
+  }
+
+  // the devices are reported in order of quality, use the first one that deinterlaces
+  // only the current frame is passed to the processor, so devices that need reference frames are skipped
+  for (UINT i = 0; i < nGuids && m_pDeintProcessor == nullptr; i++) {
+    const GUID &guid = pGuids[i];
+    if (guid == DXVA2_VideoProcProgressiveDevice || guid == DXVA2_VideoProcSoftwareDevice)
+      continue;
+
+    DXVA2_VideoProcessorCaps caps;
+    if (FAILED(m_pDXVAProcessorService->GetVideoProcessorCaps(guid, &m_DeintVideoDesc, surfaceDesc.Format, &caps)))
+      continue;
+
+    if (caps.DeinterlaceTechnology == DXVA2_DeinterlaceTech_Unknown || caps.NumBackwardRefSamples > 0 || caps.NumForwardRefSamples > 0)
+      continue;
+
+    // the output needs to be in the surface format to be copied back like a decoded frame
+    UINT nFormats = 0;
+    D3DFORMAT *pFormats = nullptr;
+    bool bFormatSupported = false;
+    if (SUCCEEDED(m_pDXVAProcessorService->GetVideoProcessorRenderTargets(guid, &m_DeintVideoDesc, &nFormats, &pFormats))) {
+      for (UINT k = 0; k < nFormats; k++) {
+        if (pFormats[k] == surfaceDesc.Format) {
+          bFormatSupported = true;
+          break;
+        }
+      }
+      CoTaskMemFree(pFormats);
+    }
+
+    if (!bFormatSupported)
+      continue;
+
+    hr = m_pDXVAProcessorService->CreateVideoProcessor(guid, &m_DeintVideoDesc, surfaceDesc.Format, 0, &m_pDeintProcessor);
+    if (SUCCEEDED(hr)) {
+      DbgLog((LOG_TRACE, 10, L"-> Using video processor device %d for deinterlacing (technology: 0x%x)", i, caps.DeinterlaceTechnology));
+    }
+  }
+  CoTaskMemFree(pGuids);
+
+  if (m_pDeintProcessor == nullptr) {
+    DbgLog((LOG_TRACE, 10, L"-> No suitable video processor device for deinterlacing found"));
+    return E_FAIL;
+  }
+
+  // one back buffer, for a total of two surfaces
+  hr = m_pDXVAProcessorService->CreateSurface(surfaceDesc.Width, surfaceDesc.Height, 1, surfaceDesc.Format, D3DPOOL_DEFAULT, 0, DXVA2_VideoProcessorRenderTarget, m_pDeintSurfaces, nullptr);
+  if (FAILED(hr)) {
+    DbgLog((LOG_ERROR, 10, L"-> Creation of the video processor render targets failed with hr: %X", hr));
+    return hr;
+  }
+
+  return S_OK;
+}
+
+void CDecDXVA2::ReleaseDXVA2Deinterlacer()
+{
+  SafeRelease(&m_pDeintSurfaces[0]);
+  SafeRelease(&m_pDeintSurfaces[1]);
+  SafeRelease(&m_pDeintProcessor);
+}
+
+HRESULT CDecDXVA2::DeliverDeinterlacedFrame(LAVFrame *pFrame)
+{
+  HRESULT hr = S_OK;
+  LPDIRECT3DSURFACE9 pSurface = (LPDIRECT3DSURFACE9)pFrame->data[3];
+
+  if (m_pDeintProcessor == nullptr) {
+    hr = CreateDXVA2Deinterlacer(pSurface);
+    if (FAILED(hr)) {
+      DbgLog((LOG_ERROR, 10, L"-> Creating the DXVA2 video processor failed, disabling hardware deinterlacing"));
+      ReleaseDXVA2Deinterlacer();
+      m_bHWDeint = FALSE;
+      return S_FALSE;
+    }
+  }
+
+  RECT rcFrame = { 0, 0, (LONG)m_DeintVideoDesc.SampleWidth, (LONG)m_DeintVideoDesc.SampleHeight };
+
+  // the sample covers both fields, the target time selects the field
+  DXVA2_VideoSample sample = { 0 };
+  sample.Start        = 0;
+  sample.End          = 2;
+  sample.SampleFormat = m_DeintVideoDesc.SampleFormat;
+  sample.SampleFormat.SampleFormat = pFrame->tff ? DXVA2_SampleFieldInterleavedEvenFirst : DXVA2_SampleFieldInterleavedOddFirst;
+  sample.SrcSurface   = pSurface;
+  sample.SrcRect      = rcFrame;
+  sample.DstRect      = rcFrame;
+  sample.PlanarAlpha  = DXVA2_Fixed32OpaqueAlpha();
+
+  DXVA2_VideoProcessBltParams blt = { 0 };
+  blt.TargetRect = rcFrame;
+  blt.BackgroundColor.Y     = 0x1000;
+  blt.BackgroundColor.Cb    = 0x8000;
+  blt.BackgroundColor.Cr    = 0x8000;
+  blt.BackgroundColor.Alpha = 0xffff;
+  blt.DestFormat = m_DeintVideoDesc.SampleFormat;
+  blt.DestFormat.SampleFormat = DXVA2_SampleProgressiveFrame;
+  blt.ProcAmpValues.Brightness = DXVA2FloatToFixed(0.0f);
+  blt.ProcAmpValues.Contrast   = DXVA2FloatToFixed(1.0f);
+  blt.ProcAmpValues.Hue        = DXVA2FloatToFixed(0.0f);
+  blt.ProcAmpValues.Saturation = DXVA2FloatToFixed(1.0f);
+  blt.Alpha = DXVA2_Fixed32OpaqueAlpha();
+
+  // in double-rate mode, every field turns into its own frame
+  LAVFrame *pSecondField = nullptr;
+  SplitDeinterlacedFrame(pFrame, &pSecondField);
+
+  LAVFrame *pFields[2] = { pFrame, pSecondField };
+  for (int nField = 0; nField < 2 && SUCCEEDED(hr); nField++) {
+    if (pFields[nField] == nullptr)
+      continue;
+
+    blt.TargetFrame = nField;
+    hr = m_pDeintProcessor->VideoProcessBlt(m_pDeintSurfaces[nField], &blt, &sample, 1, nullptr);
+  }
+
+  if (FAILED(hr)) {
+    DbgLog((LOG_TRACE, 10, L"VideoProcessBlt failed (hr: %X)", hr));
+    ReleaseFrame(&pSecondField);
+    ReleaseFrame(&pFrame);
+    return E_FAIL;
+  }
+
+  // copy back the fields, the first copy releases the decoder surface
+  for (int nField = 0; nField < 2; nField++) {
+    if (pFields[nField] == nullptr)
+      continue;
+
+    if (CopyFrame(pFields[nField], m_pDeintSurfaces[nField]))
+      Deliver(pFields[nField]);
+    else
+      ReleaseFrame(&pFields[nField]);
+  }
+
+  return S_OK;
+}
 
 static bool direct_lock(LAVFrame * pFrame, LAVDirectBuffer *pBuffer)
 {
@@ -21,6 +21,8 @@
 #include "DecBase.h"
 #include "avcodec.h"
 #include "libavcodec/dxva2.h"
+#include "dxva2/dxva_common.h"
+#include "dxva2/AdapterRegistry.h"
 
 #define DXVA2_MAX_SURFACES 64
 #define DXVA2_QUEUE_SURFACES 4
@@ -45,6 +47,7 @@ public:
 
   // ILAVDecoder
   STDMETHODIMP InitDecoder(AVCodecID codec, const CMediaType *pmt);
+  STDMETHODIMP Reconfigure(AVCodecID codec, const CMediaType *pmt);
   STDMETHODIMP GetPixelFormat(LAVPixelFormat *pPix, int *pBpp);
   STDMETHODIMP Flush();
   STDMETHODIMP EndOfStream();
@@ -55,6 +58,7 @@ public:
   STDMETHODIMP_(const WCHAR*) GetDecoderName() { return m_bNative ? L"dxva2n" : (m_bDirect ? L"dxva2cb direct" : L"dxva2cb"); }
   STDMETHODIMP HasThreadSafeBuffers() { return m_bNative ? S_FALSE : S_OK; }
   STDMETHODIMP SetDirectOutput(BOOL bDirect) { m_bDirect = bDirect; return S_OK; }
+  STDMETHODIMP GetSurfacePoolStatus(LAVHWSurfacePoolStatus *pStatus) { return m_SurfacePool.GetStatus(pStatus); }
   STDMETHODIMP_(DWORD) GetHWAccelNumDevices();
   STDMETHODIMP GetHWAccelDeviceInfo(DWORD dwIndex, BSTR *pstrDeviceName, DWORD *dwDeviceIdentifier);
   STDMETHODIMP GetHWAccelActiveDevice(BSTR *pstrDeviceName);
@@ -70,13 +74,17 @@ protected:
   HRESULT HandleDXVA2Frame(LAVFrame *pFrame);
   HRESULT DeliverDXVA2Frame(LAVFrame *pFrame);
 
-  bool CopyFrame(LAVFrame *pFrame);
+  bool CopyFrame(LAVFrame *pFrame, LPDIRECT3DSURFACE9 pSourceSurface = nullptr);
   bool DeliverDirect(LAVFrame *pFrame);
+  HRESULT DeliverDeinterlacedFrame(LAVFrame *pFrame);
 
 private:
   HRESULT InitD3D(UINT lAdapter);
   HRESULT InitD3DEx(UINT lAdapter);
   HRESULT InitD3DAdapterIdentifier(UINT lAdapter);
+  UINT AcquireBalancedAdapter();
+  HRESULT InitCachedD3D(UINT lAdapter);
+  void CacheD3D(UINT lAdapter);
   STDMETHODIMP DestroyDecoder(bool bFull, bool bNoAVCodec = false);
   STDMETHODIMP FreeD3DResources();
   STDMETHODIMP LoadDXVA2Functions();
@@ -95,12 +103,19 @@ private:
 
   HRESULT ReInitDXVA2Decoder(AVCodecContext *c);
 
+  HRESULT CreateDXVA2Deinterlacer(LPDIRECT3DSURFACE9 pSourceSurface);
+  void ReleaseDXVA2Deinterlacer();
+
+  int AcquireSurface();
+  void ReleaseSurface(int index);
+
   static enum AVPixelFormat get_dxva2_format(struct AVCodecContext *s, const enum AVPixelFormat * pix_fmts);
   static int get_dxva2_buffer(struct AVCodecContext *c, AVFrame *pic, int flags);
   static void free_dxva2_buffer(void *opaque, uint8_t *data);
 
   STDMETHODIMP FlushDisplayQueue(BOOL bDeliver);
   STDMETHODIMP FlushFromAllocator();
+  void UpdateDisplayDelay();
 
 private:
   friend class CDXVA2SurfaceAllocator;
@@ -120,6 +135,7 @@ private:
   IDirect3DDevice9        *m_pD3DDev       = nullptr;
   IDirect3DDeviceManager9 *m_pD3DDevMngr   = nullptr;
   UINT                    m_pD3DResetToken = 0;
+  AVBufferRef             *m_pCachedDevice = nullptr;
   HANDLE                  m_hDevice        = INVALID_HANDLE_VALUE;
 
   IDirectXVideoDecoderService *m_pDXVADecoderService = nullptr;
@@ -130,8 +146,23 @@ private:
   d3d_surface_t      m_pSurfaces[DXVA2_MAX_SURFACES];
   uint64_t           m_CurrentSurfaceAge = 1;
 
+  // unused copy-back surfaces, in the order they were released
+  int                m_FreeSurfaces[DXVA2_MAX_SURFACES];
+  int                m_FreeSurfacesHead  = 0;
+  int                m_nFreeSurfaces     = 0;
+
+  CDXVASurfacePool   m_SurfacePool;
+
+  CAdapterRegistry   m_AdapterRegistry;
+
   LPDIRECT3DSURFACE9 m_pRawSurface[DXVA2_MAX_SURFACES];
 
+  // video processor used to deinterlace before copy-back, with one render target per field
+  IDirectXVideoProcessorService *m_pDXVAProcessorService = nullptr;
+  IDirectXVideoProcessor        *m_pDeintProcessor       = nullptr;
+  LPDIRECT3DSURFACE9            m_pDeintSurfaces[2]      = { nullptr, nullptr };
+  DXVA2_VideoDesc               m_DeintVideoDesc;
+
   BOOL m_bFailHWDecode = FALSE;
 
   LAVFrame* m_FrameQueue[DXVA2_QUEUE_SURFACES];
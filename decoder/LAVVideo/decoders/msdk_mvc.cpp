@@ -142,10 +142,7 @@ void CDecMSDKMVC::DestroyDecoder(bool bFull)
 
   {
     CAutoLock lock(&m_BufferCritSec);
-    for (int i = 0; i < ASYNC_QUEUE_SIZE; i++) {
-      ReleaseBuffer(&m_pOutputQueue[i]->surface);
-    }
-    memset(m_pOutputQueue, 0, sizeof(m_pOutputQueue));
+    ClearOutputQueue();
 
     for (auto it = m_BufferQueue.begin(); it != m_BufferQueue.end(); it++) {
       if (!(*it)->queued) {
@@ -662,25 +659,67 @@ void CDecMSDKMVC::GetOffsetSideData(LAVFrame *pFrame, mfxU64 timestamp)
 
 HRESULT CDecMSDKMVC::HandleOutput(MVCBuffer * pOutputBuffer)
 {
-  int nCur = m_nOutputQueuePosition, nNext = (m_nOutputQueuePosition + 1) % ASYNC_QUEUE_SIZE;
-  if (m_pOutputQueue[nCur] && m_pOutputQueue[nNext]) {
-    DeliverOutput(m_pOutputQueue[nCur], m_pOutputQueue[nNext]);
+  m_OutputQueue.push_back(pOutputBuffer);
+  return ProcessOutputQueue(FALSE);
+}
+
+// Deliver the view pairs which finished decoding
+// Frames are only waited for once the queue is full, or when draining, so the decoder keeps several frames in flight
+HRESULT CDecMSDKMVC::ProcessOutputQueue(BOOL bDrain)
+{
+  HRESULT hr = S_OK;
 
-    m_pOutputQueue[nCur] = nullptr;
-    m_pOutputQueue[nNext] = nullptr;
+  while (m_OutputQueue.size() >= 2) {
+    MVCBuffer *pBaseView = m_OutputQueue[0];
+    MVCBuffer *pExtraView = m_OutputQueue[1];
+
+    if (pBaseView->surface.Info.FrameId.ViewId != 0 || pExtraView->surface.Info.FrameId.ViewId == 0) {
+      DbgLog((LOG_TRACE, 10, L"CDevMSDKMVC::ProcessOutputQueue(): Dropping unpaired frame"));
+
+      ReleaseBuffer(&pBaseView->surface);
+      m_OutputQueue.pop_front();
+      continue;
+    }
+
+    if (!bDrain && m_OutputQueue.size() <= ASYNC_QUEUE_SIZE && !(IsOutputReady(pBaseView) && IsOutputReady(pExtraView)))
+      break;
+
+    m_OutputQueue.pop_front();
+    m_OutputQueue.pop_front();
+
+    hr = DeliverOutput(pBaseView, pExtraView);
   }
-  else if (m_pOutputQueue[nCur]) {
-    DbgLog((LOG_TRACE, 10, L"CDevMSDKMVC::HandleOutput(): Dropping unpaired frame"));
 
-    ReleaseBuffer(&m_pOutputQueue[nCur]->surface);
-    m_pOutputQueue[nCur]->sync = nullptr;
-    m_pOutputQueue[nCur] = nullptr;
+  if (bDrain && !m_OutputQueue.empty()) {
+    DbgLog((LOG_TRACE, 10, L"CDevMSDKMVC::ProcessOutputQueue(): Dropping unpaired frame"));
+    ClearOutputQueue();
   }
 
-  m_pOutputQueue[nCur] = pOutputBuffer;
-  m_nOutputQueuePosition = nNext;
+  return hr;
+}
 
-  return S_OK;
+void CDecMSDKMVC::ClearOutputQueue()
+{
+  for (MVCBuffer *pBuffer : m_OutputQueue)
+    ReleaseBuffer(&pBuffer->surface);
+  m_OutputQueue.clear();
+}
+
+// Check the sync point without waiting, a completed view no longer needs to be synced
+BOOL CDecMSDKMVC::IsOutputReady(MVCBuffer * pBuffer)
+{
+  if (pBuffer->sync == nullptr)
+    return TRUE;
+
+  mfxStatus sts = MFXVideoCORE_SyncOperation(m_mfxSession, pBuffer->sync, 0);
+  if (sts == MFX_WRN_IN_EXECUTION)
+    return FALSE;
+
+  if (sts != MFX_ERR_NONE)
+    DbgLog((LOG_TRACE, 10, L"CDevMSDKMVC::IsOutputReady(): Sync operation failed (%d)", sts));
+
+  pBuffer->sync = nullptr;
+  return TRUE;
 }
 
 HRESULT CDecMSDKMVC::DeliverOutput(MVCBuffer * pBaseView, MVCBuffer * pExtraView)
@@ -691,16 +730,18 @@ HRESULT CDecMSDKMVC::DeliverOutput(MVCBuffer * pBaseView, MVCBuffer * pExtraView
   ASSERT(pBaseView->surface.Data.FrameOrder == pExtraView->surface.Data.FrameOrder);
 
   // Sync base view
-  do {
+  while (pBaseView->sync) {
     sts = MFXVideoCORE_SyncOperation(m_mfxSession, pBaseView->sync, 1000);
-  } while (sts == MFX_WRN_IN_EXECUTION);
-  pBaseView->sync = nullptr;
+    if (sts != MFX_WRN_IN_EXECUTION)
+      pBaseView->sync = nullptr;
+  }
 
   // Sync extra view
-  do {
+  while (pExtraView->sync) {
     sts = MFXVideoCORE_SyncOperation(m_mfxSession, pExtraView->sync, 1000);
-  } while (sts == MFX_WRN_IN_EXECUTION);
-  pExtraView->sync = nullptr;
+    if (sts != MFX_WRN_IN_EXECUTION)
+      pExtraView->sync = nullptr;
+  }
 
   LAVFrame *pFrame = nullptr;
   AllocateFrame(&pFrame);
@@ -777,10 +818,7 @@ STDMETHODIMP CDecMSDKMVC::Flush()
       MFXVideoDECODE_Reset(m_mfxSession, &m_mfxVideoParams);
     // TODO: decode sequence data
 
-    for (int i = 0; i < ASYNC_QUEUE_SIZE; i++) {
-      ReleaseBuffer(&m_pOutputQueue[i]->surface);
-    }
-    memset(m_pOutputQueue, 0, sizeof(m_pOutputQueue));
+    ClearOutputQueue();
   }
 
   m_GOPs.clear();
@@ -798,24 +836,7 @@ STDMETHODIMP CDecMSDKMVC::EndOfStream()
   Decode(nullptr, 0, AV_NOPTS_VALUE, AV_NOPTS_VALUE, FALSE, FALSE, nullptr);
 
   // Process all remaining frames in the queue
-  for (int i = 0; i < ASYNC_QUEUE_SIZE; i++) {
-    int nCur = (m_nOutputQueuePosition + i) % ASYNC_QUEUE_SIZE, nNext = (m_nOutputQueuePosition + i + 1) % ASYNC_QUEUE_SIZE;
-    if (m_pOutputQueue[nCur] && m_pOutputQueue[nNext]) {
-      DeliverOutput(m_pOutputQueue[nCur], m_pOutputQueue[nNext]);
-
-      m_pOutputQueue[nCur] = nullptr;
-      m_pOutputQueue[nNext] = nullptr;
-
-      i++;
-    }
-    else if (m_pOutputQueue[nCur]) {
-      DbgLog((LOG_TRACE, 10, L"CDevMSDKMVC::EndOfStream(): Dropping unpaired frame"));
-
-      ReleaseBuffer(&m_pOutputQueue[nCur]->surface);
-      m_pOutputQueue[nCur] = nullptr;
-    }
-  }
-  m_nOutputQueuePosition = 0;
+  ProcessOutputQueue(TRUE);
 
   return S_OK;
 }
@@ -28,6 +28,8 @@
 #include <vector>
 
 #define ASYNC_DEPTH 8
+
+// Maximum number of decoded views waiting for their sync point, before the oldest view pair is waited for
 #define ASYNC_QUEUE_SIZE (ASYNC_DEPTH + 2)
 
 // 10s timestamp offset to avoid negative timestamps
@@ -74,6 +76,9 @@ private:
   void ReleaseBuffer(mfxFrameSurface1 * pSurface);
 
   HRESULT HandleOutput(MVCBuffer * pOutputBuffer);
+  HRESULT ProcessOutputQueue(BOOL bDrain);
+  void ClearOutputQueue();
+  BOOL IsOutputReady(MVCBuffer * pBuffer);
   HRESULT DeliverOutput(MVCBuffer * pBaseView, MVCBuffer * pExtraView);
 
   HRESULT ParseSEI(const BYTE *buffer, size_t size, mfxU64 timestamp);
@@ -105,8 +110,8 @@ private:
   GrowableArray<BYTE>  m_buff;
   int                  m_nMP4NALUSize = 0;
 
-  MVCBuffer           *m_pOutputQueue[ASYNC_QUEUE_SIZE] = { 0 };
-  int                  m_nOutputQueuePosition = 0;
+  // Decoded views in decoding order, each base view is followed by its extra view
+  std::deque<MVCBuffer *> m_OutputQueue;
 
   std::deque<MVCGOP>    m_GOPs;
   MediaSideData3DOffset m_PrevOffset;
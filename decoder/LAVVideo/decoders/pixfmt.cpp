@@ -19,6 +19,12 @@
 
 #include "stdafx.h"
 #include "ILAVDecoder.h"
+#include "NumaPlacement.h"
+#include "LargePages.h"
+#include "MemoryAccount.h"
+#include "MemoryPressure.h"
+
+#include <deque>
 
 static LAVPixFmtDesc lav_pixfmt_desc[] = {
   { 1, 3, { 1, 2, 2 }, { 1, 2, 2 } },       ///< LAVPixFmt_YUV420
@@ -86,18 +92,222 @@ AVPixelFormat getFFPixelFormatFromLAV(LAVPixelFormat pixFmt, int bpp)
   return fmt;
 }
 
+// Plane buffers of a frame, as allocated by AllocLAVFrameBuffers
+typedef struct LAVFrameBuffers {
+  LAVPixelFormat format;
+  int width;
+  int height;
+  ptrdiff_t stride;
+  bool mvc;
+  int node;                 ///< NUMA node of the memory, or -1 for the heap
+
+  BYTE *data[4];
+  BYTE *stereo[4];
+  void *block;              ///< Large page allocation holding all planes, or nullptr if they are allocated one by one
+
+  size_t size;              ///< Bytes allocated for all planes
+  CMemoryAccount *account;  ///< Account of the frame using the buffers, holding a reference, or nullptr
+} LAVFrameBuffers;
+
+// Plane start and stride alignment, suitable for loads and stores of full 512-bit vectors
+#define LAV_FRAME_ALIGN 64
+
+// Frames of at least this size (4K and larger) are allocated from large pages, if the process can use them
+#define LAV_FRAME_LARGE_PAGE_SIZE (8 << 20)
+
+// Maximum number of unused buffer sets kept around for re-use
+#define LAV_FRAME_BUFFER_POOL_SIZE 8
+// Limit while any decoder uses the low footprint profile
+#define LAV_FRAME_BUFFER_POOL_SIZE_LOW_FOOTPRINT 2
+
+// Charge buffers in use to the account of their frame, frames without one are only counted for the process
+static void charge_buffers(LAVFrameBuffers *pBuffers, CMemoryAccount *pAccount)
+{
+  pBuffers->account = pAccount;
+  if (pAccount) {
+    pAccount->AddRef();
+    pAccount->Add(LAVMemory_FrameBuffers, pBuffers->size);
+  } else {
+    CMemoryAccount::AddProcess(LAVMemory_FrameBuffers, pBuffers->size);
+  }
+}
+
+static void uncharge_buffers(LAVFrameBuffers *pBuffers)
+{
+  if (pBuffers->account) {
+    pBuffers->account->Add(LAVMemory_FrameBuffers, -(LONGLONG)pBuffers->size);
+    SafeRelease(&pBuffers->account);
+  } else {
+    CMemoryAccount::AddProcess(LAVMemory_FrameBuffers, -(LONGLONG)pBuffers->size);
+  }
+}
+
+// Pool of frame buffers shared by all decoders, frames usually have the same
+// format and dimensions for a long time, and re-using their buffers avoids
+// a large allocation (and the page faults of touching fresh memory) for every frame.
+// Unused buffers in the pool are charged to the process only, and released while the system is low on memory.
+class CLAVFrameBufferPool
+{
+public:
+  ~CLAVFrameBufferPool()
+  {
+    // the process usage is gone at this point, the remaining buffers are not accounted anymore
+    for (LAVFrameBuffers *pBuffers : m_Pool)
+      Free(pBuffers);
+  }
+
+  LAVFrameBuffers *Get(LAVPixelFormat format, int width, int height, ptrdiff_t stride, bool mvc, int node)
+  {
+    CAutoLock lock(&m_csPool);
+    // most recently released buffers are at the end of the pool
+    for (auto it = m_Pool.rbegin(); it != m_Pool.rend(); it++) {
+      LAVFrameBuffers *pBuffers = *it;
+      if (pBuffers->format == format && pBuffers->width == width && pBuffers->height == height && pBuffers->stride == stride && pBuffers->mvc == mvc && pBuffers->node == node) {
+        m_Pool.erase(std::next(it).base());
+        CMemoryAccount::AddProcess(LAVMemory_FrameBuffers, -(LONGLONG)pBuffers->size);
+        return pBuffers;
+      }
+    }
+    return nullptr;
+  }
+
+  void Put(LAVFrameBuffers *pBuffers)
+  {
+    uncharge_buffers(pBuffers);
+
+    CAutoLock lock(&m_csPool);
+    if (memory_pressure_low()) {
+      for (LAVFrameBuffers *pPooled : m_Pool) {
+        CMemoryAccount::AddProcess(LAVMemory_FrameBuffers, -(LONGLONG)pPooled->size);
+        Free(pPooled);
+      }
+      m_Pool.clear();
+      Free(pBuffers);
+      return;
+    }
+
+    m_Pool.push_back(pBuffers);
+    CMemoryAccount::AddProcess(LAVMemory_FrameBuffers, pBuffers->size);
+
+    // evict the least recently used buffers
+    while (m_Pool.size() > GetSize()) {
+      CMemoryAccount::AddProcess(LAVMemory_FrameBuffers, -(LONGLONG)m_Pool.front()->size);
+      Free(m_Pool.front());
+      m_Pool.pop_front();
+    }
+  }
+
+  void Clear()
+  {
+    CAutoLock lock(&m_csPool);
+    for (LAVFrameBuffers *pBuffers : m_Pool) {
+      CMemoryAccount::AddProcess(LAVMemory_FrameBuffers, -(LONGLONG)pBuffers->size);
+      Free(pBuffers);
+    }
+    m_Pool.clear();
+  }
+
+  void SetLowFootprint(bool bEnable)
+  {
+    if (bEnable)
+      InterlockedIncrement(&m_nLowFootprint);
+    else
+      InterlockedDecrement(&m_nLowFootprint);
+  }
+
+  size_t GetSize() const
+  {
+    return m_nLowFootprint > 0 ? LAV_FRAME_BUFFER_POOL_SIZE_LOW_FOOTPRINT : LAV_FRAME_BUFFER_POOL_SIZE;
+  }
+
+  static void Free(LAVFrameBuffers *pBuffers)
+  {
+    if (pBuffers->block) {
+      large_page_free(pBuffers->block);
+      delete pBuffers;
+      return;
+    }
+
+    for (int i = 0; i < 4; i++) {
+      if (pBuffers->node >= 0) {
+        numa_free(pBuffers->data[i]);
+        numa_free(pBuffers->stereo[i]);
+      } else {
+        _aligned_free(pBuffers->data[i]);
+        _aligned_free(pBuffers->stereo[i]);
+      }
+    }
+    delete pBuffers;
+  }
+
+private:
+  CCritSec m_csPool;
+  std::deque<LAVFrameBuffers *> m_Pool;
+
+  // number of decoders using the low footprint profile
+  volatile LONG m_nLowFootprint = 0;
+};
+
+static CLAVFrameBufferPool g_FrameBufferPool;
+
+void SetLAVFrameBufferPoolLowFootprint(bool bEnable)
+{
+  g_FrameBufferPool.SetLowFootprint(bEnable);
+}
+
+size_t GetLAVFrameBufferPoolSize()
+{
+  return g_FrameBufferPool.GetSize();
+}
+
+void ReleaseLAVFrameBufferPool()
+{
+  g_FrameBufferPool.Clear();
+}
+
+static BYTE *alloc_plane(size_t size, int node)
+{
+  if (node >= 0)
+    return (BYTE *)numa_alloc(size, node);
+  return (BYTE *)_aligned_malloc(size, LAV_FRAME_ALIGN);
+}
+
+// Allocate all planes of a frame in one block of large pages
+// Large pages are always aligned far beyond LAV_FRAME_ALIGN, and every plane size is padded to keep that alignment.
+static bool alloc_large_page_planes(LAVFrameBuffers *pBuffers, const LAVPixFmtDesc &desc, const size_t sizes[4])
+{
+  size_t total = 0;
+  for (int plane = 0; plane < desc.planes; plane++)
+    total += FFALIGN(sizes[plane], LAV_FRAME_ALIGN);
+  if (pBuffers->mvc)
+    total *= 2;
+
+  if (total < LAV_FRAME_LARGE_PAGE_SIZE)
+    return false;
+
+  BYTE *block = (BYTE *)large_page_alloc(total, pBuffers->node);
+  if (block == nullptr)
+    return false;
+
+  pBuffers->block = block;
+  for (int plane = 0; plane < desc.planes; plane++) {
+    pBuffers->data[plane] = block;
+    block += FFALIGN(sizes[plane], LAV_FRAME_ALIGN);
+  }
+  if (pBuffers->mvc) {
+    for (int plane = 0; plane < desc.planes; plane++) {
+      pBuffers->stereo[plane] = block;
+      block += FFALIGN(sizes[plane], LAV_FRAME_ALIGN);
+    }
+  }
+  return true;
+}
+
 static void free_buffers(struct LAVFrame *pFrame)
 {
-  _aligned_free(pFrame->data[0]);
-  _aligned_free(pFrame->data[1]);
-  _aligned_free(pFrame->data[2]);
-  _aligned_free(pFrame->data[3]);
-  memset(pFrame->data, 0, sizeof(pFrame->data));
+  g_FrameBufferPool.Put((LAVFrameBuffers *)pFrame->priv_data);
 
-  _aligned_free(pFrame->stereo[0]);
-  _aligned_free(pFrame->stereo[1]);
-  _aligned_free(pFrame->stereo[2]);
-  _aligned_free(pFrame->stereo[3]);
+  memset(pFrame->data, 0, sizeof(pFrame->data));
   memset(pFrame->stereo, 0, sizeof(pFrame->stereo));
 }
 
@@ -106,45 +316,94 @@ HRESULT AllocLAVFrameBuffers(LAVFrame *pFrame, ptrdiff_t stride)
   LAVPixFmtDesc desc = getPixelFormatDesc(pFrame->format);
 
   if (stride < pFrame->width) {
-    // Ensure alignment of at least 32 on all planes
-    stride = FFALIGN(pFrame->width, 64);
+    // Ensure alignment of LAV_FRAME_ALIGN bytes on all planes, also on the subsampled chroma planes
+    int maxPlaneWidth = 1;
+    for (int plane = 0; plane < desc.planes; plane++)
+      maxPlaneWidth = max(maxPlaneWidth, desc.planeWidth[plane]);
+    stride = FFALIGN(pFrame->width, LAV_FRAME_ALIGN * maxPlaneWidth);
   }
 
   stride *= desc.codedbytes;
 
   int alignedHeight = FFALIGN(pFrame->height, 2);
+  bool mvc = !!(pFrame->flags & LAV_FRAME_FLAG_MVC);
 
   memset(pFrame->data, 0, sizeof(pFrame->data));
   memset(pFrame->stereo, 0, sizeof(pFrame->stereo));
   memset(pFrame->stride, 0, sizeof(pFrame->stride));
-  for (int plane = 0; plane < desc.planes; plane++) {
-    ptrdiff_t planeStride = stride / desc.planeWidth[plane];
-    size_t size = planeStride * (alignedHeight / desc.planeHeight[plane]);
-    pFrame->data[plane]   = (BYTE *)_aligned_malloc(size + AV_INPUT_BUFFER_PADDING_SIZE, 64);
-    if (pFrame->data[plane] == nullptr) {
-      free_buffers(pFrame);
-      return E_OUTOFMEMORY;
-    }
-    pFrame->stride[plane] = planeStride;
-  }
 
-  if (pFrame->flags & LAV_FRAME_FLAG_MVC) {
-    for (int plane = 0; plane < desc.planes; plane++) {
-      size_t size = pFrame->stride[plane] * (alignedHeight / desc.planeHeight[plane]);
-      pFrame->stereo[plane] = (BYTE *)_aligned_malloc(size + AV_INPUT_BUFFER_PADDING_SIZE, 64);
-      if (pFrame->stereo[plane] == nullptr) {
-        free_buffers(pFrame);
+  // threads placed on a NUMA node get buffers from the memory of their node
+  const int node = numa_thread_node();
+
+  LAVFrameBuffers *pBuffers = g_FrameBufferPool.Get(pFrame->format, pFrame->width, pFrame->height, stride, mvc, node);
+  if (pBuffers == nullptr) {
+    pBuffers = new LAVFrameBuffers();
+    pBuffers->format = pFrame->format;
+    pBuffers->width  = pFrame->width;
+    pBuffers->height = pFrame->height;
+    pBuffers->stride = stride;
+    pBuffers->mvc    = mvc;
+    pBuffers->node   = node;
+
+    size_t sizes[4] = { 0 };
+    for (int plane = 0; plane < desc.planes; plane++)
+      sizes[plane] = (stride / desc.planeWidth[plane]) * (alignedHeight / desc.planeHeight[plane]) + AV_INPUT_BUFFER_PADDING_SIZE;
+
+    const bool bLargePages = alloc_large_page_planes(pBuffers, desc, sizes);
+    for (int plane = 0; plane < desc.planes && !bLargePages; plane++) {
+      pBuffers->data[plane] = alloc_plane(sizes[plane], node);
+      if (pBuffers->data[plane] == nullptr) {
+        CLAVFrameBufferPool::Free(pBuffers);
         return E_OUTOFMEMORY;
       }
+
+      if (mvc) {
+        pBuffers->stereo[plane] = alloc_plane(sizes[plane], node);
+        if (pBuffers->stereo[plane] == nullptr) {
+          CLAVFrameBufferPool::Free(pBuffers);
+          return E_OUTOFMEMORY;
+        }
+      }
     }
+
+    for (int plane = 0; plane < desc.planes; plane++)
+      pBuffers->size += bLargePages ? FFALIGN(sizes[plane], LAV_FRAME_ALIGN) : sizes[plane];
+    if (mvc)
+      pBuffers->size *= 2;
+  }
+
+  charge_buffers(pBuffers, pFrame->memory_account);
+
+  for (int plane = 0; plane < desc.planes; plane++) {
+    pFrame->data[plane]   = pBuffers->data[plane];
+    pFrame->stereo[plane] = pBuffers->stereo[plane];
+    pFrame->stride[plane] = stride / desc.planeWidth[plane];
   }
 
-  pFrame->destruct = &free_buffers;
-  pFrame->flags   |= LAV_FRAME_FLAG_BUFFER_MODIFY;
+  pFrame->destruct  = &free_buffers;
+  pFrame->priv_data = pBuffers;
+  pFrame->flags    |= LAV_FRAME_FLAG_BUFFER_MODIFY;
 
   return S_OK;
 }
 
+static inline bool side_data_is_inline(const LAVFrame *pFrame, const BYTE *data)
+{
+  return data >= pFrame->side_data_buffer && data < pFrame->side_data_buffer + sizeof(pFrame->side_data_buffer);
+}
+
+// Point the side data of a struct copy of pSrc into its own inline storage
+static void rebase_side_data(LAVFrame *pDst, const LAVFrame *pSrc)
+{
+  if (pSrc->side_data == pSrc->side_data_inline)
+    pDst->side_data = pDst->side_data_inline;
+
+  for (int i = 0; i < pDst->side_data_count; i++) {
+    if (side_data_is_inline(pSrc, pDst->side_data[i].data))
+      pDst->side_data[i].data = pDst->side_data_buffer + (pDst->side_data[i].data - pSrc->side_data_buffer);
+  }
+}
+
 HRESULT FreeLAVFrameBuffers(LAVFrame *pFrame)
 {
   CheckPointer(pFrame, E_POINTER);
@@ -154,20 +413,43 @@ HRESULT FreeLAVFrameBuffers(LAVFrame *pFrame)
     pFrame->destruct = nullptr;
     pFrame->priv_data = nullptr;
   }
+  pFrame->dr_sample = nullptr;
   memset(pFrame->data, 0, sizeof(pFrame->data));
   memset(pFrame->stereo, 0, sizeof(pFrame->stereo));
   memset(pFrame->stride, 0, sizeof(pFrame->stride));
 
   for (int i = 0; i < pFrame->side_data_count; i++)
   {
-    SAFE_CO_FREE(pFrame->side_data[i].data);
+    if (pFrame->side_data[i].shared)
+      ReleaseLAVFrameSideDataBlob(pFrame->side_data[i].shared);
+    else if (!side_data_is_inline(pFrame, pFrame->side_data[i].data))
+      SAFE_CO_FREE(pFrame->side_data[i].data);
   }
-  SAFE_CO_FREE(pFrame->side_data);
+  if (pFrame->side_data != pFrame->side_data_inline)
+    SAFE_CO_FREE(pFrame->side_data);
+  pFrame->side_data = nullptr;
   pFrame->side_data_count = 0;
+  pFrame->side_data_buffer_used = 0;
 
   return S_OK;
 }
 
+// Add the side data of pSrc to pDst, shared entries are referenced instead of copied
+static void copy_side_data(LAVFrame *pDst, const LAVFrame *pSrc)
+{
+  for (int i = 0; i < pSrc->side_data_count; i++)
+  {
+    if (pSrc->side_data[i].shared) {
+      AddLAVFrameSideDataShared(pDst, pSrc->side_data[i].guidType, pSrc->side_data[i].shared);
+      continue;
+    }
+
+    BYTE * p = AddLAVFrameSideData(pDst, pSrc->side_data[i].guidType, pSrc->side_data[i].size);
+    if (p)
+      memcpy(p, pSrc->side_data[i].data, pSrc->side_data[i].size);
+  }
+}
+
 HRESULT CopyLAVFrame(LAVFrame *pSrc, LAVFrame **ppDst)
 {
   ASSERT(pSrc->format != LAVPixFmt_DXVA2 && pSrc->format != LAVPixFmt_D3D11);
@@ -177,6 +459,7 @@ HRESULT CopyLAVFrame(LAVFrame *pSrc, LAVFrame **ppDst)
 
   (*ppDst)->destruct  = nullptr;
   (*ppDst)->priv_data = nullptr;
+  (*ppDst)->dr_sample = nullptr;
 
   HRESULT hr = AllocLAVFrameBuffers(*ppDst);
   if (FAILED(hr))
@@ -210,13 +493,65 @@ HRESULT CopyLAVFrame(LAVFrame *pSrc, LAVFrame **ppDst)
 
   (*ppDst)->side_data = nullptr;
   (*ppDst)->side_data_count = 0;
-  for (int i = 0; i < pSrc->side_data_count; i++)
-  {
-    BYTE * p = AddLAVFrameSideData(*ppDst, pSrc->side_data[i].guidType, pSrc->side_data[i].size);
-    if (p)
-      memcpy(p, pSrc->side_data[i].data, pSrc->side_data[i].size);
+  (*ppDst)->side_data_buffer_used = 0;
+  copy_side_data(*ppDst, pSrc);
+
+  return S_OK;
+}
+
+// Shared ownership of the buffers of a frame, created by RefLAVFrame
+typedef struct LAVFrameSharedBuffers {
+  volatile LONG refs;
+  LAVFrame      owner;      ///< frame the buffers were taken from, without side data, to call its destruct on
+} LAVFrameSharedBuffers;
+
+static void release_shared_buffers(struct LAVFrame *pFrame)
+{
+  LAVFrameSharedBuffers *pShared = (LAVFrameSharedBuffers *)pFrame->priv_data;
+  if (InterlockedDecrement(&pShared->refs) == 0) {
+    if (pShared->owner.destruct)
+      pShared->owner.destruct(&pShared->owner);
+    delete pShared;
+  }
+}
+
+HRESULT RefLAVFrame(LAVFrame *pSrc, LAVFrame **ppDst, bool bPersistentBuffers)
+{
+  ASSERT(pSrc->format != LAVPixFmt_DXVA2 && pSrc->format != LAVPixFmt_D3D11);
+
+  // Buffers of the frame pool and of shared frames always stay valid until they are released
+  const bool bOwnBuffers = (pSrc->destruct == &free_buffers || pSrc->destruct == &release_shared_buffers);
+
+  // Direct and direct rendering frames are bound to decoder or output buffers, which can't be held for long
+  if (pSrc->direct || pSrc->dr_sample || !pSrc->destruct || !(bPersistentBuffers || bOwnBuffers))
+    return CopyLAVFrame(pSrc, ppDst);
+
+  if (pSrc->destruct != &release_shared_buffers) {
+    LAVFrameSharedBuffers *pShared = new LAVFrameSharedBuffers();
+    pShared->refs  = 1;
+    pShared->owner = *pSrc;
+    pShared->owner.side_data = nullptr;
+    pShared->owner.side_data_count = 0;
+
+    pSrc->destruct  = &release_shared_buffers;
+    pSrc->priv_data = pShared;
   }
 
+  *ppDst = (LAVFrame *)CoTaskMemAlloc(sizeof(LAVFrame));
+  if (!*ppDst) return E_OUTOFMEMORY;
+  **ppDst = *pSrc;
+
+  InterlockedIncrement(&((LAVFrameSharedBuffers *)pSrc->priv_data)->refs);
+
+  // Neither of the frames may be written to anymore
+  pSrc->flags     &= ~LAV_FRAME_FLAG_BUFFER_MODIFY;
+  (*ppDst)->flags &= ~LAV_FRAME_FLAG_BUFFER_MODIFY;
+
+  (*ppDst)->side_data = nullptr;
+  (*ppDst)->side_data_count = 0;
+  (*ppDst)->side_data_buffer_used = 0;
+  copy_side_data(*ppDst, pSrc);
+
   return S_OK;
 }
 
@@ -226,29 +561,187 @@ HRESULT CopyLAVFrameInPlace(LAVFrame *pFrame)
   CopyLAVFrame(pFrame, &tmpFrame);
   FreeLAVFrameBuffers(pFrame);
   *pFrame = *tmpFrame;
+  rebase_side_data(pFrame, tmpFrame);
   SAFE_CO_FREE(tmpFrame);
   return S_OK;
 }
 
+// Make room for one more side data entry, which is not counted yet
+static LAVFrameSideData * alloc_side_data_entry(LAVFrame *pFrame)
+{
+  // A struct copy can leave stale inline state behind, which is unused without any entries
+  if (pFrame->side_data_count == 0) {
+    pFrame->side_data = nullptr;
+    pFrame->side_data_buffer_used = 0;
+  }
+
+  // The entries are stored inline first, and move to the heap once they don't fit anymore
+  if (pFrame->side_data_count < LAV_FRAME_SIDE_DATA_INLINE_ENTRIES) {
+    pFrame->side_data = pFrame->side_data_inline;
+  } else {
+    const bool bInline = (pFrame->side_data == pFrame->side_data_inline);
+    BYTE * ptr = (BYTE *)CoTaskMemRealloc(bInline ? nullptr : pFrame->side_data, sizeof(LAVFrameSideData) * (pFrame->side_data_count + 1));
+    if (!ptr)
+      return NULL;
+
+    if (bInline)
+      memcpy(ptr, pFrame->side_data_inline, sizeof(pFrame->side_data_inline));
+    pFrame->side_data = (LAVFrameSideData *)ptr;
+  }
+
+  return &pFrame->side_data[pFrame->side_data_count];
+}
+
 BYTE * AddLAVFrameSideData(LAVFrame *pFrame, GUID guidType, size_t size)
 {
-  BYTE * ptr = (BYTE *)CoTaskMemRealloc(pFrame->side_data, sizeof(LAVFrameSideData) * (pFrame->side_data_count + 1));
-  if (!ptr)
+  LAVFrameSideData *pEntry = alloc_side_data_entry(pFrame);
+  if (!pEntry)
     return NULL;
 
-  pFrame->side_data = (LAVFrameSideData *)ptr;
-  pFrame->side_data[pFrame->side_data_count].guidType = guidType;
-  pFrame->side_data[pFrame->side_data_count].data = (BYTE *)CoTaskMemAlloc(size);
-  pFrame->side_data[pFrame->side_data_count].size = size;
+  // Payloads are padded to 16 bytes in the inline buffer
+  BYTE *data = nullptr;
+  const size_t alignedSize = FFALIGN(size, 16);
+  if (alignedSize <= sizeof(pFrame->side_data_buffer) - pFrame->side_data_buffer_used) {
+    data = pFrame->side_data_buffer + pFrame->side_data_buffer_used;
+    pFrame->side_data_buffer_used += alignedSize;
+  } else {
+    data = (BYTE *)CoTaskMemAlloc(size);
+  }
 
-  if (!pFrame->side_data[pFrame->side_data_count].data)
+  if (!data)
     return NULL;
 
-  memset(pFrame->side_data[pFrame->side_data_count].data, 0, size);
+  pEntry->guidType = guidType;
+  pEntry->data     = data;
+  pEntry->size     = size;
+  pEntry->shared   = nullptr;
+  pEntry->version  = 0;
+
+  memset(data, 0, size);
+
+  pFrame->side_data_count++;
+
+  return data;
+}
+
+BYTE * AddLAVFrameSideDataShared(LAVFrame *pFrame, GUID guidType, LAVFrameSideDataBlob *pBlob)
+{
+  LAVFrameSideData *pEntry = alloc_side_data_entry(pFrame);
+  if (!pEntry)
+    return NULL;
+
+  InterlockedIncrement(&pBlob->refs);
+
+  pEntry->guidType = guidType;
+  pEntry->data     = pBlob->data;
+  pEntry->size     = pBlob->size;
+  pEntry->shared   = pBlob;
+  pEntry->version  = pBlob->version;
 
   pFrame->side_data_count++;
 
-  return pFrame->side_data[pFrame->side_data_count - 1].data;
+  return pBlob->data;
+}
+
+void RemoveLAVFrameSideData(LAVFrame *pFrame, GUID guidType)
+{
+  for (int i = 0; i < pFrame->side_data_count; i++)
+  {
+    if (pFrame->side_data[i].guidType != guidType)
+      continue;
+
+    // Inline data stays allocated in the inline buffer until the frame is freed
+    if (pFrame->side_data[i].shared)
+      ReleaseLAVFrameSideDataBlob(pFrame->side_data[i].shared);
+    else if (!side_data_is_inline(pFrame, pFrame->side_data[i].data))
+      CoTaskMemFree(pFrame->side_data[i].data);
+
+    memmove(&pFrame->side_data[i], &pFrame->side_data[i + 1], sizeof(LAVFrameSideData) * (pFrame->side_data_count - i - 1));
+    pFrame->side_data_count--;
+    return;
+  }
+}
+
+LAVFrameSideDataBlob * CreateLAVFrameSideDataBlob(size_t size)
+{
+  static volatile LONG s_version = 0;
+
+  const size_t headerSize = FFALIGN(sizeof(LAVFrameSideDataBlob), 16);
+  LAVFrameSideDataBlob *pBlob = (LAVFrameSideDataBlob *)CoTaskMemAlloc(headerSize + size);
+  if (!pBlob)
+    return NULL;
+
+  pBlob->refs    = 1;
+  pBlob->version = (ULONG)InterlockedIncrement(&s_version);
+  pBlob->data    = (BYTE *)pBlob + headerSize;
+  pBlob->size    = size;
+  memset(pBlob->data, 0, size);
+
+  return pBlob;
+}
+
+void ReleaseLAVFrameSideDataBlob(LAVFrameSideDataBlob *pBlob)
+{
+  if (pBlob && InterlockedDecrement(&pBlob->refs) == 0)
+    CoTaskMemFree(pBlob);
+}
+
+BYTE * CLAVFrameSideDataCache::SetSideData(LAVFrame *pFrame, GUID guidType, size_t size, const void *pSource, size_t sourceSize, bool *pbNew)
+{
+  *pbNew = false;
+
+  Entry *pEntry = nullptr;
+  for (int i = 0; i < m_nEntries; i++) {
+    if (m_Entries[i].guidType == guidType) {
+      pEntry = &m_Entries[i];
+      break;
+    }
+  }
+
+  // Without room in the cache, the frame gets side data of its own
+  if (!pEntry && m_nEntries == LAV_FRAME_SIDE_DATA_CACHE_ENTRIES) {
+    RemoveLAVFrameSideData(pFrame, guidType);
+    *pbNew = true;
+    return AddLAVFrameSideData(pFrame, guidType, size);
+  }
+
+  if (!pEntry) {
+    pEntry = &m_Entries[m_nEntries++];
+    memset(pEntry, 0, sizeof(*pEntry));
+    pEntry->guidType = guidType;
+  }
+
+  if (!pEntry->blob || pEntry->blob->size != size || pEntry->sourceSize != sourceSize || (sourceSize && memcmp(pEntry->source, pSource, sourceSize) != 0)) {
+    LAVFrameSideDataBlob *pBlob = CreateLAVFrameSideDataBlob(size);
+    BYTE *pSourceCopy = (BYTE *)CoTaskMemRealloc(pEntry->source, sourceSize ? sourceSize : 1);
+    if (!pBlob || !pSourceCopy) {
+      ReleaseLAVFrameSideDataBlob(pBlob);
+      if (pSourceCopy)
+        pEntry->source = pSourceCopy;
+      return NULL;
+    }
+
+    if (sourceSize)
+      memcpy(pSourceCopy, pSource, sourceSize);
+
+    ReleaseLAVFrameSideDataBlob(pEntry->blob);
+    pEntry->blob       = pBlob;
+    pEntry->source     = pSourceCopy;
+    pEntry->sourceSize = sourceSize;
+    *pbNew = true;
+  }
+
+  RemoveLAVFrameSideData(pFrame, guidType);
+  return AddLAVFrameSideDataShared(pFrame, guidType, pEntry->blob);
+}
+
+void CLAVFrameSideDataCache::Clear()
+{
+  for (int i = 0; i < m_nEntries; i++) {
+    ReleaseLAVFrameSideDataBlob(m_Entries[i].blob);
+    SAFE_CO_FREE(m_Entries[i].source);
+  }
+  m_nEntries = 0;
 }
 
 BYTE * GetLAVFrameSideData(LAVFrame *pFrame, GUID guidType, size_t *pSize)
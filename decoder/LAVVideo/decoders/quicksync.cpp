@@ -22,11 +22,12 @@
 
 #include "moreuuids.h"
 
-#include "parsers/H264SequenceParser.h"
 #include "parsers/MPEG2HeaderParser.h"
 #include "parsers/VC1HeaderParser.h"
 
 #include "Media.h"
+#include "timer.h"
+#include "dxva2/gpu_copy.h"
 
 #include <Shlwapi.h>
 #include <dxva2api.h>
@@ -55,6 +56,8 @@ static const FOURCC FourCC_WMV3 = mmioFOURCC('W','M','V','3');
 static const FOURCC FourCC_H264 = mmioFOURCC('H','2','6','4');
 static const FOURCC FourCC_AVC1 = mmioFOURCC('A','V','C','1');
 
+static const FOURCC FourCC_P010 = mmioFOURCC('P','0','1','0');
+
 static struct {
   AVCodecID ffcodec;
   FOURCC fourCC;
@@ -211,11 +214,61 @@ private:
 // QuickSync decoder implementation
 ////////////////////////////////////////////////////////////////////////////////
 
+////////////////////////////////////////////////////////////////////////////////
+// Copy-back buffers
+////////////////////////////////////////////////////////////////////////////////
+
+struct QsCopyBuffer {
+  AVBufferRef *pBuffer;
+  AVBufferRef *pInUse;
+};
+
+// The pool is only grown from within the decoder, the opaque is its buffer counter
+static AVBufferRef *qs_copy_buffer_alloc(void *opaque, int size)
+{
+  AVBufferRef *pBuffer = av_buffer_alloc(size);
+  if (pBuffer)
+    (*(DWORD *)opaque)++;
+  return pBuffer;
+}
+
+static void qs_frame_free(LAVFrame *pFrame)
+{
+  QsCopyBuffer *pCopy = (QsCopyBuffer *)pFrame->priv_data;
+  if (pCopy->pInUse) {
+    InterlockedDecrement((volatile LONG *)pCopy->pInUse->data);
+    av_buffer_unref(&pCopy->pInUse);
+  }
+  av_buffer_unref(&pCopy->pBuffer);
+  delete pCopy;
+}
+
+// Direct frames point at the buffers of the decoder, which are valid until the delivery returns
+static bool qs_direct_lock(LAVFrame *pFrame, LAVDirectBuffer *pBuffer)
+{
+  ASSERT(pFrame && pBuffer);
+
+  for (int i = 0; i < 4; i++) {
+    pBuffer->data[i] = pFrame->data[i];
+    pBuffer->stride[i] = pFrame->stride[i];
+  }
+  return true;
+}
+
+static void qs_direct_unlock(LAVFrame *pFrame)
+{
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// QuickSync decoder implementation
+////////////////////////////////////////////////////////////////////////////////
+
 CDecQuickSync::CDecQuickSync(void)
   : CDecBase()
 {
   ZeroMemory(&qs, sizeof(qs));
   ZeroMemory(&m_DXVAExtendedFormat, sizeof(m_DXVAExtendedFormat));
+  m_pCopyInUse = av_buffer_allocz(sizeof(LONG));
 }
 
 CDecQuickSync::~CDecQuickSync(void)
@@ -230,9 +283,18 @@ STDMETHODIMP CDecQuickSync::DestroyDecoder(bool bFull)
     m_pDecoder = nullptr;
   }
 
+  // frames still holding a buffer keep it alive until they are released
+  av_buffer_pool_uninit(&m_pCopyPool);
+  m_nCopyPoolSize  = 0;
+  m_dwCopyBuffers  = 0;
+  m_dwCopyMaxInUse = 0;
+  m_dwCopyStalls   = 0;
+  m_OutputFormat   = LAVPixFmt_NV12;
+
   if (bFull) {
     SafeRelease(&m_pD3DDevMngr);
     FreeLibrary(qs.quickSyncLib);
+    av_buffer_unref(&m_pCopyInUse);
   }
 
   return S_OK;
@@ -316,7 +378,7 @@ STDMETHODIMP CDecQuickSync::Check()
 STDMETHODIMP CDecQuickSync::CheckH264Sequence(const BYTE *buffer, size_t buflen, int nal_size, int *pRefFrames, int *pProfile, int *pLevel)
 {
   DbgLog((LOG_TRACE, 10, L"CDecQuickSync::CheckH264Sequence(): Checking H264 frame for SPS"));
-  CH264SequenceParser h264parser;
+  CH264SequenceParser &h264parser = m_H264Parser;
   h264parser.ParseNALs(buffer, buflen, nal_size);
   if (h264parser.sps.valid) {
     m_bInterlaced = h264parser.sps.interlaced;
@@ -615,7 +677,9 @@ STDMETHODIMP CDecQuickSync::HandleFrame(QsFrameData *data)
   LAVFrame *pFrame = nullptr;
   AllocateFrame(&pFrame);
 
-  pFrame->format = LAVPixFmt_NV12;
+  m_OutputFormat = (data->fourCC == FourCC_P010) ? LAVPixFmt_P016 : LAVPixFmt_NV12;
+
+  pFrame->format = m_OutputFormat;
   pFrame->width  = data->rcClip.right - data->rcClip.left + 1;
   pFrame->height = data->rcClip.bottom - data->rcClip.top + 1;
   pFrame->rtStart = data->rtStart;
@@ -631,10 +695,22 @@ STDMETHODIMP CDecQuickSync::HandleFrame(QsFrameData *data)
   pFrame->tff           = (fo == DeintFieldOrder_Auto) ? !!(data->dwInterlaceFlags & AM_VIDEO_FLAG_FIELD1FIRST) : (fo == DeintFieldOrder_TopFieldFirst);
 
 
-  // Assign the buffer to the LAV Frame bufers
-  pFrame->data[0] = data->y;
-  pFrame->data[1] = data->u;
-  pFrame->stride[0] = pFrame->stride[1] = data->dwStride;
+  if (m_bDirect) {
+    // Direct output reads the buffers of the decoder while it waits for the delivery
+    pFrame->data[0] = data->y;
+    pFrame->data[1] = data->u;
+    pFrame->stride[0] = pFrame->stride[1] = data->dwStride;
+
+    pFrame->direct        = true;
+    pFrame->direct_lock   = qs_direct_lock;
+    pFrame->direct_unlock = qs_direct_unlock;
+  } else {
+    HRESULT hr = CopyFrame(data, pFrame);
+    if (FAILED(hr)) {
+      ReleaseFrame(&pFrame);
+      return hr;
+    }
+  }
 
   if (!m_bInterlaced && pFrame->interlaced)
     m_bInterlaced = TRUE;
@@ -649,6 +725,95 @@ STDMETHODIMP CDecQuickSync::HandleFrame(QsFrameData *data)
   return S_OK;
 }
 
+STDMETHODIMP CDecQuickSync::CopyFrame(QsFrameData *data, LAVFrame *pFrame)
+{
+  REFERENCE_TIME rtCopyStart = timer_get_ref_time();
+
+  const size_t pitch = data->dwStride;
+  const size_t alignedHeight = FFALIGN(pFrame->height, 2);
+
+  // The copy engine expects the chroma plane right after the luma plane, as in a locked surface
+  const size_t lumaSize = (size_t)(data->u - data->y);
+  const bool bContiguous = data->u > data->y && (lumaSize % pitch) == 0 && (lumaSize / pitch) >= alignedHeight;
+
+  AVBufferRef *pBuffer = nullptr;
+  HRESULT hr = GetCopyBuffer((int)(pitch * (alignedHeight + alignedHeight / 2)) + AV_INPUT_BUFFER_PADDING_SIZE, &pBuffer);
+  if (FAILED(hr))
+    return hr;
+
+  BYTE *pY = pBuffer->data;
+  BYTE *pUV = pBuffer->data + pitch * alignedHeight;
+
+  if (bContiguous) {
+    gpu_copy_frame_nv12(data->y, pY, pUV, lumaSize / pitch, pFrame->height, pitch, true);
+  } else {
+    memcpy(pY, data->y, pitch * pFrame->height);
+    memcpy(pUV, data->u, pitch * (pFrame->height >> 1));
+  }
+
+  QsCopyBuffer *pCopy = new QsCopyBuffer;
+  pCopy->pBuffer = pBuffer;
+  pCopy->pInUse  = av_buffer_ref(m_pCopyInUse);
+  if (pCopy->pInUse)
+    InterlockedIncrement((volatile LONG *)pCopy->pInUse->data);
+
+  // The frame owns the buffer, which makes it safe to keep it past the callback
+  pFrame->data[0] = pY;
+  pFrame->data[1] = pUV;
+  pFrame->stride[0] = pFrame->stride[1] = pitch;
+  pFrame->flags |= LAV_FRAME_FLAG_BUFFER_MODIFY;
+
+  pFrame->priv_data = pCopy;
+  pFrame->destruct  = qs_frame_free;
+
+  m_pCallback->AddStageTime(VideoStage_GPUCopyBack, timer_get_ref_time() - rtCopyStart);
+
+  return S_OK;
+}
+
+STDMETHODIMP CDecQuickSync::GetCopyBuffer(int size, AVBufferRef **ppBuffer)
+{
+  if (!m_pCopyPool || m_nCopyPoolSize != size) {
+    av_buffer_pool_uninit(&m_pCopyPool);
+    m_dwCopyBuffers  = 0;
+    m_dwCopyMaxInUse = 0;
+
+    m_pCopyPool = av_buffer_pool_init2(size, &m_dwCopyBuffers, qs_copy_buffer_alloc, nullptr);
+    if (!m_pCopyPool) {
+      m_nCopyPoolSize = 0;
+      return E_OUTOFMEMORY;
+    }
+    m_nCopyPoolSize = size;
+  }
+
+  // all buffers are held by frames, the pool has to grow
+  const DWORD dwInUse = m_pCopyInUse ? *(volatile LONG *)m_pCopyInUse->data : 0;
+  if (m_dwCopyBuffers > 0 && dwInUse >= m_dwCopyBuffers)
+    m_dwCopyStalls++;
+
+  m_dwCopyMaxInUse = max(m_dwCopyMaxInUse, dwInUse + 1);
+
+  *ppBuffer = av_buffer_pool_get(m_pCopyPool);
+  return *ppBuffer ? S_OK : E_OUTOFMEMORY;
+}
+
+STDMETHODIMP CDecQuickSync::GetSurfacePoolStatus(LAVHWSurfacePoolStatus *pStatus)
+{
+  CheckPointer(pStatus, E_POINTER);
+
+  // The surfaces of the decoder itself are not exposed, only the copy-back buffers are accounted for
+  if (m_dwCopyBuffers == 0)
+    return S_FALSE;
+
+  pStatus->dwSurfaces = m_dwCopyBuffers;
+  pStatus->dwInUse    = m_pCopyInUse ? *(volatile LONG *)m_pCopyInUse->data : 0;
+  pStatus->dwMaxInUse = m_dwCopyMaxInUse;
+  pStatus->dwStalls   = m_dwCopyStalls;
+  // the pool grows by one buffer on every stall
+  pStatus->dwGrowths  = m_dwCopyStalls;
+  return S_OK;
+}
+
 STDMETHODIMP CDecQuickSync::Flush()
 {
   DbgLog((LOG_TRACE, 10, L"CDecQuickSync::Flush(): Flushing QuickSync decoder"));
@@ -672,11 +837,11 @@ STDMETHODIMP CDecQuickSync::EndOfStream()
 
 STDMETHODIMP CDecQuickSync::GetPixelFormat(LAVPixelFormat *pPix, int *pBpp)
 {
-  // Output is always NV12
+  // Output is NV12, unless the decoder delivered P010 frames
   if (pPix)
-    *pPix = LAVPixFmt_NV12;
+    *pPix = m_OutputFormat;
   if (pBpp)
-    *pBpp = 8;
+    *pBpp = (m_OutputFormat == LAVPixFmt_P016) ? 10 : 8;
   return S_OK;
 }
 
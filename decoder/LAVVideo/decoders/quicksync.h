@@ -21,6 +21,7 @@
 #include "DecBase.h"
 
 #include "IQuickSyncDecoder.h"
+#include "parsers/H264SequenceParser.h"
 
 typedef IQuickSyncDecoder* __stdcall pcreateQuickSync();
 typedef void               __stdcall pdestroyQuickSync(IQuickSyncDecoder*);
@@ -43,7 +44,10 @@ public:
   STDMETHODIMP GetPixelFormat(LAVPixelFormat *pPix, int *pBpp);
   STDMETHODIMP_(REFERENCE_TIME) GetFrameDuration();
   STDMETHODIMP_(BOOL) IsInterlaced(BOOL bAllowGuess);
-  STDMETHODIMP_(const WCHAR*) GetDecoderName() { return L"quicksync"; }
+  STDMETHODIMP_(const WCHAR*) GetDecoderName() { return m_bDirect ? L"quicksync direct" : L"quicksync"; }
+  STDMETHODIMP HasThreadSafeBuffers() { return S_OK; }
+  STDMETHODIMP SetDirectOutput(BOOL bDirect) { m_bDirect = bDirect; return S_OK; }
+  STDMETHODIMP GetSurfacePoolStatus(LAVHWSurfacePoolStatus *pStatus);
 
   STDMETHODIMP PostConnect(IPin *pPin);
 
@@ -57,6 +61,8 @@ private:
 
   static HRESULT QS_DeliverSurfaceCallback(void* obj, QsFrameData* data);
   STDMETHODIMP HandleFrame(QsFrameData *data);
+  STDMETHODIMP CopyFrame(QsFrameData *data, LAVFrame *pFrame);
+  STDMETHODIMP GetCopyBuffer(int size, AVBufferRef **ppBuffer);
 
   STDMETHODIMP CheckH264Sequence(const BYTE *buffer, size_t buflen, int nal_size, int *pRefFrames = nullptr, int *pProfile = nullptr, int *pLevel = nullptr);
 
@@ -72,6 +78,7 @@ private:
   IQuickSyncDecoder *m_pDecoder = nullptr;
 
   BOOL m_bNeedSequenceCheck = FALSE;
+  CH264SequenceParser m_H264Parser;
   BOOL m_bInterlaced        = TRUE;
   BOOL m_bDI                = FALSE;
   BOOL m_bAVC1              = FALSE;
@@ -86,4 +93,16 @@ private:
   FOURCC m_Codec = 0;
 
   IDirect3DDeviceManager9 *m_pD3DDevMngr = nullptr;
+
+  LAVPixelFormat m_OutputFormat = LAVPixFmt_NV12;
+  BOOL           m_bDirect      = FALSE;
+
+  // The decoder only lends its output buffers for the duration of the callback,
+  // every frame is copied into a pooled buffer which it holds on to until it is released
+  AVBufferPool *m_pCopyPool      = nullptr;
+  int          m_nCopyPoolSize   = 0;
+  AVBufferRef  *m_pCopyInUse     = nullptr;   ///< LONG counter of the buffers held by frames, can outlive the decoder
+  DWORD        m_dwCopyBuffers   = 0;
+  DWORD        m_dwCopyMaxInUse  = 0;
+  DWORD        m_dwCopyStalls    = 0;
 };
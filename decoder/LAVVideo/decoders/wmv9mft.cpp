@@ -62,8 +62,7 @@ STDMETHODIMP CDecWMV9MFT::DestroyDecoder(bool bFull)
   {
     CAutoLock lock(&m_BufferCritSec);
     for (auto it = m_BufferQueue.begin(); it != m_BufferQueue.end(); it++) {
-      SafeRelease(&(*it)->pBuffer);
-      delete (*it);
+      wmv9_buffer_unref(*it);
     }
     m_BufferQueue.clear();
   }
@@ -378,7 +377,7 @@ static inline void memcpy_plane(BYTE *dst, const BYTE *src, ptrdiff_t width, ptr
   }
 }
 
-IMFMediaBuffer * CDecWMV9MFT::GetBuffer(DWORD dwRequiredSize)
+CDecWMV9MFT::Buffer * CDecWMV9MFT::GetBuffer(DWORD dwRequiredSize)
 {
   CAutoLock lock(&m_BufferCritSec);
   HRESULT hr;
@@ -390,48 +389,60 @@ IMFMediaBuffer * CDecWMV9MFT::GetBuffer(DWORD dwRequiredSize)
       break;
     }
   }
-  if (buffer) {
-    // Validate Size
-    if (buffer->size < dwRequiredSize || !buffer->pBuffer) {
-      SafeRelease(&buffer->pBuffer);
-      hr = MF.CreateAlignedMemoryBuffer(dwRequiredSize, MF_32_BYTE_ALIGNMENT, &buffer->pBuffer);
-      if (FAILED(hr)) return nullptr;
-      buffer->size = dwRequiredSize;
-    }
-  } else {
-    // Create a new buffer
+  if (!buffer) {
     DbgLog((LOG_TRACE, 10, L"Allocating new buffer for WMV9 MFT"));
     buffer = new Buffer();
+    m_BufferQueue.push_back(buffer);
+  }
+
+  // Validate Size
+  if (buffer->size < dwRequiredSize || !buffer->pSample) {
+    SafeRelease(&buffer->pSample);
+    SafeRelease(&buffer->pBuffer);
+    buffer->size = 0;
+
     hr = MF.CreateAlignedMemoryBuffer(dwRequiredSize, MF_32_BYTE_ALIGNMENT, &buffer->pBuffer);
-    if (FAILED(hr)) { delete buffer; return nullptr; }
+    if (FAILED(hr)) return nullptr;
+
+    hr = MF.CreateSample(&buffer->pSample);
+    if (FAILED(hr)) { DbgLog((LOG_TRACE, 10, L"Unable to allocate MF sample, hr: 0x%x", hr)); SafeRelease(&buffer->pBuffer); return nullptr; }
+
+    buffer->pSample->AddBuffer(buffer->pBuffer);
     buffer->size = dwRequiredSize;
-    m_BufferQueue.push_back(buffer);
+  } else {
+    // the MFT only sets the attributes which apply to the new frame
+    buffer->pSample->DeleteAllItems();
   }
+
+  // sample times can't be removed, they are reset to an invalid value instead
+  buffer->pSample->SetSampleTime(AV_NOPTS_VALUE);
+  buffer->pSample->SetSampleDuration(0);
+
   buffer->used = 1;
-  buffer->pBuffer->AddRef();
   buffer->pBuffer->SetCurrentLength(0);
-  return buffer->pBuffer;
+  return buffer;
 }
 
-void CDecWMV9MFT::ReleaseBuffer(IMFMediaBuffer *pBuffer)
+void CDecWMV9MFT::ReleaseBuffer(Buffer *buffer)
 {
-  CAutoLock lock(&m_BufferCritSec);
-  Buffer *buffer = nullptr;
-  for (auto it = m_BufferQueue.begin(); it != m_BufferQueue.end(); it++) {
-    if ((*it)->pBuffer == pBuffer) {
-      (*it)->used = 0;
-      break;
-    }
+  InterlockedExchange(&buffer->used, 0);
+}
+
+void CDecWMV9MFT::wmv9_buffer_unref(Buffer *buffer)
+{
+  if (InterlockedDecrement(&buffer->refs) == 0) {
+    SafeRelease(&buffer->pSample);
+    SafeRelease(&buffer->pBuffer);
+    delete buffer;
   }
-  pBuffer->Release();
 }
 
 void CDecWMV9MFT::wmv9_buffer_destruct(LAVFrame *pFrame)
 {
-  CDecWMV9MFT *pDec = (CDecWMV9MFT *)pFrame->priv_data;
-  IMFMediaBuffer * pMFBuffer = (IMFMediaBuffer *)pFrame->data[3];
-  pMFBuffer->Unlock();
-  pDec->ReleaseBuffer(pMFBuffer);
+  Buffer *buffer = (Buffer *)pFrame->priv_data;
+  buffer->pBuffer->Unlock();
+  InterlockedExchange(&buffer->used, 0);
+  wmv9_buffer_unref(buffer);
 }
 
 STDMETHODIMP CDecWMV9MFT::ProcessOutput()
@@ -442,20 +453,18 @@ STDMETHODIMP CDecWMV9MFT::ProcessOutput()
   MFT_OUTPUT_STREAM_INFO outputInfo = {0};
   m_pMFT->GetOutputStreamInfo(0, &outputInfo);
 
+  Buffer *pOutBuffer = nullptr;
   IMFMediaBuffer *pMFBuffer = nullptr;
   ASSERT(!(outputInfo.dwFlags & MFT_OUTPUT_STREAM_PROVIDES_SAMPLES));
 
   MFT_OUTPUT_DATA_BUFFER OutputBuffer = {0};
   if (!(outputInfo.dwFlags & MFT_OUTPUT_STREAM_PROVIDES_SAMPLES)) {
-    pMFBuffer = GetBuffer(outputInfo.cbSize);
-    if (!pMFBuffer) { DbgLog((LOG_TRACE, 10, L"Unable to allocate media buffere")); return E_FAIL; }
-  
-    IMFSample *pSampleOut = nullptr;
-    hr = MF.CreateSample(&pSampleOut);
-    if (FAILED(hr)) { DbgLog((LOG_TRACE, 10, L"Unable to allocate MF sample, hr: 0x%x", hr)); ReleaseBuffer(pMFBuffer); return E_FAIL; }
-    
-    pSampleOut->AddBuffer(pMFBuffer);
-    OutputBuffer.pSample = pSampleOut;
+    pOutBuffer = GetBuffer(outputInfo.cbSize);
+    if (!pOutBuffer) { DbgLog((LOG_TRACE, 10, L"Unable to allocate media buffere")); return E_FAIL; }
+
+    // the sample stays owned by the pool entry
+    pMFBuffer = pOutBuffer->pBuffer;
+    OutputBuffer.pSample = pOutBuffer->pSample;
   }
   hr = m_pMFT->ProcessOutput(0, 1, &OutputBuffer, &dwStatus);
 
@@ -464,8 +473,7 @@ STDMETHODIMP CDecWMV9MFT::ProcessOutput()
 
   // handle stream format changes
   if (hr == MF_E_TRANSFORM_STREAM_CHANGE || OutputBuffer.dwStatus == MFT_OUTPUT_DATA_BUFFER_FORMAT_CHANGE ) {
-    SafeRelease(&OutputBuffer.pSample);
-    ReleaseBuffer(pMFBuffer);
+    ReleaseBuffer(pOutBuffer);
     hr = SelectOutputType();
     if (FAILED(hr)) {
       DbgLog((LOG_TRACE, 10, L"-> Failed to handle stream change, hr: %x", hr));
@@ -477,16 +485,14 @@ STDMETHODIMP CDecWMV9MFT::ProcessOutput()
   
   // the MFT generated no output, discard the sample and return
   if (hr == MF_E_TRANSFORM_NEED_MORE_INPUT || OutputBuffer.dwStatus == MFT_OUTPUT_DATA_BUFFER_NO_SAMPLE) {
-    SafeRelease(&OutputBuffer.pSample);
-    ReleaseBuffer(pMFBuffer);
+    ReleaseBuffer(pOutBuffer);
     return S_FALSE;
   }
   
   // unknown error condition
   if (FAILED(hr)) {
     DbgLog((LOG_TRACE, 10, L"-> ProcessOutput failed with hr: %x", hr));
-    SafeRelease(&OutputBuffer.pSample);
-    ReleaseBuffer(pMFBuffer);
+    ReleaseBuffer(pOutBuffer);
     return E_FAIL;
   }
 
@@ -543,7 +549,7 @@ STDMETHODIMP CDecWMV9MFT::ProcessOutput()
   } else {
     LONGLONG llTimestamp = 0;
     hr = OutputBuffer.pSample->GetSampleTime(&llTimestamp);
-    if (SUCCEEDED(hr)) {
+    if (SUCCEEDED(hr) && llTimestamp != AV_NOPTS_VALUE) {
       pFrame->rtStart = llTimestamp;
       
       LONGLONG llDuration = 0;
@@ -567,8 +573,7 @@ STDMETHODIMP CDecWMV9MFT::ProcessOutput()
     hr = AllocLAVFrameBuffers(pFrame);
     if (FAILED(hr)) {
       pMFBuffer->Unlock();
-      ReleaseBuffer(pMFBuffer);
-      SafeRelease(&OutputBuffer.pSample);
+      ReleaseBuffer(pOutBuffer);
       return hr;
     }
     size_t ySize = pFrame->width * pFrame->height;
@@ -582,7 +587,7 @@ STDMETHODIMP CDecWMV9MFT::ProcessOutput()
       memcpy_plane(pFrame->data[1], pBuffer + ySize + uvSize, pFrame->width / 2, pFrame->stride[1], pFrame->height / 2);
     }
     pMFBuffer->Unlock();
-    ReleaseBuffer(pMFBuffer);
+    ReleaseBuffer(pOutBuffer);
   } else {
     if (m_OutPixFmt == LAVPixFmt_NV12) {
       pFrame->data[0] = pBuffer;
@@ -595,15 +600,14 @@ STDMETHODIMP CDecWMV9MFT::ProcessOutput()
       pFrame->stride[0] = pFrame->width;
       pFrame->stride[1] = pFrame->stride[2] = pFrame->width / 2;
     }
-    pFrame->data[3] = (BYTE *)pMFBuffer;
+    // the frame keeps the pool entry alive, the buffer is unlocked and returned to the pool when it is released
+    InterlockedIncrement(&pOutBuffer->refs);
     pFrame->destruct = wmv9_buffer_destruct;
-    pFrame->priv_data = this;
+    pFrame->priv_data = pOutBuffer;
   }
   pFrame->flags |= LAV_FRAME_FLAG_BUFFER_MODIFY;
   Deliver(pFrame);
 
-  SafeRelease(&OutputBuffer.pSample);
-
   if (OutputBuffer.dwStatus == MFT_OUTPUT_DATA_BUFFER_INCOMPLETE)
     return ProcessOutput();
   return hr;
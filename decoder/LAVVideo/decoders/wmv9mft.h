@@ -47,10 +47,14 @@ class CVC1HeaderParser;
 
 class CDecWMV9MFT : public CDecBase
 {
+  // Output sample with its memory buffer, re-used for every decoded frame
+  // The pool and every frame using the buffer hold a reference, so frames can outlive the decoder
   typedef struct _Buffer {
+    IMFSample *pSample      = nullptr;
     IMFMediaBuffer *pBuffer = nullptr;
     DWORD size              = 0;
-    bool used               = false;
+    volatile LONG refs      = 1;
+    volatile LONG used      = 0;
   } Buffer;
 
 public:
@@ -78,9 +82,10 @@ private:
   IMFMediaBuffer * CreateMediaBuffer(const BYTE * pData, DWORD dwDataLen);
 
   static void wmv9_buffer_destruct(LAVFrame *pFrame);
+  static void wmv9_buffer_unref(Buffer *buffer);
 
-  IMFMediaBuffer *GetBuffer(DWORD dwRequiredSize);
-  void ReleaseBuffer(IMFMediaBuffer *pBuffer);
+  Buffer *GetBuffer(DWORD dwRequiredSize);
+  void ReleaseBuffer(Buffer *buffer);
 
 private:
   IMFTransform *m_pMFT = nullptr;
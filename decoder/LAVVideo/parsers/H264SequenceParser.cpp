@@ -40,15 +40,30 @@ HRESULT CH264SequenceParser::ParseNALs(const BYTE *buffer, size_t buflen, int na
   CH264Nalu nalu;
   nalu.SetBuffer(buffer, buflen, nal_size);
 
+  bool bFound = false;
   while (nalu.ReadNext())  {
     const BYTE *data = nalu.GetDataBuffer() + 1;
     const size_t len = nalu.GetDataLength() - 1;
     if (nalu.GetType() == NALU_TYPE_SPS) {
-      ParseSPS(data, len);
+      bFound = true;
+
+      // the SPS is repeated on every keyframe, but usually never changes
+      if (sps.valid && m_SPS.size() == len && memcmp(m_SPS.data(), data, len) == 0)
+        break;
+
+      m_SPS.assign(data, data + len);
+      CH264NALUnescape unescapedNAL(data, len);
+      ParseSPS(unescapedNAL.GetBuffer(), unescapedNAL.GetSize());
       break;
     }
   }
 
+  // the results only describe the SPS of the last buffer, like a fresh parser
+  if (!bFound) {
+    ZeroMemory(&sps, sizeof(sps));
+    m_SPS.clear();
+  }
+
   return S_OK;
 }
 
@@ -67,6 +82,21 @@ static void SPSDecodeScalingList(CByteParser &parser, int size) {
   }
 }
 
+static void SPSDecodeHRDParameters(CByteParser &parser) {
+  int cpb_count = (int)parser.UExpGolombRead() + 1; // cpb_cnt_minus1
+  parser.BitRead(4);                      // bit_rate_scale
+  parser.BitRead(4);                      // cpb_size_scale
+  for (int i = 0; i < cpb_count && i < 32; i++) {
+    parser.UExpGolombRead();              // bit_rate_value_minus1
+    parser.UExpGolombRead();              // cpb_size_value_minus1
+    parser.BitRead(1);                    // cbr_flag
+  }
+  parser.BitRead(5);                      // initial_cpb_removal_delay_length_minus1
+  parser.BitRead(5);                      // cpb_removal_delay_length_minus1
+  parser.BitRead(5);                      // dpb_output_delay_length_minus1
+  parser.BitRead(5);                      // time_offset_length
+}
+
 HRESULT CH264SequenceParser::ParseSPS(const BYTE *buffer, size_t buflen)
 {
   CByteParser parser(buffer, buflen);
@@ -79,10 +109,11 @@ HRESULT CH264SequenceParser::ParseSPS(const BYTE *buffer, size_t buflen)
   sps.trc = AVCOL_TRC_UNSPECIFIED;
   sps.colorspace = AVCOL_SPC_UNSPECIFIED;
   sps.full_range = -1;
+  sps.reorder_frames = -1;
 
   // Parse
   sps.profile = parser.BitRead(8);
-  parser.BitRead(4); // constraint flags
+  int constraints = parser.BitRead(4); // constraint flags
   parser.BitRead(4); // reserved
   sps.level = parser.BitRead(8);
   parser.UExpGolombRead(); // sps id
@@ -154,6 +185,10 @@ HRESULT CH264SequenceParser::ParseSPS(const BYTE *buffer, size_t buflen)
     parser.UExpGolombRead();              // crop_bottom
   }
 
+  // Baseline and intra profiles, and POC type 2, have no frames out of order
+  if (sps.profile == 66 || sps.profile == 44 || poc_type == 2 || ((constraints & 0x1) && (sps.profile == 110 || sps.profile == 122 || sps.profile == 244)))
+    sps.reorder_frames = 0;
+
   int vui_present = parser.BitRead(1);    // vui_parameters_present_flag
   if (vui_present) {
     sps.ar_present = parser.BitRead(1);   // aspect_ratio_info_present_flag
@@ -181,6 +216,39 @@ HRESULT CH264SequenceParser::ParseSPS(const BYTE *buffer, size_t buflen)
         sps.colorspace = parser.BitRead(8);
       }
     }
+
+    if (parser.BitRead(1)) {              // chroma_loc_info_present_flag
+      parser.UExpGolombRead();            // chroma_sample_loc_type_top_field
+      parser.UExpGolombRead();            // chroma_sample_loc_type_bottom_field
+    }
+
+    if (parser.BitRead(1)) {              // timing_info_present_flag
+      parser.BitRead(32);                 // num_units_in_tick
+      parser.BitRead(32);                 // time_scale
+      parser.BitRead(1);                  // fixed_frame_rate_flag
+    }
+
+    int nal_hrd = parser.BitRead(1);      // nal_hrd_parameters_present_flag
+    if (nal_hrd)
+      SPSDecodeHRDParameters(parser);
+    int vcl_hrd = parser.BitRead(1);      // vcl_hrd_parameters_present_flag
+    if (vcl_hrd)
+      SPSDecodeHRDParameters(parser);
+    if (nal_hrd || vcl_hrd)
+      parser.BitRead(1);                  // low_delay_hrd_flag
+    parser.BitRead(1);                    // pic_struct_present_flag
+
+    // a truncated SPS reads as zero bits, which would look like a stream without reordering
+    if (parser.RemainingBits() > 0 && parser.BitRead(1)) { // bitstream_restriction_flag
+      parser.BitRead(1);                  // motion_vectors_over_pic_boundaries_flag
+      parser.UExpGolombRead();            // max_bytes_per_pic_denom
+      parser.UExpGolombRead();            // max_bits_per_mb_denom
+      parser.UExpGolombRead();            // log2_max_mv_length_horizontal
+      parser.UExpGolombRead();            // log2_max_mv_length_vertical
+      int reorder = (int)parser.UExpGolombRead(); // max_num_reorder_frames
+      if (parser.RemainingBits() > 0 && reorder <= 16)
+        sps.reorder_frames = reorder;
+    }
   }
 
   return S_OK;
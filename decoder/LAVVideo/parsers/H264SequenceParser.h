@@ -19,6 +19,8 @@
 
 #pragma once
 
+#include <vector>
+
 class CH264SequenceParser
 {
 public:
@@ -39,6 +41,7 @@ public:
     int ref_frames;
     int interlaced;
     int ar_present;
+    int reorder_frames;   ///< frames output out of decoding order, -1 if unknown
 
     int full_range;
     int primaries;
@@ -52,4 +55,7 @@ public:
 
 private:
   HRESULT ParseSPS(const BYTE *buffer, size_t buflen);
+
+  // Escaped SPS of the last parse, an identical SPS is not parsed again
+  std::vector<BYTE> m_SPS;
 };
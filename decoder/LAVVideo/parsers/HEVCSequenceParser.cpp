@@ -42,16 +42,30 @@ HRESULT CHEVCSequenceParser::ParseNALs(const BYTE *buffer, size_t buflen, int na
   CH265Nalu nalu;
   nalu.SetBuffer(buffer, buflen, nal_size);
 
+  bool bFound = false;
   while (nalu.ReadNext())  {
     const BYTE *data = nalu.GetDataBuffer() + 2;
     const size_t len = nalu.GetDataLength() - 2;
     if (nalu.GetType() == HEVC_NAL_SPS) {
+      bFound = true;
+
+      // the SPS is repeated on every keyframe, but usually never changes
+      if (sps.valid && m_SPS.size() == len && memcmp(m_SPS.data(), data, len) == 0)
+        break;
+
+      m_SPS.assign(data, data + len);
       CH264NALUnescape unescapedNAL(data, len);
       ParseSPS(unescapedNAL.GetBuffer(), unescapedNAL.GetSize());
       break;
     }
   }
 
+  // the results only describe the SPS of the last buffer, like a fresh parser
+  if (!bFound) {
+    ZeroMemory(&sps, sizeof(sps));
+    m_SPS.clear();
+  }
+
   return S_OK;
 }
 
@@ -62,6 +76,7 @@ HRESULT CHEVCSequenceParser::ParseSPS(const BYTE *buffer, size_t buflen)
 
   ZeroMemory(&sps, sizeof(sps));
   sps.valid = 1;
+  sps.reorder_pics = -1;
 
   struct {
     int profile_present;
@@ -151,15 +166,20 @@ HRESULT CHEVCSequenceParser::ParseSPS(const BYTE *buffer, size_t buflen)
   sps.bitdepth = parser.UExpGolombRead() + 8; // bit_depth_luma_minus8
   parser.UExpGolombRead(); // bit_depth_chroma_minus8
 
-  /*int log2_max_pic_order_count = parser.UExpGolombRead() + 4; // log2_max_pic_order_cnt_lsb_minus4
+  parser.UExpGolombRead(); // log2_max_pic_order_cnt_lsb_minus4
 
+  // the values of the highest sub-layer apply to the whole stream
   for (i = (parser.BitRead(1) ? 0 : max_sub_layers); i <= max_sub_layers; i++) {
     parser.UExpGolombRead(); // sps_max_dec_pic_buffering_minus1
-    parser.UExpGolombRead(); // sps_max_num_reorder_pics
+    sps.reorder_pics = (int)parser.UExpGolombRead(); // sps_max_num_reorder_pics
     parser.UExpGolombRead(); // sps_max_latency_increase_plus1
   }
 
-  parser.UExpGolombRead(); // log2_min_luma_coding_block_size_minus3
+  // a truncated SPS reads as zero bits, which would look like a stream without reordering
+  if (parser.RemainingBits() == 0 || sps.reorder_pics > 16)
+    sps.reorder_pics = -1;
+
+  /*parser.UExpGolombRead(); // log2_min_luma_coding_block_size_minus3
   parser.UExpGolombRead(); // log2_diff_max_min_luma_coding_block_size
   parser.UExpGolombRead(); // log2_min_luma_transform_block_size_minus2
   parser.UExpGolombRead(); // log2_diff_max_min_luma_transform_block_size
@@ -19,6 +19,7 @@
 
 #pragma once
 
+#include <vector>
 #include "ByteParser.h"
 
 #define HEVC_REXT_PROFILE_MAIN_12 0x98
@@ -40,8 +41,12 @@ public:
     int level;
     int chroma;
     int bitdepth;
+    int reorder_pics;   ///< pictures output out of decoding order, -1 if unknown
   } sps;
 
 private:
   HRESULT ParseSPS(const BYTE *buffer, size_t buflen);
+
+  // Escaped SPS of the last parse, an identical SPS is not parsed again
+  std::vector<BYTE> m_SPS;
 };
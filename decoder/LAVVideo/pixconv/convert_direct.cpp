@@ -308,3 +308,84 @@ DECLARE_CONV_FUNC_IMPL(convert_p010_nv12_direct_sse4)
 
   return S_OK;
 }
+
+// Copy lines from USWC memory into a cache-resident buffer, with streaming loads
+static void stream_copy_lines(const uint8_t *src, ptrdiff_t srcStride, uint8_t *dst, ptrdiff_t dstStride, ptrdiff_t byteWidth, int lines)
+{
+  __m128i xmm0, xmm1, xmm2, xmm3;
+
+  for (int line = 0; line < lines; line++) {
+    const uint8_t *s = src + line * srcStride;
+          uint8_t *d = dst + line * dstStride;
+
+    ptrdiff_t i;
+    for (i = 0; i < (byteWidth - 63); i += 64) {
+      PIXCONV_STREAM_LOAD(xmm0, s + i +  0);
+      PIXCONV_STREAM_LOAD(xmm1, s + i + 16);
+      PIXCONV_STREAM_LOAD(xmm2, s + i + 32);
+      PIXCONV_STREAM_LOAD(xmm3, s + i + 48);
+
+      _ReadWriteBarrier();
+
+      _mm_store_si128((__m128i *)(d + i +  0), xmm0);
+      _mm_store_si128((__m128i *)(d + i + 16), xmm1);
+      _mm_store_si128((__m128i *)(d + i + 32), xmm2);
+      _mm_store_si128((__m128i *)(d + i + 48), xmm3);
+    }
+
+    for (; i < byteWidth; i += 16) {
+      PIXCONV_STREAM_LOAD(xmm0, s + i);
+      _mm_store_si128((__m128i *)(d + i), xmm0);
+    }
+  }
+}
+
+// Converters which look at neighbouring lines can't run on plain slices of the frame, and reading USWC memory
+// with regular loads is very slow. Instead every slice is staged into a per-thread buffer a few lines at a time,
+// with streaming loads, and converted from there while it is still in the cache.
+// The frame never goes through system memory as a whole, which halves the memory traffic of the copy-back.
+//
+// fn is a 4:2:0 line pair converter like yuv2rgb_convert, which converts the lines [sliceYStart, sliceYEnd)
+// with the pairs starting at odd lines, and handles the first and last line of the frame on its own.
+// The block passed to it looks like a frame of blockHeight lines, which only ends where the real frame ends.
+// The height of the frame has to be even.
+HRESULT CLAVPixFmtConverter::ConvertStaged(const uint8_t* const src[4], const ptrdiff_t srcStride[4], int width, int height, const StagedConverterFn &fn)
+{
+  ASSERT(!(height & 1));
+
+  const ptrdiff_t byteWidth     = (m_InputPixFmt == LAVPixFmt_P016) ? width << 1 : width;
+  const ptrdiff_t copyWidth     = min(FFALIGN(byteWidth, 64), min(srcStride[0], srcStride[1]));
+  const ptrdiff_t stagingStride = FFALIGN(byteWidth, 64);
+  const int       chromaHeight  = (height + 1) >> 1;
+
+  // a block needs the first line of the next block as well, plus padding for the over-reads of the converters
+  const size_t lumaSize  = stagingStride * (PIXCONV_STAGING_LINES + 1);
+  const size_t blockSize = FFALIGN(lumaSize + stagingStride * (PIXCONV_STAGING_LINES / 2 + 1) + AV_INPUT_BUFFER_PADDING_SIZE, PIXCONV_BUFFER_ALIGN);
+  if (FAILED(AllocStagingBuffer(blockSize * SLICE_MAX_THREADS)))
+    return E_OUTOFMEMORY;
+
+  _mm_sfence();
+
+  RunSlices(width, height, [&](int thread, int starty, int endy) {
+    ASSERT(thread < SLICE_MAX_THREADS);
+    uint8_t *y  = m_pStagingBuffer + thread * blockSize;
+    uint8_t *uv = y + lumaSize;
+
+    // blocks start at multiples of PIXCONV_STAGING_LINES, so the chroma lines and the dithering rows line up with the frame
+    for (int start = starty; start < endy; start += PIXCONV_STAGING_LINES) {
+      const int end = min(start + PIXCONV_STAGING_LINES, endy);
+
+      // the line pairs overlap the end of the block by one line, like the slices in convert_yuv_rgb
+      const int lastLine = (end == height) ? end : end + 1;
+
+      stream_copy_lines(src[0] + start * srcStride[0], srcStride[0], y, stagingStride, copyWidth, min(end + 1, height) - start);
+      stream_copy_lines(src[1] + (start >> 1) * srcStride[1], srcStride[1], uv, stagingStride, copyWidth, min((end >> 1) + 1, chromaHeight) - (start >> 1));
+
+      // the block is only the end of the frame if it actually is
+      const int blockHeight = (lastLine == height) ? height - start : lastLine - start + 1;
+      fn(y, uv, stagingStride, start, blockHeight, start ? 1 : 0, lastLine - start);
+    }
+  });
+
+  return S_OK;
+}
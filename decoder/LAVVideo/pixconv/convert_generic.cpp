@@ -96,63 +96,162 @@ DECLARE_CONV_FUNC_IMPL(convert_generic)
   return S_OK;
 }
 
-inline SwsContext *CLAVPixFmtConverter::GetSWSContext(int width, int height, enum AVPixelFormat srcPix, enum AVPixelFormat dstPix, int flags)
+// Create a context converting between two formats of the same size
+// The colorspace defaults are chosen by the size of the whole frame, which differs from the context size for slices.
+SwsContext *CLAVPixFmtConverter::CreateSWSContext(int width, int height, int frameWidth, int frameHeight, enum AVPixelFormat srcPix, enum AVPixelFormat dstPix, int flags)
 {
-  if (!m_pSwsContext || swsWidth != width || swsHeight != height) {
-    // Get context
-    m_pSwsContext = sws_getCachedContext(m_pSwsContext,
-                                 width, height, srcPix,
-                                 width, height, dstPix,
-                                 flags|SWS_PRINT_INFO, nullptr, nullptr, nullptr);
-
-    int *inv_tbl = nullptr, *tbl = nullptr;
-    int srcRange, dstRange, brightness, contrast, saturation;
-    int ret = sws_getColorspaceDetails(m_pSwsContext, &inv_tbl, &srcRange, &tbl, &dstRange, &brightness, &contrast, &saturation);
-    if (ret >= 0) {
-      const int *rgbTbl = nullptr;
-      if (m_ColorProps.VideoTransferMatrix != DXVA2_VideoTransferMatrix_Unknown) {
-        int colorspace = SWS_CS_ITU709;
-        switch (m_ColorProps.VideoTransferMatrix) {
-        case DXVA2_VideoTransferMatrix_BT709:
-          colorspace = SWS_CS_ITU709;
-          break;
-        case DXVA2_VideoTransferMatrix_BT601:
-          colorspace = SWS_CS_ITU601;
-          break;
-        case DXVA2_VideoTransferMatrix_SMPTE240M:
-          colorspace = SWS_CS_SMPTE240M;
-          break;
-        }
-        rgbTbl = sws_getCoefficients(colorspace);
-      } else {
-        BOOL isHD = (height >= 720 || width >= 1280);
-        rgbTbl = sws_getCoefficients(isHD ? SWS_CS_ITU709 : SWS_CS_ITU601);
+  // Get context
+  SwsContext *ctx = sws_getContext(width, height, srcPix,
+                                   width, height, dstPix,
+                                   flags|SWS_PRINT_INFO, nullptr, nullptr, nullptr);
+  if (!ctx)
+    return nullptr;
+
+  int *inv_tbl = nullptr, *tbl = nullptr;
+  int srcRange, dstRange, brightness, contrast, saturation;
+  int ret = sws_getColorspaceDetails(ctx, &inv_tbl, &srcRange, &tbl, &dstRange, &brightness, &contrast, &saturation);
+  if (ret >= 0) {
+    const int *rgbTbl = nullptr;
+    if (m_ColorProps.VideoTransferMatrix != DXVA2_VideoTransferMatrix_Unknown) {
+      int colorspace = SWS_CS_ITU709;
+      switch (m_ColorProps.VideoTransferMatrix) {
+      case DXVA2_VideoTransferMatrix_BT709:
+        colorspace = SWS_CS_ITU709;
+        break;
+      case DXVA2_VideoTransferMatrix_BT601:
+        colorspace = SWS_CS_ITU601;
+        break;
+      case DXVA2_VideoTransferMatrix_SMPTE240M:
+        colorspace = SWS_CS_SMPTE240M;
+        break;
       }
-      srcRange = dstRange = (m_ColorProps.NominalRange == DXVA2_NominalRange_0_255);
-      sws_setColorspaceDetails(m_pSwsContext, rgbTbl, srcRange, rgbTbl, dstRange, brightness, contrast, saturation);
+      rgbTbl = sws_getCoefficients(colorspace);
+    } else {
+      BOOL isHD = (frameHeight >= 720 || frameWidth >= 1280);
+      rgbTbl = sws_getCoefficients(isHD ? SWS_CS_ITU709 : SWS_CS_ITU601);
     }
-    swsWidth = width;
-    swsHeight = height;
+    srcRange = dstRange = (m_ColorProps.NominalRange == DXVA2_NominalRange_0_255);
+    sws_setColorspaceDetails(ctx, rgbTbl, srcRange, rgbTbl, dstRange, brightness, contrast, saturation);
   }
-  return m_pSwsContext;
+
+  return ctx;
 }
 
-HRESULT CLAVPixFmtConverter::swscale_scale(enum AVPixelFormat srcPix, enum AVPixelFormat dstPix, const uint8_t* const src[], const ptrdiff_t srcStride[], uint8_t* dst[], int width, int height, const ptrdiff_t dstStride[], LAVOutPixFmtDesc pixFmtDesc, bool swapPlanes12)
+inline SwsContext *CLAVPixFmtConverter::GetSWSContext(int width, int height, enum AVPixelFormat srcPix, enum AVPixelFormat dstPix, int flags)
+{
+  // Look for a matching context, and otherwise replace the least recently used one
+  SwsCacheEntry *entry = &m_SwsCache[0];
+  for (int i = 0; i < SWS_CACHE_SIZE; i++) {
+    SwsCacheEntry *e = &m_SwsCache[i];
+    if (e->ctx && e->width == width && e->height == height && e->srcPix == srcPix && e->dstPix == dstPix && e->flags == flags && e->colorProps == m_ColorProps.value) {
+      e->lastUse = ++m_CacheUseCounter;
+      return e->ctx;
+    }
+    if (!e->ctx || (entry->ctx && e->lastUse < entry->lastUse))
+      entry = e;
+  }
+
+  if (entry->ctx) {
+    sws_freeContext(entry->ctx);
+    entry->ctx = nullptr;
+  }
+
+  SwsContext *ctx = CreateSWSContext(width, height, width, height, srcPix, dstPix, flags);
+  if (!ctx)
+    return nullptr;
+
+  entry->ctx = ctx;
+  entry->width = width;
+  entry->height = height;
+  entry->srcPix = srcPix;
+  entry->dstPix = dstPix;
+  entry->flags = flags;
+  entry->colorProps = m_ColorProps.value;
+  entry->frameHeight = height;
+  entry->lastUse = ++m_CacheUseCounter;
+  return ctx;
+}
+
+// Context of one slice thread, each thread only ever touches its own slot
+SwsContext *CLAVPixFmtConverter::GetSliceSWSContext(int slot, int width, int height, int frameHeight, enum AVPixelFormat srcPix, enum AVPixelFormat dstPix, int flags)
+{
+  SwsCacheEntry *e = &m_SliceSwsCache[slot];
+  if (e->ctx && e->width == width && e->height == height && e->srcPix == srcPix && e->dstPix == dstPix && e->flags == flags && e->colorProps == m_ColorProps.value && e->frameHeight == frameHeight)
+    return e->ctx;
+
+  if (e->ctx) {
+    sws_freeContext(e->ctx);
+    e->ctx = nullptr;
+  }
+
+  e->ctx = CreateSWSContext(width, height, width, frameHeight, srcPix, dstPix, flags);
+  e->width = width;
+  e->height = height;
+  e->srcPix = srcPix;
+  e->dstPix = dstPix;
+  e->flags = flags;
+  e->colorProps = m_ColorProps.value;
+  e->frameHeight = frameHeight;
+  return e->ctx;
+}
+
+// Convert with swscale, sliced over the worker threads
+// Every slice is converted as an image of its own, with the context of the thread running it. The last slice can be
+// shorter than the others, and uses a context of its own. Vertical chroma interpolation doesn't look across slice
+// boundaries, which is acceptable for the fallback path.
+HRESULT CLAVPixFmtConverter::sws_scale_sliced(enum AVPixelFormat srcPix, enum AVPixelFormat dstPix, int flags, const uint8_t* const src[4], const ptrdiff_t srcStride[4], uint8_t* const dst[4], const ptrdiff_t dstStride[4], int width, int height)
 {
-  int ret;
+  const AVPixFmtDescriptor *srcDesc = av_pix_fmt_desc_get(srcPix);
+  const AVPixFmtDescriptor *dstDesc = av_pix_fmt_desc_get(dstPix);
+
+  // palettes can't be sliced
+  if (!srcDesc || !dstDesc || (srcDesc->flags & AV_PIX_FMT_FLAG_PAL)) {
+    SwsContext *ctx = GetSWSContext(width, height, srcPix, dstPix, flags);
+    CheckPointer(ctx, E_POINTER);
+    sws_scale2(ctx, src, srcStride, 0, height, dst, dstStride);
+    return S_OK;
+  }
+
+  int srcShift[4] = { 0 }, dstShift[4] = { 0 };
+  srcShift[1] = srcShift[2] = srcDesc->log2_chroma_h;
+  dstShift[1] = dstShift[2] = dstDesc->log2_chroma_h;
+
+  HRESULT hr = S_OK;
+  RunSlices(width, height, [&](int thread, int start, int end) {
+    SwsContext *ctx = nullptr;
+    if (start == 0 && end == height)
+      ctx = GetSWSContext(width, height, srcPix, dstPix, flags);
+    else
+      ctx = GetSliceSWSContext((end == height) ? SLICE_MAX_THREADS : thread, width, end - start, height, srcPix, dstPix, flags);
+    if (!ctx) {
+      hr = E_POINTER;
+      return;
+    }
 
-  SwsContext *ctx = GetSWSContext(width, height, srcPix, dstPix, SWS_BILINEAR);
-  CheckPointer(m_pSwsContext, E_POINTER);
+    const uint8_t *sliceSrc[4] = { 0 };
+    uint8_t *sliceDst[4] = { 0 };
+    for (int i = 0; i < 4; i++) {
+      if (src[i])
+        sliceSrc[i] = src[i] + (start >> srcShift[i]) * srcStride[i];
+      if (dst[i])
+        sliceDst[i] = dst[i] + (start >> dstShift[i]) * dstStride[i];
+    }
+
+    sws_scale2(ctx, sliceSrc, srcStride, 0, end - start, sliceDst, dstStride);
+  });
+
+  return hr;
+}
 
+HRESULT CLAVPixFmtConverter::swscale_scale(enum AVPixelFormat srcPix, enum AVPixelFormat dstPix, const uint8_t* const src[], const ptrdiff_t srcStride[], uint8_t* dst[], int width, int height, const ptrdiff_t dstStride[], LAVOutPixFmtDesc pixFmtDesc, bool swapPlanes12)
+{
   if (swapPlanes12) {
     uint8_t *tmp = dst[1];
     dst[1] = dst[2];
     dst[2] = tmp;
   }
 
-  ret = sws_scale2(ctx, src, srcStride, 0, height, dst, dstStride);
-
-  return S_OK;
+  return sws_scale_sliced(srcPix, dstPix, SWS_BILINEAR, src, srcStride, dst, dstStride, width, height);
 }
 
 HRESULT CLAVPixFmtConverter::ConvertTo422Packed(const uint8_t* const src[4], const ptrdiff_t srcStride[4], uint8_t* dst[], int width, int height, const ptrdiff_t dstStride[])
@@ -183,8 +282,7 @@ HRESULT CLAVPixFmtConverter::ConvertTo422Packed(const uint8_t* const src[4], con
     tmpStride[2] = scaleStride / 2;
     tmpStride[3] = 0;
 
-    SwsContext *ctx = GetSWSContext(width, height, GetFFInput(), AV_PIX_FMT_YUV422P, SWS_BILINEAR);
-    sws_scale2(ctx, src, srcStride, 0, height, tmp, tmpStride);
+    sws_scale_sliced(GetFFInput(), AV_PIX_FMT_YUV422P, SWS_BILINEAR, src, srcStride, tmp, tmpStride, width, height);
 
     y = tmp[0];
     u = tmp[1];
@@ -280,8 +378,7 @@ HRESULT CLAVPixFmtConverter::ConvertToAYUV(const uint8_t* const src[4], const pt
     tmpStride[2] = scaleStride;
     tmpStride[3] = 0;
 
-    SwsContext *ctx = GetSWSContext(width, height, GetFFInput(), AV_PIX_FMT_YUV444P, SWS_BILINEAR);
-    sws_scale2(ctx, src, srcStride, 0, height, tmp, tmpStride);
+    sws_scale_sliced(GetFFInput(), AV_PIX_FMT_YUV444P, SWS_BILINEAR, src, srcStride, tmp, tmpStride, width, height);
 
     y = tmp[0];
     u = tmp[1];
@@ -353,8 +450,7 @@ HRESULT CLAVPixFmtConverter::ConvertToPX1X(const uint8_t* const src[4], const pt
     tmpStride[2] = scaleStride / 2;
     tmpStride[3] = 0;
 
-    SwsContext *ctx = GetSWSContext(width, height, GetFFInput(), chromaVertical == 1 ? AV_PIX_FMT_YUV422P16LE : AV_PIX_FMT_YUV420P16LE, SWS_BILINEAR);
-    sws_scale2(ctx, src, srcStride, 0, height, tmp, tmpStride);
+    sws_scale_sliced(GetFFInput(), chromaVertical == 1 ? AV_PIX_FMT_YUV422P16LE : AV_PIX_FMT_YUV420P16LE, SWS_BILINEAR, src, srcStride, tmp, tmpStride, width, height);
 
     y = tmp[0];
     u = tmp[1];
@@ -461,8 +557,7 @@ HRESULT CLAVPixFmtConverter::ConvertToY410(const uint8_t* const src[4], const pt
     tmpStride[2] = scaleStride * 2;
     tmpStride[3] = 0;
 
-    SwsContext *ctx = GetSWSContext(width, height, GetFFInput(), AV_PIX_FMT_YUV444P10LE, SWS_BILINEAR);
-    sws_scale2(ctx, src, srcStride, 0, height, tmp, tmpStride);
+    sws_scale_sliced(GetFFInput(), AV_PIX_FMT_YUV444P10LE, SWS_BILINEAR, src, srcStride, tmp, tmpStride, width, height);
 
     y = (uint16_t *)tmp[0];
     u = (uint16_t *)tmp[1];
@@ -523,8 +618,7 @@ HRESULT CLAVPixFmtConverter::ConvertToY416(const uint8_t* const src[4], const pt
     tmpStride[2] = scaleStride * 2;
     tmpStride[3] = 0;
 
-    SwsContext *ctx = GetSWSContext(width, height, GetFFInput(), AV_PIX_FMT_YUV444P16LE, SWS_BILINEAR);
-    sws_scale2(ctx, src, srcStride, 0, height, tmp, tmpStride);
+    sws_scale_sliced(GetFFInput(), AV_PIX_FMT_YUV444P16LE, SWS_BILINEAR, src, srcStride, tmp, tmpStride, width, height);
 
     y = (uint16_t *)tmp[0];
     u = (uint16_t *)tmp[1];
@@ -582,8 +676,7 @@ HRESULT CLAVPixFmtConverter::ConvertTov210(const uint8_t* const src[4], const pt
     tmpStride[2] = scaleStride;
     tmpStride[3] = 0;
 
-    SwsContext *ctx = GetSWSContext(width, height, GetFFInput(), AV_PIX_FMT_YUV422P10LE, SWS_BILINEAR);
-    sws_scale2(ctx, src, srcStride, 0, height, tmp, tmpStride);
+    sws_scale_sliced(GetFFInput(), AV_PIX_FMT_YUV422P10LE, SWS_BILINEAR, src, srcStride, tmp, tmpStride, width, height);
 
     y = (uint16_t *)tmp[0];
     u = (uint16_t *)tmp[1];
@@ -682,8 +775,7 @@ HRESULT CLAVPixFmtConverter::ConvertTov410(const uint8_t* const src[4], const pt
     tmpStride[2] = scaleStride * 2;
     tmpStride[3] = 0;
 
-    SwsContext *ctx = GetSWSContext(width, height, GetFFInput(), AV_PIX_FMT_YUV444P10LE, SWS_BILINEAR);
-    sws_scale2(ctx, src, srcStride, 0, height, tmp, tmpStride);
+    sws_scale_sliced(GetFFInput(), AV_PIX_FMT_YUV444P10LE, SWS_BILINEAR, src, srcStride, tmp, tmpStride, width, height);
 
     y = (uint16_t *)tmp[0];
     u = (uint16_t *)tmp[1];
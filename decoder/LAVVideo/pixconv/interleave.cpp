@@ -78,3 +78,201 @@ DECLARE_CONV_FUNC_IMPL(convert_yuv444_y410)
   }
   return S_OK;
 }
+
+DECLARE_CONV_FUNC_IMPL(convert_yuv444_y416)
+{
+  const uint16_t *y = (const uint16_t *)src[0];
+  const uint16_t *u = (const uint16_t *)src[1];
+  const uint16_t *v = (const uint16_t *)src[2];
+
+  const ptrdiff_t inStride = srcStride[0] >> 1;
+  const ptrdiff_t outStride = dstStride[0];
+  int shift = 16 - bpp;
+
+  ptrdiff_t line, i;
+
+  __m128i xmm0,xmm1,xmm2,xmm3,xmm4,xmm7;
+
+  xmm7 = _mm_set1_epi16(-1);
+
+  _mm_sfence();
+
+  for (line = 0; line < height; ++line) {
+    __m128i *dst128 = (__m128i *)(dst[0] + line * outStride);
+
+    for (i = 0; i < width; i+=8) {
+      PIXCONV_LOAD_PIXEL8_ALIGNED(xmm0, (y+i));
+      xmm0 = _mm_slli_epi16(xmm0, shift);
+      PIXCONV_LOAD_PIXEL8_ALIGNED(xmm1, (u+i));
+      xmm1 = _mm_slli_epi16(xmm1, shift);
+      PIXCONV_LOAD_PIXEL8_ALIGNED(xmm2, (v+i));
+      xmm2 = _mm_slli_epi16(xmm2, shift);
+
+      xmm3 = _mm_unpacklo_epi16(xmm1, xmm0); // YUYUYUYU
+      xmm4 = _mm_unpacklo_epi16(xmm2, xmm7); // AVAVAVAV
+      _mm_stream_si128(dst128++, _mm_unpacklo_epi32(xmm3, xmm4));
+      _mm_stream_si128(dst128++, _mm_unpackhi_epi32(xmm3, xmm4));
+
+      xmm3 = _mm_unpackhi_epi16(xmm1, xmm0);
+      xmm4 = _mm_unpackhi_epi16(xmm2, xmm7);
+      _mm_stream_si128(dst128++, _mm_unpacklo_epi32(xmm3, xmm4));
+      _mm_stream_si128(dst128++, _mm_unpackhi_epi32(xmm3, xmm4));
+    }
+
+    y += inStride;
+    u += inStride;
+    v += inStride;
+  }
+  return S_OK;
+}
+
+// v410 output is not required to be aligned, so loads and stores are unaligned, and partial blocks are packed one pixel at a time
+DECLARE_CONV_FUNC_IMPL(convert_yuv444_v410)
+{
+  const uint16_t *y = (const uint16_t *)src[0];
+  const uint16_t *u = (const uint16_t *)src[1];
+  const uint16_t *v = (const uint16_t *)src[2];
+
+  const ptrdiff_t inStride = srcStride[0] >> 1;
+  const ptrdiff_t outStride = dstStride[0];
+  int shift = 10 - bpp;
+
+  ptrdiff_t line, i;
+
+  __m128i xmm0,xmm1,xmm2,xmm3,xmm4,xmm6,xmm7;
+
+  xmm7 = _mm_set1_epi16(0x3FF);
+  xmm6 = _mm_setzero_si128();
+
+  for (line = 0; line < height; ++line) {
+    uint32_t *out = (uint32_t *)(dst[0] + line * outStride);
+
+    for (i = 0; i <= width - 8; i+=8) {
+      xmm0 = _mm_and_si128(_mm_slli_epi16(_mm_loadu_si128((const __m128i *)(y+i)), shift), xmm7);
+      xmm1 = _mm_and_si128(_mm_slli_epi16(_mm_loadu_si128((const __m128i *)(u+i)), shift), xmm7);
+      xmm2 = _mm_and_si128(_mm_slli_epi16(_mm_loadu_si128((const __m128i *)(v+i)), shift), xmm7);
+
+      xmm1 = _mm_slli_epi16(xmm1, 2);        // 0000UUUUUUUUUU00
+      xmm2 = _mm_slli_epi16(xmm2, 6);        // VVVVVVVVVV000000
+
+      xmm3 = _mm_unpacklo_epi16(xmm1, xmm2); // VVVVVVVVVV0000000000UUUUUUUUUU00
+      xmm4 = _mm_unpackhi_epi16(xmm1, xmm2);
+
+      xmm1 = _mm_slli_epi32(_mm_unpacklo_epi16(xmm0, xmm6), 12);
+      xmm2 = _mm_slli_epi32(_mm_unpackhi_epi16(xmm0, xmm6), 12);
+
+      _mm_storeu_si128((__m128i *)(out + i), _mm_or_si128(xmm3, xmm1));
+      _mm_storeu_si128((__m128i *)(out + i + 4), _mm_or_si128(xmm4, xmm2));
+    }
+
+    for (; i < width; ++i) {
+      uint32_t yv = (y[i] << shift) & 0x3FF, uv = (u[i] << shift) & 0x3FF, vv = (v[i] << shift) & 0x3FF;
+      out[i] = (uv << 2) | (yv << 12) | (vv << 22);
+    }
+
+    y += inStride;
+    u += inStride;
+    v += inStride;
+  }
+  return S_OK;
+}
+
+// v210 packs 6 pixels into 4 dwords, each holding three 10-bit samples:
+// U0 Y0 V0 | Y1 U1 Y2 | V1 Y3 U2 | Y4 V2 Y5
+// The three sample positions are gathered from the Y and U/V registers with byte shuffles, and combined with shifts.
+DECLARE_CONV_FUNC_IMPL(convert_yuv422_v210)
+{
+  const uint16_t *y = (const uint16_t *)src[0];
+  const uint16_t *u = (const uint16_t *)src[1];
+  const uint16_t *v = (const uint16_t *)src[2];
+
+  const ptrdiff_t inYStride = srcStride[0] >> 1;
+  const ptrdiff_t inUVStride = srcStride[1] >> 1;
+
+  // Calculate v210 stride
+  const ptrdiff_t outStride = (((dstStride[0] >> 2) + 47) / 48) * 128;
+
+  // Align width to an even number for processing
+  // This may read into the source stride, but otherwise the algorithm won't work.
+  width = FFALIGN(width, 2);
+
+  // Every dword lane of the shuffled registers holds one sample of the matching output dword
+  const __m128i shufYA  = _mm_setr_epi8(-1, -1, -1, -1,  2,  3, -1, -1, -1, -1, -1, -1,  8,  9, -1, -1);
+  const __m128i shufYB  = _mm_setr_epi8( 0,  1, -1, -1, -1, -1, -1, -1,  6,  7, -1, -1, -1, -1, -1, -1);
+  const __m128i shufYC  = _mm_setr_epi8(-1, -1, -1, -1,  4,  5, -1, -1, -1, -1, -1, -1, 10, 11, -1, -1);
+  // U/V register holds U0-U3 in the low, and V0-V3 in the high half
+  const __m128i shufUVA = _mm_setr_epi8( 0,  1, -1, -1, -1, -1, -1, -1, 10, 11, -1, -1, -1, -1, -1, -1);
+  const __m128i shufUVB = _mm_setr_epi8(-1, -1, -1, -1,  2,  3, -1, -1, -1, -1, -1, -1, 12, 13, -1, -1);
+  const __m128i shufUVC = _mm_setr_epi8( 8,  9, -1, -1, -1, -1, -1, -1,  4,  5, -1, -1, -1, -1, -1, -1);
+  const __m128i mask = _mm_set1_epi16(0x3FF);
+
+  __m128i xmm0,xmm1,xmm2,xmm3,xmm4;
+
+  BYTE *pdst = dst[0];
+  uint32_t *p = (uint32_t *)pdst;
+  uint32_t val;
+  int w;
+
+#define CLIP(v) (v & 0x03FF)
+#define WRITE_PIXELS(a, b, c)       \
+  do {                              \
+    val =   CLIP(*a++);             \
+    val |= (CLIP(*b++) << 10) |     \
+           (CLIP(*c++) << 20);      \
+    *p++ = val;                     \
+  } while (0)
+
+  for (int h = 0; h < height; h++) {
+    // the loads read 8 luma and 4 chroma samples, 6 and 3 of which are packed
+    for (w = 0; w <= width - 8; w += 6) {
+      xmm0 = _mm_and_si128(_mm_loadu_si128((const __m128i *)y), mask);
+      xmm1 = _mm_unpacklo_epi64(_mm_loadl_epi64((const __m128i *)u), _mm_loadl_epi64((const __m128i *)v));
+      xmm1 = _mm_and_si128(xmm1, mask);
+
+      xmm2 = _mm_or_si128(_mm_shuffle_epi8(xmm0, shufYA), _mm_shuffle_epi8(xmm1, shufUVA));
+      xmm3 = _mm_or_si128(_mm_shuffle_epi8(xmm0, shufYB), _mm_shuffle_epi8(xmm1, shufUVB));
+      xmm4 = _mm_or_si128(_mm_shuffle_epi8(xmm0, shufYC), _mm_shuffle_epi8(xmm1, shufUVC));
+
+      xmm2 = _mm_or_si128(xmm2, _mm_slli_epi32(xmm3, 10));
+      xmm2 = _mm_or_si128(xmm2, _mm_slli_epi32(xmm4, 20));
+      _mm_storeu_si128((__m128i *)p, xmm2);
+
+      p += 4;
+      y += 6;
+      u += 3;
+      v += 3;
+    }
+    for (; w < width - 5; w += 6) {
+      WRITE_PIXELS(u, y, v);
+      WRITE_PIXELS(y, u, y);
+      WRITE_PIXELS(v, y, u);
+      WRITE_PIXELS(y, v, y);
+    }
+    if (w < width - 1) {
+      WRITE_PIXELS(u, y, v);
+
+      val = CLIP(*y++);
+      if (w == width - 2)
+        *p++ = val;
+      if (w < width - 3) {
+        val |= (CLIP(*u++) << 10) | (CLIP(*y++) << 20);
+        *p++ = val;
+
+        val = CLIP(*v++) | (CLIP(*y++) << 10);
+        *p++ = val;
+      }
+    }
+
+    pdst += outStride;
+    memset(p, 0, pdst - (BYTE *)p);
+    p = (uint32_t *)pdst;
+    y += inYStride - width;
+    u += inUVStride - (width >> 1);
+    v += inUVStride - (width >> 1);
+  }
+
+#undef WRITE_PIXELS
+#undef CLIP
+
+  return S_OK;
+}
@@ -0,0 +1,124 @@
+/*
+ *      Copyright (C) 2010-2019 Hendrik Leppkes
+ *      http://www.1f0.de
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program; if not, write to the Free Software Foundation, Inc.,
+ *  51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#pragma once
+
+// AVX2 variants of the helpers in pixconv_sse2_templates.h
+//
+// Only include this header from files that are compiled with AVX2 code generation enabled,
+// and only call the functions in those files after checking for AV_CPU_FLAG_AVX2.
+//
+// Most AVX2 integer instructions operate on the two 128-bit lanes independently, so packing
+// results need to be re-ordered (PIXCONV_AVX2_PACKUS_EPI16), and output buffers are only
+// guaranteed to have 16-byte alignment, so streaming writes are split into two 128-bit halves.
+
+#include <immintrin.h>
+
+#include "pixconv_sse2_templates.h"
+
+// Load the dithering coefficients for this line into both lanes
+// reg   - register to load coefficients into
+// line  - index of line to process (0 based)
+// bits  - number of bits to dither (for 10 -> 8, set to 2)
+#define PIXCONV_AVX2_LOAD_DITHER_COEFFS(reg,line,bits,name)                    \
+  const uint16_t *name = dither_8x8_256[(line) % 8];                           \
+  reg = _mm256_broadcastsi128_si256(_mm_load_si128((const __m128i *)name));    \
+  reg = _mm256_srli_epi16(reg, 8-bits); /* shift to the required dithering strength */
+
+// Load 256-bit into a register
+// reg   - register to store pixels in
+// src   - memory pointer of the source
+#define PIXCONV_AVX2_LOAD(reg,src) \
+  reg = _mm256_loadu_si256((const __m256i *)(src));  /* load (unaligned) */
+
+// Load two 128-bit values into the lanes of a register
+// reg   - register to store pixels in
+// src0  - memory pointer of the low lane
+// src1  - memory pointer of the high lane
+#define PIXCONV_AVX2_LOAD_LANES(reg,src0,src1) \
+  reg = _mm256_inserti128_si256(_mm256_castsi128_si256(_mm_loadu_si128((const __m128i *)(src0))), _mm_loadu_si128((const __m128i *)(src1)), 1);
+
+// Load 16 16-bit pixels into a register
+// reg   - register to store pixels in
+// src   - memory pointer of the source
+// bpp   - bit depth of the pixels
+#define PIXCONV_AVX2_LOAD_PIXEL16(reg,src,bpp)                       \
+  PIXCONV_AVX2_LOAD(reg,src)                                         \
+  reg = _mm256_slli_epi16(reg, 16-bpp);          /* shift to 16-bit */
+
+// Load 16 16-bit pixels into a register, and dither them to 8 bit
+// The 8-bit pixels will be in the low-bytes of the 16 16-bit parts
+// reg   - register to store pixels in
+// dreg  - register with dithering coefficients
+// src   - memory pointer of the source
+// bpp   - bit depth of the pixels
+#define PIXCONV_AVX2_LOAD_PIXEL16_DITHER(reg,dreg,src,bpp)           \
+  PIXCONV_AVX2_LOAD_PIXEL16(reg,src,bpp)                             \
+  reg = _mm256_adds_epu16(reg, dreg);            /* dither */        \
+  reg = _mm256_srli_epi16(reg, 8);               /* shift to 8-bit */
+
+// Pack two registers of 16 16-bit values into 32 8-bit values, in order
+#define PIXCONV_AVX2_PACKUS_EPI16(a,b) \
+  _mm256_permute4x64_epi64(_mm256_packus_epi16(a, b), _MM_SHUFFLE(3,1,2,0))
+
+// Load 4 8-bit pixels into each lane of the register
+// reg     - register to store pixels in
+// src0    - source memory of the low lane
+// src1    - source memory of the high lane
+#define PIXCONV_AVX2_LOAD_4PIXEL8X2(reg,src0,src1) \
+  reg = _mm256_inserti128_si256(_mm256_castsi128_si256(_mm_cvtsi32_si128(*(const int*)(src0))), _mm_cvtsi32_si128(*(const int*)(src1)), 1);
+
+// Load 4 16-bit pixels into each lane of the register
+// reg     - register to store pixels in
+// src0    - source memory of the low lane
+// src1    - source memory of the high lane
+#define PIXCONV_AVX2_LOAD_4PIXEL16X2(reg,src0,src1) \
+  reg = _mm256_inserti128_si256(_mm256_castsi128_si256(_mm_loadl_epi64((const __m128i *)(src0))), _mm_loadl_epi64((const __m128i *)(src1)), 1);
+
+// Put 256-bit into memory with 16-byte alignment, using streaming write
+#define PIXCONV_AVX2_PUT_STREAM(dst,reg)                                                    \
+  _mm_stream_si128((__m128i *)(dst), _mm256_castsi256_si128(reg));          /* low lane */  \
+  _mm_stream_si128((__m128i *)(dst) + 1, _mm256_extracti128_si256(reg, 1)); /* high lane */
+
+// AVX2 memcpy, the destination needs to be 16-byte aligned
+// dst - memory destination
+// src - memory source
+// len - size in bytes
+#define PIXCONV_AVX2_MEMCPY(dst,src,len)         \
+  {                                              \
+    const uint8_t * const srcLinePtr = (src);    \
+          uint8_t * const dstLinePtr = (dst);    \
+    __m256i r1, r2, r3, r4;                      \
+    __m128i r5;                                  \
+    ptrdiff_t i;                                 \
+    for (i = 0; i < (len - 127); i += 128) {     \
+      PIXCONV_AVX2_LOAD(r1, srcLinePtr+i+ 0);    \
+      PIXCONV_AVX2_LOAD(r2, srcLinePtr+i+32);    \
+      PIXCONV_AVX2_LOAD(r3, srcLinePtr+i+64);    \
+      PIXCONV_AVX2_LOAD(r4, srcLinePtr+i+96);    \
+      PIXCONV_AVX2_PUT_STREAM(dstLinePtr+i+ 0, r1); \
+      PIXCONV_AVX2_PUT_STREAM(dstLinePtr+i+32, r2); \
+      PIXCONV_AVX2_PUT_STREAM(dstLinePtr+i+64, r3); \
+      PIXCONV_AVX2_PUT_STREAM(dstLinePtr+i+96, r4); \
+    }                                            \
+    for (; i < len; i += 16) {                   \
+      PIXCONV_LOAD_ALIGNED(r5, srcLinePtr+i);    \
+      PIXCONV_PUT_STREAM(dstLinePtr+i, r5);      \
+    }                                            \
+  }
@@ -0,0 +1,120 @@
+/*
+ *      Copyright (C) 2010-2019 Hendrik Leppkes
+ *      http://www.1f0.de
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program; if not, write to the Free Software Foundation, Inc.,
+ *  51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#include "stdafx.h"
+
+#include "pixconv_internal.h"
+#include "pixconv_avx2_templates.h"
+
+DECLARE_CONV_FUNC_IMPL(convert_rgb48_rgb32_avx2)
+{
+  const uint16_t *rgb = (const uint16_t *)src[0];
+  const ptrdiff_t inStride = srcStride[0] >> 1;
+  const ptrdiff_t outStride = dstStride[0];
+  ptrdiff_t line, i;
+
+  int processWidth = width * 3;
+
+  LAVDitherMode ditherMode = m_pSettings->GetDitherMode();
+  const uint16_t *dithers = GetRandomDitherCoeffs(height, 4, 8, 0);
+  if (dithers == nullptr)
+    ditherMode = LAVDither_Ordered;
+
+  __m256i ymm0,ymm1,ymm2,ymm3,ymm4,ymm5,ymm6;
+  __m128i xmm0,xmm1,xmm2,xmm3,xmm4,xmm5,xmm6,xmm7;
+
+  // Gather 12 bytes (4 pixels) of the 8-bit RGB data into each lane
+  const __m256i gather0 = _mm256_setr_epi32(0, 1, 2, 3, 3, 4, 5, 6);
+  const __m256i gather1 = _mm256_setr_epi32(2, 3, 4, 5, 5, 6, 7, 7);
+  // Swap RGB to BGR(A) on 8-bit samples
+  const __m256i mask8 = _mm256_setr_epi8(2,1,0,-1,5,4,3,-1,8,7,6,-1,11,10,9,-1,2,1,0,-1,5,4,3,-1,8,7,6,-1,11,10,9,-1);
+  // Swap RGB to BGR(A) on 16-bit samples
+  const __m128i mask16 = _mm_setr_epi8(4,5,2,3,0,1,-1,-1,10,11,8,9,6,7,-1,-1);
+
+  _mm_sfence();
+  for (line = 0; line < height; line++) {
+    uint8_t *dst8 = dst[0] + line * outStride;
+
+    // Load dithering coefficients for this line
+    if (ditherMode == LAVDither_Random) {
+      xmm5 = _mm_load_si128((const __m128i *)(dithers + (line << 5) + 0));
+      xmm6 = _mm_load_si128((const __m128i *)(dithers + (line << 5) + 8));
+      xmm7 = _mm_load_si128((const __m128i *)(dithers + (line << 5) + 16));
+    } else {
+      PIXCONV_LOAD_DITHER_COEFFS(xmm7,line,8,dithers);
+      xmm5 = xmm6 = xmm7;
+    }
+
+    // The coefficients repeat every 24 samples, spread them over 48 samples
+    ymm4 = _mm256_inserti128_si256(_mm256_castsi128_si256(xmm5), xmm6, 1);
+    ymm5 = _mm256_inserti128_si256(_mm256_castsi128_si256(xmm7), xmm5, 1);
+    ymm6 = _mm256_inserti128_si256(_mm256_castsi128_si256(xmm6), xmm7, 1);
+
+    // 16 pixels per iteration
+    for (i = 0; i < (processWidth - 47); i += 48) {
+      PIXCONV_AVX2_LOAD(ymm0, (rgb + i));         /* load */
+      PIXCONV_AVX2_LOAD(ymm1, (rgb + i + 16));
+      PIXCONV_AVX2_LOAD(ymm2, (rgb + i + 32));
+      ymm0 = _mm256_adds_epu16(ymm0, ymm4);       /* apply dithering coefficients */
+      ymm1 = _mm256_adds_epu16(ymm1, ymm5);
+      ymm2 = _mm256_adds_epu16(ymm2, ymm6);
+      ymm0 = _mm256_srli_epi16(ymm0, 8);          /* shift to 8-bit */
+      ymm1 = _mm256_srli_epi16(ymm1, 8);
+      ymm2 = _mm256_srli_epi16(ymm2, 8);
+
+      ymm0 = PIXCONV_AVX2_PACKUS_EPI16(ymm0, ymm1);                                          /* RGB bytes 0-31 */
+      ymm2 = PIXCONV_AVX2_PACKUS_EPI16(ymm2, ymm2);                                          /* RGB bytes 32-47 */
+      ymm1 = _mm256_permute2x128_si256(ymm0, ymm2, 0x21);                                    /* RGB bytes 16-47 */
+
+      ymm3 = _mm256_shuffle_epi8(_mm256_permutevar8x32_epi32(ymm0, gather0), mask8);         /* pixel 0-7 */
+      ymm1 = _mm256_shuffle_epi8(_mm256_permutevar8x32_epi32(ymm1, gather1), mask8);         /* pixel 8-15 */
+
+      PIXCONV_AVX2_PUT_STREAM(dst8 + (i << 2) / 3 +  0, ymm3);
+      PIXCONV_AVX2_PUT_STREAM(dst8 + (i << 2) / 3 + 32, ymm1);
+    }
+
+    // Remaining 8 pixels
+    for (; i < processWidth; i += 24) {
+      PIXCONV_LOAD_ALIGNED(xmm0, (rgb + i));      /* load */
+      PIXCONV_LOAD_ALIGNED(xmm1, (rgb + i + 8));
+      PIXCONV_LOAD_ALIGNED(xmm2, (rgb + i + 16));
+      xmm0 = _mm_adds_epu16(xmm0, xmm5);          /* apply dithering coefficients */
+      xmm1 = _mm_adds_epu16(xmm1, xmm6);
+      xmm2 = _mm_adds_epu16(xmm2, xmm7);
+      xmm0 = _mm_srli_epi16(xmm0, 8);             /* shift to 8-bit */
+      xmm1 = _mm_srli_epi16(xmm1, 8);
+      xmm2 = _mm_srli_epi16(xmm2, 8);
+
+      xmm3 = _mm_shuffle_epi8(xmm0, mask16);
+      xmm4 = _mm_shuffle_epi8(_mm_alignr_epi8(xmm1, xmm0, 12), mask16);
+      xmm0 = _mm_shuffle_epi8(_mm_alignr_epi8(xmm2, xmm1, 8),  mask16);
+      xmm1 = _mm_shuffle_epi8(_mm_alignr_epi8(xmm2, xmm2, 4),  mask16);
+
+      xmm3 = _mm_packus_epi16(xmm3, xmm4);
+      xmm0 = _mm_packus_epi16(xmm0, xmm1);
+
+      PIXCONV_PUT_STREAM(dst8 + (i << 2) / 3 +  0, xmm3);
+      PIXCONV_PUT_STREAM(dst8 + (i << 2) / 3 + 16, xmm0);
+    }
+
+    rgb += inStride;
+  }
+
+  return S_OK;
+}
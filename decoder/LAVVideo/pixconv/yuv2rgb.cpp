@@ -20,7 +20,6 @@
 #include "stdafx.h"
 
 #include <emmintrin.h>
-#include <ppl.h>
 
 #include "pixconv_internal.h"
 #include "pixconv_sse2_templates.h"
@@ -481,12 +480,8 @@ static int __stdcall yuv2rgb_convert(const uint8_t *srcY, const uint8_t *srcU, c
   return 0;
 }
 
-DECLARE_CONV_FUNC_IMPL(convert_yuv_rgb)
+YUVRGBConversionFunc CLAVPixFmtConverter::GetRGBConvFunc(LAVPixelFormat inputFormat, int bpp, LAVOutPixFmts outputFormat, int height, const uint16_t **pDithers)
 {
-  const RGBCoeffs *coeffs = getRGBCoeffs(width, height);
-  if (coeffs == nullptr)
-    return E_OUTOFMEMORY;
-
   if (!m_bRGBConvInit) {
     m_bRGBConvInit = TRUE;
     InitRGBConvDispatcher();
@@ -506,6 +501,7 @@ DECLARE_CONV_FUNC_IMPL(convert_yuv_rgb)
     break;
   default:
     ASSERT(0);
+    return nullptr;
   }
 
   LAVDitherMode ditherMode = m_pSettings->GetDitherMode();
@@ -523,28 +519,53 @@ DECLARE_CONV_FUNC_IMPL(convert_yuv_rgb)
     shift = 8;
 
   YUVRGBConversionFunc convFn = m_RGBConvFuncs[outFmt][ditherMode][bYCgCo][inputFormat][shift];
-  if (convFn == nullptr) {
-    ASSERT(0);
+  ASSERT(convFn);
+
+  *pDithers = dithers;
+  return convFn;
+}
+
+DECLARE_CONV_FUNC_IMPL(convert_yuv_rgb)
+{
+  const RGBCoeffs *coeffs = getRGBCoeffs(width, height);
+  if (coeffs == nullptr)
+    return E_OUTOFMEMORY;
+
+  const uint16_t *dithers = nullptr;
+  YUVRGBConversionFunc convFn = GetRGBConvFunc(inputFormat, bpp, outputFormat, height, &dithers);
+  if (convFn == nullptr)
     return E_FAIL;
-  }
 
-  // run conversion, threaded
-  if (m_NumThreads <= 1) {
-    convFn(src[0], src[1], src[2], dst[0], width, height, srcStride[0], srcStride[1], dstStride[0], 0, height, coeffs, dithers);
-  } else {
-    const int is_odd = (inputFormat == LAVPixFmt_YUV420 || inputFormat == LAVPixFmt_NV12 || inputFormat == LAVPixFmt_P016);
-    const ptrdiff_t lines_per_thread = (height / m_NumThreads)&~1;
-
-    Concurrency::parallel_for(0, m_NumThreads, [&](int i) {
-      const ptrdiff_t starty = (i * lines_per_thread);
-      const ptrdiff_t endy = (i == (m_NumThreads - 1)) ? height : starty + lines_per_thread + is_odd;
-      convFn(src[0], src[1], src[2], dst[0], width, height, srcStride[0], srcStride[1], dstStride[0], starty + (i ? is_odd : 0), endy, coeffs, dithers);
-    });
-  }
+  // run conversion, sliced over threads
+  const int is_odd = (inputFormat == LAVPixFmt_YUV420 || inputFormat == LAVPixFmt_NV12 || inputFormat == LAVPixFmt_P016);
+  RunSlices(width, height, [&](int, int starty, int endy) {
+    convFn(src[0], src[1], src[2], dst[0], width, height, srcStride[0], srcStride[1], dstStride[0], starty + (starty ? is_odd : 0), (endy == height) ? endy : endy + is_odd, coeffs, dithers);
+  });
 
   return S_OK;
 }
 
+// NV12 and P010 frames in USWC memory, see ConvertStaged
+DECLARE_CONV_FUNC_IMPL(convert_yuv_rgb_direct)
+{
+  // the last line of odd heights reads chroma outside of the staged block
+  if (height & 1)
+    return convert_yuv_rgb(src, srcStride, dst, dstStride, width, height, inputFormat, bpp, outputFormat);
+
+  const RGBCoeffs *coeffs = getRGBCoeffs(width, height);
+  if (coeffs == nullptr)
+    return E_OUTOFMEMORY;
+
+  const uint16_t *dithers = nullptr;
+  YUVRGBConversionFunc convFn = GetRGBConvFunc(inputFormat, bpp, outputFormat, height, &dithers);
+  if (convFn == nullptr)
+    return E_FAIL;
+
+  return ConvertStaged(src, srcStride, width, height, [&](const uint8_t *y, const uint8_t *uv, ptrdiff_t stride, int origin, int blockHeight, ptrdiff_t sliceYStart, ptrdiff_t sliceYEnd) {
+    convFn(y, uv, uv, dst[0] + origin * dstStride[0], width, blockHeight, stride, stride, dstStride[0], sliceYStart, sliceYEnd, coeffs, dithers ? dithers + origin * 24 * DITHER_STEPS : nullptr);
+  });
+}
+
 #define CONV_FUNC_INT2(out32, dither, ycgco, format, shift) \
   m_RGBConvFuncs[out32][dither][ycgco][format][shift] = yuv2rgb_convert<format, shift, out32, dither, ycgco>;
 
@@ -579,117 +600,135 @@ void CLAVPixFmtConverter::InitRGBConvDispatcher()
   CONV_FUNCX(LAVPixFmt_YUV420);
   CONV_FUNCX(LAVPixFmt_YUV422);
   CONV_FUNCX(LAVPixFmt_YUV444);
+
+  // Replace them with the AVX2 versions if the CPU supports them
+  if (av_get_cpu_flags() & AV_CPU_FLAG_AVX2)
+    InitRGBConvDispatcherAVX2();
 }
 
 const RGBCoeffs* CLAVPixFmtConverter::getRGBCoeffs(int width, int height)
 {
-  if (!m_rgbCoeffs || width != swsWidth || height != swsHeight) {
-    swsWidth = width;
-    swsHeight = height;
-
-    if (!m_rgbCoeffs) {
-      m_rgbCoeffs = (RGBCoeffs *)_aligned_malloc(sizeof(RGBCoeffs), 16);
-      if (m_rgbCoeffs == nullptr)
-        return nullptr;
+  // Look for matching coefficients, and otherwise replace the least recently used ones
+  RGBCoeffsCacheEntry *entry = &m_RGBCoeffsCache[0];
+  for (int i = 0; i < SWS_CACHE_SIZE; i++) {
+    RGBCoeffsCacheEntry *e = &m_RGBCoeffsCache[i];
+    if (e->coeffs && e->width == width && e->height == height && e->colorProps == m_ColorProps.value && e->outputRange == swsOutputRange) {
+      e->lastUse = ++m_CacheUseCounter;
+      return e->coeffs;
     }
+    if (!e->coeffs || (entry->coeffs && e->lastUse < entry->lastUse))
+      entry = e;
+  }
 
-    DXVA2_VideoTransferMatrix matrix = (DXVA2_VideoTransferMatrix)m_ColorProps.VideoTransferMatrix;
-    if (matrix == DXVA2_VideoTransferMatrix_Unknown) {
-      matrix = (swsHeight > 576 || swsWidth > 1024) ? DXVA2_VideoTransferMatrix_BT709 : DXVA2_VideoTransferMatrix_BT601;
-    }
+  if (!entry->coeffs) {
+    entry->coeffs = (RGBCoeffs *)_aligned_malloc(sizeof(RGBCoeffs), 16);
+    if (entry->coeffs == nullptr)
+      return nullptr;
+  }
+  entry->width = width;
+  entry->height = height;
+  entry->colorProps = m_ColorProps.value;
+  entry->outputRange = swsOutputRange;
+  entry->lastUse = ++m_CacheUseCounter;
 
-    BOOL inFullRange = (m_ColorProps.NominalRange == DXVA2_NominalRange_0_255);
-    BOOL outFullRange = (swsOutputRange == 0) ? inFullRange : (swsOutputRange == 2);
+  RGBCoeffs *coeffs = entry->coeffs;
 
-    int inputWhite, inputBlack, inputChroma, outputWhite, outputBlack;
-    if (inFullRange) {
-      inputWhite = 255;
-      inputBlack = 0;
-      inputChroma = 1;
-    } else {
-      inputWhite = 235;
-      inputBlack = 16;
-      inputChroma = 16;
-    }
+  DXVA2_VideoTransferMatrix matrix = (DXVA2_VideoTransferMatrix)m_ColorProps.VideoTransferMatrix;
+  if (matrix == DXVA2_VideoTransferMatrix_Unknown) {
+    matrix = (height > 576 || width > 1024) ? DXVA2_VideoTransferMatrix_BT709 : DXVA2_VideoTransferMatrix_BT601;
+  }
 
-    if (outFullRange) {
-      outputWhite = 255;
-      outputBlack = 0;
-    } else {
-      outputWhite = 235;
-      outputBlack = 16;
-    }
+  BOOL inFullRange = (m_ColorProps.NominalRange == DXVA2_NominalRange_0_255);
+  BOOL outFullRange = (swsOutputRange == 0) ? inFullRange : (swsOutputRange == 2);
 
-    double Kr, Kg, Kb;
-    switch (matrix) {
-    case DXVA2_VideoTransferMatrix_BT601:
-      Kr = 0.299;
-      Kg = 0.587;
-      Kb = 0.114;
-      break;
-    case DXVA2_VideoTransferMatrix_SMPTE240M:
-      Kr = 0.2120;
-      Kg = 0.7010;
-      Kb = 0.0870;
-      break;
-    case 6: // FCC
-      Kr = 0.300;
-      Kg = 0.590;
-      Kb = 0.110;
-      break;
-    case 4: // BT.2020
-      Kr = 0.2627;
-      Kg = 0.6780;
-      Kb = 0.0593;
-      break;
-    default:
-      DbgLog((LOG_TRACE, 10, L"::getRGBCoeffs(): Unknown color space: %d - defaulting to BT709", matrix));
-    case DXVA2_VideoTransferMatrix_BT709:
-      Kr = 0.2126;
-      Kg = 0.7152;
-      Kb = 0.0722;
-      break;
-    }
+  int inputWhite, inputBlack, inputChroma, outputWhite, outputBlack;
+  if (inFullRange) {
+    inputWhite = 255;
+    inputBlack = 0;
+    inputChroma = 1;
+  } else {
+    inputWhite = 235;
+    inputBlack = 16;
+    inputChroma = 16;
+  }
 
-    double in_y_range = inputWhite - inputBlack;
-    double chr_range = 128 - inputChroma;
-
-    double cspOptionsRGBrange = outputWhite - outputBlack;
-
-    double y_mul, vr_mul, ug_mul, vg_mul, ub_mul;
-    y_mul  = cspOptionsRGBrange / in_y_range;
-    vr_mul = (cspOptionsRGBrange / chr_range) * (1.0 - Kr);
-    ug_mul = (cspOptionsRGBrange / chr_range) * (1.0 - Kb) * Kb / Kg;
-    vg_mul = (cspOptionsRGBrange / chr_range) * (1.0 - Kr) * Kr / Kg;
-    ub_mul = (cspOptionsRGBrange / chr_range) * (1.0 - Kb);
-    short sub = min(outputBlack, inputBlack);
-    short Ysub = inputBlack - sub;
-    short RGB_add1 = outputBlack - sub;
-
-    short cy  = short(y_mul * 16384 + 0.5);
-    short crv = short(vr_mul * 8192 + 0.5);
-    short cgu = short(-ug_mul * 8192 - 0.5);
-    short cgv = short(-vg_mul * 8192 - 0.5);
-    short cbu = short(ub_mul * 8192 + 0.5);
-
-    m_rgbCoeffs->Ysub        = _mm_set1_epi16(Ysub << 6);
-    m_rgbCoeffs->cy          = _mm_set1_epi16(cy);
-    m_rgbCoeffs->CbCr_center = _mm_set1_epi16(128 << 4);
-
-    m_rgbCoeffs->cR_Cr       = _mm_set1_epi32(crv << 16);         // R
-    m_rgbCoeffs->cG_Cb_cG_Cr = _mm_set1_epi32((cgv << 16) + cgu); // G
-    m_rgbCoeffs->cB_Cb       = _mm_set1_epi32(cbu);               // B
-
-    m_rgbCoeffs->rgb_add     = _mm_set1_epi16(RGB_add1 << 4);
-
-    // YCgCo
-    if (matrix == 7) {
-      m_rgbCoeffs->CbCr_center = _mm_set1_epi16(0x0800);
-      // Other Coeffs are not used in YCgCo
-    }
+  if (outFullRange) {
+    outputWhite = 255;
+    outputBlack = 0;
+  } else {
+    outputWhite = 235;
+    outputBlack = 16;
+  }
 
+  double Kr, Kg, Kb;
+  switch (matrix) {
+  case DXVA2_VideoTransferMatrix_BT601:
+    Kr = 0.299;
+    Kg = 0.587;
+    Kb = 0.114;
+    break;
+  case DXVA2_VideoTransferMatrix_SMPTE240M:
+    Kr = 0.2120;
+    Kg = 0.7010;
+    Kb = 0.0870;
+    break;
+  case 6: // FCC
+    Kr = 0.300;
+    Kg = 0.590;
+    Kb = 0.110;
+    break;
+  case 4: // BT.2020
+    Kr = 0.2627;
+    Kg = 0.6780;
+    Kb = 0.0593;
+    break;
+  default:
+    DbgLog((LOG_TRACE, 10, L"::getRGBCoeffs(): Unknown color space: %d - defaulting to BT709", matrix));
+  case DXVA2_VideoTransferMatrix_BT709:
+    Kr = 0.2126;
+    Kg = 0.7152;
+    Kb = 0.0722;
+    break;
   }
-  return m_rgbCoeffs;
+
+  double in_y_range = inputWhite - inputBlack;
+  double chr_range = 128 - inputChroma;
+
+  double cspOptionsRGBrange = outputWhite - outputBlack;
+
+  double y_mul, vr_mul, ug_mul, vg_mul, ub_mul;
+  y_mul  = cspOptionsRGBrange / in_y_range;
+  vr_mul = (cspOptionsRGBrange / chr_range) * (1.0 - Kr);
+  ug_mul = (cspOptionsRGBrange / chr_range) * (1.0 - Kb) * Kb / Kg;
+  vg_mul = (cspOptionsRGBrange / chr_range) * (1.0 - Kr) * Kr / Kg;
+  ub_mul = (cspOptionsRGBrange / chr_range) * (1.0 - Kb);
+  short sub = min(outputBlack, inputBlack);
+  short Ysub = inputBlack - sub;
+  short RGB_add1 = outputBlack - sub;
+
+  short cy  = short(y_mul * 16384 + 0.5);
+  short crv = short(vr_mul * 8192 + 0.5);
+  short cgu = short(-ug_mul * 8192 - 0.5);
+  short cgv = short(-vg_mul * 8192 - 0.5);
+  short cbu = short(ub_mul * 8192 + 0.5);
+
+  coeffs->Ysub        = _mm_set1_epi16(Ysub << 6);
+  coeffs->cy          = _mm_set1_epi16(cy);
+  coeffs->CbCr_center = _mm_set1_epi16(128 << 4);
+
+  coeffs->cR_Cr       = _mm_set1_epi32(crv << 16);         // R
+  coeffs->cG_Cb_cG_Cr = _mm_set1_epi32((cgv << 16) + cgu); // G
+  coeffs->cB_Cb       = _mm_set1_epi32(cbu);               // B
+
+  coeffs->rgb_add     = _mm_set1_epi16(RGB_add1 << 4);
+
+  // YCgCo
+  if (matrix == 7) {
+    coeffs->CbCr_center = _mm_set1_epi16(0x0800);
+    // Other Coeffs are not used in YCgCo
+  }
+
+  return coeffs;
 }
 
 #pragma warning(pop)
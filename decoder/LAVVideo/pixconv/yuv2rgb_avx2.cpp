@@ -0,0 +1,524 @@
+/*
+ *      Copyright (C) 2010-2019 Hendrik Leppkes
+ *      http://www.1f0.de
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program; if not, write to the Free Software Foundation, Inc.,
+ *  51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#include "stdafx.h"
+
+#include "pixconv_internal.h"
+#include "pixconv_avx2_templates.h"
+
+#pragma warning(push)
+#pragma warning(disable: 4556)
+
+#define DITHER_STEPS 3
+
+// AVX2 version of the YUV->RGB converter in yuv2rgb.cpp
+//
+// The conversion math is identical to the SSE2 version. Each 128-bit lane processes one
+// block of 4x2 pixels exactly like the SSE2 version does, so one call converts 8x2 pixels.
+
+// The RGBCoeffs broadcast into both lanes
+typedef struct {
+  __m256i Ysub;
+  __m256i CbCr_center;
+  __m256i rgb_add;
+  __m256i cy;
+  __m256i cR_Cr;
+  __m256i cG_Cb_cG_Cr;
+  __m256i cB_Cb;
+} RGBCoeffsAVX2;
+
+// This function converts 8x2 pixels from the source into 8x2 RGB pixels in the destination
+// For lanes = 1, only the first 4x2 pixels are converted
+// right_edge marks the last block of pixels in the line, which is in the last lane
+template <LAVPixelFormat inputFormat, int shift, int outFmt, int right_edge, int lanes, int dithertype, int ycgco> __forceinline
+static int yuv2rgb_convert_pixels_avx2(const uint8_t* &srcY, const uint8_t* &srcU, const uint8_t* &srcV, uint8_t* &dst, ptrdiff_t srcStrideY, ptrdiff_t srcStrideUV, ptrdiff_t dstStride, ptrdiff_t line, const RGBCoeffsAVX2 &coeffs, const uint16_t* &dithers, ptrdiff_t pos)
+{
+  __m256i ymm0,ymm1,ymm2,ymm3,ymm4,ymm5,ymm6,ymm7;
+  ymm7 = _mm256_setzero_si256 ();
+
+  // Source advance for 4 pixels
+  const ptrdiff_t uvStep = (inputFormat == LAVPixFmt_P016) ? 8 : (inputFormat == LAVPixFmt_YUV444) ? (shift > 0 ? 8 : 4) : ((shift > 0 || inputFormat == LAVPixFmt_NV12) ? 4 : 2);
+  const ptrdiff_t yStep = (shift > 0) ? 8 : 4;
+
+  // Offset of the second lane, with one lane it just loads the same pixels again
+  const ptrdiff_t uvLane = (lanes == 2) ? uvStep : 0;
+  const ptrdiff_t yLane = (lanes == 2) ? yStep : 0;
+
+  // Shift > 0 is for 9/10 bit formats
+  if (inputFormat == LAVPixFmt_P016) {
+    // Load 2 32-bit macro pixels from each line, which contain 4 UV at 16-bit each samples
+    PIXCONV_AVX2_LOAD_LANES(ymm0, srcU, srcU+uvLane);
+    PIXCONV_AVX2_LOAD_LANES(ymm2, srcU+srcStrideUV, srcU+srcStrideUV+uvLane);
+  } else if (shift > 0) {
+    // Load 4 U/V values from line 0/1 into registers
+    PIXCONV_AVX2_LOAD_4PIXEL16X2(ymm1, srcU, srcU+uvLane);
+    PIXCONV_AVX2_LOAD_4PIXEL16X2(ymm3, srcU+srcStrideUV, srcU+srcStrideUV+uvLane);
+    PIXCONV_AVX2_LOAD_4PIXEL16X2(ymm0, srcV, srcV+uvLane);
+    PIXCONV_AVX2_LOAD_4PIXEL16X2(ymm2, srcV+srcStrideUV, srcV+srcStrideUV+uvLane);
+
+    // Interleave U and V
+    ymm0 = _mm256_unpacklo_epi16(ymm1, ymm0);                    /* 0V0U0V0U */
+    ymm2 = _mm256_unpacklo_epi16(ymm3, ymm2);                    /* 0V0U0V0U */
+  } else if (inputFormat == LAVPixFmt_NV12) {
+    // Load 4 16-bit macro pixels, which contain 4 UV samples
+    PIXCONV_AVX2_LOAD_4PIXEL16X2(ymm0, srcU, srcU+uvLane);
+    PIXCONV_AVX2_LOAD_4PIXEL16X2(ymm2, srcU+srcStrideUV, srcU+srcStrideUV+uvLane);
+
+    // Expand to 16-bit
+    ymm0 = _mm256_unpacklo_epi8(ymm0, ymm7);                     /* 0V0U0V0U */
+    ymm2 = _mm256_unpacklo_epi8(ymm2, ymm7);                     /* 0V0U0V0U */
+  } else {
+    PIXCONV_AVX2_LOAD_4PIXEL8X2(ymm1, srcU, srcU+uvLane);
+    PIXCONV_AVX2_LOAD_4PIXEL8X2(ymm3, srcU+srcStrideUV, srcU+srcStrideUV+uvLane);
+    PIXCONV_AVX2_LOAD_4PIXEL8X2(ymm0, srcV, srcV+uvLane);
+    PIXCONV_AVX2_LOAD_4PIXEL8X2(ymm2, srcV+srcStrideUV, srcV+srcStrideUV+uvLane);
+
+    // Interleave U and V
+    ymm0 = _mm256_unpacklo_epi8(ymm1, ymm0);                     /* VUVU0000 */
+    ymm2 = _mm256_unpacklo_epi8(ymm3, ymm2);                     /* VUVU0000 */
+
+    // Expand to 16-bit
+    ymm0 = _mm256_unpacklo_epi8(ymm0, ymm7);                     /* 0V0U0V0U */
+    ymm2 = _mm256_unpacklo_epi8(ymm2, ymm7);                     /* 0V0U0V0U */
+  }
+
+  srcU += uvStep * lanes;
+  srcV += uvStep * lanes;
+
+  // ymm0/ymm2 contain 4 interleaved U/V samples from two lines each in the 16bit parts of each lane, still in their native bitdepth
+
+  // Chroma upsampling required
+  if (inputFormat == LAVPixFmt_YUV420 || inputFormat == LAVPixFmt_NV12 || inputFormat == LAVPixFmt_YUV422 || inputFormat == LAVPixFmt_P016) {
+    // Cut off the over-read into the stride and replace it with the last valid pixel
+    if (right_edge) {
+      if (lanes == 2)
+        ymm6 = _mm256_set_epi32(0, 0xffffffff, 0, 0, 0, 0, 0, 0);
+      else
+        ymm6 = _mm256_set_epi32(0, 0xffffffff, 0, 0, 0, 0xffffffff, 0, 0);
+
+      // First line
+      ymm1 = _mm256_slli_si256(ymm0, 4);
+      ymm1 = _mm256_and_si256(ymm1, ymm6);
+      ymm0 = _mm256_andnot_si256(ymm6, ymm0);
+      ymm0 = _mm256_or_si256(ymm0, ymm1);
+
+      // Second line
+      ymm3 = _mm256_slli_si256(ymm2, 4);
+      ymm3 = _mm256_and_si256(ymm3, ymm6);
+      ymm2 = _mm256_andnot_si256(ymm6, ymm2);
+      ymm2 = _mm256_or_si256(ymm2, ymm3);
+    }
+
+    // 4:2:0 - upsample to 4:2:2 using 75:25
+    if (inputFormat == LAVPixFmt_YUV420 || inputFormat == LAVPixFmt_NV12 || inputFormat == LAVPixFmt_P016) {
+      // Too high bitdepth, shift down to 14-bit
+      if (shift >= 7) {
+        ymm0 = _mm256_srli_epi16(ymm0, shift-6);
+        ymm2 = _mm256_srli_epi16(ymm2, shift-6);
+      }
+      ymm1 = _mm256_add_epi16(ymm0, ymm0);                       /* 2x line 0 */
+      ymm1 = _mm256_add_epi16(ymm1, ymm0);                       /* 3x line 0 */
+      ymm1 = _mm256_add_epi16(ymm1, ymm2);                       /* 3x line 0 + line 1 (10bit) */
+
+      ymm3 = _mm256_add_epi16(ymm2, ymm2);                       /* 2x line 1 */
+      ymm3 = _mm256_add_epi16(ymm3, ymm2);                       /* 3x line 1 */
+      ymm3 = _mm256_add_epi16(ymm3, ymm0);                       /* 3x line 1 + line 0 (10bit) */
+
+      // If the bit depth is too high, we need to reduce it here (max 15bit)
+      // 14-16 bits need the reduction, because they all result in a 16-bit result
+      if (shift >= 6) {
+        ymm1 = _mm256_srli_epi16(ymm1, 1);
+        ymm3 = _mm256_srli_epi16(ymm3, 1);
+      }
+    } else {
+      ymm1 = ymm0;
+      ymm3 = ymm2;
+
+      // Shift to maximum of 15-bit, if required
+      if (shift >= 8) {
+        ymm1 = _mm256_srli_epi16(ymm1, 1);
+        ymm3 = _mm256_srli_epi16(ymm3, 1);
+      }
+    }
+
+    // Upsample to 4:4:4 using 100:0, 50:50, 0:100 scheme (MPEG2 chroma siting)
+    ymm0 = _mm256_unpacklo_epi32(ymm1, ymm7);                    /* UV 00 UV 00 */
+    ymm1 = _mm256_srli_si256(ymm1, 4);                           /* UV UV UV 00 */
+    ymm1 = _mm256_unpacklo_epi32(ymm7, ymm1);                    /* 00 UV 00 UV */
+
+    ymm1 = _mm256_add_epi16(ymm1, ymm0);                         /*  UV  UV  UV  UV */
+    ymm1 = _mm256_add_epi16(ymm1, ymm0);                         /* 2UV  UV 2UV  UV */
+
+    ymm0 = _mm256_slli_si256(ymm0, 4);                           /*  00  UV  00  UV */
+    ymm1 = _mm256_add_epi16(ymm1, ymm0);                         /* 2UV 2UV 2UV 2UV */
+
+    // Same for the second row
+    ymm2 = _mm256_unpacklo_epi32(ymm3, ymm7);                    /* UV 00 UV 00 */
+    ymm3 = _mm256_srli_si256(ymm3, 4);                           /* UV UV UV 00 */
+    ymm3 = _mm256_unpacklo_epi32(ymm7, ymm3);                    /* 00 UV 00 UV */
+
+    ymm3 = _mm256_add_epi16(ymm3, ymm2);                         /*  UV  UV  UV  UV */
+    ymm3 = _mm256_add_epi16(ymm3, ymm2);                         /* 2UV  UV 2UV  UV */
+
+    ymm2 = _mm256_slli_si256(ymm2, 4);                           /*  00  UV  00  UV */
+    ymm3 = _mm256_add_epi16(ymm3, ymm2);                         /* 2UV 2UV 2UV 2UV */
+
+    // Shift the result to 12 bit
+    if ((inputFormat == LAVPixFmt_YUV420 && shift > 1) || inputFormat == LAVPixFmt_P016) {
+      if (shift >= 5) {
+        ymm1 = _mm256_srli_epi16(ymm1, 4);
+        ymm3 = _mm256_srli_epi16(ymm3, 4);
+      } else {
+        ymm1 = _mm256_srli_epi16(ymm1, shift-1);
+        ymm3 = _mm256_srli_epi16(ymm3, shift-1);
+      }
+    } else if (inputFormat == LAVPixFmt_YUV422) {
+      if (shift >= 7) {
+        ymm1 = _mm256_srli_epi16(ymm1, 4);
+        ymm3 = _mm256_srli_epi16(ymm3, 4);
+      } else if (shift > 3) {
+        ymm1 = _mm256_srli_epi16(ymm1, shift-3);
+        ymm3 = _mm256_srli_epi16(ymm3, shift-3);
+      } else if (shift < 3) {
+        ymm1 = _mm256_slli_epi16(ymm1, 3-shift);
+        ymm3 = _mm256_slli_epi16(ymm3, 3-shift);
+      }
+    } else if ((inputFormat == LAVPixFmt_YUV420 && shift == 0) || inputFormat == LAVPixFmt_NV12) {
+      ymm1 = _mm256_slli_epi16(ymm1, 1);
+      ymm3 = _mm256_slli_epi16(ymm3, 1);
+    }
+
+    // 12-bit result, ymm1 & ymm3 with 4 UV combinations in each lane
+  } else if (inputFormat == LAVPixFmt_YUV444) {
+    // Shift to 12 bit
+    if (shift > 4) {
+      ymm1 = _mm256_srli_epi16(ymm0, shift-4);
+      ymm3 = _mm256_srli_epi16(ymm2, shift-4);
+    } else if (shift < 4) {
+      ymm1 = _mm256_slli_epi16(ymm0, 4-shift);
+      ymm3 = _mm256_slli_epi16(ymm2, 4-shift);
+    } else {
+      ymm1 = ymm0;
+      ymm3 = ymm2;
+    }
+  }
+
+  // Load Y
+  if (shift > 0) {
+    // Load 4 Y values from line 0/1 into registers
+    PIXCONV_AVX2_LOAD_4PIXEL16X2(ymm5, srcY, srcY+yLane);
+    PIXCONV_AVX2_LOAD_4PIXEL16X2(ymm0, srcY+srcStrideY, srcY+srcStrideY+yLane);
+  } else {
+    PIXCONV_AVX2_LOAD_4PIXEL8X2(ymm5, srcY, srcY+yLane);
+    PIXCONV_AVX2_LOAD_4PIXEL8X2(ymm0, srcY+srcStrideY, srcY+srcStrideY+yLane);
+
+    ymm5 = _mm256_unpacklo_epi8(ymm5, ymm7);                     /* YYYY0000 (16-bit fields) */
+    ymm0 = _mm256_unpacklo_epi8(ymm0, ymm7);                     /* YYYY0000 (16-bit fields)*/
+  }
+  srcY += yStep * lanes;
+
+  ymm0 = _mm256_unpacklo_epi64(ymm0, ymm5);                      /* YYYYYYYY */
+
+  if (!ycgco) {
+    // YCbCr conversion
+    // Shift Y to 14 bits
+    if (shift < 6) {
+      ymm0 = _mm256_slli_epi16(ymm0, 6-shift);
+    } else if (shift > 6) {
+      ymm0 = _mm256_srli_epi16(ymm0, shift-6);
+    }
+    ymm0 = _mm256_subs_epu16(ymm0, coeffs.Ysub);                 /* Y-16 (in case of range expansion) */
+    ymm0 = _mm256_mulhi_epi16(ymm0, coeffs.cy);                  /* Y*cy (result is 28 bits, with 12 high-bits packed into the result) */
+    ymm0 = _mm256_add_epi16(ymm0, coeffs.rgb_add);               /* Y*cy + 16 (in case of range compression) */
+
+    ymm1 = _mm256_subs_epi16(ymm1, coeffs.CbCr_center);          /* move CbCr to proper range */
+    ymm3 = _mm256_subs_epi16(ymm3, coeffs.CbCr_center);
+
+    ymm6 = _mm256_madd_epi16(ymm1, coeffs.cR_Cr);                /* Result is 25 bits (12 from chroma, 13 from coeff) */
+    ymm4 = _mm256_madd_epi16(ymm3, coeffs.cR_Cr);
+    ymm6 = _mm256_srai_epi32(ymm6, 13);                          /* Reduce to 12 bit */
+    ymm4 = _mm256_srai_epi32(ymm4, 13);
+    ymm6 = _mm256_packs_epi32(ymm6, ymm7);                       /* Pack back into 16 bit cells */
+    ymm4 = _mm256_packs_epi32(ymm4, ymm7);
+    ymm6 = _mm256_unpacklo_epi64(ymm4, ymm6);                    /* Interleave both parts */
+    ymm6 = _mm256_add_epi16(ymm6, ymm0);                         /* R (12bit) */
+
+    ymm5 = _mm256_madd_epi16(ymm1, coeffs.cG_Cb_cG_Cr);          /* Result is 25 bits (12 from chroma, 13 from coeff) */
+    ymm4 = _mm256_madd_epi16(ymm3, coeffs.cG_Cb_cG_Cr);
+    ymm5 = _mm256_srai_epi32(ymm5, 13);                          /* Reduce to 12 bit */
+    ymm4 = _mm256_srai_epi32(ymm4, 13);
+    ymm5 = _mm256_packs_epi32(ymm5, ymm7);                       /* Pack back into 16 bit cells */
+    ymm4 = _mm256_packs_epi32(ymm4, ymm7);
+    ymm5 = _mm256_unpacklo_epi64(ymm4, ymm5);                    /* Interleave both parts */
+    ymm5 = _mm256_add_epi16(ymm5, ymm0);                         /* G (12bit) */
+
+    ymm1 = _mm256_madd_epi16(ymm1, coeffs.cB_Cb);                /* Result is 25 bits (12 from chroma, 13 from coeff) */
+    ymm3 = _mm256_madd_epi16(ymm3, coeffs.cB_Cb);
+    ymm1 = _mm256_srai_epi32(ymm1, 13);                          /* Reduce to 12 bit */
+    ymm3 = _mm256_srai_epi32(ymm3, 13);
+    ymm1 = _mm256_packs_epi32(ymm1, ymm7);                       /* Pack back into 16 bit cells */
+    ymm3 = _mm256_packs_epi32(ymm3, ymm7);
+    ymm1 = _mm256_unpacklo_epi64(ymm3, ymm1);                    /* Interleave both parts */
+    ymm1 = _mm256_add_epi16(ymm1, ymm0);                         /* B (12bit) */
+  } else {
+    // YCgCo conversion
+    // Shift Y to 12 bits
+    if (shift < 4) {
+      ymm0 = _mm256_slli_epi16(ymm0, 4-shift);
+    } else if (shift > 4) {
+      ymm0 = _mm256_srli_epi16(ymm0, shift-4);
+    }
+
+    ymm7 = _mm256_set1_epi32(0x0000FFFF);
+    ymm2 = ymm1;
+    ymm4 = ymm3;
+
+    ymm1 = _mm256_and_si256(ymm1, ymm7);                         /* null out the high-order bytes to get the Cg values */
+    ymm4 = _mm256_and_si256(ymm4, ymm7);
+
+    ymm3 = _mm256_srli_epi32(ymm3, 16);                          /* right shift the Co values */
+    ymm2 = _mm256_srli_epi32(ymm2, 16);
+
+    ymm1 = _mm256_packs_epi32(ymm4, ymm1);                       /* Pack Cg into ymm1 */
+    ymm3 = _mm256_packs_epi32(ymm3, ymm2);                       /* Pack Co into ymm3 */
+
+    ymm2 = coeffs.CbCr_center;                                   /* move CgCo to proper range */
+    ymm1 = _mm256_subs_epi16(ymm1, ymm2);
+    ymm3 = _mm256_subs_epi16(ymm3, ymm2);
+
+    ymm2 = _mm256_subs_epi16(ymm0, ymm1);                        /* tmp = Y - Cg */
+    ymm6 = _mm256_adds_epi16(ymm2, ymm3);                        /* R = tmp + Co */
+    ymm5 = _mm256_adds_epi16(ymm0, ymm1);                        /* G = Y + Cg */
+    ymm1 = _mm256_subs_epi16(ymm2, ymm3);                        /* B = tmp - Co */
+  }
+
+  // Dithering
+  if (dithertype == LAVDither_Random) {
+    /* Load random dithering coeffs from the dithers buffer, each lane uses the coefficients of its block */
+    int offset0 = (pos % (DITHER_STEPS * 4 * 2)) * 6;
+    int offset1 = (lanes == 2) ? ((pos + 4) % (DITHER_STEPS * 4 * 2)) * 6 : offset0;
+    PIXCONV_AVX2_LOAD_LANES(ymm2, dithers +  0 + offset0, dithers +  0 + offset1);
+    PIXCONV_AVX2_LOAD_LANES(ymm3, dithers +  8 + offset0, dithers +  8 + offset1);
+    PIXCONV_AVX2_LOAD_LANES(ymm4, dithers + 16 + offset0, dithers + 16 + offset1);
+  } else {
+    /* Load dithering coeffs and combine them for two lines */
+    const uint16_t *d1 = dither_8x8_256[line % 8];
+    __m128i xmm2 = _mm_load_si128((const __m128i *)d1);
+    const uint16_t *d2 = dither_8x8_256[(line+1) % 8];
+    __m128i xmm3 = _mm_load_si128((const __m128i *)d2);
+
+    __m128i xmm4 = _mm_unpackhi_epi64(xmm2, xmm3);
+    xmm2 = _mm_unpacklo_epi64(xmm2, xmm3);
+
+    ymm2 = _mm256_srli_epi16(_mm256_broadcastsi128_si256(xmm2), 4);
+    ymm4 = _mm256_srli_epi16(_mm256_broadcastsi128_si256(xmm4), 4);
+
+    ymm3 = ymm4;
+  }
+
+  ymm6 = _mm256_adds_epu16(ymm6, ymm2);                          /* Apply coefficients to the RGB values */
+  ymm5 = _mm256_adds_epu16(ymm5, ymm3);
+  ymm1 = _mm256_adds_epu16(ymm1, ymm4);
+
+  ymm6 = _mm256_srai_epi16(ymm6, 4);                             /* Shift to 8 bit */
+  ymm5 = _mm256_srai_epi16(ymm5, 4);
+  ymm1 = _mm256_srai_epi16(ymm1, 4);
+
+  ymm2 = _mm256_cmpeq_epi8(ymm2, ymm2);                          /* 0xffffffff,0xffffffff,0xffffffff,0xffffffff */
+  ymm6 = _mm256_packus_epi16(ymm6, ymm7);                        /* R (lower 8bytes,8bit) * 8 */
+  ymm5 = _mm256_packus_epi16(ymm5, ymm7);                        /* G (lower 8bytes,8bit) * 8 */
+  ymm1 = _mm256_packus_epi16(ymm1, ymm7);                        /* B (lower 8bytes,8bit) * 8 */
+
+  ymm6 = _mm256_unpacklo_epi8(ymm6,ymm2); // 0xff,R
+  ymm1 = _mm256_unpacklo_epi8(ymm1,ymm5); // G,B
+  ymm2 = ymm1;
+
+  ymm1 = _mm256_unpackhi_epi16(ymm1, ymm6); // 0xff,RGB * 4 (line 0)
+  ymm2 = _mm256_unpacklo_epi16(ymm2, ymm6); // 0xff,RGB * 4 (line 1)
+
+  if (outFmt == 1) {
+    if (lanes == 2) {
+      PIXCONV_AVX2_PUT_STREAM(dst, ymm1);
+      PIXCONV_AVX2_PUT_STREAM(dst + dstStride, ymm2);
+    } else {
+      PIXCONV_PUT_STREAM(dst, _mm256_castsi256_si128(ymm1));
+      PIXCONV_PUT_STREAM(dst + dstStride, _mm256_castsi256_si128(ymm2));
+    }
+    dst += 16 * lanes;
+  } else {
+    // Drop the alpha bytes, leaving 12 bytes of RGB 24 in each lane
+    const __m256i rgb24mask = _mm256_setr_epi8(0,1,2,4,5,6,8,9,10,12,13,14,-1,-1,-1,-1,0,1,2,4,5,6,8,9,10,12,13,14,-1,-1,-1,-1);
+    ymm1 = _mm256_shuffle_epi8(ymm1, rgb24mask);
+    ymm2 = _mm256_shuffle_epi8(ymm2, rgb24mask);
+
+    __m128i xmm1 = _mm256_castsi256_si128(ymm1);
+    __m128i xmm2 = _mm256_castsi256_si128(ymm2);
+
+    _mm_storel_epi64((__m128i *)(dst), xmm1);
+    *(uint32_t *)(dst + 8) = _mm_extract_epi32(xmm1, 2);
+    _mm_storel_epi64((__m128i *)(dst + dstStride), xmm2);
+    *(uint32_t *)(dst + dstStride + 8) = _mm_extract_epi32(xmm2, 2);
+
+    if (lanes == 2) {
+      xmm1 = _mm256_extracti128_si256(ymm1, 1);
+      xmm2 = _mm256_extracti128_si256(ymm2, 1);
+
+      _mm_storel_epi64((__m128i *)(dst + 12), xmm1);
+      *(uint32_t *)(dst + 20) = _mm_extract_epi32(xmm1, 2);
+      _mm_storel_epi64((__m128i *)(dst + dstStride + 12), xmm2);
+      *(uint32_t *)(dst + dstStride + 20) = _mm_extract_epi32(xmm2, 2);
+    }
+
+    dst += 12 * lanes;
+  }
+
+  return 0;
+}
+
+// Convert one line (or pair of lines) in blocks of 8x2 pixels
+// The last block of every line replicates the last chroma sample, like in the SSE2 version
+template <LAVPixelFormat inputFormat, int shift, int outFmt, int dithertype, int ycgco> __forceinline
+static void yuv2rgb_convert_line_avx2(const uint8_t *y, const uint8_t *u, const uint8_t *v, uint8_t *rgb, int width, ptrdiff_t srcStrideY, ptrdiff_t srcStrideUV, ptrdiff_t dstStride, ptrdiff_t line, const RGBCoeffsAVX2 &coeffs, const uint16_t *lineDither)
+{
+  // Start of the last block of 4 pixels
+  const ptrdiff_t endx = (((width + 3) >> 2) - 1) * 4;
+
+  ptrdiff_t i;
+  for (i = 0; i < endx - 4; i += 8) {
+    yuv2rgb_convert_pixels_avx2<inputFormat, shift, outFmt, 0, 2, dithertype, ycgco>(y, u, v, rgb, srcStrideY, srcStrideUV, dstStride, line, coeffs, lineDither, i);
+  }
+
+  // One or two blocks are left
+  if (i < endx)
+    yuv2rgb_convert_pixels_avx2<inputFormat, shift, outFmt, 1, 2, dithertype, ycgco>(y, u, v, rgb, srcStrideY, srcStrideUV, dstStride, line, coeffs, lineDither, i);
+  else
+    yuv2rgb_convert_pixels_avx2<inputFormat, shift, outFmt, 1, 1, dithertype, ycgco>(y, u, v, rgb, srcStrideY, srcStrideUV, dstStride, line, coeffs, lineDither, i);
+}
+
+template <LAVPixelFormat inputFormat, int shift, int outFmt, int dithertype, int ycgco>
+static int __stdcall yuv2rgb_convert_avx2(const uint8_t *srcY, const uint8_t *srcU, const uint8_t *srcV, uint8_t *dst, int width, int height, ptrdiff_t srcStrideY, ptrdiff_t srcStrideUV, ptrdiff_t dstStride, ptrdiff_t sliceYStart, ptrdiff_t sliceYEnd, const RGBCoeffs *coeffs, const uint16_t *dithers)
+{
+  const uint8_t *y = srcY;
+  const uint8_t *u = srcU;
+  const uint8_t *v = srcV;
+  uint8_t *rgb = dst;
+
+  ptrdiff_t line = sliceYStart;
+  ptrdiff_t lastLine = sliceYEnd;
+  bool lastLineInOddHeight = false;
+
+  const uint16_t *lineDither = dithers;
+
+  RGBCoeffsAVX2 coeffs256;
+  coeffs256.Ysub        = _mm256_broadcastsi128_si256(coeffs->Ysub);
+  coeffs256.CbCr_center = _mm256_broadcastsi128_si256(coeffs->CbCr_center);
+  coeffs256.rgb_add     = _mm256_broadcastsi128_si256(coeffs->rgb_add);
+  coeffs256.cy          = _mm256_broadcastsi128_si256(coeffs->cy);
+  coeffs256.cR_Cr       = _mm256_broadcastsi128_si256(coeffs->cR_Cr);
+  coeffs256.cG_Cb_cG_Cr = _mm256_broadcastsi128_si256(coeffs->cG_Cb_cG_Cr);
+  coeffs256.cB_Cb       = _mm256_broadcastsi128_si256(coeffs->cB_Cb);
+
+  _mm_sfence();
+
+  // 4:2:0 needs special handling for the first and the last line
+  if (inputFormat == LAVPixFmt_YUV420 || inputFormat == LAVPixFmt_NV12 || inputFormat == LAVPixFmt_P016) {
+    if (line == 0) {
+      yuv2rgb_convert_line_avx2<inputFormat, shift, outFmt, dithertype, ycgco>(y, u, v, rgb, width, 0, 0, 0, line, coeffs256, lineDither);
+      line = 1;
+    }
+    if (lastLine == height)
+      lastLine--;
+  } else if (lastLine == height && (lastLine & 1)) {
+    lastLine--;
+    lastLineInOddHeight = true;
+  }
+
+  for (; line < lastLine; line += 2) {
+    if (dithertype == LAVDither_Random)
+      lineDither = dithers + (line * 24 * DITHER_STEPS);
+    y = srcY + line * srcStrideY;
+
+    if (inputFormat == LAVPixFmt_YUV420 || inputFormat == LAVPixFmt_NV12 || inputFormat == LAVPixFmt_P016) {
+      u = srcU + (line >> 1) * srcStrideUV;
+      v = srcV + (line >> 1) * srcStrideUV;
+    } else {
+      u = srcU + line * srcStrideUV;
+      v = srcV + line * srcStrideUV;
+    }
+
+    rgb = dst + line * dstStride;
+
+    yuv2rgb_convert_line_avx2<inputFormat, shift, outFmt, dithertype, ycgco>(y, u, v, rgb, width, srcStrideY, srcStrideUV, dstStride, line, coeffs256, lineDither);
+  }
+
+  if (inputFormat == LAVPixFmt_YUV420 || inputFormat == LAVPixFmt_NV12 || inputFormat == LAVPixFmt_P016 || lastLineInOddHeight) {
+    if (sliceYEnd == height) {
+      if (dithertype == LAVDither_Random)
+        lineDither = dithers + ((height - 2) * 24 * DITHER_STEPS);
+      y = srcY + (height - 1) * srcStrideY;
+      if (inputFormat == LAVPixFmt_YUV420 || inputFormat == LAVPixFmt_NV12 || inputFormat == LAVPixFmt_P016) {
+        u = srcU + ((height >> 1) - 1)  * srcStrideUV;
+        v = srcV + ((height >> 1) - 1)  * srcStrideUV;
+      } else {
+        u = srcU + (height - 1)  * srcStrideUV;
+        v = srcV + (height - 1)  * srcStrideUV;
+      }
+      rgb = dst + (height - 1) * dstStride;
+
+      yuv2rgb_convert_line_avx2<inputFormat, shift, outFmt, dithertype, ycgco>(y, u, v, rgb, width, 0, 0, 0, line, coeffs256, lineDither);
+    }
+  }
+  return 0;
+}
+
+#define CONV_FUNC_INT2(out32, dither, ycgco, format, shift) \
+  m_RGBConvFuncs[out32][dither][ycgco][format][shift] = yuv2rgb_convert_avx2<format, shift, out32, dither, ycgco>;
+
+#define CONV_FUNC_INT(dither, ycgco, format, shift)  \
+  CONV_FUNC_INT2(0, dither, ycgco, format, shift)    \
+  CONV_FUNC_INT2(1, dither, ycgco, format, shift)    \
+
+#define CONV_FUNC(format, shift)                     \
+  CONV_FUNC_INT(LAVDither_Ordered, 0, format, shift) \
+  CONV_FUNC_INT(LAVDither_Random,  0, format, shift) \
+  CONV_FUNC_INT(LAVDither_Ordered, 1, format, shift) \
+  CONV_FUNC_INT(LAVDither_Random,  1, format, shift) \
+
+#define CONV_FUNCX(format)   \
+  CONV_FUNC(format, 0)       \
+  CONV_FUNC(format, 1)       \
+  CONV_FUNC(format, 2)       \
+  /* CONV_FUNC(format, 3) */ \
+  CONV_FUNC(format, 4)       \
+  /* CONV_FUNC(format, 5) */ \
+  CONV_FUNC(format, 6)       \
+  /* CONV_FUNC(format, 7) */ \
+  CONV_FUNC(format, 8)
+
+void CLAVPixFmtConverter::InitRGBConvDispatcherAVX2()
+{
+  CONV_FUNC(LAVPixFmt_NV12,   0);
+  CONV_FUNC(LAVPixFmt_P016,   8);
+
+  CONV_FUNCX(LAVPixFmt_YUV420);
+  CONV_FUNCX(LAVPixFmt_YUV422);
+  CONV_FUNCX(LAVPixFmt_YUV444);
+}
+
+#pragma warning(pop)
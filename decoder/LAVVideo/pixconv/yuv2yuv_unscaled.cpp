@@ -24,9 +24,13 @@
 #include "pixconv_internal.h"
 #include "pixconv_sse2_templates.h"
 
-template <int nv12>
-DECLARE_CONV_FUNC_IMPL(convert_yuv_yv_nv12_dither_le)
+// The bit depth and the dithering mode are template parameters, so the inner loops shift by immediates
+// bits = 0 takes the bit depth from bpp at run-time
+template <int nv12, int bits, int dither>
+static void yuv_yv_nv12_dither_le(const uint8_t* const src[4], const ptrdiff_t srcStride[4], uint8_t* dst[4], const ptrdiff_t dstStride[4], int width, int height, LAVPixelFormat inputFormat, int bpp, const uint16_t *dithers)
 {
+  const int inBpp = bits ? bits : bpp;
+
   const ptrdiff_t inYStride   = srcStride[0];
   const ptrdiff_t inUVStride  = srcStride[1];
 
@@ -36,11 +40,6 @@ DECLARE_CONV_FUNC_IMPL(convert_yuv_yv_nv12_dither_le)
   ptrdiff_t chromaWidth       = width;
   ptrdiff_t chromaHeight      = height;
 
-  LAVDitherMode ditherMode = m_pSettings->GetDitherMode();
-  const uint16_t *dithers = GetRandomDitherCoeffs(height, 4, 8, 0);
-  if (dithers == nullptr)
-    ditherMode = LAVDither_Ordered;
-
   if (inputFormat == LAVPixFmt_YUV420bX)
     chromaHeight = chromaHeight >> 1;
   if (inputFormat == LAVPixFmt_YUV420bX || inputFormat == LAVPixFmt_YUV422bX)
@@ -55,13 +54,13 @@ DECLARE_CONV_FUNC_IMPL(convert_yuv_yv_nv12_dither_le)
   // Process Y
   for (line = 0; line < height; ++line) {
     // Load dithering coefficients for this line
-    if (ditherMode == LAVDither_Random) {
+    if (dither == LAVDither_Random) {
       xmm4 = _mm_load_si128((const __m128i *)(dithers + (line << 5) + 0));
       xmm5 = _mm_load_si128((const __m128i *)(dithers + (line << 5) + 8));
       xmm6 = _mm_load_si128((const __m128i *)(dithers + (line << 5) + 16));
       xmm7 = _mm_load_si128((const __m128i *)(dithers + (line << 5) + 24));
     } else {
-      PIXCONV_LOAD_DITHER_COEFFS(xmm7,line,8,dithers);
+      PIXCONV_LOAD_DITHER_COEFFS(xmm7,line,8,ordered);
       xmm4 = xmm5 = xmm6 = xmm7;
     }
 
@@ -70,10 +69,10 @@ DECLARE_CONV_FUNC_IMPL(convert_yuv_yv_nv12_dither_le)
 
     for (i = 0; i < width; i+=32) {
       // Load pixels into registers, and apply dithering
-      PIXCONV_LOAD_PIXEL16_DITHER(xmm0, xmm4, (y+i+ 0), bpp);  /* Y0Y0Y0Y0 */
-      PIXCONV_LOAD_PIXEL16_DITHER(xmm1, xmm5, (y+i+ 8), bpp);  /* Y0Y0Y0Y0 */
-      PIXCONV_LOAD_PIXEL16_DITHER(xmm2, xmm6, (y+i+16), bpp);  /* Y0Y0Y0Y0 */
-      PIXCONV_LOAD_PIXEL16_DITHER(xmm3, xmm7, (y+i+24), bpp);  /* Y0Y0Y0Y0 */
+      PIXCONV_LOAD_PIXEL16_DITHER(xmm0, xmm4, (y+i+ 0), inBpp);  /* Y0Y0Y0Y0 */
+      PIXCONV_LOAD_PIXEL16_DITHER(xmm1, xmm5, (y+i+ 8), inBpp);  /* Y0Y0Y0Y0 */
+      PIXCONV_LOAD_PIXEL16_DITHER(xmm2, xmm6, (y+i+16), inBpp);  /* Y0Y0Y0Y0 */
+      PIXCONV_LOAD_PIXEL16_DITHER(xmm3, xmm7, (y+i+24), inBpp);  /* Y0Y0Y0Y0 */
       xmm0 = _mm_packus_epi16(xmm0, xmm1);                     /* YYYYYYYY */
       xmm2 = _mm_packus_epi16(xmm2, xmm3);                     /* YYYYYYYY */
 
@@ -92,10 +91,10 @@ DECLARE_CONV_FUNC_IMPL(convert_yuv_yv_nv12_dither_le)
       uint8_t * const dv  = (uint8_t *)(dst[1] + line * outUVStride);
 
        for (i = 0; i < chromaWidth; i+=16) {
-        PIXCONV_LOAD_PIXEL16_DITHER(xmm0, xmm4, (u+i+0), bpp);  /* U0U0U0U0 */
-        PIXCONV_LOAD_PIXEL16_DITHER(xmm1, xmm5, (u+i+8), bpp);  /* U0U0U0U0 */
-        PIXCONV_LOAD_PIXEL16_DITHER(xmm2, xmm6, (v+i+0), bpp);  /* V0V0V0V0 */
-        PIXCONV_LOAD_PIXEL16_DITHER(xmm3, xmm7, (v+i+8), bpp);  /* V0V0V0V0 */
+        PIXCONV_LOAD_PIXEL16_DITHER(xmm0, xmm4, (u+i+0), inBpp);  /* U0U0U0U0 */
+        PIXCONV_LOAD_PIXEL16_DITHER(xmm1, xmm5, (u+i+8), inBpp);  /* U0U0U0U0 */
+        PIXCONV_LOAD_PIXEL16_DITHER(xmm2, xmm6, (v+i+0), inBpp);  /* V0V0V0V0 */
+        PIXCONV_LOAD_PIXEL16_DITHER(xmm3, xmm7, (v+i+8), inBpp);  /* V0V0V0V0 */
 
         xmm0 = _mm_packus_epi16(xmm0, xmm1);                    /* UUUUUUUU */
         xmm2 = _mm_packus_epi16(xmm2, xmm3);                    /* VVVVVVVV */
@@ -113,13 +112,30 @@ DECLARE_CONV_FUNC_IMPL(convert_yuv_yv_nv12_dither_le)
       }
     }
   }
+}
+
+template <int nv12, int bits>
+DECLARE_CONV_FUNC_IMPL(convert_yuv_yv_nv12_dither_le)
+{
+  const uint16_t *dithers = GetRandomDitherCoeffs(height, 4, 8, 0);
+  if (dithers)
+    yuv_yv_nv12_dither_le<nv12, bits, LAVDither_Random>(src, srcStride, dst, dstStride, width, height, inputFormat, bpp, dithers);
+  else
+    yuv_yv_nv12_dither_le<nv12, bits, LAVDither_Ordered>(src, srcStride, dst, dstStride, width, height, inputFormat, bpp, nullptr);
 
   return S_OK;
 }
 
-// Force creation of these two variants
-template HRESULT CLAVPixFmtConverter::convert_yuv_yv_nv12_dither_le<0>CONV_FUNC_PARAMS;
-template HRESULT CLAVPixFmtConverter::convert_yuv_yv_nv12_dither_le<1>CONV_FUNC_PARAMS;
+// Force creation of the variants for YV12 and NV12, in all specialized bit depths
+#define DITHER_CONV_VARIANTS(name, arg) \
+  template HRESULT CLAVPixFmtConverter::name<arg, 0>CONV_FUNC_PARAMS;  \
+  template HRESULT CLAVPixFmtConverter::name<arg, 9>CONV_FUNC_PARAMS;  \
+  template HRESULT CLAVPixFmtConverter::name<arg, 10>CONV_FUNC_PARAMS; \
+  template HRESULT CLAVPixFmtConverter::name<arg, 12>CONV_FUNC_PARAMS; \
+  template HRESULT CLAVPixFmtConverter::name<arg, 16>CONV_FUNC_PARAMS;
+
+DITHER_CONV_VARIANTS(convert_yuv_yv_nv12_dither_le, 0)
+DITHER_CONV_VARIANTS(convert_yuv_yv_nv12_dither_le, 1)
 
 DECLARE_CONV_FUNC_IMPL(convert_yuv420_px1x_le)
 {
@@ -352,19 +368,16 @@ DECLARE_CONV_FUNC_IMPL(convert_yuv422_yuy2_uyvy)
 template HRESULT CLAVPixFmtConverter::convert_yuv422_yuy2_uyvy<0>CONV_FUNC_PARAMS;
 template HRESULT CLAVPixFmtConverter::convert_yuv422_yuy2_uyvy<1>CONV_FUNC_PARAMS;
 
-template <int uyvy>
-DECLARE_CONV_FUNC_IMPL(convert_yuv422_yuy2_uyvy_dither_le)
+template <int uyvy, int bits, int dither>
+static void yuv422_yuy2_uyvy_dither_le(const uint8_t* const src[4], const ptrdiff_t srcStride[4], uint8_t* dst[4], const ptrdiff_t dstStride[4], int width, int height, int bpp, const uint16_t *dithers)
 {
+  const int inBpp = bits ? bits : bpp;
+
   const ptrdiff_t inLumaStride    = srcStride[0];
   const ptrdiff_t inChromaStride  = srcStride[1];
   const ptrdiff_t outStride       = dstStride[0];
   const ptrdiff_t chromaWidth     = (width + 1) >> 1;
 
-  LAVDitherMode ditherMode = m_pSettings->GetDitherMode();
-  const uint16_t *dithers = GetRandomDitherCoeffs(height, 4, 8, 0);
-  if (dithers == nullptr)
-    ditherMode = LAVDither_Ordered;
-
   ptrdiff_t line,i;
   __m128i xmm0,xmm1,xmm2,xmm3,xmm4,xmm5,xmm6,xmm7;
 
@@ -377,22 +390,22 @@ DECLARE_CONV_FUNC_IMPL(convert_yuv422_yuy2_uyvy_dither_le)
           uint16_t * const d = (      uint16_t *)(dst[0] + line * outStride);
 
     // Load dithering coefficients for this line
-    if (ditherMode == LAVDither_Random) {
+    if (dither == LAVDither_Random) {
       xmm4 = _mm_load_si128((const __m128i *)(dithers + (line << 5) +  0));
       xmm5 = _mm_load_si128((const __m128i *)(dithers + (line << 5) +  8));
       xmm6 = _mm_load_si128((const __m128i *)(dithers + (line << 5) + 16));
       xmm7 = _mm_load_si128((const __m128i *)(dithers + (line << 5) + 24));
     } else {
-      PIXCONV_LOAD_DITHER_COEFFS(xmm7,line,8,dithers);
+      PIXCONV_LOAD_DITHER_COEFFS(xmm7,line,8,ordered);
       xmm4 = xmm5 = xmm6 = xmm7;
     }
 
     for (i = 0; i < chromaWidth; i+=8) {
       // Load pixels
-      PIXCONV_LOAD_PIXEL16_DITHER(xmm0, xmm4, (y+(i*2)+0), bpp);  /* YYYY */
-      PIXCONV_LOAD_PIXEL16_DITHER(xmm1, xmm5, (y+(i*2)+8), bpp);  /* YYYY */
-      PIXCONV_LOAD_PIXEL16_DITHER(xmm2, xmm6, (u+i), bpp);        /* UUUU */
-      PIXCONV_LOAD_PIXEL16_DITHER(xmm3, xmm7, (v+i), bpp);        /* VVVV */
+      PIXCONV_LOAD_PIXEL16_DITHER(xmm0, xmm4, (y+(i*2)+0), inBpp);  /* YYYY */
+      PIXCONV_LOAD_PIXEL16_DITHER(xmm1, xmm5, (y+(i*2)+8), inBpp);  /* YYYY */
+      PIXCONV_LOAD_PIXEL16_DITHER(xmm2, xmm6, (u+i), inBpp);        /* UUUU */
+      PIXCONV_LOAD_PIXEL16_DITHER(xmm3, xmm7, (v+i), inBpp);        /* VVVV */
 
       // Pack Ys
       xmm0 = _mm_packus_epi16(xmm0, xmm1);
@@ -417,13 +430,23 @@ DECLARE_CONV_FUNC_IMPL(convert_yuv422_yuy2_uyvy_dither_le)
       PIXCONV_PUT_STREAM(d + (i << 1) + 8, xmm2);
     }
   }
+}
+
+template <int uyvy, int bits>
+DECLARE_CONV_FUNC_IMPL(convert_yuv422_yuy2_uyvy_dither_le)
+{
+  const uint16_t *dithers = GetRandomDitherCoeffs(height, 4, 8, 0);
+  if (dithers)
+    yuv422_yuy2_uyvy_dither_le<uyvy, bits, LAVDither_Random>(src, srcStride, dst, dstStride, width, height, bpp, dithers);
+  else
+    yuv422_yuy2_uyvy_dither_le<uyvy, bits, LAVDither_Ordered>(src, srcStride, dst, dstStride, width, height, bpp, nullptr);
 
   return S_OK;
 }
 
-// Force creation of these two variants
-template HRESULT CLAVPixFmtConverter::convert_yuv422_yuy2_uyvy_dither_le<0>CONV_FUNC_PARAMS;
-template HRESULT CLAVPixFmtConverter::convert_yuv422_yuy2_uyvy_dither_le<1>CONV_FUNC_PARAMS;
+// Force creation of the variants for YUY2 and UYVY, in all specialized bit depths
+DITHER_CONV_VARIANTS(convert_yuv422_yuy2_uyvy_dither_le, 0)
+DITHER_CONV_VARIANTS(convert_yuv422_yuy2_uyvy_dither_le, 1)
 
 DECLARE_CONV_FUNC_IMPL(convert_nv12_yv12)
 {
@@ -0,0 +1,240 @@
+/*
+ *      Copyright (C) 2010-2019 Hendrik Leppkes
+ *      http://www.1f0.de
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program; if not, write to the Free Software Foundation, Inc.,
+ *  51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#include "stdafx.h"
+
+#include "pixconv_internal.h"
+#include "pixconv_avx2_templates.h"
+
+template <int nv12>
+DECLARE_CONV_FUNC_IMPL(convert_yuv_yv_nv12_dither_le_avx2)
+{
+  const ptrdiff_t inYStride   = srcStride[0];
+  const ptrdiff_t inUVStride  = srcStride[1];
+
+  const ptrdiff_t outYStride  = dstStride[0];
+  const ptrdiff_t outUVStride = dstStride[1];
+
+  ptrdiff_t chromaWidth       = width;
+  ptrdiff_t chromaHeight      = height;
+
+  LAVDitherMode ditherMode = m_pSettings->GetDitherMode();
+  const uint16_t *dithers = GetRandomDitherCoeffs(height, 4, 8, 0);
+  if (dithers == nullptr)
+    ditherMode = LAVDither_Ordered;
+
+  if (inputFormat == LAVPixFmt_YUV420bX)
+    chromaHeight = chromaHeight >> 1;
+  if (inputFormat == LAVPixFmt_YUV420bX || inputFormat == LAVPixFmt_YUV422bX)
+    chromaWidth = (chromaWidth + 1) >> 1;
+
+  ptrdiff_t line, i;
+
+  __m256i ymm0,ymm1,ymm4,ymm5;
+
+  // Interleave the U and V bytes in each lane after packing them
+  const __m256i nv12mask = _mm256_setr_epi8(0,8,1,9,2,10,3,11,4,12,5,13,6,14,7,15,0,8,1,9,2,10,3,11,4,12,5,13,6,14,7,15);
+
+  _mm_sfence();
+
+  // Process Y
+  for (line = 0; line < height; ++line) {
+    // Load dithering coefficients for this line
+    if (ditherMode == LAVDither_Random) {
+      PIXCONV_AVX2_LOAD(ymm4, dithers + (line << 5) + 0);
+      PIXCONV_AVX2_LOAD(ymm5, dithers + (line << 5) + 16);
+    } else {
+      PIXCONV_AVX2_LOAD_DITHER_COEFFS(ymm5,line,8,dithers);
+      ymm4 = ymm5;
+    }
+
+    const uint16_t * const y  = (const uint16_t *)(src[0] + line * inYStride);
+          uint8_t  * const dy = (      uint8_t  *)(dst[0] + line * outYStride);
+
+    for (i = 0; i < width; i+=32) {
+      // Load pixels into registers, and apply dithering
+      PIXCONV_AVX2_LOAD_PIXEL16_DITHER(ymm0, ymm4, (y+i+ 0), bpp);  /* Y0Y0Y0Y0 */
+      PIXCONV_AVX2_LOAD_PIXEL16_DITHER(ymm1, ymm5, (y+i+16), bpp);  /* Y0Y0Y0Y0 */
+      ymm0 = PIXCONV_AVX2_PACKUS_EPI16(ymm0, ymm1);                 /* YYYYYYYY */
+
+      // Write data back
+      PIXCONV_AVX2_PUT_STREAM(dy + i, ymm0);
+    }
+
+    // Process U/V for chromaHeight lines
+    if (line < chromaHeight) {
+      const uint16_t * const u = (const uint16_t *)(src[1] + line * inUVStride);
+      const uint16_t * const v = (const uint16_t *)(src[2] + line * inUVStride);
+
+      uint8_t * const duv = (uint8_t *)(dst[1] + line * outUVStride);
+      uint8_t * const du  = (uint8_t *)(dst[2] + line * outUVStride);
+      uint8_t * const dv  = (uint8_t *)(dst[1] + line * outUVStride);
+
+      // 16 chroma pixels per iteration, to cover the same area as the SSE2 version
+      for (i = 0; i < chromaWidth; i+=16) {
+        PIXCONV_AVX2_LOAD_PIXEL16_DITHER(ymm0, ymm4, (u+i), bpp);  /* U0U0U0U0 */
+        PIXCONV_AVX2_LOAD_PIXEL16_DITHER(ymm1, ymm5, (v+i), bpp);  /* V0V0V0V0 */
+
+        if (nv12) {
+          ymm0 = _mm256_packus_epi16(ymm0, ymm1);                  /* UUUUVVVV UUUUVVVV */
+          ymm0 = _mm256_shuffle_epi8(ymm0, nv12mask);              /* UVUVUVUV UVUVUVUV */
+
+          PIXCONV_AVX2_PUT_STREAM(duv + (i << 1), ymm0);
+        } else {
+          ymm0 = PIXCONV_AVX2_PACKUS_EPI16(ymm0, ymm1);            /* UUUUUUUU VVVVVVVV */
+
+          PIXCONV_PUT_STREAM(du + i, _mm256_castsi256_si128(ymm0));
+          PIXCONV_PUT_STREAM(dv + i, _mm256_extracti128_si256(ymm0, 1));
+        }
+      }
+    }
+  }
+
+  return S_OK;
+}
+
+// Force creation of these two variants
+template HRESULT CLAVPixFmtConverter::convert_yuv_yv_nv12_dither_le_avx2<0>CONV_FUNC_PARAMS;
+template HRESULT CLAVPixFmtConverter::convert_yuv_yv_nv12_dither_le_avx2<1>CONV_FUNC_PARAMS;
+
+DECLARE_CONV_FUNC_IMPL(convert_yuv420_nv12_avx2)
+{
+  const ptrdiff_t inLumaStride    = srcStride[0];
+  const ptrdiff_t inChromaStride  = srcStride[1];
+
+  const ptrdiff_t outLumaStride   = dstStride[0];
+  const ptrdiff_t outChromaStride = dstStride[1];
+
+  const ptrdiff_t chromaWidth     = (width + 1) >> 1;
+  const ptrdiff_t chromaHeight    = height >> 1;
+
+  ptrdiff_t line,i;
+  __m256i ymm0,ymm1,ymm2,ymm3;
+  __m128i xmm0,xmm1,xmm2;
+
+  _mm_sfence();
+
+  // Y
+  for(line = 0; line < height; ++line) {
+    PIXCONV_AVX2_MEMCPY(dst[0] + outLumaStride * line, src[0] + inLumaStride * line, width);
+  }
+
+  // U/V
+  for(line = 0; line < chromaHeight; ++line) {
+    const uint8_t * const u = src[1] + line * inChromaStride;
+    const uint8_t * const v = src[2] + line * inChromaStride;
+          uint8_t * const d = dst[1] + line * outChromaStride;
+
+    for (i = 0; i < (chromaWidth - 31); i += 32) {
+      PIXCONV_AVX2_LOAD(ymm0, v + i);
+      PIXCONV_AVX2_LOAD(ymm1, u + i);
+
+      ymm2 = _mm256_unpacklo_epi8(ymm1, ymm0);                 /* UV 0-7   | UV 16-23 */
+      ymm3 = _mm256_unpackhi_epi8(ymm1, ymm0);                 /* UV 8-15  | UV 24-31 */
+
+      ymm0 = _mm256_permute2x128_si256(ymm2, ymm3, 0x20);      /* UV 0-15  */
+      ymm1 = _mm256_permute2x128_si256(ymm2, ymm3, 0x31);      /* UV 16-31 */
+
+      PIXCONV_AVX2_PUT_STREAM(d + (i << 1) +  0, ymm0);
+      PIXCONV_AVX2_PUT_STREAM(d + (i << 1) + 32, ymm1);
+    }
+    for (; i < chromaWidth; i += 16) {
+      PIXCONV_LOAD_PIXEL8_ALIGNED(xmm0, v + i);
+      PIXCONV_LOAD_PIXEL8_ALIGNED(xmm1, u + i);
+
+      xmm2 = xmm0;
+      xmm0 = _mm_unpacklo_epi8(xmm1, xmm0);
+      xmm2 = _mm_unpackhi_epi8(xmm1, xmm2);
+
+      PIXCONV_PUT_STREAM(d + (i << 1) +  0, xmm0);
+      PIXCONV_PUT_STREAM(d + (i << 1) + 16, xmm2);
+    }
+  }
+
+  return S_OK;
+}
+
+DECLARE_CONV_FUNC_IMPL(convert_p010_nv12_avx2)
+{
+  const ptrdiff_t inStride = srcStride[0];
+  const ptrdiff_t outStride = dstStride[0];
+  const ptrdiff_t chromaHeight = (height >> 1);
+
+  const ptrdiff_t byteWidth = width << 1;
+
+  LAVDitherMode ditherMode = m_pSettings->GetDitherMode();
+  const uint16_t *dithers = GetRandomDitherCoeffs(height, 2, 8, 0);
+  if (dithers == nullptr)
+    ditherMode = LAVDither_Ordered;
+
+  __m256i ymm0, ymm1, ymm2;
+  __m128i xmm0, xmm1, xmm2, xmm3;
+
+  _mm_sfence();
+
+  ptrdiff_t line, i;
+
+  // Luma and chroma are processed the same way, the chroma plane just has half the lines
+  for (int plane = 0; plane < 2; plane++) {
+    const ptrdiff_t planeHeight = plane ? chromaHeight : height;
+
+    for (line = 0; line < planeHeight; line++) {
+      // Load dithering coefficients for this line
+      if (ditherMode == LAVDither_Random) {
+        PIXCONV_AVX2_LOAD(ymm2, dithers + (line << 4));
+      } else {
+        PIXCONV_AVX2_LOAD_DITHER_COEFFS(ymm2, line, 8, dithers);
+      }
+      xmm2 = _mm256_castsi256_si128(ymm2);
+      xmm3 = _mm256_extracti128_si256(ymm2, 1);
+
+      const uint8_t *y = (src[plane] + line * inStride);
+      uint8_t *dy = (dst[plane] + line * outStride);
+
+      for (i = 0; i < (byteWidth - 63); i += 64) {
+        PIXCONV_AVX2_LOAD(ymm0, y + i + 0);
+        PIXCONV_AVX2_LOAD(ymm1, y + i + 32);
+
+        // apply dithering coeffs
+        ymm0 = _mm256_adds_epu16(ymm0, ymm2);
+        ymm1 = _mm256_adds_epu16(ymm1, ymm2);
+
+        // shift and pack to 8-bit
+        ymm0 = PIXCONV_AVX2_PACKUS_EPI16(_mm256_srli_epi16(ymm0, 8), _mm256_srli_epi16(ymm1, 8));
+
+        PIXCONV_AVX2_PUT_STREAM(dy + (i >> 1), ymm0);
+      }
+      for (; i < byteWidth; i += 32) {
+        PIXCONV_LOAD_ALIGNED(xmm0, y + i + 0);
+        PIXCONV_LOAD_ALIGNED(xmm1, y + i + 16);
+
+        // apply dithering coeffs
+        xmm0 = _mm_adds_epu16(xmm0, xmm2);
+        xmm1 = _mm_adds_epu16(xmm1, xmm3);
+
+        // shift and pack to 8-bit
+        xmm0 = _mm_packus_epi16(_mm_srli_epi16(xmm0, 8), _mm_srli_epi16(xmm1, 8));
+
+        PIXCONV_PUT_STREAM(dy + (i >> 1), xmm0);
+      }
+    }
+  }
+
+  return S_OK;
+}
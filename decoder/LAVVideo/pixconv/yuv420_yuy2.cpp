@@ -161,7 +161,7 @@ static int yuv420yuy2_convert_pixels(const uint8_t* &srcY, const uint8_t* &srcU,
 }
 
 template <LAVPixelFormat inputFormat, int shift, int uyvy, int dithertype>
-static int __stdcall yuv420yuy2_process_lines(const uint8_t *srcY, const uint8_t *srcU, const uint8_t *srcV, uint8_t *dst, int width, int height, ptrdiff_t srcStrideY, ptrdiff_t srcStrideUV, ptrdiff_t dstStride, const uint16_t *dithers)
+static int __stdcall yuv420yuy2_process_lines(const uint8_t *srcY, const uint8_t *srcU, const uint8_t *srcV, uint8_t *dst, int width, int height, ptrdiff_t srcStrideY, ptrdiff_t srcStrideUV, ptrdiff_t dstStride, ptrdiff_t sliceYStart, ptrdiff_t sliceYEnd, const uint16_t *dithers)
 {
   const uint8_t *y = srcY;
   const uint8_t *u = srcU;
@@ -169,8 +169,9 @@ static int __stdcall yuv420yuy2_process_lines(const uint8_t *srcY, const uint8_t
   uint8_t *yuy2 = dst;
 
   // Processing starts at line 1, and ends at height - 1. The first and last line have special handling
-  ptrdiff_t line = 1;
-  const ptrdiff_t lastLine = height - 1;
+  // Lines are processed in pairs starting at odd lines, so slices other than the first start at an odd line
+  ptrdiff_t line = sliceYStart;
+  const ptrdiff_t lastLine = min(sliceYEnd, (ptrdiff_t)height - 1);
 
   const uint16_t *lineDither = dithers;
 
@@ -178,8 +179,11 @@ static int __stdcall yuv420yuy2_process_lines(const uint8_t *srcY, const uint8_t
 
   // Process first line
   // This needs special handling because of the chroma offset of YUV420
-  for (ptrdiff_t i = 0; i < width; i += 8) {
-    yuv420yuy2_convert_pixels<inputFormat, shift, uyvy, dithertype>(y, u, v, yuy2, 0, 0, 0, 0, lineDither, i);
+  if (line == 0) {
+    for (ptrdiff_t i = 0; i < width; i += 8) {
+      yuv420yuy2_convert_pixels<inputFormat, shift, uyvy, dithertype>(y, u, v, yuy2, 0, 0, 0, 0, lineDither, i);
+    }
+    line = 1;
   }
 
   for (; line < lastLine; line += 2) {
@@ -198,6 +202,9 @@ static int __stdcall yuv420yuy2_process_lines(const uint8_t *srcY, const uint8_t
     }
   }
 
+  if (sliceYEnd != height)
+    return 0;
+
   // Process last line
   // This needs special handling because of the chroma offset of YUV420
   if (dithertype == LAVDither_Random)
@@ -215,27 +222,27 @@ static int __stdcall yuv420yuy2_process_lines(const uint8_t *srcY, const uint8_t
 }
 
 template<int uyvy, int dithertype>
-static int __stdcall yuv420yuy2_dispatch(LAVPixelFormat inputFormat, int bpp, const uint8_t *srcY, const uint8_t *srcU, const uint8_t *srcV, uint8_t *dst, int width, int height, ptrdiff_t srcStrideY, ptrdiff_t srcStrideUV, ptrdiff_t dstStride, const uint16_t *dithers)
+static int __stdcall yuv420yuy2_dispatch(LAVPixelFormat inputFormat, int bpp, const uint8_t *srcY, const uint8_t *srcU, const uint8_t *srcV, uint8_t *dst, int width, int height, ptrdiff_t srcStrideY, ptrdiff_t srcStrideUV, ptrdiff_t dstStride, ptrdiff_t sliceYStart, ptrdiff_t sliceYEnd, const uint16_t *dithers)
 {
     // Wrap the input format into template args
   switch (inputFormat) {
   case LAVPixFmt_YUV420:
-    return yuv420yuy2_process_lines<LAVPixFmt_YUV420, 0, uyvy, dithertype>(srcY, srcU, srcV, dst, width, height, srcStrideY, srcStrideUV, dstStride, dithers);
+    return yuv420yuy2_process_lines<LAVPixFmt_YUV420, 0, uyvy, dithertype>(srcY, srcU, srcV, dst, width, height, srcStrideY, srcStrideUV, dstStride, sliceYStart, sliceYEnd, dithers);
   case LAVPixFmt_NV12:
-    return yuv420yuy2_process_lines<LAVPixFmt_NV12, 0, uyvy, dithertype>(srcY, srcU, srcV, dst, width, height, srcStrideY, srcStrideUV, dstStride, dithers);
+    return yuv420yuy2_process_lines<LAVPixFmt_NV12, 0, uyvy, dithertype>(srcY, srcU, srcV, dst, width, height, srcStrideY, srcStrideUV, dstStride, sliceYStart, sliceYEnd, dithers);
   case LAVPixFmt_YUV420bX:
     if (bpp == 9)
-      return yuv420yuy2_process_lines<LAVPixFmt_YUV420, 1, uyvy, dithertype>(srcY, srcU, srcV, dst, width, height, srcStrideY, srcStrideUV, dstStride, dithers);
+      return yuv420yuy2_process_lines<LAVPixFmt_YUV420, 1, uyvy, dithertype>(srcY, srcU, srcV, dst, width, height, srcStrideY, srcStrideUV, dstStride, sliceYStart, sliceYEnd, dithers);
     else if (bpp == 10)
-      return yuv420yuy2_process_lines<LAVPixFmt_YUV420, 2, uyvy, dithertype>(srcY, srcU, srcV, dst, width, height, srcStrideY, srcStrideUV, dstStride, dithers);
+      return yuv420yuy2_process_lines<LAVPixFmt_YUV420, 2, uyvy, dithertype>(srcY, srcU, srcV, dst, width, height, srcStrideY, srcStrideUV, dstStride, sliceYStart, sliceYEnd, dithers);
     /*else if (bpp == 11)
-      return yuv420yuy2_process_lines<LAVPixFmt_YUV420, 3, uyvy, dithertype>(srcY, srcU, srcV, dst, width, height, srcStrideY, srcStrideUV, dstStride, dithers);*/
+      return yuv420yuy2_process_lines<LAVPixFmt_YUV420, 3, uyvy, dithertype>(srcY, srcU, srcV, dst, width, height, srcStrideY, srcStrideUV, dstStride, sliceYStart, sliceYEnd, dithers);*/
     else if (bpp == 12)
-      return yuv420yuy2_process_lines<LAVPixFmt_YUV420, 4, uyvy, dithertype>(srcY, srcU, srcV, dst, width, height, srcStrideY, srcStrideUV, dstStride, dithers);
+      return yuv420yuy2_process_lines<LAVPixFmt_YUV420, 4, uyvy, dithertype>(srcY, srcU, srcV, dst, width, height, srcStrideY, srcStrideUV, dstStride, sliceYStart, sliceYEnd, dithers);
     /*else if (bpp == 13)
-      return yuv420yuy2_process_lines<LAVPixFmt_YUV420, 5, uyvy, dithertype>(srcY, srcU, srcV, dst, width, height, srcStrideY, srcStrideUV, dstStride, dithers);*/
+      return yuv420yuy2_process_lines<LAVPixFmt_YUV420, 5, uyvy, dithertype>(srcY, srcU, srcV, dst, width, height, srcStrideY, srcStrideUV, dstStride, sliceYStart, sliceYEnd, dithers);*/
     else if (bpp == 14)
-      return yuv420yuy2_process_lines<LAVPixFmt_YUV420, 6, uyvy, dithertype>(srcY, srcU, srcV, dst, width, height, srcStrideY, srcStrideUV, dstStride, dithers);
+      return yuv420yuy2_process_lines<LAVPixFmt_YUV420, 6, uyvy, dithertype>(srcY, srcU, srcV, dst, width, height, srcStrideY, srcStrideUV, dstStride, sliceYStart, sliceYEnd, dithers);
     else
       ASSERT(0);
     break;
@@ -250,15 +257,38 @@ DECLARE_CONV_FUNC_IMPL(convert_yuv420_yuy2)
 {
   LAVDitherMode ditherMode = m_pSettings->GetDitherMode();
   const uint16_t *dithers = (ditherMode == LAVDither_Random) ? GetRandomDitherCoeffs(height, DITHER_STEPS * 2, bpp - 8 + 2, 0) : nullptr;
-  if (ditherMode == LAVDither_Random && dithers != nullptr) {
-    yuv420yuy2_dispatch<uyvy, 1>(inputFormat, bpp, src[0], src[1], src[2], dst[0], width, height, srcStride[0], srcStride[1], dstStride[0], dithers);
-  } else {
-    yuv420yuy2_dispatch<uyvy, 0>(inputFormat, bpp, src[0], src[1], src[2], dst[0], width, height, srcStride[0], srcStride[1], dstStride[0], nullptr);
-  }
+  const BOOL bDither = (ditherMode == LAVDither_Random && dithers != nullptr);
+
+  // Line pairs overlap the slice boundaries by one line, see yuv420yuy2_process_lines
+  RunSlices(width, height, [&](int, int starty, int endy) {
+    const ptrdiff_t sliceYStart = starty + (starty ? 1 : 0);
+    const ptrdiff_t sliceYEnd = (endy == height) ? endy : endy + 1;
+    if (bDither)
+      yuv420yuy2_dispatch<uyvy, 1>(inputFormat, bpp, src[0], src[1], src[2], dst[0], width, height, srcStride[0], srcStride[1], dstStride[0], sliceYStart, sliceYEnd, dithers);
+    else
+      yuv420yuy2_dispatch<uyvy, 0>(inputFormat, bpp, src[0], src[1], src[2], dst[0], width, height, srcStride[0], srcStride[1], dstStride[0], sliceYStart, sliceYEnd, nullptr);
+  });
 
   return S_OK;
 }
 
-// Force creation of these two variants
+// NV12 frames in USWC memory, see ConvertStaged
+template<int uyvy>
+DECLARE_CONV_FUNC_IMPL(convert_yuv420_yuy2_direct)
+{
+  ASSERT(inputFormat == LAVPixFmt_NV12);
+
+  // the last line of odd heights reads chroma outside of the staged block
+  if (height & 1)
+    return convert_yuv420_yuy2<uyvy>(src, srcStride, dst, dstStride, width, height, inputFormat, bpp, outputFormat);
+
+  return ConvertStaged(src, srcStride, width, height, [&](const uint8_t *y, const uint8_t *uv, ptrdiff_t stride, int origin, int blockHeight, ptrdiff_t sliceYStart, ptrdiff_t sliceYEnd) {
+    yuv420yuy2_dispatch<uyvy, 0>(inputFormat, bpp, y, uv, uv, dst[0] + origin * dstStride[0], width, blockHeight, stride, stride, dstStride[0], sliceYStart, sliceYEnd, nullptr);
+  });
+}
+
+// Force creation of these variants
 template HRESULT CLAVPixFmtConverter::convert_yuv420_yuy2<0>CONV_FUNC_PARAMS;
 template HRESULT CLAVPixFmtConverter::convert_yuv420_yuy2<1>CONV_FUNC_PARAMS;
+template HRESULT CLAVPixFmtConverter::convert_yuv420_yuy2_direct<0>CONV_FUNC_PARAMS;
+template HRESULT CLAVPixFmtConverter::convert_yuv420_yuy2_direct<1>CONV_FUNC_PARAMS;
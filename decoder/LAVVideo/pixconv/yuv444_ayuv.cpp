@@ -88,8 +88,13 @@ DECLARE_CONV_FUNC_IMPL(convert_yuv444_ayuv)
   return S_OK;
 }
 
-DECLARE_CONV_FUNC_IMPL(convert_yuv444_ayuv_dither_le)
+// The bit depth and the dithering mode are template parameters, so the inner loop shifts by immediates
+// bits = 0 takes the bit depth from bpp at run-time
+template <int bits, int dither>
+static void yuv444_ayuv_dither_le(const uint8_t* const src[4], const ptrdiff_t srcStride[4], uint8_t* dst[4], const ptrdiff_t dstStride[4], int width, int height, int bpp, const uint16_t *dithers)
 {
+  const int inBpp = bits ? bits : bpp;
+
   const uint16_t *y = (const uint16_t *)src[0];
   const uint16_t *u = (const uint16_t *)src[1];
   const uint16_t *v = (const uint16_t *)src[2];
@@ -97,11 +102,6 @@ DECLARE_CONV_FUNC_IMPL(convert_yuv444_ayuv_dither_le)
   const ptrdiff_t inStride = srcStride[0] >> 1;
   const ptrdiff_t outStride = dstStride[0];
 
-  LAVDitherMode ditherMode = m_pSettings->GetDitherMode();
-  const uint16_t *dithers = GetRandomDitherCoeffs(height, 3, 8, 0);
-  if (dithers == nullptr)
-    ditherMode = LAVDither_Ordered;
-
   ptrdiff_t line, i;
 
   __m128i xmm0,xmm1,xmm2,xmm3,xmm4,xmm5,xmm6,xmm7;
@@ -112,12 +112,12 @@ DECLARE_CONV_FUNC_IMPL(convert_yuv444_ayuv_dither_le)
 
   for (line = 0; line < height; ++line) {
     // Load dithering coefficients for this line
-    if (ditherMode == LAVDither_Random) {
+    if (dither == LAVDither_Random) {
       xmm4 = _mm_load_si128((const __m128i *)(dithers + (line * 24) +  0));
       xmm5 = _mm_load_si128((const __m128i *)(dithers + (line * 24) +  8));
       xmm6 = _mm_load_si128((const __m128i *)(dithers + (line * 24) + 16));
     } else {
-      PIXCONV_LOAD_DITHER_COEFFS(xmm6,line,8,dithers);
+      PIXCONV_LOAD_DITHER_COEFFS(xmm6,line,8,ordered);
       xmm4 = xmm5 = xmm6;
     }
 
@@ -125,9 +125,9 @@ DECLARE_CONV_FUNC_IMPL(convert_yuv444_ayuv_dither_le)
 
     for (i = 0; i < width; i+=8) {
       // Load pixels into registers, and apply dithering
-      PIXCONV_LOAD_PIXEL16_DITHER(xmm0, xmm4, (y+i), bpp); /* Y0Y0Y0Y0 */
-      PIXCONV_LOAD_PIXEL16_DITHER_HIGH(xmm1, xmm5, (u+i), bpp); /* U0U0U0U0 */
-      PIXCONV_LOAD_PIXEL16_DITHER(xmm2, xmm6, (v+i), bpp); /* V0V0V0V0 */
+      PIXCONV_LOAD_PIXEL16_DITHER(xmm0, xmm4, (y+i), inBpp); /* Y0Y0Y0Y0 */
+      PIXCONV_LOAD_PIXEL16_DITHER_HIGH(xmm1, xmm5, (u+i), inBpp); /* U0U0U0U0 */
+      PIXCONV_LOAD_PIXEL16_DITHER(xmm2, xmm6, (v+i), inBpp); /* V0V0V0V0 */
 
       // Interlave into AYUV
       xmm0 = _mm_or_si128(xmm0, xmm7);          /* YAYAYAYA */
@@ -147,6 +147,23 @@ DECLARE_CONV_FUNC_IMPL(convert_yuv444_ayuv_dither_le)
     u += inStride;
     v += inStride;
   }
+}
+
+template <int bits>
+DECLARE_CONV_FUNC_IMPL(convert_yuv444_ayuv_dither_le)
+{
+  const uint16_t *dithers = GetRandomDitherCoeffs(height, 3, 8, 0);
+  if (dithers)
+    yuv444_ayuv_dither_le<bits, LAVDither_Random>(src, srcStride, dst, dstStride, width, height, bpp, dithers);
+  else
+    yuv444_ayuv_dither_le<bits, LAVDither_Ordered>(src, srcStride, dst, dstStride, width, height, bpp, nullptr);
 
   return S_OK;
 }
+
+// Force creation of the specialized bit depths
+template HRESULT CLAVPixFmtConverter::convert_yuv444_ayuv_dither_le<0>CONV_FUNC_PARAMS;
+template HRESULT CLAVPixFmtConverter::convert_yuv444_ayuv_dither_le<9>CONV_FUNC_PARAMS;
+template HRESULT CLAVPixFmtConverter::convert_yuv444_ayuv_dither_le<10>CONV_FUNC_PARAMS;
+template HRESULT CLAVPixFmtConverter::convert_yuv444_ayuv_dither_le<12>CONV_FUNC_PARAMS;
+template HRESULT CLAVPixFmtConverter::convert_yuv444_ayuv_dither_le<16>CONV_FUNC_PARAMS;
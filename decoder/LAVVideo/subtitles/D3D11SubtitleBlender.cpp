@@ -0,0 +1,419 @@
+/*
+ *      Copyright (C) 2010-2019 Hendrik Leppkes
+ *      http://www.1f0.de
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program; if not, write to the Free Software Foundation, Inc.,
+ *  51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#include "stdafx.h"
+#include "D3D11SubtitleBlender.h"
+
+#include <d3dcompiler.h>
+
+// The vertex shader spans a quad over the area of one bitmap, given in normalized device coordinates.
+// The pixel shaders un-pre-multiply the bitmap and convert it to BT.601 limited range YUV,
+// which matches the conversion of the software blending. The plane is blended using the alpha of the bitmap.
+static const char s_BlendShaders[] =
+  "cbuffer BitmapRect : register(b0) { float4 rect; };\n"
+  "Texture2D bitmap : register(t0);\n"
+  "SamplerState samp : register(s0);\n"
+  "struct VS_OUTPUT { float4 pos : SV_Position; float2 tex : TEXCOORD0; };\n"
+  "VS_OUTPUT vs_main(uint id : SV_VertexID) {\n"
+  "  VS_OUTPUT o;\n"
+  "  o.tex = float2(id & 1, id >> 1);\n"
+  "  o.pos = float4(lerp(rect.xy, rect.zw, o.tex), 0.0, 1.0);\n"
+  "  return o;\n"
+  "}\n"
+  "float4 sample_rgba(float2 tex) {\n"
+  "  float4 c = bitmap.Sample(samp, tex);\n"
+  "  return float4(c.rgb / max(c.a, 1.0 / 255.0), c.a);\n"
+  "}\n"
+  "float4 ps_luma(VS_OUTPUT i) : SV_Target {\n"
+  "  float4 c = sample_rgba(i.tex);\n"
+  "  return float4(dot(c.rgb, float3(0.256788, 0.504129, 0.097906)) + 16.0 / 255.0, 0.0, 0.0, c.a);\n"
+  "}\n"
+  "float4 ps_chroma(VS_OUTPUT i) : SV_Target {\n"
+  "  float4 c = sample_rgba(i.tex);\n"
+  "  return float4(dot(c.rgb, float3(-0.148223, -0.290993, 0.439216)) + 128.0 / 255.0,\n"
+  "                dot(c.rgb, float3(0.439216, -0.367788, -0.071427)) + 128.0 / 255.0, 0.0, c.a);\n"
+  "}\n";
+
+CD3D11SubtitleBlender::CD3D11SubtitleBlender()
+{
+  ZeroMemory(&m_RenderTargetDesc, sizeof(m_RenderTargetDesc));
+}
+
+CD3D11SubtitleBlender::~CD3D11SubtitleBlender()
+{
+  Release();
+}
+
+void CD3D11SubtitleBlender::Release()
+{
+  ClearBitmapCache(FALSE);
+
+  SafeRelease(&m_pLumaView);
+  SafeRelease(&m_pChromaView);
+  SafeRelease(&m_pRenderTarget);
+  ZeroMemory(&m_RenderTargetDesc, sizeof(m_RenderTargetDesc));
+
+  SafeRelease(&m_pVertexShader);
+  SafeRelease(&m_pLumaShader);
+  SafeRelease(&m_pChromaShader);
+  SafeRelease(&m_pRectBuffer);
+  SafeRelease(&m_pSampler);
+  SafeRelease(&m_pBlendState);
+
+  SafeRelease(&m_pMultithread);
+  SafeRelease(&m_pContext);
+  SafeRelease(&m_pDevice);
+  m_bInitFailed = FALSE;
+}
+
+static HRESULT compile_shader(pD3DCompile mD3DCompile, const char *entry, const char *target, ID3DBlob **ppCode)
+{
+  ID3DBlob *pErrors = nullptr;
+  HRESULT hr = mD3DCompile(s_BlendShaders, sizeof(s_BlendShaders) - 1, "LAVSubtitleBlend", nullptr, nullptr, entry, target, D3DCOMPILE_OPTIMIZATION_LEVEL3, 0, ppCode, &pErrors);
+  if (FAILED(hr)) {
+    DbgLog((LOG_ERROR, 10, L"-> Compiling shader %S failed: %S", entry, pErrors ? (const char *)pErrors->GetBufferPointer() : "unknown error"));
+  }
+  SafeRelease(&pErrors);
+  return hr;
+}
+
+HRESULT CD3D11SubtitleBlender::Init(ID3D11Device *pDevice)
+{
+  HRESULT hr = S_OK;
+  ID3DBlob *pVSCode = nullptr, *pLumaCode = nullptr, *pChromaCode = nullptr;
+
+  DbgLog((LOG_TRACE, 10, L"CD3D11SubtitleBlender::Init(): Initializing GPU subtitle blending"));
+
+  // the shaders are compiled at runtime, which only has to happen once per device
+  m_pDevice = pDevice;
+  m_pDevice->AddRef();
+  m_pDevice->GetImmediateContext(&m_pContext);
+
+  HMODULE d3dcompiler = LoadLibrary(D3DCOMPILER_DLL_W);
+  pD3DCompile mD3DCompile = d3dcompiler ? (pD3DCompile)GetProcAddress(d3dcompiler, "D3DCompile") : nullptr;
+  if (mD3DCompile == nullptr) {
+    DbgLog((LOG_ERROR, 10, L"-> Loading %s failed", D3DCOMPILER_DLL_W));
+    hr = E_FAIL;
+    goto done;
+  }
+
+  // the immediate context is shared with the decoder, and needs to be protected while blending
+  hr = m_pDevice->QueryInterface(&m_pMultithread);
+  if (FAILED(hr))
+    goto done;
+
+  if (FAILED(hr = compile_shader(mD3DCompile, "vs_main", "vs_4_0", &pVSCode))
+   || FAILED(hr = compile_shader(mD3DCompile, "ps_luma", "ps_4_0", &pLumaCode))
+   || FAILED(hr = compile_shader(mD3DCompile, "ps_chroma", "ps_4_0", &pChromaCode)))
+    goto done;
+
+  hr = m_pDevice->CreateVertexShader(pVSCode->GetBufferPointer(), pVSCode->GetBufferSize(), nullptr, &m_pVertexShader);
+  if (FAILED(hr))
+    goto done;
+
+  hr = m_pDevice->CreatePixelShader(pLumaCode->GetBufferPointer(), pLumaCode->GetBufferSize(), nullptr, &m_pLumaShader);
+  if (FAILED(hr))
+    goto done;
+
+  hr = m_pDevice->CreatePixelShader(pChromaCode->GetBufferPointer(), pChromaCode->GetBufferSize(), nullptr, &m_pChromaShader);
+  if (FAILED(hr))
+    goto done;
+
+  {
+    D3D11_BUFFER_DESC bufferDesc = { 0 };
+    bufferDesc.ByteWidth = 4 * sizeof(float);
+    bufferDesc.Usage = D3D11_USAGE_DEFAULT;
+    bufferDesc.BindFlags = D3D11_BIND_CONSTANT_BUFFER;
+
+    hr = m_pDevice->CreateBuffer(&bufferDesc, nullptr, &m_pRectBuffer);
+    if (FAILED(hr))
+      goto done;
+  }
+
+  {
+    D3D11_SAMPLER_DESC samplerDesc = { };
+    samplerDesc.Filter = D3D11_FILTER_MIN_MAG_MIP_LINEAR;
+    samplerDesc.AddressU = D3D11_TEXTURE_ADDRESS_CLAMP;
+    samplerDesc.AddressV = D3D11_TEXTURE_ADDRESS_CLAMP;
+    samplerDesc.AddressW = D3D11_TEXTURE_ADDRESS_CLAMP;
+    samplerDesc.ComparisonFunc = D3D11_COMPARISON_NEVER;
+    samplerDesc.MaxLOD = D3D11_FLOAT32_MAX;
+
+    hr = m_pDevice->CreateSamplerState(&samplerDesc, &m_pSampler);
+    if (FAILED(hr))
+      goto done;
+  }
+
+  {
+    D3D11_BLEND_DESC blendDesc = { };
+    blendDesc.RenderTarget[0].BlendEnable = TRUE;
+    blendDesc.RenderTarget[0].SrcBlend = D3D11_BLEND_SRC_ALPHA;
+    blendDesc.RenderTarget[0].DestBlend = D3D11_BLEND_INV_SRC_ALPHA;
+    blendDesc.RenderTarget[0].BlendOp = D3D11_BLEND_OP_ADD;
+    blendDesc.RenderTarget[0].SrcBlendAlpha = D3D11_BLEND_ZERO;
+    blendDesc.RenderTarget[0].DestBlendAlpha = D3D11_BLEND_ONE;
+    blendDesc.RenderTarget[0].BlendOpAlpha = D3D11_BLEND_OP_ADD;
+    blendDesc.RenderTarget[0].RenderTargetWriteMask = D3D11_COLOR_WRITE_ENABLE_RED | D3D11_COLOR_WRITE_ENABLE_GREEN;
+
+    hr = m_pDevice->CreateBlendState(&blendDesc, &m_pBlendState);
+    if (FAILED(hr))
+      goto done;
+  }
+
+done:
+  SafeRelease(&pVSCode);
+  SafeRelease(&pLumaCode);
+  SafeRelease(&pChromaCode);
+  if (d3dcompiler)
+    FreeLibrary(d3dcompiler);
+
+  if (FAILED(hr)) {
+    DbgLog((LOG_ERROR, 10, L"-> Initializing GPU subtitle blending failed (hr: 0x%x)", hr));
+    Release();
+
+    // remember the device, so the initialization is not retried for every frame
+    m_pDevice = pDevice;
+    m_pDevice->AddRef();
+    m_bInitFailed = TRUE;
+  }
+
+  return hr;
+}
+
+HRESULT CD3D11SubtitleBlender::InitRenderTarget(const D3D11_TEXTURE2D_DESC *pDesc)
+{
+  if (m_pRenderTarget && m_RenderTargetDesc.Width == pDesc->Width && m_RenderTargetDesc.Height == pDesc->Height && m_RenderTargetDesc.Format == pDesc->Format)
+    return S_OK;
+
+  SafeRelease(&m_pLumaView);
+  SafeRelease(&m_pChromaView);
+  SafeRelease(&m_pRenderTarget);
+  ZeroMemory(&m_RenderTargetDesc, sizeof(m_RenderTargetDesc));
+
+  DXGI_FORMAT lumaFormat, chromaFormat;
+  switch (pDesc->Format) {
+  case DXGI_FORMAT_NV12:
+    lumaFormat = DXGI_FORMAT_R8_UNORM;
+    chromaFormat = DXGI_FORMAT_R8G8_UNORM;
+    break;
+  case DXGI_FORMAT_P010:
+  case DXGI_FORMAT_P016:
+    lumaFormat = DXGI_FORMAT_R16_UNORM;
+    chromaFormat = DXGI_FORMAT_R16G16_UNORM;
+    break;
+  default:
+    DbgLog((LOG_TRACE, 10, L"-> Unsupported texture format %d for GPU subtitle blending", pDesc->Format));
+    return E_NOTIMPL;
+  }
+
+  UINT nSupport = 0;
+  if (FAILED(m_pDevice->CheckFormatSupport(pDesc->Format, &nSupport)) || !(nSupport & D3D11_FORMAT_SUPPORT_RENDER_TARGET)) {
+    DbgLog((LOG_TRACE, 10, L"-> Texture format %d can't be rendered to", pDesc->Format));
+    return E_NOTIMPL;
+  }
+
+  D3D11_TEXTURE2D_DESC texDesc = { 0 };
+  texDesc.Width = pDesc->Width;
+  texDesc.Height = pDesc->Height;
+  texDesc.MipLevels = 1;
+  texDesc.ArraySize = 1;
+  texDesc.Format = pDesc->Format;
+  texDesc.SampleDesc.Count = 1;
+  texDesc.Usage = D3D11_USAGE_DEFAULT;
+  texDesc.BindFlags = D3D11_BIND_RENDER_TARGET;
+
+  HRESULT hr = m_pDevice->CreateTexture2D(&texDesc, nullptr, &m_pRenderTarget);
+  if (FAILED(hr))
+    goto fail;
+
+  {
+    D3D11_RENDER_TARGET_VIEW_DESC viewDesc = { };
+    viewDesc.ViewDimension = D3D11_RTV_DIMENSION_TEXTURE2D;
+
+    viewDesc.Format = lumaFormat;
+    hr = m_pDevice->CreateRenderTargetView(m_pRenderTarget, &viewDesc, &m_pLumaView);
+    if (FAILED(hr))
+      goto fail;
+
+    viewDesc.Format = chromaFormat;
+    hr = m_pDevice->CreateRenderTargetView(m_pRenderTarget, &viewDesc, &m_pChromaView);
+    if (FAILED(hr))
+      goto fail;
+  }
+
+  m_RenderTargetDesc = texDesc;
+  return S_OK;
+
+fail:
+  DbgLog((LOG_ERROR, 10, L"-> Creating the subtitle render target failed (hr: 0x%x)", hr));
+  SafeRelease(&m_pLumaView);
+  SafeRelease(&m_pChromaView);
+  SafeRelease(&m_pRenderTarget);
+  return hr;
+}
+
+HRESULT CD3D11SubtitleBlender::GetBitmapTexture(const D3D11SubtitleBitmap *pBitmap, ID3D11ShaderResourceView **ppView)
+{
+  for (auto &entry : m_BitmapCache) {
+    if (entry.id == pBitmap->id && entry.size.cx == pBitmap->size.cx && entry.size.cy == pBitmap->size.cy) {
+      entry.bUsed = TRUE;
+      *ppView = entry.pView;
+      return S_OK;
+    }
+  }
+
+  D3D11_TEXTURE2D_DESC texDesc = { 0 };
+  texDesc.Width = pBitmap->size.cx;
+  texDesc.Height = pBitmap->size.cy;
+  texDesc.MipLevels = 1;
+  texDesc.ArraySize = 1;
+  texDesc.Format = DXGI_FORMAT_B8G8R8A8_UNORM;
+  texDesc.SampleDesc.Count = 1;
+  texDesc.Usage = D3D11_USAGE_IMMUTABLE;
+  texDesc.BindFlags = D3D11_BIND_SHADER_RESOURCE;
+
+  D3D11_SUBRESOURCE_DATA data = { 0 };
+  data.pSysMem = pBitmap->rgbData;
+  data.SysMemPitch = (UINT)pBitmap->pitch;
+
+  ID3D11Texture2D *pTexture = nullptr;
+  HRESULT hr = m_pDevice->CreateTexture2D(&texDesc, &data, &pTexture);
+  if (FAILED(hr))
+    return hr;
+
+  BitmapTexture bitmap = { 0 };
+  bitmap.id = pBitmap->id;
+  bitmap.size = pBitmap->size;
+  bitmap.bUsed = TRUE;
+
+  // the view holds the only reference on the texture
+  hr = m_pDevice->CreateShaderResourceView(pTexture, nullptr, &bitmap.pView);
+  SafeRelease(&pTexture);
+  if (FAILED(hr))
+    return hr;
+
+  m_BitmapCache.push_back(bitmap);
+  *ppView = bitmap.pView;
+
+  return S_OK;
+}
+
+void CD3D11SubtitleBlender::ClearBitmapCache(BOOL bUnusedOnly)
+{
+  for (auto it = m_BitmapCache.begin(); it != m_BitmapCache.end();) {
+    if (!bUnusedOnly || !it->bUsed) {
+      SafeRelease(&it->pView);
+      it = m_BitmapCache.erase(it);
+    } else {
+      it->bUsed = FALSE;
+      it++;
+    }
+  }
+}
+
+HRESULT CD3D11SubtitleBlender::Blend(ID3D11Texture2D *pSource, UINT nSourceSlice, ID3D11Texture2D *pTarget, UINT nTargetSlice, SIZE videoSize, const D3D11SubtitleBitmap *pBitmaps, int nBitmaps)
+{
+  CheckPointer(pSource, E_POINTER);
+  CheckPointer(pTarget, E_POINTER);
+
+  HRESULT hr = S_OK;
+
+  if (videoSize.cx <= 0 || videoSize.cy <= 0)
+    return E_INVALIDARG;
+
+  // Re-initialize on a new device
+  ID3D11Device *pDevice = nullptr;
+  pSource->GetDevice(&pDevice);
+  if (pDevice != m_pDevice) {
+    Release();
+    hr = Init(pDevice);
+  }
+  SafeRelease(&pDevice);
+  if (FAILED(hr) || m_bInitFailed)
+    return E_FAIL;
+
+  D3D11_TEXTURE2D_DESC desc;
+  pSource->GetDesc(&desc);
+
+  hr = InitRenderTarget(&desc);
+  if (FAILED(hr))
+    return hr;
+
+  // Upload the new bitmaps, and compute their position in normalized device coordinates
+  std::vector<ID3D11ShaderResourceView *> views(nBitmaps);
+  std::vector<float> rects(nBitmaps * 4);
+  for (int i = 0; i < nBitmaps; i++) {
+    hr = GetBitmapTexture(&pBitmaps[i], &views[i]);
+    if (FAILED(hr)) {
+      DbgLog((LOG_TRACE, 10, L"-> Uploading subtitle bitmap %d failed (hr: 0x%x)", i, hr));
+      return hr;
+    }
+
+    const RECT &rc = pBitmaps[i].dstRect;
+    rects[i * 4 + 0] = 2.0f * rc.left / videoSize.cx - 1.0f;
+    rects[i * 4 + 1] = 1.0f - 2.0f * rc.top / videoSize.cy;
+    rects[i * 4 + 2] = 2.0f * rc.right / videoSize.cx - 1.0f;
+    rects[i * 4 + 3] = 1.0f - 2.0f * rc.bottom / videoSize.cy;
+  }
+
+  m_pMultithread->Enter();
+
+  m_pContext->CopySubresourceRegion(m_pRenderTarget, 0, 0, 0, 0, pSource, D3D11CalcSubresource(0, nSourceSlice, desc.MipLevels), nullptr);
+
+  m_pContext->IASetPrimitiveTopology(D3D11_PRIMITIVE_TOPOLOGY_TRIANGLESTRIP);
+  m_pContext->IASetInputLayout(nullptr);
+  m_pContext->VSSetShader(m_pVertexShader, nullptr, 0);
+  m_pContext->VSSetConstantBuffers(0, 1, &m_pRectBuffer);
+  m_pContext->PSSetSamplers(0, 1, &m_pSampler);
+  m_pContext->OMSetBlendState(m_pBlendState, nullptr, 0xffffffff);
+
+  // luma first, then the chroma plane with half the size
+  for (int plane = 0; plane < 2; plane++) {
+    ID3D11RenderTargetView *pView = plane ? m_pChromaView : m_pLumaView;
+
+    D3D11_VIEWPORT viewport = { 0 };
+    viewport.Width = (float)(plane ? (videoSize.cx + 1) / 2 : videoSize.cx);
+    viewport.Height = (float)(plane ? (videoSize.cy + 1) / 2 : videoSize.cy);
+    viewport.MaxDepth = 1.0f;
+
+    m_pContext->OMSetRenderTargets(1, &pView, nullptr);
+    m_pContext->RSSetViewports(1, &viewport);
+    m_pContext->PSSetShader(plane ? m_pChromaShader : m_pLumaShader, nullptr, 0);
+
+    for (int i = 0; i < nBitmaps; i++) {
+      m_pContext->UpdateSubresource(m_pRectBuffer, 0, nullptr, &rects[i * 4], 0, 0);
+      m_pContext->PSSetShaderResources(0, 1, &views[i]);
+      m_pContext->Draw(4, 0);
+    }
+  }
+
+  // unbind everything, so the textures can be used elsewhere
+  ID3D11ShaderResourceView *pNullView = nullptr;
+  m_pContext->PSSetShaderResources(0, 1, &pNullView);
+  m_pContext->OMSetRenderTargets(0, nullptr, nullptr);
+
+  m_pContext->CopySubresourceRegion(pTarget, D3D11CalcSubresource(0, nTargetSlice, desc.MipLevels), 0, 0, 0, m_pRenderTarget, 0, nullptr);
+
+  m_pMultithread->Leave();
+
+  // Drop the bitmaps which are no longer on screen
+  ClearBitmapCache(TRUE);
+
+  return S_OK;
+}
@@ -0,0 +1,83 @@
+/*
+ *      Copyright (C) 2010-2019 Hendrik Leppkes
+ *      http://www.1f0.de
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program; if not, write to the Free Software Foundation, Inc.,
+ *  51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#pragma once
+
+#include <d3d10.h>
+#include <d3d11.h>
+#include <vector>
+
+typedef struct D3D11SubtitleBitmap {
+  ULONGLONG      id;
+  RECT           dstRect;               ///< Area of the video covered by the bitmap, in pixels
+  SIZE           size;                  ///< Size of the bitmap delivered by the subtitle renderer
+  const uint8_t *rgbData;               ///< Pre-multiplied BGRA
+  ptrdiff_t      pitch;
+} D3D11SubtitleBitmap;
+
+// Blends subtitle bitmaps into NV12 and P010 video textures on the GPU
+// Every bitmap is uploaded into a texture once, and re-used as long as the subtitle renderer keeps its ID.
+// Decoder textures can't be rendered to, so the video is composited in an intermediate render target.
+class CD3D11SubtitleBlender
+{
+public:
+  CD3D11SubtitleBlender();
+  ~CD3D11SubtitleBlender();
+
+  // Blend the bitmaps into the video in the source slice, and store the result in the target slice
+  // Source and target can be the same slice, and have to be of the same size and format.
+  HRESULT Blend(ID3D11Texture2D *pSource, UINT nSourceSlice, ID3D11Texture2D *pTarget, UINT nTargetSlice, SIZE videoSize, const D3D11SubtitleBitmap *pBitmaps, int nBitmaps);
+
+  // Free all resources
+  void Release();
+
+private:
+  HRESULT Init(ID3D11Device *pDevice);
+  HRESULT InitRenderTarget(const D3D11_TEXTURE2D_DESC *pDesc);
+  HRESULT GetBitmapTexture(const D3D11SubtitleBitmap *pBitmap, ID3D11ShaderResourceView **ppView);
+  void ClearBitmapCache(BOOL bUnusedOnly);
+
+private:
+  struct BitmapTexture {
+    ULONGLONG                 id;
+    SIZE                      size;
+    ID3D11ShaderResourceView *pView;
+    BOOL                      bUsed;    ///< Part of the current subtitle frame
+  };
+
+  ID3D11Device        *m_pDevice        = nullptr;
+  ID3D11DeviceContext *m_pContext       = nullptr;
+  ID3D10Multithread   *m_pMultithread   = nullptr;
+  BOOL                 m_bInitFailed    = FALSE;
+
+  ID3D11VertexShader  *m_pVertexShader  = nullptr;
+  ID3D11PixelShader   *m_pLumaShader    = nullptr;
+  ID3D11PixelShader   *m_pChromaShader  = nullptr;
+  ID3D11Buffer        *m_pRectBuffer    = nullptr;
+  ID3D11SamplerState  *m_pSampler       = nullptr;
+  ID3D11BlendState    *m_pBlendState    = nullptr;
+
+  // Intermediate copy of the video, with a render target on each plane
+  ID3D11Texture2D        *m_pRenderTarget = nullptr;
+  ID3D11RenderTargetView *m_pLumaView     = nullptr;
+  ID3D11RenderTargetView *m_pChromaView   = nullptr;
+  D3D11_TEXTURE2D_DESC    m_RenderTargetDesc;
+
+  std::vector<BitmapTexture> m_BitmapCache;
+};
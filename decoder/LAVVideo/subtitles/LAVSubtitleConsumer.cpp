@@ -23,6 +23,8 @@
 #include "Media.h"
 #include "version.h"
 
+#include "../decoders/d3d11/ID3DVideoMemoryConfiguration.h"
+
 #define OFFSET(x) offsetof(LAVSubtitleConsumerContext, x)
 static const SubRenderOption options[] = {
   { "name",           OFFSET(name),            SROPT_TYPE_STRING, SROPT_FLAG_READONLY },
@@ -78,6 +80,8 @@ STDMETHODIMP CLAVSubtitleConsumer::Disconnect(void)
     sws_freeContext(m_pSwsContext);
     m_pSwsContext = nullptr;
   }
+  ClearBitmapCache(FALSE);
+  m_D3D11Blender.Release();
   return S_OK;
 }
 
@@ -114,12 +118,15 @@ STDMETHODIMP CLAVSubtitleConsumer::ProcessFrame(LAVFrame *pFrame)
   m_evFrame.Wait();
 
   if (m_SubtitleFrame != nullptr) {
+    REFERENCE_TIME rtBlendStart = timer_get_ref_time();
+
     int count = 0;
     if (FAILED(m_SubtitleFrame->GetBitmapCount(&count))) {
       count = 0;
     }
 
     if (count == 0) {
+      ClearBitmapCache(FALSE);
       SafeRelease(&m_SubtitleFrame);
       return S_FALSE;
     }
@@ -183,9 +190,12 @@ STDMETHODIMP CLAVSubtitleConsumer::ProcessFrame(LAVFrame *pFrame)
       format = LAVPixFmt_NV12;
       bpp = 8;
     } else if (pFrame->format == LAVPixFmt_D3D11) {
-      // TODO D3D11
+      hr = ProcessD3D11Frame(pFrame, count);
+
+      m_pLAVVideo->m_Telemetry.AddSample(VideoStage_SubtitleBlend, timer_get_ref_time() - rtBlendStart);
+
       SafeRelease(&m_SubtitleFrame);
-      return E_FAIL;
+      return hr;
     } else {
       if (!(pFrame->flags & LAV_FRAME_FLAG_BUFFER_MODIFY)) {
         CopyLAVFrameInPlace(pFrame);
@@ -210,12 +220,17 @@ STDMETHODIMP CLAVSubtitleConsumer::ProcessFrame(LAVFrame *pFrame)
         DbgLog((LOG_TRACE, 10, L"GetBitmap() failed on index %d", i));
         break;
       }
-      ProcessSubtitleBitmap(format, bpp, videoRect, data, stride, subRect, position, size, rgbData, pitch);
+      ProcessSubtitleBitmap(format, bpp, videoRect, data, stride, subRect, id, position, size, rgbData, pitch);
     }
 
+    // Drop all converted bitmaps which are no longer on screen
+    ClearBitmapCache(TRUE);
+
     if (pSurface)
       pSurface->UnlockRect();
 
+    m_pLAVVideo->m_Telemetry.AddSample(VideoStage_SubtitleBlend, timer_get_ref_time() - rtBlendStart);
+
     SafeRelease(&m_SubtitleFrame);
     return S_OK;
   }
@@ -284,26 +299,32 @@ static AVPixelFormat getFFPixFmtForSubtitle(LAVPixelFormat pixFmt)
 
 STDMETHODIMP CLAVSubtitleConsumer::SelectBlendFunction()
 {
+  const int cpu = av_get_cpu_flags();
+  const BOOL bAVX2 = (cpu & AV_CPU_FLAG_AVX2);
+  const BOOL bSSE4 = (cpu & AV_CPU_FLAG_SSE4);
+
   switch (m_PixFmt) {
   case LAVPixFmt_RGB32:
+    blend = bAVX2 ? &CLAVSubtitleConsumer::blend_rgb32_avx2 : bSSE4 ? &CLAVSubtitleConsumer::blend_rgb_sse4 : &CLAVSubtitleConsumer::blend_rgb_c;
+    break;
   case LAVPixFmt_RGB24:
-    blend = &CLAVSubtitleConsumer::blend_rgb_c;
+    blend = bSSE4 ? &CLAVSubtitleConsumer::blend_rgb_sse4 : &CLAVSubtitleConsumer::blend_rgb_c;
     break;
   case LAVPixFmt_NV12:
-    blend = &CLAVSubtitleConsumer::blend_yuv_c<uint8_t,1>;
+    blend = bAVX2 ? &CLAVSubtitleConsumer::blend_yuv_avx2<uint8_t,1> : bSSE4 ? &CLAVSubtitleConsumer::blend_yuv_sse4<uint8_t,1> : &CLAVSubtitleConsumer::blend_yuv_c<uint8_t,1>;
     break;
   case LAVPixFmt_P016:
-    blend = &CLAVSubtitleConsumer::blend_yuv_c<uint16_t, 1>;
+    blend = bAVX2 ? &CLAVSubtitleConsumer::blend_yuv_avx2<uint16_t,1> : bSSE4 ? &CLAVSubtitleConsumer::blend_yuv_sse4<uint16_t,1> : &CLAVSubtitleConsumer::blend_yuv_c<uint16_t,1>;
     break;
   case LAVPixFmt_YUV420:
   case LAVPixFmt_YUV422:
   case LAVPixFmt_YUV444:
-    blend = &CLAVSubtitleConsumer::blend_yuv_c<uint8_t,0>;
+    blend = bAVX2 ? &CLAVSubtitleConsumer::blend_yuv_avx2<uint8_t,0> : bSSE4 ? &CLAVSubtitleConsumer::blend_yuv_sse4<uint8_t,0> : &CLAVSubtitleConsumer::blend_yuv_c<uint8_t,0>;
     break;
   case LAVPixFmt_YUV420bX:
   case LAVPixFmt_YUV422bX:
   case LAVPixFmt_YUV444bX:
-    blend = &CLAVSubtitleConsumer::blend_yuv_c<uint16_t,0>;
+    blend = bAVX2 ? &CLAVSubtitleConsumer::blend_yuv_avx2<uint16_t,0> : bSSE4 ? &CLAVSubtitleConsumer::blend_yuv_sse4<uint16_t,0> : &CLAVSubtitleConsumer::blend_yuv_c<uint16_t,0>;
     break;
   default:
     DbgLog((LOG_ERROR, 10, L"ProcessSubtitleBitmap(): No Blend function available"));
@@ -313,7 +334,161 @@ STDMETHODIMP CLAVSubtitleConsumer::SelectBlendFunction()
   return S_OK;
 }
 
-STDMETHODIMP CLAVSubtitleConsumer::ProcessSubtitleBitmap(LAVPixelFormat pixFmt, int bpp, RECT videoRect, BYTE *videoData[4], ptrdiff_t videoStride[4], RECT subRect, POINT subPosition, SIZE subSize, const uint8_t *rgbData, ptrdiff_t pitch)
+static HRESULT get_d3d11_texture(IMediaSample *pSample, ID3D11Texture2D **ppTexture, UINT *pArraySlice)
+{
+  IMediaSampleD3D11 *pD3D11Sample = nullptr;
+  HRESULT hr = pSample->QueryInterface(&pD3D11Sample);
+  if (SUCCEEDED(hr)) {
+    hr = pD3D11Sample->GetD3D11Texture(0, ppTexture, pArraySlice);
+    SafeRelease(&pD3D11Sample);
+  }
+  return hr;
+}
+
+// Blend the subtitles into D3D11 textures on the GPU, so they never have to be copied into system memory
+STDMETHODIMP CLAVSubtitleConsumer::ProcessD3D11Frame(LAVFrame *pFrame, int count)
+{
+  HRESULT hr = S_OK;
+  IMediaSample *pOrigSample = (IMediaSample *)pFrame->data[0];
+  ID3D11Texture2D *pSource = nullptr, *pTarget = nullptr;
+  UINT nSourceSlice = 0, nTargetSlice = 0;
+
+  RECT subRect;
+  m_SubtitleFrame->GetOutputRect(&subRect);
+  if (subRect.right <= 0 || subRect.bottom <= 0)
+    return E_FAIL;
+
+  // Subtitle bitmaps are scaled to the video size, like in software blending
+  std::vector<D3D11SubtitleBitmap> bitmaps;
+  for (int i = 0; i < count; i++) {
+    D3D11SubtitleBitmap bitmap = { 0 };
+    POINT position;
+    int pitch;
+    if (FAILED(m_SubtitleFrame->GetBitmap(i, &bitmap.id, &position, &bitmap.size, (LPCVOID *)&bitmap.rgbData, &pitch))) {
+      DbgLog((LOG_TRACE, 10, L"GetBitmap() failed on index %d", i));
+      break;
+    }
+    if (bitmap.size.cx <= 0 || bitmap.size.cy <= 0)
+      continue;
+
+    bitmap.pitch = pitch;
+    bitmap.dstRect.left   = (LONG)av_rescale(position.x, pFrame->width, subRect.right);
+    bitmap.dstRect.top    = (LONG)av_rescale(position.y, pFrame->height, subRect.bottom);
+    bitmap.dstRect.right  = (LONG)av_rescale(position.x + bitmap.size.cx, pFrame->width, subRect.right);
+    bitmap.dstRect.bottom = (LONG)av_rescale(position.y + bitmap.size.cy, pFrame->height, subRect.bottom);
+    bitmaps.push_back(bitmap);
+  }
+
+  if (bitmaps.empty())
+    return S_FALSE;
+
+  hr = get_d3d11_texture(pOrigSample, &pSource, &nSourceSlice);
+  if (FAILED(hr))
+    return hr;
+
+  // Blend into a new sample, the decoder texture might still be referenced by other frames
+  BOOL bNewSample = FALSE;
+  if (!(pFrame->flags & LAV_FRAME_FLAG_BUFFER_MODIFY)) {
+    hr = m_pLAVVideo->GetD3DBuffer(pFrame);
+    if (FAILED(hr)) {
+      DbgLog((LOG_TRACE, 10, L"CLAVSubtitleConsumer::ProcessD3D11Frame: getting a new D3D buffer failed"));
+      goto done;
+    }
+    bNewSample = TRUE;
+  }
+
+  hr = get_d3d11_texture((IMediaSample *)pFrame->data[0], &pTarget, &nTargetSlice);
+  if (SUCCEEDED(hr)) {
+    SIZE videoSize = { pFrame->width, pFrame->height };
+    hr = m_D3D11Blender.Blend(pSource, nSourceSlice, pTarget, nTargetSlice, videoSize, bitmaps.data(), (int)bitmaps.size());
+  }
+
+  if (bNewSample) {
+    if (SUCCEEDED(hr)) {
+      pFrame->flags |= LAV_FRAME_FLAG_BUFFER_MODIFY|LAV_FRAME_FLAG_DXVA_NOADDREF;
+    } else {
+      DbgLog((LOG_TRACE, 10, L"CLAVSubtitleConsumer::ProcessD3D11Frame: blending failed, restoring previous buffer"));
+      ((IMediaSample *)pFrame->data[0])->Release();
+      pFrame->data[0] = (BYTE *)pOrigSample;
+    }
+  }
+
+done:
+  SafeRelease(&pSource);
+  SafeRelease(&pTarget);
+  return hr;
+}
+
+STDMETHODIMP CLAVSubtitleConsumer::ConvertSubtitleBitmap(AVPixelFormat avPixFmt, SIZE subSize, SIZE newSize, const uint8_t *rgbData, ptrdiff_t pitch, LAVSubtitleBitmapCache *pBitmap)
+{
+  uint8_t *tmpBuf = nullptr;
+
+  m_pSwsContext = sws_getCachedContext(m_pSwsContext, subSize.cx, subSize.cy, AV_PIX_FMT_BGRA, newSize.cx, newSize.cy, avPixFmt, SWS_BILINEAR|SWS_FULL_CHR_H_INP, nullptr, nullptr, nullptr);
+
+  const uint8_t *src[4] = { (const uint8_t *)rgbData, nullptr, nullptr, nullptr };
+  const ptrdiff_t srcStride[4] = { pitch, 0, 0, 0 };
+
+  const LAVPixFmtDesc desc = getFFSubPixelFormatDesc(avPixFmt);
+  const ptrdiff_t stride = FFALIGN(newSize.cx, 64) * desc.codedbytes;
+
+  for (int plane = 0; plane < desc.planes; plane++) {
+    pBitmap->stride[plane] = stride / desc.planeWidth[plane];
+    const size_t size      = pBitmap->stride[plane] * FFALIGN(newSize.cy, 2) / desc.planeHeight[plane];
+    pBitmap->data[plane]   = (BYTE *)av_mallocz(size + AV_INPUT_BUFFER_PADDING_SIZE);
+    if (pBitmap->data[plane] == nullptr)
+      return E_OUTOFMEMORY;
+  }
+
+  // Un-pre-multiply alpha for YUV formats
+  // TODO: Can we SIMD this? See ARGBUnattenuateRow_C/SSE2 in libyuv
+  if (avPixFmt != AV_PIX_FMT_BGRA) {
+    tmpBuf = (uint8_t *)av_malloc(pitch * subSize.cy);
+    if (tmpBuf == nullptr)
+      return E_OUTOFMEMORY;
+
+    memcpy(tmpBuf, rgbData, pitch * subSize.cy);
+    for (int line = 0; line < subSize.cy; line++) {
+      uint8_t *p = tmpBuf + line * pitch;
+      for (int col = 0; col < subSize.cx; col++) {
+        if (p[3] != 0 && p[3] != 255) {
+          p[0] = av_clip_uint8(p[0] * 255 / p[3]);
+          p[1] = av_clip_uint8(p[1] * 255 / p[3]);
+          p[2] = av_clip_uint8(p[2] * 255 / p[3]);
+        }
+        p += 4;
+      }
+    }
+    src[0] = tmpBuf;
+  }
+
+  sws_scale2(m_pSwsContext, src, srcStride, 0, subSize.cy, pBitmap->data, pBitmap->stride);
+
+  if (tmpBuf)
+    av_free(tmpBuf);
+
+  pBitmap->pixFmt  = avPixFmt;
+  pBitmap->srcSize = subSize;
+  pBitmap->dstSize = newSize;
+
+  return S_OK;
+}
+
+void CLAVSubtitleConsumer::ClearBitmapCache(BOOL bUnusedOnly)
+{
+  for (auto it = m_BitmapCache.begin(); it != m_BitmapCache.end();) {
+    if (bUnusedOnly && it->bUsed) {
+      it->bUsed = FALSE;
+      it++;
+      continue;
+    }
+    for (int i = 0; i < 4; i++) {
+      av_freep(&it->data[i]);
+    }
+    it = m_BitmapCache.erase(it);
+  }
+}
+
+STDMETHODIMP CLAVSubtitleConsumer::ProcessSubtitleBitmap(LAVPixelFormat pixFmt, int bpp, RECT videoRect, BYTE *videoData[4], ptrdiff_t videoStride[4], RECT subRect, ULONGLONG id, POINT subPosition, SIZE subSize, const uint8_t *rgbData, ptrdiff_t pitch)
 {
   if (subRect.left != 0 || subRect.top != 0) {
     DbgLog((LOG_ERROR, 10, L"ProcessSubtitleBitmap(): Left/Top in SubRect non-zero"));
@@ -344,7 +519,6 @@ STDMETHODIMP CLAVSubtitleConsumer::ProcessSubtitleBitmap(LAVPixelFormat pixFmt,
 
   // If we need scaling (either scaling or pixel conversion), do it here before starting the blend process
   if (bNeedScaling) {
-    uint8_t *tmpBuf = nullptr;
     const AVPixelFormat avPixFmt = getFFPixFmtForSubtitle(pixFmt);
 
     // Calculate scaled size
@@ -371,49 +545,36 @@ STDMETHODIMP CLAVSubtitleConsumer::ProcessSubtitleBitmap(LAVPixelFormat pixFmt,
     subPosition.x = (LONG)av_rescale(subPosition.x, newSize.cx, subSize.cx);
     subPosition.y = (LONG)av_rescale(subPosition.y, newSize.cy, subSize.cy);
 
-    m_pSwsContext = sws_getCachedContext(m_pSwsContext, subSize.cx, subSize.cy, AV_PIX_FMT_BGRA, newSize.cx, newSize.cy, avPixFmt, SWS_BILINEAR|SWS_FULL_CHR_H_INP, nullptr, nullptr, nullptr);
-
-    const uint8_t *src[4] = { (const uint8_t *)rgbData, nullptr, nullptr, nullptr };
-    const ptrdiff_t srcStride[4] = { pitch, 0, 0, 0 };
-
-    const LAVPixFmtDesc desc = getFFSubPixelFormatDesc(avPixFmt);
-    const ptrdiff_t stride = FFALIGN(newSize.cx, 64) * desc.codedbytes;
-
-    for (int plane = 0; plane < desc.planes; plane++) {
-      subStride[plane]  = stride / desc.planeWidth[plane];
-      const size_t size = subStride[plane] * FFALIGN(newSize.cy, 2) / desc.planeHeight[plane];
-      subData[plane]    = (BYTE *)av_mallocz(size + AV_INPUT_BUFFER_PADDING_SIZE);
-      if (subData[plane] == nullptr)
-        goto fail;
+    // The renderer only changes the ID of a bitmap if its content changed, so a converted bitmap can be re-used
+    // until the ID, the video format or the video size changes. Only the position may change without a new ID.
+    LAVSubtitleBitmapCache *pBitmap = nullptr;
+    for (auto &entry : m_BitmapCache) {
+      if (entry.id == id && entry.pixFmt == avPixFmt
+        && entry.srcSize.cx == subSize.cx && entry.srcSize.cy == subSize.cy
+        && entry.dstSize.cx == newSize.cx && entry.dstSize.cy == newSize.cy) {
+        pBitmap = &entry;
+        break;
+      }
     }
 
-    // Un-pre-multiply alpha for YUV formats
-    // TODO: Can we SIMD this? See ARGBUnattenuateRow_C/SSE2 in libyuv
-    if (avPixFmt != AV_PIX_FMT_BGRA) {
-      tmpBuf = (uint8_t *)av_malloc(pitch * subSize.cy);
-      if (tmpBuf == nullptr)
-        goto fail;
-
-      memcpy(tmpBuf, rgbData, pitch * subSize.cy);
-      for (int line = 0; line < subSize.cy; line++) {
-        uint8_t *p = tmpBuf + line * pitch;
-        for (int col = 0; col < subSize.cx; col++) {
-          if (p[3] != 0 && p[3] != 255) {
-            p[0] = av_clip_uint8(p[0] * 255 / p[3]);
-            p[1] = av_clip_uint8(p[1] * 255 / p[3]);
-            p[2] = av_clip_uint8(p[2] * 255 / p[3]);
-          }
-          p += 4;
+    if (pBitmap == nullptr) {
+      LAVSubtitleBitmapCache bitmap = { 0 };
+      bitmap.id = id;
+      HRESULT hr = ConvertSubtitleBitmap(avPixFmt, subSize, newSize, rgbData, pitch, &bitmap);
+      if (FAILED(hr)) {
+        for (int i = 0; i < 4; i++) {
+          av_freep(&bitmap.data[i]);
         }
+        return hr;
       }
-      src[0] = tmpBuf;
+      m_BitmapCache.push_back(bitmap);
+      pBitmap = &m_BitmapCache.back();
     }
 
-    int ret = sws_scale2(m_pSwsContext, src, srcStride, 0, subSize.cy, subData, subStride);
+    pBitmap->bUsed = TRUE;
+    memcpy(subData, pBitmap->data, sizeof(subData));
+    memcpy(subStride, pBitmap->stride, sizeof(subStride));
     subSize = newSize;
-
-    if (tmpBuf)
-      av_free(tmpBuf);
   } else {
     subData[0] = (BYTE *)rgbData;
     subStride[0] = pitch;
@@ -425,17 +586,5 @@ STDMETHODIMP CLAVSubtitleConsumer::ProcessSubtitleBitmap(LAVPixelFormat pixFmt,
   if (blend)
     (this->*blend)(videoData, videoStride, videoRect, subData, subStride, subPosition, subSize, pixFmt, bpp);
 
-  if (bNeedScaling) {
-    for (int i = 0; i < 4; i++) {
-      av_freep(&subData[i]);
-    }
-  }
-
   return S_OK;
-
-fail:
-  for (int i = 0; i < 4; i++) {
-    av_freep(&subData[i]);
-  }
-  return E_OUTOFMEMORY;
 }
@@ -19,8 +19,11 @@
 
 #pragma once
 
+#include <vector>
+
 #include "SubRenderOptionsImpl.h"
 #include "LAVSubtitleFrame.h"
+#include "D3D11SubtitleBlender.h"
 
 #include "../decoders/ILAVDecoder.h"
 
@@ -32,6 +35,17 @@
 #define DECLARE_BLEND_FUNC_IMPL(name) \
   DECLARE_BLEND_FUNC(CLAVSubtitleConsumer::name)
 
+// Subtitle bitmap converted to the format and size of the video, re-used as long as the ID of the bitmap stays the same
+typedef struct LAVSubtitleBitmapCache {
+  ULONGLONG     id;
+  AVPixelFormat pixFmt;
+  SIZE          srcSize;                ///< Size of the bitmap delivered by the subtitle renderer
+  SIZE          dstSize;                ///< Size after scaling
+  BYTE          *data[4];
+  ptrdiff_t     stride[4];
+  BOOL          bUsed;                  ///< Part of the current subtitle frame
+} LAVSubtitleBitmapCache;
+
 typedef struct LAVSubtitleConsumerContext {
   LPWSTR name;                    ///< name of the Consumer
   LPWSTR version;                 ///< Version of the Consumer
@@ -68,7 +82,10 @@ public:
   void SetVideoSize(LONG w, LONG h) { context.originalVideoSize.cx = w; context.originalVideoSize.cy = h; }
 
 private:
-  STDMETHODIMP ProcessSubtitleBitmap(LAVPixelFormat pixFmt, int bpp, RECT videoRect, BYTE *videoData[4], ptrdiff_t videoStride[4], RECT subRect, POINT subPosition, SIZE subSize, const uint8_t *rgbData, ptrdiff_t pitch);
+  STDMETHODIMP ProcessSubtitleBitmap(LAVPixelFormat pixFmt, int bpp, RECT videoRect, BYTE *videoData[4], ptrdiff_t videoStride[4], RECT subRect, ULONGLONG id, POINT subPosition, SIZE subSize, const uint8_t *rgbData, ptrdiff_t pitch);
+  STDMETHODIMP ProcessD3D11Frame(LAVFrame *pFrame, int count);
+  STDMETHODIMP ConvertSubtitleBitmap(AVPixelFormat avPixFmt, SIZE subSize, SIZE newSize, const uint8_t *rgbData, ptrdiff_t pitch, LAVSubtitleBitmapCache *pBitmap);
+  void ClearBitmapCache(BOOL bUnusedOnly);
 
   STDMETHODIMP SelectBlendFunction();
   typedef HRESULT (CLAVSubtitleConsumer::*BlendFn) BLEND_FUNC_PARAMS;
@@ -77,6 +94,12 @@ private:
   DECLARE_BLEND_FUNC(blend_rgb_c);
   template <class pixT, int nv12> DECLARE_BLEND_FUNC(blend_yuv_c);
 
+  DECLARE_BLEND_FUNC(blend_rgb_sse4);
+  template <class pixT, int nv12> DECLARE_BLEND_FUNC(blend_yuv_sse4);
+
+  DECLARE_BLEND_FUNC(blend_rgb32_avx2);
+  template <class pixT, int nv12> DECLARE_BLEND_FUNC(blend_yuv_avx2);
+
 private:
   ISubRenderProvider *m_pProvider     = nullptr;
   ISubRenderFrame    *m_SubtitleFrame = nullptr;
@@ -85,6 +108,10 @@ private:
   SwsContext         *m_pSwsContext   = nullptr;
   LAVPixelFormat     m_PixFmt         = LAVPixFmt_None;
 
+  std::vector<LAVSubtitleBitmapCache> m_BitmapCache;
+
+  CD3D11SubtitleBlender m_D3D11Blender;
+
   LAVSubtitleConsumerContext context;
 
   CLAVVideo          *m_pLAVVideo     = nullptr;
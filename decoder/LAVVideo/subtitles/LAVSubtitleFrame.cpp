@@ -30,11 +30,19 @@ CLAVSubtitleFrame::CLAVSubtitleFrame(void)
 
 
 CLAVSubtitleFrame::~CLAVSubtitleFrame(void)
+{
+  Reset();
+  SAFE_CO_FREE(m_Bitmaps);
+}
+
+void CLAVSubtitleFrame::Reset()
 {
   for (int i = 0; i < m_NumBitmaps; i++) {
     m_Bitmaps[i]->Release();
   }
-  SAFE_CO_FREE(m_Bitmaps);
+  m_NumBitmaps = 0;
+  ZeroMemory(&m_outputRect, sizeof(m_outputRect));
+  ZeroMemory(&m_clipRect, sizeof(m_clipRect));
 }
 
 STDMETHODIMP CLAVSubtitleFrame::SetOutputRect(RECT outputRect)
@@ -51,13 +59,17 @@ STDMETHODIMP CLAVSubtitleFrame::SetClipRect(RECT clipRect)
 
 STDMETHODIMP CLAVSubtitleFrame::AddBitmap(CLAVSubRect *subRect)
 {
-  // Allocate memory for the new block
-  void *mem = CoTaskMemRealloc(m_Bitmaps, sizeof(*m_Bitmaps) * (m_NumBitmaps+1));
-  if (!mem) {
-    return E_OUTOFMEMORY;
+  // Grow the array, it is kept when the frame is reset
+  if (m_NumBitmaps == m_nCapacity) {
+    const int nCapacity = max(m_nCapacity * 2, 4);
+    void *mem = CoTaskMemRealloc(m_Bitmaps, sizeof(*m_Bitmaps) * nCapacity);
+    if (!mem) {
+      return E_OUTOFMEMORY;
+    }
+    m_Bitmaps = (CLAVSubRect **)mem;
+    m_nCapacity = nCapacity;
   }
 
-  m_Bitmaps = (CLAVSubRect **)mem;
   m_Bitmaps[m_NumBitmaps] = subRect;
   m_NumBitmaps++;
 
@@ -19,11 +19,13 @@
 
 #pragma once
 
+#include "MemoryAccount.h"
+
 class CLAVSubRect : public IUnknown
 {
 public:
   CLAVSubRect() { memset(&position, 0, sizeof(position)); memset(&size, 0, sizeof(size));}
-  ~CLAVSubRect() { SAFE_CO_FREE(pixels); SAFE_CO_FREE(pixelsPal); }
+  ~CLAVSubRect() { SAFE_CO_FREE(pixels); SAFE_CO_FREE(pixelsPal); SetMemoryAccount(nullptr); }
 
   // IUnknown
   STDMETHODIMP QueryInterface(REFIID riid, void **ppvObject)
@@ -42,6 +44,23 @@ public:
   // Reset the reference count to 0, can be used after a copy-constructor
   STDMETHODIMP ResetRefCount() { m_cRef = 0ul; return S_OK; }
 
+  // Charge the pixel data to the account, the rect holds a reference to it until it is destroyed
+  void SetMemoryAccount(CMemoryAccount *pAccount)
+  {
+    if (pAccount)
+      pAccount->AddRef();
+    if (m_pAccount) {
+      m_pAccount->Update(LAVMemory_Subtitles, &m_nCharged, 0);
+      m_pAccount->Release();
+    }
+    m_pAccount = pAccount;
+    if (m_pAccount)
+      m_pAccount->Update(LAVMemory_Subtitles, &m_nCharged, (size_t)pitch * size.cy * (pixels ? 4 : 0) + (pixelsPal ? (size_t)pitch * size.cy : 0));
+  }
+
+  // Forget the charge of the original, to be used after a copy-constructor
+  void ResetMemoryAccount() { m_pAccount = nullptr; m_nCharged = 0; }
+
 public:
   REFERENCE_TIME rtStart = AV_NOPTS_VALUE;  ///< Start Time
   REFERENCE_TIME rtStop  = AV_NOPTS_VALUE;  ///< Stop time
@@ -57,6 +76,9 @@ public:
 
 private:
   ULONG m_cRef = 0;
+
+  CMemoryAccount *m_pAccount = nullptr;
+  size_t m_nCharged = 0;
 };
 
 class CLAVSubtitleFrame : public ISubRenderFrame, public CUnknown
@@ -76,7 +98,12 @@ public:
   STDMETHODIMP SetClipRect(RECT clipRect);
   STDMETHODIMP AddBitmap(CLAVSubRect *subRect);
 
+  // Release all bitmaps, so the frame can be filled again
+  void Reset();
+
   BOOL Empty() const { return m_NumBitmaps == 0; };
+  // Anyone but the owner still holding a reference
+  BOOL IsShared() const { return m_cRef > 1; }
 
 private:
   RECT m_outputRect;
@@ -84,4 +111,5 @@ private:
 
   CLAVSubRect **m_Bitmaps = nullptr;
   int m_NumBitmaps        = 0;
+  int m_nCapacity         = 0;
 };
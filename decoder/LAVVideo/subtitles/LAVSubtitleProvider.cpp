@@ -24,12 +24,80 @@
 #include "libavutil/colorspace.h"
 
 #include "LAVVideo.h"
+#include "ThreadPriority.h"
+#include "TraceProvider.h"
 
 #include "version.h"
 
+#include <algorithm>
+
 #define FAST_DIV255(x) ((((x) + 128) * 257) >> 16)
 #define SUBTITLE_PTS_TIMEOUT (AV_NOPTS_VALUE + 1)
 
+// Key of a subtitle in the store, subtitles without a stop time never expire
+static inline REFERENCE_TIME sub_stop_key(const CLAVSubRect *rect)
+{
+  return (rect->rtStop == AV_NOPTS_VALUE) ? INT64_MAX : rect->rtStop;
+}
+
+typedef struct DVDSubContext
+{
+  AVClass *avclass;
+  uint32_t palette[16];
+  char    *palette_str;
+  char    *ifo_str;
+  int      has_palette;
+  uint8_t  colormap[4];
+  uint8_t  alpha[256];
+  uint8_t  buf[0x10000];
+  int      buf_size;
+  int      forced_subs_only;
+} DVDSubContext;
+
+// Check if a DVD SPU forces its display, which also shows it while the subtitles are turned off
+// Walks the control sequences the same way the decoder does, but only looks for the forced display command.
+static BOOL spu_is_forced(const BYTE *buf, size_t size)
+{
+  if (size < 4)
+    return FALSE;
+
+  // SPUs larger than 64k have a 16-bit size of zero, followed by 32-bit sizes and offsets
+  const BOOL bBigOffsets = (AV_RB16(buf) == 0);
+  const size_t offset_size = bBigOffsets ? 4 : 2;
+  if (bBigOffsets && size < 10)
+    return FALSE;
+
+  #define READ_OFFSET(p) (bBigOffsets ? AV_RB32(p) : AV_RB16(p))
+  size_t cmd_pos = READ_OFFSET(buf + offset_size);
+  while (cmd_pos > 0 && cmd_pos + 2 + offset_size < size) {
+    const size_t next_cmd_pos = READ_OFFSET(buf + cmd_pos + 2);
+    size_t pos = cmd_pos + 2 + offset_size;
+    while (pos < size) {
+      const BYTE cmd = buf[pos++];
+      if (cmd == 0x00)
+        return TRUE;
+      else if (cmd == 0x01 || cmd == 0x02)
+        continue;
+      else if (cmd == 0x03 || cmd == 0x04)
+        pos += 2;
+      else if (cmd == 0x05)
+        pos += 6;
+      else if (cmd == 0x06)
+        pos += offset_size * 2;
+      else if (cmd == 0x07 && pos + 2 <= size)
+        pos += AV_RB16(buf + pos);
+      else
+        break;
+    }
+    if (next_cmd_pos <= cmd_pos)
+      break;
+    cmd_pos = next_cmd_pos;
+  }
+  #undef READ_OFFSET
+
+  return FALSE;
+}
+
 #define OFFSET(x) offsetof(LAVSubtitleProviderContext, x)
 static const SubRenderOption options[] = {
   { "name",           OFFSET(name),            SROPT_TYPE_STRING, SROPT_FLAG_READONLY },
@@ -48,6 +116,11 @@ CLAVSubtitleProvider::CLAVSubtitleProvider(CLAVVideo *pLAVVideo, ISubRenderConsu
 {
   m_ControlThread = new CLAVSubtitleProviderControlThread();
 
+  ZeroMemory(m_DVDPalette, sizeof(m_DVDPalette));
+  m_ExpandPalette = (av_get_cpu_flags() & AV_CPU_FLAG_AVX2) ? &CLAVSubtitleProvider::expand_palette_avx2 : &CLAVSubtitleProvider::expand_palette_c;
+  m_evDecodeIdle.Set();
+  m_DecodeThread = new CLAVSubtitleProviderDecodeThread(this);
+
   ASSERT(pConsumer);
   ZeroMemory(&context, sizeof(context));
   context.name = TEXT(LAV_VIDEO);
@@ -63,14 +136,16 @@ CLAVSubtitleProvider::CLAVSubtitleProvider(CLAVVideo *pLAVVideo, ISubRenderConsu
 CLAVSubtitleProvider::~CLAVSubtitleProvider(void)
 {
   Flush();
+  SAFE_DELETE(m_DecodeThread);
   CloseDecoder();
+  ClearFramePool();
   DisconnectConsumer();
   SAFE_DELETE(m_ControlThread);
 }
 
 void CLAVSubtitleProvider::CloseDecoder()
 {
-  CAutoLock lock(this);
+  CAutoLock lock(&m_csDecoder);
   m_pAVCodec = nullptr;
   if (m_pAVCtx) {
     if (m_pAVCtx->extradata)
@@ -86,20 +161,24 @@ void CLAVSubtitleProvider::CloseDecoder()
 
 STDMETHODIMP CLAVSubtitleProvider::SetConsumer(ISubRenderConsumer *pConsumer)
 {
-  CAutoLock lock(this);
-  if (m_pConsumer)
-    DisconnectConsumer();
+  {
+    CAutoLock lock(this);
+    if (m_pConsumer)
+      DisconnectConsumer();
+
+    CheckPointer(pConsumer, E_FAIL);
 
-  CheckPointer(pConsumer, E_FAIL);
+    m_pConsumer = pConsumer;
+    m_pConsumer->AddRef();
+    m_pConsumer->Connect(this);
 
-  m_pConsumer = pConsumer;
-  m_pConsumer->AddRef();
-  m_pConsumer->Connect(this);
+    if (FAILED(m_pConsumer->QueryInterface(&m_pConsumer2)))
+      m_pConsumer2 = nullptr;
 
-  if (FAILED(m_pConsumer->QueryInterface(&m_pConsumer2)))
-    m_pConsumer2 = nullptr;
+    m_ControlThread->SetConsumer2(m_pConsumer2);
+  }
 
-  m_ControlThread->SetConsumer2(m_pConsumer2);
+  ResumeOutput();
 
   return S_OK;
 }
@@ -118,51 +197,122 @@ STDMETHODIMP CLAVSubtitleProvider::DisconnectConsumer(void)
 
 #define PTS2RT(pts) (10000i64 * pts / 90)
 
+// Get a frame the renderer doesn't hold anymore, or a new one
+CLAVSubtitleFrame *CLAVSubtitleProvider::GetPooledFrame(BOOL *pbPooled)
+{
+  for (CLAVSubtitleFrame *pFrame : m_FramePool) {
+    if (!pFrame->IsShared()) {
+      if (pFrame == m_pLastFrame)
+        m_pLastFrame = nullptr;
+      pFrame->Reset();
+      pFrame->AddRef();
+      *pbPooled = TRUE;
+      return pFrame;
+    }
+  }
+
+  CLAVSubtitleFrame *pFrame = new CLAVSubtitleFrame();
+  pFrame->AddRef();
+
+  *pbPooled = (m_FramePool.size() < LAV_SUBTITLE_FRAME_POOL);
+  if (*pbPooled) {
+    pFrame->AddRef();
+    m_FramePool.push_back(pFrame);
+  }
+  return pFrame;
+}
+
+void CLAVSubtitleProvider::ClearFramePool()
+{
+  CAutoLock lock(&m_csFrames);
+  for (CLAVSubtitleFrame *pFrame : m_FramePool)
+    pFrame->Release();
+  m_FramePool.clear();
+  m_LastFrameRects.clear();
+  m_pLastFrame = nullptr;
+}
+
 STDMETHODIMP CLAVSubtitleProvider::RequestFrame(REFERENCE_TIME start, REFERENCE_TIME stop, LPVOID context)
 {
   ASSERT(m_pConsumer);
 
-  // Create a new frame
-  CLAVSubtitleFrame *subtitleFrame = new CLAVSubtitleFrame();
-  subtitleFrame->AddRef();
+  SIZE outputSize;
+  {
+    CAutoLock lock(this);
+    outputSize = m_OutputSize;
+  }
 
-  if (m_pAVCtx->width == 720 && m_pAVCtx->height == 480) {
+  if (outputSize.cx == 720 && outputSize.cy == 480) {
     SIZE videoSize;
     m_pConsumer->GetSize("originalVideoSize", &videoSize);
-    if (videoSize.cx == 720) {
-      m_pAVCtx->height = videoSize.cy;
+    if (videoSize.cx == 720 && videoSize.cy != 480) {
+      CAutoLock decoderLock(&m_csDecoder);
+      CAutoLock lock(this);
+      m_OutputSize.cy = outputSize.cy = videoSize.cy;
+      if (m_pAVCtx)
+        m_pAVCtx->height = videoSize.cy;
     }
   }
 
   RECT outputRect;
-  ::SetRect(&outputRect, 0, 0, m_pAVCtx->width, m_pAVCtx->height);
-  subtitleFrame->SetOutputRect(outputRect);
+  ::SetRect(&outputRect, 0, 0, outputSize.cx, outputSize.cy);
 
   REFERENCE_TIME mid = start + ((stop-start) >> 1);
 
-  // Scope this so we limit the provider-lock to the part where its needed
+  CAutoLock frameLock(&m_csFrames);
+  std::vector<CLAVSubRect *> &rects = m_FrameRects;
+  AM_PROPERTY_SPHLI hli;
+  uint32_t palette[16];
+  BOOL bHLI = FALSE;
+
+  // Only collect the subtitles under the provider-lock, the decode thread can add new ones meanwhile
+  // Expired subtitles are skipped by the index, only the ones still shown or queued ahead are checked.
   {
     CAutoLock lock(this);
-    for (auto it = m_SubFrames.begin(); it != m_SubFrames.end(); it++) {
-      CLAVSubRect *pRect = *it;
-      if ((pRect->rtStart == AV_NOPTS_VALUE || pRect->rtStart <= mid)
-        && (pRect->rtStop == AV_NOPTS_VALUE || pRect->rtStop > mid)
-        && (m_bComposit || pRect->forced)) {
-
-        if (m_pHLI && PTS2RT(m_pHLI->StartPTM) <= mid && PTS2RT(m_pHLI->EndPTM) >= mid) {
-          pRect = ProcessDVDHLI(pRect);
-        }
-        subtitleFrame->AddBitmap(pRect);
+    for (auto it = m_SubFrames.upper_bound(mid); it != m_SubFrames.end(); it++) {
+      CLAVSubRect *pRect = it->second;
+      if ((pRect->rtStart == AV_NOPTS_VALUE || pRect->rtStart <= mid) && (m_bComposit || pRect->forced)) {
+        pRect->AddRef();
+        rects.push_back(pRect);
       }
     }
 
+    if (m_pHLI && m_bDVDPalette && PTS2RT(m_pHLI->StartPTM) <= mid && PTS2RT(m_pHLI->EndPTM) >= mid) {
+      hli = *m_pHLI;
+      memcpy(palette, m_DVDPalette, sizeof(palette));
+      bHLI = TRUE;
+    }
+
     m_rtLastFrame = start;
   }
 
-  if (subtitleFrame->Empty()) {
-    SafeRelease(&subtitleFrame);
+  // Keep the bitmaps in decoding order
+  std::sort(rects.begin(), rects.end(), [](const CLAVSubRect *a, const CLAVSubRect *b) { return a->id < b->id; });
+
+  CLAVSubtitleFrame *subtitleFrame = nullptr;
+  if (!rects.empty()) {
+    if (!bHLI && m_pLastFrame && rects == m_LastFrameRects && EqualRect(&outputRect, &m_LastFrameRect)) {
+      // Nothing changed since the last frame, deliver it again
+      subtitleFrame = m_pLastFrame;
+      subtitleFrame->AddRef();
+    } else {
+      BOOL bPooled = FALSE;
+      subtitleFrame = GetPooledFrame(&bPooled);
+      subtitleFrame->SetOutputRect(outputRect);
+      for (CLAVSubRect *pRect : rects)
+        subtitleFrame->AddBitmap(bHLI ? ProcessDVDHLI(pRect, &hli, palette) : pRect);
+
+      // Highlighted bitmaps are created for every request, those frames are never delivered again
+      m_pLastFrame = (bPooled && !bHLI) ? subtitleFrame : nullptr;
+      m_LastFrameRects = rects;
+      m_LastFrameRect = outputRect;
+    }
   }
 
+  for (CLAVSubRect *pRect : rects)
+    pRect->Release();
+  rects.clear();
+
   // Deliver Frame
   m_pConsumer->DeliverFrame(start, stop, context, subtitleFrame);
   SafeRelease(&subtitleFrame);
@@ -180,14 +330,37 @@ STDMETHODIMP CLAVSubtitleProvider::Disconnect(void)
 
 STDMETHODIMP CLAVSubtitleProvider::InitDecoder(const CMediaType *pmt, AVCodecID codecId)
 {
-  CAutoLock lock(this);
+  CAutoLock lock(&m_csDecoder);
   m_pAVCodec = avcodec_find_decoder(codecId);
   CheckPointer(m_pAVCodec, VFW_E_TYPE_NOT_ACCEPTED);
 
+  // The decoder is only opened once there is a subtitle to show
+  m_mtDecoder = *pmt;
+
+  SIZE size = { 0, 0 };
+  if (pmt->formattype != FORMAT_SubtitleInfo) {
+    // Try video info
+    BITMAPINFOHEADER *bmi = nullptr;
+    videoFormatTypeHandler(*pmt, &bmi, nullptr, nullptr, nullptr);
+    size.cx = bmi->biWidth;
+    size.cy = bmi->biHeight;
+  }
+
+  CAutoLock providerLock(this);
+  m_OutputSize = size;
+
+  return S_OK;
+}
+
+// Called with the decoder lock held
+HRESULT CLAVSubtitleProvider::OpenDecoder()
+{
+  const CMediaType *pmt = &m_mtDecoder;
+
   m_pAVCtx = avcodec_alloc_context3(m_pAVCodec);
   CheckPointer(m_pAVCtx, E_POINTER);
 
-  m_pParser = av_parser_init(codecId);
+  m_pParser = av_parser_init(m_pAVCodec->id);
 
   size_t extralen = 0;
   getExtraData((const BYTE *)pmt->Format(), pmt->FormatType(), pmt->FormatLength(), nullptr, &extralen);
@@ -201,28 +374,66 @@ STDMETHODIMP CLAVSubtitleProvider::InitDecoder(const CMediaType *pmt, AVCodecID
     m_pAVCtx->extradata_size = (int)extralen;
   }
 
-  if (pmt->formattype == FORMAT_SubtitleInfo) {
-    // Not much info in here
-  } else {
-    // Try video info
-    BITMAPINFOHEADER *bmi = nullptr;
-    videoFormatTypeHandler(*pmt, &bmi, nullptr, nullptr, nullptr);
-    m_pAVCtx->width = bmi->biWidth;
-    m_pAVCtx->height = bmi->biHeight;
+  {
+    CAutoLock providerLock(this);
+    m_pAVCtx->width = m_OutputSize.cx;
+    m_pAVCtx->height = m_OutputSize.cy;
   }
 
   int ret = avcodec_open2(m_pAVCtx, m_pAVCodec, nullptr);
   if (ret < 0) {
-    DbgLog((LOG_TRACE, 10, L"CLAVSubtitleProvider::InitDecoder(): avocdec_open2 failed with %d", ret));
+    DbgLog((LOG_TRACE, 10, L"CLAVSubtitleProvider::OpenDecoder(): avocdec_open2 failed with %d", ret));
     CloseDecoder();
     return VFW_E_TYPE_NOT_ACCEPTED;
   }
 
+  CAutoLock providerLock(this);
+  m_OutputSize.cx = m_pAVCtx->width;
+  m_OutputSize.cy = m_pAVCtx->height;
+
+  // Apply a palette that was set before the decoder was opened
+  if (m_bDVDPalette && m_pAVCtx->codec_id == AV_CODEC_ID_DVD_SUBTITLE) {
+    DVDSubContext *ctx = (DVDSubContext *)m_pAVCtx->priv_data;
+    ctx->has_palette = 1;
+    memcpy(ctx->palette, m_DVDPalette, sizeof(m_DVDPalette));
+  }
+
   return S_OK;
 }
 
+// Anyone to show the subtitles to
+BOOL CLAVSubtitleProvider::IsOutputActive()
+{
+  CAutoLock lock(this);
+  return m_pConsumer != nullptr && m_bComposit;
+}
+
+// Decode the latest SPU, if it was skipped while the subtitles weren't shown
+void CLAVSubtitleProvider::ResumeOutput()
+{
+  CAutoLock lock(&m_csSPU);
+  if (!m_LastSPU.empty() && !m_bLastSPUDecoded && IsOutputActive()) {
+    DbgLog((LOG_TRACE, 10, L"CLAVSubtitleProvider::ResumeOutput(): Decoding the last skipped subtitle"));
+    m_bLastSPUDecoded = TRUE;
+    QueuePacket(m_LastSPU.data(), (int)m_LastSPU.size(), m_rtLastSPUStart, m_rtLastSPUStop);
+  }
+}
+
 STDMETHODIMP CLAVSubtitleProvider::Flush()
 {
+  {
+    CAutoLock lock(&m_csSPU);
+    m_PendingSPU.clear();
+    m_LastSPU.clear();
+  }
+
+  // Don't hold on to the old subtitles
+  ClearFramePool();
+
+  // Drop the pending packets, and let the decode thread finish the one in progress before clearing its subtitles
+  ClearDecodeQueue();
+  m_evDecodeIdle.Wait();
+
   CAutoLock lock(this);
   ClearSubtitleRects();
   SAFE_DELETE(m_pHLI);
@@ -238,7 +449,7 @@ void CLAVSubtitleProvider::ClearSubtitleRects()
 {
   CAutoLock lock(this);
   for (auto it = m_SubFrames.begin(); it != m_SubFrames.end(); it++) {
-    (*it)->Release();
+    it->second->Release();
   }
   m_SubFrames.clear();
 }
@@ -247,21 +458,130 @@ void CLAVSubtitleProvider::TimeoutSubtitleRects(REFERENCE_TIME rt)
 {
   CAutoLock lock(this);
   REFERENCE_TIME timestamp = rt - 10 * 10000000; // Timeout all subs 10 seconds in the past
+
+  // The store is ordered by the stop time, so the expired subtitles are all at the front
   auto it = m_SubFrames.begin();
-  while (it != m_SubFrames.end()) {
-    if ((*it)->rtStop != AV_NOPTS_VALUE && (*it)->rtStop < timestamp) {
-      DbgLog((LOG_TRACE, 10, L"Timed out subtitle at %I64d", (*it)->rtStart));
-      (*it)->Release();
-      it = m_SubFrames.erase(it);
-    } else {
-      it++;
+  while (it != m_SubFrames.end() && it->first < timestamp) {
+    DbgLog((LOG_TRACE, 10, L"Timed out subtitle at %I64d", it->second->rtStart));
+    it->second->Release();
+    it = m_SubFrames.erase(it);
+  }
+}
+
+STDMETHODIMP CLAVSubtitleProvider::Decode(BYTE *buf, int buflen, REFERENCE_TIME rtStart, REFERENCE_TIME rtStop)
+{
+  if (!buflen || !buf) {
+    return S_OK;
+  }
+
+  CAutoLock lock(&m_csSPU);
+  while (buflen > 0) {
+    // A new SPU starts with its size, in 16-bit or 32-bit
+    if (m_PendingSPU.empty()) {
+      if (buflen < 2)
+        break;
+      m_nPendingSPUSize = AV_RB16(buf);
+      if (m_nPendingSPUSize == 0 && buflen >= 6)
+        m_nPendingSPUSize = AV_RB32(buf + 2);
+      if (m_nPendingSPUSize < 4) {
+        DbgLog((LOG_TRACE, 10, L"CLAVSubtitleProvider::Decode(): Invalid SPU size, dropping packet"));
+        break;
+      }
+      m_rtPendingSPUStart = rtStart;
+      m_rtPendingSPUStop = rtStop;
+      rtStart = rtStop = AV_NOPTS_VALUE;
     }
+
+    const size_t size = min((size_t)buflen, m_nPendingSPUSize - m_PendingSPU.size());
+    m_PendingSPU.insert(m_PendingSPU.end(), buf, buf + size);
+    buf += size;
+    buflen -= (int)size;
+
+    if (m_PendingSPU.size() < m_nPendingSPUSize)
+      break;
+
+    m_LastSPU.swap(m_PendingSPU);
+    m_PendingSPU.clear();
+    m_rtLastSPUStart = m_rtPendingSPUStart;
+    m_rtLastSPUStop = m_rtPendingSPUStop;
+
+    // Forced subtitles are shown even if the subtitles are turned off
+    m_bLastSPUDecoded = IsOutputActive() || spu_is_forced(m_LastSPU.data(), m_LastSPU.size());
+    if (m_bLastSPUDecoded)
+      QueuePacket(m_LastSPU.data(), (int)m_LastSPU.size(), m_rtLastSPUStart, m_rtLastSPUStop);
   }
+
+  return S_OK;
 }
 
-STDMETHODIMP CLAVSubtitleProvider::Decode(BYTE *buf, int buflen, REFERENCE_TIME rtStartIn, REFERENCE_TIME rtStopIn)
+HRESULT CLAVSubtitleProvider::QueuePacket(BYTE *buf, int buflen, REFERENCE_TIME rtStart, REFERENCE_TIME rtStop)
 {
-  ASSERT(m_pAVCtx);
+  // Decode synchronously if the decode thread is not available
+  if (!m_DecodeThread->ThreadExists()) {
+    CAutoLock lock(&m_csDecoder);
+    DecodePacket(buf, buflen, rtStart, rtStop);
+    return S_OK;
+  }
+
+  SubtitlePacket *pPacket = new SubtitlePacket();
+  pPacket->data = (BYTE *)av_malloc(buflen + AV_INPUT_BUFFER_PADDING_SIZE);
+  if (!pPacket->data) {
+    delete pPacket;
+    return E_OUTOFMEMORY;
+  }
+  memcpy(pPacket->data, buf, buflen);
+  memset(pPacket->data + buflen, 0, AV_INPUT_BUFFER_PADDING_SIZE);
+  pPacket->size = buflen;
+  pPacket->rtStart = rtStart;
+  pPacket->rtStop = rtStop;
+
+  {
+    CAutoLock lock(&m_DecodeQueue);
+    m_evDecodeIdle.Reset();
+    m_DecodeQueue.Push(pPacket);
+  }
+  m_evDecodeQueued.Set();
+
+  return S_OK;
+}
+
+void CLAVSubtitleProvider::ProcessDecodeQueue()
+{
+  while (!m_DecodeThread->CheckRequest(nullptr)) {
+    SubtitlePacket *pPacket = nullptr;
+    {
+      CAutoLock lock(&m_DecodeQueue);
+      pPacket = m_DecodeQueue.Pop();
+      if (!pPacket) {
+        m_evDecodeIdle.Set();
+        break;
+      }
+    }
+
+    {
+      CAutoLock lock(&m_csDecoder);
+      DecodePacket(pPacket->data, pPacket->size, pPacket->rtStart, pPacket->rtStop);
+    }
+
+    av_freep(&pPacket->data);
+    delete pPacket;
+  }
+}
+
+void CLAVSubtitleProvider::ClearDecodeQueue()
+{
+  SubtitlePacket *pPacket = nullptr;
+  while (pPacket = m_DecodeQueue.Pop()) {
+    av_freep(&pPacket->data);
+    delete pPacket;
+  }
+}
+
+// Called with the decoder lock held
+void CLAVSubtitleProvider::DecodePacket(BYTE *buf, int buflen, REFERENCE_TIME rtStartIn, REFERENCE_TIME rtStopIn)
+{
+  if (!m_pAVCtx && (!m_pAVCodec || FAILED(OpenDecoder())))
+    return;
 
   AVPacket avpkt;
   av_init_packet(&avpkt);
@@ -269,10 +589,6 @@ STDMETHODIMP CLAVSubtitleProvider::Decode(BYTE *buf, int buflen, REFERENCE_TIME
   AVSubtitle sub;
   memset(&sub, 0, sizeof(sub));
 
-  if (!buflen || !buf) {
-    return S_OK;
-  }
-
   while (buflen > 0) {
     REFERENCE_TIME rtStart = rtStartIn, rtStop = rtStopIn;
     int used_bytes = 0;
@@ -304,7 +620,13 @@ STDMETHODIMP CLAVSubtitleProvider::Decode(BYTE *buf, int buflen, REFERENCE_TIME
         avpkt.pts = rtStart;
         avpkt.duration = 0;
 
+        LAV_TRACE("SubtitleDecodeBegin", LAV_TRACE_KEYWORD_SUBTITLE,
+                  TraceLoggingInt64(rtStart, "Start"),
+                  TraceLoggingInt32(avpkt.size, "Size"));
         int ret = avcodec_decode_subtitle2(m_pAVCtx, &sub, &got_sub, &avpkt);
+        LAV_TRACE("SubtitleDecodeEnd", LAV_TRACE_KEYWORD_SUBTITLE,
+                  TraceLoggingInt32(ret, "Result"),
+                  TraceLoggingUInt32(ret >= 0 && got_sub ? sub.num_rects : 0, "Rects"));
         if (ret < 0) {
           DbgLog((LOG_TRACE, 50, L"CLAVSubtitleProvider::Decode - decoding failed despite successfull parsing"));
           got_sub = 0;
@@ -315,7 +637,7 @@ STDMETHODIMP CLAVSubtitleProvider::Decode(BYTE *buf, int buflen, REFERENCE_TIME
     }
 
     if (used_bytes < 0) {
-      return S_OK;
+      break;
     }
 
     if (!m_pParser && (!got_sub && used_bytes == 0)) {
@@ -332,7 +654,10 @@ STDMETHODIMP CLAVSubtitleProvider::Decode(BYTE *buf, int buflen, REFERENCE_TIME
     avsubtitle_free(&sub);
   }
 
-  return S_OK;
+  // The decoder can change the video size, which is read by the renderer
+  CAutoLock lock(this);
+  m_OutputSize.cx = m_pAVCtx->width;
+  m_OutputSize.cy = m_pAVCtx->height;
 }
 
 void CLAVSubtitleProvider::ProcessSubtitleFrame(AVSubtitle *sub, REFERENCE_TIME rtStart)
@@ -345,11 +670,17 @@ void CLAVSubtitleProvider::ProcessSubtitleFrame(AVSubtitle *sub, REFERENCE_TIME
       // DVD subs have the limitation that only one subtitle can be shown at a given time,
       // so we need to timeout unlimited subs when a new one appears, as well as limit the duration of timed subs
       // to prevent overlapping subtitles
+      // The stop time is the key in the store, so the affected subtitles are re-inserted
       REFERENCE_TIME rtSubTimeout = (rtStart != AV_NOPTS_VALUE) ? rtStart - 1 : SUBTITLE_PTS_TIMEOUT;
-      for (auto it = m_SubFrames.begin(); it != m_SubFrames.end(); it++) {
-        if ((*it)->rtStop == AV_NOPTS_VALUE || rtStart == AV_NOPTS_VALUE || (*it)->rtStop > rtStart) {
-          (*it)->rtStop = rtSubTimeout;
-        }
+      auto it = (rtStart != AV_NOPTS_VALUE) ? m_SubFrames.upper_bound(rtStart) : m_SubFrames.begin();
+      std::vector<CLAVSubRect *> timedOut;
+      while (it != m_SubFrames.end()) {
+        timedOut.push_back(it->second);
+        it = m_SubFrames.erase(it);
+      }
+      for (CLAVSubRect *pRect : timedOut) {
+        pRect->rtStop = rtSubTimeout;
+        m_SubFrames.insert(std::make_pair(sub_stop_key(pRect), pRect));
       }
 
       // Override subtitle timestamps if we have a timeout, and are not in a menu
@@ -421,36 +752,24 @@ void CLAVSubtitleProvider::ProcessSubtitleRect(AVSubtitleRect *rect, REFERENCE_T
 
   rgbSub += (rgbStride * vpad + hpad) * 4;
 
-  for (int y = 0; y < rect->h; y++) {
-    for (int x = 0; x < rect->w; x++) {
-      // Read paletted value
-      int idx = palSub[x];
-
-      // Skip invalid values
-      if (idx >= rect->nb_colors)
-        continue;
-
-      // Read RGB values from palette
-      BYTE b = palette[(idx << 2) + 0];
-      BYTE g = palette[(idx << 2) + 1];
-      BYTE r = palette[(idx << 2) + 2];
-      BYTE a = palette[(idx << 2) + 3];
-      // Store as RGBA pixel, pre-multiplied
-      rgbSub[(x << 2) + 0] = FAST_DIV255(b * a);
-      rgbSub[(x << 2) + 1] = FAST_DIV255(g * a);
-      rgbSub[(x << 2) + 2] = FAST_DIV255(r * a);
-      rgbSub[(x << 2) + 3] = a;
-    }
-    palSub += rect->linesize[0];
-    rgbSub += rgbStride * 4;
+  // Pre-multiply the palette once, invalid values stay transparent
+  uint32_t rgbPalette[256] = { 0 };
+  for (int idx = 0; idx < FFMIN(rect->nb_colors, 256); idx++) {
+    BYTE b = palette[(idx << 2) + 0];
+    BYTE g = palette[(idx << 2) + 1];
+    BYTE r = palette[(idx << 2) + 2];
+    BYTE a = palette[(idx << 2) + 3];
+    rgbPalette[idx] = FAST_DIV255(b * a) | (FAST_DIV255(g * a) << 8) | (FAST_DIV255(r * a) << 16) | ((uint32_t)a << 24);
   }
 
+  m_ExpandPalette(rgbSub, rgbStride * 4, palSub, rect->linesize[0], rect->w, rect->h, rgbPalette);
+
   // Store the rect
   POINT position = { rect->x - hpad, rect->y - vpad };
   SIZE size = { width, height };
   CLAVSubRect *lavRect = new CLAVSubRect();
   if (!lavRect) return;
-  lavRect->id       = m_SubPicId++;
+  lavRect->id       = InterlockedIncrement64(&m_SubPicId) - 1;
   lavRect->pitch    = rgbStride;
   lavRect->pixels   = rgbSubStart;
   lavRect->position = position;
@@ -497,37 +816,22 @@ void CLAVSubtitleProvider::AddSubtitleRect(CLAVSubRect *rect)
 {
   CAutoLock lock(this);
   rect->AddRef();
-  m_SubFrames.push_back(rect);
+  rect->SetMemoryAccount(m_pLAVVideo->GetMemoryAccount());
+  m_SubFrames.insert(std::make_pair(sub_stop_key(rect), rect));
 }
 
-typedef struct DVDSubContext
-{
-  AVClass *avclass;
-  uint32_t palette[16];
-  char    *palette_str;
-  char    *ifo_str;
-  int      has_palette;
-  uint8_t  colormap[4];
-  uint8_t  alpha[256];
-  uint8_t  buf[0x10000];
-  int      buf_size;
-  int      forced_subs_only;
-} DVDSubContext;
-
 #define MAX_NEG_CROP 1024
 extern "C" __declspec(dllimport) uint8_t ff_crop_tab[256 + 2 * MAX_NEG_CROP];
 
 STDMETHODIMP CLAVSubtitleProvider::SetDVDPalette(AM_PROPERTY_SPPAL *pPal)
 {
   DbgLog((LOG_TRACE, 10, L"CLAVSubtitleProvider(): Setting new DVD Palette"));
-  CAutoLock lock(this);
-  if (!m_pAVCtx || m_pAVCtx->codec_id != AV_CODEC_ID_DVD_SUBTITLE || !pPal) {
+  CAutoLock lock(&m_csDecoder);
+  if (!m_pAVCodec || m_pAVCodec->id != AV_CODEC_ID_DVD_SUBTITLE || !pPal) {
     return E_FAIL;
   }
 
-  DVDSubContext *ctx = (DVDSubContext *)m_pAVCtx->priv_data;
-  ctx->has_palette = 1;
-
+  uint32_t palette[16];
   uint8_t r,g,b;
   int i, y, cb, cr;
   int r_add, g_add, b_add;
@@ -538,9 +842,21 @@ STDMETHODIMP CLAVSubtitleProvider::SetDVDPalette(AM_PROPERTY_SPPAL *pPal)
     cr = pPal->sppal[i].U;
     YUV_TO_RGB1_CCIR(cb, cr);
     YUV_TO_RGB2_CCIR(r, g, b, y);
-    ctx->palette[i] = (0xFF << 24) | (r << 16) | (g << 8) | b;
+    palette[i] = (0xFF << 24) | (r << 16) | (g << 8) | b;
   }
 
+  // The decoder might only be opened later, it picks up the palette then
+  if (m_pAVCtx) {
+    DVDSubContext *ctx = (DVDSubContext *)m_pAVCtx->priv_data;
+    ctx->has_palette = 1;
+    memcpy(ctx->palette, palette, sizeof(palette));
+  }
+
+  // Keep a copy for the highlight processing on the renderer thread
+  CAutoLock providerLock(this);
+  memcpy(m_DVDPalette, palette, sizeof(m_DVDPalette));
+  m_bDVDPalette = TRUE;
+
   return S_OK;
 }
 
@@ -573,10 +889,10 @@ STDMETHODIMP CLAVSubtitleProvider::SetDVDHLI(struct _AM_PROPERTY_SPHLI *pHLI)
   return S_OK;
 }
 
-CLAVSubRect* CLAVSubtitleProvider::ProcessDVDHLI(CLAVSubRect *rect)
+// Runs outside of the provider lock, with copies of the highlight and the palette
+CLAVSubRect* CLAVSubtitleProvider::ProcessDVDHLI(CLAVSubRect *rect, const AM_PROPERTY_SPHLI *pHLI, const uint32_t *pPalette)
 {
-  DVDSubContext *ctx = (DVDSubContext *)m_pAVCtx->priv_data;
-  if (!m_pHLI || !rect->pixelsPal || !ctx->has_palette)
+  if (!rect->pixelsPal)
     return rect;
 
   LPVOID newPixels = CoTaskMemAlloc(rect->pitch * rect->size.cy * 4);
@@ -590,60 +906,55 @@ CLAVSubRect* CLAVSubtitleProvider::ProcessDVDHLI(CLAVSubRect *rect)
   // create new object
   rect = new CLAVSubRect(*rect);
   rect->ResetRefCount();
+  rect->ResetMemoryAccount();
   rect->pixels = newPixels;
   rect->pixelsPal = nullptr;
+  rect->SetMemoryAccount(m_pLAVVideo->GetMemoryAccount());
 
   // Need to assign a new Id since we're modifying it here..
-  rect->id = m_SubPicId++;
-
-  uint8_t *palette   = (uint8_t *)ctx->palette;
-  for (int y = 0; y < rect->size.cy; y++) {
-    if (y+rect->position.y < m_pHLI->StartY || y+rect->position.y > m_pHLI->StopY)
-      continue;
-    uint8_t *pixelsPal = originalPalPixels + rect->pitch * y;
-    uint8_t *pixels = ((uint8_t *)rect->pixels) + rect->pitch * y * 4;
-    for (int x = 0; x < rect->size.cx; x++) {
-      if (x+rect->position.x < m_pHLI->StartX || x+rect->position.x > m_pHLI->StopX)
-        continue;
-      uint8_t idx = pixelsPal[x];
-      uint8_t alpha = 0;
-      switch (idx) {
-      case 0:
-        idx = m_pHLI->ColCon.backcol;
-        alpha = m_pHLI->ColCon.backcon;
-        break;
-      case 1:
-        idx = m_pHLI->ColCon.patcol;
-        alpha = m_pHLI->ColCon.patcon;
-        break;
-      case 2:
-        idx = m_pHLI->ColCon.emph1col;
-        alpha = m_pHLI->ColCon.emph1con;
-        break;
-      case 3:
-        idx = m_pHLI->ColCon.emph2col;
-        alpha = m_pHLI->ColCon.emph2con;
-        break;
-      }
-      // Read RGB values from palette
-      BYTE b = palette[(idx << 2) + 0];
-      BYTE g = palette[(idx << 2) + 1];
-      BYTE r = palette[(idx << 2) + 2];
-      BYTE a = alpha << 4;
-      // Store as RGBA pixel, pre-multiplied
-      pixels[(x << 2) + 0] = FAST_DIV255(b * a);
-      pixels[(x << 2) + 1] = FAST_DIV255(g * a);
-      pixels[(x << 2) + 2] = FAST_DIV255(r * a);
-      pixels[(x << 2) + 3] = a;
-    }
+  rect->id = InterlockedIncrement64(&m_SubPicId) - 1;
+
+  // Highlight colors for the four DVD subtitle colors, everything else is transparent
+  const uint8_t *palette = (const uint8_t *)pPalette;
+  const struct { uint8_t col, con; } colcon[4] = {
+    { pHLI->ColCon.backcol,  pHLI->ColCon.backcon  },
+    { pHLI->ColCon.patcol,   pHLI->ColCon.patcon   },
+    { pHLI->ColCon.emph1col, pHLI->ColCon.emph1con },
+    { pHLI->ColCon.emph2col, pHLI->ColCon.emph2con },
+  };
+
+  uint32_t rgbPalette[256] = { 0 };
+  for (int i = 0; i < 4; i++) {
+    // Read RGB values from palette
+    BYTE b = palette[(colcon[i].col << 2) + 0];
+    BYTE g = palette[(colcon[i].col << 2) + 1];
+    BYTE r = palette[(colcon[i].col << 2) + 2];
+    BYTE a = colcon[i].con << 4;
+    // Store as RGBA pixel, pre-multiplied
+    rgbPalette[i] = FAST_DIV255(b * a) | (FAST_DIV255(g * a) << 8) | (FAST_DIV255(r * a) << 16) | ((uint32_t)a << 24);
+  }
+
+  // Only the highlight area is re-colored
+  const int x0 = FFMAX((int)pHLI->StartX - rect->position.x, 0);
+  const int x1 = FFMIN((int)pHLI->StopX - rect->position.x, rect->size.cx - 1);
+  const int y0 = FFMAX((int)pHLI->StartY - rect->position.y, 0);
+  const int y1 = FFMIN((int)pHLI->StopY - rect->position.y, rect->size.cy - 1);
+  if (x1 >= x0 && y1 >= y0) {
+    m_ExpandPalette((BYTE *)rect->pixels + (rect->pitch * y0 + x0) * 4, rect->pitch * 4, originalPalPixels + rect->pitch * y0 + x0, rect->pitch, x1 - x0 + 1, y1 - y0 + 1, rgbPalette);
   }
   return rect;
 }
 
 STDMETHODIMP CLAVSubtitleProvider::SetDVDComposit(BOOL bComposit)
 {
-  CAutoLock lock(this);
-  m_bComposit = bComposit;
+  {
+    CAutoLock lock(this);
+    m_bComposit = bComposit;
+  }
+
+  if (bComposit)
+    ResumeOutput();
+
   return S_OK;
 }
 
@@ -687,3 +998,54 @@ DWORD CLAVSubtitleProviderControlThread::ThreadProc()
   }
   return 1;
 }
+
+CLAVSubtitleProviderDecodeThread::CLAVSubtitleProviderDecodeThread(CLAVSubtitleProvider *pProvider)
+  : CAMThread()
+  , m_pProvider(pProvider)
+{
+  Create();
+}
+
+CLAVSubtitleProviderDecodeThread::~CLAVSubtitleProviderDecodeThread()
+{
+  if (ThreadExists()) {
+    CallWorker(CLAVSubtitleProvider::CNTRL_EXIT);
+    Close();
+  }
+}
+
+DWORD CLAVSubtitleProviderDecodeThread::ThreadProc()
+{
+  SetThreadName(-1, "LAV Subtitle Decode Thread");
+
+  CStreamingThreadPriority priority(ThreadClass_Playback, m_pProvider->m_pLAVVideo->GetStreamingThreadPriority());
+
+  HANDLE hEvts[] = { GetRequestHandle(), m_pProvider->m_evDecodeQueued };
+
+  while (1) {
+    DWORD dwWait = WaitForMultipleObjects(countof(hEvts), hEvts, FALSE, INFINITE);
+    if (dwWait == WAIT_OBJECT_0) {
+      DWORD cmd = GetRequest();
+      switch (cmd) {
+      case CLAVSubtitleProvider::CNTRL_EXIT:
+        Reply(S_OK);
+        return 0;
+      }
+    } else if (dwWait == WAIT_OBJECT_0 + 1) {
+      m_pProvider->ProcessDecodeQueue();
+    }
+  }
+  return 1;
+}
+
+void CLAVSubtitleProvider::expand_palette_c(BYTE *dst, ptrdiff_t dstStride, const BYTE *src, ptrdiff_t srcStride, int width, int height, const uint32_t *palette)
+{
+  for (int line = 0; line < height; line++) {
+    uint32_t *out = (uint32_t *)dst;
+    for (int x = 0; x < width; x++) {
+      out[x] = palette[src[x]];
+    }
+    src += srcStride;
+    dst += dstStride;
+  }
+}
@@ -21,9 +21,16 @@
 
 #include "SubRenderOptionsImpl.h"
 #include "LAVSubtitleFrame.h"
+#include "SynchronizedQueue.h"
+
+#include <map>
+#include <vector>
 
 class CLAVVideo;
 
+// Number of subtitle frames kept for re-use once the renderer released them
+#define LAV_SUBTITLE_FRAME_POOL 8
+
 typedef struct LAVSubtitleProviderContext {
   LPWSTR name;                    ///< name of the Provider
   LPWSTR version;                 ///< Version of the Provider
@@ -52,6 +59,22 @@ private:
   ISubRenderConsumer2 *m_pConsumer2 = nullptr;
 };
 
+class CLAVSubtitleProvider;
+
+// Decodes the queued subtitle packets, so neither the streaming thread nor the renderer wait on the bitmap conversion
+class CLAVSubtitleProviderDecodeThread : public CAMThread
+{
+public:
+  CLAVSubtitleProviderDecodeThread(CLAVSubtitleProvider *pProvider);
+  ~CLAVSubtitleProviderDecodeThread();
+
+protected:
+  DWORD ThreadProc();
+
+private:
+  CLAVSubtitleProvider *m_pProvider = nullptr;
+};
+
 class CLAVSubtitleProvider : public ISubRenderProvider, public CSubRenderOptionsImpl, public CUnknown, private CCritSec
 {
 public:
@@ -78,15 +101,39 @@ public:
   STDMETHODIMP SetDVDComposit(BOOL bComposit);
 
 private:
+  struct SubtitlePacket {
+    BYTE *data;
+    int size;
+    REFERENCE_TIME rtStart;
+    REFERENCE_TIME rtStop;
+  };
+
+  HRESULT OpenDecoder();
   void CloseDecoder();
 
+  BOOL IsOutputActive();
+  void ResumeOutput();
+  HRESULT QueuePacket(BYTE *buf, int buflen, REFERENCE_TIME rtStart, REFERENCE_TIME rtStop);
+
+  void DecodePacket(BYTE *buf, int buflen, REFERENCE_TIME rtStart, REFERENCE_TIME rtStop);
+  void ProcessDecodeQueue();
+  void ClearDecodeQueue();
+
   void ProcessSubtitleFrame(AVSubtitle *sub, REFERENCE_TIME rtStart);
   void ProcessSubtitleRect(AVSubtitleRect *rect, REFERENCE_TIME rtStart, REFERENCE_TIME rtStop);
   void AddSubtitleRect(CLAVSubRect *rect);
-  CLAVSubRect* ProcessDVDHLI(CLAVSubRect *rect);
+  CLAVSubRect* ProcessDVDHLI(CLAVSubRect *rect, const struct _AM_PROPERTY_SPHLI *pHLI, const uint32_t *palette);
+
+  // Expand 8-bit palette indices into pre-multiplied BGRA pixels, using a palette with 256 pre-multiplied entries
+  typedef void (*ExpandPaletteFn)(BYTE *dst, ptrdiff_t dstStride, const BYTE *src, ptrdiff_t srcStride, int width, int height, const uint32_t *palette);
+  static void expand_palette_c(BYTE *dst, ptrdiff_t dstStride, const BYTE *src, ptrdiff_t srcStride, int width, int height, const uint32_t *palette);
+  static void expand_palette_avx2(BYTE *dst, ptrdiff_t dstStride, const BYTE *src, ptrdiff_t srcStride, int width, int height, const uint32_t *palette);
   void ClearSubtitleRects();
   void TimeoutSubtitleRects(REFERENCE_TIME rtStop);
 
+  CLAVSubtitleFrame *GetPooledFrame(BOOL *pbPooled);
+  void ClearFramePool();
+
   enum { CNTRL_EXIT, CNTRL_FLUSH };
   HRESULT ControlCmd(DWORD cmd) {
     return m_ControlThread->CallWorker(cmd);
@@ -94,24 +141,60 @@ private:
 
 private:
   friend class CLAVSubtitleProviderControlThread;
+  friend class CLAVSubtitleProviderDecodeThread;
   LAVSubtitleProviderContext context;
   CLAVVideo *m_pLAVVideo            = nullptr;
 
   ISubRenderConsumer  *m_pConsumer  = nullptr;
   ISubRenderConsumer2 *m_pConsumer2 = nullptr;
 
+  // The decoder is only used by the decode thread, and whoever changes its state holds this lock
+  // The provider lock only protects the subtitle store and the state shared with the renderer.
+  CCritSec              m_csDecoder;
   const AVCodec        *m_pAVCodec  = nullptr;
   AVCodecContext       *m_pAVCtx    = nullptr;
   AVCodecParserContext *m_pParser   = nullptr;
+  CMediaType            m_mtDecoder;                 ///< Media type the decoder is opened with on the first packet to decode
+
+  // The packets are assembled into complete SPUs, which are only decoded if anyone shows them
+  // The latest one is kept, so the subtitle appears right away once they are shown again.
+  CCritSec              m_csSPU;
+  std::vector<BYTE>     m_PendingSPU;
+  size_t                m_nPendingSPUSize = 0;
+  REFERENCE_TIME        m_rtPendingSPUStart = AV_NOPTS_VALUE;
+  REFERENCE_TIME        m_rtPendingSPUStop  = AV_NOPTS_VALUE;
+  std::vector<BYTE>     m_LastSPU;
+  REFERENCE_TIME        m_rtLastSPUStart = AV_NOPTS_VALUE;
+  REFERENCE_TIME        m_rtLastSPUStop  = AV_NOPTS_VALUE;
+  BOOL                  m_bLastSPUDecoded = FALSE;
 
   REFERENCE_TIME        m_rtLastFrame  = AV_NOPTS_VALUE;
   REFERENCE_TIME        m_rtStartCache = AV_NOPTS_VALUE;
-  ULONGLONG             m_SubPicId     = 0;
+  LONG64                m_SubPicId     = 0;
   BOOL                  m_bComposit    = TRUE;
+  SIZE                  m_OutputSize   = { 0, 0 };
 
-  std::list<CLAVSubRect *> m_SubFrames;
+  // Ready subtitles, indexed by their stop time for the lookup and the expiry
+  std::multimap<REFERENCE_TIME, CLAVSubRect *> m_SubFrames;
 
   struct _AM_PROPERTY_SPHLI *m_pHLI = nullptr;
+  uint32_t              m_DVDPalette[16];
+  BOOL                  m_bDVDPalette  = FALSE;
+
+  ExpandPaletteFn       m_ExpandPalette = nullptr;
+
+  // Frames are re-used once the renderer released them, and the last frame is delivered again while the same subtitles are visible
+  CCritSec                         m_csFrames;
+  std::vector<CLAVSubtitleFrame *> m_FramePool;
+  std::vector<CLAVSubRect *>       m_FrameRects;      ///< Subtitles visible at the requested time
+  std::vector<CLAVSubRect *>       m_LastFrameRects;  ///< Subtitles in the last frame, it holds the references
+  CLAVSubtitleFrame               *m_pLastFrame = nullptr;
+  RECT                             m_LastFrameRect = { 0 };
+
+  CSynchronizedQueue<SubtitlePacket *> m_DecodeQueue;
+  CAMEvent              m_evDecodeQueued;
+  CAMEvent              m_evDecodeIdle{TRUE};
 
   CLAVSubtitleProviderControlThread *m_ControlThread = nullptr;
+  CLAVSubtitleProviderDecodeThread  *m_DecodeThread  = nullptr;
 };
@@ -0,0 +1,242 @@
+/*
+ *      Copyright (C) 2010-2019 Hendrik Leppkes
+ *      http://www.1f0.de
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program; if not, write to the Free Software Foundation, Inc.,
+ *  51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#include "stdafx.h"
+#include "../LAVSubtitleConsumer.h"
+#include "blend_internal.h"
+
+#include <immintrin.h>
+
+// AVX2 variants of the functions in blend_sse4.cpp
+// All arithmetic is done per element, so the lane layout of AVX2 only matters for packing and interleaving.
+
+static inline __m256i blend_epi16_8bit_avx2(__m256i dst, __m256i src, __m256i alpha)
+{
+  const __m256i x = _mm256_add_epi16(_mm256_mullo_epi16(dst, _mm256_sub_epi16(_mm256_set1_epi16(255), alpha)), _mm256_mullo_epi16(src, alpha));
+  return _mm256_mulhi_epu16(_mm256_add_epi16(x, _mm256_set1_epi16(128)), _mm256_set1_epi16(257));
+}
+
+static inline __m256i blend_epi16_16bit_avx2(__m256i dst, __m256i src, __m256i alpha)
+{
+  const __m256i ialpha = _mm256_sub_epi16(_mm256_set1_epi16(255), alpha);
+  const __m256i dlo = _mm256_mullo_epi16(dst, ialpha), dhi = _mm256_mulhi_epu16(dst, ialpha);
+  const __m256i slo = _mm256_mullo_epi16(src, alpha),  shi = _mm256_mulhi_epu16(src, alpha);
+  const __m256i round = _mm256_set1_epi32(128);
+
+  __m256i x0 = _mm256_add_epi32(_mm256_add_epi32(_mm256_unpacklo_epi16(dlo, dhi), _mm256_unpacklo_epi16(slo, shi)), round);
+  __m256i x1 = _mm256_add_epi32(_mm256_add_epi32(_mm256_unpackhi_epi16(dlo, dhi), _mm256_unpackhi_epi16(slo, shi)), round);
+  x0 = _mm256_srli_epi32(_mm256_add_epi32(x0, _mm256_slli_epi32(x0, 8)), 16);
+  x1 = _mm256_srli_epi32(_mm256_add_epi32(x1, _mm256_slli_epi32(x1, 8)), 16);
+  __m256i res = _mm256_packus_epi32(x0, x1); /* undoes the in-lane unpacking */
+
+  res = _mm256_blendv_epi8(res, dst, _mm256_cmpeq_epi16(alpha, _mm256_setzero_si256()));
+  res = _mm256_blendv_epi8(res, src, _mm256_cmpeq_epi16(alpha, _mm256_set1_epi16(255)));
+  return res;
+}
+
+// Blend 16 samples in-place
+static inline void blend_samples_avx2(uint8_t *dst, __m256i src, __m256i alpha)
+{
+  __m256i d = _mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i *)dst));
+  d = blend_epi16_8bit_avx2(d, src, alpha);
+  _mm_storeu_si128((__m128i *)dst, _mm_packus_epi16(_mm256_castsi256_si128(d), _mm256_extracti128_si256(d, 1)));
+}
+
+static inline void blend_samples_avx2(uint16_t *dst, __m256i src, __m256i alpha)
+{
+  __m256i d = _mm256_loadu_si256((const __m256i *)dst);
+  _mm256_storeu_si256((__m256i *)dst, blend_epi16_16bit_avx2(d, src, alpha));
+}
+
+// Load 16 8-bit subtitle samples into 16-bit lanes
+#define BLEND_AVX2_LOAD_SAMPLES(src,shift) \
+  _mm256_sll_epi16(_mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i *)(src))), shift)
+
+DECLARE_BLEND_FUNC_IMPL(blend_rgb32_avx2)
+{
+  ASSERT(pixFmt == LAVPixFmt_RGB32);
+
+  BYTE *rgbOut = video[0];
+  const BYTE *subIn = subData[0];
+
+  const ptrdiff_t outStride = videoStride[0];
+  const ptrdiff_t inStride = subStride[0];
+
+  const __m256i zero = _mm256_setzero_si256();
+  const __m256i c255 = _mm256_set1_epi16(255);
+  const __m256i c128 = _mm256_set1_epi16(128);
+  const __m256i c257 = _mm256_set1_epi16(257);
+  const __m256i alphaMask = _mm256_set1_epi32(0xFF000000);
+  const __m256i alphaShuffle = _mm256_setr_epi8(3,3,3,3,7,7,7,7,11,11,11,11,15,15,15,15,3,3,3,3,7,7,7,7,11,11,11,11,15,15,15,15);
+
+  for (int y = 0; y < size.cy; y++) {
+    BYTE *dstLine = rgbOut + ((y + position.y) * outStride) + (position.x << 2);
+    const BYTE *srcLine = subIn + (y * inStride);
+    int x = 0;
+
+    for (; x < (size.cx - 7); x += 8) {
+      const __m256i src = _mm256_loadu_si256((const __m256i *)(srcLine + (x << 2)));
+      const __m256i transparent = _mm256_cmpeq_epi32(_mm256_and_si256(src, alphaMask), zero);
+      if (_mm256_movemask_epi8(transparent) == -1)
+        continue;
+
+      const __m256i dst = _mm256_loadu_si256((const __m256i *)(dstLine + (x << 2)));
+      const __m256i alpha = _mm256_shuffle_epi8(src, alphaShuffle);
+
+      __m256i lo = _mm256_mullo_epi16(_mm256_unpacklo_epi8(dst, zero), _mm256_sub_epi16(c255, _mm256_unpacklo_epi8(alpha, zero)));
+      __m256i hi = _mm256_mullo_epi16(_mm256_unpackhi_epi8(dst, zero), _mm256_sub_epi16(c255, _mm256_unpackhi_epi8(alpha, zero)));
+      lo = _mm256_mulhi_epu16(_mm256_add_epi16(lo, c128), c257);
+      hi = _mm256_mulhi_epu16(_mm256_add_epi16(hi, c128), c257);
+
+      __m256i res = _mm256_adds_epu8(_mm256_packus_epi16(lo, hi), src);
+      // Keep transparent pixels and the alpha channel of the video untouched
+      res = _mm256_blendv_epi8(res, dst, _mm256_or_si256(transparent, alphaMask));
+      _mm256_storeu_si256((__m256i *)(dstLine + (x << 2)), res);
+    }
+
+    for (; x < size.cx; x++) {
+      blend_rgb_pixel(dstLine + (x << 2), srcLine + (x << 2));
+    }
+  }
+
+  return S_OK;
+}
+
+template <class pixT, int nv12>
+DECLARE_BLEND_FUNC_IMPL(blend_yuv_avx2)
+{
+  ASSERT(pixFmt == LAVPixFmt_YUV420 || pixFmt == LAVPixFmt_NV12 || pixFmt == LAVPixFmt_YUV422 || pixFmt == LAVPixFmt_YUV444 || pixFmt == LAVPixFmt_YUV420bX || pixFmt == LAVPixFmt_YUV422bX || pixFmt == LAVPixFmt_YUV444bX || pixFmt == LAVPixFmt_P016);
+
+  BYTE *y = video[0];
+  BYTE *u = video[1];
+  BYTE *v = video[2];
+
+  const BYTE *subY = subData[0];
+  const BYTE *subU = subData[1];
+  const BYTE *subV = subData[2];
+  const BYTE *subA = subData[3];
+
+  const ptrdiff_t outStride = videoStride[0];
+  const ptrdiff_t outStrideUV = videoStride[1];
+  const ptrdiff_t inStride = subStride[0];
+  const ptrdiff_t inStrideUV = subStride[1];
+
+  int line, col;
+  int w = size.cx, h = size.cy;
+  int yPos = position.y;
+  int xPos = position.x;
+
+  const int hsub = nv12 || (pixFmt != LAVPixFmt_YUV444 && pixFmt != LAVPixFmt_YUV444bX);
+  const int vsub = nv12 || (pixFmt == LAVPixFmt_YUV420 || pixFmt == LAVPixFmt_YUV420bX || pixFmt == LAVPixFmt_NV12);
+  const int shift = sizeof(pixT) > 1 ? bpp - 8 : 0;
+
+  const __m128i shiftReg = _mm_cvtsi32_si128(shift);
+  const __m256i ones = _mm256_set1_epi8(1);
+  const __m256i lowBytes = _mm256_set1_epi16(0x00FF);
+
+  for (line = 0; line < h; line++) {
+    pixT *dstY = (pixT *)(y + ((line + yPos) * outStride)) + xPos;
+    const BYTE *srcY = subY + (line * inStride);
+    const BYTE *srcA = subA + (line * inStride);
+
+    for (col = 0; col < (w - 15); col += 16) {
+      const __m128i alpha = _mm_loadu_si128((const __m128i *)(srcA + col));
+      if (_mm_testz_si128(alpha, alpha))
+        continue;
+
+      blend_samples_avx2(dstY + col, BLEND_AVX2_LOAD_SAMPLES(srcY + col, shiftReg), _mm256_cvtepu8_epi16(alpha));
+    }
+    for (; col < w; col++) {
+      blend_yuv_sample(dstY[col], srcY[col] << shift, srcA[col]);
+    }
+  }
+
+  if (hsub) {
+    w >>= 1;
+    xPos >>= 1;
+  }
+  if (vsub) {
+    h >>= 1;
+    yPos >>= 1;
+  }
+
+  for (line = 0; line < h; line++) {
+    pixT *dstUV = (pixT *)(u + (line + yPos) * outStrideUV) + (xPos << 1);
+
+    pixT *dstU = (pixT *)(u + (line + yPos) * outStrideUV) + xPos;
+    const BYTE *srcU = subU + line * inStrideUV;
+
+    pixT *dstV = (pixT *)(v + (line + yPos) * outStrideUV) + xPos;
+    const BYTE *srcV = subV + line * inStrideUV;
+
+    const BYTE *srcA = subA + (line * inStride * (ptrdiff_t(1) << vsub));
+    const int vedge = line + 1 >= h;
+
+    // The last column is left to the scalar code, since it has no right neighbour to average the alpha with
+    for (col = 0; col < (w - 16); col += 16) {
+      __m256i alpha;
+      if (hsub) {
+        const __m256i a0 = _mm256_loadu_si256((const __m256i *)(srcA + (col << 1)));
+        if (vsub && !vedge) {
+          const __m256i a1 = _mm256_loadu_si256((const __m256i *)(srcA + (col << 1) + inStride));
+          alpha = _mm256_srli_epi16(_mm256_add_epi16(_mm256_maddubs_epi16(a0, ones), _mm256_maddubs_epi16(a1, ones)), 2);
+        } else {
+          const __m256i even = _mm256_and_si256(a0, lowBytes);
+          alpha = _mm256_srli_epi16(_mm256_add_epi16(_mm256_srli_epi16(_mm256_add_epi16(even, _mm256_srli_epi16(a0, 8)), 1), even), 1);
+        }
+      } else {
+        alpha = _mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i *)(srcA + col)));
+      }
+      if (_mm256_testz_si256(alpha, alpha))
+        continue;
+
+      __m256i srcU16 = BLEND_AVX2_LOAD_SAMPLES(srcU + col, shiftReg);
+      __m256i srcV16 = BLEND_AVX2_LOAD_SAMPLES(srcV + col, shiftReg);
+      if (nv12) {
+        // Re-order the quad-words so the in-lane interleaving produces samples 0-7 and 8-15 in order
+        alpha  = _mm256_permute4x64_epi64(alpha,  _MM_SHUFFLE(3,1,2,0));
+        srcU16 = _mm256_permute4x64_epi64(srcU16, _MM_SHUFFLE(3,1,2,0));
+        srcV16 = _mm256_permute4x64_epi64(srcV16, _MM_SHUFFLE(3,1,2,0));
+        blend_samples_avx2(dstUV + (col << 1) +  0, _mm256_unpacklo_epi16(srcU16, srcV16), _mm256_unpacklo_epi16(alpha, alpha));
+        blend_samples_avx2(dstUV + (col << 1) + 16, _mm256_unpackhi_epi16(srcU16, srcV16), _mm256_unpackhi_epi16(alpha, alpha));
+      } else {
+        blend_samples_avx2(dstU + col, srcU16, alpha);
+        blend_samples_avx2(dstV + col, srcV16, alpha);
+      }
+    }
+
+    for (; col < w; col++) {
+      int alpha = blend_chroma_alpha(srcA + (col << hsub), inStride, hsub, vsub, col+1 >= w, vedge);
+      if (nv12) {
+        blend_yuv_sample(dstUV[(col << 1)+0], srcU[col] << shift, alpha);
+        blend_yuv_sample(dstUV[(col << 1)+1], srcV[col] << shift, alpha);
+      } else {
+        blend_yuv_sample(dstU[col], srcU[col] << shift, alpha);
+        blend_yuv_sample(dstV[col], srcV[col] << shift, alpha);
+      }
+    }
+  }
+
+  return S_OK;
+}
+
+template HRESULT CLAVSubtitleConsumer::blend_yuv_avx2<uint8_t,1>BLEND_FUNC_PARAMS;
+template HRESULT CLAVSubtitleConsumer::blend_yuv_avx2<uint8_t,0>BLEND_FUNC_PARAMS;
+template HRESULT CLAVSubtitleConsumer::blend_yuv_avx2<uint16_t,0>BLEND_FUNC_PARAMS;
+template HRESULT CLAVSubtitleConsumer::blend_yuv_avx2<uint16_t,1>BLEND_FUNC_PARAMS;
@@ -19,8 +19,7 @@
 
 #include "stdafx.h"
 #include "../LAVSubtitleConsumer.h"
-
-#define FAST_DIV255(x) ((((x) + 128) * 257) >> 16)
+#include "blend_internal.h"
 
 DECLARE_BLEND_FUNC_IMPL(blend_rgb_c)
 {
@@ -38,21 +37,7 @@ DECLARE_BLEND_FUNC_IMPL(blend_rgb_c)
     BYTE *dstLine = rgbOut + ((y + position.y) * outStride) + (position.x * dstep);
     const BYTE *srcLine = subIn + (y * inStride);
     for (int x = 0; x < size.cx; x++) {
-      const BYTE a = srcLine[3];
-      switch (a) {
-      case 0:
-        break;
-      case 255:
-        dstLine[0] = srcLine[0];
-        dstLine[1] = srcLine[1];
-        dstLine[2] = srcLine[2];
-        break;
-      default:
-        dstLine[0] = av_clip_uint8(FAST_DIV255(dstLine[0] * (255 - a)) + srcLine[0]);
-        dstLine[1] = av_clip_uint8(FAST_DIV255(dstLine[1] * (255 - a)) + srcLine[1]);
-        dstLine[2] = av_clip_uint8(FAST_DIV255(dstLine[2] * (255 - a)) + srcLine[2]);
-        break;
-      }
+      blend_rgb_pixel(dstLine, srcLine);
       dstLine += dstep;
       srcLine += 4;
     }
@@ -85,8 +70,8 @@ DECLARE_BLEND_FUNC_IMPL(blend_yuv_c)
   int yPos = position.y;
   int xPos = position.x;
 
-  const int hsub = nv12 || (pixFmt == LAVPixFmt_YUV420 || pixFmt == LAVPixFmt_YUV420bX || pixFmt == LAVPixFmt_NV12);
-  const int vsub = nv12 || (pixFmt != LAVPixFmt_YUV444 && pixFmt != LAVPixFmt_YUV444bX);
+  const int hsub = nv12 || (pixFmt != LAVPixFmt_YUV444 && pixFmt != LAVPixFmt_YUV444bX);
+  const int vsub = nv12 || (pixFmt == LAVPixFmt_YUV420 || pixFmt == LAVPixFmt_YUV420bX || pixFmt == LAVPixFmt_NV12);
   const int shift = sizeof(pixT) > 1 ? bpp - 8 : 0;
 
   for (line = 0; line < h; line++) {
@@ -94,16 +79,7 @@ DECLARE_BLEND_FUNC_IMPL(blend_yuv_c)
     const BYTE *srcY = subY + (line * inStride);
     const BYTE *srcA = subA + (line * inStride);
     for (col = 0; col < w; col++) {
-      switch (srcA[col]) {
-      case 0:
-        break;
-      case 255:
-        dstY[col] = srcY[col] << shift;
-        break;
-      default:
-        dstY[col] = FAST_DIV255(dstY[col] * (255 - srcA[col]) + (srcY[col] << shift) * srcA[col]);
-        break;
-      }
+      blend_yuv_sample(dstY[col], srcY[col] << shift, srcA[col]);
     }
   }
 
@@ -125,47 +101,18 @@ DECLARE_BLEND_FUNC_IMPL(blend_yuv_c)
     pixT *dstV = (pixT *)(v + (line + yPos) * outStrideUV) + xPos;
     const BYTE *srcV = subV + line * inStrideUV;
 
-    const BYTE *srcA = subA + (line * inStride * (ptrdiff_t(1) << hsub));
+    const BYTE *srcA = subA + (line * inStride * (ptrdiff_t(1) << vsub));
     for (col = 0; col < w; col++) {
       // Average Alpha
-      int alpha;
-      if (hsub && vsub && col+1 < w && line+1 < h) {
-        alpha = (srcA[0] + srcA[inStride] + srcA[1] + srcA[inStride+1]) >> 2;
-      } else if (hsub || vsub) {
-        int alpha_h = hsub && col+1 < w ? (srcA[0] + srcA[1]) >> 1 : srcA[0];
-        int alpha_v = vsub && line+1 < h ? (srcA[0] + srcA[inStride]) >> 1 : srcA[0];
-        alpha = (alpha_h + alpha_v) >> 1;
-      } else {
-        alpha = srcA[0];
-      }
+      int alpha = blend_chroma_alpha(srcA, inStride, hsub, vsub, col+1 >= w, line+1 >= h);
       if (nv12) {
-        switch(alpha) {
-        case 0:
-          break;
-        case 255:
-          dstUV[(col << 1)+0] = srcU[col] << shift;
-          dstUV[(col << 1)+1] = srcV[col] << shift;
-          break;
-        default:
-          dstUV[(col << 1)+0] = FAST_DIV255(dstUV[(col << 1)+0] * (255 - alpha) + (srcU[col] << shift) * alpha);
-          dstUV[(col << 1)+1] = FAST_DIV255(dstUV[(col << 1)+1] * (255 - alpha) + (srcV[col] << shift) * alpha);
-          break;
-        }
+        blend_yuv_sample(dstUV[(col << 1)+0], srcU[col] << shift, alpha);
+        blend_yuv_sample(dstUV[(col << 1)+1], srcV[col] << shift, alpha);
       } else {
-        switch(alpha) {
-        case 0:
-          break;
-        case 255:
-          dstU[col] = srcU[col] << shift;
-          dstV[col] = srcV[col] << shift;
-          break;
-        default:
-          dstU[col] = FAST_DIV255(dstU[col] * (255 - alpha) + (srcU[col] << shift) * alpha);
-          dstV[col] = FAST_DIV255(dstV[col] * (255 - alpha) + (srcV[col] << shift) * alpha);
-          break;
-        }
+        blend_yuv_sample(dstU[col], srcU[col] << shift, alpha);
+        blend_yuv_sample(dstV[col], srcV[col] << shift, alpha);
       }
-      srcA += ptrdiff_t(1) << vsub;
+      srcA += ptrdiff_t(1) << hsub;
     }
   }
 
@@ -0,0 +1,80 @@
+/*
+ *      Copyright (C) 2010-2019 Hendrik Leppkes
+ *      http://www.1f0.de
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program; if not, write to the Free Software Foundation, Inc.,
+ *  51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#pragma once
+
+// Scalar helpers shared by the generic and the SIMD blend functions
+// The SIMD functions use them for the edges, so all variants produce identical results.
+
+#define FAST_DIV255(x) ((((x) + 128) * 257) >> 16)
+
+// Blend one pre-multiplied BGRA subtitle pixel onto a RGB24/RGB32 pixel
+static inline void blend_rgb_pixel(BYTE *dst, const BYTE *src)
+{
+  const BYTE a = src[3];
+  switch (a) {
+  case 0:
+    break;
+  case 255:
+    dst[0] = src[0];
+    dst[1] = src[1];
+    dst[2] = src[2];
+    break;
+  default:
+    dst[0] = av_clip_uint8(FAST_DIV255(dst[0] * (255 - a)) + src[0]);
+    dst[1] = av_clip_uint8(FAST_DIV255(dst[1] * (255 - a)) + src[1]);
+    dst[2] = av_clip_uint8(FAST_DIV255(dst[2] * (255 - a)) + src[2]);
+    break;
+  }
+}
+
+// Blend one YUV sample, src already needs to be shifted to the bit depth of the video
+// Unsigned math is used so 16-bit samples cannot overflow the intermediate result
+template <class pixT>
+static inline void blend_yuv_sample(pixT &dst, int src, int alpha)
+{
+  switch (alpha) {
+  case 0:
+    break;
+  case 255:
+    dst = (pixT)src;
+    break;
+  default:
+    dst = (pixT)FAST_DIV255((unsigned)dst * (255 - alpha) + (unsigned)src * alpha);
+    break;
+  }
+}
+
+// Average the alpha of the luma samples covered by one chroma sample
+// srcA    - alpha of the top-left luma sample
+// hsub    - horizontal chroma subsampling
+// vsub    - vertical chroma subsampling
+// hedge   - last chroma column, no right neighbour
+// vedge   - last chroma line, no bottom neighbour
+static inline int blend_chroma_alpha(const BYTE *srcA, ptrdiff_t inStride, int hsub, int vsub, int hedge, int vedge)
+{
+  if (hsub && vsub && !hedge && !vedge) {
+    return (srcA[0] + srcA[inStride] + srcA[1] + srcA[inStride+1]) >> 2;
+  } else if (hsub || vsub) {
+    int alpha_h = hsub && !hedge ? (srcA[0] + srcA[1]) >> 1 : srcA[0];
+    int alpha_v = vsub && !vedge ? (srcA[0] + srcA[inStride]) >> 1 : srcA[0];
+    return (alpha_h + alpha_v) >> 1;
+  }
+  return srcA[0];
+}
@@ -0,0 +1,264 @@
+/*
+ *      Copyright (C) 2010-2019 Hendrik Leppkes
+ *      http://www.1f0.de
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program; if not, write to the Free Software Foundation, Inc.,
+ *  51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#include "stdafx.h"
+#include "../LAVSubtitleConsumer.h"
+#include "blend_internal.h"
+
+#include <smmintrin.h>
+
+// Blend 8-bit samples in 16-bit lanes
+// The result of FAST_DIV255 is exact for alpha 0 and 255, so no special handling is needed
+static inline __m128i blend_epi16_8bit_sse4(__m128i dst, __m128i src, __m128i alpha)
+{
+  const __m128i x = _mm_add_epi16(_mm_mullo_epi16(dst, _mm_sub_epi16(_mm_set1_epi16(255), alpha)), _mm_mullo_epi16(src, alpha));
+  return _mm_mulhi_epu16(_mm_add_epi16(x, _mm_set1_epi16(128)), _mm_set1_epi16(257));
+}
+
+// Blend high bit-depth samples in 16-bit lanes, using 32-bit intermediates
+static inline __m128i blend_epi16_16bit_sse4(__m128i dst, __m128i src, __m128i alpha)
+{
+  const __m128i ialpha = _mm_sub_epi16(_mm_set1_epi16(255), alpha);
+  const __m128i dlo = _mm_mullo_epi16(dst, ialpha), dhi = _mm_mulhi_epu16(dst, ialpha);
+  const __m128i slo = _mm_mullo_epi16(src, alpha),  shi = _mm_mulhi_epu16(src, alpha);
+  const __m128i round = _mm_set1_epi32(128);
+
+  __m128i x0 = _mm_add_epi32(_mm_add_epi32(_mm_unpacklo_epi16(dlo, dhi), _mm_unpacklo_epi16(slo, shi)), round);
+  __m128i x1 = _mm_add_epi32(_mm_add_epi32(_mm_unpackhi_epi16(dlo, dhi), _mm_unpackhi_epi16(slo, shi)), round);
+  x0 = _mm_srli_epi32(_mm_add_epi32(x0, _mm_slli_epi32(x0, 8)), 16); /* (x * 257) >> 16, fits into 32-bit unsigned */
+  x1 = _mm_srli_epi32(_mm_add_epi32(x1, _mm_slli_epi32(x1, 8)), 16);
+  __m128i res = _mm_packus_epi32(x0, x1);
+
+  // FAST_DIV255 is not exact for large values, alpha 0 and 255 need to be special-cased like in the C code
+  res = _mm_blendv_epi8(res, dst, _mm_cmpeq_epi16(alpha, _mm_setzero_si128()));
+  res = _mm_blendv_epi8(res, src, _mm_cmpeq_epi16(alpha, _mm_set1_epi16(255)));
+  return res;
+}
+
+// Blend 8 samples in-place
+static inline void blend_samples_sse4(uint8_t *dst, __m128i src, __m128i alpha)
+{
+  __m128i d = _mm_cvtepu8_epi16(_mm_loadl_epi64((const __m128i *)dst));
+  d = blend_epi16_8bit_sse4(d, src, alpha);
+  _mm_storel_epi64((__m128i *)dst, _mm_packus_epi16(d, d));
+}
+
+static inline void blend_samples_sse4(uint16_t *dst, __m128i src, __m128i alpha)
+{
+  __m128i d = _mm_loadu_si128((const __m128i *)dst);
+  _mm_storeu_si128((__m128i *)dst, blend_epi16_16bit_sse4(d, src, alpha));
+}
+
+// Blend 4 pre-multiplied BGRA pixels onto 4 BGRx pixels
+static inline __m128i blend_rgb_pixels_sse4(__m128i dst, __m128i src)
+{
+  const __m128i zero = _mm_setzero_si128();
+  const __m128i c255 = _mm_set1_epi16(255);
+  const __m128i alpha = _mm_shuffle_epi8(src, _mm_setr_epi8(3,3,3,3,7,7,7,7,11,11,11,11,15,15,15,15));
+
+  __m128i lo = _mm_mullo_epi16(_mm_unpacklo_epi8(dst, zero), _mm_sub_epi16(c255, _mm_unpacklo_epi8(alpha, zero)));
+  __m128i hi = _mm_mullo_epi16(_mm_unpackhi_epi8(dst, zero), _mm_sub_epi16(c255, _mm_unpackhi_epi8(alpha, zero)));
+  lo = _mm_mulhi_epu16(_mm_add_epi16(lo, _mm_set1_epi16(128)), _mm_set1_epi16(257));
+  hi = _mm_mulhi_epu16(_mm_add_epi16(hi, _mm_set1_epi16(128)), _mm_set1_epi16(257));
+
+  return _mm_adds_epu8(_mm_packus_epi16(lo, hi), src);
+}
+
+DECLARE_BLEND_FUNC_IMPL(blend_rgb_sse4)
+{
+  ASSERT(pixFmt == LAVPixFmt_RGB32 || pixFmt == LAVPixFmt_RGB24);
+
+  BYTE *rgbOut = video[0];
+  const BYTE *subIn = subData[0];
+
+  const ptrdiff_t outStride = videoStride[0];
+  const ptrdiff_t inStride = subStride[0];
+
+  const ptrdiff_t dstep = (pixFmt == LAVPixFmt_RGB24) ? 3 : 4;
+
+  const __m128i zero = _mm_setzero_si128();
+  const __m128i alphaMask = _mm_set1_epi32(0xFF000000);
+  const __m128i rgb24to32 = _mm_setr_epi8(0,1,2,-1,3,4,5,-1,6,7,8,-1,9,10,11,-1);
+  const __m128i rgb32to24 = _mm_setr_epi8(0,1,2,4,5,6,8,9,10,12,13,14,-1,-1,-1,-1);
+  const __m128i rgb24tail = _mm_setr_epi8(0,0,0,0,0,0,0,0,0,0,0,0,-1,-1,-1,-1);
+
+  for (int y = 0; y < size.cy; y++) {
+    BYTE *dstLine = rgbOut + ((y + position.y) * outStride) + (position.x * dstep);
+    const BYTE *srcLine = subIn + (y * inStride);
+    int x = 0;
+
+    if (pixFmt == LAVPixFmt_RGB32) {
+      for (; x < (size.cx - 3); x += 4) {
+        const __m128i src = _mm_loadu_si128((const __m128i *)(srcLine + (x << 2)));
+        const __m128i transparent = _mm_cmpeq_epi32(_mm_and_si128(src, alphaMask), zero);
+        if (_mm_movemask_epi8(transparent) == 0xFFFF)
+          continue;
+
+        const __m128i dst = _mm_loadu_si128((const __m128i *)(dstLine + (x << 2)));
+        __m128i res = blend_rgb_pixels_sse4(dst, src);
+        // Keep transparent pixels and the alpha channel of the video untouched
+        res = _mm_blendv_epi8(res, dst, _mm_or_si128(transparent, alphaMask));
+        _mm_storeu_si128((__m128i *)(dstLine + (x << 2)), res);
+      }
+    } else {
+      // 4 pixels are 12 bytes, only process them if there are two more pixels following so the 16 byte access stays in bounds
+      for (; x < (size.cx - 5); x += 4) {
+        const __m128i src = _mm_loadu_si128((const __m128i *)(srcLine + (x << 2)));
+        const __m128i transparent = _mm_cmpeq_epi32(_mm_and_si128(src, alphaMask), zero);
+        if (_mm_movemask_epi8(transparent) == 0xFFFF)
+          continue;
+
+        const __m128i dst24 = _mm_loadu_si128((const __m128i *)(dstLine + x * 3));
+        const __m128i dst = _mm_shuffle_epi8(dst24, rgb24to32);
+        __m128i res = blend_rgb_pixels_sse4(dst, src);
+        res = _mm_blendv_epi8(res, dst, transparent);
+        // Pack back to 24-bit, and keep the 4 trailing bytes which belong to the next pixels
+        res = _mm_blendv_epi8(_mm_shuffle_epi8(res, rgb32to24), dst24, rgb24tail);
+        _mm_storeu_si128((__m128i *)(dstLine + x * 3), res);
+      }
+    }
+
+    for (; x < size.cx; x++) {
+      blend_rgb_pixel(dstLine + x * dstep, srcLine + (x << 2));
+    }
+  }
+
+  return S_OK;
+}
+
+template <class pixT, int nv12>
+DECLARE_BLEND_FUNC_IMPL(blend_yuv_sse4)
+{
+  ASSERT(pixFmt == LAVPixFmt_YUV420 || pixFmt == LAVPixFmt_NV12 || pixFmt == LAVPixFmt_YUV422 || pixFmt == LAVPixFmt_YUV444 || pixFmt == LAVPixFmt_YUV420bX || pixFmt == LAVPixFmt_YUV422bX || pixFmt == LAVPixFmt_YUV444bX || pixFmt == LAVPixFmt_P016);
+
+  BYTE *y = video[0];
+  BYTE *u = video[1];
+  BYTE *v = video[2];
+
+  const BYTE *subY = subData[0];
+  const BYTE *subU = subData[1];
+  const BYTE *subV = subData[2];
+  const BYTE *subA = subData[3];
+
+  const ptrdiff_t outStride = videoStride[0];
+  const ptrdiff_t outStrideUV = videoStride[1];
+  const ptrdiff_t inStride = subStride[0];
+  const ptrdiff_t inStrideUV = subStride[1];
+
+  int line, col;
+  int w = size.cx, h = size.cy;
+  int yPos = position.y;
+  int xPos = position.x;
+
+  // Formats are never vertically subsampled without also being horizontally subsampled
+  const int hsub = nv12 || (pixFmt != LAVPixFmt_YUV444 && pixFmt != LAVPixFmt_YUV444bX);
+  const int vsub = nv12 || (pixFmt == LAVPixFmt_YUV420 || pixFmt == LAVPixFmt_YUV420bX || pixFmt == LAVPixFmt_NV12);
+  const int shift = sizeof(pixT) > 1 ? bpp - 8 : 0;
+
+  const __m128i shiftReg = _mm_cvtsi32_si128(shift);
+  const __m128i ones = _mm_set1_epi8(1);
+  const __m128i lowBytes = _mm_set1_epi16(0x00FF);
+
+  for (line = 0; line < h; line++) {
+    pixT *dstY = (pixT *)(y + ((line + yPos) * outStride)) + xPos;
+    const BYTE *srcY = subY + (line * inStride);
+    const BYTE *srcA = subA + (line * inStride);
+
+    for (col = 0; col < (w - 7); col += 8) {
+      const __m128i alpha = _mm_loadl_epi64((const __m128i *)(srcA + col));
+      if (_mm_testz_si128(alpha, alpha))
+        continue;
+
+      const __m128i src = _mm_sll_epi16(_mm_cvtepu8_epi16(_mm_loadl_epi64((const __m128i *)(srcY + col))), shiftReg);
+      blend_samples_sse4(dstY + col, src, _mm_cvtepu8_epi16(alpha));
+    }
+    for (; col < w; col++) {
+      blend_yuv_sample(dstY[col], srcY[col] << shift, srcA[col]);
+    }
+  }
+
+  if (hsub) {
+    w >>= 1;
+    xPos >>= 1;
+  }
+  if (vsub) {
+    h >>= 1;
+    yPos >>= 1;
+  }
+
+  for (line = 0; line < h; line++) {
+    pixT *dstUV = (pixT *)(u + (line + yPos) * outStrideUV) + (xPos << 1);
+
+    pixT *dstU = (pixT *)(u + (line + yPos) * outStrideUV) + xPos;
+    const BYTE *srcU = subU + line * inStrideUV;
+
+    pixT *dstV = (pixT *)(v + (line + yPos) * outStrideUV) + xPos;
+    const BYTE *srcV = subV + line * inStrideUV;
+
+    const BYTE *srcA = subA + (line * inStride * (ptrdiff_t(1) << vsub));
+    const int vedge = line + 1 >= h;
+
+    // The last column is left to the scalar code, since it has no right neighbour to average the alpha with
+    for (col = 0; col < (w - 8); col += 8) {
+      __m128i alpha;
+      if (hsub) {
+        const __m128i a0 = _mm_loadu_si128((const __m128i *)(srcA + (col << 1)));
+        if (vsub && !vedge) {
+          const __m128i a1 = _mm_loadu_si128((const __m128i *)(srcA + (col << 1) + inStride));
+          alpha = _mm_srli_epi16(_mm_add_epi16(_mm_maddubs_epi16(a0, ones), _mm_maddubs_epi16(a1, ones)), 2);
+        } else {
+          const __m128i even = _mm_and_si128(a0, lowBytes);
+          alpha = _mm_srli_epi16(_mm_add_epi16(_mm_srli_epi16(_mm_add_epi16(even, _mm_srli_epi16(a0, 8)), 1), even), 1);
+        }
+      } else {
+        alpha = _mm_cvtepu8_epi16(_mm_loadl_epi64((const __m128i *)(srcA + col)));
+      }
+      if (_mm_testz_si128(alpha, alpha))
+        continue;
+
+      const __m128i srcU16 = _mm_sll_epi16(_mm_cvtepu8_epi16(_mm_loadl_epi64((const __m128i *)(srcU + col))), shiftReg);
+      const __m128i srcV16 = _mm_sll_epi16(_mm_cvtepu8_epi16(_mm_loadl_epi64((const __m128i *)(srcV + col))), shiftReg);
+      if (nv12) {
+        blend_samples_sse4(dstUV + (col << 1) + 0, _mm_unpacklo_epi16(srcU16, srcV16), _mm_unpacklo_epi16(alpha, alpha));
+        blend_samples_sse4(dstUV + (col << 1) + 8, _mm_unpackhi_epi16(srcU16, srcV16), _mm_unpackhi_epi16(alpha, alpha));
+      } else {
+        blend_samples_sse4(dstU + col, srcU16, alpha);
+        blend_samples_sse4(dstV + col, srcV16, alpha);
+      }
+    }
+
+    for (; col < w; col++) {
+      int alpha = blend_chroma_alpha(srcA + (col << hsub), inStride, hsub, vsub, col+1 >= w, vedge);
+      if (nv12) {
+        blend_yuv_sample(dstUV[(col << 1)+0], srcU[col] << shift, alpha);
+        blend_yuv_sample(dstUV[(col << 1)+1], srcV[col] << shift, alpha);
+      } else {
+        blend_yuv_sample(dstU[col], srcU[col] << shift, alpha);
+        blend_yuv_sample(dstV[col], srcV[col] << shift, alpha);
+      }
+    }
+  }
+
+  return S_OK;
+}
+
+template HRESULT CLAVSubtitleConsumer::blend_yuv_sse4<uint8_t,1>BLEND_FUNC_PARAMS;
+template HRESULT CLAVSubtitleConsumer::blend_yuv_sse4<uint8_t,0>BLEND_FUNC_PARAMS;
+template HRESULT CLAVSubtitleConsumer::blend_yuv_sse4<uint16_t,0>BLEND_FUNC_PARAMS;
+template HRESULT CLAVSubtitleConsumer::blend_yuv_sse4<uint16_t,1>BLEND_FUNC_PARAMS;
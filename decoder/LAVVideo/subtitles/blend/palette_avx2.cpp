@@ -0,0 +1,46 @@
+/*
+ *      Copyright (C) 2010-2019 Hendrik Leppkes
+ *      http://www.1f0.de
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program; if not, write to the Free Software Foundation, Inc.,
+ *  51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+
+#include "stdafx.h"
+#include "../LAVSubtitleProvider.h"
+
+#include <immintrin.h>
+
+// AVX2 variant of CLAVSubtitleProvider::expand_palette_c
+// The palette is already pre-multiplied, so every pixel is a single 32-bit lookup, done with gathers 16 pixels at a time.
+void CLAVSubtitleProvider::expand_palette_avx2(BYTE *dst, ptrdiff_t dstStride, const BYTE *src, ptrdiff_t srcStride, int width, int height, const uint32_t *palette)
+{
+  for (int line = 0; line < height; line++) {
+    uint32_t *out = (uint32_t *)dst;
+    int x = 0;
+    for (; x <= width - 16; x += 16) {
+      const __m128i idx = _mm_loadu_si128((const __m128i *)(src + x));
+      const __m256i p0 = _mm256_i32gather_epi32((const int *)palette, _mm256_cvtepu8_epi32(idx), 4);
+      const __m256i p1 = _mm256_i32gather_epi32((const int *)palette, _mm256_cvtepu8_epi32(_mm_srli_si128(idx, 8)), 4);
+      _mm256_storeu_si256((__m256i *)(out + x), p0);
+      _mm256_storeu_si256((__m256i *)(out + x + 8), p1);
+    }
+    for (; x < width; x++) {
+      out[x] = palette[src[x]];
+    }
+    src += srcStride;
+    dst += dstStride;
+  }
+}
@@ -0,0 +1,106 @@
+/*
+ *      Copyright (C) 2010-2019 Hendrik Leppkes
+ *      http://www.1f0.de
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program; if not, write to the Free Software Foundation, Inc.,
+ *  51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+
+#include "stdafx.h"
+#include "BDClipPrefetch.h"
+
+CBDClipPrefetch::CBDClipPrefetch()
+{
+}
+
+CBDClipPrefetch::~CBDClipPrefetch()
+{
+  Stop();
+}
+
+HRESULT CBDClipPrefetch::Prefetch(LPCWSTR pszFileName)
+{
+  CheckPointer(pszFileName, E_POINTER);
+
+  {
+    CAutoLock lock(&m_csPending);
+    m_strPending = pszFileName;
+  }
+  m_evPending.Set();
+
+  if (!ThreadExists() && !Create())
+    return E_FAIL;
+
+  return S_OK;
+}
+
+void CBDClipPrefetch::Stop()
+{
+  if (ThreadExists()) {
+    CallWorker(CMD_EXIT);
+    Close();
+  }
+}
+
+DWORD CBDClipPrefetch::ThreadProc()
+{
+  SetThreadName(-1, "CBDDemuxer Clip Prefetch");
+
+  while (!CheckRequest(nullptr)) {
+    if (!m_evPending.Wait(100))
+      continue;
+
+    std::wstring strFileName;
+    {
+      CAutoLock lock(&m_csPending);
+      strFileName.swap(m_strPending);
+    }
+
+    if (!strFileName.empty())
+      ReadFileStart(strFileName);
+  }
+
+  GetRequest();
+  Reply(S_OK);
+
+  return 0;
+}
+
+void CBDClipPrefetch::ReadFileStart(const std::wstring &strFileName)
+{
+  DbgLog((LOG_TRACE, 10, L"CBDClipPrefetch::ReadFileStart(): Prefetching %s", strFileName.c_str()));
+
+  // a regular cached read, the data only needs to end up in the system file cache
+  HANDLE hFile = CreateFileW(strFileName.c_str(), GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE, nullptr, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+  if (hFile == INVALID_HANDLE_VALUE) {
+    DbgLog((LOG_TRACE, 10, L" -> Opening the file failed (error: %u)", GetLastError()));
+    return;
+  }
+
+  BYTE *pBuffer = (BYTE *)CoTaskMemAlloc(BD_PREFETCH_BLOCK);
+  if (pBuffer) {
+    DWORD dwTotal = 0, dwRead = 0;
+    while (dwTotal < BD_PREFETCH_SIZE && !CheckRequest(nullptr)) {
+      if (!ReadFile(hFile, pBuffer, BD_PREFETCH_BLOCK, &dwRead, nullptr) || dwRead == 0)
+        break;
+      dwTotal += dwRead;
+    }
+
+    DbgLog((LOG_TRACE, 10, L" -> Read %u bytes", dwTotal));
+    CoTaskMemFree(pBuffer);
+  }
+
+  CloseHandle(hFile);
+}
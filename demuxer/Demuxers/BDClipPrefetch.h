@@ -0,0 +1,55 @@
+/*
+ *      Copyright (C) 2010-2019 Hendrik Leppkes
+ *      http://www.1f0.de
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program; if not, write to the Free Software Foundation, Inc.,
+ *  51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+
+#pragma once
+
+#include <string>
+
+#define BD_PREFETCH_DISTANCE  (64 << 20)  // distance to the end of the current clip at which the next clip is prefetched
+#define BD_PREFETCH_SIZE      (16 << 20)  // amount of data read from the start of the next clip
+#define BD_PREFETCH_BLOCK     (1 << 20)
+
+// Background prefetch of the next clip in a Blu-ray playlist
+// libbluray only opens the file of the next clip once the current one has been read to the end,
+// which stalls playback on optical drives and network shares. Reading the start of the next file
+// ahead of time places it in the system file cache, so the clip transition is served from memory.
+class CBDClipPrefetch : protected CAMThread
+{
+public:
+  CBDClipPrefetch();
+  ~CBDClipPrefetch();
+
+  // Read the start of the file in the background, replacing any prefetch that did not start yet
+  HRESULT Prefetch(LPCWSTR pszFileName);
+
+  // Abort the prefetch, and stop the thread
+  void Stop();
+
+private:
+  enum {CMD_EXIT};
+  DWORD ThreadProc();
+
+  void ReadFileStart(const std::wstring &strFileName);
+
+private:
+  CCritSec m_csPending;
+  CAMEvent m_evPending;
+  std::wstring m_strPending;
+};
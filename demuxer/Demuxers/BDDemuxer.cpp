@@ -19,6 +19,9 @@
 
 #include "stdafx.h"
 #include "BDDemuxer.h"
+#include "BDTitleCache.h"
+#include "BDClipPrefetch.h"
+#include "MVCExtensionReader.h"
 #include "libbluray/bdnav/mpls_parse.h"
 
 extern "C" {
@@ -30,7 +33,18 @@ extern "C" {
 int CBDDemuxer::BDByteStreamRead(void *opaque, uint8_t *buf, int buf_size)
 {
   CBDDemuxer *demux = (CBDDemuxer *)opaque;
+  if (demux->m_pPreBuffer) {
+    LONG read = 0;
+    if (demux->m_pPreBuffer->Read(demux->m_llReadPos, buf, buf_size, &read) != S_OK)
+      return AVERROR_EOF;
+    demux->m_llReadPos += read;
+    demux->ReleaseBDEvents(demux->m_llReadPos);
+    demux->PrefetchNextClip();
+    return read;
+  }
+
   int ret = bd_read(demux->m_pBD, buf, buf_size);
+  demux->PrefetchNextClip();
   return (ret != 0) ? ret : AVERROR_EOF;
 }
 
@@ -44,8 +58,8 @@ int64_t CBDDemuxer::BDByteStreamSeek(void *opaque,  int64_t offset, int whence)
     pos = offset;
   } else if (whence == SEEK_CUR) {
     if (offset == 0)
-      return bd_tell(bd);
-    pos = bd_tell(bd) + offset;
+      return demux->TellBD();
+    pos = demux->TellBD() + offset;
   } else if (whence == SEEK_END) {
     pos = bd_get_title_size(bd) - offset;
   } else if (whence == AVSEEK_SIZE) {
@@ -54,9 +68,28 @@ int64_t CBDDemuxer::BDByteStreamSeek(void *opaque,  int64_t offset, int whence)
     return -1;
   if (pos < 0)
     pos = 0;
+
+  // the pre-buffer serves the new position from its window, or seeks the disc on its own thread
+  int64_t achieved = 0;
+  if (demux->m_pPreBuffer) {
+    achieved = min(pos, (int64_t)bd_get_title_size(bd));
+    demux->m_llReadPos = achieved;
+  } else {
+    achieved = demux->SeekBD(pos);
+  }
+
+  demux->ProcessBDEvents();
+  return achieved;
+}
+
+// Seek to the byte position in the title, which libbluray only supports in whole units
+int64_t CBDDemuxer::SeekBD(int64_t pos)
+{
+  BLURAY *bd = m_pBD;
+
   int64_t achieved = bd_seek(bd, pos);
   if (pos > achieved) {
-    offset = pos - achieved;
+    int64_t offset = pos - achieved;
     DbgLog((LOG_TRACE, 10, L"BD Seek to %I64d, achieved %I64d, correcting target by %I64d", pos, achieved, offset));
     uint8_t *dump_buffer = (uint8_t *)CoTaskMemAlloc(6144);
     while (offset > 0) {
@@ -72,10 +105,87 @@ int64_t CBDDemuxer::BDByteStreamSeek(void *opaque,  int64_t offset, int whence)
     achieved = bd_tell(bd);
   }
 
-  demux->ProcessBDEvents();
   return achieved;
 }
 
+int64_t CBDDemuxer::TellBD()
+{
+  return m_pPreBuffer ? m_llReadPos : bd_tell(m_pBD);
+}
+
+// Read on the thread of the pre-buffer, which is the only one moving the position of libbluray while it exists
+int CBDDemuxer::PreBufferRead(LONGLONG llPos, BYTE *pBuffer, int size)
+{
+  DWORD dwGeneration = 0;
+  {
+    CAutoLock lock(&m_csEvents);
+    dwGeneration = m_dwEventGeneration;
+  }
+
+  if (llPos != (LONGLONG)bd_tell(m_pBD) && SeekBD(llPos) != llPos) {
+    QueueBDEvents(dwGeneration, llPos, llPos);
+    return 0;
+  }
+
+  int ret = bd_read(m_pBD, pBuffer, size);
+  QueueBDEvents(dwGeneration, llPos, ret > 0 ? llPos + ret : llPos);
+  return ret;
+}
+
+// Events of data the demuxer never received are dropped, the seek of the pre-buffer creates new ones
+void CBDDemuxer::PreBufferRestart(LONGLONG llPos)
+{
+  CAutoLock lock(&m_csEvents);
+  m_PendingEvents.clear();
+  m_dwEventGeneration++;
+}
+
+void CBDDemuxer::QueueBDEvents(DWORD dwGeneration, LONGLONG llStart, LONGLONG llEnd)
+{
+  CAutoLock lock(&m_csEvents);
+
+  BD_EVENT event;
+  while (bd_get_event(m_pBD, &event)) {
+    // the events of a read which was in progress during a restart are outdated
+    if (dwGeneration != m_dwEventGeneration)
+      continue;
+
+    // a clip change happens at the start of the clip, the end of the title after all of the data
+    PendingEvent pending = { event, llStart };
+    if (event.event == BD_EVENT_PLAYITEM) {
+      uint64_t clip_start, clip_in, bytepos;
+      if (bd_get_clip_infos(m_pBD, event.param, &clip_start, &clip_in, &bytepos, nullptr))
+        pending.llPos = min(max(llStart, (LONGLONG)bytepos), llEnd);
+    } else if (event.event == BD_EVENT_END_OF_TITLE) {
+      pending.llPos = llEnd;
+    }
+    m_PendingEvents.push_back(pending);
+  }
+}
+
+void CBDDemuxer::ReleaseBDEvents(LONGLONG llPos)
+{
+  CAutoLock lock(&m_csEvents);
+  while (!m_PendingEvents.empty() && m_PendingEvents.front().llPos <= llPos) {
+    m_ReadyEvents.push_back(m_PendingEvents.front().event);
+    m_PendingEvents.pop_front();
+  }
+}
+
+BOOL CBDDemuxer::GetBDEvent(BD_EVENT *pEvent)
+{
+  if (!m_pPreBuffer)
+    return bd_get_event(m_pBD, pEvent);
+
+  CAutoLock lock(&m_csEvents);
+  if (m_ReadyEvents.empty())
+    return FALSE;
+
+  *pEvent = m_ReadyEvents.front();
+  m_ReadyEvents.pop_front();
+  return TRUE;
+}
+
 static inline REFERENCE_TIME Convert90KhzToDSTime(int64_t timestamp)
 {
   return av_rescale(timestamp, 1000, 9);
@@ -125,6 +235,8 @@ CBDDemuxer::CBDDemuxer(CCritSec *pLock, ILAVFSettingsInternal *pSettings)
 CBDDemuxer::~CBDDemuxer(void)
 {
   CloseMVCExtensionDemuxer();
+  SAFE_DELETE(m_pClipPrefetch);
+  SAFE_DELETE(m_pPreBuffer);
 
   if (m_pTitle) {
     bd_free_title_info(m_pTitle);
@@ -202,6 +314,30 @@ STDMETHODIMP CBDDemuxer::Open(LPCOLESTR pszFileName)
     m_pBD = bd;
     strcpy_s(m_cBDRootPath, bd_path);
 
+    // A playlist can be opened directly, without parsing all others for the title listing
+    if (iPlaylist != -1 && SUCCEEDED(SetPlaylist(iPlaylist)))
+      return S_OK;
+
+    // The main title of a disc that was opened before is known from the cache
+    CBDTitleCache *pTitleCache = nullptr;
+    if (iPlaylist == -1 && m_pSettings->GetFastOpen()) {
+      WCHAR wRootPath[4096];
+      pTitleCache = new CBDTitleCache();
+      if (!SafeMultiByteToWideChar(CP_UTF8, 0, bd_path, -1, wRootPath, 4096) || FAILED(pTitleCache->Open(wRootPath))) {
+        SAFE_DELETE(pTitleCache);
+      }
+    }
+
+    if (pTitleCache) {
+      uint32_t playlist = 0;
+      uint64_t duration = 0;
+      if (pTitleCache->Load(&playlist, &duration) == S_OK && SUCCEEDED(SetPlaylist(playlist)) && m_pTitle->duration == duration) {
+        DbgLog((LOG_TRACE, 10, L"Opened playlist %u as the main title from the cache", playlist));
+        SAFE_DELETE(pTitleCache);
+        return S_OK;
+      }
+    }
+
     uint32_t timelimit = (iPlaylist != -1) ? 0 : 180;
     uint8_t flags = (iPlaylist != -1) ? TITLES_ALL : TITLES_RELEVANT;
 
@@ -218,6 +354,7 @@ fetchtitles:
         flags = TITLES_ALL;
         goto fetchtitles;
       }
+      SAFE_DELETE(pTitleCache);
       return E_FAIL;
     }
 
@@ -246,6 +383,10 @@ fetchtitles:
     DbgLog((LOG_TRACE, 20, L" ------ End Title Listing ------"));
 
     hr = SetTitle(title_id);
+
+    if (SUCCEEDED(hr) && pTitleCache)
+      pTitleCache->Store(m_pTitle->playlist, m_pTitle->duration);
+    SAFE_DELETE(pTitleCache);
   }
 
   return hr;
@@ -274,7 +415,7 @@ void CBDDemuxer::ProcessBDEvents()
 {
   // Check for clip change
   BD_EVENT event;
-  while(bd_get_event(m_pBD, &event)) {
+  while(GetBDEvent(&event)) {
     if (event.event == BD_EVENT_PLAYITEM) {
       uint64_t clip_start, clip_in, bytepos;
       int ret = bd_get_clip_infos(m_pBD, event.param, &clip_start, &clip_in, &bytepos, nullptr);
@@ -293,6 +434,33 @@ void CBDDemuxer::ProcessBDEvents()
   }
 }
 
+// Read the start of the next clip in the background, once the end of the current clip comes near
+void CBDDemuxer::PrefetchNextClip()
+{
+  if (!m_pClipPrefetch || !m_pTitle)
+    return;
+
+  uint16_t next = m_NewClip + 1;
+  if (next >= m_pTitle->clip_count || next == m_PrefetchClip)
+    return;
+
+  uint64_t clip_start, clip_in, bytepos;
+  if (!bd_get_clip_infos(m_pBD, next, &clip_start, &clip_in, &bytepos, nullptr) || TellBD() + BD_PREFETCH_DISTANCE < bytepos)
+    return;
+
+  MPLS_PL *mpls = bd_get_title_mpls(m_pBD);
+  if (!mpls || next >= mpls->list_count)
+    return;
+
+  m_PrefetchClip = next;
+
+  char fileName[4096];
+  WCHAR wFileName[4096];
+  sprintf_s(fileName, "%sBDMV\\STREAM\\%s.m2ts", m_cBDRootPath, mpls->play_item[next].clip[0].clip_id);
+  if (SafeMultiByteToWideChar(CP_UTF8, 0, fileName, -1, wFileName, 4096))
+    m_pClipPrefetch->Prefetch(wFileName);
+}
+
 STDMETHODIMP CBDDemuxer::ProcessPacket(Packet *pPacket)
 {
   ProcessBDEvents();
@@ -328,8 +496,11 @@ STDMETHODIMP CBDDemuxer::ProcessPacket(Packet *pPacket)
 
 void CBDDemuxer::CloseMVCExtensionDemuxer()
 {
+  SAFE_DELETE(m_pMVCReader);
+
   if (m_MVCFormatContext)
     avformat_close_input(&m_MVCFormatContext);
+  SAFE_DELETE(m_pMVCIO);
 
   m_MVCExtensionClip = -1;
 }
@@ -346,6 +517,23 @@ STDMETHODIMP CBDDemuxer::OpenMVCExtensionDemuxer(int playItem)
 
   DbgLog((LOG_TRACE, 10, "CBDDemuxer::OpenMVCExtensionDemuxer(): Opening MVC extension stream at %s", fileName));
 
+  // Read the MVC stream through the shared block cache, other graphs playing the same disc share its reads
+  DWORD dwCacheSize = m_pSettings->GetSharedBlockCacheLimit();
+  if (dwCacheSize) {
+    wchar_t wFileName[4096];
+    m_pMVCIO = new CSharedBlockIO();
+    if (!SafeMultiByteToWideChar(CP_UTF8, 0, fileName, -1, wFileName, 4096) || FAILED(m_pMVCIO->Open(wFileName, (size_t)dwCacheSize << 20))) {
+      DbgLog((LOG_TRACE, 10, "-> Shared block cache not available, using regular file access"));
+      SAFE_DELETE(m_pMVCIO);
+    }
+  }
+
+  if (m_pMVCIO) {
+    m_MVCFormatContext = avformat_alloc_context();
+    m_MVCFormatContext->pb = m_pMVCIO->GetAVIOContext();
+    m_MVCFormatContext->flags |= AVFMT_FLAG_CUSTOM_IO;
+  }
+
   // Try to open the MVC stream
   AVInputFormat *format = av_find_input_format("mpegts");
   ret = avformat_open_input(&m_MVCFormatContext, fileName, format, nullptr);
@@ -398,59 +586,60 @@ STDMETHODIMP CBDDemuxer::FillMVCExtensionQueue(REFERENCE_TIME rtBase)
   if (!m_MVCFormatContext)
     return E_FAIL;
 
-  int ret, count = 0;
+  int count = 0;
   bool found = (rtBase == Packet::INVALID_TIME);
 
-  AVPacket mvcPacket = { 0 };
-  av_init_packet(&mvcPacket);
+  // The extension is read on its own thread, which is started after any seeking on the context is done
+  if (!m_pMVCReader) {
+    m_pMVCReader = new CMVCExtensionReader(m_MVCFormatContext, m_MVCStreamIndex);
+    if (FAILED(m_pMVCReader->Start())) {
+      SAFE_DELETE(m_pMVCReader);
+      return E_FAIL;
+    }
+  }
 
-  while (count < MVC_DEMUX_COUNT) {
-    ret = av_read_frame(m_MVCFormatContext, &mvcPacket);
+  AVStream *stream = m_MVCFormatContext->streams[m_MVCStreamIndex];
 
-    if (ret == AVERROR(EINTR) || ret == AVERROR(EAGAIN)) {
-      continue;
-    }
-    else if (ret == AVERROR_EOF) {
+  // Take everything that was read ahead, and only wait while the extension of the base packet is missing
+  while (count < MVC_DEMUX_COUNT) {
+    AVPacket *mvcPacket = nullptr;
+    HRESULT hr = m_pMVCReader->GetPacket(&mvcPacket, found ? 0 : MVC_READER_TIMEOUT);
+    if (hr == S_FALSE) {
+      break;
+    } else if (FAILED(hr)) {
       DbgLog((LOG_TRACE, 10, L"EOF reading MVC extension data"));
       break;
     }
-    else if (mvcPacket.size <= 0 || mvcPacket.stream_index != m_MVCStreamIndex) {
-      av_packet_unref(&mvcPacket);
-      continue;
-    }
-    else {
-      AVStream *stream = m_MVCFormatContext->streams[mvcPacket.stream_index];
 
-      REFERENCE_TIME rtDTS = m_lavfDemuxer->ConvertTimestampToRT(mvcPacket.dts, stream->time_base.num, stream->time_base.den);
-      REFERENCE_TIME rtPTS = m_lavfDemuxer->ConvertTimestampToRT(mvcPacket.pts, stream->time_base.num, stream->time_base.den);
+    REFERENCE_TIME rtDTS = m_lavfDemuxer->ConvertTimestampToRT(mvcPacket->dts, stream->time_base.num, stream->time_base.den);
+    REFERENCE_TIME rtPTS = m_lavfDemuxer->ConvertTimestampToRT(mvcPacket->pts, stream->time_base.num, stream->time_base.den);
 
-      if (rtBase == Packet::INVALID_TIME || rtDTS == Packet::INVALID_TIME) {
-        // do nothing, can't compare timestamps when they are not set
-      } else if (rtDTS < rtBase) {
-        DbgLog((LOG_TRACE, 10, L"CBDDemuxer::FillMVCExtensionQueue(): Dropping MVC extension at %I64d, base is %I64d", rtDTS, rtBase));
-        av_packet_unref(&mvcPacket);
-        continue;
-      }
-      else if (rtDTS == rtBase) {
-        found = true;
-      }
+    if (rtBase == Packet::INVALID_TIME || rtDTS == Packet::INVALID_TIME) {
+      // do nothing, can't compare timestamps when they are not set
+    } else if (rtDTS < rtBase) {
+      DbgLog((LOG_TRACE, 10, L"CBDDemuxer::FillMVCExtensionQueue(): Dropping MVC extension at %I64d, base is %I64d", rtDTS, rtBase));
+      av_packet_free(&mvcPacket);
+      continue;
+    }
+    else if (rtDTS == rtBase) {
+      found = true;
+    }
 
-      Packet *pPacket = new Packet();
-      if (!pPacket) {
-        av_packet_unref(&mvcPacket);
-        return E_OUTOFMEMORY;
-      }
+    Packet *pPacket = m_pPacketPool->Acquire();
+    if (!pPacket) {
+      av_packet_free(&mvcPacket);
+      return E_OUTOFMEMORY;
+    }
 
-      pPacket->SetPacket(&mvcPacket);
-      pPacket->rtDTS = rtDTS;
-      pPacket->rtPTS = rtPTS;
+    pPacket->SetPacket(mvcPacket);
+    pPacket->rtDTS = rtDTS;
+    pPacket->rtPTS = rtPTS;
 
-      m_lavfDemuxer->QueueMVCExtension(pPacket);
-      av_packet_unref(&mvcPacket);
+    m_lavfDemuxer->QueueMVCExtension(pPacket);
+    av_packet_free(&mvcPacket);
 
-      count++;
-    }
-  };
+    count++;
+  }
 
   if (found)
     return S_OK;
@@ -462,11 +651,11 @@ STDMETHODIMP CBDDemuxer::FillMVCExtensionQueue(REFERENCE_TIME rtBase)
 
 STDMETHODIMP CBDDemuxer::SetTitle(int idx)
 {
-  HRESULT hr = S_OK;
   int ret; // return values
   if (m_pTitle) {
     bd_free_title_info(m_pTitle);
   }
+  SAFE_DELETE(m_pPreBuffer);
 
   // Init Event Queue
   bd_get_event(m_pBD, nullptr);
@@ -478,6 +667,39 @@ STDMETHODIMP CBDDemuxer::SetTitle(int idx)
     return E_FAIL;
   }
 
+  return OpenTitle();
+}
+
+// Select a playlist by its number, which does not require the title listing
+HRESULT CBDDemuxer::SetPlaylist(uint32_t playlist)
+{
+  int ret; // return values
+  if (m_pTitle) {
+    bd_free_title_info(m_pTitle);
+  }
+  SAFE_DELETE(m_pPreBuffer);
+
+  // Init Event Queue
+  bd_get_event(m_pBD, nullptr);
+
+  m_pTitle = bd_get_playlist_info(m_pBD, playlist, 0);
+  if (!m_pTitle) {
+    return E_FAIL;
+  }
+
+  ret = bd_select_playlist(m_pBD, playlist);
+  if (ret == 0) {
+    return E_FAIL;
+  }
+
+  return OpenTitle();
+}
+
+// Open the demuxer for the selected title
+HRESULT CBDDemuxer::OpenTitle()
+{
+  HRESULT hr = S_OK;
+
   MPLS_PL * mpls = bd_get_title_mpls(m_pBD);
   if (mpls) {
     for (int i = 0; i < mpls->ext_sub_count; i++)
@@ -504,6 +726,19 @@ STDMETHODIMP CBDDemuxer::SetTitle(int idx)
   uint8_t *buffer = (uint8_t *)av_mallocz(BD_READ_BUFFER_SIZE + AV_INPUT_BUFFER_PADDING_SIZE);
   m_pb = avio_alloc_context(buffer, BD_READ_BUFFER_SIZE, 0, this, BDByteStreamRead, nullptr, BDByteStreamSeek);
 
+  // Read ahead into a large window of memory, so the drive does not have to seek for every read
+  m_PendingEvents.clear();
+  m_ReadyEvents.clear();
+  m_llReadPos = bd_tell(m_pBD);
+  DWORD dwPreBufferSize = m_pSettings->GetPreBufferLimit();
+  if (dwPreBufferSize) {
+    m_pPreBuffer = new CPreBuffer(this);
+    if (FAILED(m_pPreBuffer->Init((size_t)dwPreBufferSize << 20, bd_get_title_size(m_pBD), m_llReadPos))) {
+      DbgLog((LOG_TRACE, 10, L"CBDDemuxer::OpenTitle(): allocating the pre-buffer failed"));
+      SAFE_DELETE(m_pPreBuffer);
+    }
+  }
+
   SafeRelease(&m_lavfDemuxer);
   SAFE_CO_FREE(m_StreamClip);
   SAFE_CO_FREE(m_rtOffset);
@@ -531,6 +766,10 @@ STDMETHODIMP CBDDemuxer::SetTitle(int idx)
   // Reset EOS protection
   m_EndOfStreamPacketFlushProtection = FALSE;
 
+  m_PrefetchClip = 0;
+  if (m_pTitle->clip_count > 1 && !m_pClipPrefetch)
+    m_pClipPrefetch = new CBDClipPrefetch();
+
   // space for storing stream offsets
   m_StreamClip = (uint16_t *)CoTaskMemAlloc(sizeof(*m_StreamClip) * m_lavfDemuxer->GetNumStreams());
   if (!m_StreamClip)
@@ -754,7 +993,7 @@ void CBDDemuxer::ProcessClipInfo(CLPI_CL *clpi, bool overwrite)
 
 STDMETHODIMP CBDDemuxer::Seek(REFERENCE_TIME rTime)
 {
-  int64_t prev = bd_tell(m_pBD);
+  int64_t prev = TellBD();
 
   int64_t target = bd_find_seek_point(m_pBD, ConvertDSTimeTo90Khz(rTime));
   m_EndOfStreamPacketFlushProtection = FALSE;
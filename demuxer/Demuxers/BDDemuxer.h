@@ -21,8 +21,14 @@
 
 #include "BaseDemuxer.h"
 #include "LAVFDemuxer.h"
+#include "PreBuffer.h"
 
-class CBDDemuxer : public CBaseDemuxer, public IAMExtendedSeeking
+#include <deque>
+
+class CBDClipPrefetch;
+class CMVCExtensionReader;
+
+class CBDDemuxer : public CBaseDemuxer, public IAMExtendedSeeking, public CPreBufferSource
 {
 public:
   CBDDemuxer(CCritSec *pLock, ILAVFSettingsInternal *pSettings);
@@ -50,8 +56,11 @@ public:
 
   CStreamList *GetStreams(StreamType type) { if (m_lavfDemuxer) return m_lavfDemuxer->GetStreams(type); else return __super::GetStreams(type);  }
   HRESULT SetActiveStream(StreamType type, int pid) { if (m_lavfDemuxer) { m_lavfDemuxer->SetActiveStream(type, pid); return S_OK; } else return E_FAIL; }
+  void SetOutputConnected(StreamType type, BOOL bConnected) { if (m_lavfDemuxer) m_lavfDemuxer->SetOutputConnected(type, bConnected); }
 
   void SettingsChanged(ILAVFSettingsInternal *pSettings) { if (m_lavfDemuxer) m_lavfDemuxer->SettingsChanged(pSettings); }
+  void SetPacketPoolSize(size_t nPackets) { if (m_lavfDemuxer) m_lavfDemuxer->SetPacketPoolSize(nPackets); __super::SetPacketPoolSize(nPackets); }
+  void GetPacketPoolStatistics(ULONGLONG *pHits, ULONGLONG *pMisses) { if (m_lavfDemuxer) m_lavfDemuxer->GetPacketPoolStatistics(pHits, pMisses); else __super::GetPacketPoolStatistics(pHits, pMisses); }
 
   const stream* SelectVideoStream() { return m_lavfDemuxer->SelectVideoStream(); }
   const stream* SelectAudioStream(std::list<std::string> prefLanguages) { return m_lavfDemuxer->SelectAudioStream(prefLanguages); }
@@ -74,9 +83,25 @@ public:
   STDMETHODIMP ProcessPacket(Packet *pPacket);
   STDMETHODIMP FillMVCExtensionQueue(REFERENCE_TIME rtBase);
 
+  // CPreBufferSource
+  int PreBufferRead(LONGLONG llPos, BYTE *pBuffer, int size);
+  void PreBufferRestart(LONGLONG llPos);
+
 private:
+  HRESULT SetPlaylist(uint32_t playlist);
+  HRESULT OpenTitle();
+
   void ProcessClipInfo(struct clpi_cl *clpi, bool overwrite);
   void ProcessBDEvents();
+  void PrefetchNextClip();
+
+  int64_t SeekBD(int64_t pos);
+  int64_t TellBD();
+
+  // Events of reads on the pre-buffer thread, delivered once the demuxer reaches their position
+  void QueueBDEvents(DWORD dwGeneration, LONGLONG llStart, LONGLONG llEnd);
+  void ReleaseBDEvents(LONGLONG llPos);
+  BOOL GetBDEvent(BD_EVENT *pEvent);
 
   void CloseMVCExtensionDemuxer();
   STDMETHODIMP OpenMVCExtensionDemuxer(int playItem);
@@ -107,6 +132,23 @@ private:
 
   AVFormatContext *m_MVCFormatContext     = nullptr;
   int              m_MVCStreamIndex       = -1;
+  CMVCExtensionReader *m_pMVCReader       = nullptr;
+  CSharedBlockIO  *m_pMVCIO               = nullptr;
 
   BOOL m_EndOfStreamPacketFlushProtection = FALSE;
+
+  CBDClipPrefetch *m_pClipPrefetch        = nullptr;
+
+  struct PendingEvent {
+    BD_EVENT event;
+    LONGLONG llPos;
+  };
+
+  CPreBuffer *m_pPreBuffer                = nullptr;
+  LONGLONG    m_llReadPos                 = 0;
+  CCritSec    m_csEvents;
+  std::deque<PendingEvent> m_PendingEvents;
+  std::deque<BD_EVENT>     m_ReadyEvents;
+  DWORD       m_dwEventGeneration         = 0;
+  uint16_t         m_PrefetchClip         = 0;
 };
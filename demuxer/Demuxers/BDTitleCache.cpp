@@ -0,0 +1,113 @@
+/*
+ *      Copyright (C) 2010-2019 Hendrik Leppkes
+ *      http://www.1f0.de
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program; if not, write to the Free Software Foundation, Inc.,
+ *  51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+
+#include "stdafx.h"
+#include "BDTitleCache.h"
+
+#define BD_TITLE_CACHE_MAGIC   MKTAG('L', 'A', 'V', 'B')
+#define BD_TITLE_CACHE_VERSION 1
+
+CBDTitleCache::CBDTitleCache()
+{
+}
+
+CBDTitleCache::~CBDTitleCache()
+{
+}
+
+HRESULT CBDTitleCache::Open(LPCWSTR pszRootPath)
+{
+  CheckPointer(pszRootPath, E_POINTER);
+
+  std::wstring strRoot = pszRootPath;
+  if (!strRoot.empty() && strRoot.back() != L'\\')
+    strRoot += L'\\';
+
+  if (FAILED(GetFileIdentity((strRoot + L"BDMV\\index.bdmv").c_str(), m_Identity)))
+    return E_FAIL;
+
+  // Playlists are only listed, not read, which is a single directory query
+  WIN32_FIND_DATAW fd;
+  HANDLE hFind = FindFirstFileW((strRoot + L"BDMV\\PLAYLIST\\*.mpls").c_str(), &fd);
+  if (hFind == INVALID_HANDLE_VALUE)
+    return E_FAIL;
+
+  DWORD dwPlaylists = 0;
+  do {
+    HashFileIdentity(m_Identity, fd.cFileName, wcslen(fd.cFileName) * sizeof(WCHAR));
+    HashFileIdentity(m_Identity, &fd.nFileSizeLow, sizeof(fd.nFileSizeLow));
+    HashFileIdentity(m_Identity, &fd.ftLastWriteTime, sizeof(fd.ftLastWriteTime));
+    dwPlaylists++;
+  } while (FindNextFileW(hFind, &fd));
+  FindClose(hFind);
+
+  HashFileIdentity(m_Identity, &dwPlaylists, sizeof(dwPlaylists));
+
+  return GetCacheFilePath(L"BluRayTitles", m_Identity, m_strCacheDir, m_strCacheFile);
+}
+
+HRESULT CBDTitleCache::Load(uint32_t *pPlaylist, uint64_t *pDuration)
+{
+  CheckPointer(pPlaylist, E_POINTER);
+  CheckPointer(pDuration, E_POINTER);
+
+  if (m_strCacheFile.empty())
+    return E_UNEXPECTED;
+
+  std::vector<BYTE> data;
+  HRESULT hr = ReadCacheFile(m_strCacheFile, data);
+  if (hr != S_OK)
+    return hr;
+
+  CCacheReader reader(data);
+  if (!reader.CheckIdentity(BD_TITLE_CACHE_MAGIC, BD_TITLE_CACHE_VERSION, m_Identity))
+    return S_FALSE;
+
+  // the playlist listing is only part of the hash
+  uint64_t hash = 0;
+  uint32_t playlist = 0;
+  uint64_t duration = 0;
+  if (!reader.Read(hash) || !reader.Read(playlist) || !reader.Read(duration) || hash != m_Identity.hash)
+    return S_FALSE;
+
+  *pPlaylist = playlist;
+  *pDuration = duration;
+
+  return S_OK;
+}
+
+HRESULT CBDTitleCache::Store(uint32_t playlist, uint64_t duration)
+{
+  if (m_strCacheFile.empty())
+    return E_UNEXPECTED;
+
+  CCacheWriter writer;
+  writer.WriteIdentity(BD_TITLE_CACHE_MAGIC, BD_TITLE_CACHE_VERSION, m_Identity);
+  writer.Write(m_Identity.hash);
+  writer.Write(playlist);
+  writer.Write(duration);
+
+  if (FAILED(WriteCacheFile(m_strCacheDir, m_strCacheFile, writer.GetData(), BD_TITLE_CACHE_MAX_FILES)))
+    return E_FAIL;
+
+  DbgLog((LOG_TRACE, 10, L"CBDTitleCache::Store(): Stored playlist %u as the main title", playlist));
+
+  return S_OK;
+}
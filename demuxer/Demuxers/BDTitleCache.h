@@ -0,0 +1,52 @@
+/*
+ *      Copyright (C) 2010-2019 Hendrik Leppkes
+ *      http://www.1f0.de
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program; if not, write to the Free Software Foundation, Inc.,
+ *  51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+
+#pragma once
+
+#include <string>
+
+#include "FileCache.h"
+
+#define BD_TITLE_CACHE_MAX_FILES 64 // number of discs to keep in the cache
+
+// Persistent cache of the main title of Blu-ray discs
+//
+// Finding the main title requires libbluray to parse every playlist on the disc, which takes
+// several seconds on discs with hundreds of obfuscation playlists. The playlist of the main
+// title is stored keyed by the identity of the disc structure, that is the index file and the
+// listing of all playlist files, and can then be opened directly on the next open.
+class CBDTitleCache
+{
+public:
+  CBDTitleCache();
+  ~CBDTitleCache();
+
+  // Open the cache for the disc in the specified root directory
+  HRESULT Open(LPCWSTR pszRootPath);
+
+  // Returns S_FALSE if the disc is not in the cache
+  HRESULT Load(uint32_t *pPlaylist, uint64_t *pDuration);
+  HRESULT Store(uint32_t playlist, uint64_t duration);
+
+private:
+  FileIdentity m_Identity;
+  std::wstring m_strCacheDir;
+  std::wstring m_strCacheFile;
+};
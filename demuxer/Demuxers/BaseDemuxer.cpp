@@ -28,6 +28,16 @@ CBaseDemuxer::CBaseDemuxer(LPCTSTR pName, CCritSec *pLock)
   for(int i = 0; i < unknown; ++i) {
     m_dActiveStreams[i] = -1;
   }
+
+  m_pPacketPool = new CPacketPool();
+}
+
+CBaseDemuxer::~CBaseDemuxer()
+{
+  // Packets still in flight keep the pool alive
+  if (m_pPacketPool)
+    m_pPacketPool->Release();
+  m_pPacketPool = nullptr;
 }
 
 void CBaseDemuxer::CreateNoSubtitleStream()
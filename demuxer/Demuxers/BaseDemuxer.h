@@ -23,6 +23,7 @@
 
 #include "StreamInfo.h"
 #include "Packet.h"
+#include "PacketPool.h"
 #include "IMediaSideDataFFmpeg.h"
 
 #define DSHOW_TIME_BASE 10000000        // DirectShow times are in 100ns units
@@ -33,6 +34,7 @@
 #define FORCED_SUB_STRING L"Forced Subtitles (auto)"
 
 struct ILAVFSettingsInternal;
+struct LAVFNetworkStatistics;
 
 typedef struct CSubtitleSelector {
   std::string audioLanguage;
@@ -79,6 +81,8 @@ public:
   virtual STDMETHODIMP AbortOpening(int mode = 1, int timeout = 0) { return E_NOTIMPL; }
   // Get Duration
   virtual REFERENCE_TIME GetDuration() const = 0;
+  // Whether the duration was refined since the last call, for demuxers which estimate it in the background
+  virtual BOOL CheckDurationChanged() { return FALSE; }
   // Get the next packet from the file
   virtual STDMETHODIMP GetNextPacket(Packet **ppPacket) = 0;
   // Seek to the given position
@@ -90,6 +94,8 @@ public:
   // Get Container Flags
 #define LAVFMT_TS_DISCONT               0x0001
 #define LAVFMT_TS_DISCONT_NO_DOWNSTREAM 0x0002
+#define LAVFMT_LIVE                     0x0004
+#define LAVFMT_REALTIME                 0x0008
   virtual DWORD GetContainerFlags() { return 0; }
   // Select the active title
   virtual STDMETHODIMP SetTitle(int idx) { return E_NOTIMPL; }
@@ -106,6 +112,11 @@ public:
   // for active streams.
   virtual HRESULT SetActiveStream(StreamType type, int pid) { m_dActiveStreams[type] = pid; return S_OK; }
 
+  // Tell the demuxer whether the output of a stream type is connected
+  // The active stream of a type without connected output doesn't need to be read at all, but the demuxer
+  // keeps it selected, and resumes reading it once the output is connected again. Optional as well.
+  virtual void SetOutputConnected(StreamType type, BOOL bConnected) {}
+
   // Called when the settings of the splitter change
   virtual void SettingsChanged(ILAVFSettingsInternal *pSettings) {};
 
@@ -114,6 +125,15 @@ public:
   virtual STDMETHODIMP_(int) GetHasBFrames(DWORD dwStream) { return -1; }
   virtual STDMETHODIMP GetSideData(DWORD dwStream, GUID guidType, const BYTE **pData, size_t *pSize) { return E_NOTIMPL; }
 
+  // Packet pool
+  // The number of recycled packets should roughly match the capacity of the downstream queues
+  virtual void SetPacketPoolSize(size_t nPackets) { m_pPacketPool->SetMaxFree(nPackets); }
+  virtual void GetPacketPoolStatistics(ULONGLONG *pHits, ULONGLONG *pMisses) { m_pPacketPool->GetStatistics(pHits, pMisses); }
+
+  // Reception statistics of datagram sources, E_NOTIMPL if the source isn't received by the demuxer
+  virtual STDMETHODIMP GetNetworkStatistics(LAVFNetworkStatistics *pStats) { return E_NOTIMPL; }
+  virtual void ResetNetworkStatistics() {}
+
 public:
   class CStreamList : public std::deque<stream>
   {
@@ -129,6 +149,7 @@ public:
 
 protected:
   CBaseDemuxer(LPCTSTR pName, CCritSec *pLock);
+  virtual ~CBaseDemuxer();
   void CreateNoSubtitleStream();
   void CreatePGSForcedSubtitleStream();
 
@@ -150,4 +171,6 @@ protected:
   CCritSec *m_pLock = nullptr;
   CStreamList m_streams[unknown];
   int m_dActiveStreams[unknown];
+
+  CPacketPool *m_pPacketPool = nullptr;
 };
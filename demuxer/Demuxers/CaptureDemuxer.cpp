@@ -0,0 +1,226 @@
+/*
+ *      Copyright (C) 2010-2019 Hendrik Leppkes
+ *      http://www.1f0.de
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program; if not, write to the Free Software Foundation, Inc.,
+ *  51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+
+#include "stdafx.h"
+#include "CaptureDemuxer.h"
+#include "timer.h"
+
+CCaptureDemuxer::CCaptureDemuxer(CCritSec *pLock)
+  : CBaseDemuxer(L"capture demuxer", pLock)
+{
+}
+
+CCaptureDemuxer::~CCaptureDemuxer()
+{
+  ClearSideData();
+}
+
+void CCaptureDemuxer::ClearSideData()
+{
+  for (AVPacketSideData &sd : m_SideData)
+    av_freep(&sd.data);
+  m_SideData.clear();
+}
+
+STDMETHODIMP CCaptureDemuxer::Open(LPCOLESTR pszFileName)
+{
+  HRESULT hr = m_Reader.Open(pszFileName);
+  if (FAILED(hr))
+    return hr;
+
+  return IndexCapture();
+}
+
+// Read the stream properties, and collect the sync points for seeking
+HRESULT CCaptureDemuxer::IndexCapture()
+{
+  const LAVCapRecord *pRecord = nullptr;
+  const BYTE *pPayload = nullptr;
+  size_t nMediaType = 0;
+  size_t nPos = m_Reader.GetStart();
+  size_t nRecord = nPos;
+
+  HRESULT hr = S_OK;
+  while ((hr = m_Reader.ReadRecord(&nPos, &pRecord, &pPayload)) == S_OK) {
+    if (pRecord->dwType == LAVCAP_RECORD_MEDIATYPE) {
+      if (nMediaType == 0) {
+        CMediaType mt;
+        if (FAILED(hr = CPacketCaptureReader::ParseMediaType(pRecord, pPayload, &mt)))
+          break;
+
+        StreamType type = (mt.majortype == MEDIATYPE_Video) ? video : (mt.majortype == MEDIATYPE_Audio) ? audio : subpic;
+
+        stream s;
+        s.pid = 0;
+        s.language = "und";
+        s.streamInfo = new CStreamInfo();
+        s.streamInfo->mtypes.push_back(mt);
+        m_streams[type].push_back(s);
+
+        m_nFirstMediaType = nRecord;
+      } else {
+        m_bTypeChanges = TRUE;
+      }
+      nMediaType = nRecord;
+    } else if (pRecord->dwType == LAVCAP_RECORD_SIDEDATA && m_nFirstPacket == 0) {
+      if (pRecord->dwSize < sizeof(LAVCapSideData) || pRecord->dwSize - sizeof(LAVCapSideData) < ((const LAVCapSideData *)pPayload)->dwSize) {
+        hr = E_FAIL;
+        break;
+      }
+
+      const LAVCapSideData *pEntry = (const LAVCapSideData *)pPayload;
+      AVPacketSideData sd = { 0 };
+      sd.type = (enum AVPacketSideDataType)pEntry->dwType;
+      sd.size = pEntry->dwSize;
+      sd.data = (uint8_t *)av_memdup(pPayload + sizeof(LAVCapSideData), pEntry->dwSize);
+      if (!sd.data) {
+        hr = E_OUTOFMEMORY;
+        break;
+      }
+      m_SideData.push_back(sd);
+    } else if (pRecord->dwType == LAVCAP_RECORD_PACKET && pRecord->dwSize >= sizeof(LAVCapPacket)) {
+      if (m_nFirstPacket == 0)
+        m_nFirstPacket = nRecord;
+
+      const LAVCapPacket *pHeader = (const LAVCapPacket *)pPayload;
+      if (pHeader->rtStart != Packet::INVALID_TIME) {
+        if (pHeader->dwSampleFlags & LAVCAP_PACKET_SYNCPOINT)
+          m_SyncPoints.push_back({ pHeader->rtStart, nRecord, nMediaType });
+        m_rtDuration = max(m_rtDuration, pHeader->rtStop != Packet::INVALID_TIME ? pHeader->rtStop : pHeader->rtStart);
+      }
+    }
+    nRecord = nPos;
+  }
+
+  if (nMediaType == 0 || m_nFirstPacket == 0) {
+    DbgLog((LOG_ERROR, 10, L"CCaptureDemuxer::IndexCapture(): The capture contains no media type or no packets"));
+    return VFW_E_INVALID_FILE_FORMAT;
+  }
+
+  // a capture which was not closed properly is played up to the truncated record
+  if (FAILED(hr)) {
+    DbgLog((LOG_TRACE, 10, L"CCaptureDemuxer::IndexCapture(): The capture is damaged at offset %Iu, only playing the packets before it", nRecord));
+  }
+
+  DbgLog((LOG_TRACE, 10, L"CCaptureDemuxer::IndexCapture(): %Iu sync points, %Iu side data elements, duration %I64d", m_SyncPoints.size(), m_SideData.size(), m_rtDuration));
+
+  m_nPos = m_nFirstPacket;
+  return S_OK;
+}
+
+STDMETHODIMP CCaptureDemuxer::GetNextPacket(Packet **ppPacket)
+{
+  CheckPointer(ppPacket, E_POINTER);
+
+  const LAVCapRecord *pRecord = nullptr;
+  const BYTE *pPayload = nullptr;
+  HRESULT hr = S_OK;
+
+  for (;;) {
+    const size_t nRecord = m_nPos;
+    if (m_Reader.ReadRecord(&m_nPos, &pRecord, &pPayload) != S_OK)
+      return E_FAIL;
+
+    if (pRecord->dwType == LAVCAP_RECORD_MEDIATYPE) {
+      m_nMediaType = nRecord;
+    } else if (pRecord->dwType == LAVCAP_RECORD_PACKET) {
+      break;
+    }
+  }
+
+  AVPacket pkt;
+  const LAVCapPacket *pHeader = nullptr;
+  if (FAILED(hr = CPacketCaptureReader::ParsePacket(pRecord, pPayload, &pkt, &pHeader)))
+    return hr;
+
+  Packet *pPacket = m_pPacketPool->Acquire();
+  if (!pPacket || pPacket->SetPacket(&pkt) < 0) {
+    SAFE_DELETE(pPacket);
+    av_packet_unref(&pkt);
+    return E_OUTOFMEMORY;
+  }
+  av_packet_unref(&pkt);
+
+  pPacket->StreamId = 0;
+  pPacket->rtStart = pHeader->rtStart;
+  pPacket->rtStop = pHeader->rtStop;
+  pPacket->bSyncPoint = !!(pHeader->dwSampleFlags & LAVCAP_PACKET_SYNCPOINT);
+  pPacket->bDiscontinuity = !!(pHeader->dwSampleFlags & LAVCAP_PACKET_DISCONTINUITY);
+  // the packets were already parsed before they were captured
+  pPacket->dwFlags = pHeader->dwFlags | LAV_PACKET_PARSED;
+  pPacket->rtCapture = timer_get_ref_time();
+
+  if (m_nMediaType) {
+    size_t nPos = m_nMediaType;
+    CMediaType mt;
+    if (m_Reader.ReadRecord(&nPos, &pRecord, &pPayload) == S_OK && SUCCEEDED(CPacketCaptureReader::ParseMediaType(pRecord, pPayload, &mt)))
+      pPacket->pmt = CreateMediaType(&mt);
+    m_nMediaType = 0;
+  }
+
+  *ppPacket = pPacket;
+  return S_OK;
+}
+
+STDMETHODIMP CCaptureDemuxer::Seek(REFERENCE_TIME rTime)
+{
+  const SyncPoint *pSyncPoint = nullptr;
+  for (const SyncPoint &sp : m_SyncPoints) {
+    if (sp.rtStart > rTime)
+      break;
+    pSyncPoint = &sp;
+  }
+
+  if (!pSyncPoint)
+    return Reset();
+
+  DbgLog((LOG_TRACE, 10, L"CCaptureDemuxer::Seek(): Seeking to %I64d, starting at the sync point at %I64d", rTime, pSyncPoint->rtStart));
+
+  // the media type of the target is sent again, it may differ from the current one
+  m_nPos = pSyncPoint->nPos;
+  m_nMediaType = m_bTypeChanges ? pSyncPoint->nMediaType : 0;
+
+  return S_OK;
+}
+
+STDMETHODIMP CCaptureDemuxer::Reset()
+{
+  m_nPos = m_nFirstPacket;
+  m_nMediaType = m_bTypeChanges ? m_nFirstMediaType : 0;
+  return S_OK;
+}
+
+STDMETHODIMP CCaptureDemuxer::GetSideData(DWORD dwStream, GUID guidType, const BYTE **pData, size_t *pSize)
+{
+  if (guidType == IID_MediaSideDataFFMpeg) {
+    CBaseDemuxer::stream *pStream = FindStream(dwStream);
+    if (!pStream)
+      return E_INVALIDARG;
+
+    pStream->SideData.side_data = m_SideData.empty() ? nullptr : m_SideData.data();
+    pStream->SideData.side_data_elems = (int)m_SideData.size();
+    *pData = (BYTE*)&pStream->SideData;
+    *pSize = sizeof(pStream->SideData);
+
+    return S_OK;
+  }
+
+  return E_INVALIDARG;
+}
@@ -0,0 +1,75 @@
+/*
+ *      Copyright (C) 2010-2019 Hendrik Leppkes
+ *      http://www.1f0.de
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program; if not, write to the Free Software Foundation, Inc.,
+ *  51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+
+#pragma once
+
+#include "BaseDemuxer.h"
+#include "PacketCapture.h"
+
+#include <vector>
+
+// Replays a capture of an output pin, see CPacketCaptureWriter
+// The packets are delivered exactly as captured, so decoders can be benchmarked on the same input
+// without the timing of the file IO and the original demuxer.
+class CCaptureDemuxer : public CBaseDemuxer
+{
+public:
+  CCaptureDemuxer(CCritSec *pLock);
+  ~CCaptureDemuxer();
+
+  // CBaseDemuxer
+  STDMETHODIMP Open(LPCOLESTR pszFileName);
+  REFERENCE_TIME GetDuration() const { return m_rtDuration; }
+  STDMETHODIMP GetNextPacket(Packet **ppPacket);
+  STDMETHODIMP Seek(REFERENCE_TIME rTime);
+  STDMETHODIMP Reset();
+  const char *GetContainerFormat() const { return "lavcap"; }
+  STDMETHODIMP GetSideData(DWORD dwStream, GUID guidType, const BYTE **pData, size_t *pSize);
+
+  const stream* SelectVideoStream() { return SelectStream(video); }
+  const stream* SelectAudioStream(std::list<std::string> prefLanguages) { return SelectStream(audio); }
+  const stream* SelectSubtitleStream(std::list<CSubtitleSelector> subtitleSelectors, std::string audioLanguage) { return SelectStream(subpic); }
+
+private:
+  const stream* SelectStream(StreamType type) { return m_streams[type].empty() ? nullptr : &m_streams[type].front(); }
+
+  HRESULT IndexCapture();
+  void ClearSideData();
+
+private:
+  CPacketCaptureReader m_Reader;
+
+  struct SyncPoint {
+    REFERENCE_TIME rtStart;
+    size_t         nPos;          ///< Offset of the packet record
+    size_t         nMediaType;    ///< Offset of the media type record in effect for the packet
+  };
+  std::vector<SyncPoint> m_SyncPoints;
+
+  size_t m_nFirstPacket    = 0;
+  size_t m_nFirstMediaType = 0;
+  size_t m_nPos            = 0;
+  size_t m_nMediaType      = 0;     ///< Media type record to attach to the next packet, 0 if unchanged
+  BOOL   m_bTypeChanges    = FALSE; ///< The capture contains media type changes
+
+  REFERENCE_TIME m_rtDuration = 0;
+
+  std::vector<AVPacketSideData> m_SideData;
+};
@@ -0,0 +1,290 @@
+/*
+ *      Copyright (C) 2010-2019 Hendrik Leppkes
+ *      http://www.1f0.de
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program; if not, write to the Free Software Foundation, Inc.,
+ *  51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#include "stdafx.h"
+#include "BaseDemuxer.h"
+#include "DurationEstimator.h"
+
+#include <process.h>
+
+CDurationEstimator::CDurationEstimator()
+{
+}
+
+CDurationEstimator::~CDurationEstimator()
+{
+  Stop();
+}
+
+HRESULT CDurationEstimator::Start(const char *pszFileName, AVInputFormat *pFormat, int streamId, BOOL bRawAudio)
+{
+  CheckPointer(pszFileName, E_POINTER);
+  Stop();
+
+  m_strFileName = pszFileName;
+  m_pFormat = pFormat;
+  m_StreamId = streamId;
+  m_bRawAudio = bRawAudio;
+  m_bExit = FALSE;
+
+  m_hThread = (HANDLE)_beginthreadex(nullptr, 0, ThreadProc, (LPVOID)this, 0, nullptr);
+  if (!m_hThread)
+    return E_FAIL;
+
+  return S_OK;
+}
+
+void CDurationEstimator::Stop()
+{
+  m_bExit = TRUE;
+  if (m_hThread) {
+    WaitForSingleObject(m_hThread, INFINITE);
+    CloseHandle(m_hThread);
+    m_hThread = nullptr;
+  }
+}
+
+int CDurationEstimator::Interrupt(void *opaque)
+{
+  CDurationEstimator *pEstimator = static_cast<CDurationEstimator *>(opaque);
+  return pEstimator->m_bExit;
+}
+
+unsigned int WINAPI CDurationEstimator::ThreadProc(LPVOID pv)
+{
+  CDurationEstimator *pEstimator = static_cast<CDurationEstimator *>(pv);
+  pEstimator->Estimate();
+  return 0;
+}
+
+void CDurationEstimator::SetDuration(REFERENCE_TIME rtDuration)
+{
+  if (rtDuration <= 0 || rtDuration == m_rtDuration)
+    return;
+
+  DbgLog((LOG_TRACE, 10, L"CDurationEstimator::SetDuration(): Duration is %I64d", rtDuration));
+  m_rtDuration = rtDuration;
+  m_bChanged = TRUE;
+}
+
+// Difference of two timestamps, with a wrap-around in between undone
+static int64_t TimestampDiff(int64_t a, int64_t b, int wrapBits)
+{
+  int64_t diff = b - a;
+  if (wrapBits < 64) {
+    int64_t range = 1LL << wrapBits;
+    if (diff < -range / 2)
+      diff += range;
+    else if (diff > range / 2)
+      diff -= range;
+  }
+  return diff;
+}
+
+HRESULT CDurationEstimator::OpenFile(AVFormatContext **ps)
+{
+  AVFormatContext *s = avformat_alloc_context();
+  if (!s)
+    return E_OUTOFMEMORY;
+
+  s->interrupt_callback = { Interrupt, this };
+
+  // only the stream layout at the start of the file is needed, and the raw timestamps
+  AVDictionary *options = nullptr;
+  av_dict_set_int(&options, "probesize", DURATION_WINDOW_SIZE, 0);
+  av_dict_set_int(&options, "correct_ts_overflow", 0, 0);
+
+  int ret = avformat_open_input(&s, m_strFileName.c_str(), m_pFormat, &options);
+  av_dict_free(&options);
+  if (ret < 0) {
+    DbgLog((LOG_ERROR, 10, L"CDurationEstimator::OpenFile(): Opening the file failed (%d)", ret));
+    return E_FAIL;
+  }
+
+  *ps = s;
+  return S_OK;
+}
+
+// Read the next packet of the stream, pts is AV_NOPTS_VALUE for packets without timestamps
+BOOL CDurationEstimator::ReadTimestamp(AVFormatContext *s, AVPacket *pkt, int64_t *pts)
+{
+  while (!m_bExit && av_read_frame(s, pkt) >= 0) {
+    AVStream *st = s->streams[pkt->stream_index];
+    if (st->id != m_StreamId) {
+      av_packet_unref(pkt);
+      continue;
+    }
+
+    m_TimeBase = st->time_base;
+    m_WrapBits = st->pts_wrap_bits;
+
+    *pts = (pkt->pts != AV_NOPTS_VALUE) ? pkt->pts : pkt->dts;
+    return TRUE;
+  }
+  return FALSE;
+}
+
+// Duration from the first timestamp at the head and the last one at the tail, and the
+// duration derived from the bitrate in the head window to check it against
+HRESULT CDurationEstimator::EstimateFromWindows(AVFormatContext *s, int64_t size, REFERENCE_TIME *prtDuration, REFERENCE_TIME *prtBitrate)
+{
+  AVPacket pkt;
+  av_init_packet(&pkt);
+
+  int64_t ts = AV_NOPTS_VALUE;
+  int64_t first = AV_NOPTS_VALUE, firstPos = -1;
+  int64_t last = 0, lastPos = -1;
+  while (ReadTimestamp(s, &pkt, &ts)) {
+    int64_t pos = pkt.pos;
+    av_packet_unref(&pkt);
+
+    if (ts != AV_NOPTS_VALUE && pos >= 0) {
+      if (first == AV_NOPTS_VALUE) {
+        first = ts;
+        firstPos = pos;
+      } else if (TimestampDiff(first, ts, m_WrapBits) > last) {
+        last = TimestampDiff(first, ts, m_WrapBits);
+        lastPos = pos;
+      }
+    }
+
+    if (first != AV_NOPTS_VALUE && pos >= firstPos + DURATION_WINDOW_SIZE)
+      break;
+  }
+
+  if (first == AV_NOPTS_VALUE)
+    return E_FAIL;
+
+  *prtBitrate = -1;
+  if (last > 0 && lastPos > firstPos)
+    *prtBitrate = av_rescale(av_rescale(last, size - firstPos, lastPos - firstPos), (int64_t)m_TimeBase.num * DSHOW_TIME_BASE, m_TimeBase.den);
+
+  if (av_seek_frame(s, -1, max(size - DURATION_WINDOW_SIZE, 0LL), AVSEEK_FLAG_BYTE) < 0)
+    return E_FAIL;
+
+  while (ReadTimestamp(s, &pkt, &ts)) {
+    if (ts != AV_NOPTS_VALUE && TimestampDiff(first, ts, m_WrapBits) + pkt.duration > last) {
+      last = TimestampDiff(first, ts, m_WrapBits) + pkt.duration;
+    }
+    av_packet_unref(&pkt);
+  }
+
+  if (m_bExit || last <= 0)
+    return E_FAIL;
+
+  *prtDuration = av_rescale(last, (int64_t)m_TimeBase.num * DSHOW_TIME_BASE, m_TimeBase.den);
+  return S_OK;
+}
+
+// Add up the continuous parts of the timestamps of the whole file
+HRESULT CDurationEstimator::ScanTimestamps(AVFormatContext *s, REFERENCE_TIME *prtDuration)
+{
+  if (av_seek_frame(s, -1, 0, AVSEEK_FLAG_BYTE) < 0)
+    return E_FAIL;
+
+  AVPacket pkt;
+  av_init_packet(&pkt);
+
+  int64_t ts = AV_NOPTS_VALUE, prev = AV_NOPTS_VALUE;
+  int64_t total = 0, maxGap = 0, lastDuration = 0;
+  int nDiscontinuities = 0;
+  while (ReadTimestamp(s, &pkt, &ts)) {
+    if (!maxGap)
+      maxGap = av_rescale(DURATION_MAX_GAP, m_TimeBase.den, (int64_t)m_TimeBase.num * DSHOW_TIME_BASE);
+
+    if (ts != AV_NOPTS_VALUE) {
+      if (prev == AV_NOPTS_VALUE) {
+        prev = ts;
+      } else {
+        int64_t diff = TimestampDiff(prev, ts, m_WrapBits);
+        // small steps back are reordered frames, larger jumps in either direction start a new part
+        if (diff > maxGap || diff < -maxGap) {
+          prev = ts;
+          nDiscontinuities++;
+        } else if (diff > 0) {
+          total += diff;
+          prev = ts;
+        }
+      }
+      lastDuration = pkt.duration;
+    }
+    av_packet_unref(&pkt);
+  }
+
+  if (m_bExit || total <= 0)
+    return E_FAIL;
+
+  DbgLog((LOG_TRACE, 10, L"CDurationEstimator::ScanTimestamps(): Found %d discontinuities", nDiscontinuities));
+
+  *prtDuration = av_rescale(total + lastDuration, (int64_t)m_TimeBase.num * DSHOW_TIME_BASE, m_TimeBase.den);
+  return S_OK;
+}
+
+// Add up the durations of all frames
+HRESULT CDurationEstimator::ScanFrameDurations(AVFormatContext *s, REFERENCE_TIME *prtDuration)
+{
+  AVPacket pkt;
+  av_init_packet(&pkt);
+
+  int64_t ts = AV_NOPTS_VALUE;
+  int64_t total = 0;
+  while (ReadTimestamp(s, &pkt, &ts)) {
+    int64_t duration = pkt.duration;
+    av_packet_unref(&pkt);
+
+    if (duration <= 0)
+      return E_FAIL;
+    total += duration;
+  }
+
+  if (m_bExit || total <= 0)
+    return E_FAIL;
+
+  *prtDuration = av_rescale(total, (int64_t)m_TimeBase.num * DSHOW_TIME_BASE, m_TimeBase.den);
+  return S_OK;
+}
+
+void CDurationEstimator::Estimate()
+{
+  SetThreadName(-1, "CDurationEstimator");
+
+  AVFormatContext *s = nullptr;
+  if (FAILED(OpenFile(&s)))
+    return;
+
+  int64_t size = avio_size(s->pb);
+  REFERENCE_TIME rtDuration = -1, rtBitrate = -1;
+  if (size <= 0) {
+    // nothing to estimate from
+  } else if (m_bRawAudio) {
+    if (size <= DURATION_SCAN_MAX_SIZE && SUCCEEDED(ScanFrameDurations(s, &rtDuration)))
+      SetDuration(rtDuration);
+  } else if (SUCCEEDED(EstimateFromWindows(s, size, &rtDuration, &rtBitrate))) {
+    SetDuration(rtDuration);
+
+    // the timestamps jump somewhere in between
+    if (rtBitrate > 0 && _abs64(rtDuration - rtBitrate) > rtBitrate / 2 && size <= DURATION_SCAN_MAX_SIZE) {
+      DbgLog((LOG_TRACE, 10, L"CDurationEstimator::Estimate(): Duration %I64d doesn't match the bitrate (%I64d), scanning the file", rtDuration, rtBitrate));
+      if (SUCCEEDED(ScanTimestamps(s, &rtDuration)))
+        SetDuration(rtDuration);
+    }
+  }
+
+  avformat_close_input(&s);
+}
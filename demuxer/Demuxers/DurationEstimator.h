@@ -0,0 +1,83 @@
+/*
+ *      Copyright (C) 2010-2019 Hendrik Leppkes
+ *      http://www.1f0.de
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program; if not, write to the Free Software Foundation, Inc.,
+ *  51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#pragma once
+
+#include <atomic>
+#include <string>
+
+#define DURATION_WINDOW_SIZE    (1 << 20)               // bytes read at the head and at the tail of the file
+#define DURATION_SCAN_MAX_SIZE  (1LL << 30)             // larger files are never scanned completely
+#define DURATION_MAX_GAP        (10 * DSHOW_TIME_BASE)  // larger timestamp jumps are discontinuities
+
+// Estimation of the duration of files without a reliable duration in their headers, on a background thread
+//
+// MPEG-TS/PS: the first and last timestamps of one stream are taken from a small window at the head
+// and at the tail of the file, with wrap-arounds of the timestamps undone. If that duration doesn't
+// match the bitrate measured at the head, the timestamps jump somewhere in the file, and all of them
+// are scanned to add up the continuous parts.
+// Raw audio: the durations of all frames are added up, instead of estimating from the bitrate.
+//
+// The file is read through a format context of its own, so the demuxer is never blocked by the estimation.
+class CDurationEstimator
+{
+public:
+  CDurationEstimator();
+  ~CDurationEstimator();
+
+  // Start estimating the duration of the file, based on the timestamps of the stream with the given id
+  HRESULT Start(const char *pszFileName, AVInputFormat *pFormat, int streamId, BOOL bRawAudio);
+  void Stop();
+
+  // The estimated duration, -1 until it is known
+  REFERENCE_TIME GetDuration() const { return m_rtDuration; }
+
+  // Whether the duration changed since the last call
+  BOOL CheckChanged() { return m_bChanged.exchange(FALSE); }
+
+private:
+  static int Interrupt(void *opaque);
+  static unsigned int WINAPI ThreadProc(LPVOID pv);
+  void Estimate();
+
+  HRESULT OpenFile(AVFormatContext **ps);
+  BOOL ReadTimestamp(AVFormatContext *s, AVPacket *pkt, int64_t *pts);
+
+  HRESULT EstimateFromWindows(AVFormatContext *s, int64_t size, REFERENCE_TIME *prtDuration, REFERENCE_TIME *prtBitrate);
+  HRESULT ScanTimestamps(AVFormatContext *s, REFERENCE_TIME *prtDuration);
+  HRESULT ScanFrameDurations(AVFormatContext *s, REFERENCE_TIME *prtDuration);
+
+  void SetDuration(REFERENCE_TIME rtDuration);
+
+private:
+  std::string m_strFileName;
+  AVInputFormat *m_pFormat = nullptr;
+  int m_StreamId           = -1;
+  BOOL m_bRawAudio         = FALSE;
+
+  // time base and wrap-around of the timestamps of the stream, once it was found
+  AVRational m_TimeBase    = { 0, 1 };
+  int m_WrapBits           = 64;
+
+  std::atomic<REFERENCE_TIME> m_rtDuration{-1};
+  std::atomic<BOOL> m_bChanged{FALSE};
+
+  HANDLE m_hThread         = nullptr;
+  volatile BOOL m_bExit    = FALSE;
+};
@@ -0,0 +1,250 @@
+/*
+ *      Copyright (C) 2010-2019 Hendrik Leppkes
+ *      http://www.1f0.de
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program; if not, write to the Free Software Foundation, Inc.,
+ *  51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#include "stdafx.h"
+#include "FileCache.h"
+
+#include <ShlObj.h>
+#include <algorithm>
+
+#define CACHE_MAX_STRING_LENGTH 32768
+
+// 64-bit FNV-1a
+static uint64_t fnv1a_hash(uint64_t hash, const void *data, size_t size)
+{
+  const uint8_t *p = (const uint8_t *)data;
+  for (size_t i = 0; i < size; i++) {
+    hash ^= p[i];
+    hash *= 0x100000001B3ULL;
+  }
+  return hash;
+}
+
+HRESULT GetFileIdentity(LPCWSTR pszFileName, FileIdentity &id)
+{
+  CheckPointer(pszFileName, E_POINTER);
+
+  WIN32_FILE_ATTRIBUTE_DATA attr;
+  if (!GetFileAttributesExW(pszFileName, GetFileExInfoStandard, &attr))
+    return E_FAIL;
+
+  id.llSize = ((LONGLONG)attr.nFileSizeHigh << 32) | attr.nFileSizeLow;
+  id.ftLastWrite = attr.ftLastWriteTime;
+
+  WCHAR szFullPath[4096];
+  DWORD dwLen = GetFullPathNameW(pszFileName, 4096, szFullPath, nullptr);
+  if (dwLen == 0 || dwLen >= 4096)
+    return E_FAIL;
+  CharLowerBuffW(szFullPath, dwLen);
+  id.strPath = szFullPath;
+
+  id.hash = 0xCBF29CE484222325ULL;
+  id.hash = fnv1a_hash(id.hash, id.strPath.c_str(), id.strPath.length() * sizeof(WCHAR));
+  id.hash = fnv1a_hash(id.hash, &id.llSize, sizeof(id.llSize));
+  id.hash = fnv1a_hash(id.hash, &id.ftLastWrite, sizeof(id.ftLastWrite));
+
+  return S_OK;
+}
+
+void HashFileIdentity(FileIdentity &id, const void *pData, size_t size)
+{
+  id.hash = fnv1a_hash(id.hash, pData, size);
+}
+
+HRESULT GetCacheFilePath(LPCWSTR pszCacheName, const FileIdentity &id, std::wstring &strDirectory, std::wstring &strFile)
+{
+  WCHAR szAppData[MAX_PATH];
+  if (FAILED(SHGetFolderPathW(nullptr, CSIDL_LOCAL_APPDATA, nullptr, 0, szAppData)))
+    return E_FAIL;
+
+  strDirectory = std::wstring(szAppData) + L"\\LAV Filters\\" + pszCacheName;
+
+  // Name the cache file after the identity of the file
+  WCHAR szFileName[32];
+  swprintf_s(szFileName, L"\\%016I64x.bin", id.hash);
+  strFile = strDirectory + szFileName;
+
+  return S_OK;
+}
+
+HRESULT ReadCacheFile(const std::wstring &strFile, std::vector<BYTE> &data)
+{
+  HANDLE hFile = CreateFileW(strFile.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+  if (hFile == INVALID_HANDLE_VALUE)
+    return S_FALSE;
+
+  HRESULT hr = E_FAIL;
+  LARGE_INTEGER size;
+  DWORD dwRead = 0;
+
+  // Cache files are small, anything else is not ours
+  if (!GetFileSizeEx(hFile, &size) || size.QuadPart <= 0 || size.QuadPart > (64 << 20))
+    goto done;
+
+  data.resize((size_t)size.QuadPart);
+  if (!ReadFile(hFile, data.data(), (DWORD)data.size(), &dwRead, nullptr) || dwRead != data.size())
+    goto done;
+
+  hr = S_OK;
+done:
+  CloseHandle(hFile);
+  return hr;
+}
+
+static void PruneCacheDirectory(const std::wstring &strDirectory, size_t nMaxFiles)
+{
+  std::vector<std::pair<ULONGLONG, std::wstring>> files;
+
+  WIN32_FIND_DATAW fd;
+  HANDLE hFind = FindFirstFileW((strDirectory + L"\\*.bin").c_str(), &fd);
+  if (hFind == INVALID_HANDLE_VALUE)
+    return;
+
+  do {
+    ULONGLONG time = ((ULONGLONG)fd.ftLastWriteTime.dwHighDateTime << 32) | fd.ftLastWriteTime.dwLowDateTime;
+    files.push_back(std::make_pair(time, std::wstring(fd.cFileName)));
+  } while (FindNextFileW(hFind, &fd));
+  FindClose(hFind);
+
+  if (files.size() <= nMaxFiles)
+    return;
+
+  // Remove the least recently written files
+  std::sort(files.begin(), files.end());
+  for (size_t i = 0; i < files.size() - nMaxFiles; i++) {
+    DeleteFileW((strDirectory + L"\\" + files[i].second).c_str());
+  }
+}
+
+HRESULT WriteCacheFile(const std::wstring &strDirectory, const std::wstring &strFile, const std::vector<BYTE> &data, size_t nMaxFiles)
+{
+  int ret = SHCreateDirectoryExW(nullptr, strDirectory.c_str(), nullptr);
+  if (ret != ERROR_SUCCESS && ret != ERROR_ALREADY_EXISTS && ret != ERROR_FILE_EXISTS)
+    return E_FAIL;
+
+  // Write to a temporary file first, so a concurrent reader never sees a partial file
+  std::wstring strTempFile = strFile + L".tmp";
+  HANDLE hFile = CreateFileW(strTempFile.c_str(), GENERIC_WRITE, 0, nullptr, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, nullptr);
+  if (hFile == INVALID_HANDLE_VALUE)
+    return E_FAIL;
+
+  DWORD dwWritten = 0;
+  BOOL bOK = WriteFile(hFile, data.data(), (DWORD)data.size(), &dwWritten, nullptr) && dwWritten == data.size();
+  CloseHandle(hFile);
+
+  if (!bOK || !MoveFileExW(strTempFile.c_str(), strFile.c_str(), MOVEFILE_REPLACE_EXISTING)) {
+    DeleteFileW(strTempFile.c_str());
+    return E_FAIL;
+  }
+
+  PruneCacheDirectory(strDirectory, nMaxFiles);
+
+  return S_OK;
+}
+
+void CCacheWriter::WriteBytes(const void *pData, size_t size)
+{
+  const BYTE *p = (const BYTE *)pData;
+  m_Data.insert(m_Data.end(), p, p + size);
+}
+
+void CCacheWriter::WriteString(const std::wstring &str)
+{
+  Write((DWORD)str.length());
+  WriteBytes(str.c_str(), str.length() * sizeof(WCHAR));
+}
+
+void CCacheWriter::WriteString(const char *str)
+{
+  DWORD len = str ? (DWORD)strlen(str) : 0;
+  Write(len);
+  WriteBytes(str, len);
+}
+
+void CCacheWriter::WriteIdentity(DWORD dwMagic, DWORD dwVersion, const FileIdentity &id)
+{
+  Write(dwMagic);
+  Write(dwVersion);
+  Write(id.llSize);
+  Write(id.ftLastWrite);
+  WriteString(id.strPath);
+}
+
+bool CCacheReader::ReadBytes(void *pData, size_t size)
+{
+  if (m_bError || m_nLeft < size) {
+    m_bError = true;
+    return false;
+  }
+
+  memcpy(pData, m_pData, size);
+  m_pData += size;
+  m_nLeft -= size;
+  return true;
+}
+
+bool CCacheReader::Skip(size_t size)
+{
+  if (m_bError || m_nLeft < size) {
+    m_bError = true;
+    return false;
+  }
+
+  m_pData += size;
+  m_nLeft -= size;
+  return true;
+}
+
+bool CCacheReader::ReadString(std::wstring &str)
+{
+  DWORD len = 0;
+  if (!Read(len) || len > CACHE_MAX_STRING_LENGTH || m_nLeft < len * sizeof(WCHAR)) {
+    m_bError = true;
+    return false;
+  }
+
+  str.assign((const WCHAR *)m_pData, len);
+  return Skip(len * sizeof(WCHAR));
+}
+
+bool CCacheReader::ReadString(std::string &str)
+{
+  DWORD len = 0;
+  if (!Read(len) || len > CACHE_MAX_STRING_LENGTH || m_nLeft < len) {
+    m_bError = true;
+    return false;
+  }
+
+  str.assign((const char *)m_pData, len);
+  return Skip(len);
+}
+
+bool CCacheReader::CheckIdentity(DWORD dwMagic, DWORD dwVersion, const FileIdentity &id)
+{
+  DWORD magic = 0, version = 0;
+  LONGLONG size = 0;
+  FILETIME ft = { 0 };
+  std::wstring path;
+
+  if (!Read(magic) || !Read(version) || !Read(size) || !Read(ft) || !ReadString(path))
+    return false;
+
+  // Validate the full identity, in case of hash collisions
+  return magic == dwMagic && version == dwVersion && size == id.llSize && CompareFileTime(&ft, &id.ftLastWrite) == 0 && path == id.strPath;
+}
@@ -0,0 +1,87 @@
+/*
+ *      Copyright (C) 2010-2019 Hendrik Leppkes
+ *      http://www.1f0.de
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program; if not, write to the Free Software Foundation, Inc.,
+ *  51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#pragma once
+
+#include <string>
+#include <vector>
+
+// Helpers for per-file caches stored below %LOCALAPPDATA%\LAV Filters
+
+// Identity of a file, caches are invalidated when any of it changes
+struct FileIdentity {
+  std::wstring strPath;      // full path, lower-case
+  LONGLONG llSize = 0;
+  FILETIME ftLastWrite = { 0 };
+  uint64_t hash = 0;
+};
+
+HRESULT GetFileIdentity(LPCWSTR pszFileName, FileIdentity &id);
+
+// Mix additional data into the hash of an identity, for caches that depend on more than one file
+// Only the hash covers this data, so it has to be validated by the cache itself
+void HashFileIdentity(FileIdentity &id, const void *pData, size_t size);
+
+// Build the path of the cache file for a file identity in the named cache
+HRESULT GetCacheFilePath(LPCWSTR pszCacheName, const FileIdentity &id, std::wstring &strDirectory, std::wstring &strFile);
+
+HRESULT ReadCacheFile(const std::wstring &strFile, std::vector<BYTE> &data);
+
+// Atomically replace the cache file, and keep at most nMaxFiles files in the cache directory
+HRESULT WriteCacheFile(const std::wstring &strDirectory, const std::wstring &strFile, const std::vector<BYTE> &data, size_t nMaxFiles);
+
+// Serialization of cache contents
+class CCacheWriter
+{
+public:
+  template <class T> void Write(const T &value) { WriteBytes(&value, sizeof(T)); }
+  void WriteBytes(const void *pData, size_t size);
+  void WriteString(const std::wstring &str);
+  void WriteString(const char *str);
+  void WriteIdentity(DWORD dwMagic, DWORD dwVersion, const FileIdentity &id);
+
+  const std::vector<BYTE>& GetData() const { return m_Data; }
+
+private:
+  std::vector<BYTE> m_Data;
+};
+
+class CCacheReader
+{
+public:
+  CCacheReader(const std::vector<BYTE> &data) : m_pData(data.data()), m_nLeft(data.size()) {}
+
+  template <class T> bool Read(T &value) { return ReadBytes(&value, sizeof(T)); }
+  bool ReadBytes(void *pData, size_t size);
+  bool ReadString(std::wstring &str);
+  bool ReadString(std::string &str);
+  // Check that the cache was written for this file identity
+  bool CheckIdentity(DWORD dwMagic, DWORD dwVersion, const FileIdentity &id);
+
+  // Access to the remaining data
+  const BYTE *Peek(size_t size) const { return (!m_bError && m_nLeft >= size) ? m_pData : nullptr; }
+  bool Skip(size_t size);
+
+  bool IsValid() const { return !m_bError; }
+
+private:
+  const BYTE *m_pData = nullptr;
+  size_t m_nLeft      = 0;
+  bool m_bError       = false;
+};
@@ -0,0 +1,371 @@
+/*
+ *      Copyright (C) 2010-2019 Hendrik Leppkes
+ *      http://www.1f0.de
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program; if not, write to the Free Software Foundation, Inc.,
+ *  51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#include "stdafx.h"
+#include "HTTPPrefetchIO.h"
+
+#include <process.h>
+
+CHTTPPrefetchIO::CHTTPPrefetchIO()
+{
+}
+
+CHTTPPrefetchIO::~CHTTPPrefetchIO()
+{
+  Close();
+}
+
+HRESULT CHTTPPrefetchIO::Open(const char *pszUrl, const AVIOInterruptCB *pInterrupt)
+{
+  uint8_t *buffer = nullptr;
+  Block block;
+
+  Close();
+  m_bExit = FALSE;
+
+  m_url = pszUrl;
+  if (pInterrupt)
+    m_Interrupt = *pInterrupt;
+
+  // The first block is fetched right away, its response tells if the server accepts range requests
+  block.pData = (uint8_t *)av_malloc(HTTP_PREFETCH_BLOCK_SIZE);
+  if (!block.pData)
+    goto fail;
+
+  if (FAILED(FetchBlock(0, block.pData, &block.nSize, &m_llSize)) || m_llSize <= 0) {
+    DbgLog((LOG_TRACE, 10, L"CHTTPPrefetchIO::Open(): Server does not support range requests"));
+    av_free(block.pData);
+    goto fail;
+  }
+
+  block.state = BlockReady;
+  m_Blocks[0] = block;
+
+  buffer = (uint8_t *)av_mallocz(HTTP_PREFETCH_BUFFER_SIZE + AV_INPUT_BUFFER_PADDING_SIZE);
+  if (!buffer)
+    goto fail;
+
+  m_pAVIOContext = avio_alloc_context(buffer, HTTP_PREFETCH_BUFFER_SIZE, 0, this, Read, nullptr, Seek);
+  if (!m_pAVIOContext) {
+    av_free(buffer);
+    goto fail;
+  }
+
+  for (m_dwWorkers = 0; m_dwWorkers < HTTP_PREFETCH_CONNECTIONS; m_dwWorkers++) {
+    m_hWorkers[m_dwWorkers] = (HANDLE)_beginthreadex(nullptr, 0, WorkerThreadProc, (LPVOID)this, 0, nullptr);
+    if (!m_hWorkers[m_dwWorkers])
+      break;
+  }
+  if (m_dwWorkers == 0)
+    goto fail;
+
+  m_llPos = 0;
+
+  DbgLog((LOG_TRACE, 10, L"CHTTPPrefetchIO::Open(): Opened %I64d bytes with %u connections", m_llSize, m_dwWorkers));
+
+  return S_OK;
+fail:
+  Close();
+  return E_FAIL;
+}
+
+void CHTTPPrefetchIO::Close()
+{
+  m_bExit = TRUE;
+  m_evRequest.Set();
+  if (m_dwWorkers > 0) {
+    WaitForMultipleObjects(m_dwWorkers, m_hWorkers, TRUE, INFINITE);
+    for (DWORD i = 0; i < m_dwWorkers; i++) {
+      CloseHandle(m_hWorkers[i]);
+      m_hWorkers[i] = nullptr;
+    }
+    m_dwWorkers = 0;
+  }
+
+  if (m_pAVIOContext) {
+    av_free(m_pAVIOContext->buffer);
+    av_free(m_pAVIOContext);
+    m_pAVIOContext = nullptr;
+  }
+
+  for (auto &it : m_Blocks)
+    av_free(it.second.pData);
+  m_Blocks.clear();
+  m_Requests.clear();
+  m_evRequest.Reset();
+
+  m_llSize = 0;
+  m_llPos = 0;
+}
+
+// Connections are aborted when the demuxer is interrupted, or this object is closed
+int CHTTPPrefetchIO::Interrupt(void *opaque)
+{
+  CHTTPPrefetchIO *io = static_cast<CHTTPPrefetchIO *>(opaque);
+  if (io->m_bExit)
+    return 1;
+  if (io->m_Interrupt.callback)
+    return io->m_Interrupt.callback(io->m_Interrupt.opaque);
+  return 0;
+}
+
+// Every block is fetched with a request for exactly its range
+HRESULT CHTTPPrefetchIO::FetchBlock(LONGLONG llBlock, uint8_t *pData, int *pnSize, LONGLONG *pllFileSize)
+{
+  const LONGLONG llStart = llBlock * HTTP_PREFETCH_BLOCK_SIZE;
+  int nSize = HTTP_PREFETCH_BLOCK_SIZE;
+  if (m_llSize > 0)
+    nSize = (int)min((LONGLONG)nSize, m_llSize - llStart);
+
+  AVDictionary *options = nullptr;
+  av_dict_set_int(&options, "offset", llStart, 0);
+  av_dict_set_int(&options, "end_offset", llStart + nSize, 0);
+  av_dict_set(&options, "reconnect", "1", 0);
+
+  AVIOInterruptCB cb = { Interrupt, this };
+  AVIOContext *pb = nullptr;
+  int ret = avio_open2(&pb, m_url.c_str(), AVIO_FLAG_READ, &cb, &options);
+  av_dict_free(&options);
+  if (ret < 0) {
+    DbgLog((LOG_TRACE, 10, L"CHTTPPrefetchIO::FetchBlock(): Opening the connection for block %I64d failed (%d)", llBlock, ret));
+    return E_FAIL;
+  }
+
+  // a server which ignores the range sends the whole file, and can't be used
+  if (pllFileSize)
+    *pllFileSize = (pb->seekable & AVIO_SEEKABLE_NORMAL) ? avio_size(pb) : -1;
+
+  int nRead = 0;
+  while (nRead < nSize) {
+    ret = avio_read(pb, pData + nRead, nSize - nRead);
+    if (ret <= 0)
+      break;
+    nRead += ret;
+  }
+  avio_closep(&pb);
+
+  // only the last block of the file may be short
+  if (nRead < nSize && (m_llSize > 0 || nRead == 0)) {
+    DbgLog((LOG_TRACE, 10, L"CHTTPPrefetchIO::FetchBlock(): Block %I64d ended after %d of %d bytes (%d)", llBlock, nRead, nSize, ret));
+    return E_FAIL;
+  }
+
+  *pnSize = nRead;
+  return S_OK;
+}
+
+unsigned int WINAPI CHTTPPrefetchIO::WorkerThreadProc(LPVOID pv)
+{
+  CHTTPPrefetchIO *io = static_cast<CHTTPPrefetchIO *>(pv);
+  io->Worker();
+  return 0;
+}
+
+void CHTTPPrefetchIO::Worker()
+{
+  SetThreadName(-1, "CHTTPPrefetchIO Worker");
+
+  while (!m_bExit) {
+    LONGLONG llBlock = -1;
+    {
+      CAutoLock lock(&m_csBlocks);
+      if (!m_Requests.empty()) {
+        llBlock = m_Requests.front();
+        m_Requests.pop_front();
+        m_Blocks[llBlock].state = BlockLoading;
+      }
+      if (m_Requests.empty() && !m_bExit)
+        m_evRequest.Reset();
+    }
+
+    if (llBlock < 0) {
+      m_evRequest.Wait(100);
+      continue;
+    }
+
+    int nSize = 0;
+    uint8_t *pData = (uint8_t *)av_malloc(HTTP_PREFETCH_BLOCK_SIZE);
+    HRESULT hr = pData ? FetchBlock(llBlock, pData, &nSize, nullptr) : E_OUTOFMEMORY;
+    if (FAILED(hr))
+      av_freep(&pData);
+
+    {
+      // blocks which are loading are never removed from the map
+      CAutoLock lock(&m_csBlocks);
+      Block &block = m_Blocks[llBlock];
+      block.pData = pData;
+      block.nSize = nSize;
+      block.state = SUCCEEDED(hr) ? BlockReady : BlockFailed;
+      block.ullLastUse = ++m_ullUseClock;
+      // aborted requests are not counted, they are retried once the demuxer continues
+      if (FAILED(hr) && !Interrupt(this))
+        block.nFailures++;
+    }
+    m_evBlockDone.Set();
+  }
+}
+
+CHTTPPrefetchIO::Block *CHTTPPrefetchIO::RequestBlock(LONGLONG llBlock, BOOL bUrgent)
+{
+  auto it = m_Blocks.find(llBlock);
+  if (it != m_Blocks.end()) {
+    // a block which is being read is the most recent one, and never evicted for the prefetches
+    if (bUrgent)
+      it->second.ullLastUse = ++m_ullUseClock;
+
+    // move a queued prefetch in front of the others, once it is read
+    if (bUrgent && it->second.state == BlockQueued) {
+      auto req = std::find(m_Requests.begin(), m_Requests.end(), llBlock);
+      if (req != m_Requests.end() && req != m_Requests.begin()) {
+        m_Requests.erase(req);
+        m_Requests.push_front(llBlock);
+      }
+    }
+    return &it->second;
+  }
+
+  EvictBlocks();
+
+  Block *pBlock = &m_Blocks[llBlock];
+  if (bUrgent)
+    m_Requests.push_front(llBlock);
+  else
+    m_Requests.push_back(llBlock);
+  m_evRequest.Set();
+
+  return pBlock;
+}
+
+void CHTTPPrefetchIO::PrefetchBlocks(LONGLONG llBlock)
+{
+  for (LONGLONG i = llBlock; i < llBlock + HTTP_PREFETCH_AHEAD && i * HTTP_PREFETCH_BLOCK_SIZE < m_llSize; i++) {
+    if (m_Blocks.find(i) == m_Blocks.end())
+      RequestBlock(i, FALSE);
+  }
+}
+
+// Drop the prefetches which did not start yet, the ones which are loading already are kept in the cache
+void CHTTPPrefetchIO::DropRequests()
+{
+  for (LONGLONG llBlock : m_Requests)
+    m_Blocks.erase(llBlock);
+  m_Requests.clear();
+}
+
+// Remove the least recently used blocks, to make room for a new one
+void CHTTPPrefetchIO::EvictBlocks()
+{
+  while (m_Blocks.size() >= HTTP_PREFETCH_CACHE_BLOCKS) {
+    auto oldest = m_Blocks.end();
+    for (auto it = m_Blocks.begin(); it != m_Blocks.end(); ++it) {
+      if (it->second.state != BlockReady && it->second.state != BlockFailed)
+        continue;
+      if (oldest == m_Blocks.end() || it->second.ullLastUse < oldest->second.ullLastUse)
+        oldest = it;
+    }
+    if (oldest == m_Blocks.end())
+      break;
+
+    av_free(oldest->second.pData);
+    m_Blocks.erase(oldest);
+  }
+}
+
+int CHTTPPrefetchIO::Read(void *opaque, uint8_t *buf, int buf_size)
+{
+  CHTTPPrefetchIO *io = static_cast<CHTTPPrefetchIO *>(opaque);
+
+  if (io->m_llPos >= io->m_llSize)
+    return AVERROR_EOF;
+
+  const LONGLONG llBlock = io->m_llPos / HTTP_PREFETCH_BLOCK_SIZE;
+  const int nOffset = (int)(io->m_llPos % HTTP_PREFETCH_BLOCK_SIZE);
+
+  CAutoLock lock(&io->m_csBlocks);
+
+  Block *pBlock = io->RequestBlock(llBlock, TRUE);
+  io->PrefetchBlocks(llBlock + 1);
+
+  for (;;) {
+    if (pBlock->state == BlockReady)
+      break;
+
+    if (pBlock->state == BlockFailed) {
+      if (pBlock->nFailures > HTTP_PREFETCH_RETRIES) {
+        DbgLog((LOG_TRACE, 10, L"CHTTPPrefetchIO::Read(): Read failed at pos: %I64d", io->m_llPos));
+        io->m_Blocks.erase(llBlock);
+        return AVERROR(EIO);
+      }
+      pBlock->state = BlockQueued;
+      io->m_Requests.push_front(llBlock);
+      io->m_evRequest.Set();
+    }
+
+    // wait for the workers without holding the lock
+    io->m_csBlocks.Unlock();
+    const BOOL bInterrupted = Interrupt(io);
+    if (!bInterrupted)
+      io->m_evBlockDone.Wait(50);
+    io->m_csBlocks.Lock();
+
+    if (bInterrupted)
+      return AVERROR_EXIT;
+  }
+
+  if (nOffset >= pBlock->nSize)
+    return AVERROR_EOF;
+
+  const int size = min(buf_size, pBlock->nSize - nOffset);
+  memcpy(buf, pBlock->pData + nOffset, size);
+  pBlock->ullLastUse = ++io->m_ullUseClock;
+
+  io->m_llPos += size;
+  return size;
+}
+
+int64_t CHTTPPrefetchIO::Seek(void *opaque, int64_t offset, int whence)
+{
+  CHTTPPrefetchIO *io = static_cast<CHTTPPrefetchIO *>(opaque);
+
+  LONGLONG llPos = 0;
+  if (whence == SEEK_SET) {
+    llPos = offset;
+  } else if (whence == SEEK_CUR) {
+    llPos = io->m_llPos + offset;
+  } else if (whence == SEEK_END) {
+    llPos = io->m_llSize + offset;
+  } else if (whence == AVSEEK_SIZE) {
+    return io->m_llSize;
+  } else
+    return -1;
+
+  if (llPos < 0)
+    return AVERROR(EINVAL);
+
+  // Prefetches for the old position are of no use outside of the prefetched range
+  const LONGLONG llBlock = llPos / HTTP_PREFETCH_BLOCK_SIZE;
+  const LONGLONG llCurrent = io->m_llPos / HTTP_PREFETCH_BLOCK_SIZE;
+  if (llBlock < llCurrent || llBlock > llCurrent + HTTP_PREFETCH_AHEAD) {
+    CAutoLock lock(&io->m_csBlocks);
+    io->DropRequests();
+  }
+
+  io->m_llPos = llPos;
+  return llPos;
+}
@@ -0,0 +1,99 @@
+/*
+ *      Copyright (C) 2010-2019 Hendrik Leppkes
+ *      http://www.1f0.de
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program; if not, write to the Free Software Foundation, Inc.,
+ *  51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#pragma once
+
+#include <map>
+#include <deque>
+#include <string>
+#include <algorithm>
+
+#define HTTP_PREFETCH_BUFFER_SIZE  32768
+#define HTTP_PREFETCH_BLOCK_SIZE   (1 << 20)
+#define HTTP_PREFETCH_CONNECTIONS  4
+#define HTTP_PREFETCH_AHEAD        8         // blocks requested ahead of the read position
+#define HTTP_PREFETCH_CACHE_BLOCKS 64        // blocks kept in memory, including the ones ahead
+#define HTTP_PREFETCH_RETRIES      2
+
+// Access to HTTP sources through parallel range requests, exposed through a custom AVIOContext
+// The file is split into blocks, which are fetched by a set of worker threads, each with its own connection.
+// Blocks ahead of the read position are prefetched, and recently used blocks are kept in a cache,
+// so jumping between the index and the data of a file does not wait for a new request every time.
+class CHTTPPrefetchIO
+{
+public:
+  CHTTPPrefetchIO();
+  ~CHTTPPrefetchIO();
+
+  // Open the URL, fails if the server does not support range requests
+  HRESULT Open(const char *pszUrl, const AVIOInterruptCB *pInterrupt);
+  void Close();
+
+  // The context is owned by this object, and stays valid until Close
+  AVIOContext *GetAVIOContext() const { return m_pAVIOContext; }
+
+private:
+  enum BlockState { BlockQueued, BlockLoading, BlockReady, BlockFailed };
+
+  struct Block {
+    BlockState state      = BlockQueued;
+    uint8_t *pData        = nullptr;
+    int nSize             = 0;
+    int nFailures         = 0;
+    ULONGLONG ullLastUse  = 0;
+  };
+
+  static int Read(void *opaque, uint8_t *buf, int buf_size);
+  static int64_t Seek(void *opaque, int64_t offset, int whence);
+  static int Interrupt(void *opaque);
+
+  static unsigned int WINAPI WorkerThreadProc(LPVOID pv);
+  void Worker();
+
+  HRESULT FetchBlock(LONGLONG llBlock, uint8_t *pData, int *pnSize, LONGLONG *pllFileSize);
+
+  // Called with the block lock held
+  Block *RequestBlock(LONGLONG llBlock, BOOL bUrgent);
+  void PrefetchBlocks(LONGLONG llBlock);
+  void DropRequests();
+  void EvictBlocks();
+
+private:
+  std::string m_url;
+  AVIOInterruptCB m_Interrupt = { nullptr, nullptr };
+
+  LONGLONG m_llSize = 0;
+  LONGLONG m_llPos  = 0;
+
+  CCritSec m_csBlocks;
+  std::map<LONGLONG, Block> m_Blocks;
+  std::deque<LONGLONG> m_Requests;
+  ULONGLONG m_ullUseClock = 0;
+
+  // set while requests are waiting for a worker
+  CAMEvent m_evRequest{TRUE};
+  // signaled when a worker finished a block
+  CAMEvent m_evBlockDone;
+
+  HANDLE m_hWorkers[HTTP_PREFETCH_CONNECTIONS] = { 0 };
+  DWORD m_dwWorkers = 0;
+  volatile BOOL m_bExit = FALSE;
+
+  AVIOContext *m_pAVIOContext = nullptr;
+};
@@ -0,0 +1,403 @@
+/*
+ *      Copyright (C) 2010-2019 Hendrik Leppkes
+ *      http://www.1f0.de
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program; if not, write to the Free Software Foundation, Inc.,
+ *  51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#include "stdafx.h"
+#include "ImageSequencePrefetch.h"
+
+#include <algorithm>
+#include <process.h>
+
+#define IMAGE_READ_BUFFER_SIZE 32768
+
+BOOL CImageSequencePrefetch::SplitNumberedName(const std::string &name, std::string &prefix, LONGLONG &llNumber, int &nDigits, std::string &suffix)
+{
+  const size_t slash = name.find_last_of("/\\");
+  const size_t start = (slash == std::string::npos) ? 0 : slash + 1;
+
+  const size_t end = name.find_last_of("0123456789");
+  if (end == std::string::npos || end < start)
+    return FALSE;
+
+  size_t begin = end;
+  while (begin > start && name[begin - 1] >= '0' && name[begin - 1] <= '9')
+    begin--;
+
+  if (end - begin + 1 > 18)
+    return FALSE;
+
+  nDigits = (int)(end - begin + 1);
+  llNumber = _strtoi64(name.c_str() + begin, nullptr, 10);
+  prefix = name.substr(0, begin);
+  suffix = name.substr(end + 1);
+  return TRUE;
+}
+
+std::string CImageSequencePrefetch::GetName(LONGLONG llNumber) const
+{
+  char number[32];
+  sprintf_s(number, "%0*I64d", m_nDigits, llNumber);
+  return m_strPrefix + number + m_strSuffix;
+}
+
+CImageSequencePrefetch::CImageSequencePrefetch()
+{
+}
+
+CImageSequencePrefetch::~CImageSequencePrefetch()
+{
+  m_bExit = TRUE;
+  m_evRequest.Set();
+  if (m_dwWorkers > 0) {
+    WaitForMultipleObjects(m_dwWorkers, m_hWorkers, TRUE, INFINITE);
+    for (DWORD i = 0; i < m_dwWorkers; i++)
+      CloseHandle(m_hWorkers[i]);
+    m_dwWorkers = 0;
+  }
+
+  ASSERT(m_MemoryContexts.empty());
+  Clear();
+
+  DbgLog((LOG_TRACE, 10, L"CImageSequencePrefetch::~CImageSequencePrefetch(): %u images read from memory, %u read directly", m_dwHits, m_dwMisses));
+}
+
+void CImageSequencePrefetch::Attach(AVFormatContext *s)
+{
+  m_pfnIoOpen = s->io_open;
+  m_pfnIoClose = s->io_close;
+  m_Interrupt = s->interrupt_callback;
+
+  s->opaque = this;
+  s->io_open = IoOpen;
+  s->io_close = IoClose;
+
+  for (; m_dwWorkers < IMAGE_PREFETCH_THREADS; m_dwWorkers++) {
+    m_hWorkers[m_dwWorkers] = (HANDLE)_beginthreadex(nullptr, 0, WorkerThreadProc, (LPVOID)this, 0, nullptr);
+    if (!m_hWorkers[m_dwWorkers])
+      break;
+  }
+}
+
+int CImageSequencePrefetch::IoOpen(AVFormatContext *s, AVIOContext **pb, const char *url, int flags, AVDictionary **options)
+{
+  CImageSequencePrefetch *prefetch = static_cast<CImageSequencePrefetch *>(s->opaque);
+  return prefetch->Open(s, pb, url, flags, options);
+}
+
+void CImageSequencePrefetch::IoClose(AVFormatContext *s, AVIOContext *pb)
+{
+  CImageSequencePrefetch *prefetch = static_cast<CImageSequencePrefetch *>(s->opaque);
+  {
+    CAutoLock lock(&prefetch->m_csImages);
+    if (prefetch->m_MemoryContexts.erase(pb)) {
+      MemoryReader *reader = static_cast<MemoryReader *>(pb->opaque);
+      av_free(reader->pData);
+      delete reader;
+      av_free(pb->buffer);
+      av_free(pb);
+      return;
+    }
+  }
+  prefetch->m_pfnIoClose(s, pb);
+}
+
+int CImageSequencePrefetch::Open(AVFormatContext *s, AVIOContext **pb, const char *url, int flags, AVDictionary **options)
+{
+  std::string prefix, suffix;
+  LONGLONG llNumber = 0;
+  int nDigits = 0;
+  if ((flags & AVIO_FLAG_WRITE) || !SplitNumberedName(url, prefix, llNumber, nDigits, suffix))
+    return m_pfnIoOpen(s, pb, url, flags, options);
+
+  {
+    CAutoLock lock(&m_csImages);
+
+    if (prefix != m_strPrefix || suffix != m_strSuffix || nDigits != m_nDigits) {
+      Clear();
+      m_strPrefix = prefix;
+      m_strSuffix = suffix;
+      m_nDigits = nDigits;
+    }
+    m_llPosition = llNumber;
+    if (m_llEnd >= 0 && llNumber >= m_llEnd)
+      m_llEnd = -1;
+
+    // wait for a read in progress, it is ahead of a new request
+    auto it = m_Images.find(llNumber);
+    while (it != m_Images.end() && it->second.state == ImageLoading) {
+      m_csImages.Unlock();
+      const BOOL bInterrupted = Interrupt(this);
+      if (!bInterrupted)
+        m_evImageDone.Wait(50);
+      m_csImages.Lock();
+
+      if (bInterrupted)
+        return AVERROR_EXIT;
+      it = m_Images.find(llNumber);
+    }
+
+    if (it != m_Images.end() && it->second.state == ImageReady) {
+      uint8_t *pData = it->second.pData;
+      const int nSize = it->second.nSize;
+      m_nMemory -= nSize;
+      m_Images.erase(it);
+      Schedule();
+
+      int ret = OpenMemory(pb, pData, nSize);
+      if (ret >= 0) {
+        m_dwHits++;
+        return ret;
+      }
+    } else {
+      // a read which did not start yet is no faster than the request of the demuxer
+      DropImage(llNumber);
+      Schedule();
+    }
+    m_dwMisses++;
+  }
+
+  return m_pfnIoOpen(s, pb, url, flags, options);
+}
+
+// Called with the image lock held, takes ownership of the data
+int CImageSequencePrefetch::OpenMemory(AVIOContext **pb, uint8_t *pData, int nSize)
+{
+  MemoryReader *reader = new MemoryReader();
+  reader->pData = pData;
+  reader->nSize = nSize;
+
+  uint8_t *buffer = (uint8_t *)av_malloc(IMAGE_READ_BUFFER_SIZE);
+  AVIOContext *ctx = buffer ? avio_alloc_context(buffer, IMAGE_READ_BUFFER_SIZE, 0, reader, ReadMemory, nullptr, SeekMemory) : nullptr;
+  if (!ctx) {
+    av_free(buffer);
+    av_free(pData);
+    delete reader;
+    return AVERROR(ENOMEM);
+  }
+
+  m_MemoryContexts.insert(ctx);
+  *pb = ctx;
+  return 0;
+}
+
+int CImageSequencePrefetch::ReadMemory(void *opaque, uint8_t *buf, int buf_size)
+{
+  MemoryReader *reader = static_cast<MemoryReader *>(opaque);
+  if (reader->nPos >= reader->nSize)
+    return AVERROR_EOF;
+
+  const int size = min(buf_size, reader->nSize - reader->nPos);
+  memcpy(buf, reader->pData + reader->nPos, size);
+  reader->nPos += size;
+  return size;
+}
+
+int64_t CImageSequencePrefetch::SeekMemory(void *opaque, int64_t offset, int whence)
+{
+  MemoryReader *reader = static_cast<MemoryReader *>(opaque);
+
+  int64_t pos = 0;
+  whence &= ~AVSEEK_FORCE;
+  if (whence == SEEK_SET) {
+    pos = offset;
+  } else if (whence == SEEK_CUR) {
+    pos = reader->nPos + offset;
+  } else if (whence == SEEK_END) {
+    pos = reader->nSize + offset;
+  } else if (whence == AVSEEK_SIZE) {
+    return reader->nSize;
+  } else
+    return -1;
+
+  if (pos < 0 || pos > reader->nSize)
+    return AVERROR(EINVAL);
+
+  reader->nPos = (int)pos;
+  return pos;
+}
+
+// Reads are aborted when the demuxer is interrupted, or the prefetcher is destroyed
+int CImageSequencePrefetch::Interrupt(void *opaque)
+{
+  CImageSequencePrefetch *prefetch = static_cast<CImageSequencePrefetch *>(opaque);
+  if (prefetch->m_bExit)
+    return 1;
+  if (prefetch->m_Interrupt.callback)
+    return prefetch->m_Interrupt.callback(prefetch->m_Interrupt.opaque);
+  return 0;
+}
+
+HRESULT CImageSequencePrefetch::ReadImage(const std::string &url, uint8_t **ppData, int *pnSize)
+{
+  AVIOInterruptCB cb = { Interrupt, this };
+  AVIOContext *pb = nullptr;
+  int ret = avio_open2(&pb, url.c_str(), AVIO_FLAG_READ, &cb, nullptr);
+  if (ret < 0)
+    return E_FAIL;
+
+  const int64_t size = avio_size(pb);
+  if (size <= 0 || size > IMAGE_PREFETCH_MAX_SIZE) {
+    avio_closep(&pb);
+    return E_FAIL;
+  }
+
+  int nRead = 0;
+  uint8_t *pData = (uint8_t *)av_malloc((size_t)size);
+  while (pData && nRead < (int)size) {
+    ret = avio_read(pb, pData + nRead, (int)size - nRead);
+    if (ret <= 0)
+      break;
+    nRead += ret;
+  }
+  avio_closep(&pb);
+
+  if (!pData || nRead == 0) {
+    DbgLog((LOG_TRACE, 10, L"CImageSequencePrefetch::ReadImage(): Reading %S failed (%d)", url.c_str(), ret));
+    av_free(pData);
+    return E_FAIL;
+  }
+
+  *ppData = pData;
+  *pnSize = nRead;
+  return S_OK;
+}
+
+unsigned int WINAPI CImageSequencePrefetch::WorkerThreadProc(LPVOID pv)
+{
+  CImageSequencePrefetch *prefetch = static_cast<CImageSequencePrefetch *>(pv);
+  prefetch->Worker();
+  return 0;
+}
+
+void CImageSequencePrefetch::Worker()
+{
+  SetThreadName(-1, "CImageSequencePrefetch Worker");
+
+  while (!m_bExit) {
+    LONGLONG llNumber = -1;
+    DWORD dwGeneration = 0;
+    std::string url;
+    {
+      CAutoLock lock(&m_csImages);
+      if (!m_Requests.empty()) {
+        llNumber = m_Requests.front();
+        m_Requests.pop_front();
+
+        auto it = m_Images.find(llNumber);
+        if (it != m_Images.end() && it->second.state == ImageQueued) {
+          it->second.state = ImageLoading;
+          url = GetName(llNumber);
+          dwGeneration = m_dwGeneration;
+        }
+      }
+      if (m_Requests.empty() && !m_bExit)
+        m_evRequest.Reset();
+    }
+
+    if (url.empty()) {
+      m_evRequest.Wait(100);
+      continue;
+    }
+
+    uint8_t *pData = nullptr;
+    int nSize = 0;
+    HRESULT hr = ReadImage(url, &pData, &nSize);
+
+    {
+      CAutoLock lock(&m_csImages);
+      auto it = m_Images.find(llNumber);
+      if (dwGeneration == m_dwGeneration && it != m_Images.end() && it->second.state == ImageLoading) {
+        if (SUCCEEDED(hr)) {
+          it->second.state = ImageReady;
+          it->second.pData = pData;
+          it->second.nSize = nSize;
+          m_nMemory += nSize;
+          m_nImageSize = nSize;
+          pData = nullptr;
+        } else {
+          // the end of the sequence
+          it->second.state = ImageFailed;
+          if (m_llEnd < 0 || llNumber < m_llEnd)
+            m_llEnd = llNumber;
+        }
+      }
+    }
+
+    av_free(pData);
+    m_evImageDone.Set();
+  }
+}
+
+// Queue the images following the position of the demuxer, as many as fit into the memory limit
+void CImageSequencePrefetch::Schedule()
+{
+  LONGLONG llAhead = IMAGE_PREFETCH_THREADS;
+  if (m_nImageSize > 0)
+    llAhead = max(1LL, min((LONGLONG)IMAGE_PREFETCH_MAX_FILES, (LONGLONG)(IMAGE_PREFETCH_MAX_MEMORY / m_nImageSize)));
+
+  // images behind the demuxer, or outside of the window after a seek
+  for (auto it = m_Images.begin(); it != m_Images.end();) {
+    if (it->first <= m_llPosition || it->first > m_llPosition + llAhead) {
+      if (it->second.state == ImageReady) {
+        m_nMemory -= it->second.nSize;
+        av_free(it->second.pData);
+      }
+      it = m_Images.erase(it);
+    } else {
+      ++it;
+    }
+  }
+
+  m_Requests.erase(std::remove_if(m_Requests.begin(), m_Requests.end(), [this](LONGLONG n) { return m_Images.find(n) == m_Images.end(); }), m_Requests.end());
+
+  for (LONGLONG n = m_llPosition + 1; n <= m_llPosition + llAhead && (m_llEnd < 0 || n < m_llEnd); n++) {
+    if (m_Images.find(n) == m_Images.end()) {
+      m_Images[n].state = ImageQueued;
+      m_Requests.push_back(n);
+    }
+  }
+
+  if (!m_Requests.empty())
+    m_evRequest.Set();
+}
+
+void CImageSequencePrefetch::DropImage(LONGLONG llNumber)
+{
+  auto it = m_Images.find(llNumber);
+  if (it == m_Images.end())
+    return;
+
+  if (it->second.state == ImageReady) {
+    m_nMemory -= it->second.nSize;
+    av_free(it->second.pData);
+  }
+  m_Images.erase(it);
+}
+
+void CImageSequencePrefetch::Clear()
+{
+  for (auto &it : m_Images) {
+    if (it.second.state == ImageReady)
+      av_free(it.second.pData);
+  }
+  m_Images.clear();
+  m_Requests.clear();
+  m_nMemory = 0;
+  m_llEnd = -1;
+  m_dwGeneration++;
+}
@@ -0,0 +1,116 @@
+/*
+ *      Copyright (C) 2010-2019 Hendrik Leppkes
+ *      http://www.1f0.de
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program; if not, write to the Free Software Foundation, Inc.,
+ *  51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#pragma once
+
+#include <map>
+#include <set>
+#include <deque>
+#include <string>
+
+#define IMAGE_PREFETCH_THREADS    4
+#define IMAGE_PREFETCH_MAX_FILES  16
+#define IMAGE_PREFETCH_MAX_MEMORY (512 << 20)
+#define IMAGE_PREFETCH_MAX_SIZE   (256 << 20)   // larger images are read by the demuxer itself
+
+// Parallel read-ahead of the files of image sequences
+// The image2 demuxer of libavformat opens every image of a sequence through the io_open callback of the format
+// context, one after the other. The prefetcher installs its own callbacks, and reads the following images with a
+// set of worker threads while the current one is decoded. Once the demuxer opens a prefetched image, it is read
+// from memory.
+class CImageSequencePrefetch
+{
+public:
+  CImageSequencePrefetch();
+  ~CImageSequencePrefetch();
+
+  // Route the file requests of the format context through the prefetcher
+  // The format context has to be closed before the prefetcher is destroyed
+  void Attach(AVFormatContext *s);
+
+  // Split a file name at the last group of digits of its name, fails for names without digits
+  static BOOL SplitNumberedName(const std::string &name, std::string &prefix, LONGLONG &llNumber, int &nDigits, std::string &suffix);
+
+private:
+  enum ImageState { ImageQueued, ImageLoading, ImageReady, ImageFailed };
+
+  struct Image {
+    ImageState state = ImageQueued;
+    uint8_t *pData   = nullptr;
+    int nSize        = 0;
+  };
+
+  struct MemoryReader {
+    uint8_t *pData = nullptr;
+    int nSize      = 0;
+    int nPos       = 0;
+  };
+
+  static int IoOpen(AVFormatContext *s, AVIOContext **pb, const char *url, int flags, AVDictionary **options);
+  static void IoClose(AVFormatContext *s, AVIOContext *pb);
+
+  static int ReadMemory(void *opaque, uint8_t *buf, int buf_size);
+  static int64_t SeekMemory(void *opaque, int64_t offset, int whence);
+  static int Interrupt(void *opaque);
+
+  static unsigned int WINAPI WorkerThreadProc(LPVOID pv);
+  void Worker();
+
+  int Open(AVFormatContext *s, AVIOContext **pb, const char *url, int flags, AVDictionary **options);
+  int OpenMemory(AVIOContext **pb, uint8_t *pData, int nSize);
+  HRESULT ReadImage(const std::string &url, uint8_t **ppData, int *pnSize);
+  std::string GetName(LONGLONG llNumber) const;
+
+  // Called with the image lock held
+  void Schedule();
+  void DropImage(LONGLONG llNumber);
+  void Clear();
+
+private:
+  int (*m_pfnIoOpen)(AVFormatContext *s, AVIOContext **pb, const char *url, int flags, AVDictionary **options) = nullptr;
+  void (*m_pfnIoClose)(AVFormatContext *s, AVIOContext *pb) = nullptr;
+  AVIOInterruptCB m_Interrupt = { nullptr, nullptr };
+
+  CCritSec m_csImages;
+
+  // the sequence opened last, the images are named prefix + number + suffix
+  std::string m_strPrefix, m_strSuffix;
+  int m_nDigits         = 0;
+  LONGLONG m_llPosition = -1;
+  LONGLONG m_llEnd      = -1;   // first image which failed to read, nothing is prefetched beyond it
+  DWORD m_dwGeneration  = 0;    // changes with the sequence, reads of a previous one are dropped
+
+  std::map<LONGLONG, Image> m_Images;
+  std::deque<LONGLONG> m_Requests;
+  std::set<AVIOContext *> m_MemoryContexts;
+  size_t m_nMemory      = 0;
+  int m_nImageSize      = 0;    // size of the image read last, to fit the read-ahead into the memory limit
+
+  DWORD m_dwHits        = 0;
+  DWORD m_dwMisses      = 0;
+
+  // set while requests are waiting for a worker
+  CAMEvent m_evRequest{TRUE};
+  // signaled when a worker finished an image
+  CAMEvent m_evImageDone;
+
+  HANDLE m_hWorkers[IMAGE_PREFETCH_THREADS] = { 0 };
+  DWORD m_dwWorkers = 0;
+  volatile BOOL m_bExit = FALSE;
+};
@@ -0,0 +1,215 @@
+/*
+ *      Copyright (C) 2010-2019 Hendrik Leppkes
+ *      http://www.1f0.de
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program; if not, write to the Free Software Foundation, Inc.,
+ *  51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#include "stdafx.h"
+#include "BaseDemuxer.h"
+#include "KeyFrameIndex.h"
+
+#include <vector>
+
+#define KEYFRAME_INDEX_MAGIC    MKTAG('L', 'A', 'V', 'K')
+#define KEYFRAME_INDEX_VERSION  3
+#define KEYFRAME_INDEX_MAX_ENTRIES (1 << 22)
+#define KEYFRAME_INDEX_MAX_PROBES  4096
+
+CKeyFrameIndex::CKeyFrameIndex()
+{
+}
+
+CKeyFrameIndex::~CKeyFrameIndex()
+{
+  Save();
+}
+
+HRESULT CKeyFrameIndex::Open(LPCWSTR pszFileName)
+{
+  if (FAILED(GetFileIdentity(pszFileName, m_Identity)))
+    return E_FAIL;
+
+  if (FAILED(GetCacheFilePath(L"KeyFrameIndex", m_Identity, m_strCacheDir, m_strCacheFile)))
+    return E_FAIL;
+
+  if (Load() == S_OK) {
+    DbgLog((LOG_TRACE, 10, L"CKeyFrameIndex::Open(): Loaded %u key-frames and %u probes from the cache (complete: %d)", (unsigned)m_Entries.size(), (unsigned)m_Probes.size(), m_bComplete));
+  }
+
+  return S_OK;
+}
+
+HRESULT CKeyFrameIndex::Load()
+{
+  std::vector<BYTE> data;
+  HRESULT hr = ReadCacheFile(m_strCacheFile, data);
+  if (hr != S_OK)
+    return hr;
+
+  CCacheReader reader(data);
+  if (!reader.CheckIdentity(KEYFRAME_INDEX_MAGIC, KEYFRAME_INDEX_VERSION, m_Identity))
+    return E_FAIL;
+
+  int StreamId = -1;
+  DWORD bComplete = 0, nEntries = 0;
+  if (!reader.Read(StreamId) || !reader.Read(bComplete) || !reader.Read(nEntries) || nEntries > KEYFRAME_INDEX_MAX_ENTRIES)
+    return E_FAIL;
+
+  const KeyFrameIndexPoint *entries = (const KeyFrameIndexPoint *)reader.Peek(nEntries * sizeof(KeyFrameIndexPoint));
+  if (!entries)
+    return E_FAIL;
+
+  m_Entries.clear();
+  for (DWORD i = 0; i < nEntries; i++) {
+    m_Entries[entries[i].rt] = entries[i].pos;
+  }
+
+  DWORD nProbes = 0;
+  if (!reader.Read(nProbes) || nProbes > KEYFRAME_INDEX_MAX_PROBES)
+    return E_FAIL;
+
+  const KeyFrameIndexPoint *probes = (const KeyFrameIndexPoint *)reader.Peek(nProbes * sizeof(KeyFrameIndexPoint));
+  if (!probes)
+    return E_FAIL;
+
+  m_Probes.clear();
+  for (DWORD i = 0; i < nProbes; i++) {
+    m_Probes[probes[i].rt] = probes[i].pos;
+  }
+
+  m_StreamId = StreamId;
+  m_bComplete = bComplete;
+  m_bModified = FALSE;
+
+  return S_OK;
+}
+
+HRESULT CKeyFrameIndex::Save()
+{
+  if (!m_bModified || (m_Entries.empty() && m_Probes.empty()) || m_strCacheFile.empty())
+    return S_FALSE;
+
+  DWORD nEntries = (DWORD)min(m_Entries.size(), (size_t)KEYFRAME_INDEX_MAX_ENTRIES);
+  DWORD nProbes = (DWORD)min(m_Probes.size(), (size_t)KEYFRAME_INDEX_MAX_PROBES);
+
+  CCacheWriter writer;
+  writer.WriteIdentity(KEYFRAME_INDEX_MAGIC, KEYFRAME_INDEX_VERSION, m_Identity);
+  writer.Write(m_StreamId);
+  writer.Write((DWORD)m_bComplete);
+  writer.Write(nEntries);
+
+  DWORD n = 0;
+  for (auto it = m_Entries.begin(); it != m_Entries.end() && n < nEntries; it++, n++) {
+    KeyFrameIndexPoint e = { it->first, it->second };
+    writer.Write(e);
+  }
+
+  writer.Write(nProbes);
+  n = 0;
+  for (auto it = m_Probes.begin(); it != m_Probes.end() && n < nProbes; it++, n++) {
+    KeyFrameIndexPoint p = { it->first, it->second };
+    writer.Write(p);
+  }
+
+  if (FAILED(WriteCacheFile(m_strCacheDir, m_strCacheFile, writer.GetData(), KEYFRAME_INDEX_MAX_FILES)))
+    return E_FAIL;
+
+  DbgLog((LOG_TRACE, 10, L"CKeyFrameIndex::Save(): Stored %u key-frames and %u probes in the cache (complete: %d)", nEntries, nProbes, m_bComplete));
+
+  m_bModified = FALSE;
+
+  return S_OK;
+}
+
+void CKeyFrameIndex::Add(int streamId, REFERENCE_TIME rt, int64_t pos)
+{
+  if (pos < 0)
+    return;
+
+  // The index only tracks one stream
+  if (m_StreamId == -1)
+    m_StreamId = streamId;
+  else if (streamId != m_StreamId)
+    return;
+
+  auto it = m_Entries.find(rt);
+  if (it != m_Entries.end() && it->second == pos)
+    return;
+
+  if (m_Entries.size() >= KEYFRAME_INDEX_MAX_ENTRIES)
+    return;
+
+  m_Entries[rt] = pos;
+  m_bModified = TRUE;
+}
+
+BOOL CKeyFrameIndex::Find(int streamId, REFERENCE_TIME rt, int64_t *pPos) const
+{
+  if (streamId != m_StreamId || m_Entries.empty())
+    return FALSE;
+
+  auto it = m_Entries.upper_bound(rt);
+  if (it == m_Entries.begin())
+    return FALSE;
+  --it;
+
+  // An incomplete index may be missing the key-frames right before the target
+  if (!m_bComplete && (rt - it->first) > KEYFRAME_INDEX_MAX_GAP)
+    return FALSE;
+
+  *pPos = it->second;
+  return TRUE;
+}
+
+void CKeyFrameIndex::AddProbe(REFERENCE_TIME rt, int64_t pos)
+{
+  if (pos < 0 || m_Probes.size() >= KEYFRAME_INDEX_MAX_PROBES)
+    return;
+
+  auto it = m_Probes.find(rt);
+  if (it != m_Probes.end() && it->second == pos)
+    return;
+
+  m_Probes[rt] = pos;
+  m_bModified = TRUE;
+}
+
+static void NarrowBracket(const std::map<REFERENCE_TIME, int64_t> &points, REFERENCE_TIME rt, KeyFrameIndexPoint &lo, KeyFrameIndexPoint &hi)
+{
+  auto it = points.upper_bound(rt);
+  if (it != points.end() && it->second > lo.pos && it->second < hi.pos)
+    hi = { it->first, it->second };
+
+  if (it != points.begin()) {
+    --it;
+    if (it->second > lo.pos && it->second < hi.pos)
+      lo = { it->first, it->second };
+  }
+}
+
+void CKeyFrameIndex::GetBracket(REFERENCE_TIME rt, KeyFrameIndexPoint &lo, KeyFrameIndexPoint &hi) const
+{
+  NarrowBracket(m_Entries, rt, lo, hi);
+  NarrowBracket(m_Probes, rt, lo, hi);
+}
+
+void CKeyFrameIndex::SetComplete()
+{
+  if (!m_bComplete) {
+    m_bComplete = TRUE;
+    m_bModified = TRUE;
+  }
+}
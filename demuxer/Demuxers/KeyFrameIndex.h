@@ -0,0 +1,86 @@
+/*
+ *      Copyright (C) 2010-2019 Hendrik Leppkes
+ *      http://www.1f0.de
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program; if not, write to the Free Software Foundation, Inc.,
+ *  51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#pragma once
+
+#include <map>
+#include <string>
+
+#include "FileCache.h"
+
+#define KEYFRAME_INDEX_MAX_GAP    (5 * DSHOW_TIME_BASE) // maximum distance to the seek target for incomplete indexes
+#define KEYFRAME_INDEX_MAX_FILES  256                   // number of index files to keep in the cache
+
+struct KeyFrameIndexPoint {
+  REFERENCE_TIME rt;
+  int64_t pos;
+};
+
+// Persistent key-frame index for containers without a usable index of their own
+//
+// The index maps the presentation time of key-frames of one stream to their byte position,
+// and is stored on disk keyed by the identity of the file (path, size and modification time).
+// It is built incrementally while packets are being demuxed, and considered complete once
+// the file was read from start to end without interruption.
+// Timestamps sampled while seeking by bisection are stored along with it, so later seeks into
+// the same region don't have to read the file again.
+class CKeyFrameIndex
+{
+public:
+  CKeyFrameIndex();
+  ~CKeyFrameIndex();
+
+  // Open the index for the given file, and load it from the cache if present
+  HRESULT Open(LPCWSTR pszFileName);
+
+  // Write the index back to the cache, if it was changed
+  HRESULT Save();
+
+  void Add(int streamId, REFERENCE_TIME rt, int64_t pos);
+
+  // Find the byte position of the last key-frame at or before rt
+  BOOL Find(int streamId, REFERENCE_TIME rt, int64_t *pPos) const;
+
+  // Remember the timestamp found at a byte position while seeking
+  void AddProbe(REFERENCE_TIME rt, int64_t pos);
+
+  // Narrow the byte range [lo, hi] around rt with the known key-frames and timestamp probes
+  void GetBracket(REFERENCE_TIME rt, KeyFrameIndexPoint &lo, KeyFrameIndexPoint &hi) const;
+
+  void SetComplete();
+  BOOL IsComplete() const { return m_bComplete; }
+
+  int GetStreamId() const { return m_StreamId; }
+  const std::map<REFERENCE_TIME, int64_t>& GetEntries() const { return m_Entries; }
+
+private:
+  HRESULT Load();
+
+private:
+  FileIdentity m_Identity;
+  std::wstring m_strCacheDir;
+  std::wstring m_strCacheFile;
+
+  int m_StreamId     = -1;
+  BOOL m_bComplete   = FALSE;
+  BOOL m_bModified   = FALSE;
+
+  std::map<REFERENCE_TIME, int64_t> m_Entries;
+  std::map<REFERENCE_TIME, int64_t> m_Probes;
+};
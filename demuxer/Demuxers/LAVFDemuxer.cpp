@@ -29,6 +29,7 @@
 #include "LAVSplitterSettingsInternal.h"
 
 #include "moreuuids.h"
+#include "timer.h"
 
 extern "C" {
 typedef struct CodecMime{
@@ -54,11 +55,22 @@ AVChapter *avpriv_new_chapter(AVFormatContext *s, int id, AVRational time_base,
 
 #define AVFORMAT_OPEN_TIMEOUT 20
 
+// Stream probing limits of the low-latency live mode (in us and bytes)
+#define LIVE_ANALYZE_DURATION 100000
+#define LIVE_PROBE_SIZE       524288
+
+// Seeking in MPEG-TS/PS files by bisection of the timestamps
+#define TS_SEEK_MAX_PROBES    40
+#define TS_SEEK_PRECISION     (DSHOW_TIME_BASE / 10)  // stop once the timestamps around the target are this close
+#define TS_SEEK_MIN_INTERVAL  (64 << 10)              // or the byte range is this small
+#define TS_SEEK_PREROLL       (DSHOW_TIME_BASE / 2)   // the PCR runs ahead of the PTS of the packets it is sent with
+
 extern void lavf_get_iformat_infos(const AVInputFormat *pFormat, const char **pszName, const char **pszDescription);
+extern AVInputFormat *lavf_sniff_iformat(AVIOContext *pb);
 
 static const AVRational AV_RATIONAL_TIMEBASE = {1, AV_TIME_BASE};
 
-std::set<FormatInfo> CLAVFDemuxer::GetFormatList()
+static std::set<FormatInfo> build_format_list()
 {
   std::set<FormatInfo> formats;
   const AVInputFormat *f = nullptr;
@@ -73,6 +85,13 @@ std::set<FormatInfo> CLAVFDemuxer::GetFormatList()
   return formats;
 }
 
+const std::set<FormatInfo>& CLAVFDemuxer::GetFormatList()
+{
+  // the names and descriptions are static strings of libavformat, so the list never changes
+  static const std::set<FormatInfo> formats = build_format_list();
+  return formats;
+}
+
 CLAVFDemuxer::CLAVFDemuxer(CCritSec *pLock, ILAVFSettingsInternal *settings)
   : CBaseDemuxer(L"lavf demuxer", pLock)
 {
@@ -160,6 +179,10 @@ STDMETHODIMP CLAVFDemuxer::Start()
     }
   }
 
+  // Subtitles may be rendered as soon as playback starts, all embedded fonts need to be available then
+  if (m_pFontInstaller)
+    m_pFontInstaller->WaitForFonts();
+
   if (m_avFormat)
     av_read_play(m_avFormat);
 
@@ -195,6 +218,8 @@ static LPCWSTR wszImageExtensions[] = {
   L".tga",                      // TGA
   L".bmp",                      // BMP
   L".j2c",                      // JPEG2000
+  L".dpx",                      // DPX
+  L".exr",                      // OpenEXR
 };
 
 static LPCWSTR wszBlockedExtensions[] = {
@@ -271,6 +296,7 @@ STDMETHODIMP CLAVFDemuxer::OpenInputStream(AVIOContext *byteContext, LPCOLESTR p
   }
 
   AVIOInterruptCB cb = {avio_interrupt_cb, this};
+  BOOL bSniffed = FALSE;
 
 trynoformat:
   // Create the avformat_context
@@ -308,7 +334,96 @@ trynoformat:
     }
   }
 
+  // Receive udp and rtp streams on a dedicated thread, so the socket is read while the demuxer is busy
+  const BOOL bDatagram = _strnicmp("udp:", fileName, 4) == 0 || _strnicmp("rtp:", fileName, 4) == 0;
+  if (byteContext == nullptr && inputFormat == nullptr && bDatagram && m_pSettings->GetNetworkReceiveBufferLimit()) {
+    if (!m_pUDPIO) {
+      m_pUDPIO = new CUDPReceiveIO();
+      if (FAILED(m_pUDPIO->Open(fileName, m_pSettings->GetNetworkReceiveBufferLimit() << 20, &cb, m_pSettings->GetStreamingThreadPriority()))) {
+        DbgLog((LOG_TRACE, 10, L"::OpenInputStream(): receive thread not available, receiving in the demuxer"));
+        SAFE_DELETE(m_pUDPIO);
+      }
+    }
+
+    if (m_pUDPIO) {
+      m_avFormat->pb = m_pUDPIO->GetAVIOContext();
+      m_avFormat->flags |= AVFMT_FLAG_CUSTOM_IO;
+      // the RTP headers are removed by the receiver
+      if (m_pUDPIO->IsRTP())
+        inputFormat = av_find_input_format("mpegts");
+    }
+  }
+
+  // Access local files through a memory mapping, instead of the file protocol
+  if (byteContext == nullptr && inputFormat == nullptr && pszFileName && m_pSettings->GetMemoryMappedIO()
+    && !PathIsURLW(pszFileName) && !PathIsNetworkPathW(pszFileName)) {
+    if (!m_pMappedIO) {
+      m_pMappedIO = new CMappedFileIO();
+      if (FAILED(m_pMappedIO->Open(pszFileName))) {
+        DbgLog((LOG_TRACE, 10, L"::OpenInputStream(): memory mapping failed, using regular file access"));
+        SAFE_DELETE(m_pMappedIO);
+      }
+    }
+
+    if (m_pMappedIO) {
+      m_avFormat->pb = m_pMappedIO->GetAVIOContext();
+      m_avFormat->flags |= AVFMT_FLAG_CUSTOM_IO;
+      avio_seek(m_avFormat->pb, 0, SEEK_SET);
+    }
+  }
+
+  // Read other files through the shared block cache, to share the reads with other readers of the same file
+  if (byteContext == nullptr && inputFormat == nullptr && m_avFormat->pb == nullptr && pszFileName && m_pSettings->GetSharedBlockCacheLimit()
+    && !PathIsURLW(pszFileName)) {
+    if (!m_pSharedIO) {
+      m_pSharedIO = new CSharedBlockIO();
+      if (FAILED(m_pSharedIO->Open(pszFileName, (size_t)m_pSettings->GetSharedBlockCacheLimit() << 20))) {
+        DbgLog((LOG_TRACE, 10, L"::OpenInputStream(): shared block cache not available, using regular file access"));
+        SAFE_DELETE(m_pSharedIO);
+      }
+    }
+
+    if (m_pSharedIO) {
+      m_avFormat->pb = m_pSharedIO->GetAVIOContext();
+      m_avFormat->flags |= AVFMT_FLAG_CUSTOM_IO;
+      avio_seek(m_avFormat->pb, 0, SEEK_SET);
+    }
+  }
+
+  const BOOL bHTTP = _strnicmp("http:", fileName, 5) == 0 || _strnicmp("https:", fileName, 6) == 0;
+
+  // Prefetch the segments of adaptive streams over several connections
+  // The main playlist is read by avformat as usual, so the segment URLs are known from the start
+  BOOL bSegmentPrefetch = FALSE;
+  if (byteContext == nullptr && m_avFormat->pb == nullptr && bHTTP && m_pSettings->GetSegmentPrefetch() && !m_pSettings->GetLowFootprint()) {
+    if (!m_pSegmentPrefetch)
+      m_pSegmentPrefetch = new CSegmentPrefetch(m_pSettings->GetSegmentPrefetch());
+    m_pSegmentPrefetch->Attach(m_avFormat);
+    bSegmentPrefetch = TRUE;
+  }
+
+  // Access http sources through parallel range requests, instead of one sequential connection
+  // The blocks kept in memory are too much for the low footprint profile, and of no use for small playlists
+  if (byteContext == nullptr && inputFormat == nullptr && m_avFormat->pb == nullptr && m_pSettings->GetHTTPPrefetch() && !m_pSettings->GetLowFootprint()
+    && bHTTP && !(bSegmentPrefetch && CSegmentPrefetch::IsManifestUrl(fileName))) {
+    if (!m_pHTTPIO) {
+      m_pHTTPIO = new CHTTPPrefetchIO();
+      if (FAILED(m_pHTTPIO->Open(fileName, &cb))) {
+        DbgLog((LOG_TRACE, 10, L"::OpenInputStream(): range requests not available, using a sequential connection"));
+        SAFE_DELETE(m_pHTTPIO);
+      }
+    }
+
+    if (m_pHTTPIO) {
+      m_avFormat->pb = m_pHTTPIO->GetAVIOContext();
+      m_avFormat->flags |= AVFMT_FLAG_CUSTOM_IO;
+      avio_seek(m_avFormat->pb, 0, SEEK_SET);
+    }
+  }
+
   // Disable loading of external mkv segments, if required
+  // The linked segments are found and opened by the matroska demuxer of our ffmpeg tree, all of them within
+  // avformat_open_input, and kept open in its virtual timeline. Opening them on demand has to happen there.
   if (!m_pSettings->GetLoadMatroskaExternalSegments())
     m_avFormat->flags |= AVFMT_FLAG_NOEXTERNAL;
 
@@ -318,6 +433,59 @@ trynoformat:
   av_dict_set(&options, "advanced_editlist", "0", 0); // disable broken mov editlist handling
   av_dict_set(&options, "reconnect", "1", 0); // for http, reconnect if we get disconnected
 
+  // a larger socket buffer when libavformat receives udp itself
+  if (bDatagram && !m_pUDPIO)
+    av_dict_set_int(&options, "buffer_size", UDP_SOCKET_BUFFER_MAX, 0);
+
+  // the segments are fetched by the prefetcher, hls must not reuse its connections for them
+  if (bSegmentPrefetch) {
+    av_dict_set(&options, "http_persistent", "0", 0);
+    av_dict_set(&options, "http_multiple", "0", 0);
+  }
+
+  // Play numbered images as a sequence, when the next image exists
+  // image2 opens every image through the io_open callback, so the following ones are read ahead by the prefetcher
+  std::string strSequence;
+  if (byteContext == nullptr && inputFormat != nullptr && inputFormat == av_find_input_format("image2") && m_pSettings->GetImageSequenceFrameRate()) {
+    std::string prefix, suffix;
+    LONGLONG llNumber = 0;
+    int nDigits = 0;
+    if (CImageSequencePrefetch::SplitNumberedName(fileName, prefix, llNumber, nDigits, suffix)) {
+      char number[32];
+      sprintf_s(number, "%0*I64d", nDigits, llNumber + 1);
+      if (avio_check((prefix + number + suffix).c_str(), AVIO_FLAG_READ) > 0) {
+        // the pattern of image2, with a literal % escaped
+        auto escape = [](const std::string &str) {
+          std::string escaped;
+          for (const char c : str) {
+            if (c == '%')
+              escaped += '%';
+            escaped += c;
+          }
+          return escaped;
+        };
+        strSequence = escape(prefix) + "%0" + std::to_string(nDigits) + "d" + escape(suffix);
+
+        av_dict_set(&options, "pattern_type", "sequence", 0);
+        av_dict_set_int(&options, "start_number", llNumber, 0);
+        char framerate[32];
+        sprintf_s(framerate, "%u/1000", m_pSettings->GetImageSequenceFrameRate());
+        av_dict_set(&options, "framerate", framerate, 0);
+
+        if (!m_pSettings->GetLowFootprint()) {
+          if (!m_pImagePrefetch)
+            m_pImagePrefetch = new CImageSequencePrefetch();
+          m_pImagePrefetch->Attach(m_avFormat);
+        }
+        DbgLog((LOG_TRACE, 10, TEXT("::OpenInputStream(): playing image sequence '%S' from %I64d"), strSequence.c_str(), llNumber));
+      }
+    }
+  }
+
+  // low-latency live mode, don't hold back packets to reorder RTP
+  if (m_pSettings->GetLowLatencyLiveMode() && pszFileName && PathIsURLW(pszFileName) && !UrlIsFileUrlW(pszFileName))
+    av_dict_set(&options, "max_delay", "0", 0);
+
   if (rtsp_transport != nullptr) {
     av_dict_set(&options, "rtsp_transport", rtsp_transport, 0);
   }
@@ -360,15 +528,25 @@ trynoformat:
     }
   }
 
+  // Decide common containers by their signature, instead of probing all demuxers
+  if (inputFormat == nullptr && !bSniffed && m_avFormat->pb && (m_avFormat->pb->seekable & AVIO_SEEKABLE_NORMAL)) {
+    inputFormat = lavf_sniff_iformat(m_avFormat->pb);
+    bSniffed = (inputFormat != nullptr);
+    if (bSniffed)
+      DbgLog((LOG_TRACE, 10, TEXT("::OpenInputStream(): format '%S' detected by its signature"), inputFormat->name));
+  }
+
   m_timeOpening = time(nullptr);
-  ret = avformat_open_input(&m_avFormat, fileName, inputFormat, &options);
+  ret = avformat_open_input(&m_avFormat, strSequence.empty() ? fileName : strSequence.c_str(), inputFormat, &options);
   av_dict_free(&options);
   if (ret < 0) {
     DbgLog((LOG_ERROR, 0, TEXT("::OpenInputStream(): avformat_open_input failed (%d)"), ret));
-    if (format) {
+    if (format || (bSniffed && inputFormat)) {
       DbgLog((LOG_ERROR, 0, TEXT(" -> trying again without specific format")));
       format = nullptr;
       avformat_close_input(&m_avFormat);
+      if (byteContext)
+        avio_seek(byteContext, 0, SEEK_SET);
       goto trynoformat;
     }
     goto done;
@@ -590,9 +768,21 @@ STDMETHODIMP CLAVFDemuxer::InitAVFormat(LPCOLESTR pszFileName, BOOL bForce)
     }
   }
 
+  const BOOL bNetworkStream = (m_avFormat->flags & AVFMT_FLAG_NETWORK || (m_avFormat->flags & AVFMT_FLAG_CUSTOM_IO && !m_avFormat->pb->seekable));
+  m_bLiveStream = bNetworkStream && m_pSettings->GetLowLatencyLiveMode();
+  // network streams which can't be seeked are delivered in real-time by the sender
+  m_bRealTimeStream = bNetworkStream && (!m_avFormat->pb || !m_avFormat->pb->seekable);
+
   // TODO: make both durations below configurable
   // decrease analyze duration for network streams
-  if (m_avFormat->flags & AVFMT_FLAG_NETWORK || (m_avFormat->flags & AVFMT_FLAG_CUSTOM_IO && !m_avFormat->pb->seekable)) {
+  if (m_bLiveStream) {
+    // only probe until the codec parameters are known, and don't keep the probed packets around
+    DbgLog((LOG_TRACE, 10, TEXT("::InitAVFormat(): using low-latency live mode")));
+    av_opt_set_int(m_avFormat, "analyzeduration", LIVE_ANALYZE_DURATION, 0);
+    av_opt_set_int(m_avFormat, "probesize", LIVE_PROBE_SIZE, 0);
+    av_opt_set_int(m_avFormat, "fpsprobesize", 0, 0);
+    m_avFormat->flags |= AVFMT_FLAG_NOBUFFER;
+  } else if (bNetworkStream) {
     // require at least 0.2 seconds
     av_opt_set_int(m_avFormat, "analyzeduration", max(m_pSettings->GetNetworkStreamAnalysisDuration() * 1000, 200000), 0);
   } else {
@@ -601,6 +791,9 @@ STDMETHODIMP CLAVFDemuxer::InitAVFormat(LPCOLESTR pszFileName, BOOL bForce)
     if (m_bMPEGTS || m_bMPEGPS) {
       av_opt_set_int(m_avFormat, "analyzeduration", 30000000, 0);
       av_opt_set_int(m_avFormat, "probesize", 75000000, 0);
+      // the duration is estimated in the background instead, see InitDurationEstimator
+      if (pszFileName && !m_pBluRay && !PathIsURLW(pszFileName))
+        av_opt_set_int(m_avFormat, "skip_estimate_duration_from_pts", 1, 0);
     }
   }
 
@@ -610,12 +803,22 @@ STDMETHODIMP CLAVFDemuxer::InitAVFormat(LPCOLESTR pszFileName, BOOL bForce)
   m_avFormat->flags |= AVFMT_FLAG_KEEP_SIDE_DATA;
 
   m_timeOpening = time(nullptr);
-  int ret = avformat_find_stream_info(m_avFormat, nullptr);
-  if (ret < 0) {
-    DbgLog((LOG_ERROR, 0, TEXT("::InitAVFormat(): av_find_stream_info failed (%d)"), ret));
-    goto done;
+  InitProbeCache(pszFileName);
+  if (m_pProbeCache && m_pProbeCache->Restore(m_avFormat) == S_OK) {
+    DbgLog((LOG_TRACE, 10, TEXT("::InitAVFormat(): Restored stream layout from the probe cache, skipping avformat_find_stream_info")));
+  } else {
+    int ret = avformat_find_stream_info(m_avFormat, nullptr);
+    if (ret < 0) {
+      DbgLog((LOG_ERROR, 0, TEXT("::InitAVFormat(): av_find_stream_info failed (%d)"), ret));
+      goto done;
+    }
+    DbgLog((LOG_TRACE, 10, TEXT("::InitAVFormat(): avformat_find_stream_info finished, took %I64d seconds"), time(nullptr) - m_timeOpening));
+
+    if (m_pProbeCache) {
+      m_pProbeCache->Store(m_avFormat);
+      SAFE_DELETE(m_pProbeCache);
+    }
   }
-  DbgLog((LOG_TRACE, 10, TEXT("::InitAVFormat(): avformat_find_stream_info finished, took %I64d seconds"), time(nullptr) - m_timeOpening));
   m_timeOpening = 0;
 
   // Check if this is a m2ts in a BD structure, and if it is, read some extra stream properties out of the CLPI files
@@ -721,7 +924,8 @@ STDMETHODIMP CLAVFDemuxer::InitAVFormat(LPCOLESTR pszFileName, BOOL bForce)
         if (!m_pFontInstaller) {
           m_pFontInstaller = new CFontInstaller();
         }
-        m_pFontInstaller->InstallFont(st->codecpar->extradata, st->codecpar->extradata_size);
+        // fonts are only needed once subtitles are rendered, don't hold up opening the file
+        m_pFontInstaller->InstallFontAsync(st->codecpar->extradata, st->codecpar->extradata_size);
       }
     } else if (st->disposition & AV_DISPOSITION_ATTACHED_PIC && st->attached_pic.data && st->attached_pic.size > 0) {
       LPWSTR chFilename = nullptr;
@@ -795,6 +999,9 @@ STDMETHODIMP CLAVFDemuxer::InitAVFormat(LPCOLESTR pszFileName, BOOL bForce)
     }
   }
 
+  InitKeyFrameIndex(pszFileName);
+  InitDurationEstimator(pszFileName);
+
   CHECK_HR(hr = CreateStreams());
 
   return S_OK;
@@ -803,6 +1010,82 @@ done:
   return E_FAIL;
 }
 
+void CLAVFDemuxer::InitKeyFrameIndex(LPCOLESTR pszFileName)
+{
+  if (!pszFileName || !m_pSettings->GetKeyFrameIndexCache() || m_pBluRay || PathIsURLW(pszFileName))
+    return;
+
+  if ((m_avFormat->flags & AVFMT_FLAG_NETWORK) || !m_avFormat->pb || !m_avFormat->pb->seekable)
+    return;
+
+  // Only containers without an index of their own benefit from it
+  // The cues of matroska files are read by the demuxer of our ffmpeg tree within avformat_open_input already, so
+  // an index built from them here would not save the reads at the end of the file.
+  BOOL bHasIndex = FALSE;
+  for (unsigned i = 0; i < m_avFormat->nb_streams; i++) {
+    AVStream *st = m_avFormat->streams[i];
+    if (st->codecpar->codec_type == AVMEDIA_TYPE_VIDEO && st->nb_index_entries > 0)
+      bHasIndex = TRUE;
+  }
+
+  if (!m_bMPEGTS && !m_bMPEGPS && bHasIndex)
+    return;
+
+  m_pKeyFrameIndex = new CKeyFrameIndex();
+  if (FAILED(m_pKeyFrameIndex->Open(pszFileName))) {
+    SAFE_DELETE(m_pKeyFrameIndex);
+    return;
+  }
+
+  m_bKeyFrameIndexContiguous = TRUE;
+}
+
+void CLAVFDemuxer::InitProbeCache(LPCOLESTR pszFileName)
+{
+  if (!pszFileName || !m_pSettings->GetFastOpen() || m_pBluRay || PathIsURLW(pszFileName))
+    return;
+
+  // The cache is only valid for complete, local files
+  if ((m_avFormat->flags & AVFMT_FLAG_NETWORK) || !m_avFormat->pb || !m_avFormat->pb->seekable)
+    return;
+
+  m_pProbeCache = new CProbeCache();
+  if (FAILED(m_pProbeCache->Open(pszFileName))) {
+    SAFE_DELETE(m_pProbeCache);
+  }
+}
+
+void CLAVFDemuxer::InitDurationEstimator(LPCOLESTR pszFileName)
+{
+  if (!pszFileName || m_pBluRay || PathIsURLW(pszFileName))
+    return;
+
+  if ((m_avFormat->flags & AVFMT_FLAG_NETWORK) || !m_avFormat->pb || !m_avFormat->pb->seekable)
+    return;
+
+  // Raw audio files without a duration in their header, estimated from the bitrate by lavf
+  BOOL bRawAudio = m_avFormat->duration_estimation_method == AVFMT_DURATION_FROM_BITRATE && m_avFormat->nb_streams == 1
+                && m_avFormat->streams[0]->codecpar->codec_type == AVMEDIA_TYPE_AUDIO;
+  if (!m_bMPEGTS && !m_bMPEGPS && !bRawAudio)
+    return;
+
+  int idx = av_find_best_stream(m_avFormat, AVMEDIA_TYPE_VIDEO, -1, -1, nullptr, 0);
+  if (idx < 0)
+    idx = av_find_best_stream(m_avFormat, AVMEDIA_TYPE_AUDIO, -1, -1, nullptr, 0);
+  if (idx < 0)
+    return;
+
+  char *fileName = CoTaskGetMultiByteFromWideChar(CP_UTF8, 0, pszFileName, -1);
+  if (!fileName)
+    return;
+
+  m_pDurationEstimator = new CDurationEstimator();
+  if (FAILED(m_pDurationEstimator->Start(fileName, m_avFormat->iformat, m_avFormat->streams[idx]->id, bRawAudio))) {
+    SAFE_DELETE(m_pDurationEstimator);
+  }
+  SAFE_CO_FREE(fileName);
+}
+
 void CLAVFDemuxer::CleanupAVFormat()
 {
   FlushMVCExtensionQueue();
@@ -811,6 +1094,15 @@ void CLAVFDemuxer::CleanupAVFormat()
     AbortOpening(1, 5);
     avformat_close_input(&m_avFormat);
   }
+  SAFE_DELETE(m_pDurationEstimator);
+  SAFE_DELETE(m_pSegmentPrefetch);
+  SAFE_DELETE(m_pImagePrefetch);
+  SAFE_DELETE(m_pUDPIO);
+  SAFE_DELETE(m_pMappedIO);
+  SAFE_DELETE(m_pHTTPIO);
+  SAFE_DELETE(m_pSharedIO);
+  SAFE_DELETE(m_pKeyFrameIndex);
+  SAFE_DELETE(m_pProbeCache);
   SAFE_CO_FREE(m_stOrigParser);
 }
 
@@ -850,6 +1142,28 @@ HRESULT CLAVFDemuxer::SetActiveStream(StreamType type, int pid)
       m_ForcedSubStream = subst->pid;
   }
 
+  UpdateStreamDiscard();
+
+  return hr;
+}
+
+void CLAVFDemuxer::SetOutputConnected(StreamType type, BOOL bConnected)
+{
+  // the video stream is always read, seeking and the key-frame index rely on it
+  if (type == video || type >= unknown || m_bOutputConnected[type] == bConnected)
+    return;
+
+  DbgLog((LOG_TRACE, 10, L"CLAVFDemuxer::SetOutputConnected(): %s output %s", CStreamList::ToStringW(type), bConnected ? L"connected" : L"not connected, skipping its streams"));
+  m_bOutputConnected[type] = bConnected;
+  UpdateStreamDiscard();
+}
+
+// Let libavformat skip all streams which are not delivered, before any packet is created for them
+void CLAVFDemuxer::UpdateStreamDiscard()
+{
+  const BOOL bAudio = m_bOutputConnected[audio];
+  const BOOL bSubpic = m_bOutputConnected[subpic];
+
   for(unsigned int idx = 0; idx < m_avFormat->nb_streams; ++idx) {
     AVStream *st = m_avFormat->streams[idx];
     if (st->codecpar->codec_type == AVMEDIA_TYPE_VIDEO) {
@@ -859,7 +1173,7 @@ HRESULT CLAVFDemuxer::SetActiveStream(StreamType type, int pid)
       if (m_bH264MVCCombine && st->codecpar->codec_id == AV_CODEC_ID_H264_MVC)
         st->discard = AVDISCARD_DEFAULT;
     } else if (st->codecpar->codec_type == AVMEDIA_TYPE_AUDIO) {
-      st->discard = (m_dActiveStreams[audio] == idx) ? AVDISCARD_DEFAULT : AVDISCARD_ALL;
+      st->discard = (bAudio && m_dActiveStreams[audio] == idx) ? AVDISCARD_DEFAULT : AVDISCARD_ALL;
       // If the stream is a sub stream, make sure to activate the main stream as well
       if (m_bMPEGTS && (st->disposition & LAVF_DISPOSITION_SUB_STREAM) && st->discard == AVDISCARD_DEFAULT) {
         for(unsigned int idx2 = 0; idx2 < m_avFormat->nb_streams; ++idx2) {
@@ -871,13 +1185,11 @@ HRESULT CLAVFDemuxer::SetActiveStream(StreamType type, int pid)
         }
       }
     } else if (st->codecpar->codec_type == AVMEDIA_TYPE_SUBTITLE) {
-      st->discard = (m_dActiveStreams[subpic] == idx || (m_dActiveStreams[subpic] == FORCED_SUBTITLE_PID && m_ForcedSubStream == idx)) ? AVDISCARD_DEFAULT : AVDISCARD_ALL;
+      st->discard = (bSubpic && (m_dActiveStreams[subpic] == idx || (m_dActiveStreams[subpic] == FORCED_SUBTITLE_PID && m_ForcedSubStream == idx))) ? AVDISCARD_DEFAULT : AVDISCARD_ALL;
     } else {
       st->discard = AVDISCARD_ALL;
     }
   }
-
-  return hr;
 }
 
 void CLAVFDemuxer::UpdateSubStreams()
@@ -987,6 +1299,9 @@ void CLAVFDemuxer::SettingsChanged(ILAVFSettingsInternal *pSettings)
 
 REFERENCE_TIME CLAVFDemuxer::GetDuration() const
 {
+  if (m_pDurationEstimator && m_pDurationEstimator->GetDuration() > 0)
+    return m_pDurationEstimator->GetDuration();
+
   int64_t iLength = 0;
   if (m_avFormat->duration == (int64_t)AV_NOPTS_VALUE || m_avFormat->duration < 0LL) {
     // no duration is available for us
@@ -1212,12 +1527,20 @@ STDMETHODIMP CLAVFDemuxer::GetNextPacket(Packet **ppPacket)
     // ignore..
   }
 
+  // All reads of the source, through the input pin or any of the custom and network IO contexts, return on this thread
+  // inside av_read_frame, so the packet was complete once it returned
+  const REFERENCE_TIME rtCapture = timer_get_ref_time();
+
   if (result == AVERROR(EINTR) || result == AVERROR(EAGAIN))
   {
     // timeout, probably no real error, return empty packet
     bReturnEmpty = true;
   } else if (result == AVERROR_EOF) {
     DbgLog((LOG_TRACE, 10, L"::GetNextPacket(): End of File reached"));
+
+    // The whole file was read without seeking, so the index saw every key-frame
+    if (m_pKeyFrameIndex && m_bKeyFrameIndexContiguous)
+      m_pKeyFrameIndex->SetComplete();
   } else if (result < 0) {
     // meh, fail
   } else if (pkt.size <= 0 || pkt.stream_index < 0 || (unsigned)pkt.stream_index >= m_avFormat->nb_streams) {
@@ -1227,6 +1550,10 @@ STDMETHODIMP CLAVFDemuxer::GetNextPacket(Packet **ppPacket)
     }
     av_packet_unref(&pkt);
   } else {
+    // Check the first packets against a stream layout restored from the probe cache
+    if (m_pProbeCache && m_pProbeCache->Validate(m_avFormat, &pkt) == S_FALSE)
+      SAFE_DELETE(m_pProbeCache);
+
     // Check right here if the stream is active, we can drop the package otherwise.
     AVStream *stream = m_avFormat->streams[pkt.stream_index];
     BOOL streamActive = FALSE;
@@ -1252,7 +1579,7 @@ STDMETHODIMP CLAVFDemuxer::GetNextPacket(Packet **ppPacket)
       return S_FALSE;
     }
 
-    pPacket = new Packet();
+    pPacket = m_pPacketPool->Acquire();
     if (!pPacket)
       return E_OUTOFMEMORY;
 
@@ -1265,6 +1592,7 @@ STDMETHODIMP CLAVFDemuxer::GetNextPacket(Packet **ppPacket)
     pPacket->rtDTS = dts;
     pPacket->StreamId = (DWORD)pkt.stream_index;
     pPacket->bPosition = pkt.pos;
+    pPacket->rtCapture = rtCapture;
 
     if (stream->codecpar->codec_id == AV_CODEC_ID_H264) {
       if (m_bMatroska || m_bOgg) {
@@ -1327,7 +1655,7 @@ STDMETHODIMP CLAVFDemuxer::GetNextPacket(Packet **ppPacket)
     }
 
     // Mark the packet as parsed, so the forced subtitle parser doesn't hit it
-    if (stream->codecpar->codec_id == AV_CODEC_ID_HDMV_PGS_SUBTITLE && m_bPGSNoParsing) {
+    if ((stream->codecpar->codec_id == AV_CODEC_ID_HDMV_PGS_SUBTITLE || stream->codecpar->codec_id == AV_CODEC_ID_DVD_SUBTITLE) && m_bPGSNoParsing) {
       pPacket->dwFlags |= LAV_PACKET_PARSED;
     }
 
@@ -1366,6 +1694,10 @@ STDMETHODIMP CLAVFDemuxer::GetNextPacket(Packet **ppPacket)
     }
 
     pPacket->bSyncPoint = pkt.flags & AV_PKT_FLAG_KEY;
+
+    if (m_pKeyFrameIndex && pPacket->bSyncPoint && pkt.stream_index == m_dActiveStreams[video] && rt != Packet::INVALID_TIME)
+      m_pKeyFrameIndex->Add(stream->id, rt, pkt.pos);
+
     pPacket->bDiscontinuity = !m_pBluRay && (pkt.flags & AV_PKT_FLAG_CORRUPT);
 #ifdef DEBUG
     if (pkt.flags & AV_PKT_FLAG_CORRUPT)
@@ -1478,6 +1810,24 @@ STDMETHODIMP CLAVFDemuxer::Seek(REFERENCE_TIME rTime)
 {
   int seekStreamId = m_dActiveStreams[video];
   int64_t seek_pts = 0;
+
+  if (m_pKeyFrameIndex) {
+    m_bKeyFrameIndexContiguous = (rTime <= 0);
+
+    // Jump straight to the key-frame position from the index
+    int64_t pos = 0;
+    if (rTime > 0 && seekStreamId != -1 && m_pKeyFrameIndex->Find(m_avFormat->streams[seekStreamId]->id, rTime, &pos)) {
+      DbgLog((LOG_TRACE, 10, L"::Seek() -- Using cached key-frame at byte position %I64d", pos));
+      return SeekByte(pos, AVSEEK_FLAG_BACKWARD);
+    }
+  }
+
+  if (rTime > 0 && (m_bMPEGTS || m_bMPEGPS)) {
+    int streamIndex = (seekStreamId != -1) ? seekStreamId : m_dActiveStreams[audio];
+    if (streamIndex != -1 && SeekByTimestampBisection(streamIndex, rTime) == S_OK)
+      return S_OK;
+  }
+
 retry:
   // If we have a video stream, seek on that one. If we don't, well, then don't!
   if (rTime > 0) {
@@ -1528,6 +1878,82 @@ retry:
   return S_OK;
 }
 
+BOOL CLAVFDemuxer::ProbeTimestamp(int streamIndex, int64_t pos, int64_t pos_limit, KeyFrameIndexPoint *pPoint)
+{
+  AVStream *st = m_avFormat->streams[streamIndex];
+
+  int64_t ts_pos = pos;
+  int64_t ts = m_avFormat->iformat->read_timestamp(m_avFormat, streamIndex, &ts_pos, pos_limit);
+  if (ts == AV_NOPTS_VALUE || ts_pos < pos || ts_pos >= pos_limit)
+    return FALSE;
+
+  // Undo a wrap-around of the timestamps after the start of the file
+  if (st->pts_wrap_bits < 64 && m_avFormat->start_time != AV_NOPTS_VALUE) {
+    int64_t start = av_rescale_q(m_avFormat->start_time, AV_TIME_BASE_Q, st->time_base);
+    if (ts < start - (1LL << (st->pts_wrap_bits - 1)))
+      ts += 1LL << st->pts_wrap_bits;
+  }
+
+  pPoint->rt = ConvertTimestampToRT(ts, st->time_base.num, st->time_base.den);
+  pPoint->pos = ts_pos;
+
+  if (m_pKeyFrameIndex)
+    m_pKeyFrameIndex->AddProbe(pPoint->rt, pPoint->pos);
+
+  return TRUE;
+}
+
+// Seek in MPEG-TS/PS files without an index by sampling the timestamps at byte positions
+// The byte range around the target is narrowed with the known key-frames and earlier probes, and then by
+// interpolating the position of the target, falling back to bisection when interpolation converges slowly.
+HRESULT CLAVFDemuxer::SeekByTimestampBisection(int streamIndex, REFERENCE_TIME rTime)
+{
+  if (m_pBluRay || !m_avFormat->iformat->read_timestamp || !m_avFormat->pb || !m_avFormat->pb->seekable || (m_avFormat->flags & AVFMT_FLAG_NETWORK))
+    return E_NOTIMPL;
+
+  int64_t size = avio_size(m_avFormat->pb);
+  REFERENCE_TIME rtDuration = GetDuration();
+  if (size <= 0 || rtDuration <= 0)
+    return E_FAIL;
+
+  REFERENCE_TIME rtTarget = max(rTime - TS_SEEK_PREROLL, 0LL);
+
+  KeyFrameIndexPoint lo = { 0, 0 };
+  KeyFrameIndexPoint hi = { rtDuration, size };
+  if (m_pKeyFrameIndex)
+    m_pKeyFrameIndex->GetBracket(rtTarget, lo, hi);
+
+  int nProbes = 0;
+  BOOL bBisect = FALSE;
+  while ((hi.rt - lo.rt) > TS_SEEK_PRECISION && (hi.pos - lo.pos) > TS_SEEK_MIN_INTERVAL && nProbes < TS_SEEK_MAX_PROBES) {
+    int64_t span = hi.pos - lo.pos;
+    int64_t pos = lo.pos + span / 2;
+    if (!bBisect && hi.rt > lo.rt) {
+      pos = lo.pos + av_rescale(rtTarget - lo.rt, span, hi.rt - lo.rt);
+      // Keep away from the edges, every probe has to shrink the range
+      pos = av_clip64(pos, lo.pos + span / 16, hi.pos - span / 16);
+    }
+
+    KeyFrameIndexPoint point;
+    nProbes++;
+    if (!ProbeTimestamp(streamIndex, pos, hi.pos, &point)) {
+      // No timestamps from pos to the end of the range
+      hi.pos = pos;
+    } else if (point.rt <= rtTarget) {
+      lo = point;
+    } else {
+      // The first timestamp after pos is past the target, so is everything after pos
+      hi = { point.rt, pos };
+    }
+
+    bBisect = (hi.pos - lo.pos) > span / 2;
+  }
+
+  DbgLog((LOG_TRACE, 10, L"::SeekByTimestampBisection() -- Target %I64d found at byte position %I64d (%I64d) after %d probes", rtTarget, lo.pos, lo.rt, nProbes));
+
+  return SeekByte(lo.pos, AVSEEK_FLAG_BACKWARD);
+}
+
 STDMETHODIMP CLAVFDemuxer::SeekByte(int64_t pos, int flags)
 {
   int ret = av_seek_frame(m_avFormat, -1, pos, flags | AVSEEK_FLAG_BYTE);
@@ -1643,10 +2069,26 @@ STDMETHODIMP CLAVFDemuxer::GetMarkerName(long MarkerNum, BSTR* pbstrMarkerName)
 
 /////////////////////////////////////////////////////////////////////////////
 // IKeyFrameInfo
+const CKeyFrameIndex *CLAVFDemuxer::GetCompleteKeyFrameIndex() const
+{
+  if (!m_pKeyFrameIndex || !m_pKeyFrameIndex->IsComplete() || m_dActiveStreams[video] < 0)
+    return nullptr;
+
+  if (m_avFormat->streams[m_dActiveStreams[video]]->id != m_pKeyFrameIndex->GetStreamId())
+    return nullptr;
+
+  return m_pKeyFrameIndex;
+}
+
 STDMETHODIMP CLAVFDemuxer::GetKeyFrameCount(UINT& nKFs)
 {
   if(m_dActiveStreams[video] < 0) { return E_NOTIMPL; }
 
+  if (const CKeyFrameIndex *pIndex = GetCompleteKeyFrameIndex()) {
+    nKFs = (UINT)pIndex->GetEntries().size();
+    return S_OK;
+  }
+
   if (!m_bMatroska && !m_bAVI && !m_bMP4) {
     return E_FAIL;
   }
@@ -1675,6 +2117,17 @@ STDMETHODIMP CLAVFDemuxer::GetKeyFrames(const GUID* pFormat, REFERENCE_TIME* pKF
 
   if(m_dActiveStreams[video] < 0) { return E_NOTIMPL; }
 
+  if (const CKeyFrameIndex *pIndex = GetCompleteKeyFrameIndex()) {
+    if(*pFormat != TIME_FORMAT_MEDIA_TIME) return E_INVALIDARG;
+
+    UINT nKFsMax = nKFs;
+    nKFs = 0;
+    for (auto it = pIndex->GetEntries().begin(); it != pIndex->GetEntries().end() && nKFs < nKFsMax; it++) {
+      pKFs[nKFs++] = it->first;
+    }
+    return S_OK;
+  }
+
   if (!m_bMatroska && !m_bAVI && !m_bMP4) {
     return E_FAIL;
   }
@@ -2539,6 +2992,10 @@ STDMETHODIMP_(DWORD) CLAVFDemuxer::GetStreamFlags(DWORD dwStream)
   if (m_avFormat->flags & AVFMT_FLAG_NETWORK)
     dwFlags |= LAV_STREAM_FLAG_LIVE;
 
+  // The full parser of libavformat splits the stream into complete frames, the decoder doesn't need to parse it again
+  if (st->codecpar->codec_type == AVMEDIA_TYPE_VIDEO && (st->need_parsing == AVSTREAM_PARSE_FULL || st->need_parsing == AVSTREAM_PARSE_FULL_RAW) && !(m_avFormat->flags & AVFMT_FLAG_NOPARSE))
+    dwFlags |= LAV_STREAM_FLAG_PARSED;
+
   return dwFlags;
 }
 
@@ -29,6 +29,15 @@
 #include "ITrackInfo.h"
 #include "FontInstaller.h"
 #include "DSMResourceBag.h"
+#include "MappedFileIO.h"
+#include "SharedBlockCache.h"
+#include "HTTPPrefetchIO.h"
+#include "SegmentPrefetch.h"
+#include "ImageSequencePrefetch.h"
+#include "UDPReceiveIO.h"
+#include "KeyFrameIndex.h"
+#include "DurationEstimator.h"
+#include "ProbeCache.h"
 
 #define SUBMODE_FORCED_PGS_ONLY 0xFF
 
@@ -42,7 +51,8 @@ public:
   CLAVFDemuxer(CCritSec *pLock, ILAVFSettingsInternal *settings);
   ~CLAVFDemuxer();
 
-  static std::set<FormatInfo> GetFormatList();
+  // List of the libavformat input formats, built once per process
+  static const std::set<FormatInfo>& GetFormatList();
 
   // IUnknown
   DECLARE_IUNKNOWN
@@ -59,11 +69,12 @@ public:
   STDMETHODIMP Start();
   STDMETHODIMP AbortOpening(int mode = 1, int timeout = 0);
   REFERENCE_TIME GetDuration() const;
+  BOOL CheckDurationChanged() { return m_pDurationEstimator && m_pDurationEstimator->CheckChanged(); }
   STDMETHODIMP GetNextPacket(Packet **ppPacket);
   STDMETHODIMP Seek(REFERENCE_TIME rTime);
   STDMETHODIMP Reset();
   const char *GetContainerFormat() const;
-  virtual DWORD GetContainerFlags() { return m_bTSDiscont ? LAVFMT_TS_DISCONT : 0; }
+  virtual DWORD GetContainerFlags() { return (m_bTSDiscont ? LAVFMT_TS_DISCONT : 0) | (m_bLiveStream ? LAVFMT_LIVE : 0) | (m_bRealTimeStream ? LAVFMT_REALTIME : 0); }
 
   STDMETHODIMP SetTitle(int idx);
   STDMETHODIMP_(int) GetTitle();
@@ -72,6 +83,9 @@ public:
 
   void SettingsChanged(ILAVFSettingsInternal *pSettings);
 
+  STDMETHODIMP GetNetworkStatistics(LAVFNetworkStatistics *pStats) { if (!m_pUDPIO) return E_NOTIMPL; m_pUDPIO->GetStatistics(pStats); return S_OK; }
+  void ResetNetworkStatistics() { if (m_pUDPIO) m_pUDPIO->ResetStatistics(); }
+
   // Select the best video stream
   const stream* SelectVideoStream();
   // Select the best audio stream
@@ -80,6 +94,7 @@ public:
   const stream* SelectSubtitleStream(std::list<CSubtitleSelector> subtitleSelectors, std::string audioLanguage);
 
   HRESULT SetActiveStream(StreamType type, int pid);
+  void SetOutputConnected(StreamType type, BOOL bConnected);
 
   STDMETHODIMP_(DWORD) GetStreamFlags(DWORD dwStream);
   STDMETHODIMP_(int) GetPixelFormat(DWORD dwStream);
@@ -138,6 +153,7 @@ public:
 
   AVStream* GetAVStreamByPID(int pid);
   void UpdateSubStreams();
+  void UpdateStreamDiscard();
   unsigned int GetNumStreams() const { return m_avFormat->nb_streams; }
 
   REFERENCE_TIME GetStartTime() const;
@@ -149,6 +165,12 @@ private:
   STDMETHODIMP AddStream(int streamId);
   STDMETHODIMP CreateStreams();
   STDMETHODIMP InitAVFormat(LPCOLESTR pszFileName, BOOL bForce);
+  void InitKeyFrameIndex(LPCOLESTR pszFileName);
+  void InitProbeCache(LPCOLESTR pszFileName);
+  void InitDurationEstimator(LPCOLESTR pszFileName);
+  const CKeyFrameIndex *GetCompleteKeyFrameIndex() const;
+  HRESULT SeekByTimestampBisection(int streamIndex, REFERENCE_TIME rTime);
+  BOOL ProbeTimestamp(int streamIndex, int64_t pos, int64_t pos_limit, KeyFrameIndexPoint *pPoint);
   void CleanupAVFormat();
   void UpdateParserFlags(AVStream *st);
 
@@ -186,6 +208,8 @@ private:
   BOOL m_bMP4                        = FALSE;
 
   BOOL m_bTSDiscont                  = FALSE;
+  BOOL m_bLiveStream                 = FALSE;
+  BOOL m_bRealTimeStream             = FALSE;
   BOOL m_bSubStreams                 = FALSE;
   BOOL m_bVC1Correction              = FALSE;
   BOOL m_bVC1SeenTimestamp           = FALSE;
@@ -197,6 +221,7 @@ private:
   std::deque<Packet *> m_MVCExtensionQueue;
 
   int m_ForcedSubStream              = -1;
+  BOOL m_bOutputConnected[unknown]   = { TRUE, TRUE, TRUE };
   unsigned int m_program             = 0;
 
   REFERENCE_TIME m_rtCurrent         = 0;
@@ -204,6 +229,16 @@ private:
   AVStreamParseType *m_stOrigParser  = nullptr;
 
   CFontInstaller *m_pFontInstaller   = nullptr;
+  CMappedFileIO *m_pMappedIO         = nullptr;
+  CHTTPPrefetchIO *m_pHTTPIO         = nullptr;
+  CSegmentPrefetch *m_pSegmentPrefetch = nullptr;
+  CImageSequencePrefetch *m_pImagePrefetch = nullptr;
+  CUDPReceiveIO *m_pUDPIO            = nullptr;
+  CSharedBlockIO *m_pSharedIO        = nullptr;
+  CKeyFrameIndex *m_pKeyFrameIndex   = nullptr;
+  BOOL m_bKeyFrameIndexContiguous    = FALSE;
+  CProbeCache *m_pProbeCache         = nullptr;
+  CDurationEstimator *m_pDurationEstimator = nullptr;
   ILAVFSettingsInternal *m_pSettings = nullptr;
 
   BOOL m_bEnableTrackInfo            = TRUE;
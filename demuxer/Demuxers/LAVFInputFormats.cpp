@@ -99,3 +99,44 @@ void lavf_get_iformat_infos(const AVInputFormat *pFormat, const char **pszName,
   if (pszDescription)
     *pszDescription = desc;
 }
+
+#define LAVF_SNIFF_SIZE 1024
+#define TS_SYNC_COUNT   5
+
+// Count the MPEG-TS sync bytes at the given offset and packet stride
+static BOOL lavf_sniff_ts(const uint8_t *buf, int size, int offset, int stride)
+{
+  if (offset + (TS_SYNC_COUNT - 1) * stride >= size)
+    return FALSE;
+  for (int i = 0; i < TS_SYNC_COUNT; i++) {
+    if (buf[offset + i * stride] != 0x47)
+      return FALSE;
+  }
+  return TRUE;
+}
+
+// Pick the format of common containers from their signature, so they don't need to be probed by all demuxers
+// Returns nullptr if the signature is not unambiguous, the position of the context is left unchanged.
+AVInputFormat *lavf_sniff_iformat(AVIOContext *pb)
+{
+  uint8_t buf[LAVF_SNIFF_SIZE];
+  int64_t pos = avio_tell(pb);
+  int size = avio_read(pb, buf, sizeof(buf));
+  if (avio_seek(pb, pos, SEEK_SET) < 0 || size < 16)
+    return nullptr;
+
+  const char *format = nullptr;
+  if (AV_RB32(buf) == 0x1A45DFA3) {
+    format = "matroska";
+  } else if (AV_RL32(buf + 4) == MKTAG('f','t','y','p')) {
+    format = "mov";
+  } else if (AV_RL32(buf) == MKTAG('R','I','F','F') && AV_RL32(buf + 8) == MKTAG('A','V','I',' ')) {
+    format = "avi";
+  } else if (AV_RL32(buf) == MKTAG('O','g','g','S')) {
+    format = "ogg";
+  } else if (lavf_sniff_ts(buf, size, 0, 188) || lavf_sniff_ts(buf, size, 4, 192)) {
+    format = "mpegts";
+  }
+
+  return format ? av_find_input_format(format) : nullptr;
+}
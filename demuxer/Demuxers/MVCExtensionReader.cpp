@@ -0,0 +1,138 @@
+/*
+ *      Copyright (C) 2010-2019 Hendrik Leppkes
+ *      http://www.1f0.de
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program; if not, write to the Free Software Foundation, Inc.,
+ *  51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+
+#include "stdafx.h"
+#include "MVCExtensionReader.h"
+
+CMVCExtensionReader::CMVCExtensionReader(AVFormatContext *avFormat, int streamIndex)
+  : m_avFormat(avFormat)
+  , m_StreamIndex(streamIndex)
+{
+}
+
+CMVCExtensionReader::~CMVCExtensionReader()
+{
+  Stop();
+}
+
+HRESULT CMVCExtensionReader::Start()
+{
+  if (ThreadExists())
+    return S_FALSE;
+
+  m_bEOF = FALSE;
+  m_evQueued.Reset();
+  m_evSpace.Reset();
+
+  if (!Create())
+    return E_FAIL;
+
+  return S_OK;
+}
+
+void CMVCExtensionReader::Stop()
+{
+  if (ThreadExists()) {
+    CallWorker(CMD_EXIT);
+    Close();
+  }
+
+  CAutoLock lock(&m_csQueue);
+  for (AVPacket *pkt : m_queue) {
+    av_packet_free(&pkt);
+  }
+  m_queue.clear();
+}
+
+HRESULT CMVCExtensionReader::GetPacket(AVPacket **ppPacket, DWORD dwTimeout)
+{
+  CheckPointer(ppPacket, E_POINTER);
+
+  for (;;) {
+    {
+      CAutoLock lock(&m_csQueue);
+      if (!m_queue.empty()) {
+        *ppPacket = m_queue.front();
+        m_queue.pop_front();
+        m_evSpace.Set();
+        return S_OK;
+      }
+      if (m_bEOF)
+        return E_FAIL;
+    }
+
+    if (dwTimeout == 0 || !m_evQueued.Wait(dwTimeout))
+      return S_FALSE;
+  }
+}
+
+DWORD CMVCExtensionReader::ThreadProc()
+{
+  SetThreadName(-1, "CBDDemuxer MVC Reader");
+
+  AVPacket *pkt = av_packet_alloc();
+  BOOL bExit = FALSE;
+  while (pkt && !(bExit = CheckRequest(nullptr))) {
+    BOOL bFull = FALSE;
+    {
+      CAutoLock lock(&m_csQueue);
+      bFull = (m_queue.size() >= MVC_READER_MAX_PACKETS);
+    }
+
+    // the base view is behind, wait until it caught up
+    if (bFull) {
+      m_evSpace.Wait(50);
+      continue;
+    }
+
+    int ret = av_read_frame(m_avFormat, pkt);
+    if (ret == AVERROR(EINTR) || ret == AVERROR(EAGAIN)) {
+      continue;
+    } else if (ret < 0) {
+      DbgLog((LOG_TRACE, 10, L"CMVCExtensionReader::ThreadProc(): Reading MVC extension data ended (%d)", ret));
+      break;
+    } else if (pkt->size <= 0 || pkt->stream_index != m_StreamIndex) {
+      av_packet_unref(pkt);
+      continue;
+    }
+
+    {
+      CAutoLock lock(&m_csQueue);
+      m_queue.push_back(pkt);
+    }
+    m_evQueued.Set();
+
+    pkt = av_packet_alloc();
+  }
+  av_packet_free(&pkt);
+
+  {
+    CAutoLock lock(&m_csQueue);
+    m_bEOF = TRUE;
+  }
+  m_evQueued.Set();
+
+  // stay around until asked to exit
+  if (!bExit)
+    GetRequest();
+  Reply(S_OK);
+
+  return 0;
+}
@@ -0,0 +1,62 @@
+/*
+ *      Copyright (C) 2010-2019 Hendrik Leppkes
+ *      http://www.1f0.de
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program; if not, write to the Free Software Foundation, Inc.,
+ *  51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+
+#pragma once
+
+#include <deque>
+
+#define MVC_READER_MAX_PACKETS 256   // packets read ahead of the base view
+#define MVC_READER_TIMEOUT     10000 // ms to wait for the extension packet of a base view packet
+
+// Reads the MVC extension stream of a 3D Blu-ray on its own thread
+// The dependent view is stored in a separate M2TS file. The reader keeps a bounded queue of
+// extension packets read ahead, so the base view demuxing only waits for I/O when the
+// extension packet it needs has not been read yet.
+// The format context is owned by the caller, but must not be accessed while the reader runs.
+class CMVCExtensionReader : protected CAMThread
+{
+public:
+  CMVCExtensionReader(AVFormatContext *avFormat, int streamIndex);
+  ~CMVCExtensionReader();
+
+  HRESULT Start();
+
+  // Stop reading, and drop all queued packets
+  void Stop();
+
+  // Take the next extension packet, waiting at most dwTimeout ms for it to be read
+  // Returns S_FALSE if no packet is available yet, and E_FAIL at the end of the stream
+  HRESULT GetPacket(AVPacket **ppPacket, DWORD dwTimeout);
+
+private:
+  enum {CMD_EXIT};
+  DWORD ThreadProc();
+
+private:
+  AVFormatContext *m_avFormat = nullptr;
+  int m_StreamIndex           = -1;
+
+  CCritSec m_csQueue;
+  std::deque<AVPacket *> m_queue;
+  BOOL m_bEOF = FALSE;
+
+  CAMEvent m_evQueued;
+  CAMEvent m_evSpace;
+};
@@ -0,0 +1,236 @@
+/*
+ *      Copyright (C) 2010-2019 Hendrik Leppkes
+ *      http://www.1f0.de
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program; if not, write to the Free Software Foundation, Inc.,
+ *  51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#include "stdafx.h"
+#include "MappedFileIO.h"
+
+// Mirrors WIN32_MEMORY_RANGE_ENTRY, which is not available when targeting older Windows versions
+typedef struct {
+  PVOID VirtualAddress;
+  SIZE_T NumberOfBytes;
+} LAV_MEMORY_RANGE_ENTRY;
+
+typedef BOOL (WINAPI *PFN_PREFETCHVIRTUALMEMORY)(HANDLE hProcess, ULONG_PTR NumberOfEntries, LAV_MEMORY_RANGE_ENTRY *VirtualAddresses, ULONG Flags);
+
+// I/O errors on a mapped file are raised as exceptions when the page is accessed
+static int CopyMappedData(uint8_t *dst, const BYTE *src, int size)
+{
+  __try {
+    memcpy(dst, src, size);
+  } __except (GetExceptionCode() == EXCEPTION_IN_PAGE_ERROR ? EXCEPTION_EXECUTE_HANDLER : EXCEPTION_CONTINUE_SEARCH) {
+    return AVERROR(EIO);
+  }
+  return size;
+}
+
+CMappedFileIO::CMappedFileIO()
+{
+  SYSTEM_INFO si;
+  GetSystemInfo(&si);
+  m_dwGranularity = si.dwAllocationGranularity;
+
+  HMODULE hKernel32 = GetModuleHandle(L"kernel32.dll");
+  if (hKernel32)
+    m_pfnPrefetchVirtualMemory = GetProcAddress(hKernel32, "PrefetchVirtualMemory");
+}
+
+CMappedFileIO::~CMappedFileIO()
+{
+  Close();
+}
+
+HRESULT CMappedFileIO::Open(LPCWSTR pszFileName)
+{
+  LARGE_INTEGER size;
+  uint8_t *buffer = nullptr;
+
+  Close();
+
+  // Sequential scan tells the cache manager to read ahead aggressively
+  m_hFile = CreateFileW(pszFileName, GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+  if (m_hFile == INVALID_HANDLE_VALUE) {
+    DbgLog((LOG_TRACE, 10, L"CMappedFileIO::Open(): Opening file failed (error: %d)", GetLastError()));
+    return E_FAIL;
+  }
+
+  if (!GetFileSizeEx(m_hFile, &size) || size.QuadPart <= 0)
+    goto fail;
+  m_llSize = size.QuadPart;
+
+#ifdef _WIN64
+  if ((ULONGLONG)m_llSize > SIZE_MAX)
+    goto fail;
+#endif
+
+  m_hMapping = CreateFileMappingW(m_hFile, nullptr, PAGE_READONLY, 0, 0, nullptr);
+  if (!m_hMapping) {
+    DbgLog((LOG_TRACE, 10, L"CMappedFileIO::Open(): Creating the file mapping failed (error: %d)", GetLastError()));
+    goto fail;
+  }
+
+  if (FAILED(MapView(0)))
+    goto fail;
+
+  buffer = (uint8_t *)av_mallocz(MAPPED_IO_BUFFER_SIZE + AV_INPUT_BUFFER_PADDING_SIZE);
+  m_pAVIOContext = avio_alloc_context(buffer, MAPPED_IO_BUFFER_SIZE, 0, this, Read, nullptr, Seek);
+  if (!m_pAVIOContext) {
+    av_free(buffer);
+    goto fail;
+  }
+
+  m_llPos = 0;
+
+  DbgLog((LOG_TRACE, 10, L"CMappedFileIO::Open(): Mapped file of %I64d bytes", m_llSize));
+
+  return S_OK;
+fail:
+  Close();
+  return E_FAIL;
+}
+
+void CMappedFileIO::Close()
+{
+  if (m_pAVIOContext) {
+    av_free(m_pAVIOContext->buffer);
+    av_free(m_pAVIOContext);
+    m_pAVIOContext = nullptr;
+  }
+
+  UnmapView();
+
+  if (m_hMapping) {
+    CloseHandle(m_hMapping);
+    m_hMapping = nullptr;
+  }
+
+  if (m_hFile != INVALID_HANDLE_VALUE) {
+    CloseHandle(m_hFile);
+    m_hFile = INVALID_HANDLE_VALUE;
+  }
+
+  m_llSize = 0;
+  m_llPos = 0;
+}
+
+HRESULT CMappedFileIO::MapView(LONGLONG llPos)
+{
+  UnmapView();
+
+#ifdef _WIN64
+  m_llViewPos = 0;
+  m_cbView = (SIZE_T)m_llSize;
+#else
+  // Views need to start at a multiple of the allocation granularity
+  m_llViewPos = llPos - (llPos % m_dwGranularity);
+  m_cbView = (SIZE_T)min((LONGLONG)MAPPED_IO_WINDOW_SIZE, m_llSize - m_llViewPos);
+#endif
+
+  m_pView = (const BYTE *)MapViewOfFile(m_hMapping, FILE_MAP_READ, (DWORD)(m_llViewPos >> 32), (DWORD)(m_llViewPos & 0xFFFFFFFF), m_cbView);
+  if (!m_pView) {
+    DbgLog((LOG_TRACE, 10, L"CMappedFileIO::MapView(): Mapping view at %I64d failed (error: %d)", m_llViewPos, GetLastError()));
+    m_cbView = 0;
+    return E_FAIL;
+  }
+
+  m_llPrefetch = 0;
+
+  return S_OK;
+}
+
+void CMappedFileIO::UnmapView()
+{
+  if (m_pView) {
+    UnmapViewOfFile(m_pView);
+    m_pView = nullptr;
+  }
+  m_llViewPos = 0;
+  m_cbView = 0;
+}
+
+void CMappedFileIO::Prefetch(LONGLONG llPos)
+{
+  if (!m_pfnPrefetchVirtualMemory)
+    return;
+
+  // Only issue a new prefetch once half of the previous one has been consumed
+  if ((llPos + MAPPED_IO_PREFETCH_SIZE / 2) < m_llPrefetch)
+    return;
+
+  LONGLONG llStart = max(llPos, m_llPrefetch);
+  LONGLONG llEnd = min(llPos + MAPPED_IO_PREFETCH_SIZE, m_llViewPos + (LONGLONG)m_cbView);
+  if (llEnd <= llStart)
+    return;
+
+  LAV_MEMORY_RANGE_ENTRY range = { (PVOID)(m_pView + (llStart - m_llViewPos)), (SIZE_T)(llEnd - llStart) };
+  ((PFN_PREFETCHVIRTUALMEMORY)m_pfnPrefetchVirtualMemory)(GetCurrentProcess(), 1, &range, 0);
+
+  m_llPrefetch = llEnd;
+}
+
+int CMappedFileIO::Read(void *opaque, uint8_t *buf, int buf_size)
+{
+  CMappedFileIO *io = static_cast<CMappedFileIO *>(opaque);
+
+  if (io->m_llPos >= io->m_llSize)
+    return AVERROR_EOF;
+
+  if (!io->m_pView || io->m_llPos < io->m_llViewPos || io->m_llPos >= (io->m_llViewPos + (LONGLONG)io->m_cbView)) {
+    if (FAILED(io->MapView(io->m_llPos)))
+      return AVERROR(EIO);
+  }
+
+  io->Prefetch(io->m_llPos);
+
+  int size = (int)min((LONGLONG)buf_size, io->m_llViewPos + (LONGLONG)io->m_cbView - io->m_llPos);
+  int ret = CopyMappedData(buf, io->m_pView + (io->m_llPos - io->m_llViewPos), size);
+  if (ret < 0) {
+    DbgLog((LOG_TRACE, 10, L"CMappedFileIO::Read(): Read failed at pos: %I64d", io->m_llPos));
+    return ret;
+  }
+
+  io->m_llPos += size;
+  return size;
+}
+
+int64_t CMappedFileIO::Seek(void *opaque, int64_t offset, int whence)
+{
+  CMappedFileIO *io = static_cast<CMappedFileIO *>(opaque);
+
+  LONGLONG llPos = 0;
+  if (whence == SEEK_SET) {
+    llPos = offset;
+  } else if (whence == SEEK_CUR) {
+    llPos = io->m_llPos + offset;
+  } else if (whence == SEEK_END) {
+    llPos = io->m_llSize + offset;
+  } else if (whence == AVSEEK_SIZE) {
+    return io->m_llSize;
+  } else
+    return -1;
+
+  if (llPos < 0)
+    return AVERROR(EINVAL);
+
+  // Restart prefetching if the new position is outside of the prefetched range
+  if (llPos < io->m_llPos || llPos > io->m_llPrefetch)
+    io->m_llPrefetch = 0;
+
+  io->m_llPos = llPos;
+  return llPos;
+}
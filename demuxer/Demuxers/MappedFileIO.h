@@ -0,0 +1,66 @@
+/*
+ *      Copyright (C) 2010-2019 Hendrik Leppkes
+ *      http://www.1f0.de
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program; if not, write to the Free Software Foundation, Inc.,
+ *  51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#pragma once
+
+#define MAPPED_IO_BUFFER_SIZE    32768
+#define MAPPED_IO_WINDOW_SIZE    (64 << 20) // size of the mapped view on 32-bit builds
+#define MAPPED_IO_PREFETCH_SIZE  (4 << 20)
+
+// Memory-mapped file access for local files, exposed through a custom AVIOContext
+// On 64-bit builds the whole file is mapped at once, 32-bit builds map a sliding window
+// to be able to access files larger than the address space.
+class CMappedFileIO
+{
+public:
+  CMappedFileIO();
+  ~CMappedFileIO();
+
+  HRESULT Open(LPCWSTR pszFileName);
+  void Close();
+
+  // The context is owned by this object, and stays valid until Close
+  AVIOContext *GetAVIOContext() const { return m_pAVIOContext; }
+
+private:
+  static int Read(void *opaque, uint8_t *buf, int buf_size);
+  static int64_t Seek(void *opaque, int64_t offset, int whence);
+
+  HRESULT MapView(LONGLONG llPos);
+  void UnmapView();
+  void Prefetch(LONGLONG llPos);
+
+private:
+  HANDLE m_hFile    = INVALID_HANDLE_VALUE;
+  HANDLE m_hMapping = nullptr;
+
+  const BYTE *m_pView  = nullptr;
+  LONGLONG m_llViewPos = 0;
+  SIZE_T m_cbView      = 0;
+  DWORD m_dwGranularity = 65536;
+
+  LONGLONG m_llSize     = 0;
+  LONGLONG m_llPos      = 0;
+  LONGLONG m_llPrefetch = 0;
+
+  AVIOContext *m_pAVIOContext = nullptr;
+
+  // PrefetchVirtualMemory, only available on Windows 8 and newer
+  FARPROC m_pfnPrefetchVirtualMemory = nullptr;
+};
@@ -18,7 +18,51 @@
  */
 
 #include <stdafx.h>
+#include <new>
 #include "Packet.h"
+#include "PacketPool.h"
+
+// Every Packet is prefixed by a header, so delete can return it to the pool it came from
+// The header is 16 bytes to keep the alignment of the packet itself intact
+struct PacketHeader {
+  CPacketPool *pPool;
+  void *reserved;
+};
+
+void *Packet::operator new(size_t size)
+{
+  PacketHeader *hdr = (PacketHeader *)malloc(sizeof(PacketHeader) + size);
+  if (!hdr)
+    throw std::bad_alloc();
+  hdr->pPool = nullptr;
+  return hdr + 1;
+}
+
+void *Packet::operator new(size_t size, CPacketPool *pPool)
+{
+  PacketHeader *hdr = (PacketHeader *)pPool->AllocPacketMemory(sizeof(PacketHeader) + size);
+  if (!hdr)
+    throw std::bad_alloc();
+  hdr->pPool = pPool;
+  return hdr + 1;
+}
+
+void Packet::operator delete(void *ptr)
+{
+  if (!ptr)
+    return;
+
+  PacketHeader *hdr = (PacketHeader *)ptr - 1;
+  if (hdr->pPool)
+    hdr->pPool->FreePacketMemory(hdr);
+  else
+    free(hdr);
+}
+
+void Packet::operator delete(void *ptr, CPacketPool *pPool)
+{
+  Packet::operator delete(ptr);
+}
 
 Packet::Packet()
 {
@@ -27,7 +71,17 @@ Packet::Packet()
 Packet::~Packet()
 {
   DeleteMediaType(pmt);
-  av_packet_free(&m_Packet);
+  if (m_pPool && m_Packet) {
+    m_pPool->FreeAVPacket(m_Packet);
+    m_Packet = nullptr;
+  } else {
+    av_packet_free(&m_Packet);
+  }
+}
+
+AVPacket *Packet::AllocAVPacket()
+{
+  return m_pPool ? m_pPool->AllocAVPacket() : av_packet_alloc();
 }
 
 int Packet::SetDataSize(int len)
@@ -41,8 +95,16 @@ int Packet::SetDataSize(int len)
   }
 
   if (!m_Packet) {
-    m_Packet = av_packet_alloc();
-    if (av_new_packet(m_Packet, len) < 0)
+    m_Packet = AllocAVPacket();
+    if (!m_Packet)
+      return -1;
+
+    // Try to use a recycled buffer from the pool
+    if (m_pPool && (m_Packet->buf = m_pPool->AllocBuffer(len))) {
+      m_Packet->data = m_Packet->buf->data;
+      m_Packet->size = len;
+      memset(m_Packet->data + len, 0, AV_INPUT_BUFFER_PADDING_SIZE);
+    } else if (av_new_packet(m_Packet, len) < 0)
       return -1;
   }
   else
@@ -70,13 +132,18 @@ int Packet::SetPacket(AVPacket *pkt)
 {
   ASSERT(!m_Packet);
 
-  m_Packet = av_packet_alloc();
+  m_Packet = AllocAVPacket();
   if (!m_Packet)
     return -1;
 
   return av_packet_ref(m_Packet, pkt);
 }
 
+int Packet::MakeWritable()
+{
+  return m_Packet ? av_packet_make_writable(m_Packet) : 0;
+}
+
 int Packet::Append(Packet *ptr)
 {
   return AppendData(ptr->GetData(), ptr->GetDataSize());
@@ -109,6 +176,7 @@ bool Packet::CopyProperties(const Packet *src)
   rtStop = src->rtStop;
   rtPTS = src->rtPTS;
   rtDTS = src->rtDTS;
+  rtCapture = src->rtCapture;
   if (src->pmt)
     pmt = CreateMediaType(src->pmt);
   dwFlags = src->dwFlags;
@@ -19,6 +19,8 @@
 
 #pragma once
 
+class CPacketPool;
+
 // Data Packet for queue storage
 class Packet
 {
@@ -28,15 +30,26 @@ public:
   Packet();
   ~Packet();
 
+  // Packets created by a CPacketPool return their memory to the pool on delete
+  static void *operator new(size_t size);
+  static void *operator new(size_t size, CPacketPool *pPool);
+  static void operator delete(void *ptr);
+  static void operator delete(void *ptr, CPacketPool *pPool);
+
   int GetDataSize() const { return m_Packet ? m_Packet->size : 0; }
   BYTE *GetData() { return m_Packet ? m_Packet->data : nullptr; }
 
   int GetNumSideData() const { return m_Packet ? m_Packet->side_data_elems : 0; }
   AVPacketSideData* GetSideData() { return m_Packet ? m_Packet->side_data : nullptr; }
 
+  // The underlying AVPacket, for consumers that want to reference the buffer instead of copying it
+  const AVPacket *GetAVPacket() const { return m_Packet; }
+
   int SetDataSize(int len);
   int SetData(const void* ptr, int len);
   int SetPacket(AVPacket *pkt);
+  // Copy the data if the buffer is shared with other packets, so it can be modified in place
+  int MakeWritable();
 
   // Append the data of the package to our data buffer
   int Append(Packet *ptr);
@@ -58,6 +71,9 @@ public:
   REFERENCE_TIME rtPTS   = INVALID_TIME;
   REFERENCE_TIME rtDTS   = INVALID_TIME;
 
+  // Performance counter time the data was read from the source (see timer_get_ref_time)
+  REFERENCE_TIME rtCapture = INVALID_TIME;
+
   AM_MEDIA_TYPE *pmt     = nullptr;
 
 #define LAV_PACKET_PARSED           0x0001
@@ -68,6 +84,12 @@ public:
 #define LAV_PACKET_PLANAR_PCM       0x0020
   DWORD dwFlags          = 0;
 
+private:
+  AVPacket *AllocAVPacket();
+
+  friend class CPacketPool;
+  CPacketPool *m_pPool    = nullptr;
+
 private:
   AVPacket    *m_Packet   = nullptr;
 };
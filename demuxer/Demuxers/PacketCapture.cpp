@@ -0,0 +1,331 @@
+/*
+ *      Copyright (C) 2010-2019 Hendrik Leppkes
+ *      http://www.1f0.de
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program; if not, write to the Free Software Foundation, Inc.,
+ *  51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+
+#include "stdafx.h"
+#include "PacketCapture.h"
+#include "Packet.h"
+#include "IMediaSideDataFFmpeg.h"
+
+// Records are written to the file once this much data is collected
+#define LAVCAP_WRITE_BLOCK (1 << 20)
+
+CPacketCaptureWriter::CPacketCaptureWriter()
+{
+}
+
+CPacketCaptureWriter::~CPacketCaptureWriter()
+{
+  Close();
+}
+
+HRESULT CPacketCaptureWriter::Open(LPCWSTR pszFileName)
+{
+  Close();
+
+  m_hFile = CreateFileW(pszFileName, GENERIC_WRITE, FILE_SHARE_READ, nullptr, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+  if (m_hFile == INVALID_HANDLE_VALUE) {
+    DWORD dwError = GetLastError();
+    DbgLog((LOG_ERROR, 10, L"CPacketCaptureWriter::Open(): Failed to create capture file '%s' (error: %u)", pszFileName, dwError));
+    return HRESULT_FROM_WIN32(dwError);
+  }
+
+  m_hrError = S_OK;
+  m_Buffer.reserve(LAVCAP_WRITE_BLOCK * 2);
+
+  LAVCapHeader header = { LAVCAP_MAGIC, LAVCAP_VERSION };
+  m_Buffer.insert(m_Buffer.end(), (const BYTE *)&header, (const BYTE *)(&header + 1));
+
+  return S_OK;
+}
+
+void CPacketCaptureWriter::Close()
+{
+  if (m_hFile != INVALID_HANDLE_VALUE) {
+    Flush();
+    CloseHandle(m_hFile);
+    m_hFile = INVALID_HANDLE_VALUE;
+  }
+  m_Buffer.clear();
+}
+
+HRESULT CPacketCaptureWriter::Flush()
+{
+  if (SUCCEEDED(m_hrError) && !m_Buffer.empty()) {
+    DWORD dwWritten = 0;
+    if (!WriteFile(m_hFile, m_Buffer.data(), (DWORD)m_Buffer.size(), &dwWritten, nullptr) || dwWritten != m_Buffer.size()) {
+      DWORD dwError = GetLastError();
+      DbgLog((LOG_ERROR, 10, L"CPacketCaptureWriter::Flush(): Writing the capture file failed, stopping the capture (error: %u)", dwError));
+      m_hrError = dwError ? HRESULT_FROM_WIN32(dwError) : E_FAIL;
+    }
+  }
+  m_Buffer.clear();
+  return m_hrError;
+}
+
+BYTE *CPacketCaptureWriter::AppendRecord(DWORD dwType, size_t nSize)
+{
+  if (m_hFile == INVALID_HANDLE_VALUE || FAILED(m_hrError) || nSize > MAXDWORD)
+    return nullptr;
+
+  if (m_Buffer.size() >= LAVCAP_WRITE_BLOCK && FAILED(Flush()))
+    return nullptr;
+
+  const size_t nOffset = m_Buffer.size();
+  m_Buffer.resize(nOffset + sizeof(LAVCapRecord) + nSize);
+
+  LAVCapRecord *pRecord = (LAVCapRecord *)&m_Buffer[nOffset];
+  pRecord->dwType = dwType;
+  pRecord->dwSize = (DWORD)nSize;
+
+  return &m_Buffer[nOffset + sizeof(LAVCapRecord)];
+}
+
+HRESULT CPacketCaptureWriter::WriteMediaType(const AM_MEDIA_TYPE *pmt)
+{
+  CheckPointer(pmt, E_POINTER);
+
+  const ULONG cbFormat = pmt->pbFormat ? pmt->cbFormat : 0;
+  BYTE *pData = AppendRecord(LAVCAP_RECORD_MEDIATYPE, sizeof(LAVCapMediaType) + cbFormat);
+  if (!pData)
+    return E_FAIL;
+
+  LAVCapMediaType *pType = (LAVCapMediaType *)pData;
+  pType->majortype = pmt->majortype;
+  pType->subtype = pmt->subtype;
+  pType->bFixedSizeSamples = pmt->bFixedSizeSamples;
+  pType->bTemporalCompression = pmt->bTemporalCompression;
+  pType->lSampleSize = pmt->lSampleSize;
+  pType->formattype = pmt->formattype;
+  pType->cbFormat = cbFormat;
+  if (cbFormat)
+    memcpy(pData + sizeof(LAVCapMediaType), pmt->pbFormat, cbFormat);
+
+  return S_OK;
+}
+
+HRESULT CPacketCaptureWriter::WriteStreamSideData(const MediaSideDataFFMpeg *pSideData)
+{
+  CheckPointer(pSideData, E_POINTER);
+
+  for (int i = 0; i < pSideData->side_data_elems; i++) {
+    const AVPacketSideData *sd = &pSideData->side_data[i];
+    BYTE *pData = AppendRecord(LAVCAP_RECORD_SIDEDATA, sizeof(LAVCapSideData) + sd->size);
+    if (!pData)
+      return E_FAIL;
+
+    LAVCapSideData *pEntry = (LAVCapSideData *)pData;
+    pEntry->dwType = sd->type;
+    pEntry->dwSize = (DWORD)sd->size;
+    memcpy(pData + sizeof(LAVCapSideData), sd->data, sd->size);
+  }
+
+  return S_OK;
+}
+
+HRESULT CPacketCaptureWriter::WritePacket(Packet *pPacket)
+{
+  CheckPointer(pPacket, E_POINTER);
+
+  const int nSideData = pPacket->GetNumSideData();
+  const AVPacketSideData *pSideData = pPacket->GetSideData();
+
+  size_t nSize = sizeof(LAVCapPacket) + pPacket->GetDataSize();
+  for (int i = 0; i < nSideData; i++)
+    nSize += sizeof(LAVCapSideData) + pSideData[i].size;
+
+  BYTE *pData = AppendRecord(LAVCAP_RECORD_PACKET, nSize);
+  if (!pData)
+    return E_FAIL;
+
+  LAVCapPacket *pHeader = (LAVCapPacket *)pData;
+  pHeader->rtStart = pPacket->rtStart;
+  pHeader->rtStop = pPacket->rtStop;
+  pHeader->dwSampleFlags = (pPacket->bSyncPoint ? LAVCAP_PACKET_SYNCPOINT : 0) | (pPacket->bDiscontinuity ? LAVCAP_PACKET_DISCONTINUITY : 0);
+  pHeader->dwFlags = pPacket->dwFlags;
+  pHeader->nSideData = nSideData;
+  pData += sizeof(LAVCapPacket);
+
+  for (int i = 0; i < nSideData; i++) {
+    LAVCapSideData *pEntry = (LAVCapSideData *)pData;
+    pEntry->dwType = pSideData[i].type;
+    pEntry->dwSize = (DWORD)pSideData[i].size;
+    memcpy(pData + sizeof(LAVCapSideData), pSideData[i].data, pSideData[i].size);
+    pData += sizeof(LAVCapSideData) + pSideData[i].size;
+  }
+
+  memcpy(pData, pPacket->GetData(), pPacket->GetDataSize());
+
+  return S_OK;
+}
+
+CPacketCaptureReader::CPacketCaptureReader()
+{
+}
+
+CPacketCaptureReader::~CPacketCaptureReader()
+{
+  Close();
+}
+
+HRESULT CPacketCaptureReader::Open(LPCWSTR pszFileName)
+{
+  Close();
+
+  LARGE_INTEGER size = { 0 };
+  const LAVCapHeader *pHeader = nullptr;
+
+  m_hFile = CreateFileW(pszFileName, GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+  if (m_hFile == INVALID_HANDLE_VALUE)
+    goto fail;
+
+  if (!GetFileSizeEx(m_hFile, &size) || size.QuadPart < sizeof(LAVCapHeader) || (ULONGLONG)size.QuadPart > SIZE_MAX)
+    goto fail;
+
+  m_hMapping = CreateFileMapping(m_hFile, nullptr, PAGE_READONLY, 0, 0, nullptr);
+  if (m_hMapping == nullptr)
+    goto fail;
+
+  m_pData = (const BYTE *)MapViewOfFile(m_hMapping, FILE_MAP_READ, 0, 0, 0);
+  if (m_pData == nullptr)
+    goto fail;
+
+  m_nSize = (size_t)size.QuadPart;
+
+  pHeader = (const LAVCapHeader *)m_pData;
+  if (pHeader->dwMagic != LAVCAP_MAGIC || pHeader->dwVersion != LAVCAP_VERSION) {
+    DbgLog((LOG_ERROR, 10, L"CPacketCaptureReader::Open(): '%s' is not a capture file of a supported version", pszFileName));
+    Close();
+    return VFW_E_UNKNOWN_FILE_TYPE;
+  }
+
+  // Fault in the whole file now, so the replay never waits on the disk
+  for (size_t nPos = 0; nPos < m_nSize; nPos += 4096)
+    (void)*(volatile const BYTE *)(m_pData + nPos);
+
+  return S_OK;
+
+fail:
+  DbgLog((LOG_ERROR, 10, L"CPacketCaptureReader::Open(): Failed to open capture file '%s' (error: %u)", pszFileName, GetLastError()));
+  Close();
+  return E_FAIL;
+}
+
+void CPacketCaptureReader::Close()
+{
+  if (m_pData) {
+    UnmapViewOfFile(m_pData);
+    m_pData = nullptr;
+  }
+  if (m_hMapping) {
+    CloseHandle(m_hMapping);
+    m_hMapping = nullptr;
+  }
+  if (m_hFile != INVALID_HANDLE_VALUE) {
+    CloseHandle(m_hFile);
+    m_hFile = INVALID_HANDLE_VALUE;
+  }
+  m_nSize = 0;
+}
+
+HRESULT CPacketCaptureReader::ReadRecord(size_t *pnPos, const LAVCapRecord **ppRecord, const BYTE **ppPayload)
+{
+  const size_t nPos = *pnPos;
+  if (!m_pData || nPos >= m_nSize)
+    return S_FALSE;
+
+  // a capture which was not closed properly ends with a truncated record
+  if (m_nSize - nPos < sizeof(LAVCapRecord))
+    return E_FAIL;
+
+  const LAVCapRecord *pRecord = (const LAVCapRecord *)(m_pData + nPos);
+  if (m_nSize - nPos - sizeof(LAVCapRecord) < pRecord->dwSize)
+    return E_FAIL;
+
+  *ppRecord = pRecord;
+  *ppPayload = m_pData + nPos + sizeof(LAVCapRecord);
+  *pnPos = nPos + sizeof(LAVCapRecord) + pRecord->dwSize;
+  return S_OK;
+}
+
+HRESULT CPacketCaptureReader::ParseMediaType(const LAVCapRecord *pRecord, const BYTE *pPayload, CMediaType *pmt)
+{
+  if (pRecord->dwType != LAVCAP_RECORD_MEDIATYPE || pRecord->dwSize < sizeof(LAVCapMediaType))
+    return E_INVALIDARG;
+
+  const LAVCapMediaType *pType = (const LAVCapMediaType *)pPayload;
+  if (pRecord->dwSize - sizeof(LAVCapMediaType) < pType->cbFormat)
+    return E_FAIL;
+
+  pmt->InitMediaType();
+  pmt->majortype = pType->majortype;
+  pmt->subtype = pType->subtype;
+  pmt->bFixedSizeSamples = pType->bFixedSizeSamples;
+  pmt->bTemporalCompression = pType->bTemporalCompression;
+  pmt->lSampleSize = pType->lSampleSize;
+  pmt->formattype = pType->formattype;
+  if (pType->cbFormat && !pmt->SetFormat((BYTE *)(pPayload + sizeof(LAVCapMediaType)), pType->cbFormat))
+    return E_OUTOFMEMORY;
+
+  return S_OK;
+}
+
+HRESULT CPacketCaptureReader::ParsePacket(const LAVCapRecord *pRecord, const BYTE *pPayload, AVPacket *pkt, const LAVCapPacket **ppHeader)
+{
+  if (pRecord->dwType != LAVCAP_RECORD_PACKET || pRecord->dwSize < sizeof(LAVCapPacket))
+    return E_INVALIDARG;
+
+  const LAVCapPacket *pHeader = (const LAVCapPacket *)pPayload;
+  const BYTE *pSideData = pPayload + sizeof(LAVCapPacket);
+  const BYTE *pEnd = pPayload + pRecord->dwSize;
+
+  // the side data precedes the packet data, validate it before allocating anything
+  const BYTE *p = pSideData;
+  for (DWORD i = 0; i < pHeader->nSideData; i++) {
+    if ((size_t)(pEnd - p) < sizeof(LAVCapSideData))
+      return E_FAIL;
+    const LAVCapSideData *pEntry = (const LAVCapSideData *)p;
+    if ((size_t)(pEnd - p) - sizeof(LAVCapSideData) < pEntry->dwSize)
+      return E_FAIL;
+    p += sizeof(LAVCapSideData) + pEntry->dwSize;
+  }
+
+  const size_t nDataSize = pEnd - p;
+  if (nDataSize > INT_MAX - AV_INPUT_BUFFER_PADDING_SIZE)
+    return E_FAIL;
+
+  if (av_new_packet(pkt, (int)nDataSize) < 0)
+    return E_OUTOFMEMORY;
+  memcpy(pkt->data, p, nDataSize);
+
+  p = pSideData;
+  for (DWORD i = 0; i < pHeader->nSideData; i++) {
+    const LAVCapSideData *pEntry = (const LAVCapSideData *)p;
+    uint8_t *pData = av_packet_new_side_data(pkt, (enum AVPacketSideDataType)pEntry->dwType, (int)pEntry->dwSize);
+    if (!pData) {
+      av_packet_unref(pkt);
+      return E_OUTOFMEMORY;
+    }
+    memcpy(pData, p + sizeof(LAVCapSideData), pEntry->dwSize);
+    p += sizeof(LAVCapSideData) + pEntry->dwSize;
+  }
+
+  *ppHeader = pHeader;
+  return S_OK;
+}
@@ -0,0 +1,133 @@
+/*
+ *      Copyright (C) 2010-2019 Hendrik Leppkes
+ *      http://www.1f0.de
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program; if not, write to the Free Software Foundation, Inc.,
+ *  51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+
+#pragma once
+
+#include <vector>
+
+class Packet;
+struct MediaSideDataFFMpeg;
+
+/* Capture files of the samples delivered by an output pin
+ *
+ * The file starts with a LAVCapHeader, followed by records of a LAVCapRecord header and dwSize bytes of payload:
+ * - LAVCAP_RECORD_MEDIATYPE: LAVCapMediaType and its format block. The first record is the type of the connection,
+ *   every later one a type change which applies to the next packet.
+ * - LAVCAP_RECORD_SIDEDATA: LAVCapSideData and its data, one record for every side data element of the stream.
+ * - LAVCAP_RECORD_PACKET: LAVCapPacket, nSideData LAVCapSideData entries each followed by its data, and the packet data.
+ * All values are little-endian, timestamps are as delivered downstream. */
+
+#define LAVCAP_MAGIC   MKTAG('L', 'C', 'A', 'P')
+#define LAVCAP_VERSION 1
+
+#define LAVCAP_RECORD_MEDIATYPE 1
+#define LAVCAP_RECORD_SIDEDATA  2
+#define LAVCAP_RECORD_PACKET    3
+
+#define LAVCAP_PACKET_SYNCPOINT     0x0001
+#define LAVCAP_PACKET_DISCONTINUITY 0x0002
+
+#pragma pack(push, 1)
+struct LAVCapHeader {
+  DWORD dwMagic;
+  DWORD dwVersion;
+};
+
+struct LAVCapRecord {
+  DWORD dwType;
+  DWORD dwSize;
+};
+
+struct LAVCapMediaType {
+  GUID  majortype;
+  GUID  subtype;
+  BOOL  bFixedSizeSamples;
+  BOOL  bTemporalCompression;
+  ULONG lSampleSize;
+  GUID  formattype;
+  ULONG cbFormat;
+};
+
+struct LAVCapSideData {
+  DWORD dwType;           ///< AVPacketSideDataType
+  DWORD dwSize;
+};
+
+struct LAVCapPacket {
+  LONGLONG rtStart;
+  LONGLONG rtStop;
+  DWORD    dwSampleFlags; ///< LAVCAP_PACKET_*
+  DWORD    dwFlags;       ///< LAV_PACKET_* of the packet
+  DWORD    nSideData;
+};
+#pragma pack(pop)
+
+// Writes the capture of one output pin
+// Records are collected in memory, and written to the file in large blocks.
+class CPacketCaptureWriter
+{
+public:
+  CPacketCaptureWriter();
+  ~CPacketCaptureWriter();
+
+  HRESULT Open(LPCWSTR pszFileName);
+  void Close();
+
+  HRESULT WriteMediaType(const AM_MEDIA_TYPE *pmt);
+  HRESULT WriteStreamSideData(const MediaSideDataFFMpeg *pSideData);
+  HRESULT WritePacket(Packet *pPacket);
+
+private:
+  BYTE *AppendRecord(DWORD dwType, size_t nSize);
+  HRESULT Flush();
+
+private:
+  HANDLE            m_hFile = INVALID_HANDLE_VALUE;
+  std::vector<BYTE> m_Buffer;
+  HRESULT           m_hrError = S_OK;
+};
+
+// Reads a capture file, which is mapped into memory in whole
+class CPacketCaptureReader
+{
+public:
+  CPacketCaptureReader();
+  ~CPacketCaptureReader();
+
+  HRESULT Open(LPCWSTR pszFileName);
+  void Close();
+
+  // Offset of the first record
+  size_t GetStart() const { return sizeof(LAVCapHeader); }
+
+  // Get the record at the offset, and advance the offset to the next one
+  // Returns S_FALSE at the end of the file, and an error if the record is truncated
+  HRESULT ReadRecord(size_t *pnPos, const LAVCapRecord **ppRecord, const BYTE **ppPayload);
+
+  // Parse the payload of a record
+  static HRESULT ParseMediaType(const LAVCapRecord *pRecord, const BYTE *pPayload, CMediaType *pmt);
+  static HRESULT ParsePacket(const LAVCapRecord *pRecord, const BYTE *pPayload, AVPacket *pkt, const LAVCapPacket **ppHeader);
+
+private:
+  HANDLE      m_hFile    = INVALID_HANDLE_VALUE;
+  HANDLE      m_hMapping = nullptr;
+  const BYTE *m_pData    = nullptr;
+  size_t      m_nSize    = 0;
+};
@@ -0,0 +1,217 @@
+/*
+ *      Copyright (C) 2010-2019 Hendrik Leppkes
+ *      http://www.1f0.de
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program; if not, write to the Free Software Foundation, Inc.,
+ *  51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#include "stdafx.h"
+#include "PacketPool.h"
+#include "Packet.h"
+#include "MemoryPressure.h"
+
+// Buffer size classes, starting at 4KB and growing 4x per class, up to 1MB
+#define BUFFER_CLASS_SIZE(n) (4096 << (2 * (n)))
+
+CPacketPool::CPacketPool(size_t nMaxFree)
+  : m_nMaxFree(nMaxFree)
+{
+}
+
+CPacketPool::~CPacketPool()
+{
+  for (void *ptr : m_FreePackets) {
+    free(ptr);
+  }
+  m_FreePackets.clear();
+
+  for (AVPacket *pkt : m_FreeAVPackets) {
+    av_packet_free(&pkt);
+  }
+  m_FreeAVPackets.clear();
+
+  // Buffers still in use keep their pool alive until they are released
+  for (int i = 0; i < PACKET_POOL_BUFFER_CLASSES; i++) {
+    av_buffer_pool_uninit(&m_BufferPools[i]);
+  }
+}
+
+ULONG CPacketPool::AddRef()
+{
+  return (ULONG)InterlockedIncrement(&m_cRef);
+}
+
+ULONG CPacketPool::Release()
+{
+  LONG lRef = InterlockedDecrement(&m_cRef);
+  if (lRef == 0) {
+    delete this;
+  }
+  return (ULONG)lRef;
+}
+
+Packet *CPacketPool::Acquire()
+{
+  Packet *pPacket = new (this) Packet();
+  if (pPacket)
+    pPacket->m_pPool = this;
+  return pPacket;
+}
+
+void CPacketPool::SetMaxFree(size_t nMaxFree)
+{
+  CAutoLock lock(&m_csPool);
+  m_nMaxFree = nMaxFree;
+
+  while (m_FreePackets.size() > m_nMaxFree) {
+    free(m_FreePackets.back());
+    m_FreePackets.pop_back();
+  }
+  while (m_FreeAVPackets.size() > m_nMaxFree) {
+    av_packet_free(&m_FreeAVPackets.back());
+    m_FreeAVPackets.pop_back();
+  }
+
+  DbgLog((LOG_TRACE, 10, L"CPacketPool::SetMaxFree(): Keeping up to %Iu packets", m_nMaxFree));
+}
+
+BOOL CPacketPool::TrimLocked()
+{
+  if (!memory_pressure_low())
+    return FALSE;
+
+  if (!m_FreePackets.empty() || !m_FreeAVPackets.empty())
+    DbgLog((LOG_TRACE, 10, L"CPacketPool::TrimLocked(): Releasing %Iu unused packets", max(m_FreePackets.size(), m_FreeAVPackets.size())));
+
+  for (void *ptr : m_FreePackets) {
+    free(ptr);
+  }
+  m_FreePackets.clear();
+
+  for (AVPacket *pkt : m_FreeAVPackets) {
+    av_packet_free(&pkt);
+  }
+  m_FreeAVPackets.clear();
+
+  // The buffers still in use are freed when they are released, new pools are only created once the memory recovers
+  for (int i = 0; i < PACKET_POOL_BUFFER_CLASSES; i++) {
+    av_buffer_pool_uninit(&m_BufferPools[i]);
+  }
+
+  return TRUE;
+}
+
+void CPacketPool::GetStatistics(ULONGLONG *pHits, ULONGLONG *pMisses)
+{
+  CAutoLock lock(&m_csPool);
+  if (pHits)
+    *pHits = m_nHits;
+  if (pMisses)
+    *pMisses = m_nMisses;
+}
+
+void CPacketPool::ResetStatistics()
+{
+  CAutoLock lock(&m_csPool);
+  m_nHits = m_nMisses = 0;
+}
+
+void *CPacketPool::AllocPacketMemory(size_t size)
+{
+  void *ptr = nullptr;
+  {
+    CAutoLock lock(&m_csPool);
+    if (!m_FreePackets.empty()) {
+      ptr = m_FreePackets.back();
+      m_FreePackets.pop_back();
+      m_nHits++;
+    } else {
+      m_nMisses++;
+    }
+  }
+
+  if (!ptr)
+    ptr = malloc(size);
+
+  // Every packet holds a reference on its pool
+  if (ptr)
+    AddRef();
+
+  return ptr;
+}
+
+void CPacketPool::FreePacketMemory(void *ptr)
+{
+  {
+    CAutoLock lock(&m_csPool);
+    if (m_FreePackets.size() < m_nMaxFree && !TrimLocked()) {
+      m_FreePackets.push_back(ptr);
+      ptr = nullptr;
+    }
+  }
+  free(ptr);
+
+  // This can delete the pool, if this was the last packet
+  Release();
+}
+
+AVPacket *CPacketPool::AllocAVPacket()
+{
+  {
+    CAutoLock lock(&m_csPool);
+    if (!m_FreeAVPackets.empty()) {
+      AVPacket *pkt = m_FreeAVPackets.back();
+      m_FreeAVPackets.pop_back();
+      m_nHits++;
+      return pkt;
+    }
+    m_nMisses++;
+  }
+  return av_packet_alloc();
+}
+
+void CPacketPool::FreeAVPacket(AVPacket *pkt)
+{
+  av_packet_unref(pkt);
+  {
+    CAutoLock lock(&m_csPool);
+    if (m_FreeAVPackets.size() < m_nMaxFree && !TrimLocked()) {
+      m_FreeAVPackets.push_back(pkt);
+      return;
+    }
+  }
+  av_packet_free(&pkt);
+}
+
+AVBufferRef *CPacketPool::AllocBuffer(int size)
+{
+  if (size < 0)
+    return nullptr;
+
+  size_t padded = (size_t)size + AV_INPUT_BUFFER_PADDING_SIZE;
+  for (int i = 0; i < PACKET_POOL_BUFFER_CLASSES; i++) {
+    if (padded <= BUFFER_CLASS_SIZE(i)) {
+      CAutoLock lock(&m_csPool);
+      if (!m_BufferPools[i] && !memory_pressure_low())
+        m_BufferPools[i] = av_buffer_pool_init(BUFFER_CLASS_SIZE(i), nullptr);
+      if (!m_BufferPools[i])
+        break;
+      return av_buffer_pool_get(m_BufferPools[i]);
+    }
+  }
+
+  // Too big for any size class
+  return nullptr;
+}
@@ -0,0 +1,81 @@
+/*
+ *      Copyright (C) 2010-2019 Hendrik Leppkes
+ *      http://www.1f0.de
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program; if not, write to the Free Software Foundation, Inc.,
+ *  51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#pragma once
+
+#include <vector>
+
+class Packet;
+
+#define PACKET_POOL_DEFAULT_SIZE  256
+#define PACKET_POOL_BUFFER_CLASSES  5
+
+// Pool of recycled Packet objects, AVPacket structures and packet data buffers
+//
+// Packets acquired from the pool return their resources to it when they are deleted.
+// The pool is reference counted and every outstanding packet holds a reference,
+// so packets can safely outlive the demuxer that created them.
+// While the system is low on memory, the unused objects are released instead of kept.
+class CPacketPool
+{
+public:
+  CPacketPool(size_t nMaxFree = PACKET_POOL_DEFAULT_SIZE);
+
+  ULONG AddRef();
+  ULONG Release();
+
+  // Get a new, empty packet from the pool
+  Packet *Acquire();
+
+  // Limit the number of unused objects to keep around
+  void SetMaxFree(size_t nMaxFree);
+  size_t GetMaxFree() const { return m_nMaxFree; }
+
+  // Pool statistics, counting all requests that were (or were not) served from the pool
+  void GetStatistics(ULONGLONG *pHits, ULONGLONG *pMisses);
+  void ResetStatistics();
+
+private:
+  ~CPacketPool();
+
+  friend class Packet;
+  void *AllocPacketMemory(size_t size);
+  void FreePacketMemory(void *ptr);
+  AVPacket *AllocAVPacket();
+  void FreeAVPacket(AVPacket *pkt);
+  AVBufferRef *AllocBuffer(int size);
+
+  // Release all unused objects if the system is low on memory, returns TRUE if it is
+  BOOL TrimLocked();
+
+private:
+  LONG m_cRef = 1;
+
+  CCritSec m_csPool;
+  size_t m_nMaxFree = PACKET_POOL_DEFAULT_SIZE;
+
+  std::vector<void *> m_FreePackets;
+  std::vector<AVPacket *> m_FreeAVPackets;
+
+  // Data buffers for packets that get assembled by the splitter
+  AVBufferPool *m_BufferPools[PACKET_POOL_BUFFER_CLASSES] = { nullptr };
+
+  ULONGLONG m_nHits   = 0;
+  ULONGLONG m_nMisses = 0;
+};
@@ -0,0 +1,193 @@
+/*
+ *      Copyright (C) 2010-2019 Hendrik Leppkes
+ *      http://www.1f0.de
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program; if not, write to the Free Software Foundation, Inc.,
+ *  51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+
+#include "stdafx.h"
+#include "PreBuffer.h"
+
+CPreBuffer::CPreBuffer(CPreBufferSource *pSource)
+  : m_pSource(pSource)
+{
+}
+
+CPreBuffer::~CPreBuffer()
+{
+  Stop();
+  if (m_pBuffer) {
+    VirtualFree(m_pBuffer, 0, MEM_RELEASE);
+    m_pBuffer = nullptr;
+  }
+}
+
+HRESULT CPreBuffer::Init(size_t cbWindow, LONGLONG llLength, LONGLONG llPos)
+{
+  CheckPointer(m_pSource, E_UNEXPECTED);
+  if (m_pBuffer)
+    return E_UNEXPECTED;
+
+  m_cbWindow = max(cbWindow, (size_t)PREBUFFER_MIN_WINDOW);
+  m_pBuffer = (BYTE *)VirtualAlloc(nullptr, m_cbWindow, MEM_COMMIT | MEM_RESERVE, PAGE_READWRITE);
+  if (!m_pBuffer) {
+    DbgLog((LOG_TRACE, 10, L"CPreBuffer::Init(): Allocating %Iu bytes failed", m_cbWindow));
+    return E_OUTOFMEMORY;
+  }
+
+  m_llLength = llLength;
+  m_llStart = m_llEnd = m_llRead = llPos;
+  m_bEnd = FALSE;
+
+  if (!Create())
+    return E_FAIL;
+
+  DbgLog((LOG_TRACE, 10, L"CPreBuffer::Init(): Buffering %Iu bytes", m_cbWindow));
+  return S_OK;
+}
+
+void CPreBuffer::Stop()
+{
+  if (ThreadExists()) {
+    CallWorker(CMD_EXIT);
+    Close();
+  }
+}
+
+void CPreBuffer::Restart(LONGLONG llPos)
+{
+  m_llStart = m_llEnd = m_llRead = llPos;
+  m_bEnd = FALSE;
+  m_dwGeneration++;
+  m_pSource->PreBufferRestart(llPos);
+}
+
+void CPreBuffer::Flush()
+{
+  {
+    CAutoLock lock(&m_csWindow);
+    Restart(m_llRead);
+  }
+  m_evWork.Set();
+}
+
+HRESULT CPreBuffer::Read(LONGLONG llPos, BYTE *pBuffer, LONG lSize, LONG *plRead)
+{
+  CheckPointer(pBuffer, E_POINTER);
+  CheckPointer(plRead, E_POINTER);
+  *plRead = 0;
+
+  for (;;) {
+    {
+      CAutoLock lock(&m_csWindow);
+
+      // a position shortly after the buffered data is only waited for
+      if (llPos < m_llStart || llPos > m_llEnd + PREBUFFER_CHUNK_SIZE) {
+        DbgLog((LOG_TRACE, 10, L"CPreBuffer::Read(): Position %I64d outside of the window (%I64d - %I64d), restarting", llPos, m_llStart, m_llEnd));
+        Restart(llPos);
+        m_evWork.Set();
+      }
+
+      if (llPos < m_llEnd) {
+        LONG lRead = (LONG)min((LONGLONG)lSize, m_llEnd - llPos);
+
+        // the data may wrap around the end of the window
+        size_t offset = (size_t)(llPos % m_cbWindow);
+        size_t first = min((size_t)lRead, m_cbWindow - offset);
+        memcpy(pBuffer, m_pBuffer + offset, first);
+        if (first < (size_t)lRead)
+          memcpy(pBuffer + first, m_pBuffer, lRead - first);
+
+        m_llRead = llPos + lRead;
+        m_evWork.Set();
+
+        *plRead = lRead;
+        return S_OK;
+      }
+
+      m_llRead = llPos;
+      if (m_bEnd)
+        return S_FALSE;
+    }
+
+    if (!ThreadExists())
+      return S_FALSE;
+
+    m_evWork.Set();
+    m_evData.Wait(100);
+  }
+}
+
+DWORD CPreBuffer::ThreadProc()
+{
+  SetThreadName(-1, "CPreBuffer");
+
+  while (!CheckRequest(nullptr)) {
+    LONGLONG llPos = 0;
+    size_t offset = 0;
+    LONG lSize = 0;
+    DWORD dwGeneration = 0;
+
+    {
+      CAutoLock lock(&m_csWindow);
+      if (m_llLength >= 0 && m_llEnd >= m_llLength)
+        m_bEnd = TRUE;
+
+      if (!m_bEnd) {
+        // only keep a quarter of the window behind the reader
+        LONGLONG llKeep = max(m_llStart, min(m_llRead, m_llEnd) - (LONGLONG)(m_cbWindow / 4));
+        size_t cbFree = m_cbWindow - (size_t)(m_llEnd - llKeep);
+
+        // a full window is only refilled once a quarter of it is free, unless the reader is waiting
+        if (cbFree >= m_cbWindow / 4 || (m_llRead >= m_llEnd && cbFree > 0)) {
+          m_llStart = llKeep;
+          llPos = m_llEnd;
+          offset = (size_t)(llPos % m_cbWindow);
+          lSize = (LONG)min(min(cbFree, m_cbWindow - offset), (size_t)PREBUFFER_CHUNK_SIZE);
+          if (m_llLength >= 0)
+            lSize = (LONG)min((LONGLONG)lSize, m_llLength - llPos);
+          dwGeneration = m_dwGeneration;
+        }
+      }
+    }
+
+    if (lSize <= 0) {
+      m_evWork.Wait(100);
+      continue;
+    }
+
+    // reads which were in progress during a restart only write into parts of the window which are not in use yet
+    int ret = m_pSource->PreBufferRead(llPos, m_pBuffer + offset, lSize);
+
+    {
+      CAutoLock lock(&m_csWindow);
+      if (dwGeneration == m_dwGeneration) {
+        if (ret > 0) {
+          m_llEnd += ret;
+        } else {
+          DbgLog((LOG_TRACE, 10, L"CPreBuffer::ThreadProc(): Reading at %I64d ended (%d)", llPos, ret));
+          m_bEnd = TRUE;
+        }
+      }
+    }
+    m_evData.Set();
+  }
+
+  GetRequest();
+  Reply(S_OK);
+
+  return 0;
+}
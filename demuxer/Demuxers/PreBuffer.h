@@ -0,0 +1,94 @@
+/*
+ *      Copyright (C) 2010-2019 Hendrik Leppkes
+ *      http://www.1f0.de
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program; if not, write to the Free Software Foundation, Inc.,
+ *  51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+
+#pragma once
+
+#define PREBUFFER_CHUNK_SIZE (4 << 20)
+#define PREBUFFER_MIN_WINDOW (4 * PREBUFFER_CHUNK_SIZE)
+
+// Source of the data of a pre-buffer
+class CPreBufferSource
+{
+public:
+  virtual ~CPreBufferSource() {}
+
+  // Read up to size bytes at llPos, called on the pre-buffer thread
+  // Consecutive calls continue where the previous one ended, unless buffering was restarted.
+  // Returns the number of bytes read, 0 at the end of the source, or a negative value on errors
+  virtual int PreBufferRead(LONGLONG llPos, BYTE *pBuffer, int size) = 0;
+
+  // Notify that the buffered data was dropped, and buffering restarts at llPos
+  // Called on the thread of the reader, while it holds the lock of the pre-buffer.
+  virtual void PreBufferRestart(LONGLONG llPos) {}
+};
+
+// RAM pre-buffer for slow media, like optical drives and spinning disks
+// A background thread reads ahead of the reader sequentially in large chunks, into a window of memory.
+// A quarter of the window is kept behind the read position, so short seeks in either direction are
+// served from memory instead of waiting for the drive. Once the window is full, the source is left idle
+// until a quarter of it was consumed again, which allows the drive to spin down during long stretches.
+class CPreBuffer : protected CAMThread
+{
+public:
+  CPreBuffer(CPreBufferSource *pSource);
+  ~CPreBuffer();
+
+  // Allocate the window and start buffering at llPos
+  // llLength is the size of the source, or -1 if it is not known
+  HRESULT Init(size_t cbWindow, LONGLONG llLength, LONGLONG llPos = 0);
+
+  // Read up to lSize bytes at llPos, waiting until the data is buffered
+  // A position outside of the window restarts buffering there.
+  // Returns S_FALSE if nothing could be read, at the end of the source or on read errors
+  HRESULT Read(LONGLONG llPos, BYTE *pBuffer, LONG lSize, LONG *plRead);
+
+  // Drop all buffered data, and restart buffering at the read position
+  void Flush();
+
+  // Stop the thread
+  void Stop();
+
+private:
+  enum {CMD_EXIT};
+  DWORD ThreadProc();
+
+  // Called with the lock held
+  void Restart(LONGLONG llPos);
+
+private:
+  CPreBufferSource *m_pSource = nullptr;
+
+  BYTE *m_pBuffer   = nullptr;
+  size_t m_cbWindow = 0;
+  LONGLONG m_llLength = -1;
+
+  // the data from m_llStart to m_llEnd is buffered, at its position modulo the size of the window
+  CCritSec m_csWindow;
+  LONGLONG m_llStart  = 0;
+  LONGLONG m_llEnd    = 0;
+  LONGLONG m_llRead   = 0;
+  BOOL m_bEnd         = FALSE;   ///< No more data can be read after m_llEnd
+  DWORD m_dwGeneration = 0;      ///< Incremented on every restart, to discard reads which were in progress
+
+  // signaled when the reader moved, or restarted buffering
+  CAMEvent m_evWork;
+  // signaled when the thread buffered more data
+  CAMEvent m_evData;
+};
@@ -0,0 +1,318 @@
+/*
+ *      Copyright (C) 2010-2019 Hendrik Leppkes
+ *      http://www.1f0.de
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program; if not, write to the Free Software Foundation, Inc.,
+ *  51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#include "stdafx.h"
+#include "ProbeCache.h"
+
+#define PROBE_CACHE_MAGIC         MKTAG('L', 'A', 'V', 'P')
+#define PROBE_CACHE_VERSION       1
+#define PROBE_CACHE_MAX_STREAMS   1024
+#define PROBE_CACHE_MAX_EXTRADATA (16 << 20)
+
+// Codec parameters and stream properties filled in by avformat_find_stream_info
+struct ProbeCacheStream {
+  int id;
+  AVRational time_base;
+  int64_t start_time;
+  int64_t duration;
+  int64_t nb_frames;
+  int disposition;
+  AVRational sample_aspect_ratio;
+  AVRational avg_frame_rate;
+  AVRational r_frame_rate;
+  int codec_info_nb_frames;
+
+  AVMediaType codec_type;
+  AVCodecID codec_id;
+  uint32_t codec_tag;
+  int format;
+  int64_t bit_rate;
+  int bits_per_coded_sample;
+  int bits_per_raw_sample;
+  int profile;
+  int level;
+  int width;
+  int height;
+  AVRational codec_sample_aspect_ratio;
+  AVFieldOrder field_order;
+  AVColorRange color_range;
+  AVColorPrimaries color_primaries;
+  AVColorTransferCharacteristic color_trc;
+  AVColorSpace color_space;
+  AVChromaLocation chroma_location;
+  int video_delay;
+  uint64_t channel_layout;
+  int channels;
+  int sample_rate;
+  int block_align;
+  int frame_size;
+  int initial_padding;
+  int trailing_padding;
+  int seek_preroll;
+  int extradata_size;
+};
+
+CProbeCache::CProbeCache()
+{
+}
+
+CProbeCache::~CProbeCache()
+{
+}
+
+HRESULT CProbeCache::Open(LPCWSTR pszFileName)
+{
+  if (FAILED(GetFileIdentity(pszFileName, m_Identity)))
+    return E_FAIL;
+
+  return GetCacheFilePath(L"ProbeCache", m_Identity, m_strCacheDir, m_strCacheFile);
+}
+
+HRESULT CProbeCache::Restore(AVFormatContext *avFormat)
+{
+  CheckPointer(avFormat, E_POINTER);
+
+  std::vector<BYTE> data;
+  if (ReadCacheFile(m_strCacheFile, data) != S_OK)
+    return S_FALSE;
+
+  CCacheReader reader(data);
+  if (!reader.CheckIdentity(PROBE_CACHE_MAGIC, PROBE_CACHE_VERSION, m_Identity))
+    return S_FALSE;
+
+  std::string format;
+  int64_t duration = 0, start_time = 0, bit_rate = 0;
+  DWORD nb_streams = 0;
+  if (!reader.ReadString(format) || !reader.Read(duration) || !reader.Read(start_time) || !reader.Read(bit_rate) || !reader.Read(nb_streams))
+    return S_FALSE;
+
+  // The demuxer needs to have created the same streams while reading the header
+  if (format != avFormat->iformat->name || nb_streams != avFormat->nb_streams || nb_streams > PROBE_CACHE_MAX_STREAMS) {
+    DbgLog((LOG_TRACE, 10, L"CProbeCache::Restore(): Layout mismatch (format: %S, streams: %u/%u)", format.c_str(), nb_streams, avFormat->nb_streams));
+    return S_FALSE;
+  }
+
+  // Validate all streams before touching the format context
+  std::vector<ProbeCacheStream> streams(nb_streams);
+  std::vector<const BYTE *> extradata(nb_streams);
+  for (DWORD i = 0; i < nb_streams; i++) {
+    ProbeCacheStream &s = streams[i];
+    const AVStream *st = avFormat->streams[i];
+
+    if (!reader.Read(s) || s.extradata_size < 0 || s.extradata_size > PROBE_CACHE_MAX_EXTRADATA)
+      return S_FALSE;
+    extradata[i] = reader.Peek(s.extradata_size);
+    if (!reader.Skip(s.extradata_size))
+      return S_FALSE;
+
+    if (s.id != st->id || av_cmp_q(s.time_base, st->time_base) != 0
+      || (st->codecpar->codec_id != AV_CODEC_ID_NONE && st->codecpar->codec_id != s.codec_id)) {
+      DbgLog((LOG_TRACE, 10, L"CProbeCache::Restore(): Stream %u (id %d) does not match the cached layout", i, st->id));
+      return S_FALSE;
+    }
+  }
+
+  m_Streams.clear();
+  for (DWORD i = 0; i < nb_streams; i++) {
+    const ProbeCacheStream &s = streams[i];
+    AVStream *st = avFormat->streams[i];
+    AVCodecParameters *par = st->codecpar;
+
+    st->start_time = s.start_time;
+    st->duration = s.duration;
+    st->nb_frames = s.nb_frames;
+    st->disposition = s.disposition;
+    st->sample_aspect_ratio = s.sample_aspect_ratio;
+    st->avg_frame_rate = s.avg_frame_rate;
+    st->r_frame_rate = s.r_frame_rate;
+    st->codec_info_nb_frames = s.codec_info_nb_frames;
+
+    // The codec is known now, no need to probe the packets for it
+    if (s.codec_id != AV_CODEC_ID_NONE)
+      st->request_probe = 0;
+
+    par->codec_type = s.codec_type;
+    par->codec_id = s.codec_id;
+    par->codec_tag = s.codec_tag;
+    par->format = s.format;
+    par->bit_rate = s.bit_rate;
+    par->bits_per_coded_sample = s.bits_per_coded_sample;
+    par->bits_per_raw_sample = s.bits_per_raw_sample;
+    par->profile = s.profile;
+    par->level = s.level;
+    par->width = s.width;
+    par->height = s.height;
+    par->sample_aspect_ratio = s.codec_sample_aspect_ratio;
+    par->field_order = s.field_order;
+    par->color_range = s.color_range;
+    par->color_primaries = s.color_primaries;
+    par->color_trc = s.color_trc;
+    par->color_space = s.color_space;
+    par->chroma_location = s.chroma_location;
+    par->video_delay = s.video_delay;
+    par->channel_layout = s.channel_layout;
+    par->channels = s.channels;
+    par->sample_rate = s.sample_rate;
+    par->block_align = s.block_align;
+    par->frame_size = s.frame_size;
+    par->initial_padding = s.initial_padding;
+    par->trailing_padding = s.trailing_padding;
+    par->seek_preroll = s.seek_preroll;
+
+    av_freep(&par->extradata);
+    par->extradata_size = 0;
+    if (s.extradata_size > 0) {
+      par->extradata = (uint8_t *)av_mallocz(s.extradata_size + AV_INPUT_BUFFER_PADDING_SIZE);
+      if (par->extradata) {
+        memcpy(par->extradata, extradata[i], s.extradata_size);
+        par->extradata_size = s.extradata_size;
+      }
+    }
+
+    StreamLayout layout = { s.codec_type, s.codec_id, s.width, s.height };
+    m_Streams.push_back(layout);
+  }
+
+  avFormat->duration = duration;
+  avFormat->start_time = start_time;
+  avFormat->bit_rate = bit_rate;
+
+  m_bRestored = TRUE;
+  m_nValidated = 0;
+
+  DbgLog((LOG_TRACE, 10, L"CProbeCache::Restore(): Restored the layout of %u streams", nb_streams));
+
+  return S_OK;
+}
+
+HRESULT CProbeCache::Store(const AVFormatContext *avFormat)
+{
+  CheckPointer(avFormat, E_POINTER);
+
+  if (m_strCacheFile.empty() || avFormat->nb_streams == 0 || avFormat->nb_streams > PROBE_CACHE_MAX_STREAMS)
+    return S_FALSE;
+
+  CCacheWriter writer;
+  writer.WriteIdentity(PROBE_CACHE_MAGIC, PROBE_CACHE_VERSION, m_Identity);
+  writer.WriteString(avFormat->iformat->name);
+  writer.Write(avFormat->duration);
+  writer.Write(avFormat->start_time);
+  writer.Write(avFormat->bit_rate);
+  writer.Write((DWORD)avFormat->nb_streams);
+
+  for (unsigned i = 0; i < avFormat->nb_streams; i++) {
+    const AVStream *st = avFormat->streams[i];
+    const AVCodecParameters *par = st->codecpar;
+
+    ProbeCacheStream s;
+    memset(&s, 0, sizeof(s));
+
+    s.id = st->id;
+    s.time_base = st->time_base;
+    s.start_time = st->start_time;
+    s.duration = st->duration;
+    s.nb_frames = st->nb_frames;
+    s.disposition = st->disposition;
+    s.sample_aspect_ratio = st->sample_aspect_ratio;
+    s.avg_frame_rate = st->avg_frame_rate;
+    s.r_frame_rate = st->r_frame_rate;
+    s.codec_info_nb_frames = st->codec_info_nb_frames;
+
+    s.codec_type = par->codec_type;
+    s.codec_id = par->codec_id;
+    s.codec_tag = par->codec_tag;
+    s.format = par->format;
+    s.bit_rate = par->bit_rate;
+    s.bits_per_coded_sample = par->bits_per_coded_sample;
+    s.bits_per_raw_sample = par->bits_per_raw_sample;
+    s.profile = par->profile;
+    s.level = par->level;
+    s.width = par->width;
+    s.height = par->height;
+    s.codec_sample_aspect_ratio = par->sample_aspect_ratio;
+    s.field_order = par->field_order;
+    s.color_range = par->color_range;
+    s.color_primaries = par->color_primaries;
+    s.color_trc = par->color_trc;
+    s.color_space = par->color_space;
+    s.chroma_location = par->chroma_location;
+    s.video_delay = par->video_delay;
+    s.channel_layout = par->channel_layout;
+    s.channels = par->channels;
+    s.sample_rate = par->sample_rate;
+    s.block_align = par->block_align;
+    s.frame_size = par->frame_size;
+    s.initial_padding = par->initial_padding;
+    s.trailing_padding = par->trailing_padding;
+    s.seek_preroll = par->seek_preroll;
+    s.extradata_size = par->extradata ? par->extradata_size : 0;
+
+    writer.Write(s);
+    if (s.extradata_size > 0)
+      writer.WriteBytes(par->extradata, s.extradata_size);
+  }
+
+  HRESULT hr = WriteCacheFile(m_strCacheDir, m_strCacheFile, writer.GetData(), PROBE_CACHE_MAX_FILES);
+  if (SUCCEEDED(hr)) {
+    DbgLog((LOG_TRACE, 10, L"CProbeCache::Store(): Stored the layout of %u streams", avFormat->nb_streams));
+  }
+
+  return hr;
+}
+
+HRESULT CProbeCache::Validate(const AVFormatContext *avFormat, const AVPacket *pkt)
+{
+  if (!m_bRestored || m_nValidated >= PROBE_CACHE_VALIDATE_PACKETS)
+    return S_FALSE;
+
+  m_nValidated++;
+
+  BOOL bMismatch = FALSE;
+
+  // New streams showing up means the cached layout is incomplete
+  if (avFormat->nb_streams != m_Streams.size() || pkt->stream_index < 0 || (unsigned)pkt->stream_index >= m_Streams.size()) {
+    bMismatch = TRUE;
+  } else {
+    const AVStream *st = avFormat->streams[pkt->stream_index];
+    const StreamLayout &layout = m_Streams[pkt->stream_index];
+
+    if (st->codecpar->codec_id != layout.codec_id) {
+      bMismatch = TRUE;
+    } else if (layout.codec_type == AVMEDIA_TYPE_VIDEO && st->parser && st->parser->width > 0 && st->parser->height > 0) {
+      // The parser reports the dimensions found in the bitstream
+      bMismatch = (st->parser->width != layout.width || st->parser->height != layout.height);
+    }
+  }
+
+  if (bMismatch) {
+    DbgLog((LOG_TRACE, 10, L"CProbeCache::Validate(): Packet %d of stream %d disagrees with the cached layout, dropping the cache", m_nValidated, pkt->stream_index));
+    Invalidate();
+    return S_FALSE;
+  }
+
+  return S_OK;
+}
+
+void CProbeCache::Invalidate()
+{
+  if (!m_strCacheFile.empty())
+    DeleteFileW(m_strCacheFile.c_str());
+
+  m_bRestored = FALSE;
+}
@@ -0,0 +1,76 @@
+/*
+ *      Copyright (C) 2010-2019 Hendrik Leppkes
+ *      http://www.1f0.de
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program; if not, write to the Free Software Foundation, Inc.,
+ *  51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#pragma once
+
+#include <string>
+#include <vector>
+
+#include "FileCache.h"
+
+#define PROBE_CACHE_MAX_FILES         256 // number of stream layouts to keep in the cache
+#define PROBE_CACHE_VALIDATE_PACKETS  256 // number of packets after opening that are checked against the cached layout
+
+// Persistent cache of the stream layout found by avformat_find_stream_info
+//
+// The codec parameters and timing information of all streams are stored on disk keyed by
+// the identity of the file, and restored on the next open instead of probing the file again.
+// The first packets demuxed afterwards are checked against the cached layout, and the cache
+// is dropped if they disagree, so the next open will probe the file again.
+class CProbeCache
+{
+public:
+  CProbeCache();
+  ~CProbeCache();
+
+  HRESULT Open(LPCWSTR pszFileName);
+
+  // Restore the cached layout into the streams of the format context
+  // Returns S_FALSE if there is no usable cached layout, and the file needs to be probed
+  HRESULT Restore(AVFormatContext *avFormat);
+
+  // Store the probed layout of the format context
+  HRESULT Store(const AVFormatContext *avFormat);
+
+  // Check a demuxed packet against the restored layout
+  // Returns S_FALSE once validation is finished
+  HRESULT Validate(const AVFormatContext *avFormat, const AVPacket *pkt);
+
+  BOOL IsRestored() const { return m_bRestored; }
+
+private:
+  struct StreamLayout {
+    AVMediaType codec_type;
+    AVCodecID codec_id;
+    int width;
+    int height;
+  };
+
+  void Invalidate();
+
+private:
+  FileIdentity m_Identity;
+  std::wstring m_strCacheDir;
+  std::wstring m_strCacheFile;
+
+  BOOL m_bRestored   = FALSE;
+  int m_nValidated   = 0;
+
+  std::vector<StreamLayout> m_Streams;
+};
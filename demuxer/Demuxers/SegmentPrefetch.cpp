@@ -0,0 +1,708 @@
+/*
+ *      Copyright (C) 2010-2019 Hendrik Leppkes
+ *      http://www.1f0.de
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program; if not, write to the Free Software Foundation, Inc.,
+ *  51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#include "stdafx.h"
+#include "SegmentPrefetch.h"
+
+#include <process.h>
+#include <Shlwapi.h>
+
+#define SEGMENT_READ_BUFFER_SIZE 32768
+
+static BOOL url_has_extension(const char *url, const char *ext)
+{
+  const size_t len = strcspn(url, "?#");
+  const size_t ext_len = strlen(ext);
+  return len > ext_len && _strnicmp(url + len - ext_len, ext, ext_len) == 0;
+}
+
+static BOOL is_digits(const std::string &str, size_t pos, size_t len)
+{
+  if (len == 0)
+    return FALSE;
+  for (size_t i = pos; i < pos + len; i++) {
+    if (str[i] < '0' || str[i] > '9')
+      return FALSE;
+  }
+  return TRUE;
+}
+
+// Resolve a relative playlist entry like the hls demuxer does, dot segments are not handled
+// Entries which resolve differently are simply not prefetched
+static std::string resolve_url(const std::string &base, const std::string &rel)
+{
+  if (rel.find("://") != std::string::npos)
+    return rel;
+
+  const size_t scheme = base.find("://");
+  if (scheme == std::string::npos)
+    return rel;
+
+  if (rel.compare(0, 2, "//") == 0)
+    return base.substr(0, scheme + 1) + rel;
+
+  if (rel[0] == '/') {
+    const size_t host_end = base.find('/', scheme + 3);
+    return (host_end == std::string::npos ? base : base.substr(0, host_end)) + rel;
+  }
+
+  const std::string path = base.substr(0, base.find_first_of("?#"));
+  const size_t slash = path.rfind('/');
+  if (slash == std::string::npos || slash < scheme + 3)
+    return path + "/" + rel;
+  return path.substr(0, slash + 1) + rel;
+}
+
+BOOL CSegmentPrefetch::IsManifestUrl(const char *url)
+{
+  return url_has_extension(url, ".m3u8") || url_has_extension(url, ".m3u") || url_has_extension(url, ".mpd");
+}
+
+static BOOL is_hls_playlist(const char *url, AVIOContext *pb)
+{
+  if (url_has_extension(url, ".m3u8") || url_has_extension(url, ".m3u"))
+    return TRUE;
+
+  BOOL bPlaylist = FALSE;
+  uint8_t *mime = nullptr;
+  if (av_opt_get(pb, "mime_type", AV_OPT_SEARCH_CHILDREN, &mime) >= 0 && mime) {
+    bPlaylist = StrStrIA((const char *)mime, "mpegurl") != nullptr;
+    av_free(mime);
+  }
+  return bPlaylist;
+}
+
+std::string CSegmentPrefetch::Series::GetUrl(LONGLONG llIndex) const
+{
+  if (IsNumbered()) {
+    if (llIndex < 0)
+      return std::string();
+    char number[32];
+    sprintf_s(number, "%0*I64d", nDigits, llIndex);
+    return prefix + number + suffix;
+  }
+
+  // encrypted segments are opened through the crypto protocol, and never match a prefetch
+  auto it = playlist.find(llIndex);
+  if (it == playlist.end() || it->second.bEncrypted)
+    return std::string();
+  return it->second.url;
+}
+
+CSegmentPrefetch::CSegmentPrefetch(DWORD dwMaxSegments)
+  : m_dwMaxSegments(dwMaxSegments)
+{
+}
+
+CSegmentPrefetch::~CSegmentPrefetch()
+{
+  m_bExit = TRUE;
+  m_evRequest.Set();
+  if (m_dwWorkers > 0) {
+    WaitForMultipleObjects(m_dwWorkers, m_hWorkers, TRUE, INFINITE);
+    for (DWORD i = 0; i < m_dwWorkers; i++)
+      CloseHandle(m_hWorkers[i]);
+    m_dwWorkers = 0;
+  }
+
+  ASSERT(m_MemoryContexts.empty());
+
+  for (auto &it : m_Segments)
+    av_free(it.second.pData);
+  m_Segments.clear();
+  av_dict_free(&m_Options);
+
+  DbgLog((LOG_TRACE, 10, L"CSegmentPrefetch::~CSegmentPrefetch(): %u segments read from memory, %u requested directly", m_dwHits, m_dwMisses));
+}
+
+void CSegmentPrefetch::Attach(AVFormatContext *s)
+{
+  m_pfnIoOpen = s->io_open;
+  m_pfnIoClose = s->io_close;
+  m_Interrupt = s->interrupt_callback;
+
+  s->opaque = this;
+  s->io_open = IoOpen;
+  s->io_close = IoClose;
+
+  for (; m_dwWorkers < SEGMENT_PREFETCH_CONNECTIONS; m_dwWorkers++) {
+    m_hWorkers[m_dwWorkers] = (HANDLE)_beginthreadex(nullptr, 0, WorkerThreadProc, (LPVOID)this, 0, nullptr);
+    if (!m_hWorkers[m_dwWorkers])
+      break;
+  }
+}
+
+int CSegmentPrefetch::IoOpen(AVFormatContext *s, AVIOContext **pb, const char *url, int flags, AVDictionary **options)
+{
+  CSegmentPrefetch *prefetch = static_cast<CSegmentPrefetch *>(s->opaque);
+  return prefetch->Open(s, pb, url, flags, options);
+}
+
+void CSegmentPrefetch::IoClose(AVFormatContext *s, AVIOContext *pb)
+{
+  CSegmentPrefetch *prefetch = static_cast<CSegmentPrefetch *>(s->opaque);
+  {
+    CAutoLock lock(&prefetch->m_csSegments);
+    if (prefetch->m_MemoryContexts.erase(pb)) {
+      MemoryReader *reader = static_cast<MemoryReader *>(pb->opaque);
+      av_free(reader->pData);
+      delete reader;
+      av_free(pb->buffer);
+      av_free(pb);
+      return;
+    }
+  }
+  prefetch->m_pfnIoClose(s, pb);
+}
+
+int CSegmentPrefetch::Open(AVFormatContext *s, AVIOContext **pb, const char *url, int flags, AVDictionary **options)
+{
+  // byte ranges of a file are read directly
+  if ((flags & AVIO_FLAG_WRITE) || (_strnicmp(url, "http:", 5) != 0 && _strnicmp(url, "https:", 6) != 0)
+    || (options && av_dict_get(*options, "offset", nullptr, 0)))
+    return m_pfnIoOpen(s, pb, url, flags, options);
+
+  // the main input is closed by avformat without the io_close callback, so it can't be a memory context
+  const BOOL bMainInput = s->pb == nullptr && s->url && strcmp(s->url, url) == 0;
+
+  {
+    CAutoLock lock(&m_csSegments);
+
+    // the prefetches are made with the same cookies and headers
+    av_dict_free(&m_Options);
+    if (options)
+      av_dict_copy(&m_Options, *options, 0);
+
+    int nSeries = -1;
+    LONGLONG llIndex = 0;
+    if (!bMainInput && FindSegment(url, &nSeries, &llIndex)) {
+      Series &series = m_Series[nSeries];
+      series.llPosition = llIndex;
+      series.ullLastUse = GetTickCount64();
+      if (series.llFailed >= 0 && llIndex >= series.llFailed)
+        series.llFailed = -1;
+      Schedule(nSeries);
+
+      // wait for a prefetch in progress, it is ahead of a new request
+      auto it = m_Segments.find(url);
+      while (it != m_Segments.end() && it->second.state == SegmentLoading) {
+        m_csSegments.Unlock();
+        const BOOL bInterrupted = Interrupt(this);
+        if (!bInterrupted)
+          m_evSegmentDone.Wait(50);
+        m_csSegments.Lock();
+
+        if (bInterrupted)
+          return AVERROR_EXIT;
+        it = m_Segments.find(url);
+      }
+
+      if (it != m_Segments.end() && it->second.state == SegmentReady) {
+        uint8_t *pData = it->second.pData;
+        const int nSize = it->second.nSize;
+        m_nMemory -= nSize;
+        m_Segments.erase(it);
+
+        int ret = OpenMemory(pb, pData, nSize);
+        if (ret >= 0) {
+          m_dwHits++;
+          return ret;
+        }
+      } else {
+        // a prefetch which did not start yet is no faster than the request of the demuxer
+        DropSegment(url);
+      }
+      m_dwMisses++;
+    }
+  }
+
+  int ret = m_pfnIoOpen(s, pb, url, flags, options);
+
+  // The demuxer reads its own copy of the playlist, so redirects and cookies behave as before,
+  // and a worker fetches it once more to learn the segment URLs
+  if (ret >= 0 && is_hls_playlist(url, *pb)) {
+    CAutoLock lock(&m_csSegments);
+    QueuePlaylist(url);
+  }
+
+  return ret;
+}
+
+// Called with the segment lock held, takes ownership of the data
+int CSegmentPrefetch::OpenMemory(AVIOContext **pb, uint8_t *pData, int nSize)
+{
+  MemoryReader *reader = new MemoryReader();
+  reader->pData = pData;
+  reader->nSize = nSize;
+
+  uint8_t *buffer = (uint8_t *)av_malloc(SEGMENT_READ_BUFFER_SIZE);
+  AVIOContext *ctx = buffer ? avio_alloc_context(buffer, SEGMENT_READ_BUFFER_SIZE, 0, reader, ReadMemory, nullptr, SeekMemory) : nullptr;
+  if (!ctx) {
+    av_free(buffer);
+    av_free(pData);
+    delete reader;
+    return AVERROR(ENOMEM);
+  }
+
+  m_MemoryContexts.insert(ctx);
+  *pb = ctx;
+  return 0;
+}
+
+int CSegmentPrefetch::ReadMemory(void *opaque, uint8_t *buf, int buf_size)
+{
+  MemoryReader *reader = static_cast<MemoryReader *>(opaque);
+  if (reader->nPos >= reader->nSize)
+    return AVERROR_EOF;
+
+  const int size = min(buf_size, reader->nSize - reader->nPos);
+  memcpy(buf, reader->pData + reader->nPos, size);
+  reader->nPos += size;
+  return size;
+}
+
+int64_t CSegmentPrefetch::SeekMemory(void *opaque, int64_t offset, int whence)
+{
+  MemoryReader *reader = static_cast<MemoryReader *>(opaque);
+
+  int64_t pos = 0;
+  whence &= ~AVSEEK_FORCE;
+  if (whence == SEEK_SET) {
+    pos = offset;
+  } else if (whence == SEEK_CUR) {
+    pos = reader->nPos + offset;
+  } else if (whence == SEEK_END) {
+    pos = reader->nSize + offset;
+  } else if (whence == AVSEEK_SIZE) {
+    return reader->nSize;
+  } else
+    return -1;
+
+  if (pos < 0 || pos > reader->nSize)
+    return AVERROR(EINVAL);
+
+  reader->nPos = (int)pos;
+  return pos;
+}
+
+// Fetches are aborted when the demuxer is interrupted, or the prefetcher is destroyed
+int CSegmentPrefetch::Interrupt(void *opaque)
+{
+  CSegmentPrefetch *prefetch = static_cast<CSegmentPrefetch *>(opaque);
+  if (prefetch->m_bExit)
+    return 1;
+  if (prefetch->m_Interrupt.callback)
+    return prefetch->m_Interrupt.callback(prefetch->m_Interrupt.opaque);
+  return 0;
+}
+
+HRESULT CSegmentPrefetch::Fetch(const std::string &url, int nMaxSize, uint8_t **ppData, int *pnSize, std::string *pLocation)
+{
+  AVDictionary *options = nullptr;
+  {
+    CAutoLock lock(&m_csSegments);
+    av_dict_copy(&options, m_Options, 0);
+  }
+
+  AVIOInterruptCB cb = { Interrupt, this };
+  AVIOContext *pb = nullptr;
+  int ret = avio_open2(&pb, url.c_str(), AVIO_FLAG_READ, &cb, &options);
+  av_dict_free(&options);
+  if (ret < 0) {
+    DbgLog((LOG_TRACE, 10, L"CSegmentPrefetch::Fetch(): Opening %S failed (%d)", url.c_str(), ret));
+    return E_FAIL;
+  }
+
+  const int64_t size = avio_size(pb);
+  if (size > nMaxSize) {
+    avio_closep(&pb);
+    return E_FAIL;
+  }
+
+  // one byte more than the announced size, to read up to the end of the file without growing the buffer
+  int nAlloc = size > 0 ? (int)size + 1 : min(1 << 20, nMaxSize + 1);
+  int nRead = 0;
+  uint8_t *pData = (uint8_t *)av_malloc(nAlloc);
+  while (pData) {
+    ret = avio_read(pb, pData + nRead, nAlloc - nRead);
+    if (ret <= 0)
+      break;
+    nRead += ret;
+    if (nRead == nAlloc) {
+      if (nAlloc > nMaxSize) {
+        ret = AVERROR(ENOMEM);
+        break;
+      }
+      nAlloc = min(nAlloc * 2, nMaxSize + 1);
+      if (av_reallocp(&pData, nAlloc) < 0)
+        break;
+    }
+  }
+
+  if (pLocation) {
+    uint8_t *location = nullptr;
+    if (av_opt_get(pb, "location", AV_OPT_SEARCH_CHILDREN, &location) >= 0 && location) {
+      *pLocation = (const char *)location;
+      av_free(location);
+    }
+  }
+  avio_closep(&pb);
+
+  if (!pData || (ret < 0 && ret != AVERROR_EOF) || nRead == 0) {
+    DbgLog((LOG_TRACE, 10, L"CSegmentPrefetch::Fetch(): Reading %S failed after %d bytes (%d)", url.c_str(), nRead, ret));
+    av_free(pData);
+    return E_FAIL;
+  }
+
+  *ppData = pData;
+  *pnSize = nRead;
+  return S_OK;
+}
+
+unsigned int WINAPI CSegmentPrefetch::WorkerThreadProc(LPVOID pv)
+{
+  CSegmentPrefetch *prefetch = static_cast<CSegmentPrefetch *>(pv);
+  prefetch->Worker();
+  return 0;
+}
+
+void CSegmentPrefetch::Worker()
+{
+  SetThreadName(-1, "CSegmentPrefetch Worker");
+
+  while (!m_bExit) {
+    std::string url;
+    BOOL bPlaylist = FALSE;
+    {
+      // playlists come first, they tell which segments to fetch
+      CAutoLock lock(&m_csSegments);
+      if (!m_PlaylistRequests.empty()) {
+        url = m_PlaylistRequests.front();
+        m_PlaylistRequests.pop_front();
+        bPlaylist = TRUE;
+      } else if (!m_Requests.empty()) {
+        url = m_Requests.front();
+        m_Requests.pop_front();
+        m_Segments[url].state = SegmentLoading;
+      }
+      if (m_PlaylistRequests.empty() && m_Requests.empty() && !m_bExit)
+        m_evRequest.Reset();
+    }
+
+    if (url.empty()) {
+      m_evRequest.Wait(100);
+      continue;
+    }
+
+    uint8_t *pData = nullptr;
+    int nSize = 0;
+    std::string location;
+    HRESULT hr = Fetch(url, bPlaylist ? SEGMENT_PREFETCH_PLAYLIST_SIZE : SEGMENT_PREFETCH_MAX_SIZE, &pData, &nSize, bPlaylist ? &location : nullptr);
+
+    if (bPlaylist) {
+      if (SUCCEEDED(hr))
+        ParsePlaylist(url, location.empty() ? url : location, (const char *)pData, nSize);
+      av_free(pData);
+      continue;
+    }
+
+    {
+      // segments which are loading are never removed from the map
+      CAutoLock lock(&m_csSegments);
+      Segment &segment = m_Segments[url];
+      Series &series = m_Series[segment.nSeries];
+      if (SUCCEEDED(hr)) {
+        segment.pData = pData;
+        segment.nSize = nSize;
+        segment.state = SegmentReady;
+        m_nMemory += nSize;
+
+        // estimate the bitrate, to size the prefetch window
+        series.llAvgSize = series.llAvgSize ? (3 * series.llAvgSize + nSize) / 4 : nSize;
+        auto entry = series.playlist.find(segment.llIndex);
+        if (entry != series.playlist.end() && entry->second.dDuration > 0.0) {
+          const LONGLONG llBitrate = (LONGLONG)(nSize * 8.0 / entry->second.dDuration);
+          series.llBitrate = series.llBitrate ? (3 * series.llBitrate + llBitrate) / 4 : llBitrate;
+        }
+      } else {
+        segment.state = SegmentFailed;
+        // not published yet, or not part of the stream, don't try further segments until the demuxer gets there
+        if (!Interrupt(this) && (series.llFailed < 0 || segment.llIndex < series.llFailed))
+          series.llFailed = segment.llIndex;
+      }
+    }
+    m_evSegmentDone.Set();
+  }
+}
+
+void CSegmentPrefetch::ParsePlaylist(const std::string &url, const std::string &base, const char *data, int size)
+{
+  if (size < 7 || strncmp(data, "#EXTM3U", 7) != 0)
+    return;
+
+  std::map<LONGLONG, PlaylistEntry> segments;
+  std::vector<std::pair<std::string, LONGLONG>> variants;
+  LONGLONG llSequence = 0, llBandwidth = -1;
+  double dDuration = 0.0, dTotal = 0.0;
+  BOOL bEncrypted = FALSE;
+
+  const char *p = data, *end = data + size;
+  while (p < end) {
+    const char *eol = (const char *)memchr(p, '\n', end - p);
+    if (!eol)
+      eol = end;
+    std::string line(p, eol);
+    p = eol + 1;
+
+    while (!line.empty() && isspace((unsigned char)line.back()))
+      line.pop_back();
+    if (line.empty())
+      continue;
+
+    if (line[0] == '#') {
+      if (line.compare(0, 22, "#EXT-X-MEDIA-SEQUENCE:") == 0) {
+        llSequence = _atoi64(line.c_str() + 22);
+      } else if (line.compare(0, 8, "#EXTINF:") == 0) {
+        dDuration = atof(line.c_str() + 8);
+      } else if (line.compare(0, 11, "#EXT-X-KEY:") == 0) {
+        bEncrypted = strstr(line.c_str(), "METHOD=NONE") == nullptr;
+      } else if (line.compare(0, 16, "#EXT-X-BYTERANGE") == 0) {
+        // ranges of one file, which the demuxer reads directly
+        return;
+      } else if (line.compare(0, 18, "#EXT-X-STREAM-INF:") == 0) {
+        const char *bandwidth = strstr(line.c_str(), "BANDWIDTH=");
+        llBandwidth = bandwidth ? _atoi64(bandwidth + 10) : 0;
+      }
+      continue;
+    }
+
+    if (llBandwidth >= 0) {
+      variants.push_back(std::make_pair(resolve_url(base, line), llBandwidth));
+      llBandwidth = -1;
+    } else {
+      PlaylistEntry &entry = segments[llSequence++];
+      entry.url = resolve_url(base, line);
+      entry.dDuration = dDuration;
+      entry.bEncrypted = bEncrypted;
+      dTotal += dDuration;
+      dDuration = 0.0;
+    }
+  }
+
+  CAutoLock lock(&m_csSegments);
+
+  for (auto &variant : variants)
+    m_Bandwidths[variant.first] = variant.second;
+
+  if (segments.empty())
+    return;
+  m_bPlaylists = TRUE;
+
+  int nSeries = 0;
+  while (nSeries < (int)m_Series.size() && (m_Series[nSeries].IsNumbered() || m_Series[nSeries].url != url))
+    nSeries++;
+  if (nSeries == (int)m_Series.size()) {
+    m_Series.push_back(Series());
+    m_Series[nSeries].url = url;
+  }
+
+  // a live playlist replaces the segments which were listed before
+  Series &series = m_Series[nSeries];
+  for (auto &it : series.playlist)
+    m_PlaylistSegments.erase(it.second.url);
+  series.playlist.swap(segments);
+  for (auto &it : series.playlist)
+    m_PlaylistSegments[it.second.url] = std::make_pair(nSeries, it.first);
+
+  series.dDuration = dTotal / series.playlist.size();
+  if (series.llBitrate == 0) {
+    auto bandwidth = m_Bandwidths.find(url);
+    if (bandwidth != m_Bandwidths.end())
+      series.llBitrate = bandwidth->second;
+  }
+
+  DbgLog((LOG_TRACE, 10, L"CSegmentPrefetch::ParsePlaylist(): %S with %u segments of %.1f s", url.c_str(), (unsigned)series.playlist.size(), series.dDuration));
+
+  if (series.llPosition >= 0)
+    Schedule(nSeries);
+}
+
+BOOL CSegmentPrefetch::FindSegment(const std::string &url, int *pnSeries, LONGLONG *pllIndex)
+{
+  auto it = m_PlaylistSegments.find(url);
+  if (it != m_PlaylistSegments.end()) {
+    *pnSeries = it->second.first;
+    *pllIndex = it->second.second;
+    return TRUE;
+  }
+
+  // streams with playlists don't need predictions
+  if (m_bPlaylists)
+    return FALSE;
+  return MatchNumbered(url, pnSeries, pllIndex);
+}
+
+// Segment templates with $Number$ (or $Time$ with constant durations) produce URLs which only differ in one number
+BOOL CSegmentPrefetch::MatchNumbered(const std::string &url, int *pnSeries, LONGLONG *pllIndex)
+{
+  for (int i = 0; i < (int)m_Series.size(); i++) {
+    const Series &series = m_Series[i];
+    const size_t affix = series.prefix.size() + series.suffix.size();
+    if (!series.IsNumbered() || url.size() <= affix || url.compare(0, series.prefix.size(), series.prefix) != 0
+      || url.compare(url.size() - series.suffix.size(), series.suffix.size(), series.suffix) != 0
+      || !is_digits(url, series.prefix.size(), url.size() - affix))
+      continue;
+
+    *pnSeries = i;
+    *pllIndex = _atoi64(url.c_str() + series.prefix.size());
+    return TRUE;
+  }
+
+  // a new series, once two URLs differ in one number only
+  for (const std::string &prev : m_RecentUrls) {
+    size_t start = 0;
+    while (start < url.size() && start < prev.size() && url[start] == prev[start])
+      start++;
+    size_t tail = 0;
+    while (tail < url.size() - start && tail < prev.size() - start && url[url.size() - 1 - tail] == prev[prev.size() - 1 - tail])
+      tail++;
+
+    // extend the difference to the whole number
+    while (start > 0 && url[start - 1] >= '0' && url[start - 1] <= '9')
+      start--;
+    while (tail > 0 && url[url.size() - tail] >= '0' && url[url.size() - tail] <= '9')
+      tail--;
+
+    const size_t len = url.size() - start - tail, prev_len = prev.size() - start - tail;
+    if (len > 18 || prev_len > 18 || !is_digits(url, start, len) || !is_digits(prev, start, prev_len))
+      continue;
+
+    const LONGLONG llNumber = _atoi64(url.c_str() + start), llPrevious = _atoi64(prev.c_str() + start);
+    if (llNumber <= llPrevious || m_Series.size() >= SEGMENT_PREFETCH_MAX_SERIES)
+      continue;
+
+    Series series;
+    series.prefix = url.substr(0, start);
+    series.suffix = url.substr(url.size() - tail);
+    series.nDigits = (url[start] == '0' && len > 1) ? (int)len : 0;
+    series.llStep = llNumber - llPrevious;
+    m_Series.push_back(series);
+
+    DbgLog((LOG_TRACE, 10, L"CSegmentPrefetch::MatchNumbered(): Numbered segments %S<n>%S, step %I64d", series.prefix.c_str(), series.suffix.c_str(), series.llStep));
+
+    *pnSeries = (int)m_Series.size() - 1;
+    *pllIndex = llNumber;
+    return TRUE;
+  }
+
+  m_RecentUrls.push_back(url);
+  if (m_RecentUrls.size() > SEGMENT_PREFETCH_MAX_SERIES)
+    m_RecentUrls.pop_front();
+  return FALSE;
+}
+
+int CSegmentPrefetch::GetSegmentsAhead(const Series &series)
+{
+  int nAhead = (int)m_dwMaxSegments;
+  if (series.dDuration > 0.0)
+    nAhead = min(nAhead, max(1, (int)ceil(SEGMENT_PREFETCH_DURATION / series.dDuration)));
+
+  LONGLONG llSegmentSize = series.llAvgSize;
+  if (series.llBitrate > 0 && series.dDuration > 0.0)
+    llSegmentSize = (LONGLONG)(series.llBitrate / 8 * series.dDuration);
+
+  if (llSegmentSize > 0) {
+    // the memory is shared between the playlists in use, like the video and audio renditions
+    const ULONGLONG now = GetTickCount64();
+    LONGLONG llActive = 0;
+    for (const Series &s : m_Series) {
+      if (s.llPosition >= 0 && now - s.ullLastUse < SEGMENT_PREFETCH_ACTIVE_TIME)
+        llActive++;
+    }
+    nAhead = min(nAhead, (int)max(1LL, SEGMENT_PREFETCH_MAX_MEMORY / max(llActive, 1LL) / llSegmentSize));
+  }
+
+  return nAhead;
+}
+
+void CSegmentPrefetch::Schedule(int nSeries)
+{
+  const Series &series = m_Series[nSeries];
+  const LONGLONG llStep = series.IsNumbered() ? series.llStep : 1;
+  const LONGLONG llEnd = series.llPosition + GetSegmentsAhead(series) * llStep;
+
+  // drop the prefetches outside of the window after seeks, and the ones of playlists which are no longer read
+  const ULONGLONG now = GetTickCount64();
+  for (auto it = m_Segments.begin(); it != m_Segments.end();) {
+    const Segment &segment = it->second;
+    const BOOL bOutside = segment.nSeries == nSeries && (segment.llIndex <= series.llPosition || segment.llIndex > llEnd);
+    const BOOL bIdle = now - m_Series[segment.nSeries].ullLastUse >= SEGMENT_PREFETCH_ACTIVE_TIME;
+    if (segment.state == SegmentLoading || (!bOutside && !bIdle)) {
+      ++it;
+      continue;
+    }
+
+    auto request = std::find(m_Requests.begin(), m_Requests.end(), it->first);
+    if (request != m_Requests.end())
+      m_Requests.erase(request);
+    m_nMemory -= segment.nSize;
+    av_free(segment.pData);
+    it = m_Segments.erase(it);
+  }
+
+  for (LONGLONG llIndex = series.llPosition + llStep; llIndex <= llEnd; llIndex += llStep) {
+    if ((series.llFailed >= 0 && llIndex >= series.llFailed) || m_nMemory >= SEGMENT_PREFETCH_MAX_MEMORY)
+      break;
+
+    const std::string url = series.GetUrl(llIndex);
+    if (url.empty())
+      break;
+    if (m_Segments.find(url) != m_Segments.end())
+      continue;
+
+    Segment &segment = m_Segments[url];
+    segment.nSeries = nSeries;
+    segment.llIndex = llIndex;
+    m_Requests.push_back(url);
+    m_evRequest.Set();
+  }
+}
+
+void CSegmentPrefetch::DropSegment(const std::string &url)
+{
+  auto it = m_Segments.find(url);
+  if (it == m_Segments.end() || it->second.state == SegmentLoading)
+    return;
+
+  auto request = std::find(m_Requests.begin(), m_Requests.end(), url);
+  if (request != m_Requests.end())
+    m_Requests.erase(request);
+  m_nMemory -= it->second.nSize;
+  av_free(it->second.pData);
+  m_Segments.erase(it);
+}
+
+void CSegmentPrefetch::QueuePlaylist(const std::string &url)
+{
+  if (std::find(m_PlaylistRequests.begin(), m_PlaylistRequests.end(), url) != m_PlaylistRequests.end())
+    return;
+
+  m_PlaylistRequests.push_back(url);
+  m_evRequest.Set();
+}
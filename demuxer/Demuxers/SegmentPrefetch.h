@@ -0,0 +1,160 @@
+/*
+ *      Copyright (C) 2010-2019 Hendrik Leppkes
+ *      http://www.1f0.de
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program; if not, write to the Free Software Foundation, Inc.,
+ *  51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#pragma once
+
+#include <map>
+#include <set>
+#include <deque>
+#include <vector>
+#include <string>
+#include <algorithm>
+
+#define SEGMENT_PREFETCH_CONNECTIONS   3
+#define SEGMENT_PREFETCH_DURATION      30           // seconds of media prefetched at most, for each playlist
+#define SEGMENT_PREFETCH_MAX_MEMORY    (96 << 20)   // prefetched segments of all playlists together
+#define SEGMENT_PREFETCH_MAX_SIZE      (32 << 20)   // larger segments are read by the demuxer itself
+#define SEGMENT_PREFETCH_PLAYLIST_SIZE (4 << 20)
+#define SEGMENT_PREFETCH_MAX_SERIES    16
+#define SEGMENT_PREFETCH_ACTIVE_TIME   60000        // ms after the last segment request until a playlist is idle
+
+// Prefetching of the segments of adaptive streams (HLS and DASH)
+// The hls and dash demuxers of libavformat open every segment through the io_open callback of the format context,
+// one after the other. The prefetcher installs its own callbacks, and downloads the next segments with a set of
+// worker threads while the demuxer reads the current one. Once the demuxer opens a prefetched segment, it is read
+// from memory.
+//
+// The segment URLs of HLS are taken from the media playlists, which the workers fetch and parse as well.
+// DASH manifests are not parsed, the URLs of numbered segment templates are predicted from the segments
+// which the demuxer opened before.
+class CSegmentPrefetch
+{
+public:
+  CSegmentPrefetch(DWORD dwMaxSegments);
+  ~CSegmentPrefetch();
+
+  // Route the segment requests of the format context through the prefetcher
+  // The format context has to be closed before the prefetcher is destroyed
+  void Attach(AVFormatContext *s);
+
+  // Whether the URL names an HLS playlist or a DASH manifest, by its extension
+  static BOOL IsManifestUrl(const char *url);
+
+private:
+  enum SegmentState { SegmentQueued, SegmentLoading, SegmentReady, SegmentFailed };
+
+  struct PlaylistEntry {
+    std::string url;
+    double dDuration = 0.0;
+    BOOL bEncrypted  = FALSE;
+  };
+
+  // A media playlist, or a series of numbered segments
+  struct Series {
+    // HLS: segments by media sequence number
+    std::map<LONGLONG, PlaylistEntry> playlist;
+    std::string url;
+
+    // DASH: prefix + number + suffix, with a fixed step between segments
+    std::string prefix, suffix;
+    int nDigits         = 0;
+    LONGLONG llStep     = 0;
+
+    LONGLONG llPosition = -1;  // index of the segment opened last
+    LONGLONG llFailed   = -1;  // index of the first prefetch which failed, nothing is prefetched beyond it
+    ULONGLONG ullLastUse = 0;
+
+    double dDuration    = 0.0; // average segment duration, 0 if unknown
+    LONGLONG llBitrate  = 0;   // bits per second, estimated from the fetched segments
+    LONGLONG llAvgSize  = 0;   // bytes per segment, for series without durations
+
+    BOOL IsNumbered() const { return !prefix.empty(); }
+    std::string GetUrl(LONGLONG llIndex) const;
+  };
+
+  struct Segment {
+    int nSeries       = -1;
+    LONGLONG llIndex  = 0;
+    SegmentState state = SegmentQueued;
+    uint8_t *pData    = nullptr;
+    int nSize         = 0;
+  };
+
+  struct MemoryReader {
+    uint8_t *pData = nullptr;
+    int nSize      = 0;
+    int nPos       = 0;
+  };
+
+  static int IoOpen(AVFormatContext *s, AVIOContext **pb, const char *url, int flags, AVDictionary **options);
+  static void IoClose(AVFormatContext *s, AVIOContext *pb);
+
+  static int ReadMemory(void *opaque, uint8_t *buf, int buf_size);
+  static int64_t SeekMemory(void *opaque, int64_t offset, int whence);
+  static int Interrupt(void *opaque);
+
+  static unsigned int WINAPI WorkerThreadProc(LPVOID pv);
+  void Worker();
+
+  int Open(AVFormatContext *s, AVIOContext **pb, const char *url, int flags, AVDictionary **options);
+  int OpenMemory(AVIOContext **pb, uint8_t *pData, int nSize);
+  HRESULT Fetch(const std::string &url, int nMaxSize, uint8_t **ppData, int *pnSize, std::string *pLocation);
+
+  void ParsePlaylist(const std::string &url, const std::string &base, const char *data, int size);
+
+  // Called with the segment lock held
+  BOOL FindSegment(const std::string &url, int *pnSeries, LONGLONG *pllIndex);
+  BOOL MatchNumbered(const std::string &url, int *pnSeries, LONGLONG *pllIndex);
+  void Schedule(int nSeries);
+  int GetSegmentsAhead(const Series &series);
+  void DropSegment(const std::string &url);
+  void QueuePlaylist(const std::string &url);
+
+private:
+  const DWORD m_dwMaxSegments;
+
+  int (*m_pfnIoOpen)(AVFormatContext *s, AVIOContext **pb, const char *url, int flags, AVDictionary **options) = nullptr;
+  void (*m_pfnIoClose)(AVFormatContext *s, AVIOContext *pb) = nullptr;
+  AVIOInterruptCB m_Interrupt = { nullptr, nullptr };
+
+  CCritSec m_csSegments;
+  std::vector<Series> m_Series;
+  std::map<std::string, std::pair<int, LONGLONG>> m_PlaylistSegments;
+  std::map<std::string, LONGLONG> m_Bandwidths;       // from the variant streams of master playlists
+  std::map<std::string, Segment> m_Segments;
+  std::deque<std::string> m_Requests;
+  std::deque<std::string> m_PlaylistRequests;
+  std::deque<std::string> m_RecentUrls;               // unmatched requests, to find numbered segments
+  std::set<AVIOContext *> m_MemoryContexts;
+  AVDictionary *m_Options = nullptr;                  // of the last request of the demuxer, with its cookies and headers
+  BOOL m_bPlaylists = FALSE;
+  size_t m_nMemory = 0;
+
+  DWORD m_dwHits = 0;
+  DWORD m_dwMisses = 0;
+
+  // set while requests are waiting for a worker
+  CAMEvent m_evRequest{TRUE};
+  // signaled when a worker finished a segment
+  CAMEvent m_evSegmentDone;
+
+  HANDLE m_hWorkers[SEGMENT_PREFETCH_CONNECTIONS] = { 0 };
+  DWORD m_dwWorkers = 0;
+  volatile BOOL m_bExit = FALSE;
+};
@@ -0,0 +1,267 @@
+/*
+ *      Copyright (C) 2010-2019 Hendrik Leppkes
+ *      http://www.1f0.de
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program; if not, write to the Free Software Foundation, Inc.,
+ *  51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+
+#include "stdafx.h"
+#include "SharedBlockCache.h"
+#include "FileCache.h"
+
+CCritSec CSharedBlockCache::s_csInstance;
+CSharedBlockCache *CSharedBlockCache::s_pInstance = nullptr;
+DWORD CSharedBlockCache::s_dwReferences = 0;
+
+CSharedBlockCache *CSharedBlockCache::Acquire(size_t cbMaxSize)
+{
+  CAutoLock lock(&s_csInstance);
+  if (!s_pInstance)
+    s_pInstance = new CSharedBlockCache();
+  s_dwReferences++;
+
+  CAutoLock lockBlocks(&s_pInstance->m_csBlocks);
+  s_pInstance->m_cbMaxSize = cbMaxSize;
+  s_pInstance->EvictBlocks();
+
+  return s_pInstance;
+}
+
+void CSharedBlockCache::Release()
+{
+  CAutoLock lock(&s_csInstance);
+  ASSERT(s_dwReferences > 0 && s_pInstance == this);
+  if (--s_dwReferences == 0) {
+    delete s_pInstance;
+    s_pInstance = nullptr;
+  }
+}
+
+HRESULT CSharedBlockCache::GetBlock(uint64_t file, LONGLONG llBlock, PFN_READ_BLOCK pfnRead, void *opaque, BlockData &data)
+{
+  const BlockKey key(file, llBlock);
+
+  for (;;) {
+    {
+      CAutoLock lock(&m_csBlocks);
+      auto it = m_Blocks.find(key);
+      if (it == m_Blocks.end()) {
+        // claim the block, other readers wait for it instead of reading it as well
+        m_Blocks[key].ullLastUse = ++m_ullUseClock;
+        break;
+      }
+
+      if (!it->second.bLoading) {
+        it->second.ullLastUse = ++m_ullUseClock;
+        data = it->second.data;
+        return S_OK;
+      }
+      m_evBlockDone.Reset();
+    }
+    // the event is shared by all blocks, so only wait shortly before checking again
+    m_evBlockDone.Wait(50);
+  }
+
+  std::shared_ptr<std::vector<BYTE>> pData = std::make_shared<std::vector<BYTE>>();
+  HRESULT hr = pfnRead(opaque, llBlock, *pData);
+
+  {
+    CAutoLock lock(&m_csBlocks);
+    if (SUCCEEDED(hr)) {
+      Block &block = m_Blocks[key];
+      block.bLoading = FALSE;
+      block.data = pData;
+      block.ullLastUse = ++m_ullUseClock;
+      m_cbSize += pData->size();
+      data = pData;
+
+      EvictBlocks();
+    } else {
+      // failed blocks are not cached, the next reader tries again
+      m_Blocks.erase(key);
+    }
+  }
+  m_evBlockDone.Set();
+
+  return hr;
+}
+
+// Blocks still referenced by a reader stay alive until it moves on, they only leave the cache
+void CSharedBlockCache::EvictBlocks()
+{
+  while (m_cbSize > m_cbMaxSize) {
+    auto oldest = m_Blocks.end();
+    for (auto it = m_Blocks.begin(); it != m_Blocks.end(); it++) {
+      if (!it->second.bLoading && (oldest == m_Blocks.end() || it->second.ullLastUse < oldest->second.ullLastUse))
+        oldest = it;
+    }
+    if (oldest == m_Blocks.end())
+      break;
+
+    m_cbSize -= oldest->second.data->size();
+    m_Blocks.erase(oldest);
+  }
+}
+
+CSharedBlockIO::CSharedBlockIO()
+{
+}
+
+CSharedBlockIO::~CSharedBlockIO()
+{
+  Close();
+}
+
+HRESULT CSharedBlockIO::Open(LPCWSTR pszFileName, size_t cbCacheSize)
+{
+  LARGE_INTEGER size;
+  uint8_t *buffer = nullptr;
+
+  Close();
+
+  // the identity changes with the size and modification time, so a modified file never uses stale blocks
+  FileIdentity id;
+  if (FAILED(GetFileIdentity(pszFileName, id)))
+    return E_FAIL;
+  m_FileKey = id.hash;
+
+  m_hFile = CreateFileW(pszFileName, GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+  if (m_hFile == INVALID_HANDLE_VALUE) {
+    DbgLog((LOG_TRACE, 10, L"CSharedBlockIO::Open(): Opening file failed (error: %d)", GetLastError()));
+    return E_FAIL;
+  }
+
+  if (!GetFileSizeEx(m_hFile, &size) || size.QuadPart <= 0)
+    goto fail;
+  m_llSize = size.QuadPart;
+
+  buffer = (uint8_t *)av_mallocz(SHARED_BLOCK_IO_BUFFER_SIZE + AV_INPUT_BUFFER_PADDING_SIZE);
+  m_pAVIOContext = avio_alloc_context(buffer, SHARED_BLOCK_IO_BUFFER_SIZE, 0, this, Read, nullptr, Seek);
+  if (!m_pAVIOContext) {
+    av_free(buffer);
+    goto fail;
+  }
+
+  m_pCache = CSharedBlockCache::Acquire(cbCacheSize);
+  m_llPos = 0;
+
+  DbgLog((LOG_TRACE, 10, L"CSharedBlockIO::Open(): Opened file of %I64d bytes, with a cache of %Iu bytes", m_llSize, cbCacheSize));
+
+  return S_OK;
+fail:
+  Close();
+  return E_FAIL;
+}
+
+void CSharedBlockIO::Close()
+{
+  if (m_pAVIOContext) {
+    av_free(m_pAVIOContext->buffer);
+    av_free(m_pAVIOContext);
+    m_pAVIOContext = nullptr;
+  }
+
+  m_CurrentBlock.reset();
+  m_llCurrentBlock = -1;
+
+  if (m_pCache) {
+    m_pCache->Release();
+    m_pCache = nullptr;
+  }
+
+  if (m_hFile != INVALID_HANDLE_VALUE) {
+    CloseHandle(m_hFile);
+    m_hFile = INVALID_HANDLE_VALUE;
+  }
+
+  m_llSize = 0;
+  m_llPos = 0;
+}
+
+HRESULT CSharedBlockIO::ReadBlock(void *opaque, LONGLONG llBlock, std::vector<BYTE> &data)
+{
+  CSharedBlockIO *io = static_cast<CSharedBlockIO *>(opaque);
+
+  const LONGLONG llStart = llBlock * SHARED_BLOCK_SIZE;
+  const DWORD dwSize = (DWORD)min((LONGLONG)SHARED_BLOCK_SIZE, io->m_llSize - llStart);
+  data.resize(dwSize);
+
+  DWORD dwTotal = 0;
+  while (dwTotal < dwSize) {
+    OVERLAPPED ov = { 0 };
+    ov.Offset = (DWORD)((llStart + dwTotal) & 0xFFFFFFFF);
+    ov.OffsetHigh = (DWORD)((llStart + dwTotal) >> 32);
+
+    DWORD dwRead = 0;
+    if (!ReadFile(io->m_hFile, data.data() + dwTotal, dwSize - dwTotal, &dwRead, &ov) || dwRead == 0) {
+      DbgLog((LOG_TRACE, 10, L"CSharedBlockIO::ReadBlock(): Read failed at pos: %I64d (error: %d)", llStart + dwTotal, GetLastError()));
+      return E_FAIL;
+    }
+    dwTotal += dwRead;
+  }
+
+  return S_OK;
+}
+
+int CSharedBlockIO::Read(void *opaque, uint8_t *buf, int buf_size)
+{
+  CSharedBlockIO *io = static_cast<CSharedBlockIO *>(opaque);
+
+  if (io->m_llPos >= io->m_llSize)
+    return AVERROR_EOF;
+
+  const LONGLONG llBlock = io->m_llPos / SHARED_BLOCK_SIZE;
+  if (llBlock != io->m_llCurrentBlock) {
+    io->m_CurrentBlock.reset();
+    io->m_llCurrentBlock = -1;
+    if (FAILED(io->m_pCache->GetBlock(io->m_FileKey, llBlock, ReadBlock, io, io->m_CurrentBlock)))
+      return AVERROR(EIO);
+    io->m_llCurrentBlock = llBlock;
+  }
+
+  const size_t offset = (size_t)(io->m_llPos - llBlock * SHARED_BLOCK_SIZE);
+  if (offset >= io->m_CurrentBlock->size())
+    return AVERROR_EOF;
+
+  int size = (int)min((size_t)buf_size, io->m_CurrentBlock->size() - offset);
+  memcpy(buf, io->m_CurrentBlock->data() + offset, size);
+
+  io->m_llPos += size;
+  return size;
+}
+
+int64_t CSharedBlockIO::Seek(void *opaque, int64_t offset, int whence)
+{
+  CSharedBlockIO *io = static_cast<CSharedBlockIO *>(opaque);
+
+  LONGLONG llPos = 0;
+  if (whence == SEEK_SET) {
+    llPos = offset;
+  } else if (whence == SEEK_CUR) {
+    llPos = io->m_llPos + offset;
+  } else if (whence == SEEK_END) {
+    llPos = io->m_llSize + offset;
+  } else if (whence == AVSEEK_SIZE) {
+    return io->m_llSize;
+  } else
+    return -1;
+
+  if (llPos < 0)
+    return AVERROR(EINVAL);
+
+  io->m_llPos = llPos;
+  return llPos;
+}
@@ -0,0 +1,110 @@
+/*
+ *      Copyright (C) 2010-2019 Hendrik Leppkes
+ *      http://www.1f0.de
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program; if not, write to the Free Software Foundation, Inc.,
+ *  51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+
+#pragma once
+
+#include <map>
+#include <memory>
+#include <vector>
+
+#define SHARED_BLOCK_IO_BUFFER_SIZE 32768
+#define SHARED_BLOCK_SIZE           (256 << 10)
+
+// Process-wide cache of file blocks, shared by all readers of the same file
+// Blocks are keyed by the identity of the file and their offset, so readers in different graphs, or of
+// the same file from several demuxers, are served from memory instead of reading it from the disk again.
+// The least recently used blocks are evicted once the cache grows beyond its memory limit.
+// The cache exists as long as one reader holds a reference on it.
+class CSharedBlockCache
+{
+public:
+  typedef std::shared_ptr<const std::vector<BYTE>> BlockData;
+
+  // Get a reference on the cache, the memory limit is updated to the one of the newest reader
+  static CSharedBlockCache *Acquire(size_t cbMaxSize);
+  void Release();
+
+  // Get a block from the cache, or read it with the callback if it is not cached
+  // If another reader is already loading the block, wait for it to finish instead of reading it again.
+  typedef HRESULT (*PFN_READ_BLOCK)(void *opaque, LONGLONG llBlock, std::vector<BYTE> &data);
+  HRESULT GetBlock(uint64_t file, LONGLONG llBlock, PFN_READ_BLOCK pfnRead, void *opaque, BlockData &data);
+
+private:
+  CSharedBlockCache() {}
+  ~CSharedBlockCache() {}
+
+  struct Block {
+    BOOL bLoading         = TRUE;
+    BlockData data;
+    ULONGLONG ullLastUse  = 0;
+  };
+  typedef std::pair<uint64_t, LONGLONG> BlockKey;
+
+  // Called with the cache lock held
+  void EvictBlocks();
+
+private:
+  static CCritSec s_csInstance;
+  static CSharedBlockCache *s_pInstance;
+  static DWORD s_dwReferences;
+
+  CCritSec m_csBlocks;
+  std::map<BlockKey, Block> m_Blocks;
+  size_t m_cbSize      = 0;
+  size_t m_cbMaxSize   = 0;
+  ULONGLONG m_ullUseClock = 0;
+
+  // signaled when a reader finished loading a block
+  CAMEvent m_evBlockDone{TRUE};
+};
+
+// File access through the shared block cache, exposed through a custom AVIOContext
+class CSharedBlockIO
+{
+public:
+  CSharedBlockIO();
+  ~CSharedBlockIO();
+
+  HRESULT Open(LPCWSTR pszFileName, size_t cbCacheSize);
+  void Close();
+
+  // The context is owned by this object, and stays valid until Close
+  AVIOContext *GetAVIOContext() const { return m_pAVIOContext; }
+
+private:
+  static int Read(void *opaque, uint8_t *buf, int buf_size);
+  static int64_t Seek(void *opaque, int64_t offset, int whence);
+  static HRESULT ReadBlock(void *opaque, LONGLONG llBlock, std::vector<BYTE> &data);
+
+private:
+  HANDLE m_hFile = INVALID_HANDLE_VALUE;
+  uint64_t m_FileKey = 0;
+
+  LONGLONG m_llSize = 0;
+  LONGLONG m_llPos  = 0;
+
+  CSharedBlockCache *m_pCache = nullptr;
+
+  // the block of the read position, to avoid a cache lookup for every read
+  CSharedBlockCache::BlockData m_CurrentBlock;
+  LONGLONG m_llCurrentBlock = -1;
+
+  AVIOContext *m_pAVIOContext = nullptr;
+};
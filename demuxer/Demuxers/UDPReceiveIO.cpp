@@ -0,0 +1,331 @@
+/*
+ *      Copyright (C) 2010-2019 Hendrik Leppkes
+ *      http://www.1f0.de
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program; if not, write to the Free Software Foundation, Inc.,
+ *  51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#include "stdafx.h"
+#include "UDPReceiveIO.h"
+#include "ThreadPriority.h"
+
+#include <process.h>
+
+#define RTP_PT_MP2T 33
+
+CUDPReceiveIO::CUDPReceiveIO()
+{
+}
+
+CUDPReceiveIO::~CUDPReceiveIO()
+{
+  Close();
+}
+
+HRESULT CUDPReceiveIO::Open(const char *pszUrl, DWORD dwRingSize, const AVIOInterruptCB *pInterrupt, BOOL bThreadPriority)
+{
+  AVDictionary *options = nullptr;
+  AVIOInterruptCB cb = { Interrupt, this };
+  uint8_t *buffer = nullptr;
+  int ret = 0;
+
+  Close();
+  m_bExit = FALSE;
+  m_bRTP = _strnicmp(pszUrl, "rtp:", 4) == 0;
+  m_bThreadPriority = bThreadPriority;
+  if (pInterrupt)
+    m_Interrupt = *pInterrupt;
+
+  // the ring is indexed with a mask
+  m_nRingSize = 1 << 16;
+  while (m_nRingSize * 2 <= dwRingSize)
+    m_nRingSize *= 2;
+
+  // The socket buffer only has to cover the scheduling latency of the receive thread, the ring covers the demuxer
+  av_dict_set_int(&options, "buffer_size", min(m_nRingSize / 4, (size_t)UDP_SOCKET_BUFFER_MAX), 0);
+  ret = avio_open2(&m_pSocket, pszUrl, AVIO_FLAG_READ, &cb, &options);
+  av_dict_free(&options);
+  if (ret < 0) {
+    DbgLog((LOG_TRACE, 10, L"CUDPReceiveIO::Open(): Opening the socket failed (%d)", ret));
+    goto fail;
+  }
+
+  m_pDatagram = (uint8_t *)av_malloc(UDP_RECEIVE_MAX_DATAGRAM);
+  m_pRing = (uint8_t *)av_malloc(m_nRingSize);
+  if (!m_pDatagram || !m_pRing)
+    goto fail;
+
+  memset(m_ContinuityCounters, 0xFF, sizeof(m_ContinuityCounters));
+  m_nRTPSequence = -1;
+  m_nWrite = 0;
+  m_nRead = 0;
+  m_bReceiveDone = FALSE;
+  ResetStatistics();
+
+  // The payload type of RTP has to be known before the demuxer is chosen, only MPEG-TS is handled here
+  if (m_bRTP) {
+    m_ullProbeDeadline = GetTickCount64() + UDP_RECEIVE_PROBE_TIMEOUT;
+    for (;;) {
+      ret = avio_read_partial(m_pSocket, m_pDatagram, UDP_RECEIVE_MAX_DATAGRAM);
+      if (ret == AVERROR(EAGAIN))
+        continue;
+      if (ret < 0) {
+        DbgLog((LOG_TRACE, 10, L"CUDPReceiveIO::Open(): No RTP packet received (%d)", ret));
+        goto fail;
+      }
+
+      // the rtp protocol returns the RTCP packets as well
+      if (ret < 12 || (m_pDatagram[0] >> 6) != 2 || (m_pDatagram[1] >= 200 && m_pDatagram[1] <= 204))
+        continue;
+
+      if ((m_pDatagram[1] & 0x7F) != RTP_PT_MP2T) {
+        DbgLog((LOG_TRACE, 10, L"CUDPReceiveIO::Open(): RTP payload type %d is not MPEG-TS", m_pDatagram[1] & 0x7F));
+        goto fail;
+      }
+      break;
+    }
+    m_ullProbeDeadline = 0;
+    ProcessDatagram(m_pDatagram, ret);
+  }
+
+  buffer = (uint8_t *)av_mallocz(UDP_RECEIVE_BUFFER_SIZE + AV_INPUT_BUFFER_PADDING_SIZE);
+  if (!buffer)
+    goto fail;
+
+  m_pAVIOContext = avio_alloc_context(buffer, UDP_RECEIVE_BUFFER_SIZE, 0, this, Read, nullptr, nullptr);
+  if (!m_pAVIOContext) {
+    av_free(buffer);
+    goto fail;
+  }
+
+  m_hThread = (HANDLE)_beginthreadex(nullptr, 0, ReceiveThreadProc, (LPVOID)this, 0, nullptr);
+  if (!m_hThread)
+    goto fail;
+
+  DbgLog((LOG_TRACE, 10, L"CUDPReceiveIO::Open(): Receiving %S with a ring of %u bytes", m_bRTP ? "RTP" : "UDP", (unsigned)m_nRingSize));
+
+  return S_OK;
+fail:
+  Close();
+  return E_FAIL;
+}
+
+void CUDPReceiveIO::Close()
+{
+  m_bExit = TRUE;
+  if (m_hThread) {
+    WaitForSingleObject(m_hThread, INFINITE);
+    CloseHandle(m_hThread);
+    m_hThread = nullptr;
+  }
+
+  if (m_pSocket)
+    avio_closep(&m_pSocket);
+
+  if (m_pAVIOContext) {
+    av_free(m_pAVIOContext->buffer);
+    av_free(m_pAVIOContext);
+    m_pAVIOContext = nullptr;
+  }
+
+  av_freep(&m_pDatagram);
+  av_freep(&m_pRing);
+  m_nRingSize = 0;
+  m_ullProbeDeadline = 0;
+}
+
+void CUDPReceiveIO::GetStatistics(LAVFNetworkStatistics *pStats) const
+{
+  pStats->ullDatagrams = m_ullDatagrams;
+  pStats->ullBytes = m_ullBytes;
+  pStats->ullOverflows = m_ullOverflows;
+  pStats->ullRTPLost = m_ullRTPLost;
+  pStats->ullContinuityErrors = m_ullContinuityErrors;
+  pStats->ullRingSize = m_nRingSize;
+  pStats->ullRingHighWater = m_nRingHighWater;
+}
+
+void CUDPReceiveIO::ResetStatistics()
+{
+  m_ullDatagrams = 0;
+  m_ullBytes = 0;
+  m_ullOverflows = 0;
+  m_ullRTPLost = 0;
+  m_ullContinuityErrors = 0;
+  m_nRingHighWater = 0;
+}
+
+// The socket is closed when the demuxer is interrupted, or this object is closed
+int CUDPReceiveIO::Interrupt(void *opaque)
+{
+  CUDPReceiveIO *io = static_cast<CUDPReceiveIO *>(opaque);
+  if (io->m_bExit)
+    return 1;
+  if (io->m_ullProbeDeadline && GetTickCount64() > io->m_ullProbeDeadline)
+    return 1;
+  if (io->m_Interrupt.callback)
+    return io->m_Interrupt.callback(io->m_Interrupt.opaque);
+  return 0;
+}
+
+unsigned int WINAPI CUDPReceiveIO::ReceiveThreadProc(LPVOID pv)
+{
+  CUDPReceiveIO *io = static_cast<CUDPReceiveIO *>(pv);
+  io->Receive();
+  return 0;
+}
+
+void CUDPReceiveIO::Receive()
+{
+  SetThreadName(-1, "CUDPReceiveIO Receive");
+  CStreamingThreadPriority priority(ThreadClass_Capture, m_bThreadPriority);
+
+  while (!m_bExit) {
+    int ret = avio_read_partial(m_pSocket, m_pDatagram, UDP_RECEIVE_MAX_DATAGRAM);
+    if (ret == AVERROR(EAGAIN))
+      continue;
+    if (ret < 0) {
+      DbgLog((LOG_TRACE, 10, L"CUDPReceiveIO::Receive(): Reception ended (%d)", ret));
+      break;
+    }
+    ProcessDatagram(m_pDatagram, ret);
+  }
+
+  m_bReceiveDone = TRUE;
+  m_evData.Set();
+}
+
+void CUDPReceiveIO::ProcessDatagram(const uint8_t *pData, int nSize)
+{
+  m_ullDatagrams++;
+  m_ullBytes += nSize;
+
+  if (m_bRTP) {
+    if (nSize < 12 || (pData[0] >> 6) != 2 || (pData[1] >= 200 && pData[1] <= 204))
+      return;
+
+    // late and duplicate packets can't be put back in order in the ring, they were counted as lost already
+    const int nSequence = AV_RB16(pData + 2);
+    if (m_nRTPSequence >= 0) {
+      const int nGap = (nSequence - m_nRTPSequence - 1) & 0xFFFF;
+      if (nGap >= 0x8000)
+        return;
+      m_ullRTPLost += nGap;
+    }
+    m_nRTPSequence = nSequence;
+
+    // skip the CSRC list and the header extension, and drop the padding
+    int nHeader = 12 + 4 * (pData[0] & 0x0F);
+    if (pData[0] & 0x10) {
+      if (nSize < nHeader + 4)
+        return;
+      nHeader += 4 + 4 * AV_RB16(pData + nHeader + 2);
+    }
+    int nPayload = nSize - nHeader;
+    if (pData[0] & 0x20)
+      nPayload -= pData[nSize - 1];
+    if (nPayload <= 0)
+      return;
+
+    pData += nHeader;
+    nSize = nPayload;
+  }
+
+  CheckContinuity(pData, nSize);
+
+  // a datagram is dropped as a whole, so the demuxer resyncs on the next TS packet
+  if (!WriteRing(pData, nSize))
+    m_ullOverflows++;
+}
+
+void CUDPReceiveIO::CheckContinuity(const uint8_t *pData, int nSize)
+{
+  for (int i = 0; i + TS_PACKET_SIZE <= nSize; i += TS_PACKET_SIZE) {
+    const uint8_t *p = pData + i;
+
+    // not aligned MPEG-TS, nothing to check
+    if (p[0] != 0x47)
+      return;
+
+    // null packets and packets without payload don't advance the counter
+    const int pid = AV_RB16(p + 1) & 0x1FFF;
+    if (pid == 0x1FFF || !(p[3] & 0x10))
+      continue;
+
+    const uint8_t cc = p[3] & 0x0F;
+    const uint8_t last = m_ContinuityCounters[pid];
+    const BOOL bDiscontinuity = (p[3] & 0x20) && p[4] > 0 && (p[5] & 0x80);
+    if (last != 0xFF && cc != ((last + 1) & 0x0F) && cc != last && !bDiscontinuity)
+      m_ullContinuityErrors++;
+    m_ContinuityCounters[pid] = cc;
+  }
+}
+
+BOOL CUDPReceiveIO::WriteRing(const uint8_t *pData, int nSize)
+{
+  const size_t nWrite = m_nWrite.load(std::memory_order_relaxed);
+  const size_t nUsed = nWrite - m_nRead.load(std::memory_order_acquire);
+  if (nUsed + nSize > m_nRingSize)
+    return FALSE;
+
+  const size_t nOffset = nWrite & (m_nRingSize - 1);
+  const size_t nFirst = min((size_t)nSize, m_nRingSize - nOffset);
+  memcpy(m_pRing + nOffset, pData, nFirst);
+  memcpy(m_pRing, pData + nFirst, nSize - nFirst);
+  m_nWrite.store(nWrite + nSize, std::memory_order_release);
+
+  if (nUsed + nSize > m_nRingHighWater)
+    m_nRingHighWater = nUsed + nSize;
+
+  if (m_bWaiting)
+    m_evData.Set();
+  return TRUE;
+}
+
+int CUDPReceiveIO::Read(void *opaque, uint8_t *buf, int buf_size)
+{
+  CUDPReceiveIO *io = static_cast<CUDPReceiveIO *>(opaque);
+
+  for (;;) {
+    const size_t nRead = io->m_nRead.load(std::memory_order_relaxed);
+    const size_t nAvailable = io->m_nWrite.load(std::memory_order_acquire) - nRead;
+    if (nAvailable > 0) {
+      const size_t nSize = min(nAvailable, (size_t)buf_size);
+      const size_t nOffset = nRead & (io->m_nRingSize - 1);
+      const size_t nFirst = min(nSize, io->m_nRingSize - nOffset);
+      memcpy(buf, io->m_pRing + nOffset, nFirst);
+      memcpy(buf + nFirst, io->m_pRing, nSize - nFirst);
+      io->m_nRead.store(nRead + nSize, std::memory_order_release);
+      return (int)nSize;
+    }
+
+    if (io->m_bReceiveDone) {
+      if (io->m_nWrite.load() == nRead)
+        return AVERROR_EOF;
+      continue;
+    }
+
+    // the flag is set before checking again, so the receive thread either sees it, or the data is seen here
+    io->m_bWaiting = TRUE;
+    if (io->m_nWrite.load() == nRead) {
+      if (Interrupt(io)) {
+        io->m_bWaiting = FALSE;
+        return AVERROR_EXIT;
+      }
+      io->m_evData.Wait(50);
+    }
+    io->m_bWaiting = FALSE;
+  }
+}
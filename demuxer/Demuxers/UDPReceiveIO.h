@@ -0,0 +1,101 @@
+/*
+ *      Copyright (C) 2010-2019 Hendrik Leppkes
+ *      http://www.1f0.de
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program; if not, write to the Free Software Foundation, Inc.,
+ *  51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#pragma once
+
+#include <atomic>
+#include "LAVSplitterSettings.h"
+
+#define UDP_RECEIVE_BUFFER_SIZE   32768
+#define UDP_RECEIVE_MAX_DATAGRAM  65536
+#define UDP_SOCKET_BUFFER_MAX     (8 << 20)
+#define UDP_RECEIVE_PROBE_TIMEOUT 5000      // ms to wait for the first RTP packet
+
+#define TS_PACKET_SIZE 188
+
+// Reception of MPEG-TS over UDP and RTP on a dedicated thread
+// The socket is read by its own thread with a large socket buffer, which writes the payload into a single-producer,
+// single-consumer byte ring. The demuxer reads from the ring through a custom AVIOContext, so packets keep being
+// received while the demuxer is busy or blocked on full output queues. Datagrams which don't fit into the ring are
+// dropped as a whole and counted, and lost RTP packets and MPEG-TS continuity errors are counted as well.
+class CUDPReceiveIO
+{
+public:
+  CUDPReceiveIO();
+  ~CUDPReceiveIO();
+
+  // Open a udp:// or rtp:// URL, with a ring of dwRingSize bytes
+  // rtp:// is only handled for MPEG-TS payloads, fails for any other payload type
+  HRESULT Open(const char *pszUrl, DWORD dwRingSize, const AVIOInterruptCB *pInterrupt, BOOL bThreadPriority);
+  void Close();
+
+  // The context is owned by this object, and stays valid until Close
+  AVIOContext *GetAVIOContext() const { return m_pAVIOContext; }
+
+  BOOL IsRTP() const { return m_bRTP; }
+
+  void GetStatistics(LAVFNetworkStatistics *pStats) const;
+  void ResetStatistics();
+
+private:
+  static int Read(void *opaque, uint8_t *buf, int buf_size);
+  static int Interrupt(void *opaque);
+
+  static unsigned int WINAPI ReceiveThreadProc(LPVOID pv);
+  void Receive();
+
+  // Called on the receive thread
+  void ProcessDatagram(const uint8_t *pData, int nSize);
+  void CheckContinuity(const uint8_t *pData, int nSize);
+  BOOL WriteRing(const uint8_t *pData, int nSize);
+
+private:
+  AVIOContext *m_pSocket = nullptr;
+  BOOL m_bRTP = FALSE;
+  ULONGLONG m_ullProbeDeadline = 0;
+  AVIOInterruptCB m_Interrupt = { nullptr, nullptr };
+
+  // the ring, m_nWrite is only advanced by the receive thread, m_nRead only by the demuxer
+  uint8_t *m_pRing = nullptr;
+  size_t m_nRingSize = 0;
+  std::atomic<size_t> m_nWrite{0};
+  std::atomic<size_t> m_nRead{0};
+  std::atomic<BOOL> m_bWaiting{FALSE};
+  std::atomic<BOOL> m_bReceiveDone{FALSE};
+  CAMEvent m_evData;
+
+  // receive state
+  uint8_t *m_pDatagram = nullptr;
+  int m_nRTPSequence = -1;
+  uint8_t m_ContinuityCounters[8192];
+
+  // statistics, written by the receive thread
+  std::atomic<ULONGLONG> m_ullDatagrams{0};
+  std::atomic<ULONGLONG> m_ullBytes{0};
+  std::atomic<ULONGLONG> m_ullOverflows{0};
+  std::atomic<ULONGLONG> m_ullRTPLost{0};
+  std::atomic<ULONGLONG> m_ullContinuityErrors{0};
+  std::atomic<size_t> m_nRingHighWater{0};
+
+  HANDLE m_hThread = nullptr;
+  BOOL m_bThreadPriority = TRUE;
+  volatile BOOL m_bExit = FALSE;
+
+  AVIOContext *m_pAVIOContext = nullptr;
+};
@@ -0,0 +1,269 @@
+/*
+ *      Copyright (C) 2010-2019 Hendrik Leppkes
+ *      http://www.1f0.de
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program; if not, write to the Free Software Foundation, Inc.,
+ *  51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#include "stdafx.h"
+#include "AsyncReadAhead.h"
+
+CAsyncReadAhead::CAsyncReadAhead(IAsyncReader *pReader)
+  : m_pReader(pReader)
+{
+  ASSERT(m_pReader);
+  m_pReader->AddRef();
+}
+
+CAsyncReadAhead::~CAsyncReadAhead()
+{
+  Close();
+  SafeRelease(&m_pReader);
+}
+
+HRESULT CAsyncReadAhead::Init(LONG cbBlock, LONG nBlocks)
+{
+  HRESULT hr = S_OK;
+
+  Close();
+
+  // Only data which is already available can be read ahead
+  LONGLONG total = 0, available = 0;
+  hr = m_pReader->Length(&total, &available);
+  if (FAILED(hr) || available <= 0)
+    return E_FAIL;
+  m_llLength = available;
+
+  ALLOCATOR_PROPERTIES props = { nBlocks, cbBlock, 1, 0 }, actual = { 0 };
+  hr = m_pReader->RequestAllocator(nullptr, &props, &m_pAlloc);
+  if (FAILED(hr) || !m_pAlloc) {
+    DbgLog((LOG_TRACE, 10, L"CAsyncReadAhead::Init(): Failed to get an allocator from the source (hr: 0x%x)", hr));
+    return E_FAIL;
+  }
+
+  hr = m_pAlloc->GetProperties(&actual);
+  if (FAILED(hr))
+    goto fail;
+
+  // Requests need to be aligned to what the source demands
+  m_cbAlign = max(actual.cbAlign, 1);
+  m_cbBlock = (min(cbBlock, actual.cbBuffer) / m_cbAlign) * m_cbAlign;
+  m_nBlocks = min(nBlocks, actual.cBuffers);
+  if (m_cbBlock <= 0 || m_nBlocks < 2) {
+    DbgLog((LOG_TRACE, 10, L"CAsyncReadAhead::Init(): Unusable allocator properties (%d buffers of %d bytes, align %d)", actual.cBuffers, actual.cbBuffer, actual.cbAlign));
+    goto fail;
+  }
+
+  hr = m_pAlloc->Commit();
+  if (FAILED(hr))
+    goto fail;
+
+  m_pBlocks = new Block[m_nBlocks];
+  for (LONG i = 0; i < m_nBlocks; i++) {
+    hr = m_pAlloc->GetBuffer(&m_pBlocks[i].pSample, nullptr, nullptr, 0);
+    if (FAILED(hr))
+      goto fail;
+    m_pBlocks[i].pSample->GetPointer(&m_pBlocks[i].pData);
+  }
+
+  m_llFirst = 0;
+  m_nPending = 0;
+
+  DbgLog((LOG_TRACE, 10, L"CAsyncReadAhead::Init(): Reading ahead %d blocks of %d bytes", m_nBlocks, m_cbBlock));
+
+  return S_OK;
+fail:
+  Close();
+  return E_FAIL;
+}
+
+void CAsyncReadAhead::Close()
+{
+  Flush();
+
+  if (m_pBlocks) {
+    for (LONG i = 0; i < m_nBlocks; i++) {
+      SafeRelease(&m_pBlocks[i].pSample);
+    }
+    SAFE_ARRAY_DELETE(m_pBlocks);
+  }
+
+  if (m_pAlloc) {
+    m_pAlloc->Decommit();
+    SafeRelease(&m_pAlloc);
+  }
+
+  m_nBlocks = 0;
+  m_cbBlock = 0;
+}
+
+HRESULT CAsyncReadAhead::RequestBlock(Block &block, LONGLONG llBlock)
+{
+  LONGLONG llStart = llBlock * m_cbBlock;
+  LONG lLength = (LONG)min((LONGLONG)m_cbBlock, m_llLength - llStart);
+  if (lLength <= 0)
+    return S_FALSE;
+
+  // The source will clip the read at the end of the file
+  LONG lRequest = ((lLength + m_cbAlign - 1) / m_cbAlign) * m_cbAlign;
+
+  REFERENCE_TIME tStart = llStart * UNITS;
+  REFERENCE_TIME tStop = (llStart + lRequest) * UNITS;
+  block.pSample->SetTime(&tStart, &tStop);
+
+  block.llBlock = llBlock;
+  block.lLength = lLength;
+
+  HRESULT hr = m_pReader->Request(block.pSample, (DWORD_PTR)(&block - m_pBlocks));
+  if (FAILED(hr)) {
+    block.llBlock = -1;
+    return hr;
+  }
+
+  block.bPending = TRUE;
+  block.hr = S_OK;
+  m_nPending++;
+
+  return S_OK;
+}
+
+HRESULT CAsyncReadAhead::WaitForBlock(Block &block)
+{
+  // Requests can complete in any order, so collect completions until the requested one is done
+  while (block.bPending) {
+    IMediaSample *pSample = nullptr;
+    DWORD_PTR dwUser = 0;
+    HRESULT hr = m_pReader->WaitForNext(INFINITE, &pSample, &dwUser);
+    if (!pSample || dwUser >= (DWORD_PTR)m_nBlocks) {
+      DbgLog((LOG_TRACE, 10, L"CAsyncReadAhead::WaitForBlock(): WaitForNext returned no sample (hr: 0x%x)", hr));
+      return FAILED(hr) ? hr : E_FAIL;
+    }
+
+    Block &done = m_pBlocks[dwUser];
+    ASSERT(done.pSample == pSample && done.bPending);
+
+    done.bPending = FALSE;
+    done.hr = hr;
+    if (SUCCEEDED(hr))
+      done.lLength = min(done.lLength, pSample->GetActualDataLength());
+    m_nPending--;
+  }
+
+  return block.hr;
+}
+
+void CAsyncReadAhead::FillWindow()
+{
+  for (LONGLONG llBlock = m_llFirst; llBlock < (m_llFirst + m_nBlocks); llBlock++) {
+    Block &block = GetBlock(llBlock);
+    if (block.llBlock == llBlock)
+      continue;
+
+    // The slot still holds a request from behind the window
+    if (block.bPending && FAILED(WaitForBlock(block)))
+      break;
+
+    if (RequestBlock(block, llBlock) != S_OK)
+      break;
+  }
+}
+
+HRESULT CAsyncReadAhead::Read(LONGLONG llPos, BYTE *pBuffer, LONG lSize, LONG *plRead)
+{
+  *plRead = 0;
+
+  if (!m_pBlocks || llPos < 0)
+    return S_FALSE;
+
+  while (lSize > 0 && llPos < m_llLength) {
+    LONGLONG llBlock = llPos / m_cbBlock;
+
+    // Non-sequential access outside of the window restarts it from the new position
+    if (llBlock < m_llFirst || llBlock >= (m_llFirst + m_nBlocks))
+      Flush();
+
+    // The blocks before the current one are no longer needed, and will be re-used
+    m_llFirst = llBlock;
+    FillWindow();
+
+    Block &block = GetBlock(llBlock);
+    if (block.llBlock != llBlock)
+      break;
+
+    HRESULT hr = WaitForBlock(block);
+    if (FAILED(hr)) {
+      DbgLog((LOG_TRACE, 10, L"CAsyncReadAhead::Read(): Read-ahead failed at pos: %I64d, hr: 0x%X", llPos, hr));
+      Flush();
+      break;
+    }
+
+    LONG lOffset = (LONG)(llPos - llBlock * m_cbBlock);
+    if (lOffset >= block.lLength)
+      break;
+
+    LONG lCopy = min(lSize, block.lLength - lOffset);
+    memcpy(pBuffer, block.pData + lOffset, lCopy);
+
+    pBuffer += lCopy;
+    lSize   -= lCopy;
+    llPos   += lCopy;
+    *plRead += lCopy;
+  }
+
+  return *plRead > 0 ? S_OK : S_FALSE;
+}
+
+void CAsyncReadAhead::Seek(LONGLONG llPos)
+{
+  if (!m_pBlocks)
+    return;
+
+  LONGLONG llBlock = llPos / m_cbBlock;
+  if (llBlock < m_llFirst || llBlock >= (m_llFirst + m_nBlocks)) {
+    Flush();
+    m_llFirst = llBlock;
+  }
+}
+
+void CAsyncReadAhead::Flush()
+{
+  if (!m_pBlocks)
+    return;
+
+  // Abort all in-flight requests, and collect them
+  if (m_nPending > 0) {
+    m_pReader->BeginFlush();
+    while (m_nPending > 0) {
+      IMediaSample *pSample = nullptr;
+      DWORD_PTR dwUser = 0;
+      m_pReader->WaitForNext(INFINITE, &pSample, &dwUser);
+      if (!pSample)
+        break;
+      if (dwUser < (DWORD_PTR)m_nBlocks && m_pBlocks[dwUser].bPending) {
+        m_pBlocks[dwUser].bPending = FALSE;
+        m_nPending--;
+      }
+    }
+    m_pReader->EndFlush();
+  }
+
+  for (LONG i = 0; i < m_nBlocks; i++) {
+    m_pBlocks[i].llBlock  = -1;
+    m_pBlocks[i].lLength  = 0;
+    m_pBlocks[i].bPending = FALSE;
+    m_pBlocks[i].hr       = S_OK;
+  }
+  m_nPending = 0;
+}
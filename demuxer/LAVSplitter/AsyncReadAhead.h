@@ -0,0 +1,76 @@
+/*
+ *      Copyright (C) 2010-2019 Hendrik Leppkes
+ *      http://www.1f0.de
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program; if not, write to the Free Software Foundation, Inc.,
+ *  51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#pragma once
+
+#define READAHEAD_BLOCK_SIZE 131072
+#define READAHEAD_NUM_BLOCKS 8
+
+// Read-ahead engine on top of IAsyncReader
+// Keeps a window of overlapped requests in flight ahead of the current read position,
+// so sequential reads can be served from memory instead of waiting on the source.
+// Not thread-safe, the caller needs to serialize access.
+class CAsyncReadAhead
+{
+public:
+  CAsyncReadAhead(IAsyncReader *pReader);
+  ~CAsyncReadAhead();
+
+  // Allocate the buffers and start the engine, nBlocks of cbBlock bytes each
+  HRESULT Init(LONG cbBlock = READAHEAD_BLOCK_SIZE, LONG nBlocks = READAHEAD_NUM_BLOCKS);
+
+  // Read up to lSize bytes at llPos
+  // Returns S_FALSE if nothing could be read, the caller should fall back to synchronous reading
+  HRESULT Read(LONGLONG llPos, BYTE *pBuffer, LONG lSize, LONG *plRead);
+
+  // Notify about a seek, drops all in-flight requests if the new position is outside of the window
+  void Seek(LONGLONG llPos);
+
+  // Drop all buffered data and in-flight requests
+  void Flush();
+
+private:
+  struct Block {
+    IMediaSample *pSample = nullptr;
+    BYTE *pData           = nullptr;
+    LONGLONG llBlock      = -1;
+    LONG lLength          = 0;
+    BOOL bPending         = FALSE;
+    HRESULT hr            = S_OK;
+  };
+
+  void Close();
+  HRESULT RequestBlock(Block &block, LONGLONG llBlock);
+  HRESULT WaitForBlock(Block &block);
+  void FillWindow();
+  Block &GetBlock(LONGLONG llBlock) { return m_pBlocks[llBlock % m_nBlocks]; }
+
+private:
+  IAsyncReader  *m_pReader = nullptr;
+  IMemAllocator *m_pAlloc  = nullptr;
+
+  Block *m_pBlocks  = nullptr;
+  LONG m_nBlocks    = 0;
+  LONG m_cbBlock    = 0;
+  LONG m_cbAlign    = 1;
+
+  LONGLONG m_llLength = 0;
+  LONGLONG m_llFirst  = 0;
+  LONG m_nPending     = 0;
+};
@@ -32,6 +32,8 @@ CLAVInputPin::CLAVInputPin(TCHAR *pName, CLAVSplitter *pFilter, CCritSec *pLock,
 
 CLAVInputPin::~CLAVInputPin(void)
 {
+  SAFE_DELETE(m_pPreBuffer);
+  SAFE_DELETE(m_pReadAhead);
   if (m_pAVIOContext) {
     av_free(m_pAVIOContext->buffer);
     av_free(m_pAVIOContext);
@@ -82,6 +84,8 @@ HRESULT CLAVInputPin::BreakConnect()
     return hr;
   }
 
+  SAFE_DELETE(m_pPreBuffer);
+  SAFE_DELETE(m_pReadAhead);
   SafeRelease(&m_pAsyncReader);
   SafeRelease(&m_pStreamControl);
 
@@ -134,15 +138,59 @@ HRESULT CLAVInputPin::CompleteConnect(IPin* pPin)
   return S_OK;
 }
 
+HRESULT CLAVInputPin::GetReadStatistics(LAVFReadStatistics *pStats)
+{
+  CheckPointer(pStats, E_POINTER);
+  CAutoLock lock(this);
+  *pStats = m_ReadStats;
+  return S_OK;
+}
+
+void CLAVInputPin::ResetReadStatistics()
+{
+  CAutoLock lock(this);
+  memset(&m_ReadStats, 0, sizeof(m_ReadStats));
+}
+
+void CLAVInputPin::AddReadSample(REFERENCE_TIME rtStart, int read)
+{
+  REFERENCE_TIME rtRead = timer_get_ref_time() - rtStart;
+  m_ReadStats.ullReads++;
+  m_ReadStats.ullBytes += read;
+  m_ReadStats.rtTotal += rtRead;
+  if (rtRead > m_ReadStats.rtMax)
+    m_ReadStats.rtMax = rtRead;
+}
+
 int CLAVInputPin::Read(void *opaque, uint8_t *buf, int buf_size)
 {
   CLAVInputPin *pin = static_cast<CLAVInputPin *>(opaque);
   CAutoLock lock(pin);
 
+  REFERENCE_TIME rtReadStart = timer_get_ref_time();
+
   // The URL source doesn't properly signal EOF in all cases, so make sure no stale data is in the buffer
   if (pin->m_bURLSource)
     memset(buf, 0, buf_size);
 
+  // Serve the read from the pre-buffer or the read-ahead buffers, if possible
+  // Anything they can't provide is read synchronously below
+  if (pin->m_pPreBuffer) {
+    LONG read = 0;
+    if (pin->m_pPreBuffer->Read(pin->m_llPos, buf, buf_size, &read) == S_OK) {
+      pin->m_llPos += read;
+      pin->AddReadSample(rtReadStart, read);
+      return read;
+    }
+  } else if (pin->m_pReadAhead) {
+    LONG read = 0;
+    if (pin->m_pReadAhead->Read(pin->m_llPos, buf, buf_size, &read) == S_OK) {
+      pin->m_llPos += read;
+      pin->AddReadSample(rtReadStart, read);
+      return read;
+    }
+  }
+
   HRESULT hr = pin->m_pAsyncReader->SyncRead(pin->m_llPos, buf_size, buf);
   if (FAILED(hr)) {
     DbgLog((LOG_TRACE, 10, L"Read failed at pos: %I64d, hr: 0x%X", pin->m_llPos, hr));
@@ -162,12 +210,25 @@ int CLAVInputPin::Read(void *opaque, uint8_t *buf, int buf_size)
       DbgLog((LOG_TRACE, 10, L"-> Read %d bytes", read));
     }
     pin->m_llPos += read;
+    pin->AddReadSample(rtReadStart, read);
     return read > 0 ? read : AVERROR_EOF;
   }
   pin->m_llPos += buf_size;
+  pin->AddReadSample(rtReadStart, buf_size);
   return buf_size;
 }
 
+// The pre-buffer always reads within the length of the source
+int CLAVInputPin::PreBufferRead(LONGLONG llPos, BYTE *pBuffer, int size)
+{
+  HRESULT hr = m_pAsyncReader->SyncRead(llPos, size, pBuffer);
+  if (hr != S_OK) {
+    DbgLog((LOG_TRACE, 10, L"CLAVInputPin::PreBufferRead(): Read failed at pos: %I64d, hr: 0x%X", llPos, hr));
+    return -1;
+  }
+  return size;
+}
+
 int64_t CLAVInputPin::Seek(void *opaque,  int64_t offset, int whence)
 {
   CLAVInputPin *pin = static_cast<CLAVInputPin *>(opaque);
@@ -193,6 +254,9 @@ int64_t CLAVInputPin::Seek(void *opaque,  int64_t offset, int whence)
   else if (pin->m_llPos < 0)
     pin->m_llPos = 0;
 
+  if (pin->m_pReadAhead)
+    pin->m_pReadAhead->Seek(pin->m_llPos);
+
   return pin->m_llPos;
 }
 
@@ -213,6 +277,25 @@ HRESULT CLAVInputPin::GetAVIOContext(AVIOContext** ppContext)
       m_pAVIOContext->seekable = 0;
       m_pAVIOContext->seek = nullptr;
       m_pAVIOContext->buffer_size = READ_BUFFER_SIZE / 4;
+    } else if (!m_bURLSource) {
+      // Read ahead into a large window of memory, for slow media
+      DWORD dwPreBufferSize = (static_cast<CLAVSplitter *>(m_pFilter))->GetPreBufferLimit();
+      if (dwPreBufferSize) {
+        m_pPreBuffer = new CPreBuffer(this);
+        if (FAILED(m_pPreBuffer->Init((size_t)dwPreBufferSize << 20, total))) {
+          DbgLog((LOG_TRACE, 10, L"CLAVInputPin::GetAVIOContext(): allocating the pre-buffer failed"));
+          SAFE_DELETE(m_pPreBuffer);
+        }
+      }
+
+      // Keep overlapped requests in flight ahead of the demuxer, so it doesn't have to wait on every read
+      if (!m_pPreBuffer) {
+        m_pReadAhead = new CAsyncReadAhead(m_pAsyncReader);
+        if (FAILED(m_pReadAhead->Init())) {
+          DbgLog((LOG_TRACE, 10, L"CLAVInputPin::GetAVIOContext(): read-ahead not supported by the source"));
+          SAFE_DELETE(m_pReadAhead);
+        }
+      }
     }
   }
   *ppContext = m_pAVIOContext;
@@ -241,6 +324,14 @@ STDMETHODIMP CLAVInputPin::SeekStream(REFERENCE_TIME rtPosition)
 			avio_flush(m_pAVIOContext);
 			m_pAVIOContext->pos = 0;
 		}
+		if (m_pReadAhead) {
+			CAutoLock lock(this);
+			m_pReadAhead->Flush();
+		}
+		if (m_pPreBuffer) {
+			CAutoLock lock(this);
+			m_pPreBuffer->Flush();
+		}
 	}
 
 	return hr;
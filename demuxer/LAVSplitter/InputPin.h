@@ -20,10 +20,14 @@
 #pragma once
 
 #include "IStreamSourceControl.h"
+#include "AsyncReadAhead.h"
+#include "PreBuffer.h"
+#include "LAVSplitterSettings.h"
+#include "timer.h"
 
 class CLAVSplitter;
 
-class CLAVInputPin : public CBasePin, public CCritSec, public IStreamSourceControl
+class CLAVInputPin : public CBasePin, public CCritSec, public IStreamSourceControl, public CPreBufferSource
 {
 public:
   CLAVInputPin(TCHAR* pName, CLAVSplitter *pFilter, CCritSec* pLock, HRESULT* phr);
@@ -48,6 +52,12 @@ public:
   STDMETHODIMP GetStreamDuration(REFERENCE_TIME *prtDuration) { CheckPointer(m_pStreamControl, E_NOTIMPL); return m_pStreamControl->GetStreamDuration(prtDuration); }
   STDMETHODIMP SeekStream(REFERENCE_TIME rtPosition);
 
+  HRESULT GetReadStatistics(LAVFReadStatistics *pStats);
+  void ResetReadStatistics();
+
+  // CPreBufferSource
+  int PreBufferRead(LONGLONG llPos, BYTE *pBuffer, int size);
+
 protected:
   static int Read(void *opaque, uint8_t *buf, int buf_size);
   static int64_t Seek(void *opaque, int64_t offset, int whence);
@@ -55,10 +65,16 @@ protected:
   LONGLONG m_llPos = 0;
 
 private:
+  void AddReadSample(REFERENCE_TIME rtStart, int read);
+
   IAsyncReader *m_pAsyncReader = nullptr;
   AVIOContext *m_pAVIOContext  = nullptr;
+  CAsyncReadAhead *m_pReadAhead = nullptr;
+  CPreBuffer *m_pPreBuffer      = nullptr;
 
   IStreamSourceControl *m_pStreamControl = nullptr;
 
   BOOL m_bURLSource = false;
+
+  LAVFReadStatistics m_ReadStats = { 0 };
 };
@@ -0,0 +1,185 @@
+/*
+ *      Copyright (C) 2010-2019 Hendrik Leppkes
+ *      http://www.1f0.de
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program; if not, write to the Free Software Foundation, Inc.,
+ *  51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#include "stdafx.h"
+#include "JitterBuffer.h"
+
+#include "timer.h"
+#include "ThreadPriority.h"
+#include "NumaPlacement.h"
+
+CJitterBuffer::CJitterBuffer(CBaseDemuxer *pDemuxer, REFERENCE_TIME rtMaxDelay, BOOL bThreadPriority, int nNUMANode)
+  : m_pDemuxer(pDemuxer), m_rtMaxDelay(rtMaxDelay), m_bThreadPriority(bThreadPriority), m_nNUMANode(nNUMANode)
+{
+  ASSERT(m_pDemuxer);
+}
+
+CJitterBuffer::~CJitterBuffer()
+{
+  Stop();
+}
+
+HRESULT CJitterBuffer::Start()
+{
+  if (ThreadExists())
+    return S_FALSE;
+
+  m_hrDemux = S_OK;
+  m_bEnded = FALSE;
+  m_evQueued.Reset();
+  m_evSpace.Reset();
+
+  if (!Create())
+    return E_FAIL;
+
+  return S_OK;
+}
+
+void CJitterBuffer::Stop()
+{
+  if (ThreadExists()) {
+    CallWorker(CMD_EXIT);
+    Close();
+    DbgLog((LOG_TRACE, 10, L"CJitterBuffer::Stop(): jitter %I64d, target delay %I64d, %u packets dropped", m_rtJitter, m_rtTargetDelay, (unsigned)m_queue.size()));
+  }
+
+  CAutoLock lock(&m_csQueue);
+  for (Entry &entry : m_queue)
+    delete entry.pPacket;
+  m_queue.clear();
+  m_Clocks.clear();
+  m_rtJitter = 0;
+  m_rtTargetDelay = 0;
+}
+
+DWORD CJitterBuffer::ThreadProc()
+{
+  SetThreadName(-1, "CLAVSplitter Jitter Buffer");
+
+  // the arrival times are only accurate if packets are taken from the network as soon as they arrive
+  CStreamingThreadPriority priority(ThreadClass_Capture, m_bThreadPriority);
+  numa_bind_thread(m_nNUMANode);
+
+  HRESULT hr = S_OK;
+  BOOL bExit = FALSE;
+  while (!(bExit = CheckRequest(nullptr))) {
+    BOOL bFull = FALSE;
+    {
+      CAutoLock lock(&m_csQueue);
+      bFull = (m_queue.size() >= JITTER_MAX_PACKETS);
+    }
+
+    // the splitter is not taking packets, like when paused, stop reading until there is space again
+    if (bFull) {
+      m_evSpace.Wait(50);
+      continue;
+    }
+
+    Packet *pPacket = nullptr;
+    hr = m_pDemuxer->GetNextPacket(&pPacket);
+    if (hr == S_OK)
+      QueuePacket(pPacket, timer_get_ref_time());
+    else if (FAILED(hr))
+      break;
+  }
+
+  {
+    CAutoLock lock(&m_csQueue);
+    m_hrDemux = FAILED(hr) ? hr : E_ABORT;
+    m_bEnded = TRUE;
+  }
+  m_evQueued.Set();
+
+  // stay around until asked to exit
+  if (!bExit)
+    GetRequest();
+  Reply(S_OK);
+
+  return 0;
+}
+
+void CJitterBuffer::QueuePacket(Packet *pPacket, REFERENCE_TIME rtArrival)
+{
+  // DTS are used if available, they increase steadily in presence of B-frames
+  const REFERENCE_TIME rtTime = (pPacket->rtDTS != Packet::INVALID_TIME) ? pPacket->rtDTS : pPacket->rtStart;
+
+  CAutoLock lock(&m_csQueue);
+
+  // packets without timestamp are released right away, once the packets before them are
+  REFERENCE_TIME rtRelease = rtArrival;
+  if (rtTime != Packet::INVALID_TIME) {
+    const REFERENCE_TIME rtTransit = rtArrival - rtTime;
+
+    // every stream has its own transit base, the streams of a multiplex are offset against each other
+    auto it = m_Clocks.find(pPacket->StreamId);
+    if (it == m_Clocks.end()) {
+      it = m_Clocks.insert(std::make_pair(pPacket->StreamId, StreamClock{ rtTransit, rtTransit })).first;
+    } else {
+      StreamClock &clock = it->second;
+      const REFERENCE_TIME rtDelta = rtTransit - clock.rtLastTransit;
+      if (_abs64(rtDelta) > JITTER_MAX_SHIFT) {
+        DbgLog((LOG_TRACE, 10, L"CJitterBuffer::QueuePacket(): Timestamp discontinuity of %I64d on stream %u", rtDelta, pPacket->StreamId));
+        clock.rtBaseTransit = rtTransit;
+      } else {
+        m_rtJitter += (_abs64(rtDelta) - m_rtJitter) / 16;
+
+        if (rtTransit < clock.rtBaseTransit)
+          clock.rtBaseTransit = rtTransit;
+        else
+          clock.rtBaseTransit += (rtTransit - clock.rtBaseTransit) / JITTER_BASE_ADAPT;
+      }
+      clock.rtLastTransit = rtTransit;
+    }
+
+    m_rtTargetDelay = min(JITTER_DELAY_FACTOR * m_rtJitter, m_rtMaxDelay);
+    rtRelease = rtTime + it->second.rtBaseTransit + m_rtTargetDelay;
+  }
+
+  m_queue.push_back(Entry{ pPacket, rtRelease });
+  m_evQueued.Set();
+}
+
+HRESULT CJitterBuffer::GetNextPacket(Packet **ppPacket, DWORD dwTimeout)
+{
+  CheckPointer(ppPacket, E_POINTER);
+
+  DWORD dwWait = dwTimeout;
+  {
+    CAutoLock lock(&m_csQueue);
+    if (!m_queue.empty()) {
+      const Entry &entry = m_queue.front();
+      const REFERENCE_TIME rtNow = timer_get_ref_time();
+
+      // once the reader ended, the remaining packets are flushed out
+      if (entry.rtRelease <= rtNow || m_bEnded) {
+        *ppPacket = entry.pPacket;
+        m_queue.pop_front();
+        m_evSpace.Set();
+        return S_OK;
+      }
+
+      dwWait = (DWORD)min((REFERENCE_TIME)dwTimeout, (entry.rtRelease - rtNow) / 10000 + 1);
+    } else if (m_bEnded) {
+      return m_hrDemux;
+    }
+  }
+
+  m_evQueued.Wait(dwWait);
+  return S_FALSE;
+}
@@ -0,0 +1,103 @@
+/*
+ *      Copyright (C) 2010-2019 Hendrik Leppkes
+ *      http://www.1f0.de
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program; if not, write to the Free Software Foundation, Inc.,
+ *  51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#pragma once
+
+#include <deque>
+#include <map>
+#include "BaseDemuxer.h"
+
+// Upper limit of the delay added to smooth out the arrival jitter, and the limit in low-latency live mode
+#define JITTER_MAX_DELAY      10000000LL
+#define JITTER_MAX_DELAY_LIVE  1000000LL
+
+// The target delay covers this multiple of the mean arrival jitter
+#define JITTER_DELAY_FACTOR 4
+
+// Arrival time changes larger than this are timestamp discontinuities, and not counted as jitter
+#define JITTER_MAX_SHIFT 10000000LL
+
+// Speed at which the transit base of a stream follows slower arrivals, to compensate clock drift
+#define JITTER_BASE_ADAPT 256
+
+#define JITTER_MAX_PACKETS 2048
+
+// Time the demux thread waits for a packet to become due, before checking for commands again
+#define JITTER_POLL_TIMEOUT 50
+
+// Jitter buffer for real-time network streams
+// A reader thread takes the packets from the demuxer as soon as they arrive, and measures the arrival jitter
+// of every stream against its timestamps (RFC 3550). Packets are held until their timestamp, plus the
+// smallest observed transit time and a target delay adapted to the jitter, has passed on the wall clock.
+// Packets are released in demuxing order.
+class CJitterBuffer : protected CAMThread
+{
+public:
+  CJitterBuffer(CBaseDemuxer *pDemuxer, REFERENCE_TIME rtMaxDelay, BOOL bThreadPriority = TRUE, int nNUMANode = -1);
+  ~CJitterBuffer();
+
+  // Start reading packets from the demuxer
+  HRESULT Start();
+
+  // Stop reading, and drop all buffered packets
+  void Stop();
+
+  // Get the next packet once it is due, waiting at most dwTimeout ms
+  // Returns S_FALSE if no packet is due yet, and the error of the demuxer once it stopped and the buffer ran empty
+  HRESULT GetNextPacket(Packet **ppPacket, DWORD dwTimeout);
+
+  REFERENCE_TIME GetJitter() const { return m_rtJitter; }
+  REFERENCE_TIME GetTargetDelay() const { return m_rtTargetDelay; }
+
+private:
+  enum {CMD_EXIT};
+  DWORD ThreadProc();
+
+  void QueuePacket(Packet *pPacket, REFERENCE_TIME rtArrival);
+
+private:
+  struct Entry {
+    Packet *pPacket;
+    REFERENCE_TIME rtRelease;
+  };
+
+  struct StreamClock {
+    REFERENCE_TIME rtLastTransit;
+    REFERENCE_TIME rtBaseTransit;
+  };
+
+  CBaseDemuxer *m_pDemuxer = nullptr;
+  REFERENCE_TIME m_rtMaxDelay = JITTER_MAX_DELAY;
+  BOOL m_bThreadPriority = TRUE;
+  int m_nNUMANode = -1;
+
+  CCritSec m_csQueue;
+  std::deque<Entry> m_queue;
+  HRESULT m_hrDemux = S_OK;
+  BOOL m_bEnded = FALSE;
+
+  // signaled when a packet is queued, or the reader ended
+  CAMEvent m_evQueued;
+  // signaled when a packet is taken from the buffer
+  CAMEvent m_evSpace;
+
+  std::map<DWORD, StreamClock> m_Clocks;
+  REFERENCE_TIME m_rtJitter      = 0;
+  REFERENCE_TIME m_rtTargetDelay = 0;
+};
@@ -28,6 +28,10 @@
 #include "BaseDemuxer.h"
 #include "LAVFDemuxer.h"
 #include "BDDemuxer.h"
+#include "CaptureDemuxer.h"
+#include "JitterBuffer.h"
+#include "NextSource.h"
+#include "PacketAllocator.h"
 
 #include <Shlwapi.h>
 #include <string>
@@ -35,21 +39,20 @@
 #include <algorithm>
 
 #include "registry.h"
+#include "ThreadPriority.h"
+#include "TraceProvider.h"
+#include "WorkerPool.h"
 
 #include "IGraphRebuildDelegate.h"
 
 CLAVSplitter::CLAVSplitter(LPUNKNOWN pUnk, HRESULT* phr) 
   : CBaseFilter(NAME("lavf dshow source filter"), pUnk, this,  __uuidof(this), phr)
+  , m_InputFormats(CLAVFDemuxer::GetFormatList())
 {
   WCHAR fileName[1024];
   GetModuleFileName(nullptr, fileName, 1024);
   m_processName = PathFindFileName (fileName);
 
-  m_InputFormats.clear();
-
-  std::set<FormatInfo> lavf_formats = CLAVFDemuxer::GetFormatList();
-  m_InputFormats.insert(lavf_formats.begin(), lavf_formats.end());
-
   LoadSettings();
 
   m_pInput = new CLAVInputPin(NAME("LAV Input Pin"), this, this, phr);
@@ -79,6 +82,7 @@ CLAVSplitter::~CLAVSplitter()
   m_pRetiredPins.clear();
 
   SafeRelease(&m_pSite);
+  SafeRelease(&m_pMemoryAccount);
 
 #if defined(DEBUG) && defined(LAV_DEBUG_RELEASE)
   DbgCloseLogFile();
@@ -96,7 +100,21 @@ STDMETHODIMP CLAVSplitter::Close()
   m_State = State_Stopped;
   DeleteOutputs();
 
+  {
+    CAutoLock nextLock(&m_csNextSource);
+    SAFE_DELETE(m_pNextSource);
+  }
+
   SafeRelease(&m_pDemuxer);
+  SafeRelease(&m_pPrevDemuxer);
+  m_dwSourceSwitches = 0;
+  m_Lookback.Clear();
+
+  // samples still held by the application keep the allocator alive
+  if (m_pSourceAllocator) {
+    m_pSourceAllocator->Decommit();
+    SafeRelease(&m_pSourceAllocator);
+  }
 
   return S_OK;
 }
@@ -130,6 +148,18 @@ static BOOL get_iformat_default(std::string name)
   return TRUE;
 }
 
+static std::shared_ptr<const std::map<std::string, BOOL>> get_iformat_defaults(const std::set<FormatInfo> &formats)
+{
+  static const std::shared_ptr<const std::map<std::string, BOOL>> defaults = [&formats]() {
+    auto map = std::make_shared<std::map<std::string, BOOL>>();
+    for (const FormatInfo& fmt : formats) {
+      (*map)[std::string(fmt.strName)] = get_iformat_default(fmt.strName);
+    }
+    return map;
+  }();
+  return defaults;
+}
+
 STDMETHODIMP CLAVSplitter::LoadDefaults()
 {
   m_settings.TrayIcon         = FALSE;
@@ -152,11 +182,26 @@ STDMETHODIMP CLAVSplitter::LoadDefaults()
   m_settings.PreferHighQualityAudio = TRUE;
   m_settings.QueueMaxPackets  = 350;
   m_settings.QueueMaxMemSize  = 256;
+  m_settings.QueueMaxDuration = 10000;
   m_settings.NetworkAnalysisDuration = 1000;
-
-  for (const FormatInfo& fmt : m_InputFormats) {
-    m_settings.formats[std::string(fmt.strName)] = get_iformat_default(fmt.strName);
-  }
+  m_settings.MemoryMappedIO   = FALSE;
+  m_settings.KeyFrameIndexCache = TRUE;
+  m_settings.FastOpen         = FALSE;
+  m_settings.LowLatencyLive   = FALSE;
+  m_settings.NetworkJitterBuffer = TRUE;
+  m_settings.HTTPPrefetch     = TRUE;
+  m_settings.StreamingThreadPriority = TRUE;
+  m_settings.NUMANode         = NUMA_NODE_OFF;
+  m_settings.AudioPacketCoalescing = 0;
+  m_settings.SharedBlockCacheSize = 128;
+  m_settings.PreBufferSize    = 0;
+  m_settings.LookbackDuration = 20000;
+  m_settings.LowFootprint     = FALSE;
+  m_settings.SegmentPrefetch  = 4;
+  m_settings.NetworkReceiveBuffer = 16;
+  m_settings.ImageSequenceFrameRate = 0;
+
+  m_settings.formats = get_iformat_defaults(m_InputFormats);
 
   return S_OK;
 }
@@ -167,8 +212,11 @@ STDMETHODIMP CLAVSplitter::LoadSettings()
   if (m_bRuntimeConfig)
     return S_FALSE;
 
-  ReadSettings(HKEY_LOCAL_MACHINE);
-  return ReadSettings(HKEY_CURRENT_USER);
+  static CRegistrySettingsCache<decltype(m_settings)> cache(LAVF_REGISTRY_KEY);
+  return cache.Load(m_settings, [this]() {
+    ReadSettings(HKEY_LOCAL_MACHINE);
+    return ReadSettings(HKEY_CURRENT_USER);
+  });
 }
 
 STDMETHODIMP CLAVSplitter::ReadSettings(HKEY rootKey)
@@ -229,16 +277,69 @@ STDMETHODIMP CLAVSplitter::ReadSettings(HKEY rootKey)
 
     dwVal = reg.ReadDWORD(L"QueueMaxPackets", hr);
     if (SUCCEEDED(hr)) m_settings.QueueMaxPackets = dwVal;
+
+    dwVal = reg.ReadDWORD(L"QueueMaxDuration", hr);
+    if (SUCCEEDED(hr)) m_settings.QueueMaxDuration = dwVal;
+
+    bFlag = reg.ReadBOOL(L"MemoryMappedIO", hr);
+    if (SUCCEEDED(hr)) m_settings.MemoryMappedIO = bFlag;
+
+    bFlag = reg.ReadBOOL(L"KeyFrameIndexCache", hr);
+    if (SUCCEEDED(hr)) m_settings.KeyFrameIndexCache = bFlag;
+
+    bFlag = reg.ReadBOOL(L"FastOpen", hr);
+    if (SUCCEEDED(hr)) m_settings.FastOpen = bFlag;
+
+    bFlag = reg.ReadBOOL(L"LowLatencyLive", hr);
+    if (SUCCEEDED(hr)) m_settings.LowLatencyLive = bFlag;
+
+    bFlag = reg.ReadBOOL(L"NetworkJitterBuffer", hr);
+    if (SUCCEEDED(hr)) m_settings.NetworkJitterBuffer = bFlag;
+
+    bFlag = reg.ReadBOOL(L"HTTPPrefetch", hr);
+    if (SUCCEEDED(hr)) m_settings.HTTPPrefetch = bFlag;
+
+    bFlag = reg.ReadBOOL(L"StreamingThreadPriority", hr);
+    if (SUCCEEDED(hr)) m_settings.StreamingThreadPriority = bFlag;
+
+    dwVal = reg.ReadDWORD(L"NUMANode", hr);
+    if (SUCCEEDED(hr)) m_settings.NUMANode = dwVal;
+
+    dwVal = reg.ReadDWORD(L"AudioPacketCoalescing", hr);
+    if (SUCCEEDED(hr)) m_settings.AudioPacketCoalescing = dwVal;
+
+    dwVal = reg.ReadDWORD(L"SharedBlockCacheSize", hr);
+    if (SUCCEEDED(hr)) m_settings.SharedBlockCacheSize = dwVal;
+
+    dwVal = reg.ReadDWORD(L"PreBufferSize", hr);
+    if (SUCCEEDED(hr)) m_settings.PreBufferSize = dwVal;
+
+    dwVal = reg.ReadDWORD(L"LookbackDuration", hr);
+    if (SUCCEEDED(hr)) m_settings.LookbackDuration = dwVal;
+
+    bFlag = reg.ReadBOOL(L"LowFootprint", hr);
+    if (SUCCEEDED(hr)) m_settings.LowFootprint = bFlag;
+
+    dwVal = reg.ReadDWORD(L"SegmentPrefetch", hr);
+    if (SUCCEEDED(hr)) m_settings.SegmentPrefetch = dwVal;
+
+    dwVal = reg.ReadDWORD(L"NetworkReceiveBuffer", hr);
+    if (SUCCEEDED(hr)) m_settings.NetworkReceiveBuffer = dwVal;
+
+    dwVal = reg.ReadDWORD(L"ImageSequenceFrameRate", hr);
+    if (SUCCEEDED(hr)) m_settings.ImageSequenceFrameRate = dwVal;
   }
 
   CRegistry regF = CRegistry(rootKey, LAVF_REGISTRY_KEY_FORMATS, hr, TRUE);
   if (SUCCEEDED(hr)) {
+    auto formats = std::make_shared<std::map<std::string, BOOL>>(*m_settings.formats);
     WCHAR wBuffer[80];
     for (const FormatInfo& fmt : m_InputFormats) {
       SafeMultiByteToWideChar(CP_UTF8, 0, fmt.strName, -1, wBuffer, 80);
       bFlag = regF.ReadBOOL(wBuffer, hr);
-      if (SUCCEEDED(hr)) m_settings.formats[std::string(fmt.strName)] = bFlag;
+      if (SUCCEEDED(hr)) (*formats)[std::string(fmt.strName)] = bFlag;
     }
+    m_settings.formats = formats;
   }
 
   return S_OK;
@@ -272,6 +373,23 @@ STDMETHODIMP CLAVSplitter::SaveSettings()
     reg.WriteDWORD(L"QueueMaxSize", m_settings.QueueMaxMemSize);
     reg.WriteDWORD(L"NetworkAnalysisDuration", m_settings.NetworkAnalysisDuration);
     reg.WriteDWORD(L"QueueMaxPackets", m_settings.QueueMaxPackets);
+    reg.WriteDWORD(L"QueueMaxDuration", m_settings.QueueMaxDuration);
+    reg.WriteBOOL(L"MemoryMappedIO", m_settings.MemoryMappedIO);
+    reg.WriteBOOL(L"KeyFrameIndexCache", m_settings.KeyFrameIndexCache);
+    reg.WriteBOOL(L"FastOpen", m_settings.FastOpen);
+    reg.WriteBOOL(L"LowLatencyLive", m_settings.LowLatencyLive);
+    reg.WriteBOOL(L"NetworkJitterBuffer", m_settings.NetworkJitterBuffer);
+    reg.WriteBOOL(L"HTTPPrefetch", m_settings.HTTPPrefetch);
+    reg.WriteBOOL(L"StreamingThreadPriority", m_settings.StreamingThreadPriority);
+    reg.WriteDWORD(L"NUMANode", m_settings.NUMANode);
+    reg.WriteDWORD(L"AudioPacketCoalescing", m_settings.AudioPacketCoalescing);
+    reg.WriteDWORD(L"SharedBlockCacheSize", m_settings.SharedBlockCacheSize);
+    reg.WriteDWORD(L"PreBufferSize", m_settings.PreBufferSize);
+    reg.WriteDWORD(L"LookbackDuration", m_settings.LookbackDuration);
+    reg.WriteBOOL(L"LowFootprint", m_settings.LowFootprint);
+    reg.WriteDWORD(L"SegmentPrefetch", m_settings.SegmentPrefetch);
+    reg.WriteDWORD(L"NetworkReceiveBuffer", m_settings.NetworkReceiveBuffer);
+    reg.WriteDWORD(L"ImageSequenceFrameRate", m_settings.ImageSequenceFrameRate);
   }
 
   CreateRegistryKey(HKEY_CURRENT_USER, LAVF_REGISTRY_KEY_FORMATS);
@@ -280,7 +398,9 @@ STDMETHODIMP CLAVSplitter::SaveSettings()
     WCHAR wBuffer[80];
     for (const FormatInfo& fmt : m_InputFormats) {
       SafeMultiByteToWideChar(CP_UTF8, 0, fmt.strName, -1, wBuffer, 80);
-      regF.WriteBOOL(wBuffer, m_settings.formats[std::string(fmt.strName)]);
+      auto it = m_settings.formats->find(std::string(fmt.strName));
+      if (it != m_settings.formats->end())
+        regF.WriteBOOL(wBuffer, it->second);
     }
   }
 
@@ -309,6 +429,11 @@ STDMETHODIMP CLAVSplitter::NonDelegatingQueryInterface(REFIID riid, void** ppv)
     QI2(ILAVFSettingsInternal)
     QI(IObjectWithSite)
     QI(IBufferInfo)
+    QI2(ILAVFStatistics)
+    QI2(ILAVFSourceQueue)
+    QI2(ILAVFPacketCapture)
+    QI2(ILAVFPacketSource)
+    QI(ILAVMemoryInfo)
     __super::NonDelegatingQueryInterface(riid, ppv);
 }
 
@@ -384,13 +509,13 @@ STDMETHODIMP CLAVSplitter::GetSite(REFIID riid, void **ppvSite)
 // IBufferInfo
 STDMETHODIMP_(int) CLAVSplitter::GetCount()
 {
-  CAutoLock pinLock(&m_csPins);
+  CAutoSharedLock pinLock(&m_csPins);
   return (int)m_pPins.size();
 }
 
 STDMETHODIMP CLAVSplitter::GetStatus(int i, int& samples, int& size)
 {
-  CAutoLock pinLock(&m_csPins);
+  CAutoSharedLock pinLock(&m_csPins);
   if ((size_t)i >= m_pPins.size())
     return E_FAIL;
 
@@ -405,6 +530,232 @@ STDMETHODIMP_(DWORD) CLAVSplitter::GetPriority()
   return 0;
 }
 
+// ILAVFStatistics
+STDMETHODIMP CLAVSplitter::GetPinStatistics(int iPin, LAVFPinStatistics *pStats)
+{
+  CheckPointer(pStats, E_POINTER);
+  CAutoSharedLock pinLock(&m_csPins);
+  if ((size_t)iPin >= m_pPins.size())
+    return E_INVALIDARG;
+
+  CLAVOutputPin *pPin = m_pPins.at(iPin);
+  if (!pPin)
+    return E_FAIL;
+  return pPin->GetStatistics(pStats);
+}
+
+STDMETHODIMP CLAVSplitter::GetReadStatistics(LAVFReadStatistics *pStats)
+{
+  CheckPointer(pStats, E_POINTER);
+  if (!m_pInput || !m_pInput->IsConnected())
+    return E_NOTIMPL;
+  return m_pInput->GetReadStatistics(pStats);
+}
+
+STDMETHODIMP CLAVSplitter::ResetStatistics()
+{
+  CAutoSharedLock pinLock(&m_csPins);
+  for (CLAVOutputPin *pPin : m_pPins) {
+    if (pPin)
+      pPin->ResetStatistics();
+  }
+  if (m_pInput)
+    m_pInput->ResetReadStatistics();
+  if (m_pDemuxer)
+    m_pDemuxer->ResetNetworkStatistics();
+
+  CAutoLock statsLock(&m_csDemuxStats);
+  memset(&m_DemuxStats, 0, sizeof(m_DemuxStats));
+  return S_OK;
+}
+
+STDMETHODIMP CLAVSplitter::GetDemuxStatistics(LAVFDemuxStatistics *pStats)
+{
+  CheckPointer(pStats, E_POINTER);
+  CAutoLock statsLock(&m_csDemuxStats);
+  *pStats = m_DemuxStats;
+  return S_OK;
+}
+
+STDMETHODIMP CLAVSplitter::GetNetworkStatistics(LAVFNetworkStatistics *pStats)
+{
+  CheckPointer(pStats, E_POINTER);
+  CAutoLock cAutoLock(this);
+  if (!m_pDemuxer)
+    return E_NOTIMPL;
+  return m_pDemuxer->GetNetworkStatistics(pStats);
+}
+
+// ILAVFSourceQueue
+STDMETHODIMP CLAVSplitter::QueueNextSource(LPCOLESTR pszFileName)
+{
+  CheckPointer(pszFileName, E_POINTER);
+  CAutoLock cAutoLock(this);
+
+  // only files opened by the splitter itself can be continued
+  if (!m_pDemuxer || m_pInput->IsConnected())
+    return E_UNEXPECTED;
+
+  LPWSTR extension = PathFindExtensionW(pszFileName);
+  if (_wcsicmp(extension, L".bdmv") == 0 || _wcsicmp(extension, L".mpls") == 0 || _wcsicmp(extension, L".lavcap") == 0)
+    return E_NOTIMPL;
+
+  std::set<CBaseDemuxer::StreamType> pinTypes;
+  {
+    CAutoSharedLock pinLock(&m_csPins);
+    for (CLAVOutputPin *pPin : m_pPins)
+      pinTypes.insert(pPin->GetPinType());
+  }
+
+  CAutoLock nextLock(&m_csNextSource);
+  if (!m_pNextSource)
+    m_pNextSource = new CNextSource(&m_csNextDemuxer, this);
+
+  return m_pNextSource->Open(pszFileName, GetPreferredAudioLanguageList(), GetSubtitleSelectors(), pinTypes);
+}
+
+STDMETHODIMP CLAVSplitter::ClearNextSource()
+{
+  CAutoLock nextLock(&m_csNextSource);
+  if (m_pNextSource)
+    m_pNextSource->Close();
+  return S_OK;
+}
+
+STDMETHODIMP CLAVSplitter::GetNextSourceState()
+{
+  CAutoLock nextLock(&m_csNextSource);
+  return m_pNextSource ? m_pNextSource->GetState() : VFW_E_NOT_FOUND;
+}
+
+// ILAVFPacketCapture
+STDMETHODIMP CLAVSplitter::StartPacketCapture(LPCWSTR pszPathPrefix)
+{
+  CheckPointer(pszPathPrefix, E_POINTER);
+  if (!*pszPathPrefix)
+    return E_INVALIDARG;
+
+  CAutoLock cAutoLock(this);
+  if (m_State != State_Stopped)
+    return E_UNEXPECTED;
+
+  m_strCapturePrefix = pszPathPrefix;
+  return S_OK;
+}
+
+STDMETHODIMP CLAVSplitter::StopPacketCapture()
+{
+  CAutoLock cAutoLock(this);
+  if (m_State != State_Stopped)
+    return E_UNEXPECTED;
+
+  m_strCapturePrefix.clear();
+  return S_OK;
+}
+
+// ILAVFPacketSource
+STDMETHODIMP CLAVSplitter::GetPacketSourceMediaType(AM_MEDIA_TYPE **ppmt)
+{
+  CheckPointer(ppmt, E_POINTER);
+  *ppmt = nullptr;
+
+  CAutoLock cAutoLock(this);
+  if (!m_pDemuxer)
+    return E_UNEXPECTED;
+
+  CAutoSharedLock lock(&m_csPins);
+  for (CLAVOutputPin *pPin : m_pPins) {
+    if (pPin->IsVideoPin()) {
+      CMediaType mt;
+      HRESULT hr = pPin->GetMediaType(0, &mt);
+      if (FAILED(hr))
+        return hr;
+      *ppmt = CreateMediaType(&mt);
+      return *ppmt ? S_OK : E_OUTOFMEMORY;
+    }
+  }
+  return VFW_E_NOT_FOUND;
+}
+
+STDMETHODIMP CLAVSplitter::ReadSourcePacket(IMediaSample **ppSample)
+{
+  CheckPointer(ppSample, E_POINTER);
+  *ppSample = nullptr;
+
+  CAutoLock cAutoLock(this);
+  if (!m_pDemuxer || m_State != State_Stopped)
+    return E_UNEXPECTED;
+
+  DWORD dwStreamId = 0;
+  {
+    CAutoSharedLock lock(&m_csPins);
+    auto it = std::find_if(m_pPins.begin(), m_pPins.end(), [](CLAVOutputPin *pPin) { return pPin->IsVideoPin(); });
+    if (it == m_pPins.end())
+      return VFW_E_NOT_FOUND;
+    if ((*it)->IsConnected())
+      return VFW_E_ALREADY_CONNECTED;
+    dwStreamId = (*it)->GetStreamId();
+  }
+
+  HRESULT hr = S_OK;
+  if (!m_pSourceAllocator) {
+    m_pSourceAllocator = new CPacketAllocator(NAME("CPacketAllocator"), nullptr, &hr);
+    m_pSourceAllocator->AddRef();
+    m_pSourceAllocator->SetMemoryAccount(m_pMemoryAccount);
+
+    ALLOCATOR_PROPERTIES props = { PACKET_SOURCE_SAMPLES, 1, 1, 0 }, actual;
+    if (FAILED(hr) || FAILED(hr = m_pSourceAllocator->SetProperties(&props, &actual)) || FAILED(hr = m_pSourceAllocator->Commit())) {
+      SafeRelease(&m_pSourceAllocator);
+      return hr;
+    }
+  }
+
+  Packet *pPacket = nullptr;
+  for (;;) {
+    hr = m_pDemuxer->GetNextPacket(&pPacket);
+    // errors are the end of the file, as for the demuxing thread
+    if (FAILED(hr))
+      return S_FALSE;
+    if (hr == S_OK && pPacket->StreamId == dwStreamId && pPacket->GetDataSize() > 0)
+      break;
+    SAFE_DELETE(pPacket);
+  }
+
+  IMediaSample *pSample = nullptr;
+  ILAVMediaSample *pLAVSample = nullptr;
+  const long nBytes = (long)pPacket->GetDataSize();
+  const bool fTimeValid = pPacket->rtStart != Packet::INVALID_TIME;
+
+  if (FAILED(hr = m_pSourceAllocator->GetBuffer(&pSample, nullptr, nullptr, 0))) {
+    SAFE_DELETE(pPacket);
+    return hr;
+  }
+
+  if (pPacket->pmt) {
+    pSample->SetMediaType(pPacket->pmt);
+    pPacket->bDiscontinuity = true;
+  }
+  pSample->SetTime(fTimeValid ? &pPacket->rtStart : nullptr, fTimeValid ? &pPacket->rtStop : nullptr);
+  pSample->SetMediaTime(nullptr, nullptr);
+  pSample->SetDiscontinuity(pPacket->bDiscontinuity);
+  pSample->SetSyncPoint(pPacket->bSyncPoint);
+  pSample->SetPreroll(fTimeValid && pPacket->rtStart < 0);
+
+  if (FAILED(hr = pSample->QueryInterface(&pLAVSample))) {
+    SafeRelease(&pSample);
+    SAFE_DELETE(pPacket);
+    return hr;
+  }
+
+  // the sample takes over the packet
+  pLAVSample->SetPacket(pPacket);
+  SafeRelease(&pLAVSample);
+
+  pSample->SetActualDataLength(nBytes);
+  *ppSample = pSample;
+  return S_OK;
+}
+
 // IAMOpenProgress
 
 STDMETHODIMP CLAVSplitter::QueryProgress(LONGLONG *pllTotal, LONGLONG *pllCurrent)
@@ -423,7 +774,7 @@ STDMETHODIMP CLAVSplitter::AbortOperation()
 // CBaseSplitter
 int CLAVSplitter::GetPinCount()
 {
-  CAutoLock lock(&m_csPins);
+  CAutoSharedLock lock(&m_csPins);
 
   int count = (int)m_pPins.size();
   if (m_pInput)
@@ -434,9 +785,7 @@ int CLAVSplitter::GetPinCount()
 
 CBasePin *CLAVSplitter::GetPin(int n)
 {
-  CAutoLock lock(&m_csPins);
-
-  if (n < 0 ||n >= GetPinCount()) return nullptr;
+  if (n < 0) return nullptr;
 
   if (m_pInput) {
     if(n == 0)
@@ -445,6 +794,9 @@ CBasePin *CLAVSplitter::GetPin(int n)
       n--;
   }
 
+  CAutoSharedLock lock(&m_csPins);
+  if ((size_t)n >= m_pPins.size()) return nullptr;
+
   return m_pPins[n];
 }
 
@@ -462,7 +814,7 @@ STDMETHODIMP CLAVSplitter::GetClassID(CLSID* pClsID)
 
 CLAVOutputPin *CLAVSplitter::GetOutputPin(DWORD streamId, BOOL bActiveOnly)
 {
-  CAutoLock lock(&m_csPins);
+  CAutoSharedLock lock(&m_csPins);
 
   auto &vec = bActiveOnly ? m_pActivePins : m_pPins;
   for(CLAVOutputPin *pPin : vec) {
@@ -543,7 +895,10 @@ STDMETHODIMP CLAVSplitter::Load(LPCOLESTR pszFileName, const AM_MEDIA_TYPE * pmt
   // Close, just in case we're being re-used
   Close();
 
-  m_fileName = std::wstring(pszFileName);
+  {
+    CAutoLock nextLock(&m_csNextSource);
+    m_fileName = std::wstring(pszFileName);
+  }
 
   HRESULT hr = S_OK;
   SAFE_DELETE(m_pDemuxer);
@@ -551,9 +906,11 @@ STDMETHODIMP CLAVSplitter::Load(LPCOLESTR pszFileName, const AM_MEDIA_TYPE * pmt
 
   DbgLog((LOG_TRACE, 10, L"::Load(): Opening file '%s' (extension: %s)", pszFileName, extension));
 
-  // BDMV uses the BD demuxer, everything else LAVF
+  // BDMV uses the BD demuxer, sample captures are replayed by the capture demuxer, everything else LAVF
   if (_wcsicmp(extension, L".bdmv") == 0 || _wcsicmp(extension, L".mpls") == 0) {
     m_pDemuxer = new CBDDemuxer(this, this);
+  } else if (_wcsicmp(extension, L".lavcap") == 0) {
+    m_pDemuxer = new CCaptureDemuxer(this);
   } else {
     m_pDemuxer = new CLAVFDemuxer(this, this);
   }
@@ -571,6 +928,7 @@ STDMETHODIMP CLAVSplitter::GetCurFile(LPOLESTR *ppszFileName, AM_MEDIA_TYPE *pmt
 {
   CheckPointer(ppszFileName, E_POINTER);
 
+  CAutoLock nextLock(&m_csNextSource);
   size_t strlen = m_fileName.length() + 1;
   *ppszFileName = (LPOLESTR)CoTaskMemAlloc(sizeof(wchar_t) * strlen);
 
@@ -589,7 +947,7 @@ STDMETHODIMP CLAVSplitter::InitDemuxer()
   bool bNoSubtitles = _wcsicmp(m_processName.c_str(), L"dllhost.exe") == 0 || _wcsicmp(m_processName.c_str(), L"explorer.exe") == 0 || _wcsicmp(m_processName.c_str(), L"powerpnt.exe") == 0 || _wcsicmp(m_processName.c_str(), L"pptview.exe") == 0;
 
   m_rtStart = m_rtNewStart = m_rtCurrent = 0;
-  m_rtStop = m_rtNewStop = m_pDemuxer->GetDuration();
+  m_rtStop = m_rtNewStop = m_rtDuration = m_pDemuxer->GetDuration();
   m_bPlaybackStarted = FALSE;
 
   const CBaseDemuxer::stream *videoStream = m_pDemuxer->SelectVideoStream();
@@ -645,14 +1003,19 @@ STDMETHODIMP CLAVSplitter::DeleteOutputs()
   CAutoLock lock(this);
   if(m_State != State_Stopped) return VFW_E_NOT_STOPPED;
 
-  CAutoLock pinLock(&m_csPins);
+  // The pins are disconnected without the pin lock, downstream filters may call back into the splitter
+  std::vector<CLAVOutputPin *> pins;
+  {
+    CAutoExclusiveLock pinLock(&m_csPins);
+    pins.swap(m_pPins);
+  }
+
   // Release pins
-  for(CLAVOutputPin *pPin : m_pPins) {
+  for(CLAVOutputPin *pPin : pins) {
     if(IPin* pPinTo = pPin->GetConnected()) pPinTo->Disconnect();
     pPin->Disconnect();
     m_pRetiredPins.push_back(pPin);
   }
-  m_pPins.clear();
 
   return S_OK;
 }
@@ -662,13 +1025,45 @@ bool CLAVSplitter::IsAnyPinDrying()
   // MPC changes thread priority here
   // TODO: Investigate if that is needed
   for(CLAVOutputPin *pPin : m_pActivePins) {
-    if(pPin->IsConnected() && !pPin->IsDiscontinuous() && pPin->QueueCount() < pPin->GetQueueLowLimit()) {
+    if(pPin->IsConnected() && !pPin->IsDiscontinuous() && pPin->IsQueueDrying()) {
+      return true;
+    }
+  }
+  return false;
+}
+
+bool CLAVSplitter::IsAnyPinBehind(REFERENCE_TIME rtBufferedUntil)
+{
+  for(CLAVOutputPin *pPin : m_pActivePins) {
+    if(pPin->IsConnected() && !pPin->IsDiscontinuous() && pPin->IsQueueBehind(rtBufferedUntil)) {
       return true;
     }
   }
   return false;
 }
 
+size_t CLAVSplitter::GetQueueDataSize()
+{
+  size_t size = 0;
+  for(CLAVOutputPin *pPin : m_pActivePins) {
+    size += pPin->QueueDataSize();
+  }
+  return size;
+}
+
+// Run fn for all pins at once, and wait for all of them
+// Downstream filters can take a while to flush, hardware decoders in particular, so the pins don't wait on each other
+static void ForAllPinsParallel(const std::vector<CLAVOutputPin *> &pins, const std::function<void(CLAVOutputPin *)> &fn)
+{
+  worker_pool_run((int)pins.size(), (int)pins.size(), [&](int job, int thread) {
+    // the pool threads call into the downstream filters, which may use COM
+    HRESULT hrCo = CoInitializeEx(nullptr, COINIT_MULTITHREADED);
+    fn(pins[job]);
+    if (SUCCEEDED(hrCo))
+      CoUninitialize();
+  });
+}
+
 // Worker Thread
 DWORD CLAVSplitter::ThreadProc()
 {
@@ -678,8 +1073,16 @@ DWORD CLAVSplitter::ThreadProc()
 
   SetThreadName(-1, "CLAVSplitter Demux");
 
+  // live sources are read as they arrive, and can't wait behind other work
+  CStreamingThreadPriority priority(IsLiveStream() ? ThreadClass_Capture : ThreadClass_Playback, m_settings.StreamingThreadPriority);
+  numa_bind_thread(GetNUMAPlacement());
+
   m_pDemuxer->Start();
 
+  // the lookback buffer needs monotonic timestamps, and is of no use without seeking
+  m_Lookback.Clear();
+  m_Lookback.SetDuration((m_settings.LowFootprint || (m_pDemuxer->GetContainerFlags() & (LAVFMT_TS_DISCONT | LAVFMT_LIVE | LAVFMT_REALTIME))) ? 0 : m_settings.LookbackDuration * 10000LL);
+
   m_fFlushing = false;
   m_eEndFlush.Set();
   for(DWORD cmd = (DWORD)-1; ; cmd = GetRequest())
@@ -696,7 +1099,7 @@ DWORD CLAVSplitter::ThreadProc()
     m_rtStart = m_rtNewStart;
     m_rtStop = m_rtNewStop;
 
-    if(m_bPlaybackStarted || m_rtStart != 0 || cmd == CMD_SEEK) {
+    if((m_bPlaybackStarted || m_rtStart != 0 || cmd == CMD_SEEK) && !LookbackSeek(m_rtStart)) {
       HRESULT hr = S_FALSE;
       if (m_pInput) {
         hr = m_pInput->SeekStream(m_rtStart);
@@ -715,24 +1118,71 @@ DWORD CLAVSplitter::ThreadProc()
 
     m_pActivePins.clear();
 
+    m_rtSegmentStart = m_rtStart;
+    m_rtSegmentStop = m_rtStop;
     for(pinIter = m_pPins.begin(); pinIter != m_pPins.end() && !m_fFlushing; ++pinIter) {
       if ((*pinIter)->IsConnected()) {
-        (*pinIter)->DeliverNewSegment(m_rtStart, m_rtStop, m_dRate);
         m_pActivePins.push_back(*pinIter);
       }
+      // streams without a connected output are not read from the file at all
+      m_pDemuxer->SetOutputConnected((*pinIter)->GetPinType(), (*pinIter)->IsConnected());
     }
+    ForAllPinsParallel(m_pActivePins, [this](CLAVOutputPin *pPin) { pPin->DeliverNewSegment(m_rtStart, m_rtStop, m_dRate); });
     m_rtOffset = AV_NOPTS_VALUE;
+    m_rtSourceOffset = 0;
+
+    m_llLastPacketPos = -1;
+    m_llSwitchSkipPos = -1;
+    m_pSwitchPin = nullptr;
 
     m_bDiscontinuitySent.clear();
 
+    InitTrickPlay();
+
     m_bPlaybackStarted = TRUE;
     m_ePlaybackInit.Set();
 
+    // real-time streams are read on a separate thread, which smooths out their arrival jitter
+    if (m_settings.NetworkJitterBuffer && (m_pDemuxer->GetContainerFlags() & LAVFMT_REALTIME)) {
+      m_pJitterBuffer = new CJitterBuffer(m_pDemuxer, IsLiveStream() ? JITTER_MAX_DELAY_LIVE : JITTER_MAX_DELAY, m_settings.StreamingThreadPriority, GetNUMAPlacement());
+      if (FAILED(m_pJitterBuffer->Start()))
+        SAFE_DELETE(m_pJitterBuffer);
+    }
+
+    {
+      CAutoLock switchLock(&m_csStreamSwitch);
+      m_bStreamSwitchReady = (m_pJitterBuffer == nullptr);
+    }
+
     HRESULT hr = S_OK;
     while(SUCCEEDED(hr) && !CheckRequest(&cmd)) {
+      if (m_pStreamSwitch)
+        DemuxStreamSwitch();
+
       hr = DemuxNextPacket();
+
+      if (m_pDemuxer->CheckDurationChanged())
+        UpdateDuration();
+
+      // at the end of the file, continue with the queued next file if it fits the connected pins
+      if (FAILED(hr) && !CheckRequest(&cmd) && SwitchToNextSource() == S_OK)
+        hr = S_OK;
     }
 
+    // switch requests coming in too late go the regular way
+    {
+      CAutoLock switchLock(&m_csStreamSwitch);
+      m_bStreamSwitchReady = FALSE;
+      if (m_pStreamSwitch) {
+        m_pStreamSwitch->hr = S_FALSE;
+        m_pStreamSwitch = nullptr;
+        m_evStreamSwitched.Set();
+      }
+    }
+
+    // the demuxer is only accessed by this thread again, before any seeking happens
+    SAFE_DELETE(m_pJitterBuffer);
+
     // If we didnt exit by request, deliver end-of-stream
     if(!CheckRequest(&cmd)) {
       for(pinIter = m_pActivePins.begin(); pinIter != m_pActivePins.end(); ++pinIter) {
@@ -746,28 +1196,259 @@ DWORD CLAVSplitter::ThreadProc()
   return 0;
 }
 
+// Follow the duration refined by the demuxer in the background
+// The stop position moves along unless it was set somewhere else. The filter lock isn't taken, a seek holds it while
+// waiting for this thread.
+void CLAVSplitter::UpdateDuration()
+{
+  REFERENCE_TIME rtDuration = m_pDemuxer->GetDuration();
+  if (rtDuration <= 0 || rtDuration == m_rtDuration)
+    return;
+
+  DbgLog((LOG_TRACE, 10, L"::UpdateDuration(): Duration changed from %I64d to %I64d", m_rtDuration, rtDuration));
+
+  if (m_rtStop == m_rtDuration)
+    m_rtStop = rtDuration;
+  if (m_rtNewStop == m_rtDuration)
+    m_rtNewStop = rtDuration;
+  m_rtDuration = rtDuration;
+
+  NotifyEvent(EC_LENGTH_CHANGED, 0, 0);
+}
+
 // Seek to the specified time stamp
 // Based on DVDDemuxFFMPEG
 HRESULT CLAVSplitter::DemuxSeek(REFERENCE_TIME rtStart)
 {
   if(rtStart < 0) { rtStart = 0; }
-  
+
+  // the packets in the lookback buffer only connect to the read position of the demuxer
+  m_Lookback.Clear();
+
   return m_pDemuxer->Seek(rtStart);
 }
 
+// Serve a seek from the packets read recently, if it lands in the lookback window
+BOOL CLAVSplitter::LookbackSeek(REFERENCE_TIME rtStart)
+{
+  // trick-play seeks on its own, in between the packets
+  if (m_dRate >= TRICKPLAY_MIN_RATE || rtStart < 0)
+    return FALSE;
+
+  // the replay starts at a keyframe of the video, or of the first stream without video
+  CLAVOutputPin *pSeekPin = nullptr;
+  for (CLAVOutputPin *pPin : m_pPins) {
+    if (pPin->IsConnected() && (!pSeekPin || (pPin->IsVideoPin() && !pSeekPin->IsVideoPin())))
+      pSeekPin = pPin;
+  }
+
+  return pSeekPin && m_Lookback.Seek(rtStart, pSeekPin->GetStreamId());
+}
+
 // Demux the next packet and deliver it to the output pins
 // Based on DVDDemuxFFMPEG
 HRESULT CLAVSplitter::DemuxNextPacket()
 {
   Packet *pPacket;
   HRESULT hr = S_OK;
-  hr = m_pDemuxer->GetNextPacket(&pPacket);
+  REFERENCE_TIME rtDemuxStart = timer_get_ref_time();
+  if (m_Lookback.IsReplaying()) {
+    pPacket = m_Lookback.GetReplayPacket();
+    hr = pPacket ? S_OK : S_FALSE;
+    // replayed data is already in memory, it is captured again now
+    if (pPacket)
+      pPacket->rtCapture = rtDemuxStart;
+  } else {
+    if (m_pJitterBuffer)
+      hr = m_pJitterBuffer->GetNextPacket(&pPacket, JITTER_POLL_TIMEOUT);
+    else
+      hr = m_pDemuxer->GetNextPacket(&pPacket);
+
+    if (hr == S_OK)
+      m_Lookback.Store(pPacket);
+  }
   // Only S_OK indicates we have a proper packet
   // S_FALSE is a "soft error", don't deliver the packet
   if (hr != S_OK) {
     return hr;
   }
-  return DeliverPacket(pPacket);
+
+  REFERENCE_TIME rtDeliverStart = timer_get_ref_time();
+  const int size = pPacket->GetDataSize();
+  LAV_TRACE("PacketDemuxed", LAV_TRACE_KEYWORD_SPLITTER,
+            TraceLoggingUInt32(pPacket->StreamId, "StreamId"),
+            TraceLoggingInt64(pPacket->rtStart, "Start"),
+            TraceLoggingInt64(pPacket->rtStop, "Stop"),
+            TraceLoggingInt32(size, "Size"),
+            TraceLoggingInt64(rtDeliverStart - rtDemuxStart, "DemuxTime"));
+  hr = DeliverPacket(pPacket);
+
+  {
+    REFERENCE_TIME rtNow = timer_get_ref_time();
+    CAutoLock statsLock(&m_csDemuxStats);
+    m_DemuxStats.ullPackets++;
+    m_DemuxStats.ullBytes += size;
+    m_DemuxStats.rtDemux += rtDeliverStart - rtDemuxStart;
+    m_DemuxStats.rtDeliver += rtNow - rtDeliverStart;
+  }
+
+  if (m_bTrickPlaySeek) {
+    m_bTrickPlaySeek = FALSE;
+    TrickPlaySeek();
+  }
+
+  return hr;
+}
+
+// Trick-play is used for high rates, unless the source can't be seeked
+void CLAVSplitter::InitTrickPlay()
+{
+  m_bTrickPlay = FALSE;
+  m_bTrickPlaySeek = FALSE;
+  m_TrickPlayKeyFrames.clear();
+
+  if (m_dRate < TRICKPLAY_MIN_RATE || (m_pDemuxer->GetContainerFlags() & (LAVFMT_LIVE | LAVFMT_REALTIME)))
+    return;
+
+  auto it = std::find_if(m_pActivePins.begin(), m_pActivePins.end(), [](CLAVOutputPin *pPin) { return pPin->GetPinType() == CBaseDemuxer::video; });
+  if (it == m_pActivePins.end())
+    return;
+
+  DbgLog((LOG_TRACE, 10, L"::InitTrickPlay(): Delivering only keyframes at rate %.1f", m_dRate));
+
+  m_bTrickPlay = TRUE;
+  m_rtTrickPlayNext = m_rtStart;
+
+  // with the keyframe positions, the next keyframe to show can be seeked to directly
+  GetKeyFrames(m_TrickPlayKeyFrames);
+}
+
+// Get the sorted keyframe positions of the file, if the demuxer knows them
+BOOL CLAVSplitter::GetKeyFrames(std::vector<REFERENCE_TIME> &keyFrames)
+{
+  keyFrames.clear();
+  if (!m_pDemuxer)
+    return FALSE;
+
+  IKeyFrameInfo *pKeyFrameInfo = nullptr;
+  if (SUCCEEDED(m_pDemuxer->QueryInterface(__uuidof(IKeyFrameInfo), (void **)&pKeyFrameInfo))) {
+    UINT nKFs = 0;
+    if (pKeyFrameInfo->GetKeyFrameCount(nKFs) == S_OK && nKFs > 0) {
+      keyFrames.resize(nKFs);
+      if (pKeyFrameInfo->GetKeyFrames(&TIME_FORMAT_MEDIA_TIME, keyFrames.data(), nKFs) == S_OK) {
+        keyFrames.resize(nKFs);
+        std::sort(keyFrames.begin(), keyFrames.end());
+      } else {
+        keyFrames.clear();
+      }
+    }
+    SafeRelease(&pKeyFrameInfo);
+  }
+
+  return !keyFrames.empty();
+}
+
+// Only the video keyframes spaced by the rate are delivered in trick-play, everything else is dropped
+BOOL CLAVSplitter::FilterTrickPlayPacket(CLAVOutputPin *pPin, const Packet *pPacket)
+{
+  if (pPin->GetPinType() != CBaseDemuxer::video || !pPacket->bSyncPoint || pPacket->rtStart == Packet::INVALID_TIME || pPacket->rtStart < m_rtTrickPlayNext)
+    return FALSE;
+
+  m_rtTrickPlayNext = pPacket->rtStart + (REFERENCE_TIME)(m_dRate * DSHOW_TIME_BASE / TRICKPLAY_FRAMES_PER_SEC);
+  m_bTrickPlaySeek = TRUE;
+  return TRUE;
+}
+
+// Skip ahead to the next keyframe to show, instead of reading all packets in between
+void CLAVSplitter::TrickPlaySeek()
+{
+  REFERENCE_TIME rtTarget = m_rtTrickPlayNext;
+  if (!m_TrickPlayKeyFrames.empty()) {
+    auto it = std::lower_bound(m_TrickPlayKeyFrames.begin(), m_TrickPlayKeyFrames.end(), m_rtTrickPlayNext);
+    if (it == m_TrickPlayKeyFrames.end())
+      return;
+    rtTarget = *it;
+  }
+
+  if (rtTarget - m_rtCurrent < TRICKPLAY_MIN_SEEK)
+    return;
+
+  DbgLog((LOG_TRACE, 20, L"::TrickPlaySeek(): Seeking from %I64d to %I64d", m_rtCurrent, rtTarget));
+  DemuxSeek(rtTarget);
+
+  // the jump is not a timestamp discontinuity
+  for (CLAVOutputPin *pPin : m_pActivePins) {
+    pPin->m_rtPrev = AV_NOPTS_VALUE;
+  }
+}
+
+// Take over a stream switch request of SwitchStreamInPlace, between two packets
+void CLAVSplitter::DemuxStreamSwitch()
+{
+  StreamSwitch *pSwitch = nullptr;
+  {
+    CAutoLock switchLock(&m_csStreamSwitch);
+    pSwitch = m_pStreamSwitch;
+    m_pStreamSwitch = nullptr;
+  }
+  if (!pSwitch)
+    return;
+
+  CLAVOutputPin *pPin = pSwitch->pPin;
+  BOOL bActive = std::find(m_pActivePins.begin(), m_pActivePins.end(), pPin) != m_pActivePins.end();
+
+  // the read position marks the end of the packets the other pins have queued already
+  if (!bActive || m_llLastPacketPos < 0 || m_llSwitchSkipPos >= 0 || m_bTrickPlay) {
+    pSwitch->hr = S_FALSE;
+    m_evStreamSwitched.Set();
+    return;
+  }
+
+  // file time of the playback position, the inverse of the timestamp mapping in DeliverPacket
+  REFERENCE_TIME rtPosition = (REFERENCE_TIME)((REFERENCE_TIME)pSwitch->rtStreamTime * m_dRate) + m_rtStart - m_rtSourceOffset;
+  if (m_rtOffset != AV_NOPTS_VALUE)
+    rtPosition -= m_rtOffset;
+  rtPosition = max(min(rtPosition, m_rtCurrent), 0LL);
+
+  DbgLog((LOG_TRACE, 10, L"::DemuxStreamSwitch(): Switching %s stream %u to %u at %I64d, read position %I64d", CBaseDemuxer::CStreamList::ToStringW(pPin->GetPinType()), pPin->GetStreamId(), pSwitch->dwStreamId, rtPosition, m_llLastPacketPos));
+
+  pPin->DeliverBeginFlush();
+  pPin->DeliverEndFlush();
+
+  pPin->SetStreamId(pSwitch->dwStreamId);
+  m_pDemuxer->SetActiveStream(pPin->GetPinType(), pSwitch->dwStreamId);
+  pPin->SetNewMediaTypes(pSwitch->pmts);
+  pPin->SendMediaType(new CMediaType(pSwitch->mt));
+  pPin->DeliverNewSegment(m_rtSegmentStart, m_rtSegmentStop, m_dRate);
+  m_bDiscontinuitySent.erase(pSwitch->dwStreamId);
+
+  m_llSwitchSkipPos = m_llLastPacketPos;
+  m_rtSwitchSkipTime = m_rtCurrent + DSHOW_TIME_BASE;
+  m_pSwitchPin = pPin;
+  m_rtSwitchStart = rtPosition;
+
+  DemuxSeek(rtPosition);
+
+  pSwitch->hr = S_OK;
+  m_evStreamSwitched.Set();
+}
+
+// While the file is read again after a stream switch, only the switched pin gets the packets up to the previous read position
+BOOL CLAVSplitter::FilterStreamSwitchPacket(CLAVOutputPin *pPin, const Packet *pPacket)
+{
+  // the seek lands on a keyframe before the playback position, the new stream starts at the position itself
+  if (pPin == m_pSwitchPin && pPacket->rtStop != Packet::INVALID_TIME && pPacket->rtStop < m_rtSwitchStart)
+    return FALSE;
+
+  // positions are not strictly ordered in all containers, the time guards against never catching up
+  if (pPacket->bPosition > m_llSwitchSkipPos || (pPacket->rtStart != Packet::INVALID_TIME && pPacket->rtStart > m_rtSwitchSkipTime)) {
+    DbgLog((LOG_TRACE, 10, L"::FilterStreamSwitchPacket(): Reached the read position %I64d again", m_llSwitchSkipPos));
+    m_llSwitchSkipPos = -1;
+    m_pSwitchPin = nullptr;
+    return TRUE;
+  }
+
+  return pPin == m_pSwitchPin;
 }
 
 HRESULT CLAVSplitter::DeliverPacket(Packet *pPacket)
@@ -783,8 +1464,24 @@ HRESULT CLAVSplitter::DeliverPacket(Packet *pPacket)
     return S_FALSE;
   }
 
+  if (m_bTrickPlay && !FilterTrickPlayPacket(pPin, pPacket)) {
+    delete pPacket;
+    return S_FALSE;
+  }
+
+  // the file is read again after a stream switch, most of it only for the switched pin
+  const BOOL bSwitchSkip = (m_llSwitchSkipPos >= 0);
+  if (bSwitchSkip && !FilterStreamSwitchPacket(pPin, pPacket)) {
+    delete pPacket;
+    return S_FALSE;
+  }
+  if (pPacket->bPosition >= 0 || !bSwitchSkip)
+    m_llLastPacketPos = pPacket->bPosition;
+
   if(pPacket->rtStart != Packet::INVALID_TIME) {
-    m_rtCurrent = pPacket->rtStop;
+    // the position only moves forward again once the read position of the switch is reached
+    if (m_llSwitchSkipPos < 0)
+      m_rtCurrent = pPacket->rtStop;
 
     if (m_bStopValid && m_rtStop && pPacket->rtStart > m_rtStop) {
       DbgLog((LOG_TRACE, 10, L"::DeliverPacket(): Reached the designated stop time of %I64d at %I64d", m_rtStop, pPacket->rtStart));
@@ -792,8 +1489,8 @@ HRESULT CLAVSplitter::DeliverPacket(Packet *pPacket)
       return E_FAIL;
     }
 
-    pPacket->rtStart -= m_rtStart;
-    pPacket->rtStop -= m_rtStart;
+    pPacket->rtStart += m_rtSourceOffset - m_rtStart;
+    pPacket->rtStop += m_rtSourceOffset - m_rtStart;
 
     ASSERT(pPacket->rtStart <= pPacket->rtStop);
 
@@ -879,9 +1576,16 @@ STDMETHODIMP CLAVSplitter::Stop()
   CAMThread::Close();
   DeliverEndFlush();
 
-  if (m_pDemuxer)
+  if (m_pDemuxer) {
     m_pDemuxer->AbortOpening(0);
 
+#ifdef DEBUG
+    ULONGLONG nHits = 0, nMisses = 0;
+    m_pDemuxer->GetPacketPoolStatistics(&nHits, &nMisses);
+    DbgLog((LOG_TRACE, 10, L"::Stop(): Packet pool statistics: %I64u hits, %I64u misses", nHits, nMisses));
+#endif
+  }
+
   HRESULT hr;
   if(FAILED(hr = __super::Stop())) {
     return hr;
@@ -910,6 +1614,15 @@ STDMETHODIMP CLAVSplitter::Pause()
     // At this point, the graph is hopefully finished, tell the demuxer about all the cool things
     m_pDemuxer->SettingsChanged(static_cast<ILAVFSettingsInternal *>(this));
 
+    // Recycle enough packets to fill all output queues
+    size_t nPoolSize = 0;
+    for (CLAVOutputPin *pPin : m_pPins) {
+      if (pPin->IsConnected())
+        nPoolSize += pPin->GetQueueHighLimit();
+    }
+    if (nPoolSize > 0)
+      m_pDemuxer->SetPacketPoolSize(nPoolSize);
+
     // Create demuxing thread
     if (!ThreadExists())
       m_ePlaybackInit.Reset();
@@ -937,17 +1650,13 @@ void CLAVSplitter::DeliverBeginFlush()
   m_fFlushing = true;
 
   // flush all pins
-  for(CLAVOutputPin *pPin : m_pPins) {
-    pPin->DeliverBeginFlush();
-  }
+  ForAllPinsParallel(m_pPins, [](CLAVOutputPin *pPin) { pPin->DeliverBeginFlush(); });
 }
 
 void CLAVSplitter::DeliverEndFlush()
 {
   // flush all pins
-  for(CLAVOutputPin *pPin : m_pPins) {
-    pPin->DeliverEndFlush();
-  }
+  ForAllPinsParallel(m_pPins, [](CLAVOutputPin *pPin) { pPin->DeliverEndFlush(); });
 
   m_fFlushing = false;
   m_eEndFlush.Set();
@@ -1046,6 +1755,17 @@ STDMETHODIMP CLAVSplitter::SetPositionsInternal(void *caller, LONGLONG* pCurrent
     case AM_SEEKING_RelativePositioning: rtCurrent = rtCurrent + *pCurrent; break;
     case AM_SEEKING_IncrementalPositioning: rtCurrent = rtCurrent + *pCurrent; break;
     }
+
+    // start at the keyframe preceding the target, so the first decoded frame is not preroll
+    std::vector<REFERENCE_TIME> keyFrames;
+    if ((dwCurrentFlags & AM_SEEKING_SeekToKeyFrame) && (dwCurrentFlags & AM_SEEKING_PositioningBitsMask) != AM_SEEKING_NoPositioning && GetKeyFrames(keyFrames)) {
+      auto it = std::upper_bound(keyFrames.begin(), keyFrames.end(), rtCurrent);
+      rtCurrent = (it == keyFrames.begin()) ? keyFrames.front() : *(it - 1);
+      DbgLog((LOG_TRACE, 20, " -> Seeking to keyframe at %I64d", rtCurrent));
+
+      if (dwCurrentFlags & AM_SEEKING_ReturnTime)
+        *pCurrent = rtCurrent;
+    }
   }
 
   if(pStop){
@@ -1097,7 +1817,28 @@ STDMETHODIMP CLAVSplitter::GetAvailable(LONGLONG* pEarliest, LONGLONG* pLatest)
   if(pEarliest) *pEarliest = 0;
   return GetDuration(pLatest);
 }
-STDMETHODIMP CLAVSplitter::SetRate(double dRate) {return dRate > 0 ? m_dRate = dRate, S_OK : E_INVALIDARG;}
+STDMETHODIMP CLAVSplitter::SetRate(double dRate)
+{
+  if (dRate <= 0)
+    return E_INVALIDARG;
+
+  CAutoLock cAutoLock(this);
+
+  BOOL bTrickPlayChange = (dRate >= TRICKPLAY_MIN_RATE) != (m_dRate >= TRICKPLAY_MIN_RATE);
+  m_dRate = dRate;
+
+  // entering or leaving trick-play changes which packets are delivered, restart at the current position
+  if (bTrickPlayChange && ThreadExists()) {
+    m_rtNewStart = m_rtCurrent;
+    m_rtNewStop = m_rtStop;
+
+    DeliverBeginFlush();
+    CallWorker(CMD_SEEK);
+    DeliverEndFlush();
+  }
+
+  return S_OK;
+}
 STDMETHODIMP CLAVSplitter::GetRate(double* pdRate) {return pdRate ? *pdRate = m_dRate, S_OK : E_POINTER;}
 STDMETHODIMP CLAVSplitter::GetPreroll(LONGLONG* pllPreroll) {return pllPreroll ? *pllPreroll = 0, S_OK : E_POINTER;}
 
@@ -1127,6 +1868,61 @@ static int QueryAcceptMediaTypes(IPin *pPin, std::deque<CMediaType> pmts)
   return -1;
 }
 
+// Switch the stream of an audio or subtitle pin without stopping the graph
+// The demuxing thread only flushes the switched pin, and reads the file again from the playback position to refill it,
+// while the other pins keep playing from their queues. Returns S_FALSE if the stream has to be switched the regular way.
+HRESULT CLAVSplitter::SwitchStreamInPlace(CLAVOutputPin *pPin, DWORD dwStreamId, const std::deque<CMediaType> &pmts)
+{
+  CAutoLock cAutoLock(this);
+
+  if (m_State != State_Running || !m_pDemuxer || pPin->IsVideoPin() || !pPin->IsConnected())
+    return S_FALSE;
+  // the audio decoder is replaced on every switch with this setting
+  if (pPin->IsAudioPin() && m_settings.StreamSwitchRemoveAudio)
+    return S_FALSE;
+  if (m_pDemuxer->GetContainerFlags() & (LAVFMT_LIVE | LAVFMT_REALTIME))
+    return S_FALSE;
+
+  int mtIdx = QueryAcceptMediaTypes(pPin->GetConnected(), pmts);
+  if (mtIdx < 0)
+    return S_FALSE;
+
+  StreamSwitch request;
+  if (FAILED(StreamTime(request.rtStreamTime)))
+    return S_FALSE;
+  request.pPin = pPin;
+  request.dwStreamId = dwStreamId;
+  request.mt = pmts[mtIdx];
+  request.pmts = pmts;
+  request.hr = S_FALSE;
+
+  {
+    CAutoLock switchLock(&m_csStreamSwitch);
+    if (!m_bStreamSwitchReady)
+      return S_FALSE;
+    m_evStreamSwitched.Reset();
+    m_pStreamSwitch = &request;
+  }
+
+  if (!m_evStreamSwitched.Wait(STREAM_SWITCH_TIMEOUT)) {
+    {
+      CAutoLock switchLock(&m_csStreamSwitch);
+      // not taken yet, the demuxing thread is stuck waiting for queue space
+      if (m_pStreamSwitch == &request) {
+        m_pStreamSwitch = nullptr;
+        return S_FALSE;
+      }
+    }
+    // taken just now, wait for it to finish
+    m_evStreamSwitched.Wait();
+  }
+
+  if (request.hr == S_OK && pPin->IsAudioPin() && m_settings.PGSForcedStream)
+    UpdateForcedSubtitleMediaType();
+
+  return request.hr;
+}
+
 STDMETHODIMP CLAVSplitter::RenameOutputPin(DWORD TrackNumSrc, DWORD TrackNumDst, std::deque<CMediaType> pmts)
 {
   CheckPointer(m_pDemuxer, E_UNEXPECTED);
@@ -1140,6 +1936,11 @@ STDMETHODIMP CLAVSplitter::RenameOutputPin(DWORD TrackNumSrc, DWORD TrackNumDst,
   CLAVOutputPin* pPin = GetOutputPin(TrackNumSrc);
 
   DbgLog((LOG_TRACE, 20, L"::RenameOutputPin() - Switching %s Stream %d to %d", CBaseDemuxer::CStreamList::ToStringW(pPin->GetPinType()), TrackNumSrc, TrackNumDst));
+
+  // audio and subtitle streams are switched during playback if possible, without interrupting the other pins
+  if (pPin && pPin->IsConnected() && SwitchStreamInPlace(pPin, TrackNumDst, pmts) == S_OK)
+    return S_OK;
+
   // Output Pin was found
   // Stop the Graph, remove the old filter, render the graph again, start it up again
   // This only works on pins that were connected before, or the filter graph could .. well, break
@@ -1265,6 +2066,110 @@ resumegraph:
   return E_FAIL;
 }
 
+// Continue playback with the queued next file in place, only to be called from the demuxing thread
+// Every active pin needs a stream in the next file with the same subtype, which its downstream filter accepts.
+// The pins are not reconnected, a changed format is sent along with the first sample instead.
+HRESULT CLAVSplitter::SwitchToNextSource()
+{
+  if (m_pActivePins.empty() || m_bStopValid || m_pJitterBuffer || m_fFlushing)
+    return S_FALSE;
+
+  CBaseDemuxer *pDemuxer = nullptr;
+  const CBaseDemuxer::stream *pStreams[CBaseDemuxer::unknown] = { nullptr };
+  std::deque<Packet *> packets;
+  std::wstring fileName;
+  {
+    CAutoLock nextLock(&m_csNextSource);
+    if (!m_pNextSource || m_pNextSource->GetState() != S_OK)
+      return S_FALSE;
+    fileName = m_pNextSource->GetFileName();
+    if (FAILED(m_pNextSource->Detach(&pDemuxer, pStreams, packets)))
+      return S_FALSE;
+  }
+
+  // index of the media type to send on each active pin, or -1 if the current type stays valid
+  std::vector<int> mtIdx(m_pActivePins.size(), -1);
+  BOOL bCompatible = TRUE;
+  for (size_t i = 0; i < m_pActivePins.size() && bCompatible; i++) {
+    CLAVOutputPin *pPin = m_pActivePins[i];
+    const CBaseDemuxer::stream *pStream = pStreams[pPin->GetPinType()];
+    if (!pStream) {
+      bCompatible = FALSE;
+      break;
+    }
+
+    const std::deque<CMediaType> &mtypes = pStream->streamInfo->mtypes;
+    const CMediaType &mtActive = pPin->GetActiveMediaType();
+    if (std::find(mtypes.begin(), mtypes.end(), mtActive) != mtypes.end())
+      continue;
+
+    mtIdx[i] = QueryAcceptMediaTypes(pPin->GetConnected(), mtypes);
+    bCompatible = (mtIdx[i] >= 0 && mtypes[mtIdx[i]].majortype == mtActive.majortype && mtypes[mtIdx[i]].subtype == mtActive.subtype);
+  }
+
+  if (!bCompatible) {
+    DbgLog((LOG_TRACE, 10, L"::SwitchToNextSource(): The streams of '%s' don't fit the connected pins", fileName.c_str()));
+    for (Packet *pPacket : packets)
+      delete pPacket;
+    SafeRelease(&pDemuxer);
+    return S_FALSE;
+  }
+
+  DbgLog((LOG_TRACE, 10, L"::SwitchToNextSource(): Continuing with '%s' at %I64d", fileName.c_str(), m_rtSourceOffset + m_rtCurrent - m_rtStart));
+
+  // the next file starts where the current one ended
+  m_rtSourceOffset += m_rtCurrent - m_rtStart;
+
+  SafeRelease(&m_pPrevDemuxer);
+  m_pPrevDemuxer = m_pDemuxer;
+  m_pDemuxer = pDemuxer;
+
+  {
+    CAutoSharedLock pinLock(&m_csPins);
+    for (CLAVOutputPin *pPin : m_pPins) {
+      const CBaseDemuxer::stream *pStream = pStreams[pPin->GetPinType()];
+      if (pStream) {
+        pPin->SetStreamId(pStream->pid);
+        pPin->SetNewMediaTypes(pStream->streamInfo->mtypes);
+      }
+      m_pDemuxer->SetOutputConnected(pPin->GetPinType(), pStream && pPin->IsConnected());
+      pPin->m_rtPrev = AV_NOPTS_VALUE;
+    }
+    for (size_t i = 0; i < m_pActivePins.size(); i++) {
+      if (mtIdx[i] >= 0)
+        m_pActivePins[i]->SendMediaType(new CMediaType(pStreams[m_pActivePins[i]->GetPinType()]->streamInfo->mtypes[mtIdx[i]]));
+    }
+  }
+
+  {
+    CAutoLock nextLock(&m_csNextSource);
+    m_fileName = fileName;
+  }
+  m_dwSourceSwitches++;
+
+  m_rtStart = m_rtNewStart = m_rtCurrent = 0;
+  m_rtStop = m_rtNewStop = m_rtDuration = m_pDemuxer->GetDuration();
+  m_rtOffset = AV_NOPTS_VALUE;
+  m_bDiscontinuitySent.clear();
+
+  m_Lookback.Clear();
+  m_pDemuxer->Start();
+  InitTrickPlay();
+
+  NotifyEvent(EC_LENGTH_CHANGED, 0, 0);
+
+  // the packets read ahead go out first
+  HRESULT hr = S_OK;
+  for (Packet *pPacket : packets) {
+    if (FAILED(hr))
+      delete pPacket;
+    else
+      hr = DeliverPacket(pPacket);
+  }
+
+  return FAILED(hr) ? hr : S_OK;
+}
+
 // IAMStreamSelect
 STDMETHODIMP CLAVSplitter::Count(DWORD *pcStreams)
 {
@@ -1688,9 +2593,9 @@ STDMETHODIMP_(BOOL) CLAVSplitter::GetFixBrokenHDPVR()
 
 STDMETHODIMP_(BOOL) CLAVSplitter::IsFormatEnabled(LPCSTR strFormat)
 {
-  std::string format(strFormat);
-  if (m_settings.formats.find(format) != m_settings.formats.end()) {
-    return m_settings.formats[format];
+  auto it = m_settings.formats->find(std::string(strFormat));
+  if (it != m_settings.formats->end()) {
+    return it->second;
   }
   return FALSE;
 }
@@ -1698,8 +2603,11 @@ STDMETHODIMP_(BOOL) CLAVSplitter::IsFormatEnabled(LPCSTR strFormat)
 STDMETHODIMP_(HRESULT) CLAVSplitter::SetFormatEnabled(LPCSTR strFormat, BOOL bEnabled)
 {
   std::string format(strFormat);
-  if (m_settings.formats.find(format) != m_settings.formats.end()) {
-    m_settings.formats[format] = bEnabled;
+  if (m_settings.formats->find(format) != m_settings.formats->end()) {
+    // other instances may share the map, so a modified copy replaces it
+    auto formats = std::make_shared<std::map<std::string, BOOL>>(*m_settings.formats);
+    (*formats)[format] = bEnabled;
+    m_settings.formats = formats;
     return SaveSettings();
   }
   return E_FAIL;
@@ -1857,7 +2765,284 @@ STDMETHODIMP_(DWORD) CLAVSplitter::GetMaxQueueSize()
   return m_settings.QueueMaxPackets;
 }
 
-STDMETHODIMP_(std::set<FormatInfo>&) CLAVSplitter::GetInputFormats()
+STDMETHODIMP CLAVSplitter::SetMemoryMappedIO(BOOL bEnabled)
+{
+  m_settings.MemoryMappedIO = bEnabled;
+  return SaveSettings();
+}
+
+STDMETHODIMP_(BOOL) CLAVSplitter::GetMemoryMappedIO()
+{
+  return m_settings.MemoryMappedIO;
+}
+
+STDMETHODIMP CLAVSplitter::SetKeyFrameIndexCache(BOOL bEnabled)
+{
+  m_settings.KeyFrameIndexCache = bEnabled;
+  return SaveSettings();
+}
+
+STDMETHODIMP_(BOOL) CLAVSplitter::GetKeyFrameIndexCache()
+{
+  return m_settings.KeyFrameIndexCache;
+}
+
+STDMETHODIMP CLAVSplitter::SetFastOpen(BOOL bEnabled)
+{
+  m_settings.FastOpen = bEnabled;
+  return SaveSettings();
+}
+
+STDMETHODIMP_(BOOL) CLAVSplitter::GetFastOpen()
+{
+  return m_settings.FastOpen;
+}
+
+STDMETHODIMP CLAVSplitter::SetLowLatencyLiveMode(BOOL bEnabled)
+{
+  m_settings.LowLatencyLive = bEnabled;
+  return SaveSettings();
+}
+
+STDMETHODIMP_(BOOL) CLAVSplitter::GetLowLatencyLiveMode()
+{
+  return m_settings.LowLatencyLive;
+}
+
+STDMETHODIMP CLAVSplitter::SetNetworkJitterBuffer(BOOL bEnabled)
+{
+  m_settings.NetworkJitterBuffer = bEnabled;
+  return SaveSettings();
+}
+
+STDMETHODIMP_(BOOL) CLAVSplitter::GetNetworkJitterBuffer()
+{
+  return m_settings.NetworkJitterBuffer;
+}
+
+STDMETHODIMP CLAVSplitter::SetHTTPPrefetch(BOOL bEnabled)
+{
+  m_settings.HTTPPrefetch = bEnabled;
+  return SaveSettings();
+}
+
+STDMETHODIMP_(BOOL) CLAVSplitter::GetHTTPPrefetch()
+{
+  return m_settings.HTTPPrefetch;
+}
+
+STDMETHODIMP CLAVSplitter::SetMaxQueueDuration(DWORD dwDuration)
+{
+  m_settings.QueueMaxDuration = dwDuration;
+  for(auto it = m_pPins.begin(); it != m_pPins.end(); it++) {
+    (*it)->SetQueueSizes();
+  }
+  return SaveSettings();
+}
+
+STDMETHODIMP_(DWORD) CLAVSplitter::GetMaxQueueDuration()
+{
+  return m_settings.QueueMaxDuration;
+}
+
+STDMETHODIMP CLAVSplitter::SetStreamingThreadPriority(BOOL bEnabled)
+{
+  m_settings.StreamingThreadPriority = bEnabled;
+  return SaveSettings();
+}
+
+STDMETHODIMP_(BOOL) CLAVSplitter::GetStreamingThreadPriority()
+{
+  return m_settings.StreamingThreadPriority;
+}
+
+STDMETHODIMP CLAVSplitter::SetNUMANode(DWORD dwNode)
+{
+  m_settings.NUMANode = dwNode;
+  return SaveSettings();
+}
+
+STDMETHODIMP_(DWORD) CLAVSplitter::GetNUMANode()
+{
+  return m_settings.NUMANode;
+}
+
+STDMETHODIMP CLAVSplitter::SetAudioPacketCoalescing(DWORD dwDuration)
+{
+  m_settings.AudioPacketCoalescing = dwDuration;
+  for(auto it = m_pPins.begin(); it != m_pPins.end(); it++) {
+    (*it)->SetQueueSizes();
+  }
+  return SaveSettings();
+}
+
+STDMETHODIMP_(DWORD) CLAVSplitter::GetAudioPacketCoalescing()
+{
+  return m_settings.AudioPacketCoalescing;
+}
+
+STDMETHODIMP CLAVSplitter::SetSharedBlockCacheSize(DWORD dwSize)
+{
+  m_settings.SharedBlockCacheSize = dwSize;
+  return SaveSettings();
+}
+
+STDMETHODIMP_(DWORD) CLAVSplitter::GetSharedBlockCacheSize()
+{
+  return m_settings.SharedBlockCacheSize;
+}
+
+STDMETHODIMP CLAVSplitter::SetPreBufferSize(DWORD dwSize)
+{
+  m_settings.PreBufferSize = dwSize;
+  return SaveSettings();
+}
+
+STDMETHODIMP_(DWORD) CLAVSplitter::GetPreBufferSize()
+{
+  return m_settings.PreBufferSize;
+}
+
+STDMETHODIMP CLAVSplitter::SetLookbackDuration(DWORD dwDuration)
+{
+  m_settings.LookbackDuration = dwDuration;
+  return SaveSettings();
+}
+
+STDMETHODIMP_(DWORD) CLAVSplitter::GetLookbackDuration()
+{
+  return m_settings.LookbackDuration;
+}
+
+STDMETHODIMP CLAVSplitter::SetLowFootprint(BOOL bEnabled)
+{
+  m_settings.LowFootprint = bEnabled;
+  for(auto it = m_pPins.begin(); it != m_pPins.end(); it++) {
+    (*it)->SetQueueSizes();
+  }
+  return SaveSettings();
+}
+
+STDMETHODIMP_(BOOL) CLAVSplitter::GetLowFootprint()
+{
+  return m_settings.LowFootprint;
+}
+
+STDMETHODIMP CLAVSplitter::GetMemoryBudget(ULONGLONG *pBudget)
+{
+  CheckPointer(pBudget, E_POINTER);
+
+  CAutoLock cAutoLock(this);
+  if (!m_pDemuxer)
+    return E_UNEXPECTED;
+
+  // every pin can fill its queue up to the memory limit
+  ULONGLONG budget = (ULONGLONG)max(GetActivePinCount(), (size_t)1) * GetQueueMemLimit() << 20;
+  budget += (ULONGLONG)GetSharedBlockCacheLimit() << 20;
+  budget += (ULONGLONG)GetPreBufferLimit() << 20;
+  if (!m_settings.LowFootprint && m_settings.LookbackDuration)
+    budget += LOOKBACK_MAX_MEMORY;
+
+  // prefetched segments of adaptive streams
+  const char *format = m_pDemuxer->GetContainerFormat();
+  if (!m_settings.LowFootprint && m_settings.SegmentPrefetch && format && (strcmp(format, "hls") == 0 || strcmp(format, "dash") == 0))
+    budget += SEGMENT_PREFETCH_MAX_MEMORY;
+
+  // images read ahead of image sequences
+  if (!m_settings.LowFootprint && m_settings.ImageSequenceFrameRate && format && strcmp(format, "image2") == 0)
+    budget += IMAGE_PREFETCH_MAX_MEMORY;
+
+  // receive buffer of datagram sources
+  LAVFNetworkStatistics network;
+  if (m_pDemuxer->GetNetworkStatistics(&network) == S_OK)
+    budget += network.ullRingSize;
+
+  *pBudget = budget;
+  return S_OK;
+}
+
+STDMETHODIMP CLAVSplitter::SetSegmentPrefetch(DWORD dwSegments)
+{
+  m_settings.SegmentPrefetch = dwSegments;
+  return SaveSettings();
+}
+
+STDMETHODIMP_(DWORD) CLAVSplitter::GetSegmentPrefetch()
+{
+  return m_settings.SegmentPrefetch;
+}
+
+STDMETHODIMP CLAVSplitter::SetNetworkReceiveBuffer(DWORD dwSize)
+{
+  m_settings.NetworkReceiveBuffer = dwSize;
+  return SaveSettings();
+}
+
+STDMETHODIMP_(DWORD) CLAVSplitter::GetNetworkReceiveBuffer()
+{
+  return m_settings.NetworkReceiveBuffer;
+}
+
+STDMETHODIMP CLAVSplitter::SetImageSequenceFrameRate(DWORD dwFrameRate)
+{
+  m_settings.ImageSequenceFrameRate = dwFrameRate;
+  return SaveSettings();
+}
+
+STDMETHODIMP_(DWORD) CLAVSplitter::GetImageSequenceFrameRate()
+{
+  return m_settings.ImageSequenceFrameRate;
+}
+
+STDMETHODIMP_(DWORD) CLAVSplitter::GetSharedBlockCacheLimit()
+{
+  if (m_settings.LowFootprint)
+    return min(m_settings.SharedBlockCacheSize, (DWORD)LOW_FOOTPRINT_BLOCK_CACHE);
+  return m_settings.SharedBlockCacheSize;
+}
+
+STDMETHODIMP_(DWORD) CLAVSplitter::GetPreBufferLimit()
+{
+  if (m_settings.LowFootprint)
+    return min(m_settings.PreBufferSize, (DWORD)LOW_FOOTPRINT_PRE_BUFFER);
+  return m_settings.PreBufferSize;
+}
+
+STDMETHODIMP_(DWORD) CLAVSplitter::GetNetworkReceiveBufferLimit()
+{
+  if (m_settings.LowFootprint)
+    return min(m_settings.NetworkReceiveBuffer, (DWORD)LOW_FOOTPRINT_RECEIVE_BUFFER);
+  return m_settings.NetworkReceiveBuffer;
+}
+
+// 0 means the default memory limit of the queues
+DWORD CLAVSplitter::GetQueueMemLimit() const
+{
+  DWORD dwMaxMem = m_settings.QueueMaxMemSize ? m_settings.QueueMaxMemSize : 256;
+  if (m_settings.LowFootprint)
+    dwMaxMem = min(dwMaxMem, (DWORD)LOW_FOOTPRINT_QUEUE_MEM);
+  return dwMaxMem;
+}
+
+DWORD CLAVSplitter::GetQueuePacketLimit() const
+{
+  if (m_settings.LowFootprint)
+    return min(m_settings.QueueMaxPackets, (DWORD)LOW_FOOTPRINT_QUEUE_PACKETS);
+  return m_settings.QueueMaxPackets;
+}
+
+int CLAVSplitter::GetNUMAPlacement()
+{
+  CAutoLock lock(&m_csNUMAPlacement);
+  if (m_settings.NUMANode != m_dwNUMAPlacementSetting) {
+    m_dwNUMAPlacementSetting = m_settings.NUMANode;
+    m_nNUMAPlacement = numa_select_node(m_dwNUMAPlacementSetting);
+    DbgLog((LOG_TRACE, 10, L"CLAVSplitter::GetNUMAPlacement(): Streaming threads placed on node %d", m_nNUMAPlacement));
+  }
+  return m_nNUMAPlacement;
+}
+
+STDMETHODIMP_(const std::set<FormatInfo>&) CLAVSplitter::GetInputFormats()
 {
   return m_InputFormats;
 }
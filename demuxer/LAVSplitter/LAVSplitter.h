@@ -27,6 +27,7 @@
 #include <set>
 #include <vector>
 #include <map>
+#include <memory>
 #include "PacketQueue.h"
 
 #include "BaseDemuxer.h"
@@ -38,6 +39,10 @@
 #include "ISpecifyPropertyPages2.h"
 
 #include "LAVSplitterTrayIcon.h"
+#include "NumaPlacement.h"
+#include "SharedLock.h"
+#include "LookbackBuffer.h"
+#include "MemoryAccount.h"
 
 #define LAVF_REGISTRY_KEY L"Software\\LAV\\Splitter"
 #define LAVF_REGISTRY_KEY_FORMATS LAVF_REGISTRY_KEY L"\\Formats"
@@ -45,8 +50,31 @@
 
 #define MAX_PTS_SHIFT 50000000i64
 
+// From this rate on, only the keyframes of the video stream are delivered
+#define TRICKPLAY_MIN_RATE        4.0
+// Number of keyframes shown per second of playback in trick-play
+#define TRICKPLAY_FRAMES_PER_SEC  8
+// Shorter distances to the next keyframe are read through instead of seeking
+#define TRICKPLAY_MIN_SEEK        (2 * DSHOW_TIME_BASE)
+
+// Time to wait for the demuxing thread to take an in-place stream switch, before the graph is rebuilt instead
+#define STREAM_SWITCH_TIMEOUT     500
+
+// Limits of the low footprint profile, memory sizes in MB
+#define LOW_FOOTPRINT_QUEUE_MEM     32
+#define LOW_FOOTPRINT_QUEUE_PACKETS 100
+#define LOW_FOOTPRINT_BLOCK_CACHE   16
+#define LOW_FOOTPRINT_PRE_BUFFER    16
+#define LOW_FOOTPRINT_RECEIVE_BUFFER 4
+
+// Number of samples of the packet source that can be held at once
+#define PACKET_SOURCE_SAMPLES       16
+
 class CLAVOutputPin;
+class CPacketAllocator;
 class CLAVInputPin;
+class CJitterBuffer;
+class CNextSource;
 
 #ifdef	_MSC_VER
 #pragma warning(disable: 4355)
@@ -64,6 +92,11 @@ class __declspec(uuid("171252A0-8820-4AFE-9DF8-5C92B2D66B04")) CLAVSplitter
   , public ISpecifyPropertyPages2
   , public IObjectWithSite
   , public IBufferInfo
+  , public ILAVFStatistics
+  , public ILAVFSourceQueue
+  , public ILAVFPacketCapture
+  , public ILAVFPacketSource
+  , public ILAVMemoryInfo
 {
 public:
   CLAVSplitter(LPUNKNOWN pUnk, HRESULT* phr);
@@ -129,6 +162,33 @@ public:
   STDMETHODIMP GetStatus(int i, int& samples, int& size);
   STDMETHODIMP_(DWORD) GetPriority();
 
+  // ILAVFStatistics
+  STDMETHODIMP_(int) GetPinStatisticsCount() { return GetCount(); }
+  STDMETHODIMP GetPinStatistics(int iPin, LAVFPinStatistics *pStats);
+  STDMETHODIMP GetReadStatistics(LAVFReadStatistics *pStats);
+  STDMETHODIMP ResetStatistics();
+  STDMETHODIMP GetDemuxStatistics(LAVFDemuxStatistics *pStats);
+  STDMETHODIMP GetNetworkStatistics(LAVFNetworkStatistics *pStats);
+
+  // ILAVFSourceQueue
+  STDMETHODIMP QueueNextSource(LPCOLESTR pszFileName);
+  STDMETHODIMP ClearNextSource();
+  STDMETHODIMP GetNextSourceState();
+  STDMETHODIMP_(DWORD) GetSourceSwitchCount() { return m_dwSourceSwitches; }
+
+  // ILAVFPacketCapture
+  STDMETHODIMP StartPacketCapture(LPCWSTR pszPathPrefix);
+  STDMETHODIMP StopPacketCapture();
+
+  // ILAVFPacketSource
+  STDMETHODIMP GetPacketSourceMediaType(AM_MEDIA_TYPE **ppmt);
+  STDMETHODIMP ReadSourcePacket(IMediaSample **ppSample);
+
+  // ILAVMemoryInfo
+  STDMETHODIMP GetMemoryUsage(LAVMemoryCategory category, LAVMemoryUsage *pUsage) { return m_pMemoryAccount->GetUsage(category, pUsage); }
+  STDMETHODIMP GetProcessMemoryUsage(LAVMemoryCategory category, LAVMemoryUsage *pUsage) { return CMemoryAccount::GetProcessUsage(category, pUsage); }
+  STDMETHODIMP ResetPeakMemoryUsage() { m_pMemoryAccount->ResetPeak(); return S_OK; }
+
   // ILAVFSettings
   STDMETHODIMP SetRuntimeConfig(BOOL bRuntimeConfig);
   STDMETHODIMP GetPreferredLanguages(LPWSTR *ppLanguages);
@@ -172,13 +232,51 @@ public:
   STDMETHODIMP_(DWORD) GetNetworkStreamAnalysisDuration();
   STDMETHODIMP SetMaxQueueSize(DWORD dwMaxSize);
   STDMETHODIMP_(DWORD) GetMaxQueueSize();
+  STDMETHODIMP SetMemoryMappedIO(BOOL bEnabled);
+  STDMETHODIMP_(BOOL) GetMemoryMappedIO();
+  STDMETHODIMP SetKeyFrameIndexCache(BOOL bEnabled);
+  STDMETHODIMP_(BOOL) GetKeyFrameIndexCache();
+  STDMETHODIMP SetFastOpen(BOOL bEnabled);
+  STDMETHODIMP_(BOOL) GetFastOpen();
+  STDMETHODIMP SetLowLatencyLiveMode(BOOL bEnabled);
+  STDMETHODIMP_(BOOL) GetLowLatencyLiveMode();
+  STDMETHODIMP SetNetworkJitterBuffer(BOOL bEnabled);
+  STDMETHODIMP_(BOOL) GetNetworkJitterBuffer();
+  STDMETHODIMP SetHTTPPrefetch(BOOL bEnabled);
+  STDMETHODIMP_(BOOL) GetHTTPPrefetch();
+  STDMETHODIMP SetMaxQueueDuration(DWORD dwDuration);
+  STDMETHODIMP_(DWORD) GetMaxQueueDuration();
+  STDMETHODIMP SetStreamingThreadPriority(BOOL bEnabled);
+  STDMETHODIMP_(BOOL) GetStreamingThreadPriority();
+  STDMETHODIMP SetNUMANode(DWORD dwNode);
+  STDMETHODIMP_(DWORD) GetNUMANode();
+  STDMETHODIMP SetAudioPacketCoalescing(DWORD dwDuration);
+  STDMETHODIMP_(DWORD) GetAudioPacketCoalescing();
+  STDMETHODIMP SetSharedBlockCacheSize(DWORD dwSize);
+  STDMETHODIMP_(DWORD) GetSharedBlockCacheSize();
+  STDMETHODIMP SetPreBufferSize(DWORD dwSize);
+  STDMETHODIMP_(DWORD) GetPreBufferSize();
+  STDMETHODIMP SetLookbackDuration(DWORD dwDuration);
+  STDMETHODIMP_(DWORD) GetLookbackDuration();
+  STDMETHODIMP SetLowFootprint(BOOL bEnabled);
+  STDMETHODIMP_(BOOL) GetLowFootprint();
+  STDMETHODIMP GetMemoryBudget(ULONGLONG *pBudget);
+  STDMETHODIMP SetSegmentPrefetch(DWORD dwSegments);
+  STDMETHODIMP_(DWORD) GetSegmentPrefetch();
+  STDMETHODIMP SetNetworkReceiveBuffer(DWORD dwSize);
+  STDMETHODIMP_(DWORD) GetNetworkReceiveBuffer();
+  STDMETHODIMP SetImageSequenceFrameRate(DWORD dwFrameRate);
+  STDMETHODIMP_(DWORD) GetImageSequenceFrameRate();
 
   // ILAVSplitterSettingsInternal
   STDMETHODIMP_(LPCSTR) GetInputFormat() { if (m_pDemuxer) return m_pDemuxer->GetContainerFormat(); return nullptr; }
-  STDMETHODIMP_(std::set<FormatInfo>&) GetInputFormats();
+  STDMETHODIMP_(const std::set<FormatInfo>&) GetInputFormats();
   STDMETHODIMP_(BOOL) IsVC1CorrectionRequired();
   STDMETHODIMP_(CMediaType *) GetOutputMediatype(int stream);
   STDMETHODIMP_(IFilterGraph *) GetFilterGraph() { if (m_pGraph) { m_pGraph->AddRef(); return m_pGraph; } return nullptr; }
+  STDMETHODIMP_(DWORD) GetSharedBlockCacheLimit();
+  STDMETHODIMP_(DWORD) GetPreBufferLimit();
+  STDMETHODIMP_(DWORD) GetNetworkReceiveBufferLimit();
 
   STDMETHODIMP_(DWORD) GetStreamFlags(DWORD dwStream) { if (m_pDemuxer) return m_pDemuxer->GetStreamFlags(dwStream); return 0; }
   STDMETHODIMP_(int) GetPixelFormat(DWORD dwStream) { if (m_pDemuxer) return m_pDemuxer->GetPixelFormat(dwStream); return AV_PIX_FMT_NONE; }
@@ -190,15 +288,42 @@ public:
   std::list<CSubtitleSelector> GetSubtitleSelectors();
 
   bool IsAnyPinDrying();
+  // Is any pin short of its queue target, and only buffered up to an earlier time, only to be called from the demuxing thread
+  bool IsAnyPinBehind(REFERENCE_TIME rtBufferedUntil);
+  // Total size of the packets queued on all active pins, only to be called from the demuxing thread
+  size_t GetQueueDataSize();
+  size_t GetActivePinCount() const { return m_pActivePins.size(); }
+  // Queue limits in effect, with the limits of the low footprint profile applied
+  DWORD GetQueueMemLimit() const;
+  DWORD GetQueuePacketLimit() const;
+  bool IsLiveStream() { return m_pDemuxer && (m_pDemuxer->GetContainerFlags() & LAVFMT_LIVE); }
   void SetFakeASFReader(BOOL bFlag) { m_bFakeASFReader = bFlag; }
+  // NUMA node of the streaming threads, or -1 if they are not placed
+  int GetNUMAPlacement();
+  // Path prefix of the sample capture files, empty if not capturing
+  const std::wstring& GetCapturePrefix() const { return m_strCapturePrefix; }
+  // Memory account of the queues and samples of all pins
+  CMemoryAccount *GetMemoryAccount() const { return m_pMemoryAccount; }
 protected:
   // CAMThread
   enum {CMD_EXIT, CMD_SEEK};
   DWORD ThreadProc();
 
   HRESULT DemuxSeek(REFERENCE_TIME rtStart);
+  BOOL LookbackSeek(REFERENCE_TIME rtStart);
   HRESULT DemuxNextPacket();
   HRESULT DeliverPacket(Packet *pPacket);
+  void UpdateDuration();
+  HRESULT SwitchToNextSource();
+  HRESULT SwitchStreamInPlace(CLAVOutputPin *pPin, DWORD dwStreamId, const std::deque<CMediaType> &pmts);
+  void DemuxStreamSwitch();
+  BOOL FilterStreamSwitchPacket(CLAVOutputPin *pPin, const Packet *pPacket);
+
+  BOOL GetKeyFrames(std::vector<REFERENCE_TIME> &keyFrames);
+
+  void InitTrickPlay();
+  BOOL FilterTrickPlayPacket(CLAVOutputPin *pPin, const Packet *pPacket);
+  void TrickPlaySeek();
 
   void DeliverBeginFlush();
   void DeliverEndFlush();
@@ -231,7 +356,8 @@ protected:
   CLAVInputPin *m_pInput;
 
 private:
-  CCritSec m_csPins;
+  // looked up for every packet, only modified while the filter is stopped
+  CSharedLock m_csPins;
   std::vector<CLAVOutputPin *> m_pPins;
   std::vector<CLAVOutputPin *> m_pActivePins;
   std::vector<CLAVOutputPin *> m_pRetiredPins;
@@ -241,6 +367,31 @@ private:
   std::wstring m_processName;
 
   CBaseDemuxer *m_pDemuxer = nullptr;
+  CJitterBuffer *m_pJitterBuffer = nullptr;
+  // only accessed by the demuxing thread, while it runs
+  CLookbackBuffer m_Lookback;
+
+  // Gapless playback, the file name is also protected by the lock, since the demuxing thread changes it
+  CCritSec m_csNextSource;
+  CCritSec m_csNextDemuxer;
+  CNextSource *m_pNextSource = nullptr;
+  // the demuxer of the previous file stays alive, in case another thread is still using it
+  CBaseDemuxer *m_pPrevDemuxer = nullptr;
+  DWORD m_dwSourceSwitches = 0;
+
+  // only changed while the filter is stopped
+  std::wstring m_strCapturePrefix;
+
+  // samples of the packet source, created on the first read
+  CPacketAllocator *m_pSourceAllocator = nullptr;
+
+  // the samples hold their own reference, they can be released after the filter
+  CMemoryAccount *m_pMemoryAccount = new CMemoryAccount();
+
+  // the node is selected once, and only selected again if the setting changes
+  CCritSec m_csNUMAPlacement;
+  DWORD m_dwNUMAPlacementSetting = NUMA_NODE_OFF;
+  int m_nNUMAPlacement = -1;
 
   BOOL m_bPlaybackStarted = FALSE;
   BOOL m_bFakeASFReader   = FALSE;
@@ -251,10 +402,45 @@ private:
   REFERENCE_TIME m_rtCurrent  = 0;
   REFERENCE_TIME m_rtNewStart = 0;
   REFERENCE_TIME m_rtNewStop  = 0;
+  REFERENCE_TIME m_rtDuration = 0;
   REFERENCE_TIME m_rtOffset   = AV_NOPTS_VALUE;
+  // stream time at which the current file started, after switching to a queued next file in place
+  REFERENCE_TIME m_rtSourceOffset = 0;
   double m_dRate              = 1.0;
   BOOL m_bStopValid           = FALSE;
 
+  // segment the active pins were started with
+  REFERENCE_TIME m_rtSegmentStart = 0;
+  REFERENCE_TIME m_rtSegmentStop  = 0;
+
+  // In-place stream switching, the request is handed to the demuxing thread
+  struct StreamSwitch {
+    CLAVOutputPin *pPin;
+    DWORD dwStreamId;
+    CMediaType mt;
+    std::deque<CMediaType> pmts;
+    CRefTime rtStreamTime;
+    HRESULT hr;
+  };
+  CCritSec m_csStreamSwitch;
+  StreamSwitch *m_pStreamSwitch = nullptr;
+  BOOL m_bStreamSwitchReady     = FALSE;
+  CAMEvent m_evStreamSwitched;
+
+  // After a switch, the file is read again from the playback position. Packets up to the previous read position
+  // are already queued on the other pins, and only the switched pin is refilled with them.
+  LONGLONG m_llLastPacketPos             = -1;
+  LONGLONG m_llSwitchSkipPos             = -1;
+  REFERENCE_TIME m_rtSwitchSkipTime      = 0;
+  CLAVOutputPin *m_pSwitchPin            = nullptr;
+  REFERENCE_TIME m_rtSwitchStart         = Packet::INVALID_TIME;
+
+  // Trick-play
+  BOOL m_bTrickPlay                = FALSE;
+  BOOL m_bTrickPlaySeek            = FALSE;
+  REFERENCE_TIME m_rtTrickPlayNext = 0;
+  std::vector<REFERENCE_TIME> m_TrickPlayKeyFrames;
+
   // Seeking
   REFERENCE_TIME m_rtLastStart = _I64_MIN;
   REFERENCE_TIME m_rtLastStop  = _I64_MIN;
@@ -266,7 +452,14 @@ private:
   bool m_fFlushing      = FALSE;
   CAMEvent m_eEndFlush;
 
-  std::set<FormatInfo> m_InputFormats;
+  // signaled when packets are removed from any output queue
+  CAMEvent m_eQueueSpace;
+
+  const std::set<FormatInfo> &m_InputFormats;
+
+  // written by the demuxing thread
+  CCritSec m_csDemuxStats;
+  LAVFDemuxStatistics m_DemuxStats = { 0 };
 
   // Settings
   struct Settings {
@@ -287,9 +480,27 @@ private:
     BOOL PreferHighQualityAudio;
     DWORD QueueMaxPackets;
     DWORD QueueMaxMemSize;
+    DWORD QueueMaxDuration;
     DWORD NetworkAnalysisDuration;
-
-    std::map<std::string, BOOL> formats;
+    BOOL MemoryMappedIO;
+    BOOL KeyFrameIndexCache;
+    BOOL FastOpen;
+    BOOL LowLatencyLive;
+    BOOL NetworkJitterBuffer;
+    BOOL HTTPPrefetch;
+    BOOL StreamingThreadPriority;
+    DWORD NUMANode;
+    DWORD AudioPacketCoalescing;
+    DWORD SharedBlockCacheSize;
+    DWORD PreBufferSize;
+    DWORD LookbackDuration;
+    BOOL LowFootprint;
+    DWORD SegmentPrefetch;
+    DWORD NetworkReceiveBuffer;
+    DWORD ImageSequenceFrameRate;
+
+    // shared between all instances with the same settings, replaced instead of modified
+    std::shared_ptr<const std::map<std::string, BOOL>> formats;
   } m_settings;
 
   BOOL m_bRuntimeConfig = FALSE;
@@ -0,0 +1,109 @@
+/*
+ *      Copyright (C) 2010-2019 Hendrik Leppkes
+ *      http://www.1f0.de
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program; if not, write to the Free Software Foundation, Inc.,
+ *  51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+
+#include "stdafx.h"
+#include "LookbackBuffer.h"
+
+CLookbackBuffer::CLookbackBuffer()
+{
+}
+
+CLookbackBuffer::~CLookbackBuffer()
+{
+  Clear();
+}
+
+void CLookbackBuffer::SetDuration(REFERENCE_TIME rtDuration)
+{
+  m_rtDuration = rtDuration;
+  if (m_rtDuration <= 0)
+    Clear();
+}
+
+// Packets are modified in place on their way downstream, the copies get their own data
+Packet *CLookbackBuffer::CopyPacket(const Packet *pPacket)
+{
+  Packet *pCopy = new Packet();
+  pCopy->CopyProperties(pPacket);
+  if (pPacket->GetAVPacket() && (pCopy->SetPacket(const_cast<AVPacket *>(pPacket->GetAVPacket())) < 0 || pCopy->MakeWritable() < 0)) {
+    delete pCopy;
+    return nullptr;
+  }
+  return pCopy;
+}
+
+void CLookbackBuffer::Store(const Packet *pPacket)
+{
+  // nothing is stored while replaying, those packets are in the buffer already
+  if (m_rtDuration <= 0 || IsReplaying())
+    return;
+
+  Packet *pCopy = CopyPacket(pPacket);
+  if (!pCopy)
+    return;
+
+  if (pPacket->rtStart != Packet::INVALID_TIME)
+    m_rtLast = (m_rtLast == Packet::INVALID_TIME) ? pPacket->rtStart : max(m_rtLast, pPacket->rtStart);
+
+  m_Packets.push_back({ pCopy, m_rtLast });
+  m_nSize += pCopy->GetDataSize();
+
+  while (!m_Packets.empty() && (m_nSize > LOOKBACK_MAX_MEMORY || (m_Packets.front().rtTime != Packet::INVALID_TIME && m_Packets.front().rtTime < m_rtLast - m_rtDuration))) {
+    m_nSize -= m_Packets.front().pPacket->GetDataSize();
+    delete m_Packets.front().pPacket;
+    m_Packets.pop_front();
+  }
+  m_nReplay = m_Packets.size();
+}
+
+BOOL CLookbackBuffer::Seek(REFERENCE_TIME rtSeek, DWORD dwStreamId)
+{
+  if (m_Packets.empty() || m_rtLast == Packet::INVALID_TIME || rtSeek > m_rtLast)
+    return FALSE;
+
+  for (size_t i = m_Packets.size(); i-- > 0;) {
+    const Packet *pPacket = m_Packets[i].pPacket;
+    if (pPacket->StreamId == dwStreamId && pPacket->bSyncPoint && pPacket->rtStart != Packet::INVALID_TIME && pPacket->rtStart <= rtSeek) {
+      DbgLog((LOG_TRACE, 10, L"CLookbackBuffer::Seek(): Replaying %u packets from %I64d for a seek to %I64d", (unsigned)(m_Packets.size() - i), pPacket->rtStart, rtSeek));
+      m_nReplay = i;
+      return TRUE;
+    }
+  }
+
+  return FALSE;
+}
+
+Packet *CLookbackBuffer::GetReplayPacket()
+{
+  if (!IsReplaying())
+    return nullptr;
+
+  return CopyPacket(m_Packets[m_nReplay++].pPacket);
+}
+
+void CLookbackBuffer::Clear()
+{
+  for (Entry &entry : m_Packets)
+    delete entry.pPacket;
+  m_Packets.clear();
+  m_nSize = 0;
+  m_nReplay = 0;
+  m_rtLast = Packet::INVALID_TIME;
+}
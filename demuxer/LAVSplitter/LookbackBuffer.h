@@ -0,0 +1,70 @@
+/*
+ *      Copyright (C) 2010-2019 Hendrik Leppkes
+ *      http://www.1f0.de
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program; if not, write to the Free Software Foundation, Inc.,
+ *  51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+
+#pragma once
+
+#include <deque>
+#include "Packet.h"
+
+// Upper limit of the memory held by the lookback buffer
+#define LOOKBACK_MAX_MEMORY (256 << 20)
+
+// Lookback buffer of the packets read most recently
+// Copies of the packets are kept in demuxing order, for a duration before the read position of the demuxer.
+// A seek into this window replays the packets from the last keyframe of the seek stream before the target,
+// and once the replay caught up, the demuxer continues reading where it stopped, without seeking the file.
+class CLookbackBuffer
+{
+public:
+  CLookbackBuffer();
+  ~CLookbackBuffer();
+
+  // Set the duration to keep, 0 disables the buffer
+  void SetDuration(REFERENCE_TIME rtDuration);
+
+  // Keep a copy of a packet coming from the demuxer, which still has its file timestamps
+  void Store(const Packet *pPacket);
+
+  // Start replaying from the last keyframe of the stream at or before rtSeek
+  // Returns FALSE if the window does not cover the time
+  BOOL Seek(REFERENCE_TIME rtSeek, DWORD dwStreamId);
+
+  // Get a copy of the next packet to replay
+  Packet *GetReplayPacket();
+
+  BOOL IsReplaying() const { return m_nReplay < m_Packets.size(); }
+
+  void Clear();
+
+private:
+  static Packet *CopyPacket(const Packet *pPacket);
+
+private:
+  struct Entry {
+    Packet *pPacket;
+    REFERENCE_TIME rtTime;    ///< time of the packet, or of the last packet before it with a time
+  };
+
+  REFERENCE_TIME m_rtDuration = 0;
+  std::deque<Entry> m_Packets;
+  size_t m_nSize = 0;
+  size_t m_nReplay = 0;
+  REFERENCE_TIME m_rtLast = Packet::INVALID_TIME;
+};
@@ -0,0 +1,165 @@
+/*
+ *      Copyright (C) 2010-2019 Hendrik Leppkes
+ *      http://www.1f0.de
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program; if not, write to the Free Software Foundation, Inc.,
+ *  51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+
+#include "stdafx.h"
+#include "NextSource.h"
+
+#include "LAVFDemuxer.h"
+
+CNextSource::CNextSource(CCritSec *pLock, ILAVFSettingsInternal *pSettings)
+  : m_pLock(pLock), m_pSettings(pSettings)
+{
+}
+
+CNextSource::~CNextSource()
+{
+  Close();
+}
+
+HRESULT CNextSource::Open(LPCOLESTR pszFileName, const std::list<std::string> &audioLanguages, const std::list<CSubtitleSelector> &subtitleSelectors, const std::set<CBaseDemuxer::StreamType> &pinTypes)
+{
+  CheckPointer(pszFileName, E_POINTER);
+
+  Close();
+
+  m_fileName = pszFileName;
+  m_AudioLanguages = audioLanguages;
+  m_SubtitleSelectors = subtitleSelectors;
+  m_PinTypes = pinTypes;
+
+  {
+    CAutoLock lock(&m_csState);
+    m_pDemuxer = new CLAVFDemuxer(m_pLock, m_pSettings);
+    m_pDemuxer->AddRef();
+    m_hrState = S_FALSE;
+  }
+  m_bAbort = FALSE;
+
+  if (!Create()) {
+    Close();
+    return E_FAIL;
+  }
+
+  DbgLog((LOG_TRACE, 10, L"CNextSource::Open(): Opening '%s' in the background", pszFileName));
+  return S_OK;
+}
+
+void CNextSource::Close()
+{
+  if (ThreadExists()) {
+    m_bAbort = TRUE;
+    {
+      CAutoLock lock(&m_csState);
+      if (m_pDemuxer)
+        m_pDemuxer->AbortOpening(1);
+    }
+    CAMThread::Close();
+  }
+
+  CAutoLock lock(&m_csState);
+  for (Packet *pPacket : m_Packets)
+    delete pPacket;
+  m_Packets.clear();
+  for (int i = 0; i < CBaseDemuxer::unknown; i++)
+    m_pStreams[i] = nullptr;
+  SafeRelease(&m_pDemuxer);
+  m_hrState = VFW_E_NOT_FOUND;
+  m_fileName.clear();
+}
+
+HRESULT CNextSource::GetState()
+{
+  CAutoLock lock(&m_csState);
+  return m_hrState;
+}
+
+HRESULT CNextSource::Detach(CBaseDemuxer **ppDemuxer, const CBaseDemuxer::stream *pStreams[CBaseDemuxer::unknown], std::deque<Packet *> &packets)
+{
+  CheckPointer(ppDemuxer, E_POINTER);
+
+  CAutoLock lock(&m_csState);
+  if (m_hrState != S_OK)
+    return E_UNEXPECTED;
+
+  // the thread already finished, only its handle is left
+  CAMThread::Close();
+
+  *ppDemuxer = m_pDemuxer;
+  m_pDemuxer = nullptr;
+  for (int i = 0; i < CBaseDemuxer::unknown; i++) {
+    pStreams[i] = m_pStreams[i];
+    m_pStreams[i] = nullptr;
+  }
+  packets.swap(m_Packets);
+  m_Packets.clear();
+  m_hrState = VFW_E_NOT_FOUND;
+
+  return S_OK;
+}
+
+DWORD CNextSource::ThreadProc()
+{
+  SetThreadName(-1, "CLAVSplitter Next Source");
+
+  // the demuxer is only released by Close, after this thread ended
+  HRESULT hr = m_pDemuxer->Open(m_fileName.c_str());
+  if (SUCCEEDED(hr) && !m_bAbort) {
+    // same selection as on loading a file, the audio stream is also needed for the language of the subtitles
+    const CBaseDemuxer::stream *audioStream = m_pDemuxer->SelectAudioStream(m_AudioLanguages);
+    std::string audioLanguage = audioStream ? audioStream->language : std::string();
+
+    if (m_PinTypes.count(CBaseDemuxer::video))
+      m_pStreams[CBaseDemuxer::video] = m_pDemuxer->SelectVideoStream();
+    if (m_PinTypes.count(CBaseDemuxer::audio))
+      m_pStreams[CBaseDemuxer::audio] = audioStream;
+    if (m_PinTypes.count(CBaseDemuxer::subpic))
+      m_pStreams[CBaseDemuxer::subpic] = m_pDemuxer->SelectSubtitleStream(m_SubtitleSelectors, audioLanguage);
+
+    for (int i = 0; i < CBaseDemuxer::unknown; i++) {
+      CBaseDemuxer::StreamType type = (CBaseDemuxer::StreamType)i;
+      if (m_pStreams[i])
+        m_pDemuxer->SetActiveStream(type, m_pStreams[i]->pid);
+      m_pDemuxer->SetOutputConnected(type, m_pStreams[i] != nullptr);
+    }
+
+    ReadAhead();
+  } else if (SUCCEEDED(hr)) {
+    hr = E_ABORT;
+  }
+
+  DbgLog((LOG_TRACE, 10, L"CNextSource::ThreadProc(): Opening '%s' finished (hr: 0x%x, %u packets read ahead)", m_fileName.c_str(), hr, (unsigned)m_Packets.size()));
+
+  CAutoLock lock(&m_csState);
+  m_hrState = SUCCEEDED(hr) ? S_OK : hr;
+  return 0;
+}
+
+void CNextSource::ReadAhead()
+{
+  for (int i = 0; i < NEXT_SOURCE_PACKETS && !m_bAbort; i++) {
+    Packet *pPacket = nullptr;
+    HRESULT hr = m_pDemuxer->GetNextPacket(&pPacket);
+    if (FAILED(hr))
+      break;
+    // files shorter than the read-ahead just end early again, after the switch
+    if (hr == S_OK)
+      m_Packets.push_back(pPacket);
+  }
+}
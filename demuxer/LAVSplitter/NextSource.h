@@ -0,0 +1,80 @@
+/*
+ *      Copyright (C) 2010-2019 Hendrik Leppkes
+ *      http://www.1f0.de
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program; if not, write to the Free Software Foundation, Inc.,
+ *  51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+
+#pragma once
+
+#include <atomic>
+#include <deque>
+#include <list>
+#include <set>
+#include <string>
+#include "BaseDemuxer.h"
+
+// Number of packets read ahead from the next file, so its playback starts without waiting for the disk
+#define NEXT_SOURCE_PACKETS 64
+
+// Next file of a gapless playback sequence
+// The file is opened and probed on a background thread while the current file plays, its streams are
+// selected like on the initial load, and the first packets are read ahead. The splitter takes over the
+// demuxer once the current file ends.
+class CNextSource : protected CAMThread
+{
+public:
+  CNextSource(CCritSec *pLock, ILAVFSettingsInternal *pSettings);
+  ~CNextSource();
+
+  // Start opening the file
+  // Streams are only selected for the types in pinTypes, the types the splitter has output pins for.
+  HRESULT Open(LPCOLESTR pszFileName, const std::list<std::string> &audioLanguages, const std::list<CSubtitleSelector> &subtitleSelectors, const std::set<CBaseDemuxer::StreamType> &pinTypes);
+
+  // Abort opening, and release the file
+  void Close();
+
+  // S_OK once the file is ready, S_FALSE while it is being opened, or the error that occurred on opening it
+  HRESULT GetState();
+
+  // Take over the opened demuxer, its selected streams (indexed by stream type) and the packets read ahead
+  // The caller owns the demuxer reference and the packets afterwards.
+  HRESULT Detach(CBaseDemuxer **ppDemuxer, const CBaseDemuxer::stream *pStreams[CBaseDemuxer::unknown], std::deque<Packet *> &packets);
+
+  const std::wstring &GetFileName() const { return m_fileName; }
+
+private:
+  DWORD ThreadProc();
+
+  void ReadAhead();
+
+private:
+  CCritSec *m_pLock = nullptr;
+  ILAVFSettingsInternal *m_pSettings = nullptr;
+
+  std::wstring m_fileName;
+  std::list<std::string> m_AudioLanguages;
+  std::list<CSubtitleSelector> m_SubtitleSelectors;
+  std::set<CBaseDemuxer::StreamType> m_PinTypes;
+
+  CCritSec m_csState;
+  CBaseDemuxer *m_pDemuxer = nullptr;
+  HRESULT m_hrState = VFW_E_NOT_FOUND;
+  std::atomic<BOOL> m_bAbort = FALSE;
+
+  const CBaseDemuxer::stream *m_pStreams[CBaseDemuxer::unknown] = { nullptr };
+  std::deque<Packet *> m_Packets;
+};
@@ -27,6 +27,23 @@
 #include "moreuuids.h"
 
 #include "PacketAllocator.h"
+#include "PacketCapture.h"
+#include "ThreadPriority.h"
+#include "TraceProvider.h"
+#include "MemoryPressure.h"
+
+// {54E125D6-8613-415F-9F64-CD9CAEB34B36}
+static const GUID GUID_LAVSplitterPerfProvider = { 0x54e125d6, 0x8613, 0x415f, { 0x9f, 0x64, 0xcd, 0x9c, 0xae, 0xb3, 0x4b, 0x36 } };
+// {84B058E0-593E-45FE-AC06-55222140A4FF}
+static const GUID GUID_LAVSplitterPerfCounterSet = { 0x84b058e0, 0x593e, 0x45fe, { 0xac, 0x06, 0x55, 0x22, 0x21, 0x40, 0xa4, 0xff } };
+
+static const ULONG SplitterPerfCounterTypes[SplitterPerf_NB] = {
+  PERF_COUNTER_BULK_COUNT,      // SplitterPerf_Packets
+  PERF_COUNTER_LARGE_RAWCOUNT,  // SplitterPerf_QueuedPackets
+  PERF_COUNTER_LARGE_RAWCOUNT,  // SplitterPerf_QueueDuration
+};
+
+static CPerfCounterSet g_SplitterPerfCounters(GUID_LAVSplitterPerfProvider, GUID_LAVSplitterPerfCounterSet, SplitterPerfCounterTypes, SplitterPerf_NB);
 
 CLAVOutputPin::CLAVOutputPin(std::deque<CMediaType>& mts, LPCWSTR pName, CBaseFilter *pFilter, CCritSec *pLock, HRESULT *phr, CBaseDemuxer::StreamType pinType, const char* container)
   : CBaseOutputPin(NAME("lavf dshow output pin"), pFilter, pLock, phr, pName)
@@ -36,13 +53,18 @@ CLAVOutputPin::CLAVOutputPin(std::deque<CMediaType>& mts, LPCWSTR pName, CBaseFi
   , m_Parser(this, container)
 {
   SetQueueSizes();
+  m_queue.SetDequeueEvent(&(static_cast<CLAVSplitter*>(m_pFilter))->m_eQueueSpace);
+  m_queue.SetMemoryAccount(static_cast<CLAVSplitter*>(m_pFilter)->GetMemoryAccount());
+  m_pPerfInstance = g_SplitterPerfCounters.CreateInstance(m_PerfValues, pName);
 }
 
 CLAVOutputPin::~CLAVOutputPin()
 {
   CAMThread::CallWorker(CMD_EXIT);
   CAMThread::Close();
+  g_SplitterPerfCounters.DeleteInstance(m_pPerfInstance);
   SAFE_DELETE(m_newMT);
+  SAFE_DELETE(m_pCapture);
 }
 
 void CLAVOutputPin::SetQueueSizes()
@@ -64,12 +86,114 @@ void CLAVOutputPin::SetQueueSizes()
   }
 
   m_nQueueLow  = MIN_PACKETS_IN_QUEUE * factor;
-  m_nQueueHigh = (size_t)(static_cast<CLAVSplitter*>(m_pFilter))->GetMaxQueueSize() * factor;
+  m_nQueueHigh = (size_t)(static_cast<CLAVSplitter*>(m_pFilter))->GetQueuePacketLimit() * factor;
 
-  m_nQueueMaxMem = (size_t)(static_cast<CLAVSplitter*>(m_pFilter))->GetMaxQueueMemSize() * 1024 * 1024;
-  if (!m_nQueueMaxMem) {
-    m_nQueueMaxMem = 256 * 1024 * 1024;
+  // Live streams arrive in real-time, a deep queue only adds latency
+  // No pin is ever considered drying, so the queues never grow beyond their limit to feed another pin
+  if ((static_cast<CLAVSplitter*>(m_pFilter))->IsLiveStream()) {
+    m_nQueueLow  = 0;
+    m_nQueueHigh = LIVE_PACKETS_IN_QUEUE * factor;
   }
+
+  m_nQueueMaxMem = (size_t)(static_cast<CLAVSplitter*>(m_pFilter))->GetQueueMemLimit() * 1024 * 1024;
+
+  // Continuous streams can be queued by duration instead, which means the same for every codec
+  // The memory limit is then shared by all pins of the splitter
+  // Sparse streams like subtitles are always limited by packet count, their timestamps say nothing about the queue
+  m_rtQueueTarget = (REFERENCE_TIME)(static_cast<CLAVSplitter*>(m_pFilter))->GetMaxQueueDuration() * 10000;
+  if ((static_cast<CLAVSplitter*>(m_pFilter))->IsLiveStream() || m_pinType == CBaseDemuxer::subpic
+    || (m_mts.begin()->majortype != MEDIATYPE_Video && m_mts.begin()->majortype != MEDIATYPE_Audio)) {
+    m_rtQueueTarget = 0;
+  }
+  m_rtQueueLow = min(m_rtQueueTarget / 4, MIN_DURATION_IN_QUEUE);
+
+  // Small audio packets can be merged into fewer samples, live streams are delivered as they arrive
+  REFERENCE_TIME rtCoalesce = (REFERENCE_TIME)(static_cast<CLAVSplitter*>(m_pFilter))->GetAudioPacketCoalescing() * 10000;
+  if (!IsAudioPin() || (static_cast<CLAVSplitter*>(m_pFilter))->IsLiveStream())
+    rtCoalesce = 0;
+  m_Parser.SetCoalescing(rtCoalesce);
+}
+
+// Duration of the queued packets, from their timestamps, or from the bitrate of the stream if there are none
+REFERENCE_TIME CLAVOutputPin::GetQueueDuration()
+{
+  const REFERENCE_TIME rtIn = m_rtQueueIn, rtOut = m_rtQueueOut;
+  if (rtIn != Packet::INVALID_TIME && rtOut != Packet::INVALID_TIME)
+    return max(rtIn - rtOut, 0LL);
+
+  const DWORD dwBitRate = m_BitRate.nCurrentBitRate ? m_BitRate.nCurrentBitRate : m_BitRate.nAverageBitRate;
+  if (dwBitRate)
+    return (REFERENCE_TIME)(m_queue.DataSize() * 8 * 10000000ULL / dwBitRate);
+
+  return Packet::INVALID_TIME;
+}
+
+// The depth of the queue for the performance counters, after a packet was queued or dequeued
+void CLAVOutputPin::UpdateQueueCounters()
+{
+  const REFERENCE_TIME rtDuration = GetQueueDuration();
+  perf_counter_set(&m_PerfValues[SplitterPerf_QueuedPackets], m_queue.Size());
+  perf_counter_set(&m_PerfValues[SplitterPerf_QueueDuration], rtDuration != Packet::INVALID_TIME ? rtDuration / 10000 : 0);
+}
+
+bool CLAVOutputPin::IsQueueFull()
+{
+  CLAVSplitter *pSplitter = static_cast<CLAVSplitter*>(m_pFilter);
+
+  // While the system is low on memory, the queues are only filled to a fraction of their limits
+  // The low limits stay the same, so a pin is not considered drying any sooner.
+  size_t nQueueMaxMem = m_nQueueMaxMem, nQueueHigh = m_nQueueHigh;
+  REFERENCE_TIME rtQueueTarget = m_rtQueueTarget;
+  if (memory_pressure_low()) {
+    nQueueMaxMem /= LOW_MEMORY_QUEUE_DIVISOR;
+    nQueueHigh = max(nQueueHigh / LOW_MEMORY_QUEUE_DIVISOR, m_nQueueLow);
+    rtQueueTarget = max(rtQueueTarget / LOW_MEMORY_QUEUE_DIVISOR, m_rtQueueLow);
+  }
+
+  if (rtQueueTarget > 0) {
+    const REFERENCE_TIME rtDuration = GetQueueDuration();
+    if (rtDuration != Packet::INVALID_TIME) {
+      // The shared memory limit only stops the pins holding more than their share, a starving pin can always be fed
+      const size_t nPins = pSplitter->GetActivePinCount();
+      if (pSplitter->GetQueueDataSize() > nQueueMaxMem && m_queue.DataSize() > nQueueMaxMem / max(nPins, (size_t)1))
+        return true;
+
+      // Same soft and hard limit as with packet counts, but the soft limit is only exceeded while another pin is
+      // buffered up to an earlier time. Its packets are further ahead in the file, and can only be reached by
+      // reading past the packets of this pin, which keeps the buffered time of all pins balanced.
+      const REFERENCE_TIME rtBufferedUntil = m_rtQueueIn;
+      return m_queue.Size() > MAX_PACKETS_IN_DURATION_QUEUE
+        || rtDuration > 2 * rtQueueTarget
+        || (rtDuration > rtQueueTarget && !(rtBufferedUntil != Packet::INVALID_TIME ? pSplitter->IsAnyPinBehind(rtBufferedUntil) : pSplitter->IsAnyPinDrying()));
+    }
+  }
+
+  return m_queue.DataSize() > nQueueMaxMem
+    || m_queue.Size() > 2*nQueueHigh
+    || (m_queue.Size() > nQueueHigh && !pSplitter->IsAnyPinDrying());
+}
+
+bool CLAVOutputPin::IsQueueDrying()
+{
+  if (m_rtQueueTarget > 0) {
+    const REFERENCE_TIME rtDuration = GetQueueDuration();
+    if (rtDuration != Packet::INVALID_TIME)
+      return rtDuration < m_rtQueueLow;
+  }
+  return m_queue.Size() < m_nQueueLow;
+}
+
+bool CLAVOutputPin::IsQueueBehind(REFERENCE_TIME rtBufferedUntil)
+{
+  if (m_rtQueueTarget > 0) {
+    const REFERENCE_TIME rtIn = m_rtQueueIn;
+    const REFERENCE_TIME rtDuration = GetQueueDuration();
+    if (rtIn != Packet::INVALID_TIME && rtDuration != Packet::INVALID_TIME)
+      return rtDuration < m_rtQueueTarget && rtIn < rtBufferedUntil;
+  }
+
+  // without timestamps, only a drying queue is behind
+  return IsQueueDrying();
 }
 
 HRESULT CLAVOutputPin::GetQueueSize(int& samples, int& size)
@@ -80,6 +204,23 @@ HRESULT CLAVOutputPin::GetQueueSize(int& samples, int& size)
   return S_OK;
 }
 
+HRESULT CLAVOutputPin::GetStatistics(LAVFPinStatistics *pStats)
+{
+  CheckPointer(pStats, E_POINTER);
+  CAutoLock lock(&m_csStats);
+  *pStats = m_Stats;
+  return S_OK;
+}
+
+void CLAVOutputPin::ResetStatistics()
+{
+  CAutoLock lock(&m_csStats);
+  memset(&m_Stats, 0, sizeof(m_Stats));
+  m_nStatsPackets = 0;
+  m_rtStatsRateStart = timer_get_ref_time();
+  m_bStatsDrying = false;
+}
+
 STDMETHODIMP CLAVOutputPin::NonDelegatingQueryInterface(REFIID riid, void** ppv)
 {
   CheckPointer(ppv, E_POINTER);
@@ -113,7 +254,9 @@ HRESULT CLAVOutputPin::DecideAllocator(IMemInputPin * pPin, IMemAllocator **ppAl
     prop.cbAlign = 1;
   }
 
-  *ppAlloc = new CPacketAllocator(NAME("CPacketAllocator"), nullptr, &hr);
+  CPacketAllocator *pPacketAllocator = new CPacketAllocator(NAME("CPacketAllocator"), nullptr, &hr);
+  pPacketAllocator->SetMemoryAccount(static_cast<CLAVSplitter*>(m_pFilter)->GetMemoryAccount());
+  *ppAlloc = pPacketAllocator;
   (*ppAlloc)->AddRef();
   if (SUCCEEDED(hr)) {
     DbgLog((LOG_TRACE, 10, L"Trying to use our CPacketAllocator"));
@@ -210,8 +353,11 @@ HRESULT CLAVOutputPin::Active()
   DbgLog((LOG_TRACE, 30, L"CLAVOutputPin::Active() - activated %s pin", CBaseDemuxer::CStreamList::ToStringW(m_pinType)));
   CAutoLock cAutoLock(m_pLock);
 
-  if(m_Connected)
+  if(m_Connected) {
+    ResetStatistics();
+    OpenCapture();
     Create();
+  }
 
   return __super::Active();
 }
@@ -227,24 +373,72 @@ HRESULT CLAVOutputPin::Inactive()
   // Clear queue when we're going inactive
   m_queue.Clear();
 
+  // Complete the capture file
+  SAFE_DELETE(m_pCapture);
+
   return __super::Inactive();
 }
 
+void CLAVOutputPin::OpenCapture()
+{
+  SAFE_DELETE(m_pCapture);
+
+  const std::wstring &prefix = (static_cast<CLAVSplitter*>(m_pFilter))->GetCapturePrefix();
+  if (prefix.empty())
+    return;
+
+  std::wstring fileName = prefix + L"_" + CBaseDemuxer::CStreamList::ToStringW(m_pinType) + std::to_wstring(m_streamId) + L".lavcap";
+  DbgLog((LOG_TRACE, 10, L"CLAVOutputPin::OpenCapture(): Capturing the samples of the %s pin to '%s'", CBaseDemuxer::CStreamList::ToStringW(m_pinType), fileName.c_str()));
+
+  m_pCapture = new CPacketCaptureWriter();
+  if (FAILED(m_pCapture->Open(fileName.c_str()))) {
+    SAFE_DELETE(m_pCapture);
+    return;
+  }
+
+  // the connection type and the side data of the stream precede the samples
+  m_pCapture->WriteMediaType(&m_mt);
+
+  const BYTE *pSideData = nullptr;
+  size_t nSize = 0;
+  if (SUCCEEDED(GetSideData(IID_MediaSideDataFFMpeg, &pSideData, &nSize)) && nSize == sizeof(MediaSideDataFFMpeg))
+    m_pCapture->WriteStreamSideData((const MediaSideDataFFMpeg *)pSideData);
+}
+
 STDMETHODIMP CLAVOutputPin::Connect(IPin* pReceivePin, const AM_MEDIA_TYPE* pmt)
 {
   HRESULT  hr;
   PIN_INFO PinInfo;
   GUID     FilterClsid;
+  BOOL     bLAVDecoder = FALSE;
 
   if (SUCCEEDED (pReceivePin->QueryPinInfo (&PinInfo))) {
     if (SUCCEEDED (PinInfo.pFilter->GetClassID(&FilterClsid))) {
       if (FilterClsid == CLSID_DMOWrapperFilter) {
         (static_cast<CLAVSplitter*>(m_pFilter))->SetFakeASFReader(TRUE);
       }
+      bLAVDecoder = (FilterClsid == CLSID_LAVVideo || FilterClsid == CLSID_LAVAudio);
     }
     PinInfo.pFilter->Release();
   }
 
+  // LAV Video and LAV Audio accept the first and most complete media type of a stream, so try it directly,
+  // instead of negotiating through the input types of the decoder and all the alternative types of the stream
+  if (bLAVDecoder) {
+    CMediaType mt;
+    {
+      CAutoSharedLock lock(&m_csMT);
+      if (!m_mts.empty())
+        mt = m_mts.front();
+    }
+    if (mt.majortype != GUID_NULL && (pmt == nullptr || mt.MatchesPartial((const CMediaType *)pmt))) {
+      hr = __super::Connect(pReceivePin, &mt);
+      if (SUCCEEDED(hr))
+        return hr;
+      DbgLog((LOG_TRACE, 10, L"CLAVOutputPin::Connect(): Connecting with the primary media type failed, trying all types"));
+    }
+  }
+
   hr = __super::Connect (pReceivePin, pmt);
   (static_cast<CLAVSplitter*>(m_pFilter))->SetFakeASFReader(FALSE);
   return hr;
@@ -274,7 +468,7 @@ HRESULT CLAVOutputPin::DeliverEndFlush()
   DbgLog((LOG_TRACE, 20, L"::DeliverEndFlush on %s Pin", CBaseDemuxer::CStreamList::ToStringW(m_pinType)));
   HRESULT hr = IsConnected() ? GetConnected()->EndFlush() : S_OK;
 
-  m_Parser.Flush();
+  m_bParserFlush = true;
 
   m_hrDeliver = S_OK;
   m_fFlushing = false;
@@ -293,6 +487,7 @@ HRESULT CLAVOutputPin::DeliverNewSegment(REFERENCE_TIME tStart, REFERENCE_TIME t
   if(!ThreadExists()) return S_FALSE;
 
   m_BitRate.rtLastDeliverTime = Packet::INVALID_TIME;
+  m_rtQueueIn = m_rtQueueOut = Packet::INVALID_TIME;
   hr = __super::DeliverNewSegment(tStart, tStop, dRate);
   if (hr != S_OK)
     return hr;
@@ -311,10 +506,51 @@ void CLAVOutputPin::MakeISCRHappy()
     p->rtStop = 0;
     p->bSyncPoint = FALSE;
     p->SetData(" ", 2);
-    QueueFromParser(p);
+    p->dwFlags |= LAV_PACKET_PARSED;
+    QueueToThread(p);
   }
 }
 
+// Output of the parser, called on the delivery thread
+HRESULT CLAVOutputPin::QueueFromParser(Packet *pPacket)
+{
+  m_Parsed.push_back(pPacket);
+  return S_OK;
+}
+
+// Drop the state of the parser and its output, on the delivery thread
+void CLAVOutputPin::ResetParser()
+{
+  m_Parser.Flush();
+  for (Packet *pPacket : m_Parsed)
+    SAFE_DELETE(pPacket);
+  m_Parsed.clear();
+}
+
+void CLAVOutputPin::QueueToThread(Packet *pPacket)
+{
+  if (pPacket && pPacket->rtStart != Packet::INVALID_TIME)
+    m_rtQueueIn = pPacket->rtStart;
+
+  // the packet belongs to the delivery thread once it is queued
+  if (pPacket) {
+    LAV_TRACE("PacketQueued", LAV_TRACE_KEYWORD_SPLITTER,
+              TraceLoggingUInt32(m_streamId, "StreamId"),
+              TraceLoggingInt64(pPacket->rtStart, "Start"),
+              TraceLoggingInt64(pPacket->rtStop, "Stop"),
+              TraceLoggingInt32(pPacket->GetDataSize(), "Size"));
+  }
+  m_queue.Queue(pPacket);
+  UpdateQueueCounters();
+
+  const size_t size = m_queue.Size(), dataSize = m_queue.DataSize();
+  CAutoLock lock(&m_csStats);
+  if (size > m_Stats.dwQueueHighWater)
+    m_Stats.dwQueueHighWater = (DWORD)size;
+  if (dataSize > m_Stats.ullQueueHighWaterBytes)
+    m_Stats.ullQueueHighWaterBytes = dataSize;
+}
+
 size_t CLAVOutputPin::QueueCount()
 {
   return m_queue.Size();
@@ -334,31 +570,47 @@ HRESULT CLAVOutputPin::QueuePacket(Packet *pPacket)
 
   CLAVSplitter *pSplitter = static_cast<CLAVSplitter*>(m_pFilter);
 
-  // While everything is good AND no pin is drying AND the queue is full .. sleep
+  // While everything is good AND no pin is drying AND the queue is full .. wait
   // The queu has a "soft" limit of MAX_PACKETS_IN_QUEUE, and a hard limit of MAX_PACKETS_IN_QUEUE * 2
   // That means, even if one pin is drying, we'll never exceed MAX_PACKETS_IN_QUEUE * 2
-  while(S_OK == m_hrDeliver 
-    && (m_queue.DataSize() > m_nQueueMaxMem
-    || m_queue.Size() > 2*m_nQueueHigh
-    || (m_queue.Size() > m_nQueueHigh && !pSplitter->IsAnyPinDrying())))
-    Sleep(10);
+  // Queues sized by duration have the same limits in time, see IsQueueFull
+  // The event is signaled whenever any pin removes packets from its queue, or delivery is aborted
+  REFERENCE_TIME rtBlockStart = 0;
+  while(S_OK == m_hrDeliver && IsQueueFull()) {
+    if (rtBlockStart == 0)
+      rtBlockStart = timer_get_ref_time();
+    pSplitter->m_eQueueSpace.Wait();
+  }
+
+  if (rtBlockStart) {
+    CAutoLock lock(&m_csStats);
+    m_Stats.rtQueueBlocked += timer_get_ref_time() - rtBlockStart;
+  }
 
   if(S_OK != m_hrDeliver) {
     SAFE_DELETE(pPacket);
     return m_hrDeliver;
   }
 
+  // only take the lock exclusively if there is a new media type
+  BOOL bNewMT = FALSE;
   {
-    CAutoLock lock(&m_csMT);
-    if(m_newMT && pPacket) {
+    CAutoSharedLock lock(&m_csMT);
+    bNewMT = (m_newMT != nullptr);
+  }
+
+  if (bNewMT && pPacket) {
+    CAutoExclusiveLock lock(&m_csMT);
+    if(m_newMT) {
       DbgLog((LOG_TRACE, 10, L"::QueuePacket() - Found new Media Type"));
       pPacket->pmt = CreateMediaType(m_newMT);
-      SetStreamMediaType(m_newMT);
+      m_StreamMT = *m_newMT;
       SAFE_DELETE(m_newMT);
     }
   }
 
-  m_Parser.Parse(m_StreamMT.subtype, pPacket);
+  // the packet is parsed on the delivery thread
+  QueueToThread(pPacket);
 
   return m_hrDeliver;
 }
@@ -378,17 +630,38 @@ DWORD CLAVOutputPin::ThreadProc()
   std::string name = "CLAVOutputPin " + std::string(CBaseDemuxer::CStreamList::ToString(m_pinType));
   SetThreadName(-1, name.c_str());
 
+  CLAVSplitter *pSplitter = static_cast<CLAVSplitter*>(m_pFilter);
+  StreamingThreadClass threadClass = ThreadClass_Playback;
+  if (m_pinType == CBaseDemuxer::audio)
+    threadClass = (pSplitter->GetLowLatencyLiveMode() && pSplitter->IsLiveStream()) ? ThreadClass_ProAudio : ThreadClass_Audio;
+  CStreamingThreadPriority priority(threadClass, pSplitter->GetStreamingThreadPriority());
+  numa_bind_thread(pSplitter->GetNUMAPlacement());
+
   m_hrDeliver = S_OK;
   m_fFlushing = m_fFlushed = false;
   m_eEndFlush.Set();
   bool bFailFlush = false;
 
-  while(1) {
-    Sleep(1);
+  {
+    CAutoSharedLock lock(&m_csMT);
+    m_ParserSubtype = m_StreamMT.subtype;
+  }
+  m_bParserFlush = false;
+  ResetParser();
+
+  // Sleep until either a command is sent, or packets are available in the queue
+  HANDLE hWaitEvents[2] = { GetRequestHandle(), m_queue.GetQueuedEvent() };
 
-    DWORD cmd;
-    if(CheckRequest(&cmd)) {
-      cmd = GetRequest();
+  while(1) {
+    REFERENCE_TIME rtWaitStart = timer_get_ref_time();
+    DWORD dwWait = WaitForMultipleObjects(2, hWaitEvents, FALSE, INFINITE);
+    {
+      CAutoLock lock(&m_csStats);
+      m_Stats.rtThreadWait += timer_get_ref_time() - rtWaitStart;
+    }
+    if (dwWait == WAIT_OBJECT_0) {
+      DWORD cmd = GetRequestParam();
+      ResetParser();
       Reply(S_OK);
       ASSERT(cmd == CMD_EXIT);
       return 0;
@@ -396,23 +669,114 @@ DWORD CLAVOutputPin::ThreadProc()
 
     size_t cnt = 0;
     do {
-      Packet *pPacket = nullptr;
-
-      // Get a packet from the queue (scoped for lock)
+      // A flush only marks the parser, which belongs to this thread
+      if (m_bParserFlush.exchange(false))
+        ResetParser();
+
+      // Get packets from the queue (scoped for lock)
+      // A deep queue, after seeking or on start-up, is taken in batches
+      Packet *pQueued[MAX_PACKETS_PER_BATCH];
+      long nQueued = 0;
       {
         CAutoLock cAutoLock(&m_queue);
         if((cnt = m_queue.Size()) > 0) {
-          pPacket = m_queue.Get();
+          do {
+            pQueued[nQueued++] = m_queue.Get();
+          } while (cnt >= MIN_PACKETS_PER_BATCH && nQueued < MAX_PACKETS_PER_BATCH && !m_queue.IsEmpty());
+        }
+      }
+
+      // Count every time the queue runs below its low limit, continuous streams only
+      if (cnt > 0 && !IsDiscontinuous()) {
+        bool bDrying = IsQueueDrying();
+        CAutoLock lock(&m_csStats);
+        if (bDrying && !m_bStatsDrying)
+          m_Stats.dwDryingEvents++;
+        m_bStatsDrying = bDrying;
+      }
+
+      // Run the packets through the parser, which queues its output for delivery
+      // Parsing here instead of on the demuxer thread lets the streams of all pins be parsed in parallel
+      for (long i = 0; i < nQueued; i++) {
+        if (m_hrDeliver != S_OK) {
+          SAFE_DELETE(pQueued[i]);
+          continue;
         }
+        if (pQueued[i] && pQueued[i]->pmt)
+          m_ParserSubtype = pQueued[i]->pmt->subtype;
+        m_Parser.Parse(m_ParserSubtype, pQueued[i]);
       }
 
-      // We need to check cnt instead of pPacket, since it can be nullptr for EndOfStream
-      if(m_hrDeliver == S_OK && cnt > 0) {
+      // The parsed packets from before a flush are stale, they are dropped with the next reset
+      while (!m_Parsed.empty() && !m_bParserFlush) {
+        Packet *pPacket = m_Parsed.front();
+        m_Parsed.pop_front();
+
+        // Many parsed packets are delivered in batches
+        // Only our own allocator can hand out a whole batch of samples without waiting for the downstream filter
+        // Media type changes and the end of the stream are always delivered on their own
+        Packet *pBatch[MAX_PACKETS_PER_BATCH];
+        long nBatch = 0;
+        if (m_bPacketAllocator && m_Parsed.size() + 1 >= MIN_PACKETS_PER_BATCH && pPacket && !pPacket->pmt) {
+          pBatch[nBatch++] = pPacket;
+          while (nBatch < MAX_PACKETS_PER_BATCH && !m_Parsed.empty() && m_Parsed.front() && !m_Parsed.front()->pmt) {
+            pBatch[nBatch++] = m_Parsed.front();
+            m_Parsed.pop_front();
+          }
+        }
+
+        if (m_hrDeliver != S_OK) {
+          // in case of stream switches or other events, we may end up here
+          for (long i = 0; i < nBatch; i++)
+            SAFE_DELETE(pBatch[i]);
+          if (nBatch == 0)
+            SAFE_DELETE(pPacket);
+          continue;
+        }
+
         ASSERT(!m_fFlushing);
         m_fFlushed = false;
 
         // flushing can still start here, to release a blocked deliver call
-        HRESULT hr = pPacket ? DeliverPacket(pPacket) : DeliverEndOfStream();
+        REFERENCE_TIME rtDeliverStart = timer_get_ref_time();
+        REFERENCE_TIME rtTraceStart = Packet::INVALID_TIME;
+        int nTraceSize = 0;
+        if (pPacket && LAV_TRACE_ENABLED(LAV_TRACE_KEYWORD_SPLITTER)) {
+          rtTraceStart = pPacket->rtStart;
+          for (long i = 0; i < max(nBatch, 1L); i++)
+            nTraceSize += (nBatch > 1 ? pBatch[i] : pPacket)->GetDataSize();
+        }
+
+        HRESULT hr = S_OK;
+        if (nBatch > 1)
+          hr = DeliverPackets(pBatch, nBatch);
+        else
+          hr = pPacket ? DeliverPacket(pPacket) : DeliverEndOfStream();
+
+        {
+          REFERENCE_TIME rtNow = timer_get_ref_time();
+          if (pPacket) {
+            LAV_TRACE("PacketDelivered", LAV_TRACE_KEYWORD_SPLITTER,
+                      TraceLoggingUInt32(m_streamId, "StreamId"),
+                      TraceLoggingInt64(rtTraceStart, "Start"),
+                      TraceLoggingInt32(nTraceSize, "Size"),
+                      TraceLoggingInt32(max(nBatch, 1L), "Packets"),
+                      TraceLoggingInt64(rtNow - rtDeliverStart, "DeliverTime"),
+                      TraceLoggingHResult(hr, "Result"));
+          }
+
+          CAutoLock lock(&m_csStats);
+          m_Stats.rtThreadDeliver += rtNow - rtDeliverStart;
+          if (pPacket) {
+            m_Stats.ullPackets += max(nBatch, 1L);
+            m_nStatsPackets += max(nBatch, 1L);
+          }
+          if (rtNow - m_rtStatsRateStart >= 10000000) {
+            m_Stats.dwPacketsPerSecond = (DWORD)(m_nStatsPackets * 10000000 / (rtNow - m_rtStatsRateStart));
+            m_nStatsPackets = 0;
+            m_rtStatsRateStart = rtNow;
+          }
+        }
 
         // .. so, wait until flush finished
         m_eEndFlush.Wait();
@@ -426,22 +790,69 @@ DWORD CLAVOutputPin::ThreadProc()
             bFailFlush = true;
           } else {
             m_hrDeliver = hr;
+            // wake up the demuxer, in case its waiting for queue space on this pin
+            (static_cast<CLAVSplitter*>(m_pFilter))->m_eQueueSpace.Set();
           }
-          break;
         }
-      } else if (pPacket) {
-        // in case of stream switches or other events, we may end up here
-        SAFE_DELETE(pPacket);
       }
-    } while(cnt > 1 && m_hrDeliver == S_OK);
+    } while((cnt > (size_t)nQueued || m_bParserFlush) && m_hrDeliver == S_OK);
   }
   return 0;
 }
 
 HRESULT CLAVOutputPin::DeliverPacket(Packet *pPacket)
+{
+  IMediaSample *pSample = nullptr;
+
+  HRESULT hr = PrepareSample(pPacket, &pSample);
+  if (hr == S_OK && pSample)
+    hr = Deliver(pSample);
+
+  SafeRelease(&pSample);
+  return hr;
+}
+
+HRESULT CLAVOutputPin::DeliverPackets(Packet **ppPackets, long nPackets)
+{
+  IMediaSample *pSamples[MAX_PACKETS_PER_BATCH];
+  long nSamples = 0;
+  HRESULT hr = S_OK;
+
+  ASSERT(nPackets <= MAX_PACKETS_PER_BATCH);
+
+  for (long i = 0; i < nPackets; i++) {
+    IMediaSample *pSample = nullptr;
+    if ((hr = PrepareSample(ppPackets[i], &pSample)) != S_OK) {
+      SafeRelease(&pSample);
+      for (long j = i + 1; j < nPackets; j++)
+        SAFE_DELETE(ppPackets[j]);
+      break;
+    }
+    if (pSample)
+      pSamples[nSamples++] = pSample;
+  }
+
+  if (hr == S_OK && nSamples > 0) {
+    if (m_pInputPin == nullptr) {
+      hr = VFW_E_NOT_CONNECTED;
+    } else {
+      // the samples after a failed one are not processed, and only released
+      long nProcessed = 0;
+      hr = m_pInputPin->ReceiveMultiple(pSamples, nSamples, &nProcessed);
+    }
+  }
+
+  for (long i = 0; i < nSamples; i++)
+    pSamples[i]->Release();
+
+  return hr;
+}
+
+HRESULT CLAVOutputPin::PrepareSample(Packet *pPacket, IMediaSample **ppSample)
 {
   HRESULT hr = S_OK;
   IMediaSample *pSample = nullptr;
+  *ppSample = nullptr;
 
   long nBytes = (long)pPacket->GetDataSize();
 
@@ -477,7 +888,10 @@ HRESULT CLAVOutputPin::DeliverPacket(Packet *pPacket)
 
     // Fill the sample
     BYTE* pData = nullptr;
-    if(FAILED(hr = pSample->GetPointer(&pData)) || !pData) goto done;
+    if(FAILED(hr = pSample->GetPointer(&pData)) || !pData) {
+      SafeRelease(&pSample);
+      goto done;
+    }
 
     memcpy(pData, pPacket->GetData(), nBytes);
   }
@@ -489,6 +903,8 @@ HRESULT CLAVOutputPin::DeliverPacket(Packet *pPacket)
 
     CAutoLock cAutoLock(m_pLock);
     CMediaType pmt = *(pPacket->pmt);
+    if (m_pCapture)
+      m_pCapture->WriteMediaType(&pmt);
     m_mts.clear();
     m_mts.push_back(pmt);
     pPacket->pmt = nullptr;
@@ -497,6 +913,11 @@ HRESULT CLAVOutputPin::DeliverPacket(Packet *pPacket)
   }
 
   bool fTimeValid = pPacket->rtStart != Packet::INVALID_TIME;
+  if (fTimeValid)
+    m_rtQueueOut = pPacket->rtStart;
+
+  perf_counter_add(&m_PerfValues[SplitterPerf_Packets], 1);
+  UpdateQueueCounters();
 
   // IBitRateInfo
   m_BitRate.nBytesSinceLastDeliverTime += nBytes;
@@ -528,19 +949,23 @@ HRESULT CLAVOutputPin::DeliverPacket(Packet *pPacket)
     }
   }
 
+  if (m_pCapture)
+    m_pCapture->WritePacket(pPacket);
+
   CHECK_HR(hr = pSample->SetActualDataLength(nBytes));
   CHECK_HR(hr = pSample->SetTime(fTimeValid ? &pPacket->rtStart : nullptr, fTimeValid ? &pPacket->rtStop : nullptr));
   CHECK_HR(hr = pSample->SetMediaTime(nullptr, nullptr));
   CHECK_HR(hr = pSample->SetDiscontinuity(pPacket->bDiscontinuity));
   CHECK_HR(hr = pSample->SetSyncPoint(pPacket->bSyncPoint));
   CHECK_HR(hr = pSample->SetPreroll(fTimeValid && pPacket->rtStart < 0));
-  // Deliver
-  CHECK_HR(hr = Deliver(pSample));
 
 done:
   if (!m_bPacketAllocator || !pSample)
     SAFE_DELETE(pPacket);
-  SafeRelease(&pSample);
+  if (hr == S_OK)
+    *ppSample = pSample;
+  else
+    SafeRelease(&pSample);
   return hr;
 }
 
@@ -33,6 +33,19 @@
 #include "ILAVPinInfo.h"
 #include "IBitRateInfo.h"
 #include "IMediaSideData.h"
+#include "timer.h"
+#include "PerfCounters.h"
+
+class CPacketCaptureWriter;
+
+// Counters of the "LAV Splitter Output" counter set, in the order of LAVFilters.PerfCounters.man
+enum LAVSplitterPerfCounter {
+  SplitterPerf_Packets,         // Packets delivered, per second
+  SplitterPerf_QueuedPackets,   // Packets in the queue
+  SplitterPerf_QueueDuration,   // Duration of the queued packets, in ms
+
+  SplitterPerf_NB
+};
 
 class CLAVOutputPin
   : public CBaseOutputPin
@@ -97,17 +110,22 @@ public:
   STDMETHODIMP GetSideData(GUID guidType, const BYTE **pData, size_t *pSize);
 
   size_t QueueCount();
+  size_t QueueDataSize() const { return m_queue.DataSize(); }
+  bool IsQueueDrying();
+  // Is the queue short of its target, and only filled up to an earlier time than rtBufferedUntil
+  bool IsQueueBehind(REFERENCE_TIME rtBufferedUntil);
   HRESULT QueuePacket(Packet *pPacket);
   HRESULT QueueEndOfStream();
   bool IsDiscontinuous();
   size_t GetQueueLowLimit() const { return m_nQueueLow; }
+  size_t GetQueueHighLimit() const { return m_nQueueHigh; }
 
   DWORD GetStreamId() { return m_streamId; };
   void SetStreamId(DWORD newStreamId) { m_streamId = newStreamId; };
 
-  void SetNewMediaTypes(std::deque<CMediaType> pmts) { CAutoLock lock(&m_csMT); m_mts = pmts; SetQueueSizes(); }
-  void SendMediaType(CMediaType *mt) { CAutoLock lock(&m_csMT); m_newMT = mt;}
-  void SetStreamMediaType(CMediaType *mt) { CAutoLock lock(&m_csMT); m_StreamMT = *mt; }
+  void SetNewMediaTypes(std::deque<CMediaType> pmts) { CAutoExclusiveLock lock(&m_csMT); m_mts = pmts; SetQueueSizes(); }
+  void SendMediaType(CMediaType *mt) { CAutoExclusiveLock lock(&m_csMT); m_newMT = mt;}
+  void SetStreamMediaType(CMediaType *mt) { CAutoExclusiveLock lock(&m_csMT); m_StreamMT = *mt; }
 
   CMediaType& GetActiveMediaType() { return m_mt; }
 
@@ -116,10 +134,13 @@ public:
   BOOL IsSubtitlePin(){ return m_pinType == CBaseDemuxer::subpic; }
   CBaseDemuxer::StreamType GetPinType() { return m_pinType; }
 
-  HRESULT QueueFromParser(Packet *pPacket) { m_queue.Queue(pPacket); return S_OK; }
+  HRESULT QueueFromParser(Packet *pPacket);
 
   HRESULT GetQueueSize(int& samples, int& size);
 
+  HRESULT GetStatistics(LAVFPinStatistics *pStats);
+  void ResetStatistics();
+
 public:
   // Packet handling functions
   virtual HRESULT DeliverBeginFlush();
@@ -133,6 +154,10 @@ public:
 
 protected:
   virtual HRESULT DeliverPacket(Packet *pPacket);
+  // Deliver the packets with one IMemInputPin::ReceiveMultiple call, takes ownership of all of them
+  HRESULT DeliverPackets(Packet **ppPackets, long nPackets);
+  // Wrap the packet into a sample, which is nullptr if there is nothing to deliver
+  HRESULT PrepareSample(Packet *pPacket, IMediaSample **ppSample);
 
 private:
   enum {CMD_EXIT};
@@ -140,10 +165,22 @@ private:
 
   void MakeISCRHappy();
 
+  // Queue a packet for the delivery thread, which runs it through the parser
+  void QueueToThread(Packet *pPacket);
+  void ResetParser();
+
+  // Start the sample capture, if the splitter is configured to capture
+  void OpenCapture();
+
+  bool IsQueueFull();
+  REFERENCE_TIME GetQueueDuration();
+  void UpdateQueueCounters();
+
 private:
-  CCritSec m_csMT;
+  // checked for a new media type with every packet, which is rarely there
+  CSharedLock m_csMT;
   std::deque<CMediaType> m_mts;
-  CPacketQueue m_queue;
+  CLockFreePacketQueue m_queue;
   CMediaType m_StreamMT;
 
   std::string m_containerFormat;
@@ -160,12 +197,22 @@ private:
   size_t m_nQueueHigh   = 350;
   size_t m_nQueueMaxMem = 256 * 1024 * 1024;
 
+  // Duration based queue limits, zero when the queue is limited by packet count
+  REFERENCE_TIME m_rtQueueTarget = 0;
+  REFERENCE_TIME m_rtQueueLow    = 0;
+  std::atomic<REFERENCE_TIME> m_rtQueueIn{Packet::INVALID_TIME};   ///< Timestamp of the last queued packet
+  std::atomic<REFERENCE_TIME> m_rtQueueOut{Packet::INVALID_TIME};  ///< Timestamp of the last delivered packet
+
   DWORD m_streamId      = 0;
   CMediaType *m_newMT   = nullptr;
 
   CBaseDemuxer::StreamType m_pinType;
 
+  // The parser runs on the delivery thread, all of its state is only used there
   CStreamParser m_Parser;
+  std::deque<Packet *> m_Parsed;                 ///< output of the parser, waiting for delivery
+  GUID m_ParserSubtype = GUID_NULL;               ///< subtype of the queued packets, changes with their media type
+  std::atomic<bool> m_bParserFlush{false};        ///< set by a flush, the delivery thread then resets the parser
   BOOL m_bPacketAllocator = FALSE;
 
   // IBitRateInfo
@@ -177,4 +224,18 @@ private:
     DWORD nCurrentBitRate               = 0;
     DWORD nAverageBitRate               = 0;
   } m_BitRate;
+
+  // ILAVFStatistics
+  CCritSec m_csStats;
+  LAVFPinStatistics m_Stats         = { 0 };
+  ULONGLONG m_nStatsPackets          = 0;   ///< Packets delivered in the current packet rate interval
+  REFERENCE_TIME m_rtStatsRateStart  = 0;   ///< Start of the current packet rate interval
+  bool m_bStatsDrying                = false;
+
+  // Performance counters of the pin
+  volatile ULONGLONG m_PerfValues[SplitterPerf_NB] = { 0 };
+  PPERF_COUNTERSET_INSTANCE m_pPerfInstance = nullptr;
+
+  // ILAVFPacketCapture, only used by the delivery thread while it runs
+  CPacketCaptureWriter *m_pCapture   = nullptr;
 };
@@ -36,6 +36,9 @@ STDMETHODIMP CMediaPacketSample::QueryInterface(REFIID riid, void **ppv)
   else if (riid == __uuidof(IMediaSideData)) {
     return GetInterface((IMediaSideData *) this, ppv);
   }
+  else if (riid == __uuidof(IMediaSampleAVPacket)) {
+    return GetInterface((IMediaSampleAVPacket *) this, ppv);
+  }
   return CMediaSample::QueryInterface(riid, ppv);
 }
 
@@ -72,8 +75,10 @@ STDMETHODIMP_(ULONG) CMediaPacketSample::Release()
     
     SAFE_DELETE(m_pPacket);
     SetPointer(nullptr, 0);
+    ChargePacket(0);
 
     SAFE_DELETE(m_pSideData);
+    m_CaptureTime.rtCapture = Packet::INVALID_TIME;
 
     /* This may cause us to be deleted */
     // Our refcount is reliably 0 thus no-one will mess with us
@@ -87,8 +92,10 @@ STDMETHODIMP CMediaPacketSample::SetPacket(Packet *pPacket)
   SAFE_DELETE(m_pPacket);
   m_pPacket = pPacket;
   SetPointer(pPacket->GetData(), (LONG)pPacket->GetDataSize());
+  ChargePacket((size_t)pPacket->GetDataSize());
 
   SAFE_DELETE(m_pSideData);
+  m_CaptureTime.rtCapture = pPacket->rtCapture;
 
   if (pPacket->GetNumSideData() > 0) {
     m_pSideData = new MediaSideDataFFMpeg();
@@ -99,6 +106,13 @@ STDMETHODIMP CMediaPacketSample::SetPacket(Packet *pPacket)
   return S_OK;
 }
 
+void CMediaPacketSample::ChargePacket(size_t nBytes)
+{
+  CMemoryAccount *pAccount = static_cast<CPacketAllocator *>(m_pAllocator)->GetMemoryAccount();
+  if (pAccount)
+    pAccount->Update(LAVMemory_Samples, &m_nCharged, nBytes);
+}
+
 STDMETHODIMP CMediaPacketSample::SetSideData(GUID guidType, const BYTE *pData, size_t size)
 {
   return E_NOTIMPL;
@@ -113,18 +127,60 @@ STDMETHODIMP CMediaPacketSample::GetSideData(GUID guidType, const BYTE **pData,
     return S_OK;
   }
 
+  if (guidType == IID_MediaSideDataCaptureTime && m_CaptureTime.rtCapture != Packet::INVALID_TIME) {
+    *pData = (const BYTE *)&m_CaptureTime;
+    *pSize = sizeof(MediaSideDataCaptureTime);
+
+    return S_OK;
+  }
+
   return E_INVALIDARG;
 }
 
+STDMETHODIMP CMediaPacketSample::GetAVPacketRef(AVPacket *pPacket)
+{
+  CheckPointer(pPacket, E_POINTER);
+
+  const AVPacket *pkt = m_pPacket ? m_pPacket->GetAVPacket() : nullptr;
+  if (!pkt || !pkt->buf)
+    return E_FAIL;
+
+  // The sample data can be changed through the IMediaSample interface, only hand out the packet if it still matches
+  BYTE *pData = nullptr;
+  if (FAILED(GetPointer(&pData)) || pData != pkt->data || GetActualDataLength() != pkt->size)
+    return E_FAIL;
+
+  if (av_packet_ref(pPacket, pkt) < 0)
+    return E_OUTOFMEMORY;
+
+  // Timestamps are in the demuxers time base, and only valid on the sample itself
+  pPacket->pts = pPacket->dts = AV_NOPTS_VALUE;
+  pPacket->duration = 0;
+  pPacket->pos = -1;
+
+  return S_OK;
+}
+
 CPacketAllocator::CPacketAllocator(LPCTSTR pName, LPUNKNOWN pUnk, HRESULT *phr)
   : CBaseAllocator(pName, pUnk, phr, TRUE, TRUE)
 {
+  InitializeSListHead(&m_FreeList);
 }
 
 CPacketAllocator::~CPacketAllocator(void)
 {
   Decommit();
   ReallyFree();
+  SafeRelease(&m_pAccount);
+}
+
+void CPacketAllocator::SetMemoryAccount(CMemoryAccount *pAccount)
+{
+  CAutoLock cObjectLock(this);
+  if (pAccount)
+    pAccount->AddRef();
+  SafeRelease(&m_pAccount);
+  m_pAccount = pAccount;
 }
 
 STDMETHODIMP CPacketAllocator::NonDelegatingQueryInterface(REFIID riid, __deref_out void **ppv)
@@ -175,6 +231,7 @@ STDMETHODIMP CPacketAllocator::SetProperties(ALLOCATOR_PROPERTIES* pRequest, ALL
 
   /* Must be no outstanding buffers */
 
+  DrainFreeList();
   if (m_lFree.GetCount() < m_lAllocated) {
     return VFW_E_BUFFERS_OUTSTANDING;
   }
@@ -262,10 +319,19 @@ HRESULT CPacketAllocator::GetBuffer(__deref_out IMediaSample **ppBuffer,
   UNREFERENCED_PARAMETER(pStartTime);
   UNREFERENCED_PARAMETER(pEndTime);
   UNREFERENCED_PARAMETER(dwFlags);
-  CMediaSample *pSample;
+  CMediaSample *pSample = NULL;
 
   *ppBuffer = NULL;
-  for (;;)
+
+  /* Fast path, take a released sample without the lock */
+  if (m_bCommitted) {
+    PSLIST_ENTRY pEntry = InterlockedPopEntrySList(&m_FreeList);
+    if (pEntry) {
+      pSample = CONTAINING_RECORD(pEntry, CMediaPacketSample, m_FreeEntry);
+    }
+  }
+
+  while (pSample == NULL)
   {
     {  // scope for lock
       CAutoLock cObjectLock(this);
@@ -275,6 +341,12 @@ HRESULT CPacketAllocator::GetBuffer(__deref_out IMediaSample **ppBuffer,
         return VFW_E_NOT_COMMITTED;
       }
       pSample = (CMediaSample *)m_lFree.RemoveHead();
+      if (pSample == NULL) {
+        PSLIST_ENTRY pEntry = InterlockedPopEntrySList(&m_FreeList);
+        if (pEntry) {
+          pSample = CONTAINING_RECORD(pEntry, CMediaPacketSample, m_FreeEntry);
+        }
+      }
 
       /* if no sample was available, allocate a new one */
       if (pSample == NULL) {
@@ -287,6 +359,16 @@ HRESULT CPacketAllocator::GetBuffer(__deref_out IMediaSample **ppBuffer,
           DbgLog((LOG_TRACE, 10, "Allocated new sample, %d total", m_lAllocated));
         }
       }
+
+      /* releases have to take the lock to wake us, samples released before are still in the list */
+      if (pSample == NULL) {
+        InterlockedExchange(&m_lLockedRelease, 1);
+        DrainFreeList();
+        pSample = (CMediaSample *)m_lFree.RemoveHead();
+        if (pSample == NULL) {
+          SetWaiting();
+        }
+      }
     }
 
     /* If we didn't get a sample then wait for the list to signal */
@@ -318,6 +400,117 @@ HRESULT CPacketAllocator::GetBuffer(__deref_out IMediaSample **ppBuffer,
   return NOERROR;
 }
 
+/* Final release of a CMediaPacketSample will call this */
+STDMETHODIMP CPacketAllocator::ReleaseBuffer(IMediaSample *pBuffer)
+{
+  CheckPointer(pBuffer, E_POINTER);
+
+#ifdef DXMPERF
+  PERFLOG_RELBUFFER((IMemAllocator *) this, pBuffer);
+#endif // DXMPERF
+
+  CMediaPacketSample *pSample = static_cast<CMediaPacketSample *>(static_cast<CMediaSample *>(pBuffer));
+  InterlockedPushEntrySList(&m_FreeList, &pSample->m_FreeEntry);
+
+  // the flag is only read after the push, a decommit or waiter setting it before draining the list
+  // either finds the sample in the list, or this release takes the lock
+  BOOL bRelease = FALSE;
+  if (m_lLockedRelease) {
+    CAutoLock cObjectLock(this);
+    DrainFreeList();
+    if (m_lWaiting != 0) {
+      NotifySample();
+    }
+
+    // if there is a pending Decommit, then we need to complete it by
+    // calling Free() when the last buffer is placed on the free list
+    if (m_bDecommitInProgress && m_lFree.GetCount() == m_lAllocated) {
+      Free();
+      m_bDecommitInProgress = FALSE;
+      bRelease = TRUE;
+    }
+
+    if (!m_bDecommitInProgress && m_lWaiting == 0) {
+      InterlockedExchange(&m_lLockedRelease, 0);
+    }
+  }
+
+  if (m_pNotify) {
+    m_pNotify->NotifyRelease();
+  }
+
+  /* For each buffer there is one AddRef, made in GetBuffer and released
+  here. This may cause the allocator and all samples to be deleted */
+  if (bRelease) {
+    Release();
+  }
+  return NOERROR;
+}
+
+STDMETHODIMP CPacketAllocator::Commit()
+{
+  CAutoLock cObjectLock(this);
+  HRESULT hr = CBaseAllocator::Commit();
+  if (SUCCEEDED(hr) && !m_bDecommitInProgress && m_lWaiting == 0) {
+    InterlockedExchange(&m_lLockedRelease, 0);
+  }
+  return hr;
+}
+
+STDMETHODIMP CPacketAllocator::Decommit()
+{
+  BOOL bRelease = FALSE;
+  {
+    /* Check we are not already decommitted */
+    CAutoLock cObjectLock(this);
+    if (m_bCommitted == FALSE && m_bDecommitInProgress == FALSE) {
+      return NOERROR;
+    }
+
+    /* No more GetBuffer calls will succeed */
+    m_bCommitted = FALSE;
+
+    // releases take the lock from now on, so the last of them completes the decommit
+    InterlockedExchange(&m_lLockedRelease, 1);
+    DrainFreeList();
+
+    // are any buffers outstanding?
+    if (m_lFree.GetCount() < m_lAllocated) {
+      m_bDecommitInProgress = TRUE;
+    } else {
+      m_bDecommitInProgress = FALSE;
+      Free();
+      bRelease = TRUE;
+    }
+
+    // Tell anyone waiting that they can go now so we can reject their call
+    NotifySample();
+  }
+
+  if (bRelease) {
+    Release();
+  }
+  return NOERROR;
+}
+
+STDMETHODIMP CPacketAllocator::GetFreeCount(LONG *plBuffersFree)
+{
+  CheckPointer(plBuffersFree, E_POINTER);
+  CAutoLock cObjectLock(this);
+  DrainFreeList();
+  return CBaseAllocator::GetFreeCount(plBuffersFree);
+}
+
+void CPacketAllocator::DrainFreeList()
+{
+  PSLIST_ENTRY pEntry = InterlockedFlushSList(&m_FreeList);
+  while (pEntry) {
+    CMediaPacketSample *pSample = CONTAINING_RECORD(pEntry, CMediaPacketSample, m_FreeEntry);
+    pEntry = pEntry->Next;
+    m_lFree.Add(pSample);
+  }
+}
+
 
 // override this to free up any resources we have allocated.
 // called from the base class on Decommit when all buffers have been
@@ -338,6 +531,8 @@ void CPacketAllocator::Free(void)
 // actually free up the memory
 void CPacketAllocator::ReallyFree(void)
 {
+  DrainFreeList();
+
   /* Should never be deleting this unless all buffers are freed */
   ASSERT(m_lAllocated == m_lFree.GetCount());
 
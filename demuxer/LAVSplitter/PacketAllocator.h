@@ -26,6 +26,8 @@
 #include "IMediaSideData.h"
 #include "IMediaSideDataFFmpeg.h"
 #include "ILAVDynamicAllocator.h"
+#include "IMediaSampleAVPacket.h"
+#include "MemoryAccount.h"
 
 interface __declspec(uuid("0B2EE323-0ED8-452D-B31E-B9B4DE2C0C39"))
 ILAVMediaSample : public IUnknown  {
@@ -33,7 +35,7 @@ ILAVMediaSample : public IUnknown  {
 };
 
 
-class CMediaPacketSample : public CMediaSample, public ILAVMediaSample, public IMediaSideData
+class CMediaPacketSample : public CMediaSample, public ILAVMediaSample, public IMediaSideData, public IMediaSampleAVPacket
 {
 public:
   CMediaPacketSample(LPCTSTR pName, CBaseAllocator *pAllocator, HRESULT *phr);
@@ -50,9 +52,21 @@ public:
   STDMETHODIMP SetSideData(GUID guidType, const BYTE *pData, size_t size);
   STDMETHODIMP GetSideData(GUID guidType, const BYTE **pData, size_t *pSize);
 
+  // IMediaSampleAVPacket
+  STDMETHODIMP GetAVPacketRef(AVPacket *pPacket);
+
+private:
+  void ChargePacket(size_t nBytes);
+
 protected:
   Packet *m_pPacket = nullptr;
   MediaSideDataFFMpeg *m_pSideData = nullptr;
+  MediaSideDataCaptureTime m_CaptureTime = { Packet::INVALID_TIME };
+  size_t m_nCharged = 0;
+
+  // Entry in the lock-free list of free samples of the allocator
+  SLIST_ENTRY m_FreeEntry;
+  friend class CPacketAllocator;
 };
 
 class CPacketAllocator : public CBaseAllocator, public ILAVDynamicAllocator
@@ -82,7 +96,28 @@ public:
   // CBaseAllocator overrides
   STDMETHODIMP SetProperties(ALLOCATOR_PROPERTIES* pRequest, ALLOCATOR_PROPERTIES* pActual);
   STDMETHODIMP GetBuffer(IMediaSample **ppBuffer, REFERENCE_TIME *pStartTime, REFERENCE_TIME *pEndTime, DWORD dwFlags);
+  STDMETHODIMP ReleaseBuffer(IMediaSample *pBuffer);
+  STDMETHODIMP Commit();
+  STDMETHODIMP Decommit();
+  STDMETHODIMP GetFreeCount(LONG *plBuffersFree);
 
   // ILAVDynamicAllocator
   STDMETHODIMP_(BOOL) IsDynamicAllocator() { return TRUE; }
+
+  // Account the packets held by the samples are charged to
+  void SetMemoryAccount(CMemoryAccount *pAccount);
+  CMemoryAccount *GetMemoryAccount() const { return m_pAccount; }
+
+private:
+  // Move the samples of the lock-free list to the free list of the base class, the caller holds the lock
+  void DrainFreeList();
+
+private:
+  CMemoryAccount *m_pAccount = nullptr;
+
+  // Released samples are pushed on a lock-free list, and taken from it again without the allocator lock.
+  // While a decommit is pending or a thread waits for a sample, releases also take the lock, to complete
+  // the decommit or wake the thread.
+  SLIST_HEADER m_FreeList;
+  volatile LONG m_lLockedRelease = 0;
 };
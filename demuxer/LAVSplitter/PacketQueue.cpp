@@ -20,6 +20,7 @@
 #include "stdafx.h"
 #include "PacketQueue.h"
 #include "BaseDemuxer.h"
+#include "MemoryAccount.h"
 
 // Queue a new packet at the end of the list
 void CPacketQueue::Queue(Packet *pPacket)
@@ -30,6 +31,7 @@ void CPacketQueue::Queue(Packet *pPacket)
     m_dataSize += (size_t)pPacket->GetDataSize();
 
   m_queue.push_back(pPacket);
+  m_evQueued.Set();
 }
 
 // Get a packet from the beginning of the list
@@ -46,6 +48,12 @@ Packet *CPacketQueue::Get()
   if (pPacket)
     m_dataSize -= (size_t)pPacket->GetDataSize();
 
+  if (m_queue.empty())
+    m_evQueued.Reset();
+
+  if (m_pevDequeue)
+    m_pevDequeue->Set();
+
   return pPacket;
 }
 
@@ -78,4 +86,125 @@ void CPacketQueue::Clear()
   }
   m_queue.clear();
   m_dataSize = 0;
+
+  m_evQueued.Reset();
+  if (m_pevDequeue)
+    m_pevDequeue->Set();
+}
+
+CLockFreePacketQueue::CLockFreePacketQueue()
+{
+  m_pHead = m_pTail = AllocBlock();
+}
+
+CLockFreePacketQueue::~CLockFreePacketQueue()
+{
+  Clear();
+  delete m_pHead;
+  delete m_pSpare.exchange(nullptr);
+}
+
+CLockFreePacketQueue::Block *CLockFreePacketQueue::AllocBlock()
+{
+  Block *pBlock = m_pSpare.exchange(nullptr);
+  if (!pBlock)
+    pBlock = new Block;
+  pBlock->next.store(nullptr, std::memory_order_relaxed);
+  return pBlock;
+}
+
+// Queue a new packet at the end of the list
+void CLockFreePacketQueue::Queue(Packet *pPacket)
+{
+  if (m_uTailPos == BLOCK_SIZE) {
+    Block *pBlock = AllocBlock();
+    m_pTail->next.store(pBlock, std::memory_order_release);
+    m_pTail = pBlock;
+    m_uTailPos = 0;
+  }
+
+  m_pTail->packets[m_uTailPos++] = pPacket;
+
+  if (pPacket) {
+    m_dataSize.fetch_add((size_t)pPacket->GetDataSize(), std::memory_order_relaxed);
+    if (m_pAccount)
+      m_pAccount->Add(LAVMemory_PacketQueue, pPacket->GetDataSize());
+  }
+
+  // Publish the packet, and wake up the consumer if the queue was empty
+  if (m_count.fetch_add(1, std::memory_order_seq_cst) == 0)
+    m_evQueued.Set();
+}
+
+// Remove the first packet from the list, caller needs to hold the lock
+Packet *CLockFreePacketQueue::Pop()
+{
+  if (m_count.load(std::memory_order_acquire) == 0)
+    return nullptr;
+
+  if (m_uHeadPos == BLOCK_SIZE) {
+    // The producer always links the next block before publishing a packet in it
+    Block *pNext = m_pHead->next.load(std::memory_order_acquire);
+    ASSERT(pNext);
+    delete m_pSpare.exchange(m_pHead);
+    m_pHead = pNext;
+    m_uHeadPos = 0;
+  }
+
+  Packet *pPacket = m_pHead->packets[m_uHeadPos++];
+
+  if (pPacket) {
+    m_dataSize.fetch_sub((size_t)pPacket->GetDataSize(), std::memory_order_relaxed);
+    if (m_pAccount)
+      m_pAccount->Add(LAVMemory_PacketQueue, -(LONGLONG)pPacket->GetDataSize());
+  }
+
+  if (m_count.fetch_sub(1, std::memory_order_seq_cst) == 1) {
+    m_evQueued.Reset();
+    // The producer may have queued a packet while we were resetting the event
+    if (m_count.load(std::memory_order_seq_cst) > 0)
+      m_evQueued.Set();
+  }
+
+  return pPacket;
+}
+
+// Look at the first packet of the list, caller needs to hold the lock
+Packet *CLockFreePacketQueue::Peek() const
+{
+  ASSERT(m_count.load(std::memory_order_acquire) > 0);
+
+  if (m_uHeadPos == BLOCK_SIZE)
+    return m_pHead->next.load(std::memory_order_acquire)->packets[0];
+
+  return m_pHead->packets[m_uHeadPos];
+}
+
+// Get a packet from the beginning of the list
+Packet *CLockFreePacketQueue::Get()
+{
+  CAutoLock cAutoLock(this);
+
+  Packet *pPacket = Pop();
+
+  if (m_pevDequeue)
+    m_pevDequeue->Set();
+
+  return pPacket;
+}
+
+// Clear the List (all elements are free'ed)
+void CLockFreePacketQueue::Clear()
+{
+  CAutoLock cAutoLock(this);
+
+  DbgLog((LOG_TRACE, 10, L"CLockFreePacketQueue::Clear() - clearing queue with %d entries", Size()));
+
+  while (m_count.load(std::memory_order_acquire) > 0) {
+    Packet *pPacket = Pop();
+    delete pPacket;
+  }
+
+  if (m_pevDequeue)
+    m_pevDequeue->Set();
 }
@@ -20,10 +20,18 @@
 #pragma once
 
 #include <deque>
+#include <atomic>
 
 #define MIN_PACKETS_IN_QUEUE 50           // Below this is considered "drying pin"
+#define LIVE_PACKETS_IN_QUEUE 8           // Queue limit for low-latency live streams
+#define MIN_DURATION_IN_QUEUE 10000000LL  // Below this is considered "drying pin", when queues are sized by duration
+#define MAX_PACKETS_IN_DURATION_QUEUE 20000 // Safety limit of the packets in a queue sized by duration
+#define MIN_PACKETS_PER_BATCH 8           // Queues holding at least this many packets are delivered in batches
+#define MAX_PACKETS_PER_BATCH 16          // Packets delivered with one call to the downstream pin
+#define LOW_MEMORY_QUEUE_DIVISOR 4        // Queue limits are divided by this while the system is low on memory
 
 class Packet;
+class CMemoryAccount;
 
 // FIFO Packet Queue
 class CPacketQueue : public CCritSec
@@ -50,13 +58,100 @@ public:
   std::deque<Packet *> *GetQueue() { return &m_queue; }
 
   bool IsEmpty() { CAutoLock cAutoLock(this); return m_queue.empty(); }
+
+  // Event that is signaled as long as the queue contains packets
+  HANDLE GetQueuedEvent() const { return m_evQueued; }
+
+  // Event that will be signaled whenever packets are removed from the queue
+  void SetDequeueEvent(CAMEvent *pEvent) { CAutoLock cAutoLock(this); m_pevDequeue = pEvent; }
+
 private:
   // The actual storage class
   std::deque<Packet *> m_queue;
   size_t m_dataSize = 0;
 
+  CAMEvent m_evQueued{TRUE};
+  CAMEvent *m_pevDequeue = nullptr;
+
 #ifdef DEBUG
   bool m_bWarnedFull    = false;
   bool m_bWarnedExtreme = false;
 #endif
 };
+
+// Lock-free FIFO Packet Queue for exactly one producer and one consumer thread
+//
+// The producer (Queue) never takes a lock. Size() and DataSize() are lock-free as well.
+// The consumer side (Get/Clear) is serialized by the critical section, which allows
+// Clear() to be called from any thread (ie. when flushing), and keeps CAutoLock usage
+// working as with the regular CPacketQueue.
+//
+// Packets are stored in fixed-size ring blocks, which get recycled once consumed.
+// Should a block fill up, another one is linked in, so the producer never has to wait.
+class CLockFreePacketQueue : public CCritSec
+{
+public:
+  CLockFreePacketQueue();
+  ~CLockFreePacketQueue();
+
+  // Queue a new packet at the end of the list (producer thread only)
+  void Queue(Packet *pPacket);
+
+  // Get a packet from the beginning of the list
+  Packet *Get();
+
+  // Look at the packet at the beginning of the list, without removing it
+  // The caller needs to hold the lock, and check that the queue is not empty.
+  Packet *Peek() const;
+
+  // Get the size of the queue
+  size_t Size() const { return m_count.load(std::memory_order_acquire); }
+
+  // Get the size of the queue in bytes
+  size_t DataSize() const { return m_dataSize.load(std::memory_order_relaxed); }
+
+  // Clear the List (all elements are free'ed)
+  void Clear();
+
+  bool IsEmpty() const { return Size() == 0; }
+
+  // Event that is signaled as long as the queue contains packets
+  HANDLE GetQueuedEvent() const { return m_evQueued; }
+
+  // Event that will be signaled whenever packets are removed from the queue
+  void SetDequeueEvent(CAMEvent *pEvent) { m_pevDequeue = pEvent; }
+
+  // Account the queued packets are charged to, it has to outlive the queue
+  void SetMemoryAccount(CMemoryAccount *pAccount) { m_pAccount = pAccount; }
+
+private:
+  Packet *Pop();
+
+private:
+  enum { BLOCK_SIZE = 256 };
+  struct Block {
+    Packet *packets[BLOCK_SIZE];
+    std::atomic<Block *> next;
+  };
+
+  Block *AllocBlock();
+
+  // Producer state
+  Block *m_pTail          = nullptr;
+  unsigned m_uTailPos     = 0;
+
+  // Consumer state
+  Block *m_pHead          = nullptr;
+  unsigned m_uHeadPos     = 0;
+
+  // One fully consumed block is kept for re-use by the producer
+  std::atomic<Block *> m_pSpare{nullptr};
+
+  std::atomic<size_t> m_count{0};
+  std::atomic<size_t> m_dataSize{0};
+
+  CAMEvent m_evQueued{TRUE};
+  CAMEvent *m_pevDequeue = nullptr;
+
+  CMemoryAccount *m_pAccount = nullptr;
+};
@@ -24,6 +24,10 @@
 
 #include "OutputPin.h"
 #include "H264Nalu.h"
+#include "StartCode.h"
+
+#include <emmintrin.h>
+#include <type_traits>
 
 #pragma warning( push )
 #pragma warning( disable : 4101 )
@@ -35,6 +39,11 @@ extern "C" {
 
 #define AAC_ADTS_HEADER_SIZE 7
 
+// Upper size of merged audio packets, well below the sample buffers of the pin
+#define COALESCE_MAX_BYTES 65536
+// Largest gap between two packets that are still merged, anything larger is a timestamp discontinuity
+#define COALESCE_MAX_GAP 10000
+
 //#define DEBUG_PGS_PARSER
 
 CStreamParser::CStreamParser(CLAVOutputPin *pPin, const char *szContainer)
@@ -52,6 +61,7 @@ CStreamParser::~CStreamParser()
 HRESULT CStreamParser::Parse(const GUID &gSubtype, Packet *pPacket)
 {
   if (gSubtype != m_gSubtype) {
+    QueueCoalesced();
     m_gSubtype = gSubtype;
     Flush();
   }
@@ -62,6 +72,8 @@ HRESULT CStreamParser::Parse(const GUID &gSubtype, Packet *pPacket)
     ParseH264AnnexB(pPacket);
   } else if (m_gSubtype == MEDIASUBTYPE_HDMVSUB) {
     ParsePGS(pPacket);
+  } else if (m_gSubtype == MEDIASUBTYPE_DVD_SUBPICTURE || m_gSubtype == MEDIASUBTYPE_VOBSUB) {
+    ParseDVDSub(pPacket);
   } else if (m_gSubtype == MEDIASUBTYPE_HDMV_LPCM_AUDIO) {
     pPacket->RemoveHead(4);
     Queue(pPacket);
@@ -86,191 +98,305 @@ HRESULT CStreamParser::Parse(const GUID &gSubtype, Packet *pPacket)
 HRESULT CStreamParser::Flush()
 {
   DbgLog((LOG_TRACE, 10, L"CStreamParser::Flush()"));
-  SAFE_DELETE(m_pPacketBuffer);
-  m_queue.Clear();
+  SAFE_DELETE(m_pCoalesced);
+
+  m_AnnexBBuffer.Clear();
+  for (AnnexBProps &props : m_AnnexBProps)
+    DeleteMediaType(props.pmt);
+  m_AnnexBProps.clear();
+  m_AUNals.clear();
+  DeleteMediaType(m_AUProps.pmt);
+  m_AUProps.pmt = nullptr;
+  m_bAnnexBNal = false;
+  m_nAnnexBNal = m_nAnnexBScan = m_nAUStart = 0;
+
   m_bPGSDropState = FALSE;
+  m_bPGSShowing = FALSE;
+  m_PGSEpochDefs.clear();
   m_bHasAccessUnitDelimiters = false;
 
+  m_nPlanarPCMChannels = m_nPlanarPCMSampleSize = 0;
+
   return S_OK;
 }
 
-HRESULT CStreamParser::Queue(Packet *pPacket) const
+HRESULT CStreamParser::Queue(Packet *pPacket)
 {
+  if (pPacket && m_rtCoalesceDuration > 0 && CanCoalesce(pPacket))
+    return Coalesce(pPacket);
+
+  // anything else keeps its place after the merged packets
+  QueueCoalesced();
   return m_pPin->QueueFromParser(pPacket);
 }
 
-static Packet *InitPacket(Packet *pSource)
+// Only formats the audio decoder parses into frames again can be merged, packets of
+// formats without framing (AAC without ADTS, Opus, Vorbis, ..) have to stay separate
+bool CStreamParser::CanCoalesce(Packet *pPacket) const
 {
-  Packet *pNew = nullptr;
+  if (pPacket->GetNumSideData() > 0 || pPacket->pmt)
+    return false;
+
+  return m_gSubtype == MEDIASUBTYPE_PCM
+      || m_gSubtype == MEDIASUBTYPE_PCM_TWOS
+      || m_gSubtype == MEDIASUBTYPE_PCM_SOWT
+      || m_gSubtype == MEDIASUBTYPE_HDMV_LPCM_AUDIO
+      || m_gSubtype == MEDIASUBTYPE_DOLBY_AC3
+      || m_gSubtype == MEDIASUBTYPE_DOLBY_DDPLUS
+      || m_gSubtype == MEDIASUBTYPE_DTS
+      || m_gSubtype == MEDIASUBTYPE_WAVE_DTS
+      || m_gSubtype == MEDIASUBTYPE_MPEG1AudioPayload
+      || m_gSubtype == MEDIASUBTYPE_MPEG2_AUDIO
+      || m_gSubtype == MEDIASUBTYPE_MP3;
+}
 
-  pNew = new Packet();
-  pNew->StreamId = pSource->StreamId;
-  pNew->bDiscontinuity = pSource->bDiscontinuity;
-  pSource->bDiscontinuity = FALSE;
+// Merged packets keep the start time of the first and the stop time of the last packet, so packets are
+// only merged while they are contiguous: a discontinuity, or a gap in the timestamps, starts a new packet.
+HRESULT CStreamParser::Coalesce(Packet *pPacket)
+{
+  if (m_pCoalesced) {
+    const bool bContiguous = !pPacket->bDiscontinuity
+      && pPacket->StreamId == m_pCoalesced->StreamId
+      && pPacket->dwFlags == m_pCoalesced->dwFlags
+      && m_pCoalesced->rtStop != Packet::INVALID_TIME && pPacket->rtStart != Packet::INVALID_TIME
+      && _abs64(pPacket->rtStart - m_pCoalesced->rtStop) <= COALESCE_MAX_GAP;
+    const bool bFits = (m_pCoalesced->GetDataSize() + pPacket->GetDataSize() <= COALESCE_MAX_BYTES)
+      && (pPacket->rtStart - m_pCoalesced->rtStart < m_rtCoalesceDuration);
+
+    if (bContiguous && bFits) {
+      // the packets of the demuxer can reference shared buffers, so the first packet is copied into one
+      // with room for the whole budget, and the following packets are appended without re-allocation
+      if (!m_bCoalescedCopy) {
+        Packet *pCopy = new Packet();
+        pCopy->CopyProperties(m_pCoalesced);
+        if (pCopy->SetDataSize(COALESCE_MAX_BYTES) < 0) {
+          delete pCopy;
+          QueueCoalesced();
+          return m_pPin->QueueFromParser(pPacket);
+        }
+        memcpy(pCopy->GetData(), m_pCoalesced->GetData(), m_pCoalesced->GetDataSize());
+        pCopy->SetDataSize(m_pCoalesced->GetDataSize());
+        delete m_pCoalesced;
+        m_pCoalesced = pCopy;
+        m_bCoalescedCopy = TRUE;
+      }
 
-  pNew->bSyncPoint = pSource->bSyncPoint;
-  pSource->bSyncPoint = FALSE;
+      m_pCoalesced->Append(pPacket);
+      m_pCoalesced->rtStop = pPacket->rtStop;
+      delete pPacket;
 
-  pNew->rtStart = pSource->rtStart;
-  pSource->rtStart = Packet::INVALID_TIME;
+      if (m_pCoalesced->rtStop == Packet::INVALID_TIME || m_pCoalesced->rtStop - m_pCoalesced->rtStart >= m_rtCoalesceDuration)
+        QueueCoalesced();
+      return S_OK;
+    }
 
-  pNew->rtStop = pSource->rtStop;
-  pSource->rtStop = Packet::INVALID_TIME;
+    QueueCoalesced();
+  }
 
-  pNew->pmt = pSource->pmt;
-  pSource->pmt = nullptr;
+  // packets without timestamps can't be checked for gaps, and large packets gain nothing
+  if (pPacket->rtStart == Packet::INVALID_TIME || pPacket->rtStop == Packet::INVALID_TIME || pPacket->GetDataSize() >= COALESCE_MAX_BYTES / 2)
+    return m_pPin->QueueFromParser(pPacket);
 
-  return pNew;
+  m_pCoalesced = pPacket;
+  m_bCoalescedCopy = FALSE;
+  return S_OK;
 }
 
-#define MOVE_TO_H264_START_CODE(b, e) while(b <= e-4 && !((*(DWORD *)b == 0x01000000) || ((*(DWORD *)b & 0x00FFFFFF) == 0x00010000))) b++; if((b <= e-4) && *(DWORD *)b == 0x01000000) b++;
-
-HRESULT CStreamParser::ParseH264AnnexB(Packet *pPacket)
+HRESULT CStreamParser::QueueCoalesced()
 {
-  if (!m_pPacketBuffer) {
-    m_pPacketBuffer = InitPacket(pPacket);
-  }
+  if (!m_pCoalesced)
+    return S_FALSE;
 
-  m_pPacketBuffer->Append(pPacket);
+  Packet *pPacket = m_pCoalesced;
+  m_pCoalesced = nullptr;
+  m_bCoalescedCopy = FALSE;
+  return m_pPin->QueueFromParser(pPacket);
+}
 
-  BYTE *start = m_pPacketBuffer->GetData();
-  BYTE *end = start + m_pPacketBuffer->GetDataSize();
+// Move to the next 00 00 01 start code, which needs to be followed by at least one byte
+// If there is none, e-3 is returned
+static inline BYTE *MoveToH264StartCode(BYTE *b, BYTE *e)
+{
+  if (b > e - 4)
+    return b;
+  b = (BYTE *)FindAnnexBStartCode(b, e - 1);
+  return (b <= e - 4) ? b : e - 3;
+}
 
-  MOVE_TO_H264_START_CODE(start, end);
+// Convert H.264 Annex B into length-prefixed NAL units, assembled into access units
+//
+// The input is collected in one buffer, which only moves its data once the room at its end runs out.
+// NAL units are only recorded by their position in the buffer until their access unit is complete, then
+// its size is known, and the whole access unit is written into its packet at once.
+HRESULT CStreamParser::ParseH264AnnexB(Packet *pPacket)
+{
+  // the properties of the packet belong to the first NAL unit starting in its data
+  AnnexBProps props = { m_AnnexBBuffer.GetCount(), pPacket->rtStart, pPacket->rtStop, pPacket->bDiscontinuity, pPacket->bSyncPoint, pPacket->pmt };
+  pPacket->pmt = nullptr;
+  m_AnnexBProps.push_back(props);
+  m_dwAnnexBStreamId = pPacket->StreamId;
 
-  while(start <= end-4) {
-    BYTE *next = start + 1;
+  HRESULT hr = m_AnnexBBuffer.Append(pPacket->GetData(), pPacket->GetDataSize());
+  SAFE_DELETE(pPacket);
+  if (FAILED(hr)) {
+    Flush();
+    return hr;
+  }
 
-    MOVE_TO_H264_START_CODE(next, end);
+  BYTE *buf = m_AnnexBBuffer.Ptr();
+  BYTE *end = buf + m_AnnexBBuffer.GetCount();
 
-    // End of buffer reached
-    if(next >= end-4) {
-      break;
-    }
-
-    size_t size = next - start;
-
-    CH264Nalu Nalu;
-    Nalu.SetBuffer(start, (int)size, 0);
-
-    Packet *p2 = nullptr;
-
-    while (Nalu.ReadNext()) {
-      Packet *p3 = new Packet();
-      p3->SetDataSize((int)Nalu.GetDataLength() + 4);
-
-      // Write size of the NALU (Big Endian)
-      AV_WB32(p3->GetData(), (uint32_t)Nalu.GetDataLength());
-      memcpy(p3->GetData() + 4, Nalu.GetDataBuffer(), Nalu.GetDataLength());
-
-      if (!p2) {
-        p2 = p3;
-      } else {
-        p2->Append(p3);
-        SAFE_DELETE(p3);
-      }
+  if (!m_bAnnexBNal) {
+    BYTE *start = MoveToH264StartCode(buf + m_nAnnexBScan, end);
+    m_nAnnexBScan = start - buf;
+    if (start <= end - 4) {
+      m_bAnnexBNal = true;
+      m_nAnnexBNal = m_nAnnexBScan;
+      m_nAnnexBScan++;
     }
+  }
 
-    if (!p2)
+  // every NAL unit is complete once the next start code is found, the search continues where it left off
+  while (m_bAnnexBNal) {
+    BYTE *next = MoveToH264StartCode(buf + m_nAnnexBScan, end);
+    if (next >= end - 4) {
+      m_nAnnexBScan = next - buf;
       break;
+    }
 
-    p2->StreamId = m_pPacketBuffer->StreamId;
-    p2->bDiscontinuity = m_pPacketBuffer->bDiscontinuity;
-    m_pPacketBuffer->bDiscontinuity = FALSE;
-
-    p2->bSyncPoint = m_pPacketBuffer->bSyncPoint;
-    m_pPacketBuffer->bSyncPoint = FALSE;
-
-    p2->rtStart = m_pPacketBuffer->rtStart;
-    m_pPacketBuffer->rtStart = Packet::INVALID_TIME;
-    p2->rtStop = m_pPacketBuffer->rtStop;
-    m_pPacketBuffer->rtStop = Packet::INVALID_TIME;
+    // empty NAL units between two start codes are skipped
+    const size_t nNextNal = next - buf;
+    if (nNextNal > m_nAnnexBNal + 3)
+      AddAnnexBNal(m_nAnnexBNal + 3, nNextNal - (m_nAnnexBNal + 3));
+    m_nAnnexBNal = nNextNal;
+    m_nAnnexBScan = nNextNal + 1;
+  }
 
-    p2->pmt = m_pPacketBuffer->pmt;
-    m_pPacketBuffer->pmt = nullptr;
+  // drop everything before the access unit in progress
+  size_t nKeep = m_nAnnexBScan;
+  if (m_bAnnexBNal)
+    nKeep = m_nAnnexBNal;
+  if (!m_AUNals.empty())
+    nKeep = m_nAUStart;
+  ConsumeAnnexB(nKeep);
 
-    m_queue.Queue(p2);
+  return S_OK;
+}
 
-    if(pPacket->rtStart != Packet::INVALID_TIME) {
-      m_pPacketBuffer->rtStart = pPacket->rtStart;
-      m_pPacketBuffer->rtStop = pPacket->rtStop;
-      pPacket->rtStart = Packet::INVALID_TIME;
-    }
-    if(pPacket->bDiscontinuity) {
-      m_pPacketBuffer->bDiscontinuity = pPacket->bDiscontinuity;
-      pPacket->bDiscontinuity = FALSE;
-    }
-    if(pPacket->bSyncPoint) {
-      m_pPacketBuffer->bSyncPoint = pPacket->bSyncPoint;
-      pPacket->bSyncPoint = FALSE;
+void CStreamParser::AddAnnexBNal(size_t pos, size_t size)
+{
+  const BYTE *buf = m_AnnexBBuffer.Ptr();
+
+  // collect the properties of all packets starting up to the NAL unit, the last timestamp wins
+  AnnexBProps props = { pos, Packet::INVALID_TIME, Packet::INVALID_TIME, FALSE, FALSE, nullptr };
+  while (!m_AnnexBProps.empty() && m_AnnexBProps.front().pos <= pos) {
+    AnnexBProps &p = m_AnnexBProps.front();
+    if (p.rtStart != Packet::INVALID_TIME) {
+      props.rtStart = p.rtStart;
+      props.rtStop = p.rtStop;
     }
-    if(m_pPacketBuffer->pmt) {
-      DeleteMediaType(m_pPacketBuffer->pmt);
+    props.bDiscontinuity |= p.bDiscontinuity;
+    props.bSyncPoint |= p.bSyncPoint;
+    if (p.pmt) {
+      DeleteMediaType(props.pmt);
+      props.pmt = p.pmt;
     }
+    m_AnnexBProps.pop_front();
+  }
 
-    m_pPacketBuffer->pmt = pPacket->pmt;
-    pPacket->pmt = nullptr;
+  const BYTE type = buf[pos] & 0x1f;
+  if (type == NALU_TYPE_AUD)
+    m_bHasAccessUnitDelimiters = true;
 
-    start = next;
+  // a new access unit starts at the delimiter, or at the next timestamp if the stream has no delimiters
+  if (!m_AUNals.empty() && (type == NALU_TYPE_AUD || (!m_bHasAccessUnitDelimiters && props.rtStart != Packet::INVALID_TIME))) {
+    // a timestamp which arrived after the start of the access unit belongs to the next one
+    if (props.rtStart == Packet::INVALID_TIME) {
+      props.rtStart = m_rtAUNextStart;
+      props.rtStop = m_rtAUNextStop;
+    }
+    QueueAccessUnit();
   }
 
-  if(start > m_pPacketBuffer->GetData()) {
-    m_pPacketBuffer->RemoveHead((int)(start - m_pPacketBuffer->GetData()));
+  if (m_AUNals.empty()) {
+    m_AUProps = props;
+    m_nAUStart = pos - 3;
+    m_rtAUNextStart = m_rtAUNextStop = Packet::INVALID_TIME;
+  } else {
+    if (m_rtAUNextStart == Packet::INVALID_TIME) {
+      m_rtAUNextStart = props.rtStart;
+      m_rtAUNextStop = props.rtStop;
+    }
+    m_AUProps.bDiscontinuity |= props.bDiscontinuity;
+    m_AUProps.bSyncPoint |= props.bSyncPoint;
+    if (!m_AUProps.pmt)
+      m_AUProps.pmt = props.pmt;
+    else
+      DeleteMediaType(props.pmt);
   }
 
-  SAFE_DELETE(pPacket);
-
-  do {
-    pPacket = nullptr;
-
-    REFERENCE_TIME rtStart = Packet::INVALID_TIME, rtStop = rtStart = Packet::INVALID_TIME;
-
-    std::deque<Packet *>::iterator it;
-    for (it = m_queue.GetQueue()->begin(); it != m_queue.GetQueue()->end(); ++it) {
-      // Skip the first
-      if (it == m_queue.GetQueue()->begin()) {
-        continue;
-      }
-
-      Packet *p = *it;
-      BYTE* pData = p->GetData();
-
-      if((pData[4]&0x1f) == 0x09) {
-        m_bHasAccessUnitDelimiters = true;
-      }
-
-      if ((pData[4]&0x1f) == 0x09 || (!m_bHasAccessUnitDelimiters && p->rtStart != Packet::INVALID_TIME)) {
-        pPacket = p;
-        if (p->rtStart == Packet::INVALID_TIME && rtStart != Packet::INVALID_TIME) {
-          p->rtStart = rtStart;
-          p->rtStop = rtStop;
-        }
-        break;
-      }
+  AnnexBNal nal = { pos, size };
+  m_AUNals.push_back(nal);
+}
 
-      if (rtStart == Packet::INVALID_TIME) {
-        rtStart = p->rtStart;
-        rtStop = p->rtStop;
-      }
-    }
+HRESULT CStreamParser::QueueAccessUnit()
+{
+  const BYTE *buf = m_AnnexBBuffer.Ptr();
+
+  size_t size = 0;
+  for (const AnnexBNal &nal : m_AUNals)
+    size += nal.size + 4;
+
+  Packet *p = new Packet();
+  p->StreamId       = m_dwAnnexBStreamId;
+  p->rtStart        = m_AUProps.rtStart;
+  p->rtStop         = m_AUProps.rtStop;
+  p->bDiscontinuity = m_AUProps.bDiscontinuity;
+  p->bSyncPoint     = m_AUProps.bSyncPoint;
+  p->pmt            = m_AUProps.pmt;
+  m_AUProps.pmt = nullptr;
+
+  if (p->SetDataSize((int)size) < 0) {
+    SAFE_DELETE(p);
+    m_AUNals.clear();
+    return E_OUTOFMEMORY;
+  }
 
-    if (pPacket) {
-      Packet *p = m_queue.Get();
-      Packet *p2 = nullptr;
-      while ((p2 = m_queue.Get()) != pPacket) {
-        p->Append(p2);
-        SAFE_DELETE(p2);
-      }
-      // Return
-      m_queue.GetQueue()->push_front(pPacket);
+  // Write the size of every NALU (Big Endian), followed by its data
+  BYTE *out = p->GetData();
+  for (const AnnexBNal &nal : m_AUNals) {
+    AV_WB32(out, (uint32_t)nal.size);
+    memcpy(out + 4, buf + nal.pos, nal.size);
+    out += nal.size + 4;
+  }
+  m_AUNals.clear();
 
-      Queue(p);
-    }
-  } while (pPacket != nullptr);
+  return Queue(p);
+}
 
-  return S_OK;
+// Remove the data before count from the buffer, and move all positions along
+void CStreamParser::ConsumeAnnexB(size_t count)
+{
+  if (count == 0)
+    return;
+
+  m_AnnexBBuffer.Consume((DWORD)count);
+
+  m_nAnnexBScan -= count;
+  if (m_bAnnexBNal)
+    m_nAnnexBNal -= count;
+  if (!m_AUNals.empty())
+    m_nAUStart -= count;
+  for (AnnexBNal &nal : m_AUNals)
+    nal.pos -= count;
+  // packets which started in the removed data still apply to the next NAL unit
+  for (AnnexBProps &props : m_AnnexBProps)
+    props.pos = (props.pos > count) ? props.pos - count : 0;
 }
 
+// Only the display sets with forced objects are delivered, and the empty ones which clear them again
+// The definitions of the dropped display sets are kept until the end of their epoch, a later forced display set
+// of the same epoch can show objects or use palettes defined in them.
 HRESULT CStreamParser::ParsePGS(Packet *pPacket)
 {
   const uint8_t *buf = pPacket->GetData();
@@ -312,27 +438,58 @@ HRESULT CStreamParser::ParsePGS(Packet *pPacket)
       // 1 unknown byte
       // 2 bytes id
       // 1 byte composition state (0x00 = normal, 0x40 = ACQU_POINT (?), 0x80 = epoch start (new frame), 0xC0 = epoch continue)
-      // 2 unknown bytes
+      // 1 byte palette_update_flag
+      // 1 byte palette_id
       // 1 byte object number
+      const uint8_t compositionState = buf[7] & 0xC0;
       uint8_t objectNumber = buf[10];
+
+      // Composition objects, the display set is forced if any of them is
       // 2 bytes object ref id
-      if (objectNumber == 0) {
-        m_bPGSDropState = FALSE;
-      } else if (segment_length >= 0x13) {
-        // 1 byte window_id
-        // 1 byte object_cropped_flag: 0x80, forced_on_flag = 0x040, 6bit reserved
-        uint8_t forced_flag = buf[14];
-        m_bPGSDropState = !(forced_flag & 0x40);
-        // 2 bytes x
-        // 2 bytes y
-        // total length = 19 bytes
+      // 1 byte window_id
+      // 1 byte object_cropped_flag: 0x80, forced_on_flag = 0x040, 6bit reserved
+      // 2 bytes x
+      // 2 bytes y
+      // 8 bytes cropping rectangle, if cropped
+      BOOL bForced = FALSE;
+      size_t pos = 11;
+      for (uint8_t i = 0; i < objectNumber && pos + 8 <= segment_length; i++) {
+        const uint8_t flags = buf[pos + 3];
+        bForced |= !!(flags & 0x40);
+        pos += (flags & 0x80) ? 16 : 8;
       }
+
+      // The decoder drops all definitions at the start of an epoch, and so do we
+      if (compositionState != 0)
+        m_PGSEpochDefs.clear();
+
+      // An empty display set clears the screen, which only matters when a forced one is shown
+      if (objectNumber == 0)
+        m_bPGSDropState = !m_bPGSShowing;
+      else
+        m_bPGSDropState = !bForced;
+
 #ifdef DEBUG_PGS_PARSER
       DbgLog((LOG_TRACE, 50, L"::ParsePGS(): Presentation Segment! obj.num: %d; state: 0x%x; dropping: %d", objectNumber, buf[7], m_bPGSDropState));
 #endif
+
+      if (!m_bPGSDropState) {
+        m_bPGSShowing = (objectNumber > 0);
+        m_pgsBuffer.Append(segment_start, (DWORD)(segment_length + 3));
+
+        // Definitions of the epoch the display set may use, its own segments follow and replace them
+        for (auto &def : m_PGSEpochDefs)
+          m_pgsBuffer.Append(def.second.data(), (DWORD)def.second.size());
+        m_PGSEpochDefs.clear();
+
+        buf += segment_length;
+        continue;
+      }
     }
     if (!m_bPGSDropState) {
       m_pgsBuffer.Append(segment_start, (DWORD)(segment_length + 3));
+    } else if (segment_type == 0x14 || segment_type == 0x15 || segment_type == 0x17) {
+      StorePGSDefinition(segment_type, segment_start, segment_length + 3);
     }
 
     buf += segment_length;
@@ -349,6 +506,92 @@ done:
   return Queue(pPacket);
 }
 
+// Keep the latest definition of every palette, object and the windows of a dropped display set
+void CStreamParser::StorePGSDefinition(uint8_t segment_type, const uint8_t *segment, size_t segment_size)
+{
+  const uint8_t *data = segment + 3;
+  const size_t data_size = segment_size - 3;
+
+  DWORD key = (DWORD)segment_type << 16;
+  bool bReplace = true;
+  if (segment_type == 0x14 && data_size >= 1) {
+    // Palette: 1 byte palette_id
+    key |= data[0];
+  } else if (segment_type == 0x15 && data_size >= 4) {
+    // Object: 2 bytes object_id, 1 byte version, 1 byte sequence flag (0x80 = first, 0x40 = last)
+    // Large objects are split into several segments, the first one starts a new definition
+    key |= AV_RB16(data);
+    bReplace = !!(data[3] & 0x80);
+  }
+
+  std::vector<BYTE> &def = m_PGSEpochDefs[key];
+  if (bReplace)
+    def.clear();
+  def.insert(def.end(), segment, segment + segment_size);
+}
+
+// Find the display commands of a complete SPU
+// Returns -1 if the SPU could not be parsed, otherwise if it starts a display, and if that is forced
+static int dvdsub_get_display(const uint8_t *buf, size_t buf_size, BOOL *pbForced)
+{
+  if (buf_size < 4)
+    return -1;
+
+  const size_t spu_size = AV_RB16(buf);
+  size_t offset = AV_RB16(buf + 2);
+  if (spu_size < 4 || spu_size > buf_size)
+    return -1;
+
+  BOOL bStart = FALSE, bForced = FALSE;
+
+  // Control sequences: 2 bytes delay, 2 bytes offset of the next sequence, the commands ending with 0xff
+  for (int seq = 0; seq < 32 && offset + 4 <= spu_size; seq++) {
+    const size_t next = AV_RB16(buf + offset + 2);
+    size_t pos = offset + 4;
+    bool bEnd = false;
+    while (!bEnd && pos < spu_size) {
+      switch (buf[pos++]) {
+      case 0x00: bForced = TRUE; break;   // forced start display
+      case 0x01: bStart = TRUE; break;    // start display
+      case 0x02: break;                   // stop display
+      case 0x03:                          // colors
+      case 0x04: pos += 2; break;         // alpha
+      case 0x05: pos += 6; break;         // display area
+      case 0x06: pos += 4; break;         // pixel data offsets
+      case 0x07:                          // color and contrast changes, with their size
+        if (pos + 2 > spu_size)
+          return -1;
+        pos += AV_RB16(buf + pos);
+        break;
+      case 0xff: bEnd = true; break;
+      default:
+        return -1;
+      }
+    }
+    if (!bEnd)
+      return -1;
+    if (next <= offset)
+      break;
+    offset = next;
+  }
+
+  *pbForced = bForced;
+  return bStart || bForced;
+}
+
+// DVD subpictures are self-contained, the ones starting a display that is not forced are dropped
+// Incomplete or broken SPUs are delivered, their forced flag is not known.
+HRESULT CStreamParser::ParseDVDSub(Packet *pPacket)
+{
+  BOOL bForced = FALSE;
+  if (dvdsub_get_display(pPacket->GetData(), pPacket->GetDataSize(), &bForced) == 1 && !bForced) {
+    delete pPacket;
+    return S_OK;
+  }
+
+  return Queue(pPacket);
+}
+
 HRESULT CStreamParser::ParseMOVText(Packet *pPacket)
 {
   size_t avail = pPacket->GetDataSize();
@@ -443,37 +686,113 @@ HRESULT CStreamParser::ParseSRT(Packet *pPacket)
   return S_FALSE;
 }
 
+// Interleave nChannels planes of nSamples samples each, the sample size is known at compile time
+// so the copy of every sample is a plain move
+template <int SampleSize>
+static void interleave_pcm_c(BYTE *dst, const BYTE *src, int nChannels, size_t nSamples, size_t nStart)
+{
+  const size_t nPlaneSize = nSamples * SampleSize;
+  for (size_t i = nStart; i < nSamples; i++) {
+    const BYTE *in = src + i * SampleSize;
+    BYTE *out = dst + i * nChannels * SampleSize;
+    for (int c = 0; c < nChannels; c++) {
+      memcpy(out, in, SampleSize);
+      out += SampleSize;
+      in += nPlaneSize;
+    }
+  }
+}
+
+static __forceinline __m128i unpacklo(__m128i a, __m128i b, std::integral_constant<int, 2>) { return _mm_unpacklo_epi16(a, b); }
+static __forceinline __m128i unpackhi(__m128i a, __m128i b, std::integral_constant<int, 2>) { return _mm_unpackhi_epi16(a, b); }
+static __forceinline __m128i unpacklo(__m128i a, __m128i b, std::integral_constant<int, 4>) { return _mm_unpacklo_epi32(a, b); }
+static __forceinline __m128i unpackhi(__m128i a, __m128i b, std::integral_constant<int, 4>) { return _mm_unpackhi_epi32(a, b); }
+
+// Interleave 2, 4 or 8 planes of 16 or 32-bit samples, one register of every plane at a time
+// Every round interleaves the first half of the registers with the second half, after log2(Channels) rounds
+// the samples of all channels are in order.
+template <int SampleSize, int Channels>
+static void interleave_pcm_sse2(BYTE *dst, const BYTE *src, size_t nSamples)
+{
+  const std::integral_constant<int, SampleSize> size;
+  const size_t nPlaneSize = nSamples * SampleSize;
+  const size_t nStep = 16 / SampleSize;
+
+  size_t i = 0;
+  for (; i + nStep <= nSamples; i += nStep) {
+    __m128i v[Channels], t[Channels];
+    for (int c = 0; c < Channels; c++)
+      v[c] = _mm_loadu_si128((const __m128i *)(src + c * nPlaneSize + i * SampleSize));
+
+    for (int n = 1; n < Channels; n <<= 1) {
+      for (int c = 0; c < Channels / 2; c++) {
+        t[2 * c + 0] = unpacklo(v[c], v[c + Channels / 2], size);
+        t[2 * c + 1] = unpackhi(v[c], v[c + Channels / 2], size);
+      }
+      memcpy(v, t, sizeof(v));
+    }
+
+    BYTE *out = dst + i * Channels * SampleSize;
+    for (int c = 0; c < Channels; c++)
+      _mm_storeu_si128((__m128i *)(out + c * 16), v[c]);
+  }
+
+  interleave_pcm_c<SampleSize>(dst, src, Channels, nSamples, i);
+}
+
+template <int SampleSize>
+static void interleave_pcm(BYTE *dst, const BYTE *src, int nChannels, size_t nSamples)
+{
+  switch (nChannels) {
+  case 2: interleave_pcm_sse2<SampleSize, 2>(dst, src, nSamples); break;
+  case 4: interleave_pcm_sse2<SampleSize, 4>(dst, src, nSamples); break;
+  case 8: interleave_pcm_sse2<SampleSize, 8>(dst, src, nSamples); break;
+  default: interleave_pcm_c<SampleSize>(dst, src, nChannels, nSamples, 0); break;
+  }
+}
+
 HRESULT CStreamParser::ParsePlanarPCM(Packet *pPacket)
 {
-  CMediaType mt = m_pPin->GetActiveMediaType();
+  // the format only changes with the media type
+  if (m_nPlanarPCMChannels == 0 || pPacket->pmt) {
+    WORD nChannels = 0, nBPS = 0, nBlockAlign = 0;
+    if (pPacket->pmt) {
+      audioFormatTypeHandler(pPacket->pmt->pbFormat, &pPacket->pmt->formattype, nullptr, &nChannels, &nBPS, &nBlockAlign, nullptr);
+    } else {
+      CMediaType mt = m_pPin->GetActiveMediaType();
+      audioFormatTypeHandler(mt.Format(), mt.FormatType(), nullptr, &nChannels, &nBPS, &nBlockAlign, nullptr);
+    }
+    m_nPlanarPCMChannels = nChannels;
+    m_nPlanarPCMSampleSize = nBPS / 8;
+  }
 
-  WORD nChannels = 0, nBPS = 0, nBlockAlign = 0;
-  audioFormatTypeHandler(mt.Format(), mt.FormatType(), nullptr, &nChannels, &nBPS, &nBlockAlign, nullptr);
+  const int nChannels = m_nPlanarPCMChannels;
+  const int nSampleSize = m_nPlanarPCMSampleSize;
 
   // Mono needs no special handling
-  if (nChannels == 1)
+  if (nChannels <= 1 || nSampleSize == 0)
     return Queue(pPacket);
 
-  Packet *out = new Packet();
-  out->CopyProperties(pPacket);
-  out->SetDataSize(pPacket->GetDataSize());
+  const size_t nSamples = pPacket->GetDataSize() / (nChannels * nSampleSize);
+  const size_t nSize = nSamples * nChannels * nSampleSize;
 
-  int nBytesPerChannel = nBPS / 8;
-  int nAudioBlocks = pPacket->GetDataSize() / nChannels;
-  BYTE *out_data = out->GetData();
-  const BYTE *in_data = pPacket->GetData();
+  // interleave into the buffer of the parser, and back into the packet
+  if (pPacket->MakeWritable() < 0 || FAILED(m_PlanarPCMBuffer.SetSize((DWORD)nSize)))
+    return Queue(pPacket);
 
-  for (int i = 0; i < nAudioBlocks; i += nBytesPerChannel) {
-    // interleave the channels into audio blocks
-    for (int c = 0; c < nChannels; c++) {
-      memcpy(out_data + (c * nBytesPerChannel), in_data + (nAudioBlocks * c), nBytesPerChannel);
-    }
-    // Skip to the next output block
-    out_data += nChannels * nBytesPerChannel;
+  BYTE *dst = m_PlanarPCMBuffer.Ptr();
+  const BYTE *src = pPacket->GetData();
 
-    // skip to the next input sample
-    in_data += nBytesPerChannel;
+  switch (nSampleSize) {
+  case 1: interleave_pcm_c<1>(dst, src, nChannels, nSamples, 0); break;
+  case 2: interleave_pcm<2>(dst, src, nChannels, nSamples); break;
+  case 3: interleave_pcm_c<3>(dst, src, nChannels, nSamples, 0); break;
+  case 4: interleave_pcm<4>(dst, src, nChannels, nSamples); break;
+  case 8: interleave_pcm_c<8>(dst, src, nChannels, nSamples, 0); break;
+  default: return Queue(pPacket);
   }
 
-  return Queue(out);
+  memcpy(pPacket->GetData(), dst, nSize);
+
+  return Queue(pPacket);
 }
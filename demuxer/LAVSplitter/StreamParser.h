@@ -21,7 +21,10 @@
 
 #pragma once
 
-#include "PacketQueue.h"
+#include <deque>
+#include <map>
+#include <vector>
+#include "Packet.h"
 #include "growarray.h"
 
 class CLAVOutputPin;
@@ -35,15 +38,27 @@ public:
   HRESULT Parse(const GUID &gSubtype, Packet *pPacket);
   HRESULT Flush();
 
+  // Merge consecutive audio packets into one sample, up to the duration, 0 disables merging
+  void SetCoalescing(REFERENCE_TIME rtMaxDuration) { m_rtCoalesceDuration = rtMaxDuration; }
+
 private:
   HRESULT ParseH264AnnexB(Packet *pPacket);
+  void AddAnnexBNal(size_t pos, size_t size);
+  HRESULT QueueAccessUnit();
+  void ConsumeAnnexB(size_t count);
   HRESULT ParsePGS(Packet *pPacket);
+  void StorePGSDefinition(uint8_t segment_type, const uint8_t *segment, size_t segment_size);
+  HRESULT ParseDVDSub(Packet *pPacket);
   HRESULT ParseMOVText(Packet *pPacket);
   HRESULT ParseAAC(Packet *pPacket);
   HRESULT ParseSRT(Packet *pPacket);
   HRESULT ParsePlanarPCM(Packet *pPacket);
 
-  HRESULT Queue(Packet *pPacket) const;
+  HRESULT Queue(Packet *pPacket);
+
+  bool CanCoalesce(Packet *pPacket) const;
+  HRESULT Coalesce(Packet *pPacket);
+  HRESULT QueueCoalesced();
 
 private:
   CLAVOutputPin * const m_pPin = nullptr;
@@ -51,12 +66,46 @@ private:
 
   GUID m_gSubtype = GUID_NULL;
 
-  Packet *m_pPacketBuffer = nullptr;
-
   BOOL m_bPGSDropState = FALSE;
+  BOOL m_bPGSShowing = FALSE;             ///< The last display set delivered showed objects
   GrowableArray<BYTE> m_pgsBuffer;
+  // Palette, object and window definitions of the dropped display sets of the current epoch, by type and id
+  // They are delivered with the next forced display set of the epoch, which may refer to them.
+  std::map<DWORD, std::vector<BYTE>> m_PGSEpochDefs;
+
+  // Annex B conversion, positions are relative to the start of the buffer
+  struct AnnexBProps {
+    size_t pos;                           ///< Where the data of the packet started
+    REFERENCE_TIME rtStart, rtStop;
+    BOOL bDiscontinuity, bSyncPoint;
+    AM_MEDIA_TYPE *pmt;
+  };
+  struct AnnexBNal {
+    size_t pos;                           ///< Start of the NAL unit, after the start code
+    size_t size;
+  };
 
-  CPacketQueue m_queue;
+  ConsumableArray<BYTE> m_AnnexBBuffer;
+  std::deque<AnnexBProps> m_AnnexBProps;  ///< Properties of the packets, not assigned to a NAL unit yet
+  DWORD m_dwAnnexBStreamId = 0;
+  bool m_bAnnexBNal = false;              ///< The start code of the next NAL unit was found at m_nAnnexBNal
+  size_t m_nAnnexBNal = 0;
+  size_t m_nAnnexBScan = 0;               ///< Where the search for the next start code continues
+
+  std::vector<AnnexBNal> m_AUNals;        ///< NAL units of the access unit in progress
+  size_t m_nAUStart = 0;                  ///< Start code of its first NAL unit
+  AnnexBProps m_AUProps = { 0, Packet::INVALID_TIME, Packet::INVALID_TIME, FALSE, FALSE, nullptr };
+  REFERENCE_TIME m_rtAUNextStart = Packet::INVALID_TIME;
+  REFERENCE_TIME m_rtAUNextStop = Packet::INVALID_TIME;
 
   bool m_bHasAccessUnitDelimiters = false;
+
+  // Format of the planar PCM, read again whenever the media type changes
+  int m_nPlanarPCMChannels = 0;
+  int m_nPlanarPCMSampleSize = 0;
+  GrowableArray<BYTE> m_PlanarPCMBuffer;
+
+  REFERENCE_TIME m_rtCoalesceDuration = 0;
+  Packet *m_pCoalesced = nullptr;          ///< Packets merged so far, not queued yet
+  BOOL m_bCoalescedCopy = FALSE;           ///< m_pCoalesced is our own copy, with room for more data
 };
@@ -25,6 +25,22 @@
 DEFINE_GUID(IID_ILAVFSettings, 
 0x774a919d, 0xea95, 0x4a87, 0x8a, 0x1e, 0xf4, 0x8a, 0xbe, 0x84, 0x99, 0xc7);
 
+// {7AC3F57C-3CAA-483A-A21C-3818B774CE0D}
+DEFINE_GUID(IID_ILAVFStatistics,
+0x7ac3f57c, 0x3caa, 0x483a, 0xa2, 0x1c, 0x38, 0x18, 0xb7, 0x74, 0xce, 0xd);
+
+// {5C7E3D2A-91B4-4F6E-8A3D-2E6B0F9C4D17}
+DEFINE_GUID(IID_ILAVFSourceQueue,
+0x5c7e3d2a, 0x91b4, 0x4f6e, 0x8a, 0x3d, 0x2e, 0x6b, 0xf, 0x9c, 0x4d, 0x17);
+
+// {4B18697C-639D-44EA-8237-9C9957238D3E}
+DEFINE_GUID(IID_ILAVFPacketCapture,
+0x4b18697c, 0x639d, 0x44ea, 0x82, 0x37, 0x9c, 0x99, 0x57, 0x23, 0x8d, 0x3e);
+
+// {7C0EEBAF-6E8D-47CF-8096-D03CCF449452}
+DEFINE_GUID(IID_ILAVFPacketSource,
+0x7c0eebaf, 0x6e8d, 0x47cf, 0x80, 0x96, 0xd0, 0x3c, 0xcf, 0x44, 0x94, 0x52);
+
 typedef enum LAVSubtitleMode {
   LAVSubtitleMode_NoSubs,
   LAVSubtitleMode_ForcedOnly,
@@ -189,4 +205,263 @@ interface __declspec(uuid("774A919D-EA95-4A87-8A1E-F48ABE8499C7")) ILAVFSettings
 
   // Get the maximum queue size, in number of packets
   STDMETHOD_(DWORD, GetMaxQueueSize)() = 0;
+
+  // Set whether local files should be accessed through a memory mapping instead of regular file reads
+  STDMETHOD(SetMemoryMappedIO)(BOOL bEnabled) = 0;
+
+  // Get whether local files should be accessed through a memory mapping instead of regular file reads
+  STDMETHOD_(BOOL, GetMemoryMappedIO)() = 0;
+
+  // Set whether key-frame indexes for containers without an index (MPEG-TS, MPEG-PS, ..) should be cached on disk
+  STDMETHOD(SetKeyFrameIndexCache)(BOOL bEnabled) = 0;
+
+  // Get whether key-frame indexes for containers without an index (MPEG-TS, MPEG-PS, ..) should be cached on disk
+  STDMETHOD_(BOOL, GetKeyFrameIndexCache)() = 0;
+
+  // Set whether the probed stream layout of local files should be cached on disk, to skip probing when the same file is opened again
+  STDMETHOD(SetFastOpen)(BOOL bEnabled) = 0;
+
+  // Get whether the probed stream layout of local files should be cached on disk, to skip probing when the same file is opened again
+  STDMETHOD_(BOOL, GetFastOpen)() = 0;
+
+  // Set whether network streams are opened in low-latency live mode
+  // Live mode uses minimal stream probing, disables demuxer buffering and keeps the packet queues shallow, trading robustness for latency
+  STDMETHOD(SetLowLatencyLiveMode)(BOOL bEnabled) = 0;
+
+  // Get whether network streams are opened in low-latency live mode
+  STDMETHOD_(BOOL, GetLowLatencyLiveMode)() = 0;
+
+  // Set whether packets of real-time network streams pass through a jitter buffer
+  // The jitter buffer measures the arrival jitter of the packets, and releases them smoothly with a delay adapted to it
+  STDMETHOD(SetNetworkJitterBuffer)(BOOL bEnabled) = 0;
+
+  // Get whether packets of real-time network streams pass through a jitter buffer
+  STDMETHOD_(BOOL, GetNetworkJitterBuffer)() = 0;
+
+  // Set whether http sources are read with several parallel range requests, with prefetching and a block cache
+  // Servers which do not support range requests are read with one sequential connection
+  STDMETHOD(SetHTTPPrefetch)(BOOL bEnabled) = 0;
+
+  // Get whether http sources are read with several parallel range requests, with prefetching and a block cache
+  STDMETHOD_(BOOL, GetHTTPPrefetch)() = 0;
+
+  // Set the maximum queue duration of audio and video streams, in ms
+  // Queues limited by duration share the maximum queue memory size between all streams, 0 limits all queues by packet count
+  STDMETHOD(SetMaxQueueDuration)(DWORD dwDuration) = 0;
+
+  // Get the maximum queue duration of audio and video streams, in ms
+  STDMETHOD_(DWORD, GetMaxQueueDuration)() = 0;
+
+  // Set whether the streaming threads register with the Multimedia Class Scheduler Service (MMCSS)
+  // The demuxing thread of live sources registers as a capture thread, audio delivery as an audio thread
+  // (pro audio in low latency mode), and all other streaming threads as playback threads. Default is on
+  STDMETHOD(SetStreamingThreadPriority)(BOOL bEnabled) = 0;
+
+  // Get whether the streaming threads register with MMCSS
+  STDMETHOD_(BOOL, GetStreamingThreadPriority)() = 0;
+
+  // Set the NUMA node the threads of the splitter run on
+  // The demuxing, jitter buffer and output pin threads are kept on the processors of the node, so the packets are
+  // allocated from its memory. 0xFFFFFFFF runs the threads on any processor, 0xFFFFFFFE assigns every splitter
+  // instance the next node, round-robin. Only used on systems with more than one node. Default is 0xFFFFFFFF
+  STDMETHOD(SetNUMANode)(DWORD dwNode) = 0;
+
+  // Get the NUMA node the threads of the splitter run on
+  STDMETHOD_(DWORD, GetNUMANode)() = 0;
+
+  // Set the duration up to which consecutive small audio packets are merged into one sample, in ms
+  // Only used for formats the audio decoder splits into frames again (PCM, AC3, E-AC3, DTS and MPEG audio),
+  // and never for live streams. Packets are only merged while their timestamps are contiguous. 0 disables it, the default
+  STDMETHOD(SetAudioPacketCoalescing)(DWORD dwDuration) = 0;
+
+  // Get the duration up to which consecutive small audio packets are merged, in ms
+  STDMETHOD_(DWORD, GetAudioPacketCoalescing)() = 0;
+
+  // Set the memory limit of the block cache shared by all readers of the same file in the process, in MB
+  // Used for files which are not memory mapped, like files on network shares, the Blu-ray MVC extension stream,
+  // or the same file opened in several graphs. 0 disables the cache, the default is 128
+  STDMETHOD(SetSharedBlockCacheSize)(DWORD dwSize) = 0;
+
+  // Get the memory limit of the block cache shared by all readers of the same file in the process, in MB
+  STDMETHOD_(DWORD, GetSharedBlockCacheSize)() = 0;
+
+  // Set the size of the RAM pre-buffer for slow media like optical drives, in MB
+  // A background thread reads ahead in large chunks into a window of this size, short seeks are served from memory,
+  // and the drive can spin down while the window is full. Used for Blu-ray discs and for files read through a source filter.
+  // 0 disables the pre-buffer, the default
+  STDMETHOD(SetPreBufferSize)(DWORD dwSize) = 0;
+
+  // Get the size of the RAM pre-buffer for slow media, in MB
+  STDMETHOD_(DWORD, GetPreBufferSize)() = 0;
+
+  // Set the duration of the packets kept in memory after they were read, in ms
+  // Seeks into this recent part of the file, like skipping back a few seconds, are served from memory without reading the file again.
+  // Not used for live streams and MPEG-TS/PS files. 0 disables the lookback buffer, the default is 20000
+  STDMETHOD(SetLookbackDuration)(DWORD dwDuration) = 0;
+
+  // Get the duration of the packets kept in memory after they were read, in ms
+  STDMETHOD_(DWORD, GetLookbackDuration)() = 0;
+
+  // Enable the low footprint profile, for systems with little memory
+  // The queues are limited to 32 MB and 100 packets, the shared block cache and the pre-buffer to 16 MB each,
+  // and the lookback buffer and the HTTP prefetching are not used. Larger configured sizes are kept, but not used
+  // while the profile is enabled. Changes take effect the next time a file is opened. Default is FALSE
+  STDMETHOD(SetLowFootprint)(BOOL bEnabled) = 0;
+
+  // Get whether the low footprint profile is enabled
+  STDMETHOD_(BOOL, GetLowFootprint)() = 0;
+
+  // Get the worst-case memory use of the splitter for the open file with the current settings, in bytes
+  // Covers the queues of the active pins, the shared block cache, the pre-buffer and the lookback buffer.
+  // Returns E_UNEXPECTED if no file is open
+  STDMETHOD(GetMemoryBudget)(ULONGLONG *pBudget) = 0;
+
+  // Set how many segments of HLS and DASH streams are downloaded ahead of the demuxer, over parallel connections
+  // Fewer segments are prefetched when they would exceed 30 seconds, or the memory limit at the estimated bitrate.
+  // Not used in the low footprint profile. 0 disables the prefetching. Default is 4
+  STDMETHOD(SetSegmentPrefetch)(DWORD dwSegments) = 0;
+
+  // Get how many segments of HLS and DASH streams are downloaded ahead of the demuxer
+  STDMETHOD_(DWORD, GetSegmentPrefetch)() = 0;
+
+  // Set the size of the receive buffer of udp:// and rtp:// MPEG-TS streams, in MB
+  // The socket is read by a dedicated thread into a buffer of this size, so no packets are lost while the demuxer
+  // is busy. The socket buffer of the system is set to a quarter of it, at most 8 MB.
+  // Limited to 4 MB in the low footprint profile. 0 disables the receive thread, the default is 16
+  STDMETHOD(SetNetworkReceiveBuffer)(DWORD dwSize) = 0;
+
+  // Get the size of the receive buffer of udp:// and rtp:// MPEG-TS streams, in MB
+  STDMETHOD_(DWORD, GetNetworkReceiveBuffer)() = 0;
+
+  // Set the frame rate of image sequences, in 1/1000 frames per second
+  // A numbered image file (e.g. frame0001.dpx) is played with all the following files of the same name as one video.
+  // The next images are read ahead in parallel, unless in the low footprint profile.
+  // 0 opens image files on their own, which is the default
+  STDMETHOD(SetImageSequenceFrameRate)(DWORD dwFrameRate) = 0;
+
+  // Get the frame rate of image sequences, in 1/1000 frames per second
+  STDMETHOD_(DWORD, GetImageSequenceFrameRate)() = 0;
+};
+
+// Delivery statistics of one output pin
+// All times are in 100ns units, and accumulate from the time the pin is activated, or the last reset
+typedef struct LAVFPinStatistics {
+  ULONGLONG ullPackets;             // Number of packets delivered
+  DWORD dwPacketsPerSecond;         // Packets delivered over the last second
+  DWORD dwQueueHighWater;           // Highest number of packets in the queue
+  ULONGLONG ullQueueHighWaterBytes; // Highest amount of data in the queue, in bytes
+  REFERENCE_TIME rtQueueBlocked;    // Time the demuxer was blocked because the queue of this pin was full
+  REFERENCE_TIME rtThreadWait;      // Time the delivery thread of the pin waited for packets
+  REFERENCE_TIME rtThreadDeliver;   // Time the delivery thread of the pin spent delivering packets downstream
+  DWORD dwDryingEvents;             // Number of times the queue ran below its low limit ("drying pin")
+} LAVFPinStatistics;
+
+// Statistics of the reads from the source filter
+// Only available when LAV Splitter is used with a separate source filter
+typedef struct LAVFReadStatistics {
+  ULONGLONG ullReads;               // Number of reads
+  ULONGLONG ullBytes;               // Number of bytes read
+  REFERENCE_TIME rtTotal;           // Time spent reading, in 100ns units
+  REFERENCE_TIME rtMax;             // Longest single read, in 100ns units
+} LAVFReadStatistics;
+
+// Statistics of the demuxing thread
+// Together with the time the statistics were collected over, these give the demuxing throughput of a file
+typedef struct LAVFDemuxStatistics {
+  ULONGLONG ullPackets;             // Number of packets demuxed
+  ULONGLONG ullBytes;               // Number of bytes demuxed
+  REFERENCE_TIME rtDemux;           // Time spent reading and parsing packets from the file, in 100ns units
+  REFERENCE_TIME rtDeliver;         // Time spent queueing packets on the output pins, including waiting for space, in 100ns units
+} LAVFDemuxStatistics;
+
+// Statistics of the reception of udp:// and rtp:// streams
+typedef struct LAVFNetworkStatistics {
+  ULONGLONG ullDatagrams;           // Number of datagrams received
+  ULONGLONG ullBytes;               // Number of bytes received
+  ULONGLONG ullOverflows;           // Number of datagrams dropped because the receive buffer was full
+  ULONGLONG ullRTPLost;             // Number of RTP packets missing from the sequence
+  ULONGLONG ullContinuityErrors;    // Number of MPEG-TS continuity counter errors
+  ULONGLONG ullRingSize;            // Size of the receive buffer, in bytes
+  ULONGLONG ullRingHighWater;       // Highest fill of the receive buffer, in bytes
+} LAVFNetworkStatistics;
+
+// LAV Splitter statistics interface
+// The statistics are always collected, and can be queried at any time, from any thread.
+interface __declspec(uuid("7AC3F57C-3CAA-483A-A21C-3818B774CE0D")) ILAVFStatistics : public IUnknown
+{
+  // Get the number of output pins, the pins are indexed the same as in IBufferInfo
+  STDMETHOD_(int, GetPinStatisticsCount)() = 0;
+
+  // Get the delivery statistics of an output pin
+  STDMETHOD(GetPinStatistics)(int iPin, LAVFPinStatistics *pStats) = 0;
+
+  // Get the statistics of the reads from the source filter
+  // Returns E_NOTIMPL if the file is not read through a source filter
+  STDMETHOD(GetReadStatistics)(LAVFReadStatistics *pStats) = 0;
+
+  // Reset all statistics
+  STDMETHOD(ResetStatistics)() = 0;
+
+  // Get the statistics of the demuxing thread
+  STDMETHOD(GetDemuxStatistics)(LAVFDemuxStatistics *pStats) = 0;
+
+  // Get the statistics of the reception of udp:// and rtp:// streams
+  // Returns E_NOTIMPL if the stream is not received by the receive thread of the splitter
+  STDMETHOD(GetNetworkStatistics)(LAVFNetworkStatistics *pStats) = 0;
+};
+
+// LAV Splitter gapless playback interface
+// The next file of a playlist can be queued while the current file plays. It is opened and probed in the background,
+// and once the current file ends, playback continues with it without interruption, as long as every connected output pin
+// finds a stream of the same format in it. Otherwise the playback ends as usual, and the player has to load the file itself.
+// Only files opened through IFileSourceFilter::Load can be continued, and Blu-ray playlists are not supported.
+interface __declspec(uuid("5C7E3D2A-91B4-4F6E-8A3D-2E6B0F9C4D17")) ILAVFSourceQueue : public IUnknown
+{
+  // Queue the file to continue playback with, replacing any file queued before
+  STDMETHOD(QueueNextSource)(LPCOLESTR pszFileName) = 0;
+
+  // Remove the queued file
+  STDMETHOD(ClearNextSource)() = 0;
+
+  // Get the state of the queued file
+  // Returns S_OK if it is ready to continue with, S_FALSE while it is still being opened, VFW_E_NOT_FOUND if no file is queued,
+  // or the error that occurred on opening it.
+  STDMETHOD(GetNextSourceState)() = 0;
+
+  // Get the number of times playback continued with a queued file
+  // The player is also notified with EC_LENGTH_CHANGED, and IFileSourceFilter::GetCurFile returns the new file afterwards.
+  STDMETHOD_(DWORD, GetSourceSwitchCount)() = 0;
+};
+
+// LAV Splitter sample capture interface
+// Every active output pin records the samples it delivers into "<prefix>_<type><stream>.lavcap", with their timestamps,
+// flags, side data and media type changes. Opening such a file with LAV Splitter Source replays the samples unchanged,
+// as fast as the downstream filters accept them, which allows to benchmark decoders on identical input.
+// Captures are meant for uninterrupted playback, seeks and flushes are not recorded.
+interface __declspec(uuid("4B18697C-639D-44EA-8237-9C9957238D3E")) ILAVFPacketCapture : public IUnknown
+{
+  // Capture the samples of the next playback, starting when the filter is paused or run
+  // The prefix is a full path without extension. Only allowed while the filter is stopped, otherwise E_UNEXPECTED.
+  STDMETHOD(StartPacketCapture)(LPCWSTR pszPathPrefix) = 0;
+
+  // Don't capture the following playbacks, a running capture is completed when the filter stops
+  // Only allowed while the filter is stopped, otherwise E_UNEXPECTED.
+  STDMETHOD(StopPacketCapture)() = 0;
+};
+
+// LAV Splitter packet source interface
+// Reads the packets of the video stream selected when the file was loaded directly from the demuxer, without delivering them
+// through the output pins, eg. to decode them without a graph with the frame source of LAV Video.
+// Only available while the filter is stopped and the video pin is not connected. The packets are delivered as they are demuxed,
+// without the re-framing of the output pin, and without timestamp discontinuity correction.
+interface __declspec(uuid("7C0EEBAF-6E8D-47CF-8096-D03CCF449452")) ILAVFPacketSource : public IUnknown
+{
+  // Get the media type of the video stream, which has to be freed with DeleteMediaType
+  // Returns VFW_E_NOT_FOUND if the file has no video stream.
+  STDMETHOD(GetPacketSourceMediaType)(AM_MEDIA_TYPE **ppmt) = 0;
+
+  // Read the next packet of the video stream, as a media sample which can be passed to a decoder
+  // At most 16 samples can be held at once, further calls wait for one of them to be released.
+  // Returns S_FALSE and NULL at the end of the file.
+  STDMETHOD(ReadSourcePacket)(IMediaSample **ppSample) = 0;
 };
@@ -27,6 +27,38 @@ DEFINE_GUID(IID_ILAVVideoSettings,
 DEFINE_GUID(IID_ILAVVideoStatus,
 0x1cc2385f, 0x36fa, 0x41b1, 0x99, 0x42, 0x50, 0x24, 0xce, 0x2, 0x35, 0xdc);
 
+// {5EBE5C8E-736C-429E-88F7-9640A4BEEAD5}
+DEFINE_GUID(IID_ILAVVideoTelemetry,
+0x5ebe5c8e, 0x736c, 0x429e, 0x88, 0xf7, 0x96, 0x40, 0xa4, 0xbe, 0xea, 0xd5);
+
+// {2514A754-6CE4-4FA5-89C4-EF9955D6CFF0}
+DEFINE_GUID(IID_ILAVVideoFrameInfoCallback,
+0x2514a754, 0x6ce4, 0x4fa5, 0x89, 0xc4, 0xef, 0x99, 0x55, 0xd6, 0xcf, 0xf0);
+
+// {9DD19F7F-CA5C-485A-9972-559C6CEFF0A9}
+DEFINE_GUID(IID_ILAVVideoThumbnailCallback,
+0x9dd19f7f, 0xca5c, 0x485a, 0x99, 0x72, 0x55, 0x9c, 0x6c, 0xef, 0xf0, 0xa9);
+
+// {7807CADD-80B7-4205-AA29-AD4BA3C781AF}
+DEFINE_GUID(IID_ILAVVideoFrameSource,
+0x7807cadd, 0x80b7, 0x4205, 0xaa, 0x29, 0xad, 0x4b, 0xa3, 0xc7, 0x81, 0xaf);
+
+// {236D9A25-3278-4039-9FA0-AB7247FC5409}
+DEFINE_GUID(IID_ILAVVideoFrameSourceCallback,
+0x236d9a25, 0x3278, 0x4039, 0x9f, 0xa0, 0xab, 0x72, 0x47, 0xfc, 0x54, 0x09);
+
+// {29E837D3-43DB-4B3C-A870-56A5724E1453}
+DEFINE_GUID(IID_ILAVVideoBatchDecoder,
+0x29e837d3, 0x43db, 0x4b3c, 0xa8, 0x70, 0x56, 0xa5, 0x72, 0x4e, 0x14, 0x53);
+
+// {FE9F2C4C-2A5B-4C35-A0B3-F201D2AD457D}
+DEFINE_GUID(IID_ILAVVideoBatchCallback,
+0xfe9f2c4c, 0x2a5b, 0x4c35, 0xa0, 0xb3, 0xf2, 0x01, 0xd2, 0xad, 0x45, 0x7d);
+
+// {8ADEE820-2879-48A4-905C-D1C56EE47C5B}
+DEFINE_GUID(IID_ILAVVideoScalingCallback,
+0x8adee820, 0x2879, 0x48a4, 0x90, 0x5c, 0xd1, 0xc5, 0x6e, 0xe4, 0x7c, 0x5b);
+
 
 // Codecs supported in the LAV Video configuration
 // Codecs not listed here cannot be turned off. You can request codecs to be added to this list, if you wish.
@@ -139,6 +171,8 @@ typedef enum LAVSWDeintModes {
   SWDeintMode_YADIF,
   SWDeintMode_W3FDIF_Simple,
   SWDeintMode_W3FDIF_Complex,
+  SWDeintMode_BWDIF,
+  SWDeintMode_Auto, // BWDIF, stepping down to YADIF and line doubling when the CPU can't keep up
 } LAVSWDeintModes;
 
 // Deinterlacing processing mode
@@ -198,6 +232,63 @@ typedef enum LAVDitherMode {
   LAVDither_Random
 } LAVDitherMode;
 
+// Performance modes, trading quality for decoding speed in the software decoder
+typedef enum LAVPerformanceMode {
+  PerfMode_Off,                 // Full quality, quality messages of the renderer are passed upstream
+  PerfMode_Auto,                // Skip the loop filter and IDCT on non-reference frames, and drop them, while the renderer reports late frames
+  PerfMode_Fast,                // Decode at half resolution where supported, always skip the loop filter and IDCT on non-reference frames, and drop them while behind
+} LAVPerformanceMode;
+
+// Application of the film grain of AV1 video
+typedef enum LAVAV1FilmGrainMode {
+  AV1FilmGrain_Decoder,         // The decoder synthesizes the grain
+  AV1FilmGrain_Export,          // The grain is not applied, its parameters are attached to the output samples (IID_MediaSideDataAV1FilmGrain) for the renderer
+  AV1FilmGrain_Output,          // The grain is synthesized after decoding, on the shared worker threads, before the conversion into the output format
+} LAVAV1FilmGrainMode;
+
+// Decoding while nobody sees the video, see ILAVVideoSettings::SetHiddenOutput
+typedef enum LAVHiddenOutputMode {
+  HiddenOutput_Visible,         // The output is visible, every frame is decoded and delivered
+  HiddenOutput_ReferenceOnly,   // Only reference frames are decoded, nothing is delivered
+  HiddenOutput_KeyFramesOnly,   // Only keyframes are decoded, nothing is delivered
+} LAVHiddenOutputMode;
+
+// HDR side data, as defined in IMediaSideData.h
+struct MediaSideDataHDR;
+struct MediaSideDataHDRContentLightLevel;
+
+// Information about one decoded frame, passed to the callback in metadata-only output mode
+// The side data pointers are NULL if the frame has no such data, and only valid during the callback
+typedef struct LAVVideoFrameInfo {
+  REFERENCE_TIME rtStart;       // Start time of the frame
+  REFERENCE_TIME rtStop;        // Stop time of the frame
+  int width;                    // Width of the frame, in pixels
+  int height;                   // Height of the frame, in pixels
+  char frameType;               // Frame type (I/P/B, or ? if unknown)
+  BOOL bKeyFrame;               // Frame is a key frame (not reported by all decoders)
+  BOOL bInterlaced;             // Frame is interlaced
+  BOOL bTopFieldFirst;          // Top field is first, only meaningful for interlaced frames
+  BOOL bRepeatField;            // Frame is shown for an additional field (soft telecine)
+  UINT uExtFormat;              // Color description, a DXVA2_ExtendedFormat value
+  const struct MediaSideDataHDR *pHDR;
+  const struct MediaSideDataHDRContentLightLevel *pHDRContentLightLevel;
+} LAVVideoFrameInfo;
+
+// Callback interface for metadata-only output mode, implemented by the application
+interface __declspec(uuid("2514A754-6CE4-4FA5-89C4-EF9955D6CFF0")) ILAVVideoFrameInfoCallback : public IUnknown
+{
+  // Called for every decoded frame, on the decoding or delivery thread of LAV Video
+  STDMETHOD(FrameDecoded)(const LAVVideoFrameInfo *pInfo) = 0;
+};
+
+// Callback interface for thumbnail output mode, implemented by the application
+interface __declspec(uuid("9DD19F7F-CA5C-485A-9972-559C6CEFF0A9")) ILAVVideoThumbnailCallback : public IUnknown
+{
+  // Called for every decoded frame, scaled to the thumbnail size as top-down 32-bit RGB (BGRA)
+  // The image is only valid during the callback
+  STDMETHOD(ThumbnailDecoded)(REFERENCE_TIME rtStart, int width, int height, const BYTE *pImage, ptrdiff_t stride) = 0;
+};
+
 // LAV Video configuration interface
 interface __declspec(uuid("FA40D6E9-4D38-4761-ADD2-71A9EC5FD32F")) ILAVVideoSettings : public IUnknown
 {
@@ -291,6 +382,7 @@ interface __declspec(uuid("FA40D6E9-4D38-4761-ADD2-71A9EC5FD32F")) ILAVVideoSett
   STDMETHOD_(BOOL, GetHWAccelCodec)(LAVVideoHWCodec hwAccelCodec) = 0;
 
   // Set the deinterlacing mode used by the hardware decoder
+  // DXVA2 and D3D11 only deinterlace in copy-back mode, using the video processor of the GPU before the frames are copied back
   STDMETHOD(SetHWAccelDeintMode)(LAVHWDeintModes deintMode) = 0;
 
   // Get the deinterlacing mode used by the hardware decoder
@@ -389,8 +481,266 @@ interface __declspec(uuid("FA40D6E9-4D38-4761-ADD2-71A9EC5FD32F")) ILAVVideoSett
 
   //  Enable the creation of the Closed Caption output pin
   STDMETHOD(SetEnableCCOutputPin)(BOOL bEnabled) = 0;
+
+  // Set the number of staging textures used for D3D11 copy-back
+  // More textures allow the GPU copy of a frame to complete while previous frames are being read back,
+  // at the cost of additional latency and GPU memory.
+  // Valid range is 1 - 8, default is 3
+  STDMETHOD(SetHWAccelStagingTextures)(DWORD dwCount) = 0;
+
+  // Get the number of staging textures used for D3D11 copy-back
+  STDMETHOD_(DWORD, GetHWAccelStagingTextures)() = 0;
+
+  // Decouple decoding from delivery to the renderer
+  // When enabled, decoded frames are queued and a separate thread performs the pixel format conversion,
+  // subtitle blending and delivery, so the decoder does not wait on the renderer.
+  // Frames from hardware decoders in native mode are still delivered synchronously, DVD playback is never decoupled.
+  STDMETHOD(SetAsyncDelivery)(BOOL bEnabled) = 0;
+
+  // Get whether decoding and delivery are decoupled
+  STDMETHOD_(BOOL, GetAsyncDelivery)() = 0;
+
+  // Set the number of threads used by the software deinterlacer
+  // 0 = Auto (follows the decoder thread setting, up to 8 threads), valid range is 0 - 16
+  STDMETHOD(SetSWDeintThreads)(DWORD dwNum) = 0;
+
+  // Get the number of threads used by the software deinterlacer
+  STDMETHOD_(DWORD, GetSWDeintThreads)() = 0;
+
+  // Set the size policy of the hardware decoder surface pool (DXVA2 and D3D11)
+  // dwMin is the minimum number of surfaces allocated, 0 = Auto (based on the codec)
+  // dwMax is the upper limit of the pool, which grows by a few surfaces whenever the decoder ran out of free surfaces
+  // 0 = no growth and no limit besides what the codec needs. A limit below the codec requirements can cause decoding errors
+  // Growth is applied when the decoder is flushed or re-created, and only in copy-back mode. Native mode only uses the limits.
+  // Valid range is 0 - 127 for both values, dwMax has to be 0 or at least dwMin
+  STDMETHOD(SetHWAccelSurfacePool)(DWORD dwMin, DWORD dwMax) = 0;
+
+  // Get the size policy of the hardware decoder surface pool
+  STDMETHOD(GetHWAccelSurfacePool)(DWORD *pdwMin, DWORD *pdwMax) = 0;
+
+  // Spread the hardware decoders over all GPUs in the system (DXVA2 copy-back and D3D11 copy-back)
+  // Every new decoder uses the GPU with the fewest decoder sessions of all processes in the user session,
+  // with the lower video memory use as tie-breaker (Windows 10 and newer)
+  // Only used if the device of the hwaccel is set to automatic, and no device was set with SetGPUDeviceIndex
+  STDMETHOD(SetHWAccelDeviceLoadBalancing)(BOOL bEnabled) = 0;
+
+  // Get whether the hardware decoders are spread over all GPUs
+  STDMETHOD_(BOOL, GetHWAccelDeviceLoadBalancing)() = 0;
+
+  // Metadata-only output mode, for analysis applications that only need the frame information
+  // While a callback is set, decoded frames are not converted or delivered downstream, their information is passed to the callback instead.
+  // The output pin still needs to be connected (eg. to a Null Renderer), but never receives any samples.
+  // With bKeyFramesOnly, all other frames are skipped by the decoder (software decoding only)
+  // This is not a permanent setting and not saved. A callback of NULL returns to normal output.
+  STDMETHOD(SetMetadataOnlyOutput)(ILAVVideoFrameInfoCallback *pCallback, BOOL bKeyFramesOnly) = 0;
+
+  // Thumbnail output mode, for media library indexers
+  // While a callback is set, only key frames are decoded, without the in-loop deblocking filter. Every frame is scaled into
+  // a 32-bit RGB image of the given size and passed to the callback, instead of being delivered downstream.
+  // If either dimension is 0, it is derived from the other one using the display aspect ratio.
+  // Seeking LAV Splitter with AM_SEEKING_SeekToKeyFrame starts at the key frame preceding the target, which is then decoded first.
+  // Hardware decoders in native mode are not supported. This is not a permanent setting and not saved.
+  STDMETHOD(SetThumbnailOutput)(ILAVVideoThumbnailCallback *pCallback, int width, int height) = 0;
+
+  // Crop and downscale the decoded video before it is converted to the output format
+  // The crop rectangle is in pixels of the decoded frame, NULL keeps the whole frame. The output size is never larger than
+  // the cropped area; 0 for both dimensions keeps the cropped size, 0 for one of them keeps the aspect ratio of the cropped area.
+  // The output media type is negotiated at the resulting size. Exact 2x and 4x reductions of 8-bit planar YUV use a fast box filter.
+  // Hardware decoders in native mode are not affected. This is not a permanent setting and not saved.
+  STDMETHOD(SetOutputScaling)(const RECT *prcCrop, DWORD dwWidth, DWORD dwHeight) = 0;
+
+  // Set the performance mode, for playing many streams at once
+  // The adaptive levels follow the quality messages of the renderer. Half resolution decoding starts with the next decoder init.
+  // While the renderer is behind, decoded frames which are already late are dropped before the conversion and subtitle blending.
+  STDMETHOD(SetPerformanceMode)(LAVPerformanceMode mode) = 0;
+
+  // Get the performance mode
+  STDMETHOD_(LAVPerformanceMode, GetPerformanceMode)() = 0;
+
+  // Convert the frames of the D3D11 hardware decoder on the GPU in copy-back mode, when the renderer asked for RGB32 or YUY2
+  // The D3D11 video processor converts the frame before it is read back, so only the final format is copied and no CPU conversion is needed.
+  // RGB32 is only produced for full range output (see SetRGBOutputRange), and only BT.601 and BT.709 video is converted on the GPU.
+  // Default is off
+  STDMETHOD(SetHWAccelGPUConversion)(BOOL bEnabled) = 0;
+
+  // Get whether frames of the D3D11 hardware decoder are converted on the GPU in copy-back mode
+  STDMETHOD_(BOOL, GetHWAccelGPUConversion)() = 0;
+
+  // Set whether the streaming threads register with the Multimedia Class Scheduler Service (MMCSS)
+  // The delivery and subtitle decoding threads register as playback threads. Default is on
+  STDMETHOD(SetStreamingThreadPriority)(BOOL bEnabled) = 0;
+
+  // Get whether the streaming threads register with MMCSS
+  STDMETHOD_(BOOL, GetStreamingThreadPriority)() = 0;
+
+  // Set the NUMA node the decoder runs on
+  // The thread delivering into the decoder and the delivery thread are kept on the processors of the node, and the
+  // frame buffers are allocated from its memory. 0xFFFFFFFF runs the threads on any processor, 0xFFFFFFFE assigns
+  // every decoder instance the next node, round-robin. Only used on systems with more than one node. Default is 0xFFFFFFFF
+  STDMETHOD(SetNUMANode)(DWORD dwNode) = 0;
+
+  // Get the NUMA node the decoder runs on
+  STDMETHOD_(DWORD, GetNUMANode)() = 0;
+
+  // Enable direct rendering in the software decoder
+  // Frames which are not used as a reference are decoded straight into the output samples of the renderer, saving
+  // a copy of every such frame. Only used if the decoded format is the output format, and the output samples are
+  // large enough for the decoder to write into. Default is FALSE
+  STDMETHOD(SetDirectRendering)(BOOL bEnabled) = 0;
+
+  // Get whether direct rendering in the software decoder is enabled
+  STDMETHOD_(BOOL, GetDirectRendering)() = 0;
+
+  // Enable low-delay decoding of live streams without B-Frames, like cameras or video conferences
+  // Frames are decoded with slice threads instead of frame threads, and leave the decoder as soon as they are decoded,
+  // without a re-ordering or display delay. Only used for live streams from LAV Splitter. Default is FALSE
+  STDMETHOD(SetLowDelay)(BOOL bEnabled) = 0;
+
+  // Get whether low-delay decoding of live streams is enabled
+  STDMETHOD_(BOOL, GetLowDelay)() = 0;
+
+  // Enable the low footprint profile, for systems with little memory
+  // The software decoder uses at most 2 threads, the surface pools of the hardware decoders are not larger than
+  // the stream requires and never grow, and fewer unused frame buffers are kept for re-use. Changes to the thread
+  // and surface counts take effect the next time a decoder is opened. Default is FALSE
+  STDMETHOD(SetLowFootprint)(BOOL bEnabled) = 0;
+
+  // Get whether the low footprint profile is enabled
+  STDMETHOD_(BOOL, GetLowFootprint)() = 0;
+
+  // Get the worst-case memory use of the decoder for the current stream with the current settings, in bytes
+  // Frames are estimated with the size of the output frames, the hardware surfaces with the pool as it was created.
+  // Returns E_UNEXPECTED if the output is not connected
+  STDMETHOD(GetMemoryBudget)(ULONGLONG *pBudget) = 0;
+
+  // Deliver the output samples to the renderer through a queue on a separate thread
+  // dwDepth is the maximum number of queued samples (0 - 32), dwBatchSize the number of samples passed to the
+  // renderer at once (1 - dwDepth). The decoder can run ahead of the renderer by up to dwDepth frames, the output
+  // allocator gets as many additional buffers. 0 delivers synchronously, DVD playback is never queued.
+  // Changes take effect the next time the output is connected. Default is 0
+  STDMETHOD(SetOutputQueue)(DWORD dwDepth, DWORD dwBatchSize) = 0;
+
+  // Get the depth and the batch size of the output queue
+  STDMETHOD(GetOutputQueue)(DWORD *pdwDepth, DWORD *pdwBatchSize) = 0;
+
+  // Share the frames of the D3D11 hardware decoder with other processes, for multiviewers and recorders
+  // Every decoded frame is copied on the GPU into a ring of dwSurfaces shared textures, which the other processes open
+  // by name, without any copy through system memory. See LAVD3D11ShareHeader for the objects of the share.
+  // Valid range of dwSurfaces is 2 - 16, a NULL or empty name stops sharing. Names are at most 64 characters.
+  // Takes effect the next time the decoder is opened. This is not a permanent setting and not saved.
+  STDMETHOD(SetD3D11FrameSharing)(LPCWSTR pszName, DWORD dwSurfaces) = 0;
+
+  // Get the name of the frame share, and the number of its surfaces. Returns NULL if frames are not shared.
+  STDMETHOD_(LPCWSTR, GetD3D11FrameSharing)(DWORD *pdwSurfaces) = 0;
+
+  // Set where the film grain of AV1 video is applied (see LAVAV1FilmGrainMode), only used by the software AV1 decoder
+  // Synthesizing the grain in the output stage removes it from the decoding threads, but it is not bit-exact with the
+  // grain of the decoder: the gaussian noise table of the specification is replaced by a generated one with the same
+  // distribution. Takes effect the next time the decoder is opened. Default is AV1FilmGrain_Decoder
+  STDMETHOD(SetAV1FilmGrainMode)(LAVAV1FilmGrainMode mode) = 0;
+
+  // Get where the film grain of AV1 video is applied
+  STDMETHOD_(LAVAV1FilmGrainMode, GetAV1FilmGrainMode)() = 0;
+
+  // Tell the decoder that the video is not visible, eg. because the player is minimized or the tile of a multiview
+  // is hidden. No frames are converted or delivered to the renderer while hidden, and only the reference frames or
+  // keyframes are decoded, if the decoder supports skipping them. Reference-only decoding can resume full decoding
+  // with the next frame, after keyframe-only decoding frames are only delivered again from the next keyframe on.
+  // Takes effect immediately. This is not a permanent setting and not saved. Default is HiddenOutput_Visible
+  STDMETHOD(SetHiddenOutput)(LAVHiddenOutputMode mode) = 0;
+
+  // Get the decoding mode while the video is hidden
+  STDMETHOD_(LAVHiddenOutputMode, GetHiddenOutput)() = 0;
+
+  // Select the decoder backend automatically, by the decoding speed measured on this system
+  // Software decoding and every hardware decoder enabled for the codec and resolution (see SetHWAccelCodec and
+  // SetHWAccelResolutionFlags) are benchmarked once per codec, resolution class and bit depth. The first seconds
+  // of a stream are decoded again by every backend on a background thread, and the results are kept in the
+  // registry. The backend with the lowest time per frame is used, or the lowest delay for live streams, and the
+  // backend set with SetHWAccel until one was measured. DXVA2 Native is never replaced. Default is off
+  STDMETHOD(SetHWAccelAutoSelect)(BOOL bEnabled) = 0;
+
+  // Get if the decoder backend is selected automatically
+  STDMETHOD_(BOOL, GetHWAccelAutoSelect)() = 0;
+
+  // Keep a copy of the packets since the last keyframe while a hardware decoder is active
+  // If the hardware decoder fails during playback, eg. after a GPU driver reset, the software decoder decodes the
+  // current GOP again from its keyframe and continues after the last frame which was delivered, instead of waiting
+  // for the next keyframe. GOPs larger than 64 MB are not kept. Default is off
+  STDMETHOD(SetHWAccelStandby)(BOOL bEnabled) = 0;
+
+  // Get if the packets of the current GOP are kept for the software decoder
+  STDMETHOD_(BOOL, GetHWAccelStandby)() = 0;
+
+  // Release the decoder and unused buffers after the filter was paused or stopped for the given time, in milliseconds
+  // While stopped, the decoder is closed with all its hardware surfaces, and created again when the graph starts.
+  // While paused, only buffers which are not in use are released, since the queued frames and the reference frames
+  // of the decoder are needed to resume. DXVA2 and D3D11 native surfaces belong to the renderer, they are released
+  // with its allocator when the graph stops. 0 disables the release. Default is 0
+  STDMETHOD(SetIdleReleaseTime)(DWORD dwMilliseconds) = 0;
+
+  // Get the time after which an idle filter releases its resources, in milliseconds
+  STDMETHOD_(DWORD, GetIdleReleaseTime)() = 0;
+
+  // Rank the output formats of the same bit depth and chroma subsampling by the cost to convert into them
+  // Formats stored as decoded are offered first, then those with an optimized converter, then those that need
+  // swscale. Formats of a different bit depth or subsampling keep their quality order. When disabled, the formats
+  // are offered in the fixed order of preference for the input format. Default is TRUE
+  STDMETHOD(SetOutputFormatCostRanking)(BOOL bEnabled) = 0;
+
+  // Get if the output formats are ranked by their conversion cost
+  STDMETHOD_(BOOL, GetOutputFormatCostRanking)() = 0;
 };
 
+// Objects of a D3D11 frame share (see ILAVVideoSettings::SetD3D11FrameSharing)
+// The header is a shared memory section, the surfaces are NT handles of textures, named with the share name
+// and the generation and index of the surface. The textures are opened with ID3D11Device1::OpenSharedResourceByName,
+// on the adapter given in the header, and have a keyed mutex which is always acquired and released with key 0.
+// A consumer polls llLatestFrame for new frames, acquires the mutex of surface dwLatestSurface and checks llFrame
+// of the surface, which is only written while the mutex is held. Surfaces held by a consumer are skipped by the
+// decoder, so the mutex should only be held for a copy or a short render. Whenever dwGeneration changes, the textures
+// were created anew and have to be opened again.
+#define LAV_D3D11_SHARE_VERSION      1
+#define LAV_D3D11_SHARE_MAX_SURFACES 16
+#define LAV_D3D11_SHARE_HEADER_NAME  L"Local\\LAVVideo_Share_%s"
+#define LAV_D3D11_SHARE_TEXTURE_NAME L"Local\\LAVVideo_Share_%s_%u_%u"
+
+typedef struct LAVD3D11ShareSurface {
+  LONGLONG       llFrame;           ///< Number of the frame in the surface, starting at 1, or 0 if the surface holds no frame
+  REFERENCE_TIME rtStart;
+  REFERENCE_TIME rtStop;
+} LAVD3D11ShareSurface;
+
+typedef struct LAVD3D11ShareHeader {
+  DWORD          dwVersion;         ///< LAV_D3D11_SHARE_VERSION
+  DWORD          dwGeneration;      ///< Generation of the textures, starting at 1, or 0 before the first frame
+  DWORD          dwSurfaces;        ///< Number of surfaces in the ring
+  DWORD          dwFormat;          ///< DXGI_FORMAT of the textures, NV12 or P010
+  DWORD          dwWidth;           ///< Size of the video in the textures, which can be larger
+  DWORD          dwHeight;
+  LUID           AdapterLuid;       ///< Adapter the textures live on
+  volatile LONGLONG llLatestFrame;  ///< Number of the newest frame, or 0 if there is none yet
+  volatile DWORD dwLatestSurface;   ///< Surface holding the newest frame
+  LAVD3D11ShareSurface surfaces[LAV_D3D11_SHARE_MAX_SURFACES];
+} LAVD3D11ShareHeader;
+
+// State of the hardware decoder surface pool
+typedef struct LAVHWSurfacePoolStatus {
+  DWORD dwSurfaces;             // Number of surfaces in the pool
+  DWORD dwInUse;                // Number of surfaces currently held by the decoder or downstream
+  DWORD dwMaxInUse;             // Highest number of surfaces held at once, since the pool was created
+  DWORD dwStalls;               // Number of surface requests which found no free surface, since the decoder was opened
+  DWORD dwGrowths;              // Number of times the pool was grown, since the decoder was opened
+} LAVHWSurfacePoolStatus;
+
+// Thread configuration of the software decoder
+typedef struct LAVDecoderThreadingStatus {
+  DWORD dwThreads;              // Number of threads the decoder was opened with
+  DWORD dwFrameThreads;         // Number of frames decoded in parallel, 1 if the decoder only splits frames into slices
+  DWORD dwTileThreads;          // Number of threads decoding the tiles of one frame (AV1 only, 0 otherwise)
+  DWORD dwAvailableThreads;     // Number of threads the decoder could have used, before limiting them to the resolution of the stream
+} LAVDecoderThreadingStatus;
+
 // LAV Video status interface
 interface __declspec(uuid("1CC2385F-36FA-41B1-9942-5024CE0235DC")) ILAVVideoStatus : public IUnknown
 {
@@ -399,4 +749,183 @@ interface __declspec(uuid("1CC2385F-36FA-41B1-9942-5024CE0235DC")) ILAVVideoStat
 
   // Get the name of the currently active hwaccel device
   STDMETHOD(GetHWAccelActiveDevice)(BSTR *pstrDeviceName) = 0;
+
+  // Get the number of frames the active decoder and the software deinterlacer can hold on to
+  // This is the number of output buffers requested in addition to what the renderer asks for
+  STDMETHOD_(DWORD, GetPipelineDepth)() = 0;
+
+  // Get the state of the hardware decoder surface pool
+  // Returns S_FALSE if the active decoder does not use a surface pool
+  STDMETHOD(GetHWAccelSurfacePoolStatus)(LAVHWSurfacePoolStatus *pStatus) = 0;
+
+  // Get the number of frames the pixel format converter had to write into an intermediate buffer first, because
+  // the output buffer of the renderer was not aligned well enough, and copy into the output again
+  STDMETHOD_(ULONGLONG, GetPixelConversionBounceFrames)() = 0;
+
+  // Get the thread configuration of the active decoder
+  // Returns S_FALSE if the active decoder does not decode with threads of its own
+  STDMETHOD(GetDecoderThreadingStatus)(LAVDecoderThreadingStatus *pStatus) = 0;
+};
+
+// Processing stages timed by LAV Video
+typedef enum LAVVideoStage {
+  VideoStage_Decode,            // Decoding, without GPU copy-back and delivery of the decoded frames
+  VideoStage_GPUCopyBack,       // Copying hardware decoded frames into system memory
+  VideoStage_Filter,            // Software deinterlacing
+  VideoStage_PixelConversion,   // Conversion into the output pixel format
+  VideoStage_SubtitleBlend,     // Blending subtitles onto the frame
+  VideoStage_DeliveryBuffer,    // Waiting for an output buffer from the renderer (GetDeliveryBuffer)
+  VideoStage_Deliver,           // Delivering the frame to the renderer (Receive)
+  VideoStage_HWDeviceLock,      // Waiting for the lock of the device context shared with the renderer (D3D11 only)
+  VideoStage_CaptureLatency,    // From reading the source data in LAV Splitter until the renderer accepted the frame
+  VideoStage_FilmGrain,         // Synthesizing the AV1 film grain after decoding (AV1FilmGrain_Output)
+
+  VideoStage_NB                 // Number of entries (do not use when dynamically linking)
+} LAVVideoStage;
+
+// Timing statistics of one stage
+// All times are in 100ns units, the percentiles are calculated over the most recent samples only
+typedef struct LAVVideoStageStats {
+  DWORD dwSamples;              // Number of samples the percentiles are calculated over
+  ULONGLONG ullTotalSamples;    // Number of samples since the start, or the last reset
+  REFERENCE_TIME rtP50;
+  REFERENCE_TIME rtP95;
+  REFERENCE_TIME rtP99;
+  REFERENCE_TIME rtMax;
+} LAVVideoStageStats;
+
+// LAV Video telemetry interface
+// Timings are always collected, this interface can be queried at any time, from any thread.
+interface __declspec(uuid("5EBE5C8E-736C-429E-88F7-9640A4BEEAD5")) ILAVVideoTelemetry : public IUnknown
+{
+  // Get the timing statistics of a stage
+  // Returns S_FALSE if no samples were collected for this stage yet
+  STDMETHOD(GetStageStatistics)(LAVVideoStage stage, LAVVideoStageStats *pStats) = 0;
+
+  // Clear all collected samples
+  STDMETHOD(ResetStageStatistics)() = 0;
+};
+
+// A decoded frame of the frame source, converted into its output format
+// The planes are stored one after another, with the layout of a DirectShow sample of the format (RGB is top-down).
+typedef struct LAVVideoSourceFrame {
+  REFERENCE_TIME rtStart;       // Start time of the frame
+  REFERENCE_TIME rtStop;        // Stop time of the frame
+  int width;                    // Width of the frame, in pixels
+  int height;                   // Height of the frame, in pixels
+  int aspectX;                  // Display aspect ratio of the frame, 0 if unknown
+  int aspectY;
+  LAVOutPixFmts format;         // Pixel format of the image
+  BYTE *pImage;                 // Image data
+  DWORD dwImageSize;            // Size of the image data, in bytes
+  ptrdiff_t stride;             // Stride of the first plane, in pixels
+  int planeHeight;              // Height of the first plane, in lines
+  BOOL bKeyFrame;               // Frame is a key frame (not reported by all decoders)
+  BOOL bInterlaced;             // Frame is interlaced
+  BOOL bTopFieldFirst;          // Top field is first, only meaningful for interlaced frames
+  UINT uExtFormat;              // Color description, a DXVA2_ExtendedFormat value
+} LAVVideoSourceFrame;
+
+// Callback interface of the frame source, implemented by the application
+interface __declspec(uuid("236D9A25-3278-4039-9FA0-AB7247FC5409")) ILAVVideoFrameSourceCallback : public IUnknown
+{
+  // Called for every decoded frame, on the thread calling into the frame source
+  // The frame is only valid during the callback
+  STDMETHOD(FrameDecoded)(const LAVVideoSourceFrame *pFrame) = 0;
+};
+
+// LAV Video frame source interface
+// Decodes into memory without a DirectShow graph: the pins of the filter stay unconnected, and the filter is never run.
+// The application feeds the compressed samples (eg. from its own allocator), and pulls the decoded frames, or gets them through a callback.
+// Only the software decoders are used, the hardware acceleration settings are ignored. All calls have to come from the same thread.
+interface __declspec(uuid("7807CADD-80B7-4205-AA29-AD4BA3C781AF")) ILAVVideoFrameSource : public IUnknown
+{
+  // Create the decoder for the media type, and convert the frames into the output format
+  // Without a callback, the decoded frames are queued until they are pulled with GetSourceFrame.
+  // Fails with VFW_E_ALREADY_CONNECTED if a pin of the filter is connected.
+  STDMETHOD(OpenFrameSource)(const AM_MEDIA_TYPE *pmt, LAVOutPixFmts outputFormat, ILAVVideoFrameSourceCallback *pCallback) = 0;
+
+  // Destroy the decoder, and free all queued frames
+  STDMETHOD(CloseFrameSource)() = 0;
+
+  // Decode a sample. The frames decoded from it are available once this returns.
+  STDMETHOD(DecodeSourceSample)(IMediaSample *pSample) = 0;
+
+  // Return the frames still held by the decoder, at the end of the stream
+  STDMETHOD(DrainFrameSource)() = 0;
+
+  // Discard the frames held by the decoder and all queued frames, ie. before feeding samples after a seek
+  STDMETHOD(FlushFrameSource)() = 0;
+
+  // Get the next queued frame, which has to be released with ReleaseSourceFrame
+  // Returns S_FALSE and NULL if no frame is queued
+  STDMETHOD(GetSourceFrame)(LAVVideoSourceFrame **ppFrame) = 0;
+
+  // Release a frame returned by GetSourceFrame
+  STDMETHOD(ReleaseSourceFrame)(LAVVideoSourceFrame *pFrame) = 0;
+};
+
+// Callback interface of the batch decoder, implemented by the application
+// The callbacks of one file are never called concurrently, but those of different files are.
+interface __declspec(uuid("FE9F2C4C-2A5B-4C35-A0B3-F201D2AD457D")) ILAVVideoBatchCallback : public IUnknown
+{
+  // Called for every decoded frame of a file, on the batch thread decoding it
+  // The frame is only valid during the callback. A failure stops decoding the file.
+  STDMETHOD(BatchFrameDecoded)(DWORD dwFile, const LAVVideoSourceFrame *pFrame) = 0;
+
+  // Called once a file is finished, with the result of decoding it
+  STDMETHOD(BatchFileDone)(DWORD dwFile, HRESULT hrResult) = 0;
+};
+
+// Measurements of one step of the scaling benchmark
+typedef struct LAVVideoScalingResult {
+  DWORD dwRound;                // Round of the benchmark, counting from 0
+  DWORD dwStreams;              // Number of streams decoded at once
+  DWORD dwFailedStreams;        // Number of streams which stopped with an error
+  REFERENCE_TIME rtDuration;    // Measured time, in 100ns units
+  ULONGLONG ullFrames;          // Frames decoded by all streams
+  double dFramesPerSecond;      // Aggregate frame rate of all streams
+  double dStreamFpsMin;         // Frame rate of the slowest stream
+  double dStreamFpsMax;         // Frame rate of the fastest stream
+  double dStreamFpsVariance;    // Variance of the frame rates of the streams
+  double dCPUUsage;             // CPU time of the process, in percent of all processors
+  double dGPUDecodeUsage;       // Utilization of the video decode engines of all GPUs, in percent summed over the engines, -1 if unknown
+  ULONGLONG ullPrivateBytes;    // Private memory of the process at the end of the step
+  ULONGLONG ullWorkingSet;      // Working set of the process at the end of the step
+} LAVVideoScalingResult;
+
+// Callback interface of the scaling benchmark, implemented by the application
+interface __declspec(uuid("8ADEE820-2879-48A4-905C-D1C56EE47C5B")) ILAVVideoScalingCallback : public IUnknown
+{
+  // Called after every step, on the thread running the benchmark. A failure stops the benchmark.
+  STDMETHOD(ScalingStepDone)(const LAVVideoScalingResult *pResult) = 0;
+};
+
+// LAV Video batch decoder interface
+// Decodes the video of many files at once, without a graph. Every file is read by its own LAV Splitter Source instance through
+// ILAVFPacketSource, and decoded by its own LAV Video instance through ILAVVideoFrameSource. All of them share the worker pool,
+// and the block and probe caches of LAV Splitter. The files are started in the order they were added, and the number of files
+// decoded at once is bounded, so the decoders split the processors among them instead of each trying to use all of them.
+// The batch instances use the settings of LAV Video from the registry.
+interface __declspec(uuid("29E837D3-43DB-4B3C-A870-56A5724E1453")) ILAVVideoBatchDecoder : public IUnknown
+{
+  // Add a file to the batch, and return its index for the callbacks
+  // Files can't be added while the batch is running.
+  STDMETHOD(AddBatchFile)(LPCWSTR pszFileName, DWORD *pdwFile) = 0;
+
+  // Decode all files of the batch into the output format, and return once all of them are done
+  // dwParallel is the number of files decoded at once, 0 derives it from the number of processors.
+  // The batch is empty again afterwards. Returns S_FALSE if decoding of any file failed, or the batch was aborted.
+  STDMETHOD(RunBatch)(LAVOutPixFmts outputFormat, DWORD dwParallel, ILAVVideoBatchCallback *pCallback) = 0;
+
+  // Abort the running batch, from any thread. Files not started yet are reported as done with E_ABORT.
+  STDMETHOD(AbortBatch)() = 0;
+
+  // Benchmark how decoding scales with the number of streams decoded at once, with the files of the batch
+  // Every step decodes dwStreams streams for dwStepSeconds, each going through the files one after another, starting at a
+  // different one. The number of streams doubles from 1 up to dwMaxStreams, which is always the last step. The steps are
+  // repeated dwRounds times, or until aborted if 0, so long runs show leaks and degradation between the rounds.
+  // The frames are converted into the output format and discarded. The batch is empty again afterwards.
+  // Returns S_FALSE if the benchmark was aborted, or any stream failed. AbortBatch stops the benchmark as well.
+  STDMETHOD(RunScalingBenchmark)(LAVOutPixFmts outputFormat, DWORD dwMaxStreams, DWORD dwStepSeconds, DWORD dwRounds, ILAVVideoScalingCallback *pCallback) = 0;
 };